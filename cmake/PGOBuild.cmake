@@ -0,0 +1,80 @@
+# The profile guided optimisation cycle of the libraries (see OPENFACE_PGO in the top level CMakeLists.txt): an instrumented build, the
+# FeatureExtraction pipeline on the reference clip to collect the profiles, and a rebuild of the libraries with the profiles and with link
+# time optimisation, all in the same build directory.
+#
+# Usage: cmake -DBUILD_DIR=<build directory> [-DCLIP=<video>] [-DCONFIGURE_ARGS="<more cmake arguments>"] -P cmake/PGOBuild.cmake
+#
+# The openface_pgo_train target runs this script with PGO_TRAIN set, for the training step alone.
+
+cmake_minimum_required(VERSION 3.2)
+
+# The training step, run from the bin directory of the instrumented build
+if(PGO_TRAIN)
+    if(NOT EXISTS "${PGO_CLIP}")
+        message(FATAL_ERROR "The reference clip ${PGO_CLIP} was not found, set OPENFACE_PGO_CLIP")
+    endif()
+
+    file(MAKE_DIRECTORY "${PGO_DIR}/run")
+    execute_process(COMMAND "${PGO_TRAIN}" -f "${PGO_CLIP}" -out_dir "${PGO_DIR}/run" -q RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "The training run failed (${result})")
+    endif()
+
+    # Clang writes raw profiles that have to be merged, GCC writes the .gcda files used directly
+    file(GLOB raw_profiles "${PGO_DIR}/*.profraw")
+    if(raw_profiles)
+        if(NOT LLVM_PROFDATA)
+            message(FATAL_ERROR "llvm-profdata is needed to merge the Clang profiles")
+        endif()
+        execute_process(COMMAND "${LLVM_PROFDATA}" merge -output=${PGO_DIR}/openface.profdata ${raw_profiles} RESULT_VARIABLE result)
+        if(NOT result EQUAL 0)
+            message(FATAL_ERROR "Merging the profiles failed (${result})")
+        endif()
+    endif()
+    return()
+endif()
+
+if(NOT BUILD_DIR)
+    message(FATAL_ERROR "Set BUILD_DIR, e.g. cmake -DBUILD_DIR=build-pgo -P cmake/PGOBuild.cmake")
+endif()
+
+get_filename_component(source_dir "${CMAKE_CURRENT_LIST_DIR}/.." ABSOLUTE)
+get_filename_component(build_dir "${BUILD_DIR}" ABSOLUTE)
+set(pgo_dir "${build_dir}/pgo")
+
+set(configure_args -DCMAKE_BUILD_TYPE=Release -DOPENFACE_PGO_DIR=${pgo_dir})
+if(CLIP)
+    get_filename_component(clip "${CLIP}" ABSOLUTE)
+    list(APPEND configure_args -DOPENFACE_PGO_CLIP=${clip})
+endif()
+if(CONFIGURE_ARGS)
+    separate_arguments(extra_args UNIX_COMMAND "${CONFIGURE_ARGS}")
+    list(APPEND configure_args ${extra_args})
+endif()
+
+include(ProcessorCount)
+ProcessorCount(num_cores)
+if(num_cores GREATER 0)
+    set(ENV{CMAKE_BUILD_PARALLEL_LEVEL} ${num_cores})
+endif()
+
+macro(run_step description)
+    message(STATUS "${description}")
+    execute_process(COMMAND ${ARGN} RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${description} failed (${result})")
+    endif()
+endmacro()
+
+# Stale profiles of an earlier cycle would be mixed in with the new ones
+file(REMOVE_RECURSE "${pgo_dir}")
+
+file(MAKE_DIRECTORY "${build_dir}")
+
+run_step("Configuring the instrumented build" ${CMAKE_COMMAND} "${source_dir}" ${configure_args} -DOPENFACE_PGO=GENERATE -DOPENFACE_LTO=OFF WORKING_DIRECTORY "${build_dir}")
+run_step("Building the instrumented build" ${CMAKE_COMMAND} --build "${build_dir}" --config Release)
+run_step("Collecting the profiles" ${CMAKE_COMMAND} --build "${build_dir}" --config Release --target openface_pgo_train)
+run_step("Configuring the optimised build" ${CMAKE_COMMAND} "${source_dir}" ${configure_args} -DOPENFACE_PGO=USE -DOPENFACE_LTO=ON WORKING_DIRECTORY "${build_dir}")
+run_step("Building the optimised build" ${CMAKE_COMMAND} --build "${build_dir}" --config Release)
+
+message(STATUS "The profile guided build is in ${build_dir}, the profiles in ${pgo_dir}")
@@ -0,0 +1,220 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+// AUPrediction.cpp : Predicting the Action Units of sequences from their recorded HOG features and tracking results (the .hog and .csv outputs
+// of FeatureExtraction), without the original videos. Useful for evaluating new AU models on already processed data.
+//
+// Usage: AUPrediction -hog <file.hog> -csv <file.csv> [-hog <file.hog> -csv <file.csv> ...] [-out_dir <dir>] [-au_static]
+
+// Local includes
+#include <FaceAnalyser.h>
+#include <Concurrency.h>
+#include <ReaderCSV.h>
+#include <ReaderHOG.h>
+#include <RecorderOpenFace.h>
+#include <RecorderOpenFaceParameters.h>
+
+// System includes
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define INFO_STREAM( stream ) \
+std::cout << stream << std::endl
+
+#define WARN_STREAM( stream ) \
+std::cout << "Warning: " << stream << std::endl
+
+#define ERROR_STREAM( stream ) \
+std::cout << "Error: " << stream << std::endl
+
+using namespace std;
+
+vector<string> get_arguments(int argc, char **argv)
+{
+
+	vector<string> arguments;
+
+	// First argument is reserved for the name of the executable
+	for (int i = 0; i < argc; ++i)
+	{
+		arguments.push_back(string(argv[i]));
+	}
+	return arguments;
+}
+
+// Predicting the AUs of a single sequence, the rows of the CSV file and the frames of the HOG file are matched by their order
+bool ProcessSequence(const string& hog_file, const string& csv_file, vector<string>& arguments, FaceAnalysis::FaceAnalyser& face_analyser)
+{
+	Utilities::ReaderHOG hog_reader;
+	if (!hog_reader.Open(hog_file))
+	{
+		ERROR_STREAM("Could not read the HOG features from " << hog_file);
+		return false;
+	}
+
+	// The AU models are trained on FHOG features
+	if (hog_reader.GetNumFrames() > 0 && hog_reader.GetNumChannels() != 31)
+	{
+		ERROR_STREAM("The HOG features in " << hog_file << " have " << hog_reader.GetNumChannels() << " channels instead of the 31 of FHOG");
+		return false;
+	}
+
+	Utilities::ReaderCSV csv_reader;
+	if (!csv_reader.Open(csv_file))
+	{
+		ERROR_STREAM("Could not read the tracking results from " << csv_file);
+		return false;
+	}
+
+	// The recorded tracking results are written out again together with the new AU predictions
+	Utilities::RecorderOpenFaceParameters recording_params(true, false, true, csv_reader.HasLandmarks3D(), csv_reader.HasModelParams(), csv_reader.HasPose(),
+		true, csv_reader.HasGaze(), false, false, false);
+	Utilities::RecorderOpenFace open_face_rec(hog_file, recording_params, arguments);
+
+	if (open_face_rec.WritesTo(csv_file))
+	{
+		ERROR_STREAM("The output would overwrite the tracking results in " << csv_file << ", choose a different output directory");
+		open_face_rec.Close();
+		return false;
+	}
+
+	INFO_STREAM("Predicting the AUs of " << hog_reader.GetNumFrames() << " frames from " << hog_file);
+
+	cv::Mat_<float> hog_descriptor;
+	Utilities::RecordedObservation observation;
+	int frame = 0;
+	for (; frame < hog_reader.GetNumFrames(); ++frame)
+	{
+		bool good_frame;
+		if (!hog_reader.ReadFrame(frame, hog_descriptor, good_frame))
+		{
+			ERROR_STREAM("Could not read frame " << frame << " of " << hog_file);
+			break;
+		}
+		if (!csv_reader.ReadNextFrame(observation))
+		{
+			break;
+		}
+
+		bool success = observation.success && good_frame;
+		face_analyser.AddNextFrameHOG(hog_descriptor, hog_reader.GetNumRows(), hog_reader.GetNumCols(), observation.landmarks_2D, success, observation.time_stamp);
+
+		open_face_rec.SetObservationActionUnits(face_analyser.GetCurrentAUsReg(), face_analyser.GetCurrentAUsClass());
+		open_face_rec.SetObservationLandmarks(observation.landmarks_2D, observation.landmarks_3D, observation.params_global, observation.params_local,
+			observation.confidence, observation.success);
+		open_face_rec.SetObservationPose(observation.pose_estimate);
+		open_face_rec.SetObservationGaze(observation.gaze_direction0, observation.gaze_direction1, observation.gaze_angle, observation.eye_landmarks_2D,
+			observation.eye_landmarks_3D);
+		open_face_rec.SetObservationTimestamp(observation.time_stamp);
+		open_face_rec.SetObservationFaceID(observation.face_id);
+		open_face_rec.SetObservationFrameNumber(observation.frame_number);
+		open_face_rec.WriteObservation();
+	}
+
+	if (frame != hog_reader.GetNumFrames() || csv_reader.ReadNextFrame(observation))
+	{
+		WARN_STREAM("The number of frames in " << hog_file << " and " << csv_file << " does not match, only the first " << frame << " were processed");
+	}
+
+	open_face_rec.Close();
+
+	INFO_STREAM("Postprocessing the Action Unit predictions");
+	face_analyser.PostprocessOutputFile(open_face_rec.GetCSVFile());
+
+	face_analyser.Reset();
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+
+	vector<string> arguments = get_arguments(argc, argv);
+
+	// The number of threads used for the processing (-threads <n>, all of the cores by default)
+	Utilities::Concurrency::ParseArguments(arguments);
+
+	// The sequences to process, every -hog has to be paired with a -csv
+	vector<string> hog_files;
+	vector<string> csv_files;
+	for (size_t i = 0; i + 1 < arguments.size();)
+	{
+		if (arguments[i].compare("-hog") == 0)
+		{
+			hog_files.push_back(arguments[i + 1]);
+			arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+		}
+		else if (arguments[i].compare("-csv") == 0)
+		{
+			csv_files.push_back(arguments[i + 1]);
+			arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	if (hog_files.empty() || hog_files.size() != csv_files.size())
+	{
+		cout << "Usage: AUPrediction -hog <file.hog> -csv <file.csv> [-hog <file.hog> -csv <file.csv> ...] [-out_dir <dir>] [-au_static]" << endl;
+		return 1;
+	}
+
+	// Load the AU models
+	FaceAnalysis::FaceAnalyserParameters face_analysis_params(arguments);
+	FaceAnalysis::FaceAnalyser face_analyser(face_analysis_params);
+
+	if (face_analyser.GetAURegNames().size() == 0 && face_analyser.GetAUClassNames().size() == 0)
+	{
+		ERROR_STREAM("No Action Unit models found");
+		return 1;
+	}
+
+	// The aligned faces are not available, only the AUs are predicted
+	face_analyser.SetRequestedOutputs(FaceAnalysis::FaceAnalyser::OUTPUT_AU_INTENSITY | FaceAnalysis::FaceAnalyser::OUTPUT_AU_PRESENCE |
+		FaceAnalysis::FaceAnalyser::OUTPUT_DYNAMIC_NORMALISATION);
+
+	int failed = 0;
+	for (size_t i = 0; i < hog_files.size(); ++i)
+	{
+		if (!ProcessSequence(hog_files[i], csv_files[i], arguments, face_analyser))
+		{
+			failed++;
+		}
+	}
+
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,806 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// AccuracyBenchmark.cpp : The accuracy against throughput harness, runs a number of settings (the FaceModelParameters presets by default) over
+// datasets with ground truth and reports the accuracy, the speed of every stage, the peak memory and the startup time of each as JSON, so that the
+// accuracy cost of every speed setting can be followed between builds.
+//
+// Usage: openface_accuracy_bench [-mloc <landmark model>] [-images <dir>] [-videos <dir>] [-config <name> "<arguments>"]... [-max_images <n>]
+//                                [-max_frames <n>] [-out <json file>]
+//	-images  300-W style images, every image (searched for recursively) with a .pts file of the same name next to it is used
+//	-videos  300-VW style videos, every sub directory with a video and an annot directory of 000001.pts, 000002.pts, ... files is used, an
+//	         optional aus.csv in it (a frame,AU01,AU02,... header, one line per frame numbered from 1) holds the ground truth AU intensities
+//	-config  a named setting, the arguments are added to the command line ones (e.g. -config edge "-preset realtime_edge -quant"), can be repeated
+// The peak memory is that of the process when the setting finishes, so it includes the settings before it, run settings one at a time to compare it.
+
+// Local includes
+#include "LandmarkCoreIncludes.h"
+
+#include <FaceAnalyser.h>
+#include <SequenceCapture.h>
+
+// System includes
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+// Boost includes
+#include <filesystem.hpp>
+#include <filesystem/fstream.hpp>
+
+#define INFO_STREAM( stream ) \
+std::cout << stream << std::endl
+
+#define WARN_STREAM( stream ) \
+std::cout << "Warning: " << stream << std::endl
+
+#define ERROR_STREAM( stream ) \
+std::cout << "Error: " << stream << std::endl
+
+using namespace std;
+
+vector<string> get_arguments(int argc, char **argv)
+{
+
+	vector<string> arguments;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		arguments.push_back(string(argv[i]));
+	}
+	return arguments;
+}
+
+typedef std::chrono::steady_clock Clock;
+
+double Seconds(const Clock::time_point& start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// The peak resident memory of the process so far
+double PeakRSSMegabytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+	}
+	return -1;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+	{
+		return -1;
+	}
+#ifdef __APPLE__
+	// In bytes on macOS and in kilobytes on Linux
+	return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+	return usage.ru_maxrss / 1024.0;
+#endif
+#endif
+}
+
+//===========================================================================
+// Reading the ground truth
+
+// Reading a .pts file into the OpenFace landmark layout (all of the xs followed by all of the ys), the files are 1 based (as in Matlab)
+bool ReadPts(const string& location, cv::Mat_<float>& landmarks)
+{
+	std::ifstream stream(location);
+	if (!stream.is_open())
+	{
+		return false;
+	}
+
+	string token;
+	while (stream >> token && token != "{")
+	{
+	}
+
+	vector<float> xs, ys;
+	float x, y;
+	while (stream >> token && token != "}")
+	{
+		x = std::stof(token);
+		if (!(stream >> y))
+		{
+			return false;
+		}
+		xs.push_back(x - 1.0f);
+		ys.push_back(y - 1.0f);
+	}
+
+	if (xs.empty())
+	{
+		return false;
+	}
+
+	landmarks.create((int)xs.size() * 2, 1);
+	for (size_t i = 0; i < xs.size(); ++i)
+	{
+		landmarks((int)i) = xs[i];
+		landmarks((int)(i + xs.size())) = ys[i];
+	}
+	return true;
+}
+
+// Reading the ground truth AU intensities of a video, frame -> AU name -> intensity
+bool ReadAUs(const string& location, map<int, map<string, double> >& aus)
+{
+	std::ifstream stream(location);
+	if (!stream.is_open())
+	{
+		return false;
+	}
+
+	string line;
+	std::getline(stream, line);
+	vector<string> names;
+	std::stringstream header(line);
+	string name;
+	while (std::getline(header, name, ','))
+	{
+		size_t first = name.find_first_not_of(' ');
+		names.push_back(first == string::npos ? "" : name.substr(first));
+	}
+
+	while (std::getline(stream, line))
+	{
+		std::stringstream values(line);
+		string value;
+		int frame = -1;
+		for (size_t i = 0; i < names.size() && std::getline(values, value, ','); ++i)
+		{
+			if (i == 0)
+			{
+				frame = std::stoi(value);
+			}
+			else
+			{
+				aus[frame][names[i]] = std::stod(value);
+			}
+		}
+	}
+	return true;
+}
+
+//===========================================================================
+// The metrics
+
+// The mean point to point error normalised by the outer eye corner distance for 68 points (as in 300-W), by the size of the face otherwise
+double NormalisedMeanError(const cv::Mat_<float>& landmarks, const cv::Mat_<float>& ground_truth)
+{
+	int n = ground_truth.rows / 2;
+
+	double normalisation;
+	if (n == 68)
+	{
+		double dx = ground_truth(36) - ground_truth(45);
+		double dy = ground_truth(36 + n) - ground_truth(45 + n);
+		normalisation = std::sqrt(dx * dx + dy * dy);
+	}
+	else
+	{
+		double min_x, max_x, min_y, max_y;
+		cv::minMaxLoc(ground_truth.rowRange(0, n), &min_x, &max_x);
+		cv::minMaxLoc(ground_truth.rowRange(n, 2 * n), &min_y, &max_y);
+		normalisation = std::sqrt((max_x - min_x) * (max_y - min_y));
+	}
+
+	double error = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		double dx = landmarks(i) - ground_truth(i);
+		double dy = landmarks(i + n) - ground_truth(i + n);
+		error += std::sqrt(dx * dx + dy * dy);
+	}
+	return error / (n * std::max(normalisation, 1.0));
+}
+
+double Pearson(const vector<double>& a, const vector<double>& b)
+{
+	size_t n = a.size();
+	if (n < 2)
+	{
+		return 0;
+	}
+
+	double mean_a = 0, mean_b = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		mean_a += a[i];
+		mean_b += b[i];
+	}
+	mean_a /= n;
+	mean_b /= n;
+
+	double cov = 0, var_a = 0, var_b = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		cov += (a[i] - mean_a) * (b[i] - mean_b);
+		var_a += (a[i] - mean_a) * (a[i] - mean_a);
+		var_b += (b[i] - mean_b) * (b[i] - mean_b);
+	}
+	return var_a > 0 && var_b > 0 ? cov / std::sqrt(var_a * var_b) : 0;
+}
+
+// The accuracy summary of the errors of a dataset, failures are the ones above 0.08 (the usual 300-W threshold)
+struct ErrorSummary
+{
+	double mean;
+	double median;
+	double failure_rate;
+};
+
+ErrorSummary Summarise(vector<double> errors)
+{
+	ErrorSummary summary = { -1, -1, -1 };
+	if (errors.empty())
+	{
+		return summary;
+	}
+
+	std::sort(errors.begin(), errors.end());
+	double sum = 0;
+	int failures = 0;
+	for (size_t i = 0; i < errors.size(); ++i)
+	{
+		sum += errors[i];
+		failures += errors[i] > 0.08 ? 1 : 0;
+	}
+	summary.mean = sum / errors.size();
+	summary.median = errors[errors.size() / 2];
+	summary.failure_rate = failures / (double)errors.size();
+	return summary;
+}
+
+//===========================================================================
+// The datasets
+
+struct ImageSample
+{
+	string image;
+	cv::Mat_<float> ground_truth;
+};
+
+struct VideoSample
+{
+	string video;
+	string annotations;
+	string aus;
+};
+
+bool IsImage(const boost::filesystem::path& path)
+{
+	string extension = path.extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	return extension == ".jpg" || extension == ".jpeg" || extension == ".png" || extension == ".bmp";
+}
+
+bool IsVideo(const boost::filesystem::path& path)
+{
+	string extension = path.extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	return extension == ".avi" || extension == ".mp4" || extension == ".mov" || extension == ".mkv";
+}
+
+vector<ImageSample> FindImages(const string& directory, int max_images)
+{
+	vector<ImageSample> samples;
+	for (boost::filesystem::recursive_directory_iterator it(directory), end; it != end; ++it)
+	{
+		boost::filesystem::path pts = it->path();
+		pts.replace_extension(".pts");
+		ImageSample sample;
+		if (IsImage(it->path()) && boost::filesystem::exists(pts) && ReadPts(pts.string(), sample.ground_truth))
+		{
+			sample.image = it->path().string();
+			samples.push_back(sample);
+		}
+	}
+
+	// In a fixed order, so that -max_images picks the same images every time
+	std::sort(samples.begin(), samples.end(), [](const ImageSample& a, const ImageSample& b) { return a.image < b.image; });
+	if (max_images > 0 && (int)samples.size() > max_images)
+	{
+		samples.resize(max_images);
+	}
+	return samples;
+}
+
+vector<VideoSample> FindVideos(const string& directory)
+{
+	vector<VideoSample> samples;
+	for (boost::filesystem::directory_iterator it(directory), end; it != end; ++it)
+	{
+		boost::filesystem::path annotations = it->path() / "annot";
+		if (!boost::filesystem::is_directory(it->path()) || !boost::filesystem::is_directory(annotations))
+		{
+			continue;
+		}
+
+		for (boost::filesystem::directory_iterator file(it->path()); file != end; ++file)
+		{
+			if (IsVideo(file->path()))
+			{
+				VideoSample sample;
+				sample.video = file->path().string();
+				sample.annotations = annotations.string();
+				boost::filesystem::path aus = it->path() / "aus.csv";
+				sample.aus = boost::filesystem::exists(aus) ? aus.string() : "";
+				samples.push_back(sample);
+				break;
+			}
+		}
+	}
+
+	std::sort(samples.begin(), samples.end(), [](const VideoSample& a, const VideoSample& b) { return a.video < b.video; });
+	return samples;
+}
+
+//===========================================================================
+// The results of a setting, written as JSON
+
+struct Stage
+{
+	string name;
+	double seconds;
+	int items;
+};
+
+struct ConfigResult
+{
+	string name;
+	string arguments;
+	double startup_seconds;
+	double peak_rss_mb;
+
+	// Images
+	int num_images;
+	double detected_fraction;
+	ErrorSummary image_error;
+
+	// Videos
+	int num_frames;
+	double tracked_fraction;
+	ErrorSummary video_error;
+	vector<std::pair<string, double> > au_correlations;
+
+	vector<Stage> stages;
+};
+
+string JSONString(const string& value)
+{
+	string out = "\"";
+	for (size_t i = 0; i < value.size(); ++i)
+	{
+		if (value[i] == '"' || value[i] == '\\')
+		{
+			out += '\\';
+		}
+		out += value[i];
+	}
+	return out + "\"";
+}
+
+void WriteErrorSummary(std::ostream& out, const ErrorSummary& summary)
+{
+	out << "{\"nme_mean\": " << summary.mean << ", \"nme_median\": " << summary.median << ", \"failure_rate\": " << summary.failure_rate << "}";
+}
+
+void WriteJSON(std::ostream& out, const vector<ConfigResult>& results)
+{
+	out << std::setprecision(6) << "{\"configs\": [";
+	for (size_t c = 0; c < results.size(); ++c)
+	{
+		const ConfigResult& result = results[c];
+
+		out << (c == 0 ? "\n" : ",\n") << "  {\"name\": " << JSONString(result.name) << ", \"arguments\": " << JSONString(result.arguments)
+			<< ", \"startup_s\": " << result.startup_seconds << ", \"peak_rss_mb\": " << result.peak_rss_mb << ",\n";
+
+		out << "   \"images\": {\"count\": " << result.num_images << ", \"detected_fraction\": " << result.detected_fraction << ", \"landmarks\": ";
+		WriteErrorSummary(out, result.image_error);
+		out << "},\n";
+
+		out << "   \"videos\": {\"frames\": " << result.num_frames << ", \"tracked_fraction\": " << result.tracked_fraction << ", \"landmarks\": ";
+		WriteErrorSummary(out, result.video_error);
+		out << ", \"au_correlation\": {";
+		double mean_correlation = 0;
+		for (size_t a = 0; a < result.au_correlations.size(); ++a)
+		{
+			out << JSONString(result.au_correlations[a].first) << ": " << result.au_correlations[a].second << ", ";
+			mean_correlation += result.au_correlations[a].second;
+		}
+		out << "\"mean\": " << (result.au_correlations.empty() ? -1 : mean_correlation / result.au_correlations.size()) << "}},\n";
+
+		out << "   \"fps\": {";
+		for (size_t s = 0; s < result.stages.size(); ++s)
+		{
+			double fps = result.stages[s].seconds > 0 ? result.stages[s].items / result.stages[s].seconds : 0;
+			out << (s == 0 ? "" : ", ") << JSONString(result.stages[s].name) << ": " << fps;
+		}
+		out << "}}";
+	}
+	out << "\n]}\n";
+}
+
+//===========================================================================
+// Running a setting over the datasets
+
+vector<string> SplitArguments(const string& arguments)
+{
+	vector<string> out;
+	std::stringstream stream(arguments);
+	string argument;
+	while (stream >> argument)
+	{
+		out.push_back(argument);
+	}
+	return out;
+}
+
+bool RunConfig(ConfigResult& result, vector<string> arguments, const vector<ImageSample>& images, const vector<VideoSample>& videos, int max_frames)
+{
+	vector<string> config_arguments = SplitArguments(result.arguments);
+	arguments.insert(arguments.end(), config_arguments.begin(), config_arguments.end());
+
+	// The startup is the loading of the models
+	Clock::time_point start = Clock::now();
+
+	LandmarkDetector::FaceModelParameters det_parameters(arguments);
+	LandmarkDetector::CLNF face_model(det_parameters.model_location);
+	if (!face_model.loaded_successfully)
+	{
+		ERROR_STREAM("Could not load the landmark detector for " << result.name);
+		return false;
+	}
+
+	// The AU models are only needed for videos with AU ground truth
+	bool with_aus = false;
+	for (size_t v = 0; v < videos.size(); ++v)
+	{
+		with_aus = with_aus || !videos[v].aus.empty();
+	}
+
+	FaceAnalysis::FaceAnalyserParameters face_analysis_params(arguments);
+	face_analysis_params.OptimizeForVideos();
+	std::unique_ptr<FaceAnalysis::FaceAnalyser> face_analyser;
+	if (with_aus)
+	{
+		face_analyser.reset(new FaceAnalysis::FaceAnalyser(face_analysis_params));
+	}
+
+	result.startup_seconds = Seconds(start);
+
+	// Images, the face closest to the ground truth is fit
+	Stage detection = { "image_detection", 0, 0 };
+	Stage image_landmarks = { "image_landmarks", 0, 0 };
+	vector<double> image_errors;
+	int num_detected = 0;
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		cv::Mat image = cv::imread(images[i].image);
+		if (image.empty())
+		{
+			WARN_STREAM("Could not read " << images[i].image);
+			continue;
+		}
+		cv::Mat_<uchar> gray;
+		cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+
+		start = Clock::now();
+		vector<cv::Rect_<float> > detections;
+		vector<float> confidences;
+		vector<vector<cv::Point2f> > keypoints;
+		if (det_parameters.curr_face_detector == LandmarkDetector::FaceModelParameters::MTCNN_DETECTOR && !face_model.face_detector_MTCNN.empty())
+		{
+			LandmarkDetector::DetectFacesMTCNN(detections, image, face_model.face_detector_MTCNN, confidences, keypoints);
+		}
+		else
+		{
+			LandmarkDetector::DetectFacesHOG(detections, gray, face_model.face_detector_HOG, confidences);
+		}
+		detection.seconds += Seconds(start);
+		detection.items++;
+
+		int n = images[i].ground_truth.rows / 2;
+		double min_x, max_x, min_y, max_y;
+		cv::minMaxLoc(images[i].ground_truth.rowRange(0, n), &min_x, &max_x);
+		cv::minMaxLoc(images[i].ground_truth.rowRange(n, 2 * n), &min_y, &max_y);
+		cv::Point2f center((float)(min_x + max_x) / 2, (float)(min_y + max_y) / 2);
+
+		// A detection counts if its center is within the ground truth face
+		int best = -1;
+		float best_distance = 0;
+		for (size_t d = 0; d < detections.size(); ++d)
+		{
+			cv::Point2f offset = (detections[d].tl() + detections[d].br()) * 0.5f - center;
+			float distance = std::sqrt(offset.dot(offset));
+			if (distance < (max_x - min_x) / 2 && (best < 0 || distance < best_distance))
+			{
+				best = (int)d;
+				best_distance = distance;
+			}
+		}
+		if (best < 0)
+		{
+			continue;
+		}
+		num_detected++;
+
+		start = Clock::now();
+		cv::Mat gray_image = gray;
+		vector<cv::Point2f> face_keypoints = keypoints.empty() ? vector<cv::Point2f>() : keypoints[best];
+		LandmarkDetector::DetectLandmarksInImage(image, detections[best], face_keypoints, face_model, det_parameters, gray_image);
+		image_landmarks.seconds += Seconds(start);
+		image_landmarks.items++;
+
+		if (face_model.detected_landmarks.rows == images[i].ground_truth.rows)
+		{
+			image_errors.push_back(NormalisedMeanError(face_model.detected_landmarks, images[i].ground_truth));
+		}
+	}
+
+	result.num_images = (int)images.size();
+	result.detected_fraction = images.empty() ? -1 : num_detected / (double)images.size();
+	result.image_error = Summarise(image_errors);
+
+	// Videos, tracked from the first frame
+	Stage video_landmarks = { "video_landmarks", 0, 0 };
+	Stage video_aus = { "video_aus", 0, 0 };
+	vector<double> video_errors;
+	map<string, vector<double> > au_predicted, au_ground_truth;
+	int num_frames = 0;
+	int num_tracked = 0;
+	for (size_t v = 0; v < videos.size(); ++v)
+	{
+		Utilities::SequenceCapture sequence_reader;
+		if (!sequence_reader.OpenVideoFile(videos[v].video))
+		{
+			WARN_STREAM("Could not open " << videos[v].video);
+			continue;
+		}
+
+		map<int, map<string, double> > aus;
+		if (face_analyser && !videos[v].aus.empty())
+		{
+			ReadAUs(videos[v].aus, aus);
+			face_analyser->Reset();
+		}
+
+		face_model.Reset();
+		int frame_num = 0;
+		cv::Mat frame = sequence_reader.GetNextFrame();
+		while (!frame.empty() && (max_frames <= 0 || frame_num < max_frames))
+		{
+			frame_num++;
+			cv::Mat gray = sequence_reader.GetGrayFrame();
+
+			start = Clock::now();
+			bool success = LandmarkDetector::DetectLandmarksInVideo(frame, face_model, det_parameters, gray);
+			video_landmarks.seconds += Seconds(start);
+			video_landmarks.items++;
+
+			num_frames++;
+			num_tracked += success ? 1 : 0;
+
+			std::stringstream pts_name;
+			pts_name << std::setw(6) << std::setfill('0') << frame_num << ".pts";
+			cv::Mat_<float> ground_truth;
+			if (success && ReadPts((boost::filesystem::path(videos[v].annotations) / pts_name.str()).string(), ground_truth) &&
+				face_model.detected_landmarks.rows == ground_truth.rows)
+			{
+				video_errors.push_back(NormalisedMeanError(face_model.detected_landmarks, ground_truth));
+			}
+
+			if (face_analyser && !aus.empty())
+			{
+				start = Clock::now();
+				face_analyser->AddNextFrame(frame, face_model.detected_landmarks, success, sequence_reader.time_stamp, true);
+				video_aus.seconds += Seconds(start);
+				video_aus.items++;
+
+				map<int, map<string, double> >::const_iterator frame_aus = aus.find(frame_num);
+				if (success && frame_aus != aus.end())
+				{
+					vector<std::pair<string, double> > predicted = face_analyser->GetCurrentAUsReg();
+					for (size_t a = 0; a < predicted.size(); ++a)
+					{
+						// The ground truth can name the AUs with or without the _r suffix
+						string name = predicted[a].first;
+						map<string, double>::const_iterator truth = frame_aus->second.find(name);
+						if (truth == frame_aus->second.end())
+						{
+							truth = frame_aus->second.find(name + "_r");
+						}
+						if (truth != frame_aus->second.end())
+						{
+							au_predicted[name].push_back(predicted[a].second);
+							au_ground_truth[name].push_back(truth->second);
+						}
+					}
+				}
+			}
+
+			frame = sequence_reader.GetNextFrame();
+		}
+		sequence_reader.Close();
+	}
+
+	result.num_frames = num_frames;
+	result.tracked_fraction = num_frames > 0 ? num_tracked / (double)num_frames : -1;
+	result.video_error = Summarise(video_errors);
+	for (map<string, vector<double> >::const_iterator au = au_predicted.begin(); au != au_predicted.end(); ++au)
+	{
+		result.au_correlations.push_back(std::make_pair(au->first, Pearson(au->second, au_ground_truth[au->first])));
+	}
+
+	result.stages.push_back(detection);
+	result.stages.push_back(image_landmarks);
+	result.stages.push_back(video_landmarks);
+	result.stages.push_back(video_aus);
+
+	result.peak_rss_mb = PeakRSSMegabytes();
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+
+	vector<string> arguments = get_arguments(argc, argv);
+
+	string images_directory;
+	string videos_directory;
+	string output_file;
+	int max_images = -1;
+	int max_frames = -1;
+	vector<std::pair<string, string> > configs;
+
+	// The harness arguments are taken out, the rest is passed on to every setting
+	vector<string> common_arguments(1, arguments[0]);
+	for (size_t i = 1; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-images") == 0 && i + 1 < arguments.size())
+		{
+			images_directory = arguments[++i];
+		}
+		else if (arguments[i].compare("-videos") == 0 && i + 1 < arguments.size())
+		{
+			videos_directory = arguments[++i];
+		}
+		else if (arguments[i].compare("-out") == 0 && i + 1 < arguments.size())
+		{
+			output_file = arguments[++i];
+		}
+		else if (arguments[i].compare("-max_images") == 0 && i + 1 < arguments.size())
+		{
+			max_images = std::stoi(arguments[++i]);
+		}
+		else if (arguments[i].compare("-max_frames") == 0 && i + 1 < arguments.size())
+		{
+			max_frames = std::stoi(arguments[++i]);
+		}
+		else if (arguments[i].compare("-config") == 0 && i + 2 < arguments.size())
+		{
+			configs.push_back(std::make_pair(arguments[i + 1], arguments[i + 2]));
+			i += 2;
+		}
+		else
+		{
+			common_arguments.push_back(arguments[i]);
+		}
+	}
+
+	if (images_directory.empty() && videos_directory.empty())
+	{
+		ERROR_STREAM("No dataset given, use -images <dir> and/or -videos <dir>");
+		return 1;
+	}
+
+	// By default every preset is compared
+	if (configs.empty())
+	{
+		vector<string> presets = LandmarkDetector::FaceModelParameters::PresetNames();
+		for (size_t p = 0; p < presets.size(); ++p)
+		{
+			configs.push_back(std::make_pair(presets[p], "-preset " + presets[p]));
+		}
+	}
+
+	vector<ImageSample> images;
+	if (!images_directory.empty())
+	{
+		images = FindImages(images_directory, max_images);
+		INFO_STREAM("Found " << images.size() << " annotated images in " << images_directory);
+	}
+
+	vector<VideoSample> videos;
+	if (!videos_directory.empty())
+	{
+		videos = FindVideos(videos_directory);
+		INFO_STREAM("Found " << videos.size() << " annotated videos in " << videos_directory);
+	}
+
+	vector<ConfigResult> results;
+	for (size_t c = 0; c < configs.size(); ++c)
+	{
+		INFO_STREAM("Running " << configs[c].first << " (" << configs[c].second << ")");
+
+		ConfigResult result;
+		result.name = configs[c].first;
+		result.arguments = configs[c].second;
+		if (RunConfig(result, common_arguments, images, videos, max_frames))
+		{
+			results.push_back(result);
+		}
+	}
+
+	if (output_file.empty())
+	{
+		WriteJSON(cout, results);
+		return 0;
+	}
+
+	std::ofstream out(output_file);
+	if (!out.is_open())
+	{
+		ERROR_STREAM("Could not write the results to " << output_file);
+		return 1;
+	}
+	WriteJSON(out, results);
+
+	return results.size() == configs.size() ? 0 : 1;
+}
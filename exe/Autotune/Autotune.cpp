@@ -0,0 +1,367 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Autotune.cpp : The one time tuning of the kernel and parallelism choices on the deployment host, written to a tuning cache file that the
+// landmark detection and the face analysis use when given -tuning_cache <file> (see TuningCache.h). It times the direct (im2col + BLAS), FFT
+// and Winograd convolutions of every MTCNN PNet layer for the pyramid levels of the frame sizes, the grain sizes of the CLNF patch response
+// tasks on the tracking of a clip, and the batch sizes of the offline AU prediction on its frames.
+//
+// Usage: openface_autotune -f <video> [-mloc <landmark model>] [-resolutions 720p,1080p|<width>x<height>] [-tune_frames <n>] [-tune_rounds <n>]
+//                          [-au_frames <n>] [-no_analyser] [-out <tuning cache file>]
+// The MTCNN convolutions are tuned for the frame size of the video and the given resolutions. The BLAS library is chosen when building
+// (OPENFACE_BLAS), so it is reported but not tuned.
+
+// Local includes
+#include "LandmarkCoreIncludes.h"
+#include "CNN_utils.h"
+#include "CpuDispatch.h"
+#include "Gemm.h"
+
+#include <FaceAnalyser.h>
+#include <SequenceCapture.h>
+#include <TuningCache.h>
+
+// System includes
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#define INFO_STREAM( stream ) \
+std::cout << stream << std::endl
+
+#define WARN_STREAM( stream ) \
+std::cout << "Warning: " << stream << std::endl
+
+#define ERROR_STREAM( stream ) \
+std::cout << "Error: " << stream << std::endl
+
+using namespace std;
+
+vector<string> get_arguments(int argc, char **argv)
+{
+
+	vector<string> arguments;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		arguments.push_back(string(argv[i]));
+	}
+	return arguments;
+}
+
+// A comma separated list
+vector<string> SplitList(const string& list)
+{
+	vector<string> items;
+	std::stringstream stream(list);
+	string item;
+	while (std::getline(stream, item, ','))
+	{
+		if (!item.empty())
+		{
+			items.push_back(item);
+		}
+	}
+	return items;
+}
+
+bool ParseResolution(const string& name, cv::Size& resolution)
+{
+	if (name == "480p") resolution = cv::Size(640, 480);
+	else if (name == "720p") resolution = cv::Size(1280, 720);
+	else if (name == "1080p") resolution = cv::Size(1920, 1080);
+	else if (name == "1440p") resolution = cv::Size(2560, 1440);
+	else if (name == "4k" || name == "2160p") resolution = cv::Size(3840, 2160);
+	else
+	{
+		// Or given as <width>x<height>
+		int width = 0, height = 0;
+		char separator = 0;
+		std::stringstream data(name);
+		data >> width >> separator >> height;
+		if (!data || separator != 'x' || width <= 0 || height <= 0)
+		{
+			return false;
+		}
+		resolution = cv::Size(width, height);
+	}
+	return true;
+}
+
+double MillisecondsSince(const std::chrono::steady_clock::time_point& start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The candidate with the lowest time, the times are the fastest of the rounds (the first round also warms up the caches and the allocations)
+template<typename Run>
+int FastestCandidate(const string& name, const vector<int>& candidates, int rounds, Run run)
+{
+	vector<double> best_times(candidates.size(), -1);
+	for (int round = 0; round < rounds; ++round)
+	{
+		for (size_t c = 0; c < candidates.size(); ++c)
+		{
+			double time = run(candidates[c]);
+			if (best_times[c] < 0 || time < best_times[c])
+			{
+				best_times[c] = time;
+			}
+		}
+	}
+
+	size_t best = 0;
+	for (size_t c = 0; c < candidates.size(); ++c)
+	{
+		INFO_STREAM("  " << name << " " << std::setw(5) << candidates[c] << ": " << std::fixed << std::setprecision(2) << best_times[c] << " ms");
+		if (best_times[c] < best_times[best])
+		{
+			best = c;
+		}
+	}
+	return candidates[best];
+}
+
+int main(int argc, char **argv)
+{
+
+	vector<string> arguments = get_arguments(argc, argv);
+
+	int num_frames = 60;
+	int num_rounds = 2;
+	int num_au_frames = 1024;
+	bool analyse = true;
+	string output_file = "tuning_cache.txt";
+	vector<string> resolution_names;
+	bool has_video = false;
+
+	for (size_t i = 1; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-resolutions") == 0 && i + 1 < arguments.size())
+		{
+			resolution_names = SplitList(arguments[i + 1]);
+		}
+		else if (arguments[i].compare("-tune_frames") == 0 && i + 1 < arguments.size())
+		{
+			num_frames = std::max(2, std::stoi(arguments[i + 1]));
+		}
+		else if (arguments[i].compare("-tune_rounds") == 0 && i + 1 < arguments.size())
+		{
+			num_rounds = std::max(1, std::stoi(arguments[i + 1]));
+		}
+		else if (arguments[i].compare("-au_frames") == 0 && i + 1 < arguments.size())
+		{
+			num_au_frames = std::max(1, std::stoi(arguments[i + 1]));
+		}
+		else if (arguments[i].compare("-out") == 0 && i + 1 < arguments.size())
+		{
+			output_file = arguments[i + 1];
+		}
+		else if (arguments[i].compare("-no_analyser") == 0)
+		{
+			analyse = false;
+		}
+		else if (arguments[i].compare("-f") == 0)
+		{
+			has_video = true;
+		}
+	}
+
+	if (!has_video)
+	{
+		ERROR_STREAM("A video with a face (-f) is needed for the tuning");
+		return 1;
+	}
+
+	vector<cv::Size> resolutions;
+	for (size_t r = 0; r < resolution_names.size(); ++r)
+	{
+		cv::Size resolution;
+		if (!ParseResolution(resolution_names[r], resolution))
+		{
+			ERROR_STREAM("Unknown resolution " << resolution_names[r] << " (480p, 720p, 1080p, 1440p, 4k or <width>x<height>)");
+			return 1;
+		}
+		resolutions.push_back(resolution);
+	}
+
+	LandmarkDetector::FaceModelParameters det_parameters(arguments);
+
+	// Everything is timed anew, without the choices of an earlier tuning
+	Utilities::TuningCache::Global().Clear();
+	Utilities::TuningCache cache;
+
+	LandmarkDetector::CLNF face_model(det_parameters.model_location);
+	if (!face_model.loaded_successfully)
+	{
+		ERROR_STREAM("Could not load the landmark detector");
+		return 1;
+	}
+
+	face_model.face_detector_HAAR.load(det_parameters.haar_face_detector_location);
+	face_model.haar_face_detector_location = det_parameters.haar_face_detector_location;
+	face_model.face_detector_MTCNN.Read(det_parameters.mtcnn_face_detector_location);
+	face_model.mtcnn_face_detector_location = det_parameters.mtcnn_face_detector_location;
+
+	// The clip, read in fully before tuning so that the decoding is not timed
+	vector<cv::Mat> frames;
+	Utilities::SequenceCapture sequence_reader;
+	if (!sequence_reader.Open(arguments))
+	{
+		ERROR_STREAM("Could not open the tuning video");
+		return 1;
+	}
+	double fps_video = sequence_reader.fps > 0 ? sequence_reader.fps : 30;
+
+	cv::Mat frame = sequence_reader.GetNextFrame();
+	while (!frame.empty() && (int)frames.size() < num_frames)
+	{
+		frames.push_back(frame.clone());
+		frame = sequence_reader.GetNextFrame();
+	}
+	sequence_reader.Close();
+
+	if (frames.size() < 2)
+	{
+		ERROR_STREAM("The tuning video needs at least two frames");
+		return 1;
+	}
+
+	vector<cv::Mat_<uchar> > gray_frames(frames.size());
+	for (size_t i = 0; i < frames.size(); ++i)
+	{
+		cv::cvtColor(frames[i], gray_frames[i], cv::COLOR_BGR2GRAY);
+	}
+
+	INFO_STREAM("Tuning on " << Utilities::TuningCache::HostSignature() << ", BLAS: " << LandmarkDetector::GetBlasBackendName() << " (chosen when building, not tuned)"
+		<< ", kernels: " << LandmarkDetector::GetCpuLevelName(LandmarkDetector::GetCpuLevel()));
+
+	// The MTCNN PNet convolutions of every pyramid level
+	if (!face_model.face_detector_MTCNN.empty())
+	{
+		resolutions.push_back(frames[0].size());
+		for (size_t r = 0; r < resolutions.size(); ++r)
+		{
+			face_model.face_detector_MTCNN.TuneConvolutions(resolutions[r]);
+		}
+		face_model.face_detector_MTCNN.ExportTuning(cache);
+
+		vector<std::pair<string, int> > choices = cache.GetPrefixed("mtcnn/pnet/");
+		int method_counts[3] = { 0, 0, 0 };
+		for (size_t i = 0; i < choices.size(); ++i)
+		{
+			if (choices[i].second >= 0 && choices[i].second < 3)
+			{
+				method_counts[choices[i].second]++;
+			}
+		}
+		INFO_STREAM("MTCNN PNet convolutions: " << choices.size() << " layer and level choices, " << method_counts[LandmarkDetector::CONV_DIRECT] << " im2col, "
+			<< method_counts[LandmarkDetector::CONV_FFT] << " FFT, " << method_counts[LandmarkDetector::CONV_WINOGRAD] << " Winograd");
+	}
+	else
+	{
+		WARN_STREAM("The MTCNN face detector could not be loaded, its convolutions are not tuned");
+	}
+
+	// The grain size of the patch response tasks, timed on the tracking of the clip (without its first frame, which is the detection)
+	vector<cv::Mat_<float> > tracked_landmarks(frames.size());
+	vector<bool> tracked(frames.size(), false);
+	vector<int> grain_sizes = { 1, 2, 4, 8, 16 };
+	INFO_STREAM("CLNF patch response grain size:");
+	int best_grain = FastestCandidate("grain", grain_sizes, num_rounds, [&](int grain) {
+		LandmarkDetector::FaceModelParameters parameters(det_parameters);
+		parameters.response_grain_size = grain;
+		LandmarkDetector::CLNF tracking_model(face_model);
+
+		double total_ms = 0;
+		for (size_t i = 0; i < frames.size(); ++i)
+		{
+			auto start = std::chrono::steady_clock::now();
+			tracked[i] = LandmarkDetector::DetectLandmarksInVideo(frames[i], tracking_model, parameters, gray_frames[i]);
+			if (i > 0)
+			{
+				total_ms += MillisecondsSince(start);
+			}
+			tracked_landmarks[i] = tracking_model.detected_landmarks.clone();
+		}
+		return total_ms;
+	});
+	cache.Set("clnf/response_grain_size", best_grain);
+
+	// The batch size of the offline AU prediction, on the tracked frames repeated up to the number of AU frames
+	if (analyse)
+	{
+		FaceAnalysis::FaceAnalyserParameters face_analysis_params(arguments);
+		face_analysis_params.batch_offline_au = true;
+		FaceAnalysis::FaceAnalyser face_analyser(face_analysis_params);
+
+		vector<int> batch_sizes = { 64, 128, 256, 512, 1024 };
+		INFO_STREAM("Offline AU prediction batch size:");
+		int best_batch = FastestCandidate("batch", batch_sizes, num_rounds, [&](int batch_size) {
+			face_analyser.Reset();
+			face_analyser.SetAUBatchSize(batch_size);
+
+			auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i < num_au_frames; ++i)
+			{
+				size_t f = i % frames.size();
+				face_analyser.AddNextFrame(frames[f], tracked_landmarks[f], tracked[f], i / fps_video, false);
+			}
+			std::vector<std::pair<std::string, std::vector<double> > > predictions;
+			std::vector<double> confidences;
+			std::vector<bool> successes;
+			std::vector<double> timestamps;
+			face_analyser.ExtractAllPredictionsOfflineReg(predictions, confidences, successes, timestamps, face_analysis_params.getDynamic());
+			return MillisecondsSince(start);
+		});
+		cache.Set("face_analyser/au_batch_size", best_batch);
+	}
+
+	if (!cache.Save(output_file))
+	{
+		ERROR_STREAM("Could not write the tuning cache " << output_file);
+		return 1;
+	}
+	INFO_STREAM("Wrote the tuning cache " << output_file << ", use it with -tuning_cache " << output_file);
+
+	return 0;
+}
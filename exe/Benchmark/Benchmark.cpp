@@ -0,0 +1,606 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Benchmark.cpp : Micro and end-to-end benchmarks of the performance critical parts of OpenFace, to catch performance regressions between builds.
+// Every benchmark is repeated a number of times and its median time per iteration is reported (optionally also to a CSV file for comparing builds).
+//
+// Usage: openface_bench [-mloc <landmark model>] [-f <video>] [-bench_frames <n>] [-filter <part of benchmark name>] [-min_time <seconds>] [-reps <n>] [-out <csv file>]
+//                       [-preset_report <csv file>]
+// With -preset_report (and a video) the speed/accuracy profile of every FaceModelParameters preset on the clip is reported as well.
+
+// Local includes
+#include "LandmarkCoreIncludes.h"
+
+#include <Face_utils.h>
+#include <RecorderCSV.h>
+#include <SequenceCapture.h>
+
+// System includes
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#define INFO_STREAM( stream ) \
+std::cout << stream << std::endl
+
+#define WARN_STREAM( stream ) \
+std::cout << "Warning: " << stream << std::endl
+
+#define ERROR_STREAM( stream ) \
+std::cout << "Error: " << stream << std::endl
+
+using namespace std;
+
+vector<string> get_arguments(int argc, char **argv)
+{
+
+	vector<string> arguments;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		arguments.push_back(string(argv[i]));
+	}
+	return arguments;
+}
+
+struct BenchmarkResult
+{
+	string name;
+
+	// Time per item in microseconds, median, fastest and slowest repetition 
+	double median_us;
+	double min_us;
+	double max_us;
+
+	// Iterations per repetition
+	int iterations;
+};
+
+//===========================================================================
+// Running the benchmarks, the number of iterations is calibrated so that every repetition takes at least min_time / repetitions seconds
+class BenchmarkRunner
+{
+public:
+
+	BenchmarkRunner(double min_time, int repetitions, const string& filter) : min_time(min_time), repetitions(std::max(repetitions, 1)), filter(filter) {}
+
+	// Running a benchmark, a single call of the function processes items_per_iteration items (e.g. frames) and the time is reported per item
+	void Run(const string& name, const std::function<void()>& function, int items_per_iteration = 1)
+	{
+		if (!filter.empty() && name.find(filter) == string::npos)
+		{
+			return;
+		}
+
+		// Warm up (caches, lazily loaded data, preallocated buffers) and calibrate the number of iterations
+		double time_single = std::max(Time(function, 1), 1e-9);
+		int iterations = (int)std::ceil((min_time / repetitions) / time_single);
+		iterations = std::max(1, std::min(iterations, 1000000));
+
+		vector<double> times;
+		for (int r = 0; r < repetitions; ++r)
+		{
+			times.push_back(Time(function, iterations) * 1e6 / ((double)iterations * items_per_iteration));
+		}
+		std::sort(times.begin(), times.end());
+
+		BenchmarkResult result;
+		result.name = name;
+		result.median_us = times[times.size() / 2];
+		result.min_us = times.front();
+		result.max_us = times.back();
+		result.iterations = iterations;
+		results.push_back(result);
+
+		cout << std::left << std::setw(60) << name << std::right << std::fixed << std::setprecision(2)
+			<< std::setw(14) << result.median_us << " us" << std::setw(14) << result.min_us << " us" << std::setw(14) << result.max_us << " us" << std::setw(10) << iterations << endl;
+	}
+
+	void Skip(const string& name, const string& reason)
+	{
+		if (filter.empty() || name.find(filter) != string::npos)
+		{
+			cout << std::left << std::setw(60) << name << "skipped: " << reason << endl;
+		}
+	}
+
+	void PrintHeader() const
+	{
+		cout << std::left << std::setw(60) << "Benchmark" << std::right << std::setw(17) << "Median" << std::setw(17) << "Min" << std::setw(17) << "Max" << std::setw(10) << "Iters" << endl;
+	}
+
+	bool WriteCSV(const string& filename) const
+	{
+		std::ofstream out(filename);
+		if (!out.is_open())
+		{
+			return false;
+		}
+
+		out << "benchmark,median_us,min_us,max_us,iterations" << endl;
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			out << "\"" << results[i].name << "\"," << results[i].median_us << "," << results[i].min_us << "," << results[i].max_us << "," << results[i].iterations << endl;
+		}
+		return true;
+	}
+
+private:
+
+	static double Time(const std::function<void()>& function, int iterations)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; ++i)
+		{
+			function();
+		}
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	double min_time;
+	int repetitions;
+	string filter;
+
+	vector<BenchmarkResult> results;
+};
+
+//===========================================================================
+// Tracking the clip with the parameters of a preset, returns the time taken in seconds
+double TrackWithPreset(const LandmarkDetector::CLNF& face_model, const LandmarkDetector::FaceModelParameters& base_parameters, const string& preset,
+	const vector<cv::Mat>& frames, const vector<cv::Mat_<uchar> >& gray_frames, vector<cv::Mat_<float> >& landmarks, vector<bool>& success)
+{
+	LandmarkDetector::FaceModelParameters parameters(base_parameters);
+	parameters.ApplyPreset(preset);
+
+	LandmarkDetector::CLNF tracking_model(face_model);
+	landmarks.assign(frames.size(), cv::Mat_<float>());
+	success.assign(frames.size(), false);
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < frames.size(); ++i)
+	{
+		cv::Mat gray = gray_frames[i];
+		success[i] = LandmarkDetector::DetectLandmarksInVideo(frames[i], tracking_model, parameters, gray);
+		landmarks[i] = tracking_model.detected_landmarks.clone();
+	}
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The mean landmark error against the reference per frame (where both were tracked), normalised by the size of the reference face
+double LandmarkError(const vector<cv::Mat_<float> >& landmarks, const vector<bool>& success, const vector<cv::Mat_<float> >& reference, const vector<bool>& reference_success)
+{
+	double error = 0;
+	int num_frames = 0;
+	for (size_t i = 0; i < landmarks.size(); ++i)
+	{
+		if (!success[i] || !reference_success[i] || landmarks[i].empty() || landmarks[i].size() != reference[i].size())
+		{
+			continue;
+		}
+
+		int n = reference[i].rows / 2;
+		double min_x, max_x, min_y, max_y;
+		cv::minMaxLoc(reference[i].rowRange(0, n), &min_x, &max_x);
+		cv::minMaxLoc(reference[i].rowRange(n, 2 * n), &min_y, &max_y);
+		double face_size = std::sqrt(std::max((max_x - min_x) * (max_y - min_y), 1.0));
+
+		double frame_error = 0;
+		for (int p = 0; p < n; ++p)
+		{
+			double dx = landmarks[i](p) - reference[i](p);
+			double dy = landmarks[i](p + n) - reference[i](p + n);
+			frame_error += std::sqrt(dx * dx + dy * dy);
+		}
+		error += frame_error / (n * face_size);
+		num_frames++;
+	}
+	return num_frames > 0 ? error / num_frames : -1;
+}
+
+int main(int argc, char **argv)
+{
+
+	vector<string> arguments = get_arguments(argc, argv);
+
+	double min_time = 2.0;
+	int repetitions = 5;
+	int num_frames = 100;
+	string filter;
+	string output_file;
+	string preset_report_file;
+	bool has_video = false;
+
+	for (size_t i = 1; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-min_time") == 0 && i + 1 < arguments.size())
+		{
+			min_time = std::stod(arguments[i + 1]);
+		}
+		else if (arguments[i].compare("-reps") == 0 && i + 1 < arguments.size())
+		{
+			repetitions = std::stoi(arguments[i + 1]);
+		}
+		else if (arguments[i].compare("-bench_frames") == 0 && i + 1 < arguments.size())
+		{
+			num_frames = std::stoi(arguments[i + 1]);
+		}
+		else if (arguments[i].compare("-filter") == 0 && i + 1 < arguments.size())
+		{
+			filter = arguments[i + 1];
+		}
+		else if (arguments[i].compare("-out") == 0 && i + 1 < arguments.size())
+		{
+			output_file = arguments[i + 1];
+		}
+		else if (arguments[i].compare("-preset_report") == 0 && i + 1 < arguments.size())
+		{
+			preset_report_file = arguments[i + 1];
+		}
+		else if (arguments[i].compare("-f") == 0)
+		{
+			has_video = true;
+		}
+	}
+
+	LandmarkDetector::FaceModelParameters det_parameters(arguments);
+
+	LandmarkDetector::CLNF face_model(det_parameters.model_location);
+	if (!face_model.loaded_successfully)
+	{
+		ERROR_STREAM("Could not load the landmark detector");
+		return 1;
+	}
+
+	// The canned clip, read in fully before benchmarking so that the decoding is not timed
+	vector<cv::Mat> frames;
+	vector<cv::Mat_<uchar> > gray_frames;
+	float fx = 500, fy = 500, cx = 320, cy = 240;
+
+	if (has_video)
+	{
+		Utilities::SequenceCapture sequence_reader;
+		if (!sequence_reader.Open(arguments))
+		{
+			ERROR_STREAM("Could not open the benchmark video");
+			return 1;
+		}
+
+		fx = sequence_reader.fx; fy = sequence_reader.fy; cx = sequence_reader.cx; cy = sequence_reader.cy;
+
+		cv::Mat frame = sequence_reader.GetNextFrame();
+		while (!frame.empty() && (int)frames.size() < num_frames)
+		{
+			frames.push_back(frame.clone());
+			gray_frames.push_back(sequence_reader.GetGrayFrame().clone());
+			frame = sequence_reader.GetNextFrame();
+		}
+		sequence_reader.Close();
+	}
+
+	// Without a clip the micro benchmarks are run on a synthetic image
+	if (frames.empty())
+	{
+		WARN_STREAM("No video provided (-f), the micro benchmarks use a synthetic image and the end-to-end benchmark is skipped");
+		cv::Mat frame(480, 640, CV_8UC3);
+		cv::RNG rng(0);
+		rng.fill(frame, cv::RNG::UNIFORM, 0, 255);
+		cv::GaussianBlur(frame, frame, cv::Size(0, 0), 3);
+		frames.push_back(frame);
+
+		cv::Mat_<uchar> gray;
+		cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+		gray_frames.push_back(gray);
+	}
+
+	cv::Mat& frame = frames[0];
+	cv::Mat_<uchar>& gray_frame = gray_frames[0];
+	cv::Mat_<float> gray_frame_float;
+	gray_frame.convertTo(gray_frame_float, CV_32F);
+
+	// Placing the model either on the detected face in the first frame, or in the middle of the image
+	if (!has_video || !LandmarkDetector::DetectLandmarksInVideo(frame, face_model, det_parameters, gray_frame))
+	{
+		cv::Rect_<float> bounding_box(frame.cols * 0.3f, frame.rows * 0.25f, frame.cols * 0.4f, frame.cols * 0.4f);
+		face_model.params_local.setTo(0);
+		face_model.pdm.CalcParams(face_model.params_global, bounding_box, face_model.params_local);
+		face_model.pdm.CalcShape2D(face_model.detected_landmarks, face_model.params_local, face_model.params_global);
+	}
+
+	const cv::Vec6f params_global = face_model.params_global;
+	const cv::Mat_<float> params_local = face_model.params_local.clone();
+	const cv::Mat_<float> landmarks = face_model.detected_landmarks.clone();
+
+	BenchmarkRunner runner(min_time, repetitions, filter);
+	runner.PrintHeader();
+
+	LandmarkDetector::Patch_experts& patch_experts = face_model.patch_experts;
+	int scale = 0;
+	int window_size = 11;
+
+	// A single CEN patch expert, on its own and together with its mirrored pair
+	if (!patch_experts.cen_expert_intensity.empty())
+	{
+		patch_experts.LoadView(scale, 0);
+
+		int landmark = 0;
+		while (landmark < (int)patch_experts.cen_expert_intensity[scale][0].size() && patch_experts.cen_expert_intensity[scale][0][landmark].biases.empty())
+		{
+			landmark++;
+		}
+		LandmarkDetector::CEN_patch_expert& expert = patch_experts.cen_expert_intensity[scale][0][landmark];
+
+		int area_size = window_size + expert.width_support - 1;
+		cv::Mat_<float> area_of_interest = gray_frame_float(cv::Rect(0, 0, area_size, area_size)).clone();
+		cv::Mat_<float> area_of_interest_mirror = gray_frame_float(cv::Rect(area_size, 0, area_size, area_size)).clone();
+		cv::Mat_<float> interp_mat;
+		LandmarkDetector::interpolationMatrix(interp_mat, window_size, window_size, area_size, area_size);
+
+		LandmarkDetector::CEN_workspace workspace;
+		cv::Mat_<float> response, response_mirror, empty;
+
+		runner.Run("CEN_patch_expert::ResponseSparse", [&]() {
+			expert.ResponseSparse(area_of_interest, empty, response, empty, interp_mat, workspace);
+		});
+		runner.Run("CEN_patch_expert::ResponseSparse (mirrored pair)", [&]() {
+			expert.ResponseSparse(area_of_interest, area_of_interest_mirror, response, response_mirror, interp_mat, workspace);
+		});
+	}
+	else
+	{
+		runner.Skip("CEN_patch_expert::ResponseSparse", "the model has no CEN patch experts");
+	}
+
+	// A single CCNF patch expert
+	if (!patch_experts.ccnf_expert_intensity.empty())
+	{
+		int landmark = 0;
+		LandmarkDetector::CCNF_patch_expert& expert = patch_experts.ccnf_expert_intensity[scale][0][landmark];
+
+		// The sigmas for the window size are computed before use
+		for (size_t w_size = 0; w_size < patch_experts.sigma_components.size(); ++w_size)
+		{
+			if (!patch_experts.sigma_components[w_size].empty() && window_size * window_size == patch_experts.sigma_components[w_size][0].rows)
+			{
+				expert.ComputeSigmas(patch_experts.sigma_components[w_size], window_size);
+			}
+		}
+
+		int area_size = window_size + expert.width - 1;
+		cv::Mat_<float> area_of_interest = gray_frame_float(cv::Rect(0, 0, area_size, area_size)).clone();
+		cv::Mat_<float> response(window_size, window_size), im2col_prealloc;
+
+		runner.Run("CCNF_patch_expert::ResponseOpenBlas", [&]() {
+			expert.ResponseOpenBlas(area_of_interest, response, im2col_prealloc);
+		});
+	}
+	else
+	{
+		runner.Skip("CCNF_patch_expert::ResponseOpenBlas", "the model has no CCNF patch experts (e.g. use -mloc model/main_clnf_general.txt)");
+	}
+
+	// The responses of all of the landmarks at every scale
+	{
+		vector<cv::Mat_<float> > responses(face_model.pdm.NumberOfPoints());
+		cv::Matx22f sim_ref_to_img, sim_img_to_ref;
+
+		for (int s = 0; s < (int)patch_experts.patch_scaling.size(); ++s)
+		{
+			if (s >= (int)det_parameters.window_sizes_current.size() || det_parameters.window_sizes_current[s] == 0)
+			{
+				continue;
+			}
+			int window = det_parameters.window_sizes_current[s];
+
+			runner.Run("Patch_experts::Response (scale " + to_string(s) + ", window " + to_string(window) + ")", [&]() {
+				patch_experts.Response(responses, sim_ref_to_img, sim_img_to_ref, gray_frame_float, face_model.pdm, params_global, params_local, window, s);
+			});
+		}
+	}
+
+	// Fitting the PDM to landmarks
+	{
+		cv::Vec6f out_params_global;
+		cv::Mat_<float> out_params_local;
+
+		runner.Run("PDM::CalcParams", [&]() {
+			face_model.pdm.CalcParams(out_params_global, out_params_local, landmarks);
+		});
+	}
+
+	// A full landmark fit from the same starting point (the patch responses and the NU_RLMS optimisation at every scale)
+	{
+		LandmarkDetector::CLNF fit_model(face_model);
+		LandmarkDetector::FaceModelParameters fit_parameters(det_parameters);
+		fit_parameters.refine_hierarchical = false;
+		fit_parameters.validate_detections = false;
+
+		runner.Run("CLNF::DetectLandmarks (Response and NU_RLMS)", [&]() {
+			fit_model.params_global = params_global;
+			params_local.copyTo(fit_model.params_local);
+			fit_model.DetectLandmarks(gray_frame, fit_parameters);
+		});
+	}
+
+	// Face detection at the common resolutions
+	if (!face_model.face_detector_MTCNN.empty())
+	{
+		const cv::Size resolutions[] = { cv::Size(320, 240), cv::Size(640, 480), cv::Size(1280, 720), cv::Size(1920, 1080) };
+		for (const cv::Size& resolution : resolutions)
+		{
+			cv::Mat image;
+			cv::resize(frame, image, resolution);
+
+			vector<cv::Rect_<float> > regions;
+			vector<float> confidences;
+
+			runner.Run("FaceDetectorMTCNN::DetectFaces (" + to_string(resolution.width) + "x" + to_string(resolution.height) + ")", [&]() {
+				face_model.face_detector_MTCNN.DetectFaces(regions, image, confidences);
+			});
+		}
+	}
+	else
+	{
+		runner.Skip("FaceDetectorMTCNN::DetectFaces", "the MTCNN face detector is not loaded");
+	}
+
+	// Face alignment and appearance features
+	{
+		cv::Mat aligned_face;
+
+		runner.Run("FaceAnalysis::AlignFace", [&]() {
+			FaceAnalysis::AlignFace(aligned_face, frame, landmarks, params_global, face_model.pdm, true, 0.7, 112, 112);
+		});
+
+		cv::Mat_<float> hog_descriptor;
+		int num_hog_rows, num_hog_cols;
+
+		runner.Run("FaceAnalysis::Extract_FHOG_descriptor (112x112)", [&]() {
+			FaceAnalysis::Extract_FHOG_descriptor(hog_descriptor, aligned_face, num_hog_rows, num_hog_cols);
+		});
+	}
+
+	// Writing the output, including the formatting on the writer thread
+	{
+		const string csv_file = "openface_bench_tmp.csv";
+		vector<string> au_names_class = { "AU01", "AU02", "AU04", "AU05", "AU06", "AU07", "AU09", "AU10", "AU12", "AU14", "AU15", "AU17", "AU20", "AU23", "AU25", "AU26", "AU28", "AU45" };
+		vector<string> au_names_reg(au_names_class.begin(), au_names_class.end() - 1);
+		vector<float> au_class(au_names_class.size(), 1.0f), au_reg(au_names_reg.size(), 1.2345f);
+
+		cv::Mat_<float> landmarks_3D = face_model.GetShape(fx, fy, cx, cy);
+		cv::Vec6f pose = LandmarkDetector::GetPose(face_model, fx, fy, cx, cy);
+		vector<cv::Point2f> eye_landmarks_2D(56, cv::Point2f(100.5f, 200.25f));
+		vector<cv::Point3f> eye_landmarks_3D(56, cv::Point3f(10.5f, 20.25f, 400.125f));
+
+		Utilities::RecorderCSV csv_recorder;
+		if (csv_recorder.Open(csv_file, true, true, true, true, true, true, true, face_model.pdm.NumberOfPoints(), face_model.pdm.NumberOfModes(), 56, au_names_class, au_names_reg))
+		{
+			int frame_num = 0;
+
+			runner.Run("RecorderCSV::WriteLine", [&]() {
+				csv_recorder.WriteLine(0, frame_num, frame_num * 0.033, true, 0.98, landmarks, landmarks_3D, params_local, params_global, pose,
+					cv::Point3f(0, 0, -1), cv::Point3f(0, 0, -1), cv::Vec2f(0.1f, 0.2f), eye_landmarks_2D, eye_landmarks_3D, au_reg, au_class);
+				frame_num++;
+			});
+
+			csv_recorder.Close();
+		}
+		else
+		{
+			runner.Skip("RecorderCSV::WriteLine", "could not open " + csv_file);
+		}
+		std::remove(csv_file.c_str());
+	}
+
+	// End-to-end tracking of the clip, starting from the detection in the first frame every time
+	if (has_video)
+	{
+		LandmarkDetector::CLNF tracking_model(face_model);
+
+		runner.Run("DetectLandmarksInVideo (per frame, " + to_string(frames.size()) + " frames)", [&]() {
+			tracking_model.Reset();
+			for (size_t i = 0; i < frames.size(); ++i)
+			{
+				LandmarkDetector::DetectLandmarksInVideo(frames[i], tracking_model, det_parameters, gray_frames[i]);
+			}
+		}, (int)frames.size());
+	}
+	else
+	{
+		runner.Skip("DetectLandmarksInVideo", "no video provided (-f)");
+	}
+
+	// The fps and the landmark error of every preset, the error is against the most accurate preset (as there is no ground truth for the clip)
+	if (!preset_report_file.empty() && has_video)
+	{
+		vector<string> presets = LandmarkDetector::FaceModelParameters::PresetNames();
+		string reference_preset = "offline_accurate";
+
+		vector<cv::Mat_<float> > reference;
+		vector<bool> reference_success;
+		TrackWithPreset(face_model, det_parameters, reference_preset, frames, gray_frames, reference, reference_success);
+
+		std::ofstream report(preset_report_file);
+		if (report.is_open())
+		{
+			report << "preset,fps,tracked_fraction,landmark_error" << endl;
+		}
+
+		cout << endl << std::left << std::setw(20) << "Preset" << std::right << std::setw(12) << "FPS" << std::setw(12) << "Tracked" << std::setw(24) << "Error (of face size)" << endl;
+		for (size_t p = 0; p < presets.size(); ++p)
+		{
+			vector<cv::Mat_<float> > landmarks_preset;
+			vector<bool> success;
+			double seconds = TrackWithPreset(face_model, det_parameters, presets[p], frames, gray_frames, landmarks_preset, success);
+
+			double fps = frames.size() / std::max(seconds, 1e-9);
+			double tracked = std::count(success.begin(), success.end(), true) / (double)frames.size();
+			double error = LandmarkError(landmarks_preset, success, reference, reference_success);
+
+			cout << std::left << std::setw(20) << presets[p] << std::right << std::fixed << std::setprecision(2) << std::setw(12) << fps
+				<< std::setw(12) << tracked << std::setw(24) << std::setprecision(4) << error << endl;
+			if (report.is_open())
+			{
+				report << presets[p] << "," << fps << "," << tracked << "," << error << endl;
+			}
+		}
+
+		if (!report.is_open())
+		{
+			ERROR_STREAM("Could not write the preset report to " << preset_report_file);
+		}
+	}
+	else if (!preset_report_file.empty())
+	{
+		WARN_STREAM("The preset report needs a video (-f)");
+	}
+
+	if (!output_file.empty() && !runner.WriteCSV(output_file))
+	{
+		ERROR_STREAM("Could not write the results to " << output_file);
+		return 1;
+	}
+
+	return 0;
+}
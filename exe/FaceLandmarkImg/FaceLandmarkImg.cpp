@@ -33,16 +33,19 @@
 ///////////////////////////////////////////////////////////////////////////////
 // FaceLandmarkImg.cpp : Defines the entry point for the console application for detecting landmarks in images.
 
-// dlib
-#include <dlib/image_processing/frontal_face_detector.h>
-
 #include "LandmarkCoreIncludes.h"
 
 #include <tbb/tbb.h>
 
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+
 #include <FaceAnalyser.h>
 #include <GazeEstimation.h>
 
+#include <Concurrency.h>
+#include <DetectionCache.h>
 #include <ImageCapture.h>
 #include <Visualizer.h>
 #include <VisualizationUtils.h>
@@ -68,12 +71,140 @@ vector<string> get_arguments(int argc, char **argv)
 	return arguments;
 }
 
+// The state needed for analysing images independently of other workers, the model weights are shared between the copies
+struct ImageWorker
+{
+	ImageWorker(const LandmarkDetector::CLNF& face_model, const FaceAnalysis::FaceAnalyser& face_analyser, const std::string& haar_location,
+		const LandmarkDetector::FaceDetectorHOG& face_detector_hog, const LandmarkDetector::FaceDetectorMTCNN& face_detector_mtcnn) :
+		face_model(face_model), face_analyser(face_analyser), face_detector_hog(face_detector_hog), face_detector_mtcnn(face_detector_mtcnn)
+	{
+		// The CascadeClassifier does not have a proper copy constructor
+		classifier.load(haar_location);
+	}
+
+	LandmarkDetector::CLNF face_model;
+	FaceAnalysis::FaceAnalyser face_analyser;
+	cv::CascadeClassifier classifier;
+	LandmarkDetector::FaceDetectorHOG face_detector_hog;
+	LandmarkDetector::FaceDetectorMTCNN face_detector_mtcnn;
+};
+
+// Everything that gets recorded and visualized about a face
+struct FaceObservation
+{
+	cv::Mat_<float> landmarks_2D;
+	cv::Mat_<float> landmarks_3D;
+	cv::Mat_<int> visibilities;
+	cv::Vec6f params_global;
+	cv::Mat_<float> params_local;
+	double detection_certainty;
+	bool detection_success;
+	cv::Vec6d pose_estimate;
+	GazeAnalysis::GazeResult gaze;
+	cv::Mat sim_warped_img;
+	cv::Mat_<float> hog_descriptor;
+	int num_hog_rows;
+	int num_hog_cols;
+	std::vector<std::pair<std::string, double> > au_intensities;
+	std::vector<std::pair<std::string, double> > au_occurences;
+};
+
+// An image read in, and the results of analysing it once done
+struct ImageObservation
+{
+	cv::Mat rgb_image;
+	cv::Mat_<uchar> grayscale_image;
+	std::string name;
+	float fx, fy, cx, cy;
+	bool has_bounding_boxes;
+	// Set if the faces were already detected together with the rest of the batch (or found in the detection cache)
+	bool faces_detected;
+	bool cached_detections;
+	uint64_t image_hash;
+	std::vector<cv::Rect_<float> > face_detections;
+	// The MTCNN keypoints of the detections (if detected with MTCNN), they seed the orientation of the landmark detection
+	std::vector<std::vector<cv::Point2f> > face_keypoints;
+	std::vector<FaceObservation> faces;
+};
+
+// Detecting the faces (unless provided) and their landmarks, gaze, and Action Units in a single image, the parameters are copied as the
+// landmark detection can modify them
+void AnalyseImage(ImageObservation& image, ImageWorker& worker, LandmarkDetector::FaceModelParameters det_parameters, bool compute_features)
+{
+	if (!image.has_bounding_boxes && !image.faces_detected)
+	{
+		image.face_keypoints.clear();
+		if (det_parameters.curr_face_detector == LandmarkDetector::FaceModelParameters::HOG_SVM_DETECTOR)
+		{
+			vector<float> confidences;
+			LandmarkDetector::DetectFacesHOG(image.face_detections, image.grayscale_image, worker.face_detector_hog, confidences);
+		}
+		else if (det_parameters.curr_face_detector == LandmarkDetector::FaceModelParameters::HAAR_DETECTOR)
+		{
+			LandmarkDetector::DetectFaces(image.face_detections, image.grayscale_image, worker.classifier);
+		}
+		else
+		{
+			vector<float> confidences;
+			LandmarkDetector::DetectFacesMTCNN(image.face_detections, image.rgb_image, worker.face_detector_mtcnn, confidences, image.face_keypoints);
+		}
+	}
+
+	LandmarkDetector::CLNF& face_model = worker.face_model;
+	FaceAnalysis::FaceAnalyser& face_analyser = worker.face_analyser;
+
+	// perform landmark detection for every face detected
+	image.faces.resize(image.face_detections.size());
+	for (size_t face = 0; face < image.face_detections.size(); ++face)
+	{
+		FaceObservation& observation = image.faces[face];
+
+		// if there are multiple detections go through them
+		const vector<cv::Point2f>& keypoints = face < image.face_keypoints.size() ? image.face_keypoints[face] : vector<cv::Point2f>();
+		LandmarkDetector::DetectLandmarksInImage(image.rgb_image, image.face_detections[face], keypoints, face_model, det_parameters, image.grayscale_image);
+
+		// Estimate head pose and eye gaze				
+		observation.pose_estimate = LandmarkDetector::GetPose(face_model, image.fx, image.fy, image.cx, image.cy);
+
+		// Gaze tracking, absolute gaze direction
+		observation.gaze.gaze_direction0 = cv::Point3f(0, 0, -1);
+		observation.gaze.gaze_direction1 = cv::Point3f(0, 0, -1);
+
+		GazeAnalysis::EstimateGazeBoth(face_model, observation.gaze, image.fx, image.fy, image.cx, image.cy, face_model.eye_model);
+
+		observation.num_hog_rows = 0;
+		observation.num_hog_cols = 0;
+
+		// Perform AU detection and HOG feature extraction, as this can be expensive only compute it if needed by output or visualization
+		if (compute_features)
+		{
+			face_analyser.PredictStaticAUsAndComputeFeatures(image.rgb_image, face_model.detected_landmarks);
+			face_analyser.GetLatestAlignedFace(observation.sim_warped_img);
+			face_analyser.GetLatestHOG(observation.hog_descriptor, observation.num_hog_rows, observation.num_hog_cols);
+		}
+
+		// The model is reused for the next face, so keep copies of its state
+		observation.landmarks_2D = face_model.detected_landmarks.clone();
+		observation.landmarks_3D = face_model.GetShape(image.fx, image.fy, image.cx, image.cy).clone();
+		observation.visibilities = face_model.GetVisibilities().clone();
+		observation.params_global = face_model.params_global;
+		observation.params_local = face_model.params_local.clone();
+		observation.detection_certainty = face_model.detection_certainty;
+		observation.detection_success = face_model.detection_success;
+		observation.au_intensities = face_analyser.GetCurrentAUsReg();
+		observation.au_occurences = face_analyser.GetCurrentAUsClass();
+	}
+}
+
 int main(int argc, char **argv)
 {
 
 	//Convert arguments to more convenient vector form
 	vector<string> arguments = get_arguments(argc, argv);
 
+	// The number of threads used for the processing (-threads <n>, all of the cores by default)
+	Utilities::Concurrency::ParseArguments(arguments);
+
 	// no arguments: output usage
 	if (arguments.size() == 1)
 	{
@@ -114,7 +245,8 @@ int main(int argc, char **argv)
 
 	// If bounding boxes not provided, use a face detector
 	cv::CascadeClassifier classifier(det_parameters.haar_face_detector_location);
-	dlib::frontal_face_detector face_detector_hog = dlib::get_frontal_face_detector();
+	LandmarkDetector::FaceDetectorHOG face_detector_hog;
+	face_detector_hog.Read();
 	LandmarkDetector::FaceDetectorMTCNN face_detector_mtcnn(det_parameters.mtcnn_face_detector_location);
 
 	// If can't find MTCNN face detector, default to HOG one
@@ -141,117 +273,194 @@ int main(int argc, char **argv)
 		cout << "WARNING: no Action Unit models found" << endl;
 	}
 
-	cout << "Starting tracking" << endl;
-	while (!rgb_image.empty())
+	// Images are independent, so a number of them can be analysed at the same time, each worker with its own copy of the models
+	int num_workers = 1;
+	for (size_t i = 0; i < arguments.size(); ++i)
 	{
-	
-		Utilities::RecorderOpenFaceParameters recording_params(arguments, false, false,
-			image_reader.fx, image_reader.fy, image_reader.cx, image_reader.cy);
-
-		if (!face_model.eye_model)
+		if (arguments[i].compare("-img_workers") == 0 && i + 1 < arguments.size())
 		{
-			recording_params.setOutputGaze(false);
+			num_workers = std::max(1, atoi(arguments[i + 1].c_str()));
 		}
-		Utilities::RecorderOpenFace open_face_rec(image_reader.name, recording_params, arguments);
+	}
 
-		visualizer.SetImage(rgb_image, image_reader.fx, image_reader.fy, image_reader.cx, image_reader.cy);
+	std::vector<std::unique_ptr<ImageWorker> > workers;
+	for (int i = 0; i < num_workers; ++i)
+	{
+		workers.push_back(std::unique_ptr<ImageWorker>(new ImageWorker(face_model, face_analyser, det_parameters.haar_face_detector_location, face_detector_hog, face_detector_mtcnn)));
+	}
+
+	// The detections can be cached across runs (-detection_cache <file>), keyed by the image content and the face detector
+	Utilities::DetectionCache detection_cache;
+	for (size_t i = 0; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-detection_cache") == 0 && i + 1 < arguments.size())
+		{
+			if (!detection_cache.Open(arguments[i + 1]))
+			{
+				return 1;
+			}
+			cout << "Using the detection cache " << arguments[i + 1] << " (" << detection_cache.Size() << " images)" << endl;
+		}
+	}
 
-		// Making sure the image is in uchar grayscale (some face detectors use RGB, landmark detector uses grayscale)
-		cv::Mat_<uchar> grayscale_image = image_reader.GetGrayFrame();
+	// The workers are handed out to the tasks as they become free
+	tbb::concurrent_bounded_queue<ImageWorker*> free_workers;
+	for (int i = 0; i < num_workers; ++i)
+	{
+		free_workers.push(workers[i].get());
+	}
 
-		// Detect faces in an image
-		vector<cv::Rect_<float> > face_detections;
+	// A few images per worker are read in at a time, so that the workers can balance out images with different numbers of faces
+	const size_t batch_size = num_workers == 1 ? 1 : 4 * num_workers;
 
-		if (image_reader.has_bounding_boxes)
+	cout << "Starting tracking" << endl;
+	while (!rgb_image.empty())
+	{
+		std::vector<ImageObservation> batch;
+		while (!rgb_image.empty() && batch.size() < batch_size)
 		{
-			face_detections = image_reader.GetBoundingBoxes();
+			ImageObservation image;
+			image.rgb_image = rgb_image;
+
+			// Making sure the image is in uchar grayscale (some face detectors use RGB, landmark detector uses grayscale)
+			image.grayscale_image = image_reader.GetGrayFrame();
+			image.name = image_reader.name;
+			image.fx = image_reader.fx; image.fy = image_reader.fy; image.cx = image_reader.cx; image.cy = image_reader.cy;
+			image.has_bounding_boxes = image_reader.has_bounding_boxes;
+			image.faces_detected = false;
+			image.cached_detections = false;
+			image.image_hash = 0;
+			if (image.has_bounding_boxes)
+			{
+				image.face_detections = image_reader.GetBoundingBoxes();
+			}
+			batch.push_back(image);
+
+			// Grabbing the next frame in the sequence
+			rgb_image = image_reader.GetNextImage();
 		}
-		else
+
+		Utilities::RecorderOpenFaceParameters feature_params(arguments, false, false);
+		bool compute_features = feature_params.outputAlignedFaces() || feature_params.outputHOG() || feature_params.outputAUs() || visualizer.vis_align || visualizer.vis_hog;
+
+		// The images detected in earlier runs reuse the detections
+		if (detection_cache.isOpen())
 		{
-			if (det_parameters.curr_face_detector == LandmarkDetector::FaceModelParameters::HOG_SVM_DETECTOR)
+			tbb::parallel_for(0, (int)batch.size(), [&](int i) {
+				if (!batch[i].has_bounding_boxes)
+				{
+					batch[i].image_hash = Utilities::DetectionCache::ImageHash(batch[i].rgb_image);
+				}
+			});
+
+			for (size_t i = 0; i < batch.size(); ++i)
 			{
-				vector<float> confidences;
-				LandmarkDetector::DetectFacesHOG(face_detections, grayscale_image, face_detector_hog, confidences);
+				ImageObservation& image = batch[i];
+				if (!image.has_bounding_boxes && detection_cache.Find(image.image_hash, det_parameters.curr_face_detector, image.face_detections, image.face_keypoints))
+				{
+					image.faces_detected = true;
+					image.cached_detections = true;
+				}
 			}
-			else if (det_parameters.curr_face_detector == LandmarkDetector::FaceModelParameters::HAAR_DETECTOR)
+		}
+
+		// MTCNN detects the faces of the whole batch at once, so that the networks are applied to the levels and proposals of many images together
+		if (det_parameters.curr_face_detector == LandmarkDetector::FaceModelParameters::MTCNN_DETECTOR && batch.size() > 1)
+		{
+			std::vector<cv::Mat> detection_images;
+			std::vector<size_t> detection_indices;
+			for (size_t i = 0; i < batch.size(); ++i)
 			{
-				LandmarkDetector::DetectFaces(face_detections, grayscale_image, classifier);
+				if (!batch[i].has_bounding_boxes && !batch[i].faces_detected)
+				{
+					detection_images.push_back(batch[i].rgb_image);
+					detection_indices.push_back(i);
+				}
 			}
-			else
+
+			std::vector<std::vector<cv::Rect_<float> > > detections;
+			std::vector<std::vector<float> > confidences;
+			std::vector<std::vector<std::vector<cv::Point2f> > > keypoints;
+			face_detector_mtcnn.DetectFacesBatch(detections, confidences, keypoints, detection_images);
+
+			for (size_t k = 0; k < detection_indices.size(); ++k)
 			{
-				vector<float> confidences;
-				LandmarkDetector::DetectFacesMTCNN(face_detections, rgb_image, face_detector_mtcnn, confidences);
+				ImageObservation& image = batch[detection_indices[k]];
+				image.face_detections = detections[k];
+				image.face_keypoints = keypoints[k];
+				image.faces_detected = true;
 			}
 		}
 
-		// Detect landmarks around detected faces
-		int face_det = 0;
-		// perform landmark detection for every face detected
-		for (size_t face = 0; face < face_detections.size(); ++face)
-		{
+		tbb::parallel_for(0, (int)batch.size(), [&](int i) {
+			ImageWorker* worker;
+			free_workers.pop(worker);
+			AnalyseImage(batch[i], *worker, det_parameters, compute_features);
+			free_workers.push(worker);
+		});
 
-			// if there are multiple detections go through them
-			bool success = LandmarkDetector::DetectLandmarksInImage(rgb_image, face_detections[face], face_model, det_parameters, grayscale_image);
+		if (detection_cache.isOpen())
+		{
+			for (size_t i = 0; i < batch.size(); ++i)
+			{
+				const ImageObservation& image = batch[i];
+				if (!image.has_bounding_boxes && !image.cached_detections)
+				{
+					detection_cache.Add(image.image_hash, det_parameters.curr_face_detector, image.face_detections, image.face_keypoints);
+				}
+			}
+		}
 
-			// Estimate head pose and eye gaze				
-			cv::Vec6d pose_estimate = LandmarkDetector::GetPose(face_model, image_reader.fx, image_reader.fy, image_reader.cx, image_reader.cy);
+		// The results are recorded and shown in the order of the input
+		for (size_t i = 0; i < batch.size(); ++i)
+		{
+			const ImageObservation& image = batch[i];
 
-			// Gaze tracking, absolute gaze direction
-			cv::Point3f gaze_direction0(0, 0, -1);
-			cv::Point3f gaze_direction1(0, 0, -1);
-			cv::Vec2f gaze_angle(0, 0);
+			Utilities::RecorderOpenFaceParameters recording_params(arguments, false, false,
+				image.fx, image.fy, image.cx, image.cy);
 
-			if (face_model.eye_model)
+			if (!face_model.eye_model)
 			{
-				GazeAnalysis::EstimateGaze(face_model, gaze_direction0, image_reader.fx, image_reader.fy, image_reader.cx, image_reader.cy, true);
-				GazeAnalysis::EstimateGaze(face_model, gaze_direction1, image_reader.fx, image_reader.fy, image_reader.cx, image_reader.cy, false);
-				gaze_angle = GazeAnalysis::GetGazeAngle(gaze_direction0, gaze_direction1);
+				recording_params.setOutputGaze(false);
 			}
+			Utilities::RecorderOpenFace open_face_rec(image.name, recording_params, arguments);
+			visualizer.record_track = recording_params.outputTracked();
 
-			cv::Mat sim_warped_img;
-			cv::Mat_<double> hog_descriptor; int num_hog_rows = 0, num_hog_cols = 0;
+			visualizer.SetImage(image.rgb_image, image.fx, image.fy, image.cx, image.cy);
 
-			// Perform AU detection and HOG feature extraction, as this can be expensive only compute it if needed by output or visualization
-			if (recording_params.outputAlignedFaces() || recording_params.outputHOG() || recording_params.outputAUs() || visualizer.vis_align || visualizer.vis_hog)
+			for (size_t face = 0; face < image.faces.size(); ++face)
 			{
-				face_analyser.PredictStaticAUsAndComputeFeatures(rgb_image, face_model.detected_landmarks);
-				face_analyser.GetLatestAlignedFace(sim_warped_img);
-				face_analyser.GetLatestHOG(hog_descriptor, num_hog_rows, num_hog_cols);
+				const FaceObservation& observation = image.faces[face];
+
+				// Displaying the tracking visualizations
+				visualizer.SetObservationFaceAlign(observation.sim_warped_img);
+				visualizer.SetObservationHOG(observation.hog_descriptor, observation.num_hog_rows, observation.num_hog_cols);
+				visualizer.SetObservationLandmarks(observation.landmarks_2D, 1.0, observation.visibilities); // Set confidence to high to make sure we always visualize
+				visualizer.SetObservationPose(observation.pose_estimate, 1.0);
+				visualizer.SetObservationGaze(observation.gaze.gaze_direction0, observation.gaze.gaze_direction1, observation.gaze.eye_landmarks_2D, observation.gaze.eye_landmarks_3D, observation.detection_certainty);
+				visualizer.SetObservationActionUnits(observation.au_intensities, observation.au_occurences);
+
+				// Setting up the recorder output
+				open_face_rec.SetObservationHOG(observation.detection_success, observation.hog_descriptor, observation.num_hog_rows, observation.num_hog_cols, 31); // The number of channels in HOG is fixed at the moment, as using FHOG
+				open_face_rec.SetObservationActionUnits(observation.au_intensities, observation.au_occurences);
+				open_face_rec.SetObservationLandmarks(observation.landmarks_2D, observation.landmarks_3D,
+					observation.params_global, observation.params_local, observation.detection_certainty, observation.detection_success);
+				open_face_rec.SetObservationPose(observation.pose_estimate);
+				open_face_rec.SetObservationGaze(observation.gaze.gaze_direction0, observation.gaze.gaze_direction1, observation.gaze.gaze_angle, observation.gaze.eye_landmarks_2D, observation.gaze.eye_landmarks_3D);
+				open_face_rec.SetObservationFaceAlign(observation.sim_warped_img);
+				open_face_rec.SetObservationFaceID(face);
+				open_face_rec.WriteObservation();
+			}
+			if (image.faces.size() > 0)
+			{
+				visualizer.ShowObservation();
 			}
 
-			// Displaying the tracking visualizations
-			visualizer.SetObservationFaceAlign(sim_warped_img);
-			visualizer.SetObservationHOG(hog_descriptor, num_hog_rows, num_hog_cols);
-			visualizer.SetObservationLandmarks(face_model.detected_landmarks, 1.0, face_model.GetVisibilities()); // Set confidence to high to make sure we always visualize
-			visualizer.SetObservationPose(pose_estimate, 1.0);
-			visualizer.SetObservationGaze(gaze_direction0, gaze_direction1, LandmarkDetector::CalculateAllEyeLandmarks(face_model), LandmarkDetector::Calculate3DEyeLandmarks(face_model, image_reader.fx, image_reader.fy, image_reader.cx, image_reader.cy), face_model.detection_certainty);
-			visualizer.SetObservationActionUnits(face_analyser.GetCurrentAUsReg(), face_analyser.GetCurrentAUsClass());
-
-			// Setting up the recorder output
-			open_face_rec.SetObservationHOG(face_model.detection_success, hog_descriptor, num_hog_rows, num_hog_cols, 31); // The number of channels in HOG is fixed at the moment, as using FHOG
-			open_face_rec.SetObservationActionUnits(face_analyser.GetCurrentAUsReg(), face_analyser.GetCurrentAUsClass());
-			open_face_rec.SetObservationLandmarks(face_model.detected_landmarks, face_model.GetShape(image_reader.fx, image_reader.fy, image_reader.cx, image_reader.cy),
-				face_model.params_global, face_model.params_local, face_model.detection_certainty, face_model.detection_success);
-			open_face_rec.SetObservationPose(pose_estimate);
-			open_face_rec.SetObservationGaze(gaze_direction0, gaze_direction1, gaze_angle, LandmarkDetector::CalculateAllEyeLandmarks(face_model), LandmarkDetector::Calculate3DEyeLandmarks(face_model, image_reader.fx, image_reader.fy, image_reader.cx, image_reader.cy));
-			open_face_rec.SetObservationFaceAlign(sim_warped_img);
-			open_face_rec.SetObservationFaceID(face);
-			open_face_rec.WriteObservation();
+			open_face_rec.SetObservationVisualization(visualizer.GetVisImage());
+			open_face_rec.WriteObservationTracked();
 
+			open_face_rec.Close();
 		}
-		if (face_detections.size() > 0)
-		{
-			visualizer.ShowObservation();
-		}
-
-		open_face_rec.SetObservationVisualization(visualizer.GetVisImage());
-		open_face_rec.WriteObservationTracked();
-
-		open_face_rec.Close();
-
-		// Grabbing the next frame in the sequence
-		rgb_image = image_reader.GetNextImage();
-
 	}
 
 	return 0;
@@ -0,0 +1,740 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+// FaceLandmarkServer.cpp : Defines the entry point for the multi-stream tracking server. Every TCP connection is a camera stream with its own
+// tracker and face analyser state, while the model weights are loaded once and shared by all of the streams. The frames arriving from the
+// different streams within a latency window are processed together as a batch, spread across the cores. Under overload (-slo_ms <ms>) the
+// best effort streams are degraded step by step to keep the guaranteed latency streams within the objective.
+//
+// The protocol is binary, little endian and one frame at a time per connection:
+//	server -> client, once after connecting:
+//		uint32 'OFHI', uint32 number of AU intensities, { uint8 length, name }, uint32 number of AU presences, { uint8 length, name }
+//	client -> server, optionally before the first frame:
+//		uint32 'OFTR', uint32 tier (0 best effort, the default, or 1 guaranteed latency)
+//	client -> server, per frame:
+//		uint32 'OFFR', uint32 width, uint32 height, uint32 channels (1 gray or 3 BGR), float64 time stamp (s),
+//		float32 fx, fy, cx, cy (-1 for a guess from the image size), width * height * channels uint8 pixels
+//	server -> client, per frame:
+//		uint32 'OFRS', uint32 frame number, uint8 detection success, float32 detection certainty, float32 pose[6] (Tx, Ty, Tz, Rx, Ry, Rz),
+//		float32 gaze angle[2], uint32 landmarks, float32 x[landmarks], float32 y[landmarks], float32 AU intensities[], float32 AU presences[]
+//	the connection is closed by the client, or by the server on a malformed message or when the stream is not admitted. A frame shed under
+//	overload is answered with the last result of the stream, so with the same frame number
+
+// Local includes
+#include "LandmarkCoreIncludes.h"
+
+#include <FaceAnalyser.h>
+#include <GazeEstimation.h>
+#include <Concurrency.h>
+#include <Metrics.h>
+#include <MetricsServer.h>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+// Boost includes
+#include <boost/asio.hpp>
+
+// TBB includes
+#include <tbb/tbb.h>
+
+// System includes
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#define INFO_STREAM( stream ) \
+std::cout << stream << std::endl
+
+#define WARN_STREAM( stream ) \
+std::cout << "Warning: " << stream << std::endl
+
+#define ERROR_STREAM( stream ) \
+std::cout << "Error: " << stream << std::endl
+
+using namespace std;
+
+static const uint32_t HELLO_MAGIC = 0x4948464F; // "OFHI"
+static const uint32_t FRAME_MAGIC = 0x5246464F; // "OFFR"
+static const uint32_t RESULT_MAGIC = 0x53524F46; // "OFRS"
+static const uint32_t TIER_MAGIC = 0x5254464F; // "OFTR"
+
+// Refusing frames that are clearly not images, so that a bad client can not make the server allocate arbitrary amounts of memory
+static const uint32_t MAX_FRAME_SIDE = 8192;
+
+vector<string> get_arguments(int argc, char **argv)
+{
+
+	vector<string> arguments;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		arguments.push_back(string(argv[i]));
+	}
+	return arguments;
+}
+
+//===========================================================================
+// Writing and reading the message fields
+class MessageWriter
+{
+public:
+
+	template<typename T>
+	void Add(const T& value)
+	{
+		const char* bytes = reinterpret_cast<const char*>(&value);
+		buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+	}
+
+	void AddString(const string& value)
+	{
+		uint8_t length = (uint8_t)std::min<size_t>(value.size(), 255);
+		Add(length);
+		buffer.insert(buffer.end(), value.begin(), value.begin() + length);
+	}
+
+	const vector<char>& Data() const { return buffer; }
+
+private:
+	vector<char> buffer;
+};
+
+template<typename T>
+static bool ReadValue(boost::asio::ip::tcp::socket& socket, T& value)
+{
+	boost::system::error_code error;
+	boost::asio::read(socket, boost::asio::buffer(&value, sizeof(T)), error);
+	return !error;
+}
+
+//===========================================================================
+// A frame received from a stream together with the result computed for it
+struct FrameRequest
+{
+	cv::Mat captured_image;
+	double time_stamp;
+	float fx, fy, cx, cy;
+};
+
+struct FrameResult
+{
+	int frame_number;
+	bool detection_success;
+	float detection_certainty;
+	cv::Vec6f pose;
+	cv::Vec2f gaze_angle;
+	cv::Mat_<float> landmarks;
+	vector<pair<string, double> > aus_reg;
+	vector<pair<string, double> > aus_class;
+};
+
+//===========================================================================
+// The per stream state, the copies of the models share the weights of the loaded models
+struct StreamState
+{
+	StreamState(const LandmarkDetector::CLNF& face_model, const LandmarkDetector::FaceModelParameters& det_parameters, const FaceAnalysis::FaceAnalyser& face_analyser)
+		: face_model(face_model), det_parameters(det_parameters), degraded_parameters(det_parameters), face_analyser(face_analyser), frame_number(0),
+		guaranteed(false), degraded(false)
+	{
+		// The cheaper fitting of the degraded streams only changes the per call settings, as the patch experts are shared between the streams
+		degraded_parameters.window_sizes_small[0] = 0; degraded_parameters.window_sizes_small[1] = 7;
+		degraded_parameters.window_sizes_small[2] = 0; degraded_parameters.window_sizes_small[3] = 0;
+		degraded_parameters.num_optimisation_iteration = 3;
+		degraded_parameters.refine_hierarchical = false;
+		degraded_parameters.motion_prediction = true;
+		degraded_parameters.full_fit_every = std::max(2, det_parameters.full_fit_every);
+		degraded_parameters.validate_every = std::max(10, det_parameters.validate_every);
+	}
+
+	FrameResult Process(const FrameRequest& request)
+	{
+		FrameResult result;
+		result.frame_number = frame_number++;
+
+		float fx = request.fx, fy = request.fy, cx = request.cx, cy = request.cy;
+		if (cx <= 0 || cy <= 0)
+		{
+			cx = request.captured_image.cols / 2.0f;
+			cy = request.captured_image.rows / 2.0f;
+		}
+		if (fx <= 0 || fy <= 0)
+		{
+			// The same rough guess of the focal length as for the sequences
+			fx = (500.0f * (request.captured_image.cols / 640.0f) + 500.0f * (request.captured_image.rows / 480.0f)) / 2.0f;
+			fy = fx;
+		}
+
+		cv::Mat_<uchar> grayscale_image;
+		if (request.captured_image.channels() == 3)
+		{
+			cv::cvtColor(request.captured_image, grayscale_image, cv::COLOR_BGR2GRAY);
+		}
+		else
+		{
+			grayscale_image = request.captured_image;
+		}
+
+		result.detection_success = LandmarkDetector::DetectLandmarksInVideo(request.captured_image, face_model, degraded ? degraded_parameters : det_parameters,
+			grayscale_image, request.time_stamp);
+		result.detection_certainty = (float)face_model.detection_certainty;
+
+		GazeAnalysis::GazeResult gaze;
+		GazeAnalysis::EstimateGazeBoth(face_model, gaze, fx, fy, cx, cy, result.detection_success && face_model.eye_model);
+		result.gaze_angle = gaze.gaze_angle;
+
+		result.pose = LandmarkDetector::GetPose(face_model, fx, fy, cx, cy);
+		result.landmarks = face_model.detected_landmarks.clone();
+
+		face_analyser.AddNextFrame(request.captured_image, face_model.detected_landmarks, face_model.detection_success, request.time_stamp, true);
+		result.aus_reg = face_analyser.GetCurrentAUsReg();
+		result.aus_class = face_analyser.GetCurrentAUsClass();
+
+		return result;
+	}
+
+	LandmarkDetector::CLNF face_model;
+	LandmarkDetector::FaceModelParameters det_parameters;
+	LandmarkDetector::FaceModelParameters degraded_parameters;
+	FaceAnalysis::FaceAnalyser face_analyser;
+	int frame_number;
+
+	// The latency tier of the stream, and is it currently fit with the degraded parameters
+	bool guaranteed;
+	bool degraded;
+};
+
+//===========================================================================
+/**
+Keeping the guaranteed latency streams within the latency objective when all of the streams together need more than the cores can give. The
+latency of the frames (the wait for their batch and the processing) is tracked as a moving average, of the guaranteed streams if there are any.
+While it is above the objective the best effort streams are shed in steps, every step held for a while before taking the next one:
+	level 1 - the best effort streams are fit with cheaper settings
+	level 2 to 4 - additionally only one in level frames of every best effort stream is processed, the same share for all of them
+	level 4 - new best effort streams are also refused
+Once the latency is well below the objective the steps are taken back one at a time. The guaranteed streams are never degraded, they are only
+refused once the stream limit (-max_streams <n>) is reached
+*/
+class AdmissionController
+{
+public:
+
+	// An objective of 0 disables the shedding, a stream limit of 0 admits any number of streams
+	AdmissionController(double slo_ms, int max_streams) : slo_ms(slo_ms), max_streams(max_streams), average_all(0), average_guaranteed(0),
+		num_streams(0), num_guaranteed(0), level(0), last_change(std::chrono::steady_clock::now())
+	{
+	}
+
+	// Admitting a new stream, released again with Release
+	bool Admit(bool guaranteed)
+	{
+		std::lock_guard<std::mutex> lock(controller_mutex);
+		if ((max_streams > 0 && num_streams >= max_streams) || (!guaranteed && level >= MAX_LEVEL))
+		{
+			return false;
+		}
+		num_streams++;
+		if (guaranteed)
+			num_guaranteed++;
+		return true;
+	}
+
+	void Release(bool guaranteed)
+	{
+		std::lock_guard<std::mutex> lock(controller_mutex);
+		num_streams--;
+		if (guaranteed)
+			num_guaranteed--;
+	}
+
+	// Recording a processed frame, how long it waited for its batch and how long its processing took
+	void Observe(bool guaranteed, double wait_ms, double process_ms, size_t queue_depth)
+	{
+		std::lock_guard<std::mutex> lock(controller_mutex);
+
+		const double smoothing = 0.1;
+		double latency = wait_ms + process_ms;
+		average_all += smoothing * (latency - average_all);
+		if (guaranteed)
+			average_guaranteed += smoothing * (latency - average_guaranteed);
+
+		METRICS_GAUGE_SET("openface_server_frame_wait_us", "The time the last frame waited for its batch", wait_ms * 1000);
+		METRICS_GAUGE_SET("openface_server_frame_process_us", "The processing time of the last frame", process_ms * 1000);
+		METRICS_GAUGE_SET("openface_server_queue_depth", "The frames of the last batch", queue_depth);
+
+		if (slo_ms <= 0)
+			return;
+
+		// Stepping up quickly and down slowly, so that the levels do not oscillate
+		double average = num_guaranteed > 0 ? average_guaranteed : average_all;
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		double since_change = std::chrono::duration<double>(now - last_change).count();
+		if (average > slo_ms && level < MAX_LEVEL && since_change > 0.5)
+		{
+			level++;
+			last_change = now;
+			WARN_STREAM("Latency of " << average << "ms above the objective of " << slo_ms << "ms, shedding the best effort streams at level " << level);
+		}
+		else if (average < 0.6 * slo_ms && level > 0 && since_change > 2.0)
+		{
+			level--;
+			last_change = now;
+			INFO_STREAM("Latency of " << average << "ms back within the objective, shedding at level " << level);
+		}
+		METRICS_GAUGE_SET("openface_server_shedding_level", "The load shedding level of the best effort streams (0 for none)", level);
+	}
+
+	// Should the stream be fit with the cheaper settings
+	bool Degrade(bool guaranteed)
+	{
+		std::lock_guard<std::mutex> lock(controller_mutex);
+		return !guaranteed && level >= 1;
+	}
+
+	// Should the given frame (counted from the start of the stream) be processed, or be answered with the last result
+	bool ShouldProcess(bool guaranteed, int frame_count)
+	{
+		std::lock_guard<std::mutex> lock(controller_mutex);
+		return guaranteed || level < 2 || frame_count % level == 0;
+	}
+
+private:
+
+	static const int MAX_LEVEL = 4;
+
+	double slo_ms;
+	int max_streams;
+
+	std::mutex controller_mutex;
+	double average_all;
+	double average_guaranteed;
+	int num_streams;
+	int num_guaranteed;
+	int level;
+	std::chrono::steady_clock::time_point last_change;
+};
+
+//===========================================================================
+/**
+Collecting the frames of all of the streams and processing them in batches. A batch is started once every connected stream has a frame
+waiting, or once the oldest waiting frame has waited for the latency window, and the frames of the batch are processed in parallel
+*/
+class FrameBatcher
+{
+public:
+
+	FrameBatcher(double latency_window_ms, AdmissionController& admission) : latency_window(std::chrono::duration<double, std::milli>(latency_window_ms)),
+		admission(admission), active_streams(0), shedding_streams(0), running(true)
+	{
+		batching_thread = std::thread(&FrameBatcher::Run, this);
+	}
+
+	~FrameBatcher()
+	{
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			running = false;
+		}
+		queue_changed.notify_all();
+		batching_thread.join();
+	}
+
+	void AddStream() { active_streams++; queue_changed.notify_all(); }
+	void RemoveStream() { active_streams--; queue_changed.notify_all(); }
+
+	// The batches do not wait for the streams whose last frame was shed, as their next frame may be shed as well
+	void SetShedding(bool shedding) { shedding_streams += shedding ? 1 : -1; queue_changed.notify_all(); }
+
+	// Blocks until the frame has been processed as part of a batch
+	FrameResult Process(StreamState& stream, const FrameRequest& request)
+	{
+		PendingFrame pending(stream, request);
+		std::future<FrameResult> result = pending.result.get_future();
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			queue.push_back(&pending);
+		}
+		queue_changed.notify_all();
+		return result.get();
+	}
+
+private:
+
+	struct PendingFrame
+	{
+		PendingFrame(StreamState& stream, const FrameRequest& request) : stream(stream), request(request), arrival(std::chrono::steady_clock::now()) {}
+
+		StreamState& stream;
+		const FrameRequest& request;
+		std::chrono::steady_clock::time_point arrival;
+		std::promise<FrameResult> result;
+	};
+
+	void Run()
+	{
+		while (true)
+		{
+			vector<PendingFrame*> batch;
+			{
+				std::unique_lock<std::mutex> lock(queue_mutex);
+				queue_changed.wait(lock, [this]() { return !running || !queue.empty(); });
+				if (!running && queue.empty())
+					return;
+
+				// Waiting for the rest of the streams, up to the latency window after the oldest frame arrived
+				std::chrono::steady_clock::time_point batch_deadline = queue.front()->arrival + std::chrono::duration_cast<std::chrono::steady_clock::duration>(latency_window);
+				queue_changed.wait_until(lock, batch_deadline, [this]() { return !running || (int)queue.size() >= active_streams - shedding_streams; });
+
+				batch.assign(queue.begin(), queue.end());
+				queue.clear();
+			}
+
+			std::chrono::steady_clock::time_point batch_start = std::chrono::steady_clock::now();
+			Utilities::Concurrency::Execute([&batch, &batch_start, this]()
+			{
+				tbb::parallel_for(0, (int)batch.size(), [&batch, &batch_start, this](int i)
+				{
+					// The frame is only handed back once it has been observed, as the pending frame lives on the stream's thread
+					PendingFrame& pending = *batch[i];
+					try
+					{
+						FrameResult result = pending.stream.Process(pending.request);
+						std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+						admission.Observe(pending.stream.guaranteed, std::chrono::duration<double, std::milli>(batch_start - pending.arrival).count(),
+							std::chrono::duration<double, std::milli>(end - batch_start).count(), batch.size());
+						pending.result.set_value(result);
+					}
+					catch (...)
+					{
+						pending.result.set_exception(std::current_exception());
+					}
+				});
+			});
+		}
+	}
+
+	std::chrono::duration<double, std::milli> latency_window;
+	AdmissionController& admission;
+	std::atomic<int> active_streams;
+	std::atomic<int> shedding_streams;
+
+	std::mutex queue_mutex;
+	std::condition_variable queue_changed;
+	std::deque<PendingFrame*> queue;
+	bool running;
+
+	std::thread batching_thread;
+};
+
+//===========================================================================
+// Reading a frame message after its magic number, returns false if the connection was closed or the message is malformed
+static bool ReadFrame(boost::asio::ip::tcp::socket& socket, uint32_t magic, FrameRequest& request)
+{
+	uint32_t width = 0, height = 0, channels = 0;
+	if (magic != FRAME_MAGIC)
+		return false;
+
+	if (!ReadValue(socket, width) || !ReadValue(socket, height) || !ReadValue(socket, channels) || !ReadValue(socket, request.time_stamp) ||
+		!ReadValue(socket, request.fx) || !ReadValue(socket, request.fy) || !ReadValue(socket, request.cx) || !ReadValue(socket, request.cy))
+		return false;
+
+	if (width == 0 || height == 0 || width > MAX_FRAME_SIDE || height > MAX_FRAME_SIDE || (channels != 1 && channels != 3))
+	{
+		WARN_STREAM("Malformed frame of " << width << "x" << height << "x" << channels);
+		return false;
+	}
+
+	request.captured_image.create((int)height, (int)width, channels == 3 ? CV_8UC3 : CV_8UC1);
+	boost::system::error_code error;
+	boost::asio::read(socket, boost::asio::buffer(request.captured_image.data, (size_t)width * height * channels), error);
+	return !error;
+}
+
+static void WriteResult(MessageWriter& message, const FrameResult& result)
+{
+	message.Add(RESULT_MAGIC);
+	message.Add((uint32_t)result.frame_number);
+	message.Add((uint8_t)(result.detection_success ? 1 : 0));
+	message.Add(result.detection_certainty);
+	for (int i = 0; i < 6; ++i)
+		message.Add(result.pose[i]);
+	message.Add(result.gaze_angle[0]);
+	message.Add(result.gaze_angle[1]);
+
+	int n = result.landmarks.rows / 2;
+	message.Add((uint32_t)n);
+	for (int i = 0; i < 2 * n; ++i)
+		message.Add(result.landmarks.at<float>(i));
+
+	for (size_t i = 0; i < result.aus_reg.size(); ++i)
+		message.Add((float)result.aus_reg[i].second);
+	for (size_t i = 0; i < result.aus_class.size(); ++i)
+		message.Add((float)result.aus_class[i].second);
+}
+
+// Serving a single stream until the client disconnects
+static void ServeStream(std::shared_ptr<boost::asio::ip::tcp::socket> socket, FrameBatcher& batcher, AdmissionController& admission,
+	const LandmarkDetector::CLNF& face_model, const LandmarkDetector::FaceModelParameters& det_parameters, const FaceAnalysis::FaceAnalyser& face_analyser)
+{
+	boost::system::error_code error;
+	socket->set_option(boost::asio::ip::tcp::no_delay(true), error);
+
+	StreamState stream(face_model, det_parameters, face_analyser);
+
+	// The AU names are only sent once, the results then only contain the values in the same order
+	MessageWriter hello;
+	hello.Add(HELLO_MAGIC);
+	vector<string> au_reg_names = face_analyser.GetAURegNames();
+	vector<string> au_class_names = face_analyser.GetAUClassNames();
+	hello.Add((uint32_t)au_reg_names.size());
+	for (size_t i = 0; i < au_reg_names.size(); ++i)
+		hello.AddString(au_reg_names[i]);
+	hello.Add((uint32_t)au_class_names.size());
+	for (size_t i = 0; i < au_class_names.size(); ++i)
+		hello.AddString(au_class_names[i]);
+	boost::asio::write(*socket, boost::asio::buffer(hello.Data()), error);
+	if (error)
+		return;
+
+	// The tier can only be declared before the first frame, which is when the stream is admitted
+	uint32_t magic = 0;
+	bool connected = ReadValue(*socket, magic);
+	if (connected && magic == TIER_MAGIC)
+	{
+		uint32_t tier = 0;
+		connected = ReadValue(*socket, tier) && ReadValue(*socket, magic);
+		stream.guaranteed = tier == 1;
+	}
+
+	if (connected && !admission.Admit(stream.guaranteed))
+	{
+		WARN_STREAM("Refusing a " << (stream.guaranteed ? "guaranteed" : "best effort") << " stream from " << socket->remote_endpoint(error) << " under the current load");
+		METRICS_INCREMENT("openface_server_refused_streams_total", "The streams refused by the admission control");
+		connected = false;
+	}
+	if (!connected)
+	{
+		socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both, error);
+		socket->close(error);
+		return;
+	}
+
+	batcher.AddStream();
+
+	FrameRequest request;
+	FrameResult result;
+	bool has_result = false;
+	bool shedding = false;
+	for (int frame_count = 0; ReadFrame(*socket, magic, request); ++frame_count)
+	{
+		bool process = !has_result || admission.ShouldProcess(stream.guaranteed, frame_count);
+		if (process == shedding)
+		{
+			shedding = !process;
+			batcher.SetShedding(shedding);
+		}
+
+		if (!process)
+		{
+			METRICS_INCREMENT("openface_server_shed_frames_total", "The frames of the best effort streams answered with their last result");
+		}
+		else
+		{
+			try
+			{
+				stream.degraded = admission.Degrade(stream.guaranteed);
+				result = batcher.Process(stream, request);
+				has_result = true;
+			}
+			catch (const std::exception& e)
+			{
+				ERROR_STREAM("Processing a frame failed: " << e.what());
+				break;
+			}
+		}
+
+		MessageWriter message;
+		WriteResult(message, result);
+		boost::asio::write(*socket, boost::asio::buffer(message.Data()), error);
+		if (error || !ReadValue(*socket, magic))
+			break;
+	}
+
+	if (shedding)
+		batcher.SetShedding(false);
+	batcher.RemoveStream();
+	admission.Release(stream.guaranteed);
+	socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both, error);
+	socket->close(error);
+}
+
+int main(int argc, char **argv)
+{
+
+	vector<string> arguments = get_arguments(argc, argv);
+
+	// The number of threads used for the processing (-threads <n>, all of the cores by default)
+	Utilities::Concurrency::ParseArguments(arguments);
+
+	// The port to listen on (-port <port>) and how long to wait for the other streams before processing a batch (-latency_ms <ms>), the latency
+	// objective of the guaranteed streams (-slo_ms <ms>, 0 for no load shedding) and the most streams to admit (-max_streams <n>, 0 for any)
+	int port = 9000;
+	double latency_window_ms = 5;
+	double slo_ms = 0;
+	int max_streams = 0;
+	int metrics_port = 0;
+	for (size_t i = 0; i + 1 < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-port") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> port;
+			arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+			i--;
+		}
+		else if (arguments[i].compare("-latency_ms") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> latency_window_ms;
+			arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+			i--;
+		}
+		else if (arguments[i].compare("-slo_ms") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> slo_ms;
+			arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+			i--;
+		}
+		else if (arguments[i].compare("-max_streams") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> max_streams;
+			arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+			i--;
+		}
+		else if (arguments[i].compare("-metrics_port") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> metrics_port;
+			arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+			i--;
+		}
+	}
+
+	// Load the models once, the streams share the weights
+	LandmarkDetector::FaceModelParameters det_parameters(arguments);
+	LandmarkDetector::CLNF face_model(det_parameters.model_location);
+
+	if (!face_model.loaded_successfully)
+	{
+		ERROR_STREAM("Could not load the landmark detector");
+		return 1;
+	}
+
+	FaceAnalysis::FaceAnalyserParameters face_analysis_params(arguments);
+	FaceAnalysis::FaceAnalyser face_analyser(face_analysis_params);
+	face_analyser.SetRequestedOutputs(FaceAnalysis::FaceAnalyser::OUTPUT_AU_INTENSITY | FaceAnalysis::FaceAnalyser::OUTPUT_AU_PRESENCE | FaceAnalysis::FaceAnalyser::OUTPUT_DYNAMIC_NORMALISATION);
+
+	if (!face_model.eye_model)
+	{
+		WARN_STREAM("No eye model found, gaze will not be estimated");
+	}
+
+	// Precomputing the caches before the first stream connects
+	face_model.WarmUp(cv::Size(640, 480), det_parameters);
+	face_analyser.WarmUp();
+
+	Utilities::MetricsServer metrics_server;
+	if (metrics_port > 0 && metrics_server.Start(metrics_port))
+	{
+		INFO_STREAM("Serving metrics at http://localhost:" << metrics_port << "/metrics");
+	}
+
+	boost::asio::io_service io_service;
+	boost::asio::ip::tcp::acceptor acceptor(io_service);
+	boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), (unsigned short)port);
+
+	boost::system::error_code error;
+	acceptor.open(endpoint.protocol(), error);
+	if (!error)
+		acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true), error);
+	if (!error)
+		acceptor.bind(endpoint, error);
+	if (!error)
+		acceptor.listen(boost::asio::socket_base::max_connections, error);
+
+	if (error)
+	{
+		ERROR_STREAM("Could not listen on port " << port << ": " << error.message());
+		return 1;
+	}
+
+	INFO_STREAM("Listening for streams on port " << port << ", batching frames within " << latency_window_ms << "ms");
+
+	if (slo_ms > 0)
+	{
+		INFO_STREAM("Shedding the best effort streams when the latency exceeds " << slo_ms << "ms");
+	}
+
+	AdmissionController admission(slo_ms, max_streams);
+	FrameBatcher batcher(latency_window_ms, admission);
+
+	// Every stream is read and answered on its own thread, the processing itself happens in the batches
+	while (true)
+	{
+		std::shared_ptr<boost::asio::ip::tcp::socket> socket = std::make_shared<boost::asio::ip::tcp::socket>(io_service);
+		acceptor.accept(*socket, error);
+		if (error)
+		{
+			WARN_STREAM("Could not accept a connection: " << error.message());
+			continue;
+		}
+
+		INFO_STREAM("Stream connected from " << socket->remote_endpoint(error));
+
+		std::thread(ServeStream, socket, std::ref(batcher), std::ref(admission), std::cref(face_model), std::cref(det_parameters), std::cref(face_analyser)).detach();
+	}
+
+	return 0;
+}
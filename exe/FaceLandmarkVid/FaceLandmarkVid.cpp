@@ -37,10 +37,18 @@
 #include "LandmarkCoreIncludes.h"
 #include "GazeEstimation.h"
 
+#include <AsyncVisualizer.h>
+#include <Concurrency.h>
 #include <SequenceCapture.h>
+#include <MatAllocationCounter.h>
+#include <MemoryReport.h>
+#include <RealtimeMemory.h>
 #include <Visualizer.h>
 #include <VisualizationUtils.h>
 
+// System includes
+#include <memory>
+
 #define INFO_STREAM( stream ) \
 std::cout << stream << std::endl
 
@@ -61,6 +69,9 @@ printErrorAndAbort( std::string( "Fatal error: " ) + stream )
 
 using namespace std;
 
+// The frame buffers faulted in up front in the real-time memory mode, enough for the frames in flight between the capture and the tracking
+const size_t REALTIME_PREFAULT_FRAMES = 8;
+
 vector<string> get_arguments(int argc, char **argv)
 {
 
@@ -78,6 +89,9 @@ int main(int argc, char **argv)
 
 	vector<string> arguments = get_arguments(argc, argv);
 
+	// The number of threads used for the processing (-threads <n>, all of the cores by default)
+	Utilities::Concurrency::ParseArguments(arguments);
+
 	// no arguments: output usage
 	if (arguments.size() == 1)
 	{
@@ -88,6 +102,41 @@ int main(int argc, char **argv)
 
 	LandmarkDetector::FaceModelParameters det_parameters(arguments);
 
+	// Optionally reporting the number of cv::Mat allocations made by the landmark detection of every frame, to check that tracking does not allocate once warmed up
+	bool count_allocations = false;
+
+	// Optionally drawing and showing the tracking from a UI thread, so that the tracking is not held up by the display (-async_vis)
+	bool async_vis = false;
+
+	// Optionally printing the memory of the model components and caches at the end of every sequence (-memory_report)
+	bool memory_report = false;
+	for (size_t i = 0; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-count_allocs") == 0)
+		{
+			count_allocations = true;
+		}
+		else if (arguments[i].compare("-async_vis") == 0)
+		{
+			async_vis = true;
+		}
+		else if (arguments[i].compare("-memory_report") == 0)
+		{
+			memory_report = true;
+		}
+	}
+
+	// The real-time memory mode (-realtime_memory, parsed with the landmark detector parameters) also follows the cv::Mat allocations after the warm up
+	if (count_allocations || det_parameters.realtime_memory)
+	{
+		Utilities::MatAllocationCounter::Instance().Install();
+	}
+	if (det_parameters.realtime_memory)
+	{
+		Utilities::RetainFreedHeap();
+	}
+	Utilities::HeapGrowthMonitor heap_monitor;
+
 	// The modules that are being used for tracking
 	LandmarkDetector::CLNF face_model(det_parameters.model_location);
 	if (!face_model.loaded_successfully)
@@ -106,6 +155,11 @@ int main(int argc, char **argv)
 
 	// A utility for visualizing the results (show just the tracks)
 	Utilities::Visualizer visualizer(true, false, false, false);
+	std::unique_ptr<Utilities::AsyncVisualizer> async_visualizer;
+	if (async_vis)
+	{
+		async_visualizer.reset(new Utilities::AsyncVisualizer(true, false, false, false));
+	}
 
 	// Tracking FPS for visualization
 	Utilities::FpsTracker fps_tracker;
@@ -124,6 +178,23 @@ int main(int argc, char **argv)
 
 		cv::Mat rgb_image = sequence_reader.GetNextFrame();
 
+		// Precompute the lazily filled caches and buffers, so that the first frames are not slower than the rest
+		if (sequence_number == 0 && !rgb_image.empty())
+		{
+			face_model.WarmUp(rgb_image.size(), det_parameters);
+
+			// Then everything should be in memory, the frame buffers are faulted in, all of the pages locked and any further growth reported
+			if (det_parameters.realtime_memory)
+			{
+				sequence_reader.PrefaultBuffers(REALTIME_PREFAULT_FRAMES);
+				if (!Utilities::LockProcessMemory())
+				{
+					WARN_STREAM("could not lock the memory of the process, only the model bundles are locked (the locked memory limit can be raised with ulimit -l)");
+				}
+				heap_monitor.Start();
+			}
+		}
+
 		INFO_STREAM("Starting tracking");
 		while (!rgb_image.empty()) // this is not a for loop as we might also be reading from a webcam
 		{
@@ -131,19 +202,23 @@ int main(int argc, char **argv)
 			// Reading the images
 			cv::Mat_<uchar> grayscale_image = sequence_reader.GetGrayFrame();
 
+			size_t allocations_before = Utilities::MatAllocationCounter::Instance().GetCount();
+
 			// The actual facial landmark detection / tracking
-			bool detection_success = LandmarkDetector::DetectLandmarksInVideo(rgb_image, face_model, det_parameters, grayscale_image);
+			bool detection_success = LandmarkDetector::DetectLandmarksInVideo(rgb_image, face_model, det_parameters, grayscale_image, sequence_reader.time_stamp);
+
+			if (count_allocations)
+			{
+				INFO_STREAM("Frame " << sequence_reader.GetFrameNumber() << ": " << Utilities::MatAllocationCounter::Instance().GetCount() - allocations_before << " cv::Mat allocations in landmark detection");
+			}
 
 			// Gaze tracking, absolute gaze direction
-			cv::Point3f gazeDirection0(0, 0, -1);
-			cv::Point3f gazeDirection1(0, 0, -1);
+			GazeAnalysis::GazeResult gaze;
+			gaze.gaze_direction0 = cv::Point3f(0, 0, -1);
+			gaze.gaze_direction1 = cv::Point3f(0, 0, -1);
 
 			// If tracking succeeded and we have an eye model, estimate gaze
-			if (detection_success && face_model.eye_model)
-			{
-				GazeAnalysis::EstimateGaze(face_model, gazeDirection0, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy, true);
-				GazeAnalysis::EstimateGaze(face_model, gazeDirection1, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy, false);
-			}
+			GazeAnalysis::EstimateGazeBoth(face_model, gaze, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy, detection_success && face_model.eye_model);
 
 			// Work out the pose of the head from the tracked model
 			cv::Vec6d pose_estimate = LandmarkDetector::GetPose(face_model, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy);
@@ -152,13 +227,27 @@ int main(int argc, char **argv)
 			fps_tracker.AddFrame();
 
 			// Displaying the tracking visualizations
-			visualizer.SetImage(rgb_image, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy);
-			visualizer.SetObservationLandmarks(face_model.detected_landmarks, face_model.detection_certainty, face_model.GetVisibilities());
-			visualizer.SetObservationPose(pose_estimate, face_model.detection_certainty);
-			visualizer.SetObservationGaze(gazeDirection0, gazeDirection1, LandmarkDetector::CalculateAllEyeLandmarks(face_model), LandmarkDetector::Calculate3DEyeLandmarks(face_model, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy), face_model.detection_certainty);
-			visualizer.SetFps(fps_tracker.GetFPS());
-			// detect key presses (due to pecularities of OpenCV, you can get it when displaying images)
-			char character_press = visualizer.ShowObservation();
+			char character_press;
+			if (async_visualizer)
+			{
+				async_visualizer->SetImage(rgb_image, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy);
+				async_visualizer->SetObservationLandmarks(face_model.detected_landmarks, face_model.detection_certainty, face_model.GetVisibilities());
+				async_visualizer->SetObservationPose(pose_estimate, face_model.detection_certainty);
+				async_visualizer->SetObservationGaze(gaze.gaze_direction0, gaze.gaze_direction1, gaze.eye_landmarks_2D, gaze.eye_landmarks_3D, face_model.detection_certainty);
+				async_visualizer->SetFps(fps_tracker.GetFPS());
+				async_visualizer->Submit();
+				character_press = async_visualizer->GetKey();
+			}
+			else
+			{
+				visualizer.SetImage(rgb_image, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy);
+				visualizer.SetObservationLandmarks(face_model.detected_landmarks, face_model.detection_certainty, face_model.GetVisibilities());
+				visualizer.SetObservationPose(pose_estimate, face_model.detection_certainty);
+				visualizer.SetObservationGaze(gaze.gaze_direction0, gaze.gaze_direction1, gaze.eye_landmarks_2D, gaze.eye_landmarks_3D, face_model.detection_certainty);
+				visualizer.SetFps(fps_tracker.GetFPS());
+				// detect key presses (due to pecularities of OpenCV, you can get it when displaying images)
+				character_press = visualizer.ShowObservation();
+			}
 
 			// restart the tracker
 			if (character_press == 'r')
@@ -171,11 +260,25 @@ int main(int argc, char **argv)
 				return(0);
 			}
 
+			size_t heap_growth, mat_allocations;
+			if (heap_monitor.Check(heap_growth, mat_allocations))
+			{
+				WARN_STREAM("Frame " << sequence_reader.GetFrameNumber() << ": the heap grew by " << heap_growth << " bytes and " << mat_allocations << " cv::Mat were allocated since the warm up");
+			}
+
 			// Grabbing the next frame in the sequence
 			rgb_image = sequence_reader.GetNextFrame();
 
 		}
 
+		if (memory_report)
+		{
+			Utilities::MemoryReport report;
+			face_model.ReportMemory(report);
+			sequence_reader.ReportMemory(report);
+			report.Print(cout);
+		}
+
 		// Reset the model, for the next video
 		face_model.Reset();
 		sequence_reader.Close();
@@ -35,15 +35,27 @@
 
 // FaceTrackingVidMulti.cpp : Defines the entry point for the multiple face tracking console application.
 #include "LandmarkCoreIncludes.h"
+#include "MultiFaceTracker.h"
 
 #include "VisualizationUtils.h"
 #include "Visualizer.h"
+#include <Concurrency.h>
+#include <MemoryReport.h>
 #include "SequenceCapture.h"
 #include <RecorderOpenFace.h>
 #include <RecorderOpenFaceParameters.h>
+#include <RecorderStream.h>
 #include <GazeEstimation.h>
 #include <FaceAnalyser.h>
 
+// System includes
+#include <algorithm>
+#include <map>
+#include <memory>
+
+// TBB includes
+#include <tbb/tbb.h>
+
 #define INFO_STREAM( stream ) \
 std::cout << stream << std::endl
 
@@ -64,6 +76,9 @@ printErrorAndAbort( std::string( "Fatal error: " ) + stream )
 
 using namespace std;
 
+// How long the analyser of a face that is not tracked anymore is kept for, in case the face is recognised again
+static const double ANALYSER_RELEASE_SECONDS = 10.0;
+
 vector<string> get_arguments(int argc, char **argv)
 {
 
@@ -76,35 +91,17 @@ vector<string> get_arguments(int argc, char **argv)
 	return arguments;
 }
 
-void NonOverlapingDetections(const vector<LandmarkDetector::CLNF>& clnf_models, vector<cv::Rect_<float> >& face_detections)
-{
-
-	// Go over the model and eliminate detections that are not informative (there already is a tracker there)
-	for (size_t model = 0; model < clnf_models.size(); ++model)
-	{
-
-		// See if the detections intersect
-		cv::Rect_<float> model_rect = clnf_models[model].GetBoundingBox();
-
-		for (int detection = face_detections.size() - 1; detection >= 0; --detection)
-		{
-			double intersection_area = (model_rect & face_detections[detection]).area();
-			double union_area = model_rect.area() + face_detections[detection].area() - 2 * intersection_area;
-
-			// If the model is already tracking what we're detecting ignore the detection, this is determined by amount of overlap
-			if (intersection_area / union_area > 0.5)
-			{
-				face_detections.erase(face_detections.begin() + detection);
-			}
-		}
-	}
-}
-
 int main(int argc, char **argv)
 {
 
 	vector<string> arguments = get_arguments(argc, argv);
 
+	// The number of threads used for the processing (-threads <n>, all of the cores by default)
+	Utilities::Concurrency::ParseArguments(arguments);
+
+	// When the results are streamed to stdout (-stream stdout) the log goes to stderr
+	Utilities::RecorderStream::ReserveStdout(arguments);
+
 	// no arguments: output usage
 	if (arguments.size() == 1)
 	{
@@ -113,22 +110,66 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
+	// The maximum number of faces tracked at the same time (-max_faces <n>, not limited by default)
+	int max_faces = -1;
+	for (size_t i = 1; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-max_faces") == 0 && i + 1 < arguments.size())
+		{
+			stringstream data(arguments[i + 1]);
+			data >> max_faces;
+			arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+			break;
+		}
+	}
+
+	// The compute budget per frame when there are many faces (-priority_budget <full> <degraded>): the <full> faces of the highest priority
+	// (the largest and most central ones) are fit fully, the next <degraded> ones at a reduced quality and the rest just rigidly on every other frame
+	int full_quality_faces = -1;
+	int degraded_faces = -1;
+	for (size_t i = 1; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-priority_budget") == 0 && i + 2 < arguments.size())
+		{
+			stringstream data(arguments[i + 1] + " " + arguments[i + 2]);
+			data >> full_quality_faces >> degraded_faces;
+			arguments.erase(arguments.begin() + i, arguments.begin() + i + 3);
+			break;
+		}
+	}
+
+	// Dynamic (person normalised) AUs with an analyser per face (-au_dynamic), instead of the static AUs of a single shared analyser
+	bool dynamic_aus = false;
+	for (size_t i = 1; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-au_dynamic") == 0)
+		{
+			dynamic_aus = true;
+			arguments.erase(arguments.begin() + i);
+			break;
+		}
+	}
+
+	// Printing the memory of the trackers, analysers and queues at the end of every sequence (-memory_report), the model weights
+	// shared by the trackers are counted once, so the per face entries show what every further face costs
+	bool memory_report = false;
+	for (size_t i = 1; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-memory_report") == 0)
+		{
+			memory_report = true;
+			arguments.erase(arguments.begin() + i);
+			break;
+		}
+	}
+
 	LandmarkDetector::FaceModelParameters det_params(arguments);
 	// This is so that the model would not try re-initialising itself
 	det_params.reinit_video_every = -1;
 
 	det_params.curr_face_detector = LandmarkDetector::FaceModelParameters::MTCNN_DETECTOR;
 
-	vector<LandmarkDetector::FaceModelParameters> det_parameters;
-	det_parameters.push_back(det_params);
-
-	// The modules that are being used for tracking
-	vector<LandmarkDetector::CLNF> face_models;
-	vector<bool> active_models;
-
-	int num_faces_max = 4;
-
-	LandmarkDetector::CLNF face_model(det_parameters[0].model_location);
+	LandmarkDetector::CLNF face_model(det_params.model_location);
 
 	if (!face_model.loaded_successfully)
 	{
@@ -137,34 +178,36 @@ int main(int argc, char **argv)
 	}
 
 	// Loading the face detectors
-	face_model.face_detector_HAAR.load(det_parameters[0].haar_face_detector_location);
-	face_model.haar_face_detector_location = det_parameters[0].haar_face_detector_location;
-	face_model.face_detector_MTCNN.Read(det_parameters[0].mtcnn_face_detector_location);
-	face_model.mtcnn_face_detector_location = det_parameters[0].mtcnn_face_detector_location;
+	face_model.face_detector_HAAR.load(det_params.haar_face_detector_location);
+	face_model.haar_face_detector_location = det_params.haar_face_detector_location;
+	face_model.face_detector_MTCNN.Read(det_params.mtcnn_face_detector_location);
+	face_model.mtcnn_face_detector_location = det_params.mtcnn_face_detector_location;
 
 	// If can't find MTCNN face detector, default to HOG one
-	if (det_parameters[0].curr_face_detector == LandmarkDetector::FaceModelParameters::MTCNN_DETECTOR && face_model.face_detector_MTCNN.empty())
+	if (det_params.curr_face_detector == LandmarkDetector::FaceModelParameters::MTCNN_DETECTOR && face_model.face_detector_MTCNN.empty())
 	{
 		cout << "INFO: defaulting to HOG-SVM face detector" << endl;
-		det_parameters[0].curr_face_detector = LandmarkDetector::FaceModelParameters::HOG_SVM_DETECTOR;
+		det_params.curr_face_detector = LandmarkDetector::FaceModelParameters::HOG_SVM_DETECTOR;
 	}
 
-	face_models.reserve(num_faces_max);
-
-	face_models.push_back(face_model);
-	active_models.push_back(false);
+	// The trackers for the faces are created as the faces appear (sharing the model weights) and released when they disappear
+	LandmarkDetector::MultiFaceTracker face_tracker(face_model, det_params, max_faces);
+	face_tracker.SetPriorityBudget(full_quality_faces, degraded_faces);
 
-	for (int i = 1; i < num_faces_max; ++i)
+	// Load facial feature extractor and AU analyser. Every analysed face gets a copy of it (the copies share the AU models, only the latest
+	// features and, for dynamic AUs, the running medians and the history are per face), so the faces can be analysed in parallel
+	FaceAnalysis::FaceAnalyserParameters face_analysis_params(arguments);
+	if (!dynamic_aus)
 	{
-		face_models.push_back(face_model);
-		active_models.push_back(false);
-		det_parameters.push_back(det_params);
+		face_analysis_params.OptimizeForImages();
+	}
+	else
+	{
+		face_analysis_params.postprocess_offline = false;
 	}
-
-	// Load facial feature extractor and AU analyser (make sure it is static, as we don't reidentify faces)
-	FaceAnalysis::FaceAnalyserParameters face_analysis_params(arguments);
-	face_analysis_params.OptimizeForImages();
 	FaceAnalysis::FaceAnalyser face_analyser(face_analysis_params);
+	std::map<int, std::unique_ptr<FaceAnalysis::FaceAnalyser> > face_analysers;
+	std::map<int, double> analyser_last_seen;
 
 	if (!face_model.eye_model)
 	{
@@ -210,6 +253,7 @@ int main(int argc, char **argv)
 		}
 
 		Utilities::RecorderOpenFace open_face_rec(sequence_reader.name, recording_params, arguments);
+		visualizer.record_track = recording_params.outputTracked();
 
 		if (sequence_reader.IsWebcam())
 		{
@@ -222,6 +266,10 @@ int main(int argc, char **argv)
 			INFO_STREAM("WARNING: using a AU detection in multiple face mode, it might not be as accurate and is experimental");
 		}
 
+		// The faces of the previous video are gone
+		face_analysers.clear();
+		analyser_last_seen.clear();
+
 		// For reporting progress
 		double reported_completion = 0;
 
@@ -232,148 +280,120 @@ int main(int argc, char **argv)
 			// Reading the images
 			cv::Mat_<uchar> grayscale_image = sequence_reader.GetGrayFrame();
 
-			vector<cv::Rect_<float> > face_detections;
-
-			bool all_models_active = true;
-			for (unsigned int model = 0; model < face_models.size(); ++model)
-			{
-				if (!active_models[model])
-				{
-					all_models_active = false;
-				}
-			}
-
-			// Get the detections (every 8th frame and when there are free models available for tracking)
-			if (frame_count % 8 == 0 && !all_models_active)
-			{
-				if (det_parameters[0].curr_face_detector == LandmarkDetector::FaceModelParameters::HOG_SVM_DETECTOR)
-				{
-					vector<float> confidences;
-					LandmarkDetector::DetectFacesHOG(face_detections, grayscale_image, face_models[0].face_detector_HOG, confidences);
-				}
-				else if (det_parameters[0].curr_face_detector == LandmarkDetector::FaceModelParameters::HAAR_DETECTOR)
-				{
-					LandmarkDetector::DetectFaces(face_detections, grayscale_image, face_models[0].face_detector_HAAR);
-				}
-				else
-				{
-					vector<float> confidences;
-					LandmarkDetector::DetectFacesMTCNN(face_detections, rgb_image, face_models[0].face_detector_MTCNN, confidences);
-				}
+			// Detecting new faces and tracking the ones present
+			face_tracker.Track(rgb_image, grayscale_image, sequence_reader.time_stamp);
 
-			}
+			// Keeping track of FPS
+			fps_tracker.AddFrame();
 
-			// Keep only non overlapping detections (also convert to a concurrent vector
-			NonOverlapingDetections(face_models, face_detections);
+			visualizer.SetImage(rgb_image, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy);
 
-			vector<tbb::atomic<bool> > face_detections_used(face_detections.size());
+			// Perform AU detection and HOG feature extraction, as this can be expensive only compute it if needed by output or visualization
+			bool analyse_faces = recording_params.outputAlignedFaces() || recording_params.outputHOG() || recording_params.outputAUs() || visualizer.vis_align || visualizer.vis_hog;
 
-			// Go through every model and update the tracking
-			//tbb::parallel_for(0, (int)face_models.size(), [&](int model) {
-			for (unsigned int model = 0; model < face_models.size(); ++model)
+			// The analysers of the faces, created serially when a face first appears. When analysing, every face works on its own copy
+			// (sharing the AU models), so the faces can be analysed in parallel
+			size_t num_faces = face_tracker.GetNumFaces();
+			std::vector<FaceAnalysis::FaceAnalyser*> analysers(num_faces, &face_analyser);
+			if (analyse_faces || dynamic_aus)
 			{
-
-				bool detection_success = false;
-
-				// If the current model has failed more than 4 times in a row, remove it
-				if (face_models[model].failures_in_a_row > 4)
+				for (size_t face = 0; face < num_faces; ++face)
 				{
-					active_models[model] = false;
-					face_models[model].Reset();
-				}
-
-				// If the model is inactive reactivate it with new detections
-				if (!active_models[model])
-				{
-
-					for (size_t detection_ind = 0; detection_ind < face_detections.size(); ++detection_ind)
+					std::unique_ptr<FaceAnalysis::FaceAnalyser>& face_analyser_ptr = face_analysers[face_tracker.GetFaceId(face)];
+					if (!face_analyser_ptr)
 					{
-						// if it was not taken by another tracker take it (if it is false swap it to true and enter detection, this makes it parallel safe)
-						if (face_detections_used[detection_ind].compare_and_swap(true, false) == false)
-						{
-
-							// Reinitialise the model
-							face_models[model].Reset();
-
-							// This ensures that a wider window is used for the initial landmark localisation
-							face_models[model].detection_success = false;
-							detection_success = LandmarkDetector::DetectLandmarksInVideo(rgb_image, face_detections[detection_ind], face_models[model], det_parameters[model], grayscale_image);
-
-							// This activates the model
-							active_models[model] = true;
-
-							// break out of the loop as the tracker has been reinitialised
-							break;
-						}
-
+						face_analyser_ptr.reset(new FaceAnalysis::FaceAnalyser(face_analyser));
 					}
-				}
-				else
-				{
-					// The actual facial landmark detection / tracking
-					detection_success = LandmarkDetector::DetectLandmarksInVideo(rgb_image, face_models[model], det_parameters[model], grayscale_image);
+					analysers[face] = face_analyser_ptr.get();
 				}
 			}
-			//});
 
-			// Keeping track of FPS
-			fps_tracker.AddFrame();
+			// Head pose, eye gaze and the face analysis of every face, they do not depend on each other
+			std::vector<cv::Vec6d> pose_estimates(num_faces);
+			std::vector<GazeAnalysis::GazeResult> gazes(num_faces);
+			std::vector<cv::Mat> sim_warped_imgs(num_faces);
+			std::vector<cv::Mat_<float> > hog_descriptors(num_faces);
+			std::vector<int> num_hog_rows(num_faces, 0), num_hog_cols(num_faces, 0);
 
-			visualizer.SetImage(rgb_image, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy);
+			tbb::parallel_for(0, (int)num_faces, [&](int face) {
 
-			// Go through every model and detect eye gaze, record results and visualise the results
-			for (size_t model = 0; model < face_models.size(); ++model)
-			{
-				// Visualising and recording the results
-				if (active_models[model])
-				{
+				const LandmarkDetector::CLNF& face_result = face_tracker.GetFace(face);
 
-					// Estimate head pose and eye gaze				
-					cv::Vec6d pose_estimate = LandmarkDetector::GetPose(face_models[model], sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy);
+				// Estimate head pose and eye gaze
+				pose_estimates[face] = LandmarkDetector::GetPose(face_result, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy);
 
-					cv::Point3f gaze_direction0(0, 0, 0); cv::Point3f gaze_direction1(0, 0, 0); cv::Vec2d gaze_angle(0, 0);
+				// Detect eye gazes
+				GazeAnalysis::EstimateGazeBoth(face_result, gazes[face], sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy, face_result.detection_success && face_model.eye_model);
 
-					// Detect eye gazes
-					if (face_models[model].detection_success && face_model.eye_model)
+				// Face analysis step
+				if (analyse_faces)
+				{
+					FaceAnalysis::FaceAnalyser* analyser = analysers[face];
+					if (dynamic_aus)
 					{
-						GazeAnalysis::EstimateGaze(face_models[model], gaze_direction0, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy, true);
-						GazeAnalysis::EstimateGaze(face_models[model], gaze_direction1, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy, false);
-						gaze_angle = GazeAnalysis::GetGazeAngle(gaze_direction0, gaze_direction1);
+						analyser->AddNextFrame(rgb_image, face_result.detected_landmarks, face_result.detection_success, sequence_reader.time_stamp, true);
 					}
-
-					// Face analysis step
-					cv::Mat sim_warped_img;
-					cv::Mat_<double> hog_descriptor; int num_hog_rows = 0, num_hog_cols = 0;
-
-					// Perform AU detection and HOG feature extraction, as this can be expensive only compute it if needed by output or visualization
-					if (recording_params.outputAlignedFaces() || recording_params.outputHOG() || recording_params.outputAUs() || visualizer.vis_align || visualizer.vis_hog)
+					else
 					{
-						face_analyser.PredictStaticAUsAndComputeFeatures(rgb_image, face_models[model].detected_landmarks);
-						face_analyser.GetLatestAlignedFace(sim_warped_img);
-						face_analyser.GetLatestHOG(hog_descriptor, num_hog_rows, num_hog_cols);
+						analyser->PredictStaticAUsAndComputeFeatures(rgb_image, face_result.detected_landmarks);
 					}
+					analyser->GetLatestAlignedFace(sim_warped_imgs[face]);
+					analyser->GetLatestHOG(hog_descriptors[face], num_hog_rows[face], num_hog_cols[face]);
+				}
+			});
 
-					// Visualize the features
-					visualizer.SetObservationFaceAlign(sim_warped_img);
-					visualizer.SetObservationHOG(hog_descriptor, num_hog_rows, num_hog_cols);
-					visualizer.SetObservationLandmarks(face_models[model].detected_landmarks, face_models[model].detection_certainty);
-					visualizer.SetObservationPose(LandmarkDetector::GetPose(face_models[model], sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy), face_models[model].detection_certainty);
-					visualizer.SetObservationGaze(gaze_direction0, gaze_direction1, LandmarkDetector::CalculateAllEyeLandmarks(face_models[model]), LandmarkDetector::Calculate3DEyeLandmarks(face_models[model], sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy), face_models[model].detection_certainty);
-					visualizer.SetObservationActionUnits(face_analyser.GetCurrentAUsReg(), face_analyser.GetCurrentAUsClass());
-
-					// Output features
-					open_face_rec.SetObservationHOG(face_models[model].detection_success, hog_descriptor, num_hog_rows, num_hog_cols, 31); // The number of channels in HOG is fixed at the moment, as using FHOG
-					open_face_rec.SetObservationActionUnits(face_analyser.GetCurrentAUsReg(), face_analyser.GetCurrentAUsClass());
-					open_face_rec.SetObservationLandmarks(face_models[model].detected_landmarks, face_models[model].GetShape(sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy),
-						face_models[model].params_global, face_models[model].params_local, face_models[model].detection_certainty, face_models[model].detection_success);
-					open_face_rec.SetObservationPose(pose_estimate);
-					open_face_rec.SetObservationGaze(gaze_direction0, gaze_direction1, gaze_angle, LandmarkDetector::CalculateAllEyeLandmarks(face_models[model]), LandmarkDetector::Calculate3DEyeLandmarks(face_models[model], sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy));
-					open_face_rec.SetObservationFaceAlign(sim_warped_img);
-					open_face_rec.SetObservationFaceID(model);
-					open_face_rec.SetObservationTimestamp(sequence_reader.time_stamp);
-					open_face_rec.SetObservationFrameNumber(sequence_reader.GetFrameNumber());
-					open_face_rec.WriteObservation();
+			// Record results and visualise them serially, ordered by face id so the output does not depend on the tracker slots
+			std::vector<size_t> face_order(num_faces);
+			for (size_t face = 0; face < num_faces; ++face)
+			{
+				face_order[face] = face;
+			}
+			std::sort(face_order.begin(), face_order.end(), [&](size_t a, size_t b) { return face_tracker.GetFaceId(a) < face_tracker.GetFaceId(b); });
+
+			for (size_t face : face_order)
+			{
+				const LandmarkDetector::CLNF& face_result = face_tracker.GetFace(face);
+				const FaceAnalysis::FaceAnalyser* analyser = analysers[face];
+				const GazeAnalysis::GazeResult& gaze = gazes[face];
+
+				// Visualize the features
+				visualizer.SetObservationFaceAlign(sim_warped_imgs[face]);
+				visualizer.SetObservationHOG(hog_descriptors[face], num_hog_rows[face], num_hog_cols[face]);
+				visualizer.SetObservationLandmarks(face_result.detected_landmarks, face_result.detection_certainty);
+				visualizer.SetObservationPose(pose_estimates[face], face_result.detection_certainty);
+				visualizer.SetObservationGaze(gaze.gaze_direction0, gaze.gaze_direction1, gaze.eye_landmarks_2D, gaze.eye_landmarks_3D, face_result.detection_certainty);
+				visualizer.SetObservationActionUnits(analyser->GetAURegNameTable(), analyser->GetCurrentAURegValues(), analyser->GetAUClassNameTable(), analyser->GetCurrentAUClassValues());
+
+				// Output features
+				open_face_rec.SetObservationHOG(face_result.detection_success, hog_descriptors[face], num_hog_rows[face], num_hog_cols[face], 31); // The number of channels in HOG is fixed at the moment, as using FHOG
+				open_face_rec.SetObservationActionUnits(analyser->GetAURegNameTable(), analyser->GetCurrentAURegValues(), analyser->GetAUClassNameTable(), analyser->GetCurrentAUClassValues());
+				open_face_rec.SetObservationLandmarks(face_result.detected_landmarks, face_result.GetShape(sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy),
+					face_result.params_global, face_result.params_local, face_result.detection_certainty, face_result.detection_success);
+				open_face_rec.SetObservationPose(pose_estimates[face]);
+				open_face_rec.SetObservationGaze(gaze.gaze_direction0, gaze.gaze_direction1, gaze.gaze_angle, gaze.eye_landmarks_2D, gaze.eye_landmarks_3D);
+				open_face_rec.SetObservationFaceAlign(sim_warped_imgs[face]);
+				open_face_rec.SetObservationFaceID(face_tracker.GetFaceId(face));
+				open_face_rec.SetObservationTimestamp(sequence_reader.time_stamp);
+				open_face_rec.SetObservationFrameNumber(sequence_reader.GetFrameNumber());
+				open_face_rec.WriteObservation();
+			}
 
+			// The analysers of the faces that have not been tracked for a while are released, a lost face that is recognised again within
+			// that time resumes its normalisation (it keeps its id)
+			for (size_t face = 0; face < face_tracker.GetNumFaces(); ++face)
+			{
+				analyser_last_seen[face_tracker.GetFaceId(face)] = sequence_reader.time_stamp;
+			}
+			for (auto it = analyser_last_seen.begin(); it != analyser_last_seen.end();)
+			{
+				if (sequence_reader.time_stamp - it->second > ANALYSER_RELEASE_SECONDS)
+				{
+					face_analysers.erase(it->first);
+					it = analyser_last_seen.erase(it);
+				}
+				else
+				{
+					++it;
 				}
 			}
 
@@ -389,11 +409,7 @@ int main(int argc, char **argv)
 			// restart the trackers
 			if (character_press == 'r')
 			{
-				for (size_t i = 0; i < face_models.size(); ++i)
-				{
-					face_models[i].Reset();
-					active_models[i] = false;
-				}
+				face_tracker.Reset();
 			}
 			// quit the application
 			else if (character_press == 'q')
@@ -422,13 +438,23 @@ int main(int argc, char **argv)
 
 		frame_count = 0;
 
-		// Reset the model, for the next video
-		for (size_t model = 0; model < face_models.size(); ++model)
+		if (memory_report)
 		{
-			face_models[model].Reset();
-			active_models[model] = false;
+			Utilities::MemoryReport report;
+			face_tracker.ReportMemory(report);
+			face_analyser.ReportMemory(report);
+			for (std::map<int, std::unique_ptr<FaceAnalysis::FaceAnalyser> >::const_iterator it = face_analysers.begin(); it != face_analysers.end(); ++it)
+			{
+				it->second->ReportMemory(report, "face_analyser_" + to_string(it->first));
+			}
+			sequence_reader.ReportMemory(report);
+			open_face_rec.ReportMemory(report);
+			report.Print(cout);
 		}
 
+		// Reset the model, for the next video
+		face_tracker.Reset();
+
 		INFO_STREAM("Closing output recorder");
 		open_face_rec.Close();
 		INFO_STREAM("Closing input reader");
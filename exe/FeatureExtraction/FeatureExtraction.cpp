@@ -40,13 +40,46 @@
 
 #include <Face_utils.h>
 #include <FaceAnalyser.h>
+#include <ReaderCSV.h>
 #include <GazeEstimation.h>
 #include <RecorderOpenFace.h>
 #include <RecorderOpenFaceParameters.h>
+#include <RecorderStream.h>
+#include <AsyncVisualizer.h>
+#include <Concurrency.h>
+#include <MemoryReport.h>
 #include <SequenceCapture.h>
+#include <JobQueue.h>
+#include <Metrics.h>
+#include <MetricsServer.h>
+#include <MultiSequenceCapture.h>
+#include <NumaNodes.h>
+#include <Tracing.h>
 #include <Visualizer.h>
 #include <VisualizationUtils.h>
 
+// OpenCV includes
+#include <opencv2/imgproc.hpp>
+
+// TBB includes
+#include <tbb/tbb.h>
+
+// System includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 #ifndef CONFIG_DIR
 #define CONFIG_DIR "~"
 #endif
@@ -70,6 +103,321 @@ printErrorAndAbort( std::string( "Fatal error: " ) + stream )
 
 using namespace std;
 
+// Everything computed for a frame that needs to be passed between the processing stages
+struct FrameObservation
+{
+	cv::Mat captured_image;
+	double time_stamp;
+	int frame_number;
+	double progress;
+
+	// Landmark detection / tracking results
+	bool detection_success;
+	bool model_detection_success;
+	float detection_certainty;
+	cv::Mat_<float> detected_landmarks;
+	cv::Mat_<float> shape_3D;
+	cv::Mat_<int> visibilities;
+	cv::Vec6f params_global;
+	cv::Mat_<float> params_local;
+	cv::Vec6d pose_estimate;
+
+	// Gaze results
+	cv::Point3f gaze_direction0;
+	cv::Point3f gaze_direction1;
+	cv::Vec2d gaze_angle;
+	vector<cv::Point2f> eye_landmarks_2D;
+	vector<cv::Point3f> eye_landmarks_3D;
+
+	// Face analysis results
+	cv::Mat sim_warped_img;
+	cv::Mat_<float> hog_descriptor;
+	int num_hog_rows;
+	int num_hog_cols;
+	// In the order of the face analyser's AU name tables
+	vector<float> aus_reg;
+	vector<float> aus_class;
+
+	// Were the results reused from the previous frame, as the face did not change
+	bool reused;
+
+	// The serialised tracker and face analyser states after this frame, if a checkpoint is written for it
+	string tracker_state;
+	string analyser_state;
+
+	FrameObservation() : num_hog_rows(0), num_hog_cols(0), reused(false) {}
+};
+
+// A segment of a long sequence processed on its own (see ProcessSegments), the offline postprocessing is then left to the caller
+struct SequenceSegment
+{
+	// The tracking starts at the begin frame, before the start of the segment, so that it has settled by the start. The frames before the start
+	// are recorded by the previous segment
+	size_t begin_frame;
+	size_t start_frame;
+	size_t end_frame;
+
+	// Filled in by ProcessSequence
+	string csv_file;
+	bool postprocess_aus;
+
+	SequenceSegment() : begin_frame(0), start_frame(0), end_frame(0), postprocess_aus(false) {}
+};
+
+// Which frames a signal computed at a lower rate than the tracking is computed on (about rate times a second by the frame time stamps, on
+// every frame for a rate of 0 or when the time stamps go back)
+struct OutputSchedule
+{
+	explicit OutputSchedule(double rate) : period(rate > 0 ? 1.0 / rate : 0), last_due(-std::numeric_limits<double>::max()) {}
+
+	bool Due(double time_stamp)
+	{
+		// A small tolerance, so that e.g. 10Hz from 30fps is exactly every third frame despite the rounding of the time stamps
+		if (period <= 0 || time_stamp < last_due || time_stamp >= last_due + period - 1e-3)
+		{
+			last_due = time_stamp;
+			return true;
+		}
+		return false;
+	}
+
+	// Roughly how many frames there are per computed one at the given frame rate
+	int FramesPerOutput(double fps) const
+	{
+		return period > 0 && fps > 0 ? std::max(1, (int)std::round(period * fps)) : 1;
+	}
+
+	double period;
+	double last_due;
+};
+
+// Frames in which the face did not change (e.g. static or duplicated frames from fixed cameras) can reuse the results of the previous
+// frame (-skip_static <threshold>, the mean absolute grey level difference of the downsampled face region below which the face has not
+// changed, off by default)
+static float GetStaticFrameThreshold(const vector<string>& arguments)
+{
+	float threshold = -1.0f;
+	for (size_t i = 0; i + 1 < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-skip_static") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> threshold;
+		}
+	}
+	return threshold;
+}
+
+// The visualizations can be drawn and shown from a UI thread of their own (-async_vis), so that the display does not slow down the
+// processing, at the cost of skipping the frames that arrive while the previous one is still being shown
+static bool GetAsyncVisualization(const vector<string>& arguments)
+{
+	for (size_t i = 0; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-async_vis") == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// The memory taken up by the models, caches and queues can be printed at the end of every sequence (-memory_report), while the caches and
+// the history for the offline postprocessing are still filled in
+static bool GetMemoryReport(const vector<string>& arguments)
+{
+	for (size_t i = 0; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-memory_report") == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// The tracking results can be read back from the CSV output of an earlier run instead of tracking the sequence again, e.g. when only the
+// Action Unit models changed (-landmarks_csv <file> for a single sequence, or -landmarks_dir <directory> for the <name>.csv files output
+// for every sequence of a batch)
+static string GetRecordedTrackingFile(const vector<string>& arguments, const string& sequence_name)
+{
+	string filename;
+	for (size_t i = 0; i + 1 < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-landmarks_csv") == 0)
+		{
+			filename = arguments[i + 1];
+		}
+		else if (arguments[i].compare("-landmarks_dir") == 0)
+		{
+			filename = arguments[i + 1] + "/" + sequence_name + ".csv";
+		}
+	}
+	return filename;
+}
+
+// The name of a video or image directory without its location and extension
+static string GetSequenceBaseName(const string& sequence_name)
+{
+	string name = sequence_name;
+	while (!name.empty() && (name.back() == '/' || name.back() == '\\'))
+	{
+		name.pop_back();
+	}
+	name = name.substr(name.find_last_of("/\\") == string::npos ? 0 : name.find_last_of("/\\") + 1);
+	return name.substr(0, name.find_last_of('.'));
+}
+
+// The AU calibration of a returning person can be loaded from their neutral baseline (-baseline_dir <directory> -subject <id>), which is then
+// updated with the sequence once it is processed (not available for segments)
+static void GetBaseline(const vector<string>& arguments, string& baseline_dir, string& subject_id)
+{
+	for (size_t i = 0; i + 1 < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-baseline_dir") == 0)
+		{
+			baseline_dir = arguments[i + 1];
+		}
+		else if (arguments[i].compare("-subject") == 0)
+		{
+			subject_id = arguments[i + 1];
+		}
+	}
+}
+
+// Long sequences can be checkpointed (-checkpoint_dir <directory>, writing <name>.checkpoint there every -checkpoint_every <n> frames, 1000
+// by default), a sequence that was interrupted is then resumed from its last checkpoint when it is processed again with the same arguments
+static string GetCheckpointFile(const vector<string>& arguments, const string& sequence_name, int& checkpoint_every)
+{
+	string directory;
+	checkpoint_every = 1000;
+	for (size_t i = 0; i + 1 < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-checkpoint_dir") == 0)
+		{
+			directory = arguments[i + 1];
+		}
+		else if (arguments[i].compare("-checkpoint_every") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> checkpoint_every;
+		}
+	}
+	if (directory.empty() || checkpoint_every <= 0)
+	{
+		checkpoint_every = 0;
+		return "";
+	}
+
+	return directory + "/" + GetSequenceBaseName(sequence_name) + ".checkpoint";
+}
+
+static const char CHECKPOINT_MAGIC[8] = { 'O', 'F', 'C', 'K', 'P', 'T', '0', '1' };
+
+// The checkpoint of a sequence, the last frame that was recorded, the number of rows in the CSV output and the states after that frame. It
+// is written to a temporary file first, so that an interruption while writing leaves the previous checkpoint in place
+static bool WriteCheckpoint(const string& filename, int64_t frame_number, int64_t csv_rows, const string& tracker_state, const string& analyser_state)
+{
+	string temporary_filename = filename + ".tmp";
+	{
+		std::ofstream out(temporary_filename, std::ios_base::out | std::ios_base::binary);
+		int64_t tracker_size = (int64_t)tracker_state.size();
+		int64_t analyser_size = (int64_t)analyser_state.size();
+		out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+		out.write((const char*)&frame_number, sizeof(frame_number));
+		out.write((const char*)&csv_rows, sizeof(csv_rows));
+		out.write((const char*)&tracker_size, sizeof(tracker_size));
+		out.write(tracker_state.data(), tracker_size);
+		out.write((const char*)&analyser_size, sizeof(analyser_size));
+		out.write(analyser_state.data(), analyser_size);
+		out.close();
+		if (!out)
+		{
+			return false;
+		}
+	}
+
+	// Renaming does not replace an existing file everywhere
+	std::remove(filename.c_str());
+	return std::rename(temporary_filename.c_str(), filename.c_str()) == 0;
+}
+
+static bool ReadCheckpoint(const string& filename, int64_t& frame_number, int64_t& csv_rows, string& tracker_state, string& analyser_state)
+{
+	std::ifstream in(filename, std::ios_base::in | std::ios_base::binary);
+	char magic[sizeof(CHECKPOINT_MAGIC)];
+	int64_t tracker_size, analyser_size;
+	if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), CHECKPOINT_MAGIC) ||
+		!in.read((char*)&frame_number, sizeof(frame_number)) || !in.read((char*)&csv_rows, sizeof(csv_rows)) ||
+		!in.read((char*)&tracker_size, sizeof(tracker_size)) || tracker_size < 0)
+	{
+		return false;
+	}
+	tracker_state.resize((size_t)tracker_size);
+	if ((tracker_size > 0 && !in.read(&tracker_state[0], tracker_size)) || !in.read((char*)&analyser_size, sizeof(analyser_size)) || analyser_size < 0)
+	{
+		return false;
+	}
+	analyser_state.resize((size_t)analyser_size);
+	return analyser_size == 0 || (bool)in.read(&analyser_state[0], analyser_size);
+}
+
+// The face region of a frame downsampled to a small patch, comparing these is cheap and not sensitive to the image noise
+static cv::Mat_<uchar> FacePatch(const cv::Mat_<uchar>& grayscale_image, const cv::Rect_<float>& face_box)
+{
+	cv::Rect region = cv::Rect((int)face_box.x, (int)face_box.y, (int)face_box.width, (int)face_box.height) & cv::Rect(0, 0, grayscale_image.cols, grayscale_image.rows);
+	cv::Mat_<uchar> patch;
+	if (region.area() > 0)
+	{
+		cv::resize(grayscale_image(region), patch, cv::Size(32, 32), 0, 0, cv::INTER_AREA);
+	}
+	return patch;
+}
+
+// Filling in the tracking results of a frame from the recorded ones, the results that were not recorded are worked out from the recorded
+// shape parameters when possible (and are zero otherwise). Frames that were not recorded are treated as failed detections
+static void SetRecordedTracking(FrameObservation& obs, Utilities::ReaderCSV& recorded_tracking, LandmarkDetector::CLNF& face_model, float fx, float fy, float cx, float cy)
+{
+	int num_landmarks = face_model.pdm.NumberOfPoints();
+
+	Utilities::RecordedObservation recorded;
+	bool recorded_frame = recorded_tracking.ReadFrame(obs.frame_number, recorded);
+
+	obs.detection_success = recorded_frame && recorded.success;
+	obs.model_detection_success = obs.detection_success;
+	obs.detection_certainty = recorded_frame ? recorded.confidence : 0.0f;
+	obs.detected_landmarks = recorded_frame ? recorded.landmarks_2D : cv::Mat_<float>(2 * num_landmarks, 1, 0.0f);
+	obs.shape_3D = recorded_frame && recorded_tracking.HasLandmarks3D() ? recorded.landmarks_3D : cv::Mat_<float>(3, num_landmarks, 0.0f);
+	obs.visibilities = cv::Mat_<int>(num_landmarks, 1, 1);
+	obs.params_global = recorded_frame ? recorded.params_global : cv::Vec6f();
+	obs.params_local = recorded_frame && recorded_tracking.HasModelParams() ? recorded.params_local : cv::Mat_<float>(face_model.pdm.NumberOfModes(), 1, 0.0f);
+	obs.pose_estimate = recorded_frame ? recorded.pose_estimate : cv::Vec6d();
+
+	obs.gaze_direction0 = recorded.gaze_direction0;
+	obs.gaze_direction1 = recorded.gaze_direction1;
+	obs.gaze_angle = recorded.gaze_angle;
+	obs.eye_landmarks_2D = recorded.eye_landmarks_2D;
+	obs.eye_landmarks_3D = recorded.eye_landmarks_3D;
+
+	// The model is not tracking, so it can be used to work out the results from the recorded parameters
+	if (recorded_frame && recorded_tracking.HasModelParams())
+	{
+		face_model.params_global = obs.params_global;
+		face_model.params_local = obs.params_local.clone();
+		face_model.detected_landmarks = obs.detected_landmarks.clone();
+
+		if (!recorded_tracking.HasLandmarks3D())
+		{
+			obs.shape_3D = face_model.GetShape(fx, fy, cx, cy);
+		}
+		if (!recorded_tracking.HasPose())
+		{
+			obs.pose_estimate = LandmarkDetector::GetPose(face_model, fx, fy, cx, cy);
+		}
+		obs.visibilities = face_model.GetVisibilities();
+	}
+}
+
 vector<string> get_arguments(int argc, char **argv)
 {
 
@@ -83,192 +431,1519 @@ vector<string> get_arguments(int argc, char **argv)
 	return arguments;
 }
 
-int main(int argc, char **argv)
+// Processing a single opened sequence, tracking and analysing every frame and recording the results
+void ProcessSequence(Utilities::SequenceCapture& sequence_reader, vector<string>& arguments, LandmarkDetector::CLNF& face_model, LandmarkDetector::FaceModelParameters& det_parameters,
+	FaceAnalysis::FaceAnalyser& face_analyser, Utilities::Visualizer& visualizer, Utilities::FpsTracker& fps_tracker, SequenceSegment* segment = NULL)
 {
+	INFO_STREAM("Device or file opened");
 
-	vector<string> arguments = get_arguments(argc, argv);
+	if (sequence_reader.IsWebcam())
+	{
+		INFO_STREAM("WARNING: using a webcam in feature extraction, Action Unit predictions will not be as accurate in real-time webcam mode");
+		INFO_STREAM("WARNING: using a webcam in feature extraction, forcing visualization of tracking to allow quitting the application (press q)");
+		visualizer.vis_track = true;
+	}
 
-	// no arguments: output usage
-	if (arguments.size() == 1)
+	Utilities::RecorderOpenFaceParameters recording_params(arguments, true, sequence_reader.IsWebcam(),
+		sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy, sequence_reader.fps);
+	if (!face_model.eye_model)
 	{
-		cout << "For command line arguments see:" << endl;
-		cout << " https://github.com/TadasBaltrusaitis/OpenFace/wiki/Command-line-arguments";
-		return 0;
+		recording_params.setOutputGaze(false);
 	}
 
-	// Load the modules that are being used for tracking and face analysis
-	// Load face landmark detector
-	LandmarkDetector::FaceModelParameters det_parameters(arguments);
-	// Always track gaze in feature extraction
-	LandmarkDetector::CLNF face_model(det_parameters.model_location);
+	// When only tracking the head pose the eyes and the expression are not fit, so there is no gaze or AUs to output
+	if (det_parameters.pose_only)
+	{
+		recording_params.setOutputGaze(false);
+		recording_params.setOutputAUs(false);
+	}
 
-	if (!face_model.loaded_successfully)
+	// Reusing the tracking results of an earlier run, if they were recorded with the same landmark model
+	Utilities::ReaderCSV recorded_tracking;
+	string recorded_tracking_file = GetRecordedTrackingFile(arguments, sequence_reader.name);
+	if (!recorded_tracking_file.empty() && recorded_tracking.Open(recorded_tracking_file))
 	{
-		cout << "ERROR: Could not load the landmark detector" << endl;
-		return 1;
+		if (recorded_tracking.GetNumLandmarks() != face_model.pdm.NumberOfPoints())
+		{
+			WARN_STREAM("The recorded tracking has " << recorded_tracking.GetNumLandmarks() << " landmarks instead of " << face_model.pdm.NumberOfPoints() << ", tracking the landmarks instead");
+			recorded_tracking.Close();
+		}
+		else if (recorded_tracking.HasModelParams() && recorded_tracking.GetNumModelModes() != face_model.pdm.NumberOfModes())
+		{
+			WARN_STREAM("The recorded tracking was done with a different shape model, tracking the landmarks instead");
+			recorded_tracking.Close();
+		}
+		else
+		{
+			INFO_STREAM("Reusing the tracking results from " << recorded_tracking_file);
+
+			// Gaze that was not recorded can not be output
+			if (!recorded_tracking.HasGaze())
+			{
+				recording_params.setOutputGaze(false);
+			}
+		}
 	}
+	else if (!recorded_tracking_file.empty())
+	{
+		WARN_STREAM("Could not read the recorded tracking from " << recorded_tracking_file << ", tracking the landmarks instead");
+	}
+	bool reuse_tracking = recorded_tracking.isOpen();
 
-	// Load facial feature extractor and AU analyser
-	FaceAnalysis::FaceAnalyserParameters face_analysis_params(arguments);
-	FaceAnalysis::FaceAnalyser face_analyser(face_analysis_params);
+	// Static frames only save on the tracking
+	float static_frame_threshold = reuse_tracking ? -1.0f : GetStaticFrameThreshold(arguments);
+	recording_params.setOutputReused(static_frame_threshold > 0);
+	Utilities::RecorderOpenFace open_face_rec(sequence_reader.name, recording_params, arguments);
 
-	if (!face_model.eye_model)
+	// The recorded file is read while the new output is written, so they can not be the same file
+	if (reuse_tracking && open_face_rec.WritesTo(recorded_tracking_file))
 	{
-		cout << "WARNING: no eye model found" << endl;
+		ERROR_STREAM("The output would overwrite the recorded tracking in " << recorded_tracking_file << ", choose a different output directory");
+		open_face_rec.Close();
+		sequence_reader.Close();
+		return;
 	}
 
-	if (face_analyser.GetAUClassNames().size() == 0 && face_analyser.GetAUClassNames().size() == 0)
+	// Checkpointing supports the CSV output and the aligned faces, the other outputs can not be resumed
+	int checkpoint_every = 0;
+	string checkpoint_file = segment == NULL ? GetCheckpointFile(arguments, sequence_reader.name, checkpoint_every) : "";
+	if (!checkpoint_file.empty() && (sequence_reader.IsWebcam() || recording_params.outputHOG() || recording_params.outputTracked() ||
+		recording_params.outputColumnar() || recording_params.outputAlignedArchive()))
 	{
-		cout << "WARNING: no Action Unit models found" << endl;
+		WARN_STREAM("Checkpoints are only supported for files with the CSV and aligned face outputs, not writing them");
+		checkpoint_file = "";
+		checkpoint_every = 0;
+	}
+	std::atomic<bool> checkpoints_enabled(!checkpoint_file.empty());
+
+	if (recording_params.outputGaze() && !face_model.eye_model)
+		cout << "WARNING: no eye model defined, but outputting gaze" << endl;
+
+	// The tracked video is recorded from the visualization, so it has to be drawn synchronously
+	bool visualizing = visualizer.vis_track || visualizer.vis_align || visualizer.vis_hog || visualizer.vis_aus;
+	std::unique_ptr<Utilities::AsyncVisualizer> async_visualizer;
+	if (visualizing && GetAsyncVisualization(arguments))
+	{
+		if (recording_params.outputTracked())
+		{
+			WARN_STREAM("The tracked video output needs the visualization drawn in order, not visualizing asynchronously");
+		}
+		else
+		{
+			async_visualizer.reset(new Utilities::AsyncVisualizer(visualizer.vis_track, visualizer.vis_hog, visualizer.vis_align, visualizer.vis_aus,
+				visualizer.visualisation_boundary, visualizer.line_type));
+		}
 	}
 
-	Utilities::SequenceCapture sequence_reader;
+	// Only drawing what is shown or recorded
+	visualizer.record_track = recording_params.outputTracked();
+	bool draw_visualization = visualizing || visualizer.record_track;
 
-	// A utility for visualizing the results
-	Utilities::Visualizer visualizer(arguments);
+	// Only compute the face analysis outputs that will be recorded or visualized
+	int analysis_outputs = 0;
+	if (recording_params.outputAlignedFaces() || visualizer.vis_align)
+		analysis_outputs |= FaceAnalysis::FaceAnalyser::OUTPUT_ALIGNED_FACE;
+	if (recording_params.outputHOG() || visualizer.vis_hog)
+		analysis_outputs |= FaceAnalysis::FaceAnalyser::OUTPUT_HOG;
+	if (recording_params.outputAUs() || visualizer.vis_aus)
+		analysis_outputs |= FaceAnalysis::FaceAnalyser::OUTPUT_AU_INTENSITY | FaceAnalysis::FaceAnalyser::OUTPUT_AU_PRESENCE | FaceAnalysis::FaceAnalyser::OUTPUT_DYNAMIC_NORMALISATION;
+	face_analyser.SetRequestedOutputs(analysis_outputs);
 
-	// Tracking FPS for visualization
-	Utilities::FpsTracker fps_tracker;
-	fps_tracker.AddFrame();
+	// The AUs and the gaze can be computed at lower rates than the tracking, repeating the last values in between
+	OutputSchedule au_schedule(recording_params.outputAURate());
+	OutputSchedule gaze_schedule(recording_params.outputGazeRate());
+	face_analyser.SetFramesPerAnalysis(au_schedule.FramesPerOutput(sequence_reader.fps));
+	GazeAnalysis::GazeResult last_gaze;
+	int last_analysed_success = -1;
 
-	while (true) // this is not a for loop as we might also be reading from a webcam
+	string baseline_dir, subject_id;
+	GetBaseline(arguments, baseline_dir, subject_id);
+	bool use_baseline = segment == NULL && !baseline_dir.empty() && !subject_id.empty() && recording_params.outputAUs();
+	if (use_baseline)
 	{
+		if (face_analyser.LoadBaseline(baseline_dir, subject_id))
+		{
+			INFO_STREAM("Calibrating the Action Units with the baseline of " << subject_id);
+		}
+		else
+		{
+			INFO_STREAM("No baseline for " << subject_id << " yet, it is created from this sequence");
+		}
+	}
 
-		// The sequence reader chooses what to open based on command line arguments provided
-		if (!sequence_reader.Open(arguments))
-			break;
+	// Resuming an interrupted sequence from its last checkpoint
+	int64_t checkpoint_frame, checkpoint_rows;
+	string tracker_state, analyser_state;
+	if (checkpoints_enabled && ReadCheckpoint(checkpoint_file, checkpoint_frame, checkpoint_rows, tracker_state, analyser_state))
+	{
+		std::istringstream tracker_stream(tracker_state);
+		std::istringstream analyser_stream(analyser_state);
+		if (face_model.ReadState(tracker_stream) && face_analyser.ReadState(analyser_stream))
+		{
+			INFO_STREAM("Resuming after frame " << checkpoint_frame << " from " << checkpoint_file);
+			open_face_rec.ResumeCSV(checkpoint_rows);
+			if (!sequence_reader.Reopen((size_t)checkpoint_frame))
+			{
+				ERROR_STREAM("Could not reopen the sequence to resume it");
+				open_face_rec.Close();
+				return;
+			}
+		}
+		else
+		{
+			WARN_STREAM("The checkpoint " << checkpoint_file << " does not match the models, starting from the beginning");
+			face_model.Reset();
+			face_analyser.Reset();
+		}
+	}
+
+	// For reporting progress
+	double reported_completion = 0;
 
-		INFO_STREAM("Device or file opened");
+	// The processing of every frame is split into three stages: tracking (landmarks, gaze and pose), face analysis (alignment, HOG and AUs)
+	// and output (visualization and recording). Each stage has to see the frames in order, but different stages can work on different frames
 
-		if (sequence_reader.IsWebcam())
+	// The results of the last tracked frame and its face region, for reusing them in the following frames if the face does not change
+	FrameObservation last_tracked;
+	cv::Mat_<uchar> last_face_patch;
+	cv::Rect_<float> last_face_box;
+
+	// Tracking stage, returns NULL when there are no more frames
+	auto track_next_frame = [&]() -> FrameObservation*
+	{
+		cv::Mat captured_image = sequence_reader.GetNextFrame();
+
+		if (captured_image.empty())
 		{
-			INFO_STREAM("WARNING: using a webcam in feature extraction, Action Unit predictions will not be as accurate in real-time webcam mode");
-			INFO_STREAM("WARNING: using a webcam in feature extraction, forcing visualization of tracking to allow quitting the application (press q)");
-			visualizer.vis_track = true;
+			return NULL;
 		}
 
-		cv::Mat captured_image;
+		FrameObservation* obs = new FrameObservation();
+
+		// The capture can reuse its buffers, so keep a copy for the later stages
+		obs->captured_image = captured_image.clone();
+		obs->time_stamp = sequence_reader.time_stamp;
+		obs->frame_number = sequence_reader.GetFrameNumber();
+		obs->progress = sequence_reader.GetProgress();
 
-		Utilities::RecorderOpenFaceParameters recording_params(arguments, true, sequence_reader.IsWebcam(),
-			sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy, sequence_reader.fps);
-		if (!face_model.eye_model)
+		if (reuse_tracking)
 		{
-			recording_params.setOutputGaze(false);
+			SetRecordedTracking(*obs, recorded_tracking, face_model, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy);
+			return obs;
 		}
-		Utilities::RecorderOpenFace open_face_rec(sequence_reader.name, recording_params, arguments);
 
-		if (recording_params.outputGaze() && !face_model.eye_model)
-			cout << "WARNING: no eye model defined, but outputting gaze" << endl;
+		// Converting to grayscale
+		cv::Mat_<uchar> grayscale_image = sequence_reader.GetGrayFrame();
 
-		captured_image = sequence_reader.GetNextFrame();
+		// Reusing the results of the last tracked frame if the face has not changed since (compared with the tracked frame rather than the
+		// previous one, so that slow changes still add up)
+		if (static_frame_threshold > 0 && !last_face_patch.empty())
+		{
+			cv::Mat_<uchar> face_patch = FacePatch(grayscale_image, last_face_box);
+			if (!face_patch.empty() && cv::norm(face_patch, last_face_patch, cv::NORM_L1) < static_frame_threshold * face_patch.total())
+			{
+				cv::Mat captured = obs->captured_image;
+				double time_stamp = obs->time_stamp;
+				int frame_number = obs->frame_number;
+				double progress = obs->progress;
+
+				*obs = last_tracked;
+				obs->captured_image = captured;
+				obs->time_stamp = time_stamp;
+				obs->frame_number = frame_number;
+				obs->progress = progress;
+				obs->reused = true;
+				return obs;
+			}
+		}
 
-		// For reporting progress
-		double reported_completion = 0;
+		// The actual facial landmark detection / tracking
+		obs->detection_success = LandmarkDetector::DetectLandmarksInVideo(obs->captured_image, face_model, det_parameters, grayscale_image, obs->time_stamp);
 
-		INFO_STREAM("Starting tracking");
-		while (!captured_image.empty())
+		// Gaze tracking, absolute gaze direction, together with the eye landmarks (which are always computed, while the gaze might be
+		// computed at a lower rate, the frames in between then repeat the last gaze)
+		GazeAnalysis::GazeResult gaze;
+		bool estimate_gaze = obs->detection_success && face_model.eye_model && !det_parameters.pose_only;
+		bool gaze_due = gaze_schedule.Due(obs->time_stamp);
+		GazeAnalysis::EstimateGazeBoth(face_model, gaze, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy, estimate_gaze && gaze_due);
+		if (gaze_due)
+		{
+			last_gaze = gaze;
+		}
+		else if (estimate_gaze)
 		{
-			// Converting to grayscale
-			cv::Mat_<uchar> grayscale_image = sequence_reader.GetGrayFrame();
+			gaze.gaze_direction0 = last_gaze.gaze_direction0; gaze.gaze_direction1 = last_gaze.gaze_direction1; gaze.gaze_angle = last_gaze.gaze_angle;
+			gaze.valid = last_gaze.valid;
+		}
+		obs->gaze_direction0 = gaze.gaze_direction0; obs->gaze_direction1 = gaze.gaze_direction1; obs->gaze_angle = gaze.gaze_angle;
 
+		// Work out the pose of the head from the tracked model
+		obs->pose_estimate = LandmarkDetector::GetPose(face_model, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy);
 
-			// The actual facial landmark detection / tracking
-			bool detection_success = LandmarkDetector::DetectLandmarksInVideo(captured_image, face_model, det_parameters, grayscale_image);
-			
-			// Gaze tracking, absolute gaze direction
-			cv::Point3f gazeDirection0(0, 0, 0); cv::Point3f gazeDirection1(0, 0, 0); cv::Vec2d gazeAngle(0, 0);
+		// The model will be updated by the next frame, so copy the state the later stages need
+		obs->model_detection_success = face_model.detection_success;
+		obs->detection_certainty = face_model.detection_certainty;
+		obs->detected_landmarks = face_model.detected_landmarks.clone();
+		obs->shape_3D = face_model.GetShape(sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy);
+		obs->visibilities = face_model.GetVisibilities();
+		obs->params_global = face_model.params_global;
+		obs->params_local = face_model.params_local.clone();
+		obs->eye_landmarks_2D = gaze.eye_landmarks_2D;
+		obs->eye_landmarks_3D = gaze.eye_landmarks_3D;
 
-			if (detection_success && face_model.eye_model)
+		if (static_frame_threshold > 0)
+		{
+			if (obs->model_detection_success)
 			{
-				GazeAnalysis::EstimateGaze(face_model, gazeDirection0, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy, true);
-				GazeAnalysis::EstimateGaze(face_model, gazeDirection1, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy, false);
-				gazeAngle = GazeAnalysis::GetGazeAngle(gazeDirection0, gazeDirection1);
+				last_tracked = *obs;
+				last_tracked.captured_image = cv::Mat();
+				last_face_box = face_model.GetBoundingBox();
+				last_face_patch = FacePatch(grayscale_image, last_face_box);
 			}
-			
-			// Do face alignment
-			cv::Mat sim_warped_img;
-			cv::Mat_<double> hog_descriptor; int num_hog_rows = 0, num_hog_cols = 0;
+			else
+			{
+				last_face_patch = cv::Mat_<uchar>();
+			}
+		}
+
+		return obs;
+	};
+
+	auto track_frame = [&]() -> FrameObservation*
+	{
+		FrameObservation* obs = track_next_frame();
+
+		// The state of the tracker after a checkpointed frame, the checkpoint is written once the later stages are done with the frame
+		if (obs != NULL && checkpoints_enabled && obs->frame_number % checkpoint_every == 0)
+		{
+			std::ostringstream state;
+			face_model.WriteState(state);
+			obs->tracker_state = state.str();
+		}
+		return obs;
+	};
+
+	// Face analysis stage
+	auto analyse_frame = [&](FrameObservation& obs)
+	{
+		// Perform AU detection and HOG feature extraction, as this can be expensive only compute it if needed by output or visualization. At a
+		// lower AU rate the frames in between repeat the last analysed one, unless the tracking succeeded or failed since
+		bool au_due = au_schedule.Due(obs.time_stamp);
+		if (analysis_outputs != 0 && (obs.reused || (!au_due && last_analysed_success == (int)obs.model_detection_success)))
+		{
+			face_analyser.RepeatLastFrame(obs.time_stamp);
+			face_analyser.GetLatestAlignedFace(obs.sim_warped_img);
+			face_analyser.GetLatestHOG(obs.hog_descriptor, obs.num_hog_rows, obs.num_hog_cols);
+		}
+		else if (analysis_outputs != 0)
+		{
+			face_analyser.AddNextFrame(obs.captured_image, obs.detected_landmarks, obs.model_detection_success, obs.time_stamp, sequence_reader.IsWebcam());
+			face_analyser.GetLatestAlignedFace(obs.sim_warped_img);
+			face_analyser.GetLatestHOG(obs.hog_descriptor, obs.num_hog_rows, obs.num_hog_cols);
+			last_analysed_success = obs.model_detection_success;
+		}
+		obs.aus_reg = face_analyser.GetCurrentAURegValues();
+		obs.aus_class = face_analyser.GetCurrentAUClassValues();
 
-			// Perform AU detection and HOG feature extraction, as this can be expensive only compute it if needed by output or visualization
-			if (recording_params.outputAlignedFaces() || recording_params.outputHOG() || recording_params.outputAUs() || visualizer.vis_align || visualizer.vis_hog || visualizer.vis_aus)
+		if (!obs.tracker_state.empty())
+		{
+			std::ostringstream state;
+			if (face_analyser.WriteState(state))
+			{
+				obs.analyser_state = state.str();
+			}
+			else
 			{
-				face_analyser.AddNextFrame(captured_image, face_model.detected_landmarks, face_model.detection_success, sequence_reader.time_stamp, sequence_reader.IsWebcam());
-				face_analyser.GetLatestAlignedFace(sim_warped_img);
-				face_analyser.GetLatestHOG(hog_descriptor, num_hog_rows, num_hog_cols);
+				WARN_STREAM("Could not checkpoint the face analyser, not writing checkpoints");
+				checkpoints_enabled = false;
 			}
-			
-			// Work out the pose of the head from the tracked model
-			cv::Vec6d pose_estimate = LandmarkDetector::GetPose(face_model, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy);
+		}
+	};
 
-			// Keeping track of FPS
-			fps_tracker.AddFrame();
+	// Output stage, returns false if the processing of the sequence should be stopped
+	auto output_frame = [&](FrameObservation& obs) -> bool
+	{
+		// Keeping track of FPS
+		fps_tracker.AddFrame();
+
+		if (async_visualizer)
+		{
+			async_visualizer->SetImage(obs.captured_image, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy);
+			async_visualizer->SetObservationFaceAlign(obs.sim_warped_img);
+			async_visualizer->SetObservationHOG(obs.hog_descriptor, obs.num_hog_rows, obs.num_hog_cols);
+			async_visualizer->SetObservationLandmarks(obs.detected_landmarks, obs.detection_certainty, obs.visibilities);
+			async_visualizer->SetObservationPose(obs.pose_estimate, obs.detection_certainty);
+			async_visualizer->SetObservationGaze(obs.gaze_direction0, obs.gaze_direction1, obs.eye_landmarks_2D, obs.eye_landmarks_3D, obs.detection_certainty);
+			async_visualizer->SetObservationActionUnits(face_analyser.GetAURegNameTable(), obs.aus_reg, face_analyser.GetAUClassNameTable(), obs.aus_class);
+			async_visualizer->SetFps(fps_tracker.GetFPS());
+			async_visualizer->Submit();
 
+			if (async_visualizer->GetKey() == 'q')
+			{
+				return false;
+			}
+		}
+		else if (draw_visualization)
+		{
 			// Displaying the tracking visualizations
-			visualizer.SetImage(captured_image, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy);
-			visualizer.SetObservationFaceAlign(sim_warped_img);
-			visualizer.SetObservationHOG(hog_descriptor, num_hog_rows, num_hog_cols);
-			visualizer.SetObservationLandmarks(face_model.detected_landmarks, face_model.detection_certainty, face_model.GetVisibilities());
-			visualizer.SetObservationPose(pose_estimate, face_model.detection_certainty);
-			visualizer.SetObservationGaze(gazeDirection0, gazeDirection1, LandmarkDetector::CalculateAllEyeLandmarks(face_model), LandmarkDetector::Calculate3DEyeLandmarks(face_model, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy), face_model.detection_certainty);
-			visualizer.SetObservationActionUnits(face_analyser.GetCurrentAUsReg(), face_analyser.GetCurrentAUsClass());
+			visualizer.SetImage(obs.captured_image, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy);
+			visualizer.SetObservationFaceAlign(obs.sim_warped_img);
+			visualizer.SetObservationHOG(obs.hog_descriptor, obs.num_hog_rows, obs.num_hog_cols);
+			visualizer.SetObservationLandmarks(obs.detected_landmarks, obs.detection_certainty, obs.visibilities);
+			visualizer.SetObservationPose(obs.pose_estimate, obs.detection_certainty);
+			visualizer.SetObservationGaze(obs.gaze_direction0, obs.gaze_direction1, obs.eye_landmarks_2D, obs.eye_landmarks_3D, obs.detection_certainty);
+			visualizer.SetObservationActionUnits(face_analyser.GetAURegNameTable(), obs.aus_reg, face_analyser.GetAUClassNameTable(), obs.aus_class);
 			visualizer.SetFps(fps_tracker.GetFPS());
 
 			// detect key presses
 			char character_press = visualizer.ShowObservation();
-			
+
 			// quit processing the current sequence (useful when in Webcam mode)
 			if (character_press == 'q')
 			{
-				break;
+				return false;
 			}
+		}
 
-			// Setting up the recorder output
-			open_face_rec.SetObservationHOG(detection_success, hog_descriptor, num_hog_rows, num_hog_cols, 31); // The number of channels in HOG is fixed at the moment, as using FHOG
-			open_face_rec.SetObservationVisualization(visualizer.GetVisImage());
-			open_face_rec.SetObservationActionUnits(face_analyser.GetCurrentAUsReg(), face_analyser.GetCurrentAUsClass());
-			open_face_rec.SetObservationLandmarks(face_model.detected_landmarks, face_model.GetShape(sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy),
-				face_model.params_global, face_model.params_local, face_model.detection_certainty, detection_success);
-			open_face_rec.SetObservationPose(pose_estimate);
-			open_face_rec.SetObservationGaze(gazeDirection0, gazeDirection1, gazeAngle, LandmarkDetector::CalculateAllEyeLandmarks(face_model), LandmarkDetector::Calculate3DEyeLandmarks(face_model, sequence_reader.fx, sequence_reader.fy, sequence_reader.cx, sequence_reader.cy));
-			open_face_rec.SetObservationTimestamp(sequence_reader.time_stamp);
-			open_face_rec.SetObservationFaceID(0);
-			open_face_rec.SetObservationFrameNumber(sequence_reader.GetFrameNumber());
-			open_face_rec.SetObservationFaceAlign(sim_warped_img);
-			open_face_rec.WriteObservation();
-			open_face_rec.WriteObservationTracked();
-			
-			// Reporting progress
-			if (sequence_reader.GetProgress() >= reported_completion / 10.0)
+		// Setting up the recorder output
+		open_face_rec.SetObservationHOG(obs.detection_success, obs.hog_descriptor, obs.num_hog_rows, obs.num_hog_cols, 31); // The number of channels in HOG is fixed at the moment, as using FHOG
+		open_face_rec.SetObservationVisualization(visualizer.GetVisImage());
+		open_face_rec.SetObservationActionUnits(face_analyser.GetAURegNameTable(), obs.aus_reg, face_analyser.GetAUClassNameTable(), obs.aus_class);
+		open_face_rec.SetObservationLandmarks(obs.detected_landmarks, obs.shape_3D, obs.params_global, obs.params_local, obs.detection_certainty, obs.detection_success);
+		open_face_rec.SetObservationPose(obs.pose_estimate);
+		open_face_rec.SetObservationGaze(obs.gaze_direction0, obs.gaze_direction1, obs.gaze_angle, obs.eye_landmarks_2D, obs.eye_landmarks_3D);
+		open_face_rec.SetObservationTimestamp(obs.time_stamp);
+		open_face_rec.SetObservationFaceID(0);
+		open_face_rec.SetObservationReused(obs.reused);
+		open_face_rec.SetObservationFrameNumber(obs.frame_number);
+		open_face_rec.SetObservationFaceAlign(obs.sim_warped_img);
+		open_face_rec.WriteObservation();
+		open_face_rec.WriteObservationTracked();
+
+		if (!obs.analyser_state.empty())
+		{
+			TRACE_SCOPE("FeatureExtraction checkpoint");
+			int64_t csv_rows = open_face_rec.SyncCSV();
+			if (!WriteCheckpoint(checkpoint_file, obs.frame_number, csv_rows, obs.tracker_state, obs.analyser_state))
 			{
-				cout << reported_completion * 10 << "% ";
-				if (reported_completion == 10)
-				{
-					cout << endl;
-				}
-				reported_completion = reported_completion + 1;
+				WARN_STREAM("Could not write the checkpoint " << checkpoint_file);
 			}
+		}
 
-			// Grabbing the next frame in the sequence
-			captured_image = sequence_reader.GetNextFrame();
-
+		// Reporting progress
+		if (obs.progress >= reported_completion / 10.0)
+		{
+			cout << reported_completion * 10 << "% ";
+			if (reported_completion == 10)
+			{
+				cout << endl;
+			}
+			reported_completion = reported_completion + 1;
 		}
+		return true;
+	};
 
-		INFO_STREAM("Closing output recorder");
-		open_face_rec.Close();
-		INFO_STREAM("Closing input reader");
-		sequence_reader.Close();
-		INFO_STREAM("Closed successfully");
+	INFO_STREAM("Starting tracking");
 
-		if (recording_params.outputAUs())
+	// The visualization windows have to be handled from a single thread, so the stages are only pipelined when nothing is shown or when the
+	// visualizer has a UI thread of its own
+	bool completed = true;
+	if (visualizing && !async_visualizer)
+	{
+		while (FrameObservation* obs = track_frame())
 		{
-			INFO_STREAM("Postprocessing the Action Unit predictions");
-			face_analyser.PostprocessOutputFile(open_face_rec.GetCSVFile());
+			analyse_frame(*obs);
+			bool keep_going = output_frame(*obs);
+			delete obs;
+
+			if (!keep_going)
+			{
+				completed = false;
+				break;
+			}
 		}
+	}
+	else
+	{
+		// Tracking for the next frame overlaps with the analysis and recording of the previous ones, the number of frames in flight is bounded
+		const size_t max_frames_in_flight = 4;
+
+		// Set by the output stage once the visualization asked to quit
+		std::atomic<bool> stop_requested(false);
 
-		// Reset the models for the next video
-		face_analyser.Reset();
-		face_model.Reset();
+		tbb::parallel_pipeline(max_frames_in_flight,
+			tbb::make_filter<void, FrameObservation*>(tbb::filter::serial_in_order, [&](tbb::flow_control& fc) -> FrameObservation*
+			{
+				if (stop_requested)
+				{
+					fc.stop();
+					return NULL;
+				}
+				FrameObservation* obs = track_frame();
+				if (obs == NULL)
+				{
+					fc.stop();
+				}
+				return obs;
+			}) &
+			tbb::make_filter<FrameObservation*, FrameObservation*>(tbb::filter::serial_in_order, [&](FrameObservation* obs) -> FrameObservation*
+			{
+				analyse_frame(*obs);
+				return obs;
+			}) &
+			tbb::make_filter<FrameObservation*, void>(tbb::filter::serial_in_order, [&](FrameObservation* obs)
+			{
+				// The frames already in flight once stopping was requested are dropped
+				if (!stop_requested && !output_frame(*obs))
+				{
+					stop_requested = true;
+				}
+				delete obs;
+			}));
+		completed = !stop_requested;
+	}
 
+	if (GetMemoryReport(arguments))
+	{
+		Utilities::MemoryReport memory_report;
+		face_model.ReportMemory(memory_report);
+		face_analyser.ReportMemory(memory_report);
+		sequence_reader.ReportMemory(memory_report);
+		open_face_rec.ReportMemory(memory_report);
+		INFO_STREAM("Memory used by " << sequence_reader.name << ":");
+		memory_report.Print(cout);
+	}
+
+	INFO_STREAM("Closing output recorder");
+	open_face_rec.Close();
+
+	// A sequence that was processed to the end does not need to be resumed
+	if (!checkpoint_file.empty() && completed)
+	{
+		std::remove(checkpoint_file.c_str());
+	}
+	INFO_STREAM("Closing input reader");
+	sequence_reader.Close();
+	INFO_STREAM("Closed successfully");
+
+	// The segments of a sequence are postprocessed together once all of them are done
+	if (segment != NULL)
+	{
+		segment->csv_file = recording_params.outputColumnar() ? "" : open_face_rec.GetCSVFile();
+		segment->postprocess_aus = recording_params.outputAUs() && !recording_params.outputColumnar();
+		return;
+	}
+
+	// The offline postprocessing rewrites the CSV output, so it is not available for the columnar output
+	if (recording_params.outputAUs() && !recording_params.outputColumnar())
+	{
+		INFO_STREAM("Postprocessing the Action Unit predictions");
+		face_analyser.PostprocessOutputFile(open_face_rec.GetCSVFile());
+	}
+
+	if (use_baseline && completed && !face_analyser.SaveBaseline(baseline_dir, subject_id))
+	{
+		WARN_STREAM("Could not save the baseline of " << subject_id);
+	}
+
+	// Reset the models for the next video
+	face_analyser.Reset();
+	face_model.Reset();
+
+}
+
+// Processing the sequences taken from a shared counter, with up to concurrency of them being processed at the same time. Every sequence gets its
+// own copy of the tracker and face analyser (the model weights are shared between the copies) as well as its own reader, visualizer and recorder
+void ProcessFiles(const vector<string>& common_arguments, const vector<string>& files, std::atomic<size_t>& next_file, int concurrency,
+	const LandmarkDetector::CLNF& face_model, const LandmarkDetector::FaceModelParameters& det_parameters, const FaceAnalysis::FaceAnalyser& face_analyser)
+{
+	// The pipeline limits how many sequences are in flight, while the work within the sequences is balanced across the cores by the TBB scheduler
+	tbb::parallel_pipeline(concurrency,
+		tbb::make_filter<void, size_t>(tbb::filter::serial_in_order, [&](tbb::flow_control& fc) -> size_t
+		{
+			size_t file_id = next_file++;
+			if (file_id >= files.size())
+			{
+				fc.stop();
+				return 0;
+			}
+			return file_id;
+		}) &
+		tbb::make_filter<size_t, void>(tbb::filter::parallel, [&](size_t file_id)
+		{
+			vector<string> sequence_arguments = common_arguments;
+			sequence_arguments.push_back("-f");
+			sequence_arguments.push_back(files[file_id]);
+
+			LandmarkDetector::CLNF sequence_model(face_model);
+			LandmarkDetector::FaceModelParameters sequence_parameters(det_parameters);
+			FaceAnalysis::FaceAnalyser sequence_analyser(face_analyser);
+
+			// The output visualizations are still created, but windows can not be shown from several threads
+			Utilities::Visualizer visualizer(sequence_arguments);
+			visualizer.vis_track = false;
+			visualizer.vis_hog = false;
+			visualizer.vis_align = false;
+			visualizer.vis_aus = false;
+
+			Utilities::FpsTracker fps_tracker;
+			fps_tracker.AddFrame();
+
+			Utilities::SequenceCapture sequence_reader;
+			if (!sequence_reader.Open(sequence_arguments))
+			{
+				ERROR_STREAM("Could not open " << files[file_id]);
+				return;
+			}
+
+			ProcessSequence(sequence_reader, sequence_arguments, sequence_model, sequence_parameters, sequence_analyser, visualizer, fps_tracker);
+		}));
+}
+
+// Processing all of the sequences given through -f arguments, with up to concurrency of them being processed at the same time. With use_numa
+// on a multi-socket machine every NUMA node gets its own replica of the models, read from a thread pinned to the node, and works through the
+// sequences in its own pinned arena, so that the trackers do not read the model weights across the interconnect
+void ProcessBatch(const vector<string>& arguments, int concurrency, bool use_numa, const LandmarkDetector::CLNF& face_model,
+	const LandmarkDetector::FaceModelParameters& det_parameters, const FaceAnalysis::FaceAnalyserParameters& face_analysis_params,
+	const FaceAnalysis::FaceAnalyser& face_analyser)
+{
+	// Split the input files from the rest of the arguments, every sequence gets the rest of the arguments together with its own file
+	vector<string> common_arguments;
+	vector<string> files;
+	for (size_t i = 0; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-f") == 0 && i + 1 < arguments.size())
+		{
+			files.push_back(arguments[i + 1]);
+			i++;
+		}
+		else
+		{
+			common_arguments.push_back(arguments[i]);
+		}
+	}
+
+	INFO_STREAM("Processing " << files.size() << " sequences, " << concurrency << " at a time");
+
+	std::atomic<size_t> next_file(0);
+
+	vector<Utilities::NumaNode> nodes;
+	if (use_numa)
+	{
+		nodes = Utilities::GetNumaNodes();
+	}
+
+	if (nodes.size() < 2)
+	{
+		ProcessFiles(common_arguments, files, next_file, concurrency, face_model, det_parameters, face_analyser);
+		return;
+	}
+
+	INFO_STREAM("Replicating the models across " << nodes.size() << " NUMA nodes");
+
+	size_t num_cpus = 0;
+	for (size_t n = 0; n < nodes.size(); ++n)
+	{
+		num_cpus += nodes[n].cpus.size();
+	}
+
+	// The sequences in flight are split across the nodes by their number of processors, the nodes take the sequences from the shared counter
+	vector<std::thread> node_threads;
+	for (size_t n = 0; n < nodes.size(); ++n)
+	{
+		int node_concurrency = std::max(1, (int)(concurrency * nodes[n].cpus.size() / num_cpus));
+
+		node_threads.push_back(std::thread([&, node_concurrency, n]()
+		{
+			Utilities::NumaArena arena(nodes[n]);
+			arena.Execute([&]()
+			{
+				// Reading a private copy of the models from the node, as the memory is placed on the node of the thread first touching it
+				LandmarkDetector::CLNF node_model(det_parameters.model_location, true);
+				if (!node_model.loaded_successfully)
+				{
+					ERROR_STREAM("Could not load the landmark detector on NUMA node " << nodes[n].id);
+					return;
+				}
+				FaceAnalysis::FaceAnalyser node_analyser(face_analysis_params);
+
+				ProcessFiles(common_arguments, files, next_file, node_concurrency, node_model, det_parameters, node_analyser);
+			});
+		}));
+	}
+
+	for (size_t n = 0; n < node_threads.size(); ++n)
+	{
+		node_threads[n].join();
+	}
+}
+
+// Processing a single long video file or image sequence split into segments (-segments <n>), which are tracked and analysed at the same time
+// by their own copies of the models. Each segment starts tracking -segment_overlap <frames> (300 by default) before its start so that the
+// tracker has settled, the CSV outputs of the segments are stitched at the segment starts and the face analysers are combined, so that the
+// Action Units are postprocessed with the normalisation of the whole sequence. The other outputs are written per segment. Returns false if
+// the sequence can not be split, so that it is processed as a whole
+bool ProcessSegments(const vector<string>& arguments, int num_segments, int overlap, const LandmarkDetector::CLNF& face_model,
+	const LandmarkDetector::FaceModelParameters& det_parameters, const FaceAnalysis::FaceAnalyser& face_analyser)
+{
+	if (std::count(arguments.begin(), arguments.end(), string("-f")) > 1)
+	{
+		WARN_STREAM("Only a single sequence can be split into segments, use -batch for several sequences");
+		return false;
+	}
+
+	// Only files of a known length can be split
+	size_t num_frames = 0;
+	string sequence_name;
+	{
+		vector<string> probe_arguments = arguments;
+		Utilities::SequenceCapture probe;
+		if (!probe.Open(probe_arguments))
+		{
+			return false;
+		}
+		num_frames = probe.GetNumFrames();
+		sequence_name = probe.name;
+		probe.Close();
+	}
+
+	// Every segment should be longer than the overlap
+	size_t max_segments = overlap > 0 ? num_frames / overlap : num_frames;
+	num_segments = (int)std::min((size_t)num_segments, max_segments);
+	if (num_segments < 2)
+	{
+		WARN_STREAM("The sequence is too short, or its length is unknown, processing it without splitting it into segments");
+		return false;
+	}
+
+	if (std::find(arguments.begin(), arguments.end(), string("-checkpoint_dir")) != arguments.end())
+	{
+		WARN_STREAM("Checkpoints are not supported for segments, not writing them");
+	}
+
+	if (std::find(arguments.begin(), arguments.end(), string("-compress_outputs")) != arguments.end())
+	{
+		WARN_STREAM("Compression is not supported for segments, as they are stitched in place, writing uncompressed outputs");
+	}
+
+	INFO_STREAM("Processing " << sequence_name << " in " << num_segments << " segments, overlapping by " << overlap << " frames");
+
+	// Every segment is recorded under its own name, the stitched output gets the name of the whole sequence
+	string out_name = GetSequenceBaseName(sequence_name);
+	vector<string>::const_iterator of_argument = std::find(arguments.begin(), arguments.end(), string("-of"));
+	if (of_argument != arguments.end() && of_argument + 1 != arguments.end())
+	{
+		out_name = *(of_argument + 1);
+		size_t extension = out_name.find_last_of('.');
+		size_t directory = out_name.find_last_of("/\\");
+		if (extension != string::npos && (directory == string::npos || extension > directory))
+		{
+			out_name = out_name.substr(0, extension);
+		}
+	}
+
+	vector<SequenceSegment> segments(num_segments);
+	vector<std::unique_ptr<FaceAnalysis::FaceAnalyser> > analysers;
+	for (int k = 0; k < num_segments; ++k)
+	{
+		segments[k].start_frame = num_frames * k / num_segments;
+		segments[k].begin_frame = segments[k].start_frame > (size_t)overlap ? segments[k].start_frame - overlap : 0;
+
+		// The frame count of a video can be approximate, so the last segment reads to the end
+		segments[k].end_frame = k + 1 < num_segments ? num_frames * (k + 1) / num_segments : 0;
+
+		analysers.push_back(std::unique_ptr<FaceAnalysis::FaceAnalyser>(new FaceAnalysis::FaceAnalyser(face_analyser)));
+	}
+
+	tbb::parallel_for(0, num_segments, [&](int k)
+	{
+		// The segments would all write to the same raw video, and the segment outputs are stitched uncompressed
+		vector<string> segment_arguments;
+		for (size_t i = 0; i < arguments.size(); ++i)
+		{
+			if (arguments[i].compare("-of") == 0 || arguments[i].compare("-write_raw") == 0 || arguments[i].compare("-compress_outputs") == 0)
+			{
+				i++;
+			}
+			else
+			{
+				segment_arguments.push_back(arguments[i]);
+			}
+		}
+		segment_arguments.push_back("-of");
+		segment_arguments.push_back(out_name + "_segment" + to_string(k));
+
+		LandmarkDetector::CLNF segment_model(face_model);
+		LandmarkDetector::FaceModelParameters segment_parameters(det_parameters);
+
+		// The output visualizations are still created, but windows can not be shown from several threads
+		Utilities::Visualizer visualizer(segment_arguments);
+		visualizer.vis_track = false;
+		visualizer.vis_hog = false;
+		visualizer.vis_align = false;
+		visualizer.vis_aus = false;
+
+		Utilities::FpsTracker fps_tracker;
+		fps_tracker.AddFrame();
+
+		Utilities::SequenceCapture sequence_reader;
+		sequence_reader.SetStartFrame(segments[k].begin_frame);
+		sequence_reader.SetEndFrame(segments[k].end_frame);
+		if (!sequence_reader.Open(segment_arguments))
+		{
+			ERROR_STREAM("Could not open segment " << k << " of " << sequence_name);
+			return;
+		}
+
+		ProcessSequence(sequence_reader, segment_arguments, segment_model, segment_parameters, *analysers[k], visualizer, fps_tracker, &segments[k]);
+	});
+
+	// Stitching the CSV outputs, the frames in an overlap are taken from the earlier segment (the later one was still settling on them)
+	const string segment_suffix = "_segment0.csv";
+	const string& first_csv = segments[0].csv_file;
+	if (first_csv.size() < segment_suffix.size() || first_csv.compare(first_csv.size() - segment_suffix.size(), segment_suffix.size(), segment_suffix) != 0)
+	{
+		ERROR_STREAM("The segments can only be stitched in the CSV output, the outputs are left per segment");
+		return true;
+	}
+	string csv_file = first_csv.substr(0, first_csv.size() - segment_suffix.size()) + ".csv";
+
+	std::ofstream stitched(csv_file);
+	bool stitched_all = stitched.is_open();
+	vector<int> skip_frames;
+	for (int k = 0; k < num_segments && stitched_all; ++k)
+	{
+		std::ifstream segment_csv(segments[k].csv_file);
+		string line;
+		if (!std::getline(segment_csv, line))
+		{
+			stitched_all = false;
+			break;
+		}
+		if (k == 0)
+		{
+			stitched << line << "\n";
+		}
+
+		// A row per frame, starting from the begin frame
+		size_t skip = segments[k].start_frame - segments[k].begin_frame;
+		for (size_t row = 0; std::getline(segment_csv, line); ++row)
+		{
+			if (row >= skip)
+			{
+				stitched << line << "\n";
+			}
+		}
+		if (k > 0)
+		{
+			skip_frames.push_back((int)skip);
+		}
+	}
+	stitched.close();
+
+	if (!stitched_all || !stitched)
+	{
+		ERROR_STREAM("Could not stitch the segments into " << csv_file << ", the outputs are left per segment");
+		return true;
+	}
+
+	for (int k = 0; k < num_segments; ++k)
+	{
+		std::remove(segments[k].csv_file.c_str());
+	}
+	INFO_STREAM("Stitched " << num_segments << " segments into " << csv_file);
+
+	// The Action Units are postprocessed with the normalisation over all of the segments
+	if (segments[0].postprocess_aus)
+	{
+		vector<FaceAnalysis::FaceAnalyser*> later_segments;
+		for (int k = 1; k < num_segments; ++k)
+		{
+			later_segments.push_back(analysers[k].get());
+		}
+
+		if (analysers[0]->AppendSegments(later_segments, skip_frames))
+		{
+			INFO_STREAM("Postprocessing the Action Unit predictions");
+			analysers[0]->PostprocessOutputFile(csv_file);
+		}
+		else
+		{
+			WARN_STREAM("The Action Unit predictions of the segments could not be postprocessed together");
+		}
+	}
+
+	return true;
+}
+
+// The settings of the job queue (-queue <dir>), the claims not kept alive for -lease <seconds> are requeued, and the jobs are retried
+// -max_attempts <n> times before they are moved to failed
+struct QueueSettings
+{
+	string directory;
+	bool submit;
+	double lease_seconds;
+	int max_attempts;
+
+	QueueSettings() : submit(false), lease_seconds(600.0), max_attempts(3) {}
+};
+
+static QueueSettings GetQueueSettings(vector<string>& arguments)
+{
+	QueueSettings settings;
+	for (size_t i = 0; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-submit") == 0)
+		{
+			settings.submit = true;
+			arguments.erase(arguments.begin() + i);
+			--i;
+		}
+		else if (i + 1 < arguments.size() && arguments[i].compare("-queue") == 0)
+		{
+			settings.directory = arguments[i + 1];
+			arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+			--i;
+		}
+		else if (i + 1 < arguments.size() && arguments[i].compare("-lease") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> settings.lease_seconds;
+			settings.lease_seconds = std::max(1.0, settings.lease_seconds);
+			arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+			--i;
+		}
+		else if (i + 1 < arguments.size() && arguments[i].compare("-max_attempts") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> settings.max_attempts;
+			settings.max_attempts = std::max(1, settings.max_attempts);
+			arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+			--i;
+		}
+	}
+	return settings;
+}
+
+// How often the queue is polled for new jobs and the coordinator reports the progress
+static const int QUEUE_POLL_SECONDS = 5;
+
+// Submitting the sequences given through -f to the job queue as one job each and waiting for the workers to process them, while requeueing
+// the claims of the workers that died and reporting the progress of every node. With -segments <n> every job is split into segments by the
+// worker processing it (the segments of a job are processed on the same node, so that they can be stitched and their statistics merged)
+int RunCoordinator(const vector<string>& arguments, const QueueSettings& settings)
+{
+	Utilities::JobQueue queue;
+	if (!queue.Open(settings.directory))
+	{
+		return 1;
+	}
+
+	vector<string> segment_arguments;
+	for (size_t i = 0; i + 1 < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-segments") == 0 || arguments[i].compare("-segment_overlap") == 0)
+		{
+			segment_arguments.push_back(arguments[i]);
+			segment_arguments.push_back(arguments[i + 1]);
+		}
+	}
+
+	size_t submitted = 0;
+	size_t num_files = 0;
+	for (size_t i = 0; i + 1 < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-f") != 0)
+			continue;
+
+		const string& file = arguments[i + 1];
+
+		// The job ids keep the submission order and are readable in the queue directories
+		string base_name = GetSequenceBaseName(file);
+		std::replace(base_name.begin(), base_name.end(), '@', '_');
+		char index[16];
+		snprintf(index, sizeof(index), "%08d", (int)num_files);
+		num_files++;
+
+		vector<string> job_arguments;
+		job_arguments.push_back("-f");
+		job_arguments.push_back(file);
+		job_arguments.insert(job_arguments.end(), segment_arguments.begin(), segment_arguments.end());
+
+		if (queue.Submit(string(index) + "_" + base_name, job_arguments))
+		{
+			submitted++;
+		}
+	}
+	queue.Close();
+
+	INFO_STREAM("Submitted " << submitted << " of " << num_files << " sequences to " << settings.directory);
+
+	while (true)
+	{
+		int requeued = queue.RequeueExpired(settings.lease_seconds, settings.max_attempts);
+		if (requeued > 0)
+		{
+			INFO_STREAM("Requeued " << requeued << " jobs with expired claims");
+		}
+
+		size_t pending, claimed, done, failed;
+		queue.GetCounts(pending, claimed, done, failed);
+		INFO_STREAM("Jobs pending: " << pending << ", in progress: " << claimed << ", done: " << done << ", failed: " << failed);
+
+		vector<Utilities::NodeStatus> nodes = queue.GetNodeStatus();
+		int64_t now = (int64_t)std::time(0);
+		for (size_t n = 0; n < nodes.size(); ++n)
+		{
+			// The nodes that stopped reporting are either finished or dead, their claims are requeued once they expire
+			if (now - nodes[n].updated > settings.lease_seconds && nodes[n].active_jobs > 0)
+			{
+				WARN_STREAM(nodes[n].worker_id << " has not reported for " << now - nodes[n].updated << " seconds");
+				continue;
+			}
+			INFO_STREAM("  " << nodes[n].worker_id << ": " << nodes[n].active_jobs << " active, " << nodes[n].jobs_done << " done, "
+				<< nodes[n].jobs_failed << " failed, " << nodes[n].frames << " frames, " << nodes[n].fps << " fps");
+		}
+
+		if (queue.IsFinished())
+		{
+			return failed > 0 ? 1 : 0;
+		}
+		std::this_thread::sleep_for(std::chrono::seconds(QUEUE_POLL_SECONDS));
+	}
+}
+
+// Running as a worker of the job queue (-queue <dir>), processing up to concurrency of the jobs at the same time with the models kept resident
+// across the jobs, until the queue is closed and drained. The outputs are written to the output directory given to the worker, which should
+// be on shared storage. The claims of the jobs in progress are kept alive and the progress and throughput of the node are reported in the
+// queue by a background thread, an idle worker requeues the expired claims of the other workers
+void ProcessQueue(const vector<string>& arguments, const QueueSettings& settings, int concurrency, const LandmarkDetector::CLNF& face_model,
+	const LandmarkDetector::FaceModelParameters& det_parameters, const FaceAnalysis::FaceAnalyser& face_analyser)
+{
+	Utilities::JobQueue queue;
+	if (!queue.Open(settings.directory))
+	{
+		return;
+	}
+
+	Utilities::NodeStatus status;
+	status.worker_id = Utilities::JobQueue::DefaultWorkerId();
+
+	std::mutex active_mutex;
+	vector<Utilities::Job> active_jobs;
+	std::atomic<int64_t> jobs_done(0);
+	std::atomic<int64_t> jobs_failed(0);
+
+	INFO_STREAM("Processing the jobs from " << settings.directory << " as " << status.worker_id << ", " << concurrency << " at a time");
+
+	// Reporting often enough for the claims to survive a couple of missed heartbeats
+	int heartbeat_seconds = std::max(1, std::min(30, (int)(settings.lease_seconds / 4)));
+
+	std::mutex stop_mutex;
+	std::condition_variable stop_condition;
+	bool stop = false;
+
+	std::thread heartbeat([&]()
+	{
+		Utilities::Metrics::Counter& frames = Utilities::Metrics::GetRegistry().GetCounter("openface_frames_processed_total",
+			"Frames passed through video landmark detection");
+		uint64_t last_frames = frames.Get();
+		std::chrono::steady_clock::time_point last_time = std::chrono::steady_clock::now();
+
+		std::unique_lock<std::mutex> stop_lock(stop_mutex);
+		while (!stop)
+		{
+			stop_condition.wait_for(stop_lock, std::chrono::seconds(heartbeat_seconds));
+
+			{
+				std::lock_guard<std::mutex> lock(active_mutex);
+				for (size_t i = 0; i < active_jobs.size(); ++i)
+				{
+					if (!queue.Heartbeat(active_jobs[i]))
+					{
+						WARN_STREAM("Lost the claim of the job " << active_jobs[i].id);
+					}
+				}
+				status.active_jobs = (int)active_jobs.size();
+			}
+
+			uint64_t current_frames = frames.Get();
+			std::chrono::steady_clock::time_point current_time = std::chrono::steady_clock::now();
+			double elapsed = std::chrono::duration<double>(current_time - last_time).count();
+
+			status.jobs_done = jobs_done;
+			status.jobs_failed = jobs_failed;
+			status.frames = (int64_t)current_frames;
+			status.fps = elapsed > 0 ? (current_frames - last_frames) / elapsed : 0.0;
+			queue.WriteNodeStatus(status);
+
+			last_frames = current_frames;
+			last_time = current_time;
+		}
+	});
+
+	tbb::parallel_pipeline(concurrency,
+		tbb::make_filter<void, Utilities::Job>(tbb::filter::serial_in_order, [&](tbb::flow_control& fc) -> Utilities::Job
+		{
+			Utilities::Job job;
+			while (!queue.Claim(status.worker_id, job))
+			{
+				if (queue.IsFinished())
+				{
+					fc.stop();
+					return job;
+				}
+
+				// Picking up the work of the dead workers while waiting
+				queue.RequeueExpired(settings.lease_seconds, settings.max_attempts);
+				std::this_thread::sleep_for(std::chrono::seconds(QUEUE_POLL_SECONDS));
+			}
+
+			std::lock_guard<std::mutex> lock(active_mutex);
+			active_jobs.push_back(job);
+			return job;
+		}) &
+		tbb::make_filter<Utilities::Job, void>(tbb::filter::parallel, [&](Utilities::Job job)
+		{
+			INFO_STREAM("Processing the job " << job.id << (job.attempts > 0 ? " (retry)" : ""));
+
+			// The segments of a long sequence are processed by this worker too
+			vector<string> job_arguments = arguments;
+			int num_segments = 1;
+			int segment_overlap = 300;
+			for (size_t i = 0; i < job.arguments.size(); ++i)
+			{
+				if (i + 1 < job.arguments.size() && job.arguments[i].compare("-segments") == 0)
+				{
+					num_segments = atoi(job.arguments[++i].c_str());
+				}
+				else if (i + 1 < job.arguments.size() && job.arguments[i].compare("-segment_overlap") == 0)
+				{
+					segment_overlap = std::max(0, atoi(job.arguments[++i].c_str()));
+				}
+				else
+				{
+					job_arguments.push_back(job.arguments[i]);
+				}
+			}
+
+			bool success = false;
+			try
+			{
+				if (num_segments > 1 && ProcessSegments(job_arguments, num_segments, segment_overlap, face_model, det_parameters, face_analyser))
+				{
+					success = true;
+				}
+				else
+				{
+					LandmarkDetector::CLNF sequence_model(face_model);
+					LandmarkDetector::FaceModelParameters sequence_parameters(det_parameters);
+					FaceAnalysis::FaceAnalyser sequence_analyser(face_analyser);
+
+					Utilities::Visualizer visualizer(job_arguments);
+					visualizer.vis_track = false;
+					visualizer.vis_hog = false;
+					visualizer.vis_align = false;
+					visualizer.vis_aus = false;
+
+					Utilities::FpsTracker fps_tracker;
+					fps_tracker.AddFrame();
+
+					Utilities::SequenceCapture sequence_reader;
+					if (sequence_reader.Open(job_arguments))
+					{
+						ProcessSequence(sequence_reader, job_arguments, sequence_model, sequence_parameters, sequence_analyser, visualizer, fps_tracker);
+						success = true;
+					}
+					else
+					{
+						ERROR_STREAM("Could not open the input of the job " << job.id);
+					}
+				}
+			}
+			catch (const std::exception& e)
+			{
+				ERROR_STREAM("The job " << job.id << " failed: " << e.what());
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(active_mutex);
+				for (size_t i = 0; i < active_jobs.size(); ++i)
+				{
+					if (active_jobs[i].claim_file == job.claim_file)
+					{
+						active_jobs.erase(active_jobs.begin() + i);
+						break;
+					}
+				}
+			}
+
+			if (success)
+			{
+				queue.Complete(job);
+				jobs_done++;
+			}
+			else
+			{
+				queue.Fail(job, settings.max_attempts);
+				jobs_failed++;
+			}
+		}));
+
+	{
+		std::lock_guard<std::mutex> lock(stop_mutex);
+		stop = true;
+	}
+	stop_condition.notify_one();
+	heartbeat.join();
+
+	INFO_STREAM("The job queue is finished, " << jobs_done << " jobs done and " << jobs_failed << " failed on this node");
+}
+
+// Processing synchronised cameras (-sync_f, -sync_fdir or -sync_device for every camera, see MultiSequenceCapture) in a single process. The
+// frames are aligned to those of the first camera, and every camera is tracked and analysed by its own copy of the models (sharing the model
+// weights), with the cameras of a frame processed at the same time. Each camera is recorded under its own name (<name>_cam<k> if -of is given),
+// a camera without a frame close enough in time to the first camera's frame has no row for that frame, the frame numbers are those of the
+// first camera so the rows of the cameras can be matched. Nothing is visualised
+void ProcessSynchronised(const vector<string>& arguments, const LandmarkDetector::CLNF& face_model, const LandmarkDetector::FaceModelParameters& det_parameters,
+	const FaceAnalysis::FaceAnalyser& face_analyser)
+{
+	vector<vector<string> > source_arguments = Utilities::MultiSequenceCapture::GetSourceArguments(arguments);
+	Utilities::MultiSequenceCapture capture;
+	if (!capture.Open(source_arguments))
+	{
+		return;
+	}
+	size_t num_cameras = capture.NumSources();
+
+	// The output name with the extension removed, if one is given
+	string out_name;
+	vector<string>::const_iterator of_argument = std::find(arguments.begin(), arguments.end(), string("-of"));
+	if (of_argument != arguments.end() && of_argument + 1 != arguments.end())
+	{
+		out_name = *(of_argument + 1);
+		size_t extension = out_name.find_last_of('.');
+		size_t directory = out_name.find_last_of("/\\");
+		if (extension != string::npos && (directory == string::npos || extension > directory))
+		{
+			out_name = out_name.substr(0, extension);
+		}
+	}
+
+	// Everything about a single camera
+	struct Camera
+	{
+		std::unique_ptr<LandmarkDetector::CLNF> face_model;
+		std::unique_ptr<LandmarkDetector::FaceModelParameters> det_parameters;
+		std::unique_ptr<FaceAnalysis::FaceAnalyser> face_analyser;
+		std::unique_ptr<Utilities::RecorderOpenFaceParameters> recording_params;
+		std::unique_ptr<Utilities::RecorderOpenFace> open_face_rec;
+	};
+	vector<Camera> cameras(num_cameras);
+
+	for (size_t k = 0; k < num_cameras; ++k)
+	{
+		Utilities::SequenceCapture& source = capture.GetSource(k);
+		vector<string> camera_arguments = source_arguments[k];
+		if (!out_name.empty())
+		{
+			camera_arguments.push_back("-of");
+			camera_arguments.push_back(out_name + "_cam" + to_string(k));
+		}
+
+		Camera& camera = cameras[k];
+		camera.face_model.reset(new LandmarkDetector::CLNF(face_model));
+		camera.det_parameters.reset(new LandmarkDetector::FaceModelParameters(det_parameters));
+		camera.face_analyser.reset(new FaceAnalysis::FaceAnalyser(face_analyser));
+		camera.recording_params.reset(new Utilities::RecorderOpenFaceParameters(camera_arguments, true, source.IsWebcam(), source.fx, source.fy, source.cx, source.cy, source.fps));
+		if (!face_model.eye_model || det_parameters.pose_only)
+		{
+			camera.recording_params->setOutputGaze(false);
+		}
+		if (det_parameters.pose_only)
+		{
+			camera.recording_params->setOutputAUs(false);
+		}
+		camera.open_face_rec.reset(new Utilities::RecorderOpenFace(source.name, *camera.recording_params, camera_arguments));
+
+		// Only computing the face analysis outputs that are recorded
+		int analysis_outputs = 0;
+		if (camera.recording_params->outputAlignedFaces())
+			analysis_outputs |= FaceAnalysis::FaceAnalyser::OUTPUT_ALIGNED_FACE;
+		if (camera.recording_params->outputHOG())
+			analysis_outputs |= FaceAnalysis::FaceAnalyser::OUTPUT_HOG;
+		if (camera.recording_params->outputAUs())
+			analysis_outputs |= FaceAnalysis::FaceAnalyser::OUTPUT_AU_INTENSITY | FaceAnalysis::FaceAnalyser::OUTPUT_AU_PRESENCE | FaceAnalysis::FaceAnalyser::OUTPUT_DYNAMIC_NORMALISATION;
+		camera.face_analyser->SetRequestedOutputs(analysis_outputs);
+	}
+
+	INFO_STREAM("Starting tracking of " << num_cameras << " synchronised cameras");
+
+	vector<cv::Mat> frames;
+	vector<cv::Mat_<uchar> > gray_frames;
+	double time_stamp = 0;
+	int frame_number = 0;
+	while (capture.GetNextFrames(frames, gray_frames, time_stamp))
+	{
+		tbb::parallel_for((size_t)0, num_cameras, [&](size_t k)
+		{
+			if (frames[k].empty())
+			{
+				return;
+			}
+
+			Camera& camera = cameras[k];
+			Utilities::SequenceCapture& source = capture.GetSource(k);
+			LandmarkDetector::CLNF& model = *camera.face_model;
+
+			cv::Mat gray_frame = gray_frames[k];
+			bool detection_success = LandmarkDetector::DetectLandmarksInVideo(frames[k], model, *camera.det_parameters, gray_frame, time_stamp);
+
+			// The camera's own intrinsics for the gaze and the head pose
+			GazeAnalysis::GazeResult gaze;
+			GazeAnalysis::EstimateGazeBoth(model, gaze, source.fx, source.fy, source.cx, source.cy, detection_success && model.eye_model && !camera.det_parameters->pose_only);
+			cv::Vec6f pose_estimate = LandmarkDetector::GetPose(model, source.fx, source.fy, source.cx, source.cy);
+
+			cv::Mat sim_warped_img;
+			cv::Mat_<float> hog_descriptor;
+			int num_hog_rows = 0, num_hog_cols = 0;
+			if (camera.face_analyser->GetRequestedOutputs() != 0)
+			{
+				camera.face_analyser->AddNextFrame(frames[k], model.detected_landmarks, model.detection_success, time_stamp, source.IsWebcam());
+				camera.face_analyser->GetLatestAlignedFace(sim_warped_img);
+				camera.face_analyser->GetLatestHOG(hog_descriptor, num_hog_rows, num_hog_cols);
+			}
+
+			Utilities::RecorderOpenFace& open_face_rec = *camera.open_face_rec;
+			open_face_rec.SetObservationHOG(detection_success, hog_descriptor, num_hog_rows, num_hog_cols, 31);
+			open_face_rec.SetObservationActionUnits(camera.face_analyser->GetAURegNameTable(), camera.face_analyser->GetCurrentAURegValues(),
+				camera.face_analyser->GetAUClassNameTable(), camera.face_analyser->GetCurrentAUClassValues());
+			open_face_rec.SetObservationLandmarks(model.detected_landmarks, model.GetShape(source.fx, source.fy, source.cx, source.cy),
+				model.params_global, model.params_local, model.detection_certainty, detection_success);
+			open_face_rec.SetObservationPose(pose_estimate);
+			open_face_rec.SetObservationGaze(gaze.gaze_direction0, gaze.gaze_direction1, gaze.gaze_angle, gaze.eye_landmarks_2D, gaze.eye_landmarks_3D);
+			open_face_rec.SetObservationTimestamp(time_stamp);
+			open_face_rec.SetObservationFaceID(0);
+			open_face_rec.SetObservationFrameNumber(frame_number);
+			open_face_rec.SetObservationFaceAlign(sim_warped_img);
+			open_face_rec.WriteObservation();
+		});
+		frame_number++;
+	}
+
+	capture.Close();
+
+	for (size_t k = 0; k < num_cameras; ++k)
+	{
+		Camera& camera = cameras[k];
+		camera.open_face_rec->Close();
+
+		if (camera.recording_params->outputAUs() && !camera.recording_params->outputColumnar())
+		{
+			INFO_STREAM("Postprocessing the Action Unit predictions of camera " << k);
+			camera.face_analyser->PostprocessOutputFile(camera.open_face_rec->GetCSVFile());
+		}
+	}
+	INFO_STREAM("Processed " << frame_number << " synchronised frames");
+}
+
+int main(int argc, char **argv)
+{
+
+	vector<string> arguments = get_arguments(argc, argv);
+
+	// A session recorded with -record_session is replayed (-replay <dir>) with the arguments it was recorded with, unless overridden
+	Utilities::SequenceCapture::AddReplayArguments(arguments);
+
+	// The number of threads used for the processing (-threads <n>, all of the cores by default)
+	Utilities::Concurrency::ParseArguments(arguments);
+
+	// When the results are streamed to stdout (-stream stdout) the log goes to stderr
+	Utilities::RecorderStream::ReserveStdout(arguments);
+
+	// no arguments: output usage
+	if (arguments.size() == 1)
+	{
+		cout << "For command line arguments see:" << endl;
+		cout << " https://github.com/TadasBaltrusaitis/OpenFace/wiki/Command-line-arguments";
+		return 0;
+	}
+
+	// Distributing the processing of an archive across nodes through a job queue on shared storage (-queue <dir>), the coordinator submits
+	// the sequences (-submit with -f for every sequence) and the workers (-queue <dir> with -batch <n> and the output arguments) process them
+	QueueSettings queue_settings = GetQueueSettings(arguments);
+	if (!queue_settings.directory.empty() && queue_settings.submit)
+	{
+		return RunCoordinator(arguments, queue_settings);
+	}
+
+	// Load the modules that are being used for tracking and face analysis
+	LandmarkDetector::FaceModelParameters det_parameters(arguments);
+	FaceAnalysis::FaceAnalyserParameters face_analysis_params(arguments);
+
+	// The face landmark detector and the facial feature extractor and AU analyser are independent, so they are read concurrently
+	std::unique_ptr<LandmarkDetector::CLNF> face_model_read;
+	std::unique_ptr<FaceAnalysis::FaceAnalyser> face_analyser_read;
+	tbb::parallel_invoke(
+		[&]() { face_model_read.reset(new LandmarkDetector::CLNF(det_parameters.model_location)); },
+		[&]() { face_analyser_read.reset(new FaceAnalysis::FaceAnalyser(face_analysis_params)); });
+
+	// Always track gaze in feature extraction
+	LandmarkDetector::CLNF& face_model = *face_model_read;
+	FaceAnalysis::FaceAnalyser& face_analyser = *face_analyser_read;
+
+	if (!face_model.loaded_successfully)
+	{
+		cout << "ERROR: Could not load the landmark detector" << endl;
+		return 1;
+	}
+
+	if (!face_model.eye_model)
+	{
+		cout << "WARNING: no eye model found" << endl;
+	}
+
+	if (face_analyser.GetAUClassNames().size() == 0 && face_analyser.GetAUClassNames().size() == 0)
+	{
+		cout << "WARNING: no Action Unit models found" << endl;
+	}
+
+	// In batch mode (-batch <n>) the sequences given through -f are processed n at a time, sharing the models
+	int batch_concurrency = 1;
+	for (size_t i = 0; i + 1 < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-batch") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> batch_concurrency;
+			arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+			break;
+		}
+	}
+
+	// A single long sequence can be split into segments processed at the same time (-segments <n>, -segment_overlap <frames>)
+	int num_segments = 1;
+	int segment_overlap = 300;
+	for (size_t i = 0; i + 1 < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-segments") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> num_segments;
+			arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+			--i;
+		}
+		else if (arguments[i].compare("-segment_overlap") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> segment_overlap;
+			segment_overlap = std::max(0, segment_overlap);
+			arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+			--i;
+		}
+	}
+
+	// On multi-socket machines the models can be replicated per NUMA node in batch mode (-numa)
+	bool use_numa = false;
+	for (size_t i = 0; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-numa") == 0)
+		{
+			use_numa = true;
+			arguments.erase(arguments.begin() + i);
+			break;
+		}
+	}
+
+	// Recording a trace of the processing stages (-trace <file>), needs to be built with OPENFACE_TRACING
+	string trace_file;
+	for (size_t i = 0; i + 1 < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-trace") == 0)
+		{
+			trace_file = arguments[i + 1];
+			arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+			break;
+		}
+	}
+
+	if (!trace_file.empty())
+	{
+#ifndef OPENFACE_TRACING
+		WARN_STREAM("Tracing is not compiled in, build with -DOPENFACE_TRACING=ON to record a trace");
+#endif
+		Utilities::Tracing::SetEnabled(true);
+	}
+
+	// Serving the metrics for Prometheus at http://<host>:<port>/metrics while processing (-metrics_port <port>), for long running
+	// tracking e.g. from a webcam
+	Utilities::MetricsServer metrics_server;
+	for (size_t i = 0; i + 1 < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-metrics_port") == 0)
+		{
+			int metrics_port = 0;
+			stringstream data(arguments[i + 1]);
+			data >> metrics_port;
+			arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+
+			if (metrics_server.Start(metrics_port))
+			{
+				INFO_STREAM("Serving metrics at http://localhost:" << metrics_port << "/metrics");
+			}
+			break;
+		}
+	}
+
+	if (!Utilities::MultiSequenceCapture::GetSourceArguments(arguments).empty())
+	{
+		ProcessSynchronised(arguments, face_model, det_parameters, face_analyser);
+	}
+	else if (!queue_settings.directory.empty())
+	{
+		ProcessQueue(arguments, queue_settings, batch_concurrency, face_model, det_parameters, face_analyser);
+	}
+	else if (batch_concurrency > 1)
+	{
+		ProcessBatch(arguments, batch_concurrency, use_numa, face_model, det_parameters, face_analysis_params, face_analyser);
+	}
+	else if (num_segments > 1 && ProcessSegments(arguments, num_segments, segment_overlap, face_model, det_parameters, face_analyser))
+	{
+		INFO_STREAM("Processed the segments");
+	}
+	else
+	{
+		Utilities::SequenceCapture sequence_reader;
+
+		// A utility for visualizing the results
+		Utilities::Visualizer visualizer(arguments);
+
+		// Tracking FPS for visualization
+		Utilities::FpsTracker fps_tracker;
+		fps_tracker.AddFrame();
+
+		while (true) // this is not a for loop as we might also be reading from a webcam
+		{
+
+			// The sequence reader chooses what to open based on command line arguments provided
+			if (!sequence_reader.Open(arguments))
+				break;
+
+			ProcessSequence(sequence_reader, arguments, face_model, det_parameters, face_analyser, visualizer, fps_tracker);
+		}
+	}
+
+	if (!trace_file.empty())
+	{
+		Utilities::Tracing::SetEnabled(false);
+		if (Utilities::Tracing::WriteChromeTrace(trace_file))
+		{
+			INFO_STREAM("Trace written to " << trace_file);
+		}
+		else
+		{
+			ERROR_STREAM("Could not write the trace to " << trace_file);
+		}
 	}
 
 	return 0;
@@ -0,0 +1,591 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// GoldenDiff.cpp : Comparing the outputs of the pipeline (the CSV, HOG and aligned face outputs of FeatureExtraction, FaceLandmarkImg, ...) against
+// golden outputs with numeric tolerances, so that the faster but not bit exact paths (float AUs, SIMD kernels, quantisation, response reuse, ...)
+// can be checked to only drift within the tolerances. The drift of every CSV column, of the HOG descriptors and of the aligned faces is summarised,
+// and the exit code is 1 if any of them is outside of its tolerance (or a golden file has no output).
+//
+// Usage: openface_golden_diff -golden <dir> -output <dir> [-run "<command>"] [-update] [-tol <column pattern> <tolerance>]... [-report <csv file>]
+//	-run     running the pipeline first, e.g. -run "bin/FeatureExtraction -f clip.avi -out_dir out"
+//	-update  copying the outputs over the golden files instead of comparing (once a change is accepted)
+//	-tol     overriding the tolerance of the CSV columns matching the pattern (* matches anything, e.g. "AU*_r" or "x_*"), or of "hog" and
+//	         "aligned" (the largest pixel difference)
+// Every file in the golden directory (recursively) is compared with the file of the same relative path in the output directory.
+
+// Local includes
+#include <ReaderHOG.h>
+
+// System includes
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// Boost includes
+#include <filesystem.hpp>
+#include <filesystem/fstream.hpp>
+
+#define INFO_STREAM( stream ) \
+std::cout << stream << std::endl
+
+#define WARN_STREAM( stream ) \
+std::cout << "Warning: " << stream << std::endl
+
+#define ERROR_STREAM( stream ) \
+std::cout << "Error: " << stream << std::endl
+
+using namespace std;
+
+vector<string> get_arguments(int argc, char **argv)
+{
+
+	vector<string> arguments;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		arguments.push_back(string(argv[i]));
+	}
+	return arguments;
+}
+
+//===========================================================================
+// The tolerances, the first matching pattern is used
+
+struct Tolerance
+{
+	string pattern;
+	double tolerance;
+};
+
+// The defaults are in the units of the outputs: pixels for the 2D landmarks, millimetres for the 3D ones and the head position, radians for
+// the rotations and gaze, intensity units for the AUs. The identifiers and the AU occurences have to match exactly
+vector<Tolerance> DefaultTolerances()
+{
+	Tolerance tolerances[] = {
+		{ "frame", 0 }, { "face_id", 0 }, { "success", 0 }, { "timestamp", 1e-3 }, { "confidence", 0.02 },
+		{ "gaze_angle_*", 0.02 }, { "gaze_*", 0.02 },
+		{ "eye_lmk_x_*", 0.5 }, { "eye_lmk_y_*", 0.5 }, { "eye_lmk_*", 1.0 },
+		{ "pose_T*", 1.0 }, { "pose_R*", 0.01 },
+		{ "x_*", 0.5 }, { "y_*", 0.5 }, { "X_*", 1.0 }, { "Y_*", 1.0 }, { "Z_*", 1.0 },
+		{ "p_scale", 0.01 }, { "p_r*", 0.01 }, { "p_t*", 0.5 }, { "p_*", 0.1 },
+		{ "AU*_r", 0.1 }, { "AU*_c", 0 },
+		{ "hog", 0.01 }, { "aligned", 10 },
+		{ "*", 1e-4 } };
+	return vector<Tolerance>(tolerances, tolerances + sizeof(tolerances) / sizeof(tolerances[0]));
+}
+
+bool MatchesPattern(const string& name, const string& pattern)
+{
+	// A glob with * only, matched greedily from both ends of every segment
+	size_t star = pattern.find('*');
+	if (star == string::npos)
+	{
+		return name == pattern;
+	}
+
+	string prefix = pattern.substr(0, star);
+	if (name.compare(0, prefix.size(), prefix) != 0)
+	{
+		return false;
+	}
+
+	string rest = pattern.substr(star + 1);
+	if (rest.find('*') == string::npos)
+	{
+		return name.size() >= prefix.size() + rest.size() && name.compare(name.size() - rest.size(), rest.size(), rest) == 0;
+	}
+
+	for (size_t start = prefix.size(); start <= name.size(); ++start)
+	{
+		if (MatchesPattern(name.substr(start), rest))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+double ToleranceOf(const vector<Tolerance>& tolerances, const string& name)
+{
+	for (size_t i = 0; i < tolerances.size(); ++i)
+	{
+		if (MatchesPattern(name, tolerances[i].pattern))
+		{
+			return tolerances[i].tolerance;
+		}
+	}
+	return 0;
+}
+
+//===========================================================================
+// The drift of a quantity (a CSV column, the HOG descriptors or the aligned faces of a file)
+
+struct Drift
+{
+	string file;
+	string name;
+	double tolerance;
+
+	double max_difference;
+	double sum_difference;
+	long long num_values;
+	long long num_outside;
+
+	Drift(const string& file, const string& name, double tolerance) : file(file), name(name), tolerance(tolerance), max_difference(0), sum_difference(0), num_values(0), num_outside(0) {}
+
+	void Add(double golden, double output)
+	{
+		// Missing values (NaN) only match each other
+		double difference = (std::isnan(golden) || std::isnan(output)) ? (std::isnan(golden) == std::isnan(output) ? 0 : INFINITY) : std::abs(golden - output);
+
+		max_difference = std::max(max_difference, difference);
+		sum_difference += std::isinf(difference) ? 0 : difference;
+		num_values++;
+		num_outside += difference > tolerance ? 1 : 0;
+	}
+
+	double MeanDifference() const { return num_values > 0 ? sum_difference / num_values : 0; }
+};
+
+//===========================================================================
+// Comparing the files
+
+bool ReadCSV(const string& location, vector<string>& header, vector<vector<double> >& rows)
+{
+	std::ifstream stream(location);
+	if (!stream.is_open())
+	{
+		return false;
+	}
+
+	string line;
+	if (!std::getline(stream, line))
+	{
+		return false;
+	}
+
+	std::stringstream header_stream(line);
+	string name;
+	while (std::getline(header_stream, name, ','))
+	{
+		size_t first = name.find_first_not_of(" \r");
+		size_t last = name.find_last_not_of(" \r");
+		header.push_back(first == string::npos ? "" : name.substr(first, last - first + 1));
+	}
+
+	while (std::getline(stream, line))
+	{
+		if (line.empty() || line == "\r")
+		{
+			continue;
+		}
+
+		vector<double> row;
+		std::stringstream values(line);
+		string value;
+		while (std::getline(values, value, ','))
+		{
+			char* end;
+			double number = std::strtod(value.c_str(), &end);
+			row.push_back(end == value.c_str() ? NAN : number);
+		}
+		row.resize(header.size(), NAN);
+		rows.push_back(row);
+	}
+	return true;
+}
+
+// The rows are matched by the frame and face (when recorded), otherwise by their order
+bool CompareCSV(const string& golden_file, const string& output_file, const string& name, const vector<Tolerance>& tolerances, vector<Drift>& drifts)
+{
+	vector<string> golden_header, output_header;
+	vector<vector<double> > golden_rows, output_rows;
+	if (!ReadCSV(golden_file, golden_header, golden_rows) || !ReadCSV(output_file, output_header, output_rows))
+	{
+		ERROR_STREAM("Could not read " << name);
+		return false;
+	}
+
+	bool matching = true;
+
+	map<string, int> output_columns;
+	for (size_t c = 0; c < output_header.size(); ++c)
+	{
+		output_columns[output_header[c]] = (int)c;
+	}
+
+	int golden_frame = -1, golden_face = -1, output_frame = -1, output_face = -1;
+	for (size_t c = 0; c < golden_header.size(); ++c)
+	{
+		golden_frame = golden_header[c] == "frame" ? (int)c : golden_frame;
+		golden_face = golden_header[c] == "face_id" ? (int)c : golden_face;
+	}
+	if (output_columns.count("frame")) output_frame = output_columns["frame"];
+	if (output_columns.count("face_id")) output_face = output_columns["face_id"];
+
+	map<std::pair<double, double>, size_t> output_keys;
+	bool keyed = golden_frame >= 0 && output_frame >= 0;
+	for (size_t r = 0; keyed && r < output_rows.size(); ++r)
+	{
+		output_keys[std::make_pair(output_rows[r][output_frame], output_face >= 0 ? output_rows[r][output_face] : 0)] = r;
+	}
+
+	size_t first_drift = drifts.size();
+	vector<int> column_map(golden_header.size(), -1);
+	for (size_t c = 0; c < golden_header.size(); ++c)
+	{
+		drifts.push_back(Drift(name, golden_header[c], ToleranceOf(tolerances, golden_header[c])));
+		if (output_columns.count(golden_header[c]) == 0)
+		{
+			ERROR_STREAM(name << ": the output has no " << golden_header[c] << " column");
+			matching = false;
+		}
+		else
+		{
+			column_map[c] = output_columns[golden_header[c]];
+		}
+	}
+
+	int num_missing = 0;
+	for (size_t r = 0; r < golden_rows.size(); ++r)
+	{
+		size_t output_row = r;
+		if (keyed)
+		{
+			map<std::pair<double, double>, size_t>::const_iterator key = output_keys.find(std::make_pair(golden_rows[r][golden_frame], golden_face >= 0 ? golden_rows[r][golden_face] : 0));
+			output_row = key == output_keys.end() ? output_rows.size() : key->second;
+		}
+		if (output_row >= output_rows.size())
+		{
+			num_missing++;
+			continue;
+		}
+
+		for (size_t c = 0; c < golden_header.size(); ++c)
+		{
+			if (column_map[c] >= 0)
+			{
+				drifts[first_drift + c].Add(golden_rows[r][c], output_rows[output_row][column_map[c]]);
+			}
+		}
+	}
+
+	if (num_missing > 0 || output_rows.size() != golden_rows.size())
+	{
+		ERROR_STREAM(name << ": " << num_missing << " of the " << golden_rows.size() << " golden rows are missing from the output (which has " << output_rows.size() << " rows)");
+		matching = false;
+	}
+
+	return matching;
+}
+
+bool CompareHOG(const string& golden_file, const string& output_file, const string& name, const vector<Tolerance>& tolerances, vector<Drift>& drifts)
+{
+	Utilities::ReaderHOG golden, output;
+	if (!golden.Open(golden_file) || !output.Open(output_file))
+	{
+		ERROR_STREAM("Could not read " << name);
+		return false;
+	}
+
+	if (golden.GetNumFrames() != output.GetNumFrames() || golden.GetNumCols() != output.GetNumCols() || golden.GetNumRows() != output.GetNumRows() ||
+		golden.GetNumChannels() != output.GetNumChannels())
+	{
+		ERROR_STREAM(name << ": the HOG descriptors differ in their size or number of frames");
+		return false;
+	}
+
+	Drift drift(name, "hog", ToleranceOf(tolerances, "hog"));
+	Drift good_frames(name, "hog_good_frame", 0);
+	cv::Mat_<float> golden_descriptor, output_descriptor;
+	bool golden_good, output_good;
+	for (int f = 0; f < golden.GetNumFrames(); ++f)
+	{
+		if (!golden.ReadFrame(f, golden_descriptor, golden_good) || !output.ReadFrame(f, output_descriptor, output_good))
+		{
+			ERROR_STREAM(name << ": could not read frame " << f);
+			return false;
+		}
+
+		good_frames.Add(golden_good, output_good);
+		for (int i = 0; i < (int)golden_descriptor.total(); ++i)
+		{
+			drift.Add(golden_descriptor(i), output_descriptor(i));
+		}
+	}
+
+	drifts.push_back(drift);
+	drifts.push_back(good_frames);
+	return true;
+}
+
+// The faces of a whole video are summarised together (per directory of aligned faces)
+bool CompareImage(const string& golden_file, const string& output_file, const string& name, const vector<Tolerance>& tolerances, map<string, Drift>& image_drifts)
+{
+	cv::Mat golden = cv::imread(golden_file, cv::IMREAD_UNCHANGED);
+	cv::Mat output = cv::imread(output_file, cv::IMREAD_UNCHANGED);
+	if (golden.empty() || output.empty() || golden.size() != output.size() || golden.type() != output.type())
+	{
+		ERROR_STREAM(name << ": the images could not be read or differ in size");
+		return false;
+	}
+
+	string directory = boost::filesystem::path(name).parent_path().string();
+	map<string, Drift>::iterator drift = image_drifts.find(directory);
+	if (drift == image_drifts.end())
+	{
+		drift = image_drifts.insert(std::make_pair(directory, Drift(directory, "aligned", ToleranceOf(tolerances, "aligned")))).first;
+	}
+
+	cv::Mat difference;
+	cv::absdiff(golden, output, difference);
+	difference = difference.reshape(1);
+	double max_difference;
+	cv::minMaxLoc(difference, 0, &max_difference);
+
+	// Per image the largest pixel difference, with the mean over all of the pixels kept separately
+	drift->second.Add(0, max_difference);
+	drift->second.sum_difference += cv::mean(difference)[0] - max_difference;
+	return true;
+}
+
+bool IsImage(const boost::filesystem::path& path)
+{
+	string extension = path.extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	return extension == ".bmp" || extension == ".png" || extension == ".jpg" || extension == ".jpeg";
+}
+
+//===========================================================================
+
+int main(int argc, char **argv)
+{
+
+	vector<string> arguments = get_arguments(argc, argv);
+
+	string golden_directory;
+	string output_directory;
+	string command;
+	string report_file;
+	bool update = false;
+	vector<Tolerance> tolerances;
+
+	for (size_t i = 1; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-golden") == 0 && i + 1 < arguments.size())
+		{
+			golden_directory = arguments[++i];
+		}
+		else if (arguments[i].compare("-output") == 0 && i + 1 < arguments.size())
+		{
+			output_directory = arguments[++i];
+		}
+		else if (arguments[i].compare("-run") == 0 && i + 1 < arguments.size())
+		{
+			command = arguments[++i];
+		}
+		else if (arguments[i].compare("-report") == 0 && i + 1 < arguments.size())
+		{
+			report_file = arguments[++i];
+		}
+		else if (arguments[i].compare("-update") == 0)
+		{
+			update = true;
+		}
+		else if (arguments[i].compare("-tol") == 0 && i + 2 < arguments.size())
+		{
+			Tolerance tolerance = { arguments[i + 1], std::stod(arguments[i + 2]) };
+			tolerances.push_back(tolerance);
+			i += 2;
+		}
+	}
+
+	if (golden_directory.empty() || output_directory.empty())
+	{
+		ERROR_STREAM("Both the golden (-golden) and the output (-output) directories are needed");
+		return 1;
+	}
+
+	// The overrides come before the defaults, so that they match first
+	vector<Tolerance> defaults = DefaultTolerances();
+	tolerances.insert(tolerances.end(), defaults.begin(), defaults.end());
+
+	if (!command.empty())
+	{
+		INFO_STREAM("Running " << command);
+		if (std::system(command.c_str()) != 0)
+		{
+			ERROR_STREAM("The command failed");
+			return 1;
+		}
+	}
+
+	boost::filesystem::path golden_root(golden_directory);
+	boost::filesystem::path output_root(output_directory);
+
+	if (update)
+	{
+		int num_copied = 0;
+		for (boost::filesystem::recursive_directory_iterator it(output_root), end; it != end; ++it)
+		{
+			if (boost::filesystem::is_regular_file(it->path()))
+			{
+				boost::filesystem::path target = golden_root / boost::filesystem::relative(it->path(), output_root);
+				boost::filesystem::create_directories(target.parent_path());
+				boost::filesystem::copy_file(it->path(), target, boost::filesystem::copy_option::overwrite_if_exists);
+				num_copied++;
+			}
+		}
+		INFO_STREAM("Updated " << num_copied << " golden files in " << golden_directory);
+		return 0;
+	}
+
+	if (!boost::filesystem::is_directory(golden_root))
+	{
+		ERROR_STREAM("The golden directory " << golden_directory << " does not exist (create it with -update)");
+		return 1;
+	}
+
+	bool matching = true;
+	vector<Drift> drifts;
+	map<string, Drift> image_drifts;
+	int num_files = 0;
+
+	vector<boost::filesystem::path> golden_files;
+	for (boost::filesystem::recursive_directory_iterator it(golden_root), end; it != end; ++it)
+	{
+		if (boost::filesystem::is_regular_file(it->path()))
+		{
+			golden_files.push_back(it->path());
+		}
+	}
+	std::sort(golden_files.begin(), golden_files.end());
+
+	for (size_t f = 0; f < golden_files.size(); ++f)
+	{
+		string name = boost::filesystem::relative(golden_files[f], golden_root).generic_string();
+		boost::filesystem::path output_file = output_root / boost::filesystem::relative(golden_files[f], golden_root);
+		string extension = golden_files[f].extension().string();
+
+		// Only the outputs with numeric contents are compared (not for example the .txt details of the run)
+		if (extension != ".csv" && extension != ".hog" && !IsImage(golden_files[f]))
+		{
+			continue;
+		}
+
+		num_files++;
+		if (!boost::filesystem::exists(output_file))
+		{
+			ERROR_STREAM(name << " is missing from the output");
+			matching = false;
+			continue;
+		}
+
+		bool compared;
+		if (extension == ".csv")
+		{
+			compared = CompareCSV(golden_files[f].string(), output_file.string(), name, tolerances, drifts);
+		}
+		else if (extension == ".hog")
+		{
+			compared = CompareHOG(golden_files[f].string(), output_file.string(), name, tolerances, drifts);
+		}
+		else
+		{
+			compared = CompareImage(golden_files[f].string(), output_file.string(), name, tolerances, image_drifts);
+		}
+		matching = matching && compared;
+	}
+
+	for (map<string, Drift>::const_iterator drift = image_drifts.begin(); drift != image_drifts.end(); ++drift)
+	{
+		drifts.push_back(drift->second);
+	}
+
+	// The summary, only the quantities that drifted at all
+	INFO_STREAM("Compared " << num_files << " files");
+	cout << std::left << std::setw(40) << "File" << std::setw(24) << "Column" << std::right << std::setw(14) << "Max diff" << std::setw(14) << "Mean diff"
+		<< std::setw(12) << "Tolerance" << std::setw(12) << "Outside" << endl;
+	int num_outside = 0;
+	for (size_t d = 0; d < drifts.size(); ++d)
+	{
+		const Drift& drift = drifts[d];
+		if (drift.num_outside > 0)
+		{
+			num_outside++;
+		}
+		if (drift.max_difference > 0)
+		{
+			cout << std::left << std::setw(40) << drift.file << std::setw(24) << drift.name << std::right << std::setprecision(4) << std::setw(14) << drift.max_difference
+				<< std::setw(14) << drift.MeanDifference() << std::setw(12) << drift.tolerance << std::setw(12) << drift.num_outside << (drift.num_outside > 0 ? "  FAIL" : "") << endl;
+		}
+	}
+
+	if (!report_file.empty())
+	{
+		std::ofstream report(report_file);
+		if (!report.is_open())
+		{
+			ERROR_STREAM("Could not write the report to " << report_file);
+			return 1;
+		}
+
+		report << "file,column,max_difference,mean_difference,tolerance,num_values,num_outside" << endl;
+		for (size_t d = 0; d < drifts.size(); ++d)
+		{
+			report << "\"" << drifts[d].file << "\",\"" << drifts[d].name << "\"," << drifts[d].max_difference << "," << drifts[d].MeanDifference() << ","
+				<< drifts[d].tolerance << "," << drifts[d].num_values << "," << drifts[d].num_outside << endl;
+		}
+	}
+
+	if (num_outside > 0 || !matching)
+	{
+		ERROR_STREAM(num_outside << " quantities drifted outside of their tolerance" << (matching ? "" : ", and some of the outputs are missing or do not match in shape"));
+		return 1;
+	}
+
+	INFO_STREAM("All of the outputs are within their tolerances");
+	return 0;
+}
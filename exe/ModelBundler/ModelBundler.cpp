@@ -0,0 +1,132 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltruaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltruaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltruaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltruaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// ModelBundler.cpp : Converts the landmark detection models to binary model bundles, that are memory mapped on load making model loading faster
+// Usage: ModelBundler -mloc <location of the main model file> [-onnx <directory>]
+// With -onnx the MTCNN face detector, the detection validator and the CEN patch experts of the main model are also exported as ONNX models to the directory
+// With -fp16_weights the CEN patch expert weights are written in half precision, halving the size of the bundle and of the weights in memory
+
+#include "LandmarkCoreIncludes.h"
+
+using namespace std;
+
+vector<string> get_arguments(int argc, char **argv)
+{
+
+	vector<string> arguments;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		arguments.push_back(string(argv[i]));
+	}
+	return arguments;
+}
+
+int main(int argc, char **argv)
+{
+
+	vector<string> arguments = get_arguments(argc, argv);
+
+	string onnx_directory;
+	for (size_t i = 1; i + 1 < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-onnx") == 0)
+		{
+			onnx_directory = arguments[i + 1];
+		}
+	}
+
+	LandmarkDetector::FaceModelParameters det_parameters(arguments);
+
+	// The modules that are being used for tracking
+	LandmarkDetector::CLNF face_model(det_parameters.model_location);
+	if (!face_model.loaded_successfully)
+	{
+		cout << "ERROR: Could not load the landmark detector" << endl;
+		return 1;
+	}
+
+	int num_failed = 0;
+
+	if (!face_model.WriteBundle())
+	{
+		cout << "Could not write the model bundle for the main model" << endl;
+		num_failed++;
+	}
+
+	for (size_t i = 0; i < face_model.hierarchical_models.size(); ++i)
+	{
+		if (!face_model.hierarchical_models[i].WriteBundle())
+		{
+			cout << "Could not write the model bundle for the hierarchical model " << face_model.hierarchical_model_names[i] << endl;
+			num_failed++;
+		}
+	}
+
+	if (!onnx_directory.empty())
+	{
+		if (!face_model.face_detector_MTCNN.empty() && !face_model.face_detector_MTCNN.WriteONNX(onnx_directory))
+		{
+			num_failed++;
+		}
+
+		for (size_t view = 0; view < face_model.landmark_validator.orientations.size(); ++view)
+		{
+			LandmarkDetector::OnnxGraph graph("validator");
+			string location = onnx_directory + "/validator_v" + to_string(view) + ".onnx";
+			if (!face_model.landmark_validator.ExportONNX((int)view, graph) || !graph.Write(location))
+			{
+				cout << "Could not write the ONNX model " << location << endl;
+				num_failed++;
+			}
+		}
+
+		// The views without CEN patch experts of their own (mirrored ones) are skipped
+		for (size_t scale = 0; scale < face_model.patch_experts.patch_scaling.size(); ++scale)
+		{
+			for (int view = 0; view < face_model.patch_experts.nViews(scale); ++view)
+			{
+				LandmarkDetector::OnnxGraph graph("cen");
+				string location = onnx_directory + "/cen_s" + to_string(scale) + "_v" + to_string(view) + ".onnx";
+				if (face_model.patch_experts.ExportONNX((int)scale, view, graph) && !graph.Write(location))
+				{
+					cout << "Could not write the ONNX model " << location << endl;
+					num_failed++;
+				}
+			}
+		}
+	}
+
+	return num_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,421 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltruaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltruaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltruaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltruaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// ModelPruner.cpp : Writes a reduced copy of the models for constrained deployments, that only keeps the views, scales, part models and AU models
+// that are used. The pruned landmark detector is written as a model bundle (see ModelBundler), next to new model files that refer to the original ones.
+// Usage: ModelPruner -mloc <location of the main model file> -out_dir <dir> [-max_yaw <degrees>] [-num_scales <n>] [-parts <name,name,...|none>]
+//                    [-no_validator] [-aus <AU01,AU12,...>] [-au_static]
+// The reduced models are then used through -mloc <dir>/<main model file name> and -au_model <dir>/<AU model file name>
+
+#include "LandmarkCoreIncludes.h"
+#include <FaceAnalyserParameters.h>
+
+// System includes
+#include <fstream>
+#include <limits>
+#include <map>
+#include <set>
+#include <sstream>
+
+// Math includes
+#define _USE_MATH_DEFINES
+#include <cmath>
+
+#ifndef M_PI
+	#define M_PI 3.14159265358979323846
+#endif
+
+// Boost includes
+#include <filesystem.hpp>
+#include <filesystem/fstream.hpp>
+#include <boost/algorithm/string.hpp>
+
+using namespace std;
+
+vector<string> get_arguments(int argc, char **argv)
+{
+
+	vector<string> arguments;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		arguments.push_back(string(argv[i]));
+	}
+	return arguments;
+}
+
+// Reading the lines of a model file, without the carriage returns of files written on Windows
+bool ReadLines(const string& location, vector<string>& lines)
+{
+	ifstream file(location.c_str(), ios_base::in);
+	if (!file.is_open())
+	{
+		cout << "Could not open the model file: " << location << endl;
+		return false;
+	}
+
+	string line;
+	while (getline(file, line))
+	{
+		if (!line.empty() && line.at(line.size() - 1) == '\r')
+		{
+			line = line.substr(0, line.size() - 1);
+		}
+		lines.push_back(line);
+	}
+	return true;
+}
+
+bool WriteLines(const string& location, const vector<string>& lines)
+{
+	ofstream file(location.c_str(), ios_base::out);
+	for (size_t i = 0; i < lines.size(); ++i)
+	{
+		file << lines[i] << endl;
+	}
+
+	if (!file)
+	{
+		cout << "Could not write the model file: " << location << endl;
+		return false;
+	}
+	return true;
+}
+
+// The readers resolve the locations relative to the model file, so the ones kept from the original models are made absolute
+string AbsoluteLocation(const boost::filesystem::path& root, const string& location)
+{
+	return boost::filesystem::absolute(root / location).string();
+}
+
+// Writing the CLNF module file of the pruned model, it refers to the original PDM, triangulations and patch experts (which are only used
+// if the model bundle next to it can not be read) with only the kept scales of the patch experts
+bool WriteCLNFModule(const string& clnf_location, const string& out_location, int num_scales)
+{
+	vector<string> lines;
+	if (!ReadLines(clnf_location, lines))
+	{
+		return false;
+	}
+
+	boost::filesystem::path root = boost::filesystem::path(clnf_location).parent_path();
+
+	vector<string> out_lines;
+	map<string, int> num_scales_written;
+	for (size_t i = 0; i < lines.size(); ++i)
+	{
+		stringstream line_stream(lines[i]);
+		string module;
+		line_stream >> module;
+
+		// The location is the rest of the line
+		string location;
+		getline(line_stream, location);
+		if (module.empty() || location.size() < 2)
+		{
+			out_lines.push_back(lines[i]);
+			continue;
+		}
+		location.erase(location.begin());
+
+		if (module.compare("PatchesIntensity") == 0 || module.compare("PatchesCCNF") == 0 || module.compare("PatchesCEN") == 0)
+		{
+			if (num_scales_written[module]++ >= num_scales)
+			{
+				continue;
+			}
+		}
+
+		out_lines.push_back(module + " " + AbsoluteLocation(root, location));
+	}
+
+	return WriteLines(out_location, out_lines);
+}
+
+// Writing the AU model files with only the regressors and classifiers of the kept AUs (a model producing several AUs is kept if any of them is)
+bool WriteAUModels(const string& au_main_location, const string& out_dir, const set<string>& kept_aus, string& out_main_location)
+{
+	vector<string> lines;
+	if (!ReadLines(au_main_location, lines))
+	{
+		return false;
+	}
+
+	boost::filesystem::path root = boost::filesystem::path(au_main_location).parent_path();
+
+	vector<string> out_lines;
+	for (size_t i = 0; i < lines.size(); ++i)
+	{
+		stringstream line_stream(lines[i]);
+		string module;
+		string location;
+		line_stream >> module >> location;
+		if (module.empty() || location.empty())
+		{
+			out_lines.push_back(lines[i]);
+			continue;
+		}
+
+		if (module.compare("AUPredictor") != 0)
+		{
+			out_lines.push_back(module + " " + AbsoluteLocation(root, location));
+			continue;
+		}
+
+		string predictor_location = (root / location).string();
+		vector<string> predictor_lines;
+		if (!ReadLines(predictor_location, predictor_lines))
+		{
+			return false;
+		}
+
+		boost::filesystem::path predictor_root = boost::filesystem::path(predictor_location).parent_path();
+
+		vector<string> out_predictor_lines;
+		for (size_t p = 0; p < predictor_lines.size(); ++p)
+		{
+			// Each line is the location of a model followed by the comma separated names of the AUs it produces
+			size_t separator = predictor_lines[p].find_first_of(' ');
+			if (separator == string::npos)
+			{
+				continue;
+			}
+
+			vector<string> au_names;
+			string names = predictor_lines[p].substr(separator + 1);
+			names.erase(names.find_last_not_of(" \n\r\t") + 1);
+			boost::split(au_names, names, boost::is_any_of(","));
+
+			bool keep = false;
+			for (size_t n = 0; n < au_names.size(); ++n)
+			{
+				keep = keep || kept_aus.count(au_names[n]) > 0;
+			}
+
+			if (keep)
+			{
+				out_predictor_lines.push_back(AbsoluteLocation(predictor_root, predictor_lines[p].substr(0, separator)) + " " + names);
+			}
+		}
+
+		if (out_predictor_lines.empty())
+		{
+			cout << "None of the AU models of " << predictor_location << " produce the requested AUs" << endl;
+			return false;
+		}
+
+		string predictor_name = boost::filesystem::path(predictor_location).filename().string();
+		if (!WriteLines((boost::filesystem::path(out_dir) / predictor_name).string(), out_predictor_lines))
+		{
+			return false;
+		}
+		out_lines.push_back(module + " " + predictor_name);
+	}
+
+	out_main_location = (boost::filesystem::path(out_dir) / boost::filesystem::path(au_main_location).filename()).string();
+	return WriteLines(out_main_location, out_lines);
+}
+
+int main(int argc, char **argv)
+{
+
+	vector<string> arguments = get_arguments(argc, argv);
+
+	// The deployment profile, by default everything is kept
+	string out_dir;
+	double max_yaw = 180;
+	int num_scales = std::numeric_limits<int>::max();
+	bool all_parts = true;
+	set<string> kept_parts;
+	bool keep_validator = true;
+	set<string> kept_aus;
+
+	for (size_t i = 1; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-out_dir") == 0 && i + 1 < arguments.size())
+		{
+			out_dir = arguments[i + 1];
+			i++;
+		}
+		else if (arguments[i].compare("-max_yaw") == 0 && i + 1 < arguments.size())
+		{
+			max_yaw = stod(arguments[i + 1]);
+			i++;
+		}
+		else if (arguments[i].compare("-num_scales") == 0 && i + 1 < arguments.size())
+		{
+			num_scales = stoi(arguments[i + 1]);
+			i++;
+		}
+		else if (arguments[i].compare("-parts") == 0 && i + 1 < arguments.size())
+		{
+			vector<string> parts;
+			boost::split(parts, arguments[i + 1], boost::is_any_of(","));
+			all_parts = false;
+			if (arguments[i + 1].compare("none") != 0)
+			{
+				kept_parts.insert(parts.begin(), parts.end());
+			}
+			i++;
+		}
+		else if (arguments[i].compare("-no_validator") == 0)
+		{
+			keep_validator = false;
+		}
+		else if (arguments[i].compare("-aus") == 0 && i + 1 < arguments.size())
+		{
+			vector<string> aus;
+			boost::split(aus, arguments[i + 1], boost::is_any_of(","));
+			kept_aus.insert(aus.begin(), aus.end());
+			i++;
+		}
+	}
+
+	if (out_dir.empty())
+	{
+		cout << "ERROR: The output directory has to be given with -out_dir" << endl;
+		return 1;
+	}
+
+	LandmarkDetector::FaceModelParameters det_parameters(arguments);
+	FaceAnalysis::FaceAnalyserParameters face_analysis_params(arguments);
+
+	LandmarkDetector::CLNF face_model(det_parameters.model_location);
+	if (!face_model.loaded_successfully)
+	{
+		cout << "ERROR: Could not load the landmark detector" << endl;
+		return 1;
+	}
+
+	if (!face_model.Prune(num_scales, max_yaw * M_PI / 180.0))
+	{
+		cout << "ERROR: The landmark detector could not be pruned, it can only be pruned when read from the model files (not a model bundle)" << endl;
+		return 1;
+	}
+
+	boost::filesystem::create_directories(out_dir);
+
+	vector<string> lines;
+	if (!ReadLines(det_parameters.model_location, lines))
+	{
+		return 1;
+	}
+
+	boost::filesystem::path root = boost::filesystem::path(det_parameters.model_location).parent_path();
+
+	vector<string> out_lines;
+	for (size_t i = 0; i < lines.size(); ++i)
+	{
+		stringstream line_stream(lines[i]);
+		string module;
+		string location;
+		line_stream >> module >> location;
+		if (module.empty() || location.empty())
+		{
+			out_lines.push_back(lines[i]);
+			continue;
+		}
+
+		// The rest of the line (the part name and the landmark mappings of the part models)
+		string rest;
+		getline(line_stream, rest);
+
+		if (module.compare("LandmarkDetector") == 0)
+		{
+			string clnf_name = boost::filesystem::path(location).filename().string();
+			string clnf_out_location = (boost::filesystem::path(out_dir) / clnf_name).string();
+
+			if (!WriteCLNFModule((root / location).string(), clnf_out_location, num_scales))
+			{
+				return 1;
+			}
+
+			if (!face_model.WriteBundle(clnf_out_location + ".bundle"))
+			{
+				cout << "WARNING: the model bundle could not be written, only the scales of the patch experts are pruned" << endl;
+			}
+
+			out_lines.push_back(module + " " + clnf_name);
+		}
+		else if (module.compare("LandmarkDetector_part") == 0)
+		{
+			stringstream rest_stream(rest);
+			string part_name;
+			rest_stream >> part_name;
+
+			if (all_parts || kept_parts.count(part_name) > 0)
+			{
+				out_lines.push_back(module + " " + AbsoluteLocation(root, location) + rest);
+			}
+			else
+			{
+				cout << "Removing the part model: " << part_name << endl;
+			}
+		}
+		else if (module.compare("DetectionValidator") == 0)
+		{
+			if (keep_validator)
+			{
+				out_lines.push_back(module + " " + AbsoluteLocation(root, location) + rest);
+			}
+			else
+			{
+				cout << "Removing the landmark validation module" << endl;
+			}
+		}
+		else
+		{
+			out_lines.push_back(module + " " + AbsoluteLocation(root, location) + rest);
+		}
+	}
+
+	string out_main_location = (boost::filesystem::path(out_dir) / boost::filesystem::path(det_parameters.model_location).filename()).string();
+	if (!WriteLines(out_main_location, out_lines))
+	{
+		return 1;
+	}
+	cout << "The pruned landmark detector can be used with: -mloc " << out_main_location << endl;
+
+	if (!kept_aus.empty())
+	{
+		string out_au_location;
+		if (!WriteAUModels(face_analysis_params.getModelLoc(), out_dir, kept_aus, out_au_location))
+		{
+			return 1;
+		}
+		cout << "The pruned AU models can be used with: -au_model " << out_au_location << endl;
+	}
+
+	return 0;
+}
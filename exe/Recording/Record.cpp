@@ -32,22 +32,30 @@
 //
 ///////////////////////////////////////////////////////////////////////////////
 
-// Record.cpp : A useful function for quick recording from a webcam for test purposes
+// Record.cpp : Recording from one or more webcams for dataset collection. Every camera is captured on a thread of its own into a ring
+// buffer of preallocated frames, from which a writer thread saves the frames as images together with their capture times. The recordings
+// are directories of images that can be read with -fdir, the timestamps.csv index in them provides the capture times of the images.
+//
+// Usage:
+//	Recording -dev 0 -dev 1 -of recordings/ [-width 1280 -height 720 -fps 60] [-raw] [-buffer 512] [-duration 60] [-no_preview]
 
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
 #include <fstream>
-#include <sstream>
-
 #include <iostream>
-
-#include <windows.h>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
-#include <opencv2/videoio/videoio.hpp>  // Video write
-#include <opencv2/videoio/videoio_c.h>  // Video write
-
-#include <stdio.h>
-#include <time.h>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/videoio/videoio.hpp>
 
 #include <filesystem.hpp>
 #include <filesystem/fstream.hpp>
@@ -61,28 +69,18 @@ std::cout << "Warning: " << stream << std::endl
 #define ERROR_STREAM( stream ) \
 std::cout << "Error: " << stream << std::endl
 
-static void printErrorAndAbort( const std::string & error )
-{
-    std::cout << error << std::endl;
-    abort();
-}
-
-#define FATAL_STREAM( stream ) \
-printErrorAndAbort( std::string( "Fatal error: " ) + stream )
-
 using namespace std;
 
-// Get current date/time, format is YYYY-MM-DD.HH:mm:ss
+// Get current date/time, format is YYYY-MM-DD-HH-mm
 const std::string currentDateTime() {
-    time_t     now = time(0);
-    struct tm  tstruct;
-    char       buf[80];
-    localtime_s(&tstruct, &now);
-    // Visit http://www.cplusplus.com/reference/clibrary/ctime/strftime/
-    // for more information about date/time format
-    strftime(buf, sizeof(buf), "%Y-%m-%d-%H-%M", &tstruct);
-
-    return buf;
+	time_t     now = time(0);
+	struct tm  tstruct = *localtime(&now);
+	char       buf[80];
+	// Visit http://www.cplusplus.com/reference/clibrary/ctime/strftime/
+	// for more information about date/time format
+	strftime(buf, sizeof(buf), "%Y-%m-%d-%H-%M", &tstruct);
+
+	return buf;
 }
 
 vector<string> get_arguments(int argc, char **argv)
@@ -97,110 +95,377 @@ vector<string> get_arguments(int argc, char **argv)
 	return arguments;
 }
 
+// A single producer, single consumer ring of preallocated frames. The capture thread fills the slot at the head and the writer empties the
+// one at the tail, the slots are handed over through the two atomic counters only so neither side ever waits on a lock
+class FrameRing
+{
+public:
+
+	FrameRing(size_t capacity, int height, int width, int type) : slots(capacity), head(0), tail(0)
+	{
+		for (size_t i = 0; i < slots.size(); ++i)
+		{
+			slots[i].image.create(height, width, type);
+		}
+	}
+
+	struct Slot
+	{
+		cv::Mat image;
+		double time_stamp;
+	};
+
+	// The slot to capture into, NULL if the writer has not freed one yet
+	Slot* Reserve()
+	{
+		size_t current = head.load(std::memory_order_relaxed);
+		if (current - tail.load(std::memory_order_acquire) >= slots.size())
+		{
+			return NULL;
+		}
+		return &slots[current % slots.size()];
+	}
+
+	void Commit()
+	{
+		head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// The oldest captured slot, NULL if there is none
+	Slot* Front()
+	{
+		size_t current = tail.load(std::memory_order_relaxed);
+		if (current == head.load(std::memory_order_acquire))
+		{
+			return NULL;
+		}
+		return &slots[current % slots.size()];
+	}
+
+	void Release()
+	{
+		tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	size_t Size() const { return head.load() - tail.load(); }
+
+private:
+
+	std::vector<Slot> slots;
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+};
+
+// Everything about the recording of a single camera
+struct CameraRecording
+{
+	int device;
+	cv::VideoCapture capture;
+	boost::filesystem::path directory;
+	std::unique_ptr<FrameRing> ring;
+
+	std::atomic<size_t> num_captured;
+	std::atomic<size_t> num_written;
+	std::atomic<size_t> num_dropped;
+	std::atomic<size_t> max_buffered;
+
+	// A copy of the latest frame for the preview, only taken when the preview asked for one
+	std::mutex preview_mutex;
+	cv::Mat preview;
+	std::atomic<bool> preview_requested;
+
+	std::thread capture_thread;
+	std::thread writer_thread;
+
+	CameraRecording() : device(0), num_captured(0), num_written(0), num_dropped(0), max_buffered(0), preview_requested(false) {}
+};
+
+// Grabbing the frames as fast as the camera delivers them, the time stamp is taken when the frame is grabbed before it is decoded. When
+// the writer falls so far behind that the ring is full the frame is still grabbed (so the camera driver does not back up) but dropped
+static void CaptureFrames(CameraRecording& camera, const std::atomic<bool>& recording, std::chrono::steady_clock::time_point start_time)
+{
+	cv::Mat discarded;
+	while (recording)
+	{
+		if (!camera.capture.grab())
+		{
+			WARN_STREAM("Camera " << camera.device << " stopped delivering frames");
+			break;
+		}
+		double time_stamp = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+		camera.num_captured++;
+
+		FrameRing::Slot* slot = camera.ring->Reserve();
+		if (slot == NULL)
+		{
+			camera.capture.retrieve(discarded);
+			camera.num_dropped++;
+			continue;
+		}
+
+		if (!camera.capture.retrieve(slot->image) || slot->image.empty())
+		{
+			camera.num_dropped++;
+			continue;
+		}
+		slot->time_stamp = time_stamp;
+
+		if (camera.preview_requested)
+		{
+			std::lock_guard<std::mutex> lock(camera.preview_mutex);
+			slot->image.copyTo(camera.preview);
+			camera.preview_requested = false;
+		}
+
+		camera.ring->Commit();
+
+		size_t buffered = camera.ring->Size();
+		if (buffered > camera.max_buffered)
+		{
+			camera.max_buffered = buffered;
+		}
+	}
+}
+
+// Saving the captured frames in order and indexing them, until the capture has stopped and the ring is empty
+static void WriteFrames(CameraRecording& camera, const std::atomic<bool>& capturing, bool raw)
+{
+	boost::filesystem::ofstream index((camera.directory / "timestamps.csv"));
+	index << "frame, timestamp" << endl;
+
+	// The PNG compression is kept at its fastest, so that the writing keeps up with the capture
+	std::vector<int> write_params;
+	if (!raw)
+	{
+		write_params.push_back(cv::IMWRITE_PNG_COMPRESSION);
+		write_params.push_back(1);
+	}
+
+	char name[64];
+	while (true)
+	{
+		FrameRing::Slot* slot = camera.ring->Front();
+		if (slot == NULL)
+		{
+			if (!capturing)
+			{
+				break;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		size_t frame = camera.num_written + 1;
+		std::snprintf(name, sizeof(name), raw ? "frame_%08zu.bmp" : "frame_%08zu.png", frame);
+		if (!cv::imwrite((camera.directory / name).string(), slot->image, write_params))
+		{
+			ERROR_STREAM("Could not write " << (camera.directory / name).string());
+		}
+		index << frame << ", " << std::fixed << slot->time_stamp << "\n";
+
+		camera.ring->Release();
+		camera.num_written++;
+	}
+	index.flush();
+}
+
 int main (int argc, char **argv)
 {
 
 	vector<string> arguments = get_arguments(argc, argv);
 
-	// Some initial parameters that can be overriden from command line	
-	string outroot, outfile;
+	// Some initial parameters that can be overriden from command line
+	string outroot = (boost::filesystem::current_path() / "recording").string();
+	string outname = currentDateTime();
 
-	TCHAR NPath[200];
-	GetCurrentDirectory(200, NPath);
+	// By default try the first webcam, at the resolution and rate it opens with
+	vector<int> devices;
+	int width = 0, height = 0;
+	double fps = 0;
 
-	// By default write to same directory
-	outroot = NPath;
-	outroot = outroot + "/recording/";
-	outfile = currentDateTime() + ".avi";
-
-	// By default try webcam
-	int device = 0;
+	// The frames buffered per camera while the disk is behind, and the recording length in seconds (until q is pressed by default)
+	int buffer_frames = 256;
+	double duration = 0;
+	bool raw = false;
+	bool preview = true;
 
 	for (size_t i = 0; i < arguments.size(); i++)
-    {
-		if( strcmp( arguments[i].c_str(), "-dev") == 0 )
-        {
-			std::stringstream ss;
-            ss << arguments[i+1].c_str();
-            ss >> device;
-        }
-        else if (strcmp(arguments[i].c_str(), "-r") == 0)
-        {
-			outroot = arguments[i+1];
-        }
-        else if (strcmp(arguments[i].c_str(), "-of") == 0)
-        {
-			outroot = arguments[i+1];
-        }
-        else
-        {
-            WARN_STREAM( "invalid argument" );
-        }
-        i++;
-    }    		
-
-	// Do some grabbing
-	cv::VideoCapture vCap;
-	INFO_STREAM( "Attempting to capture from device: " << device );
-	vCap = cv::VideoCapture( device );
-
-	if (!vCap.isOpened()) {
-		FATAL_STREAM("Failed to open video source");
+	{
+		if (arguments[i].compare("-dev") == 0 && i + 1 < arguments.size())
+		{
+			devices.push_back(atoi(arguments[++i].c_str()));
+		}
+		else if ((arguments[i].compare("-r") == 0 || arguments[i].compare("-of") == 0) && i + 1 < arguments.size())
+		{
+			outroot = arguments[++i];
+		}
+		else if (arguments[i].compare("-width") == 0 && i + 1 < arguments.size())
+		{
+			width = atoi(arguments[++i].c_str());
+		}
+		else if (arguments[i].compare("-height") == 0 && i + 1 < arguments.size())
+		{
+			height = atoi(arguments[++i].c_str());
+		}
+		else if (arguments[i].compare("-fps") == 0 && i + 1 < arguments.size())
+		{
+			fps = atof(arguments[++i].c_str());
+		}
+		else if (arguments[i].compare("-buffer") == 0 && i + 1 < arguments.size())
+		{
+			buffer_frames = std::max(1, atoi(arguments[++i].c_str()));
+		}
+		else if (arguments[i].compare("-duration") == 0 && i + 1 < arguments.size())
+		{
+			duration = atof(arguments[++i].c_str());
+		}
+		else if (arguments[i].compare("-raw") == 0)
+		{
+			raw = true;
+		}
+		else if (arguments[i].compare("-no_preview") == 0)
+		{
+			preview = false;
+		}
+		else
+		{
+			WARN_STREAM("invalid argument " << arguments[i]);
+		}
+	}
+
+	if (devices.empty())
+	{
+		devices.push_back(0);
+	}
+
+	// Without a preview window there is no way to press q
+	if (!preview && duration <= 0)
+	{
+		ERROR_STREAM("A -duration is needed when recording without a preview");
 		return 1;
 	}
-	
-	cv::Mat img;
-	vCap >> img;
-			
-	boost::filesystem::path dir(outroot);
-	boost::filesystem::create_directory(dir);
-
-	string out_file = outroot + outfile;
-	// saving the videos
-	cv::VideoWriter video_writer(out_file, CV_FOURCC('D','I','V','X'), 30, img.size(), true);
-
-	ofstream outlog;
-	outlog.open((outroot + outfile + ".log").c_str(), ios_base::out);
-	outlog << "frame, time(ms)" << endl;
-
-	double freq = cv::getTickFrequency();
-
-	double init_time = (double)cv::getTickCount();
-
-	int frameProc = 0;
-	while(!img.empty())
-	{		
-		
-		cv::namedWindow("rec",1);
-		
-		vCap >> img;
-		double curr_time = (cv::getTickCount() - init_time) / freq;
-		curr_time *= 1000;
-
-		video_writer << img;
-
-		outlog << frameProc + 1 << " " << curr_time;
-		outlog << endl;
-						
-		
-		cv::imshow("rec", img);
-
-		frameProc++;
-		
+
+	// Opening all of the cameras before any of them starts recording
+	vector<std::unique_ptr<CameraRecording> > cameras;
+	for (size_t i = 0; i < devices.size(); ++i)
+	{
+		std::unique_ptr<CameraRecording> camera(new CameraRecording());
+		camera->device = devices[i];
+
+		INFO_STREAM("Attempting to capture from device: " << camera->device);
+		camera->capture.open(camera->device);
+		if (!camera->capture.isOpened())
+		{
+			ERROR_STREAM("Failed to open video source " << camera->device);
+			return 1;
+		}
+		if (width > 0 && height > 0)
+		{
+			camera->capture.set(cv::CAP_PROP_FRAME_WIDTH, width);
+			camera->capture.set(cv::CAP_PROP_FRAME_HEIGHT, height);
+		}
+		if (fps > 0)
+		{
+			camera->capture.set(cv::CAP_PROP_FPS, fps);
+		}
+
+		// The first frame gives the size of the ring's frames
+		cv::Mat img;
+		if (!camera->capture.read(img) || img.empty())
+		{
+			ERROR_STREAM("Could not read a frame from device " << camera->device);
+			return 1;
+		}
+		INFO_STREAM("Device " << camera->device << ": " << img.cols << "x" << img.rows << " at " << camera->capture.get(cv::CAP_PROP_FPS) << " fps");
+
+		std::stringstream directory_name;
+		directory_name << outname << "_cam" << camera->device;
+		camera->directory = boost::filesystem::path(outroot) / directory_name.str();
+		boost::system::error_code error;
+		boost::filesystem::create_directories(camera->directory, error);
+		if (!boost::filesystem::is_directory(camera->directory))
+		{
+			ERROR_STREAM("Could not create the output directory " << camera->directory.string());
+			return 1;
+		}
+
+		camera->ring.reset(new FrameRing(buffer_frames, img.rows, img.cols, img.type()));
+		cameras.push_back(std::move(camera));
+	}
+
+	// All of the cameras share the start time, so that their time stamps can be compared
+	std::atomic<bool> recording(true);
+	std::atomic<bool> capturing(true);
+	std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < cameras.size(); ++i)
+	{
+		CameraRecording& camera = *cameras[i];
+		camera.capture_thread = std::thread(CaptureFrames, std::ref(camera), std::cref(recording), start_time);
+		camera.writer_thread = std::thread(WriteFrames, std::ref(camera), std::cref(capturing), raw);
+	}
+	INFO_STREAM("Recording to " << outroot << ", press q in the preview to stop");
+
+	// The preview is shown from the main thread at a modest rate, it never holds up the capture
+	while (recording)
+	{
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+		if (duration > 0 && elapsed >= duration)
+		{
+			break;
+		}
+
+		if (!preview)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			continue;
+		}
+
+		for (size_t i = 0; i < cameras.size(); ++i)
+		{
+			CameraRecording& camera = *cameras[i];
+			cv::Mat shown;
+			{
+				std::lock_guard<std::mutex> lock(camera.preview_mutex);
+				shown = camera.preview;
+				camera.preview = cv::Mat();
+			}
+			if (!shown.empty())
+			{
+				cv::imshow("rec " + std::to_string(camera.device), shown);
+			}
+			camera.preview_requested = true;
+		}
+
 		// detect key presses
-		char c = cv::waitKey(1);
-			
-		// quit the application
-		if(c=='q')
+		char c = cv::waitKey(30);
+
+		// stop recording
+		if (c == 'q')
 		{
-			outlog.close();
-				
-			return(0);
+			break;
 		}
+	}
 
+	// Stopping the capture first, the writers then write out whatever is still buffered
+	recording = false;
+	for (size_t i = 0; i < cameras.size(); ++i)
+	{
+		cameras[i]->capture_thread.join();
+	}
+	capturing = false;
+	for (size_t i = 0; i < cameras.size(); ++i)
+	{
+		CameraRecording& camera = *cameras[i];
+		camera.writer_thread.join();
+		camera.capture.release();
 
+		INFO_STREAM("Device " << camera.device << ": " << camera.num_written << " frames written to " << camera.directory.string() << ", " << camera.num_dropped
+			<< " of " << camera.num_captured << " dropped, at most " << camera.max_buffered << " of " << buffer_frames << " frames buffered");
+		if (camera.num_dropped > 0)
+		{
+			WARN_STREAM("Frames were dropped on device " << camera.device << ", use a larger -buffer, -raw or a faster disk");
+		}
 	}
-			
+
 	return 0;
 }
-
@@ -0,0 +1,488 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// ScalingBenchmark.cpp : Sweeping the number of threads, the number of faces per frame, the input resolution and the face detector, and reporting
+// the per frame latency percentiles and the throughput of single face video tracking (DetectLandmarksInVideo), of multiple face tracking
+// (MultiFaceTracker) and of the face analysis (FaceAnalyser) of every tracked face. This shows how well the parallel work scales with the cores
+// and with the faces, which openface_bench (a fixed configuration, median times) does not.
+//
+// Usage: openface_scaling_bench -f <video> [-mloc <landmark model>] [-threads_sweep 1,2,4,8] [-faces_sweep 1,2,4,9,16]
+//                               [-resolutions 480p,720p,1080p,4k] [-detectors mtcnn,hog,haar] [-bench_frames <n>] [-no_analyser] [-out <csv file>]
+// The frames with several faces are mosaics of the clip (its frames tiled in a grid), scaled to the resolution. By default the thread counts
+// are the powers of two up to the number of cores.
+
+// Local includes
+#include "LandmarkCoreIncludes.h"
+#include "MultiFaceTracker.h"
+
+#include <Concurrency.h>
+#include <FaceAnalyser.h>
+#include <SequenceCapture.h>
+
+// System includes
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#define INFO_STREAM( stream ) \
+std::cout << stream << std::endl
+
+#define WARN_STREAM( stream ) \
+std::cout << "Warning: " << stream << std::endl
+
+#define ERROR_STREAM( stream ) \
+std::cout << "Error: " << stream << std::endl
+
+using namespace std;
+
+vector<string> get_arguments(int argc, char **argv)
+{
+
+	vector<string> arguments;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		arguments.push_back(string(argv[i]));
+	}
+	return arguments;
+}
+
+// A comma separated list
+vector<string> SplitList(const string& list)
+{
+	vector<string> items;
+	std::stringstream stream(list);
+	string item;
+	while (std::getline(stream, item, ','))
+	{
+		if (!item.empty())
+		{
+			items.push_back(item);
+		}
+	}
+	return items;
+}
+
+bool ParseResolution(const string& name, cv::Size& resolution)
+{
+	if (name == "480p") resolution = cv::Size(640, 480);
+	else if (name == "720p") resolution = cv::Size(1280, 720);
+	else if (name == "1080p") resolution = cv::Size(1920, 1080);
+	else if (name == "1440p") resolution = cv::Size(2560, 1440);
+	else if (name == "4k" || name == "2160p") resolution = cv::Size(3840, 2160);
+	else
+	{
+		// Or given as <width>x<height>
+		int width = 0, height = 0;
+		char separator = 0;
+		std::stringstream data(name);
+		data >> width >> separator >> height;
+		if (!data || separator != 'x' || width <= 0 || height <= 0)
+		{
+			return false;
+		}
+		resolution = cv::Size(width, height);
+	}
+	return true;
+}
+
+bool ParseDetector(const string& name, LandmarkDetector::FaceModelParameters::FaceDetector& detector)
+{
+	if (name == "mtcnn") detector = LandmarkDetector::FaceModelParameters::MTCNN_DETECTOR;
+	else if (name == "hog") detector = LandmarkDetector::FaceModelParameters::HOG_SVM_DETECTOR;
+	else if (name == "haar") detector = LandmarkDetector::FaceModelParameters::HAAR_DETECTOR;
+	else return false;
+	return true;
+}
+
+// The frame with num_faces copies of the clip frame tiled in a grid, at the given resolution (the cells keep the aspect ratio of the clip)
+cv::Mat MakeMosaic(const cv::Mat& frame, int num_faces, const cv::Size& resolution)
+{
+	int grid = (int)std::ceil(std::sqrt((double)num_faces));
+	cv::Mat mosaic(resolution, frame.type(), cv::Scalar::all(0));
+
+	int cell_width = resolution.width / grid;
+	int cell_height = resolution.height / grid;
+	double scale = std::min(cell_width / (double)frame.cols, cell_height / (double)frame.rows);
+	cv::Size cell_size(std::max(1, (int)(frame.cols * scale)), std::max(1, (int)(frame.rows * scale)));
+
+	cv::Mat cell;
+	cv::resize(frame, cell, cell_size, 0, 0, cv::INTER_AREA);
+	for (int face = 0; face < num_faces; ++face)
+	{
+		int x = (face % grid) * cell_width + (cell_width - cell_size.width) / 2;
+		int y = (face / grid) * cell_height + (cell_height - cell_size.height) / 2;
+		cell.copyTo(mosaic(cv::Rect(x, y, cell_size.width, cell_size.height)));
+	}
+	return mosaic;
+}
+
+// The latencies of a stage over the frames of a configuration
+struct StageResult
+{
+	string stage;
+	int num_threads;
+	int num_faces;
+	cv::Size resolution;
+	string detector;
+
+	double p50_ms;
+	double p90_ms;
+	double p99_ms;
+	double max_ms;
+	double fps;
+
+	// The faces tracked on average, and the faces processed per second
+	double tracked_faces;
+	double faces_per_second;
+};
+
+double Percentile(const vector<double>& sorted, double percentile)
+{
+	if (sorted.empty())
+	{
+		return 0;
+	}
+	size_t index = (size_t)std::min((double)sorted.size() - 1, std::floor(percentile * (sorted.size() - 1) + 0.5));
+	return sorted[index];
+}
+
+StageResult Summarise(const string& stage, int num_threads, int num_faces, const cv::Size& resolution, const string& detector, vector<double> latencies_ms, double total_faces)
+{
+	std::sort(latencies_ms.begin(), latencies_ms.end());
+	double total_ms = 0;
+	for (size_t i = 0; i < latencies_ms.size(); ++i)
+	{
+		total_ms += latencies_ms[i];
+	}
+
+	StageResult result;
+	result.stage = stage;
+	result.num_threads = num_threads;
+	result.num_faces = num_faces;
+	result.resolution = resolution;
+	result.detector = detector;
+	result.p50_ms = Percentile(latencies_ms, 0.5);
+	result.p90_ms = Percentile(latencies_ms, 0.9);
+	result.p99_ms = Percentile(latencies_ms, 0.99);
+	result.max_ms = latencies_ms.empty() ? 0 : latencies_ms.back();
+	result.fps = total_ms > 0 ? latencies_ms.size() * 1000.0 / total_ms : 0;
+	result.tracked_faces = latencies_ms.empty() ? 0 : total_faces / latencies_ms.size();
+	result.faces_per_second = total_ms > 0 ? total_faces * 1000.0 / total_ms : 0;
+
+	cout << std::left << std::setw(10) << stage << std::right << std::setw(8) << num_threads << std::setw(7) << num_faces << std::setw(12)
+		<< (to_string(resolution.width) + "x" + to_string(resolution.height)) << std::setw(8) << detector << std::fixed << std::setprecision(2)
+		<< std::setw(10) << result.p50_ms << std::setw(10) << result.p90_ms << std::setw(10) << result.p99_ms << std::setw(10) << result.fps
+		<< std::setw(10) << result.tracked_faces << std::setw(12) << result.faces_per_second << endl;
+	return result;
+}
+
+double MillisecondsSince(const std::chrono::steady_clock::time_point& start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+
+	vector<string> arguments = get_arguments(argc, argv);
+
+	int num_frames = 60;
+	string output_file;
+	bool analyse = true;
+
+	vector<int> thread_counts;
+	for (int threads = 1; threads <= (int)std::max(1u, std::thread::hardware_concurrency()); threads *= 2)
+	{
+		thread_counts.push_back(threads);
+	}
+	if (thread_counts.back() != (int)std::max(1u, std::thread::hardware_concurrency()))
+	{
+		thread_counts.push_back((int)std::thread::hardware_concurrency());
+	}
+	vector<int> face_counts = { 1, 2, 4, 9, 16 };
+	vector<string> resolution_names = { "480p", "720p", "1080p", "4k" };
+	vector<string> detector_names = { "mtcnn", "hog" };
+	bool has_video = false;
+
+	for (size_t i = 1; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-threads_sweep") == 0 && i + 1 < arguments.size())
+		{
+			thread_counts.clear();
+			vector<string> items = SplitList(arguments[i + 1]);
+			for (size_t t = 0; t < items.size(); ++t)
+			{
+				thread_counts.push_back(std::max(1, std::stoi(items[t])));
+			}
+		}
+		else if (arguments[i].compare("-faces_sweep") == 0 && i + 1 < arguments.size())
+		{
+			face_counts.clear();
+			vector<string> items = SplitList(arguments[i + 1]);
+			for (size_t f = 0; f < items.size(); ++f)
+			{
+				face_counts.push_back(std::max(1, std::stoi(items[f])));
+			}
+		}
+		else if (arguments[i].compare("-resolutions") == 0 && i + 1 < arguments.size())
+		{
+			resolution_names = SplitList(arguments[i + 1]);
+		}
+		else if (arguments[i].compare("-detectors") == 0 && i + 1 < arguments.size())
+		{
+			detector_names = SplitList(arguments[i + 1]);
+		}
+		else if (arguments[i].compare("-bench_frames") == 0 && i + 1 < arguments.size())
+		{
+			num_frames = std::stoi(arguments[i + 1]);
+		}
+		else if (arguments[i].compare("-out") == 0 && i + 1 < arguments.size())
+		{
+			output_file = arguments[i + 1];
+		}
+		else if (arguments[i].compare("-no_analyser") == 0)
+		{
+			analyse = false;
+		}
+		else if (arguments[i].compare("-f") == 0)
+		{
+			has_video = true;
+		}
+	}
+
+	if (!has_video || thread_counts.empty() || face_counts.empty() || resolution_names.empty() || detector_names.empty())
+	{
+		ERROR_STREAM("A video with a face (-f) and non-empty sweeps are needed");
+		return 1;
+	}
+
+	vector<cv::Size> resolutions;
+	for (size_t r = 0; r < resolution_names.size(); ++r)
+	{
+		cv::Size resolution;
+		if (!ParseResolution(resolution_names[r], resolution))
+		{
+			ERROR_STREAM("Unknown resolution " << resolution_names[r] << " (480p, 720p, 1080p, 1440p, 4k or <width>x<height>)");
+			return 1;
+		}
+		resolutions.push_back(resolution);
+	}
+
+	LandmarkDetector::FaceModelParameters det_parameters(arguments);
+	// The multiple face tracking detects the faces itself
+	det_parameters.reinit_video_every = -1;
+
+	LandmarkDetector::CLNF face_model(det_parameters.model_location);
+	if (!face_model.loaded_successfully)
+	{
+		ERROR_STREAM("Could not load the landmark detector");
+		return 1;
+	}
+
+	face_model.face_detector_HAAR.load(det_parameters.haar_face_detector_location);
+	face_model.haar_face_detector_location = det_parameters.haar_face_detector_location;
+	face_model.face_detector_MTCNN.Read(det_parameters.mtcnn_face_detector_location);
+	face_model.mtcnn_face_detector_location = det_parameters.mtcnn_face_detector_location;
+
+	FaceAnalysis::FaceAnalyserParameters face_analysis_params(arguments);
+	face_analysis_params.OptimizeForImages();
+	std::unique_ptr<FaceAnalysis::FaceAnalyser> face_analyser;
+	if (analyse)
+	{
+		face_analyser.reset(new FaceAnalysis::FaceAnalyser(face_analysis_params));
+	}
+
+	// The clip, read in fully before benchmarking so that the decoding is not timed
+	vector<cv::Mat> frames;
+	Utilities::SequenceCapture sequence_reader;
+	if (!sequence_reader.Open(arguments))
+	{
+		ERROR_STREAM("Could not open the benchmark video");
+		return 1;
+	}
+	double fps_video = sequence_reader.fps > 0 ? sequence_reader.fps : 30;
+
+	cv::Mat frame = sequence_reader.GetNextFrame();
+	while (!frame.empty() && (int)frames.size() < num_frames)
+	{
+		frames.push_back(frame.clone());
+		frame = sequence_reader.GetNextFrame();
+	}
+	sequence_reader.Close();
+
+	if (frames.empty())
+	{
+		ERROR_STREAM("The benchmark video has no frames");
+		return 1;
+	}
+
+	cout << std::left << std::setw(10) << "Stage" << std::right << std::setw(8) << "Threads" << std::setw(7) << "Faces" << std::setw(12) << "Resolution"
+		<< std::setw(8) << "Det" << std::setw(10) << "p50 ms" << std::setw(10) << "p90 ms" << std::setw(10) << "p99 ms" << std::setw(10) << "FPS"
+		<< std::setw(10) << "Tracked" << std::setw(12) << "Faces/s" << endl;
+
+	vector<StageResult> results;
+
+	for (size_t d = 0; d < detector_names.size(); ++d)
+	{
+		LandmarkDetector::FaceModelParameters::FaceDetector detector;
+		if (!ParseDetector(detector_names[d], detector))
+		{
+			ERROR_STREAM("Unknown face detector " << detector_names[d] << " (mtcnn, hog or haar)");
+			return 1;
+		}
+		if ((detector == LandmarkDetector::FaceModelParameters::MTCNN_DETECTOR && face_model.face_detector_MTCNN.empty()) ||
+			(detector == LandmarkDetector::FaceModelParameters::HAAR_DETECTOR && face_model.face_detector_HAAR.empty()))
+		{
+			WARN_STREAM("Skipping the " << detector_names[d] << " face detector, as it could not be loaded");
+			continue;
+		}
+
+		LandmarkDetector::FaceModelParameters parameters(det_parameters);
+		parameters.curr_face_detector = detector;
+
+		for (size_t r = 0; r < resolutions.size(); ++r)
+		{
+			for (size_t f = 0; f < face_counts.size(); ++f)
+			{
+				int num_faces = face_counts[f];
+
+				// The frames of the configuration, converted before timing
+				vector<cv::Mat> mosaics(frames.size());
+				vector<cv::Mat_<uchar> > gray_mosaics(frames.size());
+				for (size_t i = 0; i < frames.size(); ++i)
+				{
+					mosaics[i] = MakeMosaic(frames[i], num_faces, resolutions[r]);
+					cv::cvtColor(mosaics[i], gray_mosaics[i], cv::COLOR_BGR2GRAY);
+				}
+
+				for (size_t t = 0; t < thread_counts.size(); ++t)
+				{
+					Utilities::Concurrency::SetNumThreads(thread_counts[t]);
+
+					// Single face tracking, only meaningful with one face in the frame
+					if (num_faces == 1)
+					{
+						LandmarkDetector::CLNF tracking_model(face_model);
+						vector<double> latencies;
+						double total_faces = 0;
+						for (size_t i = 0; i < mosaics.size(); ++i)
+						{
+							auto start = std::chrono::steady_clock::now();
+							bool success = LandmarkDetector::DetectLandmarksInVideo(mosaics[i], tracking_model, parameters, gray_mosaics[i]);
+							latencies.push_back(MillisecondsSince(start));
+							total_faces += success ? 1 : 0;
+						}
+						results.push_back(Summarise("video", thread_counts[t], num_faces, resolutions[r], detector_names[d], latencies, total_faces));
+					}
+
+					// Multiple face tracking, and the analysis of every tracked face
+					LandmarkDetector::MultiFaceTracker face_tracker(face_model, parameters);
+					vector<double> track_latencies, analyser_latencies;
+					double total_tracked = 0, total_analysed = 0;
+					for (size_t i = 0; i < mosaics.size(); ++i)
+					{
+						double time_stamp = i / fps_video;
+
+						auto start = std::chrono::steady_clock::now();
+						face_tracker.Track(mosaics[i], gray_mosaics[i], time_stamp);
+						track_latencies.push_back(MillisecondsSince(start));
+
+						int num_tracked = 0;
+						for (size_t face = 0; face < face_tracker.GetNumFaces(); ++face)
+						{
+							num_tracked += face_tracker.GetFace(face).detection_success ? 1 : 0;
+						}
+						total_tracked += num_tracked;
+
+						if (face_analyser)
+						{
+							start = std::chrono::steady_clock::now();
+							for (size_t face = 0; face < face_tracker.GetNumFaces(); ++face)
+							{
+								const LandmarkDetector::CLNF& face_result = face_tracker.GetFace(face);
+								if (face_result.detection_success)
+								{
+									face_analyser->PredictStaticAUsAndComputeFeatures(mosaics[i], face_result.detected_landmarks);
+								}
+							}
+							analyser_latencies.push_back(MillisecondsSince(start));
+							total_analysed += num_tracked;
+						}
+					}
+					results.push_back(Summarise("multi", thread_counts[t], num_faces, resolutions[r], detector_names[d], track_latencies, total_tracked));
+					if (face_analyser)
+					{
+						results.push_back(Summarise("analyser", thread_counts[t], num_faces, resolutions[r], detector_names[d], analyser_latencies, total_analysed));
+					}
+				}
+			}
+		}
+	}
+
+	Utilities::Concurrency::SetNumThreads(0);
+
+	if (!output_file.empty())
+	{
+		std::ofstream out(output_file);
+		if (!out.is_open())
+		{
+			ERROR_STREAM("Could not write the results to " << output_file);
+			return 1;
+		}
+
+		out << "stage,threads,faces,width,height,detector,p50_ms,p90_ms,p99_ms,max_ms,fps,tracked_faces,faces_per_second" << endl;
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			const StageResult& result = results[i];
+			out << result.stage << "," << result.num_threads << "," << result.num_faces << "," << result.resolution.width << "," << result.resolution.height << ","
+				<< result.detector << "," << result.p50_ms << "," << result.p90_ms << "," << result.p99_ms << "," << result.max_ms << "," << result.fps << ","
+				<< result.tracked_faces << "," << result.faces_per_second << endl;
+		}
+	}
+
+	return 0;
+}
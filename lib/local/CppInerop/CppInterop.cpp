@@ -41,6 +41,7 @@
 #include "GazeAnalyserInterop.h"
 #include "LandmarkDetectorInterop.h"
 #include "FaceAnalyserInterop.h"
+#include "FrameProcessorInterop.h"
 #include "OpenCVWrappers.h"
 #include "ImageReader.h"
 #include "FaceDetectorInterop.h"
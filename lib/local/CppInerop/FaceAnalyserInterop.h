@@ -124,17 +124,31 @@ public:
 			landmarks_mat.at<float>(i + landmarks->Count, 0) = landmarks[i]->Item2;
 		}
 
+		AddNextFrame(frame, landmarks_mat, success, online);
+	}
+
+internal:
+
+	// Used by the frame processor, which passes the landmarks of the CLNF model directly
+	void AddNextFrame(OpenCVWrappers::RawImage^ frame, const cv::Mat_<float>& landmarks, bool success, bool online) {
+
 		//(captured_image, face_model.detected_landmarks, face_model.detection_success, sequence_reader.time_stamp, sequence_reader.IsWebcam());
 
-		face_analyser->AddNextFrame(frame->Mat, landmarks_mat, success, 0, online);
+		face_analyser->AddNextFrame(frame->Mat, landmarks, success, 0, online);
 
-		cv::Mat_<double> hog_d;
+		cv::Mat_<float> hog_d;
 		face_analyser->GetLatestHOG(hog_d, *num_rows, *num_cols);
-		hog_d.convertTo(*hog_features, CV_32F);
+		*hog_features = hog_d;
 		
 		face_analyser->GetLatestAlignedFace(*aligned_face);
 				
 	}
+
+	FaceAnalysis::FaceAnalyser* getFaceAnalyser() {
+		return face_analyser;
+	}
+
+public:
 	
 	// Predicting AUs from a single image
     System::Tuple<Dictionary<System::String^, double>^, Dictionary<System::String^, double>^>^
@@ -152,9 +166,9 @@ public:
 		face_analyser->PredictStaticAUsAndComputeFeatures(frame->Mat, landmarks_mat);
 
 		// Set the computed appearance features
-		cv::Mat_<double> hog_tmp;
+		cv::Mat_<float> hog_tmp;
 		face_analyser->GetLatestHOG(hog_tmp, *num_rows, *num_cols);
-		hog_tmp.convertTo(*hog_features, CV_32F);
+		*hog_features = hog_tmp;
 
 		face_analyser->GetLatestAlignedFace(*aligned_face);
 
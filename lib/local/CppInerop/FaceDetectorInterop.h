@@ -59,7 +59,7 @@ namespace FaceDetectorInterop {
 
 	private:
 		// Where the face detectors are stored
-		dlib::frontal_face_detector* face_detector_hog;
+		LandmarkDetector::FaceDetectorHOG* face_detector_hog;
 		LandmarkDetector::FaceDetectorMTCNN* face_detector_mtcnn;
 		cv::CascadeClassifier* face_detector_haar;
 
@@ -69,7 +69,8 @@ namespace FaceDetectorInterop {
 		FaceDetector(System::String^ haar_location, System::String^ mtcnn_location) 
 		{
 			// Initialize all of the detectors (TODO should be done on need only basis)
-			face_detector_hog = new dlib::frontal_face_detector(dlib::get_frontal_face_detector());
+			face_detector_hog = new LandmarkDetector::FaceDetectorHOG();
+			face_detector_hog->Read();
 			face_detector_mtcnn = new LandmarkDetector::FaceDetectorMTCNN(msclr::interop::marshal_as<std::string>(mtcnn_location));
 			face_detector_haar = new cv::CascadeClassifier(msclr::interop::marshal_as<std::string>(haar_location));
 		}
@@ -0,0 +1,207 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltruaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltruaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltruaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltruaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef FRAME_PROCESSOR_INTEROP_H
+#define FRAME_PROCESSOR_INTEROP_H
+
+#pragma once
+
+#pragma unmanaged
+
+// Include all the unmanaged things we need.
+
+#include <opencv2/opencv.hpp>
+
+#include <OpenCVWrappers.h>
+#include <LandmarkDetectorInterop.h>
+#include <FaceAnalyserInterop.h>
+#include <GazeAnalyserInterop.h>
+
+#pragma managed
+
+namespace CppInterop {
+
+	// The per frame results of a fixed size, blittable (no bools or references) so that it crosses the managed boundary as is. The
+	// variable sized results (landmarks and AUs) are written to the caller owned arrays passed to ProcessFrame, the counts say how many
+	// values were written to them
+	[System::Runtime::InteropServices::StructLayout(System::Runtime::InteropServices::LayoutKind::Sequential)]
+	public value struct FrameResult
+	{
+		// 1 if the landmarks were detected, 0 otherwise
+		int success;
+		float confidence;
+
+		// Head pose in the camera coordinate space (translation in mm, rotation in radians)
+		float pose_tx, pose_ty, pose_tz;
+		float pose_rx, pose_ry, pose_rz;
+
+		// Gaze directions of the two eyes and the combined gaze angle (only set if gaze is estimated and the model has eyes)
+		float gaze_0_x, gaze_0_y, gaze_0_z;
+		float gaze_1_x, gaze_1_y, gaze_1_z;
+		float gaze_angle_x, gaze_angle_y;
+
+		int num_landmarks;
+		int num_eye_landmarks;
+		int num_au_intensities;
+		int num_au_occurences;
+	};
+
+	// Running the whole per frame pipeline (landmark detection, head pose, gaze and AUs) in a single call, instead of a separate call
+	// (and managed objects) for every result
+	public ref class FrameProcessor
+	{
+	private:
+
+		CppInterop::LandmarkDetector::CLNF^ clnf;
+		CppInterop::LandmarkDetector::FaceModelParameters^ model_params;
+		FaceAnalyser_Interop::FaceAnalyserManaged^ face_analyser;
+		GazeAnalyser_Interop::GazeAnalyserManaged^ gaze_analyser;
+
+		// The names of the AUs in the order they are written to the arrays
+		vector<std::string>* au_reg_names;
+		vector<std::string>* au_class_names;
+
+	public:
+
+		// The analysers can be nullptr, in which case the corresponding results are not computed
+		FrameProcessor(CppInterop::LandmarkDetector::CLNF^ clnf, CppInterop::LandmarkDetector::FaceModelParameters^ model_params,
+			FaceAnalyser_Interop::FaceAnalyserManaged^ face_analyser, GazeAnalyser_Interop::GazeAnalyserManaged^ gaze_analyser) :
+			clnf(clnf), model_params(model_params), face_analyser(face_analyser), gaze_analyser(gaze_analyser)
+		{
+			au_reg_names = new vector<std::string>();
+			au_class_names = new vector<std::string>();
+
+			if (face_analyser != nullptr)
+			{
+				*au_reg_names = face_analyser->getFaceAnalyser()->GetAURegNames();
+				*au_class_names = face_analyser->getFaceAnalyser()->GetAUClassNames();
+			}
+		}
+
+		// The landmarks are written as x0, y0, x1, y1, ..., the AUs in the order of FaceAnalyserManaged::GetRegActionUnitsNames and
+		// GetClassActionUnitsNames, any of the arrays can be nullptr if that result is not needed
+		FrameResult ProcessFrame(OpenCVWrappers::RawImage^ rgb_image, OpenCVWrappers::RawImage^ gray_image, float fx, float fy, float cx, float cy, bool online,
+			array<float>^ landmarks, array<float>^ eye_landmarks, array<float>^ au_intensities, array<float>^ au_occurences)
+		{
+			FrameResult result = FrameResult();
+
+			::LandmarkDetector::CLNF& clnf_model = *clnf->getCLNF();
+
+			bool success = ::LandmarkDetector::DetectLandmarksInVideo(rgb_image->Mat, clnf_model, *model_params->getParams(), gray_image->Mat);
+			result.success = success ? 1 : 0;
+			result.confidence = (float)clnf_model.detection_certainty;
+
+			cv::Vec6f pose = ::LandmarkDetector::GetPose(clnf_model, fx, fy, cx, cy);
+			result.pose_tx = pose[0]; result.pose_ty = pose[1]; result.pose_tz = pose[2];
+			result.pose_rx = pose[3]; result.pose_ry = pose[4]; result.pose_rz = pose[5];
+
+			if (gaze_analyser != nullptr && success && clnf_model.eye_model)
+			{
+				gaze_analyser->AddNextFrame(clnf, success, fx, fy, cx, cy);
+
+				cv::Point3f gaze_0, gaze_1;
+				cv::Vec2f gaze_angle;
+				gaze_analyser->GetGaze(gaze_0, gaze_1, gaze_angle);
+				result.gaze_0_x = gaze_0.x; result.gaze_0_y = gaze_0.y; result.gaze_0_z = gaze_0.z;
+				result.gaze_1_x = gaze_1.x; result.gaze_1_y = gaze_1.y; result.gaze_1_z = gaze_1.z;
+				result.gaze_angle_x = gaze_angle[0]; result.gaze_angle_y = gaze_angle[1];
+			}
+
+			result.num_landmarks = landmarks != nullptr ? clnf->GetAllLandmarks(landmarks) : 0;
+			result.num_eye_landmarks = eye_landmarks != nullptr ? clnf->GetAllEyeLandmarks(eye_landmarks) : 0;
+
+			result.num_au_intensities = 0;
+			result.num_au_occurences = 0;
+			if (face_analyser != nullptr)
+			{
+				face_analyser->AddNextFrame(rgb_image, clnf_model.detected_landmarks, success, online);
+
+				FaceAnalysis::FaceAnalyser* analyser = face_analyser->getFaceAnalyser();
+				result.num_au_intensities = CopyAUs(analyser->GetCurrentAUsReg(), *au_reg_names, au_intensities);
+				result.num_au_occurences = CopyAUs(analyser->GetCurrentAUsClass(), *au_class_names, au_occurences);
+			}
+
+			return result;
+		}
+
+		// Finalizer. Definitely called before Garbage Collection,
+		// but not automatically called on explicit Dispose().
+		// May be called multiple times.
+		!FrameProcessor()
+		{
+			delete au_reg_names;
+			delete au_class_names;
+			au_reg_names = NULL;
+			au_class_names = NULL;
+		}
+
+		// Destructor. Called on explicit Dispose() only.
+		~FrameProcessor()
+		{
+			this->!FrameProcessor();
+		}
+
+	private:
+
+		// Writing the AU predictions in the order of the names (the AUs not predicted on this frame are 0)
+		static int CopyAUs(const std::vector<std::pair<std::string, double> >& predictions, const vector<std::string>& names, array<float>^ out)
+		{
+			if (out == nullptr)
+			{
+				return 0;
+			}
+			if (out->Length < (int)names.size())
+			{
+				throw gcnew System::ArgumentException("The buffer is too small for the AUs");
+			}
+
+			for (size_t i = 0; i < names.size(); ++i)
+			{
+				out[i] = 0;
+				for (size_t p = 0; p < predictions.size(); ++p)
+				{
+					if (predictions[p].first == names[i])
+					{
+						out[i] = (float)predictions[p].second;
+						break;
+					}
+				}
+			}
+			return (int)names.size();
+		}
+
+	};
+}
+
+#endif // FRAME_PROCESSOR_INTEROP_H
@@ -169,6 +169,18 @@ namespace GazeAnalyser_Interop {
 			return lines;
 		}
 
+	internal:
+
+		// The gaze of the last frame, without creating the managed objects
+		void GetGaze(cv::Point3f& gaze_0, cv::Point3f& gaze_1, cv::Vec2f& gaze_angle)
+		{
+			gaze_0 = *gazeDirection0;
+			gaze_1 = *gazeDirection1;
+			gaze_angle = *gazeAngle;
+		}
+
+	public:
+
 		// Finalizer. Definitely called before Garbage Collection,
 		// but not automatically called on explicit Dispose().
 		// May be called multiple times.
@@ -386,6 +386,80 @@ namespace CppInterop {
 				return landmarks_3D;
 			}
 
+			// The buffer based versions of the landmark getters fill caller owned arrays (interleaved, x0, y0, x1, y1, ... or x0, y0, z0, ...)
+			// instead of allocating every point on every frame, they return the number of points written. The pointer versions are for
+			// pinned buffers (e.g. from a fixed statement or a Span), their length is in floats
+			int GetAllLandmarks(array<float>^ xy)
+			{
+				if (xy == nullptr || xy->Length == 0)
+				{
+					return GetAllLandmarks(System::IntPtr::Zero, 0);
+				}
+				// Only pinned for the duration of the copy
+				pin_ptr<float> data = &xy[0];
+				return GetAllLandmarks(System::IntPtr(data), xy->Length);
+			}
+
+			int GetAllLandmarks(System::IntPtr xy, int length)
+			{
+				const cv::Mat_<float>& landmarks = clnf->detected_landmarks;
+				int n = landmarks.rows / 2;
+				float* out = CheckBuffer(xy, length, 2 * n);
+				for (int i = 0; i < n; ++i)
+				{
+					out[2 * i] = landmarks.at<float>(i);
+					out[2 * i + 1] = landmarks.at<float>(i + n);
+				}
+				return n;
+			}
+
+			int GetAllEyeLandmarks(array<float>^ xy)
+			{
+				if (xy == nullptr || xy->Length == 0)
+				{
+					return GetAllEyeLandmarks(System::IntPtr::Zero, 0);
+				}
+				// Only pinned for the duration of the copy
+				pin_ptr<float> data = &xy[0];
+				return GetAllEyeLandmarks(System::IntPtr(data), xy->Length);
+			}
+
+			int GetAllEyeLandmarks(System::IntPtr xy, int length)
+			{
+				vector<cv::Point2f> vecLandmarks = ::LandmarkDetector::CalculateAllEyeLandmarks(*clnf);
+				float* out = CheckBuffer(xy, length, 2 * (int)vecLandmarks.size());
+				for (size_t i = 0; i < vecLandmarks.size(); ++i)
+				{
+					out[2 * i] = vecLandmarks[i].x;
+					out[2 * i + 1] = vecLandmarks[i].y;
+				}
+				return (int)vecLandmarks.size();
+			}
+
+			int Get3DLandmarks(array<float>^ xyz, float fx, float fy, float cx, float cy)
+			{
+				if (xyz == nullptr || xyz->Length == 0)
+				{
+					return Get3DLandmarks(System::IntPtr::Zero, 0, fx, fy, cx, cy);
+				}
+				// Only pinned for the duration of the copy
+				pin_ptr<float> data = &xyz[0];
+				return Get3DLandmarks(System::IntPtr(data), xyz->Length, fx, fy, cx, cy);
+			}
+
+			int Get3DLandmarks(System::IntPtr xyz, int length, float fx, float fy, float cx, float cy)
+			{
+				cv::Mat_<float> shape3D = clnf->GetShape(fx, fy, cx, cy);
+				float* out = CheckBuffer(xyz, length, 3 * shape3D.cols);
+				for (int i = 0; i < shape3D.cols; ++i)
+				{
+					out[3 * i] = shape3D.at<float>(0, i);
+					out[3 * i + 1] = shape3D.at<float>(1, i);
+					out[3 * i + 2] = shape3D.at<float>(2, i);
+				}
+				return shape3D.cols;
+			}
+
 			List<System::Tuple<System::Windows::Point, System::Windows::Point>^>^ CalculateBox(float fx, float fy, float cx, float cy) {
 
 				cv::Vec6f pose = ::LandmarkDetector::GetPose(*clnf, fx,fy, cx, cy);
@@ -444,6 +518,17 @@ namespace CppInterop {
 				return all_params;
 			}
 
+		private:
+
+			static float* CheckBuffer(System::IntPtr buffer, int length, int needed)
+			{
+				if (length < needed)
+				{
+					throw gcnew System::ArgumentException("The buffer is too small for the landmarks");
+				}
+				return (float*)buffer.ToPointer();
+			}
+
 		};
 
 	}
@@ -103,6 +103,20 @@ namespace OpenCVWrappers {
 			mat = new cv::Mat(m.clone());
 		}
 
+		// Without the copy the image shares (and keeps a reference to) the data of the matrix, so it should only be used when the matrix
+		// is not written to afterwards (e.g. not a capture buffer refilled with the next frame)
+		RawImage(const cv::Mat& m, bool copy)
+		{
+			mat = copy ? new cv::Mat(m.clone()) : new cv::Mat(m);
+		}
+
+		// Wrapping a caller owned buffer (e.g. a pinned array or a WriteableBitmap back buffer) without copying it, the buffer has to outlive
+		// the image and stay pinned while it is in use
+		RawImage(System::IntPtr data, int width, int height, int stride, PixelFormat format)
+		{
+			mat = new cv::Mat(height, width, PixelFormatToType(format), data.ToPointer(), (size_t)stride);
+		}
+
 		void Mirror()
 		{
 			cv::flip(*mat, *mat, 1);
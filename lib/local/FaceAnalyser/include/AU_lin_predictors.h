@@ -0,0 +1,135 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef AU_LIN_PREDICTORS_H
+#define AU_LIN_PREDICTORS_H
+
+#include <vector>
+#include <string>
+
+#include <opencv2/core/core.hpp>
+
+#include "SVR_static_lin_regressors.h"
+#include "SVR_dynamic_lin_regressors.h"
+#include "SVM_static_lin.h"
+#include "SVM_dynamic_lin.h"
+
+namespace FaceAnalysis
+{
+
+// All of the linear AU regressors and classifiers packed into a single weight matrix, so that all of the AUs of a frame are predicted with
+// one matrix product (or all of the AUs of many frames with one matrix multiplication). The feature means are folded into the biases,
+// and the running median subtraction of the dynamic models is applied as a separate correction on the dynamic columns only
+class AU_lin_predictors{
+
+public:
+
+	AU_lin_predictors() : input_dim(0), num_static(0), geometry_only(false)
+	{}
+
+	// Packing the models, returns false if they do not share the same input (in which case they have to be evaluated separately).
+	// With a geometry_dim the packed models only take the geometry descriptor (of that many values): models trained on the geometry alone
+	// are used as they are, while for the ones that take the HOG descriptor followed by the geometry only the geometry part is kept, with
+	// the appearance assumed to be at the training mean (static models) or at the running median (dynamic models)
+	bool Build(const SVR_static_lin_regressors& svr_static, const SVR_dynamic_lin_regressors& svr_dynamic, const SVM_static_lin& svm_static, const SVM_dynamic_lin& svm_dynamic,
+		int geometry_dim = 0);
+
+	bool Empty() const
+	{
+		return weights.empty();
+	}
+
+	// If the models only need the geometry descriptor
+	bool IsGeometryOnly() const
+	{
+		return geometry_only && !Empty();
+	}
+
+	// Creating the model input from the HOG and geometry descriptors (the geometry is only used if the models expect it, and the HOG
+	// descriptor is ignored, and can be empty, for geometry only models)
+	void BuildInput(cv::Mat_<float>& input, const cv::Mat_<float>& fhog_descriptor, const cv::Mat_<float>& geom_params) const;
+
+	// Raw predictions for a number of inputs (a row per frame), the running median is the input built from the HOG and geometry medians
+	// and can be empty if there is no median estimate yet
+	void Predict(cv::Mat_<float>& predictions, const cv::Mat_<float>& inputs, const cv::Mat_<float>& running_median) const;
+
+	// The response of the dynamic models to a running median (to be subtracted from their predictions), empty if there are no dynamic models
+	void MedianResponse(cv::Mat_<float>& response, const cv::Mat_<float>& running_median) const;
+
+	// Updating the response to an earlier running median for a new one, as the response is linear in the median only the dimensions that
+	// changed are needed (the running medians move in a few dimensions at a time), it is recomputed if many of them changed
+	void UpdateMedianResponse(cv::Mat_<float>& response, const cv::Mat_<float>& old_median, const cv::Mat_<float>& new_median) const;
+
+	// As above, but with precomputed median responses, either a single one for all of the inputs or one per input row
+	void PredictWithResponses(cv::Mat_<float>& predictions, const cv::Mat_<float>& inputs, const cv::Mat_<float>& median_responses) const;
+
+	// The intensity and occurence AUs of one row of predictions, in the same order as the individual models would report them
+	void GetAUs(std::vector<std::pair<std::string, double>>& intensities, std::vector<std::pair<std::string, double>>& occurences, const cv::Mat_<float>& predictions, int row) const;
+
+	const std::vector<std::string>& GetRegNames() const { return reg_names; }
+	const std::vector<std::string>& GetClassNames() const { return class_names; }
+
+	// The packed model parameters
+	const cv::Mat_<float>& GetWeights() const { return weights; }
+	const cv::Mat_<float>& GetBiases() const { return biases; }
+
+private:
+
+	void AddModel(const cv::Mat_<float>& means, const cv::Mat_<float>& support_vectors, const cv::Mat_<float>& biases, bool dynamic_model, cv::Mat_<float>& weights_all, cv::Mat_<float>& biases_all);
+
+	int input_dim;
+
+	// The columns hold the static models first and the dynamic ones after them: SVR static, SVM static, SVR dynamic, SVM dynamic
+	cv::Mat_<float> weights;
+	cv::Mat_<float> biases;
+	int num_static;
+
+	// The input is the geometry descriptor alone
+	bool geometry_only;
+
+	// For every output column, where it goes - the index in the intensity or the occurence output
+	std::vector<int> output_index;
+	std::vector<bool> output_is_class;
+
+	std::vector<std::string> reg_names;
+	std::vector<std::string> class_names;
+
+	// For turning the classifier decisions to the outputs
+	std::vector<double> pos_classes;
+	std::vector<double> neg_classes;
+
+};
+  //===========================================================================
+}
+#endif // AU_LIN_PREDICTORS_H
@@ -0,0 +1,116 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef DESCRIPTOR_STORE_H
+#define DESCRIPTOR_STORE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include <opencv2/core/core.hpp>
+
+namespace FaceAnalysis
+{
+
+// A growing table of fixed length row vectors kept in a temporary file instead of in memory (optionally stored in half precision).
+// Rows are appended sequentially while a video is processed, the file is memory mapped once the rows need to be read back or modified,
+// this keeps the memory use of the offline AU postprocessing bounded for very long recordings
+class DescriptorStore{
+
+public:
+
+	DescriptorStore();
+	~DescriptorStore();
+
+	// Create the backing file for rows of a given length, stored as float16 if half_precision is set
+	bool Open(int cols, bool half_precision);
+
+	// Unmaps and deletes the backing file
+	void Close();
+
+	bool IsOpen() const { return cols > 0; }
+
+	int Rows() const { return rows; }
+	int Cols() const { return cols; }
+
+	// The size of the stored rows (in the file, not in memory)
+	size_t Bytes() const { return (size_t)rows * row_size; }
+
+	// Add a row vector to the end of the store, returns false if it could not be written (e.g. the disk is full), the store then keeps the
+	// rows written so far and does not accept any more
+	bool Append(const cv::Mat_<float>& row);
+
+	// Writes out the buffered rows, if some of them did not reach the file the store is cut back to the complete rows that did (returns false)
+	bool Flush();
+
+	// Read and overwrite rows that have already been added
+	void Get(int index, cv::Mat_<float>& row);
+	void Set(int index, const cv::Mat_<float>& row);
+
+	// Read and overwrite a single column across all of the rows
+	void GetColumn(int col, std::vector<double>& values);
+	void SetColumn(int col, const std::vector<double>& values);
+
+private:
+
+	// The store owns the backing file so can not be copied
+	DescriptorStore(const DescriptorStore& other);
+	DescriptorStore & operator= (const DescriptorStore& other);
+
+	// Make sure all the appended rows are mapped
+	bool Map();
+	void Unmap();
+
+	std::string location;
+	std::ofstream writer;
+
+	int cols;
+	int rows;
+	size_t row_size;
+	bool half_precision;
+
+	// The mapped memory and the number of rows it covers
+	char* data;
+	int rows_mapped;
+
+#ifdef _WIN32
+	void* file_handle;
+	void* mapping_handle;
+#endif
+
+};
+  //===========================================================================
+}
+#endif // DESCRIPTOR_STORE_H
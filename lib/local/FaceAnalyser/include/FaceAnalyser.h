@@ -37,8 +37,10 @@
 
 // STL includes
 #include <string>
+#include <functional>
 #include <vector>
 #include <map>
+#include <algorithm>
 
 // OpenCV includes
 #include <opencv2/core/core.hpp>
@@ -48,12 +50,46 @@
 #include "SVR_static_lin_regressors.h"
 #include "SVM_static_lin.h"
 #include "SVM_dynamic_lin.h"
+#include "AU_lin_predictors.h"
 #include "PDM.h"
 #include "FaceAnalyserParameters.h"
+#include "DescriptorStore.h"
+#include "Face_utils.h"
+
+namespace Utilities
+{
+	class MemoryReport;
+}
 
 namespace FaceAnalysis
 {
 
+// The statistics behind the person specific normalisation of the AU predictions, the fixed bin histograms of the running medians of the
+// descriptors and of the online prediction correction (per view). As histograms they can be merged by summing them up, e.g. to normalise
+// a person over segments or sequences analysed by separate analysers, processes or machines
+struct NormalisationStatistics
+{
+	std::vector<cv::Mat_<ushort> > hog_desc_hist;
+	std::vector<int> hog_hist_sum;
+	cv::Mat_<ushort> geom_desc_hist;
+	int geom_hist_sum;
+	std::vector<cv::Mat_<int> > au_prediction_correction_histogram;
+	std::vector<int> au_prediction_correction_count;
+
+	// The view of the most recent frame, whose HOG median is the current one
+	int view;
+
+	NormalisationStatistics() : geom_hist_sum(0), view(0) {}
+
+	// Adding the samples of the statistics of another analyser with the same models (false if they do not match), the most recent view
+	// becomes the one of the other statistics
+	bool Merge(const NormalisationStatistics& other);
+
+	// Binary serialisation, for exchanging the statistics between processes
+	void Write(std::ostream& stream) const;
+	bool Read(std::istream& stream);
+};
+
 class FaceAnalyser{
 
 public:
@@ -64,8 +100,30 @@ public:
 	// Constructor for FaceAnalyser using the parameters structure
 	FaceAnalyser(const FaceAnalysis::FaceAnalyserParameters& face_analyser_params);
 
+	// Copy constructor (shares the AU models)
+	FaceAnalyser(const FaceAnalyser& other);
+
 	void AddNextFrame(const cv::Mat& frame, const cv::Mat_<float>& detected_landmarks, bool success, double timestamp_seconds, bool online = false);
 
+	// Adding a frame from its HOG descriptor (e.g. as recorded by RecorderHOG) instead of the image, so no alignment or HOG extraction is done,
+	// the landmarks are only used for the geometry descriptor. There is no aligned face for such frames
+	void AddNextFrameHOG(const cv::Mat_<float>& hog_descriptor, int num_rows, int num_cols, const cv::Mat_<float>& detected_landmarks, bool success,
+		double timestamp_seconds, bool online = false);
+
+	// Adding a frame that is the same as the last one (e.g. a duplicated or static frame), its results are those of the last frame without
+	// recomputing them, but the frame is still part of the history used by the offline postprocessing
+	void RepeatLastFrame(double timestamp_seconds);
+
+	// The outputs a caller needs from AddNextFrame, the stages not needed for them are skipped (by default everything is computed). The AUs need the HOG,
+	// and without the dynamic normalisation the running medians are not updated, so the dynamic models are not calibrated to the person
+	enum AnalysisOutputs{ OUTPUT_ALIGNED_FACE = 1, OUTPUT_HOG = 2, OUTPUT_AU_INTENSITY = 4, OUTPUT_AU_PRESENCE = 8, OUTPUT_DYNAMIC_NORMALISATION = 16, OUTPUT_ALL = 31 };
+	void SetRequestedOutputs(int outputs) { requested_outputs = outputs; }
+	int GetRequestedOutputs() const { return requested_outputs; }
+
+	// When only one in frames_per_analysis frames is added (the others repeated with RepeatLastFrame), the running medians are updated on
+	// more of the added frames, so that they still adapt over the same time as when every frame is added (they are updated every other frame)
+	void SetFramesPerAnalysis(int frames_per_analysis) { median_update_every = std::max(1, (2 + frames_per_analysis - 1) / std::max(1, frames_per_analysis)); }
+
 	double GetCurrentTimeSeconds();
 	
 	// Grab the current predictions about AUs from the face analyser
@@ -73,24 +131,73 @@ public:
 	std::vector<std::pair<std::string, double>> GetCurrentAUsReg() const;   // AU intensity
 	std::vector<std::pair<std::string, double>> GetCurrentAUsCombined() const; // Both presense and intensity
 
+	// The same predictions as contiguous values in the order of GetAURegNameTable and GetAUClassNameTable (NaN for the AUs not predicted on
+	// the current frame), they are updated in place so that reading them every frame does not allocate
+	const std::vector<float>& GetCurrentAURegValues() const { return AU_values_reg; }
+	const std::vector<float>& GetCurrentAUClassValues() const { return AU_values_class; }
+
 	// A standalone call for predicting AUs and computing face texture features from a static image
 	void PredictStaticAUsAndComputeFeatures(const cv::Mat& frame, const cv::Mat_<float>& detected_landmarks);
 
+	// The number of buffered frames the batched offline AU prediction predicts at once (see FaceAnalyserParameters::au_batch_size)
+	void SetAUBatchSize(int batch_size) { pending_au_batch_size = batch_size > 0 ? batch_size : 1; }
+
 	void Reset();
 
-	void GetLatestHOG(cv::Mat_<double>& hog_descriptor, int& num_rows, int& num_cols);
+	// Writing and reading the state built up over a sequence (the running medians, the online prediction corrections and the history used by the
+	// offline postprocessing), e.g. for checkpointing a long video and resuming it later with the same models. Writing the state completes the
+	// pending batched predictions, and is not available when the history is spilled to files
+	bool WriteState(std::ostream& stream);
+	bool ReadState(std::istream& stream);
+
+	// Exporting the normalisation statistics gathered so far, and replacing them (e.g. with ones merged over several analysers), the medians
+	// used by the dynamic models are recomputed from the imported histograms
+	NormalisationStatistics GetNormalisationStatistics() const;
+	bool SetNormalisationStatistics(const NormalisationStatistics& statistics);
+
+	// The neutral baseline of a person (the normalisation statistics) persisted in a directory under an external subject id, so that the AUs
+	// of a returning person are calibrated from the first frame, both online and offline (the first frames are then not predicted again by the
+	// offline postprocessing). The loaded baseline is added to by the following frames, and cleared by Reset
+	bool SaveBaseline(const std::string& directory, const std::string& subject_id) const;
+	bool LoadBaseline(const std::string& directory, const std::string& subject_id);
+
+	// Combining the analysers of the following segments of a sequence (each analysed on its own, e.g. in parallel) into this one, which analysed the
+	// first segment, so that the offline postprocessing covers the whole sequence. The running medians of the segments are merged, the initial
+	// frames of the later segments are predicted again with the merged medians, and their histories are appended without the first skip_frames
+	// (the frames overlapping the previous segment). Not available when the history is spilled to files
+	bool AppendSegments(const std::vector<FaceAnalyser*>& segments, const std::vector<int>& skip_frames);
+
+	// Allocating the running median histograms of the descriptors (otherwise allocated on the first frames) and extracting a HOG descriptor
+	// once, so that the first frames run at the steady state speed, it does not add any samples to the histograms
+	void WarmUp();
+
+	// Adding the memory of the AU models and the PDM (component/models), of the running median and prediction correction histograms
+	// (component/histograms), of the history kept for the offline postprocessing (component/history, spilled to files it is reported as
+	// mapped) and of the per frame buffers (component/buffers) to the report, the models shared with an analyser reported earlier are not counted again
+	void ReportMemory(Utilities::MemoryReport& report, const std::string& component = "face_analyser") const;
+
+	void GetLatestHOG(cv::Mat_<float>& hog_descriptor, int& num_rows, int& num_cols);
 	void GetLatestAlignedFace(cv::Mat& image);
 	
-	void GetLatestNeutralHOG(cv::Mat_<double>& hog_descriptor, int& num_rows, int& num_cols);
+	void GetLatestNeutralHOG(cv::Mat_<float>& hog_descriptor, int& num_rows, int& num_cols);
 	
 	cv::Mat_<int> GetTriangulation();
 	
-	void GetGeomDescriptor(cv::Mat_<double>& geom_desc);
+	void GetGeomDescriptor(cv::Mat_<float>& geom_desc);
 
 	// Grab the names of AUs being predicted
 	std::vector<std::string> GetAUClassNames() const; // Presence
 	std::vector<std::string> GetAURegNames() const; // Intensity
 
+	// The same names, built once when the models are read, these are the order of the current AU values
+	const std::vector<std::string>& GetAURegNameTable() const { return AU_name_table_reg; }
+	const std::vector<std::string>& GetAUClassNameTable() const { return AU_name_table_class; }
+
+	// The summary statistics of the successfully tracked frames so far, of the AU intensities (in the order of GetAURegNameTable) and of the
+	// geometry descriptor, e.g. for a per video summary (see SummaryStatistics::Extract). They are merged by AppendSegments
+	const SummaryStatistics& GetAURegSummary() const { return AU_reg_summary; }
+	const SummaryStatistics& GetGeomDescriptorSummary() const { return geom_desc_summary; }
+
 	// Identify if models are static or dynamic (useful for correction and shifting)
 	std::vector<bool> GetDynamicAUClass() const; // Presence
 	std::vector<std::pair<std::string, bool>> GetDynamicAUReg() const; // Intensity
@@ -101,7 +208,7 @@ public:
 	void ExtractAllPredictionsOfflineClass(std::vector<std::pair<std::string, std::vector<double>>>& au_predictions,
 		std::vector<double>& confidences, std::vector<bool>& successes, std::vector<double>& timestamps, bool dynamic);
 
-	// Helper function for post-processing AU output files
+	// Helper function for post-processing AU output files, the file is rewritten line by line so its size does not matter
 	void PostprocessOutputFile(std::string output_file);
 
 private:
@@ -115,12 +222,77 @@ private:
 
 	std::vector<std::pair<std::string, double>> AU_predictions_combined;
 
+	// The fixed AU name tables and the current predictions in their order
+	std::vector<std::string> AU_name_table_reg;
+	std::vector<std::string> AU_name_table_class;
+	std::vector<float> AU_values_reg;
+	std::vector<float> AU_values_class;
+
+	// Copying the current predictions to the values in the order of the name tables
+	void UpdateCurrentAUValues();
+	static void FillAUValues(const std::vector<std::pair<std::string, double>>& predictions, const std::vector<std::string>& names, std::vector<float>& values);
+
 	// Keeping track of AU predictions over time (useful for post-processing)
 	std::vector<double> timestamps;
 	std::map<std::string, std::vector<double>> AU_predictions_reg_all_hist;
 	std::map<std::string, std::vector<double>> AU_predictions_class_all_hist;
 	std::vector<bool> valid_preds;
 
+	// When bounded (see FaceAnalyserParameters::history_window) only the recent frames are kept in timestamps and valid_preds,
+	// the oldest ones are dropped a window at a time so that the history stays contiguous and in order
+	int history_window;
+	void AddFrameToHistory(bool success, double timestamp_seconds);
+
+	// If the offline correction is not used no history has to be kept
+	bool postprocess_offline;
+
+	// For very long videos the AU history and the initial frame descriptors are spilled to temporary files rather than kept in the above
+	bool spill_offline_history;
+	DescriptorStore AU_predictions_reg_store;
+	DescriptorStore AU_predictions_class_store;
+	std::vector<std::string> AU_predictions_reg_store_names;
+	std::vector<std::string> AU_predictions_class_store_names;
+
+	// The offline batched AU prediction, the inputs of the successfully tracked frames waiting to be predicted, with the median responses at the time
+	bool batch_offline_au;
+	int pending_au_batch_size;
+	cv::Mat_<float> pending_au_inputs;
+	cv::Mat_<float> pending_au_median_responses;
+	std::vector<int> pending_au_frames;
+	cv::Mat_<float> current_median_response;
+	bool median_changed = true;
+
+	// The running median the current response is for, the response is updated incrementally for the dimensions of the median that changed and
+	// recomputed every so often so that the rounding errors do not add up
+	cv::Mat_<float> median_response_input;
+	int median_response_updates = 0;
+	static const int median_response_refresh = 1000;
+	void UpdateCurrentMedianResponse();
+
+	// The part of adding a frame that follows the HOG extraction, the running medians, AU prediction and the history
+	void AddNextDescriptors(const cv::Mat_<float>& hog_descriptor, const cv::Vec6f& params_global, const cv::Mat_<float>& params_local, bool success,
+		double timestamp_seconds, bool online);
+
+	// Adding the current frame to the pending ones (the history gets a placeholder till it is predicted)
+	void QueueCurrentAUs(bool success);
+	// Predicting all of the pending frames and storing the predictions in the history
+	void PredictPendingAUs();
+
+	// Add the current predictions to the history (kept in memory or in the store), the predictions are zeroed if not successful
+	void AddToHistory(std::vector<std::pair<std::string, double>>& predictions, std::map<std::string, std::vector<double>>& all_hist,
+		DescriptorStore& store, std::vector<std::string>& store_names, bool success);
+
+	// Repeating the last frame of the history
+	void RepeatLastHistory(std::map<std::string, std::vector<double>>& all_hist, DescriptorStore& store);
+
+	// Retrieve the history of all AUs (sorted by name) or modify the history of a single frame
+	std::vector<std::pair<std::string, std::vector<double>>> GetHistory(std::map<std::string, std::vector<double>>& all_hist, DescriptorStore& store, const std::vector<std::string>& store_names);
+	void SetHistory(int frame, const std::vector<std::pair<std::string, double>>& predictions, std::map<std::string, std::vector<double>>& all_hist, DescriptorStore& store, const std::vector<std::string>& store_names);
+
+	// The offline correction of a single AU intensity or presence track
+	void CorrectOfflineReg(const std::string& au_name, std::vector<double>& au_vals, const std::vector<bool>& successes, bool dynamic);
+	void CorrectOfflineClass(std::vector<double>& au_vals);
+
 	int frames_tracking;
 
 	// Is the AU model dynamic
@@ -133,17 +305,31 @@ private:
 
 	// Private members to be used for predictions
 	// The HOG descriptor of the last frame
-	cv::Mat_<double> hog_desc_frame;
+	cv::Mat_<float> hog_desc_frame;
 	int num_hog_rows;
 	int num_hog_cols;
 
+	// An optional linear projection of the HOG descriptor to a reduced space (HOGProjection in the AU module), applied right after the
+	// extraction, the AU models, the running median and the history then all work with the projected descriptor. The range of the projected
+	// values is used for the median histograms. The full descriptor is only kept (in hog_desc_output) if it is one of the outputs
+	cv::Mat_<float> hog_projection_mean;
+	cv::Mat_<float> hog_projection;
+	cv::Vec2d hog_projection_range;
+	cv::Mat_<float> hog_desc_output;
+
+	void ReadHOGProjection(std::string location);
+	void ProjectHOG(cv::Mat_<float>& projected, const cv::Mat_<float>& hog_descriptor) const;
+
 	// Keep a running median of the hog descriptors and a aligned images
-	cv::Mat_<double> hog_desc_median;
-	cv::Mat_<double> face_image_median;
+	cv::Mat_<float> hog_desc_median;
+	cv::Mat_<float> face_image_median;
 
-	// Use histograms for quick (but approximate) median computation
-	// Use the same for
-	std::vector<cv::Mat_<int> > hog_desc_hist;
+	// Use histograms for quick (but approximate) median computation, as 16 bit counts (halved once a bin fills up, see UpdateRunningMedian)
+	// so that an analyser per face stays small, this is most of the per person state
+	std::vector<cv::Mat_<ushort> > hog_desc_hist;
+
+	// The current median bin of every histogram row, together with the number of samples below it, so the median can be updated incrementally
+	std::vector<cv::Mat_<int> > hog_desc_median_bins;
 
 	// This is not being used at the moment as it is a bit slow
 	std::vector<cv::Mat_<int> > face_image_hist;
@@ -158,11 +344,12 @@ private:
 	int view_used;
 
 	// The geometry descriptor (rigid followed by non-rigid shape parameters from CLNF)
-	cv::Mat_<double> geom_descriptor_frame;
-	cv::Mat_<double> geom_descriptor_median;
+	cv::Mat_<float> geom_descriptor_frame;
+	cv::Mat_<float> geom_descriptor_median;
 	
 	int geom_hist_sum;
-	cv::Mat_<int> geom_desc_hist;
+	cv::Mat_<ushort> geom_desc_hist;
+	cv::Mat_<int> geom_desc_median_bins;
 	int num_bins_geom;
 	double min_val_geom;
 	double max_val_geom;
@@ -174,10 +361,14 @@ private:
 	std::vector<std::pair<std::string, double>> PredictCurrentAUs(int view);
 	std::vector<std::pair<std::string, double>> PredictCurrentAUsClass(int view);
 
+	// Both the intensity and the occurence predictions in one go (using the fused predictors if the models could be packed together)
+	void PredictCurrentAUsAll(int view, std::vector<std::pair<std::string, double>>& intensities, std::vector<std::pair<std::string, double>>& occurences);
+
 	// special step for online (rather than offline AU prediction)
 	std::vector<std::pair<std::string, double>> CorrectOnlineAUs(std::vector<std::pair<std::string, double>> predictions_orig, int view, bool dyn_shift = false, bool dyn_scale = false, bool update_track = true, bool clip_values = false);
 
-	void Read(std::string model_loc);
+	// With geometry_only_aus the AU models are packed to only take the geometry descriptor (see FaceAnalyserParameters::geometry_only_aus)
+	void Read(std::string model_loc, bool geometry_only_aus = false);
 
 	void ReadAU(std::string au_location);
 
@@ -185,9 +376,12 @@ private:
 
 	// A utility function for keeping track of approximate running medians used for AU and emotion inference using a set of histograms (the histograms are evenly spaced from min_val to max_val)
 	// Descriptor has to be a row vector
+	// The median bins (a row per descriptor dimension, storing the bin and the number of samples in the bins below it) are moved by at most a few bins on every update,
+	// so the median is found in O(dims) instead of scanning all of the bins
+	// Once a bin would overflow all of the counts are halved, so the histogram then slowly forgets the oldest samples
 	// TODO this duplicates some other code
-	void UpdateRunningMedian(cv::Mat_<int>& histogram, int& hist_sum, cv::Mat_<double>& median, const cv::Mat_<double>& descriptor, bool update, int num_bins, double min_val, double max_val);
-	void ExtractMedian(cv::Mat_<int>& histogram, int hist_count, cv::Mat_<double>& median, int num_bins, double min_val, double max_val);
+	void UpdateRunningMedian(cv::Mat_<ushort>& histogram, int& hist_sum, cv::Mat_<int>& median_bins, cv::Mat_<float>& median, const cv::Mat_<float>& descriptor, bool update, int num_bins, double min_val, double max_val);
+	void ExtractMedian(cv::Mat_<ushort>& histogram, int hist_count, cv::Mat_<float>& median, int num_bins, double min_val, double max_val);
 	
 	// The linear SVR regressors
 	SVR_static_lin_regressors AU_SVR_static_appearance_lin_regressors;
@@ -197,6 +391,9 @@ private:
 	SVM_static_lin AU_SVM_static_appearance_lin;
 	SVM_dynamic_lin AU_SVM_dynamic_appearance_lin;
 
+	// All of the above packed into one weight matrix
+	AU_lin_predictors AU_lin_fused;
+
 	// The AUs predicted by the model are not always 0 calibrated to a person. That is they don't always predict 0 for a neutral expression
 	// Keeping track of the predictions we can correct for this, by assuming that at least "ratio" of frames are neutral and subtract that value of prediction, only perform the correction after min_frames
 	void UpdatePredictionTrack(cv::Mat_<int>& prediction_corr_histogram, int& prediction_correction_count, 
@@ -206,6 +403,14 @@ private:
 
 	void PostprocessPredictions();
 
+	// The index of the first AU column in the header of an output file, -1 if there are none
+	static int GetFirstAUColumn(const std::string& header);
+
+	// Overwriting the AU columns of the first frames of an output file in place with the values filled in by get_frame_values, false if the
+	// values do not fit in the fixed width columns (the file can then be partially patched)
+	static bool PatchOutputFile(const std::string& output_file, int num_frames, int num_values, const std::function<void(int)>& get_frame_values,
+		const std::vector<double>& frame_values);
+
 	std::vector<cv::Mat_<int>> au_prediction_correction_histogram;
 	std::vector<int> au_prediction_correction_count;
 
@@ -214,9 +419,11 @@ private:
 	// They have to be view specific
 	std::vector<std::vector<double>> dyn_scaling;
 	
-	// Keeping track of predictions for summary stats
-	cv::Mat_<double> AU_prediction_track;
-	cv::Mat_<double> geom_desc_track;
+	// Keeping track of predictions for summary stats, AU_summary_values is the buffer the intensities are put in order in
+	SummaryStatistics AU_reg_summary;
+	SummaryStatistics geom_desc_summary;
+	std::vector<float> AU_summary_values;
+	void AddToSummary(const std::vector<std::pair<std::string, double>>& predictions);
 
 	double current_time_seconds;
 
@@ -233,12 +440,23 @@ private:
 
 	// Useful placeholder for renormalizing the initial frames of shorter videos
 	int max_init_frames = 3000;
-	std::vector<cv::Mat_<double>> hog_desc_frames_init;
-	std::vector<cv::Mat_<double>> geom_descriptor_frames_init;
+	std::vector<cv::Mat_<float>> hog_desc_frames_init;
+	std::vector<cv::Mat_<float>> geom_descriptor_frames_init;
+	DescriptorStore hog_desc_frames_init_store;
+	DescriptorStore geom_descriptor_frames_init_store;
 	std::vector<int> views;
 	bool postprocessed = false;
 	int frames_tracking_succ = 0;
 
+	// With the baseline of a person loaded the first frames are already calibrated, so they are not kept for renormalizing
+	bool baseline_loaded = false;
+
+	// A mask of AnalysisOutputs
+	int requested_outputs = OUTPUT_ALL;
+
+	// How many of the added frames there are per running median update (see SetFramesPerAnalysis)
+	int median_update_every = 2;
+
 };
   //===========================================================================
 }
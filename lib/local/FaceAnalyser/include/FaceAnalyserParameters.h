@@ -63,6 +63,29 @@ public:
 	// Should the output aligned faces be grayscale
 	bool grayscale;
 
+	// Should the AU predictions be corrected offline once the whole video is processed (needs per frame history and a second pass over the output file)
+	bool postprocess_offline;
+
+	// Keep the per frame history for the offline correction in temporary files (with half precision descriptors) instead of in memory, useful for very long recordings
+	bool spill_offline_history;
+
+	// Defer the AU prediction of a video until its end (or until enough frames are buffered), and predict the buffered frames in batches,
+	// it needs the offline correction, and the per frame (current) AU predictions are not available while processing
+	bool batch_offline_au;
+
+	// The number of buffered frames the batched AU prediction predicts at once, set with -au_batch_size <frames> or from the tuning cache (see
+	// FaceModelParameters::tuning_cache_location)
+	int au_batch_size;
+
+	// Predict the AUs from the shape (PDM) geometry descriptor alone, without the aligned face and its HOG descriptor. Uses the
+	// geometry only regressors of the AU module if it lists them (AUPredictorGeom), otherwise the geometry part of the appearance models
+	bool geometry_only_aus;
+
+	// For long running online use (e.g. a camera service), keep the per frame history (time stamps and success flags) of at most this
+	// many recent frames, set with -au_history <frames>, 0 keeps all of it. The offline correction and batched prediction need the
+	// whole history so they are turned off when it is bounded
+	int history_window;
+
 	// Use getters and setters for these as they might need to reload models and make sure the scale and size ratio makes sense
 	void setAlignedOutput(int output_size, double scale=-1, bool masked = true);
 	// This will also change the model location
@@ -50,11 +50,37 @@ namespace FaceAnalysis
 	void AlignFace(cv::Mat& aligned_face, const cv::Mat& frame, const cv::Mat_<float>& detected_landmarks, cv::Vec6f params_global, const LandmarkDetector::PDM& pdm, bool rigid = true, double scale = 0.7, int width = 96, int height = 96);
 	void AlignFaceMask(cv::Mat& aligned_face, const cv::Mat& frame, const cv::Mat_<float>& detected_landmarks, cv::Vec6f params_global, const LandmarkDetector::PDM& pdm, const cv::Mat_<int>& triangulation, bool rigid = true, double scale = 0.7, int width = 96, int height = 96);
 
-	void Extract_FHOG_descriptor(cv::Mat_<double>& descriptor, const cv::Mat& image, int& num_rows, int& num_cols, int cell_size = 8);
+	void Extract_FHOG_descriptor(cv::Mat_<float>& descriptor, const cv::Mat& image, int& num_rows, int& num_cols, int cell_size = 8);
 
 	// The following two methods go hand in hand
 	void ExtractSummaryStatistics(const cv::Mat_<double>& descriptors, cv::Mat_<double>& sum_stats, bool mean, bool stdev, bool max_min);
 	void AddDescriptor(cv::Mat_<double>& descriptors, cv::Mat_<double> new_descriptor, int curr_frame, int num_frames_to_keep = 120);
+
+	// The summary statistics of every dimension of a sequence of descriptors gathered a descriptor at a time (Welford's running mean and sum of
+	// squared differences, and the running min and max), so that no descriptors have to be kept. The statistics of separate parts of a sequence
+	// (e.g. segments analysed in parallel) can be merged, giving those of the whole sequence
+	struct SummaryStatistics
+	{
+		long long count;
+		cv::Mat_<double> mean;
+		cv::Mat_<double> sum_sq_diff;
+		cv::Mat_<double> min;
+		cv::Mat_<double> max;
+
+		SummaryStatistics() : count(0) {}
+
+		// Adding a descriptor (a row), all of them should be of the same length
+		void Add(const cv::Mat_<double>& descriptor);
+		void Add(const cv::Mat_<float>& descriptor);
+
+		// Adding the descriptors summarised by other statistics (false if their lengths do not match)
+		bool Merge(const SummaryStatistics& other);
+
+		// The same layout as ExtractSummaryStatistics (the mean, the standard deviation and the range of every dimension, those that are asked for)
+		void Extract(cv::Mat_<double>& sum_stats, bool use_mean, bool use_stdev, bool use_max_min) const;
+
+		void Reset() { *this = SummaryStatistics(); }
+	};
 	
 	//============================================================================
 	// Matrix reading functionality
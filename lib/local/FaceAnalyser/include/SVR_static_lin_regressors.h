@@ -56,7 +56,7 @@ public:
 	{}
 
 	// Predict the AU from HOG appearance of the face
-	void Predict(std::vector<double>& predictions, std::vector<std::string>& names, const cv::Mat_<double>& fhog_descriptor, const cv::Mat_<double>& geom_params);
+	void Predict(std::vector<double>& predictions, std::vector<std::string>& names, const cv::Mat_<float>& fhog_descriptor, const cv::Mat_<float>& geom_params);
 
 	// Reading in the model (or adding to it)
 	void Read(std::ifstream& stream, const std::vector<std::string>& au_names);
@@ -66,17 +66,22 @@ public:
 		return AU_names;
 	}
 
+	// The model parameters, used for packing all of the linear AU models into one
+	const cv::Mat_<float>& GetMeans() const { return means; }
+	const cv::Mat_<float>& GetSupportVectors() const { return support_vectors; }
+	const cv::Mat_<float>& GetBiases() const { return biases; }
+
 private:
 
 	// The names of Action Units this model is responsible for
 	std::vector<std::string> AU_names;
 
 	// For normalisation
-	cv::Mat_<double> means;
+	cv::Mat_<float> means;
 	
 	// For actual prediction
-	cv::Mat_<double> support_vectors;	
-	cv::Mat_<double> biases;
+	cv::Mat_<float> support_vectors;	
+	cv::Mat_<float> biases;
 
 };
   //===========================================================================
@@ -0,0 +1,293 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "AU_lin_predictors.h"
+
+using namespace FaceAnalysis;
+
+void AU_lin_predictors::AddModel(const cv::Mat_<float>& means, const cv::Mat_<float>& support_vectors, const cv::Mat_<float>& biases, bool dynamic_model, cv::Mat_<float>& weights_all, cv::Mat_<float>& biases_all)
+{
+	cv::Mat_<float> model_means = means;
+	cv::Mat_<float> model_weights = support_vectors;
+	cv::Mat_<float> model_biases = biases;
+
+	// Keeping the geometry part of a model that takes the HOG descriptor followed by the geometry. For the static models the HOG is taken to be
+	// at the training mean, so its term is zero, while the dynamic models see (x - median - means) with the HOG at the median, leaving -means * W
+	if (geometry_only && means.cols > input_dim)
+	{
+		int appearance_dim = means.cols - input_dim;
+		if (dynamic_model)
+		{
+			model_biases = biases - means.colRange(0, appearance_dim) * support_vectors.rowRange(0, appearance_dim);
+		}
+		model_means = means.colRange(appearance_dim, means.cols);
+		model_weights = support_vectors.rowRange(appearance_dim, support_vectors.rows);
+	}
+
+	// (x - means) * W + b = x * W + (b - means * W)
+	cv::Mat_<float> biases_folded = model_biases - model_means * model_weights;
+
+	if (weights_all.empty())
+	{
+		weights_all = model_weights.clone();
+		biases_all = biases_folded;
+	}
+	else
+	{
+		cv::hconcat(weights_all, model_weights, weights_all);
+		cv::hconcat(biases_all, biases_folded, biases_all);
+	}
+}
+
+bool AU_lin_predictors::Build(const SVR_static_lin_regressors& svr_static, const SVR_dynamic_lin_regressors& svr_dynamic, const SVM_static_lin& svm_static, const SVM_dynamic_lin& svm_dynamic,
+	int geometry_dim)
+{
+	weights = cv::Mat_<float>();
+	biases = cv::Mat_<float>();
+	output_index.clear();
+	output_is_class.clear();
+	pos_classes.clear();
+	neg_classes.clear();
+	input_dim = 0;
+	num_static = 0;
+	geometry_only = geometry_dim > 0;
+
+	reg_names = svr_static.GetAUNames();
+	std::vector<std::string> svr_dyn_names = svr_dynamic.GetAUNames();
+	reg_names.insert(reg_names.end(), svr_dyn_names.begin(), svr_dyn_names.end());
+
+	class_names = svm_static.GetAUNames();
+	std::vector<std::string> svm_dyn_names = svm_dynamic.GetAUNames();
+	class_names.insert(class_names.end(), svm_dyn_names.begin(), svm_dyn_names.end());
+
+	// All of the models have to take the same input to be packed together (or at least end with the geometry descriptor)
+	const cv::Mat_<float>* all_means[4] = { &svr_static.GetMeans(), &svm_static.GetMeans(), &svr_dynamic.GetMeans(), &svm_dynamic.GetMeans() };
+	bool any_model = false;
+	for (int i = 0; i < 4; ++i)
+	{
+		if (all_means[i]->empty())
+			continue;
+
+		if (geometry_only ? all_means[i]->cols < geometry_dim : (input_dim != 0 && all_means[i]->cols != input_dim))
+		{
+			geometry_only = false;
+			return false;
+		}
+		input_dim = geometry_only ? geometry_dim : all_means[i]->cols;
+		any_model = true;
+	}
+
+	if (!any_model)
+	{
+		geometry_only = false;
+		return false;
+	}
+
+	cv::Mat_<float> weights_all, biases_all;
+
+	int num_svr_static = (int)svr_static.GetAUNames().size();
+	int num_svm_static = (int)svm_static.GetAUNames().size();
+
+	if (num_svr_static > 0)
+	{
+		AddModel(svr_static.GetMeans(), svr_static.GetSupportVectors(), svr_static.GetBiases(), false, weights_all, biases_all);
+		for (int i = 0; i < num_svr_static; ++i)
+		{
+			output_index.push_back(i);
+			output_is_class.push_back(false);
+		}
+	}
+	if (num_svm_static > 0)
+	{
+		AddModel(svm_static.GetMeans(), svm_static.GetSupportVectors(), svm_static.GetBiases(), false, weights_all, biases_all);
+		for (int i = 0; i < num_svm_static; ++i)
+		{
+			output_index.push_back(i);
+			output_is_class.push_back(true);
+		}
+	}
+
+	num_static = weights_all.cols;
+
+	if (!svr_dyn_names.empty())
+	{
+		AddModel(svr_dynamic.GetMeans(), svr_dynamic.GetSupportVectors(), svr_dynamic.GetBiases(), true, weights_all, biases_all);
+		for (size_t i = 0; i < svr_dyn_names.size(); ++i)
+		{
+			output_index.push_back(num_svr_static + (int)i);
+			output_is_class.push_back(false);
+		}
+	}
+	if (!svm_dyn_names.empty())
+	{
+		AddModel(svm_dynamic.GetMeans(), svm_dynamic.GetSupportVectors(), svm_dynamic.GetBiases(), true, weights_all, biases_all);
+		for (size_t i = 0; i < svm_dyn_names.size(); ++i)
+		{
+			output_index.push_back(num_svm_static + (int)i);
+			output_is_class.push_back(true);
+		}
+	}
+
+	pos_classes = svm_static.GetPosClasses();
+	pos_classes.insert(pos_classes.end(), svm_dynamic.GetPosClasses().begin(), svm_dynamic.GetPosClasses().end());
+	neg_classes = svm_static.GetNegClasses();
+	neg_classes.insert(neg_classes.end(), svm_dynamic.GetNegClasses().begin(), svm_dynamic.GetNegClasses().end());
+
+	weights = weights_all;
+	biases = biases_all;
+
+	return true;
+}
+
+void AU_lin_predictors::BuildInput(cv::Mat_<float>& input, const cv::Mat_<float>& fhog_descriptor, const cv::Mat_<float>& geom_params) const
+{
+	if (geometry_only)
+	{
+		input = geom_params;
+	}
+	else if (fhog_descriptor.cols == input_dim)
+	{
+		input = fhog_descriptor;
+	}
+	else
+	{
+		cv::hconcat(fhog_descriptor, geom_params, input);
+	}
+}
+
+void AU_lin_predictors::Predict(cv::Mat_<float>& predictions, const cv::Mat_<float>& inputs, const cv::Mat_<float>& running_median) const
+{
+	// The dynamic models are evaluated on (x - median), the median part is the same for every frame so only computed once
+	cv::Mat_<float> median_response;
+	MedianResponse(median_response, running_median);
+	PredictWithResponses(predictions, inputs, median_response);
+}
+
+void AU_lin_predictors::MedianResponse(cv::Mat_<float>& response, const cv::Mat_<float>& running_median) const
+{
+	if (Empty() || num_static == weights.cols || running_median.empty())
+	{
+		response = cv::Mat_<float>();
+		return;
+	}
+	response = running_median * weights.colRange(num_static, weights.cols);
+}
+
+void AU_lin_predictors::UpdateMedianResponse(cv::Mat_<float>& response, const cv::Mat_<float>& old_median, const cv::Mat_<float>& new_median) const
+{
+	if (response.empty() || old_median.empty() || old_median.size() != new_median.size() || response.cols != weights.cols - num_static)
+	{
+		MedianResponse(response, new_median);
+		return;
+	}
+
+	const float* old_values = old_median.ptr<float>(0);
+	const float* new_values = new_median.ptr<float>(0);
+	std::vector<int> changed;
+	for (int d = 0; d < new_median.cols; ++d)
+	{
+		if (old_values[d] != new_values[d])
+		{
+			changed.push_back(d);
+		}
+	}
+
+	// Past a quarter of the dimensions the full product is quicker
+	if ((int)changed.size() * 4 > new_median.cols)
+	{
+		MedianResponse(response, new_median);
+		return;
+	}
+
+	// response += (new - old) * W over the changed rows of the dynamic weights
+	float* response_values = response.ptr<float>(0);
+	int num_dynamic = weights.cols - num_static;
+	for (size_t i = 0; i < changed.size(); ++i)
+	{
+		float delta = new_values[changed[i]] - old_values[changed[i]];
+		const float* weight_row = weights.ptr<float>(changed[i]) + num_static;
+		for (int j = 0; j < num_dynamic; ++j)
+		{
+			response_values[j] += delta * weight_row[j];
+		}
+	}
+}
+
+void AU_lin_predictors::PredictWithResponses(cv::Mat_<float>& predictions, const cv::Mat_<float>& inputs, const cv::Mat_<float>& median_responses) const
+{
+	if (Empty() || inputs.empty())
+	{
+		predictions = cv::Mat_<float>();
+		return;
+	}
+
+	// All of the models for all of the frames at once
+	cv::gemm(inputs, weights, 1.0, cv::repeat(biases, inputs.rows, 1), 1.0, predictions);
+
+	if (!median_responses.empty())
+	{
+		for (int r = 0; r < predictions.rows; ++r)
+		{
+			cv::Mat_<float> dynamic_preds = predictions(cv::Rect(num_static, r, weights.cols - num_static, 1));
+			dynamic_preds -= median_responses.row(median_responses.rows == 1 ? 0 : r);
+		}
+	}
+}
+
+void AU_lin_predictors::GetAUs(std::vector<std::pair<std::string, double>>& intensities, std::vector<std::pair<std::string, double>>& occurences, const cv::Mat_<float>& predictions, int row) const
+{
+	intensities.assign(reg_names.size(), std::pair<std::string, double>());
+	occurences.assign(class_names.size(), std::pair<std::string, double>());
+
+	if (predictions.empty())
+	{
+		intensities.clear();
+		occurences.clear();
+		return;
+	}
+
+	const float* preds = predictions.ptr<float>(row);
+	for (size_t i = 0; i < output_index.size(); ++i)
+	{
+		int index = output_index[i];
+		if (output_is_class[i])
+		{
+			occurences[index] = std::pair<std::string, double>(class_names[index], preds[i] > 0 ? pos_classes[index] : neg_classes[index]);
+		}
+		else
+		{
+			intensities[index] = std::pair<std::string, double>(reg_names[index], preds[i]);
+		}
+	}
+}
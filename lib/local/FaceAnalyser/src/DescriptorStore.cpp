@@ -0,0 +1,356 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "DescriptorStore.h"
+
+// System includes
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// Boost includes
+#include <filesystem.hpp>
+
+// Memory mapping
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace FaceAnalysis;
+
+DescriptorStore::DescriptorStore() : cols(0), rows(0), row_size(0), half_precision(false), data(0), rows_mapped(0)
+{
+#ifdef _WIN32
+	file_handle = 0;
+	mapping_handle = 0;
+#endif
+}
+
+DescriptorStore::~DescriptorStore()
+{
+	Close();
+}
+
+bool DescriptorStore::Open(int cols, bool half_precision)
+{
+	Close();
+
+	boost::filesystem::path temp_file = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("openface-%%%%-%%%%-%%%%.tmp");
+	location = temp_file.string();
+
+	writer.open(location, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!writer.is_open())
+	{
+		std::cout << "ERROR: could not create a temporary file " << location << std::endl;
+		location.clear();
+		return false;
+	}
+
+	this->cols = cols;
+	this->half_precision = half_precision;
+	row_size = (size_t)cols * (half_precision ? 2 : 4);
+	rows = 0;
+
+	return true;
+}
+
+void DescriptorStore::Close()
+{
+	Unmap();
+
+	if (writer.is_open())
+	{
+		writer.close();
+	}
+
+	if (!location.empty())
+	{
+		boost::system::error_code error;
+		boost::filesystem::remove(location, error);
+		location.clear();
+	}
+
+	cols = 0;
+	rows = 0;
+	row_size = 0;
+}
+
+bool DescriptorStore::Append(const cv::Mat_<float>& row)
+{
+	// After a failed write the later rows would not match their index
+	if (!writer.good())
+	{
+		return false;
+	}
+
+	// The file can not grow while mapped
+	Unmap();
+
+	// Empty rows are only counted (e.g. the HOG descriptors of the geometry only AU prediction)
+	if (row_size == 0)
+	{
+		rows++;
+		return true;
+	}
+
+	cv::Mat_<float> row_cont = row.isContinuous() ? row : row.clone();
+
+	if (half_precision)
+	{
+		cv::Mat row_half;
+		cv::convertFp16(row_cont, row_half);
+		writer.write((const char*)row_half.data, row_size);
+	}
+	else
+	{
+		writer.write((const char*)row_cont.data, row_size);
+	}
+
+	if (!writer.good())
+	{
+		std::cout << "ERROR: could not write to the temporary file " << location << ", only the first " << rows << " rows are kept" << std::endl;
+		Flush();
+		return false;
+	}
+	rows++;
+	return true;
+}
+
+bool DescriptorStore::Flush()
+{
+	if (!writer.is_open() || row_size == 0)
+	{
+		return true;
+	}
+
+	if (writer.good())
+	{
+		writer.flush();
+		if (writer.good())
+		{
+			return true;
+		}
+	}
+
+	// Only the rows that made it to the file completely are kept
+	boost::system::error_code error;
+	boost::uintmax_t file_size = boost::filesystem::file_size(location, error);
+	int rows_written = error ? 0 : (int)std::min((boost::uintmax_t)rows, file_size / row_size);
+	if (rows_written < rows)
+	{
+		std::cout << "ERROR: could not write to the temporary file " << location << ", only the first " << rows_written << " rows are kept" << std::endl;
+		Unmap();
+		rows = rows_written;
+	}
+	return false;
+}
+
+void DescriptorStore::Get(int index, cv::Mat_<float>& row)
+{
+	if (index < 0 || index >= rows || !Map())
+	{
+		row = cv::Mat_<float>();
+		return;
+	}
+
+	char* row_data = data + (size_t)index * row_size;
+	if (half_precision)
+	{
+		cv::Mat row_half(1, cols, CV_16S, row_data);
+		cv::Mat row_float;
+		cv::convertFp16(row_half, row_float);
+		row = row_float;
+	}
+	else
+	{
+		row = cv::Mat_<float>(1, cols, (float*)row_data).clone();
+	}
+}
+
+void DescriptorStore::Set(int index, const cv::Mat_<float>& row)
+{
+	if (index < 0 || index >= rows || !Map())
+	{
+		return;
+	}
+
+	cv::Mat_<float> row_cont = row.isContinuous() ? row : row.clone();
+	char* row_data = data + (size_t)index * row_size;
+	if (half_precision)
+	{
+		cv::Mat row_half;
+		cv::convertFp16(row_cont, row_half);
+		memcpy(row_data, row_half.data, row_size);
+	}
+	else
+	{
+		memcpy(row_data, row_cont.data, row_size);
+	}
+}
+
+void DescriptorStore::GetColumn(int col, std::vector<double>& values)
+{
+	values.clear();
+	if (col < 0 || col >= cols || !Map())
+	{
+		return;
+	}
+
+	values.resize(rows);
+	cv::Mat_<float> value;
+	for (int i = 0; i < rows; ++i)
+	{
+		char* value_data = data + (size_t)i * row_size;
+		if (half_precision)
+		{
+			cv::convertFp16(cv::Mat(1, 1, CV_16S, value_data + col * 2), value);
+			values[i] = value.at<float>(0);
+		}
+		else
+		{
+			values[i] = ((float*)value_data)[col];
+		}
+	}
+}
+
+void DescriptorStore::SetColumn(int col, const std::vector<double>& values)
+{
+	if (col < 0 || col >= cols || (int)values.size() != rows || !Map())
+	{
+		return;
+	}
+
+	cv::Mat value_half;
+	for (int i = 0; i < rows; ++i)
+	{
+		char* value_data = data + (size_t)i * row_size;
+		if (half_precision)
+		{
+			cv::convertFp16(cv::Mat_<float>(1, 1, (float)values[i]), value_half);
+			memcpy(value_data + col * 2, value_half.data, 2);
+		}
+		else
+		{
+			((float*)value_data)[col] = (float)values[i];
+		}
+	}
+}
+
+bool DescriptorStore::Map()
+{
+	if (data != 0 && rows_mapped == rows)
+	{
+		return true;
+	}
+	Unmap();
+
+	if (rows == 0)
+	{
+		return false;
+	}
+
+	Flush();
+	if (rows == 0)
+	{
+		return false;
+	}
+	size_t data_size = (size_t)rows * row_size;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(location.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0, 0, NULL);
+	if (mapping == NULL)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	data = (char*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, data_size);
+	if (data == 0)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	file_handle = file;
+	mapping_handle = mapping;
+#else
+	int fd = open(location.c_str(), O_RDWR);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	// A shared mapping, so that the modified rows are paged out to the file rather than kept in memory
+	void* mapped = mmap(0, data_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (mapped == MAP_FAILED)
+	{
+		return false;
+	}
+	data = (char*)mapped;
+#endif
+
+	rows_mapped = rows;
+	return true;
+}
+
+void DescriptorStore::Unmap()
+{
+	if (data != 0)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+		CloseHandle((HANDLE)mapping_handle);
+		CloseHandle((HANDLE)file_handle);
+		mapping_handle = 0;
+		file_handle = 0;
+#else
+		munmap(data, (size_t)rows_mapped * row_size);
+#endif
+	}
+	data = 0;
+	rows_mapped = 0;
+}
@@ -41,7 +41,10 @@
 // System includes
 #include <stdio.h>
 #include <iostream>
+#include <fstream>
 #include <iomanip>
+#include <algorithm>
+#include <limits>
 
 #include <string>
 
@@ -53,15 +56,206 @@
 
 // Local includes
 #include "Face_utils.h"
+#include "MemoryReport.h"
+#include "Tracing.h"
+#include "Metrics.h"
 
 using namespace FaceAnalysis;
 
 using namespace std;
 
+namespace
+{
+	// Binary (native endianness) serialisation of the analyser state, see FaceAnalyser::WriteState
+	template<typename T>
+	void WriteStateValue(std::ostream& stream, const T& value)
+	{
+		stream.write((const char*)&value, sizeof(T));
+	}
+
+	template<typename T>
+	bool ReadStateValue(std::istream& stream, T& value)
+	{
+		return (bool)stream.read((char*)&value, sizeof(T));
+	}
+
+	void WriteStateMat(std::ostream& stream, const cv::Mat& mat)
+	{
+		cv::Mat continuous = mat.isContinuous() ? mat : mat.clone();
+		WriteStateValue<int32_t>(stream, continuous.rows);
+		WriteStateValue<int32_t>(stream, continuous.cols);
+		WriteStateValue<int32_t>(stream, continuous.type());
+		stream.write((const char*)continuous.data, continuous.total() * continuous.elemSize());
+	}
+
+	template<typename T>
+	bool ReadStateMat(std::istream& stream, cv::Mat_<T>& mat)
+	{
+		int32_t rows, cols, type;
+		if (!ReadStateValue(stream, rows) || !ReadStateValue(stream, cols) || !ReadStateValue(stream, type) || rows < 0 || cols < 0 ||
+			(rows * cols > 0 && type != cv::DataType<T>::type))
+		{
+			return false;
+		}
+		mat.create(rows, cols);
+		return (bool)stream.read((char*)mat.data, mat.total() * mat.elemSize());
+	}
+
+	template<typename T>
+	void WriteStateVector(std::ostream& stream, const std::vector<T>& values)
+	{
+		WriteStateValue<int64_t>(stream, (int64_t)values.size());
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			WriteStateValue(stream, values[i]);
+		}
+	}
+
+	template<typename T>
+	bool ReadStateVector(std::istream& stream, std::vector<T>& values)
+	{
+		int64_t size;
+		if (!ReadStateValue(stream, size) || size < 0)
+		{
+			return false;
+		}
+		values.resize((size_t)size);
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			if (!ReadStateValue(stream, values[i]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void WriteStateSummary(std::ostream& stream, const SummaryStatistics& summary)
+	{
+		WriteStateValue<int64_t>(stream, summary.count);
+		WriteStateMat(stream, summary.mean);
+		WriteStateMat(stream, summary.sum_sq_diff);
+		WriteStateMat(stream, summary.min);
+		WriteStateMat(stream, summary.max);
+	}
+
+	bool ReadStateSummary(std::istream& stream, SummaryStatistics& summary)
+	{
+		int64_t count;
+		bool read = ReadStateValue(stream, count) && count >= 0 && ReadStateMat(stream, summary.mean) && ReadStateMat(stream, summary.sum_sq_diff) &&
+			ReadStateMat(stream, summary.min) && ReadStateMat(stream, summary.max);
+		summary.count = read ? count : 0;
+		return read;
+	}
+
+	template<typename T>
+	void WriteStateMats(std::ostream& stream, const std::vector<cv::Mat_<T> >& mats)
+	{
+		WriteStateValue<int64_t>(stream, (int64_t)mats.size());
+		for (size_t i = 0; i < mats.size(); ++i)
+		{
+			WriteStateMat(stream, mats[i]);
+		}
+	}
+
+	template<typename T>
+	bool ReadStateMats(std::istream& stream, std::vector<cv::Mat_<T> >& mats)
+	{
+		int64_t size;
+		if (!ReadStateValue(stream, size) || size < 0)
+		{
+			return false;
+		}
+		mats.resize((size_t)size);
+		for (size_t i = 0; i < mats.size(); ++i)
+		{
+			if (!ReadStateMat(stream, mats[i]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void WriteStateString(std::ostream& stream, const std::string& value)
+	{
+		WriteStateValue<int32_t>(stream, (int32_t)value.size());
+		stream.write(value.data(), value.size());
+	}
+
+	bool ReadStateString(std::istream& stream, std::string& value)
+	{
+		int32_t size;
+		if (!ReadStateValue(stream, size) || size < 0)
+		{
+			return false;
+		}
+		value.resize(size);
+		return size == 0 || (bool)stream.read(&value[0], size);
+	}
+
+	void WriteStatePredictions(std::ostream& stream, const std::vector<std::pair<std::string, double> >& predictions)
+	{
+		WriteStateValue<int32_t>(stream, (int32_t)predictions.size());
+		for (size_t i = 0; i < predictions.size(); ++i)
+		{
+			WriteStateString(stream, predictions[i].first);
+			WriteStateValue(stream, predictions[i].second);
+		}
+	}
+
+	bool ReadStatePredictions(std::istream& stream, std::vector<std::pair<std::string, double> >& predictions)
+	{
+		int32_t size;
+		if (!ReadStateValue(stream, size) || size < 0)
+		{
+			return false;
+		}
+		predictions.resize(size);
+		for (size_t i = 0; i < predictions.size(); ++i)
+		{
+			if (!ReadStateString(stream, predictions[i].first) || !ReadStateValue(stream, predictions[i].second))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void WriteStateHistory(std::ostream& stream, const std::map<std::string, std::vector<double> >& history)
+	{
+		WriteStateValue<int32_t>(stream, (int32_t)history.size());
+		for (auto au = history.begin(); au != history.end(); ++au)
+		{
+			WriteStateString(stream, au->first);
+			WriteStateVector(stream, au->second);
+		}
+	}
+
+	bool ReadStateHistory(std::istream& stream, std::map<std::string, std::vector<double> >& history)
+	{
+		int32_t size;
+		if (!ReadStateValue(stream, size) || size < 0)
+		{
+			return false;
+		}
+		history.clear();
+		for (int32_t i = 0; i < size; ++i)
+		{
+			std::string name;
+			if (!ReadStateString(stream, name) || !ReadStateVector(stream, history[name]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
 // Constructor from a model file (or a default one if not provided
 FaceAnalyser::FaceAnalyser(const FaceAnalysis::FaceAnalyserParameters& face_analyser_params)
 {
-	this->Read(face_analyser_params.getModelLoc());
+	this->Read(face_analyser_params.getModelLoc(), face_analyser_params.geometry_only_aus);
 		
 	align_mask = face_analyser_params.getAlignMask();
 	align_scale_out = face_analyser_params.getSimScaleOut();
@@ -77,6 +271,13 @@ FaceAnalyser::FaceAnalyser(const FaceAnalysis::FaceAnalyserParameters& face_anal
 	max_val_hog = 1;
 	min_val_hog = -0.005;
 
+	// The projected descriptors are not limited to that range
+	if (!hog_projection.empty())
+	{
+		min_val_hog = hog_projection_range[0];
+		max_val_hog = hog_projection_range[1];
+	}
+
 	// The geometry histogram ranges from -60 to 60
 	num_bins_geom = 10000;
 	max_val_geom = 60;
@@ -90,6 +291,12 @@ FaceAnalyser::FaceAnalyser(const FaceAnalysis::FaceAnalyserParameters& face_anal
 
 	out_grayscale = face_analyser_params.grayscale;
 
+	postprocess_offline = face_analyser_params.postprocess_offline;
+	spill_offline_history = face_analyser_params.spill_offline_history;
+	batch_offline_au = face_analyser_params.batch_offline_au;
+	history_window = face_analyser_params.history_window;
+	pending_au_batch_size = std::max(1, face_analyser_params.au_batch_size);
+
 	if(face_analyser_params.getOrientationBins().empty())
 	{
 		// Just using frontal currently
@@ -102,6 +309,7 @@ FaceAnalyser::FaceAnalyser(const FaceAnalysis::FaceAnalyserParameters& face_anal
 	hog_hist_sum.resize(head_orientations.size());
 	face_image_hist_sum.resize(head_orientations.size());
 	hog_desc_hist.resize(head_orientations.size());
+	hog_desc_median_bins.resize(head_orientations.size());
 	geom_hist_sum = 0;
 	face_image_hist.resize(head_orientations.size());
 
@@ -111,6 +319,79 @@ FaceAnalyser::FaceAnalyser(const FaceAnalysis::FaceAnalyserParameters& face_anal
 
 }
 
+// Copy constructor, the AU models and the PDM are read only so they are shared between the copies, while the per sequence state is deep copied,
+// this allows to analyse several sequences at once without reading the models multiple times (any history spilled to temporary files is not copied)
+FaceAnalyser::FaceAnalyser(const FaceAnalyser& other) :
+	pdm(other.pdm), AU_predictions_reg(other.AU_predictions_reg), AU_predictions_class(other.AU_predictions_class),
+	AU_predictions_combined(other.AU_predictions_combined), AU_name_table_reg(other.AU_name_table_reg), AU_name_table_class(other.AU_name_table_class),
+	AU_values_reg(other.AU_values_reg), AU_values_class(other.AU_values_class), timestamps(other.timestamps), AU_predictions_reg_all_hist(other.AU_predictions_reg_all_hist),
+	AU_predictions_class_all_hist(other.AU_predictions_class_all_hist), valid_preds(other.valid_preds), history_window(other.history_window),
+	postprocess_offline(other.postprocess_offline), spill_offline_history(other.spill_offline_history),
+	batch_offline_au(other.batch_offline_au), pending_au_batch_size(other.pending_au_batch_size), pending_au_frames(other.pending_au_frames), median_changed(other.median_changed), frames_tracking(other.frames_tracking),
+	dynamic(other.dynamic), aligned_face_for_au(other.aligned_face_for_au), aligned_face_for_output(other.aligned_face_for_output),
+	out_grayscale(other.out_grayscale), hog_desc_frame(other.hog_desc_frame), num_hog_rows(other.num_hog_rows), num_hog_cols(other.num_hog_cols),
+	hog_projection_mean(other.hog_projection_mean), hog_projection(other.hog_projection), hog_projection_range(other.hog_projection_range), hog_desc_output(other.hog_desc_output),
+	hog_desc_median(other.hog_desc_median), face_image_median(other.face_image_median), hog_desc_hist(other.hog_desc_hist), hog_desc_median_bins(other.hog_desc_median_bins),
+	face_image_hist(other.face_image_hist), face_image_hist_sum(other.face_image_hist_sum), head_orientations(other.head_orientations),
+	num_bins_hog(other.num_bins_hog), min_val_hog(other.min_val_hog), max_val_hog(other.max_val_hog), hog_hist_sum(other.hog_hist_sum),
+	view_used(other.view_used), geom_descriptor_frame(other.geom_descriptor_frame), geom_descriptor_median(other.geom_descriptor_median),
+	geom_hist_sum(other.geom_hist_sum), geom_desc_hist(other.geom_desc_hist), geom_desc_median_bins(other.geom_desc_median_bins), num_bins_geom(other.num_bins_geom), min_val_geom(other.min_val_geom),
+	max_val_geom(other.max_val_geom), face_bounding_box(other.face_bounding_box),
+	AU_SVR_static_appearance_lin_regressors(other.AU_SVR_static_appearance_lin_regressors),
+	AU_SVR_dynamic_appearance_lin_regressors(other.AU_SVR_dynamic_appearance_lin_regressors),
+	AU_SVM_static_appearance_lin(other.AU_SVM_static_appearance_lin), AU_SVM_dynamic_appearance_lin(other.AU_SVM_dynamic_appearance_lin),
+	AU_lin_fused(other.AU_lin_fused),
+	au_prediction_correction_histogram(other.au_prediction_correction_histogram), au_prediction_correction_count(other.au_prediction_correction_count),
+	dyn_scaling(other.dyn_scaling),
+	current_time_seconds(other.current_time_seconds), triangulation(other.triangulation), align_scale_au(other.align_scale_au),
+	align_width_au(other.align_width_au), align_height_au(other.align_height_au), align_mask(other.align_mask), align_scale_out(other.align_scale_out),
+	align_width_out(other.align_width_out), align_height_out(other.align_height_out), max_init_frames(other.max_init_frames),
+	hog_desc_frames_init(other.hog_desc_frames_init), geom_descriptor_frames_init(other.geom_descriptor_frames_init), views(other.views),
+	postprocessed(other.postprocessed), frames_tracking_succ(other.frames_tracking_succ), requested_outputs(other.requested_outputs),
+	median_update_every(other.median_update_every)
+{
+	this->aligned_face_for_au = other.aligned_face_for_au.clone();
+	this->aligned_face_for_output = other.aligned_face_for_output.clone();
+	this->hog_desc_frame = other.hog_desc_frame.clone();
+	this->hog_desc_output = other.hog_desc_output.clone();
+	this->hog_desc_median = other.hog_desc_median.clone();
+	this->face_image_median = other.face_image_median.clone();
+	this->geom_descriptor_frame = other.geom_descriptor_frame.clone();
+	this->geom_descriptor_median = other.geom_descriptor_median.clone();
+	this->geom_desc_hist = other.geom_desc_hist.clone();
+	this->geom_desc_median_bins = other.geom_desc_median_bins.clone();
+	this->AU_reg_summary.Merge(other.AU_reg_summary);
+	this->geom_desc_summary.Merge(other.geom_desc_summary);
+	this->pending_au_inputs = other.pending_au_inputs.clone();
+	this->pending_au_median_responses = other.pending_au_median_responses.clone();
+	this->current_median_response = other.current_median_response.clone();
+	this->median_response_input = other.median_response_input.clone();
+	this->median_response_updates = other.median_response_updates;
+	this->baseline_loaded = other.baseline_loaded;
+
+	for (size_t i = 0; i < other.hog_desc_hist.size(); ++i)
+	{
+		this->hog_desc_hist[i] = other.hog_desc_hist[i].clone();
+		this->hog_desc_median_bins[i] = other.hog_desc_median_bins[i].clone();
+	}
+	for (size_t i = 0; i < other.face_image_hist.size(); ++i)
+	{
+		this->face_image_hist[i] = other.face_image_hist[i].clone();
+	}
+	for (size_t i = 0; i < other.au_prediction_correction_histogram.size(); ++i)
+	{
+		this->au_prediction_correction_histogram[i] = other.au_prediction_correction_histogram[i].clone();
+	}
+	for (size_t i = 0; i < other.hog_desc_frames_init.size(); ++i)
+	{
+		this->hog_desc_frames_init[i] = other.hog_desc_frames_init[i].clone();
+	}
+	for (size_t i = 0; i < other.geom_descriptor_frames_init.size(); ++i)
+	{
+		this->geom_descriptor_frames_init[i] = other.geom_descriptor_frames_init[i].clone();
+	}
+}
+
 // Utility for getting the names of returned AUs (presence)
 std::vector<std::string> FaceAnalyser::GetAUClassNames() const
 {
@@ -190,11 +471,12 @@ cv::Mat_<int> FaceAnalyser::GetTriangulation()
 	return triangulation.clone();
 }
 
-void FaceAnalyser::GetLatestHOG(cv::Mat_<double>& hog_descriptor, int& num_rows, int& num_cols)
+void FaceAnalyser::GetLatestHOG(cv::Mat_<float>& hog_descriptor, int& num_rows, int& num_cols)
 {
-	hog_descriptor = this->hog_desc_frame.clone();
+	// The output is always the full descriptor, not the projected one
+	hog_descriptor = hog_projection.empty() ? this->hog_desc_frame.clone() : this->hog_desc_output.clone();
 
-	if(!hog_desc_frame.empty())
+	if(!hog_descriptor.empty())
 	{
 		num_rows = this->num_hog_rows;
 		num_cols = this->num_hog_cols;
@@ -211,7 +493,7 @@ void FaceAnalyser::GetLatestAlignedFace(cv::Mat& image)
 	image = this->aligned_face_for_output.clone();
 }
 
-void FaceAnalyser::GetLatestNeutralHOG(cv::Mat_<double>& hog_descriptor, int& num_rows, int& num_cols)
+void FaceAnalyser::GetLatestNeutralHOG(cv::Mat_<float>& hog_descriptor, int& num_rows, int& num_cols)
 {
 	hog_descriptor = this->hog_desc_median;
 	if(!hog_desc_median.empty())
@@ -278,7 +560,7 @@ void FaceAnalyser::PredictStaticAUsAndComputeFeatures(const cv::Mat& frame, cons
 	}
 
 	// Extract HOG descriptor from the frame and convert it to a useable format
-	cv::Mat_<double> hog_descriptor;
+	cv::Mat_<float> hog_descriptor;
 	Extract_FHOG_descriptor(hog_descriptor, aligned_face_for_au, this->num_hog_rows, this->num_hog_cols);
 
 	// Store the descriptor
@@ -287,15 +569,11 @@ void FaceAnalyser::PredictStaticAUsAndComputeFeatures(const cv::Mat& frame, cons
 	cv::Vec3d curr_orient(params_global[1], params_global[2], params_global[3]);
 	int orientation_to_use = GetViewId(this->head_orientations, curr_orient);
 	
-	// Geom descriptor and its median, TODO these should be floats?
-	params_local = params_local.t();
-	params_local.convertTo(geom_descriptor_frame, CV_64F);
-	
-	cv::Mat_<double> princ_comp_d;
-	pdm.princ_comp.convertTo(princ_comp_d, CV_64F);
+	// Geom descriptor and its median
+	geom_descriptor_frame = params_local.t();
 
 	// Stack with the actual feature point locations (without mean)
-	cv::Mat_<double> locs = princ_comp_d * geom_descriptor_frame.t();
+	cv::Mat_<float> locs = pdm.princ_comp * geom_descriptor_frame.t();
 
 	cv::hconcat(locs.t(), geom_descriptor_frame.clone(), geom_descriptor_frame);
 	
@@ -305,8 +583,9 @@ void FaceAnalyser::PredictStaticAUsAndComputeFeatures(const cv::Mat& frame, cons
 	//aligned_face_cols.convertTo(aligned_face_cols_double, CV_64F);
 	
 	// Perform AU prediction	
-	auto AU_predictions_intensity = PredictCurrentAUs(orientation_to_use);
-	auto AU_predictions_occurence = PredictCurrentAUsClass(orientation_to_use);
+	vector<pair<string, double>> AU_predictions_intensity;
+	vector<pair<string, double>> AU_predictions_occurence;
+	PredictCurrentAUsAll(orientation_to_use, AU_predictions_intensity, AU_predictions_occurence);
 
 	// Make sure intensity is within range (0-5)
 	for (size_t au = 0; au < AU_predictions_intensity.size(); ++au)
@@ -320,14 +599,20 @@ void FaceAnalyser::PredictStaticAUsAndComputeFeatures(const cv::Mat& frame, cons
 	
 	AU_predictions_reg = AU_predictions_intensity;
 	AU_predictions_class = AU_predictions_occurence;
+	UpdateCurrentAUValues();
 
 }
 
 
 void FaceAnalyser::AddNextFrame(const cv::Mat& frame, const cv::Mat_<float>& detected_landmarks, bool success, double timestamp_seconds, bool online)
 {
+	TRACE_SCOPE("FaceAnalyser::AddNextFrame");
+	METRICS_LATENCY("openface_stage_latency_seconds{stage=\"face_analysis\"}", "Latency of the processing stages in seconds");
 
-	frames_tracking++;
+	// Work out which of the stages are needed for the requested outputs
+	bool need_aus = (requested_outputs & (OUTPUT_AU_INTENSITY | OUTPUT_AU_PRESENCE)) != 0;
+	bool need_hog = (need_aus && !AU_lin_fused.IsGeometryOnly()) || (requested_outputs & OUTPUT_HOG) != 0;
+	bool need_aligned = (requested_outputs & OUTPUT_ALIGNED_FACE) != 0;
 
 	// Extract shape parameters from the detected landmarks
 	cv::Vec6f params_global;
@@ -336,14 +621,22 @@ void FaceAnalyser::AddNextFrame(const cv::Mat& frame, const cv::Mat_<float>& det
 	// First align the face if tracking was successfull
 	if(success)
 	{
+		TRACE_SCOPE("FaceAnalyser face alignment");
 
 		pdm.CalcParams(params_global, params_local, detected_landmarks);
 
 		// The aligned face requirement for AUs
-		AlignFaceMask(aligned_face_for_au, frame, detected_landmarks, params_global, pdm, triangulation, true, align_scale_au, align_width_au, align_height_au);
+		if (need_hog)
+		{
+			AlignFaceMask(aligned_face_for_au, frame, detected_landmarks, params_global, pdm, triangulation, true, align_scale_au, align_width_au, align_height_au);
+		}
 
 		// If the aligned face for AU matches the output requested one, just reuse it, else compute it
-		if (align_scale_out == align_scale_au && align_width_out == align_width_au && align_height_out == align_height_au && align_mask)
+		if (!need_aligned)
+		{
+			aligned_face_for_output = cv::Mat();
+		}
+		else if (need_hog && align_scale_out == align_scale_au && align_width_out == align_width_au && align_height_out == align_height_au && align_mask)
 		{
 			aligned_face_for_output = aligned_face_for_au.clone();
 		}
@@ -361,10 +654,18 @@ void FaceAnalyser::AddNextFrame(const cv::Mat& frame, const cv::Mat_<float>& det
 	}
 	else
 	{
-		aligned_face_for_output = cv::Mat(align_height_out, align_width_out, CV_8UC3);
-		aligned_face_for_au = cv::Mat(align_height_au, align_width_au, CV_8UC3);
-		aligned_face_for_output.setTo(0);
-		aligned_face_for_au.setTo(0);
+		aligned_face_for_output = cv::Mat();
+		aligned_face_for_au = cv::Mat();
+		if (need_aligned)
+		{
+			aligned_face_for_output = cv::Mat(align_height_out, align_width_out, CV_8UC3);
+			aligned_face_for_output.setTo(0);
+		}
+		if (need_hog)
+		{
+			aligned_face_for_au = cv::Mat(align_height_au, align_width_au, CV_8UC3);
+			aligned_face_for_au.setTo(0);
+		}
 		params_local = cv::Mat_<float>(pdm.NumberOfModes(), 1, 0.0f);
 	}
 
@@ -374,12 +675,99 @@ void FaceAnalyser::AddNextFrame(const cv::Mat& frame, const cv::Mat_<float>& det
 	}
 
 	// Extract HOG descriptor from the frame and convert it to a useable format
-	cv::Mat_<double> hog_descriptor;
-	Extract_FHOG_descriptor(hog_descriptor, aligned_face_for_au, this->num_hog_rows, this->num_hog_cols);
+	cv::Mat_<float> hog_descriptor;
+	if (need_hog)
+	{
+		TRACE_SCOPE("Extract_FHOG_descriptor");
+		Extract_FHOG_descriptor(hog_descriptor, aligned_face_for_au, this->num_hog_rows, this->num_hog_cols);
+	}
+
+	if (!hog_projection.empty())
+	{
+		hog_desc_output = (requested_outputs & OUTPUT_HOG) ? hog_descriptor : cv::Mat_<float>();
+		cv::Mat_<float> hog_projected;
+		ProjectHOG(hog_projected, hog_descriptor);
+		hog_descriptor = hog_projected;
+	}
 	
+	AddNextDescriptors(hog_descriptor, params_global, params_local, success, timestamp_seconds, online);
+}
+
+void FaceAnalyser::AddNextFrameHOG(const cv::Mat_<float>& hog_descriptor, int num_rows, int num_cols, const cv::Mat_<float>& detected_landmarks, bool success,
+	double timestamp_seconds, bool online)
+{
+	TRACE_SCOPE("FaceAnalyser::AddNextFrameHOG");
+
+	// Only the shape parameters are needed, from the same model as when the descriptor was extracted
+	cv::Vec6f params_global;
+	cv::Mat_<float> params_local;
+	if (success)
+	{
+		pdm.CalcParams(params_global, params_local, detected_landmarks);
+	}
+	else
+	{
+		params_local = cv::Mat_<float>(pdm.NumberOfModes(), 1, 0.0f);
+	}
+
+	this->num_hog_rows = num_rows;
+	this->num_hog_cols = num_cols;
+	aligned_face_for_au = cv::Mat();
+	aligned_face_for_output = cv::Mat();
+
+	// The descriptor is kept in the history, and the caller might reuse its buffer for the next frame
+	if (!hog_projection.empty())
+	{
+		hog_desc_output = (requested_outputs & OUTPUT_HOG) ? hog_descriptor.clone() : cv::Mat_<float>();
+		cv::Mat_<float> hog_projected;
+		ProjectHOG(hog_projected, hog_descriptor);
+		AddNextDescriptors(hog_projected, params_global, params_local, success, timestamp_seconds, online);
+		return;
+	}
+	AddNextDescriptors(hog_descriptor.clone(), params_global, params_local, success, timestamp_seconds, online);
+}
+
+void FaceAnalyser::ProjectHOG(cv::Mat_<float>& projected, const cv::Mat_<float>& hog_descriptor) const
+{
+	if (hog_descriptor.empty())
+	{
+		projected = cv::Mat_<float>();
+		return;
+	}
+
+	if (hog_descriptor.cols != hog_projection.rows)
+	{
+		cout << "WARNING: the HOG descriptor has " << hog_descriptor.cols << " values while the HOG projection expects " << hog_projection.rows << endl;
+		projected = cv::Mat_<float>(1, hog_projection.cols, 0.0f);
+		return;
+	}
+
+	cv::gemm(hog_descriptor - hog_projection_mean, hog_projection, 1.0, cv::noArray(), 0.0, projected);
+}
+
+void FaceAnalyser::AddNextDescriptors(const cv::Mat_<float>& hog_descriptor, const cv::Vec6f& params_global, const cv::Mat_<float>& params_local, bool success,
+	double timestamp_seconds, bool online)
+{
+	frames_tracking++;
+
+	bool need_aus = (requested_outputs & (OUTPUT_AU_INTENSITY | OUTPUT_AU_PRESENCE)) != 0;
+	bool need_medians = need_aus && (requested_outputs & OUTPUT_DYNAMIC_NORMALISATION) != 0;
+
 	// Store the descriptor
 	hog_desc_frame = hog_descriptor;
 
+	if (!need_aus)
+	{
+		// Nothing else is needed, but keep the frame bookkeeping consistent
+		AU_predictions_reg.clear();
+		AU_predictions_class.clear();
+		UpdateCurrentAUValues();
+
+		this->current_time_seconds = timestamp_seconds;
+		AddFrameToHistory(success, timestamp_seconds);
+		return;
+	}
+
 	cv::Vec3d curr_orient(params_global[1], params_global[2], params_global[3]);
 	int orientation_to_use = GetViewId(this->head_orientations, curr_orient);
 
@@ -417,16 +805,18 @@ void FaceAnalyser::AddNextFrame(const cv::Mat& frame, const cv::Mat_<float>& det
 	if (success)
 		frames_tracking_succ++;
 
-	// A small speedup
-	if(frames_tracking % 2 == 1)
+	// A small speedup (the geometry only models do not use the HOG median)
+	if((frames_tracking - 1) % median_update_every == 0 && need_medians && !AU_lin_fused.IsGeometryOnly())
 	{
-		UpdateRunningMedian(this->hog_desc_hist[orientation_to_use], this->hog_hist_sum[orientation_to_use], this->hog_desc_median, hog_descriptor, update_median, this->num_bins_hog, this->min_val_hog, this->max_val_hog);
-		this->hog_desc_median.setTo(0, this->hog_desc_median < 0);
+		TRACE_SCOPE("FaceAnalyser HOG median update");
+		UpdateRunningMedian(this->hog_desc_hist[orientation_to_use], this->hog_hist_sum[orientation_to_use], this->hog_desc_median_bins[orientation_to_use], this->hog_desc_median, hog_descriptor, update_median, this->num_bins_hog, this->min_val_hog, this->max_val_hog);
+		if (hog_projection.empty())
+			this->hog_desc_median.setTo(0, this->hog_desc_median < 0);
+		median_changed = true;
 	}	
 
 	// Geom descriptor and its median
-	params_local = params_local.t();
-	params_local.convertTo(geom_descriptor_frame, CV_64F);
+	geom_descriptor_frame = params_local.t();
 
 	if(!success)
 	{
@@ -434,60 +824,52 @@ void FaceAnalyser::AddNextFrame(const cv::Mat& frame, const cv::Mat_<float>& det
 	}
 
 	// Stack with the actual feature point locations (without mean)
-	// TODO rem double
-	cv::Mat_<double> princ_comp_d;
-	pdm.princ_comp.convertTo(princ_comp_d, CV_64F);
-	cv::Mat_<double> locs = princ_comp_d * geom_descriptor_frame.t();
+	cv::Mat_<float> locs = pdm.princ_comp * geom_descriptor_frame.t();
 	
 	cv::hconcat(locs.t(), geom_descriptor_frame.clone(), geom_descriptor_frame);
+
+	if (success)
+	{
+		geom_desc_summary.Add(geom_descriptor_frame);
+	}
 	
 	// A small speedup
-	if(frames_tracking % 2 == 1)
+	if((frames_tracking - 1) % median_update_every == 0 && need_medians)
 	{
-		UpdateRunningMedian(this->geom_desc_hist, this->geom_hist_sum, this->geom_descriptor_median, geom_descriptor_frame, update_median, this->num_bins_geom, this->min_val_geom, this->max_val_geom);
+		UpdateRunningMedian(this->geom_desc_hist, this->geom_hist_sum, this->geom_desc_median_bins, this->geom_descriptor_median, geom_descriptor_frame, update_median, this->num_bins_geom, this->min_val_geom, this->max_val_geom);
+		median_changed = true;
 	}
-	
-	// Perform AU prediction	
-	AU_predictions_reg = PredictCurrentAUs(orientation_to_use);
 
-	// Add the reg predictions to the historic data
-	for (size_t au = 0; au < AU_predictions_reg.size(); ++au)
+	// Without the dynamic normalisation the dynamic models see a neutral (zero) median
+	if (!need_medians && hog_desc_median.empty())
 	{
-
-		// Find the appropriate AU (if not found add it)		
-		// Only add if the detection was successful
-		if(success)
-		{
-			AU_predictions_reg_all_hist[AU_predictions_reg[au].first].push_back(AU_predictions_reg[au].second);
-		}
-		else
-		{
-			AU_predictions_reg_all_hist[AU_predictions_reg[au].first].push_back(0);
-
-			// Also invalidate AU if not successful
-			AU_predictions_reg[au].second = 0;
-		}
+		hog_desc_median = cv::Mat_<float>(1, hog_descriptor.cols, 0.0f);
+		geom_descriptor_median = cv::Mat_<float>(1, geom_descriptor_frame.cols, 0.0f);
+		median_changed = true;
 	}
 	
-	AU_predictions_class = PredictCurrentAUsClass(orientation_to_use);
-
-	for (size_t au = 0; au < AU_predictions_class.size(); ++au)
+	if (batch_offline_au && postprocess_offline && !online && !AU_lin_fused.Empty())
 	{
-
-		// Find the appropriate AU (if not found add it)		
-		// Only add if the detection was successful
-		if(success)
+		// The prediction is deferred, and done for a batch of frames at once
+		TRACE_SCOPE("FaceAnalyser AU batching");
+		QueueCurrentAUs(success);
+	}
+	else
+	{
+		// Perform AU prediction	
 		{
-			AU_predictions_class_all_hist[AU_predictions_class[au].first].push_back(AU_predictions_class[au].second);
+			TRACE_SCOPE("FaceAnalyser AU prediction");
+			PredictCurrentAUsAll(orientation_to_use, AU_predictions_reg, AU_predictions_class);
 		}
-		else
-		{
-			AU_predictions_class_all_hist[AU_predictions_class[au].first].push_back(0);
 
-			// Also invalidate AU if not successful
-			AU_predictions_class[au].second = 0;
+		// Add the reg predictions to the historic data (invalidated if not successful)
+		AddToHistory(AU_predictions_reg, AU_predictions_reg_all_hist, AU_predictions_reg_store, AU_predictions_reg_store_names, success);
+		AddToHistory(AU_predictions_class, AU_predictions_class_all_hist, AU_predictions_class_store, AU_predictions_class_store_names, success);
+		if (success)
+		{
+			AddToSummary(AU_predictions_reg);
 		}
-	}	
+	}
 
 	// A workaround for online predictions to make them a bit more accurate
 	std::vector<std::pair<std::string, double>> AU_predictions_reg_corrected;
@@ -496,12 +878,32 @@ void FaceAnalyser::AddNextFrame(const cv::Mat& frame, const cv::Mat_<float>& det
 		AU_predictions_reg_corrected = CorrectOnlineAUs(AU_predictions_reg, orientation_to_use, true, false, success, true);
 		AU_predictions_reg = AU_predictions_reg_corrected;
 	}
+	UpdateCurrentAUValues();
 
 	// Useful for prediction corrections (calibration after the whole video is processed)
-	if (success && frames_tracking_succ - 1 < max_init_frames)
+	if (success && frames_tracking_succ - 1 < max_init_frames && postprocess_offline && !baseline_loaded)
 	{
-		hog_desc_frames_init.push_back(hog_descriptor);
-		geom_descriptor_frames_init.push_back(geom_descriptor_frame);
+		// Both of the stores are opened together with the first frame, if either of them fails the frames are kept in memory instead
+		if (spill_offline_history && !hog_desc_frames_init_store.IsOpen() && hog_desc_frames_init.empty())
+		{
+			bool opened = hog_desc_frames_init_store.Open(hog_descriptor.cols, true) && geom_descriptor_frames_init_store.Open(geom_descriptor_frame.cols, false);
+			if (!opened || !hog_desc_frames_init_store.IsOpen())
+			{
+				hog_desc_frames_init_store.Close();
+				geom_descriptor_frames_init_store.Close();
+			}
+		}
+
+		if (hog_desc_frames_init_store.IsOpen())
+		{
+			hog_desc_frames_init_store.Append(hog_descriptor);
+			geom_descriptor_frames_init_store.Append(geom_descriptor_frame);
+		}
+		else
+		{
+			hog_desc_frames_init.push_back(hog_descriptor);
+			geom_descriptor_frames_init.push_back(geom_descriptor_frame);
+		}
 		views.push_back(orientation_to_use);
 	}
 
@@ -509,276 +911,1169 @@ void FaceAnalyser::AddNextFrame(const cv::Mat& frame, const cv::Mat_<float>& det
 
 	view_used = orientation_to_use;
 			
-	valid_preds.push_back(success);
-	timestamps.push_back(timestamp_seconds);
-
-}
+	AddFrameToHistory(success, timestamp_seconds);
 
-void FaceAnalyser::GetGeomDescriptor(cv::Mat_<double>& geom_desc)
-{
-	geom_desc = this->geom_descriptor_frame.clone();
 }
 
-// Perform prediction on initial n frames anew as the current neutral face estimate is better now
-void FaceAnalyser::PostprocessPredictions()
+void FaceAnalyser::RepeatLastFrame(double timestamp_seconds)
 {
-	if(!postprocessed)
+	if (valid_preds.empty())
 	{
-		int success_ind = 0;
-		int all_ind = 0;
-		int all_frames_size = (int)timestamps.size();
-		
-		while(all_ind < all_frames_size && success_ind < max_init_frames)
-		{
-		
-			if(valid_preds[all_ind])
-			{
-
-				this->hog_desc_frame = hog_desc_frames_init[success_ind];
-				this->geom_descriptor_frame = geom_descriptor_frames_init[success_ind];
-
-				// Perform AU prediction	
-				auto AU_predictions_reg = PredictCurrentAUs(views[success_ind]);								
-
-				// Modify the predictions to the historic data
-				for (size_t au = 0; au < AU_predictions_reg.size(); ++au)
-				{
-					// Find the appropriate AU (if not found add it)		
-					AU_predictions_reg_all_hist[AU_predictions_reg[au].first][all_ind] = AU_predictions_reg[au].second;
+		return;
+	}
 
-				}
+	bool success = valid_preds.back();
+	int last_frame = (int)valid_preds.size() - 1;
 
-				auto AU_predictions_class = PredictCurrentAUsClass(views[success_ind]);
+	if (!pending_au_frames.empty() && pending_au_frames.back() == last_frame)
+	{
+		// The last frame is still waiting for its prediction, so the repeat waits for it as well
+		AddToHistory(AU_predictions_reg, AU_predictions_reg_all_hist, AU_predictions_reg_store, AU_predictions_reg_store_names, success);
+		AddToHistory(AU_predictions_class, AU_predictions_class_all_hist, AU_predictions_class_store, AU_predictions_class_store_names, success);
 
-				for (size_t au = 0; au < AU_predictions_class.size(); ++au)
-				{
-					// Find the appropriate AU (if not found add it)		
-					AU_predictions_class_all_hist[AU_predictions_class[au].first][all_ind] = AU_predictions_class[au].second;
-				}
-		
-				success_ind++;
-			}
-			all_ind++;
+		pending_au_inputs.push_back(cv::Mat_<float>(pending_au_inputs.row(pending_au_inputs.rows - 1).clone()));
+		if (!pending_au_median_responses.empty())
+		{
+			pending_au_median_responses.push_back(cv::Mat_<float>(pending_au_median_responses.row(pending_au_median_responses.rows - 1).clone()));
+		}
+		pending_au_frames.push_back(last_frame + 1);
 
+		if ((int)pending_au_frames.size() >= pending_au_batch_size)
+		{
+			PredictPendingAUs();
 		}
-		postprocessed = true;
 	}
-}
-
-void FaceAnalyser::ExtractAllPredictionsOfflineReg(vector<std::pair<std::string, vector<double>>>& au_predictions, vector<double>& confidences, vector<bool>& successes, vector<double>& timestamps, bool dynamic)
-{
-	if(dynamic)
+	else
 	{
-		PostprocessPredictions();
+		RepeatLastHistory(AU_predictions_reg_all_hist, AU_predictions_reg_store);
+		RepeatLastHistory(AU_predictions_class_all_hist, AU_predictions_class_store);
+		if (success)
+		{
+			AddToSummary(AU_predictions_reg);
+		}
 	}
-
-	timestamps = this->timestamps;
-	au_predictions.clear();
-	// First extract the valid AU values and put them in a different format
-	vector<vector<double>> aus_valid;
-	vector<double> offsets;
-	successes = this->valid_preds;
-	
-	vector<string> dyn_au_names = AU_SVR_dynamic_appearance_lin_regressors.GetAUNames();
-
-	// Allow these AUs to be person calirated based on expected number of neutral frames (learned from the data)
-	for(auto au_iter = AU_predictions_reg_all_hist.begin(); au_iter != AU_predictions_reg_all_hist.end(); ++au_iter)
+	if (success)
 	{
-		vector<double> au_good;
-		string au_name = au_iter->first;
-		vector<double> au_vals = au_iter->second;
-		
-		au_predictions.push_back(std::pair<string,vector<double>>(au_name, au_vals));
+		geom_desc_summary.Add(geom_descriptor_frame);
+	}
 
-		for(size_t frame = 0; frame < au_vals.size(); ++frame)
+	// The repeat counts towards the initial frames that are predicted anew by the postprocessing as well, as those are matched to the history
+	// by the successful frames
+	bool aus_predicted = !AU_predictions_reg.empty() || !AU_predictions_class.empty();
+	if (success && aus_predicted)
+	{
+		frames_tracking_succ++;
+		if (frames_tracking_succ - 1 < max_init_frames && postprocess_offline && !baseline_loaded)
 		{
-
-			if(successes[frame])
+			if (hog_desc_frames_init_store.IsOpen())
 			{
-				au_good.push_back(au_vals[frame]);
+				hog_desc_frames_init_store.Append(hog_desc_frame);
+				geom_descriptor_frames_init_store.Append(geom_descriptor_frame);
 			}
-
+			else
+			{
+				hog_desc_frames_init.push_back(hog_desc_frame.clone());
+				geom_descriptor_frames_init.push_back(geom_descriptor_frame.clone());
+			}
+			views.push_back(view_used);
 		}
+	}
+
+	this->current_time_seconds = timestamp_seconds;
+
+	AddFrameToHistory(success, timestamp_seconds);
+}
+
+void FaceAnalyser::AddFrameToHistory(bool success, double timestamp_seconds)
+{
+	valid_preds.push_back(success);
+	timestamps.push_back(timestamp_seconds);
 
-		if(au_good.empty() || !dynamic)
+	// Dropping the oldest window at once keeps the cost per frame constant, and at most twice the window in memory
+	if (history_window > 0 && (int)timestamps.size() >= 2 * history_window)
+	{
+		timestamps.erase(timestamps.begin(), timestamps.end() - history_window);
+		valid_preds.erase(valid_preds.begin(), valid_preds.end() - history_window);
+	}
+}
+
+void FaceAnalyser::RepeatLastHistory(std::map<std::string, std::vector<double>>& all_hist, DescriptorStore& store)
+{
+	if (!postprocess_offline)
+	{
+		return;
+	}
+
+	if (store.IsOpen())
+	{
+		if (store.Rows() > 0)
 		{
-			offsets.push_back(0.0);
+			cv::Mat_<float> row;
+			store.Get(store.Rows() - 1, row);
+			store.Append(row.clone());
 		}
-		else
+	}
+	else
+	{
+		for (auto au_iter = all_hist.begin(); au_iter != all_hist.end(); ++au_iter)
+		{
+			if (!au_iter->second.empty())
+			{
+				double last = au_iter->second.back();
+				au_iter->second.push_back(last);
+			}
+		}
+	}
+}
+
+void FaceAnalyser::QueueCurrentAUs(bool success)
+{
+	// The history is filled with placeholders, which are replaced once the frame is predicted
+	AU_predictions_reg.clear();
+	AU_predictions_class.clear();
+	for (const string& name : AU_lin_fused.GetRegNames())
+	{
+		AU_predictions_reg.push_back(pair<string, double>(name, 0.0));
+	}
+	for (const string& name : AU_lin_fused.GetClassNames())
+	{
+		AU_predictions_class.push_back(pair<string, double>(name, 0.0));
+	}
+
+	int frame = (int)valid_preds.size();
+	AddToHistory(AU_predictions_reg, AU_predictions_reg_all_hist, AU_predictions_reg_store, AU_predictions_reg_store_names, success);
+	AddToHistory(AU_predictions_class, AU_predictions_class_all_hist, AU_predictions_class_store, AU_predictions_class_store_names, success);
+
+	// Unsuccessful frames stay at zero
+	if (!success || (hog_desc_frame.empty() && !AU_lin_fused.IsGeometryOnly()))
+	{
+		return;
+	}
+
+	// The median is not updated on every frame (see median_update_every), so its response is only updated when it changed
+	UpdateCurrentMedianResponse();
+
+	cv::Mat_<float> input;
+	AU_lin_fused.BuildInput(input, hog_desc_frame, geom_descriptor_frame);
+	pending_au_inputs.push_back(input);
+	if (!current_median_response.empty())
+	{
+		pending_au_median_responses.push_back(current_median_response);
+	}
+	pending_au_frames.push_back(frame);
+
+	if ((int)pending_au_frames.size() >= pending_au_batch_size)
+	{
+		PredictPendingAUs();
+	}
+}
+
+void FaceAnalyser::UpdateCurrentMedianResponse()
+{
+	if (!median_changed)
+	{
+		return;
+	}
+
+	cv::Mat_<float> run_med;
+	AU_lin_fused.BuildInput(run_med, this->hog_desc_median, this->geom_descriptor_median);
+	if (current_median_response.empty() || median_response_updates >= median_response_refresh)
+	{
+		AU_lin_fused.MedianResponse(current_median_response, run_med);
+		median_response_updates = 0;
+	}
+	else
+	{
+		AU_lin_fused.UpdateMedianResponse(current_median_response, median_response_input, run_med);
+		median_response_updates++;
+	}
+
+	// The input can share the data of the medians, which are modified in place
+	median_response_input = run_med.clone();
+	median_changed = false;
+}
+
+void FaceAnalyser::PredictPendingAUs()
+{
+	if (pending_au_frames.empty())
+	{
+		return;
+	}
+
+	TRACE_SCOPE_ARG("FaceAnalyser batched AU prediction", pending_au_frames.size());
+
+	cv::Mat_<float> preds;
+	AU_lin_fused.PredictWithResponses(preds, pending_au_inputs, pending_au_median_responses);
+
+	vector<pair<string, double>> AU_predictions_reg, AU_predictions_class;
+	for (size_t i = 0; i < pending_au_frames.size(); ++i)
+	{
+		AU_lin_fused.GetAUs(AU_predictions_reg, AU_predictions_class, preds, (int)i);
+		SetHistory(pending_au_frames[i], AU_predictions_reg, AU_predictions_reg_all_hist, AU_predictions_reg_store, AU_predictions_reg_store_names);
+		SetHistory(pending_au_frames[i], AU_predictions_class, AU_predictions_class_all_hist, AU_predictions_class_store, AU_predictions_class_store_names);
+
+		// Only the successfully tracked frames are predicted
+		AddToSummary(AU_predictions_reg);
+	}
+
+	pending_au_inputs = cv::Mat_<float>();
+	pending_au_median_responses = cv::Mat_<float>();
+	pending_au_frames.clear();
+}
+
+void FaceAnalyser::GetGeomDescriptor(cv::Mat_<float>& geom_desc)
+{
+	geom_desc = this->geom_descriptor_frame.clone();
+}
+
+void FaceAnalyser::AddToSummary(const std::vector<std::pair<std::string, double>>& predictions)
+{
+	if (predictions.empty())
+	{
+		return;
+	}
+	FillAUValues(predictions, AU_name_table_reg, AU_summary_values);
+	AU_reg_summary.Add(cv::Mat_<float>(1, (int)AU_summary_values.size(), AU_summary_values.data()));
+}
+
+void FaceAnalyser::AddToHistory(std::vector<std::pair<std::string, double>>& predictions, std::map<std::string, std::vector<double>>& all_hist,
+	DescriptorStore& store, std::vector<std::string>& store_names, bool success)
+{
+	// Invalidate the AUs if not successful
+	if (!success)
+	{
+		for (size_t au = 0; au < predictions.size(); ++au)
+		{
+			predictions[au].second = 0;
+		}
+	}
+
+	if (!postprocess_offline || predictions.empty())
+	{
+		return;
+	}
+
+	if (spill_offline_history && !store.IsOpen() && store.Open((int)predictions.size(), false))
+	{
+		// The AUs are always predicted in the same order, so only keep their names once
+		store_names.clear();
+		for (size_t au = 0; au < predictions.size(); ++au)
+		{
+			store_names.push_back(predictions[au].first);
+		}
+	}
+
+	if (store.IsOpen())
+	{
+		cv::Mat_<float> row(1, store.Cols(), 0.0f);
+		for (size_t au = 0; au < predictions.size() && (int)au < store.Cols(); ++au)
+		{
+			row.at<float>((int)au) = (float)predictions[au].second;
+		}
+		store.Append(row);
+	}
+	else
+	{
+		for (size_t au = 0; au < predictions.size(); ++au)
 		{
-			std::sort(au_good.begin(), au_good.end());
-			// If it is a dynamic AU regressor we can also do some prediction shifting to make it more accurate
-			// The shifting proportion is learned and is callen cutoff
+			all_hist[predictions[au].first].push_back(predictions[au].second);
+		}
+	}
+}
+
+std::vector<std::pair<std::string, std::vector<double>>> FaceAnalyser::GetHistory(std::map<std::string, std::vector<double>>& all_hist, DescriptorStore& store, const std::vector<std::string>& store_names)
+{
+	std::vector<std::pair<std::string, std::vector<double>>> history;
+	if (store.IsOpen())
+	{
+		// Keep the same (alphabetical) order as the in memory history
+		std::map<std::string, int> order;
+		for (size_t au = 0; au < store_names.size(); ++au)
+		{
+			order[store_names[au]] = (int)au;
+		}
+		for (auto au_iter = order.begin(); au_iter != order.end(); ++au_iter)
+		{
+			history.push_back(std::pair<std::string, std::vector<double>>(au_iter->first, std::vector<double>()));
+			store.GetColumn(au_iter->second, history.back().second);
+		}
+	}
+	else
+	{
+		history.assign(all_hist.begin(), all_hist.end());
+	}
+	return history;
+}
+
+void FaceAnalyser::SetHistory(int frame, const std::vector<std::pair<std::string, double>>& predictions, std::map<std::string, std::vector<double>>& all_hist, DescriptorStore& store, const std::vector<std::string>& store_names)
+{
+	if (store.IsOpen())
+	{
+		cv::Mat_<float> row;
+		store.Get(frame, row);
+		if (row.empty())
+		{
+			return;
+		}
+		for (size_t au = 0; au < predictions.size() && (int)au < row.cols; ++au)
+		{
+			row.at<float>((int)au) = (float)predictions[au].second;
+		}
+		store.Set(frame, row);
+	}
+	else
+	{
+		for (size_t au = 0; au < predictions.size(); ++au)
+		{
+			all_hist[predictions[au].first][frame] = predictions[au].second;
+		}
+	}
+}
+
+// Perform prediction on initial n frames anew as the current neutral face estimate is better now
+void FaceAnalyser::PostprocessPredictions()
+{
+	// Any deferred predictions have to be in the history before the initial frames are predicted anew
+	PredictPendingAUs();
+
+	if(!postprocessed)
+	{
+		int success_ind = 0;
+		int all_ind = 0;
+		int all_frames_size = (int)timestamps.size();
 
-			// Find the current id of the AU and the corresponding cutoff
-			int au_id = -1;
-			for (size_t a = 0; a < dyn_au_names.size(); ++a)
+		// A store that could not be written completely only keeps its first rows, those are used
+		bool spilled = hog_desc_frames_init_store.IsOpen();
+		if (spilled)
+		{
+			hog_desc_frames_init_store.Flush();
+			geom_descriptor_frames_init_store.Flush();
+		}
+		int num_init_frames = spilled ? std::min(hog_desc_frames_init_store.Rows(), geom_descriptor_frames_init_store.Rows()) : (int)hog_desc_frames_init.size();
+
+		// With the fused predictors the frames are predicted in batches, the median used is the final one for all of them
+		const int batch_size = 256;
+		cv::Mat_<float> batch_inputs;
+		vector<int> batch_frames;
+		cv::Mat_<float> run_med;
+		if (!AU_lin_fused.Empty())
+		{
+			AU_lin_fused.BuildInput(run_med, this->hog_desc_median, this->geom_descriptor_median);
+		}
+		
+		while(all_ind < all_frames_size && success_ind < max_init_frames && success_ind < num_init_frames)
+		{
+		
+			if(valid_preds[all_ind])
 			{
-				if (au_name.compare(dyn_au_names[a]) == 0)
+
+				if (spilled)
 				{
-					au_id = (int)a;
+					hog_desc_frames_init_store.Get(success_ind, this->hog_desc_frame);
+					geom_descriptor_frames_init_store.Get(success_ind, this->geom_descriptor_frame);
+				}
+				else
+				{
+					this->hog_desc_frame = hog_desc_frames_init[success_ind];
+					this->geom_descriptor_frame = geom_descriptor_frames_init[success_ind];
 				}
-			}
 
-			if (au_id != -1 && AU_SVR_dynamic_appearance_lin_regressors.GetCutoffs()[au_id] != -1)
-			{
-				double cutoff = AU_SVR_dynamic_appearance_lin_regressors.GetCutoffs()[au_id];
-				offsets.push_back(au_good.at((int)((double)au_good.size() * cutoff)));
+				if (!AU_lin_fused.Empty())
+				{
+					// Gather the frames so that a batch of them is predicted with one matrix multiplication
+					cv::Mat_<float> input;
+					AU_lin_fused.BuildInput(input, this->hog_desc_frame, this->geom_descriptor_frame);
+					batch_inputs.push_back(input);
+					batch_frames.push_back(all_ind);
+				}
+				else
+				{
+					// Perform AU prediction	
+					auto AU_predictions_reg = PredictCurrentAUs(views[success_ind]);								
+
+					// Modify the predictions to the historic data
+					SetHistory(all_ind, AU_predictions_reg, AU_predictions_reg_all_hist, AU_predictions_reg_store, AU_predictions_reg_store_names);
+
+					auto AU_predictions_class = PredictCurrentAUsClass(views[success_ind]);
+
+					SetHistory(all_ind, AU_predictions_class, AU_predictions_class_all_hist, AU_predictions_class_store, AU_predictions_class_store_names);
+				}
+		
+				success_ind++;
 			}
-			else
+			all_ind++;
+
+			bool last = !(all_ind < all_frames_size && success_ind < max_init_frames && success_ind < num_init_frames);
+			if (!batch_frames.empty() && (batch_inputs.rows >= batch_size || last))
 			{
-				offsets.push_back(0);
+				cv::Mat_<float> preds;
+				AU_lin_fused.Predict(preds, batch_inputs, run_med);
+
+				vector<pair<string, double>> AU_predictions_reg, AU_predictions_class;
+				for (size_t i = 0; i < batch_frames.size(); ++i)
+				{
+					AU_lin_fused.GetAUs(AU_predictions_reg, AU_predictions_class, preds, (int)i);
+					SetHistory(batch_frames[i], AU_predictions_reg, AU_predictions_reg_all_hist, AU_predictions_reg_store, AU_predictions_reg_store_names);
+					SetHistory(batch_frames[i], AU_predictions_class, AU_predictions_class_all_hist, AU_predictions_class_store, AU_predictions_class_store_names);
+				}
+				batch_inputs = cv::Mat_<float>();
+				batch_frames.clear();
 			}
 		}
-		
-		aus_valid.push_back(au_good);
+		postprocessed = true;
 	}
-	
-	// sort each of the aus and adjust the dynamic ones
-	for(size_t au = 0; au < au_predictions.size(); ++au)
+}
+
+void FaceAnalyser::ExtractAllPredictionsOfflineReg(vector<std::pair<std::string, vector<double>>>& au_predictions, vector<double>& confidences, vector<bool>& successes, vector<double>& timestamps, bool dynamic)
+{
+	PredictPendingAUs();
+
+	if(dynamic)
+	{
+		PostprocessPredictions();
+	}
+
+	timestamps = this->timestamps;
+	successes = this->valid_preds;
+
+	au_predictions = GetHistory(AU_predictions_reg_all_hist, AU_predictions_reg_store, AU_predictions_reg_store_names);
+	for(auto au_iter = au_predictions.begin(); au_iter != au_predictions.end(); ++au_iter)
 	{
+		CorrectOfflineReg(au_iter->first, au_iter->second, successes, dynamic);
+	}
+}
 
-		for(size_t frame = 0; frame < au_predictions[au].second.size(); ++frame)
+void FaceAnalyser::CorrectOfflineReg(const std::string& au_name, std::vector<double>& au_vals, const std::vector<bool>& successes, bool dynamic)
+{
+	// First extract the valid AU values
+	vector<double> au_good;
+	for(size_t frame = 0; frame < au_vals.size(); ++frame)
+	{
+		if(successes[frame])
 		{
+			au_good.push_back(au_vals[frame]);
+		}
+	}
 
-			if(successes[frame])
+	// Allow these AUs to be person calirated based on expected number of neutral frames (learned from the data)
+	double offset = 0.0;
+	if(!au_good.empty() && dynamic)
+	{
+		// If it is a dynamic AU regressor we can also do some prediction shifting to make it more accurate
+		// The shifting proportion is learned and is callen cutoff
+
+		// Find the current id of the AU and the corresponding cutoff
+		vector<string> dyn_au_names = AU_SVR_dynamic_appearance_lin_regressors.GetAUNames();
+		int au_id = -1;
+		for (size_t a = 0; a < dyn_au_names.size(); ++a)
+		{
+			if (au_name.compare(dyn_au_names[a]) == 0)
 			{
-				double scaling = 1;
+				au_id = (int)a;
+			}
+		}
+
+		if (au_id != -1 && AU_SVR_dynamic_appearance_lin_regressors.GetCutoffs()[au_id] != -1)
+		{
+			double cutoff = AU_SVR_dynamic_appearance_lin_regressors.GetCutoffs()[au_id];
+
+			// Only the value at the cutoff is needed, so a partial sort is enough
+			size_t cutoff_ind = (size_t)((double)au_good.size() * cutoff);
+			std::nth_element(au_good.begin(), au_good.begin() + cutoff_ind, au_good.end());
+			offset = au_good.at(cutoff_ind);
+		}
+	}
+
+	// Adjust the dynamic ones
+	for(size_t frame = 0; frame < au_vals.size(); ++frame)
+	{
+
+		if(successes[frame])
+		{
+			double scaling = 1;
 				
-				au_predictions[au].second[frame] = (au_predictions[au].second[frame] - offsets[au]) * scaling;
+			au_vals[frame] = (au_vals[frame] - offset) * scaling;
 				
-				if(au_predictions[au].second[frame] < 0.0)
-					au_predictions[au].second[frame] = 0;
+			if(au_vals[frame] < 0.0)
+				au_vals[frame] = 0;
 
-				if(au_predictions[au].second[frame] > 5)
-					au_predictions[au].second[frame] = 5;
+			if(au_vals[frame] > 5)
+				au_vals[frame] = 5;
 				
-			}
-			else
+		}
+		else
+		{
+			au_vals[frame] = 0;
+		}
+	}
+
+	// Perform some prediction smoothing, a moving average of 3 frames
+	int window_size = 3;
+	if((int)au_vals.size() > window_size - 1)
+	{
+		vector<double> au_vals_tmp = au_vals;
+		for (size_t i = (window_size - 1) / 2; i < au_vals.size() - (window_size - 1) / 2; ++i)
+		{
+			double sum = 0;
+			for (int w = -(window_size - 1) / 2; w <= (window_size - 1) / 2; ++w)
 			{
-				au_predictions[au].second[frame] = 0;
+				sum += au_vals_tmp[i + w];
 			}
+			sum = sum / window_size;
+
+			au_vals[i] = sum;
 		}
 	}
+}
+
+void FaceAnalyser::ExtractAllPredictionsOfflineClass(vector<std::pair<std::string, vector<double>>>& au_predictions, vector<double>& confidences, vector<bool>& successes, vector<double>& timestamps, bool dynamic)
+{
+	PredictPendingAUs();
 
-	// Perform some prediction smoothing
-	for (auto au_iter = au_predictions.begin(); au_iter != au_predictions.end(); ++au_iter)
+	if (dynamic)
 	{
-		string au_name = au_iter->first;
+		PostprocessPredictions();
+	}
+
+	timestamps = this->timestamps;
+
+	au_predictions = GetHistory(AU_predictions_class_all_hist, AU_predictions_class_store, AU_predictions_class_store_names);
+	for(auto au_iter = au_predictions.begin(); au_iter != au_predictions.end(); ++au_iter)
+	{
+		CorrectOfflineClass(au_iter->second);
+	}
+
+	successes = this->valid_preds;
+}
 
-		// Perform a moving average of 3 frames
-		int window_size = 3;
-		vector<double> au_vals_tmp = au_iter->second;
-		for (size_t i = (window_size - 1) / 2; i < au_iter->second.size() - (window_size - 1) / 2; ++i)
+void FaceAnalyser::CorrectOfflineClass(std::vector<double>& au_vals)
+{
+	// Perform a moving average of 7 frames on classifications
+	int window_size = 7;
+	vector<double> au_vals_tmp = au_vals;
+	if((int)au_vals.size() > (window_size - 1) / 2)
+	{
+		for (size_t i = (window_size - 1)/2; i < au_vals.size() - (window_size - 1) / 2; ++i)
 		{
 			double sum = 0;
-			for (int w = -(window_size - 1) / 2; w <= (window_size - 1) / 2; ++w)
+			int div_by = 0;
+			for (int w = -(window_size - 1) / 2; w <= (window_size - 1) / 2 && (i+w < au_vals_tmp.size()); ++w)
 			{
 				sum += au_vals_tmp[i + w];
+				div_by++;
 			}
-			sum = sum / window_size;
+			sum = sum / div_by;
+			if (sum < 0.5)
+				sum = 0;
+			else
+				sum = 1;
+
+			au_vals[i] = sum;
+		}
+	}
+}
+
+void FaceAnalyser::WarmUp()
+{
+	TRACE_SCOPE("FaceAnalyser::WarmUp");
+
+	// The HOG descriptor size follows from the size of the aligned face
+	cv::Mat aligned_face(align_height_au, align_width_au, CV_8UC3, cv::Scalar(0, 0, 0));
+	cv::Mat_<float> hog_descriptor;
+	int num_rows, num_cols;
+	Extract_FHOG_descriptor(hog_descriptor, aligned_face, num_rows, num_cols);
+
+	for (size_t view = 0; view < hog_desc_hist.size(); ++view)
+	{
+		if (hog_desc_hist[view].empty())
+		{
+			hog_desc_hist[view] = cv::Mat_<ushort>(hog_descriptor.cols, num_bins_hog, (ushort)0);
+			hog_desc_median_bins[view] = cv::Mat_<int>(hog_descriptor.cols, 2, (int)0);
+		}
+	}
+
+	// The geometry descriptor is the 3D shape (without the mean) followed by the shape parameters
+	int geom_size = pdm.princ_comp.rows + pdm.princ_comp.cols;
+	if (geom_desc_hist.empty())
+	{
+		geom_desc_hist = cv::Mat_<ushort>(geom_size, num_bins_geom, (ushort)0);
+		geom_desc_median_bins = cv::Mat_<int>(geom_size, 2, (int)0);
+	}
+}
+
+void FaceAnalyser::ReportMemory(Utilities::MemoryReport& report, const std::string& component) const
+{
+	pdm.ReportMemory(report, component + "/models/pdm");
+	report.Add(component + "/models/au", AU_SVR_static_appearance_lin_regressors.GetMeans());
+	report.Add(component + "/models/au", AU_SVR_static_appearance_lin_regressors.GetSupportVectors());
+	report.Add(component + "/models/au", AU_SVR_static_appearance_lin_regressors.GetBiases());
+	report.Add(component + "/models/au", AU_SVR_dynamic_appearance_lin_regressors.GetMeans());
+	report.Add(component + "/models/au", AU_SVR_dynamic_appearance_lin_regressors.GetSupportVectors());
+	report.Add(component + "/models/au", AU_SVR_dynamic_appearance_lin_regressors.GetBiases());
+	report.Add(component + "/models/au", AU_SVM_static_appearance_lin.GetMeans());
+	report.Add(component + "/models/au", AU_SVM_static_appearance_lin.GetSupportVectors());
+	report.Add(component + "/models/au", AU_SVM_static_appearance_lin.GetBiases());
+	report.Add(component + "/models/au", AU_SVM_dynamic_appearance_lin.GetMeans());
+	report.Add(component + "/models/au", AU_SVM_dynamic_appearance_lin.GetSupportVectors());
+	report.Add(component + "/models/au", AU_SVM_dynamic_appearance_lin.GetBiases());
+	report.Add(component + "/models/au_fused", AU_lin_fused.GetWeights());
+	report.Add(component + "/models/au_fused", AU_lin_fused.GetBiases());
+	report.Add(component + "/models/triangulation", triangulation);
+	report.Add(component + "/models/hog_projection", hog_projection_mean);
+	report.Add(component + "/models/hog_projection", hog_projection);
+
+	report.Add(component + "/histograms", hog_desc_hist);
+	report.Add(component + "/histograms", hog_desc_median_bins);
+	report.Add(component + "/histograms", face_image_hist);
+	report.Add(component + "/histograms", geom_desc_hist);
+	report.Add(component + "/histograms", geom_desc_median_bins);
+	report.Add(component + "/histograms", au_prediction_correction_histogram);
+
+	report.AddVector(component + "/history", timestamps);
+	report.AddBytes(component + "/history", valid_preds.capacity() / 8);
+	for (map<string, vector<double> >::const_iterator it = AU_predictions_reg_all_hist.begin(); it != AU_predictions_reg_all_hist.end(); ++it)
+	{
+		report.AddVector(component + "/history", it->second);
+	}
+	for (map<string, vector<double> >::const_iterator it = AU_predictions_class_all_hist.begin(); it != AU_predictions_class_all_hist.end(); ++it)
+	{
+		report.AddVector(component + "/history", it->second);
+	}
+	report.Add(component + "/history", hog_desc_frames_init);
+	report.Add(component + "/history", geom_descriptor_frames_init);
+	report.AddVector(component + "/history", views);
+	report.Add(component + "/history", AU_reg_summary.mean);
+	report.Add(component + "/history", AU_reg_summary.sum_sq_diff);
+	report.Add(component + "/history", AU_reg_summary.min);
+	report.Add(component + "/history", AU_reg_summary.max);
+	report.Add(component + "/history", geom_desc_summary.mean);
+	report.Add(component + "/history", geom_desc_summary.sum_sq_diff);
+	report.Add(component + "/history", geom_desc_summary.min);
+	report.Add(component + "/history", geom_desc_summary.max);
+	report.AddBytes(component + "/history", AU_predictions_reg_store.Bytes(), Utilities::MemoryReport::MAPPED);
+	report.AddBytes(component + "/history", AU_predictions_class_store.Bytes(), Utilities::MemoryReport::MAPPED);
+	report.AddBytes(component + "/history", hog_desc_frames_init_store.Bytes(), Utilities::MemoryReport::MAPPED);
+	report.AddBytes(component + "/history", geom_descriptor_frames_init_store.Bytes(), Utilities::MemoryReport::MAPPED);
+
+	report.Add(component + "/buffers", aligned_face_for_au);
+	report.Add(component + "/buffers", aligned_face_for_output);
+	report.Add(component + "/buffers", hog_desc_frame);
+	report.Add(component + "/buffers", hog_desc_output);
+	report.Add(component + "/buffers", hog_desc_median);
+	report.Add(component + "/buffers", face_image_median);
+	report.Add(component + "/buffers", geom_descriptor_frame);
+	report.Add(component + "/buffers", geom_descriptor_median);
+	report.Add(component + "/buffers", pending_au_inputs);
+	report.Add(component + "/buffers", pending_au_median_responses);
+	report.Add(component + "/buffers", current_median_response);
+	report.Add(component + "/buffers", median_response_input);
+}
+
+// Reset the models
+void FaceAnalyser::Reset()
+{
+	frames_tracking = 0;
+
+	this->hog_desc_median.setTo(cv::Scalar(0));
+	this->face_image_median.setTo(cv::Scalar(0));
+
+	for( size_t i = 0; i < hog_desc_hist.size(); ++i)
+	{
+		this->hog_desc_hist[i] = cv::Mat_<ushort>(hog_desc_hist[i].rows, hog_desc_hist[i].cols, (ushort)0);
+		this->hog_desc_median_bins[i] = cv::Mat_<int>(hog_desc_median_bins[i].rows, hog_desc_median_bins[i].cols, (int)0);
+		this->hog_hist_sum[i] = 0;
+
+
+		this->face_image_hist[i] = cv::Mat_<int>(face_image_hist[i].rows, face_image_hist[i].cols, (int)0);
+		this->face_image_hist_sum[i] = 0;
+
+		// 0 callibration predictions
+		this->au_prediction_correction_count[i] = 0;
+		this->au_prediction_correction_histogram[i] = cv::Mat_<int>(au_prediction_correction_histogram[i].rows, au_prediction_correction_histogram[i].cols, (int)0);
+	}
+
+	this->geom_descriptor_median.setTo(cv::Scalar(0));
+	this->geom_desc_hist = cv::Mat_<ushort>(geom_desc_hist.rows, geom_desc_hist.cols, (ushort)0);
+	this->geom_desc_median_bins = cv::Mat_<int>(geom_desc_median_bins.rows, geom_desc_median_bins.cols, (int)0);
+	geom_hist_sum = 0;
+
+	// Reset the predictions
+	AU_reg_summary.Reset();
+	geom_desc_summary.Reset();
+
+	dyn_scaling = vector<vector<double>>(dyn_scaling.size(), vector<double>(dyn_scaling[0].size(), 5.0));	
+
+	AU_predictions_reg.clear();
+	AU_predictions_class.clear();
+	AU_predictions_combined.clear();
+	UpdateCurrentAUValues();
+	timestamps.clear();
+	AU_predictions_reg_all_hist.clear();
+	AU_predictions_class_all_hist.clear();
+	AU_predictions_reg_store.Close();
+	AU_predictions_class_store.Close();
+	AU_predictions_reg_store_names.clear();
+	AU_predictions_class_store_names.clear();
+	valid_preds.clear();
+
+	// Clean up the postprocessing data as well
+	hog_desc_frames_init.clear();
+	geom_descriptor_frames_init.clear();
+	hog_desc_frames_init_store.Close();
+	geom_descriptor_frames_init_store.Close();
+	views.clear();
+	postprocessed = false;
+	frames_tracking_succ = 0;
+	baseline_loaded = false;
+
+	pending_au_inputs = cv::Mat_<float>();
+	pending_au_median_responses = cv::Mat_<float>();
+	pending_au_frames.clear();
+	current_median_response = cv::Mat_<float>();
+	median_response_input = cv::Mat_<float>();
+	median_response_updates = 0;
+	median_changed = true;
+}
+
+// The version of the state written by WriteState, increased whenever what is written changes
+static const int32_t ANALYSER_STATE_VERSION = 3;
+
+bool FaceAnalyser::WriteState(std::ostream& stream)
+{
+	// Only the history kept in memory is part of the state
+	if (AU_predictions_reg_store.IsOpen() || AU_predictions_class_store.IsOpen() || hog_desc_frames_init_store.IsOpen())
+	{
+		std::cout << "The state of a face analyser spilling its history to files can not be written" << std::endl;
+		return false;
+	}
+
+	// So that the history is complete
+	PredictPendingAUs();
+
+	WriteStateValue<int32_t>(stream, ANALYSER_STATE_VERSION);
+	WriteStateValue<int32_t>(stream, frames_tracking);
+	WriteStateValue<int32_t>(stream, frames_tracking_succ);
+	WriteStateValue(stream, current_time_seconds);
+	WriteStateValue<int32_t>(stream, view_used);
+
+	// The running medians
+	WriteStateMats(stream, hog_desc_hist);
+	WriteStateVector(stream, hog_hist_sum);
+	WriteStateMats(stream, hog_desc_median_bins);
+	WriteStateMat(stream, hog_desc_median);
+	WriteStateMat(stream, geom_desc_hist);
+	WriteStateValue<int32_t>(stream, geom_hist_sum);
+	WriteStateMat(stream, geom_desc_median_bins);
+	WriteStateMat(stream, geom_descriptor_median);
+
+	// The online correction of the predictions
+	WriteStateMats(stream, au_prediction_correction_histogram);
+	WriteStateVector(stream, au_prediction_correction_count);
+	WriteStateValue<int32_t>(stream, (int32_t)dyn_scaling.size());
+	for (size_t i = 0; i < dyn_scaling.size(); ++i)
+	{
+		WriteStateVector(stream, dyn_scaling[i]);
+	}
+	WriteStateSummary(stream, AU_reg_summary);
+	WriteStateSummary(stream, geom_desc_summary);
+
+	// The last frame and the history used by the offline postprocessing
+	WriteStatePredictions(stream, AU_predictions_reg);
+	WriteStatePredictions(stream, AU_predictions_class);
+	WriteStateMat(stream, hog_desc_frame);
+	WriteStateMat(stream, geom_descriptor_frame);
+	WriteStateValue<int32_t>(stream, num_hog_rows);
+	WriteStateValue<int32_t>(stream, num_hog_cols);
+	WriteStateVector(stream, timestamps);
+	WriteStateVector(stream, std::vector<char>(valid_preds.begin(), valid_preds.end()));
+	WriteStateHistory(stream, AU_predictions_reg_all_hist);
+	WriteStateHistory(stream, AU_predictions_class_all_hist);
+	WriteStateMats(stream, hog_desc_frames_init);
+	WriteStateMats(stream, geom_descriptor_frames_init);
+	WriteStateVector(stream, views);
+
+	return (bool)stream;
+}
+
+bool FaceAnalyser::ReadState(std::istream& stream)
+{
+	int32_t version;
+	if (!ReadStateValue(stream, version) || version != ANALYSER_STATE_VERSION)
+	{
+		std::cout << "The face analyser state was written by a different version" << std::endl;
+		return false;
+	}
+
+	Reset();
+
+	int32_t tracking, tracking_succ, view, sum, hog_rows, hog_cols, num_views;
+	std::vector<char> valid;
+	bool read = ReadStateValue(stream, tracking) && ReadStateValue(stream, tracking_succ) && ReadStateValue(stream, current_time_seconds) &&
+		ReadStateValue(stream, view) &&
+		ReadStateMats(stream, hog_desc_hist) && ReadStateVector(stream, hog_hist_sum) && ReadStateMats(stream, hog_desc_median_bins) &&
+		ReadStateMat(stream, hog_desc_median) && ReadStateMat(stream, geom_desc_hist) && ReadStateValue(stream, sum) &&
+		ReadStateMat(stream, geom_desc_median_bins) && ReadStateMat(stream, geom_descriptor_median) &&
+		ReadStateMats(stream, au_prediction_correction_histogram) && ReadStateVector(stream, au_prediction_correction_count) &&
+		ReadStateValue(stream, num_views) && num_views == (int32_t)dyn_scaling.size();
+
+	for (size_t i = 0; read && i < dyn_scaling.size(); ++i)
+	{
+		read = ReadStateVector(stream, dyn_scaling[i]);
+	}
+
+	read = read && ReadStateSummary(stream, AU_reg_summary) && ReadStateSummary(stream, geom_desc_summary) &&
+		ReadStatePredictions(stream, AU_predictions_reg) && ReadStatePredictions(stream, AU_predictions_class) &&
+		ReadStateMat(stream, hog_desc_frame) && ReadStateMat(stream, geom_descriptor_frame) && ReadStateValue(stream, hog_rows) && ReadStateValue(stream, hog_cols) &&
+		ReadStateVector(stream, timestamps) && ReadStateVector(stream, valid) &&
+		ReadStateHistory(stream, AU_predictions_reg_all_hist) && ReadStateHistory(stream, AU_predictions_class_all_hist) &&
+		ReadStateMats(stream, hog_desc_frames_init) && ReadStateMats(stream, geom_descriptor_frames_init) && ReadStateVector(stream, views);
+
+	// The histograms have to match the views of the AU models
+	read = read && hog_desc_hist.size() == hog_hist_sum.size() && hog_desc_hist.size() == hog_desc_median_bins.size() &&
+		au_prediction_correction_histogram.size() == au_prediction_correction_count.size() && valid.size() == timestamps.size();
+
+	if (!read)
+	{
+		std::cout << "Could not read the face analyser state" << std::endl;
+		Reset();
+		return false;
+	}
+
+	frames_tracking = tracking;
+	frames_tracking_succ = tracking_succ;
+	view_used = view;
+	geom_hist_sum = sum;
+	num_hog_rows = hog_rows;
+	num_hog_cols = hog_cols;
+	valid_preds.assign(valid.begin(), valid.end());
+	median_changed = true;
+	UpdateCurrentAUValues();
+
+	return true;
+}
+
+// Halving the counts of a histogram (and its sample count) to make room for more samples
+static void HalveHistogram(cv::Mat_<ushort>& histogram, int& hist_count)
+{
+	for (int i = 0; i < histogram.rows; ++i)
+	{
+		ushort* row = histogram.ptr<ushort>(i);
+		for (int j = 0; j < histogram.cols; ++j)
+		{
+			row[j] /= 2;
+		}
+	}
+	hist_count /= 2;
+}
+
+// Adding the samples of one histogram to another, halving both if the counts would not fit
+static void AddHistogram(cv::Mat_<ushort>& histogram, int& hist_count, const cv::Mat_<ushort>& other, int other_count)
+{
+	double max_sum;
+	cv::Mat_<int> sum;
+	cv::add(histogram, other, sum, cv::noArray(), CV_32S);
+	cv::minMaxLoc(sum, NULL, &max_sum);
+
+	int shift = 0;
+	while ((max_sum / (1 << shift)) > std::numeric_limits<ushort>::max())
+	{
+		shift++;
+	}
+	sum.convertTo(histogram, CV_16U, 1.0 / (1 << shift));
+	hist_count = (hist_count + other_count) >> shift;
+}
+
+bool NormalisationStatistics::Merge(const NormalisationStatistics& other)
+{
+	if (hog_desc_hist.size() != other.hog_desc_hist.size() || au_prediction_correction_histogram.size() != other.au_prediction_correction_histogram.size())
+	{
+		return false;
+	}
+
+	// Empty histograms have not seen any samples yet
+	for (size_t v = 0; v < hog_desc_hist.size(); ++v)
+	{
+		if (!other.hog_desc_hist[v].empty() && !hog_desc_hist[v].empty() && other.hog_desc_hist[v].size() != hog_desc_hist[v].size())
+		{
+			return false;
+		}
+	}
+	if (!other.geom_desc_hist.empty() && !geom_desc_hist.empty() && other.geom_desc_hist.size() != geom_desc_hist.size())
+	{
+		return false;
+	}
+
+	for (size_t v = 0; v < hog_desc_hist.size(); ++v)
+	{
+		if (!hog_desc_hist[v].empty() && !other.hog_desc_hist[v].empty())
+		{
+			AddHistogram(hog_desc_hist[v], hog_hist_sum[v], other.hog_desc_hist[v], other.hog_hist_sum[v]);
+		}
+		else
+		{
+			if (hog_desc_hist[v].empty())
+			{
+				hog_desc_hist[v] = other.hog_desc_hist[v].clone();
+			}
+			hog_hist_sum[v] += other.hog_hist_sum[v];
+		}
+	}
+
+	if (!geom_desc_hist.empty() && !other.geom_desc_hist.empty())
+	{
+		AddHistogram(geom_desc_hist, geom_hist_sum, other.geom_desc_hist, other.geom_hist_sum);
+	}
+	else
+	{
+		if (geom_desc_hist.empty())
+		{
+			geom_desc_hist = other.geom_desc_hist.clone();
+		}
+		geom_hist_sum += other.geom_hist_sum;
+	}
+
+	for (size_t v = 0; v < au_prediction_correction_histogram.size(); ++v)
+	{
+		if (au_prediction_correction_histogram[v].empty())
+		{
+			au_prediction_correction_histogram[v] = other.au_prediction_correction_histogram[v].clone();
+		}
+		else if (!other.au_prediction_correction_histogram[v].empty() && other.au_prediction_correction_histogram[v].size() == au_prediction_correction_histogram[v].size())
+		{
+			au_prediction_correction_histogram[v] += other.au_prediction_correction_histogram[v];
+		}
+		au_prediction_correction_count[v] += other.au_prediction_correction_count[v];
+	}
+
+	view = other.view;
+	return true;
+}
+
+// The version of the statistics written by NormalisationStatistics::Write
+static const int32_t NORMALISATION_STATISTICS_VERSION = 2;
+
+void NormalisationStatistics::Write(std::ostream& stream) const
+{
+	WriteStateValue<int32_t>(stream, NORMALISATION_STATISTICS_VERSION);
+	WriteStateMats(stream, hog_desc_hist);
+	WriteStateVector(stream, hog_hist_sum);
+	WriteStateMat(stream, geom_desc_hist);
+	WriteStateValue<int32_t>(stream, geom_hist_sum);
+	WriteStateMats(stream, au_prediction_correction_histogram);
+	WriteStateVector(stream, au_prediction_correction_count);
+	WriteStateValue<int32_t>(stream, view);
+}
+
+bool NormalisationStatistics::Read(std::istream& stream)
+{
+	int32_t version, sum, view_read;
+	bool read = ReadStateValue(stream, version) && version == NORMALISATION_STATISTICS_VERSION &&
+		ReadStateMats(stream, hog_desc_hist) && ReadStateVector(stream, hog_hist_sum) && ReadStateMat(stream, geom_desc_hist) && ReadStateValue(stream, sum) &&
+		ReadStateMats(stream, au_prediction_correction_histogram) && ReadStateVector(stream, au_prediction_correction_count) && ReadStateValue(stream, view_read) &&
+		hog_desc_hist.size() == hog_hist_sum.size() && au_prediction_correction_histogram.size() == au_prediction_correction_count.size();
+
+	if (read)
+	{
+		geom_hist_sum = sum;
+		view = view_read;
+	}
+	return read;
+}
+
+NormalisationStatistics FaceAnalyser::GetNormalisationStatistics() const
+{
+	NormalisationStatistics statistics;
+	for (size_t v = 0; v < hog_desc_hist.size(); ++v)
+	{
+		statistics.hog_desc_hist.push_back(hog_desc_hist[v].clone());
+	}
+	statistics.hog_hist_sum = hog_hist_sum;
+	statistics.geom_desc_hist = geom_desc_hist.clone();
+	statistics.geom_hist_sum = geom_hist_sum;
+	for (size_t v = 0; v < au_prediction_correction_histogram.size(); ++v)
+	{
+		statistics.au_prediction_correction_histogram.push_back(au_prediction_correction_histogram[v].clone());
+	}
+	statistics.au_prediction_correction_count = au_prediction_correction_count;
+	statistics.view = view_used;
+	return statistics;
+}
+
+bool FaceAnalyser::SetNormalisationStatistics(const NormalisationStatistics& statistics)
+{
+	if (statistics.hog_desc_hist.size() != hog_desc_hist.size() || statistics.hog_hist_sum.size() != hog_hist_sum.size() ||
+		statistics.au_prediction_correction_histogram.size() != au_prediction_correction_histogram.size() ||
+		statistics.au_prediction_correction_count.size() != au_prediction_correction_count.size())
+	{
+		std::cout << "The normalisation statistics were computed with different AU models" << std::endl;
+		return false;
+	}
+
+	for (size_t v = 0; v < hog_desc_hist.size(); ++v)
+	{
+		hog_desc_hist[v] = statistics.hog_desc_hist[v].clone();
+
+		// The median bins are searched for from the start on the next update
+		hog_desc_median_bins[v] = cv::Mat_<int>(hog_desc_hist[v].rows, 2, (int)0);
+		au_prediction_correction_histogram[v] = statistics.au_prediction_correction_histogram[v].clone();
+	}
+	hog_hist_sum = statistics.hog_hist_sum;
+	au_prediction_correction_count = statistics.au_prediction_correction_count;
+	geom_desc_hist = statistics.geom_desc_hist.clone();
+	geom_desc_median_bins = cv::Mat_<int>(geom_desc_hist.rows, 2, (int)0);
+	geom_hist_sum = statistics.geom_hist_sum;
+	view_used = statistics.view;
+
+	// The medians of the view of the most recent frame, as they would be after it
+	if (view_used >= 0 && view_used < (int)hog_desc_hist.size() && !hog_desc_hist[view_used].empty())
+	{
+		cv::Mat_<float> descriptor = hog_desc_median.cols == hog_desc_hist[view_used].rows ? hog_desc_median.clone() : cv::Mat_<float>(1, hog_desc_hist[view_used].rows, 0.0f);
+		UpdateRunningMedian(hog_desc_hist[view_used], hog_hist_sum[view_used], hog_desc_median_bins[view_used], hog_desc_median, descriptor, false, num_bins_hog, min_val_hog, max_val_hog);
+		if (hog_projection.empty())
+			hog_desc_median.setTo(0, hog_desc_median < 0);
+	}
+	if (!geom_desc_hist.empty())
+	{
+		cv::Mat_<float> descriptor = geom_descriptor_median.cols == geom_desc_hist.rows ? geom_descriptor_median.clone() : cv::Mat_<float>(1, geom_desc_hist.rows, 0.0f);
+		UpdateRunningMedian(geom_desc_hist, geom_hist_sum, geom_desc_median_bins, geom_descriptor_median, descriptor, false, num_bins_geom, min_val_geom, max_val_geom);
+	}
+	median_changed = true;
+
+	return true;
+}
+
+// The file of the baseline of a subject, the subject id can not point outside of the directory
+static std::string GetBaselineFile(const std::string& directory, const std::string& subject_id)
+{
+	if (subject_id.empty() || subject_id.find_first_of("/\\:") != std::string::npos || subject_id.compare("..") == 0 || subject_id.compare(".") == 0)
+	{
+		std::cout << "Invalid subject id for a baseline: " << subject_id << std::endl;
+		return "";
+	}
+	return (boost::filesystem::path(directory) / (subject_id + ".baseline")).string();
+}
+
+bool FaceAnalyser::SaveBaseline(const std::string& directory, const std::string& subject_id) const
+{
+	std::string filename = GetBaselineFile(directory, subject_id);
+	if (filename.empty())
+	{
+		return false;
+	}
 
-			au_iter->second[i] = sum;
+	// Written to a temporary file first, so that a failure does not lose the previous baseline
+	std::string temporary_filename = filename + ".tmp";
+	{
+		std::ofstream out(temporary_filename, std::ios_base::out | std::ios_base::binary);
+		GetNormalisationStatistics().Write(out);
+		out.close();
+		if (!out)
+		{
+			std::cout << "Could not write the baseline " << temporary_filename << std::endl;
+			return false;
 		}
-
 	}
 
+	std::remove(filename.c_str());
+	return std::rename(temporary_filename.c_str(), filename.c_str()) == 0;
 }
 
-void FaceAnalyser::ExtractAllPredictionsOfflineClass(vector<std::pair<std::string, vector<double>>>& au_predictions, vector<double>& confidences, vector<bool>& successes, vector<double>& timestamps, bool dynamic)
+bool FaceAnalyser::LoadBaseline(const std::string& directory, const std::string& subject_id)
 {
-	if (dynamic)
+	std::string filename = GetBaselineFile(directory, subject_id);
+	if (filename.empty())
 	{
-		PostprocessPredictions();
+		return false;
 	}
 
-	timestamps = this->timestamps;
-	au_predictions.clear();
-
-	for(auto au_iter = AU_predictions_class_all_hist.begin(); au_iter != AU_predictions_class_all_hist.end(); ++au_iter)
+	std::ifstream in(filename, std::ios_base::in | std::ios_base::binary);
+	if (!in.is_open())
 	{
-		string au_name = au_iter->first;
-		vector<double> au_vals = au_iter->second;
-		
-		// Perform a moving average of 7 frames on classifications
-		int window_size = 7;
-		vector<double> au_vals_tmp = au_vals;
-		if((int)au_vals.size() > (window_size - 1) / 2)
-		{
-			for (size_t i = (window_size - 1)/2; i < au_vals.size() - (window_size - 1) / 2; ++i)
-			{
-				double sum = 0;
-				int div_by = 0;
-				for (int w = -(window_size - 1) / 2; w <= (window_size - 1) / 2 && (i+w < au_vals_tmp.size()); ++w)
-				{
-					sum += au_vals_tmp[i + w];
-					div_by++;
-				}
-				sum = sum / div_by;
-				if (sum < 0.5)
-					sum = 0;
-				else
-					sum = 1;
-
-				au_vals[i] = sum;
-			}
-		}
-		au_predictions.push_back(std::pair<string,vector<double>>(au_name, au_vals));
+		return false;
+	}
 
+	NormalisationStatistics statistics;
+	if (!statistics.Read(in) || !SetNormalisationStatistics(statistics))
+	{
+		std::cout << "Could not read the baseline " << filename << std::endl;
+		return false;
 	}
 
-	successes = this->valid_preds;
+	baseline_loaded = true;
+	return true;
 }
 
-// Reset the models
-void FaceAnalyser::Reset()
+bool FaceAnalyser::AppendSegments(const std::vector<FaceAnalyser*>& segments, const std::vector<int>& skip_frames)
 {
-	frames_tracking = 0;
+	for (size_t s = 0; s <= segments.size(); ++s)
+	{
+		const FaceAnalyser& analyser = s == 0 ? *this : *segments[s - 1];
+		if (analyser.AU_predictions_reg_store.IsOpen() || analyser.AU_predictions_class_store.IsOpen() || analyser.hog_desc_frames_init_store.IsOpen())
+		{
+			std::cout << "The segments of a face analyser spilling its history to files can not be combined" << std::endl;
+			return false;
+		}
+	}
 
-	this->hog_desc_median.setTo(cv::Scalar(0));
-	this->face_image_median.setTo(cv::Scalar(0));
+	PredictPendingAUs();
 
-	for( size_t i = 0; i < hog_desc_hist.size(); ++i)
+	// The normalisation statistics are summed up (the frames overlapping between the segments are counted twice)
+	NormalisationStatistics statistics = GetNormalisationStatistics();
+	for (size_t s = 0; s < segments.size(); ++s)
 	{
-		this->hog_desc_hist[i] = cv::Mat_<int>(hog_desc_hist[i].rows, hog_desc_hist[i].cols, (int)0);
-		this->hog_hist_sum[i] = 0;
+		FaceAnalyser& segment = *segments[s];
+		segment.PredictPendingAUs();
 
+		if (!statistics.Merge(segment.GetNormalisationStatistics()))
+		{
+			std::cout << "The segments were analysed with different models and can not be combined" << std::endl;
+			return false;
+		}
 
-		this->face_image_hist[i] = cv::Mat_<int>(face_image_hist[i].rows, face_image_hist[i].cols, (int)0);
-		this->face_image_hist_sum[i] = 0;
+		frames_tracking += segment.frames_tracking;
+		frames_tracking_succ += segment.frames_tracking_succ;
 
-		// 0 callibration predictions
-		this->au_prediction_correction_count[i] = 0;
-		this->au_prediction_correction_histogram[i] = cv::Mat_<int>(au_prediction_correction_histogram[i].rows, au_prediction_correction_histogram[i].cols, (int)0);
+		// The summary statistics are merged the same way
+		AU_reg_summary.Merge(segment.AU_reg_summary);
+		geom_desc_summary.Merge(segment.geom_desc_summary);
 	}
+	SetNormalisationStatistics(statistics);
 
-	this->geom_descriptor_median.setTo(cv::Scalar(0));
-	this->geom_desc_hist = cv::Mat_<int>(geom_desc_hist.rows, geom_desc_hist.cols, (int)0);
-	geom_hist_sum = 0;
-
-	// Reset the predictions
-	AU_prediction_track = cv::Mat_<double>(AU_prediction_track.rows, AU_prediction_track.cols, 0.0);
+	for (size_t s = 0; s < segments.size(); ++s)
+	{
+		FaceAnalyser& segment = *segments[s];
 
-	geom_desc_track = cv::Mat_<double>(geom_desc_track.rows, geom_desc_track.cols, 0.0);
+		// The initial frames of a segment were predicted before its own medians settled
+		if (dynamic && !hog_desc_median.empty())
+		{
+			segment.hog_desc_median = hog_desc_median.clone();
+			segment.geom_descriptor_median = geom_descriptor_median.clone();
+			segment.median_changed = true;
+			segment.PostprocessPredictions();
+		}
 
-	dyn_scaling = vector<vector<double>>(dyn_scaling.size(), vector<double>(dyn_scaling[0].size(), 5.0));	
+		size_t skip = s < skip_frames.size() ? (size_t)std::max(0, skip_frames[s]) : 0;
+		skip = std::min(skip, segment.timestamps.size());
 
-	AU_predictions_reg.clear();
-	AU_predictions_class.clear();
-	AU_predictions_combined.clear();
-	timestamps.clear();
-	AU_predictions_reg_all_hist.clear();
-	AU_predictions_class_all_hist.clear();
-	valid_preds.clear();
+		timestamps.insert(timestamps.end(), segment.timestamps.begin() + skip, segment.timestamps.end());
+		valid_preds.insert(valid_preds.end(), segment.valid_preds.begin() + skip, segment.valid_preds.end());
+		for (int c = 0; c < 2; ++c)
+		{
+			std::map<std::string, std::vector<double>>& all_hist = c == 0 ? AU_predictions_reg_all_hist : AU_predictions_class_all_hist;
+			const std::map<std::string, std::vector<double>>& segment_hist = c == 0 ? segment.AU_predictions_reg_all_hist : segment.AU_predictions_class_all_hist;
+			for (auto au_iter = segment_hist.begin(); au_iter != segment_hist.end(); ++au_iter)
+			{
+				size_t au_skip = std::min(skip, au_iter->second.size());
+				all_hist[au_iter->first].insert(all_hist[au_iter->first].end(), au_iter->second.begin() + au_skip, au_iter->second.end());
+			}
+		}
+		current_time_seconds = segment.current_time_seconds;
+	}
 
-	// Clean up the postprocessing data as well
-	hog_desc_frames_init.clear();
-	geom_descriptor_frames_init.clear();
-	postprocessed = false;
-	frames_tracking_succ = 0;
+	return true;
 }
 
-void FaceAnalyser::UpdateRunningMedian(cv::Mat_<int>& histogram, int& hist_count, cv::Mat_<double>& median, const cv::Mat_<double>& descriptor, bool update, int num_bins, double min_val, double max_val)
+void FaceAnalyser::UpdateRunningMedian(cv::Mat_<ushort>& histogram, int& hist_count, cv::Mat_<int>& median_bins, cv::Mat_<float>& median, const cv::Mat_<float>& descriptor, bool update, int num_bins, double min_val, double max_val)
 {
 
 	double length = max_val - min_val;
@@ -788,14 +2083,19 @@ void FaceAnalyser::UpdateRunningMedian(cv::Mat_<int>& histogram, int& hist_count
 	// The median update
 	if(histogram.empty())
 	{
-		histogram = cv::Mat_<int>(descriptor.cols, num_bins, (int)0);
+		histogram = cv::Mat_<ushort>(descriptor.cols, num_bins, (ushort)0);
 		median = descriptor.clone();
 	}
 
+	if(median_bins.rows != histogram.rows)
+	{
+		median_bins = cv::Mat_<int>(histogram.rows, 2, (int)0);
+	}
+
 	if(update)
 	{
 		// Find the bins corresponding to the current descriptor
-		cv::Mat_<double> converted_descriptor = (descriptor - min_val)*((double)num_bins)/(length);
+		cv::Mat_<float> converted_descriptor = (descriptor - min_val)*((double)num_bins)/(length);
 
 		// Capping the top and bottom values
 		converted_descriptor.setTo(cv::Scalar(num_bins-1), converted_descriptor > num_bins - 1);
@@ -803,8 +2103,19 @@ void FaceAnalyser::UpdateRunningMedian(cv::Mat_<int>& histogram, int& hist_count
 
 		for(int i = 0; i < histogram.rows; ++i)
 		{
-			int index = (int)converted_descriptor.at<double>(i);
-			histogram.at<int>(i, index)++;
+			int index = (int)converted_descriptor.at<float>(i);
+			if(histogram.at<ushort>(i, index) == std::numeric_limits<ushort>::max())
+			{
+				HalveHistogram(histogram, hist_count);
+				median_bins.setTo(0);
+			}
+			histogram.at<ushort>(i, index)++;
+
+			// Keep the count of the samples below the median bin up to date
+			if(index < median_bins.at<int>(i, 0))
+			{
+				median_bins.at<int>(i, 1)++;
+			}
 		}
 
 		// Update the histogram count
@@ -817,28 +2128,46 @@ void FaceAnalyser::UpdateRunningMedian(cv::Mat_<int>& histogram, int& hist_count
 	}
 	else
 	{
-		// Recompute the median
+		// Recompute the median, the median bin is the first one at which the cummulative sum reaches the cutoff point
 		int cutoff_point = (hist_count + 1)/2;
 
+		const float bin_width = (float)(length / (double)num_bins);
+		const float bin_offset = (float)(min_val + 0.5 * length / (double)num_bins);
+
 		// For each dimension
 		for(int i = 0; i < histogram.rows; ++i)
 		{
-			int cummulative_sum = 0;
-			for(int j = 0; j < histogram.cols; ++j)
+			const ushort* hist_row = histogram.ptr<ushort>(i);
+			int* median_bin = median_bins.ptr<int>(i);
+
+			int bin = median_bin[0];
+			int count_below = median_bin[1];
+
+			// As only one sample is added per update the median bin moves only a little
+			while(count_below + hist_row[bin] < cutoff_point && bin < num_bins - 1)
 			{
-				cummulative_sum += histogram.at<int>(i, j);
-				if(cummulative_sum >= cutoff_point)
-				{
-					median.at<double>(i) = min_val + ((double)j) * (length/((double)num_bins)) + (0.5*(length)/ ((double)num_bins));
-					break;
-				}
+				count_below += hist_row[bin];
+				bin++;
 			}
+			while(bin > 0 && count_below >= cutoff_point)
+			{
+				bin--;
+				count_below -= hist_row[bin];
+			}
+
+			median_bin[0] = bin;
+			median_bin[1] = count_below;
 		}
+
+		// Convert the bins to median values
+		cv::Mat_<float> bins_float;
+		median_bins.col(0).convertTo(bins_float, CV_32F, bin_width, bin_offset);
+		median = bins_float.t();
 	}
 }
 
 
-void FaceAnalyser::ExtractMedian(cv::Mat_<int>& histogram, int hist_count, cv::Mat_<double>& median, int num_bins, double min_val, double max_val)
+void FaceAnalyser::ExtractMedian(cv::Mat_<ushort>& histogram, int hist_count, cv::Mat_<float>& median, int num_bins, double min_val, double max_val)
 {
 
 	double length = max_val - min_val;
@@ -854,7 +2183,7 @@ void FaceAnalyser::ExtractMedian(cv::Mat_<int>& histogram, int hist_count, cv::M
 	{
 		if(median.empty())
 		{
-			median = cv::Mat_<double>(1, histogram.rows, 0.0);
+			median = cv::Mat_<float>(1, histogram.rows, 0.0f);
 		}
 
 		// Compute the median
@@ -866,10 +2195,10 @@ void FaceAnalyser::ExtractMedian(cv::Mat_<int>& histogram, int hist_count, cv::M
 			int cummulative_sum = 0;
 			for(int j = 0; j < histogram.cols; ++j)
 			{
-				cummulative_sum += histogram.at<int>(i, j);
+				cummulative_sum += histogram.at<ushort>(i, j);
 				if(cummulative_sum > cutoff_point)
 				{
-					median.at<double>(i) = min_val + j * (max_val/num_bins) + (0.5*(length)/num_bins);
+					median.at<float>(i) = (float)(min_val + j * (max_val/num_bins) + (0.5*(length)/num_bins));
 					break;
 				}
 			}
@@ -971,6 +2300,36 @@ vector<pair<string, double>> FaceAnalyser::CorrectOnlineAUs(std::vector<std::pai
 	return predictions;
 }
 
+void FaceAnalyser::PredictCurrentAUsAll(int view, vector<pair<string, double>>& intensities, vector<pair<string, double>>& occurences)
+{
+	intensities.clear();
+	occurences.clear();
+
+	if (AU_lin_fused.Empty())
+	{
+		if (requested_outputs & OUTPUT_AU_INTENSITY)
+			intensities = PredictCurrentAUs(view);
+		if (requested_outputs & OUTPUT_AU_PRESENCE)
+			occurences = PredictCurrentAUsClass(view);
+		return;
+	}
+
+	if (!hog_desc_frame.empty() || AU_lin_fused.IsGeometryOnly())
+	{
+		cv::Mat_<float> input, preds;
+		AU_lin_fused.BuildInput(input, hog_desc_frame, geom_descriptor_frame);
+		UpdateCurrentMedianResponse();
+		AU_lin_fused.PredictWithResponses(preds, input, current_median_response);
+		AU_lin_fused.GetAUs(intensities, occurences, preds, 0);
+
+		// Both come from the same product, only keep what was asked for
+		if (!(requested_outputs & OUTPUT_AU_INTENSITY))
+			intensities.clear();
+		if (!(requested_outputs & OUTPUT_AU_PRESENCE))
+			occurences.clear();
+	}
+}
+
 // Apply the current predictors to the currently stored descriptors (classification)
 vector<pair<string, double>> FaceAnalyser::PredictCurrentAUsClass(int view)
 {
@@ -1019,7 +2378,31 @@ vector<pair<string, double>> FaceAnalyser::GetCurrentAUsCombined() const
 	return AU_predictions_combined;
 }
 
-void FaceAnalyser::Read(std::string model_loc)
+void FaceAnalyser::UpdateCurrentAUValues()
+{
+	FillAUValues(AU_predictions_reg, AU_name_table_reg, AU_values_reg);
+	FillAUValues(AU_predictions_class, AU_name_table_class, AU_values_class);
+}
+
+void FaceAnalyser::FillAUValues(const vector<pair<string, double>>& predictions, const vector<string>& names, vector<float>& values)
+{
+	values.assign(names.size(), std::numeric_limits<float>::quiet_NaN());
+	for (size_t i = 0; i < predictions.size(); ++i)
+	{
+		// The predictions are usually in the order of the table, otherwise the name is looked up
+		size_t index = i;
+		if (index >= names.size() || names[index] != predictions[i].first)
+		{
+			index = std::find(names.begin(), names.end(), predictions[i].first) - names.begin();
+		}
+		if (index < names.size())
+		{
+			values[index] = (float)predictions[i].second;
+		}
+	}
+}
+
+void FaceAnalyser::Read(std::string model_loc, bool geometry_only_aus)
 {
 	// Reading in the modules for AU recognition
 
@@ -1036,6 +2419,9 @@ void FaceAnalyser::Read(std::string model_loc)
 	// The other module locations should be defined as relative paths from the main model
 	boost::filesystem::path root = boost::filesystem::path(model_loc).parent_path();
 
+	// The geometry only AU regressors take the place of the appearance ones if they are listed
+	bool geometry_aus_read = false;
+
 	// The main file contains the references to other files
 	while (!locations.eof())
 	{
@@ -1059,11 +2445,36 @@ void FaceAnalyser::Read(std::string model_loc)
 
 		// append to root
 		location = (root / location).string();
-		if (module.compare("AUPredictor") == 0)
+		if (module.compare("AUPredictor") == 0 && !geometry_aus_read)
 		{
 			// The AU predictors
 			cout << "Reading the AU predictors from: " << location;
 			ReadAU(location);
+			if (!AU_lin_fused.Build(AU_SVR_static_appearance_lin_regressors, AU_SVR_dynamic_appearance_lin_regressors, AU_SVM_static_appearance_lin, AU_SVM_dynamic_appearance_lin))
+			{
+				cout << " (the AU models could not be packed together, they will be evaluated separately)";
+			}
+			AU_name_table_reg = GetAURegNames();
+			AU_name_table_class = GetAUClassNames();
+			cout << "... Done" << endl;
+		}
+		else if (module.compare("AUPredictorGeom") == 0 && geometry_only_aus)
+		{
+			cout << "Reading the geometry only AU predictors from: " << location;
+			AU_SVR_static_appearance_lin_regressors = SVR_static_lin_regressors();
+			AU_SVR_dynamic_appearance_lin_regressors = SVR_dynamic_lin_regressors();
+			AU_SVM_static_appearance_lin = SVM_static_lin();
+			AU_SVM_dynamic_appearance_lin = SVM_dynamic_lin();
+			ReadAU(location);
+			AU_name_table_reg = GetAURegNames();
+			AU_name_table_class = GetAUClassNames();
+			geometry_aus_read = true;
+			cout << "... Done" << endl;
+		}
+		else if (module.compare("HOGProjection") == 0)
+		{
+			cout << "Reading the HOG projection from: " << location;
+			ReadHOGProjection(location);
 			cout << "... Done" << endl;
 		}
 		else if (module.compare("PDM") == 0)
@@ -1083,6 +2494,49 @@ void FaceAnalyser::Read(std::string model_loc)
 		}
 	}
 
+	// The geometry descriptor is known once the PDM is read
+	if (geometry_only_aus)
+	{
+		int geometry_dim = pdm.NumberOfPoints() * 3 + pdm.NumberOfModes();
+		if (!AU_lin_fused.Build(AU_SVR_static_appearance_lin_regressors, AU_SVR_dynamic_appearance_lin_regressors, AU_SVM_static_appearance_lin, AU_SVM_dynamic_appearance_lin, geometry_dim))
+		{
+			cout << "WARNING: the AU models do not use the geometry descriptor, the AUs are predicted from the appearance instead" << endl;
+			AU_lin_fused.Build(AU_SVR_static_appearance_lin_regressors, AU_SVR_dynamic_appearance_lin_regressors, AU_SVM_static_appearance_lin, AU_SVM_dynamic_appearance_lin);
+		}
+		else if (!geometry_aus_read)
+		{
+			cout << "No geometry only AU predictors listed, using the geometry part of the appearance models" << endl;
+		}
+	}
+
+}
+
+// The projection file holds the mean (1 x HOG dims) and the projection (HOG dims x reduced dims) matrices, followed by the minimum and
+// the maximum of the projected values (doubles)
+void FaceAnalyser::ReadHOGProjection(std::string location)
+{
+	ifstream projection_stream(location.c_str(), ios::in | ios::binary);
+	if (!projection_stream.is_open())
+	{
+		cout << "Couldn't open the HOG projection file at: " << location << endl;
+		return;
+	}
+
+	cv::Mat mean_file, projection_file;
+	ReadMatBin(projection_stream, mean_file);
+	ReadMatBin(projection_stream, projection_file);
+
+	double range[2];
+	projection_stream.read((char*)range, sizeof(range));
+	if (!projection_stream || mean_file.cols != projection_file.rows || range[0] >= range[1])
+	{
+		cout << " (the HOG projection is not valid, it is not used)";
+		return;
+	}
+
+	mean_file.convertTo(hog_projection_mean, CV_32F);
+	projection_file.convertTo(hog_projection, CV_32F);
+	hog_projection_range = cv::Vec2d(range[0], range[1]);
 }
 
 // Reading in AU prediction modules
@@ -1260,6 +2714,19 @@ double FaceAnalyser::GetCurrentTimeSeconds() {
 // Allows for post processing of the AU signal
 void FaceAnalyser::PostprocessOutputFile(string output_file)
 {
+	if (!postprocess_offline)
+	{
+		return;
+	}
+
+	PredictPendingAUs();
+
+	// The compressed outputs (-compress_outputs) can not be patched in place
+	if (boost::algorithm::ends_with(output_file, ".zst") || boost::algorithm::ends_with(output_file, ".gz"))
+	{
+		cout << "Warning: the Action Units of the compressed output " << output_file << " are not postprocessed, write an uncompressed output for the offline correction" << endl;
+		return;
+	}
 
 	vector<double> certainties;
 	vector<bool> successes;
@@ -1267,12 +2734,77 @@ void FaceAnalyser::PostprocessOutputFile(string output_file)
 	vector<std::pair<std::string, vector<double>>> predictions_reg;
 	vector<std::pair<std::string, vector<double>>> predictions_class;
 
-	// Construct the new values to overwrite the output file with
-	ExtractAllPredictionsOfflineReg(predictions_reg, certainties, successes, timestamps, dynamic);
-	ExtractAllPredictionsOfflineClass(predictions_class, certainties, successes, timestamps, dynamic);
+	// Names of the corrected AU tracks, in the order they are stored
+	vector<string> track_names_reg;
+	vector<string> track_names_class;
+
+	// When the history was spilled to disk the corrected tracks are kept in temporary stores as well (a row per frame),
+	// they are corrected one AU at a time so that only a single track is in memory at once
+	DescriptorStore corrected_reg;
+	DescriptorStore corrected_class;
+	bool spilled = AU_predictions_reg_store.IsOpen() || AU_predictions_class_store.IsOpen();
+
+	if (spilled)
+	{
+		if (dynamic)
+		{
+			PostprocessPredictions();
+		}
+
+		for (int c = 0; c < 2; ++c)
+		{
+			DescriptorStore& history = c == 0 ? AU_predictions_reg_store : AU_predictions_class_store;
+			DescriptorStore& corrected = c == 0 ? corrected_reg : corrected_class;
+			const vector<string>& names = c == 0 ? AU_predictions_reg_store_names : AU_predictions_class_store_names;
+
+			if (!history.IsOpen() || !corrected.Open(history.Cols(), false))
+			{
+				continue;
+			}
+
+			cv::Mat_<float> empty_row(1, history.Cols(), 0.0f);
+			for (int frame = 0; frame < history.Rows(); ++frame)
+			{
+				corrected.Append(empty_row);
+			}
+
+			vector<double> au_vals;
+			for (size_t au = 0; au < names.size(); ++au)
+			{
+				history.GetColumn((int)au, au_vals);
+				if (c == 0)
+				{
+					CorrectOfflineReg(names[au], au_vals, valid_preds, dynamic);
+				}
+				else
+				{
+					CorrectOfflineClass(au_vals);
+				}
+				corrected.SetColumn((int)au, au_vals);
+			}
+		}
+		track_names_reg = AU_predictions_reg_store_names;
+		track_names_class = AU_predictions_class_store_names;
+	}
+	else
+	{
+		// Construct the new values to overwrite the output file with
+		ExtractAllPredictionsOfflineReg(predictions_reg, certainties, successes, timestamps, dynamic);
+		ExtractAllPredictionsOfflineClass(predictions_class, certainties, successes, timestamps, dynamic);
+
+		for (size_t i = 0; i < predictions_reg.size(); ++i)
+		{
+			track_names_reg.push_back(predictions_reg[i].first);
+		}
+		for (size_t i = 0; i < predictions_class.size(); ++i)
+		{
+			track_names_class.push_back(predictions_class[i].first);
+		}
+	}
 
-	int num_class = (int)predictions_class.size();
-	int num_reg = (int)predictions_reg.size();
+	int num_class = (int)track_names_class.size();
+	int num_reg = (int)track_names_reg.size();
+	int num_frames = (int)valid_preds.size();
 
 	// Extract the indices of writing out first
 	vector<string> au_reg_names = GetAURegNames();
@@ -1284,7 +2816,7 @@ void FaceAnalyser::PostprocessOutputFile(string output_file)
 	{
 		for (int i = 0; i < num_reg; ++i)
 		{
-			if (au_name.compare(predictions_reg[i].first) == 0)
+			if (au_name.compare(track_names_reg[i]) == 0)
 			{
 				inds_reg.push_back(i);
 				break;
@@ -1301,70 +2833,87 @@ void FaceAnalyser::PostprocessOutputFile(string output_file)
 	{
 		for (int i = 0; i < num_class; ++i)
 		{
-			if (au_name.compare(predictions_class[i].first) == 0)
+			if (au_name.compare(track_names_class[i]) == 0)
 			{
 				inds_class.push_back(i);
 				break;
 			}
 		}
 	}
-	// Read all of the output file in
-	vector<string> output_file_contents;
-
-	std::ifstream infile(output_file);
-	string line;
-
-	while (std::getline(infile, line))
-		output_file_contents.push_back(line);
 
-	infile.close();
+	// The corrected values of a frame, in the order of the AU columns of the file
+	vector<double> frame_values(num_reg + num_class, 0.0);
+	cv::Mat_<float> row_reg, row_class;
+	auto get_frame_values = [&](int frame)
+	{
+		if (spilled)
+		{
+			corrected_reg.Get(frame, row_reg);
+			corrected_class.Get(frame, row_class);
+		}
+		for (int i = 0; i < num_reg; ++i)
+		{
+			frame_values[i] = spilled ? (double)row_reg.at<float>(inds_reg[i]) : predictions_reg[inds_reg[i]].second[frame];
+		}
+		for (int i = 0; i < num_class; ++i)
+		{
+			frame_values[num_reg + i] = spilled ? (double)row_class.at<float>(inds_class[i]) : predictions_class[inds_class[i]].second[frame];
+		}
+	};
 
-	// Read the header and find all _r and _c parts in a file and use their indices
-	std::vector<std::string> tokens;
-	boost::split(tokens, output_file_contents[0], boost::is_any_of(","));
+	// The AU columns are written with a fixed width by the recorder, so the corrected values can be patched into the file in place, only the
+	// file is read and the AU columns written. If a value does not fit in its column the file is rewritten instead
+	if (PatchOutputFile(output_file, num_frames, num_reg + num_class, get_frame_values, frame_values))
+	{
+		return;
+	}
 
-	int begin_ind = -1;
+	// The output file is streamed through line by line into a temporary file which then replaces it
+	std::ifstream infile(output_file);
+	string header;
+	if (!std::getline(infile, header))
+	{
+		return;
+	}
 
-	for (size_t i = 0; i < tokens.size(); ++i)
+	string temp_output_file = output_file + ".tmp";
+	std::ofstream outfile(temp_output_file, ios_base::out);
+	if (!outfile.is_open())
 	{
-		if (tokens[i].find("AU") != string::npos && begin_ind == -1)
-		{
-			begin_ind = (int)i;
-			break;
-		}
+		std::cout << "Could not postprocess the output file " << output_file << std::endl;
+		return;
 	}
+
+	std::vector<std::string> tokens;
+	int begin_ind = GetFirstAUColumn(header);
 	int end_ind = begin_ind + num_class + num_reg;
 
-	// Now overwrite the whole file
-	std::ofstream outfile(output_file, ios_base::out);
 	// Write the header
 	outfile << std::setprecision(2);
 	outfile << std::fixed;
 	outfile << std::noshowpoint;
 
-	outfile << output_file_contents[0].c_str() << endl;
+	outfile << header.c_str() << endl;
 
 	// Write the contents
-	for (int i = 1; i < (int)output_file_contents.size(); ++i)
+	string line;
+	for (int frame = 0; std::getline(infile, line); ++frame)
 	{
-		std::vector<std::string> tokens;
-		boost::split(tokens, output_file_contents[i], boost::is_any_of(","));
+		boost::split(tokens, line, boost::is_any_of(","));
+
+		if (frame < num_frames)
+		{
+			get_frame_values(frame);
+		}
 
 		boost::trim(tokens[0]);
 		outfile << tokens[0];
 
 		for (int t = 1; t < (int)tokens.size(); ++t)
 		{
-			if (t >= begin_ind && t < end_ind)
+			if (begin_ind >= 0 && t >= begin_ind && t < end_ind && frame < num_frames)
 			{
-				if (t - begin_ind < num_reg)
-				{
-					outfile << ", " << predictions_reg[inds_reg[t - begin_ind]].second[i - 1];
-				}
-				else
-				{
-					outfile << ", " << predictions_class[inds_class[t - begin_ind - num_reg]].second[i - 1];
-				}
+				outfile << ", " << frame_values[t - begin_ind];
 			}
 			else
 			{
@@ -1375,5 +2924,113 @@ void FaceAnalyser::PostprocessOutputFile(string output_file)
 		outfile << endl;
 	}
 
+	infile.close();
+	outfile.close();
+
+	// Replace the original output file
+	boost::system::error_code error;
+	boost::filesystem::rename(temp_output_file, output_file, error);
+	if (error)
+	{
+		std::cout << "Could not replace the output file " << output_file << ": " << error.message() << std::endl;
+	}
+}
+
+int FaceAnalyser::GetFirstAUColumn(const std::string& header)
+{
+	// The AUs follow all of the other columns
+	std::vector<std::string> tokens;
+	boost::split(tokens, header, boost::is_any_of(","));
+	for (size_t i = 0; i < tokens.size(); ++i)
+	{
+		if (tokens[i].find("AU") != string::npos)
+		{
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+bool FaceAnalyser::PatchOutputFile(const std::string& output_file, int num_frames, int num_values, const std::function<void(int)>& get_frame_values,
+	const std::vector<double>& frame_values)
+{
+	std::fstream file(output_file, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+	string header;
+	if (!file.is_open() || !std::getline(file, header))
+	{
+		return false;
+	}
+
+	int begin_ind = GetFirstAUColumn(header);
+	if (begin_ind < 0 || num_values == 0)
+	{
+		return false;
+	}
+
+	string line;
+	std::streamoff line_start = (std::streamoff)header.size() + 1;
+	vector<size_t> field_starts(num_values + 1);
+	char value[64];
+	for (int frame = 0; frame < num_frames && std::getline(file, line); ++frame)
+	{
+		std::streamoff next_line_start = line_start + (std::streamoff)line.size() + 1;
+
+		// Line endings written in text mode on Windows
+		size_t line_end = line.size();
+		if (line_end > 0 && line[line_end - 1] == '\r')
+		{
+			line_end--;
+		}
+
+		// Where the AU fields are in the line, the field of a value starts after its separating comma
+		int column = 0;
+		size_t pos = 0;
+		while (column < begin_ind && pos != string::npos)
+		{
+			pos = line.find(',', pos);
+			if (pos != string::npos)
+			{
+				pos++;
+			}
+			column++;
+		}
+		for (int i = 0; i < num_values && pos != string::npos; ++i)
+		{
+			field_starts[i] = pos;
+			pos = line.find(',', pos);
+			pos = pos == string::npos ? (i + 1 == num_values ? line_end + 1 : pos) : pos + 1;
+		}
+		if (pos == string::npos)
+		{
+			return false;
+		}
+		field_starts[num_values] = pos;
+
+		// The new values are written with the decimals of the old ones, right aligned in their fields
+		get_frame_values(frame);
+		string patched = line.substr(field_starts[0], field_starts[num_values] - 1 - field_starts[0]);
+		for (int i = 0; i < num_values; ++i)
+		{
+			size_t field_length = field_starts[i + 1] - 1 - field_starts[i];
+			size_t point = line.find('.', field_starts[i]);
+			int decimals = point != string::npos && point < field_starts[i] + field_length ? (int)(field_starts[i] + field_length - point - 1) : 0;
+			int length = std::snprintf(value, sizeof(value), "%*.*f", (int)field_length, decimals, frame_values[i]);
+			if (length < 0 || (size_t)length > field_length)
+			{
+				return false;
+			}
+			patched.replace(field_starts[i] - field_starts[0], field_length, value);
+		}
+
+		file.seekp(line_start + (std::streamoff)field_starts[0]);
+		file.write(patched.data(), patched.size());
+		file.seekg(next_line_start);
+		if (!file)
+		{
+			return false;
+		}
+		line_start = next_line_start;
+	}
 
+	return true;
 }
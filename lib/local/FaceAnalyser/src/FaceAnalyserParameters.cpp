@@ -34,10 +34,13 @@
 
 #include "FaceAnalyserParameters.h"
 
+#include <TuningCache.h>
+
 // System includes
 #include <sstream>
 #include <iostream>
 #include <cstdlib>
+#include <algorithm>
 
 #ifndef CONFIG_DIR
 #define CONFIG_DIR "~"
@@ -73,6 +76,10 @@ FaceAnalyserParameters::FaceAnalyserParameters(vector<string> &arguments):root()
 
 	bool scale_set = false;
 	bool size_set = false;
+	bool batch_size_set = false;
+
+	// A reduced AU model set (e.g. written by the ModelPruner tool) can be used instead of the default one
+	string au_model_location;
 
 	for (size_t i = 1; i < arguments.size(); ++i)
 	{
@@ -88,6 +95,49 @@ FaceAnalyserParameters::FaceAnalyserParameters(vector<string> &arguments):root()
 			grayscale = true;
 			valid[i] = false;
 		}
+		else if (arguments[i].compare("-au_online") == 0)
+		{
+			postprocess_offline = false;
+			valid[i] = false;
+		}
+		else if (arguments[i].compare("-au_spill") == 0)
+		{
+			spill_offline_history = true;
+			valid[i] = false;
+		}
+		else if (arguments[i].compare("-au_batch") == 0)
+		{
+			batch_offline_au = true;
+			valid[i] = false;
+		}
+		else if (arguments[i].compare("-au_geom") == 0)
+		{
+			geometry_only_aus = true;
+			valid[i] = false;
+		}
+		else if (arguments[i].compare("-au_history") == 0 && i + 1 < arguments.size())
+		{
+			history_window = std::max(0, stoi(arguments[i + 1]));
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-au_batch_size") == 0 && i + 1 < arguments.size())
+		{
+			au_batch_size = stoi(arguments[i + 1]);
+			valid[i] = false;
+			valid[i + 1] = false;
+			batch_size_set = true;
+			i++;
+		}
+		else if (arguments[i].compare("-tuning_cache") == 0 && i + 1 < arguments.size())
+		{
+			// Usually already loaded (and removed from the arguments) by the landmark detection parameters
+			Utilities::TuningCache::Global().Load(arguments[i + 1]);
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
 		else if (arguments[i].compare("-nomask") == 0)
 		{
 			sim_align_face_mask = false;
@@ -109,6 +159,13 @@ FaceAnalyserParameters::FaceAnalyserParameters(vector<string> &arguments):root()
 			size_set = true;
 			i++;
 		}
+		else if (arguments[i].compare("-au_model") == 0 && i + 1 < arguments.size())
+		{
+			au_model_location = arguments[i + 1];
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
 	}
 
 	for (int i = (int)arguments.size() - 1; i >= 0; --i)
@@ -119,7 +176,23 @@ FaceAnalyserParameters::FaceAnalyserParameters(vector<string> &arguments):root()
 		}
 	}
 
-	if (dynamic)
+	if (history_window > 0 && (postprocess_offline || batch_offline_au))
+	{
+		std::cout << "The AU history is bounded to " << history_window << " frames, turning off the offline AU correction" << std::endl;
+		postprocess_offline = false;
+		batch_offline_au = false;
+	}
+
+	if (!batch_size_set)
+	{
+		Utilities::TuningCache::Global().Get("face_analyser/au_batch_size", au_batch_size);
+	}
+
+	if (!au_model_location.empty())
+	{
+		this->model_location = au_model_location;
+	}
+	else if (dynamic)
 	{
 		this->model_location = "AU_predictors/main_dynamic_svms.txt";
 	}
@@ -158,6 +231,12 @@ void FaceAnalyserParameters::init()
 	// Initialize default parameter values
 	this->dynamic = true;
 	this->grayscale = false;
+	this->postprocess_offline = true;
+	this->spill_offline_history = false;
+	this->batch_offline_au = false;
+	this->au_batch_size = 1024;
+	this->geometry_only_aus = false;
+	this->history_window = 0;
 	this->sim_scale_out = 0.7;
 	this->sim_size_out = 112;
 	this->sim_align_face_mask = true;
@@ -34,17 +34,21 @@
 
 #include <Face_utils.h>
 
+#include <LandmarkDetectorUtils.h>
 #include <RotationHelpers.h>
+#include <TextValueReader.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <cstring>
+#include <limits>
 
 // OpenCV includes
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/calib3d.hpp>
 
-// For FHOG visualisation
-#include <dlib/opencv.h>
-#include <dlib/image_processing/frontal_face_detector.h>
-
 using namespace std;
 
 namespace FaceAnalysis
@@ -217,110 +221,172 @@ namespace FaceAnalysis
 
 		destination_landmarks = cv::Mat(destination_landmarks.t()).reshape(1, 1).t();
 
-		LandmarkDetector::PAW paw(destination_landmarks, triangulation, 0, 0, aligned_face.cols-1, aligned_face.rows-1);
-		
-		// Mask each of the channels (a bit of a roundabout way, but OpenCV 3.1 in debug mode doesn't seem to be able to handle a more direct way using split and merge)
-		vector<cv::Mat> aligned_face_channels(aligned_face.channels());
-		
-		for (int c = 0; c < aligned_face.channels(); ++c)
+		// Only the mask is needed, not the whole warp
+		cv::Mat_<uchar> mask;
+		LandmarkDetector::PAW::ComputeMask(destination_landmarks, triangulation, aligned_face.cols, aligned_face.rows, mask);
+
+		// Zero the pixels outside of the face in place, for all of the channels at once
+		size_t pixel_size = aligned_face.elemSize();
+		for (int y = 0; y < aligned_face.rows; ++y)
 		{
-			cv::extractChannel(aligned_face, aligned_face_channels[c], c);
+			const uchar* mask_row = mask.ptr<uchar>(y);
+			uchar* face_row = aligned_face.ptr<uchar>(y);
+			for (int x = 0; x < aligned_face.cols; ++x)
+			{
+				if (!mask_row[x])
+				{
+					memset(face_row + x * pixel_size, 0, pixel_size);
+				}
+			}
 		}
+	}
+
+	// Create a row vector Felzenszwalb HOG descriptor from a given image, the cells of LandmarkDetector::ExtractFHOG laid out in a single row
+	void Extract_FHOG_descriptor(cv::Mat_<float>& descriptor, const cv::Mat& image, int& num_rows, int& num_cols, int cell_size)
+	{
+		cv::Mat_<float> hog;
+		LandmarkDetector::ExtractFHOG(hog, image, num_rows, num_cols, cell_size);
 
-		for(size_t i = 0; i < aligned_face_channels.size(); ++i)
+		if(num_rows == 0 || num_cols == 0)
 		{
-			cv::multiply(aligned_face_channels[i], paw.pixel_mask, aligned_face_channels[i], 1.0, CV_8U);
+			descriptor = cv::Mat_<float>(1, 0);
+			return;
 		}
 
-		if(aligned_face.channels() == 3)
+		// The cells are continuous, so this does not copy them
+		descriptor = hog.reshape(1, 1);
+	}
+
+	// Extract summary statistics (mean, stdev, min, max) from each dimension of a descriptor, each row is a descriptor
+	void ExtractSummaryStatistics(const cv::Mat_<double>& descriptors, cv::Mat_<double>& sum_stats, bool use_mean, bool use_stdev, bool use_max_min)
+	{
+		SummaryStatistics statistics;
+		for (int i = 0; i < descriptors.rows; ++i)
 		{
-			cv::Mat planes[] = { aligned_face_channels[0], aligned_face_channels[1], aligned_face_channels[2] };
-			cv::merge(planes, 3, aligned_face);
+			statistics.Add(descriptors.row(i));
 		}
-		else
+
+		// Still a column per statistic and dimension if there are no descriptors
+		if (statistics.count == 0)
 		{
-			aligned_face = aligned_face_channels[0];
+			int num_stats = (int)use_mean + (int)use_stdev + (int)use_max_min;
+			sum_stats = cv::Mat_<double>(1, descriptors.cols * num_stats, 0.0);
+			return;
 		}
+		statistics.Extract(sum_stats, use_mean, use_stdev, use_max_min);
 	}
 
-	// Create a row vector Felzenszwalb HOG descriptor from a given image
-	void Extract_FHOG_descriptor(cv::Mat_<double>& descriptor, const cv::Mat& image, int& num_rows, int& num_cols, int cell_size)
+	template<typename T>
+	static void AddToSummary(SummaryStatistics& statistics, const cv::Mat_<T>& descriptor)
 	{
-		
-		dlib::array2d<dlib::matrix<float,31,1> > hog;
-		if(image.channels() == 1)
+		const int cols = (int)descriptor.total();
+		if (statistics.count == 0)
 		{
-			dlib::cv_image<uchar> dlib_warped_img(image);
-			dlib::extract_fhog_features(dlib_warped_img, hog, cell_size);
+			statistics.mean = cv::Mat_<double>(1, cols, 0.0);
+			statistics.sum_sq_diff = cv::Mat_<double>(1, cols, 0.0);
+			statistics.min = cv::Mat_<double>(1, cols, std::numeric_limits<double>::max());
+			statistics.max = cv::Mat_<double>(1, cols, -std::numeric_limits<double>::max());
 		}
-		else
+		if (cols != statistics.mean.cols)
 		{
-			dlib::cv_image<dlib::bgr_pixel> dlib_warped_img(image);
-			dlib::extract_fhog_features(dlib_warped_img, hog, cell_size);
+			return;
 		}
 
-		// Convert to a usable format
-		num_cols = hog.nc();
-		num_rows = hog.nr();
+		statistics.count++;
+		const double inv_count = 1.0 / (double)statistics.count;
 
-		descriptor = cv::Mat_<double>(1, num_cols * num_rows * 31);
-		cv::MatIterator_<double> descriptor_it = descriptor.begin();
-		for(int y = 0; y < num_cols; ++y)
+		double* mean = statistics.mean.ptr<double>();
+		double* sum_sq_diff = statistics.sum_sq_diff.ptr<double>();
+		double* min = statistics.min.ptr<double>();
+		double* max = statistics.max.ptr<double>();
+
+		// Rows of a matrix are continuous
+		const T* values = descriptor.template ptr<T>();
+		for (int i = 0; i < cols; ++i)
 		{
-			for(int x = 0; x < num_rows; ++x)
-			{
-				for(unsigned int o = 0; o < 31; ++o)
-				{
-					*descriptor_it++ = (double)hog[y][x](o);
-				}
-			}
+			const double value = (double)values[i];
+			const double delta = value - mean[i];
+			mean[i] += delta * inv_count;
+			sum_sq_diff[i] += delta * (value - mean[i]);
+			min[i] = std::min(min[i], value);
+			max[i] = std::max(max[i], value);
 		}
 	}
 
-	// Extract summary statistics (mean, stdev, min, max) from each dimension of a descriptor, each row is a descriptor
-	void ExtractSummaryStatistics(const cv::Mat_<double>& descriptors, cv::Mat_<double>& sum_stats, bool use_mean, bool use_stdev, bool use_max_min)
+	void SummaryStatistics::Add(const cv::Mat_<double>& descriptor)
 	{
-		// Using four summary statistics at the moment 
-		// Means, stds, mins, maxs
-		int num_stats = 0;
-
-		if(use_mean)
-			num_stats++;
+		AddToSummary(*this, descriptor);
+	}
 
-		if(use_stdev)
-			num_stats++;
+	void SummaryStatistics::Add(const cv::Mat_<float>& descriptor)
+	{
+		AddToSummary(*this, descriptor);
+	}
 
-		if(use_max_min)
-			num_stats++;
+	bool SummaryStatistics::Merge(const SummaryStatistics& other)
+	{
+		if (other.count == 0)
+		{
+			return true;
+		}
+		if (count == 0)
+		{
+			count = other.count;
+			mean = other.mean.clone();
+			sum_sq_diff = other.sum_sq_diff.clone();
+			min = other.min.clone();
+			max = other.max.clone();
+			return true;
+		}
+		if (other.mean.cols != mean.cols)
+		{
+			return false;
+		}
 
-		sum_stats = cv::Mat_<double>(1, descriptors.cols * num_stats, 0.0);
-		for(int i = 0; i < descriptors.cols; ++i)
+		// The pairwise combination of Chan et al., the squared differences of the two parts are corrected for the difference of their means
+		const double n_a = (double)count;
+		const double n_b = (double)other.count;
+		const double n = n_a + n_b;
+		for (int i = 0; i < mean.cols; ++i)
 		{
-			cv::Scalar mean, stdev;
-			cv::meanStdDev(descriptors.col(i), mean, stdev);
+			const double delta = other.mean(i) - mean(i);
+			mean(i) += delta * n_b / n;
+			sum_sq_diff(i) += other.sum_sq_diff(i) + delta * delta * n_a * n_b / n;
+			min(i) = std::min(min(i), other.min(i));
+			max(i) = std::max(max(i), other.max(i));
+		}
+		count += other.count;
+		return true;
+	}
 
+	void SummaryStatistics::Extract(cv::Mat_<double>& sum_stats, bool use_mean, bool use_stdev, bool use_max_min) const
+	{
+		int num_stats = (int)use_mean + (int)use_stdev + (int)use_max_min;
+
+		sum_stats = cv::Mat_<double>(1, mean.cols * num_stats, 0.0);
+		for (int i = 0; count > 0 && i < mean.cols; ++i)
+		{
 			int add = 0;
 
-			if(use_mean)
+			if (use_mean)
 			{
-				sum_stats.at<double>(0, i*num_stats + add) = mean[0];
+				sum_stats(0, i * num_stats + add) = mean(i);
 				add++;
 			}
 
-			if(use_stdev)
+			// The population standard deviation, as cv::meanStdDev
+			if (use_stdev)
 			{
-				sum_stats.at<double>(0, i*num_stats + add) = stdev[0];
+				sum_stats(0, i * num_stats + add) = std::sqrt(std::max(sum_sq_diff(i), 0.0) / (double)count);
 				add++;
 			}
 
-			if(use_max_min)
+			if (use_max_min)
 			{
-				double min, max;
-				cv::minMaxIdx(descriptors.col(i), &min, &max);
-				sum_stats.at<double>(0, i*num_stats + add) = max - min;
+				sum_stats(0, i * num_stats + add) = max(i) - min(i);
 				add++;
 			}
-		}		
+		}
 	}
 
 	void AddDescriptor(cv::Mat_<double>& descriptors, cv::Mat_<double> new_descriptor, int curr_frame, int num_frames_to_keep)
@@ -349,38 +415,22 @@ namespace FaceAnalysis
 
 		output_mat = cv::Mat(row, col, type);
 
+		// The values are parsed straight from the stream buffer, a newly created matrix is continuous
 		switch (output_mat.type())
 		{
 		case CV_64FC1:
 		{
-			cv::MatIterator_<double> begin_it = output_mat.begin<double>();
-			cv::MatIterator_<double> end_it = output_mat.end<double>();
-
-			while (begin_it != end_it)
-			{
-				stream >> *begin_it++;
-			}
+			Utilities::TextValueReader::ReadValues(stream, output_mat.ptr<double>(), output_mat.total());
 		}
 		break;
 		case CV_32FC1:
 		{
-			cv::MatIterator_<float> begin_it = output_mat.begin<float>();
-			cv::MatIterator_<float> end_it = output_mat.end<float>();
-
-			while (begin_it != end_it)
-			{
-				stream >> *begin_it++;
-			}
+			Utilities::TextValueReader::ReadValues(stream, output_mat.ptr<float>(), output_mat.total());
 		}
 		break;
 		case CV_32SC1:
 		{
-			cv::MatIterator_<int> begin_it = output_mat.begin<int>();
-			cv::MatIterator_<int> end_it = output_mat.end<int>();
-			while (begin_it != end_it)
-			{
-				stream >> *begin_it++;
-			}
+			Utilities::TextValueReader::ReadValues(stream, output_mat.ptr<int>(), output_mat.total());
 		}
 		break;
 		case CV_8UC1:
@@ -43,20 +43,27 @@ void SVR_static_lin_regressors::Read(std::ifstream& stream, const std::vector<st
 
 	if(this->means.empty())
 	{
-		ReadMatBin(stream, this->means);
+		cv::Mat means_file;
+		ReadMatBin(stream, means_file);
+		means_file.convertTo(this->means, CV_32F);
 	}
 	else
 	{
-		cv::Mat_<double> m_tmp;
-		ReadMatBin(stream, m_tmp);
+		cv::Mat m_file;
+		ReadMatBin(stream, m_file);
+		cv::Mat_<float> m_tmp;
+		m_file.convertTo(m_tmp, CV_32F);
 		if(cv::norm(m_tmp - this->means > 0.00001))
 		{
 			std::cout << "Something went wrong with the SVR static regressors" << std::endl;
 		}
 	}
 
-	cv::Mat_<double> support_vectors_curr;
-	ReadMatBin(stream, support_vectors_curr);
+	// The models are stored in double precision, but are evaluated in single precision
+	cv::Mat support_vectors_file;
+	ReadMatBin(stream, support_vectors_file);
+	cv::Mat_<float> support_vectors_curr;
+	support_vectors_file.convertTo(support_vectors_curr, CV_32F);
 
 	double bias;
 	stream.read((char *)&bias, 8);
@@ -70,14 +77,14 @@ void SVR_static_lin_regressors::Read(std::ifstream& stream, const std::vector<st
 		cv::transpose(this->support_vectors, this->support_vectors);
 
 		cv::transpose(this->biases, this->biases);
-		this->biases.push_back(cv::Mat_<double>(1, 1, bias));
+		this->biases.push_back(cv::Mat_<float>(1, 1, (float)bias));
 		cv::transpose(this->biases, this->biases);
 
 	}
 	else
 	{
 		this->support_vectors.push_back(support_vectors_curr);
-		this->biases.push_back(cv::Mat_<double>(1, 1, bias));
+		this->biases.push_back(cv::Mat_<float>(1, 1, (float)bias));
 	}
 	
 	for(size_t i=0; i < au_names.size(); ++i)
@@ -87,24 +94,24 @@ void SVR_static_lin_regressors::Read(std::ifstream& stream, const std::vector<st
 }
 
 // Prediction using the HOG descriptor
-void SVR_static_lin_regressors::Predict(std::vector<double>& predictions, std::vector<std::string>& names, const cv::Mat_<double>& fhog_descriptor, const cv::Mat_<double>& geom_params)
+void SVR_static_lin_regressors::Predict(std::vector<double>& predictions, std::vector<std::string>& names, const cv::Mat_<float>& fhog_descriptor, const cv::Mat_<float>& geom_params)
 {
 	if(AU_names.size() > 0)
 	{
-		cv::Mat_<double> preds;
+		cv::Mat_<float> preds;
 		if(fhog_descriptor.cols ==  this->means.cols)
 		{
 			preds = (fhog_descriptor - this->means) * this->support_vectors + this->biases;
 		}
 		else
 		{
-			cv::Mat_<double> input;
+			cv::Mat_<float> input;
 			cv::hconcat(fhog_descriptor, geom_params, input);
 
 			preds = (input - this->means) * this->support_vectors + this->biases;
 		}
 
-		for(cv::MatIterator_<double> pred_it = preds.begin(); pred_it != preds.end(); ++pred_it)
+		for(cv::MatIterator_<float> pred_it = preds.begin(); pred_it != preds.end(); ++pred_it)
 		{		
 			predictions.push_back(*pred_it);
 		}
@@ -44,6 +44,29 @@ namespace GazeAnalysis
 
 	void EstimateGaze(const LandmarkDetector::CLNF& clnf_model, cv::Point3f& gaze_absolute, float fx, float fy, float cx, float cy, bool left_eye);
 
+	// The gaze of both eyes together with the eye landmarks it was computed from, so that the visualization and recording can reuse them
+	struct GazeResult
+	{
+		GazeResult() : valid(false), gaze_direction0(0, 0, 0), gaze_direction1(0, 0, 0), gaze_angle(0, 0) {}
+
+		// Was the gaze estimated, it is not when the eyes were not refined (e.g. self occluded or too small in the image)
+		bool valid;
+
+		// Left and right eye
+		cv::Point3f gaze_direction0;
+		cv::Point3f gaze_direction1;
+		cv::Vec2f gaze_angle;
+
+		// As returned by LandmarkDetector::CalculateAllEyeLandmarks and LandmarkDetector::Calculate3DEyeLandmarks
+		std::vector<cv::Point2f> eye_landmarks_2D;
+		std::vector<cv::Point3f> eye_landmarks_3D;
+	};
+
+	// Both eyes at once, the head pose and the 3D shapes are only computed once, the eye landmarks are always filled in while the gaze is only
+	// estimated if estimate_gaze is set (e.g. when tracking succeeded), otherwise the gaze in the result is left as it is. The gaze of eyes
+	// that were not refined in the last fit (CLNF::HierarchicalPartValid) is zeroed, valid is only set when the gaze was estimated
+	void EstimateGazeBoth(const LandmarkDetector::CLNF& clnf_model, GazeResult& result, float fx, float fy, float cx, float cy, bool estimate_gaze = true);
+
 	// Getting the gaze angle in radians with respect to the world coordinates (camera plane), when looking ahead straight at camera plane the gaze angle will be (0,0)
 	cv::Vec2f GetGazeAngle(cv::Point3f& gaze_vector_1, cv::Point3f& gaze_vector_2);
 	
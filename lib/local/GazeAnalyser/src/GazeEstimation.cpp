@@ -86,6 +86,29 @@ cv::Point3f GazeAnalysis::GetPupilPosition(cv::Mat_<float> eyeLdmks3d){
 	return p;
 }
 
+// The gaze of one eye from the 3D eye landmarks, the transposed 3D face landmarks and the head rotation
+static cv::Point3f GazeFromEye(const cv::Mat& eyeLdmks3d, const cv::Mat& faceLdmks3d, const cv::Matx33f& rotMat, bool left_eye)
+{
+	cv::Point3f pupil = GazeAnalysis::GetPupilPosition(eyeLdmks3d);
+	cv::Point3f rayDir = pupil / norm(pupil);
+
+	cv::Mat offset = (cv::Mat_<float>(3, 1) << 0, -3.5, 7.0);
+
+	int eyeIdx = 1;
+	if (left_eye)
+	{
+		eyeIdx = 0;
+	}
+
+	cv::Mat eyeballCentreMat = (faceLdmks3d.row(36+eyeIdx*6) + faceLdmks3d.row(39+eyeIdx*6))/2.0f + (cv::Mat(rotMat)*offset).t();
+
+	cv::Point3f eyeballCentre = cv::Point3f(eyeballCentreMat);
+
+	cv::Point3f gazeVecAxis = RaySphereIntersect(cv::Point3f(0,0,0), rayDir, eyeballCentre, 12) - eyeballCentre;
+	
+	return gazeVecAxis / norm(gazeVecAxis);
+}
+
 void GazeAnalysis::EstimateGaze(const LandmarkDetector::CLNF& clnf_model, cv::Point3f& gaze_absolute, float fx, float fy, float cx, float cy, bool left_eye)
 {
 	cv::Vec6f headPose = LandmarkDetector::GetPose(clnf_model, fx, fy, cx, cy);
@@ -114,27 +137,86 @@ void GazeAnalysis::EstimateGaze(const LandmarkDetector::CLNF& clnf_model, cv::Po
 
 	cv::Mat eyeLdmks3d = clnf_model.hierarchical_models[part].GetShape(fx, fy, cx, cy);
 
-	cv::Point3f pupil = GetPupilPosition(eyeLdmks3d);
-	cv::Point3f rayDir = pupil / norm(pupil);
-
 	cv::Mat faceLdmks3d = clnf_model.GetShape(fx, fy, cx, cy);
 	faceLdmks3d = faceLdmks3d.t();
 
-	cv::Mat offset = (cv::Mat_<float>(3, 1) << 0, -3.5, 7.0);
+	gaze_absolute = GazeFromEye(eyeLdmks3d, faceLdmks3d, rotMat, left_eye);
+}
 
-	int eyeIdx = 1;
-	if (left_eye)
+void GazeAnalysis::EstimateGazeBoth(const LandmarkDetector::CLNF& clnf_model, GazeResult& result, float fx, float fy, float cx, float cy, bool estimate_gaze)
+{
+	result.eye_landmarks_2D.clear();
+	result.eye_landmarks_3D.clear();
+
+	// Resolve the eye parts once, in the order of the hierarchical models (the order the eye landmarks are reported in)
+	int left_part = -1;
+	int right_part = -1;
+	vector<int> eye_parts;
+	for (size_t i = 0; i < clnf_model.hierarchical_models.size(); ++i)
 	{
-		eyeIdx = 0;
+		if (clnf_model.hierarchical_model_names[i].compare("left_eye_28") == 0)
+		{
+			left_part = (int)i;
+			eye_parts.push_back((int)i);
+		}
+		else if (clnf_model.hierarchical_model_names[i].compare("right_eye_28") == 0)
+		{
+			right_part = (int)i;
+			eye_parts.push_back((int)i);
+		}
 	}
 
-	cv::Mat eyeballCentreMat = (faceLdmks3d.row(36+eyeIdx*6) + faceLdmks3d.row(39+eyeIdx*6))/2.0f + (cv::Mat(rotMat)*offset).t();
+	// The 3D eye shapes are needed both for the landmarks and the gaze
+	vector<cv::Mat> eye_shapes(clnf_model.hierarchical_models.size());
+	for (int part : eye_parts)
+	{
+		eye_shapes[part] = clnf_model.hierarchical_models[part].GetShape(fx, fy, cx, cy);
+		const cv::Mat& lmks = eye_shapes[part];
 
-	cv::Point3f eyeballCentre = cv::Point3f(eyeballCentreMat);
+		for (int lmk = 0; lmk < lmks.cols; ++lmk)
+		{
+			result.eye_landmarks_3D.push_back(cv::Point3f(lmks.at<float>(0, lmk), lmks.at<float>(1, lmk), lmks.at<float>(2, lmk)));
+		}
 
-	cv::Point3f gazeVecAxis = RaySphereIntersect(cv::Point3f(0,0,0), rayDir, eyeballCentre, 12) - eyeballCentre;
-	
-	gaze_absolute = gazeVecAxis / norm(gazeVecAxis);
+		vector<cv::Point2f> lmks_2D = LandmarkDetector::CalculateAllLandmarks(clnf_model.hierarchical_models[part]);
+		result.eye_landmarks_2D.insert(result.eye_landmarks_2D.end(), lmks_2D.begin(), lmks_2D.end());
+	}
+
+	result.valid = false;
+	if (!estimate_gaze)
+	{
+		return;
+	}
+
+	// An eye that was not refined just follows the face model, its gaze would be meaningless
+	if (left_part != -1 && right_part != -1 && (!clnf_model.HierarchicalPartValid(left_part) || !clnf_model.HierarchicalPartValid(right_part)))
+	{
+		result.gaze_direction0 = cv::Point3f(0, 0, 0);
+		result.gaze_direction1 = cv::Point3f(0, 0, 0);
+		result.gaze_angle = cv::Vec2f(0, 0);
+		return;
+	}
+
+	if (left_part == -1 || right_part == -1)
+	{
+		std::cout << "Couldn't find the eye model, something wrong" << std::endl;
+		result.gaze_direction0 = cv::Point3f(0, 0, 0);
+		result.gaze_direction1 = cv::Point3f(0, 0, 0);
+		result.gaze_angle = cv::Vec2f(0, 0);
+		return;
+	}
+
+	cv::Vec6f headPose = LandmarkDetector::GetPose(clnf_model, fx, fy, cx, cy);
+	cv::Vec3f eulerAngles(headPose(3), headPose(4), headPose(5));
+	cv::Matx33f rotMat = Utilities::Euler2RotationMatrix(eulerAngles);
+
+	cv::Mat faceLdmks3d = clnf_model.GetShape(fx, fy, cx, cy);
+	faceLdmks3d = faceLdmks3d.t();
+
+	result.gaze_direction0 = GazeFromEye(eye_shapes[left_part], faceLdmks3d, rotMat, true);
+	result.gaze_direction1 = GazeFromEye(eye_shapes[right_part], faceLdmks3d, rotMat, false);
+	result.gaze_angle = GetGazeAngle(result.gaze_direction0, result.gaze_direction1);
+	result.valid = true;
 }
 
 cv::Vec2f GazeAnalysis::GetGazeAngle(cv::Point3f& gaze_vector_1, cv::Point3f& gaze_vector_2)
@@ -0,0 +1,100 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef ASYNC_FACE_DETECTOR_H
+#define ASYNC_FACE_DETECTOR_H
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// System includes
+#include <atomic>
+#include <functional>
+#include <thread>
+
+namespace LandmarkDetector
+{
+	//===========================================================================
+	/**
+	Running a face detection in the background, so that the (re)initialisation of tracking in videos does not stall the tracking thread.
+	At most one detection is in progress at a time, the result is picked up by the tracker once it is ready and is scaled to the frame it is used on.
+	Copies do not share the detection in progress, they start without one
+	*/
+	class AsyncFaceDetector
+	{
+	public:
+
+		AsyncFaceDetector();
+
+		// Waits for the detection in progress to complete
+		~AsyncFaceDetector();
+
+		AsyncFaceDetector(const AsyncFaceDetector& other);
+		AsyncFaceDetector & operator= (const AsyncFaceDetector& other);
+
+		// Starting the detection on a frame of the given size, detect should only use data it owns (e.g. copies of the frame)
+		// and fill in the bounding box of a face, returning if a face was found
+		void Start(const std::function<bool(cv::Rect_<float>&)>& detect, cv::Size frame_size);
+
+		// Is a detection in progress (that can be finished or not)
+		bool IsPending() const { return pending; }
+
+		// Has the detection in progress completed
+		bool IsReady() const { return pending && done; }
+
+		// Retrieve the result of a completed detection, scaling the bounding box if the frame is of a different size, this
+		// returns false if no face was found (or no detection is ready)
+		bool GetResult(cv::Rect_<float>& bounding_box, cv::Size current_frame_size);
+
+		// Waiting for the detection in progress to complete and discarding its result
+		void Cancel();
+
+	private:
+
+		// A plain thread rather than a TBB task, so that the detection runs in the background even when TBB is limited to a single thread
+		std::thread detection_thread;
+
+		bool pending;
+		std::atomic<bool> done;
+
+		// The result of the detection and the size of the frame it was computed on
+		bool face_found;
+		cv::Rect_<float> result;
+		cv::Size result_frame_size;
+
+	};
+	//===========================================================================
+}
+#endif // ASYNC_FACE_DETECTOR_H
@@ -0,0 +1,130 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef ASYNC_TRACKER_H
+#define ASYNC_TRACKER_H
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// System includes
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+
+#include "LandmarkDetectorModel.h"
+#include "LandmarkDetectorParameters.h"
+
+namespace LandmarkDetector
+{
+	// The tracking result of a frame processed by an AsyncTracker
+	struct TrackingResult
+	{
+		TrackingResult() : success(false), detection_certainty(0), time_stamp(0), frame_number(0) {}
+
+		bool success;
+		double detection_certainty;
+		double time_stamp;
+
+		// The frames submitted to the tracker are numbered from 0
+		long long frame_number;
+
+		// As in CLNF after the fit of the frame
+		cv::Mat_<float> detected_landmarks;
+		cv::Vec6f params_global;
+		cv::Mat_<float> params_local;
+		cv::Rect_<float> bounding_box;
+	};
+
+	//===========================================================================
+	/**
+	Tracking a face in a video without blocking the caller: the frames are submitted and the results come back through a future or a callback.
+	The frames of a tracker are processed one after the other in the order they were submitted, while the frames of different trackers are
+	processed concurrently as TBB tasks (in the arena of Utilities::Concurrency if one is set, otherwise in one shared by all of the trackers).
+	When the process is limited to a single thread there are no workers to run the tasks, so the frames are processed as they are submitted.
+	Every tracker owns its copy of the model (sharing the read only weights), which is only touched by the tasks
+	*/
+	class AsyncTracker
+	{
+	public:
+
+		// The model is copied, its face detectors are used for the (re)initialisation
+		AsyncTracker(const CLNF& face_model, const FaceModelParameters& params);
+
+		// Waits for the submitted frames to be processed
+		~AsyncTracker();
+
+		// Submitting the next frame, the grayscale image can be empty. The images are kept by reference until the frame is processed, so their
+		// buffers must not be written to before that (clone them otherwise). The callback is called on the thread that processed the frame
+		std::future<TrackingResult> Submit(const cv::Mat& rgb_image, const cv::Mat& grayscale_image, double time_stamp);
+		void Submit(const cv::Mat& rgb_image, const cv::Mat& grayscale_image, double time_stamp, const std::function<void(const TrackingResult&)>& callback);
+
+		// Starting a new sequence once the frames submitted so far are processed
+		void Reset();
+
+		// The number of frames submitted and not processed yet, and waiting for all of them
+		size_t Pending() const;
+		void Wait();
+
+		// The model, only to be used while there are no frames pending (e.g. after Wait)
+		const CLNF& GetModel() const { return model; }
+
+	private:
+
+		AsyncTracker(const AsyncTracker& other);
+		AsyncTracker & operator= (const AsyncTracker& other);
+
+		// Adding a task to the queue, starting to process the queue if it was idle
+		void Enqueue(const std::function<void()>& task);
+
+		// Processing the queued tasks until it is empty
+		void ProcessQueue();
+
+		TrackingResult Track(const cv::Mat& rgb_image, const cv::Mat& grayscale_image, double time_stamp);
+
+		CLNF model;
+		FaceModelParameters params;
+		long long frame_number;
+
+		mutable std::mutex queue_mutex;
+		std::condition_variable queue_idle;
+		std::deque<std::function<void()> > queue;
+		bool processing;
+	};
+	//===========================================================================
+}
+#endif // ASYNC_TRACKER_H
@@ -42,8 +42,38 @@
 // OpenCV includes
 #include <opencv2/core/core.hpp>
 
+#include "Gemm.h"
+#include "ModelBundle.h"
+
 namespace LandmarkDetector
 {
+	//===========================================================================
+	/**
+	Scratch memory for evaluating the CEN patch experts, it is kept by the caller between the calls (e.g. one per landmark) so that the intermediate
+	matrices are only allocated once instead of for every iteration of every frame. A workspace should not be used by several threads at the same time
+	*/
+	struct CEN_workspace
+	{
+		// The stacked im2col matrix of the areas of interest
+		cv::Mat_<float> im2col;
+
+		// The mirrored area of interest (for the mirrored patch experts)
+		cv::Mat_<float> area_of_interest_flipped;
+
+		// The outputs of consecutive layers alternate between the two
+		cv::Mat_<float> layer_outputs[2];
+
+		// The weights of every layer widened to float, for the half precision experts (one per layer, so that they keep their sizes)
+		std::vector<cv::Mat_<float> > weights_widened;
+
+		// The quantised layer input and the transposed output of the 8 bit inference
+		std::vector<signed char> input_quantised;
+		cv::Mat_<float> output_transposed;
+
+		// The responses interpolated to the full response maps (one row per area of interest)
+		cv::Mat_<float> responses_mapped;
+	};
+
 	//===========================================================================
 	/**
 	The classes describing the CEN patch experts
@@ -63,6 +93,18 @@ namespace LandmarkDetector
 		std::vector<cv::Mat_<float>> weights;
 
 		std::vector<int> activation_function;
+
+		// Optional 8 bit versions of the weights (with a scale per output channel), used instead of the float weights when present
+		std::vector<cv::Mat_<signed char>> weights_quantised;
+		std::vector<cv::Mat_<float>> weight_scales;
+
+		// The float weights of every layer packed (transposed) for GemmPacked when the expert is read, so that nothing is repacked per response.
+		// When present the float weights are empty, and the activations are kept with one sample per row throughout
+		std::vector<PackedMatrix> weights_packed;
+
+		// Optional half precision versions of the weights (float16 bit patterns, as stored by cv::convertFp16), when present the float weights are
+		// empty and each layer is widened to float just before its matrix multiplication, which halves the memory of the expert
+		std::vector<cv::Mat_<short>> weights_half;
 		
 		// Confidence of the current patch expert (used for NU_RLMS optimisation)
 		double  confidence;
@@ -75,16 +117,61 @@ namespace LandmarkDetector
 		// Reading in the patch expert
 		void Read(std::ifstream &stream);
 
+		// Reading and writing the patch expert using a model bundle (the weights will point to the bundle memory)
+		bool Read(const ModelBundle& bundle, const std::string& prefix);
+		void Write(ModelBundleWriter& bundle, const std::string& prefix) const;
+
 		// The actual response computation from intensity image
 		void Response(const cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response);
 
-		void ResponseInternal(cv::Mat_<float>& response);
+		// The network response given the im2col matrix of the input (one sample per row), the response has one column per sample
+		// When a workspace is provided the response points to its memory
+		void ResponseInternal(const cv::Mat_<float>& im2col, cv::Mat_<float>& response);
+		void ResponseInternal(const cv::Mat_<float>& im2col, cv::Mat_<float>& response, CEN_workspace& workspace);
+		void ResponseInternalQuantised(const cv::Mat_<float>& im2col, cv::Mat_<float>& response, CEN_workspace& workspace);
+		void ResponseInternalPacked(const cv::Mat_<float>& im2col, cv::Mat_<float>& response, CEN_workspace& workspace);
+
+		// The same, but on the OpenCL device through OpenCV transparent API, the (float) weights are uploaded on first use and stay on the device
+		void ResponseInternalDevice(const cv::Mat_<float>& im2col, cv::Mat_<float>& response);
+
+		// Switching between the float and the (faster, but slightly less accurate) 8 bit inference
+		void SetQuantised(bool quantised);
+
+		// Packing the float weights for GemmPacked and releasing the unpacked ones (done when the experts are read)
+		void PackWeights();
+
+		// Keeping only half precision weights from now on, the float ones are released (so it can not be undone)
+		void SetHalfPrecision();
+		bool IsHalfPrecision() const { return !weights_half.empty(); }
 
-		// For frontal faces can apply mirrored and non-mirrored experts at the same time
-		void ResponseSparse(const cv::Mat_<float> &area_of_interest_left, const cv::Mat_<float> &area_of_interest_right, cv::Mat_<float> &response_left, cv::Mat_<float> &response_right, cv::Mat_<float>& mapMatrix, cv::Mat_<float>& im2col_prealloc_left, cv::Mat_<float>& im2col_prealloc_right);
+		// The float weights of a layer, for the half precision and the packed experts they are widened or unpacked into the provided matrix
+		const cv::Mat_<float>& LayerWeights(size_t layer, cv::Mat_<float>& widened) const;
+
+		// For frontal faces can apply mirrored and non-mirrored experts at the same time (either of the areas can be empty),
+		// the responses are written into the provided matrices, so they are not reallocated if they already have the right size
+		void ResponseSparse(const cv::Mat_<float> &area_of_interest_left, const cv::Mat_<float> &area_of_interest_right, cv::Mat_<float> &response_left, cv::Mat_<float> &response_right, const cv::Mat_<float>& mapMatrix, CEN_workspace& workspace);
+
+		// The same as ResponseSparse, but coarse to fine (for large search windows): the expert is evaluated on a strided grid of the window, then densely
+		// around the peak of the grid, and the rest of the response is bilinearly interpolated from the grid
+		void ResponseCoarseToFine(const cv::Mat_<float> &area_of_interest_left, const cv::Mat_<float> &area_of_interest_right, cv::Mat_<float> &response_left, cv::Mat_<float> &response_right, CEN_workspace& workspace);
+
+		// Apply the patch expert to a number of areas of interest (e.g. same landmark across multiple faces) using a single matrix multiplication per layer,
+		// areas of interest marked as flipped are evaluated using the mirrored version of the expert. The network can be evaluated on the OpenCL device
+		void ResponseSparseBatch(const std::vector<cv::Mat_<float> >& areas_of_interest, const std::vector<bool>& flipped, std::vector<cv::Mat_<float> >& responses, const cv::Mat_<float>& mapMatrix, cv::Mat_<float>& im2col_prealloc, bool on_device = false);
+
+	private:
+
+		// The weights and biases on the OpenCL device (empty until the device is first used)
+		std::vector<cv::UMat> weights_device;
+		std::vector<cv::UMat> biases_device;
 
 	};
 
+	// Should the CEN patch experts read from now on keep their weights in half precision (-fp16_weights, see CEN_patch_expert::SetHalfPrecision),
+	// the ones read from a half precision model bundle always do
+	void SetHalfPrecisionWeights(bool half_precision);
+	bool GetHalfPrecisionWeights();
+
 	void interpolationMatrix(cv::Mat_<float>& mapMatrix, int response_height, int response_width, int input_width, int input_height);
 
 }
@@ -37,10 +37,31 @@
 // OpenCV includes
 #include <opencv2/core/core.hpp>
 
+#include "Gemm.h"
+#include "OnnxModel.h"
+
 using namespace std;
 
 namespace LandmarkDetector
 {
+	//===========================================================================
+	// The compute backend used for the matrix multiplications of the convolutional and fully connected layers (of MTCNN and the detection validator),
+	// and for the CEN patch experts when the landmarks of many faces are detected together (CLNF::DetectLandmarksBatch)
+	// The OpenCL backend goes through OpenCV transparent API, so it is only available if OpenCV was built with OpenCL and a device is present
+	// The ONNX Runtime backend runs the whole MTCNN and detection validator networks as exported ONNX models (through the execution provider set by
+	// SetOnnxExecutionProvider), it is only available when compiled with ONNX Runtime, the layers below keep using the CPU
+	enum CNNBackend { CPU_BACKEND, OPENCL_BACKEND, ONNXRUNTIME_BACKEND };
+
+	// The backend is selected for the whole process (as is the OpenCL context), returns false and keeps using the CPU if the backend is not available
+	bool SetCNNBackend(CNNBackend backend);
+	CNNBackend GetCNNBackend();
+
+	// Computes out = a * b using the selected backend
+	void matrix_multiply(const cv::Mat_<float>& a, const cv::Mat_<float>& b, cv::Mat_<float>& out);
+
+	// The same with b packed when the model was read (GemmPacked), on the OpenCL backend b is unpacked and multiplied on the device
+	void matrix_multiply(const cv::Mat_<float>& a, const PackedMatrix& b, cv::Mat_<float>& out);
+
 	//===========================================================================	
 	// Various CNN layers
 
@@ -56,7 +77,52 @@ namespace LandmarkDetector
 	// Convolution using FFT optimization rather than matrix multiplication, TODO do these still work
 	void convolution_fft2(std::vector<cv::Mat_<float> >& outputs, const std::vector<cv::Mat_<float> >& input_maps, const std::vector<std::vector<cv::Mat_<float> > >& kernels, const std::vector<float >& biases, vector<map<int, vector<cv::Mat_<double> > > >& precomp_dfts);
 	
-	// Convolution using matrix multiplication and OpenBLAS optimization, can also provide a pre-allocated im2col result for faster processing
-	void convolution_direct_blas(std::vector<cv::Mat_<float> >& outputs, const std::vector<cv::Mat_<float> >& input_maps, const cv::Mat_<float>& weight_matrix, int height_k, int width_k, cv::Mat_<float>& pre_alloc_im2col);
+	// The ways a convolutional layer can be computed
+	enum ConvolutionMethod { CONV_DIRECT, CONV_FFT, CONV_WINOGRAD };
+
+	// Winograd F(2x2, 3x3) convolution for 3x3 kernels, it works on 4x4 input tiles so the transformed input is 16/9 the size of the input instead of the
+	// 9 times of im2col, the multiplications are 16 small matrix multiplications. The kernels (laid out kernel -> input map) are transformed once by
+	// winograd_kernels_3x3, and the workspace is reused between calls if it is big enough
+	cv::Mat_<float> winograd_kernels_3x3(const std::vector<std::vector<cv::Mat_<float> > >& kernels);
+	void convolution_winograd_3x3(std::vector<cv::Mat_<float> >& outputs, const std::vector<cv::Mat_<float> >& input_maps, const cv::Mat_<float>& winograd_kernels, const std::vector<float >& biases, cv::Mat_<float>& workspace);
+
+	// Convolution using matrix multiplication with the weight matrix packed when the model was read, can also provide a pre-allocated im2col result
+	// for faster processing
+	void convolution_direct_blas(std::vector<cv::Mat_<float> >& outputs, const std::vector<cv::Mat_<float> >& input_maps, const PackedMatrix& weight_matrix, int height_k, int width_k, cv::Mat_<float>& pre_alloc_im2col);
+
+	// Batched versions of the above, for a number of inputs of the same size (laid out input -> maps), where a single matrix multiplication is performed for the whole batch
+	void convolution_direct_blas_batch(std::vector<std::vector<cv::Mat_<float> > >& outputs, const std::vector<std::vector<cv::Mat_<float> > >& input_maps, const PackedMatrix& weight_matrix, int height_k, int width_k, cv::Mat_<float>& pre_alloc_im2col);
+	void fully_connected_batch(std::vector<std::vector<cv::Mat_<float> > >& outputs, const std::vector<std::vector<cv::Mat_<float> > >& input_maps, cv::Mat_<float> weights, cv::Mat_<float> biases);
+
+	//===========================================================================
+	// Exporting the layers to an ONNX graph, with the same results as the layers above. The tensors are batched, maps are N x C x H x W and the
+	// column (or row) vectors of the fully connected layers are N x features
+
+	// What the CPU layers would hold for a tensor, feature maps, a single column vector or a single row vector
+	enum OnnxLayout { ONNX_MAPS, ONNX_COLUMN, ONNX_ROW };
+
+	struct OnnxTensor
+	{
+		std::string name;
+		OnnxLayout layout;
+
+		// The number of maps (or features)
+		int channels;
+	};
+
+	// The layers return false if the CPU layer would not support the input either, the convolution takes the weight matrix of convolution_direct_blas
+	bool OnnxConvolution(OnnxGraph& graph, OnnxTensor& tensor, const cv::Mat_<float>& weight_matrix, int height_k, int width_k);
+	bool OnnxMaxPooling(OnnxGraph& graph, OnnxTensor& tensor, int stride_x, int stride_y, int kernel_size_x, int kernel_size_y);
+	bool OnnxFullyConnected(OnnxGraph& graph, OnnxTensor& tensor, const cv::Mat_<float>& weights, const cv::Mat_<float>& biases);
+	bool OnnxPReLU(OnnxGraph& graph, OnnxTensor& tensor, const cv::Mat_<float>& prelu_weights);
+	void OnnxReLU(OnnxGraph& graph, OnnxTensor& tensor);
+	void OnnxSigmoid(OnnxGraph& graph, OnnxTensor& tensor);
+
+	// Adding the tensor as the output of the graph, vectors are given a third dimension (N x F x 1 for a column, N x 1 x F for a row) so that
+	// FromOnnxOutput can tell them apart
+	void OnnxOutput(OnnxGraph& graph, const OnnxTensor& tensor, const std::string& name);
+
+	// Converting the output of an exported network back to what the CPU layers output, laid out input -> outputs
+	void FromOnnxOutput(const std::vector<float>& output, const std::vector<int64_t>& output_shape, std::vector<std::vector<cv::Mat_<float> > >& outputs);
 }
 #endif // CNN_UTILS_H
@@ -0,0 +1,71 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef CPU_DISPATCH_H
+#define CPU_DISPATCH_H
+
+namespace LandmarkDetector
+{
+	// The hot kernels (the FHOG orientation binning, the mean-shift sums, the CEN bias and activation and the packed product) are compiled for AVX2 and AVX-512 as
+	// well as for the baseline (SSE) the rest of the library is built for (the OPENFACE_CPU_DISPATCH CMake option, x86 only), and the best
+	// variant the CPU supports is picked at runtime, so that a single build runs on old CPUs and makes use of the new ones
+
+	enum CpuLevel { CPU_LEVEL_BASELINE = 0, CPU_LEVEL_AVX2 = 1, CPU_LEVEL_AVX512 = 2 };
+
+	// The variant used, detected through cpuid on first use, it can be capped with the OPENFACE_CPU environment variable (baseline, avx2 or avx512)
+	CpuLevel GetCpuLevel();
+
+	// Lowering the variant used (e.g. to compare them), a level the CPU or the build does not support is capped to the supported one
+	void SetCpuLevel(CpuLevel level);
+
+	const char* GetCpuLevelName(CpuLevel level);
+
+	// The dispatched kernels, each processes the elements from start in full vectors of the selected variant and returns where it stopped (start
+	// itself for the baseline), the caller finishes the rest with its baseline SIMD and scalar loops
+	namespace Kernels
+	{
+		// Snapping the gradients to one of 18 orientations and computing their magnitude (from the squared magnitude)
+		int FHOGOrientationRow(const float* grad_x, const float* grad_y, float* grad_len, int* orientation, int start, int width);
+
+		// The sums of the response times the KDE, and of those times the x and y coordinates, added to sum, mx and my
+		int MeanShiftSums(const float* response, const float* kde, const float* coord_x, const float* coord_y, int start, int count, float& sum, float& mx, float& my);
+
+		// Adding the bias and applying the activation (0 the negated input of the sigmoid, 2 ReLU, otherwise none) in place
+		int BiasActivationRow(float* data, int start, int width, float bias, int activation);
+
+		// The rows of the product of X with a packed matrix (see GemmPacked), in blocks of rows
+		int GemmPackedRows(const float* X, int start, int num_rows, int ldx, const float* panels, int k, int n, const float* bias, int activation, float* out, int ldo);
+	}
+}
+#endif // CPU_DISPATCH_H
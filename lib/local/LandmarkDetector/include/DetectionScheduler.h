@@ -0,0 +1,88 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef DETECTION_SCHEDULER_H
+#define DETECTION_SCHEDULER_H
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// System includes
+#include <vector>
+
+namespace LandmarkDetector
+{
+	//===========================================================================
+	/**
+	Deciding when (and where) to run the face detector when tracking multiple faces. The frames are compared on a coarse grid with the frame of
+	the last detection, ignoring the areas covered by the tracked faces. A scene change triggers a detection over the whole image, a local change
+	a detection around the changed area, and otherwise the image is searched every detection interval. The interval doubles (up to a maximum)
+	while the detections in a static scene keep finding nothing, and goes back to the base interval when a new face is found
+	*/
+	class DetectionScheduler
+	{
+	public:
+
+		DetectionScheduler(int base_interval = 8, int max_interval = 64, int min_interval = 2);
+
+		// Whether to detect faces in this frame and if so in which region (in image coordinates, the whole image when there is no local change),
+		// free_slots is the number of faces that can still be tracked (-1 if not limited)
+		bool ShouldDetect(const cv::Mat_<uchar>& grayscale_image, const std::vector<cv::Rect_<float> >& tracked_boxes, int free_slots, cv::Rect& region);
+
+		// The result of a detection that was run, the number of faces it found that were not tracked already
+		void DetectionDone(int num_new_faces);
+
+		void Reset();
+
+		int GetCurrentInterval() const { return current_interval; }
+
+	private:
+
+		int base_interval;
+		int max_interval;
+		int min_interval;
+
+		// Grows while the detections find nothing
+		int current_interval;
+
+		int frames_since_detection;
+
+		// The coarse grid image at the last detection, and the one of the current frame (becoming the reference if a detection is run)
+		cv::Mat_<uchar> reference_grid;
+		cv::Mat_<uchar> current_grid;
+	};
+
+}
+#endif // DETECTION_SCHEDULER_H
@@ -0,0 +1,108 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef FACE_DETECTOR_HOG_H
+#define FACE_DETECTOR_HOG_H
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// System includes
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+namespace LandmarkDetector
+{
+	//===========================================================================
+	/**
+	A HOG-SVM face detector using the weights of the dlib frontal face detector (the dlib scan_fhog_pyramid<pyramid_down<6> > detector),
+	with a vectorised FHOG pyramid whose levels are scanned in parallel and with the scanning restricted to a region of interest
+	*/
+	class FaceDetectorHOG
+	{
+
+	public:
+
+		// Default constructor, the weights are copied on Read
+		FaceDetectorHOG() { ; }
+
+		// Taking the weights from the dlib frontal face detector
+		void Read();
+
+		// Indicate if the model has been read in
+		bool empty() const { return !model; }
+
+		// Detecting the faces in the part of the image within the roi (in pixels, an empty one is the whole image), the detections are in image
+		// coordinates, the confidences are the SVM scores above the threshold and levels of the pyramid that can only produce detections narrower than
+		// min_width are not scanned
+		bool DetectFaces(vector<cv::Rect_<float> >& o_regions, std::vector<float>& o_confidences, const cv::Mat_<uchar>& image, float adjust_threshold = 0,
+			cv::Rect roi = cv::Rect(), float min_width = -1) const;
+
+	private:
+
+		// A filter of the detector, with the 31 FHOG features of each of its cells stored contiguously (as in the FHOG images)
+		struct Filter
+		{
+			cv::Mat_<float> weights;
+			float threshold;
+		};
+
+		// The weights are read only, so they are shared between the copies of the detector (e.g. between the copies of CLNF)
+		struct Model
+		{
+			vector<Filter> filters;
+			int filter_rows;
+			int filter_cols;
+			int cell_size;
+			int padding;
+			int min_level_width;
+			int min_level_height;
+			int max_levels;
+
+			// The non maximum suppression of dlib::test_box_overlap
+			float iou_threshold;
+			float covered_threshold;
+		};
+
+		std::shared_ptr<const Model> model;
+
+		// The response of a filter over an FHOG image (padded by the size of the filter, as dlib does) at the positions the filter fits in
+		static void ApplyFilter(const cv::Mat_<float>& hog, int hog_cols, const Filter& filter, int filter_rows, int filter_cols, cv::Mat_<float>& response);
+
+	};
+
+}
+#endif // FACE_DETECTOR_HOG_H
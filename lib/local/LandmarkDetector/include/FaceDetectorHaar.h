@@ -0,0 +1,92 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef FACE_DETECTOR_HAAR_H
+#define FACE_DETECTOR_HAAR_H
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+#include <opencv2/objdetect.hpp>
+
+// System includes
+#include <string>
+#include <vector>
+
+#include "ImageContext.h"
+
+namespace LandmarkDetector
+{
+	//===========================================================================
+	/**
+	A Haar cascade face detector working on the greyscale pyramid of a shared frame (ImageContext), the frame is scanned from the smallest halving at
+	which the smallest face is still bigger than the cascade window. When OpenCV uses an OpenCL device the frame stays on it and the whole scan is
+	done there, otherwise the sizes of faces are split into octaves that are scanned in parallel, each on its own halving of the frame and with its
+	own copy of the cascade (a cascade can not be used by several threads at once)
+	*/
+	class FaceDetectorHaar
+	{
+
+	public:
+
+		FaceDetectorHaar() { ; }
+
+		// The cascades are loaded again by the copies on first use, as cv::CascadeClassifier can not be copied
+		FaceDetectorHaar(const FaceDetectorHaar& other) : location(other.location) { ; }
+		FaceDetectorHaar& operator=(const FaceDetectorHaar& other);
+
+		// Reading the cascade from an OpenCV cascade file, returns false if it could not be read
+		bool Read(const std::string& location);
+
+		// Indicate if the model has been read in
+		bool empty() const { return location.empty(); }
+
+		// The detections of the cascade in frame coordinates, of at least min_width pixels across (-1 for the default of 50) and grouped as
+		// cv::CascadeClassifier::detectMultiScale does with the parameters used by DetectFaces
+		bool DetectFaces(std::vector<cv::Rect>& o_detections, ImageContext& frame, float min_width = -1);
+
+	private:
+
+		// The number of octaves of face sizes scanned in parallel, the last one has no upper bound
+		static const int MAX_OCTAVES = 4;
+
+		std::string location;
+
+		// A cascade per octave, the first one is also used for the OpenCL scan
+		std::vector<cv::CascadeClassifier> cascades;
+
+		// Loading the cascades for as many octaves as needed
+		bool LoadCascades(int num_cascades);
+	};
+}
+#endif // FACE_DETECTOR_HAAR_H
@@ -38,10 +38,21 @@
 #include <opencv2/core/core.hpp>
 
 // System includes
+#include <map>
+#include <set>
 #include <vector>
 
+#include "ImageContext.h"
+#include "OnnxModel.h"
+
 using namespace std;
 
+namespace Utilities
+{
+	class MemoryReport;
+	class TuningCache;
+}
+
 namespace LandmarkDetector
 {
 	class CNN
@@ -51,7 +62,7 @@ namespace LandmarkDetector
 		//==========================================
 
 		// Default constructor
-		CNN() { ; }
+		CNN() : onnx_session(new LazyOnnxSession()) { ; }
 
 		// Copy constructor
 		CNN(const CNN& other);
@@ -59,23 +70,51 @@ namespace LandmarkDetector
 		// Given an image apply a CNN on it, the boolean direct controls if direct convolution is used (through matrix multiplication) or an FFT optimization
 		std::vector<cv::Mat_<float> > Inference(const cv::Mat& input_img, bool direct = true, bool thread_safe = false);
 
+		// Applying the CNN with a caller provided im2col workspace, so that the inference is thread safe as long as every
+		// task uses its own workspace, and the workspace can be reused across calls by the same task
+		std::vector<cv::Mat_<float> > Inference(const cv::Mat& input_img, std::vector<cv::Mat_<float> >& im2col_workspace, bool direct = true);
+
+		// Applying the CNN to a batch of images of the same size (e.g. face proposals), every layer is computed for the whole batch at once so that
+		// the convolutional and fully connected layers are single large matrix multiplications, the outputs are laid out image -> outputs
+		std::vector<std::vector<cv::Mat_<float> > > InferenceBatch(const std::vector<cv::Mat>& input_imgs, std::vector<cv::Mat_<float> >& im2col_workspace);
+
 		// Reading in the model
 		void Read(const string& location);
 
-		// Clearing precomputed DFTs
+		// Clearing precomputed DFTs (and the convolution choices relying on them)
 		void ClearPrecomp();
 
+		// Timing the direct (im2col + BLAS), FFT and for 3x3 kernels Winograd convolution of every convolutional layer for this input size and remembering
+		// the fastest one, which is then used by Inference when direct convolution is requested. Sizes that were not tuned use Winograd convolution for
+		// 3x3 kernels and im2col for the rest. As the FFT kernel spectra are precomputed here this is not thread safe, it should be done before the
+		// network is used concurrently
+		void TuneConvolutions(const cv::Size& input_size);
+
+		bool IsTuned(const cv::Size& input_size) const { return tuned_input_sizes.count(std::make_pair(input_size.height, input_size.width)) > 0; }
+
+		// Storing the tuned convolution choices in the cache as prefix + HxW/layer, and using the ones stored there (the kernel spectra the FFT
+		// choices rely on are precomputed, so like tuning this is not thread safe)
+		void ExportTuning(Utilities::TuningCache& cache, const string& prefix) const;
+		void ImportTuning(const Utilities::TuningCache& cache, const string& prefix);
+
 		size_t NumberOfLayers() { return cnn_layer_types.size(); }
 
+		// Exporting the network to an ONNX graph with an N x 3 x H x W (RGB) input called input and an output called output, the same as
+		// InferenceBatch computes. With the ONNX Runtime backend the exported network is what Inference and InferenceBatch run
+		bool ExportONNX(OnnxGraph& graph) const;
+
+		// Adding the memory of the weights, of the precomputed kernel spectra (component/dft) and of the im2col buffers (component/im2col) to the report
+		void ReportMemory(Utilities::MemoryReport& report, const string& component) const;
+
 	private:
 		//==========================================
 		// Convolutional Neural Network
 
 		// CNN layers
-		// Layer -> Weight matrix
-		vector<cv::Mat_<float> > cnn_convolutional_layers_weights;
+		// Layer -> Weight matrix (packed for GemmPacked)
+		vector<PackedMatrix> cnn_convolutional_layers_weights;
 
-		// Keeping some pre-allocated im2col data as malloc is a significant time cost (not thread safe though)
+		// Keeping some pre-allocated im2col data as malloc is a significant time cost (not thread safe, but every copy of the network keeps its own)
 		vector<cv::Mat_<float> > conv_layer_pre_alloc_im2col;
 
 		// Layer -> kernel -> input maps
@@ -92,6 +131,22 @@ namespace LandmarkDetector
 
 		// CNN: 0 - convolutional, 1 - max pooling, 2 - fully connected, 3 - prelu, 4 - sigmoid
 		vector<int > cnn_layer_types;
+
+		// The kernels of the 3x3 convolutional layers in the Winograd domain, empty for other kernel sizes
+		vector<cv::Mat_<float> > cnn_convolutional_layers_winograd;
+
+		// The tuned convolution choices, convolutional layer -> (input height, input width) -> ConvolutionMethod
+		vector<map<std::pair<int, int>, int> > conv_layer_methods;
+		std::set<std::pair<int, int> > tuned_input_sizes;
+
+		// The ONNX Runtime session of the network, shared by the copies
+		std::shared_ptr<LazyOnnxSession> onnx_session;
+
+		// The actual inference, when tuning every convolutional layer times both of the convolution methods and records the faster one
+		std::vector<cv::Mat_<float> > RunInference(const cv::Mat& input_img, std::vector<cv::Mat_<float> >& im2col_workspace, bool direct, bool tune);
+
+		// The inference through ONNX Runtime, returns false if the ONNX Runtime backend is not selected or the network could not be run
+		bool RunOnnx(const std::vector<cv::Mat>& input_imgs, std::vector<std::vector<cv::Mat_<float> > >& outputs);
 	};
 	//===========================================================================
 	//
@@ -105,7 +160,7 @@ namespace LandmarkDetector
 	public:
 
 		// Default constructor
-		FaceDetectorMTCNN() { ; }
+		FaceDetectorMTCNN() : autotune_convolutions(false) { ; }
 
 		FaceDetectorMTCNN(const string& location);
 
@@ -115,9 +170,47 @@ namespace LandmarkDetector
 		// Given an image, orientation and detected landmarks output the result of the appropriate regressor
 		bool DetectFaces(vector<cv::Rect_<float> >& o_regions, const cv::Mat& input_img, std::vector<float>& o_confidences, int min_face = 60, float t1 = 0.6, float t2 = 0.7, float t3 = 0.7);
 
+		// The same on a frame shared with the other users of it (the landmark fitting and other detections on the same frame)
+		bool DetectFaces(vector<cv::Rect_<float> >& o_regions, ImageContext& image, std::vector<float>& o_confidences, int min_face = 60, float t1 = 0.6, float t2 = 0.7, float t3 = 0.7);
+
+		// Also returning the five facial keypoints ONet regresses for every face (left eye, right eye, nose tip, left and right mouth corner in
+		// the image), empty if the model does not output them
+		bool DetectFaces(vector<cv::Rect_<float> >& o_regions, ImageContext& image, std::vector<float>& o_confidences, vector<vector<cv::Point2f> >& o_keypoints,
+			int min_face = 60, float t1 = 0.6, float t2 = 0.7, float t3 = 0.7);
+
+		// Detecting the faces in a number of images at once (e.g. a batch of photos), the outputs are laid out image -> faces. The networks are applied
+		// to the pyramid levels of the same sized images and to the proposals of all of the images together, which amortises the per layer overheads
+		bool DetectFacesBatch(vector<vector<cv::Rect_<float> > >& o_regions, vector<vector<float> >& o_confidences, vector<vector<vector<cv::Point2f> > >& o_keypoints,
+			const vector<cv::Mat>& images, int min_face = 60, float t1 = 0.6, float t2 = 0.7, float t3 = 0.7);
+
+		// A quicker version for when only a single face is needed (the one closest to the preference point if set, otherwise the biggest one),
+		// if the expected face size is known the maximum bounds the scales searched
+		bool DetectSingleFace(cv::Rect_<float>& o_region, float& o_confidence, const cv::Mat& input_img, cv::Point preference = cv::Point(-1, -1), int min_face = 60, int max_face = -1,
+			float t1 = 0.6, float t2 = 0.7, float t3 = 0.7);
+		bool DetectSingleFace(cv::Rect_<float>& o_region, float& o_confidence, ImageContext& image, cv::Point preference = cv::Point(-1, -1), int min_face = 60, int max_face = -1,
+			float t1 = 0.6, float t2 = 0.7, float t3 = 0.7);
+		bool DetectSingleFace(cv::Rect_<float>& o_region, float& o_confidence, vector<cv::Point2f>& o_keypoints, ImageContext& image, cv::Point preference = cv::Point(-1, -1),
+			int min_face = 60, int max_face = -1, float t1 = 0.6, float t2 = 0.7, float t3 = 0.7);
+
 		// Reading in the model
 		void Read(const string& location);
 
+		// Writing the three networks as pnet.onnx, rnet.onnx and onet.onnx to the directory (see CNN::ExportONNX)
+		bool WriteONNX(const string& directory) const;
+
+		// Adding the memory of the three networks to the report under component/pnet, component/rnet and component/onet
+		void ReportMemory(Utilities::MemoryReport& report, const string& component) const;
+
+		// Should the PNet convolution methods be tuned for every new image size (the first detection on an image of a new size is slower)
+		void SetConvolutionAutotuning(bool autotune) { autotune_convolutions = autotune; }
+
+		// Tuning the PNet convolutions of all of the pyramid levels of images of this size
+		void TuneConvolutions(const cv::Size& image_size, int min_face = 60, int max_face = -1);
+
+		// The tuned PNet convolutions are stored as mtcnn/pnet/HxW/layer, reading the model imports the ones of the global tuning cache
+		void ExportTuning(Utilities::TuningCache& cache) const;
+		void ImportTuning(const Utilities::TuningCache& cache);
+
 		// Indicate if the model has been read in
 		bool empty() { return PNet.NumberOfLayers() == 0 || RNet.NumberOfLayers() == 0 || ONet.NumberOfLayers() == 0; };
 
@@ -128,6 +221,12 @@ namespace LandmarkDetector
 		CNN PNet;
 		CNN RNet;
 		CNN ONet;
+
+		bool autotune_convolutions;
+
+		// The PNet and RNet stages shared by the detection methods
+		void ProposeFaces(vector<cv::Rect_<float> >& proposal_boxes, vector<float>& scores, vector<cv::Rect_<float> >& proposal_corrections,
+			ImageContext& image, int min_face_size, int max_face_size, float t1, float t2);
 		
 	};
 
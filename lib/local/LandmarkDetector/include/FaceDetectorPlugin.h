@@ -0,0 +1,68 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef FACE_DETECTOR_PLUGIN_H
+#define FACE_DETECTOR_PLUGIN_H
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// System includes
+#include <vector>
+
+#include "ImageContext.h"
+
+namespace LandmarkDetector
+{
+	//===========================================================================
+	/**
+	A face detector supplied by the embedder (see CLNF::SetFaceDetector), used for the (re)initialisation of tracking instead of the built in
+	detectors. This is the only way to detect faces in the slim build (OPENFACE_SLIM_LANDMARK_DETECTOR) apart from MTCNN, which leaves out dlib,
+	the Haar cascade and the HOG-SVM detectors. The same detector is shared by all the copies of a model and can be run from the background
+	detection, so it has to be safe to use from several threads at once
+	*/
+	class FaceDetectorPlugin
+	{
+
+	public:
+
+		virtual ~FaceDetectorPlugin() { ; }
+
+		// The faces in the frame as the bounding boxes CLNF expects (around the 68 landmarks, as the built in detectors correct theirs to), with
+		// a confidence for each (higher is more confident, all the same if the detector does not score them). The colour frame is in
+		// frame.Colour() and the greyscale one in frame.GrayHalved(0). Returns false if no faces were found
+		virtual bool DetectFaces(std::vector<cv::Rect_<float> >& o_regions, std::vector<float>& o_confidences, ImageContext& frame) = 0;
+	};
+}
+#endif // FACE_DETECTOR_PLUGIN_H
@@ -0,0 +1,114 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef FACE_TRACKLETS_H
+#define FACE_TRACKLETS_H
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// System includes
+#include <vector>
+
+#include "LandmarkDetectorModel.h"
+
+namespace LandmarkDetector
+{
+	// A cheap appearance signature of a face, its box downsampled to a small patch normalised to zero mean and unit norm
+	cv::Mat_<float> ComputeFaceSignature(const cv::Mat_<uchar>& grayscale_image, const cv::Rect_<float>& face_box);
+
+	// The normalised correlation of two signatures in [-1, 1], -1 if either is empty
+	float CompareFaceSignatures(const cv::Mat_<float>& signature_a, const cv::Mat_<float>& signature_b);
+
+	// Intersection over union of two boxes
+	float BoxOverlap(const cv::Rect_<float>& box_a, const cv::Rect_<float>& box_b);
+
+	// The minimum cost assignment of rows to columns (Hungarian algorithm), the matrix does not have to be square. Returns the column assigned
+	// to every row, -1 if the row is not assigned (more rows than columns) or only has a cost of at least max_cost
+	std::vector<int> SolveAssignment(const cv::Mat_<double>& cost, double max_cost);
+
+	//===========================================================================
+	/**
+	Keeping the identities of the faces in multiple face tracking. Detections are associated with the faces being tracked (by overlap) and
+	with the recently lost faces (by overlap and an appearance signature), so that a face that is re-acquired keeps its id and resumes from
+	its cached shape and rotation instead of being initialised from scratch
+	*/
+	class FaceTracklets
+	{
+	public:
+
+		// Detection association results, otherwise the id of the lost face a detection re-acquires
+		enum { NEW_FACE = -1, TRACKED_FACE = -2 };
+
+		explicit FaceTracklets(int max_frames_lost = 150);
+
+		// The id for a face seen for the first time
+		int NewId() { return next_id++; }
+
+		// Associating the detections of a frame with the boxes of the active trackers and with the lost faces, returning NEW_FACE,
+		// TRACKED_FACE or the id of the lost face for every detection
+		std::vector<int> Associate(const cv::Mat_<uchar>& grayscale_image, const std::vector<cv::Rect_<float> >& detections, const std::vector<cv::Rect_<float> >& tracked_boxes) const;
+
+		// Remembering a face that stopped being tracked, with its last signature (from a successfully tracked frame)
+		void AddLost(int id, const CLNF& model, const cv::Mat_<float>& signature);
+
+		// Initialising the model from the cached parameters of the lost face at the detection, the face is no longer lost afterwards
+		bool Resume(int id, const cv::Rect_<float>& detection, CLNF& model);
+
+		// Advancing to the next frame, the faces lost for longer than max_frames_lost are forgotten
+		void NextFrame();
+
+		// Forgetting all of the faces (e.g. for a new video), the ids start again from 0
+		void Clear();
+
+	private:
+
+		struct LostFace
+		{
+			int id;
+			cv::Rect_<float> box;
+			cv::Mat_<float> signature;
+			cv::Mat_<float> params_local;
+			cv::Vec3f rotation;
+			int frames_lost;
+		};
+
+		std::vector<LostFace> lost_faces;
+		int max_frames_lost;
+		int next_id;
+	};
+
+}
+#endif // FACE_TRACKLETS_H
@@ -0,0 +1,109 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef GEMM_H
+#define GEMM_H
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+namespace LandmarkDetector
+{
+	// The matrix multiplication used by the patch experts, the PDM and the CNNs. The BLAS library behind it is selected when building
+	// (the OPENFACE_BLAS CMake option: OpenBLAS, MKL, BLIS or Accelerate), while the small products (e.g. the CCNF response times the
+	// sigma matrices) are computed by a built-in kernel, as the BLAS call overhead is larger than the work for them. The single shape PDM
+	// products have their own fixed size kernels in PDM.cpp
+
+	// C = alpha * op(A) * op(B) + beta * C, with the matrices stored in column major order as in BLAS (op(A) is m x k, op(B) is k x n and C is m x n).
+	// OpenCV matrices are row major, so a row major product is computed by swapping A and B (and m and n)
+	void Gemm(bool transpose_a, bool transpose_b, int m, int n, int k, float alpha, const float* A, int lda, const float* B, int ldb, float beta, float* C, int ldc);
+
+	// Setting the number of threads used within the BLAS library, the tracking is multi-threaded outside of it so this is set to 1 when the models are read
+	void SetBlasThreads(int num_threads);
+
+	// The name of the BLAS library the calls go to
+	const char* GetBlasBackendName();
+
+	// The number of columns of a panel of a packed matrix, two AVX2 or one AVX-512 register
+	const int GEMM_PANEL_WIDTH = 16;
+
+	//===========================================================================
+	/**
+	The constant right hand side of a product (the weights of a layer) packed once, when the model is read, into the layout the packed product
+	kernel reads: panels of GEMM_PANEL_WIDTH columns, each stored row after row, so that the kernel streams every panel with aligned vector loads.
+	The columns of the last panel are zero padded and the panels are aligned to cache lines. A BLAS library instead repacks its operands on every
+	call, which for the small and frequently repeated products of the patch experts and the CNNs is a noticeable part of the work.
+	Copies share the packed memory
+	*/
+	class PackedMatrix
+	{
+	public:
+
+		PackedMatrix() : rows(0), cols(0), offset(0) {}
+
+		// Packing a rows x cols matrix, or its transpose (for weights stored an output per row, e.g. the CEN layers)
+		void Pack(const cv::Mat_<float>& matrix, bool transpose = false);
+
+		// The matrix that was packed (transposed again if it was packed transposed)
+		void Unpack(cv::Mat_<float>& matrix, bool transpose = false) const;
+
+		bool empty() const { return rows == 0 || cols == 0; }
+
+		// The size of the packed matrix (after the transpose)
+		int Rows() const { return rows; }
+		int Cols() const { return cols; }
+		int NumPanels() const { return (cols + GEMM_PANEL_WIDTH - 1) / GEMM_PANEL_WIDTH; }
+
+		const float* Panels() const { return (const float*)storage.data + offset; }
+
+		// The memory holding the panels, for memory reports
+		const cv::Mat& Storage() const { return storage; }
+
+	private:
+
+		int rows;
+		int cols;
+
+		// The panels start offset floats into the storage, at a cache line boundary
+		cv::Mat_<float> storage;
+		size_t offset;
+	};
+
+	// out = X * B, where X is num_rows x B.Rows() (row major, rows ldx floats apart) and out is num_rows x B.Cols() (rows ldo floats apart). A bias per
+	// column (can be 0) and an activation (0 the negated input of the sigmoid, 2 ReLU, otherwise none, as Kernels::BiasActivationRow) are applied
+	// as the results are written. The accumulation order is fixed, so all of the CPU variants return the same results
+	void GemmPacked(const float* X, int num_rows, int ldx, const PackedMatrix& B, const float* bias, int activation, float* out, int ldo);
+}
+#endif // GEMM_H
@@ -0,0 +1,114 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef IMAGE_CONTEXT_H
+#define IMAGE_CONTEXT_H
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// System includes
+#include <mutex>
+#include <vector>
+
+namespace LandmarkDetector
+{
+	//===========================================================================
+	/**
+	A greyscale frame shared by all of the models fitting on it (the hierarchical part models, the faces in the multi-face path, the hypotheses when
+	detecting in images). The patch experts sample the 8 bit image directly, a floating point version is converted lazily in blocks for the users
+	that need one, so that only the regions they look at are converted, and every region is only converted once. It is safe to use from several
+	threads at once
+
+	In video the same context is also used by the face detectors run on the frame (tracking and re-detection on the same frame then share it), for
+	them it keeps the colour frame and a pyramid of its halvings built on demand, from which the detector scales are resized, and the same for the
+	greyscale frame as UMat (kept on the OpenCL device when OpenCV uses one) for the Haar cascade
+	*/
+	class ImageContext
+	{
+	public:
+
+		explicit ImageContext(const cv::Mat_<uchar>& image);
+
+		// When only the floating point image is available, it is then treated as already converted
+		explicit ImageContext(const cv::Mat_<float>& image_float);
+
+		// A colour frame (or a greyscale one, which is then expanded to three channels when needed) together with its greyscale version, the
+		// latter can be empty when only the face detectors use the context
+		ImageContext(const cv::Mat& colour_image, const cv::Mat_<uchar>& image);
+
+		// The greyscale image (empty if constructed from a floating point one)
+		const cv::Mat_<uchar>& Gray() const { return image; }
+
+		// The floating point image, of which (at least) the given region is converted, the rest of it should not be read
+		const cv::Mat_<float>& Float(const cv::Rect& region);
+
+		// The whole of the floating point image
+		const cv::Mat_<float>& Float() { return Float(cv::Rect(0, 0, image_float.cols, image_float.rows)); }
+
+		// The three channel 8 bit frame
+		const cv::Mat& Colour();
+
+		// The colour frame resized to the given size, resized from the smallest halving of the frame that is still at least as big (so repeated
+		// resizes of the same frame only read the full resolution once)
+		cv::Mat ColourResized(const cv::Size& size);
+
+		// The greyscale frame halved the given number of times (clamped to the levels there are), built on first use from the previous halving,
+		// on the OpenCL device if OpenCV uses one. Converted from the colour frame if only that was given
+		cv::UMat GrayHalved(int level);
+
+	private:
+
+		// Not copyable, as it is shared instead
+		ImageContext(const ImageContext& other);
+		ImageContext & operator= (const ImageContext& other);
+
+		static const int BLOCK_SIZE = 64;
+		static const int MAX_PYRAMID_LEVELS = 8;
+
+		cv::Mat_<uchar> image;
+		cv::Mat_<float> image_float;
+
+		// Which BLOCK_SIZE x BLOCK_SIZE blocks of the floating point image are converted
+		cv::Mat_<uchar> converted_blocks;
+
+		std::mutex conversion_mutex;
+
+		// The colour frame and its halvings, level 0 is set on construction (if given), the rest on first use
+		std::vector<cv::Mat> colour_pyramid;
+		std::vector<cv::UMat> gray_pyramid;
+		std::mutex pyramid_mutex;
+	};
+}
+#endif // IMAGE_CONTEXT_H
@@ -39,13 +39,20 @@
 #include <opencv2/core/core.hpp>
 
 // System includes
+#include <memory>
 #include <vector>
 
 // Local includes
 #include "PAW.h"
+#include "OnnxModel.h"
 
 using namespace std;
 
+namespace Utilities
+{
+	class MemoryReport;
+}
+
 namespace LandmarkDetector
 {
 //===========================================================================
@@ -71,7 +78,7 @@ public:
 	// CNN layers for each view
 	// view -> layer
 	vector<vector<vector<vector<cv::Mat_<float> > > > > cnn_convolutional_layers;
-	vector<vector<cv::Mat_<float> > > cnn_convolutional_layers_weights;
+	vector<vector<PackedMatrix> > cnn_convolutional_layers_weights;
 	vector<vector<cv::Mat_<float> > > cnn_convolutional_layers_im2col_precomp;
 
 	vector< vector<int> > cnn_subsampling_layers;
@@ -95,18 +102,34 @@ public:
 	// Given an image, orientation and detected landmarks output the result of the appropriate regressor
 	float Check(const cv::Vec3d& orientation, const cv::Mat_<uchar>& intensity_img, cv::Mat_<float>& detected_landmarks);
 
+	// The same for a number of detections in the same image (e.g. multiple faces), the CNN is run once for all of the detections of the same view
+	void CheckBatch(const vector<cv::Vec3d>& orientations, const cv::Mat_<uchar>& intensity_img, const vector<cv::Mat_<float> >& detected_landmarks, vector<float>& certainties);
+
 	// Reading in the model
 	void Read(string location);
 			
 	// Getting the closest view center based on orientation
 	int GetViewId(const cv::Vec3d& orientation) const;
 
+	// Exporting the CNN of a view to an ONNX graph with an N x 1 x H x W input (the warped and normalised faces) called input and an output
+	// called output (the N x 1 x bins class scores), with the ONNX Runtime backend the exported CNNs are what CheckCNN runs
+	bool ExportONNX(int view_id, OnnxGraph& graph) const;
+
+	// Adding the memory of the CNNs, the normalisations and the warps of every view to the report under component/view_<n>
+	void ReportMemory(Utilities::MemoryReport& report, const string& component) const;
+
 private:
 
+	// The ONNX Runtime sessions of the views, shared by the copies
+	vector<std::shared_ptr<LazyOnnxSession> > onnx_sessions;
+
 	// The actual regressor application on the image
 
-	// Convolutional Neural Network
-	double CheckCNN(const cv::Mat_<float>& warped_img, int view_id);
+	// Convolutional Neural Network, applied to a batch of inputs of the same view
+	void CheckCNN(const vector<cv::Mat_<float> >& cnn_inputs, int view_id, vector<double>& decisions);
+
+	// Cropping and warping a detection to the input of the CNN of the view
+	bool WarpToReference(const cv::Mat_<uchar>& intensity_img, const cv::Mat_<float>& detected_landmarks, int view_id, cv::Mat_<float>& cnn_input);
 
 	// A normalisation helper
 	void NormaliseWarpedToVector(const cv::Mat_<float>& warped_img, cv::Mat_<float>& feature_vec, int view_id);
@@ -58,6 +58,21 @@ namespace LandmarkDetector
 	bool DetectLandmarksInVideo(const cv::Mat &rgb_image, CLNF& clnf_model, FaceModelParameters& params, cv::Mat &grayscale_image);
 	bool DetectLandmarksInVideo(const cv::Mat &rgb_image, const cv::Rect_<double> bounding_box, CLNF& clnf_model, FaceModelParameters& params, cv::Mat &grayscale_image);
 
+	// Landmark detection in a video frame with its time stamp in seconds, used by the motion prediction (FaceModelParameters::motion_prediction)
+	// to start the fit where the face is expected to be, without it the frames are assumed to be equally spaced
+	bool DetectLandmarksInVideo(const cv::Mat &rgb_image, CLNF& clnf_model, FaceModelParameters& params, cv::Mat &grayscale_image, double time_stamp);
+
+	// Landmark detection in a video frame that has to finish by the deadline (e.g. the arrival of the next frame), when it is about to be
+	// missed the quality is degraded progressively, clnf_model.deadline_degradations reports the degradations applied (DeadlineDegradation flags)
+	// The version without a deadline uses FaceModelParameters::frame_deadline_ms (if set) from the start of the call
+	bool DetectLandmarksInVideo(const cv::Mat &rgb_image, CLNF& clnf_model, FaceModelParameters& params, cv::Mat &grayscale_image, std::chrono::steady_clock::time_point deadline);
+
+	// Tracking multiple faces in the same frame, the models have to be copies of the same model as the patch expert responses are computed for all of them at once
+	// Only the active models are updated, re-detection of lost faces is left to the caller
+	void DetectLandmarksInVideo(const cv::Mat &rgb_image, vector<CLNF>& clnf_models, vector<FaceModelParameters>& params, const vector<bool>& active_models, cv::Mat &grayscale_image);
+	// The same for models that are not stored together (e.g. a pool of trackers), all of the models passed in are updated
+	void DetectLandmarksInVideo(const cv::Mat &rgb_image, const vector<CLNF*>& clnf_models, const vector<FaceModelParameters*>& params, cv::Mat &grayscale_image);
+
 	//================================================================================================================
 	// Landmark detection in image, need to provide an image and optionally CLNF model together with parameters (default values work well)
 	// Optionally can provide a bounding box in which detection is performed (this is useful if multiple faces are to be detected in images)
@@ -66,6 +81,14 @@ namespace LandmarkDetector
 	bool DetectLandmarksInImage(const cv::Mat &rgb_image, CLNF& clnf_model, FaceModelParameters& params, cv::Mat &grayscale_image);
 	// Providing a bounding box
 	bool DetectLandmarksInImage(const cv::Mat &rgb_image, const cv::Rect_<double> bounding_box, CLNF& clnf_model, FaceModelParameters& params, cv::Mat &grayscale_image);
+	// Providing a bounding box and the MTCNN keypoints of the face (see FaceDetectorMTCNN::DetectFaces), the orientation estimated from them
+	// replaces the rotation hypotheses (or with multi_view only the ones near it are tried)
+	bool DetectLandmarksInImage(const cv::Mat &rgb_image, const cv::Rect_<double> bounding_box, const vector<cv::Point2f>& keypoints, CLNF& clnf_model, FaceModelParameters& params,
+		cv::Mat &grayscale_image);
+
+	// Estimating the in-plane and out-of-plane (yaw) rotation of a face from the five MTCNN keypoints, by matching them to the corresponding
+	// points of the (68 point) shape model. Returns false if the model or the keypoints do not allow it
+	bool EstimateRotationFromKeypoints(const PDM& pdm, const vector<cv::Point2f>& keypoints, cv::Vec3d& rotation);
 
 	//================================================================
 	// Helper function for getting head pose from CLNF parameters
@@ -36,24 +36,104 @@
 #define LANDMARK_DETECTOR_MODEL_H
 
 // OpenCV dependencies
+#include <chrono>
+#include <memory>
+
 #include <opencv2/core/core.hpp>
+
+#ifndef OPENFACE_SLIM_LANDMARK_DETECTOR
 #include <opencv2/objdetect.hpp>
 
 // dlib dependencies for face detection
 #include <dlib/image_processing/frontal_face_detector.h>
 #include <dlib/opencv.h>
+#endif
 
 #include "PDM.h"
 #include "Patch_experts.h"
 #include "LandmarkDetectionValidator.h"
 #include "LandmarkDetectorParameters.h"
+#ifndef OPENFACE_SLIM_LANDMARK_DETECTOR
+#include "FaceDetectorHaar.h"
+#include "FaceDetectorHOG.h"
+#endif
 #include "FaceDetectorMTCNN.h"
+#include "FaceDetectorPlugin.h"
+#include "ModelBundle.h"
+#include "AsyncFaceDetector.h"
+#include "ImageContext.h"
 
 using namespace std;
 
 namespace LandmarkDetector
 {
 
+// Quantities derived from the current fit of a model (computed on first use), so that all of the consumers of a frame (visualisation, recording,
+// gaze) share one computation, they are only reused while the fit they were computed from (the landmarks and parameters) stays the same
+struct FrameResult
+{
+	FrameResult() : has_state(false), has_shape(false), has_pose(false), has_visibilities(false) {}
+
+	// The fit the results belong to
+	bool has_state;
+	cv::Mat_<float> detected_landmarks;
+	cv::Mat_<float> params_local;
+	cv::Vec6f params_global;
+
+	// The 3D shape (as CLNF::GetShape) and the pose (as GetPose) for the camera they were computed with (fx, fy, cx, cy)
+	bool has_shape;
+	cv::Vec4f shape_camera;
+	cv::Mat_<float> shape_3D;
+
+	bool has_pose;
+	cv::Vec4f pose_camera;
+	cv::Vec6f pose;
+
+	bool has_visibilities;
+	cv::Mat_<int> visibilities;
+};
+
+// The quality degradations that can be applied to a fit to meet a frame deadline, combined as flags in CLNF::deadline_degradations
+enum DeadlineDegradation
+{
+	DEGRADATION_NONE = 0,
+	DEGRADATION_FEWER_ITERATIONS = 1,		// the NU_RLMS iterations were stopped before convergence
+	DEGRADATION_SKIPPED_SCALES = 2,			// coarse scales were skipped, only the finer ones were fit
+	DEGRADATION_SKIPPED_REFINEMENT = 4,		// the hierarchical refinement was skipped
+	DEGRADATION_DEFERRED_VALIDATION = 8		// the validation of a steady track was postponed to a later frame
+};
+
+// A constant velocity model of the rigid parameters (scale, rotation and translation) of a tracked face, used to start the fit of the next
+// frame where the face is expected to be instead of where it was. The velocity is smoothed over the successfully tracked frames and is
+// measured in parameter change per second of the frame time stamps (or per frame when the time stamps do not advance)
+class RigidMotionPredictor
+{
+public:
+
+	RigidMotionPredictor() { Reset(); }
+
+	// Forgetting the motion, e.g. when the track is lost or reinitialised
+	void Reset();
+
+	// Adding the parameters of a successfully tracked frame
+	void Update(const cv::Vec6f& params_global, double time_stamp);
+
+	// Predicting the parameters at the time stamp, the prediction is damped (0 keeps the last parameters, 1 extrapolates the full velocity).
+	// Returns false if there is not enough motion history for a prediction
+	bool Predict(double time_stamp, float damping, cv::Vec6f& params_global) const;
+
+private:
+
+	// The time step to use when the time stamps do not advance
+	double FrameStep(double time_stamp) const;
+
+	int num_updates;
+	cv::Vec6f last_params;
+	double last_time;
+	double last_step;
+	cv::Vec6f velocity;
+};
+
 // A main class containing all the modules required for landmark detection
 // Face shape model
 // Patch experts
@@ -84,20 +164,34 @@ public:
 	vector<vector<pair<int,int>>>	hierarchical_mapping;
 	vector<FaceModelParameters>		hierarchical_params;
 
+	// Was a hierarchical part refined in the last fit, the others (skipped, self occluded or too small, see FaceModelParameters::gate_parts)
+	// just follow the main model, so the outputs derived from them such as gaze should not be relied on
+	vector<char>					hierarchical_part_valid;
+
 	//==================== Helpers for face detection and landmark detection validation =========================================
 
 	// TODO these should be static, and loading should be made easier
 
+#ifndef OPENFACE_SLIM_LANDMARK_DETECTOR
 	// Haar cascade classifier for face detection
 	cv::CascadeClassifier   face_detector_HAAR;
 	string                  haar_face_detector_location;
+	// The same cascade working on the shared frame (on the OpenCL device if OpenCV uses one, scales scanned in parallel otherwise), used in video
+	FaceDetectorHaar		face_detector_HAAR_frame;
 	
 	// A HOG SVM-struct based face detector
-	dlib::frontal_face_detector face_detector_HOG;
+	FaceDetectorHOG			face_detector_HOG;
+#endif
 
 	FaceDetectorMTCNN		face_detector_MTCNN;
 	string                  mtcnn_face_detector_location;
 
+	// A face detector supplied by the embedder, used instead of the above when set (shared by the copies of the model)
+	std::shared_ptr<FaceDetectorPlugin> face_detector_plugin;
+
+	// Background face detection for reinitialisation in videos (uses the above detectors, so it is declared after them to finish before they are destroyed)
+	AsyncFaceDetector		async_face_detector;
+
 	// Validate if the detected landmarks are correct using an SVR regressor
 	DetectionValidator	landmark_validator; 
 
@@ -133,6 +227,47 @@ public:
 	// A template of a face that last succeeded with tracking (useful for large motions in video)
 	cv::Mat_<uchar> face_template;
 
+	// The scaling from the image to the template, the correlation of the last match of the template and the frames since it was extracted
+	float face_template_scaling;
+	float face_template_correlation;
+	int face_template_age;
+
+	// The coarse colour histogram of the previous video frame, for detecting cuts
+	cv::Mat_<float> scene_histogram;
+
+	// The pyramid level of the frame the model is fit at in the adaptive resolution mode (FaceModelParameters::adaptive_resolution), the
+	// face template, the propagation frame and the motion prediction are kept at this level, the rest of the state is in frame coordinates
+	int working_level;
+
+	// When only fitting every n-th frame, the frame the landmarks were last found in (to propagate them from) and the number of
+	// frames propagated since the last full fit
+	cv::Mat_<uchar> propagation_frame;
+	int frames_since_full_fit;
+
+	// The number of tracked frames since the last successful validation (-1 if the next frame has to be validated) and the model
+	// likelihood at that validation
+	int frames_since_validation;
+	float validated_likelihood;
+
+	// The bounding box of the landmarks in the last successfully tracked frame and the number of detections that failed since, used for
+	// searching for the face around its last location before falling back to the full frame
+	cv::Rect_<float> last_face_box;
+	int roi_detection_misses;
+
+	// The rotation of the face in the last successfully tracked frame (meaningful while last_face_box is set), the multi-hypothesis
+	// re-initialisation tries the rotation hypotheses closest to it first
+	cv::Vec3f last_face_rotation;
+
+	// How often each of the multi-view rotation hypotheses gave the successful multi-hypothesis fits of the model so far, without a prior on
+	// the rotation the hypotheses are tried in the order of their wins (ties broken by it otherwise)
+	vector<int> rotation_hypothesis_wins;
+
+	// The motion of the face over the last tracked frames, for predicting where to start the fit in the next one
+	RigidMotionPredictor motion_predictor;
+
+	// The degradations (DeadlineDegradation flags) applied to the last frame to meet its deadline
+	int deadline_degradations;
+
 	// Useful when resetting or initialising the model closer to a specific location (when multiple faces are present)
 	cv::Point_<double> preference_det;
 
@@ -145,13 +280,14 @@ public:
 	// A default constructor
 	CLNF();
 
-	// Constructor from a model file
-	CLNF(string fname);
+	// Constructor from a model file, with a local model copy a model bundle is read into memory of the model instead of being mapped, which
+	// places the weights on the NUMA node of the reading thread (for a replica of the model per node, see ModelBundle::Open)
+	CLNF(string fname, bool local_model_copy = false);
 	
-	// Copy constructor (makes a deep copy of the detector)
+	// Copy constructor (copies the tracking state, the model weights are read only and shared between the copies, so this is cheap)
 	CLNF(const CLNF& other);
 
-	// Assignment operator for lvalues (makes a deep copy of the detector)
+	// Assignment operator for lvalues (copies the tracking state and shares the model weights)
 	CLNF & operator= (const CLNF& other);
 
 	// Empty Destructor	as the memory of every object will be managed by the corresponding libraries (no pointers)
@@ -165,6 +301,70 @@ public:
 
 	// Does the actual work - landmark detection
 	bool DetectLandmarks(const cv::Mat_<uchar> &image, FaceModelParameters& params);
+
+	// The same, on a frame shared with other models fitting on it (so that the floating point conversion is shared as well)
+	bool DetectLandmarks(ImageContext& image, FaceModelParameters& params);
+
+	// Landmark detection when tracking in a video, the same as DetectLandmarks except that the validation can be skipped on steady tracks
+	// (see FaceModelParameters::validate_every), in which case detection_certainty keeps the value of the last validation
+	bool TrackLandmarks(const cv::Mat_<uchar> &image, FaceModelParameters& params);
+	bool TrackLandmarks(ImageContext& image, FaceModelParameters& params);
+
+	// Fitting only the eye part models in between the full fits (see FaceModelParameters::track_eyes_between_fits), the rigid parameters
+	// are moved to the motion prediction for the time stamp first. Returns false if no eye model could be fit, a full fit is needed then
+	bool TrackEyes(ImageContext& image, FaceModelParameters& params, double time_stamp);
+
+	// Landmark detection for several models in the same image (e.g. multiple tracked faces), the models have to be copies of the same model
+	// as the patch expert responses for all of them are computed together, success is reported per model
+	static void DetectLandmarksBatch(vector<CLNF*>& models, const cv::Mat_<uchar> &image, vector<FaceModelParameters*>& params, vector<bool>& success);
+
+	// Landmark detection for several different models in the same image (e.g. the left and right eye parts), fit scale by scale together with
+	// the patch expert responses of all of them computed in one parallel loop, otherwise the same as DetectLandmarks of each
+	static void DetectLandmarksJoint(vector<CLNF*>& models, ImageContext& image, vector<FaceModelParameters*>& params, vector<bool>& success);
+
+	// Validating the currently detected landmarks (if validation is enabled and the fit succeeded), sets and returns detection_success, this allows a
+	// fit done without validation (e.g. of several hypotheses) to only validate the result that is kept
+	bool ValidateDetection(const cv::Mat_<uchar> &image, const FaceModelParameters& params, bool fit_success);
+
+	// The state of a fit of the main model, without its hierarchical refinement and validation: the parameters and likelihoods it writes to and
+	// its scratch memory. Several of them can be fit against the patch experts and the PDM of one model (see FitConcurrent), e.g. the rotation
+	// hypotheses of a detection in an image, instead of fitting a copy of the whole model for each
+	struct FitState
+	{
+		FitState() : model_likelihood(0), view_used(0), success(false), own_fit(false) {}
+
+		cv::Vec6f					params_global;
+		cv::Mat_<float>				params_local;
+		float						model_likelihood;
+		cv::Mat_<float>				landmark_likelihoods;
+		int							view_used;
+		bool						success;
+
+		// The visibilities of the landmarks that are fit at the current scale and view, the patch expert ones limited to the pose only landmarks
+		// when only tracking the pose (or to the landmark subset)
+		cv::Mat_<int>				fit_visibilities;
+
+		// Is this the fit of the model itself, which degrades to meet its deadline, keeps the stage timings and caches the responses
+		bool						own_fit;
+
+		// The patch expert responses and the scratch memory of the patch experts of every landmark (used by FitConcurrent)
+		vector<cv::Mat_<float> >	response_maps;
+		vector<Landmark_workspace>	workspaces;
+	};
+
+	// Computing everything the fits at the window sizes would otherwise compute on first use (reading in the patch experts of all of the views,
+	// which stay with the model, their per window size precomputation, the mean shift KDE tables and the shape models the fit uses), after which
+	// FitConcurrent can be called from several threads at once. Returns false if the patch experts can not be shared between threads (the SVR
+	// ones cache their DFTs on first use), the fits then have to be done one after another
+	bool PrepareConcurrentFits(const std::vector<int>& window_sizes, const FaceModelParameters& params);
+
+	// Fitting the main model from the parameters of the state, only the state is written to (the model is not, and no deadline applies), sets and
+	// returns the success of the state
+	bool FitConcurrent(ImageContext& image, FitState& state, const std::vector<int>& window_sizes, const FaceModelParameters& params);
+
+	// Taking over the result of a fit state (its parameters, likelihoods and view), then refining and validating it as DetectLandmarks does,
+	// returns the detection success
+	bool CompleteFit(ImageContext& image, const FitState& state, FaceModelParameters& params);
 	
 	// Gets the shape of the current detected landmarks in camera space (given camera calibration)
 	// Can only be called after a call to DetectLandmarksInVideo or DetectLandmarksInImage
@@ -176,6 +376,13 @@ public:
 	// Get the currently non-self occluded landmarks
 	cv::Mat_<int> GetVisibilities() const;
 
+	// Was the hierarchical part refined in the last fit (see hierarchical_part_valid)
+	bool HierarchicalPartValid(int part) const;
+
+	// The memoised quantities of the current fit (reset if the fit changed since they were computed), the shape, pose and visibilities above
+	// go through it, this is not safe to use from several threads on the same model at once
+	FrameResult& GetFrameResult() const;
+
 	// Reset the model (useful if we want to completelly reinitialise, or we want to track another video)
 	void Reset();
 
@@ -183,25 +390,166 @@ public:
 	void Reset(double x, double y);
 
 	// Reading the model in
-	void Read(string name);
+	void Read(string name, bool local_model_copy = false);
+
+	// Writing and reading the tracking state (the parameters, landmarks, face template and failure counts of the model and its hierarchical
+	// models), e.g. for checkpointing a long video and resuming it later with the same model. The motion prediction and pending face detections
+	// are not part of the state, they start afresh after reading it
+	void WriteState(std::ostream& stream) const;
+	bool ReadState(std::istream& stream);
+
+	// Writes the PDM and patch experts as a binary model bundle next to the model files (only for models using CEN patch experts),
+	// the bundle will then be used instead of the model files which makes loading much faster
+	bool WriteBundle() const;
+
+	// The same, writing the bundle to the given location (the bundle is used when it is found next to a CLNF module file of that name)
+	bool WriteBundle(const string& bundle_location) const;
+
+	// Keeping only the first num_scales scales of the patch experts and the views within max_yaw (in radians) of the frontal one, together with
+	// their triangulations, this is used for writing a reduced model for constrained deployments (see the ModelPruner tool)
+	bool Prune(int num_scales, double max_yaw);
+
+	// Precomputing everything that is otherwise computed lazily on the first frames (the patch expert Sigmas and interpolation matrices of all
+	// of the views, the mean shift KDE tables, the patch expert and face detector buffers for the frame size), so that the first frames run at the
+	// steady state speed, the model is reset afterwards, so it should be called before tracking. With FaceModelParameters::realtime_memory the
+	// model bundles are locked in memory afterwards (see LockModelMemory)
+	void WarmUp(cv::Size frame_size, FaceModelParameters& params);
+
+	// Locking the model bundles of the model and of its hierarchical models in physical memory (see ModelBundle::Lock), returns false if a model
+	// was not read from a bundle (its weights are on the heap, which only locking the whole process covers) or the OS refused the lock
+	bool LockModelMemory();
+
+	// Adding the memory of the model components (the PDM, the patch experts, the triangulations, the validator, the MTCNN face detector and the
+	// hierarchical models under component/hierarchical/<name>) and of the runtime caches (component/cache) to the report. The weights shared with
+	// a model reported earlier (e.g. the one this one was copied from) are not counted again, so for a copy only its own memory is reported
+	void ReportMemory(Utilities::MemoryReport& report, const string& component = "clnf") const;
+
+	// Using the given face detector for the (re)initialisation of tracking instead of the one chosen in FaceModelParameters (NULL to go back to it)
+	void SetFaceDetector(std::shared_ptr<FaceDetectorPlugin> detector);
+
+	// A deadline for the following fits (DetectLandmarksInVideo sets it from FaceModelParameters::frame_deadline_ms), while it is set the fits
+	// degrade in order to finish in time: fewer NU_RLMS iterations, skipped coarse scales, skipped refinement and deferred validation
+	void SetDeadline(std::chrono::steady_clock::time_point deadline);
+	void ClearDeadline();
 	
 private:
 
 	// Helper reading function
-	bool Read_CLNF(string clnf_location);
+	bool Read_CLNF(string clnf_location, bool local_model_copy);
+
+	// Reading the PDM, triangulations and patch experts from a model bundle, returns false if not present
+	bool ReadBundle(const string& bundle_location, bool local_model_copy);
+
+	// The memory mapped model bundle (if the model was read from one), the model weights point to it so it is kept alive by all of the copies
+	std::shared_ptr<ModelBundle> model_bundle;
+
+	// Location of the CLNF module the model was read from
+	string clnf_location;
+
+	// the speedup of RLMS using precalculated KDE responses (described in Saragih 2011 RLMS paper), indexed by the response size
+	vector<cv::Mat_<float> >		kde_resp_precalc;
+
+	// The patch expert response maps, kept between the frames so that they are only allocated once (not copied between models)
+	vector<cv::Mat_<float> >		response_maps;
+
+	// The responses last computed at every scale, for reusing them for the landmarks that barely moved since (see
+	// FaceModelParameters::response_reuse_threshold), with where the landmarks were and how many frames in a row each response was reused
+	struct ResponseCache
+	{
+		vector<cv::Mat_<float> >	responses;
+		cv::Mat_<float>				landmarks;
+		vector<int>					ages;
+		cv::Vec6f					params_global;
+		int							view_id;
+		int							window_size;
+	};
+	vector<ResponseCache>			response_cache;
+
+	// The shape model with fewer modes used for fitting if the parameters ask for it, sliced from pdm on first use (see FitPDM)
+	PDM								fit_pdm;
+
+	// The fit shape models subsampled to the landmarks that are fit when only some are, number of modes -> (source mean shape, model), see SubsetFitPDM
+	vector<int>						subset_fit_points;
+	map<int, std::pair<cv::Mat_<float>, PDM> > subset_fit_pdms;
+
+	// The shape models of the hierarchical parts with only their mapped vertices, in the mapping order, so that the parts can be initialised
+	// from the main landmarks without subsampling their bases on every frame (made on first use, see HierarchicalFitPDMs)
+	vector<PDM>						hierarchical_fit_pdms;
+
+	// See GetFrameResult, invalidated by every fit and reset (not copied between models)
+	mutable FrameResult				frame_result;
+
+	// The deadline of the current frame (if any) and running averages of how long the stages took (in seconds), used to decide what to degrade
+	bool									deadline_set;
+	std::chrono::steady_clock::time_point	deadline;
+	vector<double>							scale_time_estimates;
+	double									refinement_time_estimate;
+	double									validation_time_estimate;
 
-	// the speedup of RLMS using precalculated KDE responses (described in Saragih 2011 RLMS paper)
-	map<int, cv::Mat_<float> >		kde_resp_precalc;
+	// Can a stage that is expected to take the given time (in seconds) still finish before the deadline, always true without a deadline
+	bool DeadlineAllows(double expected_time) const;
 
 	// The model fitting: patch response computation and optimisation steps
-    bool Fit(const cv::Mat_<float>& intensity_image, const std::vector<int>& window_sizes, const FaceModelParameters& parameters);
+	bool Fit(ImageContext& image, const std::vector<int>& window_sizes, const FaceModelParameters& parameters, bool reuse_responses = false);
+
+	// The same on a fit state, with the response maps and the patch expert scratch memory to use (the patch experts' own if not given)
+	bool FitScales(ImageContext& image, FitState& state, vector<cv::Mat_<float> >& patch_expert_responses, vector<Landmark_workspace>* workspaces,
+		const std::vector<int>& window_sizes, const FaceModelParameters& parameters, bool reuse_responses);
+
+	// The fit state of the model itself (its parameters, likelihoods and view) and writing it back
+	void LoadFitState(FitState& state) const;
+	void StoreFitState(const FitState& state);
+
+	// The fitting parameters adapted to the scale (see FaceModelParameters::refine_parameters)
+	FaceModelParameters ScaleParameters(const FaceModelParameters& parameters, int scale) const;
+
+	// The landmarks whose cached responses at the scale can be reused (excluded from the returned mask of the landmarks to compute)
+	vector<int> ReusableResponses(const cv::Mat_<float>& landmarks, int scale, int window_size, const FaceModelParameters& parameters, cv::Mat_<int>& landmark_mask);
+
+	// Shifting the reused responses into place, and caching the computed ones
+	void UpdateResponseCache(vector<cv::Mat_<float> >& patch_expert_responses, const cv::Mat_<float>& landmarks, const cv::Matx22f& sim_img_to_ref, int scale,
+		int window_size, const vector<int>& reused, const cv::Mat_<int>& landmark_mask);
+
+	// The optimisation step at a single scale given the patch expert responses, returns false if the face is too small to be fit
+	bool OptimiseScale(const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Matx22f& sim_ref_to_img, const cv::Matx22f& sim_img_to_ref, int window_size, int scale, bool last_scale, const FaceModelParameters& parameters);
+	bool OptimiseScale(FitState& state, const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Matx22f& sim_ref_to_img, const cv::Matx22f& sim_img_to_ref, int window_size, int scale, bool last_scale, const FaceModelParameters& parameters);
+
+	// Hierarchical refinement of the fit landmarks
+	void Refine(ImageContext& image, FaceModelParameters& params);
+
+	// The hierarchical parts fit together (the eye models, if there are both), and fitting the listed parts that way
+	vector<char> JointEyeParts() const;
+	void FitPartsJointly(ImageContext& image, const vector<char>& parts);
+
+	// Setting the detection success and certainty from the output of the validator
+	void SetValidationResult(float certainty, const FaceModelParameters& params);
+
+	// The cheap first stage of the validation, returns true (with the certainty) if the fit likelihood is clear enough to decide without the CNN
+	bool ValidateByLikelihood(const FaceModelParameters& params, float& certainty) const;
+
+	// Is the validation of a tracked detection needed, or can it be skipped on a steady track
+	bool ValidationDue(const FaceModelParameters& params) const;
+
+	// The validation of a tracked detection, which is only done when due
+	bool ValidateTrackedDetection(const cv::Mat_<uchar> &image, const FaceModelParameters& params, bool fit_success);
 
 	// Mean shift computation that uses precalculated kernel density estimators (the one actually used)
-	void NonVectorisedMeanShift_precalc_kde(cv::Mat_<float>& out_mean_shifts, const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Mat_<float> &dxs, const cv::Mat_<float> &dys, int resp_size, float a, int scale, int view_id, map<int, cv::Mat_<float> >& mean_shifts);
+	void MeanShift_precalc_kde(cv::Mat_<float>& out_mean_shifts, const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Mat_<float> &dxs, const cv::Mat_<float> &dys, int resp_size, float a, int scale, int view_id, vector<cv::Mat_<float> >& kde_resp_precalc,
+		const cv::Mat_<int>& fit_visibilities);
 
-	// The actual model optimisation (update step), returns the model likelihood
+	// The actual model optimisation (update step), returns the model likelihood, only the model's own fit stops early to meet its deadline
     float NU_RLMS(cv::Vec6f& final_global, cv::Mat_<float>& final_local, const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Vec6f& initial_global, const cv::Mat_<float>& initial_local,
-		          const cv::Mat_<float>& base_shape, const cv::Matx22f& sim_img_to_ref, const cv::Matx22f& sim_ref_to_img, int resp_size, int view_idx, bool rigid, int scale, cv::Mat_<float>& landmark_lhoods, const FaceModelParameters& parameters, bool compute_lhood);
+		          const cv::Mat_<float>& base_shape, const cv::Matx22f& sim_img_to_ref, const cv::Matx22f& sim_ref_to_img, int resp_size, int view_idx, bool rigid, int scale, cv::Mat_<float>& landmark_lhoods, const FaceModelParameters& parameters, bool compute_lhood,
+				  const cv::Mat_<int>& fit_visibilities, bool own_fit);
+
+	// The shape model the non-rigid fit uses for the number of modes (pdm itself for all of them, or for 0)
+	PDM& FitPDM(int num_modes);
+
+	// The shape model the Jacobian is computed on when only the given landmarks are fit
+	const PDM& SubsetFitPDM(const PDM& source, const vector<int>& points);
+
+	// Making the hierarchical_fit_pdms if they are not there yet
+	void HierarchicalFitPDMs();
 
 	// Generating the weight matrix for the Weighted least squares
 	void GetWeightMatrix(cv::Mat_<float>& WeightMatrix, int scale, int view_id, const FaceModelParameters& parameters);
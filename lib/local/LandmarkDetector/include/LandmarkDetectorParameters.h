@@ -58,6 +58,16 @@ struct FaceModelParameters
 	// Landmark detection validator boundary for correct detection, the regressor output 1 (perfect alignment) 0 (bad alignment), 
 	float validation_boundary;
 
+	// When tracking the validator only needs to run every n-th frame of a steady track, or earlier if the model likelihood drops
+	// by more than validation_likelihood_drop since the last validation, 1 validates every frame
+	int validate_every;
+	float validation_likelihood_drop;
+
+	// A cheap first validation stage (-tiered_validation <margin>): the fit likelihood mapped through the linear early termination model of the
+	// patch experts (where the model has one) accepts or rejects the fit on its own when it is further than the margin from validation_boundary,
+	// and only the fits in between go through the CNN validator. 0 always runs the CNN
+	float tiered_validation_margin;
+
 	// Used when tracking is going well
 	vector<int> window_sizes_small;
 
@@ -71,6 +81,38 @@ struct FaceModelParameters
 	float face_template_scale;	
 	bool use_face_template;
 
+	// The template is only re-extracted once its last match correlated less than this (the appearance changed) or once it is older than the
+	// maximum age in frames
+	float face_template_refresh_correlation;
+	int face_template_max_age;
+
+	// Adaptive tracking uses the template match to estimate the inter-frame motion, for near-static faces (moving less than the
+	// fraction of the face width with a template correlation above the minimum) only the finest scale of window_sizes_small is fitted
+	bool adaptive_tracking;
+	float adaptive_motion_threshold;
+	float adaptive_min_correlation;
+
+	// Should the fit in videos start from the rigid parameters predicted by a constant velocity motion model (from the frame time stamps)
+	// instead of the previous frame's, so that the small windows still cover the landmarks during fast head motion. The damping scales the
+	// predicted motion (1 extrapolates the full velocity)
+	bool motion_prediction;
+	float motion_prediction_damping;
+
+	// Should hard cuts in edited video be detected (from the change of a coarse colour histogram between consecutive frames), resetting the
+	// tracking and re-detecting the face straight away instead of fitting to the content of the previous shot until the tracking fails.
+	// A cut is a Bhattacharyya distance of the histograms above the threshold
+	bool scene_cut_detection;
+	float scene_cut_threshold;
+
+	// Should the video fit be done on a downscaled frame when the face is large (e.g. in 4K video), at the pyramid level at which the face
+	// is about the working face width (in pixels). Until the face is found the frame is downscaled to no less than the detection width
+	bool adaptive_resolution;
+	float adaptive_resolution_face_width;
+	int adaptive_resolution_detection_width;
+
+	// NU-RLMS stops iterating once the landmarks move less than this between iterations (L2 norm over all of the landmarks, in pixels)
+	float rlms_convergence_threshold;
+
 	// Where to load the model from
 	string model_location;
 	
@@ -87,6 +129,19 @@ struct FaceModelParameters
 	enum LandmarkDetector { CLM_DETECTOR, CLNF_DETECTOR, CECLM_DETECTOR };
 	LandmarkDetector curr_landmark_detector;
 
+	// Full landmark fitting is only done every n-th frame in videos, in between the landmarks are propagated with optical flow and
+	// projected onto the shape model (a full fit is still done as soon as the propagation fails or is not validated), 1 fits every frame
+	int full_fit_every;
+
+	// For high frame rate cameras: in between the full fits only the eye part models (the hierarchical models with "eye" in their name) are
+	// fit, on every frame, from the head pose predicted by the motion model instead of the optical flow propagation, so that the gaze can be
+	// estimated at the camera rate (set with -track_eyes, needs full_fit_every > 1 and works best with motion_prediction)
+	bool track_eyes_between_fits;
+
+	// A time budget per frame for the landmark detection in videos in milliseconds (0 for none), when it is about to be missed the fit
+	// degrades its quality progressively instead (see CLNF::deadline_degradations for what was applied)
+	double frame_deadline_ms;
+
 	// How often should face detection be used to attempt reinitialisation, every n frames (set to negative not to reinit)
 	int reinit_video_every;
 
@@ -99,19 +154,111 @@ struct FaceModelParameters
 	string mtcnn_face_detector_location;
 	FaceDetector curr_face_detector;
 
+	// Should the face detection for (re)initialisation in videos run in the background, the tracker then picks up the detection on a later frame
+	// instead of stalling on it (useful for live input, for offline processing it makes the results depend on timing)
+	bool async_face_detection;
+
+	// Should the face detection for reinitialisation in videos first search an area around the last tracked face (roi_detection_scale times
+	// its size), the full frame is only searched after roi_detection_attempts failed detections in a row
+	bool roi_detection;
+	float roi_detection_scale;
+	int roi_detection_attempts;
+
+	// Should the MTCNN detector for reinitialisation in videos only look for the single face it needs, bounding the scales by the size of the
+	// last tracked face and stopping at the first confirmed detection
+	bool mtcnn_single_face_fast;
+
+	// Should the MTCNN PNet convolutions be tuned (im2col, Winograd or FFT) for every new image size, slower on the first frame of a size but then
+	// the fastest method for the host is used for every pyramid level
+	bool mtcnn_autotune_convolutions;
+
 	// Should the results be visualised and reported to console
 	bool quiet_mode;
 
 	// Should the model be refined hierarchically (if available)
 	bool refine_hierarchical;
 
+	// The hierarchical parts (e.g. mouth, brow) that should not be refined, they just follow the main model, set with -skip_part <name>
+	vector<string> skipped_parts;
+
+	// When used for a hierarchical part model, should that part be refined at all (an opt out set directly on CLNF::hierarchical_params)
+	bool refine_part;
+
+	// Should the hierarchical parts that would not give usable landmarks be left out of the refinement: the ones with landmarks self occluded
+	// at the current head pose (as in the patch expert visibilities), or smaller than part_min_size pixels across (-part_min_size <pixels>).
+	// They then just follow the main model and are reported as not valid (CLNF::HierarchicalPartValid), turned off with -no_part_gating
+	bool gate_parts;
+	float part_min_size;
+
 	// Should the parameters be refined for different scales
 	bool refine_parameters;
 
+	// How many of the (most significant) shape modes are fit, 0 for all of them (set with -fit_modes <n>). Fewer are faster, at the cost of the
+	// face shape and expression detail, the parameters of the other modes are reported as zero
+	int num_fit_modes;
+
+	// Should only the head pose be tracked (for when only the pose and a bounding box are needed, set with -pose_only), then only the rigid
+	// parameters and the first pose_only_modes shape modes (-pose_only_modes <n>, the others are zero) are fit, on a reduced set of stable landmarks of the 68 point
+	// model (pose_only_landmarks), and there is no hierarchical refinement. The other landmarks just follow the shape model
+	bool pose_only;
+	int pose_only_modes;
+	vector<int> pose_only_landmarks;
+
+	// For when only the inner face landmarks are used (-landmark_subset 51 for all but the jaw contour, -landmark_subset 49 also without the inner
+	// mouth corners, 0 for all of the landmarks), then only those are fit (on the shape model subsampled to them) and the others are reconstructed
+	// from the shape model. Only for the 68 point model, pose only tracking takes precedence
+	int landmark_subset;
+
+	// When tracking, the patch expert responses of a landmark that moved less than this many pixels since its response was last computed at the
+	// same scale (and with the same view, window size and about the same scale and rotation of the face) are reused, shifted by the subpixel
+	// motion, instead of being computed again. For at most a few frames in a row before they are refreshed. 0 (the default) always computes them,
+	// set with -response_reuse <pixels>
+	float response_reuse_threshold;
+
+	// The CEN patch expert responses of search windows of at least this size (the large initialisation windows) are evaluated coarse to fine: on a
+	// strided grid first and then densely only around its peak, the rest is interpolated from the grid. 0 (the default) evaluates all of them
+	// on the usual checkerboard, set with -coarse_to_fine <window size>
+	int coarse_to_fine_window;
+
+	// The number of landmarks a patch response task computes (the grain size of the parallel loop over the landmarks), 1 (the default) lets
+	// TBB split the work as finely as it wants, set with -response_grain <landmarks> or from the tuning cache
+	int response_grain_size;
+
+	// The number of threads the parallel work of the process is limited to when the arguments are parsed (through Utilities::Concurrency),
+	// 0 (the default) for no limit. Only set by the low_power preset, and an explicit -threads (parsed by the executables first) takes precedence
+	int max_threads;
+
+	// The cache of the host tuned choices written by openface_autotune (see TuningCache.h), it is loaded when the arguments are parsed so that
+	// the models read afterwards use it, set with -tuning_cache <file>
+	string tuning_cache_location;
+
+	// Should the CEN patch experts use 8 bit weights (faster, especially on ARM, at a slight loss of accuracy)
+	bool quantised_patch_experts;
+
+	// Keeping the CEN patch expert weights in half precision (-fp16_weights) is decided when the model is read, so it is not a parameter of the
+	// fits but is set for the models read afterwards when the arguments are parsed (see SetHalfPrecisionWeights in CEN_patch_expert.h)
+
+	// Real-time memory mode (-realtime_memory): once warmed up (CLNF::WarmUp) the model bundles are locked in physical memory, so that no page
+	// of the weights is faulted in (or swapped out) while tracking, and the executables lock and pre-fault their frame buffers as well and report
+	// any growth of the heap after the warm-up. Locking needs the privilege or memory limit for it (RLIMIT_MEMLOCK), otherwise a warning is printed
+	bool realtime_memory;
+
 	FaceModelParameters();
 
 	FaceModelParameters(vector<string> &arguments);
 
+	// Named speed/accuracy tiers bundling the window sizes, iterations, refinement, validation and detection settings (set with -preset <name>,
+	// the other arguments are applied on top of it regardless of their order). Returns false (and changes nothing) for an unknown name
+	//	realtime_edge    - a single quantised scale when tracking, no hierarchical refinement, sparse validation (low power devices)
+	//	realtime_server  - the default fits, with detection and validation kept off the tracking path where possible
+	//	offline_accurate - in the wild settings with multiple hypotheses, every frame fully fit and validated
+	//	low_power        - for battery powered devices: two threads doing coarser grained work, the HOG SVM detector without a background
+	//	                   thread, and a full fit only on every third frame (starting from the motion prediction), with the rest propagated
+	//	gaze_hfr         - for 120-240 fps gaze tracking: the face is fully fit on every fourth frame, the eye models on every frame
+	bool ApplyPreset(const string& name);
+
+	static vector<string> PresetNames();
+
 	private:
 		void init();
 		void check_model_path(const std::string& root = "/");
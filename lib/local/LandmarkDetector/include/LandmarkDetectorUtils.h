@@ -73,22 +73,49 @@ namespace LandmarkDetector
 	// Face detection helpers
 	//============================================================================
 
+#ifndef OPENFACE_SLIM_LANDMARK_DETECTOR
 	// Face detection using Haar cascade classifier
 	bool DetectFaces(vector<cv::Rect_<float> >& o_regions, const cv::Mat_<uchar>& intensity, float min_width = -1, cv::Rect_<float> roi = cv::Rect_<float>(0.0, 0.0, 1.0, 1.0));
 	bool DetectFaces(vector<cv::Rect_<float> >& o_regions, const cv::Mat_<uchar>& intensity, cv::CascadeClassifier& classifier, float min_width = -1, cv::Rect_<float> roi = cv::Rect_<float>(0.0, 0.0, 1.0, 1.0));
 	// The preference point allows for disambiguation if multiple faces are present (pick the closest one), if it is not set the biggest face is chosen
 	bool DetectSingleFace(cv::Rect_<float>& o_region, const cv::Mat_<uchar>& intensity, cv::CascadeClassifier& classifier, const cv::Point preference = cv::Point(-1, -1), float min_width = -1, cv::Rect_<float> roi = cv::Rect_<float>(0.0, 0.0, 1.0, 1.0));
+	// On a frame shared with the landmark fitting, using its greyscale pyramid (on the OpenCL device if OpenCV uses one, see FaceDetectorHaar)
+	bool DetectFaces(vector<cv::Rect_<float> >& o_regions, LandmarkDetector::ImageContext& frame, LandmarkDetector::FaceDetectorHaar& detector, float min_width = -1, cv::Rect_<float> roi = cv::Rect_<float>(0.0, 0.0, 1.0, 1.0));
+	bool DetectSingleFace(cv::Rect_<float>& o_region, LandmarkDetector::ImageContext& frame, LandmarkDetector::FaceDetectorHaar& detector, const cv::Point preference = cv::Point(-1, -1), float min_width = -1, cv::Rect_<float> roi = cv::Rect_<float>(0.0, 0.0, 1.0, 1.0));
 
 	// Face detection using HOG-SVM classifier
 	bool DetectFacesHOG(vector<cv::Rect_<float> >& o_regions, const cv::Mat_<uchar>& intensity, std::vector<float>& confidences, float min_width = -1, cv::Rect_<float> roi = cv::Rect_<float>(0.0, 0.0, 1.0, 1.0));
 	bool DetectFacesHOG(vector<cv::Rect_<float> >& o_regions, const cv::Mat_<uchar>& intensity, dlib::frontal_face_detector& classifier, std::vector<float>& confidences, float min_width = -1, cv::Rect_<float> roi = cv::Rect_<float>(0.0, 0.0, 1.0, 1.0));
 	// The preference point allows for disambiguation if multiple faces are present (pick the closest one), if it is not set the biggest face is chosen
 	bool DetectSingleFaceHOG(cv::Rect_<float>& o_region, const cv::Mat_<uchar>& intensity, dlib::frontal_face_detector& classifier, float& confidence, const cv::Point preference = cv::Point(-1, -1), float min_width = -1, cv::Rect_<float> roi = cv::Rect_<float>(0.0, 0.0, 1.0, 1.0));
+	// Using the in-tree detector (the same weights as the dlib one), which scans only around the roi and skips the pyramid levels below min_width
+	bool DetectFacesHOG(vector<cv::Rect_<float> >& o_regions, const cv::Mat_<uchar>& intensity, FaceDetectorHOG& classifier, std::vector<float>& confidences, float min_width = -1, cv::Rect_<float> roi = cv::Rect_<float>(0.0, 0.0, 1.0, 1.0));
+	bool DetectSingleFaceHOG(cv::Rect_<float>& o_region, const cv::Mat_<uchar>& intensity, FaceDetectorHOG& classifier, float& confidence, const cv::Point preference = cv::Point(-1, -1), float min_width = -1, cv::Rect_<float> roi = cv::Rect_<float>(0.0, 0.0, 1.0, 1.0));
+#endif
 
 	// Face detection using Multi-task Convolutional Neural Network
 	bool DetectFacesMTCNN(vector<cv::Rect_<float> >& o_regions, const cv::Mat& image, LandmarkDetector::FaceDetectorMTCNN& detector, std::vector<float>& confidences);
+	// Also returning the five facial keypoints of every face (see FaceDetectorMTCNN::DetectFaces), which can seed the landmark detection
+	bool DetectFacesMTCNN(vector<cv::Rect_<float> >& o_regions, const cv::Mat& image, LandmarkDetector::FaceDetectorMTCNN& detector, std::vector<float>& confidences,
+		vector<vector<cv::Point2f> >& keypoints);
 	// The preference point allows for disambiguation if multiple faces are present (pick the closest one), if it is not set the biggest face is chosen
 	bool DetectSingleFaceMTCNN(cv::Rect_<float>& o_region, const cv::Mat& image, LandmarkDetector::FaceDetectorMTCNN& detector, float& confidence, const cv::Point preference = cv::Point(-1, -1));
+	// On a frame shared with the landmark fitting
+	bool DetectSingleFaceMTCNN(cv::Rect_<float>& o_region, LandmarkDetector::ImageContext& image, LandmarkDetector::FaceDetectorMTCNN& detector, float& confidence, const cv::Point preference = cv::Point(-1, -1));
+	bool DetectSingleFaceMTCNN(cv::Rect_<float>& o_region, vector<cv::Point2f>& keypoints, LandmarkDetector::ImageContext& image, LandmarkDetector::FaceDetectorMTCNN& detector,
+		float& confidence, const cv::Point preference = cv::Point(-1, -1));
+
+	// Face detection using a detector supplied by the embedder, the same disambiguation as above
+	bool DetectSingleFacePlugin(cv::Rect_<float>& o_region, LandmarkDetector::ImageContext& frame, LandmarkDetector::FaceDetectorPlugin& detector, float& confidence,
+		const cv::Point preference = cv::Point(-1, -1));
+
+	//============================================================================
+	// Felzenszwalb HOG features
+	//============================================================================
+
+	// The 31 features of every cell (without the border cells) of a greyscale or colour 8 bit image, the output has num_rows rows of num_cols * 31
+	// values with the features of a cell stored contiguously, as computed by dlib::extract_fhog_features
+	void ExtractFHOG(cv::Mat_<float>& hog, const cv::Mat& image, int& num_rows, int& num_cols, int cell_size = 8);
 
 	//============================================================================
 	// Matrix reading functionality
@@ -0,0 +1,194 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef LANDMARK_SHAPE_H
+#define LANDMARK_SHAPE_H
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// System includes
+#include <cmath>
+#include <cstring>
+
+namespace LandmarkDetector
+{
+	// The most landmarks a fixed size shape holds, all of the landmark models have fewer (68 for the face, 28 for the eyes)
+	static const int MAX_SHAPE_LANDMARKS = 128;
+
+	//===========================================================================
+	/**
+	The landmarks of a shape in a fixed size aligned buffer, in the structure of arrays layout the shapes are passed around in as column vectors
+	(the n xs, followed by the n ys and for a 3D shape the n zs). It is filled from such a column with a single copy (or written in place through
+	Column(), as cv::Mat::create keeps the buffer when the size matches) and gives out cv::Mat headers over its own storage, so the hot paths
+	working on the coordinates do not reshape, transpose or clone the shapes, which allocates every time. It lives on the stack, so the models
+	with more than Capacity landmarks can not use it (Set and Resize then return false)
+	*/
+	template<int D, int Capacity = MAX_SHAPE_LANDMARKS>
+	class LandmarkShape
+	{
+	public:
+
+		LandmarkShape() : n(0) { ; }
+
+		// Setting the number of landmarks, the coordinates are not initialised
+		bool Resize(int num_landmarks)
+		{
+			if (num_landmarks < 0 || num_landmarks > Capacity)
+			{
+				n = 0;
+				return false;
+			}
+			n = num_landmarks;
+			return true;
+		}
+
+		// Copying in a (D * n) x 1 column vector shape
+		bool Set(const cv::Mat_<float>& shape)
+		{
+			if (shape.cols != 1 || shape.rows % D != 0 || !Resize(shape.rows / D))
+			{
+				n = 0;
+				return false;
+			}
+			if (shape.isContinuous())
+			{
+				std::memcpy(data, shape.ptr<float>(0), D * n * sizeof(float));
+			}
+			else
+			{
+				for (int i = 0; i < D * n; ++i)
+					data[i] = shape.at<float>(i);
+			}
+			return true;
+		}
+
+		int Size() const { return n; }
+		bool empty() const { return n == 0; }
+
+		// The coordinates along a dimension (0 for x, 1 for y and 2 for z)
+		float* Coordinates(int dim) { return data + dim * n; }
+		const float* Coordinates(int dim) const { return data + dim * n; }
+
+		float* xs() { return data; }
+		float* ys() { return data + n; }
+		float* zs() { return data + 2 * n; }
+		const float* xs() const { return data; }
+		const float* ys() const { return data + n; }
+		const float* zs() const { return data + 2 * n; }
+
+		// The shape as a (D * n) x 1 column vector and as a D x n matrix (a row per dimension), both sharing the storage of the shape
+		cv::Mat_<float> Column() const { return cv::Mat_<float>(D * n, 1, const_cast<float*>(data)); }
+		cv::Mat_<float> Rows() const { return cv::Mat_<float>(D, n, const_cast<float*>(data)); }
+
+		// The mean of the coordinates along a dimension
+		float Mean(int dim) const
+		{
+			const float* coords = Coordinates(dim);
+			double sum = 0;
+			for (int i = 0; i < n; ++i)
+				sum += coords[i];
+			return n > 0 ? (float)(sum / n) : 0.0f;
+		}
+
+		void Translate(int dim, float offset)
+		{
+			float* coords = Coordinates(dim);
+			for (int i = 0; i < n; ++i)
+				coords[i] += offset;
+		}
+
+	private:
+
+		int n;
+		alignas(32) float data[D * Capacity];
+	};
+
+	typedef LandmarkShape<2> LandmarkShape2D;
+	typedef LandmarkShape<3> LandmarkShape3D;
+
+	//=============================================================================
+	// The scale and rotation aligning src to dst in the least squares sense (after removing their means), as Utilities::AlignShapesWithScale
+	// does on n x 2 shapes but without copying them: the best 2D rotation has a closed form, so no SVD is needed either
+	inline cv::Matx22f AlignShapesWithScale(const LandmarkShape2D& src, const LandmarkShape2D& dst)
+	{
+		const int n = src.Size();
+		if (n == 0 || dst.Size() != n)
+			return cv::Matx22f::eye();
+
+		const float mean_src_x = src.Mean(0), mean_src_y = src.Mean(1);
+		const float mean_dst_x = dst.Mean(0), mean_dst_y = dst.Mean(1);
+
+		const float* src_x = src.xs();
+		const float* src_y = src.ys();
+		const float* dst_x = dst.xs();
+		const float* dst_y = dst.ys();
+
+		// The spread of both and their cross covariance src' * dst
+		double ss_src = 0, ss_dst = 0;
+		double h00 = 0, h01 = 0, h10 = 0, h11 = 0;
+		for (int i = 0; i < n; ++i)
+		{
+			double sx = src_x[i] - mean_src_x, sy = src_y[i] - mean_src_y;
+			double dx = dst_x[i] - mean_dst_x, dy = dst_y[i] - mean_dst_y;
+			ss_src += sx * sx + sy * sy;
+			ss_dst += dx * dx + dy * dy;
+			h00 += sx * dx; h01 += sx * dy;
+			h10 += sy * dx; h11 += sy * dy;
+		}
+
+		if (ss_src <= 0)
+			return cv::Matx22f::eye();
+
+		double s = std::sqrt(ss_dst / ss_src);
+
+		// The rotation maximising trace(R * H), the same as Kabsch's algorithm without reflections
+		double c = h00 + h11;
+		double sn = h01 - h10;
+		double len = std::sqrt(c * c + sn * sn);
+		if (len > 0)
+		{
+			c /= len;
+			sn /= len;
+		}
+		else
+		{
+			c = 1;
+			sn = 0;
+		}
+
+		return cv::Matx22f((float)(s * c), (float)(-s * sn), (float)(s * sn), (float)(s * c));
+	}
+}
+#endif // LANDMARK_SHAPE_H
@@ -0,0 +1,147 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltruaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltruaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltruaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltruaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef MODEL_BUNDLE_H
+#define MODEL_BUNDLE_H
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// System includes
+#include <map>
+#include <string>
+#include <vector>
+
+namespace LandmarkDetector
+{
+	//===========================================================================
+	/**
+	A binary model bundle, a single versioned file containing a number of named matrices.
+	The bundle is memory mapped when opened and the matrices returned by it are views into the mapped file (no copying or parsing),
+	this makes model loading almost instant and allows the pages to be shared across processes using the same model.
+	The matrices are only valid while the bundle is open, so objects using them should keep the bundle alive (e.g. through a shared_ptr)
+
+	Layout (little endian): "OFMB", uint32 version, uint32 number of entries, uint32 start of data,
+	followed by the entries (uint32 name length, name, int32 type, int32 rows, int32 cols, uint64 offset) and the 64 byte aligned matrix data
+	*/
+	class ModelBundle
+	{
+	public:
+
+		ModelBundle();
+		~ModelBundle();
+
+		// Memory maps the bundle and reads its index, returns false if the file does not exist or is not a valid bundle
+		// With a private copy the bundle is read into memory owned by the bundle instead, which the OS places on the NUMA node of the reading
+		// thread (the mapped pages are shared by all of the nodes), useful for replicating the model weights per node
+		bool Open(const std::string& location, bool private_copy = false);
+
+		void Close();
+
+		bool IsOpen() const { return data != 0; }
+
+		// Locks the bundle in physical memory (mlock, VirtualLock on Windows), which also faults in all of its pages, so that reading the weights
+		// never waits on the disk and they are not paged out. Returns false if the OS refuses (e.g. above RLIMIT_MEMLOCK), the lock is released on Close
+		bool Lock();
+
+		bool IsLocked() const { return locked; }
+
+		size_t Size() const { return data_size; }
+
+		// Does the bundle contain a matrix with a given name
+		bool Has(const std::string& name) const;
+
+		// Retrieve a named matrix as a view into the mapped memory, returns false if the name is not in the bundle
+		bool GetMat(const std::string& name, cv::Mat& mat) const;
+
+		// Retrieve a named matrix of doubles as a vector (useful for scalar parameters)
+		bool GetValues(const std::string& name, std::vector<double>& values) const;
+
+		// The current version of the bundle format
+		static const unsigned int version = 1;
+
+	private:
+
+		// A bundle owns the mapping so can not be copied
+		ModelBundle(const ModelBundle& other);
+		ModelBundle & operator= (const ModelBundle& other);
+
+		struct Entry
+		{
+			int type;
+			int rows;
+			int cols;
+			unsigned long long offset;
+		};
+
+		std::map<std::string, Entry> entries;
+
+		// The mapped memory (or the aligned start of the private copy)
+		char* data;
+		size_t data_size;
+
+		// The allocation of a private copy, 0 if mapped
+		char* private_buffer;
+
+		bool locked;
+
+#ifdef _WIN32
+		void* file_handle;
+		void* mapping_handle;
+#endif
+
+	};
+
+	//===========================================================================
+	// Collects named matrices and writes them out as a model bundle (used by the offline model converter)
+	class ModelBundleWriter
+	{
+	public:
+
+		// Add a matrix to the bundle, the matrix is copied so the original can be modified afterwards
+		void AddMat(const std::string& name, const cv::Mat& mat);
+
+		// Add a set of scalar values (stored as a row of doubles)
+		void AddValues(const std::string& name, const std::vector<double>& values);
+
+		bool Write(const std::string& location) const;
+
+	private:
+		std::vector<std::string> names;
+		std::vector<cv::Mat> mats;
+	};
+
+}
+#endif // MODEL_BUNDLE_H
@@ -0,0 +1,164 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef MULTI_FACE_TRACKER_H
+#define MULTI_FACE_TRACKER_H
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// System includes
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "LandmarkDetectorModel.h"
+#include "LandmarkDetectorParameters.h"
+#include "FaceTracklets.h"
+#include "DetectionScheduler.h"
+
+namespace LandmarkDetector
+{
+	//===========================================================================
+	/**
+	Tracking multiple faces in a video. Every face present is tracked by its own tracker (a copy of the landmark detector that shares the read
+	only model weights, without the face detectors), the trackers are created when faces appear and released when they disappear so the memory
+	used is proportional to the number of faces actually present. A small number of released trackers are kept around for reuse, so that faces
+	coming and going do not copy the model on every frame. The faces keep their ids when they are lost and found again (see FaceTracklets), and
+	the face detector is only run when the scene changes or periodically (see DetectionScheduler). When there are more faces than the compute
+	budget allows full quality fits for, the faces are prioritised (see SetPriorityBudget)
+	*/
+	class MultiFaceTracker
+	{
+	public:
+
+		// The face model is expected to have its face detectors loaded, max_faces -1 does not limit the number of faces
+		MultiFaceTracker(const CLNF& face_model, const FaceModelParameters& params, int max_faces = -1);
+
+		// Tracking the faces in the next frame of the video (with its time stamp in seconds), detecting new faces when the scheduler decides to
+		void Track(const cv::Mat& rgb_image, cv::Mat_<uchar>& grayscale_image, double time_stamp);
+
+		// The faces currently tracked, the order is stable between frames with new faces added at the end
+		size_t GetNumFaces() const { return faces.size(); }
+		const CLNF& GetFace(size_t face) const { return faces[face]->model; }
+		int GetFaceId(size_t face) const { return faces[face]->id; }
+
+		// Forgetting all of the faces (e.g. for a new video)
+		void Reset();
+
+		// Adding the memory of the models to the report, the face detection model as component/model and every tracker as component/face_<id>
+		// (the released ones as component/released), as the trackers share the model weights those only show the per face memory
+		void ReportMemory(Utilities::MemoryReport& report, const std::string& component = "multi_face_tracker") const;
+
+		int GetMaxFaces() const { return max_faces; }
+		void SetMaxFaces(int max_faces) { this->max_faces = max_faces; }
+
+		// How a tracked face is fit: with the full parameters, degraded to a single small scale without hierarchical refinement, or with just the
+		// rigid (pose only) fit of the degraded parameters on every other frame (keeping the last landmarks in between)
+		enum FitQuality { FIT_FULL, FIT_DEGRADED, FIT_RIGID_ALTERNATE };
+
+		// The per frame budget: the full_quality_faces faces of the highest priority are fit fully, the next degraded_faces ones degraded and the
+		// rest rigid only on every other frame, a negative number does not limit that tier (the default, every face is fully fit). The new faces
+		// are always fully fit on the frame they are found in
+		void SetPriorityBudget(int full_quality_faces, int degraded_faces = -1);
+
+		// The priority of a face without a hint mixes its size (relative to the largest tracked face, with size_weight) and how close it is to the
+		// centre of the frame (with the rest of the weight), both from 0 to 1
+		void SetPriorityWeights(float size_weight);
+
+		// An external priority of a face id from 0 to 1 (e.g. for the active speaker), the hinted faces come before all of the others.
+		// A negative priority removes the hint
+		void SetPriorityHint(int face_id, float priority);
+
+		// The priority and the fit quality of a tracked face on the last frame
+		float GetFacePriority(size_t face) const { return faces[face]->priority; }
+		FitQuality GetFaceQuality(size_t face) const { return faces[face]->quality; }
+
+	private:
+
+		struct Tracker
+		{
+			Tracker(const CLNF& model, const FaceModelParameters& params) : model(model), params(params), id(-1), priority(0), quality(FIT_FULL) {}
+
+			CLNF model;
+			FaceModelParameters params;
+			int id;
+
+			float priority;
+			FitQuality quality;
+
+			// The appearance of the face in its last successfully tracked frame
+			cv::Mat_<float> signature;
+		};
+
+		// A tracker for a new face, reusing a released one if there are any
+		std::unique_ptr<Tracker> AcquireTracker();
+		void ReleaseTracker(std::unique_ptr<Tracker> tracker);
+
+		// Detecting the faces in a region of the image
+		void DetectFaces(const cv::Mat& rgb_image, const cv::Mat_<uchar>& grayscale_image, const cv::Rect& region, std::vector<cv::Rect_<float> >& detections);
+
+		// Working out the priorities of the tracked faces and the fit quality they get on this frame
+		void PrioritiseFaces(const cv::Size& image_size);
+
+		// The model used for detecting faces and the one the trackers are copied from
+		CLNF face_model;
+		CLNF tracker_model;
+		FaceModelParameters params;
+
+		// The parameters of the lower priority faces
+		FaceModelParameters degraded_params;
+		FaceModelParameters rigid_params;
+
+		int max_faces;
+
+		int full_quality_faces;
+		int degraded_faces;
+		float priority_size_weight;
+		std::map<int, float> priority_hints;
+
+		// For alternating the frames the rigid only faces are fit on
+		long long frame_count;
+
+		std::vector<std::unique_ptr<Tracker> > faces;
+		std::vector<std::unique_ptr<Tracker> > released_trackers;
+
+		FaceTracklets tracklets;
+
+		DetectionScheduler detection_scheduler;
+	};
+
+}
+#endif // MULTI_FACE_TRACKER_H
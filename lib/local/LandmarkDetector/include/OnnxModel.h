@@ -0,0 +1,187 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef ONNX_MODEL_H
+#define ONNX_MODEL_H
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// System includes
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace LandmarkDetector
+{
+	//===========================================================================
+	/**
+	A minimal builder of ONNX models (a single graph of float tensors), serialised to the ONNX protobuf format directly so that there is no
+	dependency on protobuf or the ONNX libraries. Only what is needed to export the CNNs and the CEN patch experts is supported: graph inputs
+	and outputs (a negative dimension is dynamic), float initializers, nodes with int, ints and float attributes and string metadata
+	*/
+	class OnnxGraph
+	{
+	public:
+
+		struct Attribute
+		{
+			std::string name;
+
+			// As in the ONNX AttributeProto, 1 - float, 2 - int, 7 - ints
+			int type;
+			float f;
+			int64_t i;
+			std::vector<int64_t> ints;
+
+			static Attribute Float(const std::string& name, float value);
+			static Attribute Int(const std::string& name, int64_t value);
+			static Attribute Ints(const std::string& name, const std::vector<int64_t>& values);
+		};
+
+		explicit OnnxGraph(const std::string& name) : name(name), num_names(0) {}
+
+		void AddInput(const std::string& name, const std::vector<int64_t>& shape);
+		void AddOutput(const std::string& name, const std::vector<int64_t>& shape);
+
+		// Adding a float tensor of the given dimensions, the data is copied (in row major order), returns its name
+		std::string AddInitializer(const std::string& prefix, const std::vector<int64_t>& dims, const float* data);
+		std::string AddInitializer(const std::string& prefix, const std::vector<int64_t>& dims, const cv::Mat_<float>& data);
+
+		// Adding a node with a single output, returns the (generated) name of the output unless one is given
+		std::string AddNode(const std::string& op_type, const std::vector<std::string>& inputs, const std::vector<Attribute>& attributes = std::vector<Attribute>(), const std::string& output = "");
+
+		void AddMetadata(const std::string& key, const std::string& value);
+
+		// The serialised ModelProto (IR version 6, opset 11)
+		std::string Serialize() const;
+		bool Write(const std::string& location) const;
+
+	private:
+
+		struct Tensor
+		{
+			std::string name;
+			std::vector<int64_t> dims;
+			std::vector<float> data;
+		};
+
+		struct Node
+		{
+			std::string op_type;
+			std::vector<std::string> inputs;
+			std::string output;
+			std::vector<Attribute> attributes;
+		};
+
+		struct ValueInfo
+		{
+			std::string name;
+			std::vector<int64_t> shape;
+		};
+
+		std::string UniqueName(const std::string& prefix);
+
+		std::string name;
+		int num_names;
+
+		std::vector<ValueInfo> inputs;
+		std::vector<ValueInfo> outputs;
+		std::vector<Tensor> initializers;
+		std::vector<Node> nodes;
+		std::vector<std::pair<std::string, std::string> > metadata;
+	};
+
+	//===========================================================================
+	/**
+	A model executed through ONNX Runtime, a single float input and a single float output. Only available when compiled with ONNX Runtime
+	(the OPENFACE_ONNXRUNTIME CMake option), otherwise Create always fails. Run can be called from several threads at the same time
+	*/
+	class OnnxSession
+	{
+	public:
+
+		// Creating a session from a serialised model (e.g. OnnxGraph::Serialize), using the execution provider chosen by SetOnnxExecutionProvider,
+		// returns an empty pointer if the model could not be loaded
+		static std::shared_ptr<OnnxSession> Create(const std::string& model);
+
+		// Running the model on an input of the given shape, the output is returned with its shape
+		bool Run(const float* input, const std::vector<int64_t>& input_shape, std::vector<float>& output, std::vector<int64_t>& output_shape) const;
+
+		~OnnxSession();
+
+	private:
+
+		OnnxSession();
+		OnnxSession(const OnnxSession& other);
+		OnnxSession & operator= (const OnnxSession& other);
+
+		struct Impl;
+		std::unique_ptr<Impl> impl;
+	};
+
+	//===========================================================================
+	/**
+	An ONNX Runtime session of a model that is exported (and the session created) on first use, shared by the copies of the model that hold it
+	*/
+	class LazyOnnxSession
+	{
+	public:
+
+		LazyOnnxSession() : tried(false) {}
+
+		// The session, or an empty pointer if the model could not be exported or loaded (which is only tried once)
+		std::shared_ptr<OnnxSession> Get(const std::function<bool(OnnxGraph&)>& export_model);
+
+	private:
+
+		LazyOnnxSession(const LazyOnnxSession& other);
+		LazyOnnxSession & operator= (const LazyOnnxSession& other);
+
+		std::mutex session_mutex;
+		std::shared_ptr<OnnxSession> session;
+		bool tried;
+	};
+
+	// Is ONNX Runtime compiled in
+	bool OnnxRuntimeAvailable();
+
+	// The execution provider of the sessions created from now on (cpu, cuda, tensorrt, openvino, or any other provider name ONNX Runtime knows
+	// such as CoreML or XNNPACK), if it can not be used the sessions fall back to the CPU
+	void SetOnnxExecutionProvider(const std::string& provider);
+}
+#endif // ONNX_MODEL_H
@@ -76,6 +76,10 @@ namespace LandmarkDetector
 		// Indicating if the destination warped pixels is valid (lies within a face)
 		cv::Mat_<uchar> pixel_mask;
 
+		// Runs of destination pixels lying in the same triangle, each row is (y, x start, x end (exclusive), triangle index), so that
+		// the warp does not need to look at the mask and triangle index of every pixel
+		cv::Mat_<int> triangle_spans;
+
 		// A number of precomputed coefficients that are helpful for quick warping
 
 		// affine coefficients for all triangles (see Matthews and Baker 2004)
@@ -118,6 +122,10 @@ namespace LandmarkDetector
 		// Perform the actual warping
 		void WarpRegion(cv::Mat_<float>& map_x, cv::Mat_<float>& map_y);
 
+		// Only the mask of pixels (starting at 0, 0) lying within the triangulated destination shape, the same as the pixel_mask of a warp
+		// constructed for that area but without computing any of the warping coefficients (useful for masking images)
+		static void ComputeMask(const cv::Mat_<float>& destination_shape, const cv::Mat_<int>& triangulation, int width, int height, cv::Mat_<uchar>& mask);
+
 		inline int NumberOfLandmarks() const { return destination_landmarks.rows / 2; };
 		inline int NumberOfTriangles() const { return triangulation.rows; };
 
@@ -130,7 +138,12 @@ namespace LandmarkDetector
 		// Helper functions for dealing with triangles
 		static bool sameSide(float x0, float y0, float x1, float y1, float x2, float y2, float x3, float y3);
 		static bool pointInTriangle(float x0, float y0, float x1, float y1, float x2, float y2, float x3, float y3);
-		static int findTriangle(const cv::Point_<float>& point, const std::vector<std::vector<float>>& control_points, int guess = -1);
+
+		// Filling in the triangle index and pixel mask by visiting the pixels within the bounding box of each triangle
+		void RasteriseTriangles(const std::vector<std::vector<float>>& control_points);
+
+		// Computing the triangle spans from the triangle index
+		void ComputeTriangleSpans();
 
 	};
 	//===========================================================================
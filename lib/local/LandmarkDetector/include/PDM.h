@@ -39,6 +39,12 @@
 #include <opencv2/core/core.hpp>
 
 #include "LandmarkDetectorParameters.h"
+#include "ModelBundle.h"
+
+namespace Utilities
+{
+	class MemoryReport;
+}
 
 namespace LandmarkDetector
 {
@@ -63,9 +69,19 @@ class PDM{
 		
 		// A copy constructor
 		PDM(const PDM& other);
+
+		// A copy with only the first num_modes modes of variation, for faster fitting (the parameters of the other modes are then zero)
+		PDM Truncated(int num_modes) const;
 			
 		bool Read(string location);
 
+		// Reading the model from a binary model bundle (the matrices will point to the bundle memory) and writing it to one, names are prefixed by prefix
+		bool Read(const ModelBundle& bundle, const string& prefix);
+		void Write(ModelBundleWriter& bundle, const string& prefix) const;
+
+		// Adding the memory of the model to the report under the component name
+		void ReportMemory(Utilities::MemoryReport& report, const string& component) const;
+
 		// Number of vertices
 		inline int NumberOfPoints() const {return mean_shape.rows/3;}
 		
@@ -79,13 +95,26 @@ class PDM{
 
 		// Compute shape in image space (2D)
 		void CalcShape2D(cv::Mat_<float>& out_shape, const cv::Mat_<float>& params_local, const cv::Vec6f& params_global) const;
+
+		// Batched versions for many parameter sets at once (hypotheses, faces or instances), with a row per set: the local parameters are
+		// K x modes and the shapes K x 3n (x, then y, then z of the vertices) or K x 2n (x, then y), so that each row reshapes to the shape of
+		// the single versions. The shapes are evaluated in one matrix multiplication, and the outputs are only reallocated if their size changes
+		void CalcShapes3D(cv::Mat_<float>& out_shapes, const cv::Mat_<float>& params_local) const;
+		void CalcShapes2D(cv::Mat_<float>& out_shapes, const cv::Mat_<float>& shapes_3D, const vector<cv::Vec6f>& params_global) const;
     
 		// provided the bounding box of a face and the local parameters (with optional rotation), generates the global parameters that can generate the face with the provided bounding box
-		void CalcParams(cv::Vec6f& out_params_global, const cv::Rect_<float>& bounding_box, const cv::Mat_<float>& params_local, const cv::Vec3f rotation = cv::Vec3f(0.0f));
+		void CalcParams(cv::Vec6f& out_params_global, const cv::Rect_<float>& bounding_box, const cv::Mat_<float>& params_local, const cv::Vec3f rotation = cv::Vec3f(0.0f)) const;
 
 		// Provided the landmark location compute global and local parameters best fitting it (can provide optional rotation for potentially better results)
 		void CalcParams(cv::Vec6f& out_params_global, cv::Mat_<float>& out_params_local, const cv::Mat_<float>& landmark_locations, const cv::Vec3f rotation = cv::Vec3f(0.0f));
 
+		// Refining the parameters of a previous fit to new landmark locations (all of them visible) with at most max_iterations iterations,
+		// returns false if they could not be used or did not converge in time, in which case the full CalcParams should be used
+		bool CalcParamsWarm(cv::Vec6f& params_global, cv::Mat_<float>& params_local, const cv::Mat_<float>& landmark_locations, int max_iterations);
+
+		// A copy with only the listed vertices (in that order), for repeatedly fitting to the same subset of landmarks
+		PDM Subsampled(const vector<int>& point_indices) const;
+
 		// provided the model parameters, compute the bounding box of a face
 		void CalcBoundingBox(cv::Rect_<float>& out_bounding_box, const cv::Vec6f& params_global, const cv::Mat_<float>& params_local);
 
@@ -93,12 +122,24 @@ class PDM{
 		void ComputeRigidJacobian(const cv::Mat_<float>& params_local, const cv::Vec6f& params_global, cv::Mat_<float> &Jacob, const cv::Mat_<float> W, cv::Mat_<float> &Jacob_t_w);
 		void ComputeJacobian(const cv::Mat_<float>& params_local, const cv::Vec6f& params_global, cv::Mat_<float> &Jacobian, const cv::Mat_<float> W, cv::Mat_<float> &Jacob_t_w);
 
+		// Allocation free versions for iterative fitting, the Jacobian (over rigid or all parameters) and the 3D shape are written into caller kept workspaces
+		void ComputeJacobianInPlace(const cv::Mat_<float>& params_local, const cv::Vec6f& params_global, bool rigid, cv::Mat_<float>& Jacobian, cv::Mat_<float>& shape_3D) const;
+
+		// Adds J'WJ to Hessian and computes J'Wv, with the diagonal W given as a column of weights
+		static void WeightedNormalEquations(const cv::Mat_<float>& Jacobian, const cv::Mat_<float>& weights, const cv::Mat_<float>& v, cv::Mat_<float>& Hessian, cv::Mat_<float>& J_w_t_v);
+
+		// Solves Hessian x = J_w_t_v in place with a Cholesky factorisation, without allocating, the Hessian is overwritten by its factor
+		// and J_w_t_v by the solution (zero when the Hessian is not positive definite, as with cv::solve)
+		static bool SolveNormalEquations(cv::Mat_<float>& Hessian, cv::Mat_<float>& J_w_t_v);
+
 		// Given the current parameters, and the computed delta_p compute the updated parameters
 		void UpdateModelParameters(const cv::Mat_<float>& delta_p, cv::Mat_<float>& params_local, cv::Vec6f& params_global);
 
 	private:
 		// Helper utilities
 		static void Orthonormalise(cv::Matx33f &R);
+		bool FitParams(cv::Vec6f& glob_params, cv::Mat_<float>& loc_params, const cv::Mat_<float>& landmark_locs_vis, int max_iterations, int patience);
+		static void WeightRows(cv::Mat_<float>& Jacob, const cv::Mat_<float>& W);
   };
   //===========================================================================
 }
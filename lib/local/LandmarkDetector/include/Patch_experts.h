@@ -38,14 +38,49 @@
 // OpenCV includes
 #include <opencv2/core/core.hpp>
 
+#include <algorithm>
+#include <memory>
+
 
 #include "SVR_patch_expert.h"
 #include "CCNF_patch_expert.h"
 #include "CEN_patch_expert.h"
 #include "PDM.h"
+#include "ImageContext.h"
+#include "OnnxModel.h"
 
 namespace LandmarkDetector
 {
+//===========================================================================
+// The scratch memory used when computing the response around a single landmark (and its mirrored pair)
+struct Landmark_workspace
+{
+	cv::Mat_<float> area_of_interest;
+	cv::Mat_<float> area_of_interest_mirror;
+	CEN_workspace cen;
+
+	// The im2col matrices of the CCNF patch experts, one per window size (indexed by it)
+	vector<cv::Mat_<float> > ccnf_im2col;
+};
+
+//===========================================================================
+// A landmark the patch responses are computed for, with the patch expert (view and landmark) evaluating it. The CEN experts of symmetric views also compute
+// the mirrored landmark at the same time, and landmarks without an expert are computed by the one of the mirrored view on the flipped area
+struct Response_task
+{
+	int landmark;
+
+	// The mirrored landmark computed together with it, -1 if none
+	int mirror;
+
+	int expert_view;
+	int expert_landmark;
+	bool flipped;
+};
+
+// A response computation prepared for evaluation (defined with the evaluation)
+struct Response_call;
+
 //===========================================================================
 /** 
     Combined class for all of the patch experts
@@ -67,8 +102,10 @@ public:
 	// The collection of CEN patch experts (for intensity images), the experts are laid out scale->view->landmark
 	vector<vector<vector<CEN_patch_expert> > >			cen_expert_intensity;
 
-	//Useful to pre-allocate data for im2col so that it is not allocated for every iteration and every patch
-	vector< map<int, cv::Mat_<float> > > preallocated_im2col;
+	// The areas of interest, the im2col and the CEN intermediate matrices of every landmark are preallocated, as are the CEN interpolation matrices
+	// of every window size, so that they are not allocated for every iteration and every patch
+	vector<Landmark_workspace> landmark_workspaces;
+	map<int, cv::Mat_<float> > interpolation_matrices;
 
 	// The available scales for intensity patch experts
 	vector<double>							patch_scaling;
@@ -89,7 +126,7 @@ public:
 
 
 	// A default constructor
-	Patch_experts(){;}
+	Patch_experts() : quantised(false), coarse_to_fine_window(0), response_grain_size(1) {;}
 
 	// A copy constructor
 	Patch_experts(const Patch_experts& other);
@@ -97,27 +134,119 @@ public:
 	// Returns the patch expert responses given a grayscale image.
 	// Additionally returns the transform from the image coordinates to the response coordinates (and vice versa).
 	// The computation also requires the current landmark locations to compute response around, the PDM corresponding to the desired model, and the parameters describing its instance
-	// Also need to provide the size of the area of interest and the desired scale of analysis
-	void Response(vector<cv::Mat_<float> >& patch_expert_responses, cv::Matx22f& sim_ref_to_img, cv::Matx22f& sim_img_to_ref, const cv::Mat_<float>& grayscale_image, 
+	// Also need to provide the size of the area of interest and the desired scale of analysis. Only the region of the image covered by the areas of interest is converted to floating point
+	// A non empty landmark mask limits the responses to the landmarks set in it (the others are left as they are)
+	// The scratch memory of the landmarks is that of the patch experts unless given, with their own scratch memory several fits can compute responses
+	// at once, provided the experts of the views and the window sizes have been precomputed (see WarmUp)
+	void Response(vector<cv::Mat_<float> >& patch_expert_responses, cv::Matx22f& sim_ref_to_img, cv::Matx22f& sim_img_to_ref, ImageContext& image,
+							 const PDM& pdm, const cv::Vec6f& params_global, const cv::Mat_<float>& params_local, int window_size, int scale, const cv::Mat_<int>& landmark_mask = cv::Mat_<int>(),
+							 vector<Landmark_workspace>* workspaces = 0);
+
+	// The same for an already converted floating point image
+	void Response(vector<cv::Mat_<float> >& patch_expert_responses, cv::Matx22f& sim_ref_to_img, cv::Matx22f& sim_img_to_ref, const cv::Mat_<float>& grayscale_image,
 							 const PDM& pdm, const cv::Vec6f& params_global, const cv::Mat_<float>& params_local, int window_size, int scale);
 
+	// Returns the patch expert responses for several instances of the model (e.g. multiple faces) in the same image, computed together so that areas of interest
+	// evaluated by the same patch expert are batched into one matrix multiplication, the outputs are laid out per instance
+	void ResponseBatch(vector<vector<cv::Mat_<float> > >& patch_expert_responses, vector<cv::Matx22f>& sim_ref_to_img, vector<cv::Matx22f>& sim_img_to_ref, ImageContext& image,
+		const PDM& pdm, const vector<cv::Vec6f>& params_global, const vector<cv::Mat_<float> >& params_local, int window_size, int scale);
+
+	// Returns the patch expert responses of several different models in the same image at the same scale (e.g. the left and right eye models),
+	// the landmarks of all of them are evaluated in one parallel loop rather than in one per model, the outputs are laid out per model
+	static void ResponseJoint(vector<Patch_experts*>& experts, vector<vector<cv::Mat_<float> >*>& patch_expert_responses, vector<cv::Matx22f>& sim_ref_to_img,
+		vector<cv::Matx22f>& sim_img_to_ref, ImageContext& image, const vector<const PDM*>& pdms, const vector<cv::Vec6f>& params_global,
+		const vector<cv::Mat_<float> >& params_local, const vector<int>& window_sizes, int scale, const vector<cv::Mat_<int> >& landmark_masks);
+
 	// Getting the best view associated with the current orientation
 	int GetViewIdx(const cv::Vec6f& params_global, int scale) const;
 
+	// Are the landmarks of a view computed together with their mirrored landmarks (for the CEN views that are their own mirror, e.g. the frontal
+	// one, the landmarks without an expert are computed by the flipped expert of their mirrored pair in the same call)
+	bool MirroredPairs(int view_id) const { return !cen_expert_intensity.empty() && (view_id == 0 || (!mirror_views.empty() && mirror_views.at<int>(view_id) == view_id)); }
+
 	// The number of views at a particular scale
 	inline int nViews(size_t scale = 0) const { return (int)centers[scale].size(); };
 
 	// Reading in all of the patch experts
 	bool Read(vector<string> intensity_svr_expert_locations, vector<string> intensity_ccnf_expert_locations, vector<string> intensity_cen_expert_locations, string early_term_loc = "");
+
+	// Reading and writing the patch experts using a binary model bundle (only CEN patch experts are supported)
+	// When reading from a bundle only the views and visibilities are read in, the patch experts of a view are read on first use (see LoadView)
+	bool Read(const std::shared_ptr<const ModelBundle>& bundle, const string& prefix);
+	bool Write(ModelBundleWriter& bundle, const string& prefix) const;
+
+	// Reducing the experts to the first num_scales scales and to the views within max_yaw (in radians) of the frontal one, together with the
+	// views they are mirrored from (for the model pruning tool), returns the indices of the views kept or an empty list if they could not be
+	// pruned (patch experts read from a model bundle, or scales with different views)
+	vector<int> Prune(int num_scales, double max_yaw);
+
+	// Makes sure the patch experts of a view (and its mirrored view) at a particular scale are read in, needs to be called before using them
+	// Only does something when the patch experts were read from a model bundle, otherwise all of them are already read in
+	void LoadView(int scale, int view);
+
+	// Precomputing everything that is otherwise computed on first use of a view with a window size (the per scale window sizes): reading the
+	// views in from a model bundle, the CCNF Sigmas and the CEN interpolation matrices
+	void WarmUp(const vector<int>& window_sizes);
+
+	// Exporting the (float) CEN patch experts of a view to an ONNX graph, the experts of the landmarks that have one are stacked so that the input
+	// called input is landmarks x N x (support area + 1), the rows of their im2col matrices, and the output called output is landmarks x N x 1.
+	// The landmarks are listed in the landmarks metadata, returns false if the view has no CEN experts or their networks differ in shape
+	bool ExportONNX(int scale, int view_id, OnnxGraph& graph);
+
+	// Adding the memory of the patch experts of every scale and view to the report under component/<type>/scale_<n>/view_<n>, and of the
+	// workspaces and precomputed matrices under component/workspaces and component/precomputed
+	void ReportMemory(Utilities::MemoryReport& report, const string& component) const;
+
+	// Switching the CEN patch experts between float and 8 bit inference (see FaceModelParameters::quantised_patch_experts)
+	void SetQuantised(bool quantised);
+	bool IsQuantised() const { return quantised; }
+
+	// The CEN responses of windows of at least this size are evaluated coarse to fine (see FaceModelParameters::coarse_to_fine_window), 0 for never
+	void SetCoarseToFineWindow(int min_window_size) { coarse_to_fine_window = min_window_size; }
+	int GetCoarseToFineWindow() const { return coarse_to_fine_window; }
+
+	// The number of landmarks every parallel response task computes (see FaceModelParameters::response_grain_size)
+	void SetResponseGrainSize(int grain_size) { response_grain_size = std::max(1, grain_size); }
+	int GetResponseGrainSize() const { return response_grain_size; }
    
 
 private:
 	bool Read_SVR_patch_experts(string expert_location, std::vector<cv::Vec3d>& centers, std::vector<cv::Mat_<int> >& visibility, std::vector<std::vector<Multi_SVR_patch_expert> >& patches, double& scale);
-	bool Read_CCNF_patch_experts(string patchesFileLocation, std::vector<cv::Vec3d>& centers, std::vector<cv::Mat_<int> >& visibility, std::vector<std::vector<CCNF_patch_expert> >& patches, double& patchScaling);
-	bool Read_CEN_patch_experts(string expert_location, std::vector<cv::Vec3d>& centers, std::vector<cv::Mat_<int> >& visibility, std::vector<std::vector<CEN_patch_expert> >& patches, double& scale);
+	bool Read_CCNF_patch_experts(string patchesFileLocation, std::vector<cv::Vec3d>& centers, std::vector<cv::Mat_<int> >& visibility, std::vector<std::vector<CCNF_patch_expert> >& patches, double& patchScaling, std::vector<std::vector<cv::Mat_<float> > >& sigma_components);
+	bool Read_CEN_patch_experts(string expert_location, std::vector<cv::Vec3d>& centers, std::vector<cv::Mat_<int> >& visibility, std::vector<std::vector<CEN_patch_expert> >& patches, double& scale, cv::Mat_<int>& mirror_inds, cv::Mat_<int>& mirror_views);
+
+	// Working out the landmark locations, transforms and task list of a response computation, without evaluating it
+	void PrepareResponse(Response_call& call, cv::Matx22f& sim_ref_to_img, cv::Matx22f& sim_img_to_ref, ImageContext& image, const PDM& pdm,
+		const cv::Vec6f& params_global, const cv::Mat_<float>& params_local, int window_size, int scale, const cv::Mat_<int>& landmark_mask,
+		vector<Landmark_workspace>* workspaces = 0);
+
+	// The largest support (patch expert size) of the experts of a view, which together with the window size gives the size of the areas of interest
+	int SupportSize(int scale, int view_id) const;
+
+	// Computes (on first use) the Sigmas of the CCNF patch experts of a view for the window size, returns the CEN interpolation matrix for it
+	cv::Mat_<float> PrecomputeWindowSize(int window_size, int scale, int view_id);
+
+	// The landmarks of a view to compute the responses for, built on first use of the view (after it is read in) and kept (see Response_task)
+	const vector<Response_task>& ResponseTasks(int scale, int view_id);
+	void BuildResponseTasks(int scale, int view_id, vector<Response_task>& tasks) const;
+
+	// The model bundle the patch experts are read from on demand (if any) and which of the scale/view slices have been read in already
+	std::shared_ptr<const ModelBundle>		bundle;
+	string									bundle_prefix;
+	vector<vector<bool> >					views_loaded;
+
+	// Are the CEN patch experts using 8 bit inference
+	bool									quantised;
+
+	// The smallest window size evaluated coarse to fine by the CEN patch experts (0 if none are)
+	int										coarse_to_fine_window;
+
+	// The grain size of the parallel loop over the response tasks
+	int										response_grain_size;
 
-	// Helper for collecting visibilities
-	std::vector<int> Collect_visible_landmarks(vector<vector<cv::Mat_<int> > > visibilities, int scale, int view_id, int n);
+	// The task lists of every scale and view
+	vector<vector<vector<Response_task> > >	response_tasks;
+	vector<vector<bool> >					response_tasks_built;
 };
  
 }
@@ -0,0 +1,61 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+namespace LandmarkDetector
+{
+	// The AVX2 and AVX-512 variants of the kernels dispatched in CpuDispatch.cpp (see CpuDispatch.h for what they compute). The files implementing
+	// them are compiled with the flags of their instruction set, so they only work on raw pointers through intrinsics: an inline function shared
+	// with the rest of the library (e.g. from the OpenCV or the standard headers) would be compiled for the instruction set too, and the linker
+	// could keep that copy for the baseline code. They do not contract the multiplications and additions, so that the results match the baseline
+
+	namespace Avx2
+	{
+		int FHOGOrientationRow(const float* grad_x, const float* grad_y, float* grad_len, int* orientation, int start, int width);
+		int MeanShiftSums(const float* response, const float* kde, const float* coord_x, const float* coord_y, int start, int count, float& sum, float& mx, float& my);
+		int BiasActivationRow(float* data, int start, int width, float bias, int activation);
+		int GemmPackedRows(const float* X, int start, int num_rows, int ldx, const float* panels, int k, int n, const float* bias, int activation, float* out, int ldo);
+	}
+
+	namespace Avx512
+	{
+		int FHOGOrientationRow(const float* grad_x, const float* grad_y, float* grad_len, int* orientation, int start, int width);
+		int MeanShiftSums(const float* response, const float* kde, const float* coord_x, const float* coord_y, int start, int count, float& sum, float& mx, float& my);
+		int BiasActivationRow(float* data, int start, int width, float bias, int activation);
+		int GemmPackedRows(const float* X, int start, int num_rows, int ldx, const float* panels, int k, int n, const float* bias, int activation, float* out, int ldo);
+	}
+}
+#endif // SIMD_KERNELS_H
@@ -18,14 +18,18 @@
 // OpenCV includes
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc.hpp>
+#ifndef OPENFACE_SLIM_LANDMARK_DETECTOR
 #include <opencv2/objdetect.hpp>
+#endif
 #include <opencv2/calib3d.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
+#ifndef OPENFACE_SLIM_LANDMARK_DETECTOR
 // dlib dependencies for face detection
 #include <dlib/image_processing/frontal_face_detector.h>
 #include <dlib/opencv.h>
+#endif
 
 // C++ stuff
 #include <stdio.h>
@@ -44,21 +48,8 @@
 #include <filesystem.hpp>
 #include <filesystem/fstream.hpp>
 
-// OpenBLAS stuff
-
-#include <openblas_config.h>
-// Instead of including cblas.h and f77blas.h (the definitions from OpenBLAS and other BLAS libraries differ, declare the required OpenBLAS functionality here)
-#ifdef __cplusplus
-extern "C" {
-	/* Assume C declarations for C++ */
-#endif  /* __cplusplus */
-
-	/*Set the number of threads on runtime.*/
-	void openblas_set_num_threads(int num_threads);
-
-	void sgemm_(char *, char *, blasint *, blasint *, blasint *, float *,
-		float  *, blasint *, float  *, blasint *, float  *, float  *, blasint *);
-}
+// BLAS stuff (the library is selected when building, see Gemm.h)
+#include "Gemm.h"
 
 
 #endif
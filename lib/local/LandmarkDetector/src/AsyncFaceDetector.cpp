@@ -0,0 +1,112 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "stdafx.h"
+
+#include "AsyncFaceDetector.h"
+
+#include <Concurrency.h>
+
+using namespace LandmarkDetector;
+
+AsyncFaceDetector::AsyncFaceDetector() : pending(false), done(false), face_found(false)
+{
+}
+
+AsyncFaceDetector::~AsyncFaceDetector()
+{
+	Cancel();
+}
+
+AsyncFaceDetector::AsyncFaceDetector(const AsyncFaceDetector&) : pending(false), done(false), face_found(false)
+{
+}
+
+AsyncFaceDetector & AsyncFaceDetector::operator= (const AsyncFaceDetector& other)
+{
+	if (this != &other)
+	{
+		Cancel();
+	}
+	return *this;
+}
+
+void AsyncFaceDetector::Start(const std::function<bool(cv::Rect_<float>&)>& detect, cv::Size frame_size)
+{
+	Cancel();
+
+	pending = true;
+	done = false;
+	result_frame_size = frame_size;
+
+	detection_thread = std::thread([this, detect] {
+		Utilities::Concurrency::Execute([&] { face_found = detect(result); });
+		done = true;
+	});
+}
+
+bool AsyncFaceDetector::GetResult(cv::Rect_<float>& bounding_box, cv::Size current_frame_size)
+{
+	if (!IsReady())
+	{
+		return false;
+	}
+
+	detection_thread.join();
+	pending = false;
+
+	if (!face_found)
+	{
+		return false;
+	}
+
+	bounding_box = result;
+	if (current_frame_size != result_frame_size && result_frame_size.width > 0 && result_frame_size.height > 0)
+	{
+		float scale_x = (float)current_frame_size.width / result_frame_size.width;
+		float scale_y = (float)current_frame_size.height / result_frame_size.height;
+		bounding_box = cv::Rect_<float>(result.x * scale_x, result.y * scale_y, result.width * scale_x, result.height * scale_y);
+	}
+	return true;
+}
+
+void AsyncFaceDetector::Cancel()
+{
+	if (pending)
+	{
+		detection_thread.join();
+		pending = false;
+	}
+}
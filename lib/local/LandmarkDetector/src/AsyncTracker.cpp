@@ -0,0 +1,181 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+
+#include "AsyncTracker.h"
+
+#include "LandmarkDetectorFunc.h"
+
+#include <Concurrency.h>
+
+// TBB includes
+#include <tbb/task_arena.h>
+
+using namespace LandmarkDetector;
+
+namespace
+{
+	// The arena of the trackers when the embedding application does not supply one
+	tbb::task_arena& GetDefaultArena()
+	{
+		static tbb::task_arena arena;
+		return arena;
+	}
+}
+
+AsyncTracker::AsyncTracker(const CLNF& face_model, const FaceModelParameters& params) : model(face_model), params(params), frame_number(0), processing(false)
+{
+}
+
+AsyncTracker::~AsyncTracker()
+{
+	Wait();
+}
+
+std::future<TrackingResult> AsyncTracker::Submit(const cv::Mat& rgb_image, const cv::Mat& grayscale_image, double time_stamp)
+{
+	// The promise is shared, as std::function needs a copyable task
+	std::shared_ptr<std::promise<TrackingResult> > promise = std::make_shared<std::promise<TrackingResult> >();
+	std::future<TrackingResult> result = promise->get_future();
+
+	Enqueue([this, promise, rgb_image, grayscale_image, time_stamp] {
+		try
+		{
+			promise->set_value(Track(rgb_image, grayscale_image, time_stamp));
+		}
+		catch (...)
+		{
+			promise->set_exception(std::current_exception());
+		}
+	});
+	return result;
+}
+
+void AsyncTracker::Submit(const cv::Mat& rgb_image, const cv::Mat& grayscale_image, double time_stamp, const std::function<void(const TrackingResult&)>& callback)
+{
+	Enqueue([this, callback, rgb_image, grayscale_image, time_stamp] {
+		TrackingResult result;
+		try
+		{
+			result = Track(rgb_image, grayscale_image, time_stamp);
+		}
+		catch (...)
+		{
+			// Reported as a failed frame, there is no one to rethrow to
+			result.time_stamp = time_stamp;
+		}
+		callback(result);
+	});
+}
+
+void AsyncTracker::Reset()
+{
+	Enqueue([this] {
+		model.Reset();
+	});
+}
+
+size_t AsyncTracker::Pending() const
+{
+	std::lock_guard<std::mutex> lock(queue_mutex);
+	return queue.size() + (processing ? 1 : 0);
+}
+
+void AsyncTracker::Wait()
+{
+	std::unique_lock<std::mutex> lock(queue_mutex);
+	queue_idle.wait(lock, [this] { return !processing && queue.empty(); });
+}
+
+void AsyncTracker::Enqueue(const std::function<void()>& task)
+{
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		queue.push_back(task);
+		if (processing)
+		{
+			// The task processing the queue picks it up
+			return;
+		}
+		processing = true;
+	}
+
+	// Without worker threads an enqueued task would never run
+	if (Utilities::Concurrency::GetNumThreads() == 1)
+	{
+		ProcessQueue();
+		return;
+	}
+
+	tbb::task_arena* arena = Utilities::Concurrency::GetArena();
+	(arena != nullptr ? *arena : GetDefaultArena()).enqueue([this] { ProcessQueue(); });
+}
+
+void AsyncTracker::ProcessQueue()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			if (queue.empty())
+			{
+				processing = false;
+				queue_idle.notify_all();
+				return;
+			}
+			task = queue.front();
+			queue.pop_front();
+		}
+		task();
+	}
+}
+
+TrackingResult AsyncTracker::Track(const cv::Mat& rgb_image, const cv::Mat& grayscale_image, double time_stamp)
+{
+	// The grayscale image is converted by the tracking if it is not given
+	cv::Mat grayscale = grayscale_image;
+
+	TrackingResult result;
+	result.success = DetectLandmarksInVideo(rgb_image, model, params, grayscale, time_stamp);
+	result.detection_certainty = model.detection_certainty;
+	result.time_stamp = time_stamp;
+	result.frame_number = frame_number++;
+	result.detected_landmarks = model.detected_landmarks.clone();
+	result.params_global = model.params_global;
+	result.params_local = model.params_local.clone();
+	result.bounding_box = model.GetBoundingBox();
+	return result;
+}
@@ -41,12 +41,13 @@
 #include <opencv2/imgproc.hpp>
 
 // Local includes
+#include "CpuDispatch.h"
 #include "LandmarkDetectorUtils.h"
 
 using namespace LandmarkDetector;
 
-// Copy constructors of neuron and patch expert
-CCNF_neuron::CCNF_neuron(const CCNF_neuron& other) : weights(other.weights.clone())
+// Copy constructors of neuron and patch expert (the weights are read only, so they are shared between the copies rather than cloned)
+CCNF_neuron::CCNF_neuron(const CCNF_neuron& other) : weights(other.weights)
 {
 	this->neuron_type = other.neuron_type;
 	this->norm_weights = other.norm_weights;
@@ -55,8 +56,7 @@ CCNF_neuron::CCNF_neuron(const CCNF_neuron& other) : weights(other.weights.clone
 
 	for (std::map<int, cv::Mat_<double> >::const_iterator it = other.weights_dfts.begin(); it != other.weights_dfts.end(); it++)
 	{
-		// Make sure the matrix is copied.
-		this->weights_dfts.insert(std::pair<int, cv::Mat>(it->first, it->second.clone()));
+		this->weights_dfts.insert(std::pair<int, cv::Mat>(it->first, it->second));
 	}
 }
 
@@ -67,13 +67,12 @@ CCNF_patch_expert::CCNF_patch_expert(const CCNF_patch_expert& other) : neurons(o
 	this->height = other.height;
 	this->patch_confidence = other.patch_confidence;
 	
-	this->weight_matrix = other.weight_matrix.clone();
+	this->weight_matrix = other.weight_matrix;
 
-	// Copy the Sigmas in a deep way
+	// Already computed Sigmas are not modified, so can be shared, new ones are added to this copy only
 	for (std::vector<cv::Mat_<float> >::const_iterator it = other.Sigmas.begin(); it != other.Sigmas.end(); it++)
 	{
-		// Make sure the matrix is copied.
-		this->Sigmas.push_back(it->clone());
+		this->Sigmas.push_back(*it);
 	}
 
 }
@@ -136,14 +135,18 @@ void CCNF_neuron::Read(ifstream &stream)
 }
 
 // Perform im2col, while at the same time doing contrast normalization and adding a bias term 
-void im2colContrastNormBias(const cv::Mat_<float>& input, const unsigned int width, const unsigned int height, cv::Mat_<float>& output)
+// The support (WIDTH x HEIGHT) and the window (WINDOW x WINDOW blocks) sizes can be fixed at compile time so that the loops get unrolled and
+// vectorised, with a size of 0 the runtime one is used instead. The mean and the norm of every block come from integral images, so that
+// each block is normalised while it is copied, in a single pass
+template<unsigned int WIDTH, unsigned int HEIGHT, unsigned int WINDOW>
+static void im2colContrastNormBiasImpl(const cv::Mat_<float>& input, const unsigned int width_rt, const unsigned int height_rt, cv::Mat_<float>& output)
 {
-	const unsigned int m = input.rows;
-	const unsigned int n = input.cols;
+	const unsigned int width = WIDTH > 0 ? WIDTH : width_rt;
+	const unsigned int height = HEIGHT > 0 ? HEIGHT : height_rt;
 
 	// determine how many blocks there will be with a sliding window of width x height in the input
-	const unsigned int yB = m - height + 1;
-	const unsigned int xB = n - width + 1;
+	const unsigned int yB = WINDOW > 0 ? WINDOW : input.rows - height + 1;
+	const unsigned int xB = WINDOW > 0 ? WINDOW : input.cols - width + 1;
 
 	// Allocate the output size
 	if (output.rows != xB*yB && output.cols != width * height + 1) 
@@ -151,6 +154,12 @@ void im2colContrastNormBias(const cv::Mat_<float>& input, const unsigned int wid
 		output = cv::Mat::ones(xB*yB, width * height + 1, CV_32F);
 	}
 
+	// The sums and the squared sums of the blocks (in double, as the squared sum of the centred values is their difference)
+	cv::Mat_<double> integral_sum, integral_sum_sq;
+	cv::integral(input, integral_sum, integral_sum_sq, CV_64F, CV_64F);
+
+	const double num_items = (double)(width * height);
+
 	// Iterate over the blocks
 	unsigned int rowIdx = 0;
 	for (unsigned int j = 0; j< xB; j++)
@@ -160,35 +169,13 @@ void im2colContrastNormBias(const cv::Mat_<float>& input, const unsigned int wid
 
 			float* Mo = output.ptr<float>(rowIdx);
 
-			float sum = 0;
-
-			for (unsigned int yy = 0; yy < height; ++yy)
-			{
-				const float* Mi = input.ptr<float>(i + yy);
-				for (unsigned int xx = 0; xx < width; ++xx)
-				{
-					unsigned int colIdx = xx*height + yy;
-					float in = Mi[j + xx];
-					sum += in;
-
-					Mo[colIdx + 1] = in;
-				}
-			}
-
-			// Working out the mean
-			float mean = sum / (float)(width * height);
+			const double sum = integral_sum(i + height, j + width) - integral_sum(i, j + width) - integral_sum(i + height, j) + integral_sum(i, j);
+			const double sum_sq = integral_sum_sq(i + height, j + width) - integral_sum_sq(i, j + width) - integral_sum_sq(i + height, j) + integral_sum_sq(i, j);
 
-			float sum_sq = 0;
-			const unsigned int num_items = width*height + 1;
-			// Working out the sum squared and subtracting the mean
-			for (unsigned int x = 1; x < num_items; ++x)
-			{
-				float in = Mo[x] - mean;
-				Mo[x] = in;
-				sum_sq += in * in;
-			}
-
-			float norm = sqrt(sum_sq);
+			// Working out the mean and the norm of the centred values
+			const float mean = (float)(sum / num_items);
+			double norm_sq = sum_sq - sum * sum / num_items;
+			float norm = norm_sq > 0 ? (float)sqrt(norm_sq) : 0;
 
 			// Avoiding division by 0
 			if (norm == 0)
@@ -197,11 +184,15 @@ void im2colContrastNormBias(const cv::Mat_<float>& input, const unsigned int wid
 			}
 
 			// Flip multiplication to division for speed
-			norm = 1.0 / norm;
+			norm = 1.0f / norm;
 
-			for (unsigned int x = 1; x < num_items; ++x)
+			for (unsigned int yy = 0; yy < height; ++yy)
 			{
-				Mo[x] *= norm;
+				const float* Mi = input.ptr<float>(i + yy) + j;
+				for (unsigned int xx = 0; xx < width; ++xx)
+				{
+					Mo[xx*height + yy + 1] = (Mi[xx] - mean) * norm;
+				}
 			}
 
 			rowIdx++;
@@ -209,6 +200,25 @@ void im2colContrastNormBias(const cv::Mat_<float>& input, const unsigned int wid
 	}
 }
 
+// Dispatching to the specialised versions for the 11x11 support of the CCNF experts and the window sizes used by the models
+void im2colContrastNormBias(const cv::Mat_<float>& input, const unsigned int width, const unsigned int height, cv::Mat_<float>& output)
+{
+	if (width == 11 && height == 11 && input.rows == input.cols)
+	{
+		switch (input.rows - 10)
+		{
+			case 5: im2colContrastNormBiasImpl<11, 11, 5>(input, width, height, output); return;
+			case 7: im2colContrastNormBiasImpl<11, 11, 7>(input, width, height, output); return;
+			case 9: im2colContrastNormBiasImpl<11, 11, 9>(input, width, height, output); return;
+			case 11: im2colContrastNormBiasImpl<11, 11, 11>(input, width, height, output); return;
+			case 13: im2colContrastNormBiasImpl<11, 11, 13>(input, width, height, output); return;
+			case 15: im2colContrastNormBiasImpl<11, 11, 15>(input, width, height, output); return;
+			default: im2colContrastNormBiasImpl<11, 11, 0>(input, width, height, output); return;
+		}
+	}
+	im2colContrastNormBiasImpl<0, 0, 0>(input, width, height, output);
+}
+
 //===========================================================================
 void CCNF_neuron::Response(const cv::Mat_<float> &im, cv::Mat_<double> &im_dft, cv::Mat &integral_img, cv::Mat &integral_img_sq, cv::Mat_<float> &resp)
 {
@@ -328,8 +338,8 @@ void CCNF_patch_expert::Read(ifstream &stream, std::vector<int> window_sizes, st
 		weight_matrix.at<float>(i, 0) = neurons[i].bias;
 	}
 
-	// In case we are using OpenBLAS, make sure it is not multi-threading as we are multi-threading outside of it
-	openblas_set_num_threads(1);
+	// Make sure the BLAS library is not multi-threading as we are multi-threading outside of it
+	SetBlasThreads(1);
 
 	int n_sigmas = window_sizes.size();
 
@@ -447,29 +457,33 @@ void CCNF_patch_expert::ResponseOpenBlas(const cv::Mat_<float> &area_of_interest
 
 
 	cv::Mat_<float> neuron_resp_full(weight_matrix.rows, normalized_input.cols, 0.0f);
-	// Perform matrix multiplication in OpenBLAS (fortran call)
-	float alpha1 = 1.0;
-	float beta1 = 0.0;
-	char N[2]; N[0] = 'N';
-	sgemm_(N, N, &normalized_input.cols, &weight_matrix.rows, &weight_matrix.cols, &alpha1, (float*)normalized_input.data, &normalized_input.cols, (float*)weight_matrix.data, &weight_matrix.cols, &beta1, (float*)neuron_resp_full.data, &normalized_input.cols);
+	// Perform matrix multiplication through BLAS
+	Gemm(false, false, normalized_input.cols, weight_matrix.rows, weight_matrix.cols, 1.0f, (float*)normalized_input.data, normalized_input.cols, (float*)weight_matrix.data, weight_matrix.cols, 0.0f, (float*)neuron_resp_full.data, normalized_input.cols);
 
 	// Above is a faster version of this
 	//cv::Mat_<float> neuron_resp_full = this->weight_matrix * normalized_input;
 
+	// The logistic function (sigmoid) applied to the response, as for CEN the exponent is negated first so that it can be computed in bulk
+	const int num_pixels = neuron_resp_full.cols;
+	float* p = (float*)response.data;
 	for (size_t i = 0; i < neurons.size(); i++)
 	{
 		if (neurons[i].alpha > 1e-4)
 		{
-			cv::MatIterator_<float> p = response.begin();
-
 			cv::Mat_<float> rel_row = neuron_resp_full.row(i);
-			cv::MatIterator_<float> q1 = rel_row.begin(); // respone for each pixel
-			cv::MatIterator_<float> q2 = rel_row.end();
+			float* q = rel_row.ptr<float>(0); // respone for each pixel
+
+			int x = Kernels::BiasActivationRow(q, 0, num_pixels, 0.0f, 0);
+			for (; x < num_pixels; ++x)
+			{
+				q[x] = -q[x];
+			}
+			cv::exp(rel_row, rel_row);
 
-			// the logistic function (sigmoid) applied to the response
-			while (q1 != q2)
+			const float scale = (float)(2.0 * neurons[i].alpha);
+			for (x = 0; x < num_pixels; ++x)
 			{
-				*p++ += (2.0 * neurons[i].alpha) / (1.0 + exp(-*q1++));
+				p[x] += scale / (1.0f + q[x]);
 			}
 		}
 	}
@@ -492,10 +506,8 @@ void CCNF_patch_expert::ResponseOpenBlas(const cv::Mat_<float> &area_of_interest
 
 	cv::Mat_<float> out(Sigmas[s_to_use].rows, resp_vec_f.cols, 0.0f);
 
-	// Perform matrix multiplication in OpenBLAS (fortran call)
-	alpha1 = 1.0;
-	beta1 = 0.0;
-	sgemm_(N, N, &resp_vec_f.cols, &Sigmas[s_to_use].rows, &Sigmas[s_to_use].cols, &alpha1, (float*)resp_vec_f.data, &resp_vec_f.cols, (float*)Sigmas[s_to_use].data, &Sigmas[s_to_use].cols, &beta1, (float*)out.data, &resp_vec_f.cols);
+	// Perform matrix multiplication through BLAS
+	Gemm(false, false, resp_vec_f.cols, Sigmas[s_to_use].rows, Sigmas[s_to_use].cols, 1.0f, (float*)resp_vec_f.data, resp_vec_f.cols, (float*)Sigmas[s_to_use].data, Sigmas[s_to_use].cols, 0.0f, (float*)out.data, resp_vec_f.cols);
 
 	// Above is a faster version of this
 	//cv::Mat out = Sigmas[s_to_use] * resp_vec_f;
@@ -41,13 +41,31 @@
 #include <opencv2/imgproc.hpp>
 
 // Local includes
+#include "CpuDispatch.h"
 #include "LandmarkDetectorUtils.h"
 
 // For exponential
 #include <math.h> 
 
+// For the peak of the coarse responses
+#include <algorithm>
+#include <atomic>
+
 using namespace LandmarkDetector;
 
+// Whether the experts read from now on are converted to half precision
+static std::atomic<bool> half_precision_weights(false);
+
+void LandmarkDetector::SetHalfPrecisionWeights(bool half_precision)
+{
+	half_precision_weights = half_precision;
+}
+
+bool LandmarkDetector::GetHalfPrecisionWeights()
+{
+	return half_precision_weights;
+}
+
 // Copy constructor	(do not perform a deep copy of data as it is very large, also there is no real need to stor the copies
 CEN_patch_expert::CEN_patch_expert(const CEN_patch_expert& other) : confidence(other.confidence), width_support(other.width_support), height_support(other.height_support)
 {
@@ -60,14 +78,22 @@ CEN_patch_expert::CEN_patch_expert(const CEN_patch_expert& other) : confidence(o
 		this->activation_function.push_back(other.activation_function[i]);
 	}
 
+	// The quantised weights are read only as well, so can be shared (as can the ones already on the device)
+	this->weights_quantised = other.weights_quantised;
+	this->weight_scales = other.weight_scales;
+	this->weights_half = other.weights_half;
+	this->weights_packed = other.weights_packed;
+	this->weights_device = other.weights_device;
+	this->biases_device = other.biases_device;
+
 }
 
 //===========================================================================
 void CEN_patch_expert::Read(ifstream &stream)
 {
 
-	// Setting up OpenBLAS
-	openblas_set_num_threads(1);
+	// Setting up BLAS
+	SetBlasThreads(1);
 	
 	// Sanity check
 	int read_type;
@@ -113,6 +139,141 @@ void CEN_patch_expert::Read(ifstream &stream)
 
 }
 
+//===========================================================================
+bool CEN_patch_expert::Read(const ModelBundle& bundle, const std::string& prefix)
+{
+	// The scalars are stored as [width_support, height_support, confidence, num_layers, activation functions...]
+	std::vector<double> meta;
+	if (!bundle.GetValues(prefix + "meta", meta) || meta.size() < 4)
+	{
+		return false;
+	}
+
+	width_support = (int)meta[0];
+	height_support = (int)meta[1];
+	confidence = meta[2];
+
+	// Every layer needs its activation function in the scalars (checked on the double, so a corrupt count is not cast first)
+	if (!(meta[3] >= 0 && meta[3] <= (double)(meta.size() - 4)))
+	{
+		return false;
+	}
+	int num_layers = (int)meta[3];
+
+	activation_function.resize(num_layers);
+	weights.resize(num_layers);
+	biases.resize(num_layers);
+	weights_half.clear();
+	int num_half = 0;
+
+	for (int i = 0; i < num_layers; i++)
+	{
+		activation_function[i] = (int)meta[4 + i];
+
+		cv::Mat weight, bias;
+		if (!bundle.GetMat(prefix + "w" + std::to_string(i), weight) || !bundle.GetMat(prefix + "b" + std::to_string(i), bias))
+		{
+			return false;
+		}
+
+		// A half precision bundle stores the weights as float16, they stay views into the bundle as well
+		if (weight.type() == CV_16S)
+		{
+			weights_half.resize(num_layers);
+			weights_half[i] = weight;
+			num_half++;
+		}
+		else
+		{
+			weights[i] = weight;
+		}
+		biases[i] = bias;
+	}
+
+	// Either all of the layers are in half precision or none of them
+	return num_half == 0 || num_half == num_layers;
+}
+
+void CEN_patch_expert::Write(ModelBundleWriter& bundle, const std::string& prefix) const
+{
+	std::vector<double> meta;
+	meta.push_back(width_support);
+	meta.push_back(height_support);
+	meta.push_back(confidence);
+	meta.push_back((double)weights.size());
+	for (size_t i = 0; i < activation_function.size(); ++i)
+	{
+		meta.push_back(activation_function[i]);
+	}
+	bundle.AddValues(prefix + "meta", meta);
+
+	for (size_t i = 0; i < weights.size(); i++)
+	{
+		cv::Mat_<float> unpacked;
+		bundle.AddMat(prefix + "w" + std::to_string(i), weights_half.empty() ? (const cv::Mat&)LayerWeights(i, unpacked) : (const cv::Mat&)weights_half[i]);
+		bundle.AddMat(prefix + "b" + std::to_string(i), biases[i]);
+	}
+}
+
+//===========================================================================
+void CEN_patch_expert::PackWeights()
+{
+	if (!weights_packed.empty() || !weights_half.empty())
+	{
+		return;
+	}
+
+	weights_packed.resize(weights.size());
+	for (size_t layer = 0; layer < weights.size(); ++layer)
+	{
+		// The layer is out = W * in with an output per row of W, the packed product with one sample per row needs W transposed
+		weights_packed[layer].Pack(weights[layer], true);
+		weights[layer].release();
+	}
+}
+
+void CEN_patch_expert::SetHalfPrecision()
+{
+	if (!weights_half.empty())
+	{
+		return;
+	}
+
+	weights_half.resize(weights.size());
+	cv::Mat_<float> unpacked;
+	for (size_t layer = 0; layer < weights.size(); ++layer)
+	{
+		cv::Mat weight_half;
+		cv::convertFp16(LayerWeights(layer, unpacked), weight_half);
+		weights_half[layer] = weight_half;
+
+		// Releasing the float weights, only the shape of the layer is needed from them
+		weights[layer].release();
+	}
+	weights_packed.clear();
+
+	// The device copies would be uploaded from the widened weights again
+	weights_device.clear();
+	biases_device.clear();
+}
+
+const cv::Mat_<float>& CEN_patch_expert::LayerWeights(size_t layer, cv::Mat_<float>& widened) const
+{
+	if (!weights_packed.empty())
+	{
+		weights_packed[layer].Unpack(widened, true);
+		return widened;
+	}
+	if (weights_half.empty())
+	{
+		return weights[layer];
+	}
+
+	// convertFp16 uses F16C or NEON where the CPU has them
+	cv::convertFp16(weights_half[layer], widened);
+	return widened;
+}
+
 // Contrast normalize the input for response map computation
 void contrastNorm(const cv::Mat_<float>& input, cv::Mat_<float>& output)
 {
@@ -208,17 +369,15 @@ void CEN_patch_expert::Response(const cv::Mat_<float> &area_of_interest, cv::Mat
 		// We are performing response = weights[layers] * response(t), but in OpenBLAS as that is significantly quicker than OpenCV		
 		cv::Mat_<float> resp = response;
 		float* m1 = (float*)resp.data;
-		cv::Mat_<float> weight = weights[layer];
+		cv::Mat_<float> widened;
+		cv::Mat_<float> weight = LayerWeights(layer, widened);
 		float* m2 = (float*)weight.data;
 
 		cv::Mat_<float> resp_blas(weight.rows, resp.cols);
 		float* m3 = (float*)resp_blas.data;
 
-		// Perform matrix multiplication in OpenBLAS (fortran call)
-		float alpha1 = 1.0;
-		float beta1 = 0.0;
-		char N[2]; N[0] = 'N';
-		sgemm_(N, N, &resp.cols, &weight.rows, &weight.cols, &alpha1, m1, &resp.cols, m2, &weight.cols, &beta1, m3, &resp.cols);
+		// Perform matrix multiplication through BLAS
+		Gemm(false, false, resp.cols, weight.rows, weight.cols, 1.0f, m1, resp.cols, m2, weight.cols, 0.0f, m3, resp.cols);
 
 		// The above is a faster version of this, by calling the fortran version directly
 		//cblas_sgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, resp.cols, weight.rows, weight.cols, 1, m1, resp.cols, m2, weight.cols, 0.0, m3, resp.cols);
@@ -270,14 +429,17 @@ void CEN_patch_expert::Response(const cv::Mat_<float> &area_of_interest, cv::Mat
 }
 
 // Perform im2col, while at the same time doing contrast normalization and adding a bias term (also skip every other region)
-void im2colBiasSparseContrastNorm(const cv::Mat_<float>& input, const unsigned int width, const unsigned int height, cv::Mat_<float>& output)
+// The support (WIDTH x HEIGHT) and the window (WINDOW x WINDOW blocks) sizes can be fixed at compile time so that the loops get unrolled and
+// vectorised, with a size of 0 the runtime one is used instead
+template<unsigned int WIDTH, unsigned int HEIGHT, unsigned int WINDOW>
+static void im2colBiasSparseContrastNormImpl(const cv::Mat_<float>& input, const unsigned int width_rt, const unsigned int height_rt, cv::Mat_<float>& output)
 {
-	const unsigned int m = input.rows;
-	const unsigned int n = input.cols;
+	const unsigned int width = WIDTH > 0 ? WIDTH : width_rt;
+	const unsigned int height = HEIGHT > 0 ? HEIGHT : height_rt;
 
 	// determine how many blocks there will be with a sliding window of width x height in the input
-	const unsigned int yB = m - height + 1;
-	const unsigned int xB = n - width + 1;
+	const unsigned int yB = WINDOW > 0 ? WINDOW : input.rows - height + 1;
+	const unsigned int xB = WINDOW > 0 ? WINDOW : input.cols - width + 1;
 
 	// As we will be skipping half of the outputs
 	const unsigned int out_size = (yB*xB - 1) / 2;
@@ -353,6 +515,25 @@ void im2colBiasSparseContrastNorm(const cv::Mat_<float>& input, const unsigned i
 	}
 }
 
+// Dispatching to the specialised versions for the 11x11 support of the CEN experts and the window sizes used by the models
+void im2colBiasSparseContrastNorm(const cv::Mat_<float>& input, const unsigned int width, const unsigned int height, cv::Mat_<float>& output)
+{
+	if (width == 11 && height == 11 && input.rows == input.cols)
+	{
+		switch (input.rows - 10)
+		{
+			case 5: im2colBiasSparseContrastNormImpl<11, 11, 5>(input, width, height, output); return;
+			case 7: im2colBiasSparseContrastNormImpl<11, 11, 7>(input, width, height, output); return;
+			case 9: im2colBiasSparseContrastNormImpl<11, 11, 9>(input, width, height, output); return;
+			case 11: im2colBiasSparseContrastNormImpl<11, 11, 11>(input, width, height, output); return;
+			case 13: im2colBiasSparseContrastNormImpl<11, 11, 13>(input, width, height, output); return;
+			case 15: im2colBiasSparseContrastNormImpl<11, 11, 15>(input, width, height, output); return;
+			default: im2colBiasSparseContrastNormImpl<11, 11, 0>(input, width, height, output); return;
+		}
+	}
+	im2colBiasSparseContrastNormImpl<0, 0, 0>(input, width, height, output);
+}
+
 void im2colBiasSparse(const cv::Mat_<float>& input, const unsigned int width, const unsigned int height, cv::Mat_<float>& output)
 {
 
@@ -474,24 +655,55 @@ void LandmarkDetector::interpolationMatrix(cv::Mat_<float>& mapMatrix, int respo
 	}
 }
 
-void CEN_patch_expert::ResponseInternal(cv::Mat_<float>& response)
+// Computes the network response given the im2col matrix of the input (one sample per row), the response has one column per sample
+// The bias and the activation of every layer are applied in a single pass over the output of the matrix multiplication, and the exponentials are
+// computed in bulk using OpenCV as it is vectorised
+void CEN_patch_expert::ResponseInternal(const cv::Mat_<float>& im2col, cv::Mat_<float>& response)
+{
+	CEN_workspace workspace;
+	ResponseInternal(im2col, response, workspace);
+}
+
+void CEN_patch_expert::ResponseInternal(const cv::Mat_<float>& im2col, cv::Mat_<float>& response, CEN_workspace& workspace)
 {
+	if (!weights_quantised.empty())
+	{
+		ResponseInternalQuantised(im2col, response, workspace);
+		return;
+	}
+	if (!weights_packed.empty())
+	{
+		ResponseInternalPacked(im2col, response, workspace);
+		return;
+	}
+
+	if (!weights_half.empty() && workspace.weights_widened.size() < weights_half.size())
+	{
+		workspace.weights_widened.resize(weights_half.size());
+	}
+
 	for (size_t layer = 0; layer < activation_function.size(); ++layer)
 	{
 
-		// We are performing response = weights[layers] * response, but in OpenBLAS as that is significantly quicker than OpenCV		
-		cv::Mat_<float> resp = response;
-		float* m1 = (float*)resp.data;
-		float* m2 = (float*)weights[layer].data;
+		// We are performing response = weights[layers] * response, but in OpenBLAS as that is significantly quicker than OpenCV
+		// The first layer reads the im2col matrix as transposed input directly, so it does not need to be transposed beforehand
+		const bool first_layer = layer == 0;
+		const cv::Mat_<float>& input = first_layer ? im2col : response;
+		int num_samples = first_layer ? input.rows : input.cols;
+		int lda = input.cols;
+		float* m1 = (float*)input.data;
+
+		// The half precision weights are widened a layer at a time into the workspace, the layer is small enough to stay in the cache for the
+		// matrix multiplication reading it right after
+		const cv::Mat_<float>& weight = weights_half.empty() ? weights[layer] : LayerWeights(layer, workspace.weights_widened[layer]);
+		float* m2 = (float*)weight.data;
 
-		cv::Mat_<float> resp_blas(weights[layer].rows, resp.cols);
+		cv::Mat_<float>& resp_blas = workspace.layer_outputs[layer % 2];
+		resp_blas.create(weight.rows, num_samples);
 		float* m3 = (float*)resp_blas.data;
 
-		// Perform matrix multiplication in OpenBLAS (fortran call)
-		float alpha1 = 1.0;
-		float beta1 = 0.0;
-		char N[2]; N[0] = 'N';
-		sgemm_(N, N, &resp.cols, &weights[layer].rows, &weights[layer].cols, &alpha1, m1, &resp.cols, m2, &weights[layer].cols, &beta1, m3, &resp.cols);
+		// Perform matrix multiplication through BLAS
+		Gemm(first_layer, false, num_samples, weight.rows, weight.cols, 1.0f, m1, lda, m2, weight.cols, 0.0f, m3, num_samples);
 
 		// The above is a faster version of this, by calling the fortran version directly
 		//cblas_sgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, resp.cols, weight.rows, weight.cols, 1, m1, resp.cols, m2, weight.cols, 0.0, m3, resp.cols);
@@ -501,116 +713,640 @@ void CEN_patch_expert::ResponseInternal(cv::Mat_<float>& response)
 		// Alternative is to multiply the responses directly using OpenCV (much slower)
 		//response = weights[layer] * response;
 
-		// Adding the bias (bit ugly, but the fastest way to do this), TODO can this bias be incorporated in the above?
+		// Adding the bias together with the activation in one pass (for sigmoid the exponent is negated, so that it can be computed in bulk below)
 		float* data = (float*)response.data;
 		const unsigned height = response.rows;
 		const unsigned width = response.cols;
-		float* data_b = (float*)biases[layer].data;
-		for (unsigned int y = 0; y < height; ++y)
+		const float* data_b = (const float*)biases[layer].data;
+		const int activation = activation_function[layer];
+
+		for (unsigned int y = 0; y < height; ++y, data += width)
 		{
-			float bias = data_b[y];
-			for (unsigned int x = 0; x < width; ++x)
+			const float bias = data_b[y];
+
+			// The AVX2 or AVX-512 variant first if the CPU has it, the rest of the row is then finished here
+			unsigned int x = (unsigned int)Kernels::BiasActivationRow(data, 0, (int)width, bias, activation);
+			if (activation == 0) // Sigmoid
 			{
-				float in = *data + bias;
-				*data++ = in;
+				for (; x < width; ++x)
+				{
+					data[x] = -(data[x] + bias);
+				}
+			}
+			else if (activation == 2) // ReLU
+			{
+				for (; x < width; ++x)
+				{
+					float in = data[x] + bias;
+					data[x] = in > 0 ? in : 0;
+				}
+			}
+			else
+			{
+				for (; x < width; ++x)
+				{
+					data[x] += bias;
+				}
 			}
 		}
 
-		// Perform activation and add bias at the same time	
-		if (activation_function[layer] == 0) // Sigmoid
+		// The rest of the sigmoid, 1 / (1 + exp(-in))
+		if (activation == 0)
 		{
+			cv::exp(response, response);
+			response += 1.0f;
+			cv::divide(1.0, response, response);
+		}
 
-			const unsigned int resp_size = response.rows * response.cols;
+	}
 
-			// Iterate over the data directly
-			float* data = (float*)response.data;
+}
+
+//===========================================================================
+// The network response using the packed weights, the activations are kept with one sample per row (as the im2col matrix has them), so every layer
+// is a single packed product with the bias and the activation applied as its results are written
+void CEN_patch_expert::ResponseInternalPacked(const cv::Mat_<float>& im2col, cv::Mat_<float>& response, CEN_workspace& workspace)
+{
+	cv::Mat_<float> input = im2col;
 
-			for (unsigned int counter = 0; counter < resp_size; ++counter)
+	for (size_t layer = 0; layer < activation_function.size(); ++layer)
+	{
+		const PackedMatrix& weight = weights_packed[layer];
+		const int activation = activation_function[layer];
+
+		cv::Mat_<float>& output = workspace.layer_outputs[layer % 2];
+		output.create(input.rows, weight.Cols());
+
+		GemmPacked(input.ptr<float>(), input.rows, (int)input.step1(), weight, biases[layer].ptr<float>(), activation, output.ptr<float>(), (int)output.step1());
+
+		// The rest of the sigmoid, 1 / (1 + exp(-in))
+		if (activation == 0)
+		{
+			cv::exp(output, output);
+			output += 1.0f;
+			cv::divide(1.0, output, output);
+		}
+
+		input = output;
+	}
+
+	// Same layout as the other paths, one column per sample
+	cv::transpose(input, workspace.output_transposed);
+	response = workspace.output_transposed;
+}
+
+//===========================================================================
+// The network response on the OpenCL device, only the im2col matrix is uploaded and the response downloaded, the bias is added as part of the
+// matrix multiplication and the activations are computed on the device as well
+void CEN_patch_expert::ResponseInternalDevice(const cv::Mat_<float>& im2col, cv::Mat_<float>& response)
+{
+	if (weights_device.size() != weights.size())
+	{
+		weights_device.resize(weights.size());
+		biases_device.resize(weights.size());
+		cv::Mat_<float> widened;
+		for (size_t layer = 0; layer < weights.size(); ++layer)
+		{
+			const cv::Mat_<float>& weight = LayerWeights(layer, widened);
+			weight.copyTo(weights_device[layer]);
+			biases[layer].reshape(1, weight.rows).copyTo(biases_device[layer]);
+		}
+	}
+
+	cv::UMat input;
+	im2col.copyTo(input);
+
+	for (size_t layer = 0; layer < activation_function.size(); ++layer)
+	{
+		// As on the CPU the first layer reads the im2col matrix as transposed input, the output has one column per sample
+		const bool first_layer = layer == 0;
+		const int num_samples = first_layer ? input.rows : input.cols;
+
+		cv::UMat bias;
+		cv::repeat(biases_device[layer], 1, num_samples, bias);
+
+		cv::UMat output;
+		cv::gemm(weights_device[layer], input, 1.0, bias, 1.0, output, first_layer ? cv::GEMM_2_T : 0);
+
+		const int activation = activation_function[layer];
+		if (activation == 0) // Sigmoid, 1 / (1 + exp(-in))
+		{
+			cv::subtract(cv::Scalar::all(0), output, output);
+			cv::exp(output, output);
+			cv::add(output, cv::Scalar::all(1), output);
+			cv::divide(1.0, output, output);
+		}
+		else if (activation == 2) // ReLU
+		{
+			cv::threshold(output, output, 0, 0, cv::THRESH_TOZERO);
+		}
+
+		input = output;
+	}
+
+	input.copyTo(response);
+}
+
+//===========================================================================
+// Quantising the weights of every layer to 8 bits with a separate scale for every output channel (row), so that the int8 path can be used
+void CEN_patch_expert::SetQuantised(bool quantised)
+{
+	weights_quantised.clear();
+	weight_scales.clear();
+
+	if (!quantised)
+	{
+		return;
+	}
+
+	cv::Mat_<float> widened;
+	for (size_t layer = 0; layer < weights.size(); ++layer)
+	{
+		const cv::Mat_<float>& weight = LayerWeights(layer, widened);
+
+		cv::Mat_<signed char> weight_quantised(weight.rows, weight.cols);
+		cv::Mat_<float> scales(weight.rows, 1);
+
+		for (int r = 0; r < weight.rows; ++r)
+		{
+			const float* w = weight.ptr<float>(r);
+
+			float max_abs = 0;
+			for (int k = 0; k < weight.cols; ++k)
 			{
-				float in = *data;
-				*data++ = 1.0f / (1.0f + exp(-(in)));
+				max_abs = std::max(max_abs, std::abs(w[k]));
+			}
+
+			// Symmetric quantisation, so zero stays zero
+			float scale = max_abs > 0 ? max_abs / 127.0f : 1.0f;
+			scales.at<float>(r) = scale;
+
+			signed char* w_q = weight_quantised.ptr<signed char>(r);
+			for (int k = 0; k < weight.cols; ++k)
+			{
+				w_q[k] = (signed char)cvRound(w[k] / scale);
 			}
+		}
+
+		weights_quantised.push_back(weight_quantised);
+		weight_scales.push_back(scales);
+	}
+}
+
+//===========================================================================
+// The network response using the 8 bit weights, the input to every layer is quantised on the fly with a scale per sample (so no calibration is needed).
+// The activations are kept with one sample per row throughout, so every output is a dot product of two contiguous int8 vectors which compilers vectorise well
+void CEN_patch_expert::ResponseInternalQuantised(const cv::Mat_<float>& im2col, cv::Mat_<float>& response, CEN_workspace& workspace)
+{
+	cv::Mat_<float> input = im2col;
+	std::vector<signed char>& input_quantised = workspace.input_quantised;
+
+	for (size_t layer = 0; layer < activation_function.size(); ++layer)
+	{
+		const cv::Mat_<signed char>& weight = weights_quantised[layer];
+		const float* scales = weight_scales[layer].ptr<float>();
+		const float* data_b = biases[layer].ptr<float>();
+		const int activation = activation_function[layer];
+
+		const int num_samples = input.rows;
+		const int num_in = input.cols;
+		const int num_out = weight.rows;
 
+		input_quantised.resize(num_in);
+		cv::Mat_<float>& output = workspace.layer_outputs[layer % 2];
+		output.create(num_samples, num_out);
+
+		for (int n = 0; n < num_samples; ++n)
+		{
+			const float* in = input.ptr<float>(n);
+
+			float max_abs = 0;
+			for (int k = 0; k < num_in; ++k)
+			{
+				max_abs = std::max(max_abs, std::abs(in[k]));
+			}
+
+			float scale_in = max_abs > 0 ? max_abs / 127.0f : 1.0f;
+			float scale_in_inv = 1.0f / scale_in;
+
+			for (int k = 0; k < num_in; ++k)
+			{
+				input_quantised[k] = (signed char)cvRound(in[k] * scale_in_inv);
+			}
+
+			float* out = output.ptr<float>(n);
+			for (int r = 0; r < num_out; ++r)
+			{
+				const signed char* w = weight.ptr<signed char>(r);
+
+				int acc = 0;
+				for (int k = 0; k < num_in; ++k)
+				{
+					acc += (int)w[k] * (int)input_quantised[k];
+				}
+
+				float val = (float)acc * scales[r] * scale_in + data_b[r];
+
+				// As in the float path, for sigmoid the exponent is negated and evaluated in bulk below
+				if (activation == 0)
+				{
+					val = -val;
+				}
+				else if (activation == 2 && val < 0)
+				{
+					val = 0;
+				}
+				out[r] = val;
+			}
 		}
-		else if (activation_function[layer] == 2)// ReLU
+
+		if (activation == 0)
 		{
-			cv::threshold(response, response, 0, 0, cv::THRESH_TOZERO);
+			cv::exp(output, output);
+			output += 1.0f;
+			cv::divide(1.0, output, output);
 		}
 
+		input = output;
 	}
 
+	// Same layout as the float path, one column per sample
+	cv::transpose(input, workspace.output_transposed);
+	response = workspace.output_transposed;
 }
 
 //===========================================================================
-void CEN_patch_expert::ResponseSparse(const cv::Mat_<float> &area_of_interest_left, const cv::Mat_<float> &area_of_interest_right, cv::Mat_<float> &response_left, cv::Mat_<float> &response_right, cv::Mat_<float>& mapMatrix, cv::Mat_<float>& im2col_prealloc_left, cv::Mat_<float>& im2col_prealloc_right)
+// Writing an interpolated response (the values are stored column by column) into a response map, mirroring it horizontally if needed
+static void FillResponseMap(const float* response_mapped, int response_height, int response_width, bool flip, cv::Mat_<float>& response)
 {
-	unsigned int response_height = 0;
+	response.create(response_height, response_width);
 
+	for (int y = 0; y < response_height; ++y)
+	{
+		float* out = response.ptr<float>(y);
+		for (int x = 0; x < response_width; ++x)
+		{
+			int x_in = flip ? response_width - 1 - x : x;
+			out[x] = response_mapped[x_in * response_height + y];
+		}
+	}
+}
+
+//===========================================================================
+void CEN_patch_expert::ResponseSparse(const cv::Mat_<float> &area_of_interest_left, const cv::Mat_<float> &area_of_interest_right, cv::Mat_<float> &response_left, cv::Mat_<float> &response_right, const cv::Mat_<float>& mapMatrix, CEN_workspace& workspace)
+{
 	const bool left_provided = !area_of_interest_left.empty();
 	const bool right_provided = !area_of_interest_right.empty();
 
-	if(right_provided)
+	if (!left_provided && !right_provided)
+	{
+		return;
+	}
+
+	// Both of the areas are of the same size
+	const cv::Mat_<float>& area_of_interest = left_provided ? area_of_interest_left : area_of_interest_right;
+	const int response_height = area_of_interest.rows - height_support + 1;
+	const int response_width = area_of_interest.cols - width_support + 1;
+	const int im2col_size = (response_height * response_width - 1) / 2;
+	const int num_cols = width_support * height_support + 1;
+	const int num_areas = (left_provided ? 1 : 0) + (right_provided ? 1 : 0);
+
+	// The im2col matrices of both areas are stacked, so that they are evaluated together, the first column is the bias term
+	if (workspace.im2col.rows != num_areas * im2col_size || workspace.im2col.cols != num_cols)
+	{
+		workspace.im2col = cv::Mat::ones(num_areas * im2col_size, num_cols, CV_32F);
+	}
+
+	// Extract im2col but in a sparse way and contrast normalize, directly into the stacked matrix
+	if (left_provided)
 	{
-		cv::flip(area_of_interest_right, area_of_interest_right, 1);
-		response_height = area_of_interest_right.rows - height_support + 1;
-		im2colBiasSparseContrastNorm(area_of_interest_right, width_support, height_support, im2col_prealloc_right);
+		cv::Mat_<float> im2col_block = workspace.im2col(cv::Rect(0, 0, num_cols, im2col_size));
+		im2colBiasSparseContrastNorm(area_of_interest_left, width_support, height_support, im2col_block);
 	}
 
-	// Extract im2col but in a sparse way and contrast normalize
-	if(left_provided)
+	if (right_provided)
 	{
-		response_height = area_of_interest_left.rows - height_support + 1;
-		im2colBiasSparseContrastNorm(area_of_interest_left, width_support, height_support, im2col_prealloc_left);
+		cv::flip(area_of_interest_right, workspace.area_of_interest_flipped, 1);
+		cv::Mat_<float> im2col_block = workspace.im2col(cv::Rect(0, (num_areas - 1) * im2col_size, num_cols, im2col_size));
+		im2colBiasSparseContrastNorm(workspace.area_of_interest_flipped, width_support, height_support, im2col_block);
 	}
 
 	cv::Mat_<float> response;
-	if(right_provided && left_provided)
+	ResponseInternal(workspace.im2col, response, workspace);
+
+	// The response is a single row, so every area corresponds to a row once reshaped, allowing to interpolate both with one multiplication
+	cv::gemm(response.reshape(1, num_areas), mapMatrix, 1.0, cv::noArray(), 0.0, workspace.responses_mapped);
+
+	if (left_provided)
 	{
-		cv::vconcat(im2col_prealloc_left, im2col_prealloc_right, response);
-		response = response.t();
+		FillResponseMap(workspace.responses_mapped.ptr<float>(0), response_height, response_width, false, response_left);
 	}
-	else if (left_provided)
+
+	if (right_provided)
 	{
-		response = im2col_prealloc_left.t();
+		FillResponseMap(workspace.responses_mapped.ptr<float>(num_areas - 1), response_height, response_width, true, response_right);
 	}
-	else if (right_provided)
+}
+
+//===========================================================================
+// The coarse to fine evaluation, the grid stride and how far around the peak of the grid the response is evaluated densely (so that the true peak,
+// which is at most a stride away from the one of the grid, and its immediate neighbourhood are not interpolated)
+static const int COARSE_TO_FINE_STRIDE = 3;
+static const int COARSE_TO_FINE_RADIUS = 3;
+
+// The positions of the grid along a dimension, strided and always including the last position so that nothing has to be extrapolated
+static void CoarseGrid(int size, vector<int>& grid)
+{
+	grid.clear();
+	for (int i = 0; i < size; i += COARSE_TO_FINE_STRIDE)
 	{
-		response = im2col_prealloc_right.t();
+		grid.push_back(i);
 	}
+	if (grid.back() != size - 1)
+	{
+		grid.push_back(size - 1);
+	}
+}
 
-	ResponseInternal(response);
-	
-	if(left_provided && right_provided)
+// The grid interval every position falls into and the bilinear weight of the upper end of the interval
+static void CoarseGridWeights(const vector<int>& grid, int size, vector<int>& intervals, vector<float>& weights)
+{
+	intervals.resize(size);
+	weights.resize(size);
+
+	size_t k = 0;
+	for (int i = 0; i < size; ++i)
 	{
-		response_left = response(cv::Rect(0, 0, response.cols / 2, 1));
-		response_right = response(cv::Rect(response.cols / 2, 0, response.cols / 2, 1));
+		while (k + 2 < grid.size() && grid[k + 1] <= i)
+		{
+			k++;
+		}
+		intervals[i] = (int)k;
+		weights[i] = grid.size() > 1 ? (float)(i - grid[k]) / (float)(grid[k + 1] - grid[k]) : 0.0f;
 	}
-	else if (left_provided)
+}
+
+// Perform im2col at the listed positions only (x, y of the top left corner of the support), with contrast normalization and a bias term
+static void im2colBiasContrastNormPositions(const cv::Mat_<float>& input, const int width, const int height, const vector<cv::Point>& positions, cv::Mat_<float> output)
+{
+	const int num_items = width * height + 1;
+
+	for (size_t p = 0; p < positions.size(); ++p)
 	{
-		response_left = response;
+		float* Mo = output.ptr<float>((int)p);
+		Mo[0] = 1.0f;
+
+		float sum = 0;
+		for (int yy = 0; yy < height; ++yy)
+		{
+			const float* Mi = input.ptr<float>(positions[p].y + yy) + positions[p].x;
+			for (int xx = 0; xx < width; ++xx)
+			{
+				float in = Mi[xx];
+				sum += in;
+				Mo[xx * height + yy + 1] = in;
+			}
+		}
+
+		float mean = sum / (float)(width * height);
+
+		float sum_sq = 0;
+		for (int x = 1; x < num_items; ++x)
+		{
+			float in = Mo[x] - mean;
+			Mo[x] = in;
+			sum_sq += in * in;
+		}
+
+		float norm = sqrt(sum_sq);
+		norm = norm == 0 ? 1.0f : 1.0f / norm;
+
+		for (int x = 1; x < num_items; ++x)
+		{
+			Mo[x] *= norm;
+		}
 	}
-	else if (right_provided)
+}
+
+void CEN_patch_expert::ResponseCoarseToFine(const cv::Mat_<float> &area_of_interest_left, const cv::Mat_<float> &area_of_interest_right, cv::Mat_<float> &response_left, cv::Mat_<float> &response_right, CEN_workspace& workspace)
+{
+	const bool left_provided = !area_of_interest_left.empty();
+	const bool right_provided = !area_of_interest_right.empty();
+
+	if (!left_provided && !right_provided)
 	{
-		response_right = response;
+		return;
 	}
 
-	if(left_provided)
+	// The mirrored area is flipped so that both are evaluated with the same expert, its response is flipped back at the end
+	vector<const cv::Mat_<float>*> areas;
+	vector<cv::Mat_<float>*> responses;
+	if (left_provided)
+	{
+		areas.push_back(&area_of_interest_left);
+		responses.push_back(&response_left);
+	}
+	if (right_provided)
 	{
-		// TODO This could and should be gemm'ed
-		response_left = response_left * mapMatrix;
-		response_left = response_left.t();
-		response_left = response_left.reshape(1, response_height);
-		response_left = response_left.t();
+		cv::flip(area_of_interest_right, workspace.area_of_interest_flipped, 1);
+		areas.push_back(&workspace.area_of_interest_flipped);
+		responses.push_back(&response_right);
 	}
+	const int num_areas = (int)areas.size();
 
-	if(right_provided)
+	// Both of the areas are of the same size
+	const int response_height = areas[0]->rows - height_support + 1;
+	const int response_width = areas[0]->cols - width_support + 1;
+	const int num_cols = width_support * height_support + 1;
+
+	vector<int> grid_x, grid_y;
+	CoarseGrid(response_width, grid_x);
+	CoarseGrid(response_height, grid_y);
+
+	vector<cv::Point> coarse_positions;
+	for (size_t x = 0; x < grid_x.size(); ++x)
 	{
-		// TODO This could and should be gemm'ed
-		response_right = response_right * mapMatrix;
-		response_right = response_right.t();
-		response_right = response_right.reshape(1, response_height);
-		response_right = response_right.t();
+		for (size_t y = 0; y < grid_y.size(); ++y)
+		{
+			coarse_positions.push_back(cv::Point(grid_x[x], grid_y[y]));
+		}
+	}
+	const int num_coarse = (int)coarse_positions.size();
+
+	// The coarse pass, the grids of both areas are stacked and evaluated together (every row of the im2col matrix is written, including the bias)
+	workspace.im2col.create(num_areas * num_coarse, num_cols);
+	for (int a = 0; a < num_areas; ++a)
+	{
+		im2colBiasContrastNormPositions(*areas[a], width_support, height_support, coarse_positions, workspace.im2col.rowRange(a * num_coarse, (a + 1) * num_coarse));
+	}
+
+	cv::Mat_<float> response;
+	ResponseInternal(workspace.im2col, response, workspace);
+
+	// Interpolating the whole responses from the grids (the output of the network points to the workspace, so it is used up before the fine pass)
+	vector<int> intervals_x, intervals_y;
+	vector<float> weights_x, weights_y;
+	CoarseGridWeights(grid_x, response_width, intervals_x, weights_x);
+	CoarseGridWeights(grid_y, response_height, intervals_y, weights_y);
+
+	const size_t grid_rows = grid_y.size();
+	const bool single_x = grid_x.size() == 1;
+	const bool single_y = grid_y.size() == 1;
+
+	vector<cv::Point> fine_positions;
+	vector<int> fine_counts(num_areas, 0);
+	for (int a = 0; a < num_areas; ++a)
+	{
+		// The grid is laid out column by column
+		const float* values = response.ptr<float>() + a * num_coarse;
+
+		cv::Mat_<float>& response_map = *responses[a];
+		response_map.create(response_height, response_width);
+
+		for (int y = 0; y < response_height; ++y)
+		{
+			const int ky = intervals_y[y];
+			const float wy = weights_y[y];
+			const int ky_next = single_y ? ky : ky + 1;
+
+			float* out = response_map.ptr<float>(y);
+			for (int x = 0; x < response_width; ++x)
+			{
+				const int kx = intervals_x[x];
+				const float wx = weights_x[x];
+				const int kx_next = single_x ? kx : kx + 1;
+
+				float top = (1.0f - wx) * values[kx * grid_rows + ky] + wx * values[kx_next * grid_rows + ky];
+				float bottom = (1.0f - wx) * values[kx * grid_rows + ky_next] + wx * values[kx_next * grid_rows + ky_next];
+				out[x] = (1.0f - wy) * top + wy * bottom;
+			}
+		}
+
+		// The peak of the grid, around which the response is evaluated densely (apart from the positions already on the grid)
+		int peak = (int)(std::max_element(values, values + num_coarse) - values);
+		cv::Point peak_position = coarse_positions[peak];
+
+		const int x_min = std::max(0, peak_position.x - COARSE_TO_FINE_RADIUS);
+		const int x_max = std::min(response_width - 1, peak_position.x + COARSE_TO_FINE_RADIUS);
+		const int y_min = std::max(0, peak_position.y - COARSE_TO_FINE_RADIUS);
+		const int y_max = std::min(response_height - 1, peak_position.y + COARSE_TO_FINE_RADIUS);
+
+		for (int x = x_min; x <= x_max; ++x)
+		{
+			bool on_grid_x = x == grid_x[intervals_x[x]] || (!single_x && x == grid_x[intervals_x[x] + 1]);
+			for (int y = y_min; y <= y_max; ++y)
+			{
+				bool on_grid_y = y == grid_y[intervals_y[y]] || (!single_y && y == grid_y[intervals_y[y] + 1]);
+				if (!(on_grid_x && on_grid_y))
+				{
+					fine_positions.push_back(cv::Point(x, y));
+					fine_counts[a]++;
+				}
+			}
+		}
+	}
+
+	// The fine pass, the neighbourhoods of the peaks of both areas are evaluated together again
+	if (!fine_positions.empty())
+	{
+		workspace.im2col.create((int)fine_positions.size(), num_cols);
+
+		int start = 0;
+		for (int a = 0; a < num_areas; ++a)
+		{
+			vector<cv::Point> positions(fine_positions.begin() + start, fine_positions.begin() + start + fine_counts[a]);
+			im2colBiasContrastNormPositions(*areas[a], width_support, height_support, positions, workspace.im2col.rowRange(start, start + fine_counts[a]));
+			start += fine_counts[a];
+		}
+
+		ResponseInternal(workspace.im2col, response, workspace);
 
+		const float* values = response.ptr<float>();
+		start = 0;
+		for (int a = 0; a < num_areas; ++a)
+		{
+			for (int p = start; p < start + fine_counts[a]; ++p)
+			{
+				responses[a]->at<float>(fine_positions[p].y, fine_positions[p].x) = values[p];
+			}
+			start += fine_counts[a];
+		}
+	}
+
+	if (right_provided)
+	{
 		cv::flip(response_right, response_right, 1);
 	}
-}
\ No newline at end of file
+}
+
+//===========================================================================
+void CEN_patch_expert::ResponseSparseBatch(const std::vector<cv::Mat_<float> >& areas_of_interest, const std::vector<bool>& flipped, std::vector<cv::Mat_<float> >& responses, const cv::Mat_<float>& mapMatrix, cv::Mat_<float>& im2col_prealloc, bool on_device)
+{
+	const int num_areas = (int)areas_of_interest.size();
+
+	responses.resize(num_areas);
+
+	if (num_areas == 0)
+	{
+		return;
+	}
+
+	// Assuming all of the areas are of the same size
+	const int response_height = areas_of_interest[0].rows - height_support + 1;
+	const int response_width = areas_of_interest[0].cols - width_support + 1;
+	const int im2col_size = (response_height * response_width - 1) / 2;
+	const int num_cols = width_support * height_support + 1;
+
+	// Allocate the stacked im2col matrix, the first column is the bias term
+	if (im2col_prealloc.rows != num_areas * im2col_size || im2col_prealloc.cols != num_cols)
+	{
+		im2col_prealloc = cv::Mat::ones(num_areas * im2col_size, num_cols, CV_32F);
+	}
+
+	// Extract im2col of every area of interest (in a sparse way and contrast normalized) directly into the stacked matrix
+	for (int a = 0; a < num_areas; ++a)
+	{
+		cv::Mat_<float> im2col_block = im2col_prealloc(cv::Rect(0, a * im2col_size, num_cols, im2col_size));
+
+		if (flipped[a])
+		{
+			cv::Mat_<float> area_of_interest_flipped;
+			cv::flip(areas_of_interest[a], area_of_interest_flipped, 1);
+			im2colBiasSparseContrastNorm(area_of_interest_flipped, width_support, height_support, im2col_block);
+		}
+		else
+		{
+			im2colBiasSparseContrastNorm(areas_of_interest[a], width_support, height_support, im2col_block);
+		}
+	}
+
+	cv::Mat_<float> response;
+	if (on_device)
+	{
+		ResponseInternalDevice(im2col_prealloc, response);
+	}
+	else
+	{
+		ResponseInternal(im2col_prealloc, response);
+	}
+
+	// The response is a single row, so every area corresponds to a row once reshaped, allowing to interpolate all of them with one multiplication
+	cv::Mat_<float> responses_full = response.reshape(1, num_areas) * mapMatrix;
+
+	// Split the responses back into full response maps
+	for (int a = 0; a < num_areas; ++a)
+	{
+		cv::Mat_<float> response_curr = responses_full.row(a);
+
+		response_curr = response_curr.t();
+		response_curr = response_curr.reshape(1, response_height);
+		response_curr = response_curr.t();
+
+		if (flipped[a])
+		{
+			cv::flip(response_curr, response_curr, 1);
+		}
+
+		responses[a] = response_curr;
+	}
+}
@@ -35,11 +35,98 @@
 
 #include "CNN_utils.h"
 
+// OpenCV includes
+#include <opencv2/core/ocl.hpp>
+
 using namespace std;
 
 namespace LandmarkDetector
 {
 
+	// The currently selected backend
+	static CNNBackend cnn_backend = CPU_BACKEND;
+
+	bool SetCNNBackend(CNNBackend backend)
+	{
+		if (backend == OPENCL_BACKEND)
+		{
+			if (!cv::ocl::haveOpenCL())
+			{
+				cout << "OpenCL is not available, using the CPU for CNN computation" << endl;
+				cnn_backend = CPU_BACKEND;
+				return false;
+			}
+			cv::ocl::setUseOpenCL(true);
+		}
+		else if (backend == ONNXRUNTIME_BACKEND)
+		{
+			if (!OnnxRuntimeAvailable())
+			{
+				cout << "Not compiled with ONNX Runtime, using the CPU for CNN computation" << endl;
+				cnn_backend = CPU_BACKEND;
+				return false;
+			}
+		}
+		cnn_backend = backend;
+		return true;
+	}
+
+	CNNBackend GetCNNBackend()
+	{
+		return cnn_backend;
+	}
+
+	void matrix_multiply(const cv::Mat_<float>& a, const cv::Mat_<float>& b, cv::Mat_<float>& out)
+	{
+		if (cnn_backend == OPENCL_BACKEND)
+		{
+			// Through transparent API the multiplication happens on the OpenCL device
+			cv::UMat a_dev = a.getUMat(cv::ACCESS_READ);
+			cv::UMat b_dev = b.getUMat(cv::ACCESS_READ);
+			cv::UMat out_dev;
+			cv::gemm(a_dev, b_dev, 1.0, cv::noArray(), 0.0, out_dev);
+			out_dev.copyTo(out);
+			return;
+		}
+
+		// Row major a * b is equivalent to column major b' * a', so can call column major BLAS directly (faster)
+		cv::Mat_<float> a_cont = a.isContinuous() ? a : a.clone();
+		cv::Mat_<float> b_cont = b.isContinuous() ? b : b.clone();
+
+		int m = b_cont.cols;
+		int n = a_cont.rows;
+		int k = a_cont.cols;
+
+		// The output can not share memory with the inputs, as they are read while it is written
+		if (out.data == a_cont.data || out.data == b_cont.data)
+		{
+			out = cv::Mat_<float>();
+		}
+		out.create(n, m);
+
+		Gemm(false, false, m, n, k, 1.0f, (float*)b_cont.data, m, (float*)a_cont.data, k, 0.0f, (float*)out.data, m);
+	}
+
+	void matrix_multiply(const cv::Mat_<float>& a, const PackedMatrix& b, cv::Mat_<float>& out)
+	{
+		if (cnn_backend == OPENCL_BACKEND)
+		{
+			cv::Mat_<float> b_unpacked;
+			b.Unpack(b_unpacked);
+			matrix_multiply(a, b_unpacked, out);
+			return;
+		}
+
+		// The rows of a only need to be contiguous themselves
+		if (out.data == a.data)
+		{
+			out = cv::Mat_<float>();
+		}
+		out.create(a.rows, b.Cols());
+
+		GemmPacked(a.ptr<float>(), a.rows, (int)a.step1(), b, 0, -1, out.ptr<float>(), (int)out.step1());
+	}
+
 	// Parametric ReLU with leaky weights (separate ones per channel)
 	void PReLU(std::vector<cv::Mat_<float> >& input_output_maps, cv::Mat_<float> prelu_weights)
 	{
@@ -122,7 +209,7 @@ namespace LandmarkDetector
 			// Treat the input as separate feature maps
 			if (input_concat.rows == weights.cols)
 			{
-				input_concat = weights * input_concat;
+				matrix_multiply(weights, input_concat, input_concat);
 				// Add biases
 				for (int k = 0; k < biases.rows; ++k)
 				{
@@ -143,7 +230,8 @@ namespace LandmarkDetector
 				// Flatten the input
 				input_concat = input_concat.reshape(0, input_concat.rows * input_concat.cols);
 
-				input_concat = weights * input_concat + biases;
+				matrix_multiply(weights, input_concat, input_concat);
+				input_concat = input_concat + biases;
 
 				outputs.clear();
 				outputs.push_back(input_concat);
@@ -152,7 +240,9 @@ namespace LandmarkDetector
 		}
 		else
 		{
-			cv::Mat out = weights * input_maps[0] + biases;
+			cv::Mat_<float> out;
+			matrix_multiply(weights, input_maps[0], out);
+			out = out + biases;
 			outputs.clear();
 			outputs.push_back(out.t());
 		}
@@ -244,8 +334,12 @@ namespace LandmarkDetector
 
 		vector<cv::Mat_<double>> dftTempl;
 
+		// The precomputed DFTs are keyed on both of the DFT dimensions, as inputs of the same width but different heights need different ones
+		int dft_key = dftsize.width + (dftsize.height << 16);
+
 		// if this has not been precomputed, precompute it, otherwise use it
-		if (_templ_dfts.find(dftsize.width) == _templ_dfts.end())
+		map<int, vector<cv::Mat_<double> > >::const_iterator templ_dft = _templ_dfts.find(dft_key);
+		if (templ_dft == _templ_dfts.end())
 		{
 			dftTempl.resize(_templs.size());
 			for (size_t k = 0; k < _templs.size(); ++k)
@@ -271,12 +365,12 @@ namespace LandmarkDetector
 				dft(dst, dst, 0, _templs[k].rows);
 
 			}
-			_templ_dfts[dftsize.width] = dftTempl;
+			_templ_dfts[dft_key] = dftTempl;
 
 		}
 		else
 		{
-			dftTempl = _templ_dfts[dftsize.width];
+			dftTempl = templ_dft->second;
 		}
 
 		cv::Size bsz(std::min(blocksize.width, result.cols), std::min(blocksize.height, result.rows));
@@ -494,8 +588,147 @@ namespace LandmarkDetector
 		}
 	}
 
+	// The kernels transformed to the Winograd domain (G g G'), laid out as 16 blocks of kernels x input maps matrices, one for each of the 4x4 tile elements
+	cv::Mat_<float> winograd_kernels_3x3(const std::vector<std::vector<cv::Mat_<float> > >& kernels)
+	{
+		int num_kernels = (int)kernels.size();
+		int num_maps = (int)kernels[0].size();
+
+		cv::Mat_<float> G = (cv::Mat_<float>(4, 3) << 1.0f, 0.0f, 0.0f, 0.5f, 0.5f, 0.5f, 0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 1.0f);
+
+		cv::Mat_<float> transformed(16 * num_kernels, num_maps);
+		for (int k = 0; k < num_kernels; ++k)
+		{
+			for (int c = 0; c < num_maps; ++c)
+			{
+				cv::Mat_<float> u = G * kernels[k][c] * G.t();
+				for (int xi = 0; xi < 16; ++xi)
+				{
+					transformed(xi * num_kernels + k, c) = u(xi / 4, xi % 4);
+				}
+			}
+		}
+		return transformed;
+	}
+
+	void convolution_winograd_3x3(std::vector<cv::Mat_<float> >& outputs, const std::vector<cv::Mat_<float> >& input_maps, const cv::Mat_<float>& winograd_kernels, const std::vector<float >& biases, cv::Mat_<float>& workspace)
+	{
+		outputs.clear();
+
+		int num_maps = (int)input_maps.size();
+		int num_kernels = winograd_kernels.rows / 16;
+
+		int height_in = input_maps[0].rows;
+		int width_in = input_maps[0].cols;
+		int height_out = height_in - 2;
+		int width_out = width_in - 2;
+
+		// Every 4x4 input tile (overlapping by 2) produces a 2x2 output tile
+		int tiles_y = (height_out + 1) / 2;
+		int tiles_x = (width_out + 1) / 2;
+		int num_tiles = tiles_y * tiles_x;
+
+		// The transformed input and the products share a single buffer, only reallocated when it is too small
+		size_t needed = (size_t)16 * (num_maps + num_kernels) * num_tiles;
+		if (workspace.total() < needed || !workspace.isContinuous())
+		{
+			workspace.create(1, (int)needed);
+		}
+		cv::Mat_<float> V(16 * num_maps, num_tiles, workspace.ptr<float>());
+		cv::Mat_<float> M(16 * num_kernels, num_tiles, workspace.ptr<float>() + (size_t)16 * num_maps * num_tiles);
+
+		// Input transform B' d B, the tiles on the bottom and right edges are zero padded
+		for (int c = 0; c < num_maps; ++c)
+		{
+			const cv::Mat_<float>& input = input_maps[c];
+			for (int ty = 0; ty < tiles_y; ++ty)
+			{
+				for (int tx = 0; tx < tiles_x; ++tx)
+				{
+					float d[4][4];
+					for (int r = 0; r < 4; ++r)
+					{
+						int y = 2 * ty + r;
+						const float* Mi = y < height_in ? input.ptr<float>(y) : 0;
+						for (int col = 0; col < 4; ++col)
+						{
+							int x = 2 * tx + col;
+							d[r][col] = (Mi != 0 && x < width_in) ? Mi[x] : 0.0f;
+						}
+					}
+
+					float t[4][4];
+					for (int col = 0; col < 4; ++col)
+					{
+						t[0][col] = d[0][col] - d[2][col];
+						t[1][col] = d[1][col] + d[2][col];
+						t[2][col] = d[2][col] - d[1][col];
+						t[3][col] = d[1][col] - d[3][col];
+					}
+
+					int p = ty * tiles_x + tx;
+					for (int r = 0; r < 4; ++r)
+					{
+						V((r * 4) * num_maps + c, p) = t[r][0] - t[r][2];
+						V((r * 4 + 1) * num_maps + c, p) = t[r][1] + t[r][2];
+						V((r * 4 + 2) * num_maps + c, p) = t[r][2] - t[r][1];
+						V((r * 4 + 3) * num_maps + c, p) = t[r][1] - t[r][3];
+					}
+				}
+			}
+		}
+
+		// The element wise products summed over the input maps, for every tile element
+		for (int xi = 0; xi < 16; ++xi)
+		{
+			cv::Mat_<float> M_xi = M.rowRange(xi * num_kernels, (xi + 1) * num_kernels);
+			matrix_multiply(winograd_kernels.rowRange(xi * num_kernels, (xi + 1) * num_kernels), V.rowRange(xi * num_maps, (xi + 1) * num_maps), M_xi);
+		}
+
+		// Output transform A' m A
+		for (int k = 0; k < num_kernels; ++k)
+		{
+			cv::Mat_<float> output(height_out, width_out);
+			for (int ty = 0; ty < tiles_y; ++ty)
+			{
+				for (int tx = 0; tx < tiles_x; ++tx)
+				{
+					int p = ty * tiles_x + tx;
+
+					float m[4][4];
+					for (int xi = 0; xi < 16; ++xi)
+					{
+						m[xi / 4][xi % 4] = M(xi * num_kernels + k, p);
+					}
+
+					float s[2][4];
+					for (int col = 0; col < 4; ++col)
+					{
+						s[0][col] = m[0][col] + m[1][col] + m[2][col];
+						s[1][col] = m[1][col] - m[2][col] - m[3][col];
+					}
+
+					for (int r = 0; r < 2; ++r)
+					{
+						int y = 2 * ty + r;
+						if (y >= height_out)
+							break;
+
+						float* Mo = output.ptr<float>(y);
+						Mo[2 * tx] = s[r][0] + s[r][1] + s[r][2] + biases[k];
+						if (2 * tx + 1 < width_out)
+						{
+							Mo[2 * tx + 1] = s[r][1] - s[r][2] - s[r][3] + biases[k];
+						}
+					}
+				}
+			}
+			outputs.push_back(output);
+		}
+	}
+
 	// A fast convolution implementation, can provide a pre-allocated im2col as well, if empty, it is created
-	void convolution_direct_blas(std::vector<cv::Mat_<float> >& outputs, const std::vector<cv::Mat_<float> >& input_maps, const cv::Mat_<float>& weight_matrix, int height_k, int width_k, cv::Mat_<float>& pre_alloc_im2col)
+	void convolution_direct_blas(std::vector<cv::Mat_<float> >& outputs, const std::vector<cv::Mat_<float> >& input_maps, const PackedMatrix& weight_matrix, int height_k, int width_k, cv::Mat_<float>& pre_alloc_im2col)
 	{
 		outputs.clear();
 	
@@ -510,22 +743,9 @@ namespace LandmarkDetector
 		// Instead of re-allocating data use the first rows of already allocated data and re-allocate only if not enough rows are present, this is what makes this non thread safe, as same memory would be used
 		im2col_multimap(input_maps, width_k, height_k, pre_alloc_im2col);
 		
-		float* m1 = (float*)pre_alloc_im2col.data;
-		float* m2 = (float*)weight_matrix.data;
-		int m2_cols = weight_matrix.cols;
-		int m2_rows = weight_matrix.rows;
-
-		cv::Mat_<float> out(num_rows, weight_matrix.cols, 1.0);
-		float* m3 = (float*)out.data;
-		
-		//cblas_sgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, weight_t.cols, yB * xB, pre_alloc_im2col.cols, 1, m2, weight_t.cols, m1, pre_alloc_im2col.cols, 0.0, m3, weight_t.cols);
-		float alpha = 1.0f;
-		float beta = 0.0f;
-		// Call fortran directly (faster)
-		char N[2]; N[0] = 'N';
-		sgemm_(N, N, &m2_cols, &num_rows, &pre_alloc_im2col.cols, &alpha, m2, &m2_cols, m1, &pre_alloc_im2col.cols, &beta, m3, &m2_cols);
-
-		// Above is equivalent to out = pre_alloc_im2col * weight_matrix;
+		// Only the first rows of the im2col buffer are used (a row range of a continuous matrix is continuous)
+		cv::Mat_<float> out;
+		matrix_multiply(pre_alloc_im2col.rowRange(0, num_rows), weight_matrix, out);
 		
 		out = out.t();
 
@@ -537,5 +757,287 @@ namespace LandmarkDetector
 	
 	}
 
+	// The convolution of a batch of inputs (of the same size), the im2col of all of them is stacked so that a single matrix multiplication is performed
+	void convolution_direct_blas_batch(std::vector<std::vector<cv::Mat_<float> > >& outputs, const std::vector<std::vector<cv::Mat_<float> > >& input_maps, const PackedMatrix& weight_matrix, int height_k, int width_k, cv::Mat_<float>& pre_alloc_im2col)
+	{
+		int batch_size = (int)input_maps.size();
+
+		outputs.clear();
+		outputs.resize(batch_size);
+
+		if (batch_size == 0)
+		{
+			return;
+		}
+
+		int height_in = input_maps[0][0].rows;
+		int width_n = input_maps[0][0].cols;
+
+		// determine how many blocks there will be with a sliding window of width x height in the input
+		int yB = height_in - height_k + 1;
+		int xB = width_n - width_k + 1;
+		int num_rows = yB * xB;
+		int num_cols = width_k * height_k * (int)input_maps[0].size() + 1;
+
+		// The last column is the bias term, which is never overwritten so only needs to be set when allocating
+		if (pre_alloc_im2col.cols != num_cols || pre_alloc_im2col.rows < batch_size * num_rows)
+		{
+			pre_alloc_im2col = cv::Mat::ones(batch_size * num_rows, num_cols, CV_32F);
+		}
+
+		for (int b = 0; b < batch_size; ++b)
+		{
+			cv::Mat_<float> im2col_block = pre_alloc_im2col.rowRange(b * num_rows, (b + 1) * num_rows);
+			im2col_multimap(input_maps[b], width_k, height_k, im2col_block);
+		}
+
+		cv::Mat_<float> out;
+		matrix_multiply(pre_alloc_im2col.rowRange(0, batch_size * num_rows), weight_matrix, out);
+
+		out = out.t();
+
+		// Split back into the separate inputs and reshape accordingly
+		for (int b = 0; b < batch_size; ++b)
+		{
+			for (int k = 0; k < out.rows; ++k)
+			{
+				cv::Mat_<float> out_map = out(cv::Rect(b * num_rows, k, num_rows, 1)).clone();
+				outputs[b].push_back(out_map.reshape(1, yB));
+			}
+		}
+	}
+
+	// The fully connected layer for a batch of inputs, flattened inputs are stacked as columns so a single matrix multiplication is performed
+	void fully_connected_batch(std::vector<std::vector<cv::Mat_<float> > >& outputs, const std::vector<std::vector<cv::Mat_<float> > >& input_maps, cv::Mat_<float> weights, cv::Mat_<float> biases)
+	{
+		int batch_size = (int)input_maps.size();
+
+		outputs.clear();
+		outputs.resize(batch_size);
+
+		if (batch_size == 0)
+		{
+			return;
+		}
+
+		bool multi_map = input_maps[0].size() > 1;
+
+		// Inputs treated as separate feature maps (or given as rows) are not flattened, so just do them separately
+		if ((multi_map && (int)input_maps[0].size() == weights.cols) || (!multi_map && input_maps[0][0].cols != 1))
+		{
+			for (int b = 0; b < batch_size; ++b)
+			{
+				fully_connected(outputs[b], input_maps[b], weights, biases);
+			}
+			return;
+		}
+
+		// Flatten every input into a column in the same way as fully_connected does
+		cv::Mat_<float> input_concat(weights.cols, batch_size);
+		for (int b = 0; b < batch_size; ++b)
+		{
+			if (multi_map)
+			{
+				int map_size = input_maps[b][0].rows * input_maps[b][0].cols;
+				for (size_t in = 0; in < input_maps[b].size(); ++in)
+				{
+					cv::Mat_<float> add = input_maps[b][in].t();
+					add.reshape(0, map_size).copyTo(input_concat(cv::Rect(b, (int)in * map_size, 1, map_size)));
+				}
+			}
+			else
+			{
+				input_maps[b][0].copyTo(input_concat.col(b));
+			}
+		}
+
+		cv::Mat_<float> out;
+		matrix_multiply(weights, input_concat, out);
+
+		// Add biases
+		for (int k = 0; k < biases.rows; ++k)
+		{
+			out.row(k) = out.row(k) + biases.at<float>(k);
+		}
+
+		for (int b = 0; b < batch_size; ++b)
+		{
+			if (multi_map)
+			{
+				outputs[b].push_back(out.col(b).clone());
+			}
+			else
+			{
+				outputs[b].push_back(out.col(b).t());
+			}
+		}
+	}
+
+	bool OnnxConvolution(OnnxGraph& graph, OnnxTensor& tensor, const cv::Mat_<float>& weight_matrix, int height_k, int width_k)
+	{
+		if (tensor.layout != ONNX_MAPS)
+		{
+			return false;
+		}
+
+		// The weight matrix is laid out (input map, kernel x, kernel y) + bias -> kernel, as the columns of im2col_multimap
+		int num_in = (weight_matrix.rows - 1) / (height_k * width_k);
+		int num_kernels = weight_matrix.cols;
+
+		cv::Mat_<float> weights(num_kernels, num_in * height_k * width_k);
+		for (int k = 0; k < num_kernels; ++k)
+		{
+			for (int in = 0; in < num_in; ++in)
+			{
+				for (int y = 0; y < height_k; ++y)
+				{
+					for (int x = 0; x < width_k; ++x)
+					{
+						weights(k, (in * height_k + y) * width_k + x) = weight_matrix(in * height_k * width_k + x * height_k + y, k);
+					}
+				}
+			}
+		}
+		cv::Mat_<float> biases = weight_matrix.row(weight_matrix.rows - 1).clone();
+
+		std::string w = graph.AddInitializer("conv_w", { num_kernels, num_in, height_k, width_k }, weights);
+		std::string b = graph.AddInitializer("conv_b", { num_kernels }, biases);
+		tensor.name = graph.AddNode("Conv", { tensor.name, w, b }, { OnnxGraph::Attribute::Ints("kernel_shape", { height_k, width_k }) });
+		tensor.channels = num_kernels;
+		return true;
+	}
+
+	bool OnnxMaxPooling(OnnxGraph& graph, OnnxTensor& tensor, int stride_x, int stride_y, int kernel_size_x, int kernel_size_y)
+	{
+		if (tensor.layout != ONNX_MAPS)
+		{
+			return false;
+		}
+
+		// max_pooling rounds the output size while ONNX rounds it up, which only differs when less than half of the last window is in the input
+		// (never for the 2x2 stride 2 and 3x3 stride 2 pooling of the models)
+		tensor.name = graph.AddNode("MaxPool", { tensor.name }, { OnnxGraph::Attribute::Ints("kernel_shape", { kernel_size_y, kernel_size_x }),
+			OnnxGraph::Attribute::Ints("strides", { stride_y, stride_x }), OnnxGraph::Attribute::Int("ceil_mode", 1) });
+		return true;
+	}
+
+	bool OnnxFullyConnected(OnnxGraph& graph, OnnxTensor& tensor, const cv::Mat_<float>& weights, const cv::Mat_<float>& biases)
+	{
+		std::string b = graph.AddInitializer("fc_b", { biases.rows * biases.cols }, biases);
+
+		if (tensor.layout == ONNX_MAPS && tensor.channels > 1 && tensor.channels == weights.cols)
+		{
+			// Every map is a feature, so this is a 1x1 convolution
+			std::string w = graph.AddInitializer("fc_w", { weights.rows, weights.cols, 1, 1 }, weights);
+			tensor.name = graph.AddNode("Conv", { tensor.name, w, b }, { OnnxGraph::Attribute::Ints("kernel_shape", { 1, 1 }) });
+			tensor.channels = weights.rows;
+			return true;
+		}
+
+		std::string w = graph.AddInitializer("fc_w", { weights.rows, weights.cols }, weights);
+
+		if (tensor.layout == ONNX_MAPS && tensor.channels > 1)
+		{
+			// The maps are flattened column by column
+			std::string transposed = graph.AddNode("Transpose", { tensor.name }, { OnnxGraph::Attribute::Ints("perm", { 0, 1, 3, 2 }) });
+			std::string flat = graph.AddNode("Flatten", { transposed }, { OnnxGraph::Attribute::Int("axis", 1) });
+			tensor.name = graph.AddNode("Gemm", { flat, w, b }, { OnnxGraph::Attribute::Int("transB", 1) });
+			tensor.layout = ONNX_COLUMN;
+			tensor.channels = weights.rows;
+			return true;
+		}
+
+		if (tensor.layout == ONNX_COLUMN)
+		{
+			tensor.name = graph.AddNode("Gemm", { tensor.name, w, b }, { OnnxGraph::Attribute::Int("transB", 1) });
+			tensor.layout = ONNX_ROW;
+			tensor.channels = weights.rows;
+			return true;
+		}
+
+		// A single map or a row vector is multiplied as a matrix, which the models do not do
+		return false;
+	}
+
+	bool OnnxPReLU(OnnxGraph& graph, OnnxTensor& tensor, const cv::Mat_<float>& prelu_weights)
+	{
+		std::string slope;
+		if (tensor.layout == ONNX_MAPS && tensor.channels > 1)
+		{
+			slope = graph.AddInitializer("prelu", { tensor.channels, 1, 1 }, prelu_weights);
+		}
+		else if (tensor.layout == ONNX_COLUMN)
+		{
+			slope = graph.AddInitializer("prelu", { tensor.channels }, prelu_weights);
+		}
+		else
+		{
+			return false;
+		}
+
+		tensor.name = graph.AddNode("PRelu", { tensor.name, slope });
+		return true;
+	}
+
+	void OnnxReLU(OnnxGraph& graph, OnnxTensor& tensor)
+	{
+		tensor.name = graph.AddNode("Relu", { tensor.name });
+	}
+
+	void OnnxSigmoid(OnnxGraph& graph, OnnxTensor& tensor)
+	{
+		tensor.name = graph.AddNode("Sigmoid", { tensor.name });
+	}
+
+	void OnnxOutput(OnnxGraph& graph, const OnnxTensor& tensor, const std::string& name)
+	{
+		if (tensor.layout == ONNX_MAPS)
+		{
+			graph.AddNode("Identity", { tensor.name }, std::vector<OnnxGraph::Attribute>(), name);
+			graph.AddOutput(name, { -1, -1, -1, -1 });
+		}
+		else
+		{
+			graph.AddNode("Unsqueeze", { tensor.name }, { OnnxGraph::Attribute::Ints("axes", { tensor.layout == ONNX_COLUMN ? 2 : 1 }) }, name);
+			graph.AddOutput(name, { -1, -1, -1 });
+		}
+	}
+
+	void FromOnnxOutput(const std::vector<float>& output, const std::vector<int64_t>& output_shape, std::vector<std::vector<cv::Mat_<float> > >& outputs)
+	{
+		int batch_size = output_shape.empty() ? 0 : (int)output_shape[0];
+		outputs.clear();
+		outputs.resize(batch_size);
+
+		if (batch_size == 0)
+		{
+			return;
+		}
+
+		const float* data = output.data();
+		if (output_shape.size() == 4)
+		{
+			int num_maps = (int)output_shape[1];
+			int height = (int)output_shape[2];
+			int width = (int)output_shape[3];
+			for (int b = 0; b < batch_size; ++b)
+			{
+				for (int k = 0; k < num_maps; ++k, data += height * width)
+				{
+					outputs[b].push_back(cv::Mat_<float>(height, width, const_cast<float*>(data)).clone());
+				}
+			}
+		}
+		else
+		{
+			// A column or a row vector
+			int rows = (int)output_shape[1];
+			int cols = (int)output_shape[2];
+			for (int b = 0; b < batch_size; ++b, data += rows * cols)
+			{
+				outputs[b].push_back(cv::Mat_<float>(rows, cols, const_cast<float*>(data)).clone());
+			}
+		}
+	}
 
 }
@@ -0,0 +1,200 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+
+#include "CpuDispatch.h"
+#include "SimdKernels.h"
+
+// System includes
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+using namespace LandmarkDetector;
+
+// The best level the CPU (and the operating system, which has to save the wider registers) supports
+static CpuLevel DetectCpuLevel()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+	{
+		return CPU_LEVEL_AVX512;
+	}
+	if (__builtin_cpu_supports("avx2"))
+	{
+		return CPU_LEVEL_AVX2;
+	}
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+	{
+		return CPU_LEVEL_BASELINE;
+	}
+
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx)
+	{
+		return CPU_LEVEL_BASELINE;
+	}
+	unsigned long long xcr0 = _xgetbv(0);
+
+	__cpuidex(info, 7, 0);
+	bool avx2 = (info[1] & (1 << 5)) != 0;
+	bool avx512f = (info[1] & (1 << 16)) != 0;
+
+	// The AVX-512 state is the opmask and the upper halves of the 32 vector registers, on top of the SSE and AVX state
+	if (avx512f && (xcr0 & 0xe6) == 0xe6)
+	{
+		return CPU_LEVEL_AVX512;
+	}
+	if (avx2 && (xcr0 & 0x6) == 0x6)
+	{
+		return CPU_LEVEL_AVX2;
+	}
+#endif
+	return CPU_LEVEL_BASELINE;
+}
+
+// What the CPU supports and what the build contains, capped by the OPENFACE_CPU environment variable
+static CpuLevel SupportedCpuLevel()
+{
+#ifdef OPENFACE_CPU_DISPATCH
+	static const CpuLevel supported = []() {
+		CpuLevel level = DetectCpuLevel();
+		const char* requested = std::getenv("OPENFACE_CPU");
+		if (requested != NULL)
+		{
+			if (std::strcmp(requested, "baseline") == 0 && level > CPU_LEVEL_BASELINE)
+				level = CPU_LEVEL_BASELINE;
+			else if (std::strcmp(requested, "avx2") == 0 && level > CPU_LEVEL_AVX2)
+				level = CPU_LEVEL_AVX2;
+			else if (std::strcmp(requested, "baseline") != 0 && std::strcmp(requested, "avx2") != 0 && std::strcmp(requested, "avx512") != 0)
+				std::cout << "WARNING: unknown OPENFACE_CPU " << requested << " (baseline, avx2 or avx512), using " << GetCpuLevelName(level) << std::endl;
+		}
+		return level;
+	}();
+	return supported;
+#else
+	return CPU_LEVEL_BASELINE;
+#endif
+}
+
+static std::atomic<int>& CurrentCpuLevel()
+{
+	static std::atomic<int> level((int)SupportedCpuLevel());
+	return level;
+}
+
+CpuLevel LandmarkDetector::GetCpuLevel()
+{
+	return (CpuLevel)CurrentCpuLevel().load(std::memory_order_relaxed);
+}
+
+void LandmarkDetector::SetCpuLevel(CpuLevel level)
+{
+	CpuLevel supported = SupportedCpuLevel();
+	CurrentCpuLevel() = (int)(level < supported ? level : supported);
+}
+
+const char* LandmarkDetector::GetCpuLevelName(CpuLevel level)
+{
+	switch (level)
+	{
+		case CPU_LEVEL_AVX512: return "avx512";
+		case CPU_LEVEL_AVX2: return "avx2";
+		default: return "baseline";
+	}
+}
+
+int LandmarkDetector::Kernels::FHOGOrientationRow(const float* grad_x, const float* grad_y, float* grad_len, int* orientation, int start, int width)
+{
+#ifdef OPENFACE_CPU_DISPATCH
+	switch (GetCpuLevel())
+	{
+		case CPU_LEVEL_AVX512: return Avx512::FHOGOrientationRow(grad_x, grad_y, grad_len, orientation, start, width);
+		case CPU_LEVEL_AVX2: return Avx2::FHOGOrientationRow(grad_x, grad_y, grad_len, orientation, start, width);
+		default: break;
+	}
+#endif
+	return start;
+}
+
+int LandmarkDetector::Kernels::MeanShiftSums(const float* response, const float* kde, const float* coord_x, const float* coord_y, int start, int count, float& sum, float& mx, float& my)
+{
+#ifdef OPENFACE_CPU_DISPATCH
+	switch (GetCpuLevel())
+	{
+		case CPU_LEVEL_AVX512: return Avx512::MeanShiftSums(response, kde, coord_x, coord_y, start, count, sum, mx, my);
+		case CPU_LEVEL_AVX2: return Avx2::MeanShiftSums(response, kde, coord_x, coord_y, start, count, sum, mx, my);
+		default: break;
+	}
+#endif
+	return start;
+}
+
+int LandmarkDetector::Kernels::BiasActivationRow(float* data, int start, int width, float bias, int activation)
+{
+#ifdef OPENFACE_CPU_DISPATCH
+	switch (GetCpuLevel())
+	{
+		case CPU_LEVEL_AVX512: return Avx512::BiasActivationRow(data, start, width, bias, activation);
+		case CPU_LEVEL_AVX2: return Avx2::BiasActivationRow(data, start, width, bias, activation);
+		default: break;
+	}
+#endif
+	return start;
+}
+
+int LandmarkDetector::Kernels::GemmPackedRows(const float* X, int start, int num_rows, int ldx, const float* panels, int k, int n, const float* bias, int activation, float* out, int ldo)
+{
+#ifdef OPENFACE_CPU_DISPATCH
+	switch (GetCpuLevel())
+	{
+		case CPU_LEVEL_AVX512: return Avx512::GemmPackedRows(X, start, num_rows, ldx, panels, k, n, bias, activation, out, ldo);
+		case CPU_LEVEL_AVX2: return Avx2::GemmPackedRows(X, start, num_rows, ldx, panels, k, n, bias, activation, out, ldo);
+		default: break;
+	}
+#endif
+	return start;
+}
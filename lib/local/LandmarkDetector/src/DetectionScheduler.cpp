@@ -0,0 +1,193 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "stdafx.h"
+
+#include "DetectionScheduler.h"
+
+// OpenCV includes
+#include <opencv2/imgproc.hpp>
+
+// System includes
+#include <algorithm>
+
+using namespace LandmarkDetector;
+
+// The frames are compared on a grid of this many cells
+static const int GRID_COLS = 32;
+static const int GRID_ROWS = 24;
+
+// The differences are histogrammed in bins of this width, a cell has changed when its difference falls past the first CHANGED_BIN bins
+static const int DIFFERENCE_BIN_WIDTH = 16;
+static const int CHANGED_BIN = 2;
+
+// A change of at least this fraction of the untracked cells is a scene change, a local change needs at least MIN_CHANGED_CELLS cells
+static const float SCENE_CHANGE_FRACTION = 0.4f;
+static const int MIN_CHANGED_CELLS = 2;
+
+// The tracked boxes are enlarged by this fraction before being excluded, as the faces move between detections
+static const float TRACKED_BOX_MARGIN = 0.25f;
+
+// The region around a local change is enlarged by this fraction of its size (to give the detector some context), and the whole image is
+// searched when the region is larger than MAX_REGION_FRACTION of it anyway
+static const float REGION_MARGIN = 0.5f;
+static const float MAX_REGION_FRACTION = 0.6f;
+
+DetectionScheduler::DetectionScheduler(int base_interval, int max_interval, int min_interval) :
+	base_interval(base_interval), max_interval(std::max(base_interval, max_interval)), min_interval(std::min(base_interval, min_interval))
+{
+	Reset();
+}
+
+void DetectionScheduler::Reset()
+{
+	current_interval = base_interval;
+	frames_since_detection = 0;
+	reference_grid.release();
+	current_grid.release();
+}
+
+bool DetectionScheduler::ShouldDetect(const cv::Mat_<uchar>& grayscale_image, const std::vector<cv::Rect_<float> >& tracked_boxes, int free_slots, cv::Rect& region)
+{
+	frames_since_detection++;
+
+	region = cv::Rect(0, 0, grayscale_image.cols, grayscale_image.rows);
+
+	if (free_slots == 0 || grayscale_image.empty())
+	{
+		return false;
+	}
+
+	cv::resize(grayscale_image, current_grid, cv::Size(GRID_COLS, GRID_ROWS), 0, 0, cv::INTER_AREA);
+
+	// The first frame has nothing to compare with, otherwise the whole image is still searched every interval
+	if (reference_grid.empty() || frames_since_detection >= current_interval)
+	{
+		return true;
+	}
+
+	if (frames_since_detection < min_interval)
+	{
+		return false;
+	}
+
+	// The cells covered by the tracked faces are not informative, the faces themselves move
+	cv::Mat_<uchar> untracked(GRID_ROWS, GRID_COLS, (uchar)1);
+	float cell_width = (float)grayscale_image.cols / GRID_COLS;
+	float cell_height = (float)grayscale_image.rows / GRID_ROWS;
+	for (size_t i = 0; i < tracked_boxes.size(); ++i)
+	{
+		const cv::Rect_<float>& box = tracked_boxes[i];
+		int x0 = (int)std::floor((box.x - TRACKED_BOX_MARGIN * box.width) / cell_width);
+		int y0 = (int)std::floor((box.y - TRACKED_BOX_MARGIN * box.height) / cell_height);
+		int x1 = (int)std::ceil((box.x + (1 + TRACKED_BOX_MARGIN) * box.width) / cell_width);
+		int y1 = (int)std::ceil((box.y + (1 + TRACKED_BOX_MARGIN) * box.height) / cell_height);
+		cv::Rect cells = cv::Rect(x0, y0, x1 - x0, y1 - y0) & cv::Rect(0, 0, GRID_COLS, GRID_ROWS);
+		if (cells.area() > 0)
+		{
+			untracked(cells).setTo(0);
+		}
+	}
+
+	// The histogram of the differences from the frame of the last detection, together with the extent of the changed cells
+	std::vector<int> histogram(256 / DIFFERENCE_BIN_WIDTH, 0);
+	int num_untracked = 0;
+	int min_x = GRID_COLS, min_y = GRID_ROWS, max_x = -1, max_y = -1;
+	for (int y = 0; y < GRID_ROWS; ++y)
+	{
+		for (int x = 0; x < GRID_COLS; ++x)
+		{
+			if (!untracked(y, x))
+				continue;
+
+			int bin = std::abs((int)current_grid(y, x) - (int)reference_grid(y, x)) / DIFFERENCE_BIN_WIDTH;
+			histogram[bin]++;
+			num_untracked++;
+
+			if (bin >= CHANGED_BIN)
+			{
+				min_x = std::min(min_x, x);
+				min_y = std::min(min_y, y);
+				max_x = std::max(max_x, x);
+				max_y = std::max(max_y, y);
+			}
+		}
+	}
+
+	int num_changed = 0;
+	for (size_t bin = CHANGED_BIN; bin < histogram.size(); ++bin)
+	{
+		num_changed += histogram[bin];
+	}
+
+	if (num_changed < MIN_CHANGED_CELLS)
+	{
+		return false;
+	}
+
+	// A scene change (or the camera moving), searching the whole image
+	if (num_changed >= SCENE_CHANGE_FRACTION * num_untracked)
+	{
+		return true;
+	}
+
+	// A local change, only searching around it
+	float width = (max_x - min_x + 1) * cell_width;
+	float height = (max_y - min_y + 1) * cell_height;
+	cv::Rect_<float> changed(min_x * cell_width - REGION_MARGIN * width, min_y * cell_height - REGION_MARGIN * height, (1 + 2 * REGION_MARGIN) * width, (1 + 2 * REGION_MARGIN) * height);
+	cv::Rect local = cv::Rect((int)changed.x, (int)changed.y, (int)changed.width, (int)changed.height) & region;
+
+	if (local.area() < MAX_REGION_FRACTION * region.area())
+	{
+		region = local;
+	}
+	return true;
+}
+
+void DetectionScheduler::DetectionDone(int num_new_faces)
+{
+	frames_since_detection = 0;
+	current_grid.copyTo(reference_grid);
+
+	// Backing off while nothing new is found, as the scene is likely to stay the same
+	if (num_new_faces > 0)
+	{
+		current_interval = base_interval;
+	}
+	else
+	{
+		current_interval = std::min(current_interval * 2, max_interval);
+	}
+}
@@ -0,0 +1,343 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+
+#include "FaceDetectorHOG.h"
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+// TBB includes
+#include <tbb/tbb.h>
+
+// dlib includes
+#include <dlib/image_processing/frontal_face_detector.h>
+
+// System includes
+#include <algorithm>
+#include <cmath>
+
+#include "LandmarkDetectorUtils.h"
+#include "Tracing.h"
+
+using namespace LandmarkDetector;
+
+namespace
+{
+	// The number of features of an FHOG cell
+	const int FHOG_FEATURES = 31;
+
+	// A detection in integer pixel corners (inclusive), as dlib::rectangle
+	struct HOGDetection
+	{
+		float confidence;
+		int left;
+		int top;
+		int right;
+		int bottom;
+
+		long Area() const { return (long)(right - left + 1) * (long)(bottom - top + 1); }
+	};
+
+	bool MoreConfident(const HOGDetection& a, const HOGDetection& b)
+	{
+		return a.confidence > b.confidence;
+	}
+
+	// Mapping a coordinate of the padded FHOG image to the image, as dlib::fhog_to_image (to the centre of the cell)
+	int FHOGToImage(int p, int cell_size, int filter_padding)
+	{
+		p = (p + 1 - (filter_padding - 1) / 2) * cell_size + 1;
+		return p >= 0 ? p + cell_size / 2 : p - cell_size / 2;
+	}
+
+	// Scaling a point up the pyramid levels, as dlib::pyramid_down<6>::point_up (rounded to the nearest pixel)
+	int PointUp(int p, double level_scale)
+	{
+		return (int)std::floor(p * level_scale + 0.5);
+	}
+
+	// The overlap test of dlib::test_box_overlap
+	bool Overlaps(const HOGDetection& a, const HOGDetection& b, float iou_threshold, float covered_threshold)
+	{
+		const int left = std::max(a.left, b.left);
+		const int top = std::max(a.top, b.top);
+		const int right = std::min(a.right, b.right);
+		const int bottom = std::min(a.bottom, b.bottom);
+		if (right < left || bottom < top)
+		{
+			return false;
+		}
+
+		const double inner = (double)(right - left + 1) * (double)(bottom - top + 1);
+
+		// The area of the bounding box of the two (dlib::rectangle::operator+)
+		const double outer = (double)(std::max(a.right, b.right) - std::min(a.left, b.left) + 1) * (double)(std::max(a.bottom, b.bottom) - std::min(a.top, b.top) + 1);
+
+		return inner / outer > iou_threshold || inner / a.Area() > covered_threshold || inner / b.Area() > covered_threshold;
+	}
+}
+
+void FaceDetectorHOG::Read()
+{
+	dlib::frontal_face_detector detector = dlib::get_frontal_face_detector();
+	const dlib::scan_fhog_pyramid<dlib::pyramid_down<6> >& scanner = detector.get_scanner();
+
+	std::shared_ptr<Model> new_model = std::make_shared<Model>();
+	new_model->cell_size = (int)scanner.get_cell_size();
+	new_model->padding = (int)scanner.get_padding();
+	new_model->min_level_width = (int)scanner.get_min_pyramid_layer_width();
+	new_model->min_level_height = (int)scanner.get_min_pyramid_layer_height();
+	new_model->max_levels = (int)std::min(scanner.get_max_pyramid_levels(), (unsigned long)1000);
+	new_model->iou_threshold = (float)detector.get_overlap_tester().get_iou_thresh();
+	new_model->covered_threshold = (float)detector.get_overlap_tester().get_percent_covered_thresh();
+	new_model->filter_rows = 0;
+	new_model->filter_cols = 0;
+
+	for (unsigned long i = 0; i < detector.num_detectors(); ++i)
+	{
+		const dlib::matrix<double, 0, 1>& w = detector.get_w(i);
+		const std::vector<dlib::matrix<float> >& planes = scanner.build_fhog_filterbank(w).get_filters();
+
+		new_model->filter_rows = (int)planes[0].nr();
+		new_model->filter_cols = (int)planes[0].nc();
+
+		// Interleaving the planes, so that a row of the filter is a contiguous run of cells like the rows of the FHOG image
+		Filter filter;
+		filter.weights.create(new_model->filter_rows, new_model->filter_cols * (int)planes.size());
+		for (int r = 0; r < new_model->filter_rows; ++r)
+		{
+			float* weights_row = filter.weights.ptr<float>(r);
+			for (int c = 0; c < new_model->filter_cols; ++c)
+			{
+				for (size_t p = 0; p < planes.size(); ++p)
+				{
+					weights_row[c * planes.size() + p] = planes[p](r, c);
+				}
+			}
+		}
+
+		// The bias is stored after the filter weights
+		filter.threshold = (float)w(scanner.get_num_dimensions());
+
+		new_model->filters.push_back(filter);
+	}
+
+	model = new_model;
+}
+
+void FaceDetectorHOG::ApplyFilter(const cv::Mat_<float>& hog, int hog_cols, const Filter& filter, int filter_rows, int filter_cols, cv::Mat_<float>& response)
+{
+	const int response_rows = hog.rows - filter_rows + 1;
+	const int response_cols = hog_cols - filter_cols + 1;
+	response.create(response_rows, response_cols);
+
+	// A row of the filter is a contiguous run of the features of its cells in the FHOG image as well
+	const int length = filter_cols * FHOG_FEATURES;
+
+	for (int y = 0; y < response_rows; ++y)
+	{
+		float* response_row = response.ptr<float>(y);
+		for (int x = 0; x < response_cols; ++x)
+		{
+			response_row[x] = 0;
+		}
+
+		for (int i = 0; i < filter_rows; ++i)
+		{
+			const float* hog_row = hog.ptr<float>(y + i);
+			const float* weights_row = filter.weights.ptr<float>(i);
+
+			for (int x = 0; x < response_cols; ++x)
+			{
+				const float* features = hog_row + x * FHOG_FEATURES;
+				int k = 0;
+				float sum = 0;
+#if CV_SIMD128
+				cv::v_float32x4 acc0 = cv::v_setzero_f32();
+				cv::v_float32x4 acc1 = cv::v_setzero_f32();
+				for (; k + 8 <= length; k += 8)
+				{
+					acc0 = cv::v_muladd(cv::v_load(features + k), cv::v_load(weights_row + k), acc0);
+					acc1 = cv::v_muladd(cv::v_load(features + k + 4), cv::v_load(weights_row + k + 4), acc1);
+				}
+				sum = cv::v_reduce_sum(acc0 + acc1);
+#endif
+				for (; k < length; ++k)
+				{
+					sum += features[k] * weights_row[k];
+				}
+				response_row[x] += sum;
+			}
+		}
+	}
+}
+
+bool FaceDetectorHOG::DetectFaces(vector<cv::Rect_<float> >& o_regions, std::vector<float>& o_confidences, const cv::Mat_<uchar>& image, float adjust_threshold,
+	cv::Rect roi, float min_width) const
+{
+	TRACE_SCOPE("FaceDetectorHOG::DetectFaces");
+
+	o_regions.clear();
+	o_confidences.clear();
+
+	if (!model || model->filters.empty())
+	{
+		return false;
+	}
+
+	// Only the region of interest is scanned
+	cv::Rect image_rect(0, 0, image.cols, image.rows);
+	roi = roi.area() > 0 ? roi & image_rect : image_rect;
+	if (roi.area() == 0)
+	{
+		return false;
+	}
+
+	// The image pyramid, each level 5/6 the size of the previous one (as dlib::pyramid_down<6>), down to the smallest size that fits the detector
+	vector<cv::Mat_<uchar> > levels;
+	levels.push_back(image(roi));
+	while ((int)levels.size() < model->max_levels)
+	{
+		const cv::Mat_<uchar>& previous = levels.back();
+		cv::Size size((5 * previous.cols) / 6, (5 * previous.rows) / 6);
+		if (size.width < model->min_level_width || size.height < model->min_level_height)
+		{
+			break;
+		}
+		cv::Mat_<uchar> level;
+		cv::resize(previous, level, size, 0, 0, cv::INTER_LINEAR);
+		levels.push_back(level);
+	}
+
+	const int filter_rows = model->filter_rows;
+	const int filter_cols = model->filter_cols;
+	const int box_rows = filter_rows - 2 * model->padding;
+	const int box_cols = filter_cols - 2 * model->padding;
+
+	// The corners of the detection of a response, as dlib::fhog_to_image of the box centred on the response and scaled up to the first level
+	auto ToDetection = [&](int x, int y, double level_scale, float confidence) {
+		const int r = y + filter_rows / 2;
+		const int c = x + filter_cols / 2;
+		const int left = c - box_cols / 2;
+		const int top = r - box_rows / 2;
+
+		HOGDetection detection;
+		detection.confidence = confidence;
+		detection.left = PointUp(FHOGToImage(left, model->cell_size, filter_cols), level_scale) + roi.x;
+		detection.top = PointUp(FHOGToImage(top, model->cell_size, filter_rows), level_scale) + roi.y;
+		detection.right = PointUp(FHOGToImage(left + box_cols - 1, model->cell_size, filter_cols), level_scale) + roi.x;
+		detection.bottom = PointUp(FHOGToImage(top + box_rows - 1, model->cell_size, filter_rows), level_scale) + roi.y;
+		return detection;
+	};
+
+	// The levels are independent, so they are scanned in parallel (the detection windows of the filters of a level as well)
+	vector<vector<HOGDetection> > level_detections(levels.size() * model->filters.size());
+	tbb::parallel_for(0, (int)levels.size(), [&](int l) {
+
+		const double level_scale = std::pow(6.0 / 5.0, l);
+
+		// The detections of a level all have the same size, so the levels that are too small can be skipped
+		HOGDetection sample = ToDetection(filter_cols, filter_rows, level_scale, 0);
+		if (min_width > 0 && sample.right - sample.left + 1 < min_width)
+		{
+			return;
+		}
+
+		int num_rows, num_cols;
+		cv::Mat_<float> cells;
+		ExtractFHOG(cells, levels[l], num_rows, num_cols, model->cell_size);
+		if (num_rows == 0 || num_cols == 0)
+		{
+			return;
+		}
+
+		// Padding by the size of the filter, so that the faces partially outside of the image can be detected (as dlib::extract_fhog_features)
+		cv::Mat_<float> hog = cv::Mat_<float>::zeros(num_rows + filter_rows - 1, (num_cols + filter_cols - 1) * FHOG_FEATURES);
+		cells.copyTo(hog(cv::Rect(((filter_cols - 1) / 2) * FHOG_FEATURES, (filter_rows - 1) / 2, num_cols * FHOG_FEATURES, num_rows)));
+
+		tbb::parallel_for(0, (int)model->filters.size(), [&](int f) {
+			const Filter& filter = model->filters[f];
+
+			cv::Mat_<float> response;
+			ApplyFilter(hog, num_cols + filter_cols - 1, filter, filter_rows, filter_cols, response);
+
+			vector<HOGDetection>& detections = level_detections[l * model->filters.size() + f];
+			const float threshold = filter.threshold + adjust_threshold;
+			for (int y = 0; y < response.rows; ++y)
+			{
+				const float* response_row = response.ptr<float>(y);
+				for (int x = 0; x < response.cols; ++x)
+				{
+					if (response_row[x] >= threshold)
+					{
+						detections.push_back(ToDetection(x, y, level_scale, response_row[x] - filter.threshold));
+					}
+				}
+			}
+		});
+	});
+
+	vector<HOGDetection> detections;
+	for (size_t i = 0; i < level_detections.size(); ++i)
+	{
+		detections.insert(detections.end(), level_detections[i].begin(), level_detections[i].end());
+	}
+
+	// Non maximum suppression over the detections of all of the filters, the most confident first
+	std::stable_sort(detections.begin(), detections.end(), MoreConfident);
+
+	vector<HOGDetection> kept;
+	for (size_t i = 0; i < detections.size(); ++i)
+	{
+		bool overlaps = false;
+		for (size_t k = 0; k < kept.size() && !overlaps; ++k)
+		{
+			overlaps = Overlaps(kept[k], detections[i], model->iou_threshold, model->covered_threshold);
+		}
+
+		if (!overlaps)
+		{
+			kept.push_back(detections[i]);
+			o_regions.push_back(cv::Rect_<float>((float)detections[i].left, (float)detections[i].top,
+				(float)(detections[i].right - detections[i].left + 1), (float)(detections[i].bottom - detections[i].top + 1)));
+			o_confidences.push_back(detections[i].confidence);
+		}
+	}
+
+	return !o_regions.empty();
+}
@@ -0,0 +1,182 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+
+#include "FaceDetectorHaar.h"
+
+// OpenCV includes
+#include <opencv2/core/ocl.hpp>
+#include <opencv2/imgproc.hpp>
+
+// TBB includes
+#include <tbb/tbb.h>
+
+// System includes
+#include <algorithm>
+
+using namespace LandmarkDetector;
+
+namespace
+{
+	// The most halvings of the frame the scan starts at
+	const int MAX_HALVINGS = 5;
+
+	// The halving of the frame at which faces of the given size are still a quarter bigger than the cascade window
+	int HalvingForFace(float face_size, const cv::Size& window)
+	{
+		int level = 0;
+		while (level < MAX_HALVINGS && face_size / (float)(2 << level) >= window.width * 1.25f)
+		{
+			++level;
+		}
+		return level;
+	}
+
+	// Scanning a halving of the frame for faces between min_face and max_face (in frame pixels, non-positive for no upper bound), the
+	// detections are returned in frame coordinates
+	void ScanHalving(std::vector<cv::Rect>& o_detections, cv::CascadeClassifier& cascade, const cv::UMat& gray, const cv::Size& frame_size,
+		float min_face, float max_face, int min_neighbours)
+	{
+		const float scale_x = (float)frame_size.width / (float)gray.cols;
+		const float scale_y = (float)frame_size.height / (float)gray.rows;
+
+		const int min_size = (int)(min_face / scale_x);
+		const int max_size = max_face > 0 ? (int)(max_face / scale_x) - 1 : 0;
+
+		std::vector<cv::Rect> detections;
+		cascade.detectMultiScale(gray, detections, 1.2, min_neighbours, 0, cv::Size(min_size, min_size), cv::Size(max_size, max_size));
+
+		for (const cv::Rect& detection : detections)
+		{
+			o_detections.push_back(cv::Rect(cvRound(detection.x * scale_x), cvRound(detection.y * scale_y), cvRound(detection.width * scale_x),
+				cvRound(detection.height * scale_y)));
+		}
+	}
+}
+
+FaceDetectorHaar& FaceDetectorHaar::operator=(const FaceDetectorHaar& other)
+{
+	if (this != &other)
+	{
+		location = other.location;
+		cascades.clear();
+	}
+	return *this;
+}
+
+bool FaceDetectorHaar::Read(const std::string& location)
+{
+	this->location = location;
+	cascades.clear();
+
+	if (!LoadCascades(1))
+	{
+		this->location.clear();
+		return false;
+	}
+	return true;
+}
+
+bool FaceDetectorHaar::LoadCascades(int num_cascades)
+{
+	while ((int)cascades.size() < num_cascades)
+	{
+		cv::CascadeClassifier cascade;
+		if (location.empty() || !cascade.load(location))
+		{
+			return false;
+		}
+		cascades.push_back(cascade);
+	}
+	return true;
+}
+
+bool FaceDetectorHaar::DetectFaces(std::vector<cv::Rect>& o_detections, ImageContext& frame, float min_width)
+{
+	o_detections.clear();
+
+	const cv::Size frame_size = frame.GrayHalved(0).size();
+	if (frame_size.area() == 0 || !LoadCascades(1))
+	{
+		return false;
+	}
+
+	const cv::Size window = cascades[0].getOriginalWindowSize();
+	const float min_face = min_width > 0 ? min_width : 50.0f;
+
+	// On the OpenCL device all of the scales are scanned at once, with the frame kept on the device throughout
+	if (cv::ocl::useOpenCL())
+	{
+		ScanHalving(o_detections, cascades[0], frame.GrayHalved(HalvingForFace(min_face, window)), frame_size, min_face, -1, 2);
+		return !o_detections.empty();
+	}
+
+	// Otherwise an octave of face sizes per task, the last one takes all of the bigger faces
+	int num_octaves = 1;
+	while (num_octaves < MAX_OCTAVES && min_face * (float)(2 << (num_octaves - 1)) <= (float)std::min(frame_size.width, frame_size.height))
+	{
+		++num_octaves;
+	}
+	if (!LoadCascades(num_octaves))
+	{
+		return false;
+	}
+
+	// The halvings are built up front, so that the tasks do not wait on each other building them
+	for (int octave = 0; octave < num_octaves; ++octave)
+	{
+		frame.GrayHalved(HalvingForFace(min_face * (float)(1 << octave), window));
+	}
+
+	std::vector<std::vector<cv::Rect> > octave_detections(num_octaves);
+	tbb::parallel_for(0, num_octaves, [&](int octave)
+	{
+		const float octave_min = min_face * (float)(1 << octave);
+		const float octave_max = octave + 1 < num_octaves ? octave_min * 2.0f : -1.0f;
+
+		// Not grouped yet, as the neighbours of a detection can be in the next octave
+		ScanHalving(octave_detections[octave], cascades[octave], frame.GrayHalved(HalvingForFace(octave_min, window)), frame_size, octave_min, octave_max, 0);
+	});
+
+	for (const std::vector<cv::Rect>& detections : octave_detections)
+	{
+		o_detections.insert(o_detections.end(), detections.begin(), detections.end());
+	}
+
+	// The grouping of cv::CascadeClassifier::detectMultiScale (at least two neighbours, 0.2 relative difference)
+	cv::groupRectangles(o_detections, 2, 0.2);
+
+	return !o_detections.empty();
+}
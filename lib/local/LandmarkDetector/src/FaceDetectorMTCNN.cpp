@@ -44,7 +44,9 @@
 #include <tbb/tbb.h>
 
 // System includes
+#include <cstdio>
 #include <fstream>
+#include <memory>
 
 // Math includes
 #define _USE_MATH_DEFINES
@@ -64,82 +66,205 @@
 // CNN includes
 #include "CNN_utils.h"
 
-// Instead of including cblas.h (the definitions from OpenBLAS and other BLAS libraries differ, declare the required OpenBLAS functionality here)
-#ifdef __cplusplus
-extern "C" {
-	/* Assume C declarations for C++ */
-#endif  /* __cplusplus */
+// BLAS includes
+#include "Gemm.h"
 
-	/*Set the number of threads on runtime.*/
-	void openblas_set_num_threads(int num_threads);
-}
+#include <MemoryReport.h>
+#include <TuningCache.h>
 
 using namespace LandmarkDetector;
 
 // Constructor from model file location
-FaceDetectorMTCNN::FaceDetectorMTCNN(const string& location)
+FaceDetectorMTCNN::FaceDetectorMTCNN(const string& location) : autotune_convolutions(false)
 {
 	this->Read(location);
 }
 // Copy constructor
-FaceDetectorMTCNN::FaceDetectorMTCNN(const FaceDetectorMTCNN& other) : PNet(other.PNet), RNet(other.RNet), ONet(other.ONet)
+FaceDetectorMTCNN::FaceDetectorMTCNN(const FaceDetectorMTCNN& other) : PNet(other.PNet), RNet(other.RNet), ONet(other.ONet), autotune_convolutions(other.autotune_convolutions)
 {
 }
 
-CNN::CNN(const CNN& other) : cnn_layer_types(other.cnn_layer_types), cnn_max_pooling_layers(other.cnn_max_pooling_layers), cnn_convolutional_layers_bias(other.cnn_convolutional_layers_bias), conv_layer_pre_alloc_im2col(other.conv_layer_pre_alloc_im2col)
+// The network weights are read only after loading, so the copies share them (cv::Mat is reference counted) instead of cloning
+CNN::CNN(const CNN& other) : cnn_layer_types(other.cnn_layer_types), cnn_max_pooling_layers(other.cnn_max_pooling_layers), cnn_convolutional_layers_bias(other.cnn_convolutional_layers_bias),
+	cnn_convolutional_layers_weights(other.cnn_convolutional_layers_weights), cnn_convolutional_layers(other.cnn_convolutional_layers), cnn_fully_connected_layers_weights(other.cnn_fully_connected_layers_weights),
+	cnn_fully_connected_layers_biases(other.cnn_fully_connected_layers_biases), cnn_prelu_layer_weights(other.cnn_prelu_layer_weights),
+	cnn_convolutional_layers_dft(other.cnn_convolutional_layers_dft), cnn_convolutional_layers_winograd(other.cnn_convolutional_layers_winograd), conv_layer_methods(other.conv_layer_methods), tuned_input_sizes(other.tuned_input_sizes),
+	onnx_session(other.onnx_session)
 {
+	// The im2col buffers are scratch space, do not share them between copies so that the copies can be used concurrently
+	this->conv_layer_pre_alloc_im2col.resize(other.conv_layer_pre_alloc_im2col.size());
+}
 
-	this->cnn_convolutional_layers_weights.resize(other.cnn_convolutional_layers_weights.size());
-	for (size_t l = 0; l < other.cnn_convolutional_layers_weights.size(); ++l)
+std::vector<cv::Mat_<float>> CNN::Inference(const cv::Mat& input_img, bool direct, bool thread_safe)
+{
+	if (thread_safe)
 	{
-		// Make sure the matrix is copied.
-		this->cnn_convolutional_layers_weights[l] = other.cnn_convolutional_layers_weights[l].clone();
+		// A fresh workspace just for this call
+		std::vector<cv::Mat_<float> > im2col_workspace;
+		return Inference(input_img, im2col_workspace, direct);
 	}
+	return Inference(input_img, conv_layer_pre_alloc_im2col, direct);
+}
+
+std::vector<cv::Mat_<float>> CNN::Inference(const cv::Mat& input_img, std::vector<cv::Mat_<float> >& im2col_workspace, bool direct)
+{
+	return RunInference(input_img, im2col_workspace, direct, false);
+}
 
-	this->cnn_convolutional_layers.resize(other.cnn_convolutional_layers.size());
-	for (size_t l = 0; l < other.cnn_convolutional_layers.size(); ++l)
+void CNN::TuneConvolutions(const cv::Size& input_size)
+{
+	if (IsTuned(input_size) || cnn_layer_types.empty())
 	{
-		this->cnn_convolutional_layers[l].resize(other.cnn_convolutional_layers[l].size());
+		return;
+	}
 
-		for (size_t i = 0; i < other.cnn_convolutional_layers[l].size(); ++i)
-		{
-			this->cnn_convolutional_layers[l][i].resize(other.cnn_convolutional_layers[l][i].size());
+	// The timings do not depend on the content, so any image in the expected (normalised) range will do
+	cv::Mat input_img(input_size, CV_32FC3);
+	cv::randu(input_img, cv::Scalar::all(-1.0), cv::Scalar::all(1.0));
 
-			for (size_t k = 0; k < other.cnn_convolutional_layers[l][i].size(); ++k)
-			{
-				// Make sure the matrix is copied.
-				this->cnn_convolutional_layers[l][i][k] = other.cnn_convolutional_layers[l][i][k].clone();
-			}
+	if (conv_layer_methods.size() < cnn_convolutional_layers.size())
+	{
+		conv_layer_methods.resize(cnn_convolutional_layers.size());
+	}
+
+	std::vector<cv::Mat_<float> > im2col_workspace;
+	RunInference(input_img, im2col_workspace, true, true);
+
+	tuned_input_sizes.insert(std::make_pair(input_size.height, input_size.width));
+}
+
+// Timing a convolution method, the fastest of a few runs after a warm up one (which allocates the buffers and precomputes the kernel DFTs)
+template<typename Conv>
+static double TimeConvolution(Conv conv)
+{
+	conv();
+	double best = -1;
+	for (int i = 0; i < 3; ++i)
+	{
+		int64 start = cv::getTickCount();
+		conv();
+		double time = (double)(cv::getTickCount() - start);
+		if (best < 0 || time < best)
+		{
+			best = time;
 		}
 	}
+	return best;
+}
 
-	this->cnn_fully_connected_layers_weights.resize(other.cnn_fully_connected_layers_weights.size());
+bool CNN::ExportONNX(OnnxGraph& graph) const
+{
+	int cnn_layer = 0;
+	int fully_connected_layer = 0;
+	int prelu_layer = 0;
+	int max_pool_layer = 0;
 
-	for (size_t l = 0; l < other.cnn_fully_connected_layers_weights.size(); ++l)
+	graph.AddInput("input", { -1, 3, -1, -1 });
+	OnnxTensor tensor = { "input", ONNX_MAPS, 3 };
+
+	for (size_t layer = 0; layer < cnn_layer_types.size(); ++layer)
 	{
-		// Make sure the matrix is copied.
-		this->cnn_fully_connected_layers_weights[l] = other.cnn_fully_connected_layers_weights[l].clone();
+		bool exported = true;
+
+		int layer_type = cnn_layer_types[layer];
+		if (layer_type == 0)
+		{
+			cv::Mat_<float> weight_matrix;
+			cnn_convolutional_layers_weights[cnn_layer].Unpack(weight_matrix);
+			exported = OnnxConvolution(graph, tensor, weight_matrix, cnn_convolutional_layers[cnn_layer][0][0].rows, cnn_convolutional_layers[cnn_layer][0][0].cols);
+			cnn_layer++;
+		}
+		if (layer_type == 1)
+		{
+			const std::tuple<int, int, int, int>& pooling = cnn_max_pooling_layers[max_pool_layer];
+			exported = OnnxMaxPooling(graph, tensor, std::get<2>(pooling), std::get<3>(pooling), std::get<0>(pooling), std::get<1>(pooling));
+			max_pool_layer++;
+		}
+		if (layer_type == 2)
+		{
+			exported = OnnxFullyConnected(graph, tensor, cnn_fully_connected_layers_weights[fully_connected_layer], cnn_fully_connected_layers_biases[fully_connected_layer]);
+			fully_connected_layer++;
+		}
+		if (layer_type == 3)
+		{
+			exported = OnnxPReLU(graph, tensor, cnn_prelu_layer_weights[prelu_layer]);
+			prelu_layer++;
+		}
+		if (layer_type == 4)
+		{
+			OnnxSigmoid(graph, tensor);
+		}
+
+		if (!exported)
+		{
+			return false;
+		}
 	}
 
-	this->cnn_fully_connected_layers_biases.resize(other.cnn_fully_connected_layers_biases.size());
+	OnnxOutput(graph, tensor, "output");
+	return true;
+}
+
+bool CNN::RunOnnx(const std::vector<cv::Mat>& input_imgs, std::vector<std::vector<cv::Mat_<float> > >& outputs)
+{
+	if (GetCNNBackend() != ONNXRUNTIME_BACKEND || input_imgs.empty())
+	{
+		return false;
+	}
 
-	for (size_t l = 0; l < other.cnn_fully_connected_layers_biases.size(); ++l)
+	std::shared_ptr<OnnxSession> session = onnx_session->Get([this](OnnxGraph& graph) { return ExportONNX(graph); });
+	if (!session)
 	{
-		// Make sure the matrix is copied.
-		this->cnn_fully_connected_layers_biases[l] = other.cnn_fully_connected_layers_biases[l].clone();
+		return false;
 	}
 
-	this->cnn_prelu_layer_weights.resize(other.cnn_prelu_layer_weights.size());
+	// The images are given as BGR, the network takes RGB planes
+	int height = input_imgs[0].rows;
+	int width = input_imgs[0].cols;
+	std::vector<float> input(input_imgs.size() * 3 * height * width);
+	float* input_ptr = input.data();
+	for (size_t b = 0; b < input_imgs.size(); ++b)
+	{
+		cv::Mat input_img = input_imgs[b];
+		if (input_img.channels() == 1)
+		{
+			cv::cvtColor(input_img, input_img, cv::COLOR_GRAY2BGR);
+		}
 
-	for (size_t l = 0; l < other.cnn_prelu_layer_weights.size(); ++l)
+		cv::Mat channels[3];
+		cv::split(input_img, channels);
+		for (int c = 2; c >= 0; --c, input_ptr += height * width)
+		{
+			channels[c].convertTo(cv::Mat(height, width, CV_32F, input_ptr), CV_32F);
+		}
+	}
+
+	std::vector<float> output;
+	std::vector<int64_t> output_shape;
+	if (!session->Run(input.data(), { (int64_t)input_imgs.size(), 3, height, width }, output, output_shape))
 	{
-		// Make sure the matrix is copied.
-		this->cnn_prelu_layer_weights[l] = other.cnn_prelu_layer_weights[l].clone();
+		return false;
 	}
+
+	FromOnnxOutput(output, output_shape, outputs);
+	return true;
 }
 
-std::vector<cv::Mat_<float>> CNN::Inference(const cv::Mat& input_img, bool direct, bool thread_safe)
+std::vector<cv::Mat_<float>> CNN::RunInference(const cv::Mat& input_img, std::vector<cv::Mat_<float> >& im2col_workspace, bool direct, bool tune)
 {
+	// There is nothing to tune when running through ONNX Runtime
+	std::vector<std::vector<cv::Mat_<float> > > onnx_outputs;
+	if (!tune && RunOnnx(std::vector<cv::Mat>(1, input_img), onnx_outputs))
+	{
+		return onnx_outputs[0];
+	}
+
+	// One im2col buffer per convolutional layer
+	if (im2col_workspace.size() < cnn_convolutional_layers_weights.size())
+	{
+		im2col_workspace.resize(cnn_convolutional_layers_weights.size());
+	}
+
 	if (input_img.channels() == 1)
 	{
 		cv::cvtColor(input_img, input_img, cv::COLOR_GRAY2BGR);
@@ -172,19 +297,48 @@ std::vector<cv::Mat_<float>> CNN::Inference(const cv::Mat& input_img, bool direc
 		if (layer_type == 0)		
 		{
 
-			// Either perform direct convolution through matrix multiplication or use an FFT optimized version, which one is optimal depends on the kernel and input sizes
-			if (direct)
+			int height_k = cnn_convolutional_layers[cnn_layer][0][0].rows;
+			int width_k = cnn_convolutional_layers[cnn_layer][0][0].cols;
+			std::pair<int, int> input_size(input_maps[0].rows, input_maps[0].cols);
+
+			bool winograd_available = !cnn_convolutional_layers_winograd[cnn_layer].empty();
+
+			if (tune && conv_layer_methods[cnn_layer].count(input_size) == 0)
 			{
-				if(thread_safe)
+				double time_direct = TimeConvolution([&]() { convolution_direct_blas(outputs, input_maps, cnn_convolutional_layers_weights[cnn_layer], height_k, width_k, im2col_workspace[cnn_layer]); });
+				double time_fft = TimeConvolution([&]() { convolution_fft2(outputs, input_maps, cnn_convolutional_layers[cnn_layer], cnn_convolutional_layers_bias[cnn_layer], cnn_convolutional_layers_dft[cnn_layer]); });
+
+				int method = time_fft < time_direct ? CONV_FFT : CONV_DIRECT;
+				if (winograd_available)
 				{
-					cv::Mat_<float> pre_alloc;
-					convolution_direct_blas(outputs, input_maps, cnn_convolutional_layers_weights[cnn_layer], cnn_convolutional_layers[cnn_layer][0][0].rows, cnn_convolutional_layers[cnn_layer][0][0].cols, pre_alloc);
+					double time_winograd = TimeConvolution([&]() { convolution_winograd_3x3(outputs, input_maps, cnn_convolutional_layers_winograd[cnn_layer], cnn_convolutional_layers_bias[cnn_layer], im2col_workspace[cnn_layer]); });
+					if (time_winograd < std::min(time_fft, time_direct))
+					{
+						method = CONV_WINOGRAD;
+					}
 				}
-				else
+				conv_layer_methods[cnn_layer][input_size] = method;
+			}
+
+			// The FFT is only used when it was tuned to be faster for this input size, as then the kernel DFTs are already precomputed
+			int method = direct ? (winograd_available ? CONV_WINOGRAD : CONV_DIRECT) : CONV_FFT;
+			if (direct && (size_t)cnn_layer < conv_layer_methods.size())
+			{
+				std::map<std::pair<int, int>, int>::const_iterator choice = conv_layer_methods[cnn_layer].find(input_size);
+				if (choice != conv_layer_methods[cnn_layer].end())
 				{
-					convolution_direct_blas(outputs, input_maps, cnn_convolutional_layers_weights[cnn_layer], cnn_convolutional_layers[cnn_layer][0][0].rows, cnn_convolutional_layers[cnn_layer][0][0].cols, conv_layer_pre_alloc_im2col[cnn_layer]);
+					method = choice->second;
 				}
-	
+			}
+
+			// Either perform direct convolution through matrix multiplication, Winograd convolution or use an FFT optimized version, which one is optimal depends on the kernel and input sizes
+			if (method == CONV_DIRECT)
+			{
+				convolution_direct_blas(outputs, input_maps, cnn_convolutional_layers_weights[cnn_layer], height_k, width_k, im2col_workspace[cnn_layer]);
+			}
+			else if (method == CONV_WINOGRAD)
+			{
+				convolution_winograd_3x3(outputs, input_maps, cnn_convolutional_layers_winograd[cnn_layer], cnn_convolutional_layers_bias[cnn_layer], im2col_workspace[cnn_layer]);
 			}
 			else
 			{
@@ -243,6 +397,112 @@ std::vector<cv::Mat_<float>> CNN::Inference(const cv::Mat& input_img, bool direc
 
 }
 
+std::vector<std::vector<cv::Mat_<float> > > CNN::InferenceBatch(const std::vector<cv::Mat>& input_imgs, std::vector<cv::Mat_<float> >& im2col_workspace)
+{
+	std::vector<std::vector<cv::Mat_<float> > > onnx_outputs;
+	if (RunOnnx(input_imgs, onnx_outputs))
+	{
+		return onnx_outputs;
+	}
+
+	// One im2col buffer per convolutional layer
+	if (im2col_workspace.size() < cnn_convolutional_layers_weights.size())
+	{
+		im2col_workspace.resize(cnn_convolutional_layers_weights.size());
+	}
+
+	int cnn_layer = 0;
+	int fully_connected_layer = 0;
+	int prelu_layer = 0;
+	int max_pool_layer = 0;
+
+	// Layed out as input image -> maps
+	vector<vector<cv::Mat_<float> > > input_maps(input_imgs.size());
+
+	for (size_t b = 0; b < input_imgs.size(); ++b)
+	{
+		cv::Mat input_img = input_imgs[b];
+		if (input_img.channels() == 1)
+		{
+			cv::cvtColor(input_img, input_img, cv::COLOR_GRAY2BGR);
+		}
+
+		// Slit a BGR image into three chnels
+		cv::Mat channels[3];
+		cv::split(input_img, channels);
+
+		// Flip the BGR order to RGB
+		input_maps[b].push_back(channels[2]);
+		input_maps[b].push_back(channels[1]);
+		input_maps[b].push_back(channels[0]);
+	}
+
+	vector<vector<cv::Mat_<float> > > outputs(input_imgs.size());
+
+	for (size_t layer = 0; layer < cnn_layer_types.size(); ++layer)
+	{
+
+		// Determine layer type
+		int layer_type = cnn_layer_types[layer];
+
+		// Convolutional layer, the whole batch is done through one matrix multiplication
+		if (layer_type == 0)
+		{
+			convolution_direct_blas_batch(outputs, input_maps, cnn_convolutional_layers_weights[cnn_layer], cnn_convolutional_layers[cnn_layer][0][0].rows, cnn_convolutional_layers[cnn_layer][0][0].cols, im2col_workspace[cnn_layer]);
+			cnn_layer++;
+		}
+		if (layer_type == 1)
+		{
+
+			int stride_x = std::get<2>(cnn_max_pooling_layers[max_pool_layer]);
+			int stride_y = std::get<3>(cnn_max_pooling_layers[max_pool_layer]);
+
+			int kernel_size_x = std::get<0>(cnn_max_pooling_layers[max_pool_layer]);
+			int kernel_size_y = std::get<1>(cnn_max_pooling_layers[max_pool_layer]);
+
+			for (size_t b = 0; b < input_maps.size(); ++b)
+			{
+				max_pooling(outputs[b], input_maps[b], stride_x, stride_y, kernel_size_x, kernel_size_y);
+			}
+			max_pool_layer++;
+		}
+		if (layer_type == 2)
+		{
+			fully_connected_batch(outputs, input_maps, cnn_fully_connected_layers_weights[fully_connected_layer], cnn_fully_connected_layers_biases[fully_connected_layer]);
+			fully_connected_layer++;
+		}
+		if (layer_type == 3) // PReLU
+		{
+			// In place prelu computation
+			for (size_t b = 0; b < input_maps.size(); ++b)
+			{
+				PReLU(input_maps[b], cnn_prelu_layer_weights[prelu_layer]);
+				outputs[b] = input_maps[b];
+			}
+			prelu_layer++;
+		}
+		if (layer_type == 4)
+		{
+			for (size_t b = 0; b < input_maps.size(); ++b)
+			{
+				outputs[b].clear();
+				for (size_t k = 0; k < input_maps[b].size(); ++k)
+				{
+					// Apply the sigmoid
+					cv::exp(-input_maps[b][k], input_maps[b][k]);
+					input_maps[b][k] = 1.0 / (1.0 + input_maps[b][k]);
+
+					outputs[b].push_back(input_maps[b][k]);
+				}
+			}
+		}
+		// Set the outputs of this layer to inputs of the next one
+		input_maps = outputs;
+	}
+
+	return outputs;
+}
+
 void ReadMatBin(std::ifstream& stream, cv::Mat &output_mat)
 {
 	// Read in the number of rows, columns and the data type
@@ -267,12 +527,92 @@ void CNN::ClearPrecomp()
 			cnn_convolutional_layers_dft[k1][k2].clear();
 		}
 	}
+	conv_layer_methods.clear();
+	tuned_input_sizes.clear();
+}
+
+void CNN::ExportTuning(Utilities::TuningCache& cache, const string& prefix) const
+{
+	for (size_t layer = 0; layer < conv_layer_methods.size(); ++layer)
+	{
+		for (std::map<std::pair<int, int>, int>::const_iterator choice = conv_layer_methods[layer].begin(); choice != conv_layer_methods[layer].end(); ++choice)
+		{
+			stringstream key;
+			key << prefix << choice->first.first << "x" << choice->first.second << "/" << layer;
+			cache.Set(key.str(), choice->second);
+		}
+	}
+}
+
+void CNN::ImportTuning(const Utilities::TuningCache& cache, const string& prefix)
+{
+	vector<std::pair<string, int> > choices = cache.GetPrefixed(prefix);
+	if (choices.empty() || cnn_layer_types.empty())
+	{
+		return;
+	}
+
+	if (conv_layer_methods.size() < cnn_convolutional_layers.size())
+	{
+		conv_layer_methods.resize(cnn_convolutional_layers.size());
+	}
+
+	std::set<std::pair<int, int> > imported_sizes;
+	for (size_t i = 0; i < choices.size(); ++i)
+	{
+		int height, width, layer;
+		if (sscanf(choices[i].first.c_str(), "%dx%d/%d", &height, &width, &layer) != 3 || layer < 0 || layer >= (int)conv_layer_methods.size() ||
+			choices[i].second < CONV_DIRECT || choices[i].second > CONV_WINOGRAD)
+		{
+			cout << "WARNING: ignoring the tuning cache entry " << prefix << choices[i].first << endl;
+			continue;
+		}
+		// Winograd kernels are only available for the 3x3 layers
+		if (choices[i].second == CONV_WINOGRAD && cnn_convolutional_layers_winograd[layer].empty())
+		{
+			continue;
+		}
+		conv_layer_methods[layer][std::make_pair(height, width)] = choices[i].second;
+		imported_sizes.insert(std::make_pair(height, width));
+	}
+
+	// A single inference per size precomputes the kernel spectra of the FFT choices, which would otherwise be computed on first (concurrent) use
+	for (std::set<std::pair<int, int> >::const_iterator size = imported_sizes.begin(); size != imported_sizes.end(); ++size)
+	{
+		cv::Mat input_img(size->first, size->second, CV_32FC3, cv::Scalar::all(0));
+		std::vector<cv::Mat_<float> > im2col_workspace;
+		RunInference(input_img, im2col_workspace, true, false);
+		tuned_input_sizes.insert(*size);
+	}
+}
+
+void CNN::ReportMemory(Utilities::MemoryReport& report, const string& component) const
+{
+	for (size_t layer = 0; layer < cnn_convolutional_layers_weights.size(); ++layer)
+	{
+		report.Add(component + "/weights", cnn_convolutional_layers_weights[layer].Storage());
+	}
+	report.Add(component + "/weights", cnn_convolutional_layers);
+	for (size_t layer = 0; layer < cnn_convolutional_layers_bias.size(); ++layer)
+	{
+		report.AddVector(component + "/weights", cnn_convolutional_layers_bias[layer]);
+	}
+	report.Add(component + "/weights", cnn_fully_connected_layers_weights);
+	report.Add(component + "/weights", cnn_fully_connected_layers_biases);
+	report.Add(component + "/weights", cnn_prelu_layer_weights);
+	report.Add(component + "/weights", cnn_convolutional_layers_winograd);
+
+	report.Add(component + "/dft", cnn_convolutional_layers_dft);
+	report.Add(component + "/im2col", conv_layer_pre_alloc_im2col);
 }
 
 void CNN::Read(const string& location)
 {
 
-	openblas_set_num_threads(1);
+	SetBlasThreads(1);
+
+	// A session of the previous network would be stale
+	onnx_session.reset(new LazyOnnxSession());
 
 	ifstream cnn_stream(location, ios::in | ios::binary);
 	if (cnn_stream.is_open())
@@ -347,6 +687,16 @@ void CNN::Read(const string& location)
 
 				cnn_convolutional_layers.push_back(kernels_rearr);
 
+				// The Winograd transformed kernels for 3x3 convolutions
+				if (kernels_rearr[0][0].rows == 3 && kernels_rearr[0][0].cols == 3)
+				{
+					cnn_convolutional_layers_winograd.push_back(winograd_kernels_3x3(kernels_rearr));
+				}
+				else
+				{
+					cnn_convolutional_layers_winograd.push_back(cv::Mat_<float>());
+				}
+
 				// Place-holders for DFT precomputation
 				vector<map<int, vector<cv::Mat_<double> > > > cnn_convolutional_layers_dft_curr_layer;
 				cnn_convolutional_layers_dft_curr_layer.resize(num_kernels);
@@ -376,7 +726,10 @@ void CNN::Read(const string& location)
 				}
 				weight_matrix.copyTo(W(cv::Rect(0, 0, weight_matrix.cols, weight_matrix.rows)));
 
-				cnn_convolutional_layers_weights.push_back(W.t());
+				// Packed once here rather than by the BLAS library on every product
+				PackedMatrix W_packed;
+				W_packed.Pack(W, true);
+				cnn_convolutional_layers_weights.push_back(W_packed);
 				conv_layer_pre_alloc_im2col.push_back(cv::Mat_<float>());
 
 			}
@@ -417,6 +770,31 @@ void CNN::Read(const string& location)
 
 //===========================================================================
 // Read in the MTCNN detector
+bool FaceDetectorMTCNN::WriteONNX(const string& directory) const
+{
+	const CNN* networks[3] = { &PNet, &RNet, &ONet };
+	const char* names[3] = { "pnet", "rnet", "onet" };
+
+	for (int n = 0; n < 3; ++n)
+	{
+		OnnxGraph graph(names[n]);
+		string location = directory + "/" + names[n] + ".onnx";
+		if (!networks[n]->ExportONNX(graph) || !graph.Write(location))
+		{
+			cout << "Could not write the ONNX model " << location << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+void FaceDetectorMTCNN::ReportMemory(Utilities::MemoryReport& report, const string& component) const
+{
+	PNet.ReportMemory(report, component + "/pnet");
+	RNet.ReportMemory(report, component + "/rnet");
+	ONet.ReportMemory(report, component + "/onet");
+}
+
 void FaceDetectorMTCNN::Read(const string& location)
 {
 
@@ -433,6 +811,11 @@ void FaceDetectorMTCNN::Read(const string& location)
 	// The other module locations should be defined as relative paths from the main model
 	boost::filesystem::path root = boost::filesystem::path(location).parent_path();
 
+	// The three networks are independent of each other, so they are only collected here and read in parallel
+	string pnet_location;
+	string rnet_location;
+	string onet_location;
+
 	// The main file contains the references to other files
 	while (!locations.eof())
 	{
@@ -459,19 +842,36 @@ void FaceDetectorMTCNN::Read(const string& location)
 		if (module.compare("PNet") == 0)
 		{
 			cout << "Reading the PNet module from: " << location << endl;
-			PNet.Read(location);
+			pnet_location = location;
 		}
 		else if(module.compare("RNet") == 0)
 		{
 			cout << "Reading the RNet module from: " << location << endl;
-			RNet.Read(location);
+			rnet_location = location;
 		}
 		else if (module.compare("ONet") == 0)
 		{
 			cout << "Reading the ONet module from: " << location << endl;
-			ONet.Read(location);
+			onet_location = location;
 		}
 	}
+
+	tbb::parallel_invoke(
+		[&]() { if (!pnet_location.empty()) PNet.Read(pnet_location); },
+		[&]() { if (!rnet_location.empty()) RNet.Read(rnet_location); },
+		[&]() { if (!onet_location.empty()) ONet.Read(onet_location); });
+
+	ImportTuning(Utilities::TuningCache::Global());
+}
+
+void FaceDetectorMTCNN::ExportTuning(Utilities::TuningCache& cache) const
+{
+	PNet.ExportTuning(cache, "mtcnn/pnet/");
+}
+
+void FaceDetectorMTCNN::ImportTuning(const Utilities::TuningCache& cache)
+{
+	PNet.ImportTuning(cache, "mtcnn/pnet/");
 }
 
 // Perform non maximum supression on proposal bounding boxes prioritizing boxes with high score/confidence
@@ -553,6 +953,17 @@ void select_subset(const vector<int>& to_keep, vector<cv::Rect_<float> >& boundi
 	corrections = corrections_tmp;
 }
 
+// The same for the keypoints of the bounding boxes
+void select_keypoints(const vector<int>& to_keep, vector<vector<cv::Point2f> >& keypoints)
+{
+	vector<vector<cv::Point2f> > keypoints_tmp;
+	for (size_t i = 0; i < to_keep.size(); ++i)
+	{
+		keypoints_tmp.push_back(keypoints[to_keep[i]]);
+	}
+	keypoints.swap(keypoints_tmp);
+}
+
 // Use the heatmap generated by PNet to generate bounding boxes in the original image space, also generate the correction values and scores of the bounding boxes as well
 void generate_bounding_boxes(vector<cv::Rect_<float> >& o_bounding_boxes, vector<float>& o_scores, vector<cv::Rect_<float> >& o_corrections, const cv::Mat_<float>& heatmap, const vector<cv::Mat_<float> >& corrections, float scale, float threshold, int face_support)
 {
@@ -640,89 +1051,183 @@ void apply_correction(vector<cv::Rect_<float> >& total_bboxes, const vector<cv::
 }
 
 
-// The actual MTCNN face detection step
-bool FaceDetectorMTCNN::DetectFaces(vector<cv::Rect_<float> >& o_regions, const cv::Mat& img_in, std::vector<float>& o_confidences, int min_face_size, float t1, float t2, float t3)
+// Extracting a proposal from the (8 bit colour) image and resizing it to the size expected by the next stage network (the parts outside the
+// image are zero padded), only the proposal is converted to floating point
+cv::Mat extract_proposal(const cv::Mat& img, const cv::Rect_<float>& proposal_box, int target_size)
 {
+	int width_orig = img.cols;
+	int height_orig = img.rows;
 
-	int height_orig = img_in.size().height;
-	int width_orig = img_in.size().width;
+	float width_target = proposal_box.width + 1;
+	float height_target = proposal_box.height + 1;
 
-	// Size ratio of image pyramids
-	double pyramid_factor = 0.709;
+	// Work out the start and end indices in the original image
+	int start_x_in = cv::max((int)(proposal_box.x - 1), 0);
+	int start_y_in = cv::max((int)(proposal_box.y - 1), 0);
+	int end_x_in = cv::min((int)(proposal_box.x + width_target - 1), width_orig);
+	int end_y_in = cv::min((int)(proposal_box.y + height_target - 1), height_orig);
 
-	// Face support region is 12x12 px, so from that can work out the largest
-	// scale(which is 12 / min), and work down from there to smallest scale(no smaller than 12x12px)
-	int min_dim = std::min(height_orig, width_orig);
+	// Work out the start and end indices in the target image
+	int	start_x_out = cv::max((int)(-proposal_box.x + 1), 0);
+	int start_y_out = cv::max((int)(-proposal_box.y + 1), 0);
+	int end_x_out = cv::min(width_target - (proposal_box.x + proposal_box.width - width_orig), width_target);
+	int end_y_out = cv::min(height_target - (proposal_box.y + proposal_box.height - height_orig), height_target);
 
-	int face_support = 12;
-	int num_scales = floor(log((double)min_face_size / (double)min_dim) / log(pyramid_factor)) + 1;
+	cv::Mat tmp(height_target, width_target, CV_8UC3, cv::Scalar(0, 0, 0));
 
-	cv::Mat input_img;
+	img(cv::Rect(start_x_in, start_y_in, end_x_in - start_x_in, end_y_in - start_y_in)).copyTo(
+		tmp(cv::Rect(start_x_out, start_y_out, end_x_out - start_x_out, end_y_out - start_y_out)));
 
-	// Force the image to three channels
-	if (img_in.channels() == 1)
-	{
-		cv::cvtColor(img_in, input_img, cv::COLOR_GRAY2RGB);
-	}
-	else
+	cv::Mat tmp_float;
+	tmp.convertTo(tmp_float, CV_32FC3);
+
+	cv::Mat prop_img;
+	cv::resize(tmp_float, prop_img, cv::Size(target_size, target_size));
+
+	prop_img = (prop_img - 127.5) * 0.0078125;
+
+	return prop_img;
+}
+
+// Evaluating a refinement network (RNet or ONet) on the proposal images (extracted from the proposals of one or more images), the proposals
+// are evaluated in batches (one matrix multiplication per layer for the whole batch), with the batches computed in parallel. Updates the scores
+// and corrections, and marks the proposals above the threshold. If asked for the five facial keypoints ONet regresses (eye centres, nose tip
+// and mouth corners) are returned as well, in image coordinates (left empty if the network does not output them)
+void evaluate_proposal_images(CNN& cnn, const vector<cv::Mat>& proposal_imgs, const vector<cv::Rect_<float> >& proposal_boxes, float threshold,
+	vector<float>& scores, vector<cv::Rect_<float> >& corrections, vector<char>& above_thresh, vector<vector<cv::Point2f> >* keypoints = NULL)
+{
+	const int num_proposals = (int)proposal_boxes.size();
+
+	// Big enough for the per layer matrix multiplications to be efficient, while keeping the im2col buffers small
+	const int batch_size = 64;
+
+	above_thresh.assign(num_proposals, 0);
+	if (keypoints != NULL)
 	{
-		input_img = img_in;
+		keypoints->assign(num_proposals, vector<cv::Point2f>());
 	}
 
-	cv::Mat img_float;
-	input_img.convertTo(img_float, CV_32FC3);
+	// Every task (thread) gets its own im2col workspaces
+	tbb::enumerable_thread_specific<vector<cv::Mat_<float> > > workspaces;
 
-	vector<cv::Rect_<float> > proposal_boxes_all;
-	vector<float> scores_all;
-	vector<cv::Rect_<float> > proposal_corrections_all;
+	int num_batches = (num_proposals + batch_size - 1) / batch_size;
+	tbb::parallel_for(0, num_batches, [&](int batch) {
 
-	// As the scales will be done in parallel have some containers for them
-	vector<vector<cv::Rect_<float> > > proposal_boxes_cross_scale(num_scales);
-	vector<vector<float> > scores_cross_scale(num_scales);
-	vector<vector<cv::Rect_<float> > > proposal_corrections_cross_scale(num_scales);
+		int start = batch * batch_size;
+		int end = std::min(start + batch_size, num_proposals);
 
-	//tbb::parallel_for(0, (int)num_scales, [&](int i) {
-	for (int i = 0; i < num_scales; ++i)
-	{
-		double scale = ((double)face_support / (double)min_face_size)*cv::pow(pyramid_factor, i);
+		vector<cv::Mat> batch_imgs(proposal_imgs.begin() + start, proposal_imgs.begin() + end);
+		vector<vector<cv::Mat_<float> > > cnn_out = cnn.InferenceBatch(batch_imgs, workspaces.local());
 
-		int h_pyr = ceil(height_orig * scale);
-		int w_pyr = ceil(width_orig * scale);
+		for (int k = start; k < end; ++k)
+		{
+			const cv::Mat_<float>& out = cnn_out[k - start][0];
 
-		cv::Mat normalised_img;
-		cv::resize(img_float, normalised_img, cv::Size(w_pyr, h_pyr));
-		
-		// Normalize the image
-		normalised_img = (normalised_img - 127.5) * 0.0078125;
+			float prob = 1.0 / (1.0 + cv::exp(out.at<float>(0) - out.at<float>(1)));
+			scores[k] = prob;
+			corrections[k].x = out.at<float>(2);
+			corrections[k].y = out.at<float>(3);
+			corrections[k].width = out.at<float>(4);
+			corrections[k].height = out.at<float>(5);
 
-		// Actual PNet CNN step
-		std::vector<cv::Mat_<float> > pnet_out = PNet.Inference(normalised_img, true, false);
+			above_thresh[k] = prob >= threshold;
 
-		// Clear the precomputations, as the image sizes will be different
-		PNet.ClearPrecomp();
+			// The keypoints are relative to the proposal, the x coordinates followed by the y ones
+			if (keypoints != NULL && out.total() >= 16)
+			{
+				const cv::Rect_<float>& box = proposal_boxes[k];
+				for (int p = 0; p < 5; ++p)
+				{
+					(*keypoints)[k].push_back(cv::Point2f(box.x + (box.width + 1) * out.at<float>(6 + p), box.y + (box.height + 1) * out.at<float>(11 + p)));
+				}
+			}
+		}
+	});
+}
 
-		// Extract the probabilities from PNet response
-		cv::Mat_<float> prob_heatmap;
-		cv::exp(pnet_out[0]- pnet_out[1], prob_heatmap);
-		prob_heatmap = 1.0 / (1.0 + prob_heatmap);
+// Evaluating a refinement network on all of the proposals of a single image
+void evaluate_proposals(CNN& cnn, const cv::Mat& img, const vector<cv::Rect_<float> >& proposal_boxes, int target_size, float threshold,
+	vector<float>& scores, vector<cv::Rect_<float> >& corrections, vector<char>& above_thresh, vector<vector<cv::Point2f> >* keypoints = NULL)
+{
+	const int num_proposals = (int)proposal_boxes.size();
 
-		// Extract the probabilities from PNet response
-		std::vector<cv::Mat_<float>> corrections_heatmap(pnet_out.begin() + 2, pnet_out.end());
+	// Creating proposal images from previous step detections
+	vector<cv::Mat> proposal_imgs(num_proposals);
+	tbb::parallel_for(0, num_proposals, [&](int k) {
+		proposal_imgs[k] = extract_proposal(img, proposal_boxes[k], target_size);
+	});
+
+	evaluate_proposal_images(cnn, proposal_imgs, proposal_boxes, threshold, scores, corrections, above_thresh, keypoints);
+}
+
+// Correct the ONet box to expectation to be tight around facial landmarks
+static cv::Rect_<float> LandmarkBox(const cv::Rect_<float>& box)
+{
+	return cv::Rect_<float>((float)(box.width * -0.0075 + box.x), (float)(box.height * 0.2459 + box.y), (float)(1.0323 * box.width), (float)(0.7751 * box.height));
+}
+
+// Size ratio of image pyramids
+static const double MTCNN_PYRAMID_FACTOR = 0.709;
 
-		// Grab the detections
-		vector<cv::Rect_<float> > proposal_boxes;
-		vector<float> scores;
-		vector<cv::Rect_<float> > proposal_corrections;
-		generate_bounding_boxes(proposal_boxes, scores, proposal_corrections, prob_heatmap, corrections_heatmap, scale, t1, face_support);
+// Face support region is 12x12 px
+static const int MTCNN_FACE_SUPPORT = 12;
 
-		proposal_boxes_cross_scale[i] = proposal_boxes;
-		scores_cross_scale[i] = scores;
-		proposal_corrections_cross_scale[i] = proposal_corrections;
+// The number of pyramid scales covering faces from min_face_size to max_face_size (if the latter is positive, otherwise up to the size of the image),
+// the largest scale is 12 / min_face_size and the scales work down from there to the smallest one (no smaller than 12x12px)
+static int pyramid_scales(int width, int height, int min_face_size, int max_face_size)
+{
+	int min_dim = std::min(height, width);
+
+	int num_scales = floor(log((double)min_face_size / (double)min_dim) / log(MTCNN_PYRAMID_FACTOR)) + 1;
+
+	// The scale i finds faces of around min_face_size / pyramid_factor^i, so the ones beyond the largest expected face can be skipped
+	if (max_face_size > min_face_size)
+	{
+		int num_scales_expected = (int)floor(log((double)min_face_size / (double)max_face_size) / log(MTCNN_PYRAMID_FACTOR)) + 2;
+		num_scales = std::min(num_scales, num_scales_expected);
 	}
-	//});
+	return num_scales;
+}
+
+static double pyramid_scale(int min_face_size, int i)
+{
+	return ((double)MTCNN_FACE_SUPPORT / (double)min_face_size)*cv::pow(MTCNN_PYRAMID_FACTOR, i);
+}
+
+// The normalised pyramid level of an image, resized from the 8 bit frame of the image context and only then converted to floating point,
+// so the full resolution frame is never converted
+static cv::Mat pyramid_level(ImageContext& image, double scale)
+{
+	int h_pyr = ceil(image.Colour().rows * scale);
+	int w_pyr = ceil(image.Colour().cols * scale);
+
+	cv::Mat normalised_img;
+	image.ColourResized(cv::Size(w_pyr, h_pyr)).convertTo(normalised_img, CV_32FC3, 0.0078125, -127.5 * 0.0078125);
+	return normalised_img;
+}
+
+// The proposals from the PNet response on a pyramid level
+static void pnet_proposals(vector<cv::Rect_<float> >& proposal_boxes, vector<float>& scores, vector<cv::Rect_<float> >& proposal_corrections,
+	const std::vector<cv::Mat_<float> >& pnet_out, double scale, float t1)
+{
+	// Extract the probabilities from PNet response
+	cv::Mat_<float> prob_heatmap;
+	cv::exp(pnet_out[0]- pnet_out[1], prob_heatmap);
+	prob_heatmap = 1.0 / (1.0 + prob_heatmap);
 
+	// Extract the probabilities from PNet response
+	std::vector<cv::Mat_<float>> corrections_heatmap(pnet_out.begin() + 2, pnet_out.end());
+
+	// Grab the detections
+	generate_bounding_boxes(proposal_boxes, scores, proposal_corrections, prob_heatmap, corrections_heatmap, scale, t1, MTCNN_FACE_SUPPORT);
+}
+
+// Combining the PNet proposals of all of the scales of an image into the proposals for RNet
+static void merge_pnet_proposals(vector<cv::Rect_<float> >& proposal_boxes_all, vector<float>& scores_all, vector<cv::Rect_<float> >& proposal_corrections_all,
+	vector<vector<cv::Rect_<float> > >& proposal_boxes_cross_scale, vector<vector<float> >& scores_cross_scale, vector<vector<cv::Rect_<float> > >& proposal_corrections_cross_scale)
+{
 	// Perform non-maximum supression on proposals accross scales and combine them
-	for (int i = 0; i < num_scales; ++i)
+	for (size_t i = 0; i < proposal_boxes_cross_scale.size(); ++i)
 	{
 		vector<int> to_keep = non_maximum_supression(proposal_boxes_cross_scale[i], scores_cross_scale[i], 0.5, false);
 		select_subset(to_keep, proposal_boxes_cross_scale[i], scores_cross_scale[i], proposal_corrections_cross_scale[i]);
@@ -742,60 +1247,13 @@ bool FaceDetectorMTCNN::DetectFaces(vector<cv::Rect_<float> >& o_regions, const
 
 	// Convert to rectangles and round
 	rectify(proposal_boxes_all);
+}
 
-	// Creating proposal images from previous step detections
-	vector<bool> above_thresh;
-	above_thresh.resize(proposal_boxes_all.size(), false);
-	//tbb::parallel_for(0, (int)proposal_boxes_all.size(), [&](int k) {
-	for (size_t k = 0; k < proposal_boxes_all.size(); ++k) 
-	{
-		float width_target = proposal_boxes_all[k].width + 1;
-		float height_target = proposal_boxes_all[k].height + 1;
-
-		// Work out the start and end indices in the original image
-		int start_x_in = cv::max((int)(proposal_boxes_all[k].x - 1), 0);
-		int start_y_in = cv::max((int)(proposal_boxes_all[k].y - 1), 0);
-		int end_x_in = cv::min((int)(proposal_boxes_all[k].x + width_target - 1), width_orig);
-		int end_y_in = cv::min((int)(proposal_boxes_all[k].y + height_target - 1), height_orig);
-
-		// Work out the start and end indices in the target image
-		int	start_x_out = cv::max((int)(-proposal_boxes_all[k].x + 1), 0);
-		int start_y_out = cv::max((int)(-proposal_boxes_all[k].y + 1), 0);
-		int end_x_out = cv::min(width_target - (proposal_boxes_all[k].x + proposal_boxes_all[k].width - width_orig), width_target);
-		int end_y_out = cv::min(height_target - (proposal_boxes_all[k].y + proposal_boxes_all[k].height - height_orig), height_target);
-
-		cv::Mat tmp(height_target, width_target, CV_32FC3, cv::Scalar(0.0f,0.0f,0.0f));
-
-		img_float(cv::Rect(start_x_in, start_y_in, end_x_in - start_x_in, end_y_in - start_y_in)).copyTo(
-			tmp(cv::Rect(start_x_out, start_y_out, end_x_out - start_x_out, end_y_out - start_y_out)));
-		
-		cv::Mat prop_img;
-		cv::resize(tmp, prop_img, cv::Size(24, 24));
-			
-		prop_img = (prop_img - 127.5) * 0.0078125;
-		
-		// Perform RNet on the proposal image
-		std::vector<cv::Mat_<float> > rnet_out = RNet.Inference(prop_img, true, false);
-
-		float prob = 1.0 / (1.0 + cv::exp(rnet_out[0].at<float>(0) - rnet_out[0].at<float>(1)));
-		scores_all[k] = prob;
-		proposal_corrections_all[k].x = rnet_out[0].at<float>(2);
-		proposal_corrections_all[k].y = rnet_out[0].at<float>(3);
-		proposal_corrections_all[k].width = rnet_out[0].at<float>(4);
-		proposal_corrections_all[k].height = rnet_out[0].at<float>(5);
-		if(prob >= t2)
-		{
-			above_thresh[k] = true;
-		}
-		else
-		{
-			above_thresh[k] = false;
-		}
-
-	}
-	//});
-
-	to_keep.clear();
+// Keeping the proposals RNet confirmed, as the proposals for ONet
+static void select_rnet_proposals(vector<cv::Rect_<float> >& proposal_boxes_all, vector<float>& scores_all, vector<cv::Rect_<float> >& proposal_corrections_all,
+	const vector<char>& above_thresh)
+{
+	vector<int> to_keep;
 	for (size_t i = 0; i < above_thresh.size(); ++i)
 	{
 		if (above_thresh[i])
@@ -815,59 +1273,14 @@ bool FaceDetectorMTCNN::DetectFaces(vector<cv::Rect_<float> >& o_regions, const
 
 	// Convert to rectangles and round
 	rectify(proposal_boxes_all);
+}
 
-	// Preparing for the ONet stage
-	above_thresh.clear();
-	above_thresh.resize(proposal_boxes_all.size());
-	//tbb::parallel_for(0, (int)proposal_boxes_all.size(), [&](int k) {
-	for (size_t k = 0; k < proposal_boxes_all.size(); ++k)
-	{
-		float width_target = proposal_boxes_all[k].width + 1;
-		float height_target = proposal_boxes_all[k].height + 1;
-
-		// Work out the start and end indices in the original image
-		int start_x_in = cv::max((int)(proposal_boxes_all[k].x - 1), 0);
-		int start_y_in = cv::max((int)(proposal_boxes_all[k].y - 1), 0);
-		int end_x_in = cv::min((int)(proposal_boxes_all[k].x + width_target - 1), width_orig);
-		int end_y_in = cv::min((int)(proposal_boxes_all[k].y + height_target - 1), height_orig);
-
-		// Work out the start and end indices in the target image
-		int	start_x_out = cv::max((int)(-proposal_boxes_all[k].x + 1), 0);
-		int start_y_out = cv::max((int)(-proposal_boxes_all[k].y + 1), 0);
-		int end_x_out = cv::min(width_target - (proposal_boxes_all[k].x + proposal_boxes_all[k].width - width_orig), width_target);
-		int end_y_out = cv::min(height_target - (proposal_boxes_all[k].y + proposal_boxes_all[k].height - height_orig), height_target);
-
-		cv::Mat tmp(height_target, width_target, CV_32FC3, cv::Scalar(0.0f, 0.0f, 0.0f));
-
-		img_float(cv::Rect(start_x_in, start_y_in, end_x_in - start_x_in, end_y_in - start_y_in)).copyTo(
-			tmp(cv::Rect(start_x_out, start_y_out, end_x_out - start_x_out, end_y_out - start_y_out)));
-
-		cv::Mat prop_img;
-		cv::resize(tmp, prop_img, cv::Size(48, 48));
-
-		prop_img = (prop_img - 127.5) * 0.0078125;
-
-		// Perform RNet on the proposal image
-		std::vector<cv::Mat_<float> > onet_out = ONet.Inference(prop_img, true, false);
-
-		float prob = 1.0 / (1.0 + cv::exp(onet_out[0].at<float>(0) - onet_out[0].at<float>(1)));
-		scores_all[k] = prob;
-		proposal_corrections_all[k].x = onet_out[0].at<float>(2);
-		proposal_corrections_all[k].y = onet_out[0].at<float>(3);
-		proposal_corrections_all[k].width = onet_out[0].at<float>(4);
-		proposal_corrections_all[k].height = onet_out[0].at<float>(5);
-		if (prob >= t3)
-		{
-			above_thresh[k] = true;
-		}
-		else
-		{
-			above_thresh[k] = false;
-		}
-	}
-	//});
-
-	to_keep.clear();
+// Keeping the proposals ONet confirmed, as the detected faces
+static void select_onet_detections(vector<cv::Rect_<float> >& o_regions, std::vector<float>& o_confidences, vector<vector<cv::Point2f> >& o_keypoints,
+	vector<cv::Rect_<float> >& proposal_boxes_all, vector<float>& scores_all, vector<cv::Rect_<float> >& proposal_corrections_all,
+	vector<vector<cv::Point2f> >& keypoints_all, const vector<char>& above_thresh)
+{
+	vector<int> to_keep;
 	for (size_t i = 0; i < above_thresh.size(); ++i)
 	{
 		if (above_thresh[i])
@@ -878,24 +1291,103 @@ bool FaceDetectorMTCNN::DetectFaces(vector<cv::Rect_<float> >& o_regions, const
 
 	// Pick only the bounding boxes above the threshold
 	select_subset(to_keep, proposal_boxes_all, scores_all, proposal_corrections_all);
+	select_keypoints(to_keep, keypoints_all);
 	apply_correction(proposal_boxes_all, proposal_corrections_all, true);
 
 	// Non maximum supression accross bounding boxes, and their offset correction
 	to_keep = non_maximum_supression(proposal_boxes_all, scores_all, 0.7, true);
 	select_subset(to_keep, proposal_boxes_all, scores_all, proposal_corrections_all);
+	select_keypoints(to_keep, keypoints_all);
 
 	// Correct the box to expectation to be tight around facial landmarks
 	for (size_t k = 0; k < proposal_boxes_all.size(); ++k)
 	{
-		proposal_boxes_all[k].x = proposal_boxes_all[k].width * -0.0075 + proposal_boxes_all[k].x;
-		proposal_boxes_all[k].y = proposal_boxes_all[k].height * 0.2459 + proposal_boxes_all[k].y;
-		proposal_boxes_all[k].width = 1.0323 * proposal_boxes_all[k].width;
-		proposal_boxes_all[k].height = 0.7751 * proposal_boxes_all[k].height;
-
-		o_regions.push_back(cv::Rect_<float>(proposal_boxes_all[k].x, proposal_boxes_all[k].y, proposal_boxes_all[k].width, proposal_boxes_all[k].height));
+		o_regions.push_back(LandmarkBox(proposal_boxes_all[k]));
 		o_confidences.push_back(scores_all[k]);
+		o_keypoints.push_back(keypoints_all[k]);
+	}
+}
+
+void FaceDetectorMTCNN::TuneConvolutions(const cv::Size& image_size, int min_face_size, int max_face_size)
+{
+	int num_scales = pyramid_scales(image_size.width, image_size.height, min_face_size, max_face_size);
+	for (int i = 0; i < num_scales; ++i)
+	{
+		double scale = pyramid_scale(min_face_size, i);
+		PNet.TuneConvolutions(cv::Size((int)ceil(image_size.width * scale), (int)ceil(image_size.height * scale)));
+	}
+}
+
+// The PNet and RNet stages, resulting in the proposals for ONet. The pyramid covers faces from min_face_size to max_face_size
+// (if the latter is positive, otherwise up to the size of the image)
+void FaceDetectorMTCNN::ProposeFaces(vector<cv::Rect_<float> >& proposal_boxes_all, vector<float>& scores_all, vector<cv::Rect_<float> >& proposal_corrections_all,
+	ImageContext& image, int min_face_size, int max_face_size, float t1, float t2)
+{
+	const cv::Mat& img = image.Colour();
+
+	int num_scales = pyramid_scales(img.cols, img.rows, min_face_size, max_face_size);
+
+	// As the scales will be done in parallel have some containers for them
+	vector<vector<cv::Rect_<float> > > proposal_boxes_cross_scale(num_scales);
+	vector<vector<float> > scores_cross_scale(num_scales);
+	vector<vector<cv::Rect_<float> > > proposal_corrections_cross_scale(num_scales);
+
+	// Every task (thread) gets its own im2col workspaces, so that the CNN inference can be done in parallel, these are reused across scales and proposals
+	tbb::enumerable_thread_specific<vector<cv::Mat_<float> > > pnet_workspaces;
+
+	// Tuning the convolutions for any new pyramid level sizes before the scales are processed in parallel
+	if (autotune_convolutions)
+	{
+		TuneConvolutions(img.size(), min_face_size, max_face_size);
+	}
+
+	tbb::parallel_for(0, (int)num_scales, [&](int i) {
+	{
+		double scale = pyramid_scale(min_face_size, i);
 
+		// Actual PNet CNN step
+		std::vector<cv::Mat_<float> > pnet_out = PNet.Inference(pyramid_level(image, scale), pnet_workspaces.local());
+
+		pnet_proposals(proposal_boxes_cross_scale[i], scores_cross_scale[i], proposal_corrections_cross_scale[i], pnet_out, scale, t1);
 	}
+	});
+
+	merge_pnet_proposals(proposal_boxes_all, scores_all, proposal_corrections_all, proposal_boxes_cross_scale, scores_cross_scale, proposal_corrections_cross_scale);
+
+	// Evaluate RNet on all of the proposals (not using vector<bool> as it is not safe to write its elements from different threads)
+	vector<char> above_thresh;
+	evaluate_proposals(RNet, img, proposal_boxes_all, 24, t2, scores_all, proposal_corrections_all, above_thresh);
+
+	select_rnet_proposals(proposal_boxes_all, scores_all, proposal_corrections_all, above_thresh);
+}
+
+// The actual MTCNN face detection step
+bool FaceDetectorMTCNN::DetectFaces(vector<cv::Rect_<float> >& o_regions, const cv::Mat& img_in, std::vector<float>& o_confidences, int min_face_size, float t1, float t2, float t3)
+{
+	ImageContext image(img_in, cv::Mat_<uchar>());
+	return DetectFaces(o_regions, image, o_confidences, min_face_size, t1, t2, t3);
+}
+
+bool FaceDetectorMTCNN::DetectFaces(vector<cv::Rect_<float> >& o_regions, ImageContext& image, std::vector<float>& o_confidences, int min_face_size, float t1, float t2, float t3)
+{
+	vector<vector<cv::Point2f> > keypoints;
+	return DetectFaces(o_regions, image, o_confidences, keypoints, min_face_size, t1, t2, t3);
+}
+
+bool FaceDetectorMTCNN::DetectFaces(vector<cv::Rect_<float> >& o_regions, ImageContext& image, std::vector<float>& o_confidences, vector<vector<cv::Point2f> >& o_keypoints,
+	int min_face_size, float t1, float t2, float t3)
+{
+	vector<cv::Rect_<float> > proposal_boxes_all;
+	vector<float> scores_all;
+	vector<cv::Rect_<float> > proposal_corrections_all;
+	ProposeFaces(proposal_boxes_all, scores_all, proposal_corrections_all, image, min_face_size, -1, t1, t2);
+
+	// Evaluate ONet on the remaining proposals
+	vector<char> above_thresh;
+	vector<vector<cv::Point2f> > keypoints_all;
+	evaluate_proposals(ONet, image.Colour(), proposal_boxes_all, 48, t3, scores_all, proposal_corrections_all, above_thresh, &keypoints_all);
+
+	select_onet_detections(o_regions, o_confidences, o_keypoints, proposal_boxes_all, scores_all, proposal_corrections_all, keypoints_all, above_thresh);
 
 	if(o_regions.size() > 0)
 	{
@@ -907,3 +1399,251 @@ bool FaceDetectorMTCNN::DetectFaces(vector<cv::Rect_<float> >& o_regions, const
 	}
 }
 
+// The detection on a number of images at once. The images of the same size have pyramid levels of the same sizes, so PNet is applied to the small
+// levels of all of them as a batch (the large levels have enough work for a matrix multiplication per image and use the tuned convolutions), and
+// the RNet and ONet proposals of all of the images are evaluated together, so that the batches of the refinement networks stay full
+bool FaceDetectorMTCNN::DetectFacesBatch(vector<vector<cv::Rect_<float> > >& o_regions, vector<vector<float> >& o_confidences, vector<vector<vector<cv::Point2f> > >& o_keypoints,
+	const vector<cv::Mat>& images, int min_face_size, float t1, float t2, float t3)
+{
+	const int num_images = (int)images.size();
+
+	o_regions.assign(num_images, vector<cv::Rect_<float> >());
+	o_confidences.assign(num_images, vector<float>());
+	o_keypoints.assign(num_images, vector<vector<cv::Point2f> >());
+
+	// Pyramid levels up to this many pixels are batched across the images
+	const int max_batched_level_area = 128 * 128;
+
+	vector<std::unique_ptr<ImageContext> > contexts(num_images);
+	for (int i = 0; i < num_images; ++i)
+	{
+		contexts[i].reset(new ImageContext(images[i], cv::Mat_<uchar>()));
+	}
+
+	// Grouping the images by size, every (group, scale) pair is then a PNet task
+	std::map<std::pair<int, int>, vector<int> > size_groups;
+	for (int i = 0; i < num_images; ++i)
+	{
+		size_groups[std::make_pair(images[i].rows, images[i].cols)].push_back(i);
+	}
+
+	vector<vector<vector<cv::Rect_<float> > > > proposal_boxes_cross_scale(num_images);
+	vector<vector<vector<float> > > scores_cross_scale(num_images);
+	vector<vector<vector<cv::Rect_<float> > > > proposal_corrections_cross_scale(num_images);
+
+	vector<std::pair<const vector<int>*, int> > pnet_tasks;
+	for (std::map<std::pair<int, int>, vector<int> >::const_iterator group = size_groups.begin(); group != size_groups.end(); ++group)
+	{
+		int num_scales = pyramid_scales(group->first.second, group->first.first, min_face_size, -1);
+		for (size_t k = 0; k < group->second.size(); ++k)
+		{
+			proposal_boxes_cross_scale[group->second[k]].resize(num_scales);
+			scores_cross_scale[group->second[k]].resize(num_scales);
+			proposal_corrections_cross_scale[group->second[k]].resize(num_scales);
+		}
+
+		for (int s = 0; s < num_scales; ++s)
+		{
+			pnet_tasks.push_back(std::make_pair(&group->second, s));
+
+			// Tuning the convolutions for the levels that are not batched (the batched ones always use im2col)
+			double scale = pyramid_scale(min_face_size, s);
+			cv::Size level_size((int)ceil(group->first.second * scale), (int)ceil(group->first.first * scale));
+			if (autotune_convolutions && (group->second.size() == 1 || level_size.area() > max_batched_level_area))
+			{
+				PNet.TuneConvolutions(level_size);
+			}
+		}
+	}
+
+	tbb::enumerable_thread_specific<vector<cv::Mat_<float> > > workspaces;
+
+	tbb::parallel_for(0, (int)pnet_tasks.size(), [&](int t) {
+
+		const vector<int>& group = *pnet_tasks[t].first;
+		int s = pnet_tasks[t].second;
+		double scale = pyramid_scale(min_face_size, s);
+
+		vector<cv::Mat> levels(group.size());
+		for (size_t k = 0; k < group.size(); ++k)
+		{
+			levels[k] = pyramid_level(*contexts[group[k]], scale);
+		}
+
+		vector<vector<cv::Mat_<float> > > pnet_out;
+		if (group.size() > 1 && levels[0].size().area() <= max_batched_level_area)
+		{
+			pnet_out = PNet.InferenceBatch(levels, workspaces.local());
+		}
+		else
+		{
+			for (size_t k = 0; k < group.size(); ++k)
+			{
+				pnet_out.push_back(PNet.Inference(levels[k], workspaces.local()));
+			}
+		}
+
+		for (size_t k = 0; k < group.size(); ++k)
+		{
+			int i = group[k];
+			pnet_proposals(proposal_boxes_cross_scale[i][s], scores_cross_scale[i][s], proposal_corrections_cross_scale[i][s], pnet_out[k], scale, t1);
+		}
+	});
+
+	vector<vector<cv::Rect_<float> > > proposal_boxes_all(num_images);
+	vector<vector<float> > scores_all(num_images);
+	vector<vector<cv::Rect_<float> > > proposal_corrections_all(num_images);
+	vector<vector<char> > above_thresh(num_images);
+	vector<vector<vector<cv::Point2f> > > keypoints_all(num_images);
+
+	tbb::parallel_for(0, num_images, [&](int i) {
+		merge_pnet_proposals(proposal_boxes_all[i], scores_all[i], proposal_corrections_all[i], proposal_boxes_cross_scale[i], scores_cross_scale[i], proposal_corrections_cross_scale[i]);
+	});
+
+	// Evaluating a refinement network on the proposals of all of the images together, and splitting the results back per image
+	auto evaluate_all = [&](CNN& cnn, int target_size, float threshold, bool with_keypoints) {
+
+		vector<int> offsets(num_images + 1, 0);
+		for (int i = 0; i < num_images; ++i)
+		{
+			offsets[i + 1] = offsets[i] + (int)proposal_boxes_all[i].size();
+		}
+
+		vector<cv::Mat> proposal_imgs(offsets[num_images]);
+		vector<cv::Rect_<float> > boxes(offsets[num_images]);
+		vector<float> scores(offsets[num_images]);
+		vector<cv::Rect_<float> > corrections(offsets[num_images]);
+		tbb::parallel_for(0, num_images, [&](int i) {
+			for (int k = offsets[i]; k < offsets[i + 1]; ++k)
+			{
+				boxes[k] = proposal_boxes_all[i][k - offsets[i]];
+				proposal_imgs[k] = extract_proposal(contexts[i]->Colour(), boxes[k], target_size);
+			}
+		});
+
+		vector<char> above;
+		vector<vector<cv::Point2f> > keypoints;
+		evaluate_proposal_images(cnn, proposal_imgs, boxes, threshold, scores, corrections, above, with_keypoints ? &keypoints : NULL);
+
+		for (int i = 0; i < num_images; ++i)
+		{
+			scores_all[i].assign(scores.begin() + offsets[i], scores.begin() + offsets[i + 1]);
+			proposal_corrections_all[i].assign(corrections.begin() + offsets[i], corrections.begin() + offsets[i + 1]);
+			above_thresh[i].assign(above.begin() + offsets[i], above.begin() + offsets[i + 1]);
+			if (with_keypoints)
+			{
+				keypoints_all[i].assign(keypoints.begin() + offsets[i], keypoints.begin() + offsets[i + 1]);
+			}
+		}
+	};
+
+	evaluate_all(RNet, 24, t2, false);
+	tbb::parallel_for(0, num_images, [&](int i) {
+		select_rnet_proposals(proposal_boxes_all[i], scores_all[i], proposal_corrections_all[i], above_thresh[i]);
+	});
+
+	evaluate_all(ONet, 48, t3, true);
+
+	bool detected = false;
+	for (int i = 0; i < num_images; ++i)
+	{
+		select_onet_detections(o_regions[i], o_confidences[i], o_keypoints[i], proposal_boxes_all[i], scores_all[i], proposal_corrections_all[i], keypoints_all[i], above_thresh[i]);
+		detected = detected || !o_regions[i].empty();
+	}
+	return detected;
+}
+
+
+// Detecting only the face that would be picked out of all the detections, the one closest to the preference point (if set) or the biggest
+// one. The ONet proposals are evaluated in that order a few at a time, stopping at the first one confirmed (and the proposals that are
+// too far from the preference point to be that face are not evaluated at all)
+bool FaceDetectorMTCNN::DetectSingleFace(cv::Rect_<float>& o_region, float& o_confidence, const cv::Mat& img_in, cv::Point preference, int min_face_size, int max_face_size,
+	float t1, float t2, float t3)
+{
+	ImageContext image(img_in, cv::Mat_<uchar>());
+	return DetectSingleFace(o_region, o_confidence, image, preference, min_face_size, max_face_size, t1, t2, t3);
+}
+
+bool FaceDetectorMTCNN::DetectSingleFace(cv::Rect_<float>& o_region, float& o_confidence, ImageContext& image, cv::Point preference, int min_face_size, int max_face_size,
+	float t1, float t2, float t3)
+{
+	vector<cv::Point2f> keypoints;
+	return DetectSingleFace(o_region, o_confidence, keypoints, image, preference, min_face_size, max_face_size, t1, t2, t3);
+}
+
+bool FaceDetectorMTCNN::DetectSingleFace(cv::Rect_<float>& o_region, float& o_confidence, vector<cv::Point2f>& o_keypoints, ImageContext& image, cv::Point preference,
+	int min_face_size, int max_face_size, float t1, float t2, float t3)
+{
+	o_keypoints.clear();
+
+	vector<cv::Rect_<float> > proposal_boxes;
+	vector<float> scores;
+	vector<cv::Rect_<float> > proposal_corrections;
+	ProposeFaces(proposal_boxes, scores, proposal_corrections, image, min_face_size, max_face_size, t1, t2);
+
+	bool use_preferred = (preference.x != -1) && (preference.y != -1);
+
+	// Ranking the proposals the same way the face is picked from the detections
+	vector<std::pair<float, int> > ranking;
+	for (size_t k = 0; k < proposal_boxes.size(); ++k)
+	{
+		const cv::Rect_<float>& box = proposal_boxes[k];
+		if (use_preferred)
+		{
+			float dx = preference.x - (box.x + box.width / 2);
+			float dy = preference.y - (box.y + box.height / 2);
+			float dist = sqrt(dx * dx + dy * dy);
+
+			// If the expected size is known, a face further away than it from the preference point is not the one being looked for
+			if (max_face_size > 0 && dist > max_face_size)
+				continue;
+
+			ranking.push_back(std::make_pair(dist, (int)k));
+		}
+		else
+		{
+			ranking.push_back(std::make_pair(-box.width, (int)k));
+		}
+	}
+	std::sort(ranking.begin(), ranking.end());
+
+	// Small enough to stop early, while still using a few threads
+	const size_t chunk_size = 16;
+
+	for (size_t start = 0; start < ranking.size(); start += chunk_size)
+	{
+		size_t end = std::min(start + chunk_size, ranking.size());
+
+		vector<cv::Rect_<float> > chunk_boxes;
+		vector<float> chunk_scores;
+		vector<cv::Rect_<float> > chunk_corrections;
+		for (size_t r = start; r < end; ++r)
+		{
+			chunk_boxes.push_back(proposal_boxes[ranking[r].second]);
+			chunk_scores.push_back(scores[ranking[r].second]);
+			chunk_corrections.push_back(proposal_corrections[ranking[r].second]);
+		}
+
+		vector<char> above_thresh;
+		vector<vector<cv::Point2f> > chunk_keypoints;
+		evaluate_proposals(ONet, image.Colour(), chunk_boxes, 48, t3, chunk_scores, chunk_corrections, above_thresh, &chunk_keypoints);
+
+		for (size_t k = 0; k < chunk_boxes.size(); ++k)
+		{
+			if (above_thresh[k])
+			{
+				vector<cv::Rect_<float> > found_box(1, chunk_boxes[k]);
+				apply_correction(found_box, vector<cv::Rect_<float> >(1, chunk_corrections[k]), true);
+
+				o_region = LandmarkBox(found_box[0]);
+				o_confidence = chunk_scores[k];
+				o_keypoints = chunk_keypoints[k];
+				return true;
+			}
+		}
+	}
+
+	o_region = cv::Rect_<float>(0, 0, 0, 0);
+	o_confidence = -2;
+	return false;
+}
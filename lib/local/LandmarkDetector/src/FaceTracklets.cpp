@@ -0,0 +1,318 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "stdafx.h"
+
+#include "FaceTracklets.h"
+
+// OpenCV includes
+#include <opencv2/imgproc.hpp>
+
+// System includes
+#include <limits>
+
+using namespace LandmarkDetector;
+
+// The side of the appearance signature patch
+static const int SIGNATURE_SIZE = 16;
+
+// A detection overlapping a tracked face by this much is the same face (the overlap the previous suppression used)
+static const float TRACKED_MIN_OVERLAP = 1.0f / 3.0f;
+
+// A lost face is only re-acquired by a detection that looks like it and is of a similar size, the overlap adds to the appearance
+static const float LOST_MIN_SIMILARITY = 0.6f;
+static const float LOST_MAX_SIZE_RATIO = 2.0f;
+static const float LOST_OVERLAP_WEIGHT = 0.5f;
+
+cv::Mat_<float> LandmarkDetector::ComputeFaceSignature(const cv::Mat_<uchar>& grayscale_image, const cv::Rect_<float>& face_box)
+{
+	cv::Rect box = cv::Rect(face_box) & cv::Rect(0, 0, grayscale_image.cols, grayscale_image.rows);
+	if (box.width < 2 || box.height < 2)
+	{
+		return cv::Mat_<float>();
+	}
+
+	cv::Mat_<uchar> patch;
+	cv::resize(grayscale_image(box), patch, cv::Size(SIGNATURE_SIZE, SIGNATURE_SIZE), 0, 0, cv::INTER_AREA);
+
+	cv::Mat_<float> signature;
+	patch.convertTo(signature, CV_32F);
+	signature = signature.reshape(1, 1);
+	signature -= cv::mean(signature)[0];
+
+	double norm = cv::norm(signature);
+	if (norm < 1e-6)
+	{
+		return cv::Mat_<float>();
+	}
+	signature /= norm;
+	return signature;
+}
+
+float LandmarkDetector::CompareFaceSignatures(const cv::Mat_<float>& signature_a, const cv::Mat_<float>& signature_b)
+{
+	if (signature_a.empty() || signature_b.empty() || signature_a.total() != signature_b.total())
+	{
+		return -1;
+	}
+	return (float)signature_a.dot(signature_b);
+}
+
+float LandmarkDetector::BoxOverlap(const cv::Rect_<float>& box_a, const cv::Rect_<float>& box_b)
+{
+	float intersection_area = (box_a & box_b).area();
+	float union_area = box_a.area() + box_b.area() - intersection_area;
+	return union_area > 0 ? intersection_area / union_area : 0;
+}
+
+// The Hungarian algorithm with potentials on a square (padded) cost matrix, O(n^3)
+std::vector<int> LandmarkDetector::SolveAssignment(const cv::Mat_<double>& cost, double max_cost)
+{
+	int rows = cost.rows;
+	int cols = cost.cols;
+	int n = std::max(rows, cols);
+
+	std::vector<int> assignment(rows, -1);
+	if (rows == 0 || cols == 0)
+	{
+		return assignment;
+	}
+
+	// The padding and the forbidden pairs get the maximum cost, so that they are only used when nothing else is left
+	cv::Mat_<double> square(n, n, max_cost);
+	for (int r = 0; r < rows; ++r)
+	{
+		for (int c = 0; c < cols; ++c)
+		{
+			square(r, c) = std::min(cost(r, c), max_cost);
+		}
+	}
+
+	const double INF = std::numeric_limits<double>::infinity();
+
+	// 1-based, column 0 is the virtual start column
+	std::vector<double> u(n + 1, 0), v(n + 1, 0), min_to(n + 1);
+	std::vector<int> row_of_col(n + 1, 0), way(n + 1, 0);
+	std::vector<bool> used(n + 1);
+
+	for (int r = 1; r <= n; ++r)
+	{
+		row_of_col[0] = r;
+		int col0 = 0;
+		std::fill(min_to.begin(), min_to.end(), INF);
+		std::fill(used.begin(), used.end(), false);
+
+		do
+		{
+			used[col0] = true;
+			int row0 = row_of_col[col0];
+			double delta = INF;
+			int col1 = 0;
+			for (int c = 1; c <= n; ++c)
+			{
+				if (used[c])
+					continue;
+
+				double reduced = square(row0 - 1, c - 1) - u[row0] - v[c];
+				if (reduced < min_to[c])
+				{
+					min_to[c] = reduced;
+					way[c] = col0;
+				}
+				if (min_to[c] < delta)
+				{
+					delta = min_to[c];
+					col1 = c;
+				}
+			}
+			for (int c = 0; c <= n; ++c)
+			{
+				if (used[c])
+				{
+					u[row_of_col[c]] += delta;
+					v[c] -= delta;
+				}
+				else
+				{
+					min_to[c] -= delta;
+				}
+			}
+			col0 = col1;
+		} while (row_of_col[col0] != 0);
+
+		// Flipping the augmenting path
+		do
+		{
+			int col1 = way[col0];
+			row_of_col[col0] = row_of_col[col1];
+			col0 = col1;
+		} while (col0 != 0);
+	}
+
+	for (int c = 1; c <= n; ++c)
+	{
+		int r = row_of_col[c] - 1;
+		if (r >= 0 && r < rows && c - 1 < cols && cost(r, c - 1) < max_cost)
+		{
+			assignment[r] = c - 1;
+		}
+	}
+	return assignment;
+}
+
+FaceTracklets::FaceTracklets(int max_frames_lost) : max_frames_lost(max_frames_lost), next_id(0)
+{
+}
+
+std::vector<int> FaceTracklets::Associate(const cv::Mat_<uchar>& grayscale_image, const std::vector<cv::Rect_<float> >& detections, const std::vector<cv::Rect_<float> >& tracked_boxes) const
+{
+	std::vector<int> result(detections.size(), NEW_FACE);
+
+	// Any detection overlapping a tracked face belongs to it, so that a tracker is never started on top of another
+	for (size_t d = 0; d < detections.size(); ++d)
+	{
+		for (size_t t = 0; t < tracked_boxes.size(); ++t)
+		{
+			if (BoxOverlap(detections[d], tracked_boxes[t]) > TRACKED_MIN_OVERLAP)
+			{
+				result[d] = TRACKED_FACE;
+				break;
+			}
+		}
+	}
+
+	// The remaining detections are matched to the lost faces
+	std::vector<int> free_detections;
+	for (size_t d = 0; d < detections.size(); ++d)
+	{
+		if (result[d] == NEW_FACE)
+			free_detections.push_back((int)d);
+	}
+
+	if (free_detections.empty() || lost_faces.empty())
+	{
+		return result;
+	}
+
+	cv::Mat_<double> lost_cost(free_detections.size(), lost_faces.size());
+	for (size_t i = 0; i < free_detections.size(); ++i)
+	{
+		const cv::Rect_<float>& detection = detections[free_detections[i]];
+		cv::Mat_<float> signature = ComputeFaceSignature(grayscale_image, detection);
+
+		for (size_t l = 0; l < lost_faces.size(); ++l)
+		{
+			const LostFace& lost = lost_faces[l];
+			float similarity = CompareFaceSignatures(signature, lost.signature);
+			float size_ratio = detection.width > lost.box.width ? detection.width / std::max(lost.box.width, 1.0f) : lost.box.width / std::max(detection.width, 1.0f);
+
+			if (similarity < LOST_MIN_SIMILARITY || size_ratio > LOST_MAX_SIZE_RATIO)
+			{
+				lost_cost(i, l) = 2.0;
+			}
+			else
+			{
+				lost_cost(i, l) = 2.0 - similarity - LOST_OVERLAP_WEIGHT * BoxOverlap(detection, lost.box);
+			}
+		}
+	}
+
+	std::vector<int> assignment = SolveAssignment(lost_cost, 2.0);
+	for (size_t i = 0; i < assignment.size(); ++i)
+	{
+		if (assignment[i] >= 0)
+		{
+			result[free_detections[i]] = lost_faces[assignment[i]].id;
+		}
+	}
+
+	return result;
+}
+
+void FaceTracklets::AddLost(int id, const CLNF& model, const cv::Mat_<float>& signature)
+{
+	if (id < 0 || signature.empty())
+		return;
+
+	LostFace lost;
+	lost.id = id;
+	lost.box = model.last_face_box;
+	lost.signature = signature.clone();
+	lost.params_local = model.params_local.clone();
+	lost.rotation = cv::Vec3f(model.params_global[1], model.params_global[2], model.params_global[3]);
+	lost.frames_lost = 0;
+	lost_faces.push_back(lost);
+}
+
+bool FaceTracklets::Resume(int id, const cv::Rect_<float>& detection, CLNF& model)
+{
+	for (size_t l = 0; l < lost_faces.size(); ++l)
+	{
+		if (lost_faces[l].id != id)
+			continue;
+
+		model.Reset();
+
+		// Starting from the shape and rotation of the face when it was lost, placed at the detection
+		lost_faces[l].params_local.copyTo(model.params_local);
+		model.pdm.CalcParams(model.params_global, detection, model.params_local, lost_faces[l].rotation);
+		model.pdm.CalcShape2D(model.detected_landmarks, model.params_local, model.params_global);
+		model.tracking_initialised = true;
+
+		// A wider window is still used for the first fit
+		model.detection_success = false;
+
+		lost_faces.erase(lost_faces.begin() + l);
+		return true;
+	}
+	return false;
+}
+
+void FaceTracklets::NextFrame()
+{
+	for (int l = (int)lost_faces.size() - 1; l >= 0; --l)
+	{
+		if (++lost_faces[l].frames_lost > max_frames_lost)
+		{
+			lost_faces.erase(lost_faces.begin() + l);
+		}
+	}
+}
+
+void FaceTracklets::Clear()
+{
+	lost_faces.clear();
+	next_id = 0;
+}
@@ -0,0 +1,271 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "stdafx.h"
+
+#include "Gemm.h"
+#include "CpuDispatch.h"
+
+// System includes
+#include <algorithm>
+
+#if defined(OPENFACE_BLAS_MKL)
+#include <mkl_cblas.h>
+#include <mkl_service.h>
+#elif defined(OPENFACE_BLAS_BLIS)
+#include <blis.h>
+#elif defined(OPENFACE_BLAS_ACCELERATE)
+#include <Accelerate/Accelerate.h>
+#else
+#include <openblas_config.h>
+// Instead of including cblas.h and f77blas.h (the definitions from OpenBLAS and other BLAS libraries differ, declare the required OpenBLAS functionality here)
+#ifdef __cplusplus
+extern "C" {
+	/* Assume C declarations for C++ */
+#endif  /* __cplusplus */
+
+	/*Set the number of threads on runtime.*/
+	void openblas_set_num_threads(int num_threads);
+
+	void sgemm_(char *, char *, blasint *, blasint *, blasint *, float *,
+		float  *, blasint *, float  *, blasint *, float  *, float  *, blasint *);
+}
+#endif
+
+using namespace LandmarkDetector;
+
+// Products with fewer multiply-adds than this go to the built-in kernel
+static const long long SMALL_GEMM_SIZE = 32 * 32 * 32;
+
+// A straightforward kernel for the small products, the innermost loops run over contiguous memory so that they are vectorized by the compiler
+static void SmallGemm(bool transpose_a, bool transpose_b, int m, int n, int k, float alpha, const float* A, int lda, const float* B, int ldb, float beta, float* C, int ldc)
+{
+	for (int j = 0; j < n; ++j)
+	{
+		float* c = C + (size_t)j * ldc;
+
+		if (beta == 0.0f)
+		{
+			for (int i = 0; i < m; ++i)
+				c[i] = 0.0f;
+		}
+		else if (beta != 1.0f)
+		{
+			for (int i = 0; i < m; ++i)
+				c[i] *= beta;
+		}
+
+		if (!transpose_a)
+		{
+			// Accumulating the columns of A
+			for (int p = 0; p < k; ++p)
+			{
+				const float b = alpha * (transpose_b ? B[j + (size_t)p * ldb] : B[p + (size_t)j * ldb]);
+				const float* a = A + (size_t)p * lda;
+				for (int i = 0; i < m; ++i)
+					c[i] += a[i] * b;
+			}
+		}
+		else
+		{
+			// The rows of op(A) are the columns of A, so every element is a dot product
+			for (int i = 0; i < m; ++i)
+			{
+				const float* a = A + (size_t)i * lda;
+				float sum = 0.0f;
+				if (!transpose_b)
+				{
+					const float* b = B + (size_t)j * ldb;
+					for (int p = 0; p < k; ++p)
+						sum += a[p] * b[p];
+				}
+				else
+				{
+					for (int p = 0; p < k; ++p)
+						sum += a[p] * B[j + (size_t)p * ldb];
+				}
+				c[i] += alpha * sum;
+			}
+		}
+	}
+}
+
+void LandmarkDetector::Gemm(bool transpose_a, bool transpose_b, int m, int n, int k, float alpha, const float* A, int lda, const float* B, int ldb, float beta, float* C, int ldc)
+{
+	if (m <= 0 || n <= 0)
+		return;
+
+	if ((long long)m * n * k <= SMALL_GEMM_SIZE)
+	{
+		SmallGemm(transpose_a, transpose_b, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+		return;
+	}
+
+#if defined(OPENFACE_BLAS_MKL) || defined(OPENFACE_BLAS_ACCELERATE)
+	cblas_sgemm(CblasColMajor, transpose_a ? CblasTrans : CblasNoTrans, transpose_b ? CblasTrans : CblasNoTrans, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+#elif defined(OPENFACE_BLAS_BLIS)
+	// The BLIS object free API takes the row and column strides, column major storage has a row stride of 1
+	bli_sgemm(transpose_a ? BLIS_TRANSPOSE : BLIS_NO_TRANSPOSE, transpose_b ? BLIS_TRANSPOSE : BLIS_NO_TRANSPOSE, m, n, k, &alpha,
+		(float*)A, 1, lda, (float*)B, 1, ldb, &beta, C, 1, ldc);
+#else
+	char trans_a[2]; trans_a[0] = transpose_a ? 'T' : 'N';
+	char trans_b[2]; trans_b[0] = transpose_b ? 'T' : 'N';
+	blasint m_b = m, n_b = n, k_b = k, lda_b = lda, ldb_b = ldb, ldc_b = ldc;
+	sgemm_(trans_a, trans_b, &m_b, &n_b, &k_b, &alpha, (float*)A, &lda_b, (float*)B, &ldb_b, &beta, C, &ldc_b);
+#endif
+}
+
+void LandmarkDetector::SetBlasThreads(int num_threads)
+{
+#if defined(OPENFACE_BLAS_MKL)
+	mkl_set_num_threads(num_threads);
+#elif defined(OPENFACE_BLAS_BLIS)
+	bli_thread_set_num_threads(num_threads);
+#elif defined(OPENFACE_BLAS_ACCELERATE)
+	// Accelerate manages its own threads
+	(void)num_threads;
+#else
+	openblas_set_num_threads(num_threads);
+#endif
+}
+
+const char* LandmarkDetector::GetBlasBackendName()
+{
+#if defined(OPENFACE_BLAS_MKL)
+	return "MKL";
+#elif defined(OPENFACE_BLAS_BLIS)
+	return "BLIS";
+#elif defined(OPENFACE_BLAS_ACCELERATE)
+	return "Accelerate";
+#else
+	return "OpenBLAS";
+#endif
+}
+
+//===========================================================================
+void PackedMatrix::Pack(const cv::Mat_<float>& matrix, bool transpose)
+{
+	rows = transpose ? matrix.cols : matrix.rows;
+	cols = transpose ? matrix.rows : matrix.cols;
+
+	// A cache line of slack, so that the panels can start on a cache line
+	const size_t line_floats = 64 / sizeof(float);
+	const size_t size = (size_t)NumPanels() * rows * GEMM_PANEL_WIDTH;
+	storage = cv::Mat_<float>(1, (int)(size + line_floats), 0.0f);
+	offset = ((64 - (size_t)storage.data % 64) % 64) / sizeof(float);
+
+	float* panels = (float*)storage.data + offset;
+	for (int p = 0; p < NumPanels(); ++p)
+	{
+		float* panel = panels + (size_t)p * rows * GEMM_PANEL_WIDTH;
+		const int panel_cols = std::min(GEMM_PANEL_WIDTH, cols - p * GEMM_PANEL_WIDTH);
+		for (int r = 0; r < rows; ++r)
+		{
+			for (int c = 0; c < panel_cols; ++c)
+			{
+				const int col = p * GEMM_PANEL_WIDTH + c;
+				panel[(size_t)r * GEMM_PANEL_WIDTH + c] = transpose ? matrix(col, r) : matrix(r, col);
+			}
+		}
+	}
+}
+
+void PackedMatrix::Unpack(cv::Mat_<float>& matrix, bool transpose) const
+{
+	matrix.create(transpose ? cols : rows, transpose ? rows : cols);
+
+	const float* panels = Panels();
+	for (int p = 0; p < NumPanels(); ++p)
+	{
+		const float* panel = panels + (size_t)p * rows * GEMM_PANEL_WIDTH;
+		const int panel_cols = std::min(GEMM_PANEL_WIDTH, cols - p * GEMM_PANEL_WIDTH);
+		for (int r = 0; r < rows; ++r)
+		{
+			for (int c = 0; c < panel_cols; ++c)
+			{
+				const int col = p * GEMM_PANEL_WIDTH + c;
+				(transpose ? matrix(col, r) : matrix(r, col)) = panel[(size_t)r * GEMM_PANEL_WIDTH + c];
+			}
+		}
+	}
+}
+
+void LandmarkDetector::GemmPacked(const float* X, int num_rows, int ldx, const PackedMatrix& B, const float* bias, int activation, float* out, int ldo)
+{
+	const int k = B.Rows();
+	const int n = B.Cols();
+	const float* panels = B.Panels();
+
+	// The AVX2 or AVX-512 variant first if the CPU has it (it works on blocks of rows), the remaining rows are then finished here
+	int r = Kernels::GemmPackedRows(X, 0, num_rows, ldx, panels, k, n, bias, activation, out, ldo);
+
+	float acc[GEMM_PANEL_WIDTH];
+	for (; r < num_rows; ++r)
+	{
+		const float* x = X + (size_t)r * ldx;
+		float* o = out + (size_t)r * ldo;
+
+		for (int p = 0; p < B.NumPanels(); ++p)
+		{
+			const float* w = panels + (size_t)p * k * GEMM_PANEL_WIDTH;
+			for (int c = 0; c < GEMM_PANEL_WIDTH; ++c)
+				acc[c] = 0.0f;
+
+			// Every row of the panel scaled by the element of x, the innermost loop is vectorised by the compiler
+			for (int i = 0; i < k; ++i, w += GEMM_PANEL_WIDTH)
+			{
+				const float x_i = x[i];
+				for (int c = 0; c < GEMM_PANEL_WIDTH; ++c)
+					acc[c] += x_i * w[c];
+			}
+
+			const int first_col = p * GEMM_PANEL_WIDTH;
+			const int panel_cols = std::min(GEMM_PANEL_WIDTH, n - first_col);
+			for (int c = 0; c < panel_cols; ++c)
+			{
+				float val = acc[c] + (bias ? bias[first_col + c] : 0.0f);
+				if (activation == 0)
+				{
+					val = -val;
+				}
+				else if (activation == 2)
+				{
+					val = val > 0 ? val : 0;
+				}
+				o[first_col + c] = val;
+			}
+		}
+	}
+}
@@ -0,0 +1,212 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+
+#include "ImageContext.h"
+
+// OpenCV includes
+#include <opencv2/imgproc.hpp>
+
+// System includes
+#include <algorithm>
+
+using namespace LandmarkDetector;
+
+ImageContext::ImageContext(const cv::Mat_<uchar>& image) : image(image), colour_pyramid(MAX_PYRAMID_LEVELS), gray_pyramid(MAX_PYRAMID_LEVELS)
+{
+	image_float.create(image.rows, image.cols);
+	converted_blocks = cv::Mat_<uchar>((image.rows + BLOCK_SIZE - 1) / BLOCK_SIZE, (image.cols + BLOCK_SIZE - 1) / BLOCK_SIZE, (uchar)0);
+}
+
+ImageContext::ImageContext(const cv::Mat_<float>& image_float) : image_float(image_float), colour_pyramid(MAX_PYRAMID_LEVELS), gray_pyramid(MAX_PYRAMID_LEVELS)
+{
+	converted_blocks = cv::Mat_<uchar>((image_float.rows + BLOCK_SIZE - 1) / BLOCK_SIZE, (image_float.cols + BLOCK_SIZE - 1) / BLOCK_SIZE, (uchar)1);
+}
+
+ImageContext::ImageContext(const cv::Mat& colour_image, const cv::Mat_<uchar>& image) : image(image), colour_pyramid(MAX_PYRAMID_LEVELS), gray_pyramid(MAX_PYRAMID_LEVELS)
+{
+	image_float.create(image.rows, image.cols);
+	converted_blocks = cv::Mat_<uchar>((image.rows + BLOCK_SIZE - 1) / BLOCK_SIZE, (image.cols + BLOCK_SIZE - 1) / BLOCK_SIZE, (uchar)0);
+
+	if (colour_image.channels() == 3)
+	{
+		colour_pyramid[0] = colour_image;
+	}
+	else if (!colour_image.empty())
+	{
+		cv::cvtColor(colour_image, colour_pyramid[0], cv::COLOR_GRAY2BGR);
+	}
+}
+
+const cv::Mat& ImageContext::Colour()
+{
+	std::lock_guard<std::mutex> lock(pyramid_mutex);
+
+	// Only the greyscale frame was given
+	if (colour_pyramid[0].empty() && !image.empty())
+	{
+		cv::cvtColor(image, colour_pyramid[0], cv::COLOR_GRAY2BGR);
+	}
+	return colour_pyramid[0];
+}
+
+cv::Mat ImageContext::ColourResized(const cv::Size& size)
+{
+	const cv::Mat& colour = Colour();
+
+	if (colour.empty() || size == colour.size())
+	{
+		return colour;
+	}
+
+	// Finding (and building if needed) the smallest halving still at least the requested size, the levels once built are not changed, so they
+	// can be read outside of the lock
+	const cv::Mat* source = &colour;
+	{
+		std::lock_guard<std::mutex> lock(pyramid_mutex);
+		for (int level = 1; level < MAX_PYRAMID_LEVELS; ++level)
+		{
+			const cv::Mat& prev = colour_pyramid[level - 1];
+			if ((prev.cols + 1) / 2 < size.width || (prev.rows + 1) / 2 < size.height)
+			{
+				break;
+			}
+			if (colour_pyramid[level].empty())
+			{
+				cv::pyrDown(prev, colour_pyramid[level]);
+			}
+			source = &colour_pyramid[level];
+		}
+	}
+
+	cv::Mat resized;
+	cv::resize(*source, resized, size);
+	return resized;
+}
+
+cv::UMat ImageContext::GrayHalved(int level)
+{
+	// Only the colour frame was given, Colour() takes the lock itself so it is read before
+	cv::Mat colour;
+	if (image.empty())
+	{
+		colour = Colour();
+	}
+
+	std::lock_guard<std::mutex> lock(pyramid_mutex);
+	if (gray_pyramid[0].empty())
+	{
+		if (!image.empty())
+		{
+			image.copyTo(gray_pyramid[0]);
+		}
+		else if (!colour.empty())
+		{
+			cv::cvtColor(colour, gray_pyramid[0], cv::COLOR_BGR2GRAY);
+		}
+		else
+		{
+			return cv::UMat();
+		}
+	}
+
+	level = std::min(std::max(level, 0), MAX_PYRAMID_LEVELS - 1);
+	for (int l = 1; l <= level; ++l)
+	{
+		const cv::UMat& prev = gray_pyramid[l - 1];
+		if (prev.cols < 2 || prev.rows < 2)
+		{
+			return prev;
+		}
+		if (gray_pyramid[l].empty())
+		{
+			cv::pyrDown(prev, gray_pyramid[l]);
+		}
+	}
+	return gray_pyramid[level];
+}
+
+const cv::Mat_<float>& ImageContext::Float(const cv::Rect& region)
+{
+	cv::Rect image_rect(0, 0, image_float.cols, image_float.rows);
+	cv::Rect roi = region & image_rect;
+
+	if (roi.area() == 0)
+	{
+		return image_float;
+	}
+
+	int block_x_min = roi.x / BLOCK_SIZE;
+	int block_x_max = (roi.x + roi.width - 1) / BLOCK_SIZE;
+	int block_y_min = roi.y / BLOCK_SIZE;
+	int block_y_max = (roi.y + roi.height - 1) / BLOCK_SIZE;
+
+	// The blocks converted before are never written to again, so they can be read by the other users while new blocks are converted
+	std::lock_guard<std::mutex> lock(conversion_mutex);
+
+	for (int by = block_y_min; by <= block_y_max; ++by)
+	{
+		uchar* converted = converted_blocks.ptr<uchar>(by);
+
+		int bx = block_x_min;
+		while (bx <= block_x_max)
+		{
+			if (converted[bx])
+			{
+				bx++;
+				continue;
+			}
+
+			// Convert a run of neighbouring blocks at once
+			int run_end = bx;
+			while (run_end + 1 <= block_x_max && !converted[run_end + 1])
+			{
+				run_end++;
+			}
+
+			cv::Rect block = cv::Rect(bx * BLOCK_SIZE, by * BLOCK_SIZE, (run_end - bx + 1) * BLOCK_SIZE, BLOCK_SIZE) & image_rect;
+			cv::Mat_<float> block_float = image_float(block);
+			image(block).convertTo(block_float, CV_32F);
+
+			for (int b = bx; b <= run_end; ++b)
+			{
+				converted[b] = 1;
+			}
+			bx = run_end + 1;
+		}
+	}
+
+	return image_float;
+}
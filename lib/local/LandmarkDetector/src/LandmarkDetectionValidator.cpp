@@ -45,6 +45,7 @@
 
 // System includes
 #include <fstream>
+#include <map>
 
 // Math includes
 #define _USE_MATH_DEFINES
@@ -55,77 +56,26 @@
 #endif
 // Local includes
 #include "LandmarkDetectorUtils.h"
+#include "LandmarkShape.h"
 #include "CNN_utils.h"
 
+#include <MemoryReport.h>
+
 using namespace LandmarkDetector;
 
-// Copy constructor
+// Copy constructor, the CNN weights and normalisation terms are read only so are shared between the copies (cv::Mat is reference counted)
 DetectionValidator::DetectionValidator(const DetectionValidator& other) : orientations(other.orientations), paws(other.paws),
-cnn_subsampling_layers(other.cnn_subsampling_layers), cnn_layer_types(other.cnn_layer_types), cnn_convolutional_layers_im2col_precomp(other.cnn_convolutional_layers_im2col_precomp),
-cnn_convolutional_layers_weights(other.cnn_convolutional_layers_weights)
+cnn_subsampling_layers(other.cnn_subsampling_layers), cnn_layer_types(other.cnn_layer_types), cnn_convolutional_layers(other.cnn_convolutional_layers),
+cnn_convolutional_layers_weights(other.cnn_convolutional_layers_weights), cnn_fully_connected_layers_weights(other.cnn_fully_connected_layers_weights),
+cnn_fully_connected_layers_biases(other.cnn_fully_connected_layers_biases), mean_images(other.mean_images), standard_deviations(other.standard_deviations),
+onnx_sessions(other.onnx_sessions)
 {
-
-	this->cnn_convolutional_layers.resize(other.cnn_convolutional_layers.size());
-	for (size_t v = 0; v < other.cnn_convolutional_layers.size(); ++v)
-	{
-		this->cnn_convolutional_layers[v].resize(other.cnn_convolutional_layers[v].size());
-
-		for (size_t l = 0; l < other.cnn_convolutional_layers[v].size(); ++l)
-		{
-			this->cnn_convolutional_layers[v][l].resize(other.cnn_convolutional_layers[v][l].size());
-
-			for (size_t i = 0; i < other.cnn_convolutional_layers[v][l].size(); ++i)
-			{
-				this->cnn_convolutional_layers[v][l][i].resize(other.cnn_convolutional_layers[v][l][i].size());
-
-				for (size_t k = 0; k < other.cnn_convolutional_layers[v][l][i].size(); ++k)
-				{
-					// Make sure the matrix is copied.
-					this->cnn_convolutional_layers[v][l][i][k] = other.cnn_convolutional_layers[v][l][i][k].clone();
-				}
-
-			}
-		}
-	}
-
-	this->cnn_fully_connected_layers_weights.resize(other.cnn_fully_connected_layers_weights.size());
-	for (size_t v = 0; v < other.cnn_fully_connected_layers_weights.size(); ++v)
-	{
-		this->cnn_fully_connected_layers_weights[v].resize(other.cnn_fully_connected_layers_weights[v].size());
-
-		for (size_t l = 0; l < other.cnn_fully_connected_layers_weights[v].size(); ++l)
-		{
-			// Make sure the matrix is copied.
-			this->cnn_fully_connected_layers_weights[v][l] = other.cnn_fully_connected_layers_weights[v][l].clone();
-		}
-	}
-
-	this->cnn_fully_connected_layers_biases.resize(other.cnn_fully_connected_layers_biases.size());
-	for (size_t v = 0; v < other.cnn_fully_connected_layers_biases.size(); ++v)
+	// The im2col buffers are scratch space, do not share them between copies so that the copies can be used concurrently
+	this->cnn_convolutional_layers_im2col_precomp.resize(other.cnn_convolutional_layers_im2col_precomp.size());
+	for (size_t v = 0; v < other.cnn_convolutional_layers_im2col_precomp.size(); ++v)
 	{
-		this->cnn_fully_connected_layers_biases[v].resize(other.cnn_fully_connected_layers_biases[v].size());
-
-		for (size_t l = 0; l < other.cnn_fully_connected_layers_biases[v].size(); ++l)
-		{
-			// Make sure the matrix is copied.
-			this->cnn_fully_connected_layers_biases[v][l] = other.cnn_fully_connected_layers_biases[v][l].clone();
-		}
+		this->cnn_convolutional_layers_im2col_precomp[v].resize(other.cnn_convolutional_layers_im2col_precomp[v].size());
 	}
-
-	this->mean_images.resize(other.mean_images.size());
-	for (size_t i = 0; i < other.mean_images.size(); ++i)
-	{
-		// Make sure the matrix is copied.
-		this->mean_images[i] = other.mean_images[i].clone();
-	}
-
-	this->standard_deviations.resize(other.standard_deviations.size());
-	for (size_t i = 0; i < other.standard_deviations.size(); ++i)
-	{
-		// Make sure the matrix is copied.
-		this->standard_deviations[i] = other.standard_deviations[i].clone();
-	}
-
 }
 
 //===========================================================================
@@ -174,6 +124,12 @@ void DetectionValidator::Read(string location)
 		cnn_layer_types.resize(n);
 		cnn_fully_connected_layers_biases.resize(n);
 
+		onnx_sessions.resize(n);
+		for (int i = 0; i < n; ++i)
+		{
+			onnx_sessions[i].reset(new LazyOnnxSession());
+		}
+
 		// Initialise the normalisation terms
 		mean_images.resize(n);
 		standard_deviations.resize(n);
@@ -285,7 +241,10 @@ void DetectionValidator::Read(string location)
 						}
 						weight_matrix.copyTo(W(cv::Rect(0, 0, weight_matrix.cols, weight_matrix.rows)));
 
-						cnn_convolutional_layers_weights[i].push_back(W.t());
+						// Packed once here rather than by the BLAS library on every product
+						PackedMatrix W_packed;
+						W_packed.Pack(W, true);
+						cnn_convolutional_layers_weights[i].push_back(W_packed);
 						cnn_convolutional_layers_im2col_precomp[i].push_back(cv::Mat_<float>());
 					}
 					else if (layer_type == 2)
@@ -316,14 +275,59 @@ void DetectionValidator::Read(string location)
 // Check if the fitting actually succeeded
 float DetectionValidator::Check(const cv::Vec3d& orientation, const cv::Mat_<uchar>& intensity_img, cv::Mat_<float>& detected_landmarks)
 {
+	vector<float> certainties;
+	CheckBatch(vector<cv::Vec3d>(1, orientation), intensity_img, vector<cv::Mat_<float> >(1, detected_landmarks), certainties);
+	return certainties[0];
+}
 
-	int id = GetViewId(orientation);
-	
+// Checking a number of detections in the same image, the detections falling into the same view are passed through the CNN together
+void DetectionValidator::CheckBatch(const vector<cv::Vec3d>& orientations, const cv::Mat_<uchar>& intensity_img, const vector<cv::Mat_<float> >& detected_landmarks, vector<float>& certainties)
+{
+	certainties.assign(detected_landmarks.size(), 0.0f);
+
+	// Warp every detection to the reference shape of its view
+	vector<cv::Mat_<float> > cnn_inputs(detected_landmarks.size());
+	map<int, vector<int> > view_groups;
+	for (size_t i = 0; i < detected_landmarks.size(); ++i)
+	{
+		int id = GetViewId(orientations[i]);
+
+		// A detection without a valid ROI is reported as a failure
+		if (WarpToReference(intensity_img, detected_landmarks[i], id, cnn_inputs[i]))
+		{
+			view_groups[id].push_back((int)i);
+		}
+	}
+
+	for (map<int, vector<int> >::const_iterator group = view_groups.begin(); group != view_groups.end(); ++group)
+	{
+		vector<cv::Mat_<float> > group_inputs;
+		for (size_t k = 0; k < group->second.size(); ++k)
+		{
+			group_inputs.push_back(cnn_inputs[group->second[k]]);
+		}
+
+		// The actual validation step
+		vector<double> decisions;
+		CheckCNN(group_inputs, group->first, decisions);
+
+		// Convert it to a more interpretable signal (0 low confidence, 1 high confidence)
+		for (size_t k = 0; k < group->second.size(); ++k)
+		{
+			certainties[group->second[k]] = (float)(0.5 * (1.0 - decisions[k]));
+		}
+	}
+}
+
+// Cropping the face, warping it to the reference shape and normalising it to the input of the CNN, returns false if there is no face ROI
+bool DetectionValidator::WarpToReference(const cv::Mat_<uchar>& intensity_img, const cv::Mat_<float>& detected_landmarks, int view_id, cv::Mat_<float>& cnn_input)
+{
 	// The warped (cropped) image, corresponding to a face lying withing the detected lanmarks
 	cv::Mat_<float> warped;
 	
-	// First only use the ROI of the image of interest
-	cv::Mat_<float> detected_landmarks_local = detected_landmarks.clone();
+	// First only use the ROI of the image of interest, the landmarks are moved into it on a fixed size copy (if they fit in one)
+	LandmarkShape2D local_landmarks;
+	cv::Mat_<float> detected_landmarks_local = local_landmarks.Set(detected_landmarks) ? local_landmarks.Column() : detected_landmarks.clone();
 
 	float min_x_f, max_x_f, min_y_f, max_y_f;
 	ExtractBoundingBox(detected_landmarks_local, min_x_f, max_x_f, min_y_f, max_y_f);
@@ -347,32 +351,20 @@ float DetectionValidator::Check(const cv::Vec3d& orientation, const cv::Mat_<uch
 	// If the ROI is non existent return failure (this could happen if all landmarks are outside of the image)
 	if (max_x - min_x <= 1 || max_y - min_y <= 1)
 	{
-		return 0.0f;
+		return false;
 	}
 
 	cv::Mat_<float> intensity_img_float_local;
 	intensity_img(cv::Rect(min_x, min_y, max_x - min_x, max_y - min_y)).convertTo(intensity_img_float_local, CV_32F);
 
 	// the piece-wise affine image warping
-	paws[id].Warp(intensity_img_float_local, warped, detected_landmarks_local);
-
-	// The actual validation step
-	double dec = CheckCNN(warped, id);
-
-	// Convert it to a more interpretable signal (0 low confidence, 1 high confidence)
-	dec = 0.5 * (1.0 - dec);
-
-	return (float)dec;
-}
-
-double DetectionValidator::CheckCNN(const cv::Mat_<float>& warped_img, int view_id)
-{
+	paws[view_id].Warp(intensity_img_float_local, warped, detected_landmarks_local);
 
 	cv::Mat_<float> feature_vec;
-	NormaliseWarpedToVector(warped_img, feature_vec, view_id);
+	NormaliseWarpedToVector(warped, feature_vec, view_id);
 
 	// Create a normalised image from the crop vector
-	cv::Mat_<float> img(warped_img.size(), 0.0);
+	cv::Mat_<float> img(warped.size(), 0.0);
 	img = img.t();
 
 	cv::Mat mask = paws[view_id].pixel_mask.t();
@@ -396,17 +388,55 @@ double DetectionValidator::CheckCNN(const cv::Mat_<float>& warped_img, int view_
 			}
 		}
 	}
-	img = img.t();
+	cnn_input = img.t();
+
+	return true;
+}
+
+// The CNN applied to a batch of warped faces of the same view, the convolutions and fully connected layers of the whole batch are
+// done through single matrix multiplications
+void DetectionValidator::CheckCNN(const vector<cv::Mat_<float> >& cnn_inputs, int view_id, vector<double>& decisions)
+{
+	int batch_size = (int)cnn_inputs.size();
 
 	int cnn_layer = 0;
 	int fully_connected_layer = 0;
 
-	vector<cv::Mat_<float> > input_maps;
-	input_maps.push_back(img);
+	// Layed out as input image -> maps
+	vector<vector<cv::Mat_<float> > > input_maps(batch_size);
+	for (int b = 0; b < batch_size; ++b)
+	{
+		input_maps[b].push_back(cnn_inputs[b]);
+	}
+
+	vector<vector<cv::Mat_<float> > > outputs(batch_size);
 
-	vector<cv::Mat_<float> > outputs;
+	// Through ONNX Runtime the whole network is one call, the CPU layers are skipped if it succeeds
+	bool onnx_done = false;
+	if (GetCNNBackend() == ONNXRUNTIME_BACKEND && batch_size > 0 && (size_t)view_id < onnx_sessions.size())
+	{
+		std::shared_ptr<OnnxSession> session = onnx_sessions[view_id]->Get([this, view_id](OnnxGraph& graph) { return ExportONNX(view_id, graph); });
+		if (session)
+		{
+			int height = cnn_inputs[0].rows;
+			int width = cnn_inputs[0].cols;
+			vector<float> input(batch_size * height * width);
+			for (int b = 0; b < batch_size; ++b)
+			{
+				cnn_inputs[b].copyTo(cv::Mat_<float>(height, width, input.data() + b * height * width));
+			}
 
-	for (size_t layer = 0; layer < cnn_layer_types[view_id].size(); ++layer)
+			vector<float> output;
+			vector<int64_t> output_shape;
+			if (session->Run(input.data(), { batch_size, 1, height, width }, output, output_shape))
+			{
+				FromOnnxOutput(output, output_shape, outputs);
+				onnx_done = true;
+			}
+		}
+	}
+
+	for (size_t layer = 0; layer < cnn_layer_types[view_id].size() && !onnx_done; ++layer)
 	{
 		// Determine layer type
 		int layer_type = cnn_layer_types[view_id][layer];
@@ -414,43 +444,48 @@ double DetectionValidator::CheckCNN(const cv::Mat_<float>& warped_img, int view_
 		// Convolutional layer
 		if (layer_type == 0)
 		{
-
-			convolution_direct_blas(outputs, input_maps, cnn_convolutional_layers_weights[view_id][cnn_layer], cnn_convolutional_layers[view_id][cnn_layer][0][0].rows, cnn_convolutional_layers[view_id][cnn_layer][0][0].cols, cnn_convolutional_layers_im2col_precomp[view_id][cnn_layer]);
+			convolution_direct_blas_batch(outputs, input_maps, cnn_convolutional_layers_weights[view_id][cnn_layer], cnn_convolutional_layers[view_id][cnn_layer][0][0].rows, cnn_convolutional_layers[view_id][cnn_layer][0][0].cols, cnn_convolutional_layers_im2col_precomp[view_id][cnn_layer]);
 
 			cnn_layer++;
 		}
 		if (layer_type == 1)
 		{
-			max_pooling(outputs, input_maps, 2, 2, 2, 2);
+			for (int b = 0; b < batch_size; ++b)
+			{
+				max_pooling(outputs[b], input_maps[b], 2, 2, 2, 2);
+			}
 		}
 		if (layer_type == 2)
 		{
-
-			fully_connected(outputs, input_maps, cnn_fully_connected_layers_weights[view_id][fully_connected_layer].t(), cnn_fully_connected_layers_biases[view_id][fully_connected_layer]);
+			fully_connected_batch(outputs, input_maps, cnn_fully_connected_layers_weights[view_id][fully_connected_layer].t(), cnn_fully_connected_layers_biases[view_id][fully_connected_layer]);
 			fully_connected_layer++;
 		}
 		if (layer_type == 3) // ReLU
 		{
-			outputs.clear();
-			for (size_t k = 0; k < input_maps.size(); ++k)
+			for (int b = 0; b < batch_size; ++b)
 			{
-				// Apply the ReLU
-				cv::threshold(input_maps[k], input_maps[k], 0, 0, cv::THRESH_TOZERO);
-				outputs.push_back(input_maps[k]);
-
+				outputs[b].clear();
+				for (size_t k = 0; k < input_maps[b].size(); ++k)
+				{
+					// Apply the ReLU
+					cv::threshold(input_maps[b][k], input_maps[b][k], 0, 0, cv::THRESH_TOZERO);
+					outputs[b].push_back(input_maps[b][k]);
+				}
 			}
 		}
 		if (layer_type == 4)
 		{
-			outputs.clear();
-			for (size_t k = 0; k < input_maps.size(); ++k)
+			for (int b = 0; b < batch_size; ++b)
 			{
-				// Apply the sigmoid
-				cv::exp(-input_maps[k], input_maps[k]);
-				input_maps[k] = 1.0 / (1.0 + input_maps[k]);
-
-				outputs.push_back(input_maps[k]);
+				outputs[b].clear();
+				for (size_t k = 0; k < input_maps[b].size(); ++k)
+				{
+					// Apply the sigmoid
+					cv::exp(-input_maps[b][k], input_maps[b][k]);
+					input_maps[b][k] = 1.0 / (1.0 + input_maps[b][k]);
 
+					outputs[b].push_back(input_maps[b][k]);
+				}
 			}
 		}
 		// Set the outputs of this layer to inputs of the next
@@ -458,19 +493,109 @@ double DetectionValidator::CheckCNN(const cv::Mat_<float>& warped_img, int view_
 
 	}
 
-	// Convert the class label to a continuous value
-	double max_val = 0;
-	cv::Point max_loc;
-	cv::minMaxLoc(outputs[0].t(), 0, &max_val, 0, &max_loc);
-	int max_idx = max_loc.y;
-	double max = 1;
-	double min = -1;
-	double bins = (double)outputs[0].cols;
-	// Unquantizing the softmax layer to continuous value
-	double step_size = (max - min) / bins; // This should be saved somewhere
-	double unquantized = min + step_size / 2.0 + max_idx * step_size;
-
-	return unquantized;
+	decisions.resize(batch_size);
+	for (int b = 0; b < batch_size; ++b)
+	{
+		// Convert the class label to a continuous value
+		double max_val = 0;
+		cv::Point max_loc;
+		cv::minMaxLoc(outputs[b][0].t(), 0, &max_val, 0, &max_loc);
+		int max_idx = max_loc.y;
+		double max = 1;
+		double min = -1;
+		double bins = (double)outputs[b][0].cols;
+		// Unquantizing the softmax layer to continuous value
+		double step_size = (max - min) / bins; // This should be saved somewhere
+		decisions[b] = min + step_size / 2.0 + max_idx * step_size;
+	}
+}
+
+void DetectionValidator::ReportMemory(Utilities::MemoryReport& report, const string& component) const
+{
+	for (size_t view = 0; view < orientations.size(); ++view)
+	{
+		string view_component = component + "/view_" + to_string(view);
+		if (view < cnn_convolutional_layers.size())
+		{
+			report.Add(view_component + "/cnn", cnn_convolutional_layers[view]);
+			for (size_t layer = 0; layer < cnn_convolutional_layers_weights[view].size(); ++layer)
+			{
+				report.Add(view_component + "/cnn", cnn_convolutional_layers_weights[view][layer].Storage());
+			}
+			report.Add(view_component + "/cnn", cnn_fully_connected_layers_weights[view]);
+			report.Add(view_component + "/cnn", cnn_fully_connected_layers_biases[view]);
+			report.Add(view_component + "/im2col", cnn_convolutional_layers_im2col_precomp[view]);
+		}
+		if (view < mean_images.size())
+		{
+			report.Add(view_component + "/normalisation", mean_images[view]);
+			report.Add(view_component + "/normalisation", standard_deviations[view]);
+		}
+		if (view < paws.size())
+		{
+			const PAW& paw = paws[view];
+			report.Add(view_component + "/paw", paw.destination_landmarks);
+			report.Add(view_component + "/paw", paw.source_landmarks);
+			report.Add(view_component + "/paw", paw.triangulation);
+			report.Add(view_component + "/paw", paw.triangle_id);
+			report.Add(view_component + "/paw", paw.pixel_mask);
+			report.Add(view_component + "/paw", paw.triangle_spans);
+			report.Add(view_component + "/paw", paw.coefficients);
+			report.Add(view_component + "/paw", paw.alpha);
+			report.Add(view_component + "/paw", paw.beta);
+			report.Add(view_component + "/paw", paw.map_x);
+			report.Add(view_component + "/paw", paw.map_y);
+		}
+	}
+}
+
+bool DetectionValidator::ExportONNX(int view_id, OnnxGraph& graph) const
+{
+	int cnn_layer = 0;
+	int fully_connected_layer = 0;
+
+	graph.AddInput("input", { -1, 1, -1, -1 });
+	OnnxTensor tensor = { "input", ONNX_MAPS, 1 };
+
+	for (size_t layer = 0; layer < cnn_layer_types[view_id].size(); ++layer)
+	{
+		bool exported = true;
+
+		int layer_type = cnn_layer_types[view_id][layer];
+		if (layer_type == 0)
+		{
+			cv::Mat_<float> weight_matrix;
+			cnn_convolutional_layers_weights[view_id][cnn_layer].Unpack(weight_matrix);
+			exported = OnnxConvolution(graph, tensor, weight_matrix, cnn_convolutional_layers[view_id][cnn_layer][0][0].rows, cnn_convolutional_layers[view_id][cnn_layer][0][0].cols);
+			cnn_layer++;
+		}
+		if (layer_type == 1)
+		{
+			exported = OnnxMaxPooling(graph, tensor, 2, 2, 2, 2);
+		}
+		if (layer_type == 2)
+		{
+			// The weights are stored transposed
+			exported = OnnxFullyConnected(graph, tensor, cnn_fully_connected_layers_weights[view_id][fully_connected_layer].t(), cnn_fully_connected_layers_biases[view_id][fully_connected_layer]);
+			fully_connected_layer++;
+		}
+		if (layer_type == 3)
+		{
+			OnnxReLU(graph, tensor);
+		}
+		if (layer_type == 4)
+		{
+			OnnxSigmoid(graph, tensor);
+		}
+
+		if (!exported)
+		{
+			return false;
+		}
+	}
+
+	OnnxOutput(graph, tensor, "output");
+	return true;
 }
 
 void DetectionValidator::NormaliseWarpedToVector(const cv::Mat_<float>& warped_img, cv::Mat_<float>& feature_vec, int view_id)
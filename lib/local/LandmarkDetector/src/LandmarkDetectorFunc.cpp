@@ -37,58 +37,167 @@
 #include "LandmarkDetectorFunc.h"
 #include "RotationHelpers.h"
 #include "ImageManipulationHelpers.h"
+#include "Tracing.h"
+#include "Metrics.h"
 
 // OpenCV includes
 #include <opencv2/core/core.hpp>
 #include <opencv2/calib3d.hpp>
 #include <opencv2/imgproc.hpp>
+#include <opencv2/video/tracking.hpp>
 
 // System includes
+#include <algorithm>
 #include <vector>
 #include <numeric>
+#include <atomic>
+#include <limits>
+
+#include <tbb/tbb.h>
 
 using namespace LandmarkDetector;
 
-// Getting a head pose estimate from the currently detected landmarks, with appropriate correction due to the PDM assuming an orthographic camera
-// which is only correct close to the centre of the image
-// This method returns a corrected pose estimate with respect to world coordinates with camera at origin (0,0,0)
-// The format returned is [Tx, Ty, Tz, Eul_x, Eul_y, Eul_z]
-cv::Vec6f LandmarkDetector::GetPose(const CLNF& clnf_model, float fx, float fy, float cx, float cy)
+// The pose refinement stops once the update is this small (in radians and millimetres) or after the maximum number of iterations
+static const float POSE_CONVERGENCE_THRESHOLD = 1e-5f;
+static const int POSE_MAX_ITERATIONS = 20;
+
+// Fitting the camera space pose (rotation and translation) of the shape to the detected landmarks under the perspective camera. The weak
+// perspective CLNF parameters give the starting point in closed form, which is refined with Gauss-Newton iterations on the reprojection error
+// (the same minimum the iterative cv::solvePnP converges to). The 6x6 normal equations are accumulated directly from the landmarks, so apart
+// from the 3D shape (kept per thread) nothing is allocated. Falls back to cv::solvePnP if the refinement does not converge
+static void SolvePose(const CLNF& clnf_model, float fx, float fy, float cx, float cy, cv::Matx33f& rotation, cv::Vec3f& translation)
 {
-	if (!clnf_model.detected_landmarks.empty() && clnf_model.params_global[0] != 0)
+	const cv::Vec6f& params_global = clnf_model.params_global;
+
+	// The weak perspective scale gives the depth, the translation in the image the rest of it
+	float Z = fx / params_global[0];
+	float X = ((params_global[4] - cx) * (1.0 / fx)) * Z;
+	float Y = ((params_global[5] - cy) * (1.0 / fy)) * Z;
+
+	rotation = Utilities::Euler2RotationMatrix(cv::Vec3f(params_global[1], params_global[2], params_global[3]));
+	translation = cv::Vec3f(X, Y, Z);
+
+	static thread_local cv::Mat_<float> shape_3D;
+	clnf_model.pdm.CalcShape3D(shape_3D, clnf_model.params_local);
+
+	const cv::Mat_<float>& landmarks_2D = clnf_model.detected_landmarks;
+	int n = clnf_model.pdm.NumberOfPoints();
+
+	bool converged = false;
+	float previous_error = std::numeric_limits<float>::max();
+	cv::Matx33f previous_rotation = rotation;
+	cv::Vec3f previous_translation = translation;
+
+	for (int iter = 0; iter < POSE_MAX_ITERATIONS; ++iter)
 	{
-		// This is used as an initial estimate for the iterative PnP algorithm
-		float Z = fx / clnf_model.params_global[0];
+		cv::Matx<float, 6, 6> JtJ = cv::Matx<float, 6, 6>::zeros();
+		cv::Matx<float, 6, 1> Jtr = cv::Matx<float, 6, 1>::zeros();
+		float error = 0;
+		bool in_front = true;
+
+		for (int i = 0; i < n; ++i)
+		{
+			cv::Vec3f rotated = rotation * cv::Vec3f(shape_3D.at<float>(i), shape_3D.at<float>(i + n), shape_3D.at<float>(i + 2 * n));
+			cv::Vec3f point = rotated + translation;
+			if (point[2] <= 0)
+			{
+				in_front = false;
+				break;
+			}
 
-		float X = ((clnf_model.params_global[4] - cx) * (1.0 / fx)) * Z;
-		float Y = ((clnf_model.params_global[5] - cy) * (1.0 / fy)) * Z;
+			float inv_z = 1.0f / point[2];
+			float res_u = fx * point[0] * inv_z + cx - landmarks_2D.at<float>(i);
+			float res_v = fy * point[1] * inv_z + cy - landmarks_2D.at<float>(i + n);
+			error += res_u * res_u + res_v * res_v;
 
-		// Correction for orientation
+			// The derivatives of the projection with respect to the camera space point, the rotation is updated as exp([w]x) * R so the
+			// derivative with respect to w is the cross product of the rotated point with them
+			cv::Vec3f du(fx * inv_z, 0, -fx * point[0] * inv_z * inv_z);
+			cv::Vec3f dv(0, fy * inv_z, -fy * point[1] * inv_z * inv_z);
+			cv::Vec3f du_rot = rotated.cross(du);
+			cv::Vec3f dv_rot = rotated.cross(dv);
 
-		// 2D points
-		cv::Mat_<float> landmarks_2D = clnf_model.detected_landmarks;
+			cv::Matx<float, 6, 1> J_u(du_rot[0], du_rot[1], du_rot[2], du[0], du[1], du[2]);
+			cv::Matx<float, 6, 1> J_v(dv_rot[0], dv_rot[1], dv_rot[2], dv[0], dv[1], dv[2]);
 
-		landmarks_2D = landmarks_2D.reshape(1, 2).t();
+			JtJ += J_u * J_u.t() + J_v * J_v.t();
+			Jtr += J_u * res_u + J_v * res_v;
+		}
 
-		// 3D points
-		cv::Mat_<float> landmarks_3D;
-		clnf_model.pdm.CalcShape3D(landmarks_3D, clnf_model.params_local);
-		
-		landmarks_3D = landmarks_3D.reshape(1, 3).t();
+		// A step that made things worse is undone, and the estimate before it kept
+		if (!in_front || error > previous_error)
+		{
+			rotation = previous_rotation;
+			translation = previous_translation;
+			converged = previous_error < std::numeric_limits<float>::max();
+			break;
+		}
+
+		previous_error = error;
+		previous_rotation = rotation;
+		previous_translation = translation;
 
-		// Solving the PNP model
+		cv::Matx<float, 6, 1> delta;
+		if (!cv::solve(JtJ, -Jtr, delta, cv::DECOMP_CHOLESKY))
+		{
+			break;
+		}
+
+		rotation = Utilities::AxisAngle2RotationMatrix(cv::Vec3f(delta(0), delta(1), delta(2))) * rotation;
+		translation += cv::Vec3f(delta(3), delta(4), delta(5));
+
+		if (cv::norm(delta) < POSE_CONVERGENCE_THRESHOLD)
+		{
+			converged = true;
+			break;
+		}
+	}
+
+	if (!converged)
+	{
+		// 2D and 3D points
+		cv::Mat_<float> landmarks_2D_pnp = landmarks_2D.reshape(1, 2).t();
+		cv::Mat_<float> landmarks_3D = shape_3D.reshape(1, 3).t();
 
 		// The camera matrix
 		cv::Matx33f camera_matrix(fx, 0, cx, 0, fy, cy, 0, 0, 1);
 
 		cv::Vec3f vec_trans(X, Y, Z);
-		cv::Vec3f vec_rot(clnf_model.params_global[1], clnf_model.params_global[2], clnf_model.params_global[3]);
+		cv::Vec3f vec_rot = Utilities::Euler2AxisAngle(cv::Vec3f(params_global[1], params_global[2], params_global[3]));
+
+		cv::solvePnP(landmarks_3D, landmarks_2D_pnp, camera_matrix, cv::Mat(), vec_rot, vec_trans, true);
+
+		rotation = Utilities::AxisAngle2RotationMatrix(vec_rot);
+		translation = vec_trans;
+	}
+}
+
+// Getting a head pose estimate from the currently detected landmarks, with appropriate correction due to the PDM assuming an orthographic camera
+// which is only correct close to the centre of the image
+// This method returns a corrected pose estimate with respect to world coordinates with camera at origin (0,0,0)
+// The format returned is [Tx, Ty, Tz, Eul_x, Eul_y, Eul_z]
+cv::Vec6f LandmarkDetector::GetPose(const CLNF& clnf_model, float fx, float fy, float cx, float cy)
+{
+	// The pose is shared by all of the consumers of a frame
+	FrameResult& result = clnf_model.GetFrameResult();
+	cv::Vec4f camera(fx, fy, cx, cy);
+	if (result.has_pose && result.pose_camera == camera)
+	{
+		return result.pose;
+	}
 
-		cv::solvePnP(landmarks_3D, landmarks_2D, camera_matrix, cv::Mat(), vec_rot, vec_trans, true);
+	if (!clnf_model.detected_landmarks.empty() && clnf_model.params_global[0] != 0)
+	{
+		cv::Matx33f rotation;
+		cv::Vec3f translation;
+		SolvePose(clnf_model, fx, fy, cx, cy, rotation, translation);
 
-		cv::Vec3f euler = Utilities::AxisAngle2Euler(vec_rot);
+		cv::Vec3f euler = Utilities::RotationMatrix2Euler(rotation);
 
-		return cv::Vec6f(vec_trans[0], vec_trans[1], vec_trans[2], euler[0], euler[1], euler[2]);
+		result.pose = cv::Vec6f(translation[0], translation[1], translation[2], euler[0], euler[1], euler[2]);
+		result.pose_camera = camera;
+		result.has_pose = true;
+		return result.pose;
 	}
 	else
 	{
@@ -103,34 +212,9 @@ cv::Vec6f LandmarkDetector::GetPoseWRTCamera(const CLNF& clnf_model, float fx, f
 {
 	if (!clnf_model.detected_landmarks.empty() && clnf_model.params_global[0] != 0)
 	{
-
-		float Z = fx / clnf_model.params_global[0];
-
-		float X = ((clnf_model.params_global[4] - cx) * (1.0 / fx)) * Z;
-		float Y = ((clnf_model.params_global[5] - cy) * (1.0 / fy)) * Z;
-
-		// Correction for orientation
-
-		// 3D points
-		cv::Mat_<float> landmarks_3D;
-		clnf_model.pdm.CalcShape3D(landmarks_3D, clnf_model.params_local);
-
-		landmarks_3D = landmarks_3D.reshape(1, 3).t();
-
-		// 2D points
-		cv::Mat_<float> landmarks_2D = clnf_model.detected_landmarks;
-
-		landmarks_2D = landmarks_2D.reshape(1, 2).t();
-
-		// Solving the PNP model
-
-		// The camera matrix
-		cv::Matx33f camera_matrix(fx, 0, cx, 0, fy, cy, 0, 0, 1);
-
-		cv::Vec3f vec_trans(X, Y, Z);
-		cv::Vec3f vec_rot(clnf_model.params_global[1], clnf_model.params_global[2], clnf_model.params_global[3]);
-
-		cv::solvePnP(landmarks_3D, landmarks_2D, camera_matrix, cv::Mat(), vec_rot, vec_trans, true);
+		// The same fit as GetPose, so it is shared with it
+		cv::Vec6f pose = GetPose(clnf_model, fx, fy, cx, cy);
+		cv::Vec3f vec_trans(pose[0], pose[1], pose[2]);
 
 		// Here we correct for the camera orientation, for this need to determine the angle the camera makes with the head pose
 		float z_x = cv::sqrt(vec_trans[0] * vec_trans[0] + vec_trans[2] * vec_trans[2]);
@@ -140,7 +224,7 @@ cv::Vec6f LandmarkDetector::GetPoseWRTCamera(const CLNF& clnf_model, float fx, f
 		float eul_y = -atan2(vec_trans[0], z_y);
 
 		cv::Matx33f camera_rotation = Utilities::Euler2RotationMatrix(cv::Vec3f(eul_x, eul_y, 0));
-		cv::Matx33f head_rotation = Utilities::AxisAngle2RotationMatrix(vec_rot);
+		cv::Matx33f head_rotation = Utilities::Euler2RotationMatrix(cv::Vec3f(pose[3], pose[4], pose[5]));
 
 		cv::Matx33f corrected_rotation = camera_rotation * head_rotation;
 
@@ -154,65 +238,591 @@ cv::Vec6f LandmarkDetector::GetPoseWRTCamera(const CLNF& clnf_model, float fx, f
 	}
 }
 
-// If landmark detection in video succeeded create a template for use in simple tracking
-void UpdateTemplate(const cv::Mat_<uchar> &grayscale_image, CLNF& clnf_model)
+// The template search radius around the expected location is at least this fraction of the face width, and at most half of it
+static const float TEMPLATE_MIN_SEARCH_RADIUS = 0.05f;
+static const float TEMPLATE_MAX_SEARCH_RADIUS = 0.5f;
+
+// The search is done coarse to fine once it spans more than this many template pixels, the coarse match is then refined within a few pixels
+static const int TEMPLATE_COARSE_SEARCH_RADIUS = 4;
+static const int TEMPLATE_REFINE_RADIUS = 2;
+static const int TEMPLATE_COARSE_MIN_SIZE = 16;
+
+// If landmark detection in video succeeded create a template for use in simple tracking, the template is kept at the face_template_scale
+// resolution and is only re-extracted once the appearance changed (a low correlation of the last match), the scale of the face changed or
+// it is older than face_template_max_age frames
+void UpdateTemplate(const cv::Mat_<uchar> &grayscale_image, CLNF& clnf_model, const FaceModelParameters& params, bool force = false)
 {
+	float scaling = std::min(params.face_template_scale / clnf_model.params_global[0], 1.0f);
+
+	bool refresh = force || clnf_model.face_template.empty() || clnf_model.face_template_age >= params.face_template_max_age ||
+		clnf_model.face_template_correlation < params.face_template_refresh_correlation ||
+		std::abs(scaling / clnf_model.face_template_scaling - 1.0f) > 0.1f;
+
+	clnf_model.face_template_age++;
+	if (!refresh)
+	{
+		return;
+	}
+
 	cv::Rect_<float> bounding_box;
 	clnf_model.pdm.CalcBoundingBox(bounding_box, clnf_model.params_global, clnf_model.params_local);
-	
-	// Make sure the box is not out of bounds
+
+	// The template has to be centred on the face for the matching, so it is only taken while the face is fully in the image
 	cv::Rect_<int> bbox_tmp((int)bounding_box.x, (int)bounding_box.y, (int)bounding_box.width, (int)bounding_box.height);
-	bounding_box = bbox_tmp & cv::Rect(0, 0, grayscale_image.cols, grayscale_image.rows);
+	if (bbox_tmp.width <= 0 || bbox_tmp.height <= 0 || (bbox_tmp & cv::Rect(0, 0, grayscale_image.cols, grayscale_image.rows)) != bbox_tmp)
+	{
+		return;
+	}
 
-	clnf_model.face_template = grayscale_image(bounding_box).clone();
+	if (scaling < 1)
+	{
+		cv::resize(grayscale_image(bbox_tmp), clnf_model.face_template, cv::Size(), scaling, scaling, cv::INTER_AREA);
+		clnf_model.face_template_scaling = (float)clnf_model.face_template.cols / bbox_tmp.width;
+	}
+	else
+	{
+		clnf_model.face_template = grayscale_image(bbox_tmp).clone();
+		clnf_model.face_template_scaling = 1.0f;
+	}
+	clnf_model.face_template_age = 0;
+	clnf_model.face_template_correlation = 1.0f;
 }
 
-// This method uses basic template matching in order to allow for better tracking of fast moving faces
-void CorrectGlobalParametersVideo(const cv::Mat_<uchar> &grayscale_image, CLNF& clnf_model, const FaceModelParameters& params)
+// Finding the best TM_CCOEFF_NORMED match of the template in the image, returns the correlation
+static float MatchTemplate(const cv::Mat_<uchar>& image, const cv::Mat_<uchar>& face_template, cv::Point& location)
 {
+	cv::Mat corr_out;
+	cv::matchTemplate(image, face_template, corr_out, cv::TM_CCOEFF_NORMED);
+
+	double max_corr;
+	cv::minMaxLoc(corr_out, NULL, &max_corr, NULL, &location);
+	return (float)max_corr;
+}
+
+// Estimating the inter-frame motion of the face by matching the template from the previous frames within the expected motion (in pixels,
+// negative if not known) around the current estimate, returns the correlation of the best match. Larger searches are done coarse to fine
+// on a two level pyramid
+static float EstimateTemplateMotion(const cv::Mat_<uchar> &grayscale_image, CLNF& clnf_model, const FaceModelParameters& params, float expected_motion, float& shift_x, float& shift_y)
+{
+	TRACE_SCOPE("Template matching");
+
+	shift_x = 0;
+	shift_y = 0;
+
 	cv::Rect_<float> init_box;
 	clnf_model.pdm.CalcBoundingBox(init_box, clnf_model.params_global, clnf_model.params_local);
 
-	cv::Rect roi(init_box.x - init_box.width/2, init_box.y - init_box.height/2, init_box.width * 2, init_box.height * 2);
-	roi = roi & cv::Rect(0, 0, grayscale_image.cols, grayscale_image.rows);
+	// Where the template is expected to be, in image coordinates
+	const cv::Mat_<uchar>& face_template = clnf_model.face_template;
+	float scaling = clnf_model.face_template_scaling;
+	cv::Size_<float> template_size(face_template.cols / scaling, face_template.rows / scaling);
+	cv::Point2f expected(init_box.x + init_box.width / 2 - template_size.width / 2, init_box.y + init_box.height / 2 - template_size.height / 2);
 
-	int off_x = roi.x;
-	int off_y = roi.y;
+	float radius = TEMPLATE_MAX_SEARCH_RADIUS * init_box.width;
+	if (expected_motion >= 0)
+	{
+		radius = std::min(radius, std::max(TEMPLATE_MIN_SEARCH_RADIUS * init_box.width, 2.0f / scaling) + expected_motion);
+	}
+
+	cv::Rect roi(cvFloor(expected.x - radius), cvFloor(expected.y - radius), cvCeil(template_size.width + 2 * radius), cvCeil(template_size.height + 2 * radius));
+	roi = roi & cv::Rect(0, 0, grayscale_image.cols, grayscale_image.rows);
 
-	float scaling = params.face_template_scale / clnf_model.params_global[0];
 	cv::Mat_<uchar> image;
-	if(scaling < 1)
+	if (scaling < 1)
 	{
-		cv::resize(clnf_model.face_template, clnf_model.face_template, cv::Size(), scaling, scaling);
-		cv::resize(grayscale_image(roi), image, cv::Size(), scaling, scaling);
+		cv::resize(grayscale_image(roi), image, cv::Size(), scaling, scaling, cv::INTER_AREA);
 	}
 	else
 	{
-		scaling = 1;
-		image = grayscale_image(roi).clone();
+		image = grayscale_image(roi);
+	}
+
+	if (image.rows < face_template.rows || image.cols < face_template.cols)
+	{
+		return 0;
+	}
+
+	cv::Point location;
+	float max_corr;
+
+	int search_radius = std::max(image.cols - face_template.cols, image.rows - face_template.rows) / 2;
+	if (search_radius > TEMPLATE_COARSE_SEARCH_RADIUS && face_template.cols >= TEMPLATE_COARSE_MIN_SIZE && face_template.rows >= TEMPLATE_COARSE_MIN_SIZE)
+	{
+		// Coarse search over the whole area at half the resolution
+		cv::Mat_<uchar> image_coarse, template_coarse;
+		cv::pyrDown(image, image_coarse);
+		cv::pyrDown(face_template, template_coarse);
+
+		cv::Point coarse_location;
+		MatchTemplate(image_coarse, template_coarse, coarse_location);
+
+		// Refining within a few pixels of the coarse match at the full resolution
+		cv::Rect refine_area(coarse_location.x * 2 - TEMPLATE_REFINE_RADIUS, coarse_location.y * 2 - TEMPLATE_REFINE_RADIUS,
+			face_template.cols + 2 * TEMPLATE_REFINE_RADIUS, face_template.rows + 2 * TEMPLATE_REFINE_RADIUS);
+		refine_area = refine_area & cv::Rect(0, 0, image.cols, image.rows);
+
+		max_corr = MatchTemplate(image(refine_area), face_template, location);
+		location += refine_area.tl();
+	}
+	else
+	{
+		max_corr = MatchTemplate(image, face_template, location);
 	}
-		
-	// Resizing the template			
-	cv::Mat corr_out;
-	cv::matchTemplate(image, clnf_model.face_template, corr_out, cv::TM_CCOEFF_NORMED);
 
-	// Actually matching it
-	//double min, max;
-	int max_loc[2];
+	shift_x = location.x / scaling + roi.x - expected.x;
+	shift_y = location.y / scaling + roi.y - expected.y;
 
-	cv::minMaxIdx(corr_out, NULL, NULL, NULL, max_loc);
+	clnf_model.face_template_correlation = max_corr;
 
-	cv::Rect_<float> out_bbox(max_loc[1]/scaling + off_x, max_loc[0]/scaling + off_y, clnf_model.face_template.rows / scaling, clnf_model.face_template.cols / scaling);
+	return max_corr;
+}
 
-	float shift_x = out_bbox.x - init_box.x;
-	float shift_y = out_bbox.y - init_box.y;
+// This method uses basic template matching in order to allow for better tracking of fast moving faces
+void CorrectGlobalParametersVideo(const cv::Mat_<uchar> &grayscale_image, CLNF& clnf_model, const FaceModelParameters& params)
+{
+	TRACE_SCOPE("Template correction");
+
+	float shift_x, shift_y;
+	EstimateTemplateMotion(grayscale_image, clnf_model, params, -1.0f, shift_x, shift_y);
 			
 	clnf_model.params_global[4] = clnf_model.params_global[4] + shift_x;
 	clnf_model.params_global[5] = clnf_model.params_global[5] + shift_y;
 	
 }
 
+// Propagating the landmarks from the frame of the last fit with sparse optical flow and projecting them onto the shape model, this is
+// used in between the full fits when only fitting every n-th frame, returns false if the propagated landmarks should not be trusted
+static bool PropagateLandmarks(const cv::Mat_<uchar> &grayscale_image, CLNF& clnf_model, const FaceModelParameters& params)
+{
+	TRACE_SCOPE("Landmark propagation");
+
+	int n = clnf_model.pdm.NumberOfPoints();
+
+	std::vector<cv::Point2f> prev_points(n);
+	for (int i = 0; i < n; ++i)
+	{
+		prev_points[i] = cv::Point2f(clnf_model.detected_landmarks.at<float>(i), clnf_model.detected_landmarks.at<float>(i + n));
+	}
+
+	std::vector<cv::Point2f> next_points;
+	std::vector<uchar> status;
+	std::vector<float> errors;
+	cv::calcOpticalFlowPyrLK(clnf_model.propagation_frame, grayscale_image, prev_points, next_points, status, errors, cv::Size(15, 15), 2);
+
+	// The landmarks that could not be followed are marked as invisible (zero) for the shape model fitting
+	cv::Mat_<float> propagated_landmarks(2 * n, 1, 0.0f);
+	int num_tracked = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		if (status[i])
+		{
+			propagated_landmarks.at<float>(i) = next_points[i].x;
+			propagated_landmarks.at<float>(i + n) = next_points[i].y;
+			num_tracked++;
+		}
+	}
+
+	// A large part of the face lost usually means occlusion or a fast motion, which needs a full fit
+	if (num_tracked < 0.8 * n)
+	{
+		return false;
+	}
+
+	cv::Vec6f params_global_prev = clnf_model.params_global;
+	cv::Mat_<float> params_local_prev = clnf_model.params_local.clone();
+	cv::Mat_<float> detected_landmarks_prev = clnf_model.detected_landmarks.clone();
+
+	cv::Vec3f rotation(clnf_model.params_global[1], clnf_model.params_global[2], clnf_model.params_global[3]);
+	clnf_model.pdm.CalcParams(clnf_model.params_global, clnf_model.params_local, propagated_landmarks, rotation);
+	clnf_model.pdm.CalcShape2D(clnf_model.detected_landmarks, clnf_model.params_local, clnf_model.params_global);
+
+	// The validator decides if the propagation can be kept, otherwise the full fit starts from the previous estimate
+	if (params.validate_detections)
+	{
+		cv::Vec3d orientation(clnf_model.params_global[1], clnf_model.params_global[2], clnf_model.params_global[3]);
+		float certainty = clnf_model.landmark_validator.Check(orientation, grayscale_image, clnf_model.detected_landmarks);
+
+		if (certainty <= params.validation_boundary)
+		{
+			clnf_model.params_global = params_global_prev;
+			clnf_model.params_local = params_local_prev;
+			clnf_model.detected_landmarks = detected_landmarks_prev;
+			return false;
+		}
+		clnf_model.detection_certainty = certainty;
+	}
+
+	return true;
+}
+
+// Counting the outcome of the video landmark detection for the metrics, the success rate is successful over processed frames
+static bool RecordVideoDetectionResult(bool success)
+{
+	if (success)
+	{
+		METRICS_INCREMENT("openface_landmark_detection_success_total", "Frames in which the landmarks were detected successfully");
+	}
+	return success;
+}
+
+// Reading in the chosen face detector if it has not been read yet (the Haar cascade also for the shared frame if frame_detector is set), the
+// detector chosen is changed if it is not available. Nothing is read when a face detector plug-in is set, as it is used instead
+static void ReadFaceDetector(CLNF& clnf_model, FaceModelParameters& params, bool frame_detector)
+{
+	if (clnf_model.face_detector_plugin)
+		return;
+
+#ifdef OPENFACE_SLIM_LANDMARK_DETECTOR
+	if (params.curr_face_detector != FaceModelParameters::MTCNN_DETECTOR)
+	{
+		cout << "INFO: the Haar and HOG-SVM face detectors are not built in, defaulting to MTCNN face detector" << endl;
+		params.curr_face_detector = FaceModelParameters::MTCNN_DETECTOR;
+	}
+#else
+	if(clnf_model.face_detector_HAAR.empty() && params.curr_face_detector == FaceModelParameters::HAAR_DETECTOR)
+	{
+		clnf_model.face_detector_HAAR.load(params.haar_face_detector_location);
+		clnf_model.haar_face_detector_location = params.haar_face_detector_location;
+		if (frame_detector)
+		{
+			clnf_model.face_detector_HAAR_frame.Read(params.haar_face_detector_location);
+		}
+	}
+#endif
+	if (clnf_model.face_detector_MTCNN.empty() && params.curr_face_detector == FaceModelParameters::MTCNN_DETECTOR)
+	{
+		clnf_model.face_detector_MTCNN.Read(params.mtcnn_face_detector_location);
+		clnf_model.mtcnn_face_detector_location = params.mtcnn_face_detector_location;
+
+		// If the model is still empty default to HOG (there is nothing to fall back to in the slim build)
+		if (clnf_model.face_detector_MTCNN.empty())
+		{
+#ifdef OPENFACE_SLIM_LANDMARK_DETECTOR
+			cout << "WARNING: no face detector available, the bounding boxes have to be given or a face detector plug-in set" << endl;
+#else
+			cout << "INFO: defaulting to HOG-SVM face detector" << endl;
+			params.curr_face_detector = LandmarkDetector::FaceModelParameters::HOG_SVM_DETECTOR;
+#endif
+		}
+
+	}
+	clnf_model.face_detector_MTCNN.SetConvolutionAutotuning(params.mtcnn_autotune_convolutions);
+}
+
+// Running the chosen face detector for (re)initialisation of tracking, the image is the colour one for MTCNN and a face detector plug-in and
+// grayscale one for the others. When detecting on the whole frame MTCNN, the plug-in and the Haar cascade use the frame shared with the landmark
+// fitting instead (if given). MTCNN also gives the facial keypoints of the face (which are empty for the other detectors)
+static bool DetectSingleFaceForInit(cv::Rect_<float>& bounding_box, vector<cv::Point2f>& keypoints, const cv::Mat& image, CLNF& clnf_model, FaceModelParameters::FaceDetector detector,
+	cv::Point preference_det, bool mtcnn_fast, float expected_size, ImageContext* frame = NULL)
+{
+	keypoints.clear();
+
+	bool colour_detector = detector == FaceModelParameters::MTCNN_DETECTOR || clnf_model.face_detector_plugin;
+	ImageContext image_context(colour_detector && frame == NULL ? image : cv::Mat(),
+		detector == FaceModelParameters::HAAR_DETECTOR && !colour_detector && frame == NULL ? (cv::Mat_<uchar>)image : cv::Mat_<uchar>());
+	ImageContext& detection_frame = frame != NULL ? *frame : image_context;
+
+	TRACE_SCOPE("Face detection");
+	METRICS_LATENCY("openface_stage_latency_seconds{stage=\"face_detection\"}", "Latency of the processing stages in seconds");
+
+	bool face_detection_success = false;
+	if (clnf_model.face_detector_plugin)
+	{
+		float confidence;
+		face_detection_success = LandmarkDetector::DetectSingleFacePlugin(bounding_box, detection_frame, *clnf_model.face_detector_plugin, confidence, preference_det);
+	}
+#ifdef OPENFACE_SLIM_LANDMARK_DETECTOR
+	else if (clnf_model.face_detector_MTCNN.empty())
+	{
+		// No detector available (see ReadFaceDetector)
+		face_detection_success = false;
+	}
+#else
+	else if(detector == FaceModelParameters::HOG_SVM_DETECTOR)
+	{
+		float confidence;
+		face_detection_success = LandmarkDetector::DetectSingleFaceHOG(bounding_box, image, clnf_model.face_detector_HOG, confidence, preference_det);
+	}
+	else if(detector == FaceModelParameters::HAAR_DETECTOR)
+	{
+		if (!clnf_model.face_detector_HAAR_frame.empty())
+		{
+			face_detection_success = LandmarkDetector::DetectSingleFace(bounding_box, detection_frame, clnf_model.face_detector_HAAR_frame, preference_det);
+		}
+		else
+		{
+			face_detection_success = LandmarkDetector::DetectSingleFace(bounding_box, image, clnf_model.face_detector_HAAR, preference_det);
+		}
+	}
+#endif
+	else if (detector == FaceModelParameters::MTCNN_DETECTOR && mtcnn_fast)
+	{
+		// Only searching the scales around the size of the last tracked face (if known)
+		int min_face = 60;
+		int max_face = -1;
+		if (expected_size > 0)
+		{
+			min_face = std::max(min_face, (int)(expected_size * 0.5f));
+			max_face = (int)(expected_size * 2.0f);
+		}
+		float confidence;
+		face_detection_success = clnf_model.face_detector_MTCNN.DetectSingleFace(bounding_box, confidence, keypoints, detection_frame, preference_det, min_face, max_face);
+	}
+	else if (detector == FaceModelParameters::MTCNN_DETECTOR)
+	{
+		float confidence;
+		face_detection_success = LandmarkDetector::DetectSingleFaceMTCNN(bounding_box, keypoints, detection_frame, clnf_model.face_detector_MTCNN, confidence, preference_det);
+	}
+	return face_detection_success;
+}
+
+// The area to search for the face in when reinitialising, around the last tracked face unless the searches there keep failing (empty for
+// the full frame)
+static cv::Rect DetectionROI(const CLNF& clnf_model, const FaceModelParameters& params, cv::Size image_size)
+{
+	if (!params.roi_detection || clnf_model.last_face_box.width <= 0 || clnf_model.roi_detection_misses >= params.roi_detection_attempts)
+		return cv::Rect();
+
+	const cv::Rect_<float>& box = clnf_model.last_face_box;
+	float size = std::max(box.width, box.height) * params.roi_detection_scale;
+	cv::Point2f center(box.x + box.width / 2.0f, box.y + box.height / 2.0f);
+
+	cv::Rect roi((int)(center.x - size / 2.0f), (int)(center.y - size / 2.0f), (int)size, (int)size);
+	roi &= cv::Rect(0, 0, image_size.width, image_size.height);
+
+	// Not worth it if most of the frame would be searched anyway
+	if (roi.area() <= 0 || roi.area() > 0.5 * image_size.area())
+		return cv::Rect();
+
+	return roi;
+}
+
+// Counting the degradations applied to meet the frame deadlines for the metrics
+static void RecordDeadlineDegradations(int degradations)
+{
+	if (degradations & DEGRADATION_FEWER_ITERATIONS)
+	{
+		METRICS_INCREMENT("openface_deadline_degradations_total{degradation=\"fewer_iterations\"}", "Frames degraded to meet their deadline");
+	}
+	if (degradations & DEGRADATION_SKIPPED_SCALES)
+	{
+		METRICS_INCREMENT("openface_deadline_degradations_total{degradation=\"skipped_scales\"}", "Frames degraded to meet their deadline");
+	}
+	if (degradations & DEGRADATION_SKIPPED_REFINEMENT)
+	{
+		METRICS_INCREMENT("openface_deadline_degradations_total{degradation=\"skipped_refinement\"}", "Frames degraded to meet their deadline");
+	}
+	if (degradations & DEGRADATION_DEFERRED_VALIDATION)
+	{
+		METRICS_INCREMENT("openface_deadline_degradations_total{degradation=\"deferred_validation\"}", "Frames degraded to meet their deadline");
+	}
+}
+
+static bool TrackInVideo(const cv::Mat &rgb_image, CLNF& clnf_model, FaceModelParameters& params, cv::Mat& grayscale_image, double time_stamp);
+
 bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat &rgb_image, CLNF& clnf_model, FaceModelParameters& params, cv::Mat& grayscale_image)
+{
+	return DetectLandmarksInVideo(rgb_image, clnf_model, params, grayscale_image, -1.0);
+}
+
+bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat &rgb_image, CLNF& clnf_model, FaceModelParameters& params, cv::Mat& grayscale_image, double time_stamp)
+{
+	if (params.frame_deadline_ms > 0)
+	{
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+			std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(params.frame_deadline_ms));
+
+		clnf_model.SetDeadline(deadline);
+		bool success = TrackInVideo(rgb_image, clnf_model, params, grayscale_image, time_stamp);
+		clnf_model.ClearDeadline();
+
+		RecordDeadlineDegradations(clnf_model.deadline_degradations);
+		return success;
+	}
+
+	clnf_model.deadline_degradations = DEGRADATION_NONE;
+	return TrackInVideo(rgb_image, clnf_model, params, grayscale_image, time_stamp);
+}
+
+bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat &rgb_image, CLNF& clnf_model, FaceModelParameters& params, cv::Mat& grayscale_image, std::chrono::steady_clock::time_point deadline)
+{
+	clnf_model.SetDeadline(deadline);
+	bool success = TrackInVideo(rgb_image, clnf_model, params, grayscale_image, -1.0);
+	clnf_model.ClearDeadline();
+
+	RecordDeadlineDegradations(clnf_model.deadline_degradations);
+	return success;
+}
+
+// A coarse colour histogram of the frame (4 bins per channel over a downsampled image), normalised to sum to one
+static cv::Mat_<float> SceneHistogram(const cv::Mat& image)
+{
+	cv::Mat small_image;
+	cv::resize(image, small_image, cv::Size(64, 48), 0, 0, cv::INTER_NEAREST);
+
+	int num_channels = std::min(small_image.channels(), 3);
+	int channels[] = { 0, 1, 2 };
+	int bins[] = { 4, 4, 4 };
+	float range[] = { 0, 256 };
+	const float* ranges[] = { range, range, range };
+
+	cv::Mat histogram;
+	cv::calcHist(&small_image, 1, channels, cv::Mat(), histogram, num_channels, bins, ranges);
+
+	cv::Mat_<float> histogram_row = histogram.reshape(1, 1).clone();
+	histogram_row /= (double)(small_image.rows * small_image.cols);
+	return histogram_row;
+}
+
+// Has there been a cut to a different shot since the previous frame, the histogram of the frame is remembered for the next one
+static bool DetectSceneCut(const cv::Mat& rgb_image, CLNF& clnf_model, const FaceModelParameters& params)
+{
+	cv::Mat_<float> histogram = SceneHistogram(rgb_image);
+
+	bool cut = !clnf_model.scene_histogram.empty() && clnf_model.scene_histogram.size() == histogram.size() &&
+		cv::compareHist(clnf_model.scene_histogram, histogram, cv::HISTCMP_BHATTACHARYYA) > params.scene_cut_threshold;
+
+	clnf_model.scene_histogram = histogram;
+	return cut;
+}
+
+// The number of times the working resolution can be halved in the adaptive resolution mode
+static const int MAX_WORKING_LEVEL = 4;
+
+// The pyramid level (the number of halvings of the frame) the model should work at, the face width is kept within a band around the working
+// face width so that the level does not flip between frames. Before the face is found the level is chosen for the detection from the frame size
+static int WorkingLevel(const CLNF& clnf_model, const FaceModelParameters& params, cv::Size image_size)
+{
+	if (!clnf_model.tracking_initialised)
+	{
+		int level = 0;
+		while (level < MAX_WORKING_LEVEL && (image_size.width >> (level + 1)) >= params.adaptive_resolution_detection_width)
+			level++;
+		return level;
+	}
+
+	// The face size is not known reliably
+	if (!clnf_model.detection_success)
+	{
+		return clnf_model.working_level;
+	}
+
+	float face_width = clnf_model.GetBoundingBox().width;
+	float target_width = params.adaptive_resolution_face_width;
+	float current_width = face_width / (1 << clnf_model.working_level);
+	if ((current_width < 2.5f * target_width || clnf_model.working_level == MAX_WORKING_LEVEL) &&
+		(current_width >= 0.75f * target_width || clnf_model.working_level == 0))
+	{
+		return clnf_model.working_level;
+	}
+
+	int level = 0;
+	while (level < MAX_WORKING_LEVEL && face_width / (1 << (level + 1)) >= target_width)
+		level++;
+	return level;
+}
+
+// Changing the level the model works at, the state kept in the working image coordinates is not valid at a different level
+static void SetWorkingLevel(CLNF& clnf_model, int level)
+{
+	if (clnf_model.working_level == level)
+	{
+		return;
+	}
+
+	clnf_model.face_template = cv::Mat_<uchar>();
+	clnf_model.face_template_age = 0;
+	clnf_model.propagation_frame = cv::Mat_<uchar>();
+	clnf_model.motion_predictor.Reset();
+	clnf_model.async_face_detector.Cancel();
+	clnf_model.working_level = level;
+}
+
+// Scaling the image space state of the model (the pose, the landmarks and the last face box) between the frame and the working image
+static void ScaleModelState(CLNF& clnf_model, float scale)
+{
+	clnf_model.params_global[0] *= scale;
+	clnf_model.params_global[4] *= scale;
+	clnf_model.params_global[5] *= scale;
+	clnf_model.detected_landmarks *= scale;
+
+	for (size_t part = 0; part < clnf_model.hierarchical_models.size(); ++part)
+	{
+		clnf_model.hierarchical_models[part].params_global[0] *= scale;
+		clnf_model.hierarchical_models[part].params_global[4] *= scale;
+		clnf_model.hierarchical_models[part].params_global[5] *= scale;
+		clnf_model.hierarchical_models[part].detected_landmarks *= scale;
+	}
+
+	clnf_model.last_face_box = cv::Rect_<float>(clnf_model.last_face_box.x * scale, clnf_model.last_face_box.y * scale,
+		clnf_model.last_face_box.width * scale, clnf_model.last_face_box.height * scale);
+}
+
+static bool TrackInVideoAtLevel(const cv::Mat &rgb_image, CLNF& clnf_model, FaceModelParameters& params, cv::Mat& grayscale_image, double time_stamp);
+static bool DetectLandmarksInImageContext(ImageContext& image_context, const cv::Rect_<double> bounding_box, CLNF& clnf_model, FaceModelParameters& params,
+	const vector<cv::Point2f>& keypoints = vector<cv::Point2f>());
+
+// The landmark detection in a single video frame, under the deadline of the model if one is set. The time stamp (in seconds, negative if
+// not known) is used by the motion prediction. In the adaptive resolution mode the model is fit on a downscaled frame (with the face at
+// around the working face width), the results are mapped back to the frame
+static bool TrackInVideo(const cv::Mat &rgb_image, CLNF& clnf_model, FaceModelParameters& params, cv::Mat& grayscale_image, double time_stamp)
+{
+	TRACE_SCOPE("DetectLandmarksInVideo");
+	METRICS_LATENCY("openface_stage_latency_seconds{stage=\"landmark_detection\"}", "Latency of the processing stages in seconds");
+	METRICS_INCREMENT("openface_frames_processed_total", "Frames passed through video landmark detection");
+
+	// After a cut the face from the previous shot is not worth tracking, re-detecting straight away instead
+	if(params.scene_cut_detection && DetectSceneCut(rgb_image, clnf_model, params) && clnf_model.tracking_initialised)
+	{
+		METRICS_INCREMENT("openface_scene_cuts_total", "Cuts detected in video that reset the tracking");
+
+		// The histogram of the new shot is kept for the next frame
+		cv::Mat_<float> histogram = clnf_model.scene_histogram;
+		clnf_model.Reset();
+		clnf_model.scene_histogram = histogram;
+	}
+
+	int level = params.adaptive_resolution ? WorkingLevel(clnf_model, params, rgb_image.size()) : 0;
+	SetWorkingLevel(clnf_model, level);
+
+	if(level == 0)
+	{
+		return TrackInVideoAtLevel(rgb_image, clnf_model, params, grayscale_image, time_stamp);
+	}
+
+	// The working images, the colour one is only needed when the face might have to be detected (and the greyscale one is used otherwise)
+	float scale = 1.0f / (1 << level);
+	cv::Size working_size(cvRound(rgb_image.cols * scale), cvRound(rgb_image.rows * scale));
+	bool detection_possible = !clnf_model.tracking_initialised || !clnf_model.detection_success || params.async_face_detection;
+
+	cv::Mat working_rgb;
+	cv::Mat working_grayscale;
+	if(grayscale_image.empty() || detection_possible)
+	{
+		cv::resize(rgb_image, working_rgb, working_size, 0, 0, cv::INTER_AREA);
+	}
+	if(grayscale_image.empty())
+	{
+		Utilities::ConvertToGrayscale_8bit(working_rgb, working_grayscale);
+	}
+	else
+	{
+		cv::resize(grayscale_image, working_grayscale, working_size, 0, 0, cv::INTER_AREA);
+	}
+	if(working_rgb.empty())
+	{
+		working_rgb = working_grayscale;
+	}
+
+	ScaleModelState(clnf_model, scale);
+	bool success = TrackInVideoAtLevel(working_rgb, clnf_model, params, working_grayscale, time_stamp);
+	ScaleModelState(clnf_model, 1.0f / scale);
+
+	return success;
+}
+
+// The landmark detection in a video frame that is already at the working resolution
+static bool TrackInVideoAtLevel(const cv::Mat &rgb_image, CLNF& clnf_model, FaceModelParameters& params, cv::Mat& grayscale_image, double time_stamp)
 {
 	// First need to decide if the landmarks should be "detected" or "tracked"
 	// Detected means running face detection and a larger search area, tracked means initialising from previous step
@@ -223,12 +833,33 @@ bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat &rgb_image, CLNF& cl
 		Utilities::ConvertToGrayscale_8bit(rgb_image, grayscale_image);
 	}
 
+	// The tracking, the face detection and the landmark detection after it all work on the same frame, so share its conversions
+	ImageContext frame(rgb_image, grayscale_image);
+
 	// Indicating that this is a first detection in video sequence or after restart
 	bool initial_detection = !clnf_model.tracking_initialised;
 
 	// Only do it if there was a face detection at all
 	if(clnf_model.tracking_initialised)
 	{
+		// In between the full fits only propagate the landmarks of the last successful frame, or fit the eyes alone for high frame rate gaze
+		if(params.full_fit_every > 1 && clnf_model.detection_success && !clnf_model.propagation_frame.empty() && clnf_model.frames_since_full_fit + 1 < params.full_fit_every)
+		{
+			if(params.track_eyes_between_fits && clnf_model.TrackEyes(frame, params, time_stamp))
+			{
+				clnf_model.motion_predictor.Update(clnf_model.params_global, time_stamp);
+				clnf_model.frames_since_full_fit++;
+				return RecordVideoDetectionResult(true);
+			}
+			else if(!params.track_eyes_between_fits && PropagateLandmarks(grayscale_image, clnf_model, params))
+			{
+				clnf_model.motion_predictor.Update(clnf_model.params_global, time_stamp);
+				clnf_model.frames_since_full_fit++;
+				grayscale_image.copyTo(clnf_model.propagation_frame);
+				return RecordVideoDetectionResult(true);
+			}
+		}
+		clnf_model.frames_since_full_fit = 0;
 
 		// The area of interest search size will depend if the previous track was successful
 		if(!clnf_model.detection_success)
@@ -240,58 +871,110 @@ bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat &rgb_image, CLNF& cl
 			params.window_sizes_current = params.window_sizes_small;
 		}
 
-		// Before the expensive landmark detection step apply a quick template tracking approach
-		if(params.use_face_template && !clnf_model.face_template.empty() && clnf_model.detection_success)
+		// The expected motion of the face bounds the template search, with the motion prediction the fit also starts from where the face is
+		// expected to have moved to and the template only needs to correct the prediction
+		float expected_motion = -1.0f;
+		cv::Vec6f predicted_params;
+		if(clnf_model.detection_success && clnf_model.motion_predictor.Predict(time_stamp, 1.0f, predicted_params))
 		{
-			CorrectGlobalParametersVideo(grayscale_image, clnf_model, params);
+			float motion_x = predicted_params[4] - clnf_model.params_global[4];
+			float motion_y = predicted_params[5] - clnf_model.params_global[5];
+			expected_motion = cv::sqrt(motion_x * motion_x + motion_y * motion_y);
+
+			if(params.motion_prediction && clnf_model.motion_predictor.Predict(time_stamp, params.motion_prediction_damping, predicted_params))
+			{
+				clnf_model.params_global = predicted_params;
+
+				// Allowing for the prediction being off by half of the motion
+				expected_motion = 0.5f * expected_motion;
+			}
+			else
+			{
+				expected_motion = 1.5f * expected_motion;
+			}
+		}
+
+		// Before the expensive landmark detection step apply a quick template tracking approach, in adaptive tracking the same
+		// template match is used to find near-static faces, for which only the finest scale needs fitting
+		if((params.use_face_template || params.adaptive_tracking) && !clnf_model.face_template.empty() && clnf_model.detection_success)
+		{
+			float shift_x, shift_y;
+			float correlation = EstimateTemplateMotion(grayscale_image, clnf_model, params, expected_motion, shift_x, shift_y);
+
+			cv::Rect_<float> face_box;
+			clnf_model.pdm.CalcBoundingBox(face_box, clnf_model.params_global, clnf_model.params_local);
+
+			if(params.use_face_template)
+			{
+				clnf_model.params_global[4] = clnf_model.params_global[4] + shift_x;
+				clnf_model.params_global[5] = clnf_model.params_global[5] + shift_y;
+			}
+
+			// A low correlation means the appearance changed (e.g. rotation or expression) even if the face did not move
+			float motion = cv::sqrt(shift_x * shift_x + shift_y * shift_y);
+			if(params.adaptive_tracking && correlation > params.adaptive_min_correlation && motion < params.adaptive_motion_threshold * face_box.width)
+			{
+				size_t finest_scale = params.window_sizes_current.size();
+				for(size_t scale = 0; scale < params.window_sizes_current.size(); ++scale)
+				{
+					if(params.window_sizes_current[scale] > 0)
+						finest_scale = scale;
+				}
+				for(size_t scale = 0; scale < finest_scale; ++scale)
+				{
+					params.window_sizes_current[scale] = 0;
+				}
+			}
 		}
 
-		bool track_success = clnf_model.DetectLandmarks(grayscale_image, params);
+		bool track_success = clnf_model.TrackLandmarks(frame, params);
 		
 		if(!track_success)
 		{
 			// Make a record that tracking failed
 			clnf_model.failures_in_a_row++;
+			clnf_model.motion_predictor.Reset();
 		}
 		else
 		{
 			// indicate that tracking is a success
 			clnf_model.failures_in_a_row = -1;		
+			clnf_model.last_face_box = clnf_model.GetBoundingBox();
+			clnf_model.last_face_rotation = cv::Vec3f(clnf_model.params_global[1], clnf_model.params_global[2], clnf_model.params_global[3]);
+			clnf_model.motion_predictor.Update(clnf_model.params_global, time_stamp);
 			
-			if(params.use_face_template)
+			if(params.use_face_template || params.adaptive_tracking)
+			{
+				UpdateTemplate(grayscale_image, clnf_model, params);
+			}
+
+			if(params.full_fit_every > 1)
 			{
-				UpdateTemplate(grayscale_image, clnf_model);
+				grayscale_image.copyTo(clnf_model.propagation_frame);
 			}
 		}
 	}
 
 	// This is used for both detection (if it the tracking has not been initialised yet) or if the tracking failed (however we do this every n frames, for speed)
 	// This also has the effect of an attempt to reinitialise just after the tracking has failed, which is useful during large motions
-	if((!clnf_model.tracking_initialised && (clnf_model.failures_in_a_row + 1) % (params.reinit_video_every * 6) == 0) 
-		|| (clnf_model.tracking_initialised && !clnf_model.detection_success && params.reinit_video_every > 0 && clnf_model.failures_in_a_row % params.reinit_video_every == 0))
-	{
-
-		cv::Rect_<float> bounding_box;
-		
-		// If the face detector has not been initialised and we're using it, then read it in
-		if(clnf_model.face_detector_HAAR.empty() && params.curr_face_detector == params.HAAR_DETECTOR)
-		{
-			clnf_model.face_detector_HAAR.load(params.haar_face_detector_location);
-			clnf_model.haar_face_detector_location = params.haar_face_detector_location;
-		}
-		if (clnf_model.face_detector_MTCNN.empty() && params.curr_face_detector == params.MTCNN_DETECTOR)
-		{
-			clnf_model.face_detector_MTCNN.Read(params.mtcnn_face_detector_location);
-			clnf_model.mtcnn_face_detector_location = params.mtcnn_face_detector_location;
+	bool detection_due = (!clnf_model.tracking_initialised && (clnf_model.failures_in_a_row + 1) % (params.reinit_video_every * 6) == 0)
+		|| (clnf_model.tracking_initialised && !clnf_model.detection_success && params.reinit_video_every > 0 && clnf_model.failures_in_a_row % params.reinit_video_every == 0);
 
-			// If the model is still empty default to HOG
-			if (clnf_model.face_detector_MTCNN.empty())
-			{
-				cout << "INFO: defaulting to HOG-SVM face detector" << endl;
-				params.curr_face_detector = LandmarkDetector::FaceModelParameters::HOG_SVM_DETECTOR;
-			}
+	cv::Rect_<float> bounding_box;
+	vector<cv::Point2f> keypoints;
+	bool face_detection_success = false;
+	bool detection_available = false;
 
-		}
+	if (params.async_face_detection && clnf_model.async_face_detector.IsReady())
+	{
+		// Pick up the background detection, unless the tracking has recovered on its own in the meantime
+		face_detection_success = clnf_model.async_face_detector.GetResult(bounding_box, grayscale_image.size());
+		detection_available = !(clnf_model.tracking_initialised && clnf_model.detection_success);
+	}
+	else if (detection_due && !(params.async_face_detection && clnf_model.async_face_detector.IsPending()))
+	{
+		// If the face detector has not been initialised and we're using it, then read it in
+		ReadFaceDetector(clnf_model, params, true);
 
 		cv::Point preference_det(-1, -1);
 		if(clnf_model.preference_det.x != -1 && clnf_model.preference_det.y != -1)
@@ -301,25 +984,68 @@ bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat &rgb_image, CLNF& cl
 			clnf_model.preference_det = cv::Point(-1, -1);
 		}
 
-		bool face_detection_success;
-		if(params.curr_face_detector == FaceModelParameters::HOG_SVM_DETECTOR)
+		// Only searching around the last known location of the face if possible, the detections are then shifted back to the full frame
+		cv::Rect roi = DetectionROI(clnf_model, params, grayscale_image.size());
+		cv::Point roi_offset = roi.tl();
+		if (preference_det.x != -1 && preference_det.y != -1)
+		{
+			preference_det -= roi_offset;
+		}
+
+		cv::Mat detection_image = params.curr_face_detector == FaceModelParameters::MTCNN_DETECTOR || clnf_model.face_detector_plugin ? rgb_image : grayscale_image;
+		if (roi.area() > 0)
 		{
-			float confidence;
-			face_detection_success = LandmarkDetector::DetectSingleFaceHOG(bounding_box, grayscale_image, clnf_model.face_detector_HOG, confidence, preference_det);
+			detection_image = detection_image(roi);
 		}
-		else if(params.curr_face_detector == FaceModelParameters::HAAR_DETECTOR)
+
+		bool mtcnn_fast = params.mtcnn_single_face_fast;
+		float expected_size = std::max(clnf_model.last_face_box.width, clnf_model.last_face_box.height);
+
+		if (params.async_face_detection)
 		{
-			face_detection_success = LandmarkDetector::DetectSingleFace(bounding_box, grayscale_image, clnf_model.face_detector_HAAR, preference_det);
+			// The detection runs on its own copy of the frame, the detector used is not touched by the tracking in the meantime
+			FaceModelParameters::FaceDetector detector = params.curr_face_detector;
+			detection_image = detection_image.clone();
+			CLNF* model = &clnf_model;
+			clnf_model.async_face_detector.Start([detector, detection_image, model, preference_det, roi_offset, mtcnn_fast, expected_size](cv::Rect_<float>& face_box)
+			{
+				vector<cv::Point2f> unused_keypoints;
+				bool success = DetectSingleFaceForInit(face_box, unused_keypoints, detection_image, *model, detector, preference_det, mtcnn_fast, expected_size);
+				face_box.x += roi_offset.x;
+				face_box.y += roi_offset.y;
+				return success;
+			}, grayscale_image.size());
 		}
-		else if (params.curr_face_detector == FaceModelParameters::MTCNN_DETECTOR)
+		else
 		{
-			float confidence;
-			face_detection_success = LandmarkDetector::DetectSingleFaceMTCNN(bounding_box, rgb_image, clnf_model.face_detector_MTCNN, confidence, preference_det);
+			face_detection_success = DetectSingleFaceForInit(bounding_box, keypoints, detection_image, clnf_model, params.curr_face_detector, preference_det, mtcnn_fast, expected_size,
+				roi.area() > 0 ? NULL : &frame);
+			bounding_box.x += roi_offset.x;
+			bounding_box.y += roi_offset.y;
+			for (size_t k = 0; k < keypoints.size(); ++k)
+			{
+				keypoints[k] += cv::Point2f((float)roi_offset.x, (float)roi_offset.y);
+			}
+			detection_available = true;
 		}
+	}
+
+	if (detection_available)
+	{
+		// Failed detections (around the last location or not) count towards falling back to searching the full frame
+		if (face_detection_success)
+			clnf_model.roi_detection_misses = 0;
+		else
+			clnf_model.roi_detection_misses++;
 
 		// Attempt to detect landmarks using the detected face (if unseccessful the detection will be ignored)
 		if(face_detection_success)
 		{
+			if (!initial_detection)
+			{
+				METRICS_INCREMENT("openface_face_redetections_total", "Face re-detections attempted on an already tracked face");
+			}
+
 			// Indicate that tracking has started as a face was detected
 			clnf_model.tracking_initialised = true;
 						
@@ -343,7 +1069,7 @@ bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat &rgb_image, CLNF& cl
 			// Do the actual landmark detection (and keep it only if successful)
 			// Perform multi-hypothesis detection here (as face detector can pick up multiple of them)
 			params.multi_view = true;
-			bool landmark_detection_success = DetectLandmarksInImage(rgb_image, bounding_box, clnf_model, params, grayscale_image);
+			bool landmark_detection_success = DetectLandmarksInImageContext(frame, bounding_box, clnf_model, params, keypoints);
 			params.multi_view = false;
 
 
@@ -361,18 +1087,29 @@ bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat &rgb_image, CLNF& cl
 				clnf_model.detected_landmarks = detected_landmarks_init.clone();
 				clnf_model.landmark_likelihoods = landmark_likelihoods_init.clone();
 
-				return false;
+				return RecordVideoDetectionResult(false);
 			}
 			else
 			{
 				clnf_model.failures_in_a_row = -1;			
+				clnf_model.last_face_box = clnf_model.GetBoundingBox();
+				clnf_model.last_face_rotation = cv::Vec3f(clnf_model.params_global[1], clnf_model.params_global[2], clnf_model.params_global[3]);
+
+				// The motion before the detection does not carry over to the new estimate
+				clnf_model.motion_predictor.Reset();
+				clnf_model.motion_predictor.Update(clnf_model.params_global, time_stamp);
 				
-				if(params.use_face_template)
+				if(params.use_face_template || params.adaptive_tracking)
 				{
-					UpdateTemplate(grayscale_image, clnf_model);
+					UpdateTemplate(grayscale_image, clnf_model, params, true);
 				}
 
-				return true;
+				if(params.full_fit_every > 1)
+				{
+					grayscale_image.copyTo(clnf_model.propagation_frame);
+				}
+
+				return RecordVideoDetectionResult(true);
 			}
 		}
 	}
@@ -389,7 +1126,7 @@ bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat &rgb_image, CLNF& cl
 		clnf_model.tracking_initialised = false;
 	}
 
-	return clnf_model.detection_success;
+	return RecordVideoDetectionResult(clnf_model.detection_success);
 	
 }
 
@@ -409,89 +1146,181 @@ bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat &rgb_image, const cv
 
 }
 
-//================================================================================================================
-// Landmark detection in image, need to provide an image and optionally CLNF model together with parameters (default values work well)
-// Optionally can provide a bounding box in which detection is performed (this is useful if multiple faces are to be detected in images)
-//================================================================================================================
-
-bool DetectLandmarksInImageMultiHypBasic(const cv::Mat_<uchar> &grayscale_image, vector<cv::Vec3d> rotation_hypotheses, const cv::Rect_<double> bounding_box, CLNF& clnf_model, FaceModelParameters& params)
+// Tracking of multiple faces in the same frame, the patch expert responses of all of the tracked models are computed together
+// Re-detection of lost faces is left to the caller (as multiple face tracking uses its own face detection)
+void LandmarkDetector::DetectLandmarksInVideo(const cv::Mat &rgb_image, vector<CLNF>& clnf_models, vector<FaceModelParameters>& params, const vector<bool>& active_models, cv::Mat &grayscale_image)
 {
+	vector<CLNF*> tracked_models;
+	vector<FaceModelParameters*> tracked_params;
 
-	// Use the initialisation size for the landmark detection
-	params.window_sizes_current = params.window_sizes_init;
+	for (size_t model = 0; model < clnf_models.size(); ++model)
+	{
+		if (active_models[model])
+		{
+			tracked_models.push_back(&clnf_models[model]);
+			tracked_params.push_back(&params[model]);
+		}
+	}
+
+	DetectLandmarksInVideo(rgb_image, tracked_models, tracked_params, grayscale_image);
+}
 
-	// Store the current best estimate
-	float best_likelihood;
-	float best_detection_certainty;
-	cv::Vec6f best_global_parameters;
-	cv::Mat_<float> best_local_parameters;
-	cv::Mat_<float> best_detected_landmarks;
-	cv::Mat_<float> best_landmark_likelihoods;
-	bool best_success;
+void LandmarkDetector::DetectLandmarksInVideo(const cv::Mat &rgb_image, const vector<CLNF*>& clnf_models, const vector<FaceModelParameters*>& params, cv::Mat &grayscale_image)
+{
+	if(grayscale_image.empty())
+	{
+		Utilities::ConvertToGrayscale_8bit(rgb_image, grayscale_image);
+	}
 
-	// The hierarchical model parameters
-	vector<float> best_likelihood_h(clnf_model.hierarchical_models.size());
-	vector<cv::Vec6f> best_global_parameters_h(clnf_model.hierarchical_models.size());
-	vector<cv::Mat_<float>> best_local_parameters_h(clnf_model.hierarchical_models.size());
-	vector<cv::Mat_<float>> best_detected_landmarks_h(clnf_model.hierarchical_models.size());
-	vector<cv::Mat_<float>> best_landmark_likelihoods_h(clnf_model.hierarchical_models.size());
+	vector<CLNF*> tracked_models;
+	vector<FaceModelParameters*> tracked_params;
 
-	for (size_t hypothesis = 0; hypothesis < rotation_hypotheses.size(); ++hypothesis)
+	for (size_t model = 0; model < clnf_models.size(); ++model)
 	{
-		// Reset the potentially set clnf_model parameters
-		clnf_model.params_local.setTo(0.0);
+		// Models that still need initialisation are dealt with separately
+		if (!clnf_models[model]->tracking_initialised)
+		{
+			DetectLandmarksInVideo(rgb_image, *clnf_models[model], *params[model], grayscale_image);
+			continue;
+		}
+
+		// The batched fit is on the full frame
+		SetWorkingLevel(*clnf_models[model], 0);
 
-		for (size_t part = 0; part < clnf_model.hierarchical_models.size(); ++part)
+		// The area of interest search size will depend if the previous track was successful
+		if (!clnf_models[model]->detection_success)
+		{
+			params[model]->window_sizes_current = params[model]->window_sizes_init;
+		}
+		else
 		{
-			clnf_model.hierarchical_models[part].params_local.setTo(0.0);
+			params[model]->window_sizes_current = params[model]->window_sizes_small;
 		}
 
-		// calculate the local and global parameters from the generated 2D shape (mapping from the 2D to 3D because camera params are unknown)
-		clnf_model.pdm.CalcParams(clnf_model.params_global, bounding_box, clnf_model.params_local, rotation_hypotheses[hypothesis]);
-	
-		bool success = clnf_model.DetectLandmarks(grayscale_image, params);	
+		// Before the expensive landmark detection step apply a quick template tracking approach
+		if (params[model]->use_face_template && !clnf_models[model]->face_template.empty() && clnf_models[model]->detection_success)
+		{
+			CorrectGlobalParametersVideo(grayscale_image, *clnf_models[model], *params[model]);
+		}
+
+		tracked_models.push_back(clnf_models[model]);
+		tracked_params.push_back(params[model]);
+	}
+
+	vector<bool> track_success;
+	CLNF::DetectLandmarksBatch(tracked_models, grayscale_image, tracked_params, track_success);
 
-		if (hypothesis == 0 || best_likelihood < clnf_model.model_likelihood)
+	for (size_t i = 0; i < tracked_models.size(); ++i)
+	{
+		if (!track_success[i])
 		{
-			best_likelihood = clnf_model.model_likelihood;
-			best_global_parameters = clnf_model.params_global;
-			best_local_parameters = clnf_model.params_local.clone();
-			best_detected_landmarks = clnf_model.detected_landmarks.clone();
-			best_landmark_likelihoods = clnf_model.landmark_likelihoods.clone();
-			best_detection_certainty = clnf_model.detection_certainty;
-			best_success = success;
-			
-			for (size_t part = 0; part < clnf_model.hierarchical_models.size(); ++part)
+			// Make a record that tracking failed
+			tracked_models[i]->failures_in_a_row++;
+		}
+		else
+		{
+			// indicate that tracking is a success
+			tracked_models[i]->failures_in_a_row = -1;
+
+			if (tracked_params[i]->use_face_template)
 			{
-				best_likelihood_h[part] = clnf_model.hierarchical_models[part].model_likelihood;
-				best_global_parameters_h[part] = clnf_model.hierarchical_models[part].params_global;
-				best_local_parameters_h[part] = clnf_model.hierarchical_models[part].params_local.clone();
-				best_detected_landmarks_h[part] = clnf_model.hierarchical_models[part].detected_landmarks.clone();
-				best_landmark_likelihoods_h[part] = clnf_model.hierarchical_models[part].landmark_likelihoods.clone();
+				UpdateTemplate(grayscale_image, *tracked_models[i], *tracked_params[i]);
 			}
 		}
 
+		// un-initialise the tracking
+		if (tracked_models[i]->failures_in_a_row > 100)
+		{
+			tracked_models[i]->tracking_initialised = false;
+		}
+	}
+}
+
+//================================================================================================================
+// Landmark detection in image, need to provide an image and optionally CLNF model together with parameters (default values work well)
+// Optionally can provide a bounding box in which detection is performed (this is useful if multiple faces are to be detected in images)
+//================================================================================================================
+
+// Zeroing the parameters of the parts, so that the refinement starts from the mean shape of every part
+static void ResetPartParameters(CLNF& model)
+{
+	for (size_t part = 0; part < model.hierarchical_models.size(); ++part)
+	{
+		model.hierarchical_models[part].params_local.setTo(0.0);
 	}
+}
 
-	// Store the best estimates in the clnf_model
-	clnf_model.model_likelihood = best_likelihood;
-	clnf_model.params_global = best_global_parameters;
-	clnf_model.params_local = best_local_parameters.clone();
-	clnf_model.detected_landmarks = best_detected_landmarks.clone();
-	clnf_model.detection_success = best_success;
-	clnf_model.landmark_likelihoods = best_landmark_likelihoods.clone();
-	clnf_model.detection_certainty = best_detection_certainty;
+// Setting up the fit of a rotation hypothesis from the mean shape in the bounding box
+static void InitialiseHypothesis(const CLNF& model, CLNF::FitState& state, const cv::Rect_<double>& bounding_box, const cv::Vec3d& rotation_hypothesis)
+{
+	state.params_local = cv::Mat_<float>::zeros(model.pdm.NumberOfModes(), 1);
 
-	for (size_t part = 0; part < clnf_model.hierarchical_models.size(); ++part)
+	// calculate the local and global parameters from the generated 2D shape (mapping from the 2D to 3D because camera params are unknown)
+	model.pdm.CalcParams(state.params_global, bounding_box, state.params_local, rotation_hypothesis);
+}
+
+// Running the task for every hypothesis, concurrently if the fits can share the model
+template <typename F> static void ForEachHypothesis(int count, bool concurrent, const F& task)
+{
+	if (concurrent)
+	{
+		tbb::parallel_for(0, count, task);
+	}
+	else
+	{
+		for (int hypothesis = 0; hypothesis < count; ++hypothesis)
+		{
+			task(hypothesis);
+		}
+	}
+}
+
+// The hypotheses are fit against the patch experts of the model (concurrently unless the experts keep state), every one only with its own
+// parameters and scratch memory, the most likely one is then refined and validated by the model
+// The hypothesis the result came from is returned in winner
+static bool DetectLandmarksInImageMultiHypBasic(ImageContext& image_context, vector<cv::Vec3d> rotation_hypotheses, const cv::Rect_<double> bounding_box, CLNF& clnf_model, FaceModelParameters& params,
+	int& winner)
+{
+
+	// Use the initialisation size for the landmark detection
+	params.window_sizes_current = params.window_sizes_init;
+
+	if (rotation_hypotheses.size() == 1)
+	{
+		winner = 0;
+
+		// Reset the potentially set clnf_model parameters
+		clnf_model.params_local.setTo(0.0);
+		ResetPartParameters(clnf_model);
+		clnf_model.pdm.CalcParams(clnf_model.params_global, bounding_box, clnf_model.params_local, rotation_hypotheses[0]);
+		return clnf_model.DetectLandmarks(image_context, params);
+	}
+
+	int num_hypotheses = (int)rotation_hypotheses.size();
+	bool concurrent = clnf_model.PrepareConcurrentFits(params.window_sizes_current, params);
+	vector<CLNF::FitState> fits(num_hypotheses);
+
+	ForEachHypothesis(num_hypotheses, concurrent, [&](int hypothesis)
+	{
+		InitialiseHypothesis(clnf_model, fits[hypothesis], bounding_box, rotation_hypotheses[hypothesis]);
+		clnf_model.FitConcurrent(image_context, fits[hypothesis], params.window_sizes_current, params);
+	});
+
+	// Pick the most likely one (the first one in case of ties)
+	int best = 0;
+	for (int hypothesis = 1; hypothesis < num_hypotheses; ++hypothesis)
 	{
-		clnf_model.hierarchical_models[part].params_global = best_global_parameters_h[part];
-		clnf_model.hierarchical_models[part].params_local = best_local_parameters_h[part].clone();
-		clnf_model.hierarchical_models[part].detected_landmarks = best_detected_landmarks_h[part].clone();
-		clnf_model.hierarchical_models[part].landmark_likelihoods = best_landmark_likelihoods_h[part].clone();
+		if (fits[best].model_likelihood < fits[hypothesis].model_likelihood)
+		{
+			best = hypothesis;
+		}
 	}
 
-	return best_success;
+	// Store the best estimates in the clnf_model
+	ResetPartParameters(clnf_model);
+	winner = best;
 
+	return clnf_model.CompleteFit(image_context, fits[best], params);
 
 }
 
@@ -509,15 +1338,17 @@ template <typename T> std::vector<size_t> sort_indexes(const vector<T> &v) {
 	return idx;
 }
 
-bool DetectLandmarksInImageMultiHypEarlyTerm(const cv::Mat_<uchar> &grayscale_image, vector<cv::Vec3d> rotation_hypotheses, const cv::Rect_<double> bounding_box, CLNF& clnf_model, FaceModelParameters& params)
+// The first scale of every hypothesis is fit (concurrently unless the patch experts keep state), the first hypothesis (in the given order) that
+// passes the early termination cutoff is completed and the ones after it are cancelled, otherwise the 3 most likely ones are completed. Only
+// the completed hypothesis that is kept is refined and validated by the model. The hypothesis the result came from is returned in winner
+static bool DetectLandmarksInImageMultiHypEarlyTerm(ImageContext& image_context, vector<cv::Vec3d> rotation_hypotheses, const cv::Rect_<double> bounding_box, CLNF& clnf_model, FaceModelParameters& params,
+	int& winner)
 {
 	FaceModelParameters old_params(params);
 	
 	// Use the initialisation size for the landmark detection
 	params.window_sizes_current = params.window_sizes_init;
 
-	bool early_term = false;
-
 	// Setup the parameters accordingly
 	// Only do the first iteration
 	for (size_t i = 1; i < params.window_sizes_current.size(); ++i)
@@ -527,142 +1358,91 @@ bool DetectLandmarksInImageMultiHypEarlyTerm(const cv::Mat_<uchar> &grayscale_im
 	params.refine_hierarchical = false;
 	params.validate_detections = false;
 
-	bool success = false;
+	// The parameters for completing a hypothesis
+	FaceModelParameters params_complete(params);
+	params_complete.window_sizes_current = params.window_sizes_init;
+	params_complete.window_sizes_current[0] = 0;
 
-	// Keeping track of converges
-	vector<float> likelihoods;
-	vector<cv::Vec6f> global_parameters;
-	vector<cv::Mat_<float>> local_parameters;
+	int num_hypotheses = (int)rotation_hypotheses.size();
+	bool concurrent = clnf_model.PrepareConcurrentFits(params.window_sizes_init, params);
+	vector<CLNF::FitState> fits(num_hypotheses);
+	vector<float> likelihoods(num_hypotheses, -std::numeric_limits<float>::max());
 
-	for (size_t hypothesis = 0; hypothesis < rotation_hypotheses.size(); ++hypothesis)
-	{
-		// Reset the potentially set clnf_model parameters
-		clnf_model.params_local.setTo(0.0);
+	const Patch_experts& experts = clnf_model.patch_experts;
+
+	// The first hypothesis that passed the cutoff, the ones after it do not need to be evaluated
+	std::atomic<int> first_accepted(num_hypotheses);
 
-		for (size_t part = 0; part < clnf_model.hierarchical_models.size(); ++part)
+	ForEachHypothesis(num_hypotheses, concurrent, [&](int hypothesis)
+	{
+		if (hypothesis > first_accepted)
 		{
-			clnf_model.hierarchical_models[part].params_local.setTo(0.0);
+			return;
 		}
 
-		// calculate the local and global parameters from the generated 2D shape (mapping from the 2D to 3D because camera params are unknown)
-		clnf_model.pdm.CalcParams(clnf_model.params_global, bounding_box, clnf_model.params_local, rotation_hypotheses[hypothesis]);
+		CLNF::FitState& fit = fits[hypothesis];
+		InitialiseHypothesis(clnf_model, fit, bounding_box, rotation_hypotheses[hypothesis]);
 
 		// Perform landmark detection in first scale
-		clnf_model.DetectLandmarks(grayscale_image, params);
+		clnf_model.FitConcurrent(image_context, fit, params.window_sizes_current, params);
 
-		float lhood = clnf_model.model_likelihood * clnf_model.patch_experts.early_term_weights[clnf_model.view_used] + clnf_model.patch_experts.early_term_biases[clnf_model.view_used];
+		likelihoods[hypothesis] = fit.model_likelihood * experts.early_term_weights[fit.view_used] + experts.early_term_biases[fit.view_used];
 
 		// If likelihood higher than cutoff continue on this model
-		if (lhood > clnf_model.patch_experts.early_term_cutoffs[clnf_model.view_used])
-		{
-			params.refine_hierarchical = old_params.refine_hierarchical;
-			params.window_sizes_current = params.window_sizes_init;
-			params.window_sizes_current[0] = 0;
-			params.validate_detections = old_params.validate_detections;
-			success = clnf_model.DetectLandmarks(grayscale_image, params);
-			early_term = true;
-			break;
-		}
-		else
+		if (likelihoods[hypothesis] > experts.early_term_cutoffs[fit.view_used])
 		{
-			likelihoods.push_back(lhood);
-			global_parameters.push_back(clnf_model.params_global);
-			local_parameters.push_back(clnf_model.params_local);
+			int current = first_accepted;
+			while (hypothesis < current && !first_accepted.compare_exchange_weak(current, hypothesis));
 		}
-	}
+	});
 
-
-	if (!early_term)
+	if (first_accepted < num_hypotheses)
+	{
+		winner = first_accepted;
+		clnf_model.FitConcurrent(image_context, fits[winner], params_complete.window_sizes_current, params_complete);
+	}
+	else
 	{
-
-		// Store the current best estimate
-		float best_likelihood;
-		cv::Vec6f best_global_parameters;
-		cv::Mat_<float> best_local_parameters;
-		cv::Mat_<float> best_detected_landmarks;
-		cv::Mat_<float> best_landmark_likelihoods;
-		bool best_success;
-
-		// The hierarchical model parameters
-		vector<float> best_likelihood_h(clnf_model.hierarchical_models.size());
-		vector<cv::Vec6f> best_global_parameters_h(clnf_model.hierarchical_models.size());
-		vector<cv::Mat_<float>> best_local_parameters_h(clnf_model.hierarchical_models.size());
-		vector<cv::Mat_<float>> best_detected_landmarks_h(clnf_model.hierarchical_models.size());
-		vector<cv::Mat_<float>> best_landmark_likelihoods_h(clnf_model.hierarchical_models.size());
-
 		// Sort the likelihoods and pick the best top 3 models
 		vector<size_t> indices = sort_indexes(likelihoods);
 
 		// Pick 3 best hypotheses and complete them
-		size_t max = indices.size() >= 3 ? 3 : indices.size();
-
-		params.refine_hierarchical = old_params.refine_hierarchical;
-		params.window_sizes_current = params.window_sizes_init;
-		params.window_sizes_current[0] = 0;
-		params.validate_detections = old_params.validate_detections;
+		int max = indices.size() >= 3 ? 3 : (int)indices.size();
 
-
-		for (size_t i = 0; i < max; ++i)
+		ForEachHypothesis(max, concurrent, [&](int i)
 		{
-			// Reset the potentially set clnf_model parameters
-			clnf_model.params_local = local_parameters[indices[i]];
-			clnf_model.params_global = global_parameters[indices[i]];
-			for (size_t part = 0; part < clnf_model.hierarchical_models.size(); ++part)
-			{
-				clnf_model.hierarchical_models[part].params_local.setTo(0.0);
-			}
-	
-			// Perform landmark detection in first scale
-			success = clnf_model.DetectLandmarks(grayscale_image, params);
+			clnf_model.FitConcurrent(image_context, fits[indices[i]], params_complete.window_sizes_current, params_complete);
+		});
 
-			if (i == 0 || best_likelihood < clnf_model.model_likelihood)
+		int best = 0;
+		for (int i = 1; i < max; ++i)
+		{
+			if (fits[indices[best]].model_likelihood < fits[indices[i]].model_likelihood)
 			{
-				best_likelihood = clnf_model.model_likelihood;
-				best_global_parameters = clnf_model.params_global;
-				best_local_parameters = clnf_model.params_local.clone();
-				best_detected_landmarks = clnf_model.detected_landmarks.clone();
-				best_landmark_likelihoods = clnf_model.landmark_likelihoods.clone();
-				best_success = success;
-
-				for (size_t part = 0; part < clnf_model.hierarchical_models.size(); ++part)
-				{
-					best_likelihood_h[part] = clnf_model.hierarchical_models[part].model_likelihood;
-					best_global_parameters_h[part] = clnf_model.hierarchical_models[part].params_global;
-					best_local_parameters_h[part] = clnf_model.hierarchical_models[part].params_local.clone();
-					best_detected_landmarks_h[part] = clnf_model.hierarchical_models[part].detected_landmarks.clone();
-					best_landmark_likelihoods_h[part] = clnf_model.hierarchical_models[part].landmark_likelihoods.clone();
-				}
+				best = i;
 			}
-
 		}
-
-		// Store the best estimates in the clnf_model
-		clnf_model.model_likelihood = best_likelihood;
-		clnf_model.params_global = best_global_parameters;
-		clnf_model.params_local = best_local_parameters.clone();
-		clnf_model.detected_landmarks = best_detected_landmarks.clone();
-		clnf_model.detection_success = best_success;
-		clnf_model.landmark_likelihoods = best_landmark_likelihoods.clone();
-
-		for (size_t part = 0; part < clnf_model.hierarchical_models.size(); ++part)
-		{
-			clnf_model.hierarchical_models[part].params_global = best_global_parameters_h[part];
-			clnf_model.hierarchical_models[part].params_local = best_local_parameters_h[part].clone();
-			clnf_model.hierarchical_models[part].detected_landmarks = best_detected_landmarks_h[part].clone();
-			clnf_model.hierarchical_models[part].landmark_likelihoods = best_landmark_likelihoods_h[part].clone();
-		}
-
+		winner = (int)indices[best];
 	}
 
 	params = old_params;
 
-	return success;
+	// Store the best estimates in the clnf_model
+	ResetPartParameters(clnf_model);
+
+	return clnf_model.CompleteFit(image_context, fits[winner], params);
 
 }
 
 
 // This is the one where the actual work gets done, other DetectLandmarksInImage calls lead to this one
 bool LandmarkDetector::DetectLandmarksInImage(const cv::Mat &rgb_image, const cv::Rect_<double> bounding_box, CLNF& clnf_model, FaceModelParameters& params, cv::Mat &grayscale_image)
+{
+	return DetectLandmarksInImage(rgb_image, bounding_box, vector<cv::Point2f>(), clnf_model, params, grayscale_image);
+}
+
+bool LandmarkDetector::DetectLandmarksInImage(const cv::Mat &rgb_image, const cv::Rect_<double> bounding_box, const vector<cv::Point2f>& keypoints, CLNF& clnf_model,
+	FaceModelParameters& params, cv::Mat &grayscale_image)
 {
 
 	if (grayscale_image.empty())
@@ -670,6 +1450,98 @@ bool LandmarkDetector::DetectLandmarksInImage(const cv::Mat &rgb_image, const cv
 		Utilities::ConvertToGrayscale_8bit(rgb_image, grayscale_image);
 	}
 
+	ImageContext image_context((cv::Mat_<uchar>)grayscale_image);
+	return DetectLandmarksInImageContext(image_context, bounding_box, clnf_model, params, keypoints);
+}
+
+bool LandmarkDetector::EstimateRotationFromKeypoints(const PDM& pdm, const vector<cv::Point2f>& keypoints, cv::Vec3d& rotation)
+{
+	int n = pdm.NumberOfPoints();
+	if (n != 68 || keypoints.size() != 5)
+	{
+		return false;
+	}
+
+	// The model points corresponding to the keypoints: the eye centres (the eye on the left of the image first), the nose tip and the mouth corners
+	cv::Matx<float, 5, 3> model_points = cv::Matx<float, 5, 3>::zeros();
+	const int eye_starts[2] = { 36, 42 };
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		for (int i = eye_starts[eye]; i < eye_starts[eye] + 6; ++i)
+		{
+			for (int d = 0; d < 3; ++d)
+			{
+				model_points(eye, d) += pdm.mean_shape.at<float>(i + d * n) / 6.0f;
+			}
+		}
+	}
+	const int single_points[3] = { 30, 48, 54 };
+	for (int k = 0; k < 3; ++k)
+	{
+		for (int d = 0; d < 3; ++d)
+		{
+			model_points(2 + k, d) = pdm.mean_shape.at<float>(single_points[k] + d * n);
+		}
+	}
+
+	cv::Point2f keypoints_mean(0, 0);
+	for (size_t k = 0; k < 5; ++k)
+	{
+		keypoints_mean += keypoints[k] * 0.2f;
+	}
+
+	// The rotations are searched over a grid, for every one the projected model points are aligned to the keypoints (with a scale and a
+	// translation) and the one with the smallest error is kept, the fitting only needs the rough orientation
+	float best_error = std::numeric_limits<float>::max();
+	for (int yaw_step = -14; yaw_step <= 14; ++yaw_step)
+	{
+		for (int roll_step = -8; roll_step <= 8; ++roll_step)
+		{
+			cv::Vec3f candidate(0.0f, yaw_step * 0.1f, roll_step * 0.1f);
+			cv::Matx33f R = Utilities::Euler2RotationMatrix(candidate);
+
+			cv::Point2f projected[5];
+			cv::Point2f projected_mean(0, 0);
+			for (int k = 0; k < 5; ++k)
+			{
+				cv::Vec3f rotated = R * cv::Vec3f(model_points(k, 0), model_points(k, 1), model_points(k, 2));
+				projected[k] = cv::Point2f(rotated[0], rotated[1]);
+				projected_mean += projected[k] * 0.2f;
+			}
+
+			float dot = 0, norm = 0;
+			for (int k = 0; k < 5; ++k)
+			{
+				cv::Point2f p = projected[k] - projected_mean;
+				dot += p.dot(keypoints[k] - keypoints_mean);
+				norm += p.dot(p);
+			}
+			if (norm <= 0 || dot <= 0)
+				continue;
+
+			float scale = dot / norm;
+			float error = 0;
+			for (int k = 0; k < 5; ++k)
+			{
+				cv::Point2f diff = (projected[k] - projected_mean) * scale - (keypoints[k] - keypoints_mean);
+				error += diff.dot(diff);
+			}
+
+			if (error < best_error)
+			{
+				best_error = error;
+				rotation = cv::Vec3d(candidate[0], candidate[1], candidate[2]);
+			}
+		}
+	}
+
+	return best_error < std::numeric_limits<float>::max();
+}
+
+// The landmark detection in an image from a bounding box, on a frame that can be shared with the other users of it
+static bool DetectLandmarksInImageContext(ImageContext& image_context, const cv::Rect_<double> bounding_box, CLNF& clnf_model, FaceModelParameters& params,
+	const vector<cv::Point2f>& keypoints)
+{
 	// Can have multiple hypotheses
 	vector<cv::Vec3d> rotation_hypotheses;
 
@@ -694,17 +1566,109 @@ bool LandmarkDetector::DetectLandmarksInImage(const cv::Mat &rgb_image, const cv
 		// Assume the face is close to frontal
 		rotation_hypotheses.push_back(cv::Vec3d(0,0,0));
 	}
+
+	// Which of the hypotheses above every hypothesis tried is (-1 for the one estimated from the keypoints), for keeping the statistics of the wins
+	const int num_views = (int)rotation_hypotheses.size();
+	vector<int> hypothesis_ids(num_views);
+	std::iota(hypothesis_ids.begin(), hypothesis_ids.end(), 0);
+
+	// The rotation the face most likely has, the hypotheses closest to it are tried first
+	bool has_prior = false;
+	cv::Vec3d prior_rotation;
+
+	// With the orientation known from the keypoints only it is tried, along with the hypotheses close to it when considering multiple views
+	cv::Vec3d keypoint_rotation;
+	if (EstimateRotationFromKeypoints(clnf_model.pdm, keypoints, keypoint_rotation))
+	{
+		vector<cv::Vec3d> pruned_hypotheses(1, keypoint_rotation);
+		vector<int> pruned_ids(1, -1);
+		for (size_t i = 0; params.multi_view && i < rotation_hypotheses.size(); ++i)
+		{
+			if (std::abs(rotation_hypotheses[i][1] - keypoint_rotation[1]) < 0.6 && std::abs(rotation_hypotheses[i][2] - keypoint_rotation[2]) < 0.6)
+			{
+				pruned_hypotheses.push_back(rotation_hypotheses[i]);
+				pruned_ids.push_back(hypothesis_ids[i]);
+			}
+		}
+		if (pruned_hypotheses.size() < rotation_hypotheses.size())
+		{
+			static Utilities::Metrics::Counter& pruned = Utilities::Metrics::GetRegistry().GetCounter("openface_rotation_hypotheses_pruned_total",
+				"Rotation hypotheses not fit as the orientation was estimated from the face detection keypoints");
+			pruned.Increment(rotation_hypotheses.size() - pruned_hypotheses.size());
+		}
+		rotation_hypotheses.swap(pruned_hypotheses);
+		hypothesis_ids.swap(pruned_ids);
+
+		has_prior = true;
+		prior_rotation = keypoint_rotation;
+	}
+	else if (clnf_model.last_face_box.width > 0)
+	{
+		// Re-initialising a face that was tracked before
+		has_prior = true;
+		prior_rotation = cv::Vec3d(clnf_model.last_face_rotation[0], clnf_model.last_face_rotation[1], clnf_model.last_face_rotation[2]);
+	}
+
+	// The early termination keeps the first hypothesis passing its cutoff, so the likely ones go first: the closest ones to the prior rotation,
+	// or without one those that won most often so far (the order is kept otherwise)
+	if (rotation_hypotheses.size() > 1)
+	{
+		clnf_model.rotation_hypothesis_wins.resize(num_views, 0);
+		const vector<int>& wins = clnf_model.rotation_hypothesis_wins;
+
+		vector<double> distances(rotation_hypotheses.size(), 0.0);
+		for (size_t i = 0; has_prior && i < rotation_hypotheses.size(); ++i)
+		{
+			distances[i] = cv::norm(rotation_hypotheses[i] - prior_rotation);
+		}
+
+		vector<size_t> order(rotation_hypotheses.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+		{
+			if (distances[a] != distances[b])
+				return distances[a] < distances[b];
+			int wins_a = hypothesis_ids[a] >= 0 ? wins[hypothesis_ids[a]] : 0;
+			int wins_b = hypothesis_ids[b] >= 0 ? wins[hypothesis_ids[b]] : 0;
+			return wins_a > wins_b;
+		});
+
+		vector<cv::Vec3d> ordered_hypotheses(order.size());
+		vector<int> ordered_ids(order.size());
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			ordered_hypotheses[i] = rotation_hypotheses[order[i]];
+			ordered_ids[i] = hypothesis_ids[order[i]];
+		}
+		rotation_hypotheses.swap(ordered_hypotheses);
+		hypothesis_ids.swap(ordered_ids);
+	}
 	
 	bool success;
+	int winner = 0;
 
 	// Either use basic multi-hypothesis testing or clever testing if early termination parameters are present
 	if(clnf_model.patch_experts.early_term_biases.size() == 0)
 	{
-		success = DetectLandmarksInImageMultiHypBasic(grayscale_image, rotation_hypotheses, bounding_box, clnf_model, params);
+		success = DetectLandmarksInImageMultiHypBasic(image_context, rotation_hypotheses, bounding_box, clnf_model, params, winner);
 	}
 	else
 	{
-		success = DetectLandmarksInImageMultiHypEarlyTerm(grayscale_image, rotation_hypotheses, bounding_box, clnf_model, params);
+		success = DetectLandmarksInImageMultiHypEarlyTerm(image_context, rotation_hypotheses, bounding_box, clnf_model, params, winner);
+	}
+
+	// Keeping the statistics of the wins of the session
+	if (success && rotation_hypotheses.size() > 1)
+	{
+		if (hypothesis_ids[winner] >= 0)
+		{
+			clnf_model.rotation_hypothesis_wins[hypothesis_ids[winner]]++;
+		}
+		if (winner == 0)
+		{
+			METRICS_INCREMENT("openface_rotation_hypotheses_first_wins_total", "Multi-hypothesis fits given by the first rotation hypothesis tried");
+		}
+		METRICS_INCREMENT("openface_rotation_hypotheses_fits_total", "Successful multi-hypothesis fits");
 	}
 	return success;
 }
@@ -717,30 +1681,20 @@ bool LandmarkDetector::DetectLandmarksInImage(const cv::Mat &rgb_image, CLNF& cl
 	}
 
 	cv::Rect_<float> bounding_box;
+	vector<cv::Point2f> keypoints;
 
 	// If the face detector has not been initialised read it in
-	if(clnf_model.face_detector_HAAR.empty() && params.curr_face_detector == FaceModelParameters::HAAR_DETECTOR)
-	{
-		clnf_model.face_detector_HAAR.load(params.haar_face_detector_location);
-		clnf_model.haar_face_detector_location = params.haar_face_detector_location;
-	}
-	
-	if (clnf_model.face_detector_MTCNN.empty() && params.curr_face_detector == FaceModelParameters::MTCNN_DETECTOR)
-	{
-		clnf_model.face_detector_MTCNN.Read(params.mtcnn_face_detector_location);
-		clnf_model.mtcnn_face_detector_location = params.mtcnn_face_detector_location;
-
-		// If the model is still empty default to HOG
-		if (clnf_model.face_detector_MTCNN.empty())
-		{
-			cout << "INFO: defaulting to HOG-SVM face detector" << endl;
-			params.curr_face_detector = LandmarkDetector::FaceModelParameters::HOG_SVM_DETECTOR;
-		}
-
-	}
+	ReadFaceDetector(clnf_model, params, false);
 
 	// Detect the face first
-	if(params.curr_face_detector == FaceModelParameters::HOG_SVM_DETECTOR)
+	if (clnf_model.face_detector_plugin)
+	{
+		float confidence;
+		ImageContext image_context(rgb_image, grayscale_image);
+		LandmarkDetector::DetectSingleFacePlugin(bounding_box, image_context, *clnf_model.face_detector_plugin, confidence);
+	}
+#ifndef OPENFACE_SLIM_LANDMARK_DETECTOR
+	else if(params.curr_face_detector == FaceModelParameters::HOG_SVM_DETECTOR)
 	{
 		float confidence;
 		LandmarkDetector::DetectSingleFaceHOG(bounding_box, grayscale_image, clnf_model.face_detector_HOG, confidence);
@@ -749,10 +1703,12 @@ bool LandmarkDetector::DetectLandmarksInImage(const cv::Mat &rgb_image, CLNF& cl
 	{
 		LandmarkDetector::DetectSingleFace(bounding_box, rgb_image, clnf_model.face_detector_HAAR);
 	}
-	else if (params.curr_face_detector == FaceModelParameters::MTCNN_DETECTOR)
+#endif
+	else if (params.curr_face_detector == FaceModelParameters::MTCNN_DETECTOR && !clnf_model.face_detector_MTCNN.empty())
 	{
 		float confidence;
-		LandmarkDetector::DetectSingleFaceMTCNN(bounding_box, rgb_image, clnf_model.face_detector_MTCNN, confidence);
+		ImageContext image_context(rgb_image, cv::Mat_<uchar>());
+		LandmarkDetector::DetectSingleFaceMTCNN(bounding_box, keypoints, image_context, clnf_model.face_detector_MTCNN, confidence);
 	}
 
 	if(bounding_box.width == 0)
@@ -761,6 +1717,6 @@ bool LandmarkDetector::DetectLandmarksInImage(const cv::Mat &rgb_image, CLNF& cl
 	}
 	else
 	{
-		return DetectLandmarksInImage(rgb_image, bounding_box, clnf_model, params, grayscale_image);
+		return DetectLandmarksInImage(rgb_image, bounding_box, keypoints, clnf_model, params, grayscale_image);
 	}
 }
@@ -43,12 +43,136 @@
 // TBB includes
 #include <tbb/tbb.h>
 
+// OpenCV includes
+#include <opencv2/core/hal/intrin.hpp>
+
 // Local includes
+#include <CpuDispatch.h>
 #include <LandmarkDetectorUtils.h>
+#include <MemoryReport.h>
 #include <RotationHelpers.h>
+#include <Tracing.h>
+#include <Metrics.h>
 
 using namespace LandmarkDetector;
 
+//=============================================================================
+// The motion model of the rigid parameters
+
+// How much of a new velocity measurement gets into the smoothed velocity
+static const float MOTION_VELOCITY_SMOOTHING = 0.5f;
+
+// Not predicting over gaps much longer than the last frame interval (e.g. dropped frames), the velocity will not hold over them
+static const double MOTION_MAX_STEP_RATIO = 4.0;
+
+// The Gauss-Newton iterations allowed when fitting the hierarchical part (and merged main) parameters from a previous fit, before falling
+// back to a fit from scratch
+static const int PART_WARM_START_ITERATIONS = 5;
+
+// The frames in a row a patch expert response can be reused for before it is computed again, and how much the scale (relative) and the
+// rotation (in radians) of the face can change for it to be reused
+static const int RESPONSE_REUSE_MAX_AGE = 3;
+static const float RESPONSE_REUSE_MAX_SCALE_CHANGE = 0.01f;
+static const float RESPONSE_REUSE_MAX_ROTATION_CHANGE = 0.02f;
+
+//=============================================================================
+// Binary (native endianness) serialisation of the tracking state, see CLNF::WriteState
+
+template<typename T>
+static void WriteStateValue(std::ostream& stream, const T& value)
+{
+	stream.write((const char*)&value, sizeof(T));
+}
+
+template<typename T>
+static bool ReadStateValue(std::istream& stream, T& value)
+{
+	return (bool)stream.read((char*)&value, sizeof(T));
+}
+
+static void WriteStateMat(std::ostream& stream, const cv::Mat& mat)
+{
+	cv::Mat continuous = mat.isContinuous() ? mat : mat.clone();
+	WriteStateValue<int32_t>(stream, continuous.rows);
+	WriteStateValue<int32_t>(stream, continuous.cols);
+	WriteStateValue<int32_t>(stream, continuous.type());
+	stream.write((const char*)continuous.data, continuous.total() * continuous.elemSize());
+}
+
+template<typename T>
+static bool ReadStateMat(std::istream& stream, cv::Mat_<T>& mat)
+{
+	int32_t rows, cols, type;
+	if (!ReadStateValue(stream, rows) || !ReadStateValue(stream, cols) || !ReadStateValue(stream, type) || rows < 0 || cols < 0 ||
+		(rows * cols > 0 && type != cv::DataType<T>::type))
+	{
+		return false;
+	}
+	mat.create(rows, cols);
+	return (bool)stream.read((char*)mat.data, mat.total() * mat.elemSize());
+}
+
+void RigidMotionPredictor::Reset()
+{
+	num_updates = 0;
+	last_params = cv::Vec6f(1, 0, 0, 0, 0, 0);
+	last_time = 0;
+	last_step = 1;
+	velocity = cv::Vec6f(0, 0, 0, 0, 0, 0);
+}
+
+double RigidMotionPredictor::FrameStep(double time_stamp) const
+{
+	return time_stamp > last_time ? time_stamp - last_time : last_step;
+}
+
+void RigidMotionPredictor::Update(const cv::Vec6f& params_global, double time_stamp)
+{
+	if (num_updates > 0)
+	{
+		double step = FrameStep(time_stamp);
+		cv::Vec6f measured_velocity = (params_global - last_params) * (float)(1.0 / step);
+
+		if (num_updates == 1)
+		{
+			velocity = measured_velocity;
+		}
+		else
+		{
+			velocity = velocity * (1.0f - MOTION_VELOCITY_SMOOTHING) + measured_velocity * MOTION_VELOCITY_SMOOTHING;
+		}
+
+		last_time = time_stamp > last_time ? time_stamp : last_time + step;
+		last_step = step;
+	}
+	else
+	{
+		last_time = time_stamp;
+	}
+
+	last_params = params_global;
+	num_updates++;
+}
+
+bool RigidMotionPredictor::Predict(double time_stamp, float damping, cv::Vec6f& params_global) const
+{
+	if (num_updates < 2)
+		return false;
+
+	double step = FrameStep(time_stamp);
+	if (step > MOTION_MAX_STEP_RATIO * last_step)
+		return false;
+
+	params_global = last_params + velocity * (float)(step * damping);
+
+	// The scale can not be extrapolated through zero
+	if (params_global[0] <= 0)
+	{
+		params_global[0] = last_params[0];
+	}
+	return true;
+}
+
 //=============================================================================
 //=============================================================================
 
@@ -65,53 +189,71 @@ CLNF::CLNF()
 }
 
 // Constructor from a model file
-CLNF::CLNF(string fname)
+CLNF::CLNF(string fname, bool local_model_copy)
 {
 	// A successful read wil set this to true
 	loaded_successfully = false;
 
-	this->Read(fname);
+	this->Read(fname, local_model_copy);
 }
 
-// Copy constructor (makes a deep copy of CLNF)
+// Copy constructor (copies the tracking state, while the read only model weights are shared between the copies)
 CLNF::CLNF(const CLNF& other): pdm(other.pdm), params_local(other.params_local.clone()), params_global(other.params_global), detected_landmarks(other.detected_landmarks.clone()),
-	landmark_likelihoods(other.landmark_likelihoods.clone()), patch_experts(other.patch_experts), landmark_validator(other.landmark_validator), haar_face_detector_location(other.haar_face_detector_location),
+	landmark_likelihoods(other.landmark_likelihoods.clone()), patch_experts(other.patch_experts), landmark_validator(other.landmark_validator),
 	mtcnn_face_detector_location(other.mtcnn_face_detector_location), hierarchical_mapping(other.hierarchical_mapping), hierarchical_models(other.hierarchical_models), hierarchical_model_names(other.hierarchical_model_names),
-	hierarchical_params(other.hierarchical_params), eye_model(other.eye_model), face_detector_MTCNN(other.face_detector_MTCNN), preference_det(other.preference_det), loaded_successfully(other.loaded_successfully)
+	hierarchical_params(other.hierarchical_params), hierarchical_part_valid(other.hierarchical_part_valid), eye_model(other.eye_model), face_detector_MTCNN(other.face_detector_MTCNN), face_detector_plugin(other.face_detector_plugin), preference_det(other.preference_det), loaded_successfully(other.loaded_successfully)
 {
 	this->detection_success = other.detection_success;
 	this->tracking_initialised = other.tracking_initialised;
 	this->detection_certainty = other.detection_certainty;
 	this->model_likelihood = other.model_likelihood;
 	this->failures_in_a_row = other.failures_in_a_row;
-
+	this->frame_result = FrameResult();
+	this->frames_since_full_fit = other.frames_since_full_fit;
+	this->frames_since_validation = other.frames_since_validation;
+	this->validated_likelihood = other.validated_likelihood;
+	this->last_face_box = other.last_face_box;
+	this->last_face_rotation = other.last_face_rotation;
+	this->rotation_hypothesis_wins = other.rotation_hypothesis_wins;
+	this->roi_detection_misses = other.roi_detection_misses;
+	this->motion_predictor = other.motion_predictor;
+	this->face_template_scaling = other.face_template_scaling;
+	this->face_template_correlation = other.face_template_correlation;
+	this->face_template_age = other.face_template_age;
+	this->scene_histogram = other.scene_histogram.clone();
+	this->working_level = other.working_level;
+	this->deadline_degradations = other.deadline_degradations;
+	this->deadline_set = false;
+	this->scale_time_estimates = other.scale_time_estimates;
+	this->refinement_time_estimate = other.refinement_time_estimate;
+	this->validation_time_estimate = other.validation_time_estimate;
+
+#ifndef OPENFACE_SLIM_LANDMARK_DETECTOR
 	// Load the CascadeClassifier (as it does not have a proper copy constructor)
+	this->haar_face_detector_location = other.haar_face_detector_location;
 	if(!haar_face_detector_location.empty())
 	{
 		this->face_detector_HAAR.load(haar_face_detector_location);
 	}
-	// Make sure the matrices are allocated properly
-	this->triangulations.resize(other.triangulations.size());
-	for(size_t i = 0; i < other.triangulations.size(); ++i)
-	{
-		// Make sure the matrix is copied.
-		this->triangulations[i] = other.triangulations[i].clone();
-	}
-
-	// Make sure the matrices are allocated properly
-	for(std::map<int, cv::Mat_<float>>::const_iterator it = other.kde_resp_precalc.begin(); it!= other.kde_resp_precalc.end(); it++)
-	{
-		// Make sure the matrix is copied.
-		this->kde_resp_precalc.insert(std::pair<int, cv::Mat_<float>>(it->first, it->second.clone()));
-	}
+	this->face_detector_HAAR_frame = other.face_detector_HAAR_frame;
+#endif
+	// The triangulations and precalculated KDE responses are not modified after creation, so they can be shared
+	this->triangulations = other.triangulations;
+	this->kde_resp_precalc = other.kde_resp_precalc;
+	// The bundle the model weights point to (if loaded from one) is shared between the copies
+	this->model_bundle = other.model_bundle;
+	this->clnf_location = other.clnf_location;
 
 }
 
-// Assignment operator for lvalues (makes a deep copy of CLNF)
+// Assignment operator for lvalues (copies the tracking state, while the read only model weights are shared)
 CLNF & CLNF::operator= (const CLNF& other)
 {
 	if (this != &other) // protect against invalid self-assignment
 	{
+		// The background detection uses the detectors that are replaced
+		async_face_detector.Cancel();
+
 		pdm = PDM(other.pdm);
 		params_local = other.params_local.clone();
 		params_global = other.params_global;
@@ -120,44 +262,61 @@ CLNF & CLNF::operator= (const CLNF& other)
 		landmark_likelihoods =other.landmark_likelihoods.clone();
 		patch_experts = Patch_experts(other.patch_experts);
 		landmark_validator = DetectionValidator(other.landmark_validator);
-		haar_face_detector_location = other.haar_face_detector_location;
 		mtcnn_face_detector_location = other.mtcnn_face_detector_location;
+		face_detector_plugin = other.face_detector_plugin;
 
 		this->detection_success = other.detection_success;
 		this->tracking_initialised = other.tracking_initialised;
 		this->detection_certainty = other.detection_certainty;
 		this->model_likelihood = other.model_likelihood;
 		this->failures_in_a_row = other.failures_in_a_row;
+		this->frame_result = FrameResult();
+		this->frames_since_full_fit = other.frames_since_full_fit;
+		this->frames_since_validation = other.frames_since_validation;
+		this->validated_likelihood = other.validated_likelihood;
+		this->last_face_box = other.last_face_box;
+		this->last_face_rotation = other.last_face_rotation;
+		this->rotation_hypothesis_wins = other.rotation_hypothesis_wins;
+		this->roi_detection_misses = other.roi_detection_misses;
+		this->motion_predictor = other.motion_predictor;
+		this->face_template_scaling = other.face_template_scaling;
+		this->face_template_correlation = other.face_template_correlation;
+		this->face_template_age = other.face_template_age;
+		this->scene_histogram = other.scene_histogram.clone();
+		this->working_level = other.working_level;
+		this->deadline_degradations = other.deadline_degradations;
+		this->deadline_set = false;
+		this->scale_time_estimates = other.scale_time_estimates;
+		this->refinement_time_estimate = other.refinement_time_estimate;
+		this->validation_time_estimate = other.validation_time_estimate;
 
 		this->eye_model = other.eye_model;
 		
 		this->preference_det = other.preference_det;
 
+#ifndef OPENFACE_SLIM_LANDMARK_DETECTOR
 		// Load the CascadeClassifier (as it does not have a proper copy constructor)
+		haar_face_detector_location = other.haar_face_detector_location;
 		if(!haar_face_detector_location.empty())
 		{
 			this->face_detector_HAAR.load(haar_face_detector_location);
 		}
-		// Make sure the matrices are allocated properly
-		this->triangulations.resize(other.triangulations.size());
-		for(size_t i = 0; i < other.triangulations.size(); ++i)
-		{
-			// Make sure the matrix is copied.
-			this->triangulations[i] = other.triangulations[i].clone();
-		}
-
-		// Make sure the matrices are allocated properly
-		for(std::map<int, cv::Mat_<float>>::const_iterator it = other.kde_resp_precalc.begin(); it!= other.kde_resp_precalc.end(); it++)
-		{
-			// Make sure the matrix is copied.
-			this->kde_resp_precalc.insert(std::pair<int, cv::Mat_<float>>(it->first, it->second.clone()));
-		}
+		this->face_detector_HAAR_frame = other.face_detector_HAAR_frame;
+#endif
+		// The triangulations and precalculated KDE responses are not modified after creation, so they can be shared
+		this->triangulations = other.triangulations;
+		this->kde_resp_precalc = other.kde_resp_precalc;
+		// The bundle the model weights point to (if loaded from one) is shared between the copies
+		this->model_bundle = other.model_bundle;
+		this->clnf_location = other.clnf_location;
 
 		// Copy over the hierarchical models
 		this->hierarchical_mapping = other.hierarchical_mapping;
 		this->hierarchical_models = other.hierarchical_models;
 		this->hierarchical_model_names = other.hierarchical_model_names;
 		this->hierarchical_params = other.hierarchical_params;
+	this->hierarchical_part_valid = other.hierarchical_part_valid;
+		this->hierarchical_part_valid = other.hierarchical_part_valid;
 
 		mtcnn_face_detector_location = other.mtcnn_face_detector_location;
 		face_detector_MTCNN = other.face_detector_MTCNN;
@@ -176,6 +335,25 @@ CLNF::CLNF(const CLNF&& other)
 	this->detection_certainty = other.detection_certainty;
 	this->model_likelihood = other.model_likelihood;
 	this->failures_in_a_row = other.failures_in_a_row;
+	this->frame_result = FrameResult();
+	this->frames_since_full_fit = other.frames_since_full_fit;
+	this->frames_since_validation = other.frames_since_validation;
+	this->validated_likelihood = other.validated_likelihood;
+	this->last_face_box = other.last_face_box;
+	this->last_face_rotation = other.last_face_rotation;
+	this->rotation_hypothesis_wins = other.rotation_hypothesis_wins;
+	this->roi_detection_misses = other.roi_detection_misses;
+	this->motion_predictor = other.motion_predictor;
+	this->face_template_scaling = other.face_template_scaling;
+	this->face_template_correlation = other.face_template_correlation;
+	this->face_template_age = other.face_template_age;
+	this->scene_histogram = other.scene_histogram.clone();
+	this->working_level = other.working_level;
+	this->deadline_degradations = other.deadline_degradations;
+	this->deadline_set = false;
+	this->scale_time_estimates = other.scale_time_estimates;
+	this->refinement_time_estimate = other.refinement_time_estimate;
+	this->validation_time_estimate = other.validation_time_estimate;
 
 	pdm = other.pdm;
 	params_local = other.params_local;
@@ -184,13 +362,20 @@ CLNF::CLNF(const CLNF&& other)
 	landmark_likelihoods = other.landmark_likelihoods;
 	patch_experts = other.patch_experts;
 	landmark_validator = other.landmark_validator;
-	haar_face_detector_location = other.haar_face_detector_location;
 	mtcnn_face_detector_location = other.mtcnn_face_detector_location;
+	face_detector_plugin = other.face_detector_plugin;
 
+#ifndef OPENFACE_SLIM_LANDMARK_DETECTOR
+	haar_face_detector_location = other.haar_face_detector_location;
 	face_detector_HAAR = other.face_detector_HAAR;
+	face_detector_HAAR_frame = other.face_detector_HAAR_frame;
+#endif
 
 	triangulations = other.triangulations;
 	kde_resp_precalc = other.kde_resp_precalc;
+	// The bundle the model weights point to (if loaded from one) is shared between the copies
+	model_bundle = other.model_bundle;
+	clnf_location = other.clnf_location;
 
 	face_detector_MTCNN = other.face_detector_MTCNN;
 
@@ -199,6 +384,7 @@ CLNF::CLNF(const CLNF&& other)
 	this->hierarchical_models = other.hierarchical_models;
 	this->hierarchical_model_names = other.hierarchical_model_names;
 	this->hierarchical_params = other.hierarchical_params;
+	this->hierarchical_part_valid = other.hierarchical_part_valid;
 
 	this->eye_model = other.eye_model;
 
@@ -211,11 +397,32 @@ CLNF::CLNF(const CLNF&& other)
 // Assignment operator for rvalues
 CLNF & CLNF::operator= (const CLNF&& other)
 {
+	async_face_detector.Cancel();
+
 	this->detection_success = other.detection_success;
 	this->tracking_initialised = other.tracking_initialised;
 	this->detection_certainty = other.detection_certainty;
 	this->model_likelihood = other.model_likelihood;
 	this->failures_in_a_row = other.failures_in_a_row;
+	this->frame_result = FrameResult();
+	this->frames_since_full_fit = other.frames_since_full_fit;
+	this->frames_since_validation = other.frames_since_validation;
+	this->validated_likelihood = other.validated_likelihood;
+	this->last_face_box = other.last_face_box;
+	this->last_face_rotation = other.last_face_rotation;
+	this->rotation_hypothesis_wins = other.rotation_hypothesis_wins;
+	this->roi_detection_misses = other.roi_detection_misses;
+	this->motion_predictor = other.motion_predictor;
+	this->face_template_scaling = other.face_template_scaling;
+	this->face_template_correlation = other.face_template_correlation;
+	this->face_template_age = other.face_template_age;
+	this->scene_histogram = other.scene_histogram.clone();
+	this->working_level = other.working_level;
+	this->deadline_degradations = other.deadline_degradations;
+	this->deadline_set = false;
+	this->scale_time_estimates = other.scale_time_estimates;
+	this->refinement_time_estimate = other.refinement_time_estimate;
+	this->validation_time_estimate = other.validation_time_estimate;
 
 	pdm = other.pdm;
 	params_local = other.params_local;
@@ -224,13 +431,20 @@ CLNF & CLNF::operator= (const CLNF&& other)
 	landmark_likelihoods = other.landmark_likelihoods;
 	patch_experts = other.patch_experts;
 	landmark_validator = other.landmark_validator;
-	haar_face_detector_location = other.haar_face_detector_location;
 	mtcnn_face_detector_location = other.mtcnn_face_detector_location;
+	face_detector_plugin = other.face_detector_plugin;
 
+#ifndef OPENFACE_SLIM_LANDMARK_DETECTOR
+	haar_face_detector_location = other.haar_face_detector_location;
 	face_detector_HAAR = other.face_detector_HAAR;
+	face_detector_HAAR_frame = other.face_detector_HAAR_frame;
+#endif
 
 	triangulations = other.triangulations;
 	kde_resp_precalc = other.kde_resp_precalc;
+	// The bundle the model weights point to (if loaded from one) is shared between the copies
+	model_bundle = other.model_bundle;
+	clnf_location = other.clnf_location;
 
 	face_detector_MTCNN = other.face_detector_MTCNN;
 
@@ -239,6 +453,7 @@ CLNF & CLNF::operator= (const CLNF&& other)
 	this->hierarchical_models = other.hierarchical_models;
 	this->hierarchical_model_names = other.hierarchical_model_names;
 	this->hierarchical_params = other.hierarchical_params;
+	this->hierarchical_part_valid = other.hierarchical_part_valid;
 
 	this->eye_model = other.eye_model;
 
@@ -250,7 +465,7 @@ CLNF & CLNF::operator= (const CLNF&& other)
 }
 
 
-bool CLNF::Read_CLNF(string clnf_location)
+bool CLNF::Read_CLNF(string clnf_location, bool local_model_copy)
 {
 	// Location of modules
 	ifstream locations(clnf_location.c_str(), ios_base::in);
@@ -262,6 +477,14 @@ bool CLNF::Read_CLNF(string clnf_location)
 		return false;
 	}
 
+	this->clnf_location = clnf_location;
+
+	// If a binary bundle of the model has been generated (by the ModelBundler tool), use it instead as it is much faster to load
+	if (ReadBundle(clnf_location + ".bundle", local_model_copy))
+	{
+		return true;
+	}
+
 	string line;
 	
 	vector<string> intensity_expert_locations;
@@ -367,7 +590,115 @@ bool CLNF::Read_CLNF(string clnf_location)
 	
 }
 
-void CLNF::Read(string main_location)
+//=============================================================================
+// Reading the PDM, triangulations and patch experts from a memory mapped model bundle
+bool CLNF::ReadBundle(const string& bundle_location, bool local_model_copy)
+{
+	if (!boost::filesystem::exists(bundle_location))
+	{
+		return false;
+	}
+
+	std::shared_ptr<ModelBundle> bundle = std::make_shared<ModelBundle>();
+
+	if (!bundle->Open(bundle_location, local_model_copy))
+	{
+		return false;
+	}
+
+	cout << "Reading the model bundle from: " << bundle_location << "....";
+
+	if (!pdm.Read(*bundle, "pdm/") || !patch_experts.Read(bundle, "patches/"))
+	{
+		cout << "Failed, reading the model files instead" << endl;
+
+		// Make sure nothing points to the bundle memory
+		pdm = PDM();
+		patch_experts = Patch_experts();
+		return false;
+	}
+
+	triangulations.clear();
+	for (int i = 0; bundle->Has("triangulations/" + to_string(i)); ++i)
+	{
+		cv::Mat triangulation;
+		bundle->GetMat("triangulations/" + to_string(i), triangulation);
+		triangulations.push_back(triangulation);
+	}
+
+	// Keep the mapping alive for as long as the model (and its copies) use it
+	model_bundle = bundle;
+
+	cout << "Done" << endl;
+
+	return true;
+}
+
+//=============================================================================
+// Writing the model (and its hierarchical part models) as model bundles next to the model files, so that they can be loaded faster next time
+bool CLNF::WriteBundle() const
+{
+	if (model_bundle)
+	{
+		cout << "The model has already been read from the model bundle: " << clnf_location + ".bundle" << endl;
+		return true;
+	}
+
+	return WriteBundle(clnf_location + ".bundle");
+}
+
+bool CLNF::WriteBundle(const string& bundle_location) const
+{
+	if (model_bundle)
+	{
+		cout << "The model has been read from a model bundle, it can only be written from the model files" << endl;
+		return false;
+	}
+
+	ModelBundleWriter bundle;
+
+	pdm.Write(bundle, "pdm/");
+
+	if (!patch_experts.Write(bundle, "patches/"))
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < triangulations.size(); ++i)
+	{
+		bundle.AddMat("triangulations/" + to_string(i), triangulations[i]);
+	}
+
+	cout << "Writing the model bundle to: " << bundle_location << endl;
+
+	return bundle.Write(bundle_location);
+}
+
+bool CLNF::Prune(int num_scales, double max_yaw)
+{
+	int num_views = patch_experts.nViews();
+
+	vector<int> kept_views = patch_experts.Prune(num_scales, max_yaw);
+	if (kept_views.empty())
+	{
+		return false;
+	}
+
+	// There is a triangulation per view
+	if ((int)triangulations.size() == num_views)
+	{
+		vector<cv::Mat_<int> > kept_triangulations;
+		for (size_t view = 0; view < kept_views.size(); ++view)
+		{
+			kept_triangulations.push_back(triangulations[kept_views[view]]);
+		}
+		triangulations = kept_triangulations;
+	}
+
+	return true;
+}
+
+void CLNF::Read(string main_location, bool local_model_copy)
 {
 
 	cout << "Reading the landmark detector/tracker from: " << main_location << endl;
@@ -387,6 +718,11 @@ void CLNF::Read(string main_location)
 	// Assume no eye model, unless read-in
 	eye_model = false;
 
+	// The modules are only collected here and read once the whole file is parsed, as they are independent of each other
+	string clnf_location;
+	string validator_location;
+	vector<string> part_locations;
+
 	// The main file contains the references to other files
 	while (!locations.eof())
 	{ 
@@ -413,16 +749,7 @@ void CLNF::Read(string main_location)
 		location = (root / location).string();
 		if (module.compare("LandmarkDetector") == 0) 
 		{ 
-			cout << "Reading the landmark detector module from: " << location << endl;
-
-			// The CLNF module includes the PDM and the patch experts
-			bool read_success = Read_CLNF(location);
-
-			if(!read_success)
-			{
-				loaded_successfully = false;
-				return;
-			}
+			clnf_location = location;
 		}
 		else if(module.compare("LandmarkDetector_part") == 0)
 		{
@@ -443,15 +770,7 @@ void CLNF::Read(string main_location)
 		
 			this->hierarchical_mapping.push_back(mappings);
 
-			CLNF part_model(location);
-
-			if (!part_model.loaded_successfully)
-			{
-				loaded_successfully = false;
-				return;
-			}
-
-			this->hierarchical_models.push_back(part_model);
+			part_locations.push_back(location);
 
 			this->hierarchical_model_names.push_back(part_name);
 
@@ -557,15 +876,54 @@ void CLNF::Read(string main_location)
 			}
 
 			this->hierarchical_params.push_back(params);
-
-			cout << "Done" << endl;
 		}
 		else if (module.compare("DetectionValidator") == 0)
 		{            
-			cout << "Reading the landmark validation module....";
-			landmark_validator.Read(location);
-			cout << "Done" << endl;
+			validator_location = location;
+		}
+	}
+
+	// The main model, the part models and the validator are read concurrently (with the patch expert scales of each read in parallel as well)
+	bool clnf_read = clnf_location.empty();
+	vector<std::unique_ptr<CLNF> > part_models(part_locations.size());
+	tbb::task_group module_reads;
+	if (!clnf_location.empty())
+	{
+		cout << "Reading the landmark detector module from: " << clnf_location << endl;
+		module_reads.run([&]() {
+			// The CLNF module includes the PDM and the patch experts
+			clnf_read = Read_CLNF(clnf_location, local_model_copy);
+		});
+	}
+	for (size_t part = 0; part < part_locations.size(); ++part)
+	{
+		module_reads.run([&, part]() {
+			part_models[part].reset(new CLNF(part_locations[part], local_model_copy));
+		});
+	}
+	if (!validator_location.empty())
+	{
+		cout << "Reading the landmark validation module from: " << validator_location << endl;
+		module_reads.run([&]() {
+			landmark_validator.Read(validator_location);
+		});
+	}
+	module_reads.wait();
+
+	if (!clnf_read)
+	{
+		loaded_successfully = false;
+		return;
+	}
+
+	for (size_t part = 0; part < part_models.size(); ++part)
+	{
+		if (!part_models[part]->loaded_successfully)
+		{
+			loaded_successfully = false;
+			return;
 		}
+		this->hierarchical_models.push_back(*part_models[part]);
 	}
  
 	detected_landmarks.create(2 * pdm.NumberOfPoints(), 1);
@@ -586,6 +944,24 @@ void CLNF::Read(string main_location)
 	params_global = cv::Vec6f(1, 0, 0, 0, 0, 0);
 
 	failures_in_a_row = -1;
+	frames_since_full_fit = 0;
+	frames_since_validation = -1;
+	validated_likelihood = -10;
+	last_face_box = cv::Rect_<float>();
+	roi_detection_misses = 0;
+	last_face_rotation = cv::Vec3f();
+	rotation_hypothesis_wins.clear();
+	motion_predictor.Reset();
+	face_template_scaling = 1.0f;
+	face_template_correlation = 1.0f;
+	face_template_age = 0;
+	scene_histogram = cv::Mat_<float>();
+	working_level = 0;
+	deadline_degradations = DEGRADATION_NONE;
+	deadline_set = false;
+	scale_time_estimates.clear();
+	refinement_time_estimate = 0;
+	validation_time_estimate = 0;
 
 	preference_det.x = -1;
 	preference_det.y = -1;
@@ -598,6 +974,7 @@ void CLNF::Read(string main_location)
 void CLNF::Reset()
 {
 	detected_landmarks.setTo(0);
+	frame_result = FrameResult();
 
 	detection_success = false;
 	tracking_initialised = false;
@@ -610,8 +987,34 @@ void CLNF::Reset()
 	// global parameters (pose) [scale, euler_x, euler_y, euler_z, tx, ty]
 	params_global = cv::Vec6f(1, 0, 0, 0, 0, 0);
 
+	// The parts should not be initialised from the previous track either
+	for (size_t part = 0; part < hierarchical_models.size(); ++part)
+	{
+		hierarchical_models[part].tracking_initialised = false;
+	}
+	hierarchical_part_valid.assign(hierarchical_models.size(), 0);
+
 	failures_in_a_row = -1;
 	face_template = cv::Mat_<uchar>();
+	propagation_frame = cv::Mat_<uchar>();
+	frames_since_full_fit = 0;
+	frames_since_validation = -1;
+	validated_likelihood = -10;
+	last_face_box = cv::Rect_<float>();
+	roi_detection_misses = 0;
+	last_face_rotation = cv::Vec3f();
+	motion_predictor.Reset();
+	face_template_scaling = 1.0f;
+	face_template_correlation = 1.0f;
+	face_template_age = 0;
+	scene_histogram = cv::Mat_<float>();
+	working_level = 0;
+	deadline_degradations = DEGRADATION_NONE;
+	deadline_set = false;
+	response_cache.clear();
+
+	// A detection started for the previous track is not relevant anymore
+	async_face_detector.Cancel();
 }
 
 // Resetting the model, choosing the face nearest (x,y)
@@ -627,253 +1030,1300 @@ void CLNF::Reset(double x, double y)
 
 }
 
-// The main internal landmark detection call (should not be used externally?)
-bool CLNF::DetectLandmarks(const cv::Mat_<uchar> &image, FaceModelParameters& params)
+void CLNF::SetFaceDetector(std::shared_ptr<FaceDetectorPlugin> detector)
 {
+	// A background detection could still be using the previous one
+	async_face_detector.Cancel();
+	face_detector_plugin = detector;
+}
 
-	// TODO this could be moved out
-	cv::Mat_<float> gray_image_flt;
-	image.convertTo(gray_image_flt, CV_32F);
-
-	// Fits from the current estimate of local and global parameters in the model
-	bool fit_success = Fit(gray_image_flt, params.window_sizes_current, params);
-
-	// Store the landmarks converged on in detected_landmarks
-	pdm.CalcShape2D(detected_landmarks, params_local, params_global);	
+void CLNF::SetDeadline(std::chrono::steady_clock::time_point deadline)
+{
+	this->deadline = deadline;
+	deadline_set = true;
+	deadline_degradations = DEGRADATION_NONE;
+}
 
-	if(params.refine_hierarchical && hierarchical_models.size() > 0)
-	{
-		bool parts_used = false;		
+void CLNF::ClearDeadline()
+{
+	deadline_set = false;
+}
 
-		// Do the hierarchical models in parallel
-		tbb::parallel_for(0, (int)hierarchical_models.size(), [&](int part_model){
-		{
+bool CLNF::DeadlineAllows(double expected_time) const
+{
+	if (!deadline_set)
+		return true;
 
-			int n_part_points = hierarchical_models[part_model].pdm.NumberOfPoints();
+	return std::chrono::duration<double>(deadline - std::chrono::steady_clock::now()).count() > expected_time;
+}
 
-			vector<pair<int, int>> mappings = this->hierarchical_mapping[part_model];
+// The running average of a stage duration, starting from the first measurement
+static void UpdateTimeEstimate(double& estimate, std::chrono::steady_clock::time_point start)
+{
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	estimate = estimate > 0 ? 0.8 * estimate + 0.2 * seconds : seconds;
+}
 
-			cv::Mat_<float> part_model_locs(n_part_points * 2, 1, 0.0f);
+// The quantisation of the offsets in the precomputed KDE tables
+static const float KDE_STEP_SIZE = 0.1f;
 
-			// Extract the corresponding landmarks
-			for (size_t mapping_ind = 0; mapping_ind < mappings.size(); ++mapping_ind)
-			{
-				part_model_locs.at<float>(mappings[mapping_ind].second) = detected_landmarks.at<float>(mappings[mapping_ind].first);
-				part_model_locs.at<float>(mappings[mapping_ind].second + n_part_points) = detected_landmarks.at<float>(mappings[mapping_ind].first + this->pdm.NumberOfPoints());
-			}
+// The KDE over a response window for every quantised offset (in steps of step_size), the speedup of RLMS described in Saragih 2011, every row
+// is padded to a multiple of 4 floats
+static void PrecomputeKDE(vector<cv::Mat_<float> >& kde_resp_precalc, int resp_size, float a, float step_size)
+{
+	int resp_area = resp_size * resp_size;
+	int row_length = (resp_area + 3) & ~3;
 
-			// Fit the part based model PDM
-			hierarchical_models[part_model].pdm.CalcParams(hierarchical_models[part_model].params_global, hierarchical_models[part_model].params_local, part_model_locs);
+	if((int)kde_resp_precalc.size() <= resp_size)
+	{
+		kde_resp_precalc.resize(resp_size + 1);
+	}
+	if(kde_resp_precalc[resp_size].empty())
+	{		
+		cv::Mat_<float> kde_resp((int)((resp_size / step_size)*(resp_size/step_size)), row_length, 0.0f);
 
-			// Only do this if we don't need to upsample
-			if (params_global[0] > 0.9 * hierarchical_models[part_model].patch_experts.patch_scaling[0])
+		int row = 0;
+		for(int x = 0; x < resp_size/step_size; x++)
+		{
+			float dx = x * step_size;
+			for(int y = 0; y < resp_size/step_size; y++)
 			{
-				parts_used = true;
+				float dy = y * step_size;
 
-				this->hierarchical_params[part_model].window_sizes_current = this->hierarchical_params[part_model].window_sizes_init;
+				float* kde_it = kde_resp.ptr<float>(row++);
 
-				// Do the actual landmark detection
-				hierarchical_models[part_model].DetectLandmarks(image, hierarchical_params[part_model]);
+				for(int ii = 0; ii < resp_size; ii++)
+				{
+					float vx = (dy-ii)*(dy-ii);
+					for(int jj = 0; jj < resp_size; jj++)
+					{
+						float vy = (dx-jj)*(dx-jj);
 
-			}
-			else
-			{
-				hierarchical_models[part_model].pdm.CalcShape2D(hierarchical_models[part_model].detected_landmarks, hierarchical_models[part_model].params_local, hierarchical_models[part_model].params_global);
+						// the KDE evaluation of that point
+						*kde_it++ = exp(a*(vx+vy));
+					}
+				}
 			}
 		}
-		});
-
-		// Recompute main model based on the fit part models
-		if(parts_used)
-		{
-
-			for (size_t part_model = 0; part_model < hierarchical_models.size(); ++part_model)
-			{
-				vector<pair<int, int>> mappings = this->hierarchical_mapping[part_model];
 
-				// Reincorporate the models into main tracker
-				for (size_t mapping_ind = 0; mapping_ind < mappings.size(); ++mapping_ind)
-				{
-					detected_landmarks.at<float>(mappings[mapping_ind].first) = hierarchical_models[part_model].detected_landmarks.at<float>(mappings[mapping_ind].second);
-					detected_landmarks.at<float>(mappings[mapping_ind].first + pdm.NumberOfPoints()) = hierarchical_models[part_model].detected_landmarks.at<float>(mappings[mapping_ind].second + hierarchical_models[part_model].pdm.NumberOfPoints());
-				}
-			}
+		kde_resp_precalc[resp_size] = kde_resp;
+	}
+}
 
-			pdm.CalcParams(params_global, params_local, detected_landmarks);		
-			pdm.CalcShape2D(detected_landmarks, params_local, params_global);
-		}
+void CLNF::WarmUp(cv::Size frame_size, FaceModelParameters& params)
+{
+	TRACE_SCOPE("CLNF::WarmUp");
 
+	// The patch experts of all of the views, for both the detection and the tracking window sizes
+	patch_experts.WarmUp(params.window_sizes_init);
+	patch_experts.WarmUp(params.window_sizes_small);
+	for (size_t part = 0; part < hierarchical_models.size(); ++part)
+	{
+		hierarchical_models[part].patch_experts.WarmUp(hierarchical_params[part].window_sizes_init);
 	}
 
-	// Check detection correctness
-	if(params.validate_detections && fit_success)
+	// The mean shift KDE tables, the response size is the window size
+	float a = -0.5f / (params.sigma * params.sigma);
+	for (size_t scale = 0; scale < params.window_sizes_init.size(); ++scale)
+	{
+		if (params.window_sizes_init[scale] > 0)
+			PrecomputeKDE(kde_resp_precalc, params.window_sizes_init[scale], a, KDE_STEP_SIZE);
+	}
+	for (size_t scale = 0; scale < params.window_sizes_small.size(); ++scale)
 	{
+		if (params.window_sizes_small[scale] > 0)
+			PrecomputeKDE(kde_resp_precalc, params.window_sizes_small[scale], a, KDE_STEP_SIZE);
+	}
 
-		cv::Vec3d orientation(params_global[1], params_global[2], params_global[3]);
+	if (frame_size.area() > 0)
+	{
+		// Fitting on a blank frame allocates the response maps, the im2col buffers and the scratch memory of the patch experts (and of the
+		// hierarchical models) at their final sizes
+		cv::Mat_<uchar> blank_frame(frame_size, (uchar)128);
+		float face_size = 0.5f * (float)std::min(frame_size.width, frame_size.height);
+		cv::Rect_<float> face_box(0.5f * (frame_size.width - face_size), 0.5f * (frame_size.height - face_size), face_size, face_size);
+
+		vector<int> window_sizes = params.window_sizes_current;
+		const vector<int>* warm_up_sizes[] = { &params.window_sizes_init, &params.window_sizes_small };
+		for (int i = 0; i < 2; ++i)
+		{
+			params.window_sizes_current = *warm_up_sizes[i];
+			params_local.setTo(0);
+			pdm.CalcParams(params_global, face_box, params_local);
+			DetectLandmarks(blank_frame, params);
+		}
+		params.window_sizes_current = window_sizes;
 
-		detection_certainty = landmark_validator.Check(orientation, image, detected_landmarks);
+		// The face detector image pyramid buffers (and the tuning of its convolutions if enabled) for the frame size
+		if (params.curr_face_detector == FaceModelParameters::MTCNN_DETECTOR && !face_detector_MTCNN.empty())
+		{
+			cv::Mat blank_rgb(frame_size, CV_8UC3, cv::Scalar(128, 128, 128));
+			vector<cv::Rect_<float> > regions;
+			vector<float> confidences;
+			face_detector_MTCNN.DetectFaces(regions, blank_rgb, confidences);
+		}
+	}
 
-		detection_success = detection_certainty > params.validation_boundary;
+	// The warm up fits are not a part of any track
+	Reset();
 
+	if (params.realtime_memory && !LockModelMemory())
+	{
+		std::cout << "WARNING: could not lock the landmark detector models in memory, they are only locked when read from a model bundle and "
+			"within the locked memory limit of the process (ulimit -l)" << std::endl;
+	}
+}
+
+bool CLNF::LockModelMemory()
+{
+	bool success = model_bundle && model_bundle->Lock();
+	for (size_t part = 0; part < hierarchical_models.size(); ++part)
+	{
+		success = hierarchical_models[part].LockModelMemory() && success;
+	}
+	return success;
+}
+
+// The main internal landmark detection call (should not be used externally?)
+bool CLNF::DetectLandmarks(const cv::Mat_<uchar> &image, FaceModelParameters& params)
+{
+	ImageContext image_context(image);
+	return DetectLandmarks(image_context, params);
+}
+
+bool CLNF::DetectLandmarks(ImageContext& image, FaceModelParameters& params)
+{
+	TRACE_SCOPE("CLNF::DetectLandmarks");
+	METRICS_LATENCY("openface_stage_latency_seconds{stage=\"landmark_fitting\"}", "Latency of the processing stages in seconds");
+
+	// Any results derived from the previous fit are out of date
+	frame_result = FrameResult();
+
+	// Fits from the current estimate of local and global parameters in the model
+	bool fit_success = Fit(image, params.window_sizes_current, params);
+
+	Refine(image, params);
+
+	return ValidateDetection(image.Gray(), params, fit_success);
+}
+
+// The same as DetectLandmarks, but for tracking in videos, where the validation does not need to be done on every frame of a steady track
+bool CLNF::TrackLandmarks(const cv::Mat_<uchar> &image, FaceModelParameters& params)
+{
+	ImageContext image_context(image);
+	return TrackLandmarks(image_context, params);
+}
+
+bool CLNF::TrackLandmarks(ImageContext& image, FaceModelParameters& params)
+{
+	TRACE_SCOPE("CLNF::TrackLandmarks");
+	METRICS_LATENCY("openface_stage_latency_seconds{stage=\"landmark_fitting\"}", "Latency of the processing stages in seconds");
+
+	bool fit_success = Fit(image, params.window_sizes_current, params, params.response_reuse_threshold > 0);
+
+	Refine(image, params);
+
+	return ValidateTrackedDetection(image.Gray(), params, fit_success);
+}
+
+//=============================================================================
+// Landmark detection for several models in the same image, the models need to be copies of the same model (share the patch experts and PDM)
+// as the patch expert responses of all of them are computed together at every scale
+void CLNF::DetectLandmarksBatch(vector<CLNF*>& models, const cv::Mat_<uchar> &image, vector<FaceModelParameters*>& params, vector<bool>& success)
+{
+	success.assign(models.size(), false);
+
+	if (models.empty())
+	{
+		return;
+	}
+
+	// Only the regions around the faces are converted to floating point, once for all of the models
+	ImageContext image_context(image);
+
+	// The first model provides the patch experts and the PDM for all of the models
+	Patch_experts& patch_experts = models[0]->patch_experts;
+	const PDM& pdm = models[0]->pdm;
+
+	if (patch_experts.IsQuantised() != params[0]->quantised_patch_experts)
+	{
+		patch_experts.SetQuantised(params[0]->quantised_patch_experts);
+	}
+	patch_experts.SetCoarseToFineWindow(params[0]->coarse_to_fine_window);
+	patch_experts.SetResponseGrainSize(params[0]->response_grain_size);
+
+	int num_scales = patch_experts.patch_scaling.size();
+
+	vector<bool> fit_success(models.size(), true);
+
+	for (int scale = 0; scale < num_scales; scale++)
+	{
+		// Group the models by the window size used at the current scale, as only the responses of the same size can be batched
+		map<int, vector<int> > window_groups;
+		for (size_t m = 0; m < models.size(); ++m)
+		{
+			if (fit_success[m] && params[m]->window_sizes_current[scale] != 0)
+			{
+				window_groups[params[m]->window_sizes_current[scale]].push_back(m);
+			}
+		}
+
+		for (map<int, vector<int> >::iterator group = window_groups.begin(); group != window_groups.end(); ++group)
+		{
+			int window_size = group->first;
+			const vector<int>& group_models = group->second;
+
+			vector<cv::Vec6f> params_global(group_models.size());
+			vector<cv::Mat_<float> > params_local(group_models.size());
+			for (size_t k = 0; k < group_models.size(); ++k)
+			{
+				params_global[k] = models[group_models[k]]->params_global;
+				params_local[k] = models[group_models[k]]->params_local;
+			}
+
+			// The patch expert response computation for all of the models at once
+			vector<vector<cv::Mat_<float> > > patch_expert_responses;
+			vector<cv::Matx22f> sim_ref_to_img;
+			vector<cv::Matx22f> sim_img_to_ref;
+			patch_experts.ResponseBatch(patch_expert_responses, sim_ref_to_img, sim_img_to_ref, image_context, pdm, params_global, params_local, window_size, scale);
+
+			// The optimisation step for each of the models, these only touch the state of their own model so can be done in parallel
+			vector<char> group_success(group_models.size(), 1);
+			tbb::parallel_for(0, (int)group_models.size(), [&](int k) {
+			{
+				int m = group_models[k];
+				const vector<int>& window_sizes = params[m]->window_sizes_current;
+				bool last_scale = scale == num_scales - 1 || window_sizes[scale + 1] == 0;
+
+				group_success[k] = models[m]->OptimiseScale(patch_expert_responses[k], sim_ref_to_img[k], sim_img_to_ref[k], window_size, scale, last_scale, *params[m]);
+			}
+			});
+
+			for (size_t k = 0; k < group_models.size(); ++k)
+			{
+				fit_success[group_models[k]] = group_success[k] != 0;
+			}
+		}
+	}
+
+	// Refinement of every model in parallel, the validation is done afterwards for all of them together
+	tbb::parallel_for(0, (int)models.size(), [&](int m) {
+	{
+		models[m]->Refine(image_context, *params[m]);
+	}
+	});
+
+	// The models that do not need the CNN validator are dealt with directly, the validator of the first model is used for the others
+	// (the validators of the copies share the weights)
+	vector<char> detection_success(models.size(), 0);
+	vector<int> to_validate;
+	vector<cv::Vec3d> orientations;
+	vector<cv::Mat_<float> > landmarks;
+	for (size_t m = 0; m < models.size(); ++m)
+	{
+		float certainty;
+		if (!params[m]->validate_detections || !fit_success[m] || !models[m]->ValidationDue(*params[m]))
+		{
+			detection_success[m] = models[m]->ValidateTrackedDetection(image, *params[m], fit_success[m]);
+		}
+		else if (models[m]->ValidateByLikelihood(*params[m], certainty))
+		{
+			models[m]->SetValidationResult(certainty, *params[m]);
+			detection_success[m] = models[m]->detection_success;
+		}
+		else
+		{
+			to_validate.push_back((int)m);
+			orientations.push_back(cv::Vec3d(models[m]->params_global[1], models[m]->params_global[2], models[m]->params_global[3]));
+			landmarks.push_back(models[m]->detected_landmarks);
+		}
+	}
+
+	if (!to_validate.empty())
+	{
+		TRACE_SCOPE("DetectionValidator::CheckBatch");
+
+		vector<float> certainties;
+		models[0]->landmark_validator.CheckBatch(orientations, image, landmarks, certainties);
+
+		for (size_t k = 0; k < to_validate.size(); ++k)
+		{
+			CLNF* model = models[to_validate[k]];
+			model->SetValidationResult(certainties[k], *params[to_validate[k]]);
+			detection_success[to_validate[k]] = model->detection_success;
+		}
+	}
+
+	for (size_t m = 0; m < models.size(); ++m)
+	{
+		success[m] = detection_success[m] != 0;
+	}
+}
+
+//=============================================================================
+// Hierarchical refinement of the fit model
+void CLNF::Refine(ImageContext& image, FaceModelParameters& params)
+{
+	// Store the landmarks converged on in detected_landmarks
+	pdm.CalcShape2D(detected_landmarks, params_local, params_global);	
+
+	// Only the parts refined below are valid
+	hierarchical_part_valid.assign(hierarchical_models.size(), 0);
+
+	bool refine = params.refine_hierarchical && !params.pose_only && hierarchical_models.size() > 0;
+	if(refine && !DeadlineAllows(refinement_time_estimate))
+	{
+		deadline_degradations |= DEGRADATION_SKIPPED_REFINEMENT;
+		refine = false;
+	}
+
+	if(refine)
+	{
+		std::chrono::steady_clock::time_point refinement_start = std::chrono::steady_clock::now();
+
+		// Which of the parts were fit or skipped (written from the parallel part fits, so not a vector<bool>)
+		vector<char> parts_fit(hierarchical_models.size(), 0);
+		vector<char> parts_skipped(hierarchical_models.size(), 0);
+
+		HierarchicalFitPDMs();
+
+		// The parts with self occluded or too small landmarks would not give usable results, so they are not fit at all
+		vector<char> parts_usable(hierarchical_models.size(), 1);
+		if (params.gate_parts)
+		{
+			int vis_scale = (int)patch_experts.visibilities.size() - 1;
+			const cv::Mat_<int>& visibilities = patch_experts.visibilities[vis_scale][patch_experts.GetViewIdx(params_global, vis_scale)];
+			int n = pdm.NumberOfPoints();
+
+			for (size_t part = 0; part < hierarchical_models.size(); ++part)
+			{
+				const vector<pair<int, int>>& mappings = this->hierarchical_mapping[part];
+				float min_x = std::numeric_limits<float>::max(), max_x = -std::numeric_limits<float>::max();
+				float min_y = std::numeric_limits<float>::max(), max_y = -std::numeric_limits<float>::max();
+				for (size_t mapping_ind = 0; mapping_ind < mappings.size(); ++mapping_ind)
+				{
+					int ind = mappings[mapping_ind].first;
+					if (visibilities.at<int>(ind) == 0)
+					{
+						parts_usable[part] = 0;
+					}
+					min_x = std::min(min_x, detected_landmarks.at<float>(ind));
+					max_x = std::max(max_x, detected_landmarks.at<float>(ind));
+					min_y = std::min(min_y, detected_landmarks.at<float>(ind + n));
+					max_y = std::max(max_y, detected_landmarks.at<float>(ind + n));
+				}
+
+				if (std::max(max_x - min_x, max_y - min_y) < params.part_min_size)
+				{
+					parts_usable[part] = 0;
+				}
+			}
+		}
+
+		// The eye models are fit jointly (see DetectLandmarksJoint) after the loop below, as one model they cost less than as two
+		vector<char> joint_parts = JointEyeParts();
+		vector<char> parts_joint_fit(hierarchical_models.size(), 0);
+
+		// Do the hierarchical models in parallel, they only share the read only patch experts
+		tbb::parallel_for(0, (int)hierarchical_models.size(), [&](int part_model){
+		{
+			CLNF& part = hierarchical_models[part_model];
+			const vector<pair<int, int>>& mappings = this->hierarchical_mapping[part_model];
+			int n_mapped = (int)mappings.size();
+
+			// Extract the corresponding landmarks (in the order of the part's fitting model)
+			cv::Mat_<float> part_model_locs(n_mapped * 2, 1, 0.0f);
+			for (int mapping_ind = 0; mapping_ind < n_mapped; ++mapping_ind)
+			{
+				part_model_locs.at<float>(mapping_ind) = detected_landmarks.at<float>(mappings[mapping_ind].first);
+				part_model_locs.at<float>(mapping_ind + n_mapped) = detected_landmarks.at<float>(mappings[mapping_ind].first + this->pdm.NumberOfPoints());
+			}
+
+			// Fit the part based model PDM, when tracking starting from the previous frame's part parameters
+			PDM& part_fit_pdm = hierarchical_fit_pdms[part_model];
+			if (!part.tracking_initialised || !part_fit_pdm.CalcParamsWarm(part.params_global, part.params_local, part_model_locs, PART_WARM_START_ITERATIONS))
+			{
+				part_fit_pdm.CalcParams(part.params_global, part.params_local, part_model_locs);
+			}
+			part.tracking_initialised = true;
+
+			// Parts can be opted out of, they then just follow the main model
+			bool refine_part = this->hierarchical_params[part_model].refine_part && parts_usable[part_model] &&
+				std::find(params.skipped_parts.begin(), params.skipped_parts.end(), hierarchical_model_names[part_model]) == params.skipped_parts.end();
+
+			parts_skipped[part_model] = !refine_part;
+
+			// Only do this if we don't need to upsample
+			if (refine_part && params_global[0] > 0.9 * hierarchical_models[part_model].patch_experts.patch_scaling[0])
+			{
+				parts_fit[part_model] = 1;
+
+				this->hierarchical_params[part_model].window_sizes_current = this->hierarchical_params[part_model].window_sizes_init;
+				this->hierarchical_params[part_model].quantised_patch_experts = params.quantised_patch_experts;
+
+				// Do the actual landmark detection
+				if (joint_parts[part_model])
+				{
+					parts_joint_fit[part_model] = 1;
+				}
+				else
+				{
+					hierarchical_models[part_model].DetectLandmarks(image, hierarchical_params[part_model]);
+				}
+
+			}
+			else
+			{
+				hierarchical_models[part_model].pdm.CalcShape2D(hierarchical_models[part_model].detected_landmarks, hierarchical_models[part_model].params_local, hierarchical_models[part_model].params_global);
+			}
+		}
+		});
+
+		FitPartsJointly(image, parts_joint_fit);
+
+		hierarchical_part_valid.assign(parts_fit.begin(), parts_fit.end());
+
+		// Recompute main model based on the fit part models
+		if(std::find(parts_fit.begin(), parts_fit.end(), 1) != parts_fit.end())
+		{
+
+			for (size_t part_model = 0; part_model < hierarchical_models.size(); ++part_model)
+			{
+				if (parts_skipped[part_model])
+					continue;
+
+				vector<pair<int, int>> mappings = this->hierarchical_mapping[part_model];
+
+				// Reincorporate the models into main tracker
+				for (size_t mapping_ind = 0; mapping_ind < mappings.size(); ++mapping_ind)
+				{
+					detected_landmarks.at<float>(mappings[mapping_ind].first) = hierarchical_models[part_model].detected_landmarks.at<float>(mappings[mapping_ind].second);
+					detected_landmarks.at<float>(mappings[mapping_ind].first + pdm.NumberOfPoints()) = hierarchical_models[part_model].detected_landmarks.at<float>(mappings[mapping_ind].second + hierarchical_models[part_model].pdm.NumberOfPoints());
+				}
+			}
+
+			// Only a few of the landmarks moved, so the current parameters are a good starting point
+			if (!pdm.CalcParamsWarm(params_global, params_local, detected_landmarks, PART_WARM_START_ITERATIONS))
+			{
+				pdm.CalcParams(params_global, params_local, detected_landmarks);
+			}
+			pdm.CalcShape2D(detected_landmarks, params_local, params_global);
+		}
+
+		UpdateTimeEstimate(refinement_time_estimate, refinement_start);
+	}
+}
+
+//=============================================================================
+vector<char> CLNF::JointEyeParts() const
+{
+	vector<char> joint(hierarchical_models.size(), 0);
+	int num_eyes = 0;
+	for (size_t part_model = 0; part_model < hierarchical_models.size(); ++part_model)
+	{
+		if (hierarchical_model_names[part_model].find("eye") != string::npos)
+		{
+			joint[part_model] = 1;
+			num_eyes++;
+		}
+	}
+
+	// A single eye model is just fit on its own
+	if (num_eyes < 2)
+	{
+		joint.assign(hierarchical_models.size(), 0);
+	}
+	return joint;
+}
+
+void CLNF::FitPartsJointly(ImageContext& image, const vector<char>& parts)
+{
+	vector<CLNF*> models;
+	vector<FaceModelParameters*> models_params;
+	for (size_t part_model = 0; part_model < parts.size() && part_model < hierarchical_models.size(); ++part_model)
+	{
+		if (parts[part_model])
+		{
+			models.push_back(&hierarchical_models[part_model]);
+			models_params.push_back(&hierarchical_params[part_model]);
+		}
+	}
+
+	if (models.size() == 1)
+	{
+		models[0]->DetectLandmarks(image, *models_params[0]);
+	}
+	else if (models.size() > 1)
+	{
+		vector<bool> success;
+		DetectLandmarksJoint(models, image, models_params, success);
+	}
+}
+
+//=============================================================================
+bool CLNF::TrackEyes(ImageContext& image, FaceModelParameters& params, double time_stamp)
+{
+	TRACE_SCOPE("CLNF::TrackEyes");
+
+	// The head is assumed to keep moving as predicted, its shape is kept from the last full fit
+	cv::Vec6f predicted_params;
+	if (motion_predictor.Predict(time_stamp, params.motion_prediction_damping, predicted_params))
+	{
+		params_global = predicted_params;
+	}
+	pdm.CalcShape2D(detected_landmarks, params_local, params_global);
+
+	HierarchicalFitPDMs();
+	hierarchical_part_valid.assign(hierarchical_models.size(), 0);
+
+	bool eyes_fit = false;
+	for (size_t part_model = 0; part_model < hierarchical_models.size(); ++part_model)
+	{
+		if (hierarchical_model_names[part_model].find("eye") == string::npos || !hierarchical_params[part_model].refine_part)
+		{
+			continue;
+		}
+
+		CLNF& part = hierarchical_models[part_model];
+		if (params_global[0] <= 0.9 * part.patch_experts.patch_scaling[0])
+		{
+			continue;
+		}
+
+		const vector<pair<int, int>>& mappings = this->hierarchical_mapping[part_model];
+		int n_mapped = (int)mappings.size();
+		int n = pdm.NumberOfPoints();
+
+		// The eye follows the predicted head motion, starting from its parameters of the previous frame
+		cv::Mat_<float> part_model_locs(n_mapped * 2, 1, 0.0f);
+		for (int mapping_ind = 0; mapping_ind < n_mapped; ++mapping_ind)
+		{
+			part_model_locs.at<float>(mapping_ind) = detected_landmarks.at<float>(mappings[mapping_ind].first);
+			part_model_locs.at<float>(mapping_ind + n_mapped) = detected_landmarks.at<float>(mappings[mapping_ind].first + n);
+		}
+
+		PDM& part_fit_pdm = hierarchical_fit_pdms[part_model];
+		if (!part.tracking_initialised || !part_fit_pdm.CalcParamsWarm(part.params_global, part.params_local, part_model_locs, PART_WARM_START_ITERATIONS))
+		{
+			part_fit_pdm.CalcParams(part.params_global, part.params_local, part_model_locs);
+		}
+		part.tracking_initialised = true;
+
+		// Between consecutive frames of a fast camera the eye barely moves, so the small windows are enough, the patch experts only sample
+		// the areas of interest around the eye from the frame
+		FaceModelParameters& part_params = hierarchical_params[part_model];
+		part_params.window_sizes_current = part_params.window_sizes_small;
+		part_params.quantised_patch_experts = params.quantised_patch_experts;
+
+		hierarchical_part_valid[part_model] = 1;
+		eyes_fit = true;
+	}
+
+	// Both eyes together, then back into the main model
+	vector<char> parts_to_fit(hierarchical_part_valid.begin(), hierarchical_part_valid.end());
+	FitPartsJointly(image, parts_to_fit);
+
+	for (size_t part_model = 0; part_model < hierarchical_models.size(); ++part_model)
+	{
+		if (!hierarchical_part_valid[part_model])
+		{
+			continue;
+		}
+
+		const CLNF& part = hierarchical_models[part_model];
+		const vector<pair<int, int>>& mappings = this->hierarchical_mapping[part_model];
+		int n = pdm.NumberOfPoints();
+		for (size_t mapping_ind = 0; mapping_ind < mappings.size(); ++mapping_ind)
+		{
+			detected_landmarks.at<float>(mappings[mapping_ind].first) = part.detected_landmarks.at<float>(mappings[mapping_ind].second);
+			detected_landmarks.at<float>(mappings[mapping_ind].first + n) = part.detected_landmarks.at<float>(mappings[mapping_ind].second + part.pdm.NumberOfPoints());
+		}
+	}
+
+	return eyes_fit;
+}
+
+//=============================================================================
+bool CLNF::ValidateDetection(const cv::Mat_<uchar> &image, const FaceModelParameters& params, bool fit_success)
+{
+	// Check detection correctness
+	if(params.validate_detections && fit_success)
+	{
+
+		cv::Vec3d orientation(params_global[1], params_global[2], params_global[3]);
+
+		float certainty;
+		if (!ValidateByLikelihood(params, certainty))
+		{
+			TRACE_SCOPE("DetectionValidator::Check");
+			certainty = landmark_validator.Check(orientation, image, detected_landmarks);
+		}
+
+		SetValidationResult(certainty, params);
 	}
 	else
 	{
 		detection_success = fit_success;
 		if(fit_success)
 		{
-			detection_certainty = 1;
+			detection_certainty = 1;
+		}
+		else
+		{
+			detection_certainty = 0;
+		}
+
+		// Without a validation the next tracked frame has to be validated
+		frames_since_validation = -1;
+	}
+
+	return detection_success;
+}
+
+void CLNF::SetValidationResult(float certainty, const FaceModelParameters& params)
+{
+	detection_certainty = certainty;
+	detection_success = detection_certainty > params.validation_boundary;
+
+	// A successful validation starts a steady track, which might not need validating on the next frames
+	if(detection_success)
+	{
+		frames_since_validation = 0;
+		validated_likelihood = model_likelihood;
+	}
+	else
+	{
+		frames_since_validation = -1;
+	}
+}
+
+bool CLNF::ValidateByLikelihood(const FaceModelParameters& params, float& certainty) const
+{
+	if (params.tiered_validation_margin <= 0 || view_used < 0 || view_used >= (int)patch_experts.early_term_weights.size() ||
+		view_used >= (int)patch_experts.early_term_biases.size())
+	{
+		return false;
+	}
+
+	// The early termination model maps the likelihood to the scale of the validator certainty
+	float score = (float)(model_likelihood * patch_experts.early_term_weights[view_used] + patch_experts.early_term_biases[view_used]);
+	if (std::abs(score - params.validation_boundary) < params.tiered_validation_margin)
+	{
+		return false;
+	}
+
+	certainty = std::min(1.0f, std::max(0.0f, score));
+	return true;
+}
+
+// The validation is due on the first frame of a track, every validate_every frames and whenever the fit got noticeably less likely
+bool CLNF::ValidationDue(const FaceModelParameters& params) const
+{
+	return params.validate_every <= 1 || frames_since_validation < 0 || frames_since_validation + 1 >= params.validate_every ||
+		model_likelihood < validated_likelihood - params.validation_likelihood_drop;
+}
+
+bool CLNF::ValidateTrackedDetection(const cv::Mat_<uchar> &image, const FaceModelParameters& params, bool fit_success)
+{
+	if(params.validate_detections && fit_success && !ValidationDue(params))
+	{
+		// A steady track keeps reporting the certainty of its last validation
+		frames_since_validation++;
+		detection_success = true;
+		return true;
+	}
+
+	// Out of time a steady track that has not lost likelihood can postpone a due validation, by at most validate_every frames
+	if(params.validate_detections && fit_success && frames_since_validation >= 0 && frames_since_validation < 2 * std::max(params.validate_every, 1) &&
+		model_likelihood >= validated_likelihood - params.validation_likelihood_drop && !DeadlineAllows(validation_time_estimate))
+	{
+		deadline_degradations |= DEGRADATION_DEFERRED_VALIDATION;
+		frames_since_validation++;
+		detection_success = true;
+		return true;
+	}
+
+	std::chrono::steady_clock::time_point validation_start = std::chrono::steady_clock::now();
+	bool success = ValidateDetection(image, params, fit_success);
+	UpdateTimeEstimate(validation_time_estimate, validation_start);
+	return success;
+}
+
+//=============================================================================
+// The landmarks fit when only tracking the pose or when only fitting the inner landmarks (for the 68 point model), an empty mask when all of them are
+static cv::Mat_<int> FitLandmarkMask(int n, const FaceModelParameters& parameters)
+{
+	cv::Mat_<int> mask;
+	if (parameters.pose_only && n == 68 && !parameters.pose_only_landmarks.empty())
+	{
+		mask = cv::Mat_<int>::zeros(n, 1);
+		for (size_t i = 0; i < parameters.pose_only_landmarks.size(); ++i)
+		{
+			int ind = parameters.pose_only_landmarks[i];
+			if (ind >= 0 && ind < n)
+			{
+				mask.at<int>(ind) = 1;
+			}
+		}
+	}
+	else if ((parameters.landmark_subset == 49 || parameters.landmark_subset == 51) && n == 68)
+	{
+		// Leaving out the jaw contour (and for 49 points the inner mouth corners), both symmetric so the mirrored patch experts still pair up
+		mask = cv::Mat_<int>::ones(n, 1);
+		mask.rowRange(0, 17).setTo(0);
+		if (parameters.landmark_subset == 49)
+		{
+			mask.at<int>(60) = 0;
+			mask.at<int>(64) = 0;
+		}
+	}
+	return mask;
+}
+
+// The landmarks that take part in the fit, none if all of them do
+static vector<int> FitLandmarkPoints(int n, const FaceModelParameters& parameters)
+{
+	cv::Mat_<int> landmark_mask = FitLandmarkMask(n, parameters);
+	vector<int> fit_points;
+	for (int i = 0; i < landmark_mask.rows; ++i)
+	{
+		if (landmark_mask.at<int>(i) != 0)
+		{
+			fit_points.push_back(i);
+		}
+	}
+	return fit_points;
+}
+
+void CLNF::LoadFitState(FitState& state) const
+{
+	state.params_global = params_global;
+	state.params_local = params_local;
+	state.model_likelihood = model_likelihood;
+	state.landmark_likelihoods = landmark_likelihoods;
+	state.view_used = view_used;
+	state.own_fit = true;
+}
+
+void CLNF::StoreFitState(const FitState& state)
+{
+	params_global = state.params_global;
+	params_local = state.params_local;
+	model_likelihood = state.model_likelihood;
+	landmark_likelihoods = state.landmark_likelihoods;
+	view_used = state.view_used;
+}
+
+bool CLNF::Fit(ImageContext& im, const std::vector<int>& window_sizes, const FaceModelParameters& parameters, bool reuse_responses)
+{
+	if (patch_experts.IsQuantised() != parameters.quantised_patch_experts)
+	{
+		patch_experts.SetQuantised(parameters.quantised_patch_experts);
+	}
+	patch_experts.SetCoarseToFineWindow(parameters.coarse_to_fine_window);
+	patch_experts.SetResponseGrainSize(parameters.response_grain_size);
+
+	FitState state;
+	LoadFitState(state);
+	bool success = FitScales(im, state, response_maps, 0, window_sizes, parameters, reuse_responses);
+	StoreFitState(state);
+	return success;
+}
+
+bool CLNF::FitScales(ImageContext& im, FitState& state, vector<cv::Mat_<float> >& patch_expert_responses, vector<Landmark_workspace>* workspaces,
+	const std::vector<int>& window_sizes, const FaceModelParameters& parameters, bool reuse_responses)
+{
+	int n = pdm.NumberOfPoints(); 
+		
+	int num_scales = patch_experts.patch_scaling.size();
+
+	// Storing the patch expert response maps
+	patch_expert_responses.resize(n);
+
+	// When only tracking the pose (or only fitting the inner landmarks) the responses are only needed for those landmarks
+	cv::Mat_<int> landmark_mask = FitLandmarkMask(n, parameters);
+
+	// Converting from image space to patch expert space (normalised for rotation and scale)
+	cv::Matx22f sim_ref_to_img;
+	cv::Matx22f sim_img_to_ref;
+
+	// Active scale is there in case we need to upsample too much
+	int active_scale = 0;
+
+	// Under a deadline the coarse scales are skipped when the remaining ones would not finish in time, the finest scale is always fit
+	if (state.own_fit)
+	{
+		scale_time_estimates.resize(num_scales, 0.0);
+	}
+	int finest_scale = 0;
+	for (int scale = 0; scale < num_scales; ++scale)
+	{
+		if (window_sizes[scale] > 0)
+			finest_scale = scale;
+	}
+
+	// Optimise the model across a number of areas of interest (usually in descending window size and ascending scale size)
+	for(int scale = 0; scale < num_scales; scale++)
+	{
+		// Control the number of iterations through window size
+		if (window_sizes[scale] == 0)
+			continue;
+
+		if (state.own_fit && deadline_set && scale < finest_scale)
+		{
+			double expected_time = 0;
+			for (int s = scale; s < num_scales; ++s)
+			{
+				if (window_sizes[s] > 0)
+					expected_time += scale_time_estimates[s];
+			}
+			if (!DeadlineAllows(expected_time))
+			{
+				deadline_degradations |= DEGRADATION_SKIPPED_SCALES;
+				continue;
+			}
+		}
+
+		int window_size = window_sizes[scale];
+
+		TRACE_SCOPE_ARG("CLNF::Fit scale", scale);
+		std::chrono::steady_clock::time_point scale_start = std::chrono::steady_clock::now();
+
+		// The responses of the landmarks that barely moved since the previous frame can be reused when tracking
+		bool cache_responses = state.own_fit && parameters.response_reuse_threshold > 0;
+		cv::Mat_<int> scale_mask = landmark_mask;
+		cv::Mat_<float> landmarks;
+		vector<int> reused;
+		if (cache_responses)
+		{
+			pdm.CalcShape2D(landmarks, state.params_local, state.params_global);
+			if (reuse_responses)
+			{
+				reused = ReusableResponses(landmarks, scale, window_size, parameters, scale_mask);
+			}
+		}
+
+		// The patch expert response computation
+		patch_experts.Response(patch_expert_responses, sim_ref_to_img, sim_img_to_ref, im, pdm, state.params_global, state.params_local, window_size, scale, scale_mask, workspaces);
+
+		if (cache_responses)
+		{
+			UpdateResponseCache(patch_expert_responses, landmarks, sim_img_to_ref, scale, window_size, reused, landmark_mask);
+		}
+
+		// If we are terminating next iteration, make sure to record the model likelihood
+		bool last_scale = scale == num_scales - 1 || window_sizes[scale + 1] == 0;
+
+		// the actual optimisation step
+		if (!OptimiseScale(state, patch_expert_responses, sim_ref_to_img, sim_img_to_ref, window_size, scale, last_scale, parameters))
+		{
+			return false;
+		}
+
+		if (state.own_fit)
+		{
+			UpdateTimeEstimate(scale_time_estimates[scale], scale_start);
+		}
+
+		// Making sure we do not upsample too much
+		if (active_scale < num_scales - 1 && 0.9 * patch_experts.patch_scaling[active_scale + 1] < state.params_global[0])
+			active_scale = active_scale + 1;
+
+	}
+
+	return true;
+}
+
+bool CLNF::PrepareConcurrentFits(const std::vector<int>& window_sizes, const FaceModelParameters& params)
+{
+	if (patch_experts.IsQuantised() != params.quantised_patch_experts)
+	{
+		patch_experts.SetQuantised(params.quantised_patch_experts);
+	}
+	patch_experts.SetCoarseToFineWindow(params.coarse_to_fine_window);
+	patch_experts.SetResponseGrainSize(params.response_grain_size);
+
+	// The patch experts of all of the views, with their precomputation for the window sizes
+	patch_experts.WarmUp(window_sizes);
+
+	// The mean shift KDE tables, with the sigma of the scale the response size is used at
+	for (size_t scale = 0; scale < window_sizes.size() && scale < patch_experts.patch_scaling.size(); ++scale)
+	{
+		if (window_sizes[scale] > 0)
+		{
+			float sigma = ScaleParameters(params, (int)scale).sigma;
+			PrecomputeKDE(kde_resp_precalc, window_sizes[scale], -0.5f / (sigma * sigma), KDE_STEP_SIZE);
+		}
+	}
+
+	// The truncated shape model and its subsampled versions for the rigid and the non-rigid fits
+	PDM& non_rigid_pdm = FitPDM(params.pose_only ? params.pose_only_modes : params.num_fit_modes);
+	vector<int> fit_points = FitLandmarkPoints(pdm.NumberOfPoints(), params);
+	if (!fit_points.empty())
+	{
+		SubsetFitPDM(pdm, fit_points);
+		SubsetFitPDM(non_rigid_pdm, fit_points);
+	}
+
+	// Only the CEN experts keep no state between the responses, the CCNF and the SVR ones compute their DFTs on first use
+	return !patch_experts.cen_expert_intensity.empty();
+}
+
+bool CLNF::FitConcurrent(ImageContext& image, FitState& state, const std::vector<int>& window_sizes, const FaceModelParameters& params)
+{
+	state.own_fit = false;
+	state.success = FitScales(image, state, state.response_maps, &state.workspaces, window_sizes, params, false);
+	return state.success;
+}
+
+bool CLNF::CompleteFit(ImageContext& image, const FitState& state, FaceModelParameters& params)
+{
+	// Any results derived from the previous fit are out of date
+	frame_result = FrameResult();
+
+	params_global = state.params_global;
+	state.params_local.copyTo(params_local);
+	model_likelihood = state.model_likelihood;
+	state.landmark_likelihoods.copyTo(landmark_likelihoods);
+	view_used = state.view_used;
+
+	Refine(image, params);
+
+	return ValidateDetection(image.Gray(), params, state.success);
+}
+
+void CLNF::DetectLandmarksJoint(vector<CLNF*>& models, ImageContext& image, vector<FaceModelParameters*>& params, vector<bool>& success)
+{
+	TRACE_SCOPE("CLNF::DetectLandmarksJoint");
+
+	const int num_models = (int)models.size();
+	success.assign(num_models, false);
+
+	vector<char> fit_success(num_models, 1);
+	vector<cv::Mat_<int> > landmark_masks(num_models);
+	int num_scales = 0;
+	for (int m = 0; m < num_models; ++m)
+	{
+		CLNF& model = *models[m];
+		const FaceModelParameters& parameters = *params[m];
+
+		// Any results derived from the previous fit are out of date
+		model.frame_result = FrameResult();
+
+		if (model.patch_experts.IsQuantised() != parameters.quantised_patch_experts)
+		{
+			model.patch_experts.SetQuantised(parameters.quantised_patch_experts);
+		}
+		model.patch_experts.SetCoarseToFineWindow(parameters.coarse_to_fine_window);
+		model.patch_experts.SetResponseGrainSize(parameters.response_grain_size);
+
+		int n = model.pdm.NumberOfPoints();
+		model.response_maps.resize(n);
+		landmark_masks[m] = FitLandmarkMask(n, parameters);
+
+		num_scales = std::max(num_scales, (int)model.patch_experts.patch_scaling.size());
+	}
+
+	for (int scale = 0; scale < num_scales; ++scale)
+	{
+		// The models still fitting that have a window at this scale
+		vector<int> active;
+		for (int m = 0; m < num_models; ++m)
+		{
+			const vector<int>& window_sizes = params[m]->window_sizes_current;
+			if (fit_success[m] && scale < (int)models[m]->patch_experts.patch_scaling.size() && scale < (int)window_sizes.size() && window_sizes[scale] != 0)
+			{
+				active.push_back(m);
+			}
+		}
+
+		if (active.empty())
+		{
+			continue;
+		}
+
+		TRACE_SCOPE_ARG("CLNF::DetectLandmarksJoint scale", scale);
+
+		vector<Patch_experts*> experts;
+		vector<vector<cv::Mat_<float> >*> responses;
+		vector<const PDM*> pdms;
+		vector<cv::Vec6f> params_global;
+		vector<cv::Mat_<float> > params_local;
+		vector<int> window_sizes;
+		vector<cv::Mat_<int> > masks;
+		for (size_t k = 0; k < active.size(); ++k)
+		{
+			CLNF& model = *models[active[k]];
+			experts.push_back(&model.patch_experts);
+			responses.push_back(&model.response_maps);
+			pdms.push_back(&model.pdm);
+			params_global.push_back(model.params_global);
+			params_local.push_back(model.params_local);
+			window_sizes.push_back(params[active[k]]->window_sizes_current[scale]);
+			masks.push_back(landmark_masks[active[k]]);
+		}
+
+		vector<cv::Matx22f> sim_ref_to_img, sim_img_to_ref;
+		Patch_experts::ResponseJoint(experts, responses, sim_ref_to_img, sim_img_to_ref, image, pdms, params_global, params_local, window_sizes, scale, masks);
+
+		// The optimisation steps only touch the state of their own model
+		tbb::parallel_for(0, (int)active.size(), [&](int k) {
+		{
+			int m = active[k];
+			const vector<int>& model_windows = params[m]->window_sizes_current;
+			int model_scales = (int)models[m]->patch_experts.patch_scaling.size();
+			bool last_scale = scale == model_scales - 1 || scale + 1 >= (int)model_windows.size() || model_windows[scale + 1] == 0;
+
+			fit_success[m] = models[m]->OptimiseScale(models[m]->response_maps, sim_ref_to_img[k], sim_img_to_ref[k], window_sizes[k], scale, last_scale, *params[m]);
+		}
+		});
+	}
+
+	for (int m = 0; m < num_models; ++m)
+	{
+		models[m]->Refine(image, *params[m]);
+		success[m] = models[m]->ValidateDetection(image.Gray(), *params[m], fit_success[m] != 0);
+	}
+}
+
+vector<int> CLNF::ReusableResponses(const cv::Mat_<float>& landmarks, int scale, int window_size, const FaceModelParameters& parameters, cv::Mat_<int>& landmark_mask)
+{
+	vector<int> reused;
+	if (scale >= (int)response_cache.size() || response_cache[scale].responses.empty())
+	{
+		return reused;
+	}
+
+	const ResponseCache& cache = response_cache[scale];
+	int view_id = patch_experts.GetViewIdx(params_global, scale);
+
+	// The responses are sampled in the reference frame, so the face has to be about the same size and orientation
+	bool same_frame = cache.view_id == view_id && cache.window_size == window_size &&
+		std::abs(params_global[0] / cache.params_global[0] - 1.0f) < RESPONSE_REUSE_MAX_SCALE_CHANGE;
+	for (int r = 1; r < 4; ++r)
+	{
+		same_frame = same_frame && std::abs(params_global[r] - cache.params_global[r]) < RESPONSE_REUSE_MAX_ROTATION_CHANGE;
+	}
+	if (!same_frame)
+	{
+		return reused;
+	}
+
+	int n = pdm.NumberOfPoints();
+	vector<char> reusable(n, 0);
+	for (int i = 0; i < n; ++i)
+	{
+		float dx = landmarks.at<float>(i) - cache.landmarks.at<float>(i);
+		float dy = landmarks.at<float>(i + n) - cache.landmarks.at<float>(i + n);
+		reusable[i] = !cache.responses[i].empty() && cache.ages[i] < RESPONSE_REUSE_MAX_AGE &&
+			dx * dx + dy * dy < parameters.response_reuse_threshold * parameters.response_reuse_threshold;
+	}
+
+	// The symmetric CEN views compute the mirrored landmarks together, so those are only reused in pairs
+	bool mirrored_pairs = patch_experts.MirroredPairs(view_id);
+	for (int i = 0; i < n; ++i)
+	{
+		if (reusable[i] && (!mirrored_pairs || reusable[patch_experts.mirror_inds.at<int>(i)]))
+		{
+			reused.push_back(i);
 		}
-		else
+	}
+
+	if (!reused.empty())
+	{
+		landmark_mask = landmark_mask.empty() ? cv::Mat_<int>::ones(n, 1) : landmark_mask.clone();
+		for (size_t i = 0; i < reused.size(); ++i)
 		{
-			detection_certainty = 0;
+			landmark_mask.at<int>(reused[i]) = 0;
 		}
-
 	}
-
-	return detection_success;
+	return reused;
 }
 
-//=============================================================================
-bool CLNF::Fit(const cv::Mat_<float>& im, const std::vector<int>& window_sizes, const FaceModelParameters& parameters)
+void CLNF::UpdateResponseCache(vector<cv::Mat_<float> >& patch_expert_responses, const cv::Mat_<float>& landmarks, const cv::Matx22f& sim_img_to_ref, int scale,
+	int window_size, const vector<int>& reused, const cv::Mat_<int>& landmark_mask)
 {
-	// Making sure it is a single channel image
-	assert(im.channels() == 1);	
-	
-	// Placeholder for the landmarks
-	cv::Mat_<float> current_shape(2 * pdm.NumberOfPoints() , 1, 0.0f);
+	int n = pdm.NumberOfPoints();
+	int view_id = patch_experts.GetViewIdx(params_global, scale);
 
-	int n = pdm.NumberOfPoints(); 
-		
-	int num_scales = patch_experts.patch_scaling.size();
+	if ((int)response_cache.size() <= scale)
+	{
+		response_cache.resize(scale + 1);
+	}
+	ResponseCache& cache = response_cache[scale];
+	if ((int)cache.responses.size() != n)
+	{
+		cache.responses.assign(n, cv::Mat_<float>());
+		cache.ages.assign(n, 0);
+		cache.landmarks = cv::Mat_<float>::zeros(2 * n, 1);
+	}
 
-	// Storing the patch expert response maps
-	vector<cv::Mat_<float> > patch_expert_responses(n);
+	vector<char> is_reused(n, 0);
+	for (size_t k = 0; k < reused.size(); ++k)
+	{
+		int i = reused[k];
+		is_reused[i] = 1;
+
+		// The response window is centred on the landmark, so it is shifted by how much the landmark moved (in the reference frame)
+		cv::Vec2f shift = sim_img_to_ref * cv::Vec2f(landmarks.at<float>(i) - cache.landmarks.at<float>(i), landmarks.at<float>(i + n) - cache.landmarks.at<float>(i + n));
+		cv::Matx23f translation(1, 0, shift[0], 0, 1, shift[1]);
+		cv::warpAffine(cache.responses[i], patch_expert_responses[i], translation, cache.responses[i].size(), cv::INTER_LINEAR | cv::WARP_INVERSE_MAP, cv::BORDER_REPLICATE);
+		cache.ages[i]++;
+	}
 
-	// Converting from image space to patch expert space (normalised for rotation and scale)
-	cv::Matx22f sim_ref_to_img;
-	cv::Matx22f sim_img_to_ref;
+	// Caching the computed responses, the ones of invisible or unmasked landmarks were not computed
+	const cv::Mat_<int>& visibilities = patch_experts.visibilities[scale][view_id];
+	for (int i = 0; i < n; ++i)
+	{
+		if (is_reused[i])
+			continue;
 
-	FaceModelParameters tmp_parameters = parameters;
+		if (visibilities.at<int>(i) != 0 && (landmark_mask.empty() || landmark_mask.at<int>(i) != 0))
+		{
+			patch_expert_responses[i].copyTo(cache.responses[i]);
+			cache.landmarks.at<float>(i) = landmarks.at<float>(i);
+			cache.landmarks.at<float>(i + n) = landmarks.at<float>(i + n);
+			cache.ages[i] = 0;
+		}
+		else
+		{
+			cache.responses[i].release();
+		}
+	}
 
-	// Active scale is there in case we need to upsample too much
-	int active_scale = 0;
+	cache.params_global = params_global;
+	cache.view_id = view_id;
+	cache.window_size = window_size;
+}
 
-	// Optimise the model across a number of areas of interest (usually in descending window size and ascending scale size)
-	for(int scale = 0; scale < num_scales; scale++)
+//=============================================================================
+// The fitting parameters at a particular scale, with less regularisation but a larger sigma and Tikhonov factor as the scale increases
+FaceModelParameters CLNF::ScaleParameters(const FaceModelParameters& parameters, int scale) const
+{
+	FaceModelParameters tmp_parameters = parameters;
+
+	if(parameters.refine_parameters == true)
 	{
-		// Control the number of iterations through window size
-		if (window_sizes[scale] == 0)
-			continue;
+		int scale_max = scale >= 2 ? 2 : scale;
 
-		int window_size = window_sizes[scale];
+		// Adapt the parameters based on scale (wan't to reduce regularisation as scale increases, but increase sigma and Tikhonov)
+		tmp_parameters.reg_factor = parameters.reg_factor - 15 * log(patch_experts.patch_scaling[scale_max]/0.25)/log(2);
+		
+		if(tmp_parameters.reg_factor <= 0)
+			tmp_parameters.reg_factor = 0.001;
 
-		// The patch expert response computation
-		patch_experts.Response(patch_expert_responses, sim_ref_to_img, sim_img_to_ref, im, pdm, params_global, params_local, window_size, scale);
+		tmp_parameters.sigma = parameters.sigma + 0.25 * log(patch_experts.patch_scaling[scale_max]/0.25)/log(2);
+		tmp_parameters.weight_factor = parameters.weight_factor + 2 * parameters.weight_factor *  log(patch_experts.patch_scaling[scale_max]/0.25)/log(2);
+	}
+	return tmp_parameters;
+}
 
-		if(parameters.refine_parameters == true)
-		{
-			int scale_max = scale >= 2 ? 2 : scale;
+// The optimisation at a particular scale given patch expert responses around the current estimate, returns false if the face is too small to track
+bool CLNF::OptimiseScale(const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Matx22f& sim_ref_to_img, const cv::Matx22f& sim_img_to_ref, int window_size, int scale, bool last_scale, const FaceModelParameters& parameters)
+{
+	FitState state;
+	LoadFitState(state);
+	bool success = OptimiseScale(state, patch_expert_responses, sim_ref_to_img, sim_img_to_ref, window_size, scale, last_scale, parameters);
+	StoreFitState(state);
+	return success;
+}
 
-			// Adapt the parameters based on scale (wan't to reduce regularisation as scale increases, but increase sigma and Tikhonov)
-			tmp_parameters.reg_factor = parameters.reg_factor - 15 * log(patch_experts.patch_scaling[scale_max]/0.25)/log(2);
-			
-			if(tmp_parameters.reg_factor <= 0)
-				tmp_parameters.reg_factor = 0.001;
+bool CLNF::OptimiseScale(FitState& state, const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Matx22f& sim_ref_to_img, const cv::Matx22f& sim_img_to_ref, int window_size, int scale, bool last_scale, const FaceModelParameters& parameters)
+{
+	FaceModelParameters tmp_parameters = ScaleParameters(parameters, scale);
 
-			tmp_parameters.sigma = parameters.sigma + 0.25 * log(patch_experts.patch_scaling[scale_max]/0.25)/log(2);
-			tmp_parameters.weight_factor = parameters.weight_factor + 2 * parameters.weight_factor *  log(patch_experts.patch_scaling[scale_max]/0.25)/log(2);
-		}
+	cv::Vec6f& params_global = state.params_global;
+	cv::Mat_<float>& params_local = state.params_local;
 
-		// Get the current landmark locations
-		pdm.CalcShape2D(current_shape, params_local, params_global);
+	// Get the current landmark locations
+	cv::Mat_<float> current_shape(2 * pdm.NumberOfPoints(), 1, 0.0f);
+	pdm.CalcShape2D(current_shape, params_local, params_global);
 
-		// Get the view used by patch experts
-		int view_id = patch_experts.GetViewIdx(params_global, scale);
-		this->view_used = view_id;
+	// Get the view used by patch experts
+	int view_id = patch_experts.GetViewIdx(params_global, scale);
+	state.view_used = view_id;
 
-		// the actual optimisation step
-		this->NU_RLMS(params_global, params_local, patch_expert_responses, cv::Vec6f(params_global), params_local.clone(), current_shape, sim_img_to_ref, sim_ref_to_img, window_size, view_id, true, scale, this->landmark_likelihoods, tmp_parameters, false);
+	// The landmarks that take part in the fit
+	cv::Mat_<int> landmark_mask = FitLandmarkMask(pdm.NumberOfPoints(), parameters);
+	if (landmark_mask.empty())
+	{
+		state.fit_visibilities = patch_experts.visibilities[scale][view_id];
+	}
+	else
+	{
+		state.fit_visibilities = patch_experts.visibilities[scale][view_id].mul(landmark_mask);
+	}
 
-		// non-rigid optimisation
+	// If we are terminating next iteration, make sure to record the model likelihood
+	bool compute_lhood = last_scale || params_global[0] < 0.30;
 
-		// If we are terminating next iteration, make sure to record the model likelihood
-		if(scale == num_scales - 1 || window_sizes[scale + 1] == 0 || params_global[0] < 0.30)
-		{			
-			this->model_likelihood = this->NU_RLMS(params_global, params_local, patch_expert_responses, cv::Vec6f(params_global), params_local.clone(), current_shape, sim_img_to_ref, sim_ref_to_img, window_size, view_id, false, scale, this->landmark_likelihoods, tmp_parameters, true);
-		}
-		else
-		{
-			this->NU_RLMS(params_global, params_local, patch_expert_responses, cv::Vec6f(params_global), params_local.clone(), current_shape, sim_img_to_ref, sim_ref_to_img, window_size, view_id, false, scale, this->landmark_likelihoods, tmp_parameters, false);
-		}
+	// Only tracking the pose without any shape modes leaves just the rigid optimisation
+	bool rigid_only = parameters.pose_only && parameters.pose_only_modes <= 0;
 
-		// Can't track very small images reliably (less than ~30px across)
-		if (params_global[0] < 0.25)
-		{
-			cout << "Face too small for landmark detection" << endl;
-			return false;
-		}
+	// rigid optimisation
+	if (rigid_only && compute_lhood)
+	{
+		state.model_likelihood = this->NU_RLMS(params_global, params_local, patch_expert_responses, cv::Vec6f(params_global), params_local.clone(), current_shape, sim_img_to_ref, sim_ref_to_img, window_size, view_id, true, scale, state.landmark_likelihoods, tmp_parameters, true, state.fit_visibilities, state.own_fit);
+	}
+	else
+	{
+		this->NU_RLMS(params_global, params_local, patch_expert_responses, cv::Vec6f(params_global), params_local.clone(), current_shape, sim_img_to_ref, sim_ref_to_img, window_size, view_id, true, scale, state.landmark_likelihoods, tmp_parameters, false, state.fit_visibilities, state.own_fit);
+	}
 
-		// Making sure we do not upsample too much
-		if (active_scale < num_scales - 1 && 0.9 * patch_experts.patch_scaling[active_scale + 1] < params_global[0])
-			active_scale = active_scale + 1;
+	// non-rigid optimisation
+	if (!rigid_only && compute_lhood)
+	{
+		state.model_likelihood = this->NU_RLMS(params_global, params_local, patch_expert_responses, cv::Vec6f(params_global), params_local.clone(), current_shape, sim_img_to_ref, sim_ref_to_img, window_size, view_id, false, scale, state.landmark_likelihoods, tmp_parameters, true, state.fit_visibilities, state.own_fit);
+	}
+	else if (!rigid_only)
+	{
+		this->NU_RLMS(params_global, params_local, patch_expert_responses, cv::Vec6f(params_global), params_local.clone(), current_shape, sim_img_to_ref, sim_ref_to_img, window_size, view_id, false, scale, state.landmark_likelihoods, tmp_parameters, false, state.fit_visibilities, state.own_fit);
+	}
 
+	// Can't track very small images reliably (less than ~30px across)
+	if (params_global[0] < 0.25)
+	{
+		cout << "Face too small for landmark detection" << endl;
+		return false;
 	}
 
 	return true;
 }
 
-void CLNF::NonVectorisedMeanShift_precalc_kde(cv::Mat_<float>& out_mean_shifts, const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Mat_<float> &dxs, const cv::Mat_<float> &dys, int resp_size, float a, int scale, int view_id, map<int, cv::Mat_<float> >& kde_resp_precalc)
+void CLNF::MeanShift_precalc_kde(cv::Mat_<float>& out_mean_shifts, const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Mat_<float> &dxs, const cv::Mat_<float> &dys, int resp_size, float a, int scale, int view_id, vector<cv::Mat_<float> >& kde_resp_precalc,
+	const cv::Mat_<int>& fit_visibilities)
 {
 	
 	int n = dxs.rows;
 	
-	cv::Mat_<float> kde_resp;
-	float step_size = 0.1;
-
-	// if this has not been precomputer, precompute it, otherwise use it
-	if(kde_resp_precalc.find(resp_size) == kde_resp_precalc.end())
-	{		
-		kde_resp = cv::Mat_<float>((int)((resp_size / step_size)*(resp_size/step_size)), resp_size * resp_size);
-		cv::MatIterator_<float> kde_it = kde_resp.begin();
+	float step_size = KDE_STEP_SIZE;
 
-		for(int x = 0; x < resp_size/step_size; x++)
-		{
-			float dx = x * step_size;
-			for(int y = 0; y < resp_size/step_size; y++)
-			{
-				float dy = y * step_size;
+	// Every row of the table is the KDE over the response window for one quantised offset, the rows are padded to a multiple of 4 floats
+	int resp_area = resp_size * resp_size;
+	int row_length = (resp_area + 3) & ~3;
 
-				int ii,jj;
-				float v,vx,vy;
-			
-				for(ii = 0; ii < resp_size; ii++)
-				{
-					vx = (dy-ii)*(dy-ii);
-					for(jj = 0; jj < resp_size; jj++)
-					{
-						vy = (dx-jj)*(dx-jj);
+	// if this has not been precomputer, precompute it, otherwise use it
+	PrecomputeKDE(kde_resp_precalc, resp_size, a, step_size);
 
-						// the KDE evaluation of that point
-						v = exp(a*(vx+vy));
-						
-						*kde_it++ = v;
-					}
-				}
-			}
-		}
+	const cv::Mat_<float>& kde_resp = kde_resp_precalc[resp_size];
 
-		kde_resp_precalc[resp_size] = kde_resp.clone();
-	}
-	else
+	// The x and y coordinates of every element of the (flattened) response window
+	cv::Mat_<float> coords(2, row_length, 0.0f);
+	for(int k = 0; k < resp_area; ++k)
 	{
-		// use the precomputed version
-		kde_resp = kde_resp_precalc.find(resp_size)->second;
+		coords(0, k) = (float)(k % resp_size);
+		coords(1, k) = (float)(k / resp_size);
 	}
+	const float* coord_x = coords.ptr<float>(0);
+	const float* coord_y = coords.ptr<float>(1);
+
+	// Only the whole blocks of 4 can be read from the responses, the rest is done separately
+	int vec_end = resp_area & ~3;
 
 	// for every point (patch) calculating mean-shift
 	for(int i = 0; i < n; i++)
 	{
-		if(patch_experts.visibilities[scale][view_id].at<int>(i,0) == 0)
+		if(fit_visibilities.at<int>(i,0) == 0)
 		{
 			out_mean_shifts.at<float>(i,0) = 0;
 			out_mean_shifts.at<float>(i+n,0) = 0;
@@ -900,31 +2350,42 @@ void CLNF::NonVectorisedMeanShift_precalc_kde(cv::Mat_<float>& out_mean_shifts,
 		
 		int idx = closest_row * ((int)(resp_size/step_size + 0.5)) + closest_col; // Plus 0.5 is there, as C++ rounds down with int cast
 
-		cv::MatIterator_<float> kde_it = kde_resp.begin() + kde_resp.cols*idx;
-		
+		const float* kde = kde_resp.ptr<float>(idx);
+
+		// The responses are normally continuous, as they are allocated by the patch experts, copy them if not
+		cv::Mat_<float> response = patch_expert_responses[i];
+		if(!response.isContinuous())
+			response = response.clone();
+		const float* p = response.ptr<float>(0);
+
 		float mx=0.0;
 		float my=0.0;
 		float sum=0.0;
 
-		// Iterate over the patch responses here
-		cv::MatConstIterator_<float> p = patch_expert_responses[i].begin();
-			
-		// TODO maybe do through MatMuls instead?
-		for(int ii = 0; ii < resp_size; ii++)
+		// The AVX2 or AVX-512 variant first if the CPU has it, the rest is then finished here
+		int k = Kernels::MeanShiftSums(p, kde, coord_x, coord_y, 0, resp_area, sum, mx, my);
+#if CV_SIMD128
+		cv::v_float32x4 v_sum = cv::v_setzero_f32(), v_mx = cv::v_setzero_f32(), v_my = cv::v_setzero_f32();
+		for(; k < vec_end; k += 4)
 		{
-			for(int jj = 0; jj < resp_size; jj++)
-			{
-
-				// the KDE evaluation of that point multiplied by the probability at the current, xi, yi
-				float v = (*p++) * (*kde_it++);
-
-				sum += v;
-
-				// mean shift in x and y
-				mx += v*jj;
-				my += v*ii; 
+			// the KDE evaluation of that point multiplied by the probability at the current, xi, yi
+			cv::v_float32x4 v = cv::v_load(p + k) * cv::v_load(kde + k);
+			v_sum += v;
+			v_mx = cv::v_muladd(v, cv::v_load(coord_x + k), v_mx);
+			v_my = cv::v_muladd(v, cv::v_load(coord_y + k), v_my);
+		}
+		sum += cv::v_reduce_sum(v_sum);
+		mx += cv::v_reduce_sum(v_mx);
+		my += cv::v_reduce_sum(v_my);
+#endif
+		for(; k < resp_area; ++k)
+		{
+			float v = p[k] * kde[k];
+			sum += v;
 
-			}
+			// mean shift in x and y
+			mx += v * coord_x[k];
+			my += v * coord_y[k];
 		}
 		
 		float msx = (mx/sum - dx);
@@ -946,6 +2407,9 @@ void CLNF::GetWeightMatrix(cv::Mat_<float>& WeightMatrix, int scale, int view_id
 	{
 		WeightMatrix = cv::Mat_<float>::zeros(n*2, n*2);
 
+		// The patch experts of the view might not have been read in by this copy of the model yet
+		patch_experts.LoadView(scale, view_id);
+
 		for (int p=0; p < n; p++)
 		{
 			if (!patch_experts.cen_expert_intensity.empty())
@@ -992,21 +2456,26 @@ void CLNF::GetWeightMatrix(cv::Mat_<float>& WeightMatrix, int scale, int view_id
 //=============================================================================
 float CLNF::NU_RLMS(cv::Vec6f& final_global, cv::Mat_<float>& final_local, const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Vec6f& initial_global, const cv::Mat_<float>& initial_local,
 		          const cv::Mat_<float>& base_shape, const cv::Matx22f& sim_img_to_ref, const cv::Matx22f& sim_ref_to_img, int resp_size, int view_id, bool rigid, int scale, cv::Mat_<float>& landmark_lhoods,
-				  const FaceModelParameters& parameters, bool compute_lhood)
+				  const FaceModelParameters& parameters, bool compute_lhood, const cv::Mat_<int>& fit_visibilities, bool own_fit)
 {		
+	TRACE_SCOPE("CLNF::NU_RLMS");
+
 
 	int n = pdm.NumberOfPoints();  
+
+	// The shape model that is fit, only its first modes when only tracking the pose or when truncated for speed (the other modes are left at zero)
+	PDM& fit_pdm = rigid ? pdm : FitPDM(parameters.pose_only ? parameters.pose_only_modes : parameters.num_fit_modes);
 	
 	// Mean, eigenvalues, eigenvectors
-	cv::Mat_<float> M = this->pdm.mean_shape;
-	cv::Mat_<float> E = this->pdm.eigen_values;
-	//Mat_<float> V = this->pdm.princ_comp;
+	cv::Mat_<float> M = fit_pdm.mean_shape;
+	cv::Mat_<float> E = fit_pdm.eigen_values;
+	//Mat_<float> V = fit_pdm.princ_comp;
 
-	int m = pdm.NumberOfModes();
+	int m = fit_pdm.NumberOfModes();
 	
 	cv::Vec6f current_global(initial_global);
 
-	cv::Mat_<float> current_local = initial_local.clone();
+	cv::Mat_<float> current_local = initial_local.rowRange(0, m).clone();
 
 	cv::Mat_<float> current_shape;
 	cv::Mat_<float> previous_shape;
@@ -1030,40 +2499,70 @@ float CLNF::NU_RLMS(cv::Vec6f& final_global, cv::Mat_<float>& final_local, const
 	cv::Mat_<float> WeightMatrix;
 	GetWeightMatrix(WeightMatrix, scale, view_id, parameters);
 
+	// Only the diagonal of the weight matrix is used, the non-visible observations get a weight of zero so they do not contribute to the update
+	cv::Mat_<float> weights = WeightMatrix.diag().clone();
+	for(int i = 0; i < n; ++i)
+	{
+		if(fit_visibilities.at<int>(i,0) == 0)
+		{
+			weights.at<float>(i) = 0.0f;
+			weights.at<float>(i + n) = 0.0f;
+		}
+	}
+
+	// When only some of the landmarks are fit, the Jacobian and the normal equations are only formed for them (on the shape model subsampled
+	// to those landmarks), the others have zero weight anyway
+	vector<int> fit_points = FitLandmarkPoints(n, parameters);
+	const int n_fit = fit_points.empty() ? n : (int)fit_points.size();
+	const PDM& jacobian_pdm = fit_points.empty() ? fit_pdm : SubsetFitPDM(fit_pdm, fit_points);
+
+	cv::Mat_<float> fit_weights = weights;
+	cv::Mat_<float> fit_mean_shifts;
+	if (!fit_points.empty())
+	{
+		fit_weights.create(2 * n_fit, 1);
+		fit_mean_shifts.create(2 * n_fit, 1);
+		for (int i = 0; i < n_fit; ++i)
+		{
+			fit_weights.at<float>(i) = weights.at<float>(fit_points[i]);
+			fit_weights.at<float>(i + n_fit) = weights.at<float>(fit_points[i] + n);
+		}
+	}
+
 	cv::Mat_<float> dxs, dys;
 	
 	// The preallocated memory for the mean shifts
 	cv::Mat_<float> mean_shifts(2 * pdm.NumberOfPoints(), 1, 0.0);
 
+	// The preallocated workspaces of the update computation, reused across iterations
+	cv::Mat_<float> J, shape_3D, J_w_t_m, Hessian;
+
 	// Number of iterations
 	for(int iter = 0; iter < parameters.num_optimisation_iteration; iter++)
 	{
 		// get the current estimates of x
-		pdm.CalcShape2D(current_shape, current_local, current_global);
+		fit_pdm.CalcShape2D(current_shape, current_local, current_global);
 		
 		if(iter > 0)
 		{
 			// if the shape hasn't changed terminate
-			if(norm(current_shape, previous_shape) < 0.01)
+			if(norm(current_shape, previous_shape) < parameters.rlms_convergence_threshold)
 			{				
 				break;
 			}
+
+			// Past the deadline keep the current estimate
+			if(own_fit && !DeadlineAllows(0))
+			{
+				deadline_degradations |= DEGRADATION_FEWER_ITERATIONS;
+				break;
+			}
 		}
 
 		current_shape.copyTo(previous_shape);
 		
-		// Jacobian, and transposed weighted jacobian
-		cv::Mat_<float> J, J_w_t;
-
 		// calculate the appropriate Jacobians in 2D, even though the actual behaviour is in 3D, using small angle approximation and oriented shape
-		if(rigid)
-		{
-			pdm.ComputeRigidJacobian(current_local, current_global, J, WeightMatrix, J_w_t);
-		}
-		else
-		{
-			pdm.ComputeJacobian(current_local, current_global, J, WeightMatrix, J_w_t);
-		}
+		jacobian_pdm.ComputeJacobianInPlace(current_local, current_global, rigid, J, shape_3D);
 		
 		// useful for mean shift calculation
 		float a = -0.5/(parameters.sigma * parameters.sigma);
@@ -1077,7 +2576,7 @@ float CLNF::NU_RLMS(cv::Vec6f& final_global, cv::Mat_<float>& final_local, const
 		dxs = offsets.col(0) + (resp_size-1)/2;
 		dys = offsets.col(1) + (resp_size-1)/2;
 		
-		NonVectorisedMeanShift_precalc_kde(mean_shifts, patch_expert_responses, dxs, dys, resp_size, a, scale, view_id, kde_resp_precalc);
+		MeanShift_precalc_kde(mean_shifts, patch_expert_responses, dxs, dys, resp_size, a, scale, view_id, kde_resp_precalc, fit_visibilities);
 
 		// Now transform the mean shifts to the the image reference frame, as opposed to one of ref shape (object space)
 		cv::Mat_<float> mean_shifts_2D = (mean_shifts.reshape(1, 2)).t();
@@ -1085,56 +2584,37 @@ float CLNF::NU_RLMS(cv::Vec6f& final_global, cv::Mat_<float>& final_local, const
 		mean_shifts_2D = mean_shifts_2D * cv::Mat(sim_ref_to_img).t();
 		mean_shifts = cv::Mat(mean_shifts_2D.t()).reshape(1, n*2);
 
-		// remove non-visible observations
-		for(int i = 0; i < n; ++i)
+		// projection of the meanshifts onto the jacobians (using the weighted Jacobian, see Baltrusaitis 2013) and the Hessian J'WJ + regTerm,
+		// both formed directly from the Jacobian, the non-visible observations have zero weight
+		if (!fit_points.empty())
 		{
-			// if patch unavailable for current index
-			if(patch_experts.visibilities[scale][view_id].at<int>(i,0) == 0)
-			{				
-				cv::Mat Jx = J.row(i);
-				Jx = cvScalar(0);
-				cv::Mat Jy = J.row(i+n);
-				Jy = cvScalar(0);
-
-				Jx = J_w_t.col(i);
-				Jx = cvScalar(0);
-				Jy = J_w_t.col(i + n);
-				Jy = cvScalar(0);
-
-				mean_shifts.at<float>(i,0) = 0.0f;
-				mean_shifts.at<float>(i+n,0) = 0.0f;
+			for (int i = 0; i < n_fit; ++i)
+			{
+				fit_mean_shifts.at<float>(i) = mean_shifts.at<float>(fit_points[i]);
+				fit_mean_shifts.at<float>(i + n_fit) = mean_shifts.at<float>(fit_points[i] + n);
 			}
 		}
+		regTerm.copyTo(Hessian);
+		PDM::WeightedNormalEquations(J, fit_weights, fit_points.empty() ? mean_shifts : fit_mean_shifts, Hessian, J_w_t_m);
 
-		// projection of the meanshifts onto the jacobians (using the weighted Jacobian, see Baltrusaitis 2013)
-		cv::Mat_<float> J_w_t_m = J_w_t * mean_shifts;
-
-		// Add the regularisation term
+		// Add the regularisation term (it is diagonal)
 		if(!rigid)
 		{
-			J_w_t_m(cv::Rect(0,6,1, m)) = J_w_t_m(cv::Rect(0,6,1, m)) - regTerm(cv::Rect(6,6, m, m)) * current_local;
+			for(int j = 0; j < m; ++j)
+			{
+				J_w_t_m.at<float>(6 + j) -= regTerm.at<float>(6 + j, 6 + j) * current_local.at<float>(j);
+			}
 		}
 
-		cv::Mat_<float> Hessian = regTerm.clone();
-
-		// Perform matrix multiplication in OpenBLAS (fortran call)
-		float alpha1 = 1.0;
-		float beta1 = 1.0;
-		char N[2]; N[0] = 'N';
-		sgemm_(N, N, &J.cols, &J_w_t.rows, &J_w_t.cols, &alpha1, (float*)J.data, &J.cols, (float*)J_w_t.data, &J_w_t.cols, &beta1, (float*)Hessian.data, &J.cols);
-
-		// Above is a fast (but ugly) version of 
-		// cv::Mat_<float> Hessian = J_w_t * J + regTerm;
-
-		// Solve for the parameter update (from Baltrusaitis 2013 based on eq (36) Saragih 2011)
-		cv::Mat_<float> param_update;
-		cv::solve(Hessian, J_w_t_m, param_update, cv::DECOMP_CHOLESKY);
+		// Solve for the parameter update (from Baltrusaitis 2013 based on eq (36) Saragih 2011), in place in the preallocated workspaces
+		// (J_w_t_m holds the update afterwards)
+		PDM::SolveNormalEquations(Hessian, J_w_t_m);
 		
 		// update the reference
-		pdm.UpdateModelParameters(param_update, current_local, current_global);		
+		fit_pdm.UpdateModelParameters(J_w_t_m, current_local, current_global);		
 		
 		// clamp to the local parameters for valid expressions
-		pdm.Clamp(current_local, current_global, parameters);
+		fit_pdm.Clamp(current_local, current_global, parameters);
 
 	}
 
@@ -1148,7 +2628,7 @@ float CLNF::NU_RLMS(cv::Vec6f& final_global, cv::Mat_<float>& final_local, const
 		for(int i = 0; i < n; i++)
 		{
 
-			if(patch_experts.visibilities[scale][view_id].at<int>(i,0) == 0 )
+			if(fit_visibilities.at<int>(i,0) == 0 )
 			{
 				continue;
 			}
@@ -1183,19 +2663,123 @@ float CLNF::NU_RLMS(cv::Vec6f& final_global, cv::Mat_<float>& final_local, const
 			loglhood += log(sum + 1e-8);
 
 		}	
-		loglhood = loglhood/sum(patch_experts.visibilities[scale][view_id])[0];
+		loglhood = loglhood/sum(fit_visibilities)[0];
 	}
 
 	final_global = current_global;
-	final_local = current_local;
+
+	// Padding the modes that were not fit with zeros, so the parameters are those of the full model
+	if(m < initial_local.rows)
+	{
+		final_local = cv::Mat_<float>::zeros(initial_local.rows, 1);
+		current_local.copyTo(final_local.rowRange(0, m));
+	}
+	else
+	{
+		final_local = current_local;
+	}
 
 	return loglhood;
 
 }
 
+// The shape model with only the first num_modes modes, made once (and again only if the model changes), the full model for all of them
+PDM& CLNF::FitPDM(int num_modes)
+{
+	if (num_modes <= 0 || num_modes >= pdm.NumberOfModes())
+	{
+		return pdm;
+	}
+
+	if (fit_pdm.NumberOfModes() != num_modes || fit_pdm.mean_shape.data != pdm.mean_shape.data)
+	{
+		fit_pdm = pdm.Truncated(num_modes);
+	}
+	return fit_pdm;
+}
+
+// The fit shape model subsampled to the fit landmarks, made once per number of modes (the rigid and the non-rigid fits can use models with
+// different numbers of them) and again only if the model or the landmarks change
+const PDM& CLNF::SubsetFitPDM(const PDM& source, const vector<int>& points)
+{
+	if (subset_fit_points != points)
+	{
+		subset_fit_pdms.clear();
+		subset_fit_points = points;
+	}
+
+	// Only looking up the models that are up to date, so that the concurrent fits (see PrepareConcurrentFits) do not change the map
+	std::map<int, std::pair<cv::Mat_<float>, PDM> >::iterator found = subset_fit_pdms.find(source.NumberOfModes());
+	if (found != subset_fit_pdms.end() && found->second.first.data == source.mean_shape.data)
+	{
+		return found->second.second;
+	}
+
+	// Keeping a reference to the source mean shape, so that the source is recognised even if the same memory was reused for another model
+	std::pair<cv::Mat_<float>, PDM>& subset = subset_fit_pdms[source.NumberOfModes()];
+	if (subset.first.data != source.mean_shape.data)
+	{
+		subset.first = source.mean_shape;
+		subset.second = source.Subsampled(points);
+	}
+	return subset.second;
+}
+
+void CLNF::HierarchicalFitPDMs()
+{
+	if (hierarchical_fit_pdms.size() == hierarchical_models.size())
+	{
+		return;
+	}
+
+	hierarchical_fit_pdms.clear();
+	for (size_t part = 0; part < hierarchical_models.size(); ++part)
+	{
+		vector<int> part_points;
+		for (size_t mapping_ind = 0; mapping_ind < hierarchical_mapping[part].size(); ++mapping_ind)
+		{
+			part_points.push_back(hierarchical_mapping[part][mapping_ind].second);
+		}
+		hierarchical_fit_pdms.push_back(hierarchical_models[part].pdm.Subsampled(part_points));
+	}
+}
+
 // Getting a 3D shape model from the current detected landmarks (in camera space)
+// Comparing the matrices by value
+static bool SameValues(const cv::Mat_<float>& a, const cv::Mat_<float>& b)
+{
+	if (a.rows != b.rows || a.cols != b.cols)
+	{
+		return false;
+	}
+	return a.empty() || std::equal(a.begin(), a.end(), b.begin());
+}
+
+FrameResult& CLNF::GetFrameResult() const
+{
+	bool current = frame_result.has_state && frame_result.params_global == params_global &&
+		SameValues(frame_result.params_local, params_local) && SameValues(frame_result.detected_landmarks, detected_landmarks);
+
+	if (!current)
+	{
+		frame_result = FrameResult();
+		frame_result.has_state = true;
+		frame_result.params_global = params_global;
+		frame_result.params_local = params_local.clone();
+		frame_result.detected_landmarks = detected_landmarks.clone();
+	}
+	return frame_result;
+}
+
 cv::Mat_<float> CLNF::GetShape(float fx, float fy, float cx, float cy) const
 {
+	FrameResult& result = GetFrameResult();
+	cv::Vec4f camera(fx, fy, cx, cy);
+	if (result.has_shape && result.shape_camera == camera)
+	{
+		return result.shape_3D.clone();
+	}
+
 	int n = this->detected_landmarks.rows/2;
 
 	cv::Mat_<float> shape3d(n*3, 1);
@@ -1230,20 +2814,36 @@ cv::Mat_<float> CLNF::GetShape(float fx, float fy, float cx, float cy) const
 	}
 
 	// The format is 3 rows - n cols
-	return outShape.t();
+	result.shape_3D = outShape.t();
+	result.shape_camera = camera;
+	result.has_shape = true;
+
+	return result.shape_3D.clone();
 	
 }
 
 cv::Mat_<int> CLNF::GetVisibilities() const
 {
-	// Get the view of the largest scale
-	int scale = patch_experts.visibilities.size() - 1;
-	int view_id = patch_experts.GetViewIdx(params_global, scale);
+	FrameResult& result = GetFrameResult();
+	if (!result.has_visibilities)
+	{
+		// Get the view of the largest scale
+		int scale = patch_experts.visibilities.size() - 1;
+		int view_id = patch_experts.GetViewIdx(params_global, scale);
+
+		result.visibilities = this->patch_experts.visibilities[scale][view_id];
+		result.has_visibilities = true;
+	}
 
-	cv::Mat_<int> visibilities_to_ret = this->patch_experts.visibilities[scale][view_id].clone();
+	cv::Mat_<int> visibilities_to_ret = result.visibilities.clone();
 	return visibilities_to_ret;
 }
 
+bool CLNF::HierarchicalPartValid(int part) const
+{
+	return part >= 0 && part < (int)hierarchical_part_valid.size() && hierarchical_part_valid[part] != 0;
+}
+
 // A utility bounding box function
 cv::Rect_<float> CLNF::GetBoundingBox() const
 {
@@ -1254,3 +2854,144 @@ cv::Rect_<float> CLNF::GetBoundingBox() const
 	cv::Rect_<float> model_rect(min_x, min_y, max_x - min_x, max_y - min_y);
 	return model_rect;
 }
+
+// The version of the state written by WriteState, increased whenever what is written changes
+static const int32_t TRACKING_STATE_VERSION = 1;
+
+void CLNF::WriteState(std::ostream& stream) const
+{
+	WriteStateValue<int32_t>(stream, TRACKING_STATE_VERSION);
+
+	WriteStateMat(stream, params_local);
+	WriteStateValue(stream, params_global);
+	WriteStateMat(stream, detected_landmarks);
+
+	WriteStateValue<char>(stream, detection_success);
+	WriteStateValue<char>(stream, tracking_initialised);
+	WriteStateValue(stream, detection_certainty);
+	WriteStateValue(stream, model_likelihood);
+	WriteStateValue<int32_t>(stream, failures_in_a_row);
+	WriteStateValue<int32_t>(stream, view_used);
+
+	WriteStateMat(stream, face_template);
+	WriteStateValue(stream, face_template_scaling);
+	WriteStateValue(stream, face_template_correlation);
+	WriteStateValue<int32_t>(stream, face_template_age);
+	WriteStateMat(stream, scene_histogram);
+	WriteStateValue<int32_t>(stream, working_level);
+
+	WriteStateMat(stream, propagation_frame);
+	WriteStateValue<int32_t>(stream, frames_since_full_fit);
+	WriteStateValue<int32_t>(stream, frames_since_validation);
+	WriteStateValue(stream, validated_likelihood);
+	WriteStateValue(stream, last_face_box);
+	WriteStateValue<int32_t>(stream, roi_detection_misses);
+
+	WriteStateValue<int32_t>(stream, (int32_t)hierarchical_models.size());
+	for (size_t part = 0; part < hierarchical_models.size(); ++part)
+	{
+		hierarchical_models[part].WriteState(stream);
+	}
+}
+
+bool CLNF::ReadState(std::istream& stream)
+{
+	int32_t version;
+	if (!ReadStateValue(stream, version) || version != TRACKING_STATE_VERSION)
+	{
+		std::cout << "The tracking state was written by a different version" << std::endl;
+		return false;
+	}
+
+	cv::Mat_<float> new_params_local, new_landmarks;
+	cv::Vec6f new_params_global;
+	if (!ReadStateMat(stream, new_params_local) || !ReadStateValue(stream, new_params_global) || !ReadStateMat(stream, new_landmarks) ||
+		new_params_local.rows != params_local.rows || new_landmarks.rows != detected_landmarks.rows)
+	{
+		std::cout << "The tracking state does not match the model" << std::endl;
+		return false;
+	}
+
+	// Everything not in the state starts afresh, as after a reset
+	Reset();
+
+	params_local = new_params_local;
+	params_global = new_params_global;
+	detected_landmarks = new_landmarks;
+
+	char success, initialised;
+	int32_t failures, view, template_age, level, since_full_fit, since_validation, misses, num_parts;
+	bool read = ReadStateValue(stream, success) && ReadStateValue(stream, initialised) && ReadStateValue(stream, detection_certainty) &&
+		ReadStateValue(stream, model_likelihood) && ReadStateValue(stream, failures) && ReadStateValue(stream, view) &&
+		ReadStateMat(stream, face_template) && ReadStateValue(stream, face_template_scaling) && ReadStateValue(stream, face_template_correlation) &&
+		ReadStateValue(stream, template_age) && ReadStateMat(stream, scene_histogram) && ReadStateValue(stream, level) &&
+		ReadStateMat(stream, propagation_frame) && ReadStateValue(stream, since_full_fit) && ReadStateValue(stream, since_validation) &&
+		ReadStateValue(stream, validated_likelihood) && ReadStateValue(stream, last_face_box) && ReadStateValue(stream, misses) &&
+		ReadStateValue(stream, num_parts) && num_parts == (int32_t)hierarchical_models.size();
+
+	for (size_t part = 0; read && part < hierarchical_models.size(); ++part)
+	{
+		read = hierarchical_models[part].ReadState(stream);
+	}
+
+	if (!read)
+	{
+		std::cout << "Could not read the tracking state" << std::endl;
+		Reset();
+		return false;
+	}
+
+	detection_success = success != 0;
+	tracking_initialised = initialised != 0;
+	failures_in_a_row = failures;
+	view_used = view;
+	face_template_age = template_age;
+	working_level = level;
+	frames_since_full_fit = since_full_fit;
+	frames_since_validation = since_validation;
+	roi_detection_misses = misses;
+	last_face_rotation = cv::Vec3f(params_global[1], params_global[2], params_global[3]);
+
+	return true;
+}
+
+void CLNF::ReportMemory(Utilities::MemoryReport& report, const string& component) const
+{
+	pdm.ReportMemory(report, component + "/pdm");
+	patch_experts.ReportMemory(report, component + "/patch_experts");
+	report.Add(component + "/triangulations", triangulations);
+	landmark_validator.ReportMemory(report, component + "/validator");
+	face_detector_MTCNN.ReportMemory(report, component + "/mtcnn");
+
+	for (size_t part = 0; part < hierarchical_models.size(); ++part)
+	{
+		string name = part < hierarchical_model_names.size() ? hierarchical_model_names[part] : to_string(part);
+		hierarchical_models[part].ReportMemory(report, component + "/hierarchical/" + name);
+	}
+
+	report.Add(component + "/cache/kde_resp_precalc", kde_resp_precalc);
+	report.Add(component + "/cache/response_maps", response_maps);
+	for (const ResponseCache& cache : response_cache)
+	{
+		report.Add(component + "/cache/response_cache", cache.responses);
+		report.Add(component + "/cache/response_cache", cache.landmarks);
+	}
+
+	// The truncated and subsampled shape models are copies made on first use
+	fit_pdm.ReportMemory(report, component + "/cache/fit_pdms");
+	for (map<int, std::pair<cv::Mat_<float>, PDM> >::const_iterator it = subset_fit_pdms.begin(); it != subset_fit_pdms.end(); ++it)
+	{
+		report.Add(component + "/cache/fit_pdms", it->second.first);
+		it->second.second.ReportMemory(report, component + "/cache/fit_pdms");
+	}
+	for (const PDM& part_pdm : hierarchical_fit_pdms)
+	{
+		part_pdm.ReportMemory(report, component + "/cache/fit_pdms");
+	}
+
+	report.Add(component + "/cache/tracking", face_template);
+	report.Add(component + "/cache/tracking", scene_histogram);
+	report.Add(component + "/cache/tracking", propagation_frame);
+	report.Add(component + "/cache/tracking", detected_landmarks);
+	report.Add(component + "/cache/tracking", landmark_likelihoods);
+}
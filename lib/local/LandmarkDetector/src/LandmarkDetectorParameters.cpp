@@ -35,6 +35,11 @@
 #include "stdafx.h"
 
 #include "LandmarkDetectorParameters.h"
+#include "CEN_patch_expert.h"
+#include "CNN_utils.h"
+
+#include <Concurrency.h>
+#include <TuningCache.h>
 
 // Boost includes
 #include <filesystem.hpp>
@@ -72,6 +77,17 @@ FaceModelParameters::FaceModelParameters(vector<string> &arguments)
 	bool* valid = new bool[arguments.size()];
 	valid[0] = true;
 
+	bool response_grain_set = false;
+
+	// The preset is the base the rest of the arguments are applied on, so it is applied first
+	for (size_t i = 1; i + 1 < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-preset") == 0 && !ApplyPreset(arguments[i + 1]))
+		{
+			std::cout << "Unknown preset " << arguments[i + 1] << ", using the default parameters" << std::endl;
+		}
+	}
+
 	for (size_t i = 1; i < arguments.size(); ++i)
 	{
 		valid[i] = true;
@@ -150,6 +166,274 @@ FaceModelParameters::FaceModelParameters(vector<string> &arguments)
 			valid[i + 1] = false;
 			i++;
 		}
+		else if (arguments[i].compare("-cnn_backend") == 0)
+		{
+			// The backend is process wide, so it is set straight away
+			if (arguments[i + 1].compare("opencl") == 0)
+			{
+				SetCNNBackend(OPENCL_BACKEND);
+			}
+			else if (arguments[i + 1].compare("onnxruntime") == 0)
+			{
+				SetCNNBackend(ONNXRUNTIME_BACKEND);
+			}
+			else
+			{
+				SetCNNBackend(CPU_BACKEND);
+			}
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-onnx_provider") == 0)
+		{
+			// The ONNX Runtime execution provider (cpu, cuda, tensorrt, openvino, ...) of the onnxruntime CNN backend, also process wide
+			SetOnnxExecutionProvider(arguments[i + 1]);
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-quant") == 0)
+		{
+			quantised_patch_experts = true;
+			valid[i] = false;
+		}
+		else if (arguments[i].compare("-fp16_weights") == 0)
+		{
+			SetHalfPrecisionWeights(true);
+			valid[i] = false;
+		}
+		else if (arguments[i].compare("-realtime_memory") == 0)
+		{
+			realtime_memory = true;
+			valid[i] = false;
+		}
+		else if (arguments[i].compare("-fit_modes") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> num_fit_modes;
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-pose_only") == 0)
+		{
+			pose_only = true;
+			valid[i] = false;
+		}
+		else if (arguments[i].compare("-pose_only_modes") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> pose_only_modes;
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-response_reuse") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> response_reuse_threshold;
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-coarse_to_fine") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> coarse_to_fine_window;
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-response_grain") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> response_grain_size;
+			response_grain_set = true;
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-tuning_cache") == 0)
+		{
+			tuning_cache_location = arguments[i + 1];
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-landmark_subset") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> landmark_subset;
+
+			if (landmark_subset != 0 && landmark_subset != 49 && landmark_subset != 51)
+			{
+				std::cout << "The landmark subset has to be 49, 51 or 0 (all of the landmarks), fitting all of them" << std::endl;
+				landmark_subset = 0;
+			}
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-no_part_gating") == 0)
+		{
+			gate_parts = false;
+			valid[i] = false;
+		}
+		else if (arguments[i].compare("-part_min_size") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> part_min_size;
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-skip_part") == 0)
+		{
+			skipped_parts.push_back(arguments[i + 1]);
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-tiered_validation") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> tiered_validation_margin;
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-validate_every") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> validate_every;
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-preset") == 0 && i + 1 < arguments.size())
+		{
+			// Already applied above
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-fit_every") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> full_fit_every;
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-track_eyes") == 0)
+		{
+			track_eyes_between_fits = true;
+			valid[i] = false;
+		}
+		else if (arguments[i].compare("-deadline_ms") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> frame_deadline_ms;
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-adaptive") == 0)
+		{
+			// Cheaper tracking of slowly moving faces, by skipping the coarse scales and stopping the optimisation earlier
+			adaptive_tracking = true;
+			rlms_convergence_threshold = 0.5f;
+			valid[i] = false;
+		}
+		else if (arguments[i].compare("-motion_prediction") == 0)
+		{
+			motion_prediction = true;
+			valid[i] = false;
+		}
+		else if (arguments[i].compare("-motion_damping") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> motion_prediction_damping;
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-adaptive_resolution") == 0)
+		{
+			adaptive_resolution = true;
+			valid[i] = false;
+		}
+		else if (arguments[i].compare("-working_face_width") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> adaptive_resolution_face_width;
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-noscenecut") == 0)
+		{
+			scene_cut_detection = false;
+			valid[i] = false;
+		}
+		else if (arguments[i].compare("-scene_cut_threshold") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> scene_cut_threshold;
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-async_detect") == 0)
+		{
+			async_face_detection = true;
+			valid[i] = false;
+		}
+		else if (arguments[i].compare("-mtcnn_fast") == 0)
+		{
+			mtcnn_single_face_fast = true;
+			valid[i] = false;
+		}
+		else if (arguments[i].compare("-mtcnn_autotune") == 0)
+		{
+			mtcnn_autotune_convolutions = true;
+			valid[i] = false;
+		}
+		else if (arguments[i].compare("-roi_detect") == 0)
+		{
+			roi_detection = true;
+			valid[i] = false;
+		}
+		else if (arguments[i].compare("-roi_scale") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> roi_detection_scale;
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-roi_attempts") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> roi_detection_attempts;
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
 		else if (arguments[i].compare("-q") == 0)
 		{
 
@@ -186,6 +470,19 @@ FaceModelParameters::FaceModelParameters(vector<string> &arguments)
 		}
 	}
 
+	// The tuned choices, unless set explicitly
+	if (!tuning_cache_location.empty() && Utilities::TuningCache::Global().Load(tuning_cache_location) && !response_grain_set)
+	{
+		Utilities::TuningCache::Global().Get("clnf/response_grain_size", response_grain_size);
+	}
+
+	// The thread limit of the profile, unless the process is already limited (the container limit only if the profile is lower)
+	if (max_threads > 0 && (Utilities::Concurrency::GetNumThreads() == 0 ||
+		(Utilities::Concurrency::IsContainerDefault() && max_threads < Utilities::Concurrency::GetNumThreads())))
+	{
+		Utilities::Concurrency::SetNumThreads(max_threads);
+	}
+
 
 	// Make sure model_location is valid
 	// First check working directory, then the executable's directory, then the config path set by the build process.
@@ -291,6 +588,155 @@ void FaceModelParameters::check_model_path(const std::string& root)
 	}
 }
 
+vector<string> FaceModelParameters::PresetNames()
+{
+	vector<string> names;
+	names.push_back("realtime_edge");
+	names.push_back("realtime_server");
+	names.push_back("offline_accurate");
+	names.push_back("low_power");
+	names.push_back("gaze_hfr");
+	return names;
+}
+
+bool FaceModelParameters::ApplyPreset(const string& name)
+{
+	if (name.compare("realtime_edge") == 0)
+	{
+		// A single small scale when tracking, with few iterations
+		window_sizes_small[0] = 0; window_sizes_small[1] = 7; window_sizes_small[2] = 0; window_sizes_small[3] = 0;
+		window_sizes_init[0] = 11; window_sizes_init[1] = 9; window_sizes_init[2] = 7; window_sizes_init[3] = 0;
+		num_optimisation_iteration = 3;
+
+		refine_hierarchical = false;
+		refine_parameters = true;
+		quantised_patch_experts = true;
+
+		validate_detections = true;
+		validate_every = 5;
+		tiered_validation_margin = 0.15f;
+		multi_view = false;
+
+		// Looking for the lost face less often and only around where it was
+		reinit_video_every = 4;
+		curr_face_detector = MTCNN_DETECTOR;
+		async_face_detection = true;
+		roi_detection = true;
+		mtcnn_single_face_fast = true;
+
+		// The single small window relies on starting close to the answer
+		motion_prediction = true;
+	}
+	else if (name.compare("realtime_server") == 0)
+	{
+		window_sizes_small[0] = 0; window_sizes_small[1] = 9; window_sizes_small[2] = 7; window_sizes_small[3] = 0;
+		window_sizes_init[0] = 11; window_sizes_init[1] = 9; window_sizes_init[2] = 7; window_sizes_init[3] = 5;
+		num_optimisation_iteration = 5;
+
+		refine_hierarchical = true;
+		refine_parameters = true;
+		quantised_patch_experts = false;
+
+		validate_detections = true;
+		validate_every = 3;
+		multi_view = false;
+
+		reinit_video_every = 2;
+		curr_face_detector = MTCNN_DETECTOR;
+		async_face_detection = true;
+		roi_detection = true;
+		mtcnn_single_face_fast = false;
+		motion_prediction = true;
+	}
+	else if (name.compare("offline_accurate") == 0)
+	{
+		// The in the wild settings, every frame is fully fit
+		window_sizes_init[0] = 15; window_sizes_init[1] = 13; window_sizes_init[2] = 11; window_sizes_init[3] = 11;
+		window_sizes_small = window_sizes_init;
+		num_optimisation_iteration = 10;
+
+		sigma = 1.25f;
+		reg_factor = 35.0f;
+		weight_factor = 2.5f;
+
+		refine_hierarchical = true;
+		refine_parameters = true;
+		quantised_patch_experts = false;
+
+		validate_detections = true;
+		validate_every = 1;
+		multi_view = true;
+
+		reinit_video_every = 1;
+		full_fit_every = 1;
+		curr_face_detector = MTCNN_DETECTOR;
+		async_face_detection = false;
+		roi_detection = false;
+		mtcnn_single_face_fast = false;
+	}
+	else if (name.compare("low_power") == 0)
+	{
+		// The realtime_edge fits, but only on every third frame, so that the cores can idle in between
+		window_sizes_small[0] = 0; window_sizes_small[1] = 7; window_sizes_small[2] = 0; window_sizes_small[3] = 0;
+		window_sizes_init[0] = 11; window_sizes_init[1] = 9; window_sizes_init[2] = 7; window_sizes_init[3] = 0;
+		num_optimisation_iteration = 3;
+
+		refine_hierarchical = false;
+		refine_parameters = true;
+		quantised_patch_experts = true;
+		motion_prediction = true;
+		full_fit_every = 3;
+		response_reuse_threshold = 0.5f;
+
+		validate_detections = true;
+		validate_every = 10;
+		tiered_validation_margin = 0.15f;
+		multi_view = false;
+
+		// The cheapest detector, on the tracking thread rather than waking up another one
+		reinit_video_every = 8;
+		curr_face_detector = HOG_SVM_DETECTOR;
+		async_face_detection = false;
+		roi_detection = true;
+		mtcnn_single_face_fast = true;
+
+		// A few large tasks on a couple of threads wake up fewer cores than many small ones
+		max_threads = 2;
+		response_grain_size = 17;
+	}
+	else if (name.compare("gaze_hfr") == 0)
+	{
+		// The default fits for the face, but only on every fourth frame, at a high frame rate the head barely moves in between
+		window_sizes_small[0] = 0; window_sizes_small[1] = 9; window_sizes_small[2] = 7; window_sizes_small[3] = 0;
+		window_sizes_init[0] = 11; window_sizes_init[1] = 9; window_sizes_init[2] = 7; window_sizes_init[3] = 5;
+		num_optimisation_iteration = 5;
+
+		refine_hierarchical = true;
+		refine_parameters = true;
+		motion_prediction = true;
+		full_fit_every = 4;
+
+		// The eye models on every frame from the predicted head pose
+		track_eyes_between_fits = true;
+
+		validate_detections = true;
+		validate_every = 4;
+		multi_view = false;
+
+		// The detection is kept off the tracking thread, so that the frames keep coming at the camera rate
+		reinit_video_every = 2;
+		async_face_detection = true;
+		roi_detection = true;
+	}
+	else
+	{
+		return false;
+	}
+
+	window_sizes_current = window_sizes_init;
+	return true;
+}
+
 void FaceModelParameters::init()
 {
 
@@ -300,12 +746,45 @@ void FaceModelParameters::init()
 	// using an external face checker based on SVM
 	validate_detections = true;
 
+	// Validating every tracked frame by default
+	validate_every = 1;
+	validation_likelihood_drop = 0.5f;
+	tiered_validation_margin = 0;
+
 	// Using hierarchical refinement by default (can be turned off)
 	refine_hierarchical = true;
+	refine_part = true;
+
+	// Not refining the parts that are self occluded or only a few pixels across (e.g. the eyes of faces far from the camera)
+	gate_parts = true;
+	part_min_size = 8;
 
 	// Refining parameters by default
 	refine_parameters = true;
 
+	// Float inference by default
+	quantised_patch_experts = false;
+
+	// The memory is paged by the OS as usual by default
+	realtime_memory = false;
+
+	// All of the shape modes are fit by default
+	num_fit_modes = 0;
+
+	// The full model is fit by default, for pose only tracking just the rigid parameters on the jaw corners and chin, the brows, the nose,
+	// the eye corners and the mouth corners (symmetric, so that the mirrored patch experts can still be evaluated together)
+	pose_only = false;
+	pose_only_modes = 0;
+	int stable_landmarks[] = { 0, 4, 8, 12, 16, 17, 19, 21, 22, 24, 26, 27, 30, 31, 33, 35, 36, 39, 42, 45, 48, 51, 54, 57 };
+	pose_only_landmarks = vector<int>(stable_landmarks, stable_landmarks + sizeof(stable_landmarks) / sizeof(int));
+
+	// All of the landmarks are fit by default, and their responses are always computed
+	landmark_subset = 0;
+	response_reuse_threshold = 0;
+	coarse_to_fine_window = 0;
+	response_grain_size = 1;
+	max_threads = 0;
+
 	window_sizes_small = vector<int>(4);
 	window_sizes_init = vector<int>(4);
 
@@ -322,9 +801,26 @@ void FaceModelParameters::init()
 	window_sizes_init.at(3) = 5;
 
 	face_template_scale = 0.3f;
+	face_template_refresh_correlation = 0.9f;
+	face_template_max_age = 30;
 	// Off by default (as it might lead to some slight inaccuracies in slowly moving faces)
 	use_face_template = false;
 
+	adaptive_tracking = false;
+	adaptive_motion_threshold = 0.01f;
+	adaptive_min_correlation = 0.9f;
+	rlms_convergence_threshold = 0.01f;
+
+	motion_prediction = false;
+	motion_prediction_damping = 0.8f;
+
+	scene_cut_detection = true;
+	scene_cut_threshold = 0.5f;
+
+	adaptive_resolution = false;
+	adaptive_resolution_face_width = 150.0f;
+	adaptive_resolution_detection_width = 1280;
+
 	// For first frame use the initialisation
 	window_sizes_current = window_sizes_init;
 
@@ -342,6 +838,13 @@ void FaceModelParameters::init()
 
 	reinit_video_every = 2;
 
+	// Fit every frame by default
+	full_fit_every = 1;
+	track_eyes_between_fits = false;
+
+	// No per frame deadline by default
+	frame_deadline_ms = 0;
+
 	// Face detection
 	haar_face_detector_location = "classifiers/haarcascade_frontalface_alt.xml";
 	mtcnn_face_detector_location = "model/mtcnn_detector/MTCNN_detector.txt";
@@ -349,6 +852,13 @@ void FaceModelParameters::init()
 
 	// By default use MTCNN
 	curr_face_detector = MTCNN_DETECTOR;
+	async_face_detection = false;
+
+	roi_detection = false;
+	roi_detection_scale = 2.0f;
+	roi_detection_attempts = 3;
+	mtcnn_single_face_fast = false;
+	mtcnn_autotune_convolutions = false;
 
 }
 
@@ -35,12 +35,15 @@
 #include "stdafx.h"
 
 #include <LandmarkDetectorUtils.h>
+#include <CpuDispatch.h>
 #include <RotationHelpers.h>
+#include <TextValueReader.h>
 
 // OpenCV includes
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/calib3d.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 
 using namespace std;
 
@@ -378,6 +381,7 @@ namespace LandmarkDetector
 		{
 			n = shape2D.rows / 2;
 		}
+		landmarks.reserve(n);
 
 		for (int i = 0; i < n; ++i)
 		{
@@ -496,6 +500,7 @@ namespace LandmarkDetector
 	//============================================================================
 	// Face detection helpers
 	//============================================================================
+#ifndef OPENFACE_SLIM_LANDMARK_DETECTOR
 	bool DetectFaces(vector<cv::Rect_<float> >& o_regions, const cv::Mat_<uchar>& intensity, float min_width, cv::Rect_<float> roi)
 	{
 		cv::CascadeClassifier classifier("./classifiers/haarcascade_frontalface_alt.xml");
@@ -511,19 +516,9 @@ namespace LandmarkDetector
 
 	}
 
-	bool DetectFaces(vector<cv::Rect_<float> >& o_regions, const cv::Mat_<uchar>& intensity, cv::CascadeClassifier& classifier, float min_width, cv::Rect_<float> roi)
+	// Converting the Haar cascade detections to the boxes CLNF expects, keeping those of at least min_width within the roi (if min_width is set)
+	static bool CorrectHaarDetections(vector<cv::Rect_<float> >& o_regions, const vector<cv::Rect>& face_detections, cv::Size image_size, float min_width, cv::Rect_<float> roi)
 	{
-
-		vector<cv::Rect> face_detections;
-		if (min_width == -1)
-		{
-			classifier.detectMultiScale(intensity, face_detections, 1.2, 2, 0, cv::Size(50, 50));
-		}
-		else
-		{
-			classifier.detectMultiScale(intensity, face_detections, 1.2, 2, 0, cv::Size(min_width, min_width));
-		}
-
 		// Convert from int bounding box do a double one with corrections
 		for (size_t face = 0; face < face_detections.size(); ++face)
 		{
@@ -543,7 +538,7 @@ namespace LandmarkDetector
 
 			if (min_width != -1)
 			{
-				if (region.width < min_width || region.x < ((float)intensity.cols) * roi.x || region.y < ((float)intensity.cols) * roi.y || region.x + region.width >((float)intensity.cols) * (roi.x + roi.width) || region.y + region.height >((float)intensity.rows) * (roi.y + roi.height))
+				if (region.width < min_width || region.x < ((float)image_size.width) * roi.x || region.y < ((float)image_size.width) * roi.y || region.x + region.width >((float)image_size.width) * (roi.x + roi.width) || region.y + region.height >((float)image_size.height) * (roi.y + roi.height))
 					continue;
 			}
 
@@ -553,56 +548,84 @@ namespace LandmarkDetector
 		return o_regions.size() > 0;
 	}
 
-	bool DetectSingleFace(cv::Rect_<float>& o_region, const cv::Mat_<uchar>& intensity_image, cv::CascadeClassifier& classifier, cv::Point preference, float min_width, cv::Rect_<float> roi)
+	bool DetectFaces(vector<cv::Rect_<float> >& o_regions, const cv::Mat_<uchar>& intensity, cv::CascadeClassifier& classifier, float min_width, cv::Rect_<float> roi)
 	{
-		// The tracker can return multiple faces
-		vector<cv::Rect_<float> > face_detections;
-
-		bool detect_success = LandmarkDetector::DetectFaces(face_detections, intensity_image, classifier, min_width, roi);
 
-		if (detect_success)
+		vector<cv::Rect> face_detections;
+		if (min_width == -1)
 		{
+			classifier.detectMultiScale(intensity, face_detections, 1.2, 2, 0, cv::Size(50, 50));
+		}
+		else
+		{
+			classifier.detectMultiScale(intensity, face_detections, 1.2, 2, 0, cv::Size(min_width, min_width));
+		}
 
-			bool use_preferred = (preference.x != -1) && (preference.y != -1);
+		return CorrectHaarDetections(o_regions, face_detections, intensity.size(), min_width, roi);
+	}
+
+	bool DetectFaces(vector<cv::Rect_<float> >& o_regions, ImageContext& frame, FaceDetectorHaar& detector, float min_width, cv::Rect_<float> roi)
+	{
+		vector<cv::Rect> face_detections;
+		detector.DetectFaces(face_detections, frame, min_width);
 
-			if (face_detections.size() > 1)
+		return CorrectHaarDetections(o_regions, face_detections, frame.GrayHalved(0).size(), min_width, roi);
+	}
+
+	// Picking the face closest to the preference point, or the biggest one if it is not set
+	static void PickSingleFace(cv::Rect_<float>& o_region, const vector<cv::Rect_<float> >& face_detections, cv::Point preference)
+	{
+		bool use_preferred = (preference.x != -1) && (preference.y != -1);
+
+		if (face_detections.size() > 1)
+		{
+			// keep the closest one if preference point not set
+			float best = -1;
+			int bestIndex = -1;
+			for (size_t i = 0; i < face_detections.size(); ++i)
 			{
-				// keep the closest one if preference point not set
-				float best = -1;
-				int bestIndex = -1;
-				for (size_t i = 0; i < face_detections.size(); ++i)
-				{
-					float dist;
-					bool better;
+				float dist;
+				bool better;
 
-					if (use_preferred)
-					{
-						dist = sqrt((preference.x) * (face_detections[i].width / 2 + face_detections[i].x) +
-							(preference.y) * (face_detections[i].height / 2 + face_detections[i].y));
-						better = dist < best;
-					}
-					else
-					{
-						dist = face_detections[i].width;
-						better = face_detections[i].width > best;
-					}
+				if (use_preferred)
+				{
+					dist = sqrt((preference.x) * (face_detections[i].width / 2 + face_detections[i].x) +
+						(preference.y) * (face_detections[i].height / 2 + face_detections[i].y));
+					better = dist < best;
+				}
+				else
+				{
+					dist = face_detections[i].width;
+					better = face_detections[i].width > best;
+				}
 
-					// Pick a closest face to preffered point or the biggest face
-					if (i == 0 || better)
-					{
-						bestIndex = i;
-						best = dist;
-					}
+				// Pick a closest face to preffered point or the biggest face
+				if (i == 0 || better)
+				{
+					bestIndex = i;
+					best = dist;
 				}
+			}
 
-				o_region = face_detections[bestIndex];
+			o_region = face_detections[bestIndex];
 
-			}
-			else
-			{
-				o_region = face_detections[0];
-			}
+		}
+		else
+		{
+			o_region = face_detections[0];
+		}
+	}
+
+	bool DetectSingleFace(cv::Rect_<float>& o_region, const cv::Mat_<uchar>& intensity_image, cv::CascadeClassifier& classifier, cv::Point preference, float min_width, cv::Rect_<float> roi)
+	{
+		// The tracker can return multiple faces
+		vector<cv::Rect_<float> > face_detections;
+
+		bool detect_success = LandmarkDetector::DetectFaces(face_detections, intensity_image, classifier, min_width, roi);
 
+		if (detect_success)
+		{
+			PickSingleFace(o_region, face_detections, preference);
 		}
 		else
 		{
@@ -612,9 +635,26 @@ namespace LandmarkDetector
 		return detect_success;
 	}
 
+	bool DetectSingleFace(cv::Rect_<float>& o_region, ImageContext& frame, FaceDetectorHaar& detector, cv::Point preference, float min_width, cv::Rect_<float> roi)
+	{
+		vector<cv::Rect_<float> > face_detections;
+
+		bool detect_success = LandmarkDetector::DetectFaces(face_detections, frame, detector, min_width, roi);
+
+		if (detect_success)
+		{
+			PickSingleFace(o_region, face_detections, preference);
+		}
+		else
+		{
+			o_region = cv::Rect_<float>(0, 0, 0, 0);
+		}
+		return detect_success;
+	}
+
 	bool DetectFacesHOG(vector<cv::Rect_<float> >& o_regions, const cv::Mat_<uchar>& intensity, std::vector<float>& confidences, float min_width, cv::Rect_<float> roi)
 	{
-		dlib::frontal_face_detector detector = dlib::get_frontal_face_detector();
+		FaceDetectorHOG detector;
 
 		return DetectFacesHOG(o_regions, intensity, detector, confidences, min_width, roi);
 
@@ -670,19 +710,62 @@ namespace LandmarkDetector
 		return o_regions.size() > 0;
 	}
 
-	bool DetectSingleFaceHOG(cv::Rect_<float>& o_region, const cv::Mat_<uchar>& intensity_img, dlib::frontal_face_detector& detector, float& confidence, cv::Point preference, float min_width, cv::Rect_<float> roi)
+	bool DetectFacesHOG(vector<cv::Rect_<float> >& o_regions, const cv::Mat_<uchar>& intensity, FaceDetectorHOG& detector, std::vector<float>& o_confidences, float min_width, cv::Rect_<float> roi)
 	{
+		if (detector.empty())
+		{
+			detector.Read();
+		}
 
-		if (detector.num_detectors() == 0)
+		cv::Mat_<uchar> upsampled_intensity;
+
+		float scaling = 1.3f;
+
+		cv::resize(intensity, upsampled_intensity, cv::Size((int)(intensity.cols * scaling), (int)(intensity.rows * scaling)));
+
+		// Only scanning around the region of interest (with a margin for the parts of the detection windows outside of the corrected regions), and
+		// not scanning the levels of the pyramid whose detections would be narrower than min_width after the corrections
+		cv::Rect scan_roi;
+		float min_detection_width = -1;
+		if (min_width != -1)
 		{
-			detector = dlib::get_frontal_face_detector();
+			float margin = 0.25f * std::max(roi.width * upsampled_intensity.cols, roi.height * upsampled_intensity.rows);
+			scan_roi = cv::Rect((int)(roi.x * upsampled_intensity.cols - margin), (int)(roi.y * upsampled_intensity.rows - margin),
+				(int)(roi.width * upsampled_intensity.cols + 2 * margin), (int)(roi.height * upsampled_intensity.rows + 2 * margin));
+			min_detection_width = min_width * scaling / 0.9611f;
 		}
 
-		// The tracker can return multiple faces
-		vector<cv::Rect_<float> > face_detections;
-		vector<float> confidences;
-		bool detect_success = LandmarkDetector::DetectFacesHOG(face_detections, intensity_img, detector, confidences, min_width, roi);
+		std::vector<cv::Rect_<float> > face_detections;
+		std::vector<float> confidences;
+		detector.DetectFaces(face_detections, confidences, upsampled_intensity, -0.2f, scan_roi, min_detection_width);
 
+		// Convert to the bounding box expected by CLNF, with the same corrections as for the dlib detector
+		for (size_t face = 0; face < face_detections.size(); ++face)
+		{
+			cv::Rect_<float> region;
+			region.x = (face_detections[face].x + 0.0389f * face_detections[face].width) / scaling;
+			region.y = (face_detections[face].y + 0.1278f * face_detections[face].height) / scaling;
+			region.width = (face_detections[face].width * 0.9611f) / scaling;
+			region.height = (face_detections[face].height * 0.9388f) / scaling;
+
+			if (min_width != -1)
+			{
+				if (region.width < min_width || region.x < ((float)intensity.cols) * roi.x || region.y < ((float)intensity.cols) * roi.y ||
+					region.x + region.width >((float)intensity.cols) * (roi.x + roi.width) || region.y + region.height >((float)intensity.rows) * (roi.y + roi.height))
+					continue;
+			}
+
+			o_regions.push_back(region);
+			o_confidences.push_back(confidences[face]);
+		}
+		return o_regions.size() > 0;
+	}
+#endif
+
+	// Picking the face from the HOG (or plug-in) detections, the closest one to the preference point if it is set or the biggest one otherwise
+	static bool PickSingleFace(cv::Rect_<float>& o_region, float& confidence, const vector<cv::Rect_<float> >& face_detections, const vector<float>& confidences,
+		bool detect_success, cv::Point preference)
+	{
 		// In case of multiple faces pick the biggest one
 		bool use_size = true;
 
@@ -753,6 +836,34 @@ namespace LandmarkDetector
 		return detect_success;
 	}
 
+#ifndef OPENFACE_SLIM_LANDMARK_DETECTOR
+	bool DetectSingleFaceHOG(cv::Rect_<float>& o_region, const cv::Mat_<uchar>& intensity_img, dlib::frontal_face_detector& detector, float& confidence, cv::Point preference, float min_width, cv::Rect_<float> roi)
+	{
+
+		if (detector.num_detectors() == 0)
+		{
+			detector = dlib::get_frontal_face_detector();
+		}
+
+		// The tracker can return multiple faces
+		vector<cv::Rect_<float> > face_detections;
+		vector<float> confidences;
+		bool detect_success = LandmarkDetector::DetectFacesHOG(face_detections, intensity_img, detector, confidences, min_width, roi);
+
+		return PickSingleFace(o_region, confidence, face_detections, confidences, detect_success, preference);
+	}
+
+	bool DetectSingleFaceHOG(cv::Rect_<float>& o_region, const cv::Mat_<uchar>& intensity_img, FaceDetectorHOG& detector, float& confidence, cv::Point preference, float min_width, cv::Rect_<float> roi)
+	{
+		// The tracker can return multiple faces
+		vector<cv::Rect_<float> > face_detections;
+		vector<float> confidences;
+		bool detect_success = LandmarkDetector::DetectFacesHOG(face_detections, intensity_img, detector, confidences, min_width, roi);
+
+		return PickSingleFace(o_region, confidence, face_detections, confidences, detect_success, preference);
+	}
+#endif
+
 bool DetectFacesMTCNN(vector<cv::Rect_<float> >& o_regions, const cv::Mat& image, LandmarkDetector::FaceDetectorMTCNN& detector, std::vector<float>& o_confidences)
 {
 	detector.DetectFaces(o_regions, image, o_confidences);
@@ -761,12 +872,35 @@ bool DetectFacesMTCNN(vector<cv::Rect_<float> >& o_regions, const cv::Mat& image
 }
 
 bool DetectSingleFaceMTCNN(cv::Rect_<float>& o_region, const cv::Mat& image, LandmarkDetector::FaceDetectorMTCNN& detector, float& confidence, cv::Point preference)
+{
+	LandmarkDetector::ImageContext image_context(image, cv::Mat_<uchar>());
+	return DetectSingleFaceMTCNN(o_region, image_context, detector, confidence, preference);
+}
+
+bool DetectFacesMTCNN(vector<cv::Rect_<float> >& o_regions, const cv::Mat& image, LandmarkDetector::FaceDetectorMTCNN& detector, std::vector<float>& o_confidences,
+	vector<vector<cv::Point2f> >& o_keypoints)
+{
+	LandmarkDetector::ImageContext image_context(image, cv::Mat_<uchar>());
+	detector.DetectFaces(o_regions, image_context, o_confidences, o_keypoints);
+
+	return o_regions.size() > 0;
+}
+
+bool DetectSingleFaceMTCNN(cv::Rect_<float>& o_region, LandmarkDetector::ImageContext& image, LandmarkDetector::FaceDetectorMTCNN& detector, float& confidence, cv::Point preference)
+{
+	vector<cv::Point2f> keypoints;
+	return DetectSingleFaceMTCNN(o_region, keypoints, image, detector, confidence, preference);
+}
+
+bool DetectSingleFaceMTCNN(cv::Rect_<float>& o_region, vector<cv::Point2f>& o_keypoints, LandmarkDetector::ImageContext& image, LandmarkDetector::FaceDetectorMTCNN& detector,
+	float& confidence, cv::Point preference)
 {
 	// The tracker can return multiple faces
 	vector<cv::Rect_<float> > face_detections;
 	vector<float> confidences;
+	vector<vector<cv::Point2f> > keypoints;
 
-	detector.DetectFaces(face_detections, image, confidences);
+	detector.DetectFaces(face_detections, image, confidences, keypoints);
 
 	bool detect_success = face_detections.size() > 0;
 	if (detect_success)
@@ -815,17 +949,348 @@ bool DetectSingleFaceMTCNN(cv::Rect_<float>& o_region, const cv::Mat& image, Lan
 
 		o_region = face_detections[bestIndex];
 		confidence = confidences[bestIndex];
+		o_keypoints = keypoints[bestIndex];
 	}
 	else
 	{
 		// if not detected
 		o_region = cv::Rect_<float>(0, 0, 0, 0);
+		o_keypoints.clear();
 		// A completely unreliable detection (shouldn't really matter what is returned here)
 		confidence = -2;
 	}
 	return detect_success;
 }
 
+// Running the plug-in on the whole frame and picking the face from its detections as for the HOG detector
+bool DetectSingleFacePlugin(cv::Rect_<float>& o_region, LandmarkDetector::ImageContext& frame, LandmarkDetector::FaceDetectorPlugin& detector, float& confidence,
+	cv::Point preference)
+{
+	vector<cv::Rect_<float> > face_detections;
+	vector<float> confidences;
+	bool detect_success = detector.DetectFaces(face_detections, confidences, frame) && !face_detections.empty();
+
+	// Detectors that do not score their detections
+	confidences.resize(face_detections.size(), 1.0f);
+
+	return PickSingleFace(o_region, confidence, face_detections, confidences, detect_success, preference);
+}
+
+
+//============================================================================
+// Felzenszwalb HOG features (used by the HOG face detector and the AU analysis)
+//============================================================================
+
+	// Gradients of a single channel image row (for columns 1 to width - 1)
+	static void FHOG_gradient_row(const uchar* row, const uchar* row_top, const uchar* row_bottom, int width, float* grad_x, float* grad_y, float* grad_len)
+	{
+		int x = 1;
+#if CV_SIMD128
+		for(; x + 4 <= width; x += 4)
+		{
+			cv::v_int32x4 left = cv::v_reinterpret_as_s32(cv::v_load_expand_q(row + x - 1));
+			cv::v_int32x4 right = cv::v_reinterpret_as_s32(cv::v_load_expand_q(row + x + 1));
+			cv::v_int32x4 top = cv::v_reinterpret_as_s32(cv::v_load_expand_q(row_top + x));
+			cv::v_int32x4 bottom = cv::v_reinterpret_as_s32(cv::v_load_expand_q(row_bottom + x));
+
+			cv::v_float32x4 dx = cv::v_cvt_f32(right - left);
+			cv::v_float32x4 dy = cv::v_cvt_f32(bottom - top);
+
+			cv::v_store(grad_x + x, dx);
+			cv::v_store(grad_y + x, dy);
+			cv::v_store(grad_len + x, dx * dx + dy * dy);
+		}
+#endif
+		for(; x < width; ++x)
+		{
+			const float dx = (float)((int)row[x + 1] - (int)row[x - 1]);
+			const float dy = (float)((int)row_bottom[x] - (int)row_top[x]);
+			grad_x[x] = dx;
+			grad_y[x] = dy;
+			grad_len[x] = dx * dx + dy * dy;
+		}
+	}
+
+	// Keep the strongest of two gradients, on ties the second one is kept (this matches the channel order used by dlib)
+	static void FHOG_strongest_gradient(float* grad_x, float* grad_y, float* grad_len, const float* other_x, const float* other_y, const float* other_len, int width)
+	{
+		int x = 1;
+#if CV_SIMD128
+		for(; x + 4 <= width; x += 4)
+		{
+			cv::v_float32x4 len = cv::v_load(grad_len + x);
+			cv::v_float32x4 len_other = cv::v_load(other_len + x);
+			cv::v_float32x4 cmp = len > len_other;
+
+			cv::v_store(grad_x + x, cv::v_select(cmp, cv::v_load(grad_x + x), cv::v_load(other_x + x)));
+			cv::v_store(grad_y + x, cv::v_select(cmp, cv::v_load(grad_y + x), cv::v_load(other_y + x)));
+			cv::v_store(grad_len + x, cv::v_select(cmp, len, len_other));
+		}
+#endif
+		for(; x < width; ++x)
+		{
+			if(!(grad_len[x] > other_len[x]))
+			{
+				grad_x[x] = other_x[x];
+				grad_y[x] = other_y[x];
+				grad_len[x] = other_len[x];
+			}
+		}
+	}
+
+	// Snap the gradients to one of 18 orientations and compute their magnitude
+	static void FHOG_orientation_row(const float* grad_x, const float* grad_y, float* grad_len, int* orientation, int width)
+	{
+		// Unit vectors used to compute gradient orientation
+		static const float directions_x[9] = { 1.0000f, 0.9397f, 0.7660f, 0.500f, 0.1736f, -0.1736f, -0.5000f, -0.7660f, -0.9397f };
+		static const float directions_y[9] = { 0.0000f, 0.3420f, 0.6428f, 0.8660f, 0.9848f, 0.9848f, 0.8660f, 0.6428f, 0.3420f };
+
+		// The AVX2 or AVX-512 variant first if the CPU has it, the rest of the row is then finished here
+		int x = Kernels::FHOGOrientationRow(grad_x, grad_y, grad_len, orientation, 1, width);
+#if CV_SIMD128
+		for(; x + 4 <= width; x += 4)
+		{
+			cv::v_float32x4 gx = cv::v_load(grad_x + x);
+			cv::v_float32x4 gy = cv::v_load(grad_y + x);
+			cv::v_float32x4 zero = cv::v_setzero_f32();
+			cv::v_float32x4 best_dot = zero;
+			cv::v_float32x4 best_dot_signed = zero;
+			cv::v_float32x4 best_o = zero;
+
+			// Compare against both the direction and its opposite at once, the sign of the best dot product picks between the two
+			for(int o = 0; o < 9; ++o)
+			{
+				cv::v_float32x4 dot = gx * cv::v_setall_f32(directions_x[o]) + gy * cv::v_setall_f32(directions_y[o]);
+				cv::v_float32x4 dot_abs = cv::v_abs(dot);
+				cv::v_float32x4 cmp = dot_abs > best_dot;
+				best_dot = cv::v_max(best_dot, dot_abs);
+				best_dot_signed = cv::v_select(cmp, dot, best_dot_signed);
+				best_o = cv::v_select(cmp, cv::v_setall_f32((float)o), best_o);
+			}
+			best_o += cv::v_select(best_dot_signed < zero, cv::v_setall_f32(9.0f), zero);
+
+			cv::v_store(orientation + x, cv::v_round(best_o));
+			cv::v_store(grad_len + x, cv::v_sqrt(cv::v_load(grad_len + x)));
+		}
+#endif
+		for(; x < width; ++x)
+		{
+			float best_dot = 0;
+			int best_o = 0;
+			for(int o = 0; o < 9; ++o)
+			{
+				const float dot = grad_x[x] * directions_x[o] + grad_y[x] * directions_y[o];
+				if(dot > best_dot)
+				{
+					best_dot = dot;
+					best_o = o;
+				}
+				else if(-dot > best_dot)
+				{
+					best_dot = -dot;
+					best_o = o + 9;
+				}
+			}
+			orientation[x] = best_o;
+			grad_len[x] = std::sqrt(grad_len[x]);
+		}
+	}
+
+	// Felzenszwalb HOG features of an image. This follows the dlib extract_fhog_features implementation (which is in turn based on features.cc
+	// from voc-release), but works on flat buffers and is vectorised
+	void ExtractFHOG(cv::Mat_<float>& hog, const cv::Mat& image, int& num_rows, int& num_cols, int cell_size)
+	{
+		const int cells_nr = (int)((float)image.rows / (float)cell_size + 0.5);
+		const int cells_nc = (int)((float)image.cols / (float)cell_size + 0.5);
+
+		num_rows = std::max(cells_nr - 2, 0);
+		num_cols = std::max(cells_nc - 2, 0);
+
+		if(num_rows == 0 || num_cols == 0)
+		{
+			num_rows = 0;
+			num_cols = 0;
+			hog = cv::Mat_<float>();
+			return;
+		}
+
+		// Colour images are split into planes (in BGR order), the strongest gradient over the channels is used
+		std::vector<cv::Mat> planes;
+		if(image.channels() == 1)
+		{
+			planes.push_back(image);
+		}
+		else
+		{
+			cv::split(image, planes);
+		}
+
+		// Orientation histograms, with a one cell border so that the bilinear votes do not need boundary checks
+		const int hist_stride = (cells_nc + 2) * 18;
+		std::vector<float> hist((cells_nr + 2) * hist_stride, 0.0f);
+
+		const int visible_nr = std::min(cells_nr * cell_size, image.rows) - 1;
+		const int visible_nc = std::min(cells_nc * cell_size, image.cols) - 1;
+
+		// The horizontal interpolation weights are the same for every row
+		std::vector<int> cell_x(visible_nc);
+		std::vector<float> weight_x(visible_nc);
+		for(int x = 1; x < visible_nc; ++x)
+		{
+			const float xp = ((float)x + 0.5f) / (float)cell_size - 0.5f;
+			const int ixp = (int)std::floor(xp);
+			cell_x[x] = (ixp + 1) * 18;
+			weight_x[x] = xp - ixp;
+		}
+
+		std::vector<float> grad(visible_nc * 6);
+		float* grad_x = &grad[0];
+		float* grad_y = grad_x + visible_nc;
+		float* grad_len = grad_y + visible_nc;
+		float* other_x = grad_len + visible_nc;
+		float* other_y = other_x + visible_nc;
+		float* other_len = other_y + visible_nc;
+		std::vector<int> orientation(visible_nc);
+
+		// First populate the gradient histograms
+		for(int y = 1; y < visible_nr; ++y)
+		{
+			const float yp = ((float)y + 0.5f) / (float)cell_size - 0.5f;
+			const int iyp = (int)std::floor(yp);
+			const float vy0 = yp - iyp;
+			const float vy1 = 1.0f - vy0;
+
+			// The channels are visited in R, G, B order
+			for(int c = (int)planes.size() - 1; c >= 0; --c)
+			{
+				const cv::Mat& plane = planes[c];
+				if(c == (int)planes.size() - 1)
+				{
+					FHOG_gradient_row(plane.ptr<uchar>(y), plane.ptr<uchar>(y - 1), plane.ptr<uchar>(y + 1), visible_nc, grad_x, grad_y, grad_len);
+				}
+				else
+				{
+					FHOG_gradient_row(plane.ptr<uchar>(y), plane.ptr<uchar>(y - 1), plane.ptr<uchar>(y + 1), visible_nc, other_x, other_y, other_len);
+					FHOG_strongest_gradient(grad_x, grad_y, grad_len, other_x, other_y, other_len, visible_nc);
+				}
+			}
+
+			FHOG_orientation_row(grad_x, grad_y, grad_len, orientation.data(), visible_nc);
+
+			// Add the gradient magnitude to the four neighbouring cells using bilinear interpolation
+			float* hist_top = &hist[(iyp + 1) * hist_stride];
+			float* hist_bottom = hist_top + hist_stride;
+			for(int x = 1; x < visible_nc; ++x)
+			{
+				const float v = grad_len[x];
+				const float vx0 = weight_x[x] * v;
+				const float vx1 = (1.0f - weight_x[x]) * v;
+				const int ind = cell_x[x] + orientation[x];
+
+				hist_top[ind] += vy1 * vx1;
+				hist_bottom[ind] += vy0 * vx1;
+				hist_top[ind + 18] += vy1 * vx0;
+				hist_bottom[ind + 18] += vy0 * vx0;
+			}
+		}
+
+		// Compute energy in each cell by summing over orientations
+		std::vector<float> norm(cells_nr * cells_nc);
+		for(int r = 0; r < cells_nr; ++r)
+		{
+			for(int c = 0; c < cells_nc; ++c)
+			{
+				const float* h = &hist[(r + 1) * hist_stride + (c + 1) * 18];
+				float energy = 0;
+				for(int o = 0; o < 9; ++o)
+				{
+					energy += (h[o] + h[o + 9]) * (h[o] + h[o + 9]);
+				}
+				norm[r * cells_nc + c] = energy;
+			}
+		}
+
+		// Compute the features, the 31 channels of every cell are stored contiguously (row major over the cells)
+		hog.create(num_rows, num_cols * 31);
+		float* descriptor_it = hog.ptr<float>(0);
+
+		const float eps = 0.0001f;
+		for(int y = 0; y < num_rows; ++y)
+		{
+			for(int x = 0; x < num_cols; ++x)
+			{
+				// The energies of the four 2x2 cell blocks the current cell belongs to
+				const float* n0 = &norm[y * cells_nc + x];
+				const float* n1 = n0 + cells_nc;
+				const float* n2 = n1 + cells_nc;
+				float block[4] = { n1[1] + n1[2] + n2[1] + n2[2], n0[1] + n0[2] + n1[1] + n1[2], n1[0] + n1[1] + n2[0] + n2[1], n0[0] + n0[1] + n1[0] + n1[1] };
+
+				const float* h = &hist[(y + 2) * hist_stride + (x + 2) * 18];
+#if CV_SIMD128
+				cv::v_float32x4 nn = cv::v_setall_f32(0.2f) * cv::v_sqrt(cv::v_load(block) + cv::v_setall_f32(eps));
+				cv::v_float32x4 n = cv::v_setall_f32(0.1f) / nn;
+				cv::v_float32x4 t = cv::v_setzero_f32();
+
+				// Contrast-sensitive features
+				for(int o = 0; o < 18; ++o)
+				{
+					cv::v_float32x4 h_o = cv::v_min(cv::v_setall_f32(h[o]), nn) * n;
+					descriptor_it[o] = cv::v_reduce_sum(h_o);
+					t += h_o;
+				}
+
+				// Contrast-insensitive features
+				for(int o = 0; o < 9; ++o)
+				{
+					cv::v_float32x4 h_o = cv::v_min(cv::v_setall_f32(h[o] + h[o + 9]), nn) * n;
+					descriptor_it[18 + o] = cv::v_reduce_sum(h_o);
+				}
+
+				// Texture features
+				cv::v_store(descriptor_it + 27, t * cv::v_setall_f32(2.0f * 0.2357f));
+#else
+				float nn[4], n[4], t[4] = { 0, 0, 0, 0 };
+				for(int b = 0; b < 4; ++b)
+				{
+					nn[b] = 0.2f * std::sqrt(block[b] + eps);
+					n[b] = 0.1f / nn[b];
+				}
+
+				// Contrast-sensitive features
+				for(int o = 0; o < 18; ++o)
+				{
+					float sum = 0;
+					for(int b = 0; b < 4; ++b)
+					{
+						const float h_b = std::min(h[o], nn[b]) * n[b];
+						sum += h_b;
+						t[b] += h_b;
+					}
+					descriptor_it[o] = sum;
+				}
+
+				// Contrast-insensitive features
+				for(int o = 0; o < 9; ++o)
+				{
+					float sum = 0;
+					for(int b = 0; b < 4; ++b)
+					{
+						sum += std::min(h[o] + h[o + 9], nn[b]) * n[b];
+					}
+					descriptor_it[18 + o] = sum;
+				}
+
+				// Texture features
+				for(int b = 0; b < 4; ++b)
+				{
+					descriptor_it[27 + b] = t[b] * 2.0f * 0.2357f;
+				}
+#endif
+				descriptor_it += 31;
+			}
+		}
+	}
+
 
 //============================================================================
 // Matrix reading functionality
@@ -841,38 +1306,22 @@ void ReadMat(std::ifstream& stream, cv::Mat &output_mat)
 
 	output_mat = cv::Mat(row, col, type);
 
+	// The values are parsed straight from the stream buffer, a newly created matrix is continuous
 	switch (output_mat.type())
 	{
 	case CV_64FC1:
 	{
-		cv::MatIterator_<double> begin_it = output_mat.begin<double>();
-		cv::MatIterator_<double> end_it = output_mat.end<double>();
-
-		while (begin_it != end_it)
-		{
-			stream >> *begin_it++;
-		}
+		Utilities::TextValueReader::ReadValues(stream, output_mat.ptr<double>(), output_mat.total());
 	}
 	break;
 	case CV_32FC1:
 	{
-		cv::MatIterator_<float> begin_it = output_mat.begin<float>();
-		cv::MatIterator_<float> end_it = output_mat.end<float>();
-
-		while (begin_it != end_it)
-		{
-			stream >> *begin_it++;
-		}
+		Utilities::TextValueReader::ReadValues(stream, output_mat.ptr<float>(), output_mat.total());
 	}
 	break;
 	case CV_32SC1:
 	{
-		cv::MatIterator_<int> begin_it = output_mat.begin<int>();
-		cv::MatIterator_<int> end_it = output_mat.end<int>();
-		while (begin_it != end_it)
-		{
-			stream >> *begin_it++;
-		}
+		Utilities::TextValueReader::ReadValues(stream, output_mat.ptr<int>(), output_mat.total());
 	}
 	break;
 	case CV_8UC1:
@@ -0,0 +1,440 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltruaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltruaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltruaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltruaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "stdafx.h"
+
+#include "ModelBundle.h"
+
+// System includes
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+// Memory mapping
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace LandmarkDetector;
+
+// Data blocks are aligned to cache lines (and SIMD registers)
+static const unsigned long long BUNDLE_ALIGNMENT = 64;
+
+ModelBundle::ModelBundle() : data(0), data_size(0), private_buffer(0), locked(false)
+{
+#ifdef _WIN32
+	file_handle = 0;
+	mapping_handle = 0;
+#endif
+}
+
+ModelBundle::~ModelBundle()
+{
+	Close();
+}
+
+void ModelBundle::Close()
+{
+	if (locked)
+	{
+#ifdef _WIN32
+		VirtualUnlock(data, data_size);
+#else
+		munlock(data, data_size);
+#endif
+		locked = false;
+	}
+
+	if (private_buffer != 0)
+	{
+		delete[] private_buffer;
+		private_buffer = 0;
+	}
+	else if (data != 0)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+		CloseHandle((HANDLE)mapping_handle);
+		CloseHandle((HANDLE)file_handle);
+		mapping_handle = 0;
+		file_handle = 0;
+#else
+		munmap(data, data_size);
+#endif
+	}
+	data = 0;
+	data_size = 0;
+	entries.clear();
+}
+
+//===========================================================================
+bool ModelBundle::Lock()
+{
+	if (data == 0)
+	{
+		return false;
+	}
+	if (locked)
+	{
+		return true;
+	}
+
+#ifdef _WIN32
+	// A process can only lock as much as its minimum working set, so that has to grow by the size of the bundle first
+	SIZE_T min_working_set, max_working_set;
+	HANDLE process = GetCurrentProcess();
+	if (!GetProcessWorkingSetSize(process, &min_working_set, &max_working_set) ||
+		!SetProcessWorkingSetSize(process, min_working_set + data_size, std::max(max_working_set, min_working_set + data_size)))
+	{
+		return false;
+	}
+	locked = VirtualLock(data, data_size) != 0;
+#else
+	locked = mlock(data, data_size) == 0;
+#endif
+	return locked;
+}
+
+//===========================================================================
+bool ModelBundle::Open(const std::string& location, bool private_copy)
+{
+	Close();
+
+	if (private_copy)
+	{
+		std::ifstream file(location.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+		if (!file.is_open() || file.tellg() <= 0)
+		{
+			return false;
+		}
+		data_size = (size_t)file.tellg();
+		file.seekg(0);
+
+		// The matrices are aligned relative to the start of the bundle, so the copy has to be aligned the same way
+		private_buffer = new char[data_size + BUNDLE_ALIGNMENT];
+		data = private_buffer + (BUNDLE_ALIGNMENT - (size_t)private_buffer % BUNDLE_ALIGNMENT) % BUNDLE_ALIGNMENT;
+
+		if (!file.read(data, data_size))
+		{
+			Close();
+			return false;
+		}
+	}
+	else
+	{
+#ifdef _WIN32
+		HANDLE file = CreateFileA(location.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		LARGE_INTEGER file_size;
+		GetFileSizeEx(file, &file_size);
+
+		// Copy on write mapping, so that the pages are shared between processes but can not be corrupted through the views
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		if (mapping == NULL)
+		{
+			CloseHandle(file);
+			return false;
+		}
+
+		data = (char*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+		if (data == 0)
+		{
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return false;
+		}
+		file_handle = file;
+		mapping_handle = mapping;
+		data_size = (size_t)file_size.QuadPart;
+#else
+		int fd = open(location.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			return false;
+		}
+
+		struct stat file_stat;
+		if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+		{
+			close(fd);
+			return false;
+		}
+		data_size = (size_t)file_stat.st_size;
+
+		// Copy on write mapping, so that the pages are shared between processes but can not be corrupted through the views
+		void* mapped = mmap(0, data_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+
+		if (mapped == MAP_FAILED)
+		{
+			data_size = 0;
+			return false;
+		}
+		data = (char*)mapped;
+#endif
+	}
+
+	// Parse the header
+	const unsigned int header_size = 16;
+	if (data_size < header_size || memcmp(data, "OFMB", 4) != 0)
+	{
+		std::cout << "ERROR: " << location << " is not a model bundle" << std::endl;
+		Close();
+		return false;
+	}
+
+	unsigned int bundle_version, num_entries, data_start;
+	memcpy(&bundle_version, data + 4, 4);
+	memcpy(&num_entries, data + 8, 4);
+	memcpy(&data_start, data + 12, 4);
+
+	if (bundle_version != version)
+	{
+		std::cout << "ERROR: model bundle " << location << " is version " << bundle_version << " but version " << version << " is expected, regenerate it" << std::endl;
+		Close();
+		return false;
+	}
+
+	if (data_start < header_size || data_start > data_size)
+	{
+		std::cout << "ERROR: model bundle " << location << " has a corrupt index" << std::endl;
+		Close();
+		return false;
+	}
+
+	// Read the index, every entry is the name length, the name and 20 bytes of type, size and offset, all within the index
+	const size_t entry_header_size = 20;
+	size_t pos = header_size;
+	for (unsigned int i = 0; i < num_entries; ++i)
+	{
+		unsigned int name_length;
+		if (pos + 4 > data_start)
+		{
+			std::cout << "ERROR: model bundle " << location << " has a truncated index" << std::endl;
+			Close();
+			return false;
+		}
+		memcpy(&name_length, data + pos, 4);
+		pos += 4;
+
+		if (name_length > data_start - pos || entry_header_size > data_start - pos - name_length)
+		{
+			std::cout << "ERROR: model bundle " << location << " has a truncated index" << std::endl;
+			Close();
+			return false;
+		}
+
+		std::string name(data + pos, name_length);
+		pos += name_length;
+
+		Entry entry;
+		memcpy(&entry.type, data + pos, 4);
+		memcpy(&entry.rows, data + pos + 4, 4);
+		memcpy(&entry.cols, data + pos + 8, 4);
+		memcpy(&entry.offset, data + pos + 12, 8);
+		pos += entry_header_size;
+
+		if (entry.rows < 0 || entry.cols < 0 || entry.type != CV_MAT_TYPE(entry.type))
+		{
+			std::cout << "ERROR: model bundle " << location << " has a corrupt index" << std::endl;
+			Close();
+			return false;
+		}
+
+		// Sanity check that the data is within the file (without overflowing on corrupt sizes)
+		size_t elem_size = CV_ELEM_SIZE(entry.type);
+		size_t row_size = (size_t)entry.cols * elem_size;
+		size_t entry_size = (entry.rows > 0 && row_size > data_size / entry.rows) ? data_size + 1 : (size_t)entry.rows * row_size;
+		if (entry_size > data_size || entry.offset > data_size - entry_size)
+		{
+			std::cout << "ERROR: model bundle " << location << " is truncated" << std::endl;
+			Close();
+			return false;
+		}
+
+		entries[name] = entry;
+	}
+
+	if (entries.size() != num_entries)
+	{
+		std::cout << "ERROR: model bundle " << location << " has a corrupt index" << std::endl;
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+bool ModelBundle::Has(const std::string& name) const
+{
+	return entries.find(name) != entries.end();
+}
+
+bool ModelBundle::GetMat(const std::string& name, cv::Mat& mat) const
+{
+	std::map<std::string, Entry>::const_iterator it = entries.find(name);
+	if (it == entries.end())
+	{
+		return false;
+	}
+
+	const Entry& entry = it->second;
+
+	if (entry.rows == 0 || entry.cols == 0)
+	{
+		mat = cv::Mat(entry.rows, entry.cols, entry.type);
+	}
+	else
+	{
+		// A view into the mapped memory, no data is copied
+		mat = cv::Mat(entry.rows, entry.cols, entry.type, data + entry.offset);
+	}
+	return true;
+}
+
+bool ModelBundle::GetValues(const std::string& name, std::vector<double>& values) const
+{
+	cv::Mat mat;
+	if (!GetMat(name, mat) || mat.type() != CV_64FC1)
+	{
+		return false;
+	}
+
+	values.assign((const double*)mat.data, (const double*)mat.data + mat.total());
+	return true;
+}
+
+//===========================================================================
+void ModelBundleWriter::AddMat(const std::string& name, const cv::Mat& mat)
+{
+	names.push_back(name);
+
+	// Make sure the data is continuous (and owned by the writer)
+	mats.push_back(mat.clone());
+}
+
+void ModelBundleWriter::AddValues(const std::string& name, const std::vector<double>& values)
+{
+	cv::Mat_<double> mat(1, (int)values.size());
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		mat.at<double>(0, (int)i) = values[i];
+	}
+	names.push_back(name);
+	mats.push_back(mat);
+}
+
+bool ModelBundleWriter::Write(const std::string& location) const
+{
+	std::ofstream bundle_stream(location.c_str(), std::ios::out | std::ios::binary);
+
+	if (!bundle_stream.is_open())
+	{
+		std::cout << "ERROR: could not open " << location << " for writing the model bundle" << std::endl;
+		return false;
+	}
+
+	// Work out where the data starts
+	unsigned long long index_size = 16;
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		index_size += 4 + names[i].size() + 20;
+	}
+
+	unsigned long long data_start = (index_size + BUNDLE_ALIGNMENT - 1) / BUNDLE_ALIGNMENT * BUNDLE_ALIGNMENT;
+
+	// Work out the offsets of every matrix
+	std::vector<unsigned long long> offsets(names.size());
+	unsigned long long offset = data_start;
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		offsets[i] = offset;
+		unsigned long long mat_size = mats[i].total() * mats[i].elemSize();
+		offset += (mat_size + BUNDLE_ALIGNMENT - 1) / BUNDLE_ALIGNMENT * BUNDLE_ALIGNMENT;
+	}
+
+	// The header
+	unsigned int bundle_version = ModelBundle::version;
+	unsigned int num_entries = (unsigned int)names.size();
+	unsigned int data_start_32 = (unsigned int)data_start;
+	bundle_stream.write("OFMB", 4);
+	bundle_stream.write((char*)&bundle_version, 4);
+	bundle_stream.write((char*)&num_entries, 4);
+	bundle_stream.write((char*)&data_start_32, 4);
+
+	// The index
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		unsigned int name_length = (unsigned int)names[i].size();
+		int type = mats[i].type();
+		int rows = mats[i].rows;
+		int cols = mats[i].cols;
+		bundle_stream.write((char*)&name_length, 4);
+		bundle_stream.write(names[i].c_str(), name_length);
+		bundle_stream.write((char*)&type, 4);
+		bundle_stream.write((char*)&rows, 4);
+		bundle_stream.write((char*)&cols, 4);
+		bundle_stream.write((char*)&offsets[i], 8);
+	}
+
+	// The data with padding to alignment
+	std::vector<char> padding(BUNDLE_ALIGNMENT, 0);
+	bundle_stream.write(&padding[0], data_start - index_size);
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		unsigned long long mat_size = mats[i].total() * mats[i].elemSize();
+		if (mat_size > 0)
+		{
+			bundle_stream.write((char*)mats[i].data, mat_size);
+		}
+		unsigned long long padded_size = (mat_size + BUNDLE_ALIGNMENT - 1) / BUNDLE_ALIGNMENT * BUNDLE_ALIGNMENT;
+		if (padded_size > mat_size)
+		{
+			bundle_stream.write(&padding[0], padded_size - mat_size);
+		}
+	}
+
+	return bundle_stream.good();
+}
@@ -0,0 +1,382 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "stdafx.h"
+
+#include "MultiFaceTracker.h"
+
+#include "LandmarkDetectorFunc.h"
+#include "LandmarkDetectorUtils.h"
+
+#include <MemoryReport.h>
+
+// TBB includes
+#include <tbb/tbb.h>
+
+using namespace LandmarkDetector;
+
+// A tracker failing this many frames in a row has lost its face
+static const int MAX_FAILURES_IN_A_ROW = 4;
+
+// The number of released trackers kept for reuse, the rest are freed
+static const size_t MAX_RELEASED_TRACKERS = 2;
+
+MultiFaceTracker::MultiFaceTracker(const CLNF& face_model, const FaceModelParameters& params, int max_faces) :
+	face_model(face_model), tracker_model(face_model), params(params), max_faces(max_faces), full_quality_faces(-1), degraded_faces(-1),
+	priority_size_weight(0.5f), frame_count(0)
+{
+	// The trackers do not detect faces themselves, so they do not need (to load) the detectors
+#ifndef OPENFACE_SLIM_LANDMARK_DETECTOR
+	tracker_model.haar_face_detector_location.clear();
+	tracker_model.face_detector_HAAR = cv::CascadeClassifier();
+#endif
+	tracker_model.face_detector_MTCNN = FaceDetectorMTCNN();
+	tracker_model.face_detector_plugin.reset();
+
+	// The faces are re-detected here rather than by the trackers
+	this->params.reinit_video_every = -1;
+
+	// A single small scale when tracking, as in the realtime_edge preset
+	degraded_params = this->params;
+	degraded_params.window_sizes_small[0] = 0; degraded_params.window_sizes_small[1] = 7; degraded_params.window_sizes_small[2] = 0; degraded_params.window_sizes_small[3] = 0;
+	degraded_params.num_optimisation_iteration = std::min(degraded_params.num_optimisation_iteration, 3);
+	degraded_params.refine_hierarchical = false;
+
+	rigid_params = degraded_params;
+	rigid_params.pose_only = true;
+	rigid_params.pose_only_modes = 0;
+}
+
+void MultiFaceTracker::SetPriorityBudget(int full_quality_faces, int degraded_faces)
+{
+	this->full_quality_faces = full_quality_faces;
+	this->degraded_faces = degraded_faces;
+}
+
+void MultiFaceTracker::SetPriorityWeights(float size_weight)
+{
+	priority_size_weight = std::min(std::max(size_weight, 0.0f), 1.0f);
+}
+
+void MultiFaceTracker::SetPriorityHint(int face_id, float priority)
+{
+	if (priority < 0)
+	{
+		priority_hints.erase(face_id);
+	}
+	else
+	{
+		priority_hints[face_id] = std::min(priority, 1.0f);
+	}
+}
+
+void MultiFaceTracker::PrioritiseFaces(const cv::Size& image_size)
+{
+	float max_width = 0;
+	for (size_t face = 0; face < faces.size(); ++face)
+	{
+		max_width = std::max(max_width, (float)faces[face]->model.GetBoundingBox().width);
+	}
+
+	cv::Point2f centre(image_size.width / 2.0f, image_size.height / 2.0f);
+	float half_diagonal = std::max(std::sqrt(centre.x * centre.x + centre.y * centre.y), 1.0f);
+
+	std::vector<std::pair<float, size_t> > ranking;
+	for (size_t face = 0; face < faces.size(); ++face)
+	{
+		Tracker& tracker = *faces[face];
+		std::map<int, float>::const_iterator hint = priority_hints.find(tracker.id);
+		if (hint != priority_hints.end())
+		{
+			tracker.priority = 1.0f + hint->second;
+		}
+		else
+		{
+			cv::Rect_<float> box = tracker.model.GetBoundingBox();
+			cv::Point2f offset(box.x + box.width / 2.0f - centre.x, box.y + box.height / 2.0f - centre.y);
+			float size_score = max_width > 0 ? box.width / max_width : 0;
+			float centre_score = std::max(1.0f - std::sqrt(offset.x * offset.x + offset.y * offset.y) / half_diagonal, 0.0f);
+			tracker.priority = priority_size_weight * size_score + (1.0f - priority_size_weight) * centre_score;
+		}
+		ranking.push_back(std::make_pair(-tracker.priority, face));
+	}
+
+	// The order of the faces breaks the ties, so that the same faces keep their quality
+	std::sort(ranking.begin(), ranking.end());
+
+	for (size_t rank = 0; rank < ranking.size(); ++rank)
+	{
+		Tracker& tracker = *faces[ranking[rank].second];
+
+		FitQuality quality = FIT_RIGID_ALTERNATE;
+		if (full_quality_faces < 0 || (int)rank < full_quality_faces)
+		{
+			quality = FIT_FULL;
+		}
+		else if (degraded_faces < 0 || (int)rank < full_quality_faces + degraded_faces)
+		{
+			quality = FIT_DEGRADED;
+		}
+
+		// The state of the parameters (the current window sizes) is set up again on every fit, so they can be swapped
+		if (quality != tracker.quality)
+		{
+			tracker.params = quality == FIT_FULL ? params : (quality == FIT_DEGRADED ? degraded_params : rigid_params);
+			tracker.quality = quality;
+		}
+	}
+}
+
+std::unique_ptr<MultiFaceTracker::Tracker> MultiFaceTracker::AcquireTracker()
+{
+	if (!released_trackers.empty())
+	{
+		std::unique_ptr<Tracker> tracker = std::move(released_trackers.back());
+		released_trackers.pop_back();
+		return tracker;
+	}
+	return std::unique_ptr<Tracker>(new Tracker(tracker_model, params));
+}
+
+void MultiFaceTracker::ReleaseTracker(std::unique_ptr<Tracker> tracker)
+{
+	if (released_trackers.size() < MAX_RELEASED_TRACKERS)
+	{
+		tracker->model.Reset();
+		tracker->id = -1;
+		tracker->signature.release();
+		if (tracker->quality != FIT_FULL)
+		{
+			tracker->params = params;
+			tracker->quality = FIT_FULL;
+		}
+		tracker->priority = 0;
+		released_trackers.push_back(std::move(tracker));
+	}
+}
+
+void MultiFaceTracker::DetectFaces(const cv::Mat& rgb_image, const cv::Mat_<uchar>& grayscale_image, const cv::Rect& region, std::vector<cv::Rect_<float> >& detections)
+{
+	// The detectors are run on the region only (the crops do not copy the image)
+	cv::Mat rgb_region = rgb_image(region);
+	cv::Mat_<uchar> grayscale_region = grayscale_image(region);
+
+	std::vector<float> confidences;
+	if (face_model.face_detector_plugin)
+	{
+		ImageContext region_context(rgb_region, grayscale_region);
+		face_model.face_detector_plugin->DetectFaces(detections, confidences, region_context);
+	}
+#ifndef OPENFACE_SLIM_LANDMARK_DETECTOR
+	else if (params.curr_face_detector == FaceModelParameters::HOG_SVM_DETECTOR)
+	{
+		DetectFacesHOG(detections, grayscale_region, face_model.face_detector_HOG, confidences);
+	}
+	else if (params.curr_face_detector == FaceModelParameters::HAAR_DETECTOR)
+	{
+		LandmarkDetector::DetectFaces(detections, grayscale_region, face_model.face_detector_HAAR);
+	}
+#endif
+	else
+	{
+		DetectFacesMTCNN(detections, rgb_region, face_model.face_detector_MTCNN, confidences);
+	}
+
+	for (size_t i = 0; i < detections.size(); ++i)
+	{
+		detections[i].x += region.x;
+		detections[i].y += region.y;
+	}
+}
+
+void MultiFaceTracker::Track(const cv::Mat& rgb_image, cv::Mat_<uchar>& grayscale_image, double time_stamp)
+{
+	// Releasing the trackers that have lost their face, remembering the face so that it keeps its id if it is found again
+	for (size_t face = 0; face < faces.size();)
+	{
+		if (faces[face]->model.failures_in_a_row > MAX_FAILURES_IN_A_ROW)
+		{
+			tracklets.AddLost(faces[face]->id, faces[face]->model, faces[face]->signature);
+			ReleaseTracker(std::move(faces[face]));
+			faces.erase(faces.begin() + face);
+		}
+		else
+		{
+			++face;
+		}
+	}
+
+	std::vector<cv::Rect_<float> > tracked_boxes;
+	for (size_t face = 0; face < faces.size(); ++face)
+	{
+		tracked_boxes.push_back(faces[face]->model.GetBoundingBox());
+	}
+
+	// Looking for new faces when the scene changes or periodically (as long as there is room for them)
+	std::vector<cv::Rect_<float> > detections;
+	int free_slots = max_faces < 0 ? -1 : std::max(max_faces - (int)faces.size(), 0);
+	cv::Rect detection_region;
+	bool detected = detection_scheduler.ShouldDetect(grayscale_image, tracked_boxes, free_slots, detection_region);
+	if (detected)
+	{
+		DetectFaces(rgb_image, grayscale_image, detection_region, detections);
+	}
+
+	// Associating the detections with the tracked faces (these are not informative) and with the lost faces
+	std::vector<int> associations = tracklets.Associate(grayscale_image, detections, tracked_boxes);
+
+	if (detected)
+	{
+		int num_new_faces = 0;
+		for (size_t detection_ind = 0; detection_ind < associations.size(); ++detection_ind)
+		{
+			if (associations[detection_ind] != FaceTracklets::TRACKED_FACE)
+				num_new_faces++;
+		}
+		detection_scheduler.DetectionDone(num_new_faces);
+	}
+
+	// A tracker for every detection that is not tracked yet, the re-acquired faces first as they are resumed from their cached parameters
+	std::vector<std::unique_ptr<Tracker> > new_faces;
+	std::vector<size_t> new_detections;
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		for (size_t detection_ind = 0; detection_ind < detections.size(); ++detection_ind)
+		{
+			int association = associations[detection_ind];
+			bool resumed = association >= 0;
+			if (association == FaceTracklets::TRACKED_FACE || resumed != (pass == 0))
+				continue;
+
+			if (max_faces >= 0 && (int)(faces.size() + new_faces.size()) >= max_faces)
+				break;
+
+			std::unique_ptr<Tracker> tracker = AcquireTracker();
+			if (resumed && tracklets.Resume(association, detections[detection_ind], tracker->model))
+			{
+				tracker->id = association;
+			}
+			else
+			{
+				// Reinitialise the model, this ensures that a wider window is used for the initial landmark localisation
+				tracker->model.Reset();
+				tracker->model.detection_success = false;
+				tracker->id = tracklets.NewId();
+				associations[detection_ind] = FaceTracklets::NEW_FACE;
+			}
+			new_faces.push_back(std::move(tracker));
+			new_detections.push_back(detection_ind);
+		}
+	}
+
+	// Every tracker is a separate copy so the new faces can be fit in parallel
+	tbb::parallel_for(0, (int)new_faces.size(), [&](int i) {
+		Tracker& tracker = *new_faces[i];
+		size_t detection_ind = new_detections[i];
+
+		if (associations[detection_ind] >= 0)
+		{
+			DetectLandmarksInVideo(rgb_image, tracker.model, tracker.params, grayscale_image, time_stamp);
+		}
+		else
+		{
+			DetectLandmarksInVideo(rgb_image, detections[detection_ind], tracker.model, tracker.params, grayscale_image);
+		}
+	});
+
+	// The faces that were already tracked are updated together, computing the patch expert responses of all of them at once, at the quality
+	// their priority allows (the rigid only faces alternate between the even and the odd frames by their id)
+	PrioritiseFaces(grayscale_image.size());
+
+	std::vector<CLNF*> tracked_models;
+	std::vector<FaceModelParameters*> tracked_params;
+	for (size_t face = 0; face < faces.size(); ++face)
+	{
+		if (faces[face]->quality == FIT_RIGID_ALTERNATE && faces[face]->model.tracking_initialised && (frame_count + faces[face]->id) % 2 != 0)
+			continue;
+
+		tracked_models.push_back(&faces[face]->model);
+		tracked_params.push_back(&faces[face]->params);
+	}
+	if (!tracked_models.empty())
+	{
+		DetectLandmarksInVideo(rgb_image, tracked_models, tracked_params, grayscale_image);
+	}
+
+	for (size_t i = 0; i < new_faces.size(); ++i)
+	{
+		faces.push_back(std::move(new_faces[i]));
+	}
+
+	// The appearance of the successfully tracked faces, for recognising them if they are lost and found again
+	for (size_t face = 0; face < faces.size(); ++face)
+	{
+		if (faces[face]->model.detection_success)
+		{
+			faces[face]->signature = ComputeFaceSignature(grayscale_image, faces[face]->model.GetBoundingBox());
+		}
+	}
+
+	tracklets.NextFrame();
+	frame_count++;
+}
+
+void MultiFaceTracker::Reset()
+{
+	for (size_t face = 0; face < faces.size(); ++face)
+	{
+		ReleaseTracker(std::move(faces[face]));
+	}
+	faces.clear();
+	tracklets.Clear();
+	detection_scheduler.Reset();
+	priority_hints.clear();
+	frame_count = 0;
+}
+
+void MultiFaceTracker::ReportMemory(Utilities::MemoryReport& report, const std::string& component) const
+{
+	face_model.ReportMemory(report, component + "/model");
+	tracker_model.ReportMemory(report, component + "/tracker_model");
+	for (size_t face = 0; face < faces.size(); ++face)
+	{
+		faces[face]->model.ReportMemory(report, component + "/face_" + std::to_string(faces[face]->id));
+		report.Add(component + "/face_" + std::to_string(faces[face]->id), faces[face]->signature);
+	}
+	for (size_t tracker = 0; tracker < released_trackers.size(); ++tracker)
+	{
+		released_trackers[tracker]->model.ReportMemory(report, component + "/released");
+	}
+}
@@ -0,0 +1,511 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+
+#include "OnnxModel.h"
+
+// System includes
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+
+#ifdef OPENFACE_ONNXRUNTIME
+#include <onnxruntime_cxx_api.h>
+#endif
+
+using namespace LandmarkDetector;
+
+//===========================================================================
+// Protocol buffer encoding (only what the ONNX messages need, so varints, 32 bit floats and length delimited fields)
+namespace
+{
+	class ProtoWriter
+	{
+	public:
+
+		void Varint(uint64_t value)
+		{
+			while (value >= 0x80)
+			{
+				buffer.push_back((char)(value | 0x80));
+				value >>= 7;
+			}
+			buffer.push_back((char)value);
+		}
+
+		void Int(int field, int64_t value)
+		{
+			Varint((uint64_t)field << 3);
+			Varint((uint64_t)value);
+		}
+
+		void Float(int field, float value)
+		{
+			Varint(((uint64_t)field << 3) | 5);
+			char bytes[4];
+			std::memcpy(bytes, &value, 4);
+			buffer.append(bytes, 4);
+		}
+
+		void Bytes(int field, const char* data, size_t size)
+		{
+			Varint(((uint64_t)field << 3) | 2);
+			Varint(size);
+			buffer.append(data, size);
+		}
+
+		void String(int field, const std::string& value)
+		{
+			Bytes(field, value.data(), value.size());
+		}
+
+		void Message(int field, const ProtoWriter& message)
+		{
+			String(field, message.buffer);
+		}
+
+		std::string buffer;
+	};
+
+	// The ONNX TensorProto data type of floats and the AttributeProto types
+	const int ONNX_FLOAT = 1;
+
+	ProtoWriter ValueInfoProto(const std::string& name, const std::vector<int64_t>& shape)
+	{
+		ProtoWriter shape_proto;
+		for (size_t d = 0; d < shape.size(); ++d)
+		{
+			ProtoWriter dim;
+			if (shape[d] >= 0)
+			{
+				dim.Int(1, shape[d]);
+			}
+			else
+			{
+				dim.String(2, name + "_dim" + std::to_string(d));
+			}
+			shape_proto.Message(1, dim);
+		}
+
+		ProtoWriter tensor_type;
+		tensor_type.Int(1, ONNX_FLOAT);
+		tensor_type.Message(2, shape_proto);
+
+		ProtoWriter type;
+		type.Message(1, tensor_type);
+
+		ProtoWriter value_info;
+		value_info.String(1, name);
+		value_info.Message(2, type);
+		return value_info;
+	}
+}
+
+//===========================================================================
+OnnxGraph::Attribute OnnxGraph::Attribute::Float(const std::string& name, float value)
+{
+	Attribute attribute;
+	attribute.name = name;
+	attribute.type = 1;
+	attribute.f = value;
+	attribute.i = 0;
+	return attribute;
+}
+
+OnnxGraph::Attribute OnnxGraph::Attribute::Int(const std::string& name, int64_t value)
+{
+	Attribute attribute;
+	attribute.name = name;
+	attribute.type = 2;
+	attribute.f = 0;
+	attribute.i = value;
+	return attribute;
+}
+
+OnnxGraph::Attribute OnnxGraph::Attribute::Ints(const std::string& name, const std::vector<int64_t>& values)
+{
+	Attribute attribute;
+	attribute.name = name;
+	attribute.type = 7;
+	attribute.f = 0;
+	attribute.i = 0;
+	attribute.ints = values;
+	return attribute;
+}
+
+std::string OnnxGraph::UniqueName(const std::string& prefix)
+{
+	return prefix + "_" + std::to_string(num_names++);
+}
+
+void OnnxGraph::AddInput(const std::string& name, const std::vector<int64_t>& shape)
+{
+	ValueInfo info = { name, shape };
+	inputs.push_back(info);
+}
+
+void OnnxGraph::AddOutput(const std::string& name, const std::vector<int64_t>& shape)
+{
+	ValueInfo info = { name, shape };
+	outputs.push_back(info);
+}
+
+std::string OnnxGraph::AddInitializer(const std::string& prefix, const std::vector<int64_t>& dims, const float* data)
+{
+	Tensor tensor;
+	tensor.name = UniqueName(prefix);
+	tensor.dims = dims;
+
+	size_t size = 1;
+	for (size_t d = 0; d < dims.size(); ++d)
+	{
+		size *= (size_t)dims[d];
+	}
+	tensor.data.assign(data, data + size);
+
+	initializers.push_back(tensor);
+	return tensor.name;
+}
+
+std::string OnnxGraph::AddInitializer(const std::string& prefix, const std::vector<int64_t>& dims, const cv::Mat_<float>& data)
+{
+	cv::Mat_<float> data_cont = data.isContinuous() ? data : data.clone();
+	return AddInitializer(prefix, dims, data_cont.ptr<float>());
+}
+
+std::string OnnxGraph::AddNode(const std::string& op_type, const std::vector<std::string>& inputs, const std::vector<Attribute>& attributes, const std::string& output)
+{
+	Node node;
+	node.op_type = op_type;
+	node.inputs = inputs;
+	node.attributes = attributes;
+	node.output = output.empty() ? UniqueName(op_type) : output;
+	nodes.push_back(node);
+	return node.output;
+}
+
+void OnnxGraph::AddMetadata(const std::string& key, const std::string& value)
+{
+	metadata.push_back(std::make_pair(key, value));
+}
+
+std::string OnnxGraph::Serialize() const
+{
+	ProtoWriter graph;
+
+	for (size_t n = 0; n < nodes.size(); ++n)
+	{
+		const Node& node = nodes[n];
+
+		ProtoWriter node_proto;
+		for (size_t i = 0; i < node.inputs.size(); ++i)
+		{
+			node_proto.String(1, node.inputs[i]);
+		}
+		node_proto.String(2, node.output);
+		node_proto.String(3, node.output);
+		node_proto.String(4, node.op_type);
+
+		for (size_t a = 0; a < node.attributes.size(); ++a)
+		{
+			const Attribute& attribute = node.attributes[a];
+
+			ProtoWriter attribute_proto;
+			attribute_proto.String(1, attribute.name);
+			if (attribute.type == 1)
+			{
+				attribute_proto.Float(2, attribute.f);
+			}
+			else if (attribute.type == 2)
+			{
+				attribute_proto.Int(3, attribute.i);
+			}
+			else
+			{
+				for (size_t k = 0; k < attribute.ints.size(); ++k)
+				{
+					attribute_proto.Int(8, attribute.ints[k]);
+				}
+			}
+			attribute_proto.Int(20, attribute.type);
+
+			node_proto.Message(5, attribute_proto);
+		}
+
+		graph.Message(1, node_proto);
+	}
+
+	graph.String(2, name);
+
+	for (size_t t = 0; t < initializers.size(); ++t)
+	{
+		const Tensor& tensor = initializers[t];
+
+		ProtoWriter tensor_proto;
+		for (size_t d = 0; d < tensor.dims.size(); ++d)
+		{
+			tensor_proto.Int(1, tensor.dims[d]);
+		}
+		tensor_proto.Int(2, ONNX_FLOAT);
+		tensor_proto.String(8, tensor.name);
+
+		// The raw data is little endian, as are all of the platforms this runs on
+		tensor_proto.Bytes(9, (const char*)tensor.data.data(), tensor.data.size() * sizeof(float));
+
+		graph.Message(5, tensor_proto);
+	}
+
+	for (size_t i = 0; i < inputs.size(); ++i)
+	{
+		graph.Message(11, ValueInfoProto(inputs[i].name, inputs[i].shape));
+	}
+
+	for (size_t i = 0; i < outputs.size(); ++i)
+	{
+		graph.Message(12, ValueInfoProto(outputs[i].name, outputs[i].shape));
+	}
+
+	ProtoWriter opset;
+	opset.String(1, "");
+	opset.Int(2, 11);
+
+	ProtoWriter model;
+	model.Int(1, 6);
+	model.String(2, "OpenFace");
+	model.Message(7, graph);
+	model.Message(8, opset);
+
+	for (size_t m = 0; m < metadata.size(); ++m)
+	{
+		ProtoWriter entry;
+		entry.String(1, metadata[m].first);
+		entry.String(2, metadata[m].second);
+		model.Message(14, entry);
+	}
+
+	return model.buffer;
+}
+
+bool OnnxGraph::Write(const std::string& location) const
+{
+	std::ofstream stream(location.c_str(), std::ios::out | std::ios::binary);
+	if (!stream.is_open())
+	{
+		return false;
+	}
+
+	std::string model = Serialize();
+	stream.write(model.data(), model.size());
+	return (bool)stream;
+}
+
+//===========================================================================
+// The execution provider of new sessions
+static std::mutex onnx_provider_mutex;
+static std::string onnx_provider = "cpu";
+
+void LandmarkDetector::SetOnnxExecutionProvider(const std::string& provider)
+{
+	std::lock_guard<std::mutex> lock(onnx_provider_mutex);
+	onnx_provider = provider;
+}
+
+#ifdef OPENFACE_ONNXRUNTIME
+
+struct OnnxSession::Impl
+{
+	std::unique_ptr<Ort::Session> session;
+	std::string input_name;
+	std::string output_name;
+};
+
+// A single ONNX Runtime environment for the whole process
+static Ort::Env& OnnxEnvironment()
+{
+	static Ort::Env env(ORT_LOGGING_LEVEL_WARNING, "OpenFace");
+	return env;
+}
+
+bool LandmarkDetector::OnnxRuntimeAvailable()
+{
+	return true;
+}
+
+std::shared_ptr<OnnxSession> OnnxSession::Create(const std::string& model)
+{
+	std::string provider;
+	{
+		std::lock_guard<std::mutex> lock(onnx_provider_mutex);
+		provider = onnx_provider;
+	}
+
+	std::shared_ptr<OnnxSession> onnx_session(new OnnxSession());
+
+	try
+	{
+		// The callers already run the networks of different images (and faces) in parallel
+		Ort::SessionOptions options;
+		options.SetIntraOpNumThreads(1);
+		options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+
+		try
+		{
+			if (provider == "cuda")
+			{
+				OrtCUDAProviderOptions cuda_options;
+				options.AppendExecutionProvider_CUDA(cuda_options);
+			}
+			else if (provider == "tensorrt")
+			{
+				// The default TensorRT options are only available through the V2 options
+				OrtTensorRTProviderOptionsV2* tensorrt_options = nullptr;
+				Ort::ThrowOnError(Ort::GetApi().CreateTensorRTProviderOptions(&tensorrt_options));
+				options.AppendExecutionProvider_TensorRT_V2(*tensorrt_options);
+				Ort::GetApi().ReleaseTensorRTProviderOptions(tensorrt_options);
+			}
+			else if (provider == "openvino")
+			{
+				OrtOpenVINOProviderOptions openvino_options;
+				options.AppendExecutionProvider_OpenVINO(openvino_options);
+			}
+			else if (provider != "cpu")
+			{
+				options.AppendExecutionProvider(provider);
+			}
+		}
+		catch (const Ort::Exception& e)
+		{
+			std::cout << "WARNING: The " << provider << " execution provider is not available (" << e.what() << "), using the CPU" << std::endl;
+		}
+
+		onnx_session->impl->session.reset(new Ort::Session(OnnxEnvironment(), model.data(), model.size(), options));
+
+		Ort::AllocatorWithDefaultOptions allocator;
+		onnx_session->impl->input_name = onnx_session->impl->session->GetInputNameAllocated(0, allocator).get();
+		onnx_session->impl->output_name = onnx_session->impl->session->GetOutputNameAllocated(0, allocator).get();
+	}
+	catch (const Ort::Exception& e)
+	{
+		std::cout << "ERROR: Could not create the ONNX Runtime session: " << e.what() << std::endl;
+		return std::shared_ptr<OnnxSession>();
+	}
+
+	return onnx_session;
+}
+
+bool OnnxSession::Run(const float* input, const std::vector<int64_t>& input_shape, std::vector<float>& output, std::vector<int64_t>& output_shape) const
+{
+	size_t input_size = 1;
+	for (size_t d = 0; d < input_shape.size(); ++d)
+	{
+		input_size *= (size_t)input_shape[d];
+	}
+
+	try
+	{
+		Ort::MemoryInfo memory_info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+		Ort::Value input_tensor = Ort::Value::CreateTensor<float>(memory_info, const_cast<float*>(input), input_size, input_shape.data(), input_shape.size());
+
+		const char* input_names[] = { impl->input_name.c_str() };
+		const char* output_names[] = { impl->output_name.c_str() };
+
+		std::vector<Ort::Value> outputs = impl->session->Run(Ort::RunOptions{ nullptr }, input_names, &input_tensor, 1, output_names, 1);
+
+		Ort::TensorTypeAndShapeInfo info = outputs[0].GetTensorTypeAndShapeInfo();
+		output_shape = info.GetShape();
+
+		const float* output_data = outputs[0].GetTensorData<float>();
+		output.assign(output_data, output_data + info.GetElementCount());
+	}
+	catch (const Ort::Exception& e)
+	{
+		std::cout << "ERROR: ONNX Runtime inference failed: " << e.what() << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+#else
+
+struct OnnxSession::Impl
+{
+};
+
+bool LandmarkDetector::OnnxRuntimeAvailable()
+{
+	return false;
+}
+
+std::shared_ptr<OnnxSession> OnnxSession::Create(const std::string&)
+{
+	return std::shared_ptr<OnnxSession>();
+}
+
+bool OnnxSession::Run(const float*, const std::vector<int64_t>&, std::vector<float>&, std::vector<int64_t>&) const
+{
+	return false;
+}
+
+#endif
+
+std::shared_ptr<OnnxSession> LazyOnnxSession::Get(const std::function<bool(OnnxGraph&)>& export_model)
+{
+	std::lock_guard<std::mutex> lock(session_mutex);
+	if (!tried)
+	{
+		tried = true;
+
+		OnnxGraph graph("model");
+		if (export_model(graph))
+		{
+			session = OnnxSession::Create(graph.Serialize());
+		}
+		else
+		{
+			std::cout << "WARNING: The model can not be exported to ONNX, using the CPU layers" << std::endl;
+		}
+	}
+	return session;
+}
+
+OnnxSession::OnnxSession() : impl(new Impl())
+{
+}
+
+OnnxSession::~OnnxSession()
+{
+}
@@ -42,11 +42,15 @@
 
 #include "LandmarkDetectorUtils.h"
 
+// System includes
+#include <algorithm>
+#include <cmath>
+
 using namespace LandmarkDetector;
 
-// Copy constructor
-PAW::PAW(const PAW& other) : destination_landmarks(other.destination_landmarks.clone()), source_landmarks(other.source_landmarks.clone()), triangulation(other.triangulation.clone()),
-triangle_id(other.triangle_id.clone()), pixel_mask(other.pixel_mask.clone()), coefficients(other.coefficients.clone()), alpha(other.alpha.clone()), beta(other.beta.clone()), map_x(other.map_x.clone()), map_y(other.map_y.clone())
+// Copy constructor, the warp definition is read only and is shared between the copies, while the per warp buffers (coefficients and maps) are copied
+PAW::PAW(const PAW& other) : destination_landmarks(other.destination_landmarks), source_landmarks(other.source_landmarks.clone()), triangulation(other.triangulation),
+triangle_id(other.triangle_id), pixel_mask(other.pixel_mask), triangle_spans(other.triangle_spans), coefficients(other.coefficients.clone()), alpha(other.alpha), beta(other.beta), map_x(other.map_x.clone()), map_y(other.map_y.clone())
 {
 	this->number_of_pixels = other.number_of_pixels;
 	this->min_x = other.min_x;
@@ -141,21 +145,8 @@ PAW::PAW(const cv::Mat_<float>& destination_shape, const cv::Mat_<int>& triangul
 	pixel_mask = cv::Mat_<uchar>(h, w, (uchar)0);
 	triangle_id = cv::Mat_<int>(h, w, -1);
 
-	int curr_tri = -1;
-
-	for (int y = 0; y < pixel_mask.rows; y++)
-	{
-		for (int x = 0; x < pixel_mask.cols; x++)
-		{
-			curr_tri = findTriangle(cv::Point_<float>(x + min_x, y + min_y), destination_points, curr_tri);
-			// If there is a triangle at this location
-			if (curr_tri != -1)
-			{
-				triangle_id.at<int>(y, x) = curr_tri;
-				pixel_mask.at<uchar>(y, x) = 1;
-			}
-		}
-	}
+	RasteriseTriangles(destination_points);
+	ComputeTriangleSpans();
 
 	// Preallocate maps and coefficients
 	coefficients.create(num_tris, 6);
@@ -251,21 +242,8 @@ PAW::PAW(const cv::Mat_<float>& destination_shape, const cv::Mat_<int>& triangul
 	pixel_mask = cv::Mat_<uchar>(h, w, (uchar)0);
 	triangle_id = cv::Mat_<int>(h, w, -1);
 
-	int curr_tri = -1;
-
-	for (int y = 0; y < pixel_mask.rows; y++)
-	{
-		for (int x = 0; x < pixel_mask.cols; x++)
-		{
-			curr_tri = findTriangle(cv::Point_<float>(x + min_x, y + min_y), destination_points, curr_tri);
-			// If there is a triangle at this location
-			if (curr_tri != -1)
-			{
-				triangle_id.at<int>(y, x) = curr_tri;
-				pixel_mask.at<uchar>(y, x) = 1;
-			}
-		}
-	}
+	RasteriseTriangles(destination_points);
+	ComputeTriangleSpans();
 
 	// Preallocate maps and coefficients
 	coefficients.create(num_tris, 6);
@@ -311,6 +289,8 @@ void PAW::Read(std::ifstream& stream)
 	coefficients.create(this->NumberOfTriangles(), 6);
 
 	source_landmarks = destination_landmarks;
+
+	ComputeTriangleSpans();
 }
 
 //=============================================================================
@@ -319,7 +299,7 @@ void PAW::Warp(const cv::Mat& image_to_warp, cv::Mat& destination_image, const c
 {
 
 	// set the current shape
-	source_landmarks = landmarks_to_warp.clone();
+	landmarks_to_warp.copyTo(source_landmarks);
 
 	// prepare the mapping coefficients using the current shape
 	this->CalcCoeff();
@@ -373,66 +353,139 @@ void PAW::CalcCoeff()
 // Compute the mapping coefficients
 void PAW::WarpRegion(cv::Mat_<float>& mapx, cv::Mat_<float>& mapy)
 {
+	// Pixels outside of the face are not mapped
+	mapx.setTo(-1);
+	mapy.setTo(-1);
 
-	cv::MatIterator_<float> xp = mapx.begin();
-	cv::MatIterator_<float> yp = mapy.begin();
-	cv::MatIterator_<uchar> mp = pixel_mask.begin();
-	cv::MatIterator_<int>   tp = triangle_id.begin();
-
-	// The coefficients corresponding to the current triangle
-	float * a;
+	for (int s = 0; s < triangle_spans.rows; ++s)
+	{
+		const int* span = triangle_spans.ptr<int>(s);
+		int y = span[0];
 
-	// Current triangle being processed	
-	int k = -1;
+		// The affine coefficients of the triangle the span lies in
+		const float* a = coefficients.ptr<float>(span[3]);
 
-	for (int y = 0; y < pixel_mask.rows; y++)
-	{
 		float yi = float(y) + min_y;
 
-		for (int x = 0; x < pixel_mask.cols; x++)
+		float* xp = mapx.ptr<float>(y);
+		float* yp = mapy.ptr<float>(y);
+
+		for (int x = span[1]; x < span[2]; ++x)
 		{
 			float xi = float(x) + min_x;
 
-			if (*mp == 0)
+			// The first coefficient is an offset, the second a scale as a function of x and the third a scale as a function of y
+			xp[x] = a[0] + a[1] * xi + a[2] * yi;
+			yp[x] = a[3] + a[4] * xi + a[5] * yi;
+		}
+	}
+}
+
+// Visiting the triangles in reverse order, so that a pixel on a shared edge belongs to the triangle with the lowest index
+void PAW::RasteriseTriangles(const std::vector<std::vector<float>>& control_points)
+{
+	for (int tri = (int)control_points.size() - 1; tri >= 0; --tri)
+	{
+		const std::vector<float>& points = control_points[tri];
+
+		// The bounding box of the triangle in destination pixels
+		int x_start = std::max(0, (int)std::ceil(points[8] - min_x));
+		int y_start = std::max(0, (int)std::ceil(points[9] - min_y));
+		int x_end = std::min(pixel_mask.cols - 1, (int)std::floor(points[6] - min_x));
+		int y_end = std::min(pixel_mask.rows - 1, (int)std::floor(points[7] - min_y));
+
+		for (int y = y_start; y <= y_end; ++y)
+		{
+			int* tri_row = triangle_id.ptr<int>(y);
+			uchar* mask_row = pixel_mask.ptr<uchar>(y);
+
+			for (int x = x_start; x <= x_end; ++x)
 			{
-				*xp = -1;
-				*yp = -1;
+				if (pointInTriangle(x + min_x, y + min_y, points[0], points[1], points[2], points[3], points[4], points[5]))
+				{
+					tri_row[x] = tri;
+					mask_row[x] = 1;
+				}
 			}
-			else
-			{
-				// triangle corresponding to the current pixel
-				int j = *tp;
+		}
+	}
+}
+
+void PAW::ComputeMask(const cv::Mat_<float>& destination_shape, const cv::Mat_<int>& triangulation, int width, int height, cv::Mat_<uchar>& mask)
+{
+	mask.create(height, width);
+	mask.setTo(0);
+
+	int num_points = destination_shape.rows / 2;
+	const float* xs = destination_shape.ptr<float>(0);
+	const float* ys = destination_shape.ptr<float>(num_points);
+
+	for (int tri = 0; tri < triangulation.rows; ++tri)
+	{
+		int j = triangulation.at<int>(tri, 0);
+		int k = triangulation.at<int>(tri, 1);
+		int l = triangulation.at<int>(tri, 2);
+
+		float tri_min_x = std::min(xs[j], std::min(xs[k], xs[l]));
+		float tri_max_x = std::max(xs[j], std::max(xs[k], xs[l]));
+		float tri_min_y = std::min(ys[j], std::min(ys[k], ys[l]));
+		float tri_max_y = std::max(ys[j], std::max(ys[k], ys[l]));
+
+		int x_start = std::max(0, (int)std::ceil(tri_min_x));
+		int y_start = std::max(0, (int)std::ceil(tri_min_y));
+		int x_end = std::min(width - 1, (int)std::floor(tri_max_x));
+		int y_end = std::min(height - 1, (int)std::floor(tri_max_y));
 
-				// If it is different from the previous triangle point to new coefficients
-				// This will always be the case in the first iteration, hence a will not point to nothing
-				if (j != k)
+		for (int y = y_start; y <= y_end; ++y)
+		{
+			uchar* mask_row = mask.ptr<uchar>(y);
+			for (int x = x_start; x <= x_end; ++x)
+			{
+				if (!mask_row[x] && pointInTriangle((float)x, (float)y, xs[j], ys[j], xs[k], ys[k], xs[l], ys[l]))
 				{
-					// Update the coefficient pointer if a new triangle is being processed
-					a = coefficients.ptr<float>(j);
-					k = j;
+					mask_row[x] = 1;
 				}
+			}
+		}
+	}
+}
 
-				//ap is now the pointer to the coefficients
-				float *ap = a;
+void PAW::ComputeTriangleSpans()
+{
+	std::vector<int> spans;
 
-				//look at the first coefficient (and increment). first coefficient is an x offset
-				float xo = *ap++;
-				//second coefficient is an x scale as a function of x
-				xo += *ap++ * xi;
-				//third coefficient ap(2) is an x scale as a function of y
-				*xp = float(xo + *ap++ * yi);
+	for (int y = 0; y < triangle_id.rows; ++y)
+	{
+		const int* tri_row = triangle_id.ptr<int>(y);
+		const uchar* mask_row = pixel_mask.ptr<uchar>(y);
 
-				//then fourth coefficient ap(3) is a y offset
-				float yo = *ap++;
-				//fifth coeff adds coeff[4]*x to y
-				yo += *ap++ * xi;
-				//final coeff adds coeff[5]*y to y
-				*yp = float(yo + *ap++ * yi);
+		int x = 0;
+		while (x < triangle_id.cols)
+		{
+			if (mask_row[x] == 0 || tri_row[x] < 0)
+			{
+				x++;
+				continue;
+			}
 
+			int tri = tri_row[x];
+			int x_start = x;
+			while (x < triangle_id.cols && mask_row[x] != 0 && tri_row[x] == tri)
+			{
+				x++;
 			}
-			mp++; tp++; xp++; yp++;
+			spans.push_back(y);
+			spans.push_back(x_start);
+			spans.push_back(x);
+			spans.push_back(tri);
 		}
 	}
+
+	triangle_spans = cv::Mat_<int>((int)spans.size() / 4, 4);
+	if (!spans.empty())
+	{
+		std::copy(spans.begin(), spans.end(), triangle_spans.begin());
+	}
 }
 
 // ============================================================
@@ -460,56 +513,3 @@ bool PAW::pointInTriangle(float x0, float y0, float x1, float y1, float x2, floa
 	return same_1 && same_2 && same_3;
 
 }
-
-// Find if a given point lies in the triangles
-int PAW::findTriangle(const cv::Point_<float>& point, const std::vector<std::vector<float>>& control_points, int guess)
-{
-
-	int num_tris = control_points.size();
-
-	int tri = -1;
-
-	float x0 = point.x;
-	float y0 = point.y;
-
-	// Allow a guess for speed (so as not to go through all triangles)
-	if (guess != -1)
-	{
-
-		bool in_triangle = pointInTriangle(x0, y0, control_points[guess][0], control_points[guess][1], control_points[guess][2], control_points[guess][3], control_points[guess][4], control_points[guess][5]);
-		if (in_triangle)
-		{
-			return guess;
-		}
-	}
-
-
-	for (int i = 0; i < num_tris; ++i)
-	{
-
-		float max_x = control_points[i][6];
-		float max_y = control_points[i][7];
-
-		float min_x = control_points[i][8];
-		float min_y = control_points[i][9];
-
-		// Skip the check if the point is outside the bounding box of the triangle
-
-		if (max_x < x0 || min_x > x0 || max_y < y0 || min_y > y0)
-		{
-			continue;
-		}
-
-		bool in_triangle = pointInTriangle(x0, y0,
-			control_points[i][0], control_points[i][1],
-			control_points[i][2], control_points[i][3],
-			control_points[i][4], control_points[i][5]);
-
-		if (in_triangle)
-		{
-			tri = i;
-			break;
-		}
-	}
-	return tri;
-}
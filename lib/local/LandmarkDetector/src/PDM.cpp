@@ -35,6 +35,7 @@
 #include "stdafx.h"
 
 #include <PDM.h>
+#include <MemoryReport.h>
 #include <RotationHelpers.h>
 
 // OpenCV include
@@ -44,16 +45,182 @@
 // Math includes
 #define _USE_MATH_DEFINES
 #include <cmath>
+#include <cstring>
+#include <limits>
 
 #ifndef M_PI
 	#define M_PI 3.14159265358979323846
 #endif
 
 #include <LandmarkDetectorUtils.h>
+#include "Gemm.h"
+#include "LandmarkShape.h"
 
 using namespace LandmarkDetector;
 //===========================================================================
 
+//===========================================================================
+// Fixed size kernels for the small products of the fitting. With the dimensions known at compile time the loops are unrolled and vectorized
+// by the compiler and the per iteration data stays in registers and L1, which for these sizes is faster than going through BLAS.
+// A template argument of 0 means the dimension is only known at run time, which is used for the PDMs without a specialisation
+
+// The most commonly used PDM, the 68 landmark in-the-wild model
+static const int PDM_68_POINTS = 68;
+static const int PDM_68_MODES = 34;
+
+// shape_3D = mean_shape + princ_comp * params_local, with princ_comp being 3n x m row major
+template<int NUM_POINTS, int NUM_MODES>
+static void ShapeKernel(const float* mean_shape, const float* princ_comp, const float* params_local, float* shape_3D, int n, int m)
+{
+	const int rows = NUM_POINTS > 0 ? 3 * NUM_POINTS : 3 * n;
+	const int modes = NUM_MODES > 0 ? NUM_MODES : m;
+
+	for (int i = 0; i < rows; ++i)
+	{
+		const float* basis = princ_comp + (size_t)i * modes;
+		float sum = mean_shape[i];
+		for (int j = 0; j < modes; ++j)
+		{
+			sum += basis[j] * params_local[j];
+		}
+		shape_3D[i] = sum;
+	}
+}
+
+static void CalcShapeFromParams(const cv::Mat_<float>& mean_shape, const cv::Mat_<float>& princ_comp, const cv::Mat_<float>& params_local, cv::Mat_<float>& shape_3D)
+{
+	shape_3D.create(mean_shape.rows, 1);
+
+	if (params_local.rows == 0 || princ_comp.cols == 0)
+	{
+		mean_shape.copyTo(shape_3D);
+		return;
+	}
+
+	int n = mean_shape.rows / 3;
+	int m = princ_comp.cols;
+
+	if (n == PDM_68_POINTS && m == PDM_68_MODES)
+	{
+		ShapeKernel<PDM_68_POINTS, PDM_68_MODES>(mean_shape.ptr<float>(0), princ_comp.ptr<float>(0), params_local.ptr<float>(0), shape_3D.ptr<float>(0), n, m);
+	}
+	else
+	{
+		ShapeKernel<0, 0>(mean_shape.ptr<float>(0), princ_comp.ptr<float>(0), params_local.ptr<float>(0), shape_3D.ptr<float>(0), n, m);
+	}
+}
+
+// The non-rigid part of a Jacobian row pair, how much the change of the non-rigid parameters (when object is rotated) affect 2D motion
+template<int NUM_MODES>
+static inline void NonRigidJacobianKernel(const float* Vx, const float* Vy, const float* Vz, float s, const cv::Matx33f& R, float* Jx, float* Jy, int m)
+{
+	const int modes = NUM_MODES > 0 ? NUM_MODES : m;
+
+	const float sr11 = s * R(0, 0), sr12 = s * R(0, 1), sr13 = s * R(0, 2);
+	const float sr21 = s * R(1, 0), sr22 = s * R(1, 1), sr23 = s * R(1, 2);
+
+	for (int j = 0; j < modes; ++j)
+	{
+		Jx[j] = sr11 * Vx[j] + sr12 * Vy[j] + sr13 * Vz[j];
+		Jy[j] = sr21 * Vx[j] + sr22 * Vy[j] + sr23 * Vz[j];
+	}
+}
+
+// Accumulating the upper triangle of J'WJ and J'Wv, for the rigid (6 columns) and the full 68 landmark (6 + 34 columns) Jacobians
+template<int COLS>
+static void NormalEquationsKernel(const cv::Mat_<float>& Jacobian, const cv::Mat_<float>& weights, const cv::Mat_<float>& v, cv::Mat_<float>& Hessian, float* g)
+{
+	const int rows = Jacobian.rows;
+	const int cols = COLS > 0 ? COLS : Jacobian.cols;
+
+	for (int k = 0; k < rows; ++k)
+	{
+		float w = weights.at<float>(k);
+
+		if (w == 0)
+			continue;
+
+		const float* r = Jacobian.ptr<float>(k);
+		float w_v = w * v.at<float>(k);
+
+		for (int a = 0; a < cols; ++a)
+		{
+			float w_r = w * r[a];
+			g[a] += r[a] * w_v;
+
+			float* h = Hessian.ptr<float>(a);
+			for (int b = a; b < cols; ++b)
+			{
+				h[b] += w_r * r[b];
+			}
+		}
+	}
+}
+
+// Factorising the symmetric positive definite Hessian in place (its lower triangle becomes the Cholesky factor L) and solving
+// L L' x = g with the solution written over g, for the rigid and the full 68 landmark systems the dimension is known at compile time.
+// The same tolerance as the Cholesky of cv::solve is used for a matrix that is not positive definite
+template<int DIM>
+static bool CholeskySolveKernel(cv::Mat_<float>& Hessian, float* g)
+{
+	const int dim = DIM > 0 ? DIM : Hessian.rows;
+
+	for (int j = 0; j < dim; ++j)
+	{
+		float* l_j = Hessian.ptr<float>(j);
+
+		double s = l_j[j];
+		for (int k = 0; k < j; ++k)
+		{
+			s -= (double)l_j[k] * l_j[k];
+		}
+		if (s < std::numeric_limits<float>::epsilon())
+		{
+			return false;
+		}
+		l_j[j] = (float)std::sqrt(s);
+		double inv_diag = 1.0 / l_j[j];
+
+		for (int i = j + 1; i < dim; ++i)
+		{
+			float* l_i = Hessian.ptr<float>(i);
+			s = l_i[j];
+			for (int k = 0; k < j; ++k)
+			{
+				s -= (double)l_i[k] * l_j[k];
+			}
+			l_i[j] = (float)(s * inv_diag);
+		}
+	}
+
+	// Forward substitution L y = g
+	for (int i = 0; i < dim; ++i)
+	{
+		const float* l_i = Hessian.ptr<float>(i);
+		double s = g[i];
+		for (int k = 0; k < i; ++k)
+		{
+			s -= (double)l_i[k] * g[k];
+		}
+		g[i] = (float)(s / l_i[i]);
+	}
+
+	// Back substitution L' x = y
+	for (int i = dim - 1; i >= 0; --i)
+	{
+		double s = g[i];
+		for (int k = i + 1; k < dim; ++k)
+		{
+			s -= (double)Hessian.at<float>(k, i) * g[k];
+		}
+		g[i] = (float)(s / Hessian.at<float>(i, i));
+	}
+
+	return true;
+}
+
+//===========================================================================
+
 //=============================================================================
 // Orthonormalising the 3x3 rotation matrix
 void PDM::Orthonormalise(cv::Matx33f &R)
@@ -78,10 +245,23 @@ void PDM::Orthonormalise(cv::Matx33f &R)
 // A copy constructor
 PDM::PDM(const PDM& other) {
 
-	// Make sure the matrices are allocated properly
-	this->mean_shape = other.mean_shape.clone();
-	this->princ_comp = other.princ_comp.clone();
-	this->eigen_values = other.eigen_values.clone();
+	// The model is never modified after reading, so the copies share the (reference counted) matrices instead of cloning them
+	this->mean_shape = other.mean_shape;
+	this->princ_comp = other.princ_comp;
+	this->eigen_values = other.eigen_values;
+}
+
+//===========================================================================
+// The principal components are sliced into contiguous memory, so that the Jacobian and shape computations only go over the kept modes
+PDM PDM::Truncated(int num_modes) const
+{
+	num_modes = std::max(0, std::min(num_modes, NumberOfModes()));
+
+	PDM truncated;
+	truncated.mean_shape = this->mean_shape;
+	truncated.princ_comp = this->princ_comp.colRange(0, num_modes).clone();
+	truncated.eigen_values = this->eigen_values.colRange(0, num_modes).clone();
+	return truncated;
 }
 
 //===========================================================================
@@ -138,19 +318,15 @@ void PDM::Clamp(cv::Mat_<float>& local_params, cv::Vec6f& params_global, const F
 // Compute the 3D representation of shape (in object space) using the local parameters
 void PDM::CalcShape3D(cv::Mat_<float>& out_shape, const cv::Mat_<float>& p_local) const
 {
-	out_shape = mean_shape.clone();
-
-	// Perform matrix vector multiplication in OpenBLAS (fortran call)
-	float alpha1 = 1.0;
-	float beta1 = 1.0;
-	int p_local_cols = p_local.cols;
-	int princ_comp_rows = princ_comp.rows;
-	int princ_comp_cols = princ_comp.cols;
-	char N[2]; N[0] = 'N';
-	sgemm_(N, N, &p_local_cols, &princ_comp_rows, &princ_comp_cols, &alpha1, (float*)p_local.data, &p_local_cols, (float*)princ_comp.data, &princ_comp_cols, &beta1, (float*)out_shape.data, &p_local_cols);
+	// The output should not share the memory of the model
+	if (out_shape.data == mean_shape.data)
+	{
+		out_shape = cv::Mat_<float>();
+	}
 
-	// Above is a fast (but ugly) version of 
-	// out_shape = mean_shape + princ_comp * p_local;	 
+	// Fixed size matrix vector multiplication, a fast (but ugly) version of
+	// out_shape = mean_shape + princ_comp * p_local;
+	CalcShapeFromParams(mean_shape, princ_comp, p_local, out_shape);
 
 }
 
@@ -169,8 +345,9 @@ void PDM::CalcShape2D(cv::Mat_<float>& out_shape, const cv::Mat_<float>& params_
 	cv::Vec3f euler(params_global[1], params_global[2], params_global[3]);
 	cv::Matx33f currRot = Utilities::Euler2RotationMatrix(euler);
 	
-	// get the 3D shape of the object
-	cv::Mat_<float> Shape_3D;
+	// get the 3D shape of the object, computed into a fixed size shape (rather than allocated) if it fits in one
+	LandmarkShape3D shape_3D;
+	cv::Mat_<float> Shape_3D = shape_3D.Resize(n) ? shape_3D.Column() : cv::Mat_<float>();
 	this->CalcShape3D(Shape_3D, params_local);
 
 	// create the 2D shape matrix (if it has not been defined yet)
@@ -178,19 +355,83 @@ void PDM::CalcShape2D(cv::Mat_<float>& out_shape, const cv::Mat_<float>& params_
 	{
 		out_shape.create(2*n,1);
 	}
+
+	const float* X = Shape_3D.ptr<float>(0);
+	const float* Y = X + n;
+	const float* Z = Y + n;
+
 	// for every vertex
 	for(int i = 0; i < n; i++)
 	{
 		// Transform this using the weak-perspective mapping to 2D from 3D
-		out_shape.at<float>(i  ,0) = s * ( currRot(0,0) * Shape_3D.at<float>(i, 0) + currRot(0,1) * Shape_3D.at<float>(i+n  ,0) + currRot(0,2) * Shape_3D.at<float>(i+n*2,0) ) + tx;
-		out_shape.at<float>(i+n,0) = s * ( currRot(1,0) * Shape_3D.at<float>(i, 0) + currRot(1,1) * Shape_3D.at<float>(i+n  ,0) + currRot(1,2) * Shape_3D.at<float>(i+n*2,0) ) + ty;
+		out_shape.at<float>(i  ,0) = s * ( currRot(0,0) * X[i] + currRot(0,1) * Y[i] + currRot(0,2) * Z[i] ) + tx;
+		out_shape.at<float>(i+n,0) = s * ( currRot(1,0) * X[i] + currRot(1,1) * Y[i] + currRot(1,2) * Z[i] ) + ty;
+	}
+}
+
+//===========================================================================
+void PDM::CalcShapes3D(cv::Mat_<float>& out_shapes, const cv::Mat_<float>& params_local) const
+{
+	const int num_sets = params_local.rows;
+	const int m = this->NumberOfModes();
+	const int len = mean_shape.rows;
+
+	out_shapes.create(num_sets, len);
+
+	// Starting from the mean shape in every row, the modes are then added for all of the sets at once
+	for (int k = 0; k < num_sets; ++k)
+	{
+		memcpy(out_shapes.ptr<float>(k), mean_shape.ptr<float>(0), len * sizeof(float));
+	}
+
+	if (num_sets == 0 || m == 0 || params_local.cols == 0)
+	{
+		return;
+	}
+
+	cv::Mat_<float> P = params_local.isContinuous() ? params_local : params_local.clone();
+
+	// Row major out_shapes += P * princ_comp', through the column major BLAS convention
+	Gemm(true, false, len, num_sets, m, 1.0f, princ_comp.ptr<float>(0), m, P.ptr<float>(0), m, 1.0f, out_shapes.ptr<float>(0), len);
+}
+
+//===========================================================================
+void PDM::CalcShapes2D(cv::Mat_<float>& out_shapes, const cv::Mat_<float>& shapes_3D, const vector<cv::Vec6f>& params_global) const
+{
+	const int num_sets = (int)params_global.size();
+	const int n = this->NumberOfPoints();
+
+	out_shapes.create(num_sets, 2 * n);
+
+	for (int k = 0; k < num_sets; ++k)
+	{
+		const cv::Vec6f& global = params_global[k];
+		cv::Matx33f R = Utilities::Euler2RotationMatrix(cv::Vec3f(global[1], global[2], global[3]));
+
+		// The scaled first two rows of the rotation, so that the loop below is a plain (vectorised) multiply add over the vertices
+		const float s = global[0];
+		const float r11 = s * R(0, 0), r12 = s * R(0, 1), r13 = s * R(0, 2);
+		const float r21 = s * R(1, 0), r22 = s * R(1, 1), r23 = s * R(1, 2);
+		const float tx = global[4], ty = global[5];
+
+		const float* X = shapes_3D.ptr<float>(k);
+		const float* Y = X + n;
+		const float* Z = Y + n;
+		float* x_out = out_shapes.ptr<float>(k);
+		float* y_out = x_out + n;
+
+		for (int i = 0; i < n; ++i)
+		{
+			x_out[i] = r11 * X[i] + r12 * Y[i] + r13 * Z[i] + tx;
+			y_out[i] = r21 * X[i] + r22 * Y[i] + r23 * Z[i] + ty;
+		}
 	}
 }
 
 //===========================================================================
 // provided the bounding box of a face and the local parameters (with optional rotation), generates the global parameters that can generate the face with the provided bounding box
 // This all assumes that the bounding box describes face from left outline to right outline of the face and chin to eyebrows
-void PDM::CalcParams(cv::Vec6f& out_params_global, const cv::Rect_<float>& bounding_box, const cv::Mat_<float>& params_local, const cv::Vec3f rotation)
+void PDM::CalcParams(cv::Vec6f& out_params_global, const cv::Rect_<float>& bounding_box, const cv::Mat_<float>& params_local, const cv::Vec3f rotation) const
 {
 
 	// get the shape instance based on local params
@@ -251,46 +492,46 @@ void PDM::CalcBoundingBox(cv::Rect_<float>& out_bounding_box, const cv::Vec6f& p
 }
 
 //===========================================================================
-// Calculate the PDM's Jacobian over rigid parameters (rotation, translation and scaling), the additional input W represents trust for each of the landmarks and is part of Non-Uniform RLMS 
-void PDM::ComputeRigidJacobian(const cv::Mat_<float>& p_local, const cv::Vec6f& params_global, cv::Mat_<float> &Jacob, const cv::Mat_<float> W, cv::Mat_<float> &Jacob_t_w)
+// Calculate the PDM's Jacobian over the rigid (rotation, translation and scaling) or over all parameters (rigid and non-rigid) into the provided matrix, 
+// as long as Jacobian and shape_3D have the right size already no memory is allocated, so they can be kept between the iterations of a fit
+void PDM::ComputeJacobianInPlace(const cv::Mat_<float>& params_local, const cv::Vec6f& params_global, bool rigid, cv::Mat_<float>& Jacobian, cv::Mat_<float>& shape_3D) const
 {
-  	
-	// number of verts
+	// number of vertices
 	int n = this->NumberOfPoints();
-  
-	Jacob.create(n * 2, 6);
+		
+	// number of non-rigid parameters
+	int m = rigid ? 0 : this->NumberOfModes();
+
+	int cols = 6 + m;
 
-	float X,Y,Z;
+	Jacobian.create(n * 2, cols);
+	
+	// Compute the shape in object space, without the temporary clone of CalcShape3D
+	CalcShapeFromParams(mean_shape, princ_comp, params_local, shape_3D);
 
 	float s = params_global[0];
-  	
-	cv::Mat_<float> shape_3D;
-	this->CalcShape3D(shape_3D, p_local);
-		
-	 // Get the rotation matrix
+	
 	cv::Vec3f euler(params_global[1], params_global[2], params_global[3]);
 	cv::Matx33f currRot = Utilities::Euler2RotationMatrix(euler);
 	
-	float r11 = currRot(0,0);
-	float r12 = currRot(0,1);
-	float r13 = currRot(0,2);
-	float r21 = currRot(1,0);
-	float r22 = currRot(1,1);
-	float r23 = currRot(1,2);
-	float r31 = currRot(2,0);
-	float r32 = currRot(2,1);
-	float r33 = currRot(2,2);
-
-	cv::MatIterator_<float> Jx = Jacob.begin();
-	cv::MatIterator_<float> Jy = Jx + n * 6;
+	float r11 = currRot(0, 0);
+	float r12 = currRot(0, 1);
+	float r13 = currRot(0, 2);
+	float r21 = currRot(1, 0);
+	float r22 = currRot(1, 1);
+	float r23 = currRot(1, 2);
+
+	const float* shape = shape_3D.ptr<float>(0);
 
 	for(int i = 0; i < n; i++)
 	{
+		float X = shape[i];
+		float Y = shape[i + n];
+		float Z = shape[i + n * 2];
     
-		X = shape_3D.at<float>(i, 0);
-		Y = shape_3D.at<float>(i + n, 0);
-		Z = shape_3D.at<float>(i + n * 2, 0);
-		
+		float* Jx = Jacobian.ptr<float>(i);
+		float* Jy = Jacobian.ptr<float>(i + n);
+
 		// The rigid jacobian from the axis angle rotation matrix approximation using small angle assumption (R * R')
 		// where R' = [1, -wz, wy
 		//             wz, 1, -wx
@@ -298,45 +539,130 @@ void PDM::ComputeRigidJacobian(const cv::Mat_<float>& p_local, const cv::Vec6f&
 		// And this is derived using the small angle assumption on the axis angle rotation matrix parametrisation
 
 		// scaling term
-		*Jx++ =  (X  * r11 + Y * r12 + Z * r13);
-		*Jy++ =  (X  * r21 + Y * r22 + Z * r23);
+		Jx[0] = (X  * r11 + Y * r12 + Z * r13);
+		Jy[0] = (X  * r21 + Y * r22 + Z * r23);
 		
 		// rotation terms
-		*Jx++ = (s * (Y * r13 - Z * r12) );
-		*Jy++ = (s * (Y * r23 - Z * r22) );
-		*Jx++ = (-s * (X * r13 - Z * r11));
-		*Jy++ = (-s * (X * r23 - Z * r21));
-		*Jx++ = (s * (X * r12 - Y * r11) );
-		*Jy++ = (s * (X * r22 - Y * r21) );
+		Jx[1] = (s * (Y * r13 - Z * r12) );
+		Jy[1] = (s * (Y * r23 - Z * r22) );
+		Jx[2] = (-s * (X * r13 - Z * r11));
+		Jy[2] = (-s * (X * r23 - Z * r21));
+		Jx[3] = (s * (X * r12 - Y * r11) );
+		Jy[3] = (s * (X * r22 - Y * r21) );
 		
 		// translation terms
-		*Jx++ = 1.0f;
-		*Jy++ = 0.0f;
-		*Jx++ = 0.0f;
-		*Jy++ = 1.0f;
+		Jx[4] = 1.0f;
+		Jy[4] = 0.0f;
+		Jx[5] = 0.0f;
+		Jy[5] = 1.0f;
 
+		if(m > 0)
+		{
+			const float* Vx = princ_comp.ptr<float>(i);
+			const float* Vy = princ_comp.ptr<float>(i + n);
+			const float* Vz = princ_comp.ptr<float>(i + n * 2);
+
+			// How much the change of the non-rigid parameters (when object is rotated) affect 2D motion
+			if (m == PDM_68_MODES)
+			{
+				NonRigidJacobianKernel<PDM_68_MODES>(Vx, Vy, Vz, s, currRot, Jx + 6, Jy + 6, m);
+			}
+			else
+			{
+				NonRigidJacobianKernel<0>(Vx, Vy, Vz, s, currRot, Jx + 6, Jy + 6, m);
+			}
+		}
 	}
+}
 
-	cv::Mat Jacob_w = cv::Mat::zeros(Jacob.rows, Jacob.cols, Jacob.type());
-	
-	Jx =  Jacob.begin();
-	Jy =  Jx + n*6;
+//===========================================================================
+// Form the weighted normal equations J'WJ and J'Wv directly from the Jacobian, W is diagonal and is provided as a column of its 2n weights,
+// so only the rows with non-zero weights are visited and only the upper triangle of the symmetric J'WJ is accumulated. 
+// J'WJ is added to Hessian (so that it can be initialised with the regularisation term) while J_w_t_v is overwritten
+void PDM::WeightedNormalEquations(const cv::Mat_<float>& Jacobian, const cv::Mat_<float>& weights, const cv::Mat_<float>& v, cv::Mat_<float>& Hessian, cv::Mat_<float>& J_w_t_v)
+{
+	int cols = Jacobian.cols;
 
-	cv::MatIterator_<float> Jx_w =  Jacob_w.begin<float>();
-	cv::MatIterator_<float> Jy_w =  Jx_w + n*6;
+	J_w_t_v.create(cols, 1);
+	J_w_t_v.setTo(0.0f);
 
-	// Iterate over all Jacobian values and multiply them by the weight in diagonal of W
-	for(int i = 0; i < n; i++)
+	float* g = J_w_t_v.ptr<float>(0);
+
+	// The rigid and the full 68 landmark Jacobians have specialised kernels
+	if(cols == 6)
+	{
+		NormalEquationsKernel<6>(Jacobian, weights, v, Hessian, g);
+	}
+	else if(cols == 6 + PDM_68_MODES)
+	{
+		NormalEquationsKernel<6 + PDM_68_MODES>(Jacobian, weights, v, Hessian, g);
+	}
+	else
+	{
+		NormalEquationsKernel<0>(Jacobian, weights, v, Hessian, g);
+	}
+
+	// Fill in the lower triangle
+	for(int a = 0; a < cols; ++a)
+	{
+		for(int b = a + 1; b < cols; ++b)
+		{
+			Hessian.at<float>(b, a) = Hessian.at<float>(a, b);
+		}
+	}
+}
+
+//===========================================================================
+bool PDM::SolveNormalEquations(cv::Mat_<float>& Hessian, cv::Mat_<float>& J_w_t_v)
+{
+	float* g = J_w_t_v.ptr<float>(0);
+
+	bool solved;
+	if(Hessian.rows == 6)
+	{
+		solved = CholeskySolveKernel<6>(Hessian, g);
+	}
+	else if(Hessian.rows == 6 + PDM_68_MODES)
+	{
+		solved = CholeskySolveKernel<6 + PDM_68_MODES>(Hessian, g);
+	}
+	else
+	{
+		solved = CholeskySolveKernel<0>(Hessian, g);
+	}
+
+	// As cv::solve, no update when the system can not be solved
+	if(!solved)
 	{
-		float w_x = W.at<float>(i, i);
-		float w_y = W.at<float>(i+n, i+n);
+		J_w_t_v.setTo(0.0f);
+	}
+	return solved;
+}
 
+//===========================================================================
+// Multiply every Jacobian row by the corresponding weight in diagonal of W
+void PDM::WeightRows(cv::Mat_<float>& Jacob, const cv::Mat_<float>& W)
+{
+	for(int i = 0; i < Jacob.rows; i++)
+	{
+		float w = W.at<float>(i, i);
+		float* J = Jacob.ptr<float>(i);
 		for(int j = 0; j < Jacob.cols; ++j)
 		{
-			*Jx_w++ = *Jx++ * w_x;
-			*Jy_w++ = *Jy++ * w_y;
-		}		
+			J[j] *= w;
+		}
 	}
+}
+
+//===========================================================================
+// Calculate the PDM's Jacobian over rigid parameters (rotation, translation and scaling), the additional input W represents trust for each of the landmarks and is part of Non-Uniform RLMS 
+void PDM::ComputeRigidJacobian(const cv::Mat_<float>& p_local, const cv::Vec6f& params_global, cv::Mat_<float> &Jacob, const cv::Mat_<float> W, cv::Mat_<float> &Jacob_t_w)
+{
+	cv::Mat_<float> shape_3D;
+	ComputeJacobianInPlace(p_local, params_global, true, Jacob, shape_3D);
+
+	cv::Mat_<float> Jacob_w = Jacob.clone();
+	WeightRows(Jacob_w, W);
 
 	Jacob_t_w = Jacob_w.t();
 }
@@ -345,102 +671,14 @@ void PDM::ComputeRigidJacobian(const cv::Mat_<float>& p_local, const cv::Vec6f&
 // Calculate the PDM's Jacobian over all parameters (rigid and non-rigid), the additional input W represents trust for each of the landmarks and is part of Non-Uniform RLMS
 void PDM::ComputeJacobian(const cv::Mat_<float>& params_local, const cv::Vec6f& params_global, cv::Mat_<float> &Jacobian, const cv::Mat_<float> W, cv::Mat_<float> &Jacob_t_w)
 { 
-	
-	// number of vertices
-	int n = this->NumberOfPoints();
-		
-	// number of non-rigid parameters
-	int m = this->NumberOfModes();
-
-	Jacobian.create(n * 2, 6 + m);
-	
-	float X,Y,Z;
-	
-	float s = params_global[0];
-  	
 	cv::Mat_<float> shape_3D;
-	this->CalcShape3D(shape_3D, params_local);
-	
-	cv::Vec3f euler(params_global[1], params_global[2], params_global[3]);
-	cv::Matx33f currRot = Utilities::Euler2RotationMatrix(euler);
-	
-	float r11 = currRot(0, 0);
-	float r12 = currRot(0, 1);
-	float r13 = currRot(0, 2);
-	float r21 = currRot(1, 0);
-	float r22 = currRot(1, 1);
-	float r23 = currRot(1, 2);
-	float r31 = currRot(2, 0);
-	float r32 = currRot(2, 1);
-	float r33 = currRot(2, 2);
-
-	cv::MatIterator_<float> Jx =  Jacobian.begin();
-	cv::MatIterator_<float> Jy =  Jx + n * (6 + m);
-	cv::MatConstIterator_<float> Vx =  this->princ_comp.begin();
-	cv::MatConstIterator_<float> Vy =  Vx + n*m;
-	cv::MatConstIterator_<float> Vz =  Vy + n*m;
-
-	for(int i = 0; i < n; i++)
-	{
-    
-		X = shape_3D.at<float>(i, 0);
-		Y = shape_3D.at<float>(i + n, 0);
-		Z = shape_3D.at<float>(i + n * 2, 0);
-    
-		// The rigid jacobian from the axis angle rotation matrix approximation using small angle assumption (R * R')
-		// where R' = [1, -wz, wy
-		//             wz, 1, -wx
-		//             -wy, wx, 1]
-		// And this is derived using the small angle assumption on the axis angle rotation matrix parametrisation
-
-		// scaling term
-		*Jx++ = (X  * r11 + Y * r12 + Z * r13);
-		*Jy++ = (X  * r21 + Y * r22 + Z * r23);
-		
-		// rotation terms
-		*Jx++ = (s * (Y * r13 - Z * r12) );
-		*Jy++ = (s * (Y * r23 - Z * r22) );
-		*Jx++ = (-s * (X * r13 - Z * r11));
-		*Jy++ = (-s * (X * r23 - Z * r21));
-		*Jx++ = (s * (X * r12 - Y * r11) );
-		*Jy++ = (s * (X * r22 - Y * r21) );
-		
-		// translation terms
-		*Jx++ = 1.0f;
-		*Jy++ = 0.0f;
-		*Jx++ = 0.0f;
-		*Jy++ = 1.0f;
-
-		for(int j = 0; j < m; j++,++Vx,++Vy,++Vz)
-		{
-			// How much the change of the non-rigid parameters (when object is rotated) affect 2D motion
-			*Jx++ = ( s*(r11*(*Vx) + r12*(*Vy) + r13*(*Vz)) );
-			*Jy++ = ( s*(r21*(*Vx) + r22*(*Vy) + r23*(*Vz)) );
-		}
-	}	
+	ComputeJacobianInPlace(params_local, params_global, false, Jacobian, shape_3D);
 
 	// Adding the weights here	
 	if(cv::trace(W)[0] != W.rows) 
 	{
-		cv::Mat Jacob_w = Jacobian.clone();
-		Jx =  Jacobian.begin();
-		Jy =  Jx + n*(6+m);
-
-		cv::MatIterator_<float> Jx_w =  Jacob_w.begin<float>();
-		cv::MatIterator_<float> Jy_w =  Jx_w + n*(6+m);
-
-		// Iterate over all Jacobian values and multiply them by the weight in diagonal of W
-		for(int i = 0; i < n; i++)
-		{
-			float w_x = W.at<float>(i, i);
-			float w_y = W.at<float>(i+n, i+n);
-
-			for(int j = 0; j < Jacobian.cols; ++j)
-			{
-				*Jx_w++ = *Jx++ * w_x;
-				*Jy_w++ = *Jy++ * w_y;
-			}
-		}
+		cv::Mat_<float> Jacob_w = Jacobian.clone();
+		WeightRows(Jacob_w, W);
 		Jacob_t_w = Jacob_w.t();
 	}
 	else
@@ -459,30 +697,24 @@ void PDM::UpdateModelParameters(const cv::Mat_<float>& delta_p, cv::Mat_<float>&
 	params_global[4] += delta_p.at<float>(4,0);
 	params_global[5] += delta_p.at<float>(5,0);
 
-	// get the original rotation matrix	
+	// get the original rotation
 	cv::Vec3f eulerGlobal(params_global[1], params_global[2], params_global[3]);
 	
-	cv::Matx33f R1 = Utilities::Euler2RotationMatrix(eulerGlobal);
-
-	// construct R' = [1, -wz, wy
-	//               wz, 1, -wx
-	//               -wy, wx, 1]
-	cv::Matx33f R2 = cv::Matx33f::eye();
-
-	R2(1,2) = -1.0*(R2(2,1) = delta_p.at<float>(1,0));
-	R2(2,0) = -1.0*(R2(0,2) = delta_p.at<float>(2,0));
-	R2(0,1) = -1.0*(R2(1,0) = delta_p.at<float>(3,0));
-	
-	// Make sure it's orthonormal
-	Orthonormalise(R2);
+	cv::Vec4f q1 = Utilities::Euler2Quaternion(eulerGlobal);
+
+	// The small angle update R' = [1, -wz, wy
+	//                              wz, 1, -wx
+	//                              -wy, wx, 1]
+	// made orthonormal (its closest rotation) is the rotation about w by atan(|w|), so it is composed as a quaternion instead of
+	// through an SVD of R', and the Euler angles are read from the quaternion directly (matches the matrix path up to float precision)
+	cv::Vec3f w(delta_p.at<float>(1,0), delta_p.at<float>(2,0), delta_p.at<float>(3,0));
+	float theta = (float)cv::norm(w);
+	float half_angle = atan(theta) / 2.0f;
+	float axis_scale = theta > 1e-8f ? sin(half_angle) / theta : 0.5f;
+	cv::Vec4f q2(cos(half_angle), w[0] * axis_scale, w[1] * axis_scale, w[2] * axis_scale);
 
 	// Combine rotations
-	cv::Matx33f R3 = R1 *R2;
-
-	// Extract euler angle (through axis angle first to make sure it's legal)
-	cv::Vec3f axis_angle = Utilities::RotationMatrix2AxisAngle(R3);
-
-	cv::Vec3f euler = Utilities::AxisAngle2Euler(axis_angle);
+	cv::Vec3f euler = Utilities::Quaternion2Euler(Utilities::QuaternionProduct(q1, q2));
 
 	// Temporary fix to numerical instability
 	if (isnan(euler[0]) || isnan(euler[1]) || isnan(euler[2]))
@@ -505,93 +737,27 @@ void PDM::UpdateModelParameters(const cv::Mat_<float>& delta_p, cv::Mat_<float>&
 
 }
 
-void PDM::CalcParams(cv::Vec6f& out_params_global, cv::Mat_<float>& out_params_local, const cv::Mat_<float> & landmark_locations, const cv::Vec3f rotation)
+//===========================================================================
+// The Gauss-Newton fitting of the parameters to landmark locations (all of the landmarks are used), stopping once the error did not improve
+// for patience iterations, returns false if the maximum number of iterations was reached before that
+bool PDM::FitParams(cv::Vec6f& glob_params, cv::Mat_<float>& loc_params, const cv::Mat_<float>& landmark_locs_vis, int max_iterations, int patience)
 {
-		
 	int m = this->NumberOfModes();
 	int n = this->NumberOfPoints();
 
-	cv::Mat_<int> visi_ind_2D(n * 2, 1, 1);
-	cv::Mat_<int> visi_ind_3D(3 * n , 1, 1);
-
-	int visi_count = n;
-
-	for(int i = 0; i < n; ++i)
-	{
-		// If the landmark is invisible indicate this
-		if(landmark_locations.at<float>(i) == 0)
-		{
-			visi_ind_2D.at<int>(i) = 0;
-			visi_ind_2D.at<int>(i+n) = 0;
-			visi_ind_3D.at<int>(i) = 0;
-			visi_ind_3D.at<int>(i+n) = 0;
-			visi_ind_3D.at<int>(i+2*n) = 0;
-
-			visi_count--;
-		}
-	}
-
-	// As not all landmarks might be visible, subsample the Mean and principal component matrices
-	cv::Mat_<float> M(visi_count * 3, mean_shape.cols, 0.0);
-	cv::Mat_<float> V(visi_count * 3, princ_comp.cols, 0.0);
-	visi_count = 0;
-	for (int i = 0; i < n * 3; ++i)
-	{
-		if (visi_ind_3D.at<int>(i) == 1)
-		{
-			this->mean_shape.row(i).copyTo(M.row(visi_count));
-			this->princ_comp.row(i).copyTo(V.row(visi_count));
-			visi_count++;
-		}
-	}
-
-	cv::Mat_<float> m_old = this->mean_shape.clone();
-	cv::Mat_<float> v_old = this->princ_comp.clone();
-
-	this->mean_shape = M;
-	this->princ_comp = V;
-
-	// The new number of points
-	n  = M.rows / 3;
-
-	// Extract the relevant landmark locations
-	cv::Mat_<float> landmark_locs_vis(n*2, 1, 0.0f);
-	int k = 0;
-	for(int i = 0; i < visi_ind_2D.rows; ++i)
-	{
-		if(visi_ind_2D.at<int>(i) == 1)
-		{
-			landmark_locs_vis.at<float>(k) = landmark_locations.at<float>(i);
-			k++;
-		}		
-	}
-
-	// Compute the initial global parameters
-	float min_x, max_x, min_y, max_y;
-	ExtractBoundingBox(landmark_locs_vis, min_x, max_x, min_y, max_y);
-
-	float width = abs(min_x - max_x);
-	float height = abs(min_y - max_y);
-
-	cv::Rect_<float> model_bbox;
-	CalcBoundingBox(model_bbox, cv::Vec6f(1.0, 0.0, 0.0, 0.0, 0.0, 0.0), cv::Mat_<float>(this->NumberOfModes(), 1, 0.0));
-
-	cv::Rect_<float> bbox(min_x, min_y, width, height);
-
-	float scaling = ((width / model_bbox.width) + (height / model_bbox.height)) / 2.0f;
-        
-	cv::Vec3f rotation_init = rotation;
+	float scaling = glob_params[0];
+	cv::Vec3f rotation_init(glob_params[1], glob_params[2], glob_params[3]);
+	cv::Vec2f translation(glob_params[4], glob_params[5]);
 	cv::Matx33f R = Utilities::Euler2RotationMatrix(rotation_init);
-	cv::Vec2f translation((min_x + max_x) / 2.0f, (min_y + max_y) / 2.0f);
-    
-	cv::Mat_<float> loc_params(this->NumberOfModes(),1, 0.0);
-	cv::Vec6f glob_params(scaling, rotation_init[0], rotation_init[1], rotation_init[2], translation[0], translation[1]);
 
-	// get the 3D shape of the object	
+	const cv::Mat_<float>& M = this->mean_shape;
+	const cv::Mat_<float>& V = this->princ_comp;
+
+	// get the 3D shape of the object
 	cv::Mat_<float> shape_3D = M + V * loc_params;
 
 	cv::Mat_<float> curr_shape(2*n, 1);
-	
+
 	// for every vertex
 	for(int i = 0; i < n; i++)
 	{
@@ -599,8 +765,8 @@ void PDM::CalcParams(cv::Vec6f& out_params_global, cv::Mat_<float>& out_params_l
 		curr_shape.at<float>(i  ,0) = scaling * ( R(0,0) * shape_3D.at<float>(i, 0) + R(0,1) * shape_3D.at<float>(i+n  ,0) + R(0,2) * shape_3D.at<float>(i+n*2,0) ) + translation[0];
 		curr_shape.at<float>(i+n,0) = scaling * ( R(1,0) * shape_3D.at<float>(i, 0) + R(1,1) * shape_3D.at<float>(i+n  ,0) + R(1,2) * shape_3D.at<float>(i+n*2,0) ) + translation[1];
 	}
-		    
-    float currError = cv::norm(curr_shape - landmark_locs_vis);
+
+	float currError = cv::norm(curr_shape - landmark_locs_vis);
 
 	cv::Mat_<float> regularisations = cv::Mat_<float>::zeros(1, 6 + m);
 
@@ -610,11 +776,15 @@ void PDM::CalcParams(cv::Vec6f& out_params_global, cv::Mat_<float>& out_params_l
 	cv::Mat(reg_factor / this->eigen_values).copyTo(regularisations(cv::Rect(6, 0, m, 1)));
 	regularisations = cv::Mat::diag(regularisations.t());
 
-	cv::Mat_<float> WeightMatrix = cv::Mat_<float>::eye(n*2, n*2);
+	// All the observations are trusted equally
+	cv::Mat_<float> weights = cv::Mat_<float>::ones(n*2, 1);
+
+	// The preallocated workspaces of the update computation, reused across iterations
+	cv::Mat_<float> J, J_shape_3D, J_w_t_m, Hessian;
 
 	int not_improved_in = 0;
 
-	for (size_t i = 0; i < 1000; ++i)
+	for (int i = 0; i < max_iterations; ++i)
 	{
 		// get the 3D shape of the object
 		shape_3D = M + V * loc_params;
@@ -632,34 +802,25 @@ void PDM::CalcParams(cv::Vec6f& out_params_global, cv::Mat_<float>& out_params_l
 		cv::Mat_<float> error_resid;
 		cv::Mat(landmark_locs_vis - curr_shape_2D).convertTo(error_resid, CV_32F);
         
-		cv::Mat_<float> J, J_w_t;
-		this->ComputeJacobian(loc_params, glob_params, J, WeightMatrix, J_w_t);
+		this->ComputeJacobianInPlace(loc_params, glob_params, false, J, J_shape_3D);
         
-		// projection of the meanshifts onto the jacobians (using the weighted Jacobian, see Baltrusaitis 2013)
-		cv::Mat_<float> J_w_t_m = J_w_t * error_resid;
-
-		// Add the regularisation term
-		J_w_t_m(cv::Rect(0,6,1, m)) = J_w_t_m(cv::Rect(0,6,1, m)) - regularisations(cv::Rect(6,6, m, m)) * loc_params;
-
-		cv::Mat_<float> Hessian = regularisations.clone();
+		// projection of the meanshifts onto the jacobians (using the weighted Jacobian, see Baltrusaitis 2013) and the Hessian J'J + regularisations
+		regularisations.copyTo(Hessian);
+		WeightedNormalEquations(J, weights, error_resid, Hessian, J_w_t_m);
 
-		// Perform matrix multiplication in OpenBLAS (fortran call)
-		float alpha1 = 1.0;
-		float beta1 = 1.0;
-		char N[2]; N[0] = 'N';
-		sgemm_(N, N, &J.cols, &J_w_t.rows, &J_w_t.cols, &alpha1, (float*)J.data, &J.cols, (float*)J_w_t.data, &J_w_t.cols, &beta1, (float*)Hessian.data, &J.cols);
+		// Add the regularisation term (it is diagonal)
+		for(int j = 0; j < m; ++j)
+		{
+			J_w_t_m.at<float>(6 + j) -= regularisations.at<float>(6 + j, 6 + j) * loc_params.at<float>(j);
+		}
 
-		// Above is a fast (but ugly) version of 
-		// cv::Mat_<float> Hessian2 = J_w_t * J + regularisations;
-		
-		// Solve for the parameter update (from Baltrusaitis 2013 based on eq (36) Saragih 2011)
-		cv::Mat_<float> param_update;
-		cv::solve(Hessian, J_w_t_m, param_update, cv::DECOMP_CHOLESKY);
+		// Solve for the parameter update (from Baltrusaitis 2013 based on eq (36) Saragih 2011), J_w_t_m holds the update afterwards
+		SolveNormalEquations(Hessian, J_w_t_m);
 
 		// To not overshoot, have the gradient decent rate a bit smaller
-		param_update = 0.75 * param_update;
+		J_w_t_m *= 0.75f;
 
-		UpdateModelParameters(param_update, loc_params, glob_params);		
+		UpdateModelParameters(J_w_t_m, loc_params, glob_params);		
         
         scaling = glob_params[0];
 		rotation_init[0] = glob_params[1];
@@ -685,9 +846,9 @@ void PDM::CalcParams(cv::Vec6f& out_params_global, cv::Mat_<float>& out_params_l
         if(0.999 * currError < error)
 		{
 			not_improved_in++;
-			if (not_improved_in == 3)
+			if (not_improved_in == patience)
 			{
-				break;
+				return true;
 			}
 		}
 
@@ -695,6 +856,95 @@ void PDM::CalcParams(cv::Vec6f& out_params_global, cv::Mat_<float>& out_params_l
         
 	}
 
+	return false;
+}
+
+void PDM::CalcParams(cv::Vec6f& out_params_global, cv::Mat_<float>& out_params_local, const cv::Mat_<float> & landmark_locations, const cv::Vec3f rotation)
+{
+		
+	int n = this->NumberOfPoints();
+
+	cv::Mat_<int> visi_ind_2D(n * 2, 1, 1);
+	cv::Mat_<int> visi_ind_3D(3 * n , 1, 1);
+
+	int visi_count = n;
+
+	for(int i = 0; i < n; ++i)
+	{
+		// If the landmark is invisible indicate this
+		if(landmark_locations.at<float>(i) == 0)
+		{
+			visi_ind_2D.at<int>(i) = 0;
+			visi_ind_2D.at<int>(i+n) = 0;
+			visi_ind_3D.at<int>(i) = 0;
+			visi_ind_3D.at<int>(i+n) = 0;
+			visi_ind_3D.at<int>(i+2*n) = 0;
+
+			visi_count--;
+		}
+	}
+
+	// As not all landmarks might be visible, subsample the Mean and principal component matrices (nothing to do if all of them are)
+	cv::Mat_<float> m_old = this->mean_shape;
+	cv::Mat_<float> v_old = this->princ_comp;
+	cv::Mat_<float> landmark_locs_vis = landmark_locations;
+
+	if (visi_count < n)
+	{
+		cv::Mat_<float> M(visi_count * 3, mean_shape.cols, 0.0);
+		cv::Mat_<float> V(visi_count * 3, princ_comp.cols, 0.0);
+		visi_count = 0;
+		for (int i = 0; i < n * 3; ++i)
+		{
+			if (visi_ind_3D.at<int>(i) == 1)
+			{
+				this->mean_shape.row(i).copyTo(M.row(visi_count));
+				this->princ_comp.row(i).copyTo(V.row(visi_count));
+				visi_count++;
+			}
+		}
+
+		this->mean_shape = M;
+		this->princ_comp = V;
+
+		// Extract the relevant landmark locations
+		landmark_locs_vis = cv::Mat_<float>(visi_count * 2, 1, 0.0f);
+		int k = 0;
+		for (int i = 0; i < visi_ind_2D.rows; ++i)
+		{
+			if (visi_ind_2D.at<int>(i) == 1)
+			{
+				landmark_locs_vis.at<float>(k) = landmark_locations.at<float>(i);
+				k++;
+			}
+		}
+
+		// The new number of points
+		n = visi_count;
+	}
+
+	// Compute the initial global parameters
+	float min_x, max_x, min_y, max_y;
+	ExtractBoundingBox(landmark_locs_vis, min_x, max_x, min_y, max_y);
+
+	float width = abs(min_x - max_x);
+	float height = abs(min_y - max_y);
+
+	cv::Rect_<float> model_bbox;
+	CalcBoundingBox(model_bbox, cv::Vec6f(1.0, 0.0, 0.0, 0.0, 0.0, 0.0), cv::Mat_<float>(this->NumberOfModes(), 1, 0.0));
+
+	cv::Rect_<float> bbox(min_x, min_y, width, height);
+
+	float scaling = ((width / model_bbox.width) + (height / model_bbox.height)) / 2.0f;
+        
+	cv::Vec3f rotation_init = rotation;
+	cv::Vec2f translation((min_x + max_x) / 2.0f, (min_y + max_y) / 2.0f);
+    
+	cv::Mat_<float> loc_params(this->NumberOfModes(),1, 0.0);
+	cv::Vec6f glob_params(scaling, rotation_init[0], rotation_init[1], rotation_init[2], translation[0], translation[1]);
+
+	FitParams(glob_params, loc_params, landmark_locs_vis, 1000, 3);
+
 	out_params_global = glob_params;
 	out_params_local = loc_params;
     	
@@ -704,6 +954,67 @@ void PDM::CalcParams(cv::Vec6f& out_params_global, cv::Mat_<float>& out_params_l
 
 }
 
+//===========================================================================
+// Starting from the parameters of a previous fit, the scale and translation are first aligned in closed form (matching the centroid and
+// spread of the projected shape to the landmarks), after which a couple of Gauss-Newton iterations are usually enough
+bool PDM::CalcParamsWarm(cv::Vec6f& params_global, cv::Mat_<float>& params_local, const cv::Mat_<float>& landmark_locations, int max_iterations)
+{
+	int n = this->NumberOfPoints();
+
+	if (params_global[0] <= 0 || params_local.rows != this->NumberOfModes() || landmark_locations.rows != 2 * n)
+	{
+		return false;
+	}
+
+	cv::Mat_<float> curr_shape;
+	CalcShape2D(curr_shape, params_local, params_global);
+
+	cv::Scalar curr_x, curr_y, target_x, target_y;
+	cv::Scalar curr_sd_x, curr_sd_y, target_sd_x, target_sd_y;
+	cv::meanStdDev(curr_shape.rowRange(0, n), curr_x, curr_sd_x);
+	cv::meanStdDev(curr_shape.rowRange(n, 2 * n), curr_y, curr_sd_y);
+	cv::meanStdDev(landmark_locations.rowRange(0, n), target_x, target_sd_x);
+	cv::meanStdDev(landmark_locations.rowRange(n, 2 * n), target_y, target_sd_y);
+
+	double curr_spread = curr_sd_x[0] * curr_sd_x[0] + curr_sd_y[0] * curr_sd_y[0];
+	double target_spread = target_sd_x[0] * target_sd_x[0] + target_sd_y[0] * target_sd_y[0];
+	if (curr_spread <= 0 || target_spread <= 0)
+	{
+		return false;
+	}
+
+	// Scaling the projected shape about its centroid and moving it onto the centroid of the landmarks
+	float scale_change = (float)std::sqrt(target_spread / curr_spread);
+	params_global[0] *= scale_change;
+	params_global[4] = (float)(target_x[0] + scale_change * (params_global[4] - curr_x[0]));
+	params_global[5] = (float)(target_y[0] + scale_change * (params_global[5] - curr_y[0]));
+
+	return FitParams(params_global, params_local, landmark_locations, max_iterations, 1);
+}
+
+//===========================================================================
+// Keeping the listed vertices, a PDM for fitting to a fixed subset of landmarks without subsampling the bases on every fit
+PDM PDM::Subsampled(const vector<int>& point_indices) const
+{
+	int n = this->NumberOfPoints();
+	int n_kept = (int)point_indices.size();
+
+	PDM subsampled;
+	subsampled.mean_shape.create(n_kept * 3, 1);
+	subsampled.princ_comp.create(n_kept * 3, princ_comp.cols);
+	subsampled.eigen_values = this->eigen_values;
+
+	for (int d = 0; d < 3; ++d)
+	{
+		for (int i = 0; i < n_kept; ++i)
+		{
+			this->mean_shape.row(point_indices[i] + d * n).copyTo(subsampled.mean_shape.row(i + d * n_kept));
+			this->princ_comp.row(point_indices[i] + d * n).copyTo(subsampled.princ_comp.row(i + d * n_kept));
+		}
+	}
+	return subsampled;
+}
+
 bool PDM::Read(string location)
 {
 
@@ -736,3 +1047,35 @@ bool PDM::Read(string location)
 
 	return true;
 }
+
+//===========================================================================
+bool PDM::Read(const ModelBundle& bundle, const string& prefix)
+{
+	cv::Mat mean_shape_b, princ_comp_b, eigen_values_b;
+
+	if (!bundle.GetMat(prefix + "mean_shape", mean_shape_b) || !bundle.GetMat(prefix + "princ_comp", princ_comp_b) || !bundle.GetMat(prefix + "eigen_values", eigen_values_b))
+	{
+		return false;
+	}
+
+	// The bundle already stores floats, so these are views without a copy
+	mean_shape = mean_shape_b;
+	princ_comp = princ_comp_b;
+	eigen_values = eigen_values_b;
+
+	return true;
+}
+
+void PDM::Write(ModelBundleWriter& bundle, const string& prefix) const
+{
+	bundle.AddMat(prefix + "mean_shape", mean_shape);
+	bundle.AddMat(prefix + "princ_comp", princ_comp);
+	bundle.AddMat(prefix + "eigen_values", eigen_values);
+}
+
+void PDM::ReportMemory(Utilities::MemoryReport& report, const string& component) const
+{
+	report.Add(component, mean_shape);
+	report.Add(component, princ_comp);
+	report.Add(component, eigen_values);
+}
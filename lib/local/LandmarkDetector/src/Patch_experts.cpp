@@ -37,6 +37,8 @@
 #include "Patch_experts.h"
 
 #include "RotationHelpers.h"
+#include "LandmarkShape.h"
+#include "MemoryReport.h"
 
 // TBB includes
 #include <tbb/tbb.h>
@@ -49,7 +51,11 @@
 	#define M_PI 3.14159265358979323846
 #endif
 
+#include <algorithm>
+
+#include "CNN_utils.h"
 #include "LandmarkDetectorUtils.h"
+#include "Tracing.h"
 
 using namespace LandmarkDetector;
 
@@ -61,115 +67,407 @@ Patch_experts::Patch_experts(const Patch_experts& other) : patch_scaling(other.p
 														mirror_inds(other.mirror_inds),mirror_views(other.mirror_views)
 {
 
-	// Make sure the matrices are allocated properly
-	this->sigma_components.resize(other.sigma_components.size());
-	for (size_t i = 0; i < other.sigma_components.size(); ++i)
+	// The sigma components and visibilities are read only, so they are shared between the copies (as cv::Mat is reference counted)
+	this->sigma_components = other.sigma_components;
+	this->visibilities = other.visibilities;
+
+	// The task lists only hold indices, so can be copied (the landmark workspaces are scratch space, so each copy gets its own)
+	this->response_tasks = other.response_tasks;
+	this->response_tasks_built = other.response_tasks_built;
+
+	// Views that have not been read in yet will be read by the copy from the same bundle when needed
+	this->bundle = other.bundle;
+	this->bundle_prefix = other.bundle_prefix;
+	this->views_loaded = other.views_loaded;
+
+	this->quantised = other.quantised;
+	this->coarse_to_fine_window = other.coarse_to_fine_window;
+	this->response_grain_size = other.response_grain_size;
+}
+
+// The list of the visible landmarks of a view that need to have patch responses computed, together with the expert evaluating them. For the
+// symmetric CEN views the landmarks without an expert are computed together with their mirrored pair (so they are skipped), for the other
+// views they are computed using the flipped expert of the mirrored view
+void Patch_experts::BuildResponseTasks(int scale, int view_id, vector<Response_task>& tasks) const
+{
+	tasks.clear();
+
+	const cv::Mat_<int>& visibility = visibilities[scale][view_id];
+	const int n = visibility.rows;
+	const bool use_cen = !cen_expert_intensity.empty();
+	const bool paired = MirroredPairs(view_id);
+
+	for (int i = 0; i < n; i++)
 	{
-		this->sigma_components[i].resize(other.sigma_components[i].size());
+		if (visibility.at<int>(i, 0) == 0)
+		{
+			continue;
+		}
+
+		Response_task task;
+		task.landmark = i;
+		task.mirror = -1;
+		task.expert_view = view_id;
+		task.expert_landmark = i;
+		task.flipped = false;
 
-		for (size_t j = 0; j < other.sigma_components[i].size(); ++j)
+		if (use_cen)
 		{
-			// Make sure the matrix is copied.
-			this->sigma_components[i][j] = other.sigma_components[i][j].clone();
+			const int mirror_id = mirror_inds.at<int>(i);
+			const bool has_expert = !cen_expert_intensity[scale][view_id][i].biases.empty();
+			const bool mirror_has_expert = !cen_expert_intensity[scale][view_id][mirror_id].biases.empty();
+			const bool mirror_visible = visibility.at<int>(mirror_id, 0) != 0;
+
+			if (!has_expert)
+			{
+				// If the patch expert does not have values, means it's a mirrored version, for the symmetric views it will be done with its pair
+				if (paired && mirror_has_expert && mirror_visible)
+				{
+					continue;
+				}
+
+				task.expert_view = view_id == 0 ? 0 : mirror_views.at<int>(view_id);
+				task.expert_landmark = mirror_id;
+				task.flipped = true;
+			}
+			else if (paired && mirror_id != i && !mirror_has_expert && mirror_visible)
+			{
+				task.mirror = mirror_id;
+			}
 		}
+
+		tasks.push_back(task);
+	}
+}
+
+const vector<Response_task>& Patch_experts::ResponseTasks(int scale, int view_id)
+{
+	if (response_tasks.size() != patch_scaling.size())
+	{
+		response_tasks.assign(patch_scaling.size(), vector<vector<Response_task> >());
+		response_tasks_built.assign(patch_scaling.size(), vector<bool>());
 	}
 
-	// Make sure the matrices are allocated properly
-	this->visibilities.resize(other.visibilities.size());
-	for (size_t i = 0; i < other.visibilities.size(); ++i)
+	if ((int)response_tasks[scale].size() != nViews(scale))
 	{
-		this->visibilities[i].resize(other.visibilities[i].size());
+		response_tasks[scale].assign(nViews(scale), vector<Response_task>());
+		response_tasks_built[scale].assign(nViews(scale), false);
+	}
 
-		for (size_t j = 0; j < other.visibilities[i].size(); ++j)
+	if (!response_tasks_built[scale][view_id])
+	{
+		BuildResponseTasks(scale, view_id, response_tasks[scale][view_id]);
+		response_tasks_built[scale][view_id] = true;
+	}
+
+	return response_tasks[scale][view_id];
+}
+
+int Patch_experts::SupportSize(int scale, int view_id) const
+{
+	int support = 0;
+	if (!cen_expert_intensity.empty())
+	{
+		for (size_t i = 0; i < cen_expert_intensity[scale][view_id].size(); ++i)
+		{
+			support = std::max(support, std::max(cen_expert_intensity[scale][view_id][i].width_support, cen_expert_intensity[scale][view_id][i].height_support));
+		}
+	}
+	else if (!ccnf_expert_intensity.empty())
+	{
+		for (size_t i = 0; i < ccnf_expert_intensity[scale][view_id].size(); ++i)
+		{
+			support = std::max(support, std::max(ccnf_expert_intensity[scale][view_id][i].width, ccnf_expert_intensity[scale][view_id][i].height));
+		}
+	}
+	else if (!svr_expert_intensity.empty())
+	{
+		for (size_t i = 0; i < svr_expert_intensity[scale][view_id].size(); ++i)
 		{
-			// Make sure the matrix is copied.
-			this->visibilities[i][j] = other.visibilities[i][j].clone();
+			support = std::max(support, std::max(svr_expert_intensity[scale][view_id][i].width, svr_expert_intensity[scale][view_id][i].height));
 		}
 	}
+	return support;
+}
+
+// The region of the image read when extracting the areas of interest of the given size around the landmarks, with a margin for the interpolation
+static cv::Rect AreaOfInterestRegion(const cv::Mat_<float>& landmark_locations, float a1, float b1, int area_of_interest_size)
+{
+	int n = landmark_locations.rows / 2;
+
+	double min_x, max_x, min_y, max_y;
+	cv::minMaxLoc(landmark_locations.rowRange(0, n), &min_x, &max_x);
+	cv::minMaxLoc(landmark_locations.rowRange(n, 2 * n), &min_y, &max_y);
+
+	// The furthest an area of interest (rotated and scaled by a1 and b1) reaches from its landmark
+	double margin = (std::abs(a1) + std::abs(b1)) * area_of_interest_size / 2.0 + 2.0;
 
-	preallocated_im2col.resize(other.preallocated_im2col.size());
+	int x = (int)std::floor(min_x - margin);
+	int y = (int)std::floor(min_y - margin);
+	return cv::Rect(x, y, (int)std::ceil(max_x + margin) - x + 1, (int)std::ceil(max_y + margin) - y + 1);
 }
 
-// Returns indices to landmarks that need to have patch responses computed (omits mirrored frontal landmarks for CEN as they will be computed together with their mirrored pair)
-std::vector<int> Patch_experts::Collect_visible_landmarks(vector<vector<cv::Mat_<int> > > visibilities, int scale, int view_id, int n)
+// Bilinear sampling of an area of interest, sim maps its pixels to the image (as cv::WARP_INVERSE_MAP would) and the pixels outside of the image
+// are taken as 0 (as a constant border would). Sampling from the 8 bit image directly avoids converting the frame, and away from the image
+// borders the inner loop is a plain (vectorisable) gather without any bounds checks
+template<typename T>
+static void SampleAreaOfInterest(const cv::Mat_<T>& image, const cv::Matx23f& sim, cv::Mat_<float>& area_of_interest)
 {
-	std::vector<int> vis_lmk;
-	for (int i = 0; i < n; i++)
+	const int rows = area_of_interest.rows;
+	const int cols = area_of_interest.cols;
+
+	// As the transform is affine, the patch is inside of the image if all of its corners are
+	bool inside = true;
+	for (int corner = 0; corner < 4; ++corner)
+	{
+		float x = (float)((corner & 1) * (cols - 1));
+		float y = (float)((corner >> 1) * (rows - 1));
+		float src_x = sim(0, 0) * x + sim(0, 1) * y + sim(0, 2);
+		float src_y = sim(1, 0) * x + sim(1, 1) * y + sim(1, 2);
+		if (!(src_x >= 0 && src_y >= 0 && src_x < image.cols - 1 && src_y < image.rows - 1))
+		{
+			inside = false;
+		}
+	}
+
+	for (int y = 0; y < rows; ++y)
 	{
-		if (visibilities[scale][view_id].rows == n)
+		float* out = area_of_interest.ptr<float>(y);
+		float src_x = sim(0, 1) * y + sim(0, 2);
+		float src_y = sim(1, 1) * y + sim(1, 2);
+
+		if (inside)
 		{
-			if (visibilities[scale][view_id].at<int>(i, 0) != 0)
+			for (int x = 0; x < cols; ++x)
 			{
-				// For CEN patch experts and frontal views skip the mirror indices
-				if (!cen_expert_intensity.empty())
-				{
+				int x0 = (int)src_x;
+				int y0 = (int)src_y;
+				float fx = src_x - x0;
+				float fy = src_y - y0;
 
-					// If frontal view we can do mirrored landmarks together
-					if (view_id == 0)
-					{
-						// If the patch expert does not have values, means it's a mirrored version and will be done in another part of a loop
-						if (!cen_expert_intensity[scale][view_id][i].biases.empty())
-						{
-							vis_lmk.push_back(i);
-						}
-					}
-					else
+				const T* row0 = image.template ptr<T>(y0) + x0;
+				const T* row1 = image.template ptr<T>(y0 + 1) + x0;
+
+				float top = row0[0] + fx * ((float)row0[1] - (float)row0[0]);
+				float bottom = row1[0] + fx * ((float)row1[1] - (float)row1[0]);
+				out[x] = top + fy * (bottom - top);
+
+				src_x += sim(0, 0);
+				src_y += sim(1, 0);
+			}
+		}
+		else
+		{
+			for (int x = 0; x < cols; ++x)
+			{
+				int x0 = (int)std::floor(src_x);
+				int y0 = (int)std::floor(src_y);
+				float fx = src_x - x0;
+				float fy = src_y - y0;
+
+				float p[2][2];
+				for (int dy = 0; dy < 2; ++dy)
+				{
+					int py = y0 + dy;
+					for (int dx = 0; dx < 2; ++dx)
 					{
-						vis_lmk.push_back(i);
+						int px = x0 + dx;
+						p[dy][dx] = (px >= 0 && py >= 0 && px < image.cols && py < image.rows) ? (float)image(py, px) : 0.0f;
 					}
 				}
-				else
-				{
-					vis_lmk.push_back(i);
-				}
+
+				float top = p[0][0] + fx * (p[0][1] - p[0][0]);
+				float bottom = p[1][0] + fx * (p[1][1] - p[1][0]);
+				out[x] = top + fy * (bottom - top);
+
+				src_x += sim(0, 0);
+				src_y += sim(1, 0);
 			}
 		}
 	}
-	return vis_lmk;
+}
 
+// Sampling from the 8 bit image if there is one, otherwise from the floating point one
+static void SampleAreaOfInterest(const cv::Mat_<uchar>& image, const cv::Mat_<float>& image_float, const cv::Matx23f& sim, cv::Mat_<float>& area_of_interest)
+{
+	if (!image.empty())
+	{
+		SampleAreaOfInterest<uchar>(image, sim, area_of_interest);
+	}
+	else
+	{
+		SampleAreaOfInterest<float>(image_float, sim, area_of_interest);
+	}
 }
 
-// Returns the patch expert responses given a grayscale image.
-// Additionally returns the transform from the image coordinates to the response coordinates (and vice versa).
-// The computation also requires the current landmark locations to compute response around, the PDM corresponding to the desired model, and the parameters describing its instance
-// Also need to provide the size of the area of interest and the desired scale of analysis
-void Patch_experts::Response(vector<cv::Mat_<float> >& patch_expert_responses, cv::Matx22f& sim_ref_to_img, cv::Matx22f& sim_img_to_ref, const cv::Mat_<float>& grayscale_image,
-	const PDM& pdm, const cv::Vec6f& params_global, const cv::Mat_<float>& params_local, int window_size, int scale)
+// The per call state shared by the evaluations of the patch experts of all of the landmarks
+struct Response_frame
 {
+	const cv::Mat_<uchar>* grayscale_image;
+	const cv::Mat_<float>* grayscale_image_float;
+	const cv::Mat_<float>* landmark_locations;
 
-	int view_id = GetViewIdx(params_global, scale);
+	// The rotation and scale from the reference frame to the image
+	float a1;
+	float b1;
 
-	int n = pdm.NumberOfPoints();
+	int window_size;
+	int scale;
+	int view_id;
+
+	const cv::Mat_<float>* interp_mat;
+	bool coarse_to_fine;
+
+	// The scratch memory of the landmarks
+	vector<Landmark_workspace>* workspaces;
+};
+
+enum Expert_type { EXPERT_SVR, EXPERT_CCNF, EXPERT_CEN };
+
+// A prepared response computation of a model: the frame with the storage it points to, the landmarks to compute and the experts to use
+struct LandmarkDetector::Response_call
+{
+	Response_frame frame;
 
-	// Compute the current landmark locations (around which responses will be computed)
 	cv::Mat_<float> landmark_locations;
+	cv::Mat_<float> grayscale_image_float;
+	cv::Mat_<float> interp_mat;
 
-	pdm.CalcShape2D(landmark_locations, params_local, params_global);
+	// Either the kept task list of the view or the masked one
+	const vector<Response_task>* tasks;
+	vector<Response_task> masked_tasks;
 
-	cv::Mat_<float> reference_shape;
+	int expert_type;
+};
 
-	// Initialise the reference shape on which we'll be warping
-	cv::Vec6f global_ref(patch_scaling[scale], 0, 0, 0, 0, 0);
+// Sampling the area of interest of a landmark (scaled and rotated to the reference frame), every pixel is written so the memory can be reused
+static void SampleLandmarkArea(const Response_frame& frame, int landmark, int width, int height, cv::Mat_<float>& area_of_interest)
+{
+	const cv::Mat_<float>& landmark_locations = *frame.landmark_locations;
+	const int n = landmark_locations.rows / 2;
+	const float a1 = frame.a1;
+	const float b1 = frame.b1;
 
-	// Compute the reference shape
-	pdm.CalcShape2D(reference_shape, params_local, global_ref);
+	cv::Matx23f sim(a1, -b1, landmark_locations.at<float>(landmark, 0) - a1 * (width - 1.0f) / 2.0f + b1 * (width - 1.0f) / 2.0f, b1, a1, landmark_locations.at<float>(landmark + n, 0) - a1 * (width - 1.0f) / 2.0f - b1 * (width - 1.0f) / 2.0f);
 
-	// similarity and inverse similarity transform to and from image and reference shape
-	cv::Mat_<float> reference_shape_2D = (reference_shape.reshape(1, 2).t());
-	cv::Mat_<float> image_shape_2D = landmark_locations.reshape(1, 2).t();
+	area_of_interest.create(height, width);
+	SampleAreaOfInterest(*frame.grayscale_image, *frame.grayscale_image_float, sim, area_of_interest);
+}
 
-	sim_img_to_ref = Utilities::AlignShapesWithScale(image_shape_2D, reference_shape_2D);
-	sim_ref_to_img = sim_img_to_ref.inv(cv::DECOMP_LU);
-	
-	float a1 = sim_ref_to_img(0, 0);
-	float b1 = -sim_ref_to_img(0, 1);
+// The response computation of a landmark of the task list, the expert type is fixed at compile time so that the per landmark work does not
+// branch on it, all of the pairing of mirrored experts is resolved when the task list is built
+template<int EXPERT_TYPE>
+static void EvaluateResponseTask(Patch_experts& experts, const Response_task& task, const Response_frame& frame, vector<cv::Mat_<float> >& patch_expert_responses)
+{
+	const int window_size = frame.window_size;
+	const int scale = frame.scale;
+	const int view_id = frame.view_id;
+
+	const int ind = task.landmark;
+	Landmark_workspace& workspace = (*frame.workspaces)[ind];
+
+	if (EXPERT_TYPE == EXPERT_CEN)
+	{
+		CEN_patch_expert& expert = experts.cen_expert_intensity[scale][task.expert_view][task.expert_landmark];
+
+		// Work out how big the area of interest has to be to get a response of window size
+		const int width = window_size + expert.width_support - 1;
+		const int height = window_size + expert.height_support - 1;
+
+		cv::Mat_<float> empty;
+		cv::Mat_<float>& area_of_interest = workspace.area_of_interest;
+		SampleLandmarkArea(frame, ind, width, height, area_of_interest);
+
+		// Mirrored landmarks of the symmetric views are done together, all of the others by the expert itself or (flipped) by the one of the mirrored view
+		const cv::Mat_<float>* area_left = &area_of_interest;
+		const cv::Mat_<float>* area_right = &empty;
+		cv::Mat_<float>* response_left = &patch_expert_responses[ind];
+		cv::Mat_<float>* response_right = &empty;
 
-	bool use_ccnf = !this->ccnf_expert_intensity.empty();
-	bool use_cen = !this->cen_expert_intensity.empty();
+		if (task.mirror >= 0)
+		{
+			SampleLandmarkArea(frame, task.mirror, width, height, workspace.area_of_interest_mirror);
+			area_right = &workspace.area_of_interest_mirror;
+			response_right = &patch_expert_responses[task.mirror];
+		}
+		else if (task.flipped)
+		{
+			std::swap(area_left, area_right);
+			std::swap(response_left, response_right);
+		}
+
+		if (frame.coarse_to_fine)
+		{
+			expert.ResponseCoarseToFine(*area_left, *area_right, *response_left, *response_right, workspace.cen);
+		}
+		else
+		{
+			expert.ResponseSparse(*area_left, *area_right, *response_left, *response_right, *frame.interp_mat, workspace.cen);
+
+			// A slower, but slightly more accurate version
+			//expert.Response(area_of_interest, patch_expert_responses[ind]);
+		}
+	}
+	else if (EXPERT_TYPE == EXPERT_CCNF)
+	{
+		CCNF_patch_expert& expert = experts.ccnf_expert_intensity[scale][view_id][ind];
+
+		SampleLandmarkArea(frame, ind, window_size + expert.width - 1, window_size + expert.height - 1, workspace.area_of_interest);
+
+		// get the correct size response window
+		patch_expert_responses[ind].create(window_size, window_size);
+
+		// The im2col matrix is kept for every window size
+		if ((int)workspace.ccnf_im2col.size() <= window_size)
+		{
+			workspace.ccnf_im2col.resize(window_size + 1);
+		}
+
+		expert.ResponseOpenBlas(workspace.area_of_interest, patch_expert_responses[ind], workspace.ccnf_im2col[window_size]);
+
+		// Below is an alternative way to compute the same, but that uses FFT instead of OpenBLAS
+		// expert.Response(workspace.area_of_interest, patch_expert_responses[ind]);
+	}
+	else
+	{
+		Multi_SVR_patch_expert& expert = experts.svr_expert_intensity[scale][view_id][ind];
+
+		SampleLandmarkArea(frame, ind, window_size + expert.width - 1, window_size + expert.height - 1, workspace.area_of_interest);
+
+		// get the correct size response window
+		patch_expert_responses[ind].create(window_size, window_size);
+
+		expert.Response(workspace.area_of_interest, patch_expert_responses[ind]);
+	}
+}
+
+// The response computation of every landmark of the task list
+template<int EXPERT_TYPE>
+static void EvaluateResponseTasks(Patch_experts& experts, const vector<Response_task>& tasks, const Response_frame& frame, vector<cv::Mat_<float> >& patch_expert_responses)
+{
+	tbb::parallel_for(tbb::blocked_range<int>(0, (int)tasks.size(), experts.GetResponseGrainSize()), [&](const tbb::blocked_range<int>& range) {
+	for (int i = range.begin(); i != range.end(); ++i)
+	{
+		EvaluateResponseTask<EXPERT_TYPE>(experts, tasks[i], frame, patch_expert_responses);
+	}
+	});
+}
+
+void Patch_experts::Response(vector<cv::Mat_<float> >& patch_expert_responses, cv::Matx22f& sim_ref_to_img, cv::Matx22f& sim_img_to_ref, const cv::Mat_<float>& grayscale_image,
+	const PDM& pdm, const cv::Vec6f& params_global, const cv::Mat_<float>& params_local, int window_size, int scale)
+{
+	ImageContext image(grayscale_image);
+	Response(patch_expert_responses, sim_ref_to_img, sim_img_to_ref, image, pdm, params_global, params_local, window_size, scale);
+}
 
+// The per window size precomputation of the patch experts of a view (the Sigmas of CCNF and the interpolation matrix of CEN patch experts)
+cv::Mat_<float> Patch_experts::PrecomputeWindowSize(int window_size, int scale, int view_id)
+{
 	// If using CCNF patch experts might need to precalculate Sigmas
-	if (use_ccnf)
+	if (!this->ccnf_expert_intensity.empty())
 	{
+		int n = (int)visibilities[scale][view_id].rows;
+
 		vector<cv::Mat_<float> > sigma_components;
 
 		// Retrieve the correct sigma component size
@@ -197,149 +495,508 @@ void Patch_experts::Response(vector<cv::Mat_<float> >& patch_expert_responses, c
 
 	}
 
-	// If using CEN precalculate interpolation matrix
+	// If using CEN precalculate interpolation matrix (only once for every window size)
 	cv::Mat_<float> interp_mat;
-	if (use_cen)
+	if (!this->cen_expert_intensity.empty())
 	{
-		// Assuming the same size for all experts
-		int support_region = 11;
-		int area_of_interest_width = window_size + support_region - 1;
-		int area_of_interest_height = window_size + support_region - 1;
-		int resp_size = area_of_interest_height - support_region + 1;
-		interpolationMatrix(interp_mat, resp_size, resp_size, area_of_interest_width, area_of_interest_height);
+		// Only looked up once computed, so that responses can be computed concurrently after the warm up
+		map<int, cv::Mat_<float> >::const_iterator it = interpolation_matrices.find(window_size);
+		if (it != interpolation_matrices.end())
+		{
+			interp_mat = it->second;
+		}
+		else
+		{
+			// Assuming the same size for all experts
+			int support_region = 11;
+			int area_of_interest_width = window_size + support_region - 1;
+			int area_of_interest_height = window_size + support_region - 1;
+			int resp_size = area_of_interest_height - support_region + 1;
+			interpolationMatrix(interp_mat, resp_size, resp_size, area_of_interest_width, area_of_interest_height);
+			interpolation_matrices[window_size] = interp_mat;
+		}
 	}
 
-	// We do not want to create threads for invisible landmarks, so construct an index of visible ones
-	std::vector<int> vis_lmk = Collect_visible_landmarks(visibilities, scale, view_id, n);
+	return interp_mat;
+}
 
-	// calculate the patch responses for every landmark, Actual work happens here. If openMP is turned on it is possible to do this in parallel,
-	// this might work well on some machines, while potentially have an adverse effect on others
-	//#ifdef _OPENMP
-	//#pragma omp parallel for
-	//#endif
-	tbb::parallel_for(0, (int)vis_lmk.size(), [&](int i) {
-	//for (int i = 0; i < vis_lmk.size(); i++)
+void Patch_experts::ReportMemory(Utilities::MemoryReport& report, const string& component) const
+{
+	for (size_t scale = 0; scale < patch_scaling.size(); ++scale)
 	{
+		string scale_component = "/scale_" + to_string(scale);
+		for (size_t view = 0; view < centers[scale].size(); ++view)
+		{
+			string view_component = scale_component + "/view_" + to_string(view);
 
-		// Work out how big the area of interest has to be to get a response of window size
-		int area_of_interest_width;
-		int area_of_interest_height;
-		int ind = vis_lmk.at(i);
+			if (scale < cen_expert_intensity.size() && view < cen_expert_intensity[scale].size())
+			{
+				for (const CEN_patch_expert& expert : cen_expert_intensity[scale][view])
+				{
+					report.Add(component + "/cen" + view_component, expert.weights);
+					report.Add(component + "/cen" + view_component, expert.biases);
+					report.Add(component + "/cen" + view_component, expert.weights_quantised);
+					report.Add(component + "/cen" + view_component, expert.weights_half);
+					for (const PackedMatrix& packed : expert.weights_packed)
+					{
+						report.Add(component + "/cen" + view_component, packed.Storage());
+					}
+					report.Add(component + "/cen" + view_component, expert.weight_scales);
+				}
+			}
 
-		if (use_cen)
+			if (scale < ccnf_expert_intensity.size() && view < ccnf_expert_intensity[scale].size())
+			{
+				for (const CCNF_patch_expert& expert : ccnf_expert_intensity[scale][view])
+				{
+					for (const CCNF_neuron& neuron : expert.neurons)
+					{
+						report.Add(component + "/ccnf" + view_component, neuron.weights);
+						report.Add(component + "/ccnf" + view_component + "/dft", neuron.weights_dfts);
+					}
+					report.Add(component + "/ccnf" + view_component, expert.weight_matrix);
+					report.Add(component + "/ccnf" + view_component + "/sigmas", expert.Sigmas);
+				}
+			}
+
+			if (scale < svr_expert_intensity.size() && view < svr_expert_intensity[scale].size())
+			{
+				for (const Multi_SVR_patch_expert& expert : svr_expert_intensity[scale][view])
+				{
+					for (const SVR_patch_expert& svr_expert : expert.svr_patch_experts)
+					{
+						report.Add(component + "/svr" + view_component, svr_expert.weights);
+						report.Add(component + "/svr" + view_component + "/dft", svr_expert.weights_dfts);
+					}
+				}
+			}
+
+			if (scale < visibilities.size() && view < visibilities[scale].size())
+			{
+				report.Add(component + "/visibilities", visibilities[scale][view]);
+			}
+		}
+	}
+	report.Add(component + "/ccnf/sigma_components", sigma_components);
+
+	for (const Landmark_workspace& workspace : landmark_workspaces)
+	{
+		report.Add(component + "/workspaces", workspace.area_of_interest);
+		report.Add(component + "/workspaces", workspace.area_of_interest_mirror);
+		report.Add(component + "/workspaces", workspace.ccnf_im2col);
+		report.Add(component + "/workspaces", workspace.cen.im2col);
+		report.Add(component + "/workspaces", workspace.cen.area_of_interest_flipped);
+		report.Add(component + "/workspaces", workspace.cen.layer_outputs[0]);
+		report.Add(component + "/workspaces", workspace.cen.layer_outputs[1]);
+		report.AddVector(component + "/workspaces", workspace.cen.input_quantised);
+		report.Add(component + "/workspaces", workspace.cen.output_transposed);
+		report.Add(component + "/workspaces", workspace.cen.responses_mapped);
+	}
+	report.Add(component + "/precomputed", interpolation_matrices);
+	for (size_t scale = 0; scale < response_tasks.size(); ++scale)
+	{
+		for (size_t view = 0; view < response_tasks[scale].size(); ++view)
 		{
-			area_of_interest_width = window_size + cen_expert_intensity[scale][view_id][ind].width_support - 1;
-			area_of_interest_height = window_size + cen_expert_intensity[scale][view_id][ind].height_support - 1;
+			report.AddVector(component + "/precomputed", response_tasks[scale][view]);
 		}
-		else if (use_ccnf)
+	}
+}
+
+void Patch_experts::WarmUp(const vector<int>& window_sizes)
+{
+	for (size_t scale = 0; scale < window_sizes.size() && scale < patch_scaling.size(); ++scale)
+	{
+		if (window_sizes[scale] <= 0)
+			continue;
+
+		for (int view = 0; view < nViews(scale); ++view)
 		{
-			area_of_interest_width = window_size + ccnf_expert_intensity[scale][view_id][ind].width - 1;
-			area_of_interest_height = window_size + ccnf_expert_intensity[scale][view_id][ind].height - 1;
+			LoadView((int)scale, view);
+			PrecomputeWindowSize(window_sizes[scale], (int)scale, view);
+			ResponseTasks((int)scale, view);
+		}
+	}
+}
+
+// Returns the patch expert responses given a grayscale image.
+// Additionally returns the transform from the image coordinates to the response coordinates (and vice versa).
+// The computation also requires the current landmark locations to compute response around, the PDM corresponding to the desired model, and the parameters describing its instance
+// Also need to provide the size of the area of interest and the desired scale of analysis
+void Patch_experts::Response(vector<cv::Mat_<float> >& patch_expert_responses, cv::Matx22f& sim_ref_to_img, cv::Matx22f& sim_img_to_ref, ImageContext& image,
+	const PDM& pdm, const cv::Vec6f& params_global, const cv::Mat_<float>& params_local, int window_size, int scale, const cv::Mat_<int>& landmark_mask,
+	vector<Landmark_workspace>* workspaces)
+{
+	TRACE_SCOPE("Patch_experts::Response");
+
+	Response_call call;
+	PrepareResponse(call, sim_ref_to_img, sim_img_to_ref, image, pdm, params_global, params_local, window_size, scale, landmark_mask, workspaces);
+
+	// Get intensity response either from the SVR, CCNF, or CEN patch experts (prefer CEN as they are the most accurate so far)
+	if (call.expert_type == EXPERT_CEN)
+	{
+		EvaluateResponseTasks<EXPERT_CEN>(*this, *call.tasks, call.frame, patch_expert_responses);
+	}
+	else if (call.expert_type == EXPERT_CCNF)
+	{
+		EvaluateResponseTasks<EXPERT_CCNF>(*this, *call.tasks, call.frame, patch_expert_responses);
+	}
+	else
+	{
+		EvaluateResponseTasks<EXPERT_SVR>(*this, *call.tasks, call.frame, patch_expert_responses);
+	}
+}
+
+// The responses of several different models in one parallel loop over the landmarks of all of them, each landmark is evaluated exactly as by
+// Response, so the results are the same as those of separate calls
+void Patch_experts::ResponseJoint(vector<Patch_experts*>& experts, vector<vector<cv::Mat_<float> >*>& patch_expert_responses, vector<cv::Matx22f>& sim_ref_to_img,
+	vector<cv::Matx22f>& sim_img_to_ref, ImageContext& image, const vector<const PDM*>& pdms, const vector<cv::Vec6f>& params_global,
+	const vector<cv::Mat_<float> >& params_local, const vector<int>& window_sizes, int scale, const vector<cv::Mat_<int> >& landmark_masks)
+{
+	TRACE_SCOPE("Patch_experts::ResponseJoint");
+
+	const int num_models = (int)experts.size();
+	sim_ref_to_img.resize(num_models);
+	sim_img_to_ref.resize(num_models);
+
+	// The calls are not moved once prepared, as their frames point into them
+	vector<Response_call> calls(num_models);
+	vector<pair<int, int> > items;
+	for (int m = 0; m < num_models; ++m)
+	{
+		experts[m]->PrepareResponse(calls[m], sim_ref_to_img[m], sim_img_to_ref[m], image, *pdms[m], params_global[m], params_local[m], window_sizes[m], scale,
+			m < (int)landmark_masks.size() ? landmark_masks[m] : cv::Mat_<int>());
+
+		for (int t = 0; t < (int)calls[m].tasks->size(); ++t)
+		{
+			items.push_back(pair<int, int>(m, t));
+		}
+	}
+
+	if (items.empty())
+	{
+		return;
+	}
+
+	tbb::parallel_for(tbb::blocked_range<int>(0, (int)items.size(), experts[0]->GetResponseGrainSize()), [&](const tbb::blocked_range<int>& range) {
+	for (int i = range.begin(); i != range.end(); ++i)
+	{
+		const int m = items[i].first;
+		const Response_call& call = calls[m];
+		const Response_task& task = (*call.tasks)[items[i].second];
+
+		if (call.expert_type == EXPERT_CEN)
+		{
+			EvaluateResponseTask<EXPERT_CEN>(*experts[m], task, call.frame, *patch_expert_responses[m]);
+		}
+		else if (call.expert_type == EXPERT_CCNF)
+		{
+			EvaluateResponseTask<EXPERT_CCNF>(*experts[m], task, call.frame, *patch_expert_responses[m]);
 		}
 		else
 		{
-			area_of_interest_width = window_size + svr_expert_intensity[scale][view_id][ind].width - 1;
-			area_of_interest_height = window_size + svr_expert_intensity[scale][view_id][ind].height - 1;
+			EvaluateResponseTask<EXPERT_SVR>(*experts[m], task, call.frame, *patch_expert_responses[m]);
 		}
+	}
+	});
+}
+
+// The similarity transform from the image shape to the reference shape (both column vectors), on fixed size copies of them unless the model has
+// more landmarks than they hold
+static cv::Matx22f AlignToReference(const cv::Mat_<float>& image_shape, const cv::Mat_<float>& reference_shape)
+{
+	LandmarkShape2D image_landmarks, reference_landmarks;
+	if (image_landmarks.Set(image_shape) && reference_landmarks.Set(reference_shape))
+	{
+		return AlignShapesWithScale(image_landmarks, reference_landmarks);
+	}
 
-		// scale and rotate to mean shape to reference frame
-		cv::Mat sim = (cv::Mat_<float>(2, 3) << a1, -b1, landmark_locations.at<float>(ind, 0) - a1 * (area_of_interest_width - 1.0f) / 2.0f + b1 * (area_of_interest_width - 1.0f) / 2.0f, b1, a1, landmark_locations.at<float>(ind + n, 0) - a1 * (area_of_interest_width - 1.0f) / 2.0f - b1 * (area_of_interest_width - 1.0f) / 2.0f);
+	cv::Mat_<float> reference_shape_2D = (reference_shape.reshape(1, 2).t());
+	cv::Mat_<float> image_shape_2D = image_shape.reshape(1, 2).t();
+	return Utilities::AlignShapesWithScale(image_shape_2D, reference_shape_2D);
+}
 
-		// Extract the region of interest around the current landmark location
-		cv::Mat_<float> area_of_interest(area_of_interest_height, area_of_interest_width, 0.0f);
+void Patch_experts::PrepareResponse(Response_call& call, cv::Matx22f& sim_ref_to_img, cv::Matx22f& sim_img_to_ref, ImageContext& image,
+	const PDM& pdm, const cv::Vec6f& params_global, const cv::Mat_<float>& params_local, int window_size, int scale, const cv::Mat_<int>& landmark_mask,
+	vector<Landmark_workspace>* workspaces)
+{
+	int view_id = GetViewIdx(params_global, scale);
 
-		cv::warpAffine(grayscale_image, area_of_interest, sim, area_of_interest.size(), cv::WARP_INVERSE_MAP + cv::INTER_LINEAR);
+	LoadView(scale, view_id);
 
-		// Get intensity response either from the SVR, CCNF, or CEN patch experts (prefer CEN as they are the most accurate so far)
-		if (!cen_expert_intensity.empty())
-		{
+	int n = pdm.NumberOfPoints();
 
-			int im2col_size = (area_of_interest_width * area_of_interest_height - 1) / 2;
+	// Compute the current landmark locations (around which responses will be computed)
+	cv::Mat_<float>& landmark_locations = call.landmark_locations;
+
+	pdm.CalcShape2D(landmark_locations, params_local, params_global);
+
+	// The reference shape on which we'll be warping, computed straight into a fixed size shape if it fits
+	LandmarkShape2D reference_landmarks;
+	cv::Mat_<float> reference_shape = reference_landmarks.Resize(n) ? reference_landmarks.Column() : cv::Mat_<float>();
+
+	// Initialise the reference shape on which we'll be warping
+	cv::Vec6f global_ref(patch_scaling[scale], 0, 0, 0, 0, 0);
+
+	// Compute the reference shape
+	pdm.CalcShape2D(reference_shape, params_local, global_ref);
+
+	// similarity and inverse similarity transform to and from image and reference shape
+	sim_img_to_ref = AlignToReference(landmark_locations, reference_shape);
+	sim_ref_to_img = sim_img_to_ref.inv(cv::DECOMP_LU);
+	
+	float a1 = sim_ref_to_img(0, 0);
+	float b1 = -sim_ref_to_img(0, 1);
+
+	// The areas of interest are sampled straight from the 8 bit image if there is one, otherwise from the floating point one (of which only the
+	// part the areas of interest come from has to be converted)
+	const cv::Mat_<uchar>& grayscale_image = image.Gray();
+	if (grayscale_image.empty())
+	{
+		call.grayscale_image_float = image.Float(AreaOfInterestRegion(landmark_locations, a1, b1, window_size + SupportSize(scale, view_id) - 1));
+	}
 
-			cv::Mat_<float> prealloc_mat = preallocated_im2col[ind][im2col_size];
+	// The Sigmas (CCNF) or the interpolation matrix (CEN) for the window size, computed on first use
+	call.interp_mat = PrecomputeWindowSize(window_size, scale, view_id);
 
-			// If frontal view we can do mirrored landmarks together
-			if (view_id == 0)
+	// The scratch memory of every landmark, kept between the calls
+	if (workspaces == 0)
+	{
+		workspaces = &landmark_workspaces;
+	}
+	if ((int)workspaces->size() != n)
+	{
+		workspaces->resize(n);
+	}
+
+	// The landmarks to compute the responses of (none if the visibilities do not match the model)
+	call.tasks = visibilities[scale][view_id].rows == n ? &ResponseTasks(scale, view_id) : &call.masked_tasks;
+
+	// Only the masked landmarks, the experts of the symmetric CEN views also compute the mirrored landmark so those are kept if either of the pair is masked
+	if (!landmark_mask.empty() && !call.tasks->empty())
+	{
+		for (size_t i = 0; i < call.tasks->size(); ++i)
+		{
+			const Response_task& task = (*call.tasks)[i];
+			if (landmark_mask.at<int>(task.landmark) != 0 || (task.mirror >= 0 && landmark_mask.at<int>(task.mirror) != 0))
 			{
-				// If the patch expert does not have values, means it's a mirrored version and will be done in another part of a loop
-				if (!cen_expert_intensity[scale][view_id][ind].biases.empty())
-				{
-					// No mirrored expert, so do normally
-					int mirror_id = mirror_inds.at<int>(ind);
-					if (mirror_id == ind)
-					{
-						cv::Mat_<float> empty(0,0,0.0f);
-						cen_expert_intensity[scale][view_id][ind].ResponseSparse(area_of_interest, empty, patch_expert_responses[ind], empty, interp_mat, prealloc_mat, empty);
-					}
-					else
-					{
+				call.masked_tasks.push_back(task);
+			}
+		}
+		call.tasks = &call.masked_tasks;
+	}
+
+	Response_frame& frame = call.frame;
+	frame.grayscale_image = &grayscale_image;
+	frame.grayscale_image_float = &call.grayscale_image_float;
+	frame.landmark_locations = &landmark_locations;
+	frame.a1 = a1;
+	frame.b1 = b1;
+	frame.window_size = window_size;
+	frame.scale = scale;
+	frame.view_id = view_id;
+	frame.interp_mat = &call.interp_mat;
+	frame.workspaces = workspaces;
+
+	// Large CEN windows can be evaluated coarse to fine instead of on the checkerboard interpolated by the matrix
+	frame.coarse_to_fine = coarse_to_fine_window > 0 && window_size >= coarse_to_fine_window;
+
+	// Get intensity response either from the SVR, CCNF, or CEN patch experts (prefer CEN as they are the most accurate so far)
+	call.expert_type = !cen_expert_intensity.empty() ? EXPERT_CEN : (!ccnf_expert_intensity.empty() ? EXPERT_CCNF : EXPERT_SVR);
+}
+
+// Returns the patch expert responses for a number of model instances (faces) in the same image.
+// The same landmark across the instances is evaluated by the same CEN expert, hence all of the areas of interest that share an expert are stacked and
+// evaluated using a single matrix multiplication per layer, instead of one small multiplication per landmark per face.
+// For SVR and CCNF patch experts falls back to computing the responses for each instance separately
+void Patch_experts::ResponseBatch(vector<vector<cv::Mat_<float> > >& patch_expert_responses, vector<cv::Matx22f>& sim_ref_to_img, vector<cv::Matx22f>& sim_img_to_ref,
+	ImageContext& image, const PDM& pdm, const vector<cv::Vec6f>& params_global, const vector<cv::Mat_<float> >& params_local, int window_size, int scale)
+{
+	int num_instances = (int)params_global.size();
+
+	patch_expert_responses.resize(num_instances);
+	sim_ref_to_img.resize(num_instances);
+	sim_img_to_ref.resize(num_instances);
+
+	int n = pdm.NumberOfPoints();
+
+	if (this->cen_expert_intensity.empty())
+	{
+		for (int inst = 0; inst < num_instances; ++inst)
+		{
+			patch_expert_responses[inst].resize(n);
+			Response(patch_expert_responses[inst], sim_ref_to_img[inst], sim_img_to_ref[inst], image, pdm, params_global[inst], params_local[inst], window_size, scale);
+		}
+		return;
+	}
+
+	// A single area of interest to be evaluated by a patch expert
+	struct BatchItem
+	{
+		int instance;
+		int landmark;
+		bool flipped;
+	};
+
+	vector<cv::Mat_<float> > landmark_locations(num_instances);
+	vector<cv::Vec2f> sim_coeffs(num_instances);
+
+	// Group the areas of interest by the patch expert (view and landmark) that will evaluate them
+	map<pair<int, int>, vector<BatchItem> > expert_groups;
+
+	// The image and the reference shapes of all of the instances, from their 3D shapes evaluated at once
+	cv::Mat_<float> all_local(num_instances, pdm.NumberOfModes(), 0.0f);
+	for (int inst = 0; inst < num_instances; ++inst)
+	{
+		if (params_local[inst].rows == all_local.cols)
+		{
+			cv::Mat(params_local[inst].t()).copyTo(all_local.row(inst));
+		}
+	}
+	cv::Mat_<float> all_shapes_3D, all_image_shapes, all_reference_shapes;
+	pdm.CalcShapes3D(all_shapes_3D, all_local);
+	pdm.CalcShapes2D(all_image_shapes, all_shapes_3D, params_global);
+	pdm.CalcShapes2D(all_reference_shapes, all_shapes_3D, vector<cv::Vec6f>(num_instances, cv::Vec6f(patch_scaling[scale], 0, 0, 0, 0, 0)));
+
+	for (int inst = 0; inst < num_instances; ++inst)
+	{
+		patch_expert_responses[inst].resize(n);
 
-						// Grab mirrored area of interest
+		int view_id = GetViewIdx(params_global[inst], scale);
 
-						// scale and rotate to mean shape to reference frame
-						cv::Mat sim_r = (cv::Mat_<float>(2, 3) << a1, -b1, landmark_locations.at<float>(mirror_id, 0) - a1 * (area_of_interest_width - 1.0f) / 2.0f + b1 * (area_of_interest_width - 1.0f) / 2.0f, b1, a1, landmark_locations.at<float>(mirror_id + n, 0) - a1 * (area_of_interest_width - 1.0f) / 2.0f - b1 * (area_of_interest_width - 1.0f) / 2.0f);
+		// The experts need to be read in before the parallel section below
+		LoadView(scale, view_id);
 
-						// Extract the region of interest around the current landmark location
-						cv::Mat_<float> area_of_interest_r(area_of_interest_height, area_of_interest_width, 0.0f);
+		landmark_locations[inst] = all_image_shapes.row(inst).t();
+		// The row of a continuous matrix read as a column without copying
+		cv::Mat_<float> reference_shape(all_reference_shapes.cols, 1, all_reference_shapes.ptr<float>(inst));
 
-						cv::warpAffine(grayscale_image, area_of_interest_r, sim_r, area_of_interest_r.size(), cv::WARP_INVERSE_MAP + cv::INTER_LINEAR);
+		// similarity and inverse similarity transform to and from image and reference shape
+		sim_img_to_ref[inst] = AlignToReference(landmark_locations[inst], reference_shape);
+		sim_ref_to_img[inst] = sim_img_to_ref[inst].inv(cv::DECOMP_LU);
 
-						cv::Mat_<float> prealloc_mat_right = preallocated_im2col[mirror_id][im2col_size];
+		sim_coeffs[inst] = cv::Vec2f(sim_ref_to_img[inst](0, 0), -sim_ref_to_img[inst](0, 1));
 
-						cen_expert_intensity[scale][view_id][ind].ResponseSparse(area_of_interest, area_of_interest_r, patch_expert_responses[ind], patch_expert_responses[mirror_id], interp_mat, prealloc_mat, prealloc_mat_right);
+		// Without an 8 bit image converting the part of the floating point one the areas of interest of this instance come from
+		if (image.Gray().empty())
+		{
+			image.Float(AreaOfInterestRegion(landmark_locations[inst], sim_coeffs[inst][0], sim_coeffs[inst][1], window_size + SupportSize(scale, view_id) - 1));
+		}
+
+		for (int ind = 0; ind < n; ++ind)
+		{
+			if (visibilities[scale][view_id].rows != n || visibilities[scale][view_id].at<int>(ind, 0) == 0)
+			{
+				continue;
+			}
 
-						preallocated_im2col[mirror_id][im2col_size] = prealloc_mat_right;
+			BatchItem item;
+			item.instance = inst;
+			item.landmark = ind;
 
-					}
-				}
+			// Landmarks without an expert are evaluated using a flipped version of their mirrored pair
+			if (!cen_expert_intensity[scale][view_id][ind].biases.empty())
+			{
+				item.flipped = false;
+				expert_groups[make_pair(view_id, ind)].push_back(item);
 			}
 			else
 			{
-				// For space and memory saving use a mirrored patch expert
-				if (!cen_expert_intensity[scale][view_id][ind].biases.empty())
-				{
-					cv::Mat_<float> empty(0, 0, 0.0f);
-					cen_expert_intensity[scale][view_id][ind].ResponseSparse(area_of_interest, empty, patch_expert_responses[ind], empty, interp_mat, prealloc_mat, empty);
-					
-					// A slower, but slightly more accurate version
-					//cen_expert_intensity[scale][view_id][ind].Response(area_of_interest, patch_expert_responses[ind]);
-				}
-				else
-				{
-					cv::Mat_<float> empty(0, 0, 0.0f);
-					cen_expert_intensity[scale][mirror_views.at<int>(view_id)][mirror_inds.at<int>(ind)].ResponseSparse(empty, area_of_interest, empty, patch_expert_responses[ind], interp_mat, empty, prealloc_mat);
-				}
+				item.flipped = true;
+				int mirror_view = view_id == 0 ? 0 : mirror_views.at<int>(view_id);
+				expert_groups[make_pair(mirror_view, mirror_inds.at<int>(ind))].push_back(item);
 			}
+		}
+	}
 
-			preallocated_im2col[ind][im2col_size] = prealloc_mat;
+	vector<pair<pair<int, int>, vector<BatchItem> > > groups(expert_groups.begin(), expert_groups.end());
 
-		}
-		else if (!ccnf_expert_intensity.empty())
-		{
-			// get the correct size response window			
-			patch_expert_responses[ind] = cv::Mat_<float>(window_size, window_size);
+	// The areas of interest are sampled from the 8 bit image if there is one, otherwise all of the floating point regions needed are converted above
+	const cv::Mat_<uchar>& grayscale_image = image.Gray();
+	const cv::Mat_<float>& grayscale_image_float = image.Float(cv::Rect());
+
+	// Assuming the same size for all experts
+	int support_region = 11;
+	int area_of_interest_width = window_size + support_region - 1;
+	int area_of_interest_height = window_size + support_region - 1;
+	int resp_size = area_of_interest_height - support_region + 1;
+
+	cv::Mat_<float> interp_mat;
+	interpolationMatrix(interp_mat, resp_size, resp_size, area_of_interest_width, area_of_interest_height);
+
+	// With the OpenCL backend the networks are evaluated on the device, one group at a time (the areas of interest are still sampled in parallel)
+	const bool on_device = GetCNNBackend() == OPENCL_BACKEND;
+
+	vector<cv::Mat_<float> > group_buffers(groups.size());
+	vector<vector<cv::Mat_<float> > > group_areas(groups.size());
+	vector<vector<bool> > group_flipped(groups.size());
+
+	auto sample_group = [&](int g)
+	{
+		const vector<BatchItem>& items = groups[g].second;
 
-			int im2col_size = area_of_interest_width * area_of_interest_height;
+		// The areas of interest of the group are sampled into one contiguous buffer, each of them being a (continuous) block of its rows
+		cv::Mat_<float>& areas_buffer = group_buffers[g];
+		areas_buffer.create((int)items.size() * area_of_interest_height, area_of_interest_width);
+		vector<cv::Mat_<float> >& areas_of_interest = group_areas[g];
+		vector<bool>& flipped = group_flipped[g];
+		areas_of_interest.resize(items.size());
+		flipped.resize(items.size());
 
-			cv::Mat_<float> prealloc_mat = preallocated_im2col[ind][im2col_size];
+		for (size_t i = 0; i < items.size(); ++i)
+		{
+			int inst = items[i].instance;
+			int ind = items[i].landmark;
 
-			ccnf_expert_intensity[scale][view_id][ind].ResponseOpenBlas(area_of_interest, patch_expert_responses[ind], prealloc_mat);
+			float a1 = sim_coeffs[inst][0];
+			float b1 = sim_coeffs[inst][1];
 
-			preallocated_im2col[ind][im2col_size] = prealloc_mat;
+			// scale and rotate to mean shape to reference frame
+			cv::Matx23f sim(a1, -b1, landmark_locations[inst].at<float>(ind, 0) - a1 * (area_of_interest_width - 1.0f) / 2.0f + b1 * (area_of_interest_width - 1.0f) / 2.0f, b1, a1, landmark_locations[inst].at<float>(ind + n, 0) - a1 * (area_of_interest_width - 1.0f) / 2.0f - b1 * (area_of_interest_width - 1.0f) / 2.0f);
 
-			// Below is an alternative way to compute the same, but that uses FFT instead of OpenBLAS
-			// ccnf_expert_intensity[scale][view_id][ind].Response(area_of_interest, patch_expert_responses[ind]);
+			// Extract the region of interest around the current landmark location
+			areas_of_interest[i] = areas_buffer.rowRange((int)i * area_of_interest_height, (int)(i + 1) * area_of_interest_height);
+			SampleAreaOfInterest(grayscale_image, grayscale_image_float, sim, areas_of_interest[i]);
 
+			flipped[i] = items[i].flipped;
 		}
-		else
+	};
+
+	auto evaluate_group = [&](int g)
+	{
+		CEN_patch_expert& expert = cen_expert_intensity[scale][groups[g].first.first][groups[g].first.second];
+		const vector<BatchItem>& items = groups[g].second;
+
+		vector<cv::Mat_<float> > responses;
+		cv::Mat_<float> im2col_prealloc;
+
+		expert.ResponseSparseBatch(group_areas[g], group_flipped[g], responses, interp_mat, im2col_prealloc, on_device);
+
+		for (size_t i = 0; i < items.size(); ++i)
 		{
-			// get the correct size response window			
-			patch_expert_responses[ind] = cv::Mat_<float>(window_size, window_size);
+			patch_expert_responses[items[i].instance][items[i].landmark] = responses[i];
+		}
+
+		// The areas are not needed any more
+		group_areas[g].clear();
+		group_buffers[g].release();
+	};
 
-			svr_expert_intensity[scale][view_id][ind].Response(area_of_interest, patch_expert_responses[ind]);
+	if (on_device)
+	{
+		tbb::parallel_for(0, (int)groups.size(), [&](int g) { sample_group(g); });
+		for (int g = 0; g < (int)groups.size(); ++g)
+		{
+			evaluate_group(g);
 		}
 	}
-	});
+	else
+	{
+		// Every expert group is independent, so can compute them in parallel
+		tbb::parallel_for(0, (int)groups.size(), [&](int g) {
+			sample_group(g);
+			evaluate_group(g);
+		});
+	}
 }
 
 
@@ -381,17 +1038,27 @@ bool Patch_experts::Read(vector<string> intensity_svr_expert_locations, vector<s
 	
 	svr_expert_intensity.resize(num_intensity_svr);
 	
-	// Reading in SVR intensity patch experts for each scales it is defined in
-	for(int scale = 0; scale < num_intensity_svr; ++scale)
-	{		
-		string location = intensity_svr_expert_locations[scale];
-		cout << "Reading the intensity SVR patch experts from: " << location << "....";
-		bool success_read = Read_SVR_patch_experts(location,  centers[scale], visibilities[scale], svr_expert_intensity[scale], patch_scaling[scale]);
-		if (!success_read)
+	// The scales are stored in separate files, so they are read in parallel
+	vector<char> scale_read(num_intensity_svr, 0);
+	if (num_intensity_svr > 0)
+	{
+		cout << "Reading the intensity SVR patch experts from " << num_intensity_svr << " files....";
+	}
+	tbb::parallel_for(0, num_intensity_svr, [&](int scale) {
+		scale_read[scale] = Read_SVR_patch_experts(intensity_svr_expert_locations[scale], centers[scale], visibilities[scale], svr_expert_intensity[scale], patch_scaling[scale]);
+	});
+	for (int scale = 0; scale < num_intensity_svr; ++scale)
+	{
+		if (!scale_read[scale])
 		{
+			cout << "Can't find/open the patches file: " << intensity_svr_expert_locations[scale] << endl;
 			return false;
 		}
 	}
+	if (num_intensity_svr > 0)
+	{
+		cout << "Done" << endl;
+	}
 
 	// Initialise and read CCNF patch experts (currently only intensity based), 
 	int num_intensity_ccnf = intensity_ccnf_expert_locations.size();
@@ -403,23 +1070,28 @@ bool Patch_experts::Read(vector<string> intensity_svr_expert_locations, vector<s
 		visibilities.resize(num_intensity_ccnf);
 		patch_scaling.resize(num_intensity_ccnf);
 		ccnf_expert_intensity.resize(num_intensity_ccnf);
-	}
 
-	for(int scale = 0; scale < num_intensity_ccnf; ++scale)
-	{		
-		string location = intensity_ccnf_expert_locations[scale];
-		cout << "Reading the intensity CCNF patch experts from: " << location << "....";
-		bool success_read = Read_CCNF_patch_experts(location,  centers[scale], visibilities[scale], ccnf_expert_intensity[scale], patch_scaling[scale]);
+		cout << "Reading the intensity CCNF patch experts from " << num_intensity_ccnf << " files....";
+	}
 
-		if (!success_read)
+	// Every file carries its own copy of the sigma components, the one of the last scale is kept
+	vector<vector<vector<cv::Mat_<float> > > > scale_sigma_components(num_intensity_ccnf);
+	scale_read.assign(num_intensity_ccnf, 0);
+	tbb::parallel_for(0, num_intensity_ccnf, [&](int scale) {
+		scale_read[scale] = Read_CCNF_patch_experts(intensity_ccnf_expert_locations[scale], centers[scale], visibilities[scale], ccnf_expert_intensity[scale], patch_scaling[scale], scale_sigma_components[scale]);
+	});
+	for (int scale = 0; scale < num_intensity_ccnf; ++scale)
+	{
+		if (!scale_read[scale])
 		{
+			cout << "Can't find/open the patches file: " << intensity_ccnf_expert_locations[scale] << endl;
 			return false;
 		}
-
-		if (scale == 0)
-		{
-			preallocated_im2col.resize(ccnf_expert_intensity[0][0].size());
-		}
+	}
+	if (num_intensity_ccnf > 0)
+	{
+		sigma_components = scale_sigma_components.back();
+		cout << "Done" << endl;
 	}
 
 	// Initialise and read CEN patch experts (currently only intensity based), 
@@ -432,25 +1104,31 @@ bool Patch_experts::Read(vector<string> intensity_svr_expert_locations, vector<s
 		visibilities.resize(num_intensity_cen);
 		patch_scaling.resize(num_intensity_cen);
 		cen_expert_intensity.resize(num_intensity_cen);
+
+		cout << "Reading the intensity CEN patch experts from " << num_intensity_cen << " files....";
 	}
 
+	// As with the sigma components, the mirroring of the last scale is kept
+	vector<cv::Mat_<int> > scale_mirror_inds(num_intensity_cen);
+	vector<cv::Mat_<int> > scale_mirror_views(num_intensity_cen);
+	scale_read.assign(num_intensity_cen, 0);
+	tbb::parallel_for(0, num_intensity_cen, [&](int scale) {
+		scale_read[scale] = Read_CEN_patch_experts(intensity_cen_expert_locations[scale], centers[scale], visibilities[scale], cen_expert_intensity[scale], patch_scaling[scale], scale_mirror_inds[scale], scale_mirror_views[scale]);
+	});
 	for (int scale = 0; scale < num_intensity_cen; ++scale)
 	{
-		string location = intensity_cen_expert_locations[scale];
-		cout << "Reading the intensity CEN patch experts from: " << location << "....";
-		bool success_read = Read_CEN_patch_experts(location, centers[scale], visibilities[scale], cen_expert_intensity[scale], patch_scaling[scale]);
-		if (!success_read)
+		if (!scale_read[scale])
 		{
+			cout << "Could not find CEN patch experts, for instructions of how to download them, see https://github.com/TadasBaltrusaitis/OpenFace/wiki/Model-download \n" << endl;
 			return false;
 		}
-
-		if (scale == 0)
-		{
-			preallocated_im2col.resize(cen_expert_intensity[0][0].size());
-		}
-
 	}
-
+	if (num_intensity_cen > 0)
+	{
+		mirror_inds = scale_mirror_inds.back();
+		mirror_views = scale_mirror_views.back();
+		cout << "Done" << endl;
+	}
 
 	// Reading in early termination parameters
 	if (!early_term_loc.empty())
@@ -486,6 +1164,362 @@ bool Patch_experts::Read(vector<string> intensity_svr_expert_locations, vector<s
 	}
 	return true;
 }
+
+//===========================================================================
+bool Patch_experts::Read(const std::shared_ptr<const ModelBundle>& bundle, const string& prefix)
+{
+	vector<double> scaling;
+	if (!bundle->GetValues(prefix + "patch_scaling", scaling))
+	{
+		return false;
+	}
+
+	int num_scales = (int)scaling.size();
+
+	patch_scaling = scaling;
+	centers.resize(num_scales);
+	visibilities.resize(num_scales);
+	cen_expert_intensity.resize(num_scales);
+	views_loaded.resize(num_scales);
+
+	cv::Mat mirror_inds_b, mirror_views_b;
+	if (!bundle->GetMat(prefix + "mirror_inds", mirror_inds_b) || !bundle->GetMat(prefix + "mirror_views", mirror_views_b))
+	{
+		return false;
+	}
+	mirror_inds = mirror_inds_b;
+	mirror_views = mirror_views_b;
+
+	for (int scale = 0; scale < num_scales; ++scale)
+	{
+		string scale_prefix = prefix + "s" + to_string(scale) + "/";
+
+		cv::Mat_<double> centers_b;
+		cv::Mat centers_m;
+		if (!bundle->GetMat(scale_prefix + "centers", centers_m))
+		{
+			return false;
+		}
+		centers_b = centers_m;
+
+		int num_views = centers_b.rows;
+		centers[scale].resize(num_views);
+		visibilities[scale].resize(num_views);
+		cen_expert_intensity[scale].resize(num_views);
+		views_loaded[scale].assign(num_views, false);
+
+		for (int view = 0; view < num_views; ++view)
+		{
+			centers[scale][view] = cv::Vec3d(centers_b.at<double>(view, 0), centers_b.at<double>(view, 1), centers_b.at<double>(view, 2));
+
+			string view_prefix = scale_prefix + "v" + to_string(view) + "/";
+
+			cv::Mat visibility;
+			if (!bundle->GetMat(view_prefix + "visibility", visibility))
+			{
+				return false;
+			}
+			visibilities[scale][view] = visibility;
+
+			// The experts themselves are read in on first use of the view
+			cen_expert_intensity[scale][view].resize(visibility.rows);
+		}
+	}
+
+	// Early termination parameters are optional
+	bundle->GetValues(prefix + "early_term_weights", early_term_weights);
+	bundle->GetValues(prefix + "early_term_biases", early_term_biases);
+	bundle->GetValues(prefix + "early_term_cutoffs", early_term_cutoffs);
+
+	this->bundle = bundle;
+	this->bundle_prefix = prefix;
+
+	return true;
+}
+
+void Patch_experts::LoadView(int scale, int view)
+{
+	if (!bundle || views_loaded[scale][view])
+	{
+		return;
+	}
+
+	views_loaded[scale][view] = true;
+
+	string view_prefix = bundle_prefix + "s" + to_string(scale) + "/v" + to_string(view) + "/";
+
+	for (size_t lmk = 0; lmk < cen_expert_intensity[scale][view].size(); ++lmk)
+	{
+		if (!cen_expert_intensity[scale][view][lmk].Read(*bundle, view_prefix + "l" + to_string(lmk) + "/"))
+		{
+			cout << "Could not read the patch expert " << view_prefix << "l" << lmk << " from the model bundle" << endl;
+			continue;
+		}
+
+		// The float views into the bundle are dropped, so only the half precision or the packed copy is faulted in from then on
+		if (GetHalfPrecisionWeights())
+		{
+			cen_expert_intensity[scale][view][lmk].SetHalfPrecision();
+		}
+		else
+		{
+			cen_expert_intensity[scale][view][lmk].PackWeights();
+		}
+		if (quantised)
+		{
+			cen_expert_intensity[scale][view][lmk].SetQuantised(true);
+		}
+	}
+
+	// The landmarks without patch experts are computed using their mirrored view
+	if (view != 0)
+	{
+		LoadView(scale, mirror_views.at<int>(view));
+	}
+}
+
+bool Patch_experts::ExportONNX(int scale, int view_id, OnnxGraph& graph)
+{
+	if (cen_expert_intensity.empty())
+	{
+		return false;
+	}
+
+	LoadView(scale, view_id);
+
+	vector<const CEN_patch_expert*> experts;
+	string landmarks;
+	for (size_t lmk = 0; lmk < cen_expert_intensity[scale][view_id].size(); ++lmk)
+	{
+		const CEN_patch_expert& expert = cen_expert_intensity[scale][view_id][lmk];
+		if (expert.biases.empty())
+		{
+			continue;
+		}
+
+		// The stacked layers need the same shapes and activations
+		if (!experts.empty() && expert.activation_function != experts[0]->activation_function)
+		{
+			return false;
+		}
+		for (size_t layer = 0; !experts.empty() && layer < expert.weights.size(); ++layer)
+		{
+			cv::Mat_<float> widened, widened_first;
+			if (expert.LayerWeights(layer, widened).size() != experts[0]->LayerWeights(layer, widened_first).size())
+			{
+				return false;
+			}
+		}
+
+		experts.push_back(&expert);
+		landmarks += (landmarks.empty() ? "" : ",") + to_string(lmk);
+	}
+
+	if (experts.empty())
+	{
+		return false;
+	}
+
+	int num_experts = (int)experts.size();
+	cv::Mat_<float> widened;
+	graph.AddInput("input", { num_experts, -1, experts[0]->LayerWeights(0, widened).cols });
+	graph.AddMetadata("landmarks", landmarks);
+	graph.AddMetadata("support", to_string(experts[0]->width_support) + "x" + to_string(experts[0]->height_support));
+
+	// Every layer is a batched matrix multiplication of landmarks x N x in by landmarks x in x out
+	string tensor = "input";
+	for (size_t layer = 0; layer < experts[0]->weights.size(); ++layer)
+	{
+		int num_in = experts[0]->LayerWeights(layer, widened).cols;
+		int num_out = experts[0]->LayerWeights(layer, widened).rows;
+
+		cv::Mat_<float> weights(num_experts, num_in * num_out);
+		cv::Mat_<float> biases(num_experts, num_out);
+		for (int e = 0; e < num_experts; ++e)
+		{
+			cv::Mat_<float> weights_t = experts[e]->LayerWeights(layer, widened).t();
+			weights_t.reshape(1, 1).copyTo(weights.row(e));
+			experts[e]->biases[layer].reshape(1, 1).copyTo(biases.row(e));
+		}
+
+		string w = graph.AddInitializer("cen_w", { num_experts, num_in, num_out }, weights);
+		string b = graph.AddInitializer("cen_b", { num_experts, 1, num_out }, biases);
+		tensor = graph.AddNode("Add", { graph.AddNode("MatMul", { tensor, w }), b });
+
+		if (experts[0]->activation_function[layer] == 0)
+		{
+			tensor = graph.AddNode("Sigmoid", { tensor });
+		}
+		else if (experts[0]->activation_function[layer] == 2)
+		{
+			tensor = graph.AddNode("Relu", { tensor });
+		}
+	}
+
+	graph.AddNode("Identity", { tensor }, vector<OnnxGraph::Attribute>(), "output");
+	graph.AddOutput("output", { num_experts, -1, 1 });
+	return true;
+}
+
+bool Patch_experts::Write(ModelBundleWriter& bundle, const string& prefix) const
+{
+	if (cen_expert_intensity.empty())
+	{
+		cout << "Only CEN patch experts can be stored in a model bundle" << endl;
+		return false;
+	}
+
+	if (this->bundle)
+	{
+		cout << "The patch experts have already been read from a model bundle" << endl;
+		return false;
+	}
+
+	bundle.AddValues(prefix + "patch_scaling", patch_scaling);
+	bundle.AddMat(prefix + "mirror_inds", mirror_inds);
+	bundle.AddMat(prefix + "mirror_views", mirror_views);
+
+	for (size_t scale = 0; scale < cen_expert_intensity.size(); ++scale)
+	{
+		string scale_prefix = prefix + "s" + to_string(scale) + "/";
+
+		cv::Mat_<double> centers_b((int)centers[scale].size(), 3);
+		for (size_t view = 0; view < centers[scale].size(); ++view)
+		{
+			centers_b.at<double>((int)view, 0) = centers[scale][view][0];
+			centers_b.at<double>((int)view, 1) = centers[scale][view][1];
+			centers_b.at<double>((int)view, 2) = centers[scale][view][2];
+		}
+		bundle.AddMat(scale_prefix + "centers", centers_b);
+
+		for (size_t view = 0; view < cen_expert_intensity[scale].size(); ++view)
+		{
+			string view_prefix = scale_prefix + "v" + to_string(view) + "/";
+
+			bundle.AddMat(view_prefix + "visibility", visibilities[scale][view]);
+
+			for (size_t lmk = 0; lmk < cen_expert_intensity[scale][view].size(); ++lmk)
+			{
+				cen_expert_intensity[scale][view][lmk].Write(bundle, view_prefix + "l" + to_string(lmk) + "/");
+			}
+		}
+	}
+
+	if (!early_term_weights.empty())
+	{
+		bundle.AddValues(prefix + "early_term_weights", early_term_weights);
+		bundle.AddValues(prefix + "early_term_biases", early_term_biases);
+		bundle.AddValues(prefix + "early_term_cutoffs", early_term_cutoffs);
+	}
+
+	return true;
+}
+
+vector<int> Patch_experts::Prune(int num_scales, double max_yaw)
+{
+	if (this->bundle || centers.empty())
+	{
+		return vector<int>();
+	}
+
+	for (size_t scale = 1; scale < centers.size(); ++scale)
+	{
+		if (centers[scale].size() != centers[0].size())
+		{
+			return vector<int>();
+		}
+	}
+
+	// The frontal view is always kept (and stays the first one), as are the views the kept ones are mirrored from
+	int num_views = (int)centers[0].size();
+	vector<bool> keep(num_views, false);
+	keep[0] = true;
+	for (int view = 1; view < num_views; ++view)
+	{
+		if (std::abs(centers[0][view][1]) <= max_yaw)
+		{
+			keep[view] = true;
+			if (!mirror_views.empty())
+			{
+				keep[mirror_views.at<int>(view)] = true;
+			}
+		}
+	}
+
+	vector<int> kept_views;
+	vector<int> new_index(num_views, -1);
+	for (int view = 0; view < num_views; ++view)
+	{
+		if (keep[view])
+		{
+			new_index[view] = (int)kept_views.size();
+			kept_views.push_back(view);
+		}
+	}
+
+	if (!mirror_views.empty())
+	{
+		cv::Mat_<int> pruned_mirror_views(mirror_views.rows == 1 ? 1 : (int)kept_views.size(), mirror_views.rows == 1 ? (int)kept_views.size() : 1);
+		for (size_t view = 0; view < kept_views.size(); ++view)
+		{
+			pruned_mirror_views.at<int>((int)view) = new_index[mirror_views.at<int>(kept_views[view])];
+		}
+		mirror_views = pruned_mirror_views;
+	}
+
+	num_scales = std::max(1, std::min(num_scales, (int)patch_scaling.size()));
+	patch_scaling.resize(num_scales);
+	centers.resize(num_scales);
+	visibilities.resize(num_scales);
+	if (!svr_expert_intensity.empty())
+		svr_expert_intensity.resize(num_scales);
+	if (!ccnf_expert_intensity.empty())
+		ccnf_expert_intensity.resize(num_scales);
+	if (!cen_expert_intensity.empty())
+		cen_expert_intensity.resize(num_scales);
+
+	for (int scale = 0; scale < num_scales; ++scale)
+	{
+		vector<cv::Vec3d> scale_centers;
+		vector<cv::Mat_<int> > scale_visibilities;
+		for (size_t view = 0; view < kept_views.size(); ++view)
+		{
+			scale_centers.push_back(centers[scale][kept_views[view]]);
+			scale_visibilities.push_back(visibilities[scale][kept_views[view]]);
+		}
+		centers[scale] = scale_centers;
+		visibilities[scale] = scale_visibilities;
+
+		// The task lists refer to the old views
+		response_tasks.clear();
+		response_tasks_built.clear();
+
+		if (!svr_expert_intensity.empty())
+		{
+			vector<vector<Multi_SVR_patch_expert> > experts;
+			for (size_t view = 0; view < kept_views.size(); ++view)
+				experts.push_back(svr_expert_intensity[scale][kept_views[view]]);
+			svr_expert_intensity[scale] = experts;
+		}
+		if (!ccnf_expert_intensity.empty())
+		{
+			vector<vector<CCNF_patch_expert> > experts;
+			for (size_t view = 0; view < kept_views.size(); ++view)
+				experts.push_back(ccnf_expert_intensity[scale][kept_views[view]]);
+			ccnf_expert_intensity[scale] = experts;
+		}
+		if (!cen_expert_intensity.empty())
+		{
+			vector<vector<CEN_patch_expert> > experts;
+			for (size_t view = 0; view < kept_views.size(); ++view)
+				experts.push_back(cen_expert_intensity[scale][kept_views[view]]);
+			cen_expert_intensity[scale] = experts;
+		}
+	}
+
+	return kept_views;
+}
+
 //======================= Reading the SVR patch experts =========================================//
 bool Patch_experts::Read_SVR_patch_experts(string expert_location, std::vector<cv::Vec3d>& centers, std::vector<cv::Mat_<int> >& visibility, std::vector<std::vector<Multi_SVR_patch_expert> >& patches, double& scale)
 {
@@ -545,18 +1579,16 @@ bool Patch_experts::Read_SVR_patch_experts(string expert_location, std::vector<c
 			}
 		}
 	
-		cout << "Done" << endl;
 		return true;
 	}
 	else
 	{
-		cout << "Can't find/open the patches file" << endl;
 		return false;
 	}
 }
 
 //======================= Reading the CCNF patch experts =========================================//
-bool Patch_experts::Read_CCNF_patch_experts(string patchesFileLocation, std::vector<cv::Vec3d>& centers, std::vector<cv::Mat_<int> >& visibility, std::vector<std::vector<CCNF_patch_expert> >& patches, double& patchScaling)
+bool Patch_experts::Read_CCNF_patch_experts(string patchesFileLocation, std::vector<cv::Vec3d>& centers, std::vector<cv::Mat_<int> >& visibility, std::vector<std::vector<CCNF_patch_expert> >& patches, double& patchScaling, std::vector<std::vector<cv::Mat_<float> > >& sigma_components)
 {
 
 	ifstream patchesFile(patchesFileLocation.c_str(), ios::in | ios::binary);
@@ -598,7 +1630,7 @@ bool Patch_experts::Read_CCNF_patch_experts(string patchesFileLocation, std::vec
 		vector<int> windows;
 		windows.resize(num_win_sizes);
 
-		vector<vector<cv::Mat_<float> > > sigma_components;
+		sigma_components.clear();
 		sigma_components.resize(num_win_sizes);
 
 		for (int w=0; w < num_win_sizes; ++w)
@@ -614,8 +1646,7 @@ bool Patch_experts::Read_CCNF_patch_experts(string patchesFileLocation, std::vec
 				LandmarkDetector::ReadMatBin(patchesFile, sigma_components[w][s]);
 			}
 		}
-		
-		this->sigma_components = sigma_components;
+
 
 		// read the patches themselves
 		for(size_t i = 0; i < patches.size(); i++)
@@ -628,18 +1659,16 @@ bool Patch_experts::Read_CCNF_patch_experts(string patchesFileLocation, std::vec
 				patches[i][j].Read(patchesFile, windows, sigma_components);
 			}
 		}
-		cout << "Done" << endl;
 		return true;
 	}
 	else
 	{
-		cout << "Can't find/open the patches file" << endl;
 		return false;
 	}
 }
 
 //======================= Reading the CEN patch experts =========================================//
-bool Patch_experts::Read_CEN_patch_experts(string expert_location, std::vector<cv::Vec3d>& centers, std::vector<cv::Mat_<int> >& visibility, std::vector<std::vector<CEN_patch_expert> >& patches, double& scale)
+bool Patch_experts::Read_CEN_patch_experts(string expert_location, std::vector<cv::Vec3d>& centers, std::vector<cv::Mat_<int> >& visibility, std::vector<std::vector<CEN_patch_expert> >& patches, double& scale, cv::Mat_<int>& mirror_inds, cv::Mat_<int>& mirror_views)
 {
 
 	ifstream patchesFile(expert_location.c_str(), ios::in | ios::binary);
@@ -685,14 +1714,36 @@ bool Patch_experts::Read_CEN_patch_experts(string expert_location, std::vector<c
 			for (int j = 0; j < numberOfPoints; j++)
 			{
 				patches[i][j].Read(patchesFile);
+				if (GetHalfPrecisionWeights())
+				{
+					patches[i][j].SetHalfPrecision();
+				}
+				else
+				{
+					patches[i][j].PackWeights();
+				}
 			}
 		}
-		cout << "Done" << endl;
 		return true;
 	}
 	else
 	{
-		cout << "Could not find CEN patch experts, for instructions of how to download them, see https://github.com/TadasBaltrusaitis/OpenFace/wiki/Model-download \n" << endl;
 		return false;
 	}
 }
+
+void Patch_experts::SetQuantised(bool quantised)
+{
+	this->quantised = quantised;
+
+	for (size_t scale = 0; scale < cen_expert_intensity.size(); ++scale)
+	{
+		for (size_t view = 0; view < cen_expert_intensity[scale].size(); ++view)
+		{
+			for (size_t lmk = 0; lmk < cen_expert_intensity[scale][view].size(); ++lmk)
+			{
+				cen_expert_intensity[scale][view][lmk].SetQuantised(quantised);
+			}
+		}
+	}
+}
@@ -67,39 +67,47 @@ void Grad(const cv::Mat& im, cv::Mat& grad)
 	grad.col(grad.cols-1).setTo(0);
 	grad.row(grad.rows-1).setTo(0);		*/
 
-	// A quicker alternative
-	int x,y,h = im.rows,w = im.cols;
-	float vx,vy;
+	// A quicker alternative, through row pointers (rather than iterators) so that the inner loop is vectorised by the compiler (SSE or NEON)
+	int h = im.rows, w = im.cols;
 
 	// Initialise the gradient
 	grad.create(im.size(), CV_32F);
 	grad.setTo(0.0f);
 
-	cv::MatIterator_<float> gp  = grad.begin<float>() + w+1;
-	cv::MatConstIterator_<float> px1 = im.begin<float>()   + w+2;
-	cv::MatConstIterator_<float> px2 = im.begin<float>()   + w;
-	cv::MatConstIterator_<float> py1 = im.begin<float>()   + 2*w+1;
-	cv::MatConstIterator_<float> py2 = im.begin<float>()   + 1;
-
-	for(y = 1; y < h-1; y++)
+	for(int y = 1; y < h-1; y++)
 	{ 
-		for(x = 1; x < w-1; x++)
+		const float* im_up = im.ptr<float>(y - 1);
+		const float* im_row = im.ptr<float>(y);
+		const float* im_down = im.ptr<float>(y + 1);
+		float* gp = grad.ptr<float>(y);
+
+		for(int x = 1; x < w-1; x++)
 		{
-			vx = *px1++ - *px2++;
-			vy = *py1++ - *py2++;
-			*gp++ = vx*vx + vy*vy;
+			float vx = im_row[x + 1] - im_row[x - 1];
+			float vy = im_down[x] - im_up[x];
+			gp[x] = vx*vx + vy*vy;
 		}
-		px1 += 2;
-		px2 += 2;
-		py1 += 2;
-		py2 += 2;
-		gp += 2;
 	}
 
 }
 
+// The SVR response passed through a logistic regressor, 1 / (1 + exp(-(in * scaling + bias))), with the exponent computed in bulk (OpenCV's
+// vectorised exp) rather than per pixel
+static void LogisticResponse(const cv::Mat_<float>& svr_response, double scaling, double bias, cv::Mat_<float>& response)
+{
+	svr_response.convertTo(response, CV_32F, -scaling, -bias);
+	cv::exp(response, response);
+
+	const int num_pixels = (int)response.total();
+	float* p = response.ptr<float>(0);
+	for (int x = 0; x < num_pixels; ++x)
+	{
+		p[x] = 1.0f / (1.0f + p[x]);
+	}
+}
+
 // A copy constructor
-SVR_patch_expert::SVR_patch_expert(const SVR_patch_expert& other) : weights(other.weights.clone())
+SVR_patch_expert::SVR_patch_expert(const SVR_patch_expert& other) : weights(other.weights)
 {
 	this->type = other.type;
 	this->scaling = other.scaling;
@@ -108,8 +116,8 @@ SVR_patch_expert::SVR_patch_expert(const SVR_patch_expert& other) : weights(othe
 
 	for (std::map<int, cv::Mat_<double> >::const_iterator it = other.weights_dfts.begin(); it != other.weights_dfts.end(); it++)
 	{
-		// Make sure the matrix is copied.
-		this->weights_dfts.insert(std::pair<int, cv::Mat>(it->first, it->second.clone()));
+		// The weights are read only, so share them instead of copying
+		this->weights_dfts.insert(std::pair<int, cv::Mat>(it->first, it->second));
 	}
 }
 
@@ -158,7 +166,9 @@ void SVR_patch_expert::Response(const cv::Mat_<float>& area_of_interest, cv::Mat
 		{
 			std[0] = 1;
 		}
-		normalised_area_of_interest = (area_of_interest - mean[0]) / std[0];
+
+		// Subtracting the mean and dividing by the deviation in one pass
+		area_of_interest.convertTo(normalised_area_of_interest, CV_32F, 1.0 / std[0], -mean[0] / std[0]);
 	}
 	// If type is gradient, perform the image gradient computation
 	else if(type == 1)
@@ -181,17 +191,7 @@ void SVR_patch_expert::Response(const cv::Mat_<float>& area_of_interest, cv::Mat
 	// Efficient calc of patch expert SVR response across the area of interest
 	matchTemplate_m(normalised_area_of_interest, empty_matrix_0, empty_matrix_1, empty_matrix_2, weights, weights_dfts, svr_response, cv::TM_CCOEFF_NORMED);
 	
-	response.create(svr_response.size());
-	cv::MatIterator_<float> p = response.begin();
-
-	cv::MatIterator_<float> q1 = svr_response.begin(); // respone for each pixel
-	cv::MatIterator_<float> q2 = svr_response.end();
-
-	while(q1 != q2)
-	{
-		// the SVR response passed into logistic regressor
-		*p++ = 1.0/(1.0 + exp( -(*q1++ * scaling + bias )));
-	}
+	LogisticResponse(svr_response, scaling, bias, response);
 
 }
 
@@ -248,17 +248,7 @@ void SVR_patch_expert::ResponseDepth(const cv::Mat_<float>& area_of_interest, cv
 
 	matchTemplate_m(normalised_area_of_interest, empty_matrix_0, empty_matrix_1, empty_matrix_2, weights, weights_dfts, svr_response, cv::TM_CCOEFF);
 	
-	response.create(svr_response.size());
-	cv::MatIterator_<float> p = response.begin();
-
-	cv::MatIterator_<float> q1 = svr_response.begin(); // respone for each pixel
-	cv::MatIterator_<float> q2 = svr_response.end();
-
-	while(q1 != q2)
-	{
-		// the SVR response passed through a logistic regressor
-		*p++ = 1.0/(1.0 + exp( -(*q1++ * scaling + bias )));
-	}	
+	LogisticResponse(svr_response, scaling, bias, response);
 }
 
 // Copy constructor				
@@ -306,15 +296,16 @@ void Multi_SVR_patch_expert::Response(const cv::Mat_<float> &area_of_interest, c
 	}
 	else
 	{
-		// responses from multiple patch experts these can be gradients, LBPs etc.
-		response.setTo(1.0);
+		// responses from multiple patch experts these can be gradients, LBPs etc., the first one is written directly and the others are
+		// multiplied in place (combined intensity and gradient responses without temporaries)
+		svr_patch_experts[0].Response(area_of_interest, response);
 		
 		cv::Mat_<float> modality_resp(response_height, response_width);
 
-		for(size_t i = 0; i < svr_patch_experts.size(); i++)
+		for(size_t i = 1; i < svr_patch_experts.size(); i++)
 		{			
 			svr_patch_experts[i].Response(area_of_interest, modality_resp);			
-			response = response.mul(modality_resp);	
+			cv::multiply(response, modality_resp, response);
 		}	
 		
 	}
@@ -0,0 +1,237 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// The AVX2 variants of the dispatched kernels, this file is compiled with -mavx2 (/arch:AVX2), see SimdKernels.h for what it may include
+
+#include "SimdKernels.h"
+
+#include <immintrin.h>
+
+namespace LandmarkDetector
+{
+namespace Avx2
+{
+	// The same unit vectors as the baseline FHOG orientation binning
+	static const float directions_x[9] = { 1.0000f, 0.9397f, 0.7660f, 0.500f, 0.1736f, -0.1736f, -0.5000f, -0.7660f, -0.9397f };
+	static const float directions_y[9] = { 0.0000f, 0.3420f, 0.6428f, 0.8660f, 0.9848f, 0.9848f, 0.8660f, 0.6428f, 0.3420f };
+
+	static float ReduceSum(__m256 v)
+	{
+		__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+		return _mm_cvtss_f32(sum);
+	}
+
+	int FHOGOrientationRow(const float* grad_x, const float* grad_y, float* grad_len, int* orientation, int start, int width)
+	{
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+
+		int x = start;
+		for (; x + 8 <= width; x += 8)
+		{
+			__m256 gx = _mm256_loadu_ps(grad_x + x);
+			__m256 gy = _mm256_loadu_ps(grad_y + x);
+			__m256 best_dot = zero;
+			__m256 best_dot_signed = zero;
+			__m256 best_o = zero;
+
+			// Compare against both the direction and its opposite at once, the sign of the best dot product picks between the two
+			for (int o = 0; o < 9; ++o)
+			{
+				__m256 dot = _mm256_add_ps(_mm256_mul_ps(gx, _mm256_set1_ps(directions_x[o])), _mm256_mul_ps(gy, _mm256_set1_ps(directions_y[o])));
+				__m256 dot_abs = _mm256_andnot_ps(sign_mask, dot);
+				__m256 cmp = _mm256_cmp_ps(dot_abs, best_dot, _CMP_GT_OQ);
+				best_dot = _mm256_max_ps(best_dot, dot_abs);
+				best_dot_signed = _mm256_blendv_ps(best_dot_signed, dot, cmp);
+				best_o = _mm256_blendv_ps(best_o, _mm256_set1_ps((float)o), cmp);
+			}
+			best_o = _mm256_add_ps(best_o, _mm256_and_ps(_mm256_cmp_ps(best_dot_signed, zero, _CMP_LT_OQ), _mm256_set1_ps(9.0f)));
+
+			_mm256_storeu_si256((__m256i*)(orientation + x), _mm256_cvtps_epi32(best_o));
+			_mm256_storeu_ps(grad_len + x, _mm256_sqrt_ps(_mm256_loadu_ps(grad_len + x)));
+		}
+		return x;
+	}
+
+	int MeanShiftSums(const float* response, const float* kde, const float* coord_x, const float* coord_y, int start, int count, float& sum, float& mx, float& my)
+	{
+		__m256 v_sum = _mm256_setzero_ps();
+		__m256 v_mx = _mm256_setzero_ps();
+		__m256 v_my = _mm256_setzero_ps();
+
+		int k = start;
+		for (; k + 8 <= count; k += 8)
+		{
+			// The KDE evaluation of that point multiplied by the probability at the current, xi, yi
+			__m256 v = _mm256_mul_ps(_mm256_loadu_ps(response + k), _mm256_loadu_ps(kde + k));
+			v_sum = _mm256_add_ps(v_sum, v);
+			v_mx = _mm256_add_ps(v_mx, _mm256_mul_ps(v, _mm256_loadu_ps(coord_x + k)));
+			v_my = _mm256_add_ps(v_my, _mm256_mul_ps(v, _mm256_loadu_ps(coord_y + k)));
+		}
+
+		sum += ReduceSum(v_sum);
+		mx += ReduceSum(v_mx);
+		my += ReduceSum(v_my);
+		return k;
+	}
+
+	int BiasActivationRow(float* data, int start, int width, float bias, int activation)
+	{
+		const __m256 v_bias = _mm256_set1_ps(bias);
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+
+		int x = start;
+		if (activation == 0)
+		{
+			for (; x + 8 <= width; x += 8)
+			{
+				_mm256_storeu_ps(data + x, _mm256_xor_ps(_mm256_add_ps(_mm256_loadu_ps(data + x), v_bias), sign_mask));
+			}
+		}
+		else if (activation == 2)
+		{
+			for (; x + 8 <= width; x += 8)
+			{
+				_mm256_storeu_ps(data + x, _mm256_max_ps(_mm256_add_ps(_mm256_loadu_ps(data + x), v_bias), zero));
+			}
+		}
+		else
+		{
+			for (; x + 8 <= width; x += 8)
+			{
+				_mm256_storeu_ps(data + x, _mm256_add_ps(_mm256_loadu_ps(data + x), v_bias));
+			}
+		}
+		return x;
+	}
+
+	// Adding the bias, applying the activation and writing the first cols of a row of a panel (all 16 of them for the full panels)
+	static void StorePanelRow(__m256 acc0, __m256 acc1, const float* bias, int activation, float* out, int cols)
+	{
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+
+		float bias_padded[16];
+		if (cols < 16)
+		{
+			for (int c = 0; c < 16; ++c)
+				bias_padded[c] = bias && c < cols ? bias[c] : 0.0f;
+			bias = bias_padded;
+		}
+
+		__m256 v0 = _mm256_add_ps(acc0, bias ? _mm256_loadu_ps(bias) : zero);
+		__m256 v1 = _mm256_add_ps(acc1, bias ? _mm256_loadu_ps(bias + 8) : zero);
+		if (activation == 0)
+		{
+			v0 = _mm256_xor_ps(v0, sign_mask);
+			v1 = _mm256_xor_ps(v1, sign_mask);
+		}
+		else if (activation == 2)
+		{
+			v0 = _mm256_max_ps(v0, zero);
+			v1 = _mm256_max_ps(v1, zero);
+		}
+
+		if (cols == 16)
+		{
+			_mm256_storeu_ps(out, v0);
+			_mm256_storeu_ps(out + 8, v1);
+		}
+		else
+		{
+			float values[16];
+			_mm256_storeu_ps(values, v0);
+			_mm256_storeu_ps(values + 8, v1);
+			for (int c = 0; c < cols; ++c)
+				out[c] = values[c];
+		}
+	}
+
+	// Four rows of X at a time against a panel, the 16 columns of the panel are two registers per row
+	int GemmPackedRows(const float* X, int start, int num_rows, int ldx, const float* panels, int k, int n, const float* bias, int activation, float* out, int ldo)
+	{
+		const int num_panels = (n + 15) / 16;
+
+		int r = start;
+		for (; r + 4 <= num_rows; r += 4)
+		{
+			const float* x0 = X + (size_t)r * ldx;
+			const float* x1 = x0 + ldx;
+			const float* x2 = x1 + ldx;
+			const float* x3 = x2 + ldx;
+
+			for (int p = 0; p < num_panels; ++p)
+			{
+				const float* w = panels + (size_t)p * k * 16;
+				__m256 acc00 = _mm256_setzero_ps(), acc01 = _mm256_setzero_ps();
+				__m256 acc10 = _mm256_setzero_ps(), acc11 = _mm256_setzero_ps();
+				__m256 acc20 = _mm256_setzero_ps(), acc21 = _mm256_setzero_ps();
+				__m256 acc30 = _mm256_setzero_ps(), acc31 = _mm256_setzero_ps();
+
+				for (int i = 0; i < k; ++i, w += 16)
+				{
+					const __m256 w0 = _mm256_load_ps(w);
+					const __m256 w1 = _mm256_load_ps(w + 8);
+
+					__m256 x = _mm256_set1_ps(x0[i]);
+					acc00 = _mm256_add_ps(acc00, _mm256_mul_ps(x, w0));
+					acc01 = _mm256_add_ps(acc01, _mm256_mul_ps(x, w1));
+					x = _mm256_set1_ps(x1[i]);
+					acc10 = _mm256_add_ps(acc10, _mm256_mul_ps(x, w0));
+					acc11 = _mm256_add_ps(acc11, _mm256_mul_ps(x, w1));
+					x = _mm256_set1_ps(x2[i]);
+					acc20 = _mm256_add_ps(acc20, _mm256_mul_ps(x, w0));
+					acc21 = _mm256_add_ps(acc21, _mm256_mul_ps(x, w1));
+					x = _mm256_set1_ps(x3[i]);
+					acc30 = _mm256_add_ps(acc30, _mm256_mul_ps(x, w0));
+					acc31 = _mm256_add_ps(acc31, _mm256_mul_ps(x, w1));
+				}
+
+				const int first_col = p * 16;
+				const int cols = n - first_col < 16 ? n - first_col : 16;
+				const float* panel_bias = bias ? bias + first_col : 0;
+				float* o = out + (size_t)r * ldo + first_col;
+				StorePanelRow(acc00, acc01, panel_bias, activation, o, cols);
+				StorePanelRow(acc10, acc11, panel_bias, activation, o + ldo, cols);
+				StorePanelRow(acc20, acc21, panel_bias, activation, o + 2 * (size_t)ldo, cols);
+				StorePanelRow(acc30, acc31, panel_bias, activation, o + 3 * (size_t)ldo, cols);
+			}
+		}
+		return r;
+	}
+}
+}
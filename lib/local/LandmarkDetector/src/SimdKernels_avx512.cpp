@@ -0,0 +1,182 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// The AVX-512 variants of the dispatched kernels, this file is compiled with -mavx512f (/arch:AVX512), see SimdKernels.h for what it may include
+
+#include "SimdKernels.h"
+
+#include <immintrin.h>
+
+namespace LandmarkDetector
+{
+namespace Avx512
+{
+	// The same unit vectors as the baseline FHOG orientation binning
+	static const float directions_x[9] = { 1.0000f, 0.9397f, 0.7660f, 0.500f, 0.1736f, -0.1736f, -0.5000f, -0.7660f, -0.9397f };
+	static const float directions_y[9] = { 0.0000f, 0.3420f, 0.6428f, 0.8660f, 0.9848f, 0.9848f, 0.8660f, 0.6428f, 0.3420f };
+
+	int FHOGOrientationRow(const float* grad_x, const float* grad_y, float* grad_len, int* orientation, int start, int width)
+	{
+		const __m512 zero = _mm512_setzero_ps();
+
+		int x = start;
+		for (; x + 16 <= width; x += 16)
+		{
+			__m512 gx = _mm512_loadu_ps(grad_x + x);
+			__m512 gy = _mm512_loadu_ps(grad_y + x);
+			__m512 best_dot = zero;
+			__m512 best_dot_signed = zero;
+			__m512 best_o = zero;
+
+			// Compare against both the direction and its opposite at once, the sign of the best dot product picks between the two
+			for (int o = 0; o < 9; ++o)
+			{
+				__m512 dot = _mm512_add_ps(_mm512_mul_ps(gx, _mm512_set1_ps(directions_x[o])), _mm512_mul_ps(gy, _mm512_set1_ps(directions_y[o])));
+				__m512 dot_abs = _mm512_abs_ps(dot);
+				__mmask16 cmp = _mm512_cmp_ps_mask(dot_abs, best_dot, _CMP_GT_OQ);
+				best_dot = _mm512_max_ps(best_dot, dot_abs);
+				best_dot_signed = _mm512_mask_blend_ps(cmp, best_dot_signed, dot);
+				best_o = _mm512_mask_blend_ps(cmp, best_o, _mm512_set1_ps((float)o));
+			}
+			best_o = _mm512_mask_add_ps(best_o, _mm512_cmp_ps_mask(best_dot_signed, zero, _CMP_LT_OQ), best_o, _mm512_set1_ps(9.0f));
+
+			_mm512_storeu_si512((void*)(orientation + x), _mm512_cvtps_epi32(best_o));
+			_mm512_storeu_ps(grad_len + x, _mm512_sqrt_ps(_mm512_loadu_ps(grad_len + x)));
+		}
+		return x;
+	}
+
+	int MeanShiftSums(const float* response, const float* kde, const float* coord_x, const float* coord_y, int start, int count, float& sum, float& mx, float& my)
+	{
+		__m512 v_sum = _mm512_setzero_ps();
+		__m512 v_mx = _mm512_setzero_ps();
+		__m512 v_my = _mm512_setzero_ps();
+
+		int k = start;
+		for (; k + 16 <= count; k += 16)
+		{
+			// The KDE evaluation of that point multiplied by the probability at the current, xi, yi
+			__m512 v = _mm512_mul_ps(_mm512_loadu_ps(response + k), _mm512_loadu_ps(kde + k));
+			v_sum = _mm512_add_ps(v_sum, v);
+			v_mx = _mm512_add_ps(v_mx, _mm512_mul_ps(v, _mm512_loadu_ps(coord_x + k)));
+			v_my = _mm512_add_ps(v_my, _mm512_mul_ps(v, _mm512_loadu_ps(coord_y + k)));
+		}
+
+		sum += _mm512_reduce_add_ps(v_sum);
+		mx += _mm512_reduce_add_ps(v_mx);
+		my += _mm512_reduce_add_ps(v_my);
+		return k;
+	}
+
+	int BiasActivationRow(float* data, int start, int width, float bias, int activation)
+	{
+		const __m512 v_bias = _mm512_set1_ps(bias);
+		const __m512 zero = _mm512_setzero_ps();
+		const __m512i sign_mask = _mm512_set1_epi32((int)0x80000000);
+
+		int x = start;
+		if (activation == 0)
+		{
+			for (; x + 16 <= width; x += 16)
+			{
+				_mm512_storeu_ps(data + x, _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(_mm512_add_ps(_mm512_loadu_ps(data + x), v_bias)), sign_mask)));
+			}
+		}
+		else if (activation == 2)
+		{
+			for (; x + 16 <= width; x += 16)
+			{
+				_mm512_storeu_ps(data + x, _mm512_max_ps(_mm512_add_ps(_mm512_loadu_ps(data + x), v_bias), zero));
+			}
+		}
+		else
+		{
+			for (; x + 16 <= width; x += 16)
+			{
+				_mm512_storeu_ps(data + x, _mm512_add_ps(_mm512_loadu_ps(data + x), v_bias));
+			}
+		}
+		return x;
+	}
+
+	// Four rows of X at a time against a panel, the 16 columns of the panel are a register per row, the last panel is written masked
+	int GemmPackedRows(const float* X, int start, int num_rows, int ldx, const float* panels, int k, int n, const float* bias, int activation, float* out, int ldo)
+	{
+		const int num_panels = (n + 15) / 16;
+		const __m512 zero = _mm512_setzero_ps();
+		const __m512i sign_mask = _mm512_set1_epi32((int)0x80000000);
+
+		int r = start;
+		for (; r + 4 <= num_rows; r += 4)
+		{
+			const float* x_rows[4] = { X + (size_t)r * ldx, X + (size_t)(r + 1) * ldx, X + (size_t)(r + 2) * ldx, X + (size_t)(r + 3) * ldx };
+
+			for (int p = 0; p < num_panels; ++p)
+			{
+				const float* w = panels + (size_t)p * k * 16;
+				__m512 acc[4] = { zero, zero, zero, zero };
+
+				for (int i = 0; i < k; ++i, w += 16)
+				{
+					const __m512 w_i = _mm512_load_ps(w);
+					acc[0] = _mm512_add_ps(acc[0], _mm512_mul_ps(_mm512_set1_ps(x_rows[0][i]), w_i));
+					acc[1] = _mm512_add_ps(acc[1], _mm512_mul_ps(_mm512_set1_ps(x_rows[1][i]), w_i));
+					acc[2] = _mm512_add_ps(acc[2], _mm512_mul_ps(_mm512_set1_ps(x_rows[2][i]), w_i));
+					acc[3] = _mm512_add_ps(acc[3], _mm512_mul_ps(_mm512_set1_ps(x_rows[3][i]), w_i));
+				}
+
+				const int first_col = p * 16;
+				const int cols = n - first_col < 16 ? n - first_col : 16;
+				const __mmask16 mask = (__mmask16)((1u << cols) - 1);
+				const __m512 v_bias = bias ? _mm512_maskz_loadu_ps(mask, bias + first_col) : zero;
+
+				for (int row = 0; row < 4; ++row)
+				{
+					__m512 v = _mm512_add_ps(acc[row], v_bias);
+					if (activation == 0)
+					{
+						v = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(v), sign_mask));
+					}
+					else if (activation == 2)
+					{
+						v = _mm512_max_ps(v, zero);
+					}
+					_mm512_mask_storeu_ps(out + (size_t)(r + row) * ldo + first_col, mask, v);
+				}
+			}
+		}
+		return r;
+	}
+}
+}
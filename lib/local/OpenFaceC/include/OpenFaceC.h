@@ -0,0 +1,217 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef OPENFACE_C_H
+#define OPENFACE_C_H
+
+// A C interface to the face tracking (CLNF), Action Unit recognition (FaceAnalyser) and gaze estimation (GazeAnalysis), for embedding
+// OpenFace in other languages (e.g. through ctypes, cgo or Rust FFI). The images are read directly from caller owned buffers and all of the
+// results are written to caller owned structures and arrays, so no memory crosses the interface. None of the functions throw, failures are
+// reported through the return values and of_last_error.
+//
+// Usage:
+//	const char* args[] = { "/opt/OpenFace/bin/FeatureExtraction", "-mloc", "model/main_ceclm_general.txt" };
+//	of_tracker* tracker = of_tracker_create(3, args, OF_ENABLE_AUS | OF_ENABLE_GAZE);
+//	of_image image = { pixels, width, height, stride, OF_PIXEL_BGR24 };
+//	of_frame_result result;
+//	of_tracker_process(tracker, &image, NULL, time_stamp, &result, &outputs);
+//	of_tracker_destroy(tracker);
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#if defined(OPENFACE_C_EXPORTS)
+#define OPENFACE_C_API __declspec(dllexport)
+#else
+#define OPENFACE_C_API __declspec(dllimport)
+#endif
+#else
+#define OPENFACE_C_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Incremented on every incompatible change of the structures or functions below
+#define OPENFACE_C_API_VERSION 1
+
+typedef struct of_tracker of_tracker;
+
+// The layouts of the image buffers, all 8 bits per channel. The RGB and BGRA images are converted to BGR internally (which copies them),
+// the others are wrapped as they are
+typedef enum
+{
+	OF_PIXEL_GRAY8 = 0,
+	OF_PIXEL_BGR24 = 1,
+	OF_PIXEL_RGB24 = 2,
+	OF_PIXEL_BGRA32 = 3
+} of_pixel_format;
+
+// Which of the analyses to run besides the landmark detection
+enum
+{
+	OF_ENABLE_AUS = 1,
+	OF_ENABLE_GAZE = 2
+};
+
+// The power profiles, see of_tracker_set_power_profile
+typedef enum
+{
+	OF_POWER_DEFAULT = 0,
+	OF_POWER_LOW = 1
+} of_power_profile;
+
+// A caller owned image, the stride is in bytes between the starts of two rows
+typedef struct
+{
+	const unsigned char* data;
+	int width;
+	int height;
+	size_t stride;
+	int format;
+} of_image;
+
+// The camera intrinsics in pixels, values of 0 or less are estimated from the image size
+typedef struct
+{
+	float fx;
+	float fy;
+	float cx;
+	float cy;
+} of_camera;
+
+// The results of a fixed size
+typedef struct
+{
+	int success;
+	float confidence;
+
+	// Head pose in the camera coordinate space (tx, ty, tz in mm, rx, ry, rz in radians)
+	float pose[6];
+
+	// Gaze directions of the two eyes and the gaze angle (radians), only estimated with OF_ENABLE_GAZE on successfully tracked frames
+	float gaze_0[3];
+	float gaze_1[3];
+	float gaze_angle[2];
+
+	// How many values were written to the output arrays
+	int num_landmarks;
+	int num_eye_landmarks;
+	int num_au_intensities;
+	int num_au_occurences;
+} of_frame_result;
+
+// Caller owned arrays for the variable sized results, any of them can be NULL when not needed. The landmarks are interleaved (x0, y0, x1, y1, ...),
+// the AUs are in the order of of_tracker_au_name. The lengths are in floats, a too short array is an error
+typedef struct
+{
+	float* landmarks;
+	int landmarks_length;
+	float* eye_landmarks;
+	int eye_landmarks_length;
+	float* au_intensities;
+	int au_intensities_length;
+	float* au_occurences;
+	int au_occurences_length;
+} of_frame_outputs;
+
+// The settings that decide how much work (and so energy) a frame takes, for trading the frame rate for battery life
+typedef struct
+{
+	// The profile the settings were last set from
+	int profile;
+
+	// The number of threads the whole process is limited to, 0 for all of the cores
+	int max_threads;
+
+	// The landmarks are fully fit on every n-th frame and propagated in between
+	int full_fit_every;
+
+	// How often the tracked face is validated and a lost face is looked for (in frames), and with which detector (0 HAAR, 1 HOG SVM, 2 MTCNN),
+	// and if the detection runs on a background thread
+	int validate_every;
+	int reinit_every;
+	int face_detector;
+	int async_face_detection;
+
+	// If the CEN patch experts use 8 bit weights
+	int quantised_patch_experts;
+
+	// The AUs and the gaze are computed on every n-th frame, the other frames report the last values
+	int analyse_every;
+} of_power_settings;
+
+OPENFACE_C_API int of_api_version(void);
+
+// The message of the last failure on the calling thread (an empty string if there was none)
+OPENFACE_C_API const char* of_last_error(void);
+
+// Creating a tracker of a single face in a video stream, the arguments are the same as the command line arguments of the executables
+// (e.g. -mloc, -au_root), including the first one (the relative model locations are looked up next to it). Returns NULL if the models
+// could not be loaded. Every tracker is independent and can be used from its own thread
+OPENFACE_C_API of_tracker* of_tracker_create(int argc, const char** argv, int flags);
+OPENFACE_C_API void of_tracker_destroy(of_tracker* tracker);
+
+// Starting a new sequence (the tracking and the person specific normalisation of the AUs)
+OPENFACE_C_API void of_tracker_reset(of_tracker* tracker);
+
+// The sizes of the output arrays needed
+OPENFACE_C_API int of_tracker_num_landmarks(const of_tracker* tracker);
+OPENFACE_C_API int of_tracker_num_eye_landmarks(const of_tracker* tracker);
+OPENFACE_C_API int of_tracker_num_aus(const of_tracker* tracker, int occurence);
+
+// The name of an AU (e.g. "AU01"), the string is owned by the tracker
+OPENFACE_C_API const char* of_tracker_au_name(const of_tracker* tracker, int occurence, int index);
+
+// Processing the next frame of the stream (the time stamp in seconds), the camera can be NULL. Returns 0 if the frame was processed (whether a
+// face was found or not is in result->success) and a negative value on failure
+OPENFACE_C_API int of_tracker_process(of_tracker* tracker, const of_image* image, const of_camera* camera, double time_stamp, of_frame_result* result,
+	const of_frame_outputs* outputs);
+
+// Switching the power profile, takes effect from the next frame. OF_POWER_LOW applies the low_power preset (see
+// FaceModelParameters::ApplyPreset) and computes the AUs and the gaze on every third frame, OF_POWER_DEFAULT restores the settings the tracker
+// was created with. The thread limit applies to the whole process. Returns 0 on success and a negative value for an unknown profile
+OPENFACE_C_API int of_tracker_set_power_profile(of_tracker* tracker, int profile);
+
+// The current settings, and setting them individually (e.g. to step between the two profiles), the thread limit of 0 lifts the limit
+OPENFACE_C_API int of_tracker_get_power_settings(const of_tracker* tracker, of_power_settings* settings);
+OPENFACE_C_API int of_tracker_set_power_settings(of_tracker* tracker, const of_power_settings* settings);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OPENFACE_C_H
@@ -0,0 +1,211 @@
+# Python bindings of the OpenFace C interface (lib/local/OpenFaceC/include/OpenFaceC.h), using only ctypes. The images are passed through
+# the buffer protocol (e.g. numpy arrays, bytearrays or memoryviews) without copying them, and the results are written to preallocated
+# arrays that are reused from frame to frame.
+#
+# Usage:
+#   tracker = openface.Tracker(["/opt/OpenFace/bin/FeatureExtraction", "-mloc", "model/main_ceclm_general.txt"], aus=True, gaze=True)
+#   result = tracker.process(frame, time_stamp)     # frame is a height x width x 3 BGR uint8 array
+#   result.landmarks                                # a memoryview of x0, y0, x1, y1, ... floats, valid until the next frame
+#
+# The library is found through the OPENFACE_C_LIBRARY environment variable or the system library path.
+
+import array
+import ctypes
+import ctypes.util
+import os
+
+PIXEL_GRAY8 = 0
+PIXEL_BGR24 = 1
+PIXEL_RGB24 = 2
+PIXEL_BGRA32 = 3
+
+ENABLE_AUS = 1
+ENABLE_GAZE = 2
+
+POWER_DEFAULT = 0
+POWER_LOW = 1
+
+API_VERSION = 1
+
+
+class _Image(ctypes.Structure):
+    _fields_ = [("data", ctypes.c_void_p), ("width", ctypes.c_int), ("height", ctypes.c_int), ("stride", ctypes.c_size_t), ("format", ctypes.c_int)]
+
+
+class _Camera(ctypes.Structure):
+    _fields_ = [("fx", ctypes.c_float), ("fy", ctypes.c_float), ("cx", ctypes.c_float), ("cy", ctypes.c_float)]
+
+
+class _FrameResult(ctypes.Structure):
+    _fields_ = [("success", ctypes.c_int), ("confidence", ctypes.c_float), ("pose", ctypes.c_float * 6),
+                ("gaze_0", ctypes.c_float * 3), ("gaze_1", ctypes.c_float * 3), ("gaze_angle", ctypes.c_float * 2),
+                ("num_landmarks", ctypes.c_int), ("num_eye_landmarks", ctypes.c_int),
+                ("num_au_intensities", ctypes.c_int), ("num_au_occurences", ctypes.c_int)]
+
+
+class _FrameOutputs(ctypes.Structure):
+    _fields_ = [("landmarks", ctypes.c_void_p), ("landmarks_length", ctypes.c_int),
+                ("eye_landmarks", ctypes.c_void_p), ("eye_landmarks_length", ctypes.c_int),
+                ("au_intensities", ctypes.c_void_p), ("au_intensities_length", ctypes.c_int),
+                ("au_occurences", ctypes.c_void_p), ("au_occurences_length", ctypes.c_int)]
+
+
+class _PowerSettings(ctypes.Structure):
+    _fields_ = [("profile", ctypes.c_int), ("max_threads", ctypes.c_int), ("full_fit_every", ctypes.c_int), ("validate_every", ctypes.c_int),
+                ("reinit_every", ctypes.c_int), ("face_detector", ctypes.c_int), ("async_face_detection", ctypes.c_int),
+                ("quantised_patch_experts", ctypes.c_int), ("analyse_every", ctypes.c_int)]
+
+
+def _load_library():
+    path = os.environ.get("OPENFACE_C_LIBRARY") or ctypes.util.find_library("OpenFaceC")
+    if path is None:
+        raise OSError("The OpenFaceC library was not found, set OPENFACE_C_LIBRARY to its location")
+    lib = ctypes.CDLL(path)
+
+    lib.of_api_version.restype = ctypes.c_int
+    lib.of_last_error.restype = ctypes.c_char_p
+    lib.of_tracker_create.restype = ctypes.c_void_p
+    lib.of_tracker_create.argtypes = [ctypes.c_int, ctypes.POINTER(ctypes.c_char_p), ctypes.c_int]
+    lib.of_tracker_destroy.argtypes = [ctypes.c_void_p]
+    lib.of_tracker_reset.argtypes = [ctypes.c_void_p]
+    lib.of_tracker_num_landmarks.argtypes = [ctypes.c_void_p]
+    lib.of_tracker_num_eye_landmarks.argtypes = [ctypes.c_void_p]
+    lib.of_tracker_num_aus.argtypes = [ctypes.c_void_p, ctypes.c_int]
+    lib.of_tracker_au_name.restype = ctypes.c_char_p
+    lib.of_tracker_au_name.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int]
+    lib.of_tracker_process.restype = ctypes.c_int
+    lib.of_tracker_process.argtypes = [ctypes.c_void_p, ctypes.POINTER(_Image), ctypes.POINTER(_Camera), ctypes.c_double,
+                                       ctypes.POINTER(_FrameResult), ctypes.POINTER(_FrameOutputs)]
+    lib.of_tracker_set_power_profile.restype = ctypes.c_int
+    lib.of_tracker_set_power_profile.argtypes = [ctypes.c_void_p, ctypes.c_int]
+    lib.of_tracker_get_power_settings.restype = ctypes.c_int
+    lib.of_tracker_get_power_settings.argtypes = [ctypes.c_void_p, ctypes.POINTER(_PowerSettings)]
+    lib.of_tracker_set_power_settings.restype = ctypes.c_int
+    lib.of_tracker_set_power_settings.argtypes = [ctypes.c_void_p, ctypes.POINTER(_PowerSettings)]
+
+    if lib.of_api_version() != API_VERSION:
+        raise OSError("The OpenFaceC library has API version %d, these bindings are for %d" % (lib.of_api_version(), API_VERSION))
+    return lib
+
+
+_lib = None
+
+
+def _library():
+    global _lib
+    if _lib is None:
+        _lib = _load_library()
+    return _lib
+
+
+def _float_array(length):
+    values = array.array("f", bytes(4 * length))
+    address, _ = values.buffer_info()
+    return values, address
+
+
+class FrameResult(object):
+    """The results of a frame, the arrays are views of the tracker's buffers and are overwritten by the next frame."""
+
+    def __init__(self, result, landmarks, eye_landmarks, au_intensities, au_occurences):
+        self.success = bool(result.success)
+        self.confidence = result.confidence
+        self.pose = tuple(result.pose)
+        self.gaze_0 = tuple(result.gaze_0)
+        self.gaze_1 = tuple(result.gaze_1)
+        self.gaze_angle = tuple(result.gaze_angle)
+        self.landmarks = memoryview(landmarks)[:2 * result.num_landmarks]
+        self.eye_landmarks = memoryview(eye_landmarks)[:2 * result.num_eye_landmarks]
+        self.au_intensities = memoryview(au_intensities)[:result.num_au_intensities]
+        self.au_occurences = memoryview(au_occurences)[:result.num_au_occurences]
+
+
+class Tracker(object):
+    """Tracking a single face in a stream of frames, with optional AU recognition and gaze estimation."""
+
+    def __init__(self, arguments, aus=False, gaze=False):
+        lib = _library()
+        flags = (ENABLE_AUS if aus else 0) | (ENABLE_GAZE if gaze else 0)
+        argv = (ctypes.c_char_p * len(arguments))(*[a.encode("utf-8") for a in arguments])
+        self._handle = lib.of_tracker_create(len(arguments), argv, flags)
+        if not self._handle:
+            raise RuntimeError(lib.of_last_error().decode("utf-8"))
+
+        self.au_intensity_names = [lib.of_tracker_au_name(self._handle, 0, i).decode("utf-8") for i in range(lib.of_tracker_num_aus(self._handle, 0))]
+        self.au_occurence_names = [lib.of_tracker_au_name(self._handle, 1, i).decode("utf-8") for i in range(lib.of_tracker_num_aus(self._handle, 1))]
+
+        # The output arrays are allocated once and reused for every frame
+        self._landmarks, landmarks_address = _float_array(2 * lib.of_tracker_num_landmarks(self._handle))
+        self._eye_landmarks, eye_address = _float_array(2 * lib.of_tracker_num_eye_landmarks(self._handle))
+        self._au_intensities, intensities_address = _float_array(len(self.au_intensity_names))
+        self._au_occurences, occurences_address = _float_array(len(self.au_occurence_names))
+        self._outputs = _FrameOutputs(landmarks_address, len(self._landmarks), eye_address, len(self._eye_landmarks),
+                                      intensities_address, len(self._au_intensities), occurences_address, len(self._au_occurences))
+        self._result = _FrameResult()
+
+    def close(self):
+        if self._handle:
+            _library().of_tracker_destroy(self._handle)
+            self._handle = None
+
+    def __del__(self):
+        self.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def reset(self):
+        _library().of_tracker_reset(self._handle)
+
+    def set_power_profile(self, profile):
+        """Switching between POWER_DEFAULT and POWER_LOW, from the next frame on."""
+        lib = _library()
+        if lib.of_tracker_set_power_profile(self._handle, profile) != 0:
+            raise RuntimeError(lib.of_last_error().decode("utf-8"))
+
+    def power_settings(self):
+        """The current energy relevant settings as a dictionary (see of_power_settings in OpenFaceC.h)."""
+        lib = _library()
+        settings = _PowerSettings()
+        if lib.of_tracker_get_power_settings(self._handle, ctypes.byref(settings)) != 0:
+            raise RuntimeError(lib.of_last_error().decode("utf-8"))
+        return dict((name, getattr(settings, name)) for name, _ in _PowerSettings._fields_)
+
+    def set_power_settings(self, **changes):
+        """Changing some of the settings, e.g. set_power_settings(full_fit_every=2, analyse_every=2)."""
+        lib = _library()
+        settings = _PowerSettings(**dict(self.power_settings(), **changes))
+        if lib.of_tracker_set_power_settings(self._handle, ctypes.byref(settings)) != 0:
+            raise RuntimeError(lib.of_last_error().decode("utf-8"))
+
+    def process(self, frame, time_stamp, fx=0, fy=0, cx=0, cy=0, pixel_format=None):
+        """Processing the next frame, any object exporting a height x width (x channels) uint8 buffer, the pixel format defaults to
+        grayscale for one channel, BGR for three and BGRA for four."""
+        view = memoryview(frame)
+        if view.ndim not in (2, 3) or view.itemsize != 1:
+            raise ValueError("The frame has to be a height x width (x channels) buffer of bytes")
+        channels = view.shape[2] if view.ndim == 3 else 1
+        if view.strides[1] != channels or (view.ndim == 3 and view.strides[2] != 1):
+            raise ValueError("The pixels of a row of the frame have to be contiguous")
+        if pixel_format is None:
+            pixel_format = {1: PIXEL_GRAY8, 3: PIXEL_BGR24, 4: PIXEL_BGRA32}.get(channels)
+            if pixel_format is None:
+                raise ValueError("Unsupported number of channels %d" % channels)
+
+        # Contiguous writable buffers are passed as they are, ctypes can not take the address of the others (read-only ones such as bytes,
+        # or ones with padded rows) so those are copied
+        if view.c_contiguous and not view.readonly:
+            data = (ctypes.c_char * view.nbytes).from_buffer(view)
+        else:
+            data = (ctypes.c_char * view.nbytes).from_buffer_copy(view.tobytes())
+        image = _Image(ctypes.addressof(data), view.shape[1], view.shape[0], view.shape[1] * channels, pixel_format)
+        camera = _Camera(fx, fy, cx, cy)
+
+        lib = _library()
+        if lib.of_tracker_process(self._handle, ctypes.byref(image), ctypes.byref(camera), time_stamp, ctypes.byref(self._result), ctypes.byref(self._outputs)) != 0:
+            raise RuntimeError(lib.of_last_error().decode("utf-8"))
+
+        return FrameResult(self._result, self._landmarks, self._eye_landmarks, self._au_intensities, self._au_occurences)
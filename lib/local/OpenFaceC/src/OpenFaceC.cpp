@@ -0,0 +1,463 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "OpenFaceC.h"
+
+// Local includes
+#include <LandmarkCoreIncludes.h>
+#include <FaceAnalyser.h>
+#include <GazeEstimation.h>
+#include <ImageManipulationHelpers.h>
+#include <Concurrency.h>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+// System includes
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct of_tracker
+{
+	of_tracker(std::vector<std::string>& arguments, int flags) : det_parameters(arguments), face_model(det_parameters.model_location), flags(flags),
+		initial_parameters(det_parameters), initial_threads(Utilities::Concurrency::GetNumThreads()), profile(OF_POWER_DEFAULT), analyse_every(1), frame_count(0)
+	{
+		if ((flags & OF_ENABLE_AUS) != 0)
+		{
+			FaceAnalysis::FaceAnalyserParameters face_analysis_params(arguments);
+			face_analyser.reset(new FaceAnalysis::FaceAnalyser(face_analysis_params));
+			au_reg_names = face_analyser->GetAURegNameTable();
+			au_class_names = face_analyser->GetAUClassNameTable();
+		}
+	}
+
+	LandmarkDetector::FaceModelParameters det_parameters;
+	LandmarkDetector::CLNF face_model;
+	std::unique_ptr<FaceAnalysis::FaceAnalyser> face_analyser;
+	int flags;
+
+	// The order the AUs are written in
+	std::vector<std::string> au_reg_names;
+	std::vector<std::string> au_class_names;
+
+	// The grayscale versions of the colour frames are converted into the same buffer every frame
+	cv::Mat grayscale_buffer;
+
+	// For restoring the default power profile
+	LandmarkDetector::FaceModelParameters initial_parameters;
+	int initial_threads;
+	int profile;
+
+	// The AUs and the gaze are only computed on every n-th frame, the last gaze is reported in between
+	int analyse_every;
+	long long frame_count;
+	GazeAnalysis::GazeResult last_gaze;
+};
+
+static thread_local std::string last_error;
+
+static int Fail(const std::string& message)
+{
+	last_error = message;
+	return -1;
+}
+
+// Wrapping the caller owned buffer, only the formats OpenFace does not use directly are converted
+static bool WrapImage(const of_image& image, cv::Mat& wrapped)
+{
+	if (image.data == NULL || image.width <= 0 || image.height <= 0)
+	{
+		return false;
+	}
+
+	void* data = const_cast<unsigned char*>(image.data);
+	switch (image.format)
+	{
+	case OF_PIXEL_GRAY8:
+		wrapped = cv::Mat(image.height, image.width, CV_8UC1, data, image.stride);
+		return true;
+	case OF_PIXEL_BGR24:
+		wrapped = cv::Mat(image.height, image.width, CV_8UC3, data, image.stride);
+		return true;
+	case OF_PIXEL_RGB24:
+		cv::cvtColor(cv::Mat(image.height, image.width, CV_8UC3, data, image.stride), wrapped, cv::COLOR_RGB2BGR);
+		return true;
+	case OF_PIXEL_BGRA32:
+		cv::cvtColor(cv::Mat(image.height, image.width, CV_8UC4, data, image.stride), wrapped, cv::COLOR_BGRA2BGR);
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Writing the AU predictions in the order of the names (the AUs not predicted on this frame are 0)
+static bool CopyAUs(const std::vector<float>& values, const std::vector<std::string>& names, float* out, int length, int& num_written)
+{
+	num_written = 0;
+	if (out == NULL)
+	{
+		return true;
+	}
+	if (length < (int)names.size())
+	{
+		return false;
+	}
+
+	// The values are in the order of the names, the AUs not predicted are 0
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		out[i] = i < values.size() && !std::isnan(values[i]) ? values[i] : 0;
+	}
+	num_written = (int)names.size();
+	return true;
+}
+
+int of_api_version(void)
+{
+	return OPENFACE_C_API_VERSION;
+}
+
+const char* of_last_error(void)
+{
+	return last_error.c_str();
+}
+
+of_tracker* of_tracker_create(int argc, const char** argv, int flags)
+{
+	last_error.clear();
+	try
+	{
+		std::vector<std::string> arguments;
+		for (int i = 0; i < argc; ++i)
+		{
+			arguments.push_back(argv[i] != NULL ? argv[i] : "");
+		}
+		if (arguments.empty())
+		{
+			arguments.push_back("");
+		}
+
+		// The same thread limit as for the executables
+		Utilities::Concurrency::ParseArguments(arguments);
+
+		std::unique_ptr<of_tracker> tracker(new of_tracker(arguments, flags));
+		if (!tracker->face_model.loaded_successfully)
+		{
+			Fail("Could not load the landmark detector from " + tracker->det_parameters.model_location);
+			return NULL;
+		}
+		if ((flags & OF_ENABLE_GAZE) != 0 && !tracker->face_model.eye_model)
+		{
+			Fail("Gaze estimation needs a landmark detector with eye models");
+			return NULL;
+		}
+		return tracker.release();
+	}
+	catch (const std::exception& e)
+	{
+		Fail(e.what());
+		return NULL;
+	}
+}
+
+void of_tracker_destroy(of_tracker* tracker)
+{
+	delete tracker;
+}
+
+void of_tracker_reset(of_tracker* tracker)
+{
+	if (tracker == NULL)
+	{
+		return;
+	}
+	tracker->face_model.Reset();
+	if (tracker->face_analyser)
+	{
+		tracker->face_analyser->Reset();
+	}
+	tracker->frame_count = 0;
+	tracker->last_gaze = GazeAnalysis::GazeResult();
+}
+
+int of_tracker_num_landmarks(const of_tracker* tracker)
+{
+	return tracker != NULL ? tracker->face_model.pdm.NumberOfPoints() : 0;
+}
+
+int of_tracker_num_eye_landmarks(const of_tracker* tracker)
+{
+	return tracker != NULL ? (int)LandmarkDetector::CalculateAllEyeLandmarks(tracker->face_model).size() : 0;
+}
+
+int of_tracker_num_aus(const of_tracker* tracker, int occurence)
+{
+	if (tracker == NULL)
+	{
+		return 0;
+	}
+	return (int)(occurence ? tracker->au_class_names.size() : tracker->au_reg_names.size());
+}
+
+const char* of_tracker_au_name(const of_tracker* tracker, int occurence, int index)
+{
+	if (tracker == NULL)
+	{
+		return NULL;
+	}
+	const std::vector<std::string>& names = occurence ? tracker->au_class_names : tracker->au_reg_names;
+	if (index < 0 || index >= (int)names.size())
+	{
+		return NULL;
+	}
+	return names[index].c_str();
+}
+
+int of_tracker_process(of_tracker* tracker, const of_image* image, const of_camera* camera, double time_stamp, of_frame_result* result,
+	const of_frame_outputs* outputs)
+{
+	last_error.clear();
+	if (tracker == NULL || image == NULL || result == NULL)
+	{
+		return Fail("The tracker, the image and the result have to be given");
+	}
+
+	try
+	{
+		cv::Mat frame;
+		if (!WrapImage(*image, frame))
+		{
+			return Fail("Unsupported or empty image");
+		}
+
+		// The same defaults as for the sequences
+		float fx = camera != NULL ? camera->fx : 0, fy = camera != NULL ? camera->fy : 0;
+		float cx = camera != NULL ? camera->cx : 0, cy = camera != NULL ? camera->cy : 0;
+		if (cx <= 0 || cy <= 0)
+		{
+			cx = frame.cols / 2.0f;
+			cy = frame.rows / 2.0f;
+		}
+		if (fx <= 0 || fy <= 0)
+		{
+			fx = (500.0f * (frame.cols / 640.0f) + 500.0f * (frame.rows / 480.0f)) / 2.0f;
+			fy = fx;
+		}
+
+		LandmarkDetector::CLNF& face_model = tracker->face_model;
+
+		// The grayscale frames are used as they are (so they never end up in the conversion buffer)
+		cv::Mat grayscale_image = frame;
+		if (frame.channels() != 1)
+		{
+			Utilities::ConvertToGrayscale_8bit(frame, tracker->grayscale_buffer);
+			grayscale_image = tracker->grayscale_buffer;
+		}
+
+		*result = of_frame_result();
+
+		bool success = LandmarkDetector::DetectLandmarksInVideo(frame, face_model, tracker->det_parameters, grayscale_image, time_stamp);
+		result->success = success ? 1 : 0;
+		result->confidence = (float)face_model.detection_certainty;
+
+		cv::Vec6f pose = LandmarkDetector::GetPose(face_model, fx, fy, cx, cy);
+		for (int i = 0; i < 6; ++i)
+		{
+			result->pose[i] = pose[i];
+		}
+
+		of_frame_outputs no_outputs = of_frame_outputs();
+		const of_frame_outputs& out = outputs != NULL ? *outputs : no_outputs;
+
+		// The AUs and the gaze are computed on the first frame and then on every analyse_every-th one
+		bool analyse = tracker->frame_count % std::max(1, tracker->analyse_every) == 0;
+		tracker->frame_count++;
+
+		if ((tracker->flags & OF_ENABLE_GAZE) != 0 || out.eye_landmarks != NULL)
+		{
+			GazeAnalysis::GazeResult gaze;
+			bool estimate_gaze = success && face_model.eye_model && (tracker->flags & OF_ENABLE_GAZE) != 0;
+			GazeAnalysis::EstimateGazeBoth(face_model, gaze, fx, fy, cx, cy, estimate_gaze && analyse);
+			if (estimate_gaze && !analyse)
+			{
+				gaze.gaze_direction0 = tracker->last_gaze.gaze_direction0;
+				gaze.gaze_direction1 = tracker->last_gaze.gaze_direction1;
+				gaze.gaze_angle = tracker->last_gaze.gaze_angle;
+			}
+			else
+			{
+				tracker->last_gaze = gaze;
+			}
+
+			result->gaze_0[0] = gaze.gaze_direction0.x; result->gaze_0[1] = gaze.gaze_direction0.y; result->gaze_0[2] = gaze.gaze_direction0.z;
+			result->gaze_1[0] = gaze.gaze_direction1.x; result->gaze_1[1] = gaze.gaze_direction1.y; result->gaze_1[2] = gaze.gaze_direction1.z;
+			result->gaze_angle[0] = gaze.gaze_angle[0]; result->gaze_angle[1] = gaze.gaze_angle[1];
+
+			if (out.eye_landmarks != NULL)
+			{
+				if (out.eye_landmarks_length < 2 * (int)gaze.eye_landmarks_2D.size())
+				{
+					return Fail("The eye landmark array is too short");
+				}
+				for (size_t i = 0; i < gaze.eye_landmarks_2D.size(); ++i)
+				{
+					out.eye_landmarks[2 * i] = gaze.eye_landmarks_2D[i].x;
+					out.eye_landmarks[2 * i + 1] = gaze.eye_landmarks_2D[i].y;
+				}
+				result->num_eye_landmarks = (int)gaze.eye_landmarks_2D.size();
+			}
+		}
+
+		if (out.landmarks != NULL)
+		{
+			int n = face_model.pdm.NumberOfPoints();
+			if (out.landmarks_length < 2 * n)
+			{
+				return Fail("The landmark array is too short");
+			}
+			for (int i = 0; i < n; ++i)
+			{
+				out.landmarks[2 * i] = face_model.detected_landmarks.at<float>(i);
+				out.landmarks[2 * i + 1] = face_model.detected_landmarks.at<float>(i + n);
+			}
+			result->num_landmarks = n;
+		}
+
+		if (tracker->face_analyser)
+		{
+			cv::Mat colour_frame = frame;
+			if (frame.channels() == 1)
+			{
+				cv::cvtColor(frame, colour_frame, cv::COLOR_GRAY2BGR);
+			}
+			if (analyse)
+			{
+				tracker->face_analyser->AddNextFrame(colour_frame, face_model.detected_landmarks, success, time_stamp, true);
+			}
+
+			if (!CopyAUs(tracker->face_analyser->GetCurrentAURegValues(), tracker->au_reg_names, out.au_intensities, out.au_intensities_length, result->num_au_intensities) ||
+				!CopyAUs(tracker->face_analyser->GetCurrentAUClassValues(), tracker->au_class_names, out.au_occurences, out.au_occurences_length, result->num_au_occurences))
+			{
+				return Fail("The AU array is too short");
+			}
+		}
+
+		return 0;
+	}
+	catch (const std::exception& e)
+	{
+		return Fail(e.what());
+	}
+}
+
+int of_tracker_set_power_profile(of_tracker* tracker, int profile)
+{
+	last_error.clear();
+	if (tracker == NULL)
+	{
+		return Fail("The tracker has to be given");
+	}
+
+	if (profile == OF_POWER_DEFAULT)
+	{
+		tracker->det_parameters = tracker->initial_parameters;
+		Utilities::Concurrency::SetNumThreads(tracker->initial_threads);
+		tracker->analyse_every = 1;
+	}
+	else if (profile == OF_POWER_LOW)
+	{
+		tracker->det_parameters.ApplyPreset("low_power");
+		Utilities::Concurrency::SetNumThreads(tracker->det_parameters.max_threads);
+		tracker->analyse_every = 3;
+	}
+	else
+	{
+		return Fail("Unknown power profile");
+	}
+	tracker->profile = profile;
+	return 0;
+}
+
+int of_tracker_get_power_settings(const of_tracker* tracker, of_power_settings* settings)
+{
+	last_error.clear();
+	if (tracker == NULL || settings == NULL)
+	{
+		return Fail("The tracker and the settings have to be given");
+	}
+
+	const LandmarkDetector::FaceModelParameters& params = tracker->det_parameters;
+	settings->profile = tracker->profile;
+	settings->max_threads = Utilities::Concurrency::GetNumThreads();
+	settings->full_fit_every = params.full_fit_every;
+	settings->validate_every = params.validate_every;
+	settings->reinit_every = params.reinit_video_every;
+	settings->face_detector = (int)params.curr_face_detector;
+	settings->async_face_detection = params.async_face_detection ? 1 : 0;
+	settings->quantised_patch_experts = params.quantised_patch_experts ? 1 : 0;
+	settings->analyse_every = tracker->analyse_every;
+	return 0;
+}
+
+int of_tracker_set_power_settings(of_tracker* tracker, const of_power_settings* settings)
+{
+	last_error.clear();
+	if (tracker == NULL || settings == NULL)
+	{
+		return Fail("The tracker and the settings have to be given");
+	}
+	if (settings->face_detector < LandmarkDetector::FaceModelParameters::HAAR_DETECTOR || settings->face_detector > LandmarkDetector::FaceModelParameters::MTCNN_DETECTOR)
+	{
+		return Fail("Unknown face detector");
+	}
+
+	LandmarkDetector::FaceModelParameters& params = tracker->det_parameters;
+	params.full_fit_every = std::max(1, settings->full_fit_every);
+	params.validate_every = std::max(1, settings->validate_every);
+	params.reinit_video_every = settings->reinit_every;
+	params.curr_face_detector = (LandmarkDetector::FaceModelParameters::FaceDetector)settings->face_detector;
+	params.async_face_detection = settings->async_face_detection != 0;
+	params.quantised_patch_experts = settings->quantised_patch_experts != 0;
+	params.max_threads = std::max(0, settings->max_threads);
+	Utilities::Concurrency::SetNumThreads(params.max_threads);
+	tracker->analyse_every = std::max(1, settings->analyse_every);
+	tracker->profile = settings->profile;
+	return 0;
+}
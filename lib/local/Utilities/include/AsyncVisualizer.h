@@ -0,0 +1,119 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef ASYNC_VISUALIZER_H
+#define ASYNC_VISUALIZER_H
+
+// System includes
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+#include "Visualizer.h"
+
+namespace Utilities
+{
+
+	//===========================================================================
+	/**
+	Showing the visualizations from a UI thread of its own, so that drawing and displaying do not hold up the processing. The observations of
+	a frame are copied and handed over on Submit, the UI thread renders the latest submitted frame at its own pace and frames submitted while
+	it is busy replace each other (only the latest one is shown). All of the windows are owned by the UI thread, so nothing else should use
+	OpenCV highgui while the visualizer is running
+	*/
+	class AsyncVisualizer {
+
+	public:
+
+		AsyncVisualizer(bool vis_track, bool vis_hog, bool vis_align, bool vis_aus, double visualisation_boundary = 0.4, int line_type = cv::LINE_AA);
+
+		~AsyncVisualizer();
+
+		// The same observations as the Visualizer, they are collected for the frame being built and only shown once submitted
+		void SetImage(const cv::Mat& canvas, float fx, float fy, float cx, float cy);
+		void SetObservationLandmarks(const cv::Mat_<float>& landmarks_2D, double confidence, const cv::Mat_<int>& visibilities = cv::Mat_<int>());
+		void SetObservationPose(const cv::Vec6f& pose, double confidence);
+		void SetObservationActionUnits(const std::vector<std::pair<std::string, double> >& au_intensities, const std::vector<std::pair<std::string, double> >& au_occurences);
+		void SetObservationActionUnits(const std::vector<std::string>& au_intensity_names, const std::vector<float>& au_intensities,
+			const std::vector<std::string>& au_occurence_names, const std::vector<float>& au_occurences);
+		void SetObservationGaze(const cv::Point3f& gazeDirection0, const cv::Point3f& gazeDirection1, const std::vector<cv::Point2f>& eye_landmarks, const std::vector<cv::Point3f>& eye_landmarks3d, double confidence);
+		void SetObservationFaceAlign(const cv::Mat& aligned_face);
+		void SetObservationHOG(const cv::Mat_<float>& hog_descriptor, int num_cols, int num_rows);
+		void SetFps(double fps);
+
+		// Handing the collected frame over to the UI thread, replacing a frame that has not been shown yet
+		void Submit();
+
+		// The last key pressed in one of the windows ('\0' if none), the key is only returned once
+		char GetKey();
+
+		// The number of submitted frames that were replaced before they could be shown
+		size_t GetNumDropped() const { return num_dropped; }
+
+	private:
+
+		// Blocking copy and move, as the UI thread refers to the visualizer
+		AsyncVisualizer & operator= (const AsyncVisualizer& other);
+		AsyncVisualizer(const AsyncVisualizer& other);
+
+		void RenderingThread();
+
+		// The visualizer is only used by the UI thread (what it visualizes does not change after construction)
+		Visualizer visualizer;
+
+		// The frame being collected and the one waiting to be shown, as the calls to replay on the visualizer
+		typedef std::vector<std::function<void(Visualizer&)> > Frame;
+		Frame building;
+		Frame pending;
+		bool has_pending;
+		bool stopping;
+
+		std::atomic<char> last_key;
+		std::atomic<size_t> num_dropped;
+
+		std::mutex frame_mutex;
+		std::condition_variable frame_ready;
+		std::thread ui_thread;
+	};
+}
+#endif // ASYNC_VISUALIZER_H
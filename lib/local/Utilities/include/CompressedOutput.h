@@ -0,0 +1,123 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef COMPRESSED_OUTPUT_H
+#define COMPRESSED_OUTPUT_H
+
+// System includes
+#include <fstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "tbb/concurrent_queue.h"
+
+namespace Utilities
+{
+	// The streaming compression of the outputs (-compress_outputs zstd|gzip), zstd needs to be compiled in with OPENFACE_ZSTD and gzip
+	// with OPENFACE_ZLIB
+	enum OutputCompression { COMPRESSION_NONE, COMPRESSION_GZIP, COMPRESSION_ZSTD };
+
+	// From the name of the compression, none for unknown names
+	OutputCompression ParseOutputCompression(const std::string& name);
+
+	bool IsCompressionAvailable(OutputCompression compression);
+
+	// The extension added to the compressed files (.gz or .zst)
+	std::string CompressionExtension(OutputCompression compression);
+
+	// If the file has the extension of a compressed output
+	bool IsCompressedOutput(const std::string& filename);
+
+	//===========================================================================
+	/**
+	A file written as independently compressed blocks of whole frames, every block is a complete gzip member or zstd frame, so the file is a
+	valid stream for the standard tools (zcat, zstdcat) and can be followed while it is written. The first frame and the offset of every block
+	are listed in <file>.idx (a line "first_frame offset" per block) so that readers can seek to a frame without decompressing the blocks before it.
+
+	The blocks are either compressed on the calling thread (WriteBlock, for recorders that already write on a thread of their own), or handed
+	over to a background thread of the file (PushBlock)
+	*/
+	class CompressedOutputFile {
+
+	public:
+
+		CompressedOutputFile() : compression(COMPRESSION_NONE), level(0), offset(0), context(0) {}
+
+		~CompressedOutputFile();
+
+		// The level of 0 uses the default level of the compression
+		bool Open(const std::string& filename, OutputCompression compression, int level = 0);
+
+		bool IsOpen() const { return file.is_open(); }
+
+		// Compressing and writing a block, the frames of the block start at first_frame (-1 for blocks without frames, e.g. a header, which are
+		// not indexed)
+		bool WriteBlock(const char* data, size_t size, long long first_frame);
+
+		// Handing over a block to the background thread, blocks if the thread is behind by too many blocks
+		void PushBlock(std::string&& block, long long first_frame);
+
+		// Writing out the pushed blocks and closing the file
+		void Close();
+
+	private:
+
+		// Blocking copy and move, as it doesn't make sense to write to the same file twice
+		CompressedOutputFile & operator= (const CompressedOutputFile& other);
+		CompressedOutputFile(const CompressedOutputFile& other);
+
+		bool Compress(const char* data, size_t size);
+
+		void WritingThread();
+
+		std::ofstream file;
+		std::ofstream index_file;
+		OutputCompression compression;
+		int level;
+		long long offset;
+
+		// The output of the compression, reused across the blocks
+		std::vector<char> compressed;
+
+		// The zstd compression context, reused across the blocks
+		void* context;
+
+		const int BLOCK_QUEUE_CAPACITY = 16;
+		tbb::concurrent_bounded_queue<std::pair<long long, std::string> > block_queue;
+		std::thread writing_thread;
+	};
+}
+#endif // COMPRESSED_OUTPUT_H
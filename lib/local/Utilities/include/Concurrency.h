@@ -0,0 +1,300 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef CONCURRENCY_H
+#define CONCURRENCY_H
+
+// A single place for configuring the threading of OpenFace. All of the parallel work (the patch expert responses, face detection, multiple
+// hypotheses and sequences) goes through TBB, which can be limited to a number of threads for the whole process, or be run in an arena
+// supplied by an embedding application. The capture and recording I/O runs on its own threads outside of TBB, and BLAS is kept single
+// threaded by the model readers as it is only ever called from within the parallel regions.
+// Inside containers the number of cores of the host is not what the process gets, so unless -threads is specified the thread limit follows
+// the CPU quota (and affinity) of the cgroup, and the byte limits of the I/O queues are kept within a share of its memory limit.
+// It is header only, so that it can be used by all of the libraries without adding link dependencies between them.
+//
+// Usage:
+//	Utilities::Concurrency::ParseArguments(arguments);						// -threads <n>, or SetNumThreads(n)
+//	Utilities::Concurrency::SetArena(&my_arena);							// for embedders, before any processing
+//	Utilities::Concurrency::Execute([&] { ... });							// work started on threads OpenFace creates itself
+
+// System includes
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+// global_control is a preview feature in the older versions of TBB
+#ifndef TBB_PREVIEW_GLOBAL_CONTROL
+#define TBB_PREVIEW_GLOBAL_CONTROL 1
+#endif
+#include <tbb/global_control.h>
+#include <tbb/task_arena.h>
+
+#include "Metrics.h"
+
+namespace Utilities
+{
+namespace Concurrency
+{
+	struct ConcurrencyState
+	{
+		ConcurrencyState() : num_threads(0), container_default(false), arena(nullptr) {}
+
+		std::mutex state_mutex;
+		int num_threads;
+
+		// Was the thread limit taken from the container limits rather than set explicitly
+		bool container_default;
+		std::unique_ptr<tbb::global_control> thread_limit;
+
+		// Not owned, supplied by the embedding application
+		tbb::task_arena* arena;
+	};
+
+	inline ConcurrencyState& GetState()
+	{
+		static ConcurrencyState state;
+		return state;
+	}
+
+	// Limiting all of the parallel work of the process to num_threads threads (including the calling one), 0 for the TBB default of all of the cores
+	inline void SetNumThreads(int num_threads)
+	{
+		ConcurrencyState& state = GetState();
+		std::lock_guard<std::mutex> lock(state.state_mutex);
+
+		state.thread_limit.reset();
+		state.num_threads = num_threads > 0 ? num_threads : 0;
+		state.container_default = false;
+		if (state.num_threads > 0)
+		{
+			state.thread_limit.reset(new tbb::global_control(tbb::global_control::max_allowed_parallelism, (size_t)state.num_threads));
+		}
+	}
+
+	// The configured number of threads, 0 if not limited
+	inline int GetNumThreads()
+	{
+		ConcurrencyState& state = GetState();
+		std::lock_guard<std::mutex> lock(state.state_mutex);
+		return state.num_threads;
+	}
+
+	// Is the thread limit only the container default, which the more restrictive settings (e.g. of a power profile) can still lower
+	inline bool IsContainerDefault()
+	{
+		ConcurrencyState& state = GetState();
+		std::lock_guard<std::mutex> lock(state.state_mutex);
+		return state.container_default;
+	}
+
+	// The resources of the cgroup the process runs in, 0 where not limited
+	struct ContainerLimits
+	{
+		ContainerLimits() : cpus(0), affinity_cores(0), memory_bytes(0) {}
+
+		// The CPU quota in cores (can be fractional) and the number of cores the process is allowed to run on
+		double cpus;
+		int affinity_cores;
+		int64_t memory_bytes;
+	};
+
+	// Reading the limits of cgroup v2 (cpu.max, memory.max), falling back to the ones of cgroup v1 (cpu.cfs_quota_us, memory.limit_in_bytes)
+	inline ContainerLimits ReadContainerLimits()
+	{
+		ContainerLimits limits;
+
+#ifdef __linux__
+		cpu_set_t cpu_set;
+		CPU_ZERO(&cpu_set);
+		if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0)
+		{
+			limits.affinity_cores = CPU_COUNT(&cpu_set);
+		}
+
+		std::ifstream cpu_max("/sys/fs/cgroup/cpu.max");
+		std::string quota;
+		double period = 0;
+		if (cpu_max >> quota >> period)
+		{
+			if (quota != "max" && period > 0)
+				limits.cpus = atof(quota.c_str()) / period;
+		}
+		else
+		{
+			std::ifstream cfs_quota("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+			std::ifstream cfs_period("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+			double quota_us = 0;
+			if (cfs_quota >> quota_us && cfs_period >> period && quota_us > 0 && period > 0)
+				limits.cpus = quota_us / period;
+		}
+
+		// No limit is either "max" or (in cgroup v1) a value close to the largest one
+		std::ifstream memory_max("/sys/fs/cgroup/memory.max");
+		std::string memory;
+		if (!(memory_max >> memory))
+		{
+			std::ifstream memory_limit("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+			memory_limit >> memory;
+		}
+		if (!memory.empty() && memory != "max")
+		{
+			long long bytes = atoll(memory.c_str());
+			if (bytes > 0 && bytes < (1LL << 60))
+				limits.memory_bytes = bytes;
+		}
+#endif
+		return limits;
+	}
+
+	inline const ContainerLimits& GetContainerLimits()
+	{
+		static ContainerLimits limits = ReadContainerLimits();
+		return limits;
+	}
+
+	// The number of threads the container allows for, the CPU quota rounded up and the allowed cores, 0 if neither is below the cores of the machine
+	inline int GetContainerThreads()
+	{
+		const ContainerLimits& limits = GetContainerLimits();
+		int cores = (int)std::thread::hardware_concurrency();
+		int threads = cores;
+		if (limits.affinity_cores > 0)
+			threads = std::min(threads, limits.affinity_cores);
+		if (limits.cpus > 0)
+			threads = std::min(threads, std::max(1, (int)std::ceil(limits.cpus - 0.01)));
+		return threads > 0 && threads < cores ? threads : 0;
+	}
+
+	// The byte limit of an I/O queue (capture, writing), at most a sixteenth of the memory limit of the container so that all of them together
+	// leave most of it to the models and the processing
+	inline size_t LimitQueueBytes(size_t default_bytes)
+	{
+		const ContainerLimits& limits = GetContainerLimits();
+		if (limits.memory_bytes > 0)
+			return std::min(default_bytes, (size_t)(limits.memory_bytes / 16));
+		return default_bytes;
+	}
+
+	// Limiting the threads to the container unless they were set explicitly, and reporting the limits in the metrics
+	inline void ApplyContainerLimits()
+	{
+		const ContainerLimits& limits = GetContainerLimits();
+		int threads = GetContainerThreads();
+
+		ConcurrencyState& state = GetState();
+		{
+			std::lock_guard<std::mutex> lock(state.state_mutex);
+			if (state.num_threads == 0 && threads > 0)
+			{
+				state.num_threads = threads;
+				state.container_default = true;
+				state.thread_limit.reset(new tbb::global_control(tbb::global_control::max_allowed_parallelism, (size_t)threads));
+			}
+		}
+
+		METRICS_GAUGE_SET("openface_container_cpu_limit_millicores", "The CPU quota of the container (0 if not limited)", std::llround(limits.cpus * 1000));
+		METRICS_GAUGE_SET("openface_container_memory_limit_bytes", "The memory limit of the container (0 if not limited)", limits.memory_bytes);
+		METRICS_GAUGE_SET("openface_threads", "The limit of the threads doing the parallel work (0 if not limited)", GetNumThreads());
+		METRICS_GAUGE_SET("openface_queue_limit_bytes", "The byte limit of every I/O queue within the memory limit (0 if not limited)",
+			limits.memory_bytes > 0 ? limits.memory_bytes / 16 : 0);
+	}
+
+	// Running the parallel work of the threads OpenFace creates (e.g. the background face detection) in an arena of the embedding application,
+	// which has to outlive its use, nullptr for the default arena. Work called from the threads of the application already runs in their arenas
+	inline void SetArena(tbb::task_arena* arena)
+	{
+		ConcurrencyState& state = GetState();
+		std::lock_guard<std::mutex> lock(state.state_mutex);
+		state.arena = arena;
+	}
+
+	inline tbb::task_arena* GetArena()
+	{
+		ConcurrencyState& state = GetState();
+		std::lock_guard<std::mutex> lock(state.state_mutex);
+		return state.arena;
+	}
+
+	// Running a function in the configured arena (or directly without one)
+	template<typename F>
+	void Execute(const F& function)
+	{
+		tbb::task_arena* arena = GetArena();
+		if (arena)
+		{
+			arena->execute(function);
+		}
+		else
+		{
+			function();
+		}
+	}
+
+	// Reading -threads <n> from the command line arguments (the used arguments are removed), returns if it was specified. Without it the
+	// container limits are applied
+	inline bool ParseArguments(std::vector<std::string>& arguments)
+	{
+		for (size_t i = 0; i + 1 < arguments.size(); ++i)
+		{
+			if (arguments[i].compare("-threads") == 0)
+			{
+				int num_threads = 0;
+				std::stringstream data(arguments[i + 1]);
+				data >> num_threads;
+				arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+
+				SetNumThreads(num_threads);
+				ApplyContainerLimits();
+				return true;
+			}
+		}
+		ApplyContainerLimits();
+		return false;
+	}
+}
+}
+
+#endif // CONCURRENCY_H
@@ -0,0 +1,102 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef DETECTION_CACHE_H
+#define DETECTION_CACHE_H
+
+// System includes
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+namespace Utilities
+{
+
+	//===========================================================================
+	/**
+	A persistent cache of the face detections of images, keyed by a hash of the image content and by the detector used, so that reprocessing
+	the same images (e.g. with different landmark or AU settings) can skip the face detection. The cache is a single text file, with a line
+	per image "hash detector num_faces" followed by "min_x min_y width height num_keypoints x y ..." per face, read into an index on opening
+	and appended to as new images are detected
+	*/
+	class DetectionCache {
+
+	public:
+
+		DetectionCache() {}
+
+		// Reading in the detections already in the file (if it exists) and opening it for appending the new ones
+		bool Open(const std::string& filename);
+
+		void Close();
+
+		bool isOpen() const { return cache_file.is_open(); }
+
+		// A hash of the size, type and pixels of the image
+		static uint64_t ImageHash(const cv::Mat& image);
+
+		// Looking up the detections of an image by a detector, false if they are not in the cache
+		bool Find(uint64_t image_hash, int detector, std::vector<cv::Rect_<float> >& detections, std::vector<std::vector<cv::Point2f> >& keypoints) const;
+
+		// Adding the detections of an image (the keypoints can be empty, otherwise there are keypoints for every detection), they are written out straight away
+		void Add(uint64_t image_hash, int detector, const std::vector<cv::Rect_<float> >& detections, const std::vector<std::vector<cv::Point2f> >& keypoints);
+
+		size_t Size() const { return entries.size(); }
+
+	private:
+
+		// Blocking copy and move, as the file is kept open
+		DetectionCache & operator= (const DetectionCache& other);
+		DetectionCache & operator= (const DetectionCache&& other);
+		DetectionCache(const DetectionCache&& other);
+		DetectionCache(const DetectionCache& other);
+
+		struct Entry
+		{
+			std::vector<cv::Rect_<float> > detections;
+			std::vector<std::vector<cv::Point2f> > keypoints;
+		};
+
+		// (image hash, detector) -> detections
+		std::map<std::pair<uint64_t, int>, Entry> entries;
+
+		std::ofstream cache_file;
+	};
+}
+#endif // DETECTION_CACHE_H
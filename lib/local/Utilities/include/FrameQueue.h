@@ -0,0 +1,427 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+// System includes
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+namespace Utilities
+{
+
+	// The memory taken up by the pixels of a matrix
+	inline size_t MatBytes(const cv::Mat& mat)
+	{
+		return mat.empty() ? 0 : mat.total() * mat.elemSize();
+	}
+
+	//===========================================================================
+	/**
+	A thread safe queue between a producer (capture, processing) and a consumer (processing, writing) thread, bounded by the memory of the
+	queued frames rather than by their number. When full it either blocks the producer (for files, where no frame should be lost) or drops
+	the oldest frame (for live sources, where keeping up matters more). A single element is always accepted, even if it is larger than
+	the capacity, and elements of size zero (e.g. the empty frames used for signalling the end) never block.
+	*/
+	template <typename T>
+	class FrameQueue {
+
+	public:
+
+		enum FullPolicy { BLOCK, DROP_OLDEST };
+
+		FrameQueue(size_t capacity_bytes = 0, FullPolicy policy = BLOCK) : capacity_bytes(capacity_bytes), queued_bytes(0), policy(policy) {}
+
+		// A capacity of zero means the queue is unbounded
+		void SetCapacity(size_t capacity_bytes)
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			this->capacity_bytes = capacity_bytes;
+			not_full.notify_all();
+		}
+
+		void SetPolicy(FullPolicy policy)
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			this->policy = policy;
+			not_full.notify_all();
+		}
+
+		// Adding an element taking up the given number of bytes, returns the number of elements dropped to make space for it
+		size_t Push(const T& element, size_t bytes)
+		{
+			size_t dropped = 0;
+			{
+				std::unique_lock<std::mutex> lock(queue_mutex);
+				if (policy == BLOCK)
+				{
+					not_full.wait(lock, [&] { return !Exceeds(bytes); });
+				}
+				else
+				{
+					while (Exceeds(bytes))
+					{
+						queued_bytes -= elements.front().second;
+						elements.pop_front();
+						dropped++;
+					}
+				}
+				elements.push_back(std::make_pair(element, bytes));
+				queued_bytes += bytes;
+			}
+			not_empty.notify_one();
+			return dropped;
+		}
+
+		// Blocks until an element is available
+		void Pop(T& element)
+		{
+			{
+				std::unique_lock<std::mutex> lock(queue_mutex);
+				not_empty.wait(lock, [&] { return !elements.empty(); });
+				TakeFront(element);
+			}
+			not_full.notify_all();
+		}
+
+		bool TryPop(T& element)
+		{
+			{
+				std::lock_guard<std::mutex> lock(queue_mutex);
+				if (elements.empty())
+					return false;
+				TakeFront(element);
+			}
+			not_full.notify_all();
+			return true;
+		}
+
+		void Clear()
+		{
+			{
+				std::lock_guard<std::mutex> lock(queue_mutex);
+				elements.clear();
+				queued_bytes = 0;
+			}
+			not_full.notify_all();
+		}
+
+		size_t Size()
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			return elements.size();
+		}
+
+		size_t Bytes()
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			return queued_bytes;
+		}
+
+		bool Empty() { return Size() == 0; }
+
+		// Would pushing an element of this size have to wait (or drop) at the moment
+		bool IsFull(size_t bytes)
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			return Exceeds(bytes);
+		}
+
+	private:
+
+		// Blocking copy and move, as the queue is shared between threads
+		FrameQueue & operator= (const FrameQueue& other);
+		FrameQueue(const FrameQueue& other);
+
+		bool Exceeds(size_t bytes) const
+		{
+			return capacity_bytes > 0 && bytes > 0 && !elements.empty() && queued_bytes + bytes > capacity_bytes;
+		}
+
+		void TakeFront(T& element)
+		{
+			element = elements.front().first;
+			queued_bytes -= elements.front().second;
+			elements.pop_front();
+		}
+
+		size_t capacity_bytes;
+		size_t queued_bytes;
+		FullPolicy policy;
+
+		std::mutex queue_mutex;
+		std::condition_variable not_empty;
+		std::condition_variable not_full;
+		std::deque<std::pair<T, size_t> > elements;
+	};
+
+	//===========================================================================
+	/**
+	A lock free queue between exactly one producer and one consumer thread, with a fixed number of preallocated slots which the elements are
+	moved into and out of (so a cv::Mat is handed over without touching its reference count or allocating). Meant for the fixed thread pairs
+	of the pipeline, where the mutex of a FrameQueue would be taken twice per frame. A full queue makes the producer wait and an empty one
+	makes the consumer wait, by spinning briefly and then sleeping. Once closed neither side waits any more, so that the threads can finish
+	*/
+	template <typename T>
+	class SpscRing {
+
+	public:
+
+		explicit SpscRing(size_t capacity = 2) : slots(capacity < 1 ? 1 : capacity), head(0), tail(0), closed(false) {}
+
+		// Changing the number of slots, discarding the queued elements, only while neither thread uses the queue
+		void Reset(size_t capacity)
+		{
+			slots.assign(capacity < 1 ? 1 : capacity, T());
+			Reset();
+		}
+
+		// Discarding the queued elements and reopening a closed queue, only while neither thread uses the queue
+		void Reset()
+		{
+			for (size_t i = 0; i < slots.size(); ++i)
+			{
+				slots[i] = T();
+			}
+			head.store(0);
+			tail.store(0);
+			closed.store(false);
+		}
+
+		// Adding an element, waits while the queue is full, fails (dropping the element) if the queue is closed while full
+		bool Push(T&& element)
+		{
+			size_t current = head.load(std::memory_order_relaxed);
+			for (int attempt = 0; current - tail.load(std::memory_order_acquire) >= slots.size(); ++attempt)
+			{
+				if (closed.load(std::memory_order_relaxed))
+				{
+					return false;
+				}
+				Backoff(attempt);
+			}
+			slots[current % slots.size()] = std::move(element);
+			head.store(current + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Taking the oldest element, waits while the queue is empty, fails once the queue is closed and empty
+		bool Pop(T& element)
+		{
+			size_t current = tail.load(std::memory_order_relaxed);
+			for (int attempt = 0; current == head.load(std::memory_order_acquire); ++attempt)
+			{
+				if (closed.load(std::memory_order_relaxed))
+				{
+					return false;
+				}
+				Backoff(attempt);
+			}
+			T& slot = slots[current % slots.size()];
+			element = std::move(slot);
+			slot = T();
+			tail.store(current + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Neither side waits any more, e.g. when the consumer stops early
+		void Close()
+		{
+			closed.store(true);
+		}
+
+		size_t Size() const
+		{
+			return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+		}
+
+		bool Full() const { return Size() >= slots.size(); }
+
+		size_t Capacity() const { return slots.size(); }
+
+	private:
+
+		// Blocking copy and move, as the queue is shared between threads
+		SpscRing & operator= (const SpscRing& other);
+		SpscRing(const SpscRing& other);
+
+		// Spinning for the short waits, sleeping for the long ones (e.g. the encoder or the processing being slower)
+		static void Backoff(int attempt)
+		{
+			if (attempt < 64)
+			{
+				std::this_thread::yield();
+			}
+			else
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			}
+		}
+
+		std::vector<T> slots;
+
+		// Kept on separate cache lines, as each is written by a different thread (padded rather than aligned, so that the queue can still be
+		// a member of objects allocated with new)
+		char padding_head[64];
+		std::atomic<size_t> head;
+		char padding_tail[64];
+		std::atomic<size_t> tail;
+		std::atomic<bool> closed;
+	};
+
+	//===========================================================================
+	/**
+	Recycling the frame buffers of a producer, so that it does not allocate a new cv::Mat for every frame. A buffer is handed out again once
+	nothing but the pool references it any more (all of the cv::Mat headers sharing it are gone), the pool keeps at most capacity_bytes of
+	buffers and allocates unpooled ones beyond that.
+	*/
+	class FrameBufferPool {
+
+	public:
+
+		FrameBufferPool(size_t capacity_bytes = 0) : capacity_bytes(capacity_bytes), pooled_bytes(0) {}
+
+		void SetCapacity(size_t capacity_bytes)
+		{
+			std::lock_guard<std::mutex> lock(pool_mutex);
+			this->capacity_bytes = capacity_bytes;
+		}
+
+		// A buffer of the given size and type, the contents are undefined
+		cv::Mat Acquire(int rows, int cols, int type)
+		{
+			std::lock_guard<std::mutex> lock(pool_mutex);
+			for (size_t i = 0; i < buffers.size(); ++i)
+			{
+				cv::Mat& buffer = buffers[i];
+				if (buffer.u && buffer.u->refcount == 1 && buffer.rows == rows && buffer.cols == cols && buffer.type() == type)
+				{
+					return buffer;
+				}
+			}
+
+			// Make space by releasing any free buffers of a different size
+			cv::Mat buffer(rows, cols, type);
+			size_t bytes = MatBytes(buffer);
+			for (size_t i = 0; i < buffers.size() && pooled_bytes + bytes > capacity_bytes;)
+			{
+				if (buffers[i].u && buffers[i].u->refcount == 1)
+				{
+					pooled_bytes -= MatBytes(buffers[i]);
+					buffers.erase(buffers.begin() + i);
+				}
+				else
+				{
+					++i;
+				}
+			}
+
+			if (pooled_bytes + bytes <= capacity_bytes)
+			{
+				buffers.push_back(buffer);
+				pooled_bytes += bytes;
+			}
+			return buffer;
+		}
+
+		void Clear()
+		{
+			std::lock_guard<std::mutex> lock(pool_mutex);
+			buffers.clear();
+			pooled_bytes = 0;
+		}
+
+		// Allocating up to count buffers of the given size and type up front (as many as fit in the capacity) and writing to all of their pages, so
+		// that the producer neither allocates nor faults in new pages once running, returns the number of buffers pooled
+		size_t Prefault(int rows, int cols, int type, size_t count)
+		{
+			// All of them are held at once, so that each Acquire has to hand out a different buffer
+			std::vector<cv::Mat> prefaulted;
+			for (size_t i = 0; i < count; ++i)
+			{
+				cv::Mat buffer = Acquire(rows, cols, type);
+				buffer.setTo(cv::Scalar::all(0));
+				prefaulted.push_back(buffer);
+			}
+
+			std::lock_guard<std::mutex> lock(pool_mutex);
+			size_t pooled = 0;
+			for (size_t i = 0; i < prefaulted.size(); ++i)
+			{
+				for (size_t j = 0; j < buffers.size(); ++j)
+				{
+					pooled += buffers[j].u == prefaulted[i].u ? 1 : 0;
+				}
+			}
+			return pooled;
+		}
+
+		// The memory of the pooled buffers that are not in use at the moment (the ones in use are counted by whoever holds them)
+		size_t FreeBytes()
+		{
+			std::lock_guard<std::mutex> lock(pool_mutex);
+			size_t bytes = 0;
+			for (size_t i = 0; i < buffers.size(); ++i)
+			{
+				bytes += buffers[i].u && buffers[i].u->refcount == 1 ? MatBytes(buffers[i]) : 0;
+			}
+			return bytes;
+		}
+
+	private:
+
+		// Blocking copy and move, the buffers are shared with the consumers
+		FrameBufferPool & operator= (const FrameBufferPool& other);
+		FrameBufferPool(const FrameBufferPool& other);
+
+		size_t capacity_bytes;
+		size_t pooled_bytes;
+
+		std::mutex pool_mutex;
+		std::vector<cv::Mat> buffers;
+	};
+
+}
+
+#endif // FRAME_QUEUE_H
@@ -43,6 +43,8 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
+#include "ImagePrefetcher.h"
+
 namespace Utilities
 {
 
@@ -55,19 +57,23 @@ namespace Utilities
 	public:
 
 		// Default constructor
-		ImageCapture() {};
+		ImageCapture() : decode_workers(0) {};
 
 		// Opening based on command line arguments
 		bool Open(std::vector<std::string>& arguments);
 
 		// Direct opening
 
-		// Image sequence in the directory
+		// Image sequence in the directory, the bounding boxes are either in a directory with a .txt file per image, or in a single file with
+		// a line per bounding box in the format "image_name min_x min_y max_x max_y"
 		bool OpenDirectory(std::string directory, std::string bbox_directory="", float fx = -1, float fy = -1, float cx = -1, float cy = -1);
 
 		// Video file
 		bool OpenImageFiles(const std::vector<std::string>& image_files, float fx = -1, float fy = -1, float cx = -1, float cy = -1);
 
+		// Decoding the images ahead of GetNextImage with a number of threads (0 reads them synchronously), needs to be set before opening
+		void SetDecodeWorkers(int decode_workers) { this->decode_workers = decode_workers; }
+
 		// Getting the next frame
 		cv::Mat GetNextImage();
 
@@ -109,6 +115,10 @@ namespace Utilities
 		// Could optionally read the bounding box locations from files (each image could have multiple bounding boxes)
 		std::vector<std::vector<cv::Rect_<float> > > bounding_boxes;
 
+		// Decoding the images ahead of time
+		int decode_workers;
+		ImagePrefetcher prefetcher;
+
 		void SetCameraIntrinsics(float fx, float fy, float cx, float cy);
 
 		bool image_focal_length_set;
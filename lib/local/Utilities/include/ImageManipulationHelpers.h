@@ -81,7 +81,8 @@ namespace Utilities
 			}
 			else if (in.depth() == CV_8U)
 			{
-				out = in.clone();
+				// Copying rather than cloning, so that a recycled output buffer is reused
+				in.copyTo(out);
 			}
 		}
 	}
@@ -0,0 +1,107 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef IMAGE_PREFETCHER_H
+#define IMAGE_PREFETCHER_H
+
+// System includes
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+namespace Utilities
+{
+
+	//===========================================================================
+	/**
+	Decoding a list of image files ahead of the consumer with a number of worker threads. The images are returned in the order of the files
+	no matter which worker finishes first, and at most a fixed number of images (twice the workers) is kept decoded ahead of the consumer
+	*/
+	class ImagePrefetcher {
+
+	public:
+
+		ImagePrefetcher();
+
+		~ImagePrefetcher();
+
+		// Starting to decode the files, optionally also preparing the grayscale images on the workers
+		void Start(const std::vector<std::string>& files, int num_workers, bool convert_to_gray);
+
+		// The next image in file order (empty if it could not be read), blocks until it has been decoded. Returns false once all of the
+		// images have been returned
+		bool Next(cv::Mat& image, cv::Mat_<uchar>& gray_image);
+
+		// Stopping the workers, the images not returned yet are discarded
+		void Stop();
+
+		bool IsRunning() const { return !workers.empty(); }
+
+	private:
+
+		// Blocking copy and move, as the workers refer to the prefetcher
+		ImagePrefetcher & operator= (const ImagePrefetcher& other);
+		ImagePrefetcher(const ImagePrefetcher& other);
+
+		void DecodingWorker();
+
+		// The reorder buffer, the image with index i goes to slot i % slots.size()
+		struct Slot
+		{
+			size_t index;
+			bool ready;
+			cv::Mat image;
+			cv::Mat_<uchar> gray_image;
+		};
+
+		std::vector<std::string> files;
+		std::vector<Slot> slots;
+		bool convert_to_gray;
+
+		size_t next_to_decode;
+		size_t next_to_return;
+		bool stopping;
+
+		std::mutex prefetch_mutex;
+		std::condition_variable slot_ready;
+		std::condition_variable slot_free;
+		std::vector<std::thread> workers;
+	};
+}
+#endif // IMAGE_PREFETCHER_H
@@ -0,0 +1,141 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef JOB_QUEUE_H
+#define JOB_QUEUE_H
+
+// System includes
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Utilities
+{
+	// A job queue kept on shared storage (e.g. an NFS mount visible to all of the nodes), for processing large archives with a coordinator
+	// and any number of workers. The queue is a directory with pending/, claimed/, done/ and failed/ subdirectories holding one small file
+	// per job, and nodes/ holding the progress reported by every worker. A job is claimed by atomically renaming its file from pending/ to
+	// claimed/, so that only one worker gets it without any locking, and the claim is kept alive by touching the file. Claims of workers that
+	// died are returned to pending/ once their lease expires, by the coordinator or by any idle worker, and failed jobs are retried up to a
+	// maximum number of attempts.
+
+	// A unit of work, the arguments (e.g. -f <video>) added to the common arguments of the worker when processing it
+	struct Job
+	{
+		std::string id;
+		std::vector<std::string> arguments;
+		int attempts;
+
+		// The claimed file while the job is being processed
+		std::string claim_file;
+
+		Job() : attempts(0) {}
+	};
+
+	// The progress and throughput reported by a worker node
+	struct NodeStatus
+	{
+		std::string worker_id;
+		int active_jobs;
+		int64_t jobs_done;
+		int64_t jobs_failed;
+		int64_t frames;
+		double fps;
+		// Seconds since the epoch when the status was written
+		int64_t updated;
+
+		NodeStatus() : active_jobs(0), jobs_done(0), jobs_failed(0), frames(0), fps(0.0), updated(0) {}
+	};
+
+	class JobQueue
+	{
+	public:
+
+		JobQueue() {}
+
+		// Opening the queue in a directory, creating it if it does not exist yet
+		bool Open(const std::string& directory);
+
+		const std::string& GetDirectory() const { return directory; }
+
+		// A worker identifier unique across the nodes, the host name and the process id
+		static std::string DefaultWorkerId();
+
+		// Coordinator
+
+		// Adding a job, returns false if a job with the same id is already in the queue
+		bool Submit(const std::string& job_id, const std::vector<std::string>& arguments);
+
+		// Marking that no more jobs will be submitted, the workers finish once the queue has drained
+		void Close();
+
+		// Returning the claims not kept alive for lease_seconds to pending, or to failed once they have been attempted max_attempts times,
+		// returns the number of jobs requeued
+		int RequeueExpired(double lease_seconds, int max_attempts);
+
+		void GetCounts(size_t& pending, size_t& claimed, size_t& done, size_t& failed) const;
+
+		// Nothing left to process, once closed
+		bool IsFinished() const;
+
+		std::vector<NodeStatus> GetNodeStatus() const;
+
+		// Worker
+
+		// Claiming the next pending job, false if there are none
+		bool Claim(const std::string& worker_id, Job& job);
+
+		// Keeping the claim alive, false if the claim was lost (e.g. the lease expired and the job was requeued)
+		bool Heartbeat(const Job& job);
+
+		void Complete(const Job& job);
+
+		// Returning the job to pending for another attempt, or to failed after max_attempts
+		void Fail(const Job& job, int max_attempts);
+
+		void WriteNodeStatus(const NodeStatus& status);
+
+	private:
+
+		bool WriteJobFile(const std::string& filename, const std::vector<std::string>& arguments, int attempts) const;
+		bool ReadJobFile(const std::string& filename, std::vector<std::string>& arguments, int& attempts) const;
+
+		// Moving a claimed job back to pending or to failed, counting the attempt
+		bool Release(const std::string& claim_file, const std::string& job_id, int max_attempts);
+
+		std::string directory;
+
+	};
+
+}
+#endif // JOB_QUEUE_H
@@ -0,0 +1,87 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MAT_ALLOCATION_COUNTER_H
+#define MAT_ALLOCATION_COUNTER_H
+
+// System includes
+#include <atomic>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+namespace Utilities
+{
+
+	//===========================================================================
+	/**
+	A cv::Mat allocator that counts the allocations of matrix memory, otherwise behaving exactly like the default OpenCV allocator.
+	Once installed it is used by every cv::Mat that is not given its own allocator, useful for checking that a code path does not allocate
+	in steady state (e.g. tracking from frame to frame)
+	*/
+	class MatAllocationCounter : public cv::MatAllocator {
+
+	public:
+
+		// The single instance of the counter
+		static MatAllocationCounter& Instance();
+
+		// Making the counter the default cv::Mat allocator, needs to be done before any of the counted work (it is not thread safe)
+		void Install();
+
+		// The number of allocations since the counter was installed
+		size_t GetCount() const { return count.load(); }
+
+		cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, int flags, cv::UMatUsageFlags usageFlags) const;
+		bool allocate(cv::UMatData* data, int accessflags, cv::UMatUsageFlags usageFlags) const;
+		void deallocate(cv::UMatData* data) const;
+
+	private:
+
+		MatAllocationCounter();
+
+		// Blocking copy and move, as there is only a single counter
+		MatAllocationCounter & operator= (const MatAllocationCounter& other);
+		MatAllocationCounter & operator= (const MatAllocationCounter&& other);
+		MatAllocationCounter(const MatAllocationCounter&& other);
+		MatAllocationCounter(const MatAllocationCounter& other);
+
+		// The allocator doing the actual work
+		cv::MatAllocator* std_allocator;
+
+		mutable std::atomic<size_t> count;
+
+	};
+}
+#endif // MAT_ALLOCATION_COUNTER_H
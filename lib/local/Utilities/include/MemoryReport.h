@@ -0,0 +1,246 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MEMORY_REPORT_H
+#define MEMORY_REPORT_H
+
+// Accounting of the memory held by the model components (the PDM, the patch experts per scale and view, the hierarchical models, the validator,
+// the face detectors, the AU models) and by the runtime caches and queues, without a heap profiler. The components add their buffers under
+// slash separated names (e.g. "clnf/patch_experts/cen/scale_0/view_0") through their ReportMemory methods. It is header only, so that it can
+// be used by all of the libraries without adding link dependencies between them.
+//
+// Every matrix buffer is only counted once, by the first component adding it, so the weights shared between copies of a model (e.g. the
+// trackers of MultiFaceTracker) are counted for the model they were copied from and a copy only shows what it costs on top of it.
+
+// System includes
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+namespace Utilities
+{
+
+	//===========================================================================
+	/**
+	The memory of the components, split into owned memory (buffers only referenced by the component), shared memory (matrix buffers also
+	referenced by other matrix headers, e.g. of model copies) and mapped memory (not allocated on the heap, e.g. a memory mapped model bundle
+	or a file backed descriptor store, which the operating system can page out)
+	*/
+	class MemoryReport {
+
+	public:
+
+		enum Kind { OWNED, SHARED, MAPPED };
+
+		struct Entry
+		{
+			std::string component;
+			size_t owned_bytes;
+			size_t shared_bytes;
+			size_t mapped_bytes;
+
+			// The buffers added
+			size_t count;
+
+			size_t Total() const { return owned_bytes + shared_bytes + mapped_bytes; }
+		};
+
+		// A matrix, matrices referring to the data of another matrix (or to external data) that was already added are not counted again
+		void Add(const std::string& component, const cv::Mat& mat)
+		{
+			if (mat.empty())
+			{
+				return;
+			}
+
+			const void* buffer = mat.u ? (const void*)mat.u : (const void*)mat.datastart;
+			if (!buffers.insert(buffer).second)
+			{
+				return;
+			}
+
+			if (mat.u)
+			{
+				AddBytes(component, mat.u->size, mat.u->refcount > 1 ? SHARED : OWNED);
+			}
+			else
+			{
+				AddBytes(component, (size_t)(mat.dataend - mat.datastart), MAPPED);
+			}
+		}
+
+		// The matrices in containers (e.g. the matrices per view per layer)
+		template<typename T>
+		void Add(const std::string& component, const std::vector<T>& elements)
+		{
+			for (size_t i = 0; i < elements.size(); ++i)
+			{
+				Add(component, elements[i]);
+			}
+		}
+
+		template<typename K, typename T>
+		void Add(const std::string& component, const std::map<K, T>& elements)
+		{
+			for (typename std::map<K, T>::const_iterator it = elements.begin(); it != elements.end(); ++it)
+			{
+				Add(component, it->second);
+			}
+		}
+
+		// The elements of a vector of plain values, by its capacity
+		template<typename T>
+		void AddVector(const std::string& component, const std::vector<T>& elements)
+		{
+			AddBytes(component, elements.capacity() * sizeof(T));
+		}
+
+		// Memory not held in matrices
+		void AddBytes(const std::string& component, size_t bytes, Kind kind = OWNED)
+		{
+			std::map<std::string, size_t>::iterator index = entry_index.find(component);
+			if (index == entry_index.end())
+			{
+				Entry entry = { component, 0, 0, 0, 0 };
+				index = entry_index.insert(std::make_pair(component, entries.size())).first;
+				entries.push_back(entry);
+			}
+
+			Entry& entry = entries[index->second];
+			(kind == OWNED ? entry.owned_bytes : kind == SHARED ? entry.shared_bytes : entry.mapped_bytes) += bytes;
+			entry.count++;
+		}
+
+		// The components in the order they were first added
+		const std::vector<Entry>& GetEntries() const { return entries; }
+
+		// The total of the components starting with the prefix (e.g. "clnf/patch_experts"), of all of them by default
+		Entry Total(const std::string& prefix = "") const
+		{
+			Entry total = { prefix, 0, 0, 0, 0 };
+			for (size_t i = 0; i < entries.size(); ++i)
+			{
+				if (entries[i].component.compare(0, prefix.size(), prefix) == 0)
+				{
+					Accumulate(total, entries[i]);
+				}
+			}
+			return total;
+		}
+
+		// Printing the components, followed by the totals of the top level ones (everything before the first slash)
+		void Print(std::ostream& out) const
+		{
+			out << std::left << std::setw(64) << "Component" << std::right << std::setw(12) << "Owned KB" << std::setw(12) << "Shared KB"
+				<< std::setw(12) << "Mapped KB" << std::setw(10) << "Buffers" << std::endl;
+			for (size_t i = 0; i < entries.size(); ++i)
+			{
+				PrintEntry(out, entries[i]);
+			}
+
+			out << std::endl;
+			std::vector<Entry> groups;
+			for (size_t i = 0; i < entries.size(); ++i)
+			{
+				std::string group = entries[i].component.substr(0, entries[i].component.find('/')) + " (total)";
+				size_t g = 0;
+				while (g < groups.size() && groups[g].component != group)
+				{
+					g++;
+				}
+				if (g == groups.size())
+				{
+					Entry total = { group, 0, 0, 0, 0 };
+					groups.push_back(total);
+				}
+				Accumulate(groups[g], entries[i]);
+			}
+			for (size_t g = 0; g < groups.size(); ++g)
+			{
+				PrintEntry(out, groups[g]);
+			}
+			Entry total = Total();
+			total.component = "Total";
+			PrintEntry(out, total);
+		}
+
+		// Writing the components as a CSV file
+		void WriteCSV(std::ostream& out) const
+		{
+			out << "component,owned_bytes,shared_bytes,mapped_bytes,buffers" << std::endl;
+			for (size_t i = 0; i < entries.size(); ++i)
+			{
+				out << entries[i].component << "," << entries[i].owned_bytes << "," << entries[i].shared_bytes << "," << entries[i].mapped_bytes << "," << entries[i].count << std::endl;
+			}
+		}
+
+		// Forgetting the components and the buffers counted (e.g. for reporting again later)
+		void Clear()
+		{
+			entries.clear();
+			entry_index.clear();
+			buffers.clear();
+		}
+
+	private:
+
+		static void Accumulate(Entry& total, const Entry& entry)
+		{
+			total.owned_bytes += entry.owned_bytes;
+			total.shared_bytes += entry.shared_bytes;
+			total.mapped_bytes += entry.mapped_bytes;
+			total.count += entry.count;
+		}
+
+		void PrintEntry(std::ostream& out, const Entry& entry) const
+		{
+			out << std::left << std::setw(64) << entry.component << std::right << std::fixed << std::setprecision(1) << std::setw(12) << entry.owned_bytes / 1024.0
+				<< std::setw(12) << entry.shared_bytes / 1024.0 << std::setw(12) << entry.mapped_bytes / 1024.0 << std::setw(10) << entry.count << std::endl;
+		}
+
+		std::vector<Entry> entries;
+		std::map<std::string, size_t> entry_index;
+
+		// The matrix buffers already counted
+		std::set<const void*> buffers;
+	};
+
+}
+#endif // MEMORY_REPORT_H
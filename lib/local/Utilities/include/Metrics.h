@@ -0,0 +1,342 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef METRICS_H
+#define METRICS_H
+
+// An always-on metrics registry for long running tracking, with counters, gauges and latency histograms that can be read through
+// the C++ API or exported in the Prometheus text exposition format (see MetricsServer for serving it over HTTP). Updating a metric
+// is a couple of relaxed atomic operations, so unlike the tracing it is not compiled out. It is header only, so that it can be
+// used by all of the libraries without adding link dependencies between them.
+//
+// Usage, the registration is done once per call site as the references stay valid for the lifetime of the program:
+//	static Utilities::Metrics::Counter& frames = Utilities::Metrics::GetRegistry().GetCounter("openface_frames_total", "Frames processed");
+//	frames.Increment();
+//	METRICS_LATENCY("openface_stage_latency_seconds{stage=\"landmarks\"}", "Latency of the processing stages");
+
+// System includes
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace Utilities
+{
+namespace Metrics
+{
+	// A monotonically increasing count
+	class Counter
+	{
+	public:
+
+		Counter() : value(0) {}
+
+		void Increment(uint64_t amount = 1) { value.fetch_add(amount, std::memory_order_relaxed); }
+		uint64_t Get() const { return value.load(std::memory_order_relaxed); }
+
+	private:
+
+		Counter(const Counter& other);
+		Counter & operator= (const Counter& other);
+
+		std::atomic<uint64_t> value;
+	};
+
+	// A value that can go up and down, e.g. a queue depth
+	class Gauge
+	{
+	public:
+
+		Gauge() : value(0) {}
+
+		void Set(int64_t new_value) { value.store(new_value, std::memory_order_relaxed); }
+		void Add(int64_t amount) { value.fetch_add(amount, std::memory_order_relaxed); }
+		int64_t Get() const { return value.load(std::memory_order_relaxed); }
+
+	private:
+
+		Gauge(const Gauge& other);
+		Gauge & operator= (const Gauge& other);
+
+		std::atomic<int64_t> value;
+	};
+
+	// Counts of observations in cumulative buckets (the last, implicit, bucket is +Inf) together with their sum
+	class Histogram
+	{
+	public:
+
+		explicit Histogram(const std::vector<double>& upper_bounds) : upper_bounds(upper_bounds), bucket_counts(upper_bounds.size() + 1), count(0), sum(0.0)
+		{
+			for (size_t i = 0; i < bucket_counts.size(); ++i)
+			{
+				bucket_counts[i] = 0;
+			}
+		}
+
+		void Observe(double value)
+		{
+			size_t bucket = 0;
+			while (bucket < upper_bounds.size() && value > upper_bounds[bucket])
+			{
+				bucket++;
+			}
+			bucket_counts[bucket].fetch_add(1, std::memory_order_relaxed);
+			count.fetch_add(1, std::memory_order_relaxed);
+
+			double old_sum = sum.load(std::memory_order_relaxed);
+			while (!sum.compare_exchange_weak(old_sum, old_sum + value, std::memory_order_relaxed))
+			{
+			}
+		}
+
+		const std::vector<double>& GetUpperBounds() const { return upper_bounds; }
+
+		// The number of observations in each (non-cumulative) bucket, the last one being +Inf
+		std::vector<uint64_t> GetBucketCounts() const
+		{
+			std::vector<uint64_t> counts(bucket_counts.size());
+			for (size_t i = 0; i < bucket_counts.size(); ++i)
+			{
+				counts[i] = bucket_counts[i].load(std::memory_order_relaxed);
+			}
+			return counts;
+		}
+
+		uint64_t GetCount() const { return count.load(std::memory_order_relaxed); }
+		double GetSum() const { return sum.load(std::memory_order_relaxed); }
+
+		// Latency buckets in seconds, from 1ms to 10s
+		static std::vector<double> LatencyBuckets()
+		{
+			const double bounds[] = { 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0 };
+			return std::vector<double>(bounds, bounds + sizeof(bounds) / sizeof(bounds[0]));
+		}
+
+	private:
+
+		Histogram(const Histogram& other);
+		Histogram & operator= (const Histogram& other);
+
+		std::vector<double> upper_bounds;
+		std::vector<std::atomic<uint64_t> > bucket_counts;
+		std::atomic<uint64_t> count;
+		std::atomic<double> sum;
+	};
+
+	// Metrics are identified by their full name including the labels, e.g. openface_stage_latency_seconds{stage="face_detection"},
+	// the metrics sharing the name before the labels form a family and have to be of the same type
+	class Registry
+	{
+	public:
+
+		Registry() {}
+
+		Counter& GetCounter(const std::string& name, const std::string& help)
+		{
+			std::lock_guard<std::mutex> lock(registry_mutex);
+			Entry& entry = GetEntry(name, help, "counter");
+			if (!entry.counter)
+				entry.counter.reset(new Counter());
+			return *entry.counter;
+		}
+
+		Gauge& GetGauge(const std::string& name, const std::string& help)
+		{
+			std::lock_guard<std::mutex> lock(registry_mutex);
+			Entry& entry = GetEntry(name, help, "gauge");
+			if (!entry.gauge)
+				entry.gauge.reset(new Gauge());
+			return *entry.gauge;
+		}
+
+		Histogram& GetHistogram(const std::string& name, const std::string& help, const std::vector<double>& upper_bounds = Histogram::LatencyBuckets())
+		{
+			std::lock_guard<std::mutex> lock(registry_mutex);
+			Entry& entry = GetEntry(name, help, "histogram");
+			if (!entry.histogram)
+				entry.histogram.reset(new Histogram(upper_bounds));
+			return *entry.histogram;
+		}
+
+		// All of the registered metrics in the Prometheus text exposition format (version 0.0.4)
+		std::string ExportPrometheus()
+		{
+			std::lock_guard<std::mutex> lock(registry_mutex);
+			std::ostringstream out;
+			out.precision(9);
+
+			// The entries are sorted by name, so the metrics of a family are next to each other
+			std::string last_family;
+			for (std::map<std::string, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+			{
+				std::string family, labels;
+				SplitName(it->first, family, labels);
+				const Entry& entry = it->second;
+
+				if (family != last_family)
+				{
+					out << "# HELP " << family << " " << entry.help << "\n";
+					out << "# TYPE " << family << " " << entry.type << "\n";
+					last_family = family;
+				}
+
+				if (entry.counter)
+				{
+					out << it->first << " " << entry.counter->Get() << "\n";
+				}
+				else if (entry.gauge)
+				{
+					out << it->first << " " << entry.gauge->Get() << "\n";
+				}
+				else if (entry.histogram)
+				{
+					const std::vector<double>& bounds = entry.histogram->GetUpperBounds();
+					std::vector<uint64_t> counts = entry.histogram->GetBucketCounts();
+					std::string prefix = labels.empty() ? "{" : "{" + labels + ",";
+
+					uint64_t cumulative = 0;
+					for (size_t i = 0; i < counts.size(); ++i)
+					{
+						cumulative += counts[i];
+						out << family << "_bucket" << prefix << "le=\"";
+						if (i < bounds.size())
+							out << bounds[i];
+						else
+							out << "+Inf";
+						out << "\"} " << cumulative << "\n";
+					}
+					std::string suffix = labels.empty() ? "" : "{" + labels + "}";
+					out << family << "_sum" << suffix << " " << entry.histogram->GetSum() << "\n";
+					out << family << "_count" << suffix << " " << cumulative << "\n";
+				}
+			}
+			return out.str();
+		}
+
+	private:
+
+		Registry(const Registry& other);
+		Registry & operator= (const Registry& other);
+
+		struct Entry
+		{
+			std::string help;
+			std::string type;
+			std::unique_ptr<Counter> counter;
+			std::unique_ptr<Gauge> gauge;
+			std::unique_ptr<Histogram> histogram;
+		};
+
+		Entry& GetEntry(const std::string& name, const std::string& help, const char* type)
+		{
+			Entry& entry = entries[name];
+			if (entry.type.empty())
+			{
+				entry.help = help;
+				entry.type = type;
+			}
+			return entry;
+		}
+
+		// Splitting name{labels} into the name and the labels without the braces
+		static void SplitName(const std::string& name, std::string& family, std::string& labels)
+		{
+			size_t brace = name.find('{');
+			if (brace == std::string::npos)
+			{
+				family = name;
+				labels.clear();
+			}
+			else
+			{
+				family = name.substr(0, brace);
+				labels = name.substr(brace + 1, name.size() - brace - 2);
+			}
+		}
+
+		std::mutex registry_mutex;
+		std::map<std::string, Entry> entries;
+	};
+
+	inline Registry& GetRegistry()
+	{
+		static Registry registry;
+		return registry;
+	}
+
+	// Observing the time from construction to destruction in seconds
+	class ScopedLatency
+	{
+	public:
+
+		explicit ScopedLatency(Histogram& histogram) : histogram(histogram), start(std::chrono::steady_clock::now()) {}
+
+		~ScopedLatency()
+		{
+			histogram.Observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		}
+
+	private:
+
+		ScopedLatency(const ScopedLatency& other);
+		ScopedLatency & operator= (const ScopedLatency& other);
+
+		Histogram& histogram;
+		std::chrono::steady_clock::time_point start;
+	};
+
+}
+}
+
+#define OPENFACE_METRICS_CONCAT_IMPL(a, b) a##b
+#define OPENFACE_METRICS_CONCAT(a, b) OPENFACE_METRICS_CONCAT_IMPL(a, b)
+
+// Timing the rest of the enclosing scope into a latency histogram, the name has to be the same on every call of this call site
+#define METRICS_LATENCY(name, help) \
+	static Utilities::Metrics::Histogram& OPENFACE_METRICS_CONCAT(metrics_histogram_, __LINE__) = Utilities::Metrics::GetRegistry().GetHistogram(name, help); \
+	Utilities::Metrics::ScopedLatency OPENFACE_METRICS_CONCAT(metrics_latency_, __LINE__)(OPENFACE_METRICS_CONCAT(metrics_histogram_, __LINE__))
+
+#define METRICS_INCREMENT(name, help) \
+	do { static Utilities::Metrics::Counter& metrics_counter = Utilities::Metrics::GetRegistry().GetCounter(name, help); metrics_counter.Increment(); } while (0)
+
+#define METRICS_GAUGE_SET(name, help, value) \
+	do { static Utilities::Metrics::Gauge& metrics_gauge = Utilities::Metrics::GetRegistry().GetGauge(name, help); metrics_gauge.Set((int64_t)(value)); } while (0)
+
+#endif // METRICS_H
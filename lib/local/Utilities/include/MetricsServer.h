@@ -0,0 +1,85 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+// System includes
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace Utilities
+{
+
+	//===========================================================================
+	/**
+	A minimal HTTP endpoint serving the metrics registry (Metrics.h) in the Prometheus text format, so that a long running
+	tracking process can be scraped. It runs on its own thread and answers GET /metrics, any other path gets a 404.
+	*/
+	class MetricsServer
+	{
+
+	public:
+
+		MetricsServer();
+		~MetricsServer();
+
+		// Start listening on the port (on all interfaces), returns false if the port could not be bound
+		bool Start(int port);
+
+		// Stop listening and wait for the serving thread to finish
+		void Stop();
+
+		bool IsRunning() const { return running; }
+
+	private:
+
+		// Blocking copy as the server owns a thread and a socket
+		MetricsServer & operator= (const MetricsServer& other);
+		MetricsServer & operator= (const MetricsServer&& other);
+		MetricsServer(const MetricsServer&& other);
+		MetricsServer(const MetricsServer& other);
+
+		// The networking state is kept out of the header to not pull boost asio into every user
+		struct Impl;
+		std::unique_ptr<Impl> impl;
+
+		std::thread serving_thread;
+		std::atomic<bool> running;
+
+	};
+}
+#endif // METRICS_SERVER_H
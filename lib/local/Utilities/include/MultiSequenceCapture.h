@@ -0,0 +1,114 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef MULTI_SEQUENCE_CAPTURE_H
+#define MULTI_SEQUENCE_CAPTURE_H
+
+// System includes
+#include <memory>
+#include <string>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+#include "SequenceCapture.h"
+
+namespace Utilities
+{
+
+	//===========================================================================
+	/**
+	Capturing several synchronised sequences at the same time, e.g. the cameras of a rig around a subject. The sources are read in parallel
+	and their frames are aligned by timestamp to the frames of the first (reference) source: every call returns the reference frame and, for
+	every other source, its frame closest in time within the allowed offset, or an empty frame if it has none
+	*/
+	class MultiSequenceCapture {
+
+	public:
+
+		MultiSequenceCapture() : max_offset(-1) {}
+
+		~MultiSequenceCapture();
+
+		// The arguments of every source from the command line, the sources are given by -sync_f <file>, -sync_fdir <directory> or
+		// -sync_device <n>, each optionally followed by -sync_intrinsics <fx> <fy> <cx> <cy> of its camera. The other arguments are shared
+		// by all of the sources, returns an empty list if no sources are given
+		static std::vector<std::vector<std::string> > GetSourceArguments(const std::vector<std::string>& arguments);
+
+		// Opening all of the sources, fails if any of them could not be opened
+		bool Open(std::vector<std::vector<std::string> >& source_arguments);
+
+		// The largest difference between the timestamps of aligned frames in seconds, half the frame interval of the reference by default
+		void SetMaxOffset(double max_offset) { this->max_offset = max_offset; }
+
+		// The next aligned frames, returns false once the reference source has ended. The timestamp is that of the reference frame
+		bool GetNextFrames(std::vector<cv::Mat>& frames, std::vector<cv::Mat_<uchar> >& gray_frames, double& time_stamp);
+
+		size_t NumSources() const { return sources.size(); }
+
+		// The source with its camera parameters and name
+		SequenceCapture& GetSource(size_t source) { return sources[source]->capture; }
+
+		void Close();
+
+	private:
+
+		// Blocking copy and move, as the captures own their threads
+		MultiSequenceCapture & operator= (const MultiSequenceCapture& other);
+		MultiSequenceCapture(const MultiSequenceCapture& other);
+
+		struct Source
+		{
+			SequenceCapture capture;
+
+			// The frame read ahead, which has not been aligned yet
+			cv::Mat next_frame;
+			cv::Mat_<uchar> next_gray_frame;
+			double next_time_stamp;
+			bool has_next;
+			bool ended;
+
+			Source() : next_time_stamp(0), has_next(false), ended(false) {}
+		};
+
+		// Reading ahead by a frame, unless the source has ended
+		static void ReadAhead(Source& source);
+
+		std::vector<std::unique_ptr<Source> > sources;
+		double max_offset;
+	};
+}
+#endif // MULTI_SEQUENCE_CAPTURE_H
@@ -0,0 +1,109 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef NUMA_NODES_H
+#define NUMA_NODES_H
+
+// System includes
+#include <memory>
+#include <vector>
+
+// The arena observers are a preview feature in the TBB version used
+#ifndef TBB_PREVIEW_LOCAL_OBSERVER
+#define TBB_PREVIEW_LOCAL_OBSERVER 1
+#endif
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_observer.h>
+
+namespace Utilities
+{
+
+	// A NUMA node of the machine and the processors belonging to it
+	struct NumaNode
+	{
+		int id;
+		std::vector<int> cpus;
+	};
+
+	// The NUMA nodes of the machine, a single node with all of the processors if the topology can not be determined
+	std::vector<NumaNode> GetNumaNodes();
+
+	// Restricting the calling thread to the processors of a node, returns false if not supported on the platform
+	bool PinThreadToNode(const NumaNode& node);
+
+	//===========================================================================
+	/**
+	A TBB arena with a thread per processor of a NUMA node, all of the threads working in it are pinned to the node. As the OS places memory on
+	the node of the thread first touching it, models read and sequences processed from within the arena stay local to the node
+	*/
+	class NumaArena {
+
+	public:
+
+		explicit NumaArena(const NumaNode& node);
+		~NumaArena();
+
+		// Running a function in the arena, the calling thread is pinned to the node as well
+		template<typename F>
+		void Execute(const F& function)
+		{
+			PinThreadToNode(node);
+			arena.execute(function);
+		}
+
+		const NumaNode& Node() const { return node; }
+
+	private:
+
+		NumaArena(const NumaArena& other);
+		NumaArena & operator= (const NumaArena& other);
+
+		// Pinning the threads as they join the arena
+		class PinningObserver : public tbb::task_scheduler_observer
+		{
+		public:
+			PinningObserver(tbb::task_arena& arena, const NumaNode& node) : tbb::task_scheduler_observer(arena), node(node) {}
+			void on_scheduler_entry(bool) { PinThreadToNode(node); }
+		private:
+			const NumaNode& node;
+		};
+
+		NumaNode node;
+		tbb::task_arena arena;
+		std::unique_ptr<PinningObserver> observer;
+	};
+
+}
+#endif // NUMA_NODES_H
@@ -0,0 +1,128 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef RAW_VIDEO_H
+#define RAW_VIDEO_H
+
+// System includes
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+namespace boost { namespace interprocess { class file_mapping; class mapped_region; } }
+
+namespace Utilities
+{
+
+	//===========================================================================
+	/**
+	A simple container of raw frames (.ofraw), for running the processing over the same sequences many times without decoding them again. Every
+	frame is stored as its BGR image followed by its grayscale image, together with its timestamp, so reading a frame is only a copy out of
+	the memory mapped file. The layout is a 64 byte header ("OFRAW001", width, height, fps, number of frames and the offset of the timestamp
+	index), the fixed size frames, and the index of timestamps at the end. A file that was not closed properly still has its complete frames
+	readable, with timestamps made from the fps
+	*/
+	class RawVideoWriter {
+
+	public:
+
+		RawVideoWriter() : width(0), height(0), fps(0) {}
+
+		~RawVideoWriter();
+
+		bool Open(const std::string& filename, int width, int height, double fps);
+
+		// The frame has to be of the size the file was opened with, a three channel image with its grayscale version
+		bool WriteFrame(const cv::Mat& frame, const cv::Mat_<uchar>& gray_frame, double time_stamp);
+
+		// Writing the index and the number of frames
+		bool Close();
+
+		bool IsOpen() const { return output.is_open(); }
+
+	private:
+
+		std::ofstream output;
+		int width;
+		int height;
+		double fps;
+		std::vector<double> time_stamps;
+	};
+
+	class RawVideoReader {
+
+	public:
+
+		RawVideoReader();
+
+		~RawVideoReader();
+
+		bool Open(const std::string& filename);
+
+		// Copying a frame out of the file into the given images (which are only reallocated if they do not match the frame)
+		bool ReadFrame(size_t frame, cv::Mat& image, cv::Mat_<uchar>& gray_image) const;
+
+		double GetTimestamp(size_t frame) const { return time_stamps[frame]; }
+
+		size_t GetNumFrames() const { return time_stamps.size(); }
+
+		void Close();
+
+		bool IsOpen() const { return region != nullptr; }
+
+		// If the file name has the extension of the container
+		static bool IsRawVideo(const std::string& filename);
+
+		int width;
+		int height;
+		double fps;
+
+	private:
+
+		// Blocking copy and move, as the mapping is owned by the reader
+		RawVideoReader & operator= (const RawVideoReader& other);
+		RawVideoReader(const RawVideoReader& other);
+
+		std::unique_ptr<boost::interprocess::file_mapping> mapping;
+		std::unique_ptr<boost::interprocess::mapped_region> region;
+		std::vector<double> time_stamps;
+	};
+}
+#endif // RAW_VIDEO_H
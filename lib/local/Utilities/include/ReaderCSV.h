@@ -0,0 +1,154 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef READER_CSV_H
+#define READER_CSV_H
+
+// System includes
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+namespace Utilities
+{
+
+	// The tracking results of a frame as recorded by RecorderCSV, in the layouts used by the landmark detector
+	struct RecordedObservation
+	{
+		int frame_number;
+		int face_id;
+		double time_stamp;
+		float confidence;
+		bool success;
+
+		// 2n x 1 (all of the x followed by all of the y) and 3 x n
+		cv::Mat_<float> landmarks_2D;
+		cv::Mat_<float> landmarks_3D;
+
+		cv::Vec6f params_global;
+		cv::Mat_<float> params_local;
+		cv::Vec6d pose_estimate;
+
+		cv::Point3f gaze_direction0;
+		cv::Point3f gaze_direction1;
+		cv::Vec2d gaze_angle;
+		std::vector<cv::Point2f> eye_landmarks_2D;
+		std::vector<cv::Point3f> eye_landmarks_3D;
+
+		RecordedObservation() : frame_number(0), face_id(0), time_stamp(0.0), confidence(0.0f), success(false) {}
+	};
+
+	//===========================================================================
+	/**
+	A class for reading the tracking results of a sequence back from a CSV file recorded by RecorderCSV, so that they can be reused
+	without tracking the sequence again. Only the columns that were recorded are available
+	*/
+	class ReaderCSV {
+
+	public:
+
+		ReaderCSV();
+
+		// Opening the file and locating the columns from its header, the 2D landmarks have to be present
+		bool Open(const std::string& filename);
+
+		void Close();
+
+		bool isOpen() const { return csv_file.is_open(); }
+
+		int GetNumLandmarks() const { return num_landmarks; }
+		int GetNumEyeLandmarks() const { return num_eye_landmarks; }
+		int GetNumModelModes() const { return num_model_modes; }
+
+		bool HasLandmarks3D() const { return col_landmarks_3D >= 0; }
+		bool HasModelParams() const { return col_params_global >= 0; }
+		bool HasPose() const { return col_pose >= 0; }
+		bool HasGaze() const { return col_gaze >= 0; }
+
+		// Reading the observation of a face in a frame, the frames have to be asked for in increasing order (the rows of the frames in
+		// between are skipped). Returns false if the frame was not recorded
+		bool ReadFrame(int frame_number, RecordedObservation& observation, int face_id = 0);
+
+		// Reading the observation of the next row whichever frame and face it belongs to, returns false at the end of the file
+		bool ReadNextFrame(RecordedObservation& observation);
+
+	private:
+
+		// Blocking copy and move, the reader keeps the position in the file
+		ReaderCSV & operator= (const ReaderCSV& other);
+		ReaderCSV & operator= (const ReaderCSV&& other);
+		ReaderCSV(const ReaderCSV&& other);
+		ReaderCSV(const ReaderCSV& other);
+
+		// Parsing the next line of the file into the current row, false at the end of the file
+		bool ReadRow();
+
+		int Column(const std::map<std::string, int>& columns, const std::string& name) const;
+
+		// Filling in the observation from the current row
+		void GetObservation(RecordedObservation& observation) const;
+
+		std::ifstream csv_file;
+
+		int num_landmarks;
+		int num_eye_landmarks;
+		int num_model_modes;
+
+		// The first column of every group (-1 if it was not recorded), the columns of a group are written consecutively
+		int col_frame;
+		int col_face_id;
+		int col_timestamp;
+		int col_confidence;
+		int col_success;
+		int col_gaze;
+		int col_eye_landmarks;
+		int col_pose;
+		int col_landmarks_2D;
+		int col_landmarks_3D;
+		int col_params_global;
+		int col_params_local;
+
+		// The last parsed row, it is kept when it belongs to a later frame than the one asked for
+		std::string line;
+		std::vector<double> row;
+		bool row_valid;
+
+	};
+}
+#endif // READER_CSV_H
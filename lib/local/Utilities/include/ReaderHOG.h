@@ -0,0 +1,107 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef READER_HOG_H
+#define READER_HOG_H
+
+// System includes
+#include <fstream>
+#include <string>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+namespace Utilities
+{
+
+	//===========================================================================
+	/**
+	A class for reading HOG files recorded by RecorderHOG (both the original and the compressed v2 format) with random access to the frames
+	*/
+	class ReaderHOG {
+
+	public:
+
+		ReaderHOG();
+
+		// Opening the file and reading (or constructing) the index of the frames
+		bool Open(const std::string& filename);
+
+		void Close();
+
+		bool isOpen() const { return hog_file.is_open(); }
+
+		int GetNumFrames() const { return num_frames; }
+		int GetNumCols() const { return num_cols; }
+		int GetNumRows() const { return num_rows; }
+		int GetNumChannels() const { return num_channels; }
+
+		// Reading the descriptor of a frame (as a 1 x num_cols * num_rows * num_channels row, in the recorded order) and whether the frame was good,
+		// reading the frames in order only decodes every chunk once
+		bool ReadFrame(int frame, cv::Mat_<float>& hog_descriptor, bool& good_frame);
+
+	private:
+
+		// Blocking copy and move, the reader keeps the position in the file
+		ReaderHOG & operator= (const ReaderHOG& other);
+		ReaderHOG & operator= (const ReaderHOG&& other);
+		ReaderHOG(const ReaderHOG&& other);
+		ReaderHOG(const ReaderHOG& other);
+
+		// Decoding a chunk of the v2 format into the cached frames
+		bool ReadChunk(int chunk);
+
+		std::ifstream hog_file;
+
+		int num_frames;
+		int num_cols;
+		int num_rows;
+		int num_channels;
+
+		// Details of the v2 format
+		bool compressed;
+		bool half_precision;
+		int frames_per_chunk;
+		std::vector<long long> chunk_offsets;
+
+		// The last decoded chunk
+		int cached_chunk;
+		cv::Mat_<float> cached_frames;
+		std::vector<char> cached_good_frames;
+
+	};
+}
+#endif // READER_HOG_H
@@ -0,0 +1,136 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef READER_SHARED_MEMORY_H
+#define READER_SHARED_MEMORY_H
+
+// System includes
+#include <memory>
+#include <string>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+#include "RecorderSharedMemory.h"
+
+namespace Utilities
+{
+
+	// A record read from the shared memory ring, the arrays are in the layout described in SharedRingRecord
+	struct SharedFrame
+	{
+		uint64_t record;
+		int frame_number;
+		int face_id;
+		bool success;
+		bool reused;
+		float confidence;
+		double timestamp;
+
+		cv::Vec6f pose;
+		cv::Point3f gaze_direction0;
+		cv::Point3f gaze_direction1;
+		cv::Vec2f gaze_angle;
+
+		std::vector<float> landmarks_2D;
+		std::vector<float> landmarks_3D;
+		std::vector<float> eye_landmarks_2D;
+		std::vector<float> eye_landmarks_3D;
+		std::vector<float> au_intensities;
+		std::vector<float> au_occurences;
+
+		// Empty if the record has no aligned face
+		cv::Mat aligned_face;
+	};
+
+	//===========================================================================
+	/**
+	A class for consuming the records published by RecorderSharedMemory from another process. Reading never waits for the writer: a record
+	that is being written (or was overwritten while copying it) is reported as not available, and a reader that falls behind by more than the
+	ring skips to the oldest record still in it.
+	*/
+	class ReaderSharedMemory {
+
+	public:
+
+		ReaderSharedMemory();
+
+		~ReaderSharedMemory();
+
+		// Mapping the named shared memory, false if it does not exist (yet) or has a different layout version
+		bool Open(const std::string& name);
+
+		bool isOpen() const { return impl.get() != NULL; }
+
+		void Close();
+
+		// Copying the next record after the last one read into the frame (the arrays of the frame are reused), false if there is no new complete
+		// record. The skipped records are counted in GetDropped
+		bool ReadNext(SharedFrame& frame);
+
+		// Copying the most recent record, skipping any older ones not read yet
+		bool ReadLatest(SharedFrame& frame);
+
+		// Has the writer closed the ring, so that no more records will follow (a new ring has to be opened for its next recording)
+		bool WriterClosed() const;
+
+		const std::vector<std::string>& GetAUIntensityNames() const { return au_intensity_names; }
+		const std::vector<std::string>& GetAUOccurenceNames() const { return au_occurence_names; }
+
+		uint64_t GetDropped() const { return dropped; }
+
+	private:
+
+		// Blocking copy and move, the reading position belongs to one reader
+		ReaderSharedMemory & operator= (const ReaderSharedMemory& other);
+		ReaderSharedMemory & operator= (const ReaderSharedMemory&& other);
+		ReaderSharedMemory(const ReaderSharedMemory&& other);
+		ReaderSharedMemory(const ReaderSharedMemory& other);
+
+		// Copying a record if it is complete and not overwritten while copying
+		bool ReadRecord(uint64_t record, SharedFrame& frame);
+
+		struct Impl;
+		std::unique_ptr<Impl> impl;
+
+		std::vector<std::string> au_intensity_names;
+		std::vector<std::string> au_occurence_names;
+
+		uint64_t next_record;
+		uint64_t dropped;
+
+	};
+}
+#endif // READER_SHARED_MEMORY_H
@@ -0,0 +1,89 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef REALTIME_MEMORY_H
+#define REALTIME_MEMORY_H
+
+// System includes
+#include <cstddef>
+
+namespace Utilities
+{
+
+	// Keeping freed heap memory in the process instead of returning it to the OS (no trimming and no separately mapped large blocks), so that
+	// memory freed and allocated again from frame to frame does not have to be faulted in again. Only has an effect with glibc, and should be
+	// called at startup, before the large buffers are allocated
+	void RetainFreedHeap();
+
+	// Locking all of the memory currently mapped by the process in physical memory (and the future mappings too when the locked memory limit is
+	// unlimited, otherwise they would fail once at the limit), returns false if not supported on the platform or not permitted
+	bool LockProcessMemory();
+
+	// The bytes of heap memory in use by the process, 0 if not known on the platform
+	size_t GetHeapBytes();
+
+	//===========================================================================
+	/**
+	Reporting the growth of the heap once the processing has warmed up, in the real-time memory mode everything should be allocated (and faulted
+	in) by then, so any growth is a potential stall. Both the heap in use (GetHeapBytes) and the cv::Mat allocations (through MatAllocationCounter,
+	if it is installed) are followed, and the openface_heap_growth_bytes and openface_mat_allocations_after_warm_up gauges are set
+	*/
+	class HeapGrowthMonitor {
+
+	public:
+
+		HeapGrowthMonitor();
+
+		// Taking the current state as the baseline, at the end of the warm up
+		void Start();
+
+		bool IsStarted() const { return started; }
+
+		// Returns true if the heap grew beyond its largest size seen since the start or cv::Mat memory was allocated since the last check, with
+		// the growth of the heap and the number of cv::Mat allocations since the start
+		bool Check(size_t& heap_growth, size_t& mat_allocations);
+
+	private:
+
+		bool started;
+
+		size_t baseline_heap_bytes;
+		size_t peak_heap_bytes;
+
+		size_t baseline_mat_allocations;
+		size_t last_mat_allocations;
+	};
+
+}
+#endif // REALTIME_MEMORY_H
@@ -0,0 +1,98 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef RECORDER_ALIGNED_TENSOR_H
+#define RECORDER_ALIGNED_TENSOR_H
+
+// System includes
+#include <fstream>
+#include <string>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+namespace Utilities
+{
+
+	//===========================================================================
+	/**
+	A class for recording the aligned faces of a recording into a single N x H x W x C uint8 tensor, stored as a NumPy .npy file so that it can be
+	memory-mapped directly (numpy.load(filename, mmap_mode='r'), or torch.from_numpy on top of it) without decoding any images.
+
+	The header (format version 1.0) is padded to a fixed size, so that the number of faces can be filled in when the file is closed. The size and
+	the number of channels are taken from the first face, the later ones are converted to them. Every face is described by a row of the CSV index
+	written alongside it: row, frame, face_id, timestamp, success.
+	*/
+	class RecorderAlignedTensor {
+
+	public:
+
+		// The constructor for the recorder, by default does not do anything
+		RecorderAlignedTensor();
+
+		~RecorderAlignedTensor();
+
+		// Opening the tensor and its index file
+		bool Open(const std::string& tensor_filename, const std::string& index_filename);
+
+		bool isOpen() const { return tensor_file.is_open(); }
+
+		// Appending a face, returns false if it could not be written
+		bool Write(const cv::Mat& aligned_face, int frame_number, int face_id, double timestamp, bool success);
+
+		// Filling in the number of faces and closing the files
+		void Close();
+
+	private:
+
+		// Blocking copy and move, as it doesn't make sense to write to the same file
+		RecorderAlignedTensor & operator= (const RecorderAlignedTensor& other);
+		RecorderAlignedTensor & operator= (const RecorderAlignedTensor&& other);
+		RecorderAlignedTensor(const RecorderAlignedTensor&& other);
+		RecorderAlignedTensor(const RecorderAlignedTensor& other);
+
+		void WriteHeader();
+
+		std::ofstream tensor_file;
+		std::ofstream index_file;
+
+		// The shape of a face, set by the first one
+		int rows;
+		int cols;
+		int channels;
+
+		long long num_faces;
+	};
+}
+#endif // RECORDER_ALIGNED_TENSOR_H
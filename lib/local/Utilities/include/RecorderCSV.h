@@ -35,6 +35,7 @@
 #define RECORDER_CSV_H
 
 // System includes
+#include <atomic>
 #include <fstream>
 #include <sstream>
 #include <vector>
@@ -42,12 +43,18 @@
 // OpenCV includes
 #include <opencv2/core/core.hpp>
 
+#include "tbb/concurrent_queue.h"
+
+#include "CompressedOutput.h"
+
+#include <thread>
+
 namespace Utilities
 {
 
 	//===========================================================================
 	/**
-	A class for recording CSV file from OpenFace
+	A class for recording CSV file from OpenFace, the values of the lines are collected into batches which are formatted and written on a background thread
 	*/
 	class RecorderCSV {
 
@@ -56,19 +63,34 @@ namespace Utilities
 		// The constructor for the recorder, need to specify if we are recording a sequence or not
 		RecorderCSV();
 
+		~RecorderCSV();
+
 		// Opening the file and preparing the header for it
 		bool Open(std::string output_file_name, bool is_sequence, bool output_2D_landmarks, bool output_3D_landmarks, bool output_model_params, bool output_pose, bool output_AUs, bool output_gaze,
-			int num_face_landmarks, int num_model_modes, int num_eye_landmarks, const std::vector<std::string>& au_names_class, const std::vector<std::string>& au_names_reg);
+			int num_face_landmarks, int num_model_modes, int num_eye_landmarks, const std::vector<std::string>& au_names_class, const std::vector<std::string>& au_names_reg,
+			bool output_reused = false);
+
+		bool isOpen() const { return output_file.is_open() || compressed_file.IsOpen(); }
 
-		bool isOpen() const { return output_file.is_open(); }
+		// Compressing the file in blocks of lines (see CompressedOutputFile), the compression happens on the writing thread, needs to be set
+		// before opening
+		void SetCompression(OutputCompression compression, int level = 0) { this->compression = compression; compression_level = level; }
 
-		// Closing the file and cleaning up
+		// Appending to an existing file instead of starting a new one, keeping its header and first rows (e.g. the ones up to a checkpoint),
+		// needs to be set before opening
+		void SetResume(long long rows) { resume_rows = rows; }
+
+		// Waiting for the lines so far to be written to the file, returns the number of lines in it (without the header)
+		long long Sync();
+
+		// Writing out the remaining lines, closing the file and cleaning up
 		void Close();
 
+		// The AU values are in the order of the AU names given to Open (the columns are sorted by name), missing values are written as NaN
 		void WriteLine(int face_id, int frame_num, double time_stamp, bool landmark_detection_success, double landmark_confidence,
 			const cv::Mat_<float>& landmarks_2D, const cv::Mat_<float>& landmarks_3D, const cv::Mat_<float>& pdm_model_params, const cv::Vec6f& rigid_shape_params, cv::Vec6f& pose_estimate,
 			const cv::Point3f& gazeDirection0, const cv::Point3f& gazeDirection1, const cv::Vec2f& gaze_angle, const std::vector<cv::Point2f>& eye_landmarks2d, const std::vector<cv::Point3f>& eye_landmarks3d,
-			const std::vector<std::pair<std::string, double> >& au_intensities, const std::vector<std::pair<std::string, double> >& au_occurences);
+			const std::vector<float>& au_intensities, const std::vector<float>& au_occurences, bool reused = false);
 
 	private:
 
@@ -81,6 +103,11 @@ namespace Utilities
 		// The actual output file stream that will be written
 		std::ofstream output_file;
 
+		// Or the compressed file, every batch of lines is compressed as a block
+		CompressedOutputFile compressed_file;
+		OutputCompression compression;
+		int compression_level;
+
 		// If we are recording results from a sequence each row refers to a frame, if we are recording an image each row is a face
 		bool is_sequence;
 
@@ -92,9 +119,69 @@ namespace Utilities
 		bool output_AUs;
 		bool output_gaze;
 
+		// Should sequences have a column flagging the frames whose results were reused from the previous frame
+		bool output_reused;
+
 		std::vector<std::string> au_names_class;
 		std::vector<std::string> au_names_reg;
 
+		// For every AU column, the index of its value in the AU values of a line
+		std::vector<int> au_value_indices_class;
+		std::vector<int> au_value_indices_reg;
+
+		// The columns are compiled at Open into groups of consecutive columns taken from the same input, writing a line then only runs through
+		// the groups and copies their values to the batch (inputs with fewer values than the group leave the rest of it as NaN)
+		enum ColumnSource { COLUMN_FRAME, COLUMN_FACE_ID, COLUMN_TIMESTAMP, COLUMN_CONFIDENCE, COLUMN_SUCCESS, COLUMN_REUSED, COLUMN_GAZE,
+			COLUMN_EYE_LANDMARKS_2D, COLUMN_EYE_LANDMARKS_3D, COLUMN_POSE, COLUMN_LANDMARKS_2D, COLUMN_LANDMARKS_3D, COLUMN_RIGID_PARAMS,
+			COLUMN_LOCAL_PARAMS, COLUMN_AU_INTENSITIES, COLUMN_AU_OCCURENCES };
+
+		struct ColumnGroup
+		{
+			ColumnSource source;
+			int first_column;
+			int num_columns;
+		};
+		std::vector<ColumnGroup> column_groups;
+
+		// Adding the next group of columns together with the precision they are written with
+		void AddColumns(ColumnSource source, const std::vector<int>& decimals);
+		void AddColumns(ColumnSource source, int num_columns, int decimals) { AddColumns(source, std::vector<int>(num_columns, decimals)); }
+
+		// Handing over the current batch to the writing thread
+		void FlushBatch();
+
+		// Formatting and writing the batches, runs on the writing thread
+		static void BatchWritingTask(tbb::concurrent_bounded_queue<cv::Mat_<double> > *writing_queue, std::ofstream *output_file, CompressedOutputFile *compressed_file, const std::vector<int> *decimals,
+			const std::vector<int> *widths, std::atomic<long long> *rows_written);
+
+		// Keeping the header and the given number of rows of a file, false if it has less
+		static bool TruncateFile(const std::string& filename, long long rows);
+
+		// The rows of the file to keep when opening it (-1 for a new file), and the rows handed to the writing thread and written so far
+		long long resume_rows;
+		long long rows_queued;
+		std::atomic<long long> rows_written;
+
+		// Number of decimal places every column is written with
+		std::vector<int> column_decimals;
+
+		// The minimum width of every column (values are right aligned with spaces), the AU columns have a fixed width so that the offline
+		// postprocessing can patch the corrected values into the file in place (see FaceAnalyser::PostprocessOutputFile)
+		std::vector<int> column_widths;
+		const int AU_INTENSITY_WIDTH = 5;
+		const int AU_OCCURENCE_WIDTH = 3;
+
+		// The lines that have not been handed over to the writing thread yet
+		const int LINES_PER_BATCH = 64;
+		cv::Mat_<double> batch;
+		int rows_in_batch;
+
+		// Do not keep more than this many batches waiting to be written
+		const int BATCH_QUEUE_CAPACITY = 64;
+		tbb::concurrent_bounded_queue<cv::Mat_<double> > batch_queue;
+
+		std::thread writing_thread;
+
 	};
 }
 #endif // RECORDER_CSV_H
\ No newline at end of file
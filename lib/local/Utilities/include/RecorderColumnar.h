@@ -0,0 +1,154 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef RECORDER_COLUMNAR_H
+#define RECORDER_COLUMNAR_H
+
+// System includes
+#include <fstream>
+#include <string>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+#include "tbb/concurrent_queue.h"
+
+#include <thread>
+
+namespace Utilities
+{
+
+	//===========================================================================
+	/**
+	A class for recording the same observations as RecorderCSV, but in a binary columnar format. Rows are collected into chunks and every column of a chunk
+	is stored separately: the values are quantised to the precision used by the CSV output, delta coded against the previous row and written as zig-zag
+	varints. The chunks are compressed and written on a background thread.
+
+	File layout (little endian):
+		"OFCOL001", int32 number of columns, for every column: int32 name length, name, int32 number of decimals
+		for every chunk: int32 number of rows, for every column: int32 number of bytes, encoded column
+	*/
+	class RecorderColumnar {
+
+	public:
+
+		// The constructor for the recorder, by default does not do anything
+		RecorderColumnar();
+
+		~RecorderColumnar();
+
+		// Opening the file and preparing the header for it, the arguments are the same as for RecorderCSV
+		bool Open(std::string output_file_name, bool is_sequence, bool output_2D_landmarks, bool output_3D_landmarks, bool output_model_params, bool output_pose, bool output_AUs, bool output_gaze,
+			int num_face_landmarks, int num_model_modes, int num_eye_landmarks, const std::vector<std::string>& au_names_class, const std::vector<std::string>& au_names_reg,
+			bool output_reused = false);
+
+		bool isOpen() const { return output_file.is_open(); }
+
+		// Flushing the remaining rows, closing the file and cleaning up
+		void Close();
+
+		// The AU values are in the order of the AU names given to Open (the columns are sorted by name), missing or NaN values are written as 0
+		void WriteLine(int face_id, int frame_num, double time_stamp, bool landmark_detection_success, double landmark_confidence,
+			const cv::Mat_<float>& landmarks_2D, const cv::Mat_<float>& landmarks_3D, const cv::Mat_<float>& pdm_model_params, const cv::Vec6f& rigid_shape_params, cv::Vec6f& pose_estimate,
+			const cv::Point3f& gazeDirection0, const cv::Point3f& gazeDirection1, const cv::Vec2f& gaze_angle, const std::vector<cv::Point2f>& eye_landmarks2d, const std::vector<cv::Point3f>& eye_landmarks3d,
+			const std::vector<float>& au_intensities, const std::vector<float>& au_occurences, bool reused = false);
+
+		// Reading back a file written by the recorder, data will have a row per recorded line and a column per name
+		static bool Read(const std::string& input_file_name, std::vector<std::string>& column_names, cv::Mat_<double>& data);
+
+	private:
+
+		// Blocking copy and move, as it doesn't make sense to read to write to the same file
+		RecorderColumnar & operator= (const RecorderColumnar& other);
+		RecorderColumnar & operator= (const RecorderColumnar&& other);
+		RecorderColumnar(const RecorderColumnar&& other);
+		RecorderColumnar(const RecorderColumnar& other);
+
+		// Adding a column to the header, together with the number of decimals that are kept
+		void AddColumn(const std::string& name, int decimals);
+
+		// Setting the next value of the current row
+		inline void Push(double value) { chunk(rows_in_chunk, current_col++) = value; }
+
+		// Handing over the current chunk to the writing thread
+		void FlushChunk();
+
+		// Encoding and writing the chunks, runs on the writing thread
+		static void ChunkWritingTask(tbb::concurrent_bounded_queue<cv::Mat_<double> > *writing_queue, std::ofstream *output_file, const std::vector<double> *scales);
+
+		// The actual output file stream that will be written
+		std::ofstream output_file;
+
+		// If we are recording results from a sequence each row refers to a frame, if we are recording an image each row is a face
+		bool is_sequence;
+
+		// Keep track of what we are recording
+		bool output_2D_landmarks;
+		bool output_3D_landmarks;
+		bool output_model_params;
+		bool output_pose;
+		bool output_AUs;
+		bool output_gaze;
+
+		// Should sequences have a column flagging the frames whose results were reused from the previous frame
+		bool output_reused;
+
+		std::vector<std::string> au_names_class;
+		std::vector<std::string> au_names_reg;
+
+		// For every AU column, the index of its value in the AU values of a line
+		std::vector<int> au_value_indices_class;
+		std::vector<int> au_value_indices_reg;
+
+		// The names of the columns and the scale used to quantise every one of them
+		std::vector<std::string> column_names;
+		std::vector<double> column_scales;
+
+		// The rows that have not been handed over to the writing thread yet
+		const int ROWS_PER_CHUNK = 1024;
+		cv::Mat_<double> chunk;
+		int rows_in_chunk;
+		int current_col;
+
+		// Do not keep more than this many chunks waiting to be written
+		const int CHUNK_QUEUE_CAPACITY = 8;
+		tbb::concurrent_bounded_queue<cv::Mat_<double> > chunk_queue;
+
+		std::thread writing_thread;
+
+	};
+}
+#endif // RECORDER_COLUMNAR_H
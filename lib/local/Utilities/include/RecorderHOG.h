@@ -42,13 +42,24 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+
+#include "CompressedOutput.h"
 
 namespace Utilities
 {
 
 	//===========================================================================
 	/**
-	A class for recording CSV file from OpenFace
+	A class for recording HOG files from OpenFace, either in the original format (num_cols, num_rows, num_channels, good frame flag and the raw floats
+	for every frame) or in the compressed v2 format.
+
+	The v2 format (little endian) consists of:
+		header: "OFHOG002", int32 num_cols, num_rows, num_channels, half_precision, frames_per_chunk
+		chunks: int32 num_frames, int8 good frame flag per frame, int32 number of bytes, encoded values
+		index: int32 num_chunks, int64 chunk offsets, int64 num_frames, int64 offset of the index, "OFHOGIDX"
+	The values of a chunk are stored (as float32 or float16 bit patterns) element by element, every one delta coded against the same element in the previous
+	frame and written as zig-zag varints, neighbouring frames are similar so the deltas are small. ReaderHOG can read both formats.
 	*/
 	class RecorderHOG {
 
@@ -58,11 +69,18 @@ namespace Utilities
 		RecorderHOG();
 		
 		// Adding observations to the recorder
-		void SetObservationHOG(bool success, const cv::Mat_<double>& hog_descriptor, int num_cols, int num_rows, int num_channels);
+		void SetObservationHOG(bool success, const cv::Mat_<float>& hog_descriptor, int num_cols, int num_rows, int num_channels);
 
 		void Write();
 
-		bool Open(std::string filename);
+		// Opening the file, compressed selects the v2 format and half_precision stores float16 values in it
+		bool Open(std::string filename, bool compressed = false, bool half_precision = false);
+
+		// Compressing the file in blocks of whole frames (of either format, see CompressedOutputFile), the compression happens on the writing
+		// thread of the file, needs to be set before opening
+		void SetCompression(OutputCompression compression, int level = 0) { this->compression = compression; compression_level = level; }
+
+		bool IsOpen() const;
 
 		void Close();
 
@@ -74,13 +92,43 @@ namespace Utilities
 		RecorderHOG(const RecorderHOG&& other);
 		RecorderHOG(const RecorderHOG& other);
 
+		// Encoding and writing out the collected frames of the v2 format
+		void WriteChunk();
+
 		std::ofstream hog_file;
 
+		// Where the values are written to, the file or the block of the compressed file
+		std::ostream* hog_out;
+
+		// The position in the (uncompressed) output
+		long long Position();
+
+		// Handing over the block to the compressed file, once it holds whole frames
+		void EndBlock();
+		CompressedOutputFile compressed_file;
+		OutputCompression compression;
+		int compression_level;
+		std::ostringstream block;
+		long long block_offset;
+		long long block_first_frame;
+		long long frames_recorded;
+
+		// The v2 format details
+		bool compressed;
+		bool half_precision;
+		bool header_written;
+		int header_num_values;
+		const int FRAMES_PER_CHUNK = 64;
+		cv::Mat_<float> chunk_frames;
+		std::vector<char> chunk_good_frames;
+		std::vector<long long> chunk_offsets;
+		long long num_frames_written;
+
 		// Internals for recording
 		int num_cols;
 		int num_rows;
 		int num_channels;
-		cv::Mat_<double> hog_descriptor;
+		cv::Mat_<float> hog_descriptor;
 		bool good_frame;
 
 	};
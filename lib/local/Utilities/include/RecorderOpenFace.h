@@ -34,9 +34,13 @@
 #ifndef RECORDER_OPENFACE_H
 #define RECORDER_OPENFACE_H
 
+#include "RecorderAlignedTensor.h"
 #include "RecorderCSV.h"
+#include "RecorderColumnar.h"
 #include "RecorderHOG.h"
 #include "RecorderOpenFaceParameters.h"
+#include "RecorderSharedMemory.h"
+#include "RecorderStream.h"
 
 // System includes
 #include <vector>
@@ -45,14 +49,13 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
-#include "tbb/concurrent_queue.h"
+#include "FrameQueue.h"
+#include "MemoryReport.h"
 
-#ifdef _WIN32 
-	// For speeding up writing
-	#include "tbb/task_group.h"
-#else
-	#include <thread>
-#endif
+#include <fstream>
+#include <mutex>
+
+#include <thread>
 
 namespace Utilities
 {
@@ -74,6 +77,9 @@ namespace Utilities
 		// Closing and cleaning up the recorder
 		void Close();
 
+		// Adding the memory of the frames waiting in the writing queues to the report (component/aligned_queue and component/tracked_queue)
+		void ReportMemory(MemoryReport& report, const std::string& component = "recorder");
+
 		// Adding observations to the recorder
 
 		// Required observations for video/image-sequence
@@ -85,6 +91,9 @@ namespace Utilities
 		// If in multiple face mode, identifying which face was tracked
 		void SetObservationFaceID(int face_id);
 
+		// Were the results of the observation reused from the previous frame instead of computed, only recorded with outputReused
+		void SetObservationReused(bool reused);
+
 		// All observations relevant to facial landmarks
 		void SetObservationLandmarks(const cv::Mat_<float>& landmarks_2D, const cv::Mat_<float>& landmarks_3D,
 			const cv::Vec6f& params_global, const cv::Mat_<float>& params_local, double confidence, bool success);
@@ -96,6 +105,11 @@ namespace Utilities
 		void SetObservationActionUnits(const std::vector<std::pair<std::string, double> >& au_intensities, 
 			const std::vector<std::pair<std::string, double> >& au_occurences);
 
+		// The same with the values in the order of fixed name tables (e.g. FaceAnalyser::GetAURegNameTable), the names are only used for
+		// the header of the output file so they are only copied until it is opened
+		void SetObservationActionUnits(const std::vector<std::string>& au_intensity_names, const std::vector<float>& au_intensities,
+			const std::vector<std::string>& au_occurence_names, const std::vector<float>& au_occurences);
+
 		// Gaze related observations
 		void SetObservationGaze(const cv::Point3f& gazeDirection0, const cv::Point3f& gazeDirection1,
 			const cv::Vec2f& gaze_angle, const std::vector<cv::Point2f>& eye_landmarks2D, const std::vector<cv::Point3f>& eye_landmarks3D);
@@ -104,7 +118,7 @@ namespace Utilities
 		void SetObservationFaceAlign(const cv::Mat& aligned_face);
 
 		// HOG feature related observations
-		void SetObservationHOG(bool good_frame, const cv::Mat_<double>& hog_descriptor, int num_cols, int num_rows, int num_channels);
+		void SetObservationHOG(bool good_frame, const cv::Mat_<float>& hog_descriptor, int num_cols, int num_rows, int num_channels);
 
 		void SetObservationVisualization(const cv::Mat &vis_track);
 
@@ -115,6 +129,17 @@ namespace Utilities
 		void WriteObservationTracked();
 
 		std::string GetCSVFile() { return csv_filename; }
+		std::string GetColumnarFile() { return columnar_filename; }
+
+		// Whether the recording would overwrite an existing file, e.g. one its input is read from
+		bool WritesTo(const std::string& filename) const;
+
+		// Continuing an earlier recording of the CSV output that was interrupted, keeping its first rows (as returned by SyncCSV at the
+		// checkpoint), needs to be called before the first observation is written. The other outputs are started anew
+		void ResumeCSV(long long rows) { csv_recorder.SetResume(rows); }
+
+		// Waiting for the CSV rows written so far to reach the file, returns the number of rows in it
+		long long SyncCSV() { return csv_recorder.Sync(); }
 
 	private:
 
@@ -134,18 +159,29 @@ namespace Utilities
 		std::string default_record_directory = "processed"; // By default we are writing in the processed directory in the working directory, if no output parameters provided
 		std::string out_name; // Short name, based on which other names are constructed
 		std::string csv_filename;
+		std::string columnar_filename;
 		std::string aligned_output_directory;
 		std::ofstream metadata_file;
 
 		// The actual output file stream that will be written
 		RecorderCSV csv_recorder;
+		RecorderColumnar columnar_recorder;
 		RecorderHOG hog_recorder;
 
+		// The optional live stream of the same observations, only connected once with the first observation
+		RecorderStream stream_recorder;
+		bool stream_connect_attempted = false;
+
+		// The optional shared memory ring of the same observations, created with the first observation
+		RecorderSharedMemory shared_memory_recorder;
+		bool shared_memory_attempted = false;
+
 		// The actual temporary storage for the observations
 		
 		double timestamp;
 		int face_id;
 		int frame_number;
+		bool reused;
 
 		// Facial landmark related observations
 		cv::Mat_<float> landmarks_2D;
@@ -158,9 +194,11 @@ namespace Utilities
 		// Head pose related observations
 		cv::Vec6f head_pose;
 
-		// Action Unit related observations
-		std::vector<std::pair<std::string, double> > au_intensities;
-		std::vector<std::pair<std::string, double> > au_occurences;
+		// Action Unit related observations, the values are in the order of the names
+		std::vector<std::string> au_intensity_names;
+		std::vector<std::string> au_occurence_names;
+		std::vector<float> au_intensities;
+		std::vector<float> au_occurences;
 
 		// Gaze related observations
 		cv::Point3f gaze_direction0;
@@ -173,25 +211,30 @@ namespace Utilities
 		cv::VideoWriter video_writer;
 		std::string media_filename;
 		
-		// Do not exceed 100MB in the concurrent queue
+		// Do not exceed 100MB in the writing queues
 		const int TRACKED_QUEUE_CAPACITY = 100;
 		bool tracked_writing_thread_started;
 		cv::Mat vis_to_out;
-		tbb::concurrent_bounded_queue<std::pair<std::string, cv::Mat> > vis_to_out_queue;
+		// Only the thread writing the observations pushes to it and only the video writing thread pops
+		SpscRing<std::pair<std::string, cv::Mat> > vis_to_out_queue;
 
 		// For aligned face writing
 		const int ALIGNED_QUEUE_CAPACITY = 100;
 		bool aligned_writing_thread_started;
 		cv::Mat aligned_face;
-		tbb::concurrent_bounded_queue<std::pair<std::string, cv::Mat> > aligned_face_queue;
+		FrameQueue<std::pair<std::string, cv::Mat> > aligned_face_queue;
+		int num_aligned_writers;
+
+		// When packing the aligned faces in a single tar archive, the writers encode in parallel and append under the lock
+		std::ofstream aligned_archive;
+		std::mutex aligned_archive_mutex;
+
+		// Or appending them to a single tensor, which is done directly as there is nothing to encode
+		RecorderAlignedTensor aligned_tensor_recorder;
 
-#ifdef _WIN32 
-		// For keeping track of tasks
-		tbb::task_group writing_threads;
-#else
+		// The writing threads (plain threads rather than TBB tasks, so that the blocking writes do not take up the TBB workers)
 		std::thread video_writing_thread;
-		std::thread aligned_writing_thread;
-#endif
+		std::vector<std::thread> aligned_writing_threads;
 
 
 	};
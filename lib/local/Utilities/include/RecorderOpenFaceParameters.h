@@ -69,10 +69,35 @@ namespace Utilities
 		bool outputHOG() const { return output_hog; }
 		bool outputTracked() const { return output_tracked; }
 		bool outputAlignedFaces() const { return output_aligned_faces; }
+		bool outputColumnar() const { return output_columnar; }
+		bool outputHOGCompressed() const { return output_hog_compressed; }
+		bool outputHOGHalfPrecision() const { return output_hog_half_precision; }
+		std::string outputCompression() const { return output_compression; }
 		std::string outputCodec() const { return output_codec; }
+		std::string outputVideoBackend() const { return output_video_backend; }
+		bool outputVideoHardwareAcceleration() const { return output_video_hw_acceleration; }
 		double outputFps() const { return fps_vid_out; }
+		int alignedWriters() const { return aligned_writers; }
+		bool outputAlignedArchive() const { return output_aligned_archive; }
+		bool outputAlignedTensor() const { return output_aligned_tensor; }
 
 		bool outputBadAligned() const { return record_aligned_bad; }
+		bool outputReused() const { return output_reused; }
+
+		// The rates (in Hz) the AUs and the gaze are computed at, 0 for every frame
+		double outputAURate() const { return au_rate; }
+		double outputGazeRate() const { return gaze_rate; }
+
+		// Where the per frame observations are streamed to (empty for not streaming), in which format and after how many lines
+		std::string outputStream() const { return output_stream; }
+		std::string outputStreamFormat() const { return output_stream_format; }
+		int outputStreamLinesPerFlush() const { return output_stream_flush; }
+
+		// The name of the shared memory ring the per frame observations are published to (empty for not publishing), its number of slots, and
+		// should the aligned faces be published as well
+		std::string outputSharedMemory() const { return output_shared_memory; }
+		int outputSharedMemorySlots() const { return output_shared_memory_slots; }
+		bool outputSharedMemoryAligned() const { return output_shared_memory_aligned; }
 
 		float getFx() const { return fx; }
 		float getFy() const { return fy; }
@@ -81,6 +106,8 @@ namespace Utilities
 
 		void setOutputAUs(bool output_AUs) { this->output_AUs = output_AUs; }
 		void setOutputGaze(bool output_gaze) { this->output_gaze = output_gaze; }
+		void setOutputColumnar(bool output_columnar) { this->output_columnar = output_columnar; }
+		void setOutputReused(bool output_reused) { this->output_reused = output_reused; }
 
 	private:
 		
@@ -99,14 +126,55 @@ namespace Utilities
 		bool output_hog;
 		bool output_tracked;
 		bool output_aligned_faces;
+
+		// Should the per frame observations be written in the binary columnar format instead of CSV
+		bool output_columnar;
+
+		// Should the HOG features be written in the compressed v2 format, optionally at half precision
+		bool output_hog_compressed;
+		bool output_hog_half_precision;
+
+		// The streaming compression of the CSV and HOG outputs (-compress_outputs zstd|gzip), empty for none
+		std::string output_compression;
 		
 		// Should the algined faces be recorded even if the detection failed (blank images)
 		bool record_aligned_bad;
 
+		// Should the frames whose results were reused from the previous frame (as the face did not change) be flagged in the output
+		bool output_reused;
+
+		// The AUs (with the HOG and aligned faces) and the gaze can be computed at a lower rate than the tracking (set with -au_rate <Hz> and
+		// -gaze_rate <Hz>), the frames in between repeat the last computed values while the landmarks and pose are still output for every frame
+		double au_rate;
+		double gaze_rate;
+
+		// The per frame observations can also be streamed to a live consumer (-stream stdout|unix:<path>|tcp:<host>:<port>), as ndjson or
+		// binary records (-stream_format), sent after every -stream_flush <n> lines (every line by default)
+		std::string output_stream;
+		std::string output_stream_format;
+		int output_stream_flush;
+
+		// For co-located consumers the observations can be published to a named shared memory ring (-shm <name>, read with ReaderSharedMemory)
+		// of -shm_slots <n> records, with the aligned faces with -shm_aligned
+		std::string output_shared_memory;
+		int output_shared_memory_slots;
+		bool output_shared_memory_aligned;
+
+		// How many threads encode and write the aligned faces, and should they be packed in a single tar archive instead of one file each
+		int aligned_writers;
+		bool output_aligned_archive;
+
+		// Should the aligned faces be appended to a single uint8 tensor (a memory-mappable .npy file with a CSV index) instead of being encoded
+		bool output_aligned_tensor;
+
 		// Some video recording parameters
 		std::string output_codec;
 		double fps_vid_out;
 
+		// The VideoWriter backend for the tracked video (any, ffmpeg, gstreamer, msmf), and should hardware encoding be requested from it
+		std::string output_video_backend;
+		bool output_video_hw_acceleration;
+
 		// Camera parameters for recording in the meta file;
 		float fx, fy, cx, cy;
 
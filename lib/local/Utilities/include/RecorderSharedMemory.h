@@ -0,0 +1,167 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef RECORDER_SHARED_MEMORY_H
+#define RECORDER_SHARED_MEMORY_H
+
+// System includes
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+namespace Utilities
+{
+	// The layout of the shared memory, written by RecorderSharedMemory and read by ReaderSharedMemory (both have to be built with the same
+	// layout version). The memory starts with the header, followed by the AU names and then by SharedRingHeader::slot_count slots, every
+	// slot is a SharedRingRecord followed by its arrays (see the offsets below)
+	const char SHARED_RING_MAGIC[8] = { 'O', 'F', 'S', 'H', 'M', 'R', 'N', 'G' };
+	const uint32_t SHARED_RING_VERSION = 1;
+	const int SHARED_RING_AU_NAME_LENGTH = 16;
+
+	struct SharedRingHeader
+	{
+		char magic[8];
+		uint32_t version;
+
+		// The bytes before the first slot, of every slot, and the number of slots
+		uint32_t slots_offset;
+		uint32_t slot_size;
+		uint32_t slot_count;
+
+		// The sizes of the arrays of every record, the aligned face is the capacity in bytes (0 if not recorded)
+		uint32_t num_landmarks;
+		uint32_t num_eye_landmarks;
+		uint32_t num_au_intensities;
+		uint32_t num_au_occurences;
+		uint32_t aligned_face_capacity;
+
+		// The number of records published so far, record n is in slot n % slot_count
+		std::atomic<uint64_t> published;
+
+		// Set once the recorder is done and the memory will not be written any more
+		std::atomic<uint32_t> closed;
+	};
+
+	struct SharedRingRecord
+	{
+		// A sequence lock, 2n + 1 while record n is being written and 2n + 2 once it is complete, a reader copies the record and checks that
+		// the sequence did not change in the meantime
+		std::atomic<uint64_t> sequence;
+
+		int64_t frame_number;
+		int32_t face_id;
+		int32_t success;
+		int32_t reused;
+		float confidence;
+		double timestamp;
+
+		// Tx, Ty, Tz, Rx, Ry, Rz
+		float pose[6];
+		float gaze_direction0[3];
+		float gaze_direction1[3];
+		float gaze_angle[2];
+
+		// The size of the aligned face in this record (0 if there is none), it is stored as 8 bit channels with tightly packed rows
+		int32_t aligned_width;
+		int32_t aligned_height;
+		int32_t aligned_channels;
+		int32_t padding;
+
+		// Followed by the 2D landmarks (all x then all y), the 3D landmarks (all X, Y, Z), the 2D eye landmarks (x, y pairs), the 3D eye
+		// landmarks (X, Y, Z triplets), the AU intensities and occurences (in the order of the names) as floats, and the aligned face bytes
+	};
+
+	// The offsets of the arrays of a record from its start
+	inline size_t SharedRingLandmarksOffset(const SharedRingHeader&) { return sizeof(SharedRingRecord); }
+	inline size_t SharedRingLandmarks3DOffset(const SharedRingHeader& h) { return SharedRingLandmarksOffset(h) + 2 * h.num_landmarks * sizeof(float); }
+	inline size_t SharedRingEyeLandmarksOffset(const SharedRingHeader& h) { return SharedRingLandmarks3DOffset(h) + 3 * h.num_landmarks * sizeof(float); }
+	inline size_t SharedRingEyeLandmarks3DOffset(const SharedRingHeader& h) { return SharedRingEyeLandmarksOffset(h) + 2 * h.num_eye_landmarks * sizeof(float); }
+	inline size_t SharedRingAUIntensitiesOffset(const SharedRingHeader& h) { return SharedRingEyeLandmarks3DOffset(h) + 3 * h.num_eye_landmarks * sizeof(float); }
+	inline size_t SharedRingAUOccurencesOffset(const SharedRingHeader& h) { return SharedRingAUIntensitiesOffset(h) + h.num_au_intensities * sizeof(float); }
+	inline size_t SharedRingAlignedFaceOffset(const SharedRingHeader& h) { return SharedRingAUOccurencesOffset(h) + h.num_au_occurences * sizeof(float); }
+
+	//===========================================================================
+	/**
+	A class for publishing the per frame observations to co-located consumers through a named shared memory ring, without any serialisation.
+	There is a single writer, a record is written in place into the next slot and published with a sequence number, the readers (see
+	ReaderSharedMemory) never block the writer and detect the records overwritten while they were reading them.
+	*/
+	class RecorderSharedMemory {
+
+	public:
+
+		RecorderSharedMemory();
+
+		~RecorderSharedMemory();
+
+		// Creating the named shared memory (replacing any existing one with the name) for records of the given sizes, the AU names are the order
+		// of the AU values of a record, the aligned face capacity is in bytes (0 for not publishing the aligned faces)
+		bool Open(const std::string& name, int slot_count, int num_landmarks, int num_eye_landmarks, const std::vector<std::string>& au_names_reg,
+			const std::vector<std::string>& au_names_class, int aligned_face_capacity);
+
+		bool isOpen() const { return impl.get() != NULL; }
+
+		// Marking the ring as closed and removing its name, the readers that have it mapped can still read the records in it
+		void Close();
+
+		// Publishing a record, the arrays with fewer values than the ring was opened with leave the rest as NaN, the aligned face is left out
+		// if it does not fit
+		void WriteRecord(int face_id, int frame_num, double time_stamp, bool landmark_detection_success, double landmark_confidence, bool reused,
+			const cv::Mat_<float>& landmarks_2D, const cv::Mat_<float>& landmarks_3D, const cv::Vec6f& pose_estimate, const cv::Point3f& gazeDirection0,
+			const cv::Point3f& gazeDirection1, const cv::Vec2f& gaze_angle, const std::vector<cv::Point2f>& eye_landmarks2d, const std::vector<cv::Point3f>& eye_landmarks3d,
+			const std::vector<float>& au_intensities, const std::vector<float>& au_occurences, const cv::Mat& aligned_face);
+
+	private:
+
+		// Blocking copy and move, as there is a single writer of the shared memory
+		RecorderSharedMemory & operator= (const RecorderSharedMemory& other);
+		RecorderSharedMemory & operator= (const RecorderSharedMemory&& other);
+		RecorderSharedMemory(const RecorderSharedMemory&& other);
+		RecorderSharedMemory(const RecorderSharedMemory& other);
+
+		// The shared memory is kept out of the header to not pull boost interprocess into every user
+		struct Impl;
+		std::unique_ptr<Impl> impl;
+
+		std::string name;
+		uint64_t next_record;
+
+	};
+}
+#endif // RECORDER_SHARED_MEMORY_H
@@ -0,0 +1,154 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef RECORDER_STREAM_H
+#define RECORDER_STREAM_H
+
+// System includes
+#include <memory>
+#include <string>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+namespace Utilities
+{
+
+	//===========================================================================
+	/**
+	A class for streaming the same observations as RecorderCSV to a live consumer, without going through a file. The lines are sent as they are
+	written (or every few lines), to stdout, a UNIX domain socket or a TCP connection, either as newline delimited JSON or as length prefixed binary
+	records. The consumer listens on the socket, the recorder connects to it when opened.
+
+	Targets:
+		stdout					the log output should then go to stderr, see ReserveStdout
+		unix:<path>				a UNIX domain socket (not available on Windows)
+		tcp:<host>:<port>		a TCP connection
+
+	NDJSON: a JSON object per line, with the same keys as the CSV header and null for the values not available.
+
+	Binary (little endian), every record is: uint32 number of bytes that follow, uint8 record type, payload
+		header record 'H', sent once: uint32 number of columns, for every column: uint16 name length, name
+		line record 'L': a float32 for every column (NaN for the values not available)
+	*/
+	class RecorderStream {
+
+	public:
+
+		enum StreamFormat { FORMAT_NDJSON, FORMAT_BINARY };
+
+		RecorderStream();
+
+		~RecorderStream();
+
+		// Connecting to the target and sending the header, the column arguments are the same as for RecorderCSV. The lines are sent after every
+		// lines_per_flush lines (1 for every line, the lowest latency)
+		bool Open(const std::string& target, StreamFormat format, int lines_per_flush, bool is_sequence, bool output_2D_landmarks, bool output_3D_landmarks,
+			bool output_model_params, bool output_pose, bool output_AUs, bool output_gaze, int num_face_landmarks, int num_model_modes, int num_eye_landmarks,
+			const std::vector<std::string>& au_names_class, const std::vector<std::string>& au_names_reg, bool output_reused = false);
+
+		bool isOpen() const { return impl.get() != NULL; }
+
+		// Sending the remaining lines and closing the connection
+		void Close();
+
+		// The same as RecorderCSV::WriteLine, if the consumer goes away the stream is closed and the following lines are dropped
+		void WriteLine(int face_id, int frame_num, double time_stamp, bool landmark_detection_success, double landmark_confidence,
+			const cv::Mat_<float>& landmarks_2D, const cv::Mat_<float>& landmarks_3D, const cv::Mat_<float>& pdm_model_params, const cv::Vec6f& rigid_shape_params, cv::Vec6f& pose_estimate,
+			const cv::Point3f& gazeDirection0, const cv::Point3f& gazeDirection1, const cv::Vec2f& gaze_angle, const std::vector<cv::Point2f>& eye_landmarks2d, const std::vector<cv::Point3f>& eye_landmarks3d,
+			const std::vector<float>& au_intensities, const std::vector<float>& au_occurences, bool reused = false);
+
+		// Parsing the format name (ndjson or binary), false if it is not known
+		static bool ParseFormat(const std::string& name, StreamFormat& format);
+
+		// If the arguments stream the results to stdout (-stream stdout), sending all of the std::cout output to stderr instead so that only the
+		// records end up on stdout, this has to be called before anything is logged
+		static void ReserveStdout(const std::vector<std::string>& arguments);
+
+	private:
+
+		// Blocking copy and move, as it doesn't make sense to stream to the same connection twice
+		RecorderStream & operator= (const RecorderStream& other);
+		RecorderStream & operator= (const RecorderStream&& other);
+		RecorderStream(const RecorderStream&& other);
+		RecorderStream(const RecorderStream& other);
+
+		// Adding a column to the header, together with the number of decimals it is written with
+		void AddColumn(const std::string& name, int decimals);
+
+		// Setting the next value of the current line
+		inline void Push(double value) { if (current_col < (int)line.size()) line[current_col] = value; current_col++; }
+
+		// Encoding the current line into the pending output, and sending the pending output
+		void EncodeLine();
+		bool Flush();
+
+		// The connection is kept out of the header to not pull boost asio into every user
+		struct Impl;
+		std::unique_ptr<Impl> impl;
+
+		StreamFormat format;
+		int lines_per_flush;
+		int pending_lines;
+
+		// If we are recording results from a sequence each row refers to a frame, if we are recording an image each row is a face
+		bool is_sequence;
+
+		// Keep track of what we are recording
+		bool output_2D_landmarks;
+		bool output_3D_landmarks;
+		bool output_model_params;
+		bool output_pose;
+		bool output_AUs;
+		bool output_gaze;
+		bool output_reused;
+
+		// For every AU column, the index of its value in the AU values of a line
+		std::vector<int> au_value_indices_class;
+		std::vector<int> au_value_indices_reg;
+
+		// The names of the columns, their JSON keys (with the separators) and the decimals they are written with
+		std::vector<std::string> column_names;
+		std::vector<std::string> column_keys;
+		std::vector<int> column_decimals;
+
+		// The values of the current line and the encoded lines not sent yet
+		std::vector<double> line;
+		int current_col;
+		std::string pending;
+
+	};
+}
+#endif // RECORDER_STREAM_H
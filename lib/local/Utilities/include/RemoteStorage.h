@@ -0,0 +1,72 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef REMOTE_STORAGE_H
+#define REMOTE_STORAGE_H
+
+// System includes
+#include <string>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+namespace Utilities
+{
+	// Reading the inputs directly from S3 compatible object storage over HTTP, instead of copying them to a local disk first. The objects are
+	// addressed as http://host[:port]/bucket/key, or as s3://bucket/key which is mapped (path style) to the endpoint in the OPENFACE_S3_ENDPOINT
+	// environment variable (http://s3.amazonaws.com by default). Only anonymous access is supported, e.g. public buckets or a local gateway.
+
+	// The number of remote images that are fetched concurrently ahead of the processing, unless more decoding workers were asked for
+	const int REMOTE_READ_AHEAD = 8;
+
+	// Is the path an object (or a prefix of objects) in remote storage
+	bool IsRemotePath(const std::string& path);
+
+	// The http URL of a remote path, empty if it can not be mapped to one
+	std::string RemoteHttpUrl(const std::string& path);
+
+	// Reading a whole object into memory, the objects larger than range_size are fetched with parallel_ranges concurrent range requests
+	bool ReadRemoteObject(const std::string& path, std::vector<uchar>& data, int parallel_ranges = 4, size_t range_size = 4 << 20);
+
+	// Listing the objects under a prefix (a remote "directory", with or without the trailing slash) with the ListObjectsV2 API, the objects
+	// are returned as http URLs in key order
+	bool ListRemoteObjects(const std::string& prefix, std::vector<std::string>& objects);
+
+	// Reading an image from a local file or from remote storage, empty if it could not be read
+	cv::Mat ReadImage(const std::string& path, int flags = cv::IMREAD_COLOR);
+
+}
+#endif // REMOTE_STORAGE_H
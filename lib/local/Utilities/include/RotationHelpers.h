@@ -69,6 +69,45 @@ namespace Utilities
 		return rotation_matrix;
 	}
 
+	// Quaternions are stored as (w, x, y, z), the Euler angles using the XYZ convention R = Rx * Ry * Rz, left-handed positive sign
+	static cv::Vec4f QuaternionProduct(const cv::Vec4f& a, const cv::Vec4f& b)
+	{
+		return cv::Vec4f(a[0] * b[0] - a[1] * b[1] - a[2] * b[2] - a[3] * b[3],
+			a[0] * b[1] + a[1] * b[0] + a[2] * b[3] - a[3] * b[2],
+			a[0] * b[2] - a[1] * b[3] + a[2] * b[0] + a[3] * b[1],
+			a[0] * b[3] + a[1] * b[2] - a[2] * b[1] + a[3] * b[0]);
+	}
+
+	static cv::Vec4f Euler2Quaternion(const cv::Vec3f& eulerAngles)
+	{
+		cv::Vec4f qx(cos(eulerAngles[0] / 2.0f), sin(eulerAngles[0] / 2.0f), 0, 0);
+		cv::Vec4f qy(cos(eulerAngles[1] / 2.0f), 0, sin(eulerAngles[1] / 2.0f), 0);
+		cv::Vec4f qz(cos(eulerAngles[2] / 2.0f), 0, 0, sin(eulerAngles[2] / 2.0f));
+
+		return QuaternionProduct(QuaternionProduct(qx, qy), qz);
+	}
+
+	// The quaternion does not have to be of unit length (the angles only depend on the ratios of its components) or have a positive w
+	static cv::Vec3f Quaternion2Euler(const cv::Vec4f& q)
+	{
+		float q0 = q[0];
+		float q1 = q[1];
+		float q2 = q[2];
+		float q3 = q[3];
+		float norm_sq = q0*q0 + q1*q1 + q2*q2 + q3*q3;
+
+		// Slower, but dealing with degenerate cases due to precision
+		float t1 = 2.0f * (q0*q2 + q1*q3) / norm_sq;
+		if (t1 > 1) t1 = 1.0f;
+		if (t1 < -1) t1 = -1.0f;
+
+		float yaw = asin(t1);
+		float pitch = atan2(2.0f * (q0*q1 - q2*q3), q0*q0 - q1*q1 - q2*q2 + q3*q3);
+		float roll = atan2(2.0f * (q0*q3 - q1*q2), q0*q0 + q1*q1 - q2*q2 - q3*q3);
+
+		return cv::Vec3f(pitch, yaw, roll);
+	}
+
 	// Using the XYZ convention R = Rx * Ry * Rz, left-handed positive sign
 	static cv::Vec3f RotationMatrix2Euler(const cv::Matx33f& rotation_matrix)
 	{
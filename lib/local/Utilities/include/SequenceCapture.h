@@ -38,10 +38,18 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <functional>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 
 // For speeding up capture
-#include "tbb/concurrent_queue.h"
-#include "tbb/task_group.h"
+#include <thread>
+
+#include "FrameQueue.h"
+#include "MemoryReport.h"
+#include "ImagePrefetcher.h"
+#include "RawVideo.h"
 
 // OpenCV includes
 #include <opencv2/core/core.hpp>
@@ -52,14 +60,33 @@ namespace Utilities
 
 	//===========================================================================
 	/**
-	A class for capturing sequences from video, webcam, and image directories
+	A frame in an externally owned buffer (e.g. from a hardware decoder), the planes are used without copying and release is called once
+	OpenFace no longer references the buffer. For NV12 planes[0] is Y and planes[1] the interleaved UV, for I420 planes[0..2] are Y, U, and V
+	*/
+	struct ExternalFrame
+	{
+		enum Format { GRAY, NV12, I420 };
+
+		Format format;
+		const uchar* planes[3];
+		size_t steps[3];
+		double timestamp;
+		std::function<void()> release;
+	};
+
+	//===========================================================================
+	/**
+	A class for capturing sequences from video, webcam, image directories, and externally provided frames
 	*/
 	class SequenceCapture {
 
 	public:
 
 		// Default constructor
-		SequenceCapture() {};
+		SequenceCapture() : capturing(false), decode_backend("any"), decode_hw_acceleration(false), decode_threads(0), decoded_queue(DECODE_SLOTS), drop_frames_when_full(false),
+			start_frame(0), end_frame(0), camera_time_offset(0), last_camera_time(0), has_camera_time(false), latest_frame_only(false), webcam_time_stamp(0),
+			has_webcam_frame(false), webcam_ended(false), webcam_dropped(0), is_webcam(false), is_image_seq(false), is_external(false), session_scale(1.0),
+			session_frames_written(0), paced_replay(false), replay_started(false), replay_first_timestamp(0), replay_width(0), replay_height(0) {};
 
 		// Destructor
 		~SequenceCapture();
@@ -75,11 +102,70 @@ namespace Utilities
 		// Image sequence in the directory
 		bool OpenImageSequence(std::string directory, float fx = -1, float fy = -1, float cx = -1, float cy = -1);
 
-		// Video file
+		// How video files are decoded, needs to be set before opening them: the cv::VideoCapture backend (any, ffmpeg, gstreamer, msmf),
+		// whether hardware decoding should be requested, and the number of decoding threads (0 lets the backend decide, for image sequences
+		// more than one decodes the images in parallel)
+		void SetVideoDecoding(const std::string& backend, bool hw_acceleration, int threads = 0);
+
+		// Starting the next opened video file or image sequence at a later frame (0 based, the frame numbers and timestamps are those of the
+		// whole sequence), e.g. for resuming the processing of a sequence
+		void SetStartFrame(size_t start_frame) { this->start_frame = start_frame; }
+
+		// Stopping the next opened video file or image sequence before the given frame (0 for reading to the end), e.g. for processing a
+		// segment of a long sequence
+		void SetEndFrame(size_t end_frame) { this->end_frame = end_frame; }
+
+		// Reopening the current video file or image sequence at a later frame, with the same camera parameters
+		bool Reopen(size_t start_frame);
+
+		// Also writing the frames of the next opened sequence to a raw video (see RawVideo.h, -write_raw <file>), as they are read, so that
+		// later runs over the sequence can read the raw video instead of decoding it again
+		void SetRawOutput(const std::string& filename) { raw_output_file = filename; }
+
+		// Recording a compact session of the next opened sequence for reproducing its load offline (-record_session <dir>, -record_session_scale
+		// <scale>): the frames scaled down by scale with their timestamps (frames.ofraw), a hash of every full size frame (frames.csv), the size,
+		// source and the processing arguments (session.txt), and once closed the latency metrics of the stages (metrics.txt) and the trace of
+		// the stages if tracing is on (trace.json)
+		void SetSessionOutput(const std::string& directory, double scale = 1.0, const std::vector<std::string>& arguments = std::vector<std::string>());
+
+		// Replaying a recorded session (-replay <dir>) at the cadence it was captured at, the frames are scaled back to the original size. A
+		// session recorded from a webcam drops the oldest queued frames when the processing falls behind, as the live camera would have
+		bool OpenReplay(const std::string& directory, float fx = -1, float fy = -1, float cx = -1, float cy = -1);
+
+		// Adding the processing arguments recorded with the session given through -replay <dir> to the arguments, after the given ones so
+		// that those take precedence
+		static void AddReplayArguments(std::vector<std::string>& arguments);
+
+		// Video file, or a raw video (.ofraw) which is read from the memory mapped file without decoding
 		bool OpenVideoFile(std::string video_file, float fx = -1, float fy = -1, float cx = -1, float cy = -1);
 
+		// Frames pushed through PushExternalFrame, if convert_to_bgr is false GetNextFrame returns the Y plane instead of a colour image
+		bool OpenExternal(int width, int height, double fps, bool convert_to_bgr = true, std::string name = "external", float fx = -1, float fy = -1, float cx = -1, float cy = -1);
+
+		// Adding an external frame to the capture queue (blocks if the queue is full), can be called from the decoding thread. The Y plane is used
+		// directly as the grayscale frame
+		bool PushExternalFrame(const ExternalFrame& frame);
+
+		// No more external frames will be pushed, GetNextFrame returns an empty frame once the queued ones are consumed
+		void EndExternalFrames();
+
+		// When the capture queue is full, drop the oldest frame instead of blocking the producer, meant for live external sources where
+		// keeping up matters more than processing every frame (webcams are always read synchronously, so never queue up)
+		void SetDropFramesWhenFull(bool drop_frames);
+
+		// For interactive use, the next opened webcam is grabbed continuously on a thread of its own and GetNextFrame returns the latest
+		// frame, the frames that were replaced before being returned are dropped (-latest_frame). Otherwise the frames the camera driver
+		// buffers while the processing is slower than the camera are returned in order, with growing latency
+		void SetLatestFrameOnly(bool latest_frame_only) { this->latest_frame_only = latest_frame_only; }
+
+		// The number of webcam frames replaced by a later one before being returned
+		size_t GetNumDroppedFrames() const { return webcam_dropped; }
+
 		bool IsWebcam() { return is_webcam; }
 
+		// The webcam timestamps are measured from the given cv::getTickCount() time, so that several webcams can share a clock
+		void SetClockStart(int64 start_time) { this->start_time = start_time; }
+
 		// Getting the next frame
 		cv::Mat GetNextFrame();
 
@@ -91,8 +177,19 @@ namespace Utilities
 
 		size_t GetFrameNumber() { return frame_num; }
 
+		// The number of frames in the video file (as reported by the container, so it can be approximate) or image sequence, 0 if not known
+		size_t GetNumFrames() { return (is_webcam || is_external) ? 0 : vid_length; }
+
 		bool IsOpened();
 
+		// Adding the memory of the queued frames (component/queue), of the free recycled frame buffers (component/frame_pool) and of the latest
+		// frames (component/latest) to the report
+		void ReportMemory(MemoryReport& report, const std::string& component = "capture");
+
+		// Allocating and pre-faulting the recycled buffers of num_frames colour and grayscale frames of the opened input (as many as the pools
+		// hold), for the real-time memory mode, so that capturing does not touch new memory once running. Returns the number of frames prefaulted
+		size_t PrefaultBuffers(size_t num_frames);
+
 		void Close();
 
 		int frame_width;
@@ -118,11 +215,20 @@ namespace Utilities
 		// Used to keep track if the recording is still going (for the writing threads)
 		bool capturing;
 
-		// For keeping track of tasks
-		tbb::task_group capture_threads;
+		// The capture and conversion threads (plain threads rather than TBB tasks, so that the blocking capture does not take up the TBB workers)
+		std::thread capture_thread;
+		std::thread conversion_thread;
 
 		// A thread that will write video output, so that the rest of the application does not block on it
-		void CaptureThread();
+		void CaptureThread(size_t first_frame, size_t last_frame);
+
+		// Converting the decoded frames to grayscale on a separate thread, so that decoding is not held up by it
+		void ConversionThread();
+
+		// Video decoding settings
+		std::string decode_backend;
+		bool decode_hw_acceleration;
+		int decode_threads;
 
 		// Blocking copy and move, as it doesn't make sense to have several readers pointed at the same source, and this would cause issues, especially with webcams
 		SequenceCapture & operator= (const SequenceCapture& other);
@@ -138,27 +244,102 @@ namespace Utilities
 		cv::Mat_<uchar> latest_gray_frame;
 		
 
-		// Storing the captured data queue
-		const int CAPTURE_CAPACITY = 200; // 200 MB
+		// Storing the captured data queue, bounded by the memory of the queued frames
+		const size_t CAPTURE_CAPACITY = 200; // 200 MB
 		// Storing capture timestamp, RGB image, gray image
-		tbb::concurrent_bounded_queue<std::tuple<double, cv::Mat, cv::Mat_<uchar> > > capture_queue;
+		FrameQueue<std::tuple<double, cv::Mat, cv::Mat_<uchar> > > capture_queue;
+
+		// The decoded frames waiting for grayscale conversion, between exactly the capture and the conversion thread so it does not need a lock
+		const size_t DECODE_SLOTS = 8;
+		SpscRing<std::pair<double, cv::Mat> > decoded_queue;
+
+		bool drop_frames_when_full;
+
+		// Recycling the captured frames once they have been processed
+		FrameBufferPool frame_pool;
+		FrameBufferPool gray_frame_pool;
+
+		void PushCaptured(double timestamp, const cv::Mat& frame, const cv::Mat_<uchar>& gray_frame);
+
+		// Reading a raw video instead of decoding a video file
+		bool OpenRawVideo(const std::string& video_file, float fx, float fy, float cx, float cy);
+		RawVideoReader raw_video;
+
+		// Writing the frames to a raw video as they are read
+		void StartRawOutput();
+		void WriteRawFrame(double timestamp, const cv::Mat& frame, const cv::Mat_<uchar>& gray_frame);
+		std::string raw_output_file;
+		RawVideoWriter raw_output;
 
 		// Keeping track of frame number and the files in the image sequence
 		size_t  frame_num;
+		size_t  start_frame;
+		size_t  end_frame;
 		std::vector<std::string> image_files;
 
+		// The capture times of the images from the timestamps.csv index of the directory (as written by Recording), empty without an index
+		std::vector<double> image_timestamps;
+
+		// Decoding the images of a sequence in parallel
+		ImagePrefetcher image_prefetcher;
+
 		// Length of video allowing to assess progress
 		size_t vid_length;
 
 		// If using a webcam, helps to keep track of time
 		int64 start_time;
 
-		// Keeping track if we are opening a video, webcam or image sequence
+		// The time of the frame just grabbed from the webcam, from the camera's own timestamps when the backend provides them (they are
+		// taken when the frame was captured rather than when it was read), otherwise from the time it was read
+		double WebcamTimestamp();
+		double camera_time_offset;
+		double last_camera_time;
+		bool has_camera_time;
+
+		// The single frame mailbox of the latest frame mode, filled by the capture thread
+		void WebcamThread();
+		bool latest_frame_only;
+		std::mutex webcam_mutex;
+		std::condition_variable webcam_frame_ready;
+		cv::Mat webcam_frame;
+		double webcam_time_stamp;
+		bool has_webcam_frame;
+		bool webcam_ended;
+		size_t webcam_dropped;
+
+		// Keeping track if we are opening a video, webcam, image sequence, or external frames
 		bool is_webcam;
 		bool is_image_seq;
+		bool is_external;
+		bool external_to_bgr;
 
 		void SetCameraIntrinsics(float fx, float fy, float cx, float cy);
 
+		// Recording the session, the directory is cleared once the output is started so that it is only recorded for one sequence
+		void StartSessionOutput();
+		void WriteSessionFrame(double timestamp, const cv::Mat& frame, const cv::Mat_<uchar>& gray_frame);
+		void CloseSessionOutput();
+		std::string session_directory;
+		std::string session_output_directory;
+		double session_scale;
+		std::vector<std::string> session_arguments;
+		RawVideoWriter session_video;
+		std::ofstream session_frames;
+		size_t session_frames_written;
+		cv::Mat session_frame;
+		cv::Mat_<uchar> session_gray_frame;
+
+		// Replaying a session at its original cadence, from the time the first frame was pushed, with the frames scaled back to the original size
+		void WaitForReplayFrame(double timestamp);
+		bool paced_replay;
+		bool replay_started;
+		std::chrono::steady_clock::time_point replay_start;
+		double replay_first_timestamp;
+		int replay_width;
+		int replay_height;
+		cv::Mat replay_frame;
+		cv::Mat_<uchar> replay_gray_frame;
+
 
 	};
 }
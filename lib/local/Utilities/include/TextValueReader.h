@@ -0,0 +1,136 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef TEXT_VALUE_READER_H
+#define TEXT_VALUE_READER_H
+
+// Reading whitespace separated numbers from the text model files. The values are taken straight from the stream buffer and converted with
+// strtod/strtol, which avoids the sentry construction and locale lookups operator>> does for every single value (the text models have
+// hundreds of thousands of them). The stream is left right after the last value read, so it is a drop-in for a loop of stream >> value.
+// It is header only, so that it can be used by all of the libraries without adding link dependencies between them.
+
+// System includes
+#include <cstdlib>
+#include <istream>
+#include <streambuf>
+
+namespace Utilities
+{
+namespace TextValueReader
+{
+	// The longest number representation expected, longer tokens are (as with operator>>) a read failure
+	const size_t MAX_TOKEN_LENGTH = 64;
+
+	inline bool IsSpace(int c)
+	{
+		return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+	}
+
+	// Reading the next token into the buffer, returns false on the end of the stream or on a too long token
+	inline bool ReadToken(std::streambuf* buffer, char* token)
+	{
+		typedef std::char_traits<char> traits;
+
+		traits::int_type c = buffer->sgetc();
+		while (!traits::eq_int_type(c, traits::eof()) && IsSpace(c))
+		{
+			c = buffer->snextc();
+		}
+
+		size_t length = 0;
+		while (!traits::eq_int_type(c, traits::eof()) && !IsSpace(c))
+		{
+			if (length + 1 == MAX_TOKEN_LENGTH)
+			{
+				return false;
+			}
+			token[length++] = traits::to_char_type(c);
+			c = buffer->snextc();
+		}
+		token[length] = 0;
+
+		return length > 0;
+	}
+
+	inline bool ParseValue(const char* token, double& value)
+	{
+		char* end;
+		value = std::strtod(token, &end);
+		return *end == 0;
+	}
+
+	inline bool ParseValue(const char* token, float& value)
+	{
+		char* end;
+		value = std::strtof(token, &end);
+		return *end == 0;
+	}
+
+	inline bool ParseValue(const char* token, int& value)
+	{
+		char* end;
+		value = (int)std::strtol(token, &end, 10);
+		return *end == 0;
+	}
+
+	// Reading count values into the output, on a failure the remaining values are set to 0 and the failbit of the stream is set
+	template <typename T>
+	bool ReadValues(std::istream& stream, T* output, size_t count)
+	{
+		std::istream::sentry sentry(stream, true);
+		if (!sentry)
+		{
+			for (size_t i = 0; i < count; ++i)
+				output[i] = 0;
+			return false;
+		}
+
+		std::streambuf* buffer = stream.rdbuf();
+		char token[MAX_TOKEN_LENGTH];
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (!ReadToken(buffer, token) || !ParseValue(token, output[i]))
+			{
+				for (; i < count; ++i)
+					output[i] = 0;
+				stream.setstate(std::ios_base::failbit);
+				return false;
+			}
+		}
+		return true;
+	}
+}
+}
+
+#endif // TEXT_VALUE_READER_H
@@ -0,0 +1,294 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef TRACING_H
+#define TRACING_H
+
+// A lightweight tracing layer for the hot paths: scoped timers and counters are recorded into per thread ring buffers and can be
+// exported as a Chrome trace (JSON, can be opened in chrome://tracing or Perfetto). The tracing is only compiled in when OPENFACE_TRACING
+// is defined (the OPENFACE_TRACING CMake option), and once compiled in it only records after Tracing::SetEnabled(true).
+// It is header only, so that it can be used by all of the libraries without adding link dependencies between them.
+//
+// Usage:
+//	void Function() { TRACE_SCOPE("Function"); ... }		// the name has to be a string literal (or otherwise outlive the trace)
+//	TRACE_SCOPE_ARG("CLNF::Fit scale", scale);				// with an integer argument shown with the event
+//	TRACE_COUNTER("capture_queue", queue.size());			// a counter track
+
+// System includes
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Utilities
+{
+namespace Tracing
+{
+	struct TraceEvent
+	{
+		const char* name;
+
+		// In microseconds since the start of tracing, the duration is only used by timers
+		int64_t start;
+		int64_t duration;
+
+		// The argument of a timer or the value of a counter
+		int64_t value;
+		bool has_value;
+		bool is_counter;
+	};
+
+	// The events of a single thread, once full the oldest events are overwritten
+	class ThreadBuffer
+	{
+	public:
+
+		ThreadBuffer(int thread_id, size_t capacity) : thread_id(thread_id), events(capacity), num_written(0) {}
+
+		void Add(const TraceEvent& event)
+		{
+			std::lock_guard<std::mutex> lock(buffer_mutex);
+			events[num_written % events.size()] = event;
+			num_written++;
+		}
+
+		// The recorded events, oldest first
+		std::vector<TraceEvent> GetEvents()
+		{
+			std::lock_guard<std::mutex> lock(buffer_mutex);
+			std::vector<TraceEvent> out;
+			size_t num_events = num_written < events.size() ? num_written : events.size();
+			for (size_t i = num_written - num_events; i < num_written; ++i)
+			{
+				out.push_back(events[i % events.size()]);
+			}
+			return out;
+		}
+
+		void Clear()
+		{
+			std::lock_guard<std::mutex> lock(buffer_mutex);
+			num_written = 0;
+		}
+
+		int GetThreadId() const { return thread_id; }
+
+	private:
+
+		int thread_id;
+
+		// The lock is only ever contended when exporting
+		std::mutex buffer_mutex;
+		std::vector<TraceEvent> events;
+		size_t num_written;
+	};
+
+	// The state shared by all of the threads
+	struct TraceState
+	{
+		TraceState() : enabled(false), epoch(std::chrono::steady_clock::now()), buffer_capacity(1 << 16) {}
+
+		std::atomic<bool> enabled;
+		std::chrono::steady_clock::time_point epoch;
+		size_t buffer_capacity;
+
+		std::mutex buffers_mutex;
+		std::vector<std::shared_ptr<ThreadBuffer> > buffers;
+	};
+
+	inline TraceState& GetState()
+	{
+		static TraceState state;
+		return state;
+	}
+
+	inline bool IsEnabled()
+	{
+		return GetState().enabled.load(std::memory_order_relaxed);
+	}
+
+	// Starting or stopping the recording, the events per thread can be set before recording starts
+	inline void SetEnabled(bool enabled, size_t events_per_thread = 1 << 16)
+	{
+		TraceState& state = GetState();
+		if (enabled)
+		{
+			state.buffer_capacity = events_per_thread;
+		}
+		state.enabled = enabled;
+	}
+
+	inline int64_t Now()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - GetState().epoch).count();
+	}
+
+	// The buffer of the calling thread, created (and registered for exporting) on first use
+	inline ThreadBuffer& GetThreadBuffer()
+	{
+		static thread_local std::shared_ptr<ThreadBuffer> buffer;
+		if (!buffer)
+		{
+			TraceState& state = GetState();
+			std::lock_guard<std::mutex> lock(state.buffers_mutex);
+			buffer = std::make_shared<ThreadBuffer>((int)state.buffers.size() + 1, state.buffer_capacity);
+			state.buffers.push_back(buffer);
+		}
+		return *buffer;
+	}
+
+	inline void Counter(const char* name, int64_t value)
+	{
+		if (!IsEnabled())
+			return;
+
+		TraceEvent event = { name, Now(), 0, value, true, true };
+		GetThreadBuffer().Add(event);
+	}
+
+	// Recording the time from construction to destruction
+	class ScopedTimer
+	{
+	public:
+
+		explicit ScopedTimer(const char* name) : name(name), value(0), has_value(false), start(IsEnabled() ? Now() : -1) {}
+		ScopedTimer(const char* name, int64_t value) : name(name), value(value), has_value(true), start(IsEnabled() ? Now() : -1) {}
+
+		~ScopedTimer()
+		{
+			if (start < 0 || !IsEnabled())
+				return;
+
+			int64_t end = Now();
+			TraceEvent event = { name, start, end - start, value, has_value, false };
+			GetThreadBuffer().Add(event);
+		}
+
+	private:
+
+		ScopedTimer(const ScopedTimer& other);
+		ScopedTimer & operator= (const ScopedTimer& other);
+
+		const char* name;
+		int64_t value;
+		bool has_value;
+		int64_t start;
+	};
+
+	// Discarding all of the recorded events
+	inline void Clear()
+	{
+		TraceState& state = GetState();
+		std::lock_guard<std::mutex> lock(state.buffers_mutex);
+		for (size_t i = 0; i < state.buffers.size(); ++i)
+		{
+			state.buffers[i]->Clear();
+		}
+	}
+
+	inline void WriteJSONString(std::ostream& out, const char* str)
+	{
+		out << '"';
+		for (const char* c = str; *c != 0; ++c)
+		{
+			if (*c == '"' || *c == '\\')
+				out << '\\';
+			out << *c;
+		}
+		out << '"';
+	}
+
+	// Writing the recorded events of all of the threads in the Chrome trace event format
+	inline bool WriteChromeTrace(const std::string& filename)
+	{
+		std::ofstream out(filename.c_str());
+		if (!out.is_open())
+		{
+			return false;
+		}
+
+		TraceState& state = GetState();
+		std::vector<std::shared_ptr<ThreadBuffer> > buffers;
+		{
+			std::lock_guard<std::mutex> lock(state.buffers_mutex);
+			buffers = state.buffers;
+		}
+
+		out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		bool first = true;
+		for (size_t b = 0; b < buffers.size(); ++b)
+		{
+			std::vector<TraceEvent> events = buffers[b]->GetEvents();
+			for (size_t i = 0; i < events.size(); ++i)
+			{
+				const TraceEvent& event = events[i];
+				out << (first ? "\n" : ",\n") << "{\"name\":";
+				WriteJSONString(out, event.name);
+				out << ",\"ph\":\"" << (event.is_counter ? "C" : "X") << "\",\"pid\":1,\"tid\":" << buffers[b]->GetThreadId() << ",\"ts\":" << event.start;
+				if (!event.is_counter)
+				{
+					out << ",\"dur\":" << event.duration;
+				}
+				if (event.has_value)
+				{
+					out << ",\"args\":{\"value\":" << event.value << "}";
+				}
+				out << "}";
+				first = false;
+			}
+		}
+		out << "\n]}\n";
+
+		return (bool)out;
+	}
+}
+}
+
+#ifdef OPENFACE_TRACING
+#define OPENFACE_TRACE_CONCAT_IMPL(a, b) a##b
+#define OPENFACE_TRACE_CONCAT(a, b) OPENFACE_TRACE_CONCAT_IMPL(a, b)
+#define TRACE_SCOPE(name) Utilities::Tracing::ScopedTimer OPENFACE_TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, value) Utilities::Tracing::ScopedTimer OPENFACE_TRACE_CONCAT(trace_scope_, __LINE__)(name, (int64_t)(value))
+#define TRACE_COUNTER(name, value) Utilities::Tracing::Counter(name, (int64_t)(value))
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_ARG(name, value)
+#define TRACE_COUNTER(name, value)
+#endif
+
+#endif // TRACING_H
@@ -0,0 +1,219 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef TUNING_CACHE_H
+#define TUNING_CACHE_H
+
+// The kernel and parallelism choices tuned once on the deployment host (by openface_autotune), stored as a small text file of key value pairs
+// that the models consult when they are read: the convolution method of every MTCNN PNet layer per pyramid level size (mtcnn/pnet/HxW/layer),
+// the grain size of the CLNF patch response tasks (clnf/response_grain_size) and the offline AU prediction batch size (face_analyser/au_batch_size).
+// The file starts with the host it was tuned on, and a cache tuned on another host (a different CPU or number of hardware threads) is not used.
+// It is header only, so that it can be used by all of the libraries without adding link dependencies between them.
+//
+// File format:
+//	host <cpu model>/<hardware threads>
+//	<key> <value>
+//	...
+
+// System includes
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Utilities
+{
+
+	//===========================================================================
+	/**
+	The tuned integer choices by key, the process wide cache (Global) is loaded through the -tuning_cache argument and has to be loaded before
+	the models are read
+	*/
+	class TuningCache {
+
+	public:
+
+		TuningCache() { ; }
+
+		static TuningCache& Global()
+		{
+			static TuningCache cache;
+			return cache;
+		}
+
+		// The CPU model and the number of hardware threads, the tuned choices depend on both
+		static std::string HostSignature()
+		{
+			std::string cpu = "unknown";
+			std::ifstream cpuinfo("/proc/cpuinfo");
+			std::string line;
+			while (cpuinfo.is_open() && std::getline(cpuinfo, line))
+			{
+				if (line.compare(0, 10, "model name") == 0 && line.find(':') != std::string::npos)
+				{
+					cpu = line.substr(line.find(':') + 1);
+					cpu.erase(0, cpu.find_first_not_of(" \t"));
+					break;
+				}
+			}
+			for (size_t i = 0; i < cpu.size(); ++i)
+			{
+				if (cpu[i] == ' ' || cpu[i] == '\t')
+					cpu[i] = '_';
+			}
+			std::stringstream signature;
+			signature << cpu << "/" << std::thread::hardware_concurrency();
+			return signature.str();
+		}
+
+		// Replacing the choices with the ones in the file, returns false (with the cache left empty) if the file can not be read or was tuned on another host
+		bool Load(const std::string& filename)
+		{
+			std::ifstream in(filename.c_str());
+			if (!in.is_open())
+			{
+				std::cout << "WARNING: could not open the tuning cache " << filename << std::endl;
+				return false;
+			}
+
+			std::map<std::string, int> read_values;
+			std::string host;
+			std::string line;
+			while (std::getline(in, line))
+			{
+				if (line.empty() || line[0] == '#')
+					continue;
+
+				std::stringstream line_stream(line);
+				std::string key;
+				line_stream >> key;
+				if (key == "host")
+				{
+					line_stream >> host;
+					continue;
+				}
+				int value;
+				if (line_stream >> value)
+				{
+					read_values[key] = value;
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(values_mutex);
+			values.clear();
+			if (host != HostSignature())
+			{
+				std::cout << "WARNING: the tuning cache " << filename << " was tuned on " << host << " and not on this host (" << HostSignature() << "), rerun openface_autotune" << std::endl;
+				return false;
+			}
+			values.swap(read_values);
+			std::cout << "Using the tuning cache " << filename << " (" << values.size() << " choices)" << std::endl;
+			return true;
+		}
+
+		bool Save(const std::string& filename) const
+		{
+			std::ofstream out(filename.c_str());
+			if (!out.is_open())
+			{
+				return false;
+			}
+			out << "host " << HostSignature() << "\n";
+
+			std::lock_guard<std::mutex> lock(values_mutex);
+			for (std::map<std::string, int>::const_iterator it = values.begin(); it != values.end(); ++it)
+			{
+				out << it->first << " " << it->second << "\n";
+			}
+			return (bool)out;
+		}
+
+		bool Get(const std::string& key, int& value) const
+		{
+			std::lock_guard<std::mutex> lock(values_mutex);
+			std::map<std::string, int>::const_iterator it = values.find(key);
+			if (it == values.end())
+			{
+				return false;
+			}
+			value = it->second;
+			return true;
+		}
+
+		void Set(const std::string& key, int value)
+		{
+			std::lock_guard<std::mutex> lock(values_mutex);
+			values[key] = value;
+		}
+
+		// All of the choices with keys starting with the prefix, with the prefix removed from the keys
+		std::vector<std::pair<std::string, int> > GetPrefixed(const std::string& prefix) const
+		{
+			std::lock_guard<std::mutex> lock(values_mutex);
+			std::vector<std::pair<std::string, int> > out;
+			for (std::map<std::string, int>::const_iterator it = values.lower_bound(prefix); it != values.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+			{
+				out.push_back(std::make_pair(it->first.substr(prefix.size()), it->second));
+			}
+			return out;
+		}
+
+		bool Empty() const
+		{
+			std::lock_guard<std::mutex> lock(values_mutex);
+			return values.empty();
+		}
+
+		void Clear()
+		{
+			std::lock_guard<std::mutex> lock(values_mutex);
+			values.clear();
+		}
+
+	private:
+
+		TuningCache(const TuningCache& other);
+		TuningCache & operator= (const TuningCache& other);
+
+		mutable std::mutex values_mutex;
+		std::map<std::string, int> values;
+	};
+}
+
+#endif // TUNING_CACHE_H
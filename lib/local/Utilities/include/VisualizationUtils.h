@@ -35,6 +35,7 @@
 #define VISUALIZATION_UTILS_H
 
 #include <opencv2/core/core.hpp>
+#include <opencv2/imgproc.hpp>
 
 #include <vector>
 #include <queue>
@@ -43,13 +44,13 @@ namespace Utilities
 {
 
 	// Drawing a bounding box around the face in an image
-	void DrawBox(cv::Mat image, cv::Vec6f pose, cv::Scalar color, int thickness, float fx, float fy, float cx, float cy);
-	void DrawBox(const std::vector<std::pair<cv::Point2f, cv::Point2f>>& lines, cv::Mat image, cv::Scalar color, int thickness);
+	void DrawBox(cv::Mat image, cv::Vec6f pose, cv::Scalar color, int thickness, float fx, float fy, float cx, float cy, int line_type = cv::LINE_AA);
+	void DrawBox(const std::vector<std::pair<cv::Point2f, cv::Point2f>>& lines, cv::Mat image, cv::Scalar color, int thickness, int line_type = cv::LINE_AA);
 
 	// Computing a bounding box to be drawn
 	std::vector<std::pair<cv::Point2f, cv::Point2f>> CalculateBox(cv::Vec6f pose, float fx, float fy, float cx, float cy);
 
-    void Visualise_FHOG(const cv::Mat_<double>& descriptor, int num_rows, int num_cols, cv::Mat& visualisation);
+    void Visualise_FHOG(const cv::Mat_<float>& descriptor, int num_rows, int num_cols, cv::Mat& visualisation);
 
 	class FpsTracker
 	{
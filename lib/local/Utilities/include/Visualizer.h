@@ -40,6 +40,7 @@
 // OpenCV includes
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc.hpp>
 
 namespace Utilities
 {
@@ -69,6 +70,13 @@ namespace Utilities
 		
 		void SetObservationActionUnits(const std::vector<std::pair<std::string, double> >& au_intensities, const std::vector<std::pair<std::string, double> >& au_occurences);
 
+		// The same with the values in the order of the names (e.g. FaceAnalyser::GetAURegNameTable), NaN values are not shown
+		void SetObservationActionUnits(const std::vector<std::string>& au_intensity_names, const std::vector<float>& au_intensities,
+			const std::vector<std::string>& au_occurence_names, const std::vector<float>& au_occurences);
+
+		// Pairing the values with their names, leaving out the NaN ones
+		static std::vector<std::pair<std::string, double> > NamedAUs(const std::vector<std::string>& names, const std::vector<float>& values);
+
 		// Gaze related observations
 		void SetObservationGaze(const cv::Point3f& gazeDirection0, const cv::Point3f& gazeDirection1, const std::vector<cv::Point2f>& eye_landmarks, const std::vector<cv::Point3f>& eye_landmarks3d, double confidence);
 
@@ -76,7 +84,7 @@ namespace Utilities
 		void SetObservationFaceAlign(const cv::Mat& aligned_face);
 
 		// HOG feature related observations
-		void SetObservationHOG(const cv::Mat_<double>& hog_descriptor, int num_cols, int num_rows);
+		void SetObservationHOG(const cv::Mat_<float>& hog_descriptor, int num_cols, int num_rows);
 
 		void SetFps(double fps);
 
@@ -86,15 +94,24 @@ namespace Utilities
 		cv::Mat GetVisImage();
 		cv::Mat GetHOGVis();
 
+		// If the tracking image is needed by the display or the recording
+		bool DrawsTrack() const { return vis_track || record_track; }
+
 		// Keeping track of what we're visualizing
 		bool vis_track;
 		bool vis_hog;
 		bool vis_align;
 		bool vis_aus;
 
+		// The tracking image is also drawn when it is recorded (e.g. as the tracked video), the visualizations nobody shows or records are not drawn
+		bool record_track = false;
+
 		// Can be adjusted to show less confident frames
 		double visualisation_boundary = 0.4;
 
+		// Anti-aliased by default, the considerably cheaper cv::LINE_8 can be used instead (-vis-fast)
+		int line_type = cv::LINE_AA;
+
 	private:
 
 		// Temporary variables for visualization
@@ -0,0 +1,201 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "AsyncVisualizer.h"
+
+// OpenCV includes
+#include <opencv2/highgui/highgui.hpp>
+
+using namespace Utilities;
+
+// How long the UI thread waits for a new frame before handling the window events again
+const int EVENT_INTERVAL_MS = 20;
+
+AsyncVisualizer::AsyncVisualizer(bool vis_track, bool vis_hog, bool vis_align, bool vis_aus, double visualisation_boundary, int line_type) :
+	visualizer(vis_track, vis_hog, vis_align, vis_aus), has_pending(false), stopping(false), last_key('\0'), num_dropped(0)
+{
+	visualizer.visualisation_boundary = visualisation_boundary;
+	visualizer.line_type = line_type;
+	ui_thread = std::thread(&AsyncVisualizer::RenderingThread, this);
+}
+
+AsyncVisualizer::~AsyncVisualizer()
+{
+	{
+		std::lock_guard<std::mutex> lock(frame_mutex);
+		stopping = true;
+	}
+	frame_ready.notify_all();
+	ui_thread.join();
+}
+
+// The observations are copied, as the frame is drawn after the caller has moved on
+void AsyncVisualizer::SetImage(const cv::Mat& canvas, float fx, float fy, float cx, float cy)
+{
+	cv::Mat image = canvas.clone();
+	building.push_back([image, fx, fy, cx, cy](Visualizer& vis) { vis.SetImage(image, fx, fy, cx, cy); });
+}
+
+void AsyncVisualizer::SetObservationLandmarks(const cv::Mat_<float>& landmarks_2D, double confidence, const cv::Mat_<int>& visibilities)
+{
+	cv::Mat_<float> landmarks = landmarks_2D.clone();
+	cv::Mat_<int> visible = visibilities.clone();
+	building.push_back([landmarks, confidence, visible](Visualizer& vis) { vis.SetObservationLandmarks(landmarks, confidence, visible); });
+}
+
+void AsyncVisualizer::SetObservationPose(const cv::Vec6f& pose, double confidence)
+{
+	building.push_back([pose, confidence](Visualizer& vis) { vis.SetObservationPose(pose, confidence); });
+}
+
+void AsyncVisualizer::SetObservationActionUnits(const std::vector<std::pair<std::string, double> >& au_intensities, const std::vector<std::pair<std::string, double> >& au_occurences)
+{
+	if (!visualizer.vis_aus)
+		return;
+
+	building.push_back([au_intensities, au_occurences](Visualizer& vis) { vis.SetObservationActionUnits(au_intensities, au_occurences); });
+}
+
+void AsyncVisualizer::SetObservationActionUnits(const std::vector<std::string>& au_intensity_names, const std::vector<float>& au_intensities,
+	const std::vector<std::string>& au_occurence_names, const std::vector<float>& au_occurences)
+{
+	if (!visualizer.vis_aus)
+		return;
+
+	SetObservationActionUnits(Visualizer::NamedAUs(au_intensity_names, au_intensities), Visualizer::NamedAUs(au_occurence_names, au_occurences));
+}
+
+void AsyncVisualizer::SetObservationGaze(const cv::Point3f& gazeDirection0, const cv::Point3f& gazeDirection1, const std::vector<cv::Point2f>& eye_landmarks, const std::vector<cv::Point3f>& eye_landmarks3d, double confidence)
+{
+	building.push_back([gazeDirection0, gazeDirection1, eye_landmarks, eye_landmarks3d, confidence](Visualizer& vis)
+	{
+		vis.SetObservationGaze(gazeDirection0, gazeDirection1, eye_landmarks, eye_landmarks3d, confidence);
+	});
+}
+
+void AsyncVisualizer::SetObservationFaceAlign(const cv::Mat& aligned_face)
+{
+	if (!visualizer.vis_align)
+		return;
+
+	cv::Mat aligned = aligned_face.clone();
+	building.push_back([aligned](Visualizer& vis) { vis.SetObservationFaceAlign(aligned); });
+}
+
+void AsyncVisualizer::SetObservationHOG(const cv::Mat_<float>& hog_descriptor, int num_cols, int num_rows)
+{
+	if (!visualizer.vis_hog)
+		return;
+
+	cv::Mat_<float> hog = hog_descriptor.clone();
+	building.push_back([hog, num_cols, num_rows](Visualizer& vis) { vis.SetObservationHOG(hog, num_cols, num_rows); });
+}
+
+void AsyncVisualizer::SetFps(double fps)
+{
+	building.push_back([fps](Visualizer& vis) { vis.SetFps(fps); });
+}
+
+void AsyncVisualizer::Submit()
+{
+	{
+		std::lock_guard<std::mutex> lock(frame_mutex);
+		if (has_pending)
+		{
+			num_dropped++;
+		}
+		pending.swap(building);
+		has_pending = true;
+	}
+	building.clear();
+	frame_ready.notify_one();
+}
+
+char AsyncVisualizer::GetKey()
+{
+	return last_key.exchange('\0');
+}
+
+void AsyncVisualizer::RenderingThread()
+{
+	Frame frame;
+	bool windows_shown = false;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(frame_mutex);
+			frame_ready.wait_for(lock, std::chrono::milliseconds(EVENT_INTERVAL_MS), [this] { return has_pending || stopping; });
+			if (stopping)
+			{
+				break;
+			}
+			frame.clear();
+			if (has_pending)
+			{
+				frame.swap(pending);
+				has_pending = false;
+			}
+		}
+
+		char key = '\0';
+		if (!frame.empty())
+		{
+			// Drawing happens here rather than in the Set calls, so it is off the processing thread as well
+			for (size_t i = 0; i < frame.size(); ++i)
+			{
+				frame[i](visualizer);
+			}
+			key = visualizer.ShowObservation();
+			windows_shown = windows_shown || visualizer.vis_track || visualizer.vis_align || visualizer.vis_hog || visualizer.vis_aus;
+		}
+		else if (windows_shown)
+		{
+			// Keeping the windows responsive while no new frames arrive
+			key = (char)cv::waitKey(1);
+		}
+
+		// waitKey returns -1 when no key was pressed
+		if (key != '\0' && key != (char)-1)
+		{
+			last_key = key;
+		}
+	}
+
+	if (windows_shown)
+	{
+		cv::destroyAllWindows();
+	}
+}
@@ -0,0 +1,265 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "CompressedOutput.h"
+
+#include <iostream>
+
+#ifdef OPENFACE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef OPENFACE_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace Utilities;
+
+#define WARN_STREAM( stream ) \
+std::cout << "Warning: " << stream << std::endl
+
+namespace
+{
+	// The block marking the end of the pushed blocks
+	const long long END_OF_BLOCKS = -2;
+}
+
+OutputCompression Utilities::ParseOutputCompression(const std::string& name)
+{
+	if (name == "zstd" || name == "zst")
+		return COMPRESSION_ZSTD;
+	if (name == "gzip" || name == "gz")
+		return COMPRESSION_GZIP;
+	return COMPRESSION_NONE;
+}
+
+bool Utilities::IsCompressionAvailable(OutputCompression compression)
+{
+	switch (compression)
+	{
+	case COMPRESSION_NONE:
+		return true;
+	case COMPRESSION_ZSTD:
+#ifdef OPENFACE_ZSTD
+		return true;
+#else
+		return false;
+#endif
+	case COMPRESSION_GZIP:
+#ifdef OPENFACE_ZLIB
+		return true;
+#else
+		return false;
+#endif
+	}
+	return false;
+}
+
+std::string Utilities::CompressionExtension(OutputCompression compression)
+{
+	switch (compression)
+	{
+	case COMPRESSION_ZSTD:
+		return ".zst";
+	case COMPRESSION_GZIP:
+		return ".gz";
+	default:
+		return "";
+	}
+}
+
+bool Utilities::IsCompressedOutput(const std::string& filename)
+{
+	const char* extensions[] = { ".zst", ".gz" };
+	for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i)
+	{
+		std::string extension(extensions[i]);
+		if (filename.size() >= extension.size() && filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0)
+			return true;
+	}
+	return false;
+}
+
+CompressedOutputFile::~CompressedOutputFile()
+{
+	Close();
+}
+
+bool CompressedOutputFile::Open(const std::string& filename, OutputCompression compression, int level)
+{
+	Close();
+
+	if (compression == COMPRESSION_NONE || !IsCompressionAvailable(compression))
+	{
+		WARN_STREAM("The compression of " << filename << " is not compiled in, build with -DOPENFACE_ZSTD=ON or -DOPENFACE_ZLIB=ON");
+		return false;
+	}
+
+	file.open(filename, std::ios_base::out | std::ios_base::binary);
+	index_file.open(filename + ".idx", std::ios_base::out);
+	if (!file.is_open() || !index_file.is_open())
+	{
+		file.close();
+		index_file.close();
+		return false;
+	}
+
+	this->compression = compression;
+	this->level = level;
+	offset = 0;
+
+#ifdef OPENFACE_ZSTD
+	if (compression == COMPRESSION_ZSTD && !context)
+	{
+		context = ZSTD_createCCtx();
+	}
+#endif
+
+	block_queue.set_capacity(BLOCK_QUEUE_CAPACITY);
+	return true;
+}
+
+bool CompressedOutputFile::Compress(const char* data, size_t size)
+{
+#ifdef OPENFACE_ZSTD
+	if (compression == COMPRESSION_ZSTD)
+	{
+		compressed.resize(ZSTD_compressBound(size));
+		size_t compressed_size = ZSTD_compressCCtx((ZSTD_CCtx*)context, compressed.data(), compressed.size(), data, size,
+			level > 0 ? level : ZSTD_CLEVEL_DEFAULT);
+		if (ZSTD_isError(compressed_size))
+			return false;
+		compressed.resize(compressed_size);
+		return true;
+	}
+#endif
+
+#ifdef OPENFACE_ZLIB
+	if (compression == COMPRESSION_GZIP)
+	{
+		// A complete gzip member (the window bits over 15 select the gzip wrapper)
+		z_stream stream = z_stream();
+		if (deflateInit2(&stream, level > 0 ? level : Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			return false;
+
+		compressed.resize(deflateBound(&stream, (uLong)size));
+		stream.next_in = (Bytef*)data;
+		stream.avail_in = (uInt)size;
+		stream.next_out = (Bytef*)compressed.data();
+		stream.avail_out = (uInt)compressed.size();
+		int result = deflate(&stream, Z_FINISH);
+		compressed.resize(stream.total_out);
+		deflateEnd(&stream);
+		return result == Z_STREAM_END;
+	}
+#endif
+
+	(void)data;
+	(void)size;
+	return false;
+}
+
+bool CompressedOutputFile::WriteBlock(const char* data, size_t size, long long first_frame)
+{
+	if (!file.is_open() || size == 0)
+	{
+		return file.is_open();
+	}
+
+	if (!Compress(data, size))
+	{
+		WARN_STREAM("Could not compress a block of the output");
+		return false;
+	}
+
+	if (first_frame >= 0)
+	{
+		index_file << first_frame << " " << offset << "\n";
+		index_file.flush();
+	}
+
+	// Only whole blocks are flushed, so that a reader following the file always finds complete frames
+	file.write(compressed.data(), compressed.size());
+	file.flush();
+	offset += (long long)compressed.size();
+	return (bool)file;
+}
+
+void CompressedOutputFile::PushBlock(std::string&& block, long long first_frame)
+{
+	if (!file.is_open())
+	{
+		return;
+	}
+
+	if (!writing_thread.joinable())
+	{
+		writing_thread = std::thread(&CompressedOutputFile::WritingThread, this);
+	}
+	block_queue.push(std::make_pair(first_frame, std::move(block)));
+}
+
+void CompressedOutputFile::WritingThread()
+{
+	while (true)
+	{
+		std::pair<long long, std::string> block;
+		block_queue.pop(block);
+		if (block.first == END_OF_BLOCKS)
+		{
+			break;
+		}
+		WriteBlock(block.second.data(), block.second.size(), block.first);
+	}
+}
+
+void CompressedOutputFile::Close()
+{
+	if (writing_thread.joinable())
+	{
+		block_queue.push(std::make_pair(END_OF_BLOCKS, std::string()));
+		writing_thread.join();
+	}
+
+	file.close();
+	index_file.close();
+
+#ifdef OPENFACE_ZSTD
+	if (context)
+	{
+		ZSTD_freeCCtx((ZSTD_CCtx*)context);
+		context = 0;
+	}
+#endif
+}
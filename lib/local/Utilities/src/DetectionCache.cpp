@@ -0,0 +1,207 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "DetectionCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+using namespace Utilities;
+
+#define WARN_STREAM( stream ) \
+std::cout << "Warning: " << stream << std::endl
+
+#define ERROR_STREAM( stream ) \
+std::cout << "Error: " << stream << std::endl
+
+bool DetectionCache::Open(const std::string& filename)
+{
+	Close();
+
+	std::ifstream in_file(filename.c_str(), std::ios_base::in);
+	if (in_file.is_open())
+	{
+		std::string line;
+		int line_number = 0;
+		while (std::getline(in_file, line))
+		{
+			line_number++;
+			if (line.empty())
+				continue;
+
+			std::stringstream ss(line);
+			uint64_t image_hash;
+			int detector, num_faces;
+			ss >> image_hash >> detector >> num_faces;
+
+			Entry entry;
+			for (int i = 0; i < num_faces && ss; ++i)
+			{
+				cv::Rect_<float> detection;
+				int num_keypoints;
+				ss >> detection.x >> detection.y >> detection.width >> detection.height >> num_keypoints;
+
+				std::vector<cv::Point2f> keypoints(std::max(num_keypoints, 0));
+				for (size_t k = 0; k < keypoints.size(); ++k)
+				{
+					ss >> keypoints[k].x >> keypoints[k].y;
+				}
+
+				entry.detections.push_back(detection);
+				entry.keypoints.push_back(keypoints);
+			}
+
+			// A partially written line (e.g. from an interrupted run) is skipped, the image will then be detected again
+			if (!ss)
+			{
+				WARN_STREAM("Skipping the malformed line " << line_number << " of the detection cache " << filename);
+				continue;
+			}
+
+			// Whether the detections came with keypoints or not, they are kept in the same form as they were added
+			bool has_keypoints = false;
+			for (size_t i = 0; i < entry.keypoints.size(); ++i)
+			{
+				has_keypoints = has_keypoints || !entry.keypoints[i].empty();
+			}
+			if (!has_keypoints)
+			{
+				entry.keypoints.clear();
+			}
+
+			entries[std::make_pair(image_hash, detector)] = entry;
+		}
+		in_file.close();
+	}
+
+	cache_file.open(filename.c_str(), std::ios_base::out | std::ios_base::app);
+	if (!cache_file.is_open())
+	{
+		ERROR_STREAM("Could not open the detection cache " << filename);
+		return false;
+	}
+
+	// Enough precision for the boxes to be read back identically
+	cache_file.precision(9);
+
+	return true;
+}
+
+void DetectionCache::Close()
+{
+	if (cache_file.is_open())
+	{
+		cache_file.close();
+	}
+	entries.clear();
+}
+
+uint64_t DetectionCache::ImageHash(const cv::Mat& image)
+{
+	// FNV-1a over the header and then a word at a time over the pixels of every row (the rows of a submatrix are not contiguous)
+	const uint64_t prime = 1099511628211ULL;
+	uint64_t hash = 14695981039346656037ULL;
+
+	const uint64_t header[3] = { (uint64_t)image.rows, (uint64_t)image.cols, (uint64_t)image.type() };
+	for (int i = 0; i < 3; ++i)
+	{
+		hash = (hash ^ header[i]) * prime;
+	}
+
+	const size_t row_bytes = image.cols * image.elemSize();
+	for (int r = 0; r < image.rows; ++r)
+	{
+		const uchar* row = image.ptr<uchar>(r);
+		size_t i = 0;
+		for (; i + sizeof(uint64_t) <= row_bytes; i += sizeof(uint64_t))
+		{
+			uint64_t word;
+			memcpy(&word, row + i, sizeof(uint64_t));
+			hash = (hash ^ word) * prime;
+		}
+		for (; i < row_bytes; ++i)
+		{
+			hash = (hash ^ row[i]) * prime;
+		}
+	}
+	return hash;
+}
+
+bool DetectionCache::Find(uint64_t image_hash, int detector, std::vector<cv::Rect_<float> >& detections, std::vector<std::vector<cv::Point2f> >& keypoints) const
+{
+	std::map<std::pair<uint64_t, int>, Entry>::const_iterator entry = entries.find(std::make_pair(image_hash, detector));
+	if (entry == entries.end())
+	{
+		return false;
+	}
+
+	detections = entry->second.detections;
+	keypoints = entry->second.keypoints;
+	return true;
+}
+
+void DetectionCache::Add(uint64_t image_hash, int detector, const std::vector<cv::Rect_<float> >& detections, const std::vector<std::vector<cv::Point2f> >& keypoints)
+{
+	Entry& entry = entries[std::make_pair(image_hash, detector)];
+	entry.detections = detections;
+	entry.keypoints = keypoints.size() == detections.size() ? keypoints : std::vector<std::vector<cv::Point2f> >();
+
+	if (!cache_file.is_open())
+	{
+		return;
+	}
+
+	// The whole line is written at once, so that an interrupted run leaves at most the last line partial
+	std::stringstream line;
+	line.precision(9);
+	line << image_hash << " " << detector << " " << detections.size();
+	for (size_t i = 0; i < detections.size(); ++i)
+	{
+		line << " " << detections[i].x << " " << detections[i].y << " " << detections[i].width << " " << detections[i].height;
+
+		const std::vector<cv::Point2f> no_keypoints;
+		const std::vector<cv::Point2f>& face_keypoints = entry.keypoints.empty() ? no_keypoints : entry.keypoints[i];
+		line << " " << face_keypoints.size();
+		for (size_t k = 0; k < face_keypoints.size(); ++k)
+		{
+			line << " " << face_keypoints[k].x << " " << face_keypoints[k].y;
+		}
+	}
+	line << "\n";
+
+	cache_file << line.str();
+	cache_file.flush();
+}
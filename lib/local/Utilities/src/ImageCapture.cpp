@@ -33,7 +33,10 @@
 
 #include "ImageCapture.h"
 #include "ImageManipulationHelpers.h"
+#include "RemoteStorage.h"
+#include <algorithm>
 #include <iostream>
+#include <map>
 
 // Boost includes
 #include <filesystem.hpp>
@@ -54,6 +57,39 @@ std::cout << "Warning: " << stream << std::endl
 #define ERROR_STREAM( stream ) \
 std::cout << "Error: " << stream << std::endl
 
+// Reading the bounding boxes of all of the images from a single file, each line being "image_name min_x min_y max_x max_y"
+bool ReadBoundingBoxFile(const std::string& bbox_file, std::map<std::string, std::vector<cv::Rect_<float> > >& bboxes)
+{
+	std::ifstream in_bbox(bbox_file.c_str(), std::ios_base::in);
+	if (!in_bbox.is_open())
+		return false;
+
+	std::string bbox_string;
+	while (std::getline(in_bbox, bbox_string))
+	{
+		if (bbox_string.empty())
+			continue;
+
+		std::stringstream ss(bbox_string);
+
+		std::string image_name;
+		float min_x, min_y, max_x, max_y;
+
+		if (ss >> image_name >> min_x >> min_y >> max_x >> max_y)
+		{
+			bboxes[image_name].push_back(cv::Rect_<float>(min_x, min_y, max_x - min_x, max_y - min_y));
+		}
+	}
+
+	return true;
+}
+
+// The remote images are fetched ahead of the processing even without the decoding workers, as every one of them waits on the network
+bool IsRemoteImageList(const std::vector<std::string>& image_files)
+{
+	return !image_files.empty() && IsRemotePath(image_files[0]);
+}
+
 bool ImageCapture::Open(std::vector<std::string>& arguments)
 {
 
@@ -126,6 +162,21 @@ bool ImageCapture::Open(std::vector<std::string>& arguments)
 			has_bounding_boxes = true;
 			i++;
 		}
+		else if (arguments[i].compare("-bboxfile") == 0)
+		{
+			// A single file with the bounding boxes of all of the images
+			bbox_directory = (input_root + arguments[i + 1]);
+			valid[i] = false;
+			valid[i + 1] = false;
+			has_bounding_boxes = true;
+			i++;
+		}
+		else if (arguments[i].compare("-decode_workers") == 0)
+		{
+			std::stringstream data(arguments[i + 1]);
+			data >> decode_workers;
+			i++;
+		}
 		else if (arguments[i].compare("-fx") == 0)
 		{
 			std::stringstream data(arguments[i + 1]);
@@ -186,6 +237,12 @@ bool ImageCapture::OpenImageFiles(const std::vector<std::string>& image_files, f
 	latest_gray_frame = cv::Mat();
 	this->image_files = image_files;
 
+	prefetcher.Stop();
+	if (decode_workers > 0 || IsRemoteImageList(this->image_files))
+	{
+		prefetcher.Start(this->image_files, std::max(decode_workers, IsRemoteImageList(this->image_files) ? REMOTE_READ_AHEAD : 0), true);
+	}
+
 	// Allow for setting the camera intrinsics, but have to be the same ones for every image
 	if (fx != -1 && fy != -1 )
 	{
@@ -224,9 +281,31 @@ bool ImageCapture::OpenDirectory(std::string directory, std::string bbox_directo
 
 	image_files.clear();
 
+	// Reading all of the bounding boxes up front if they are in a single file, indexed by the image name
+	std::map<std::string, std::vector<cv::Rect_<float> > > indexed_bboxes;
+	bool bbox_file = !bbox_directory.empty() && boost::filesystem::is_regular_file(bbox_directory);
+	if (bbox_file && !ReadBoundingBoxFile(bbox_directory, indexed_bboxes))
+	{
+		ERROR_STREAM("Could not read the bounding box file:" + bbox_directory);
+		exit(1);
+	}
+
 	boost::filesystem::path image_directory(directory);
 	std::vector<boost::filesystem::path> file_in_directory;
-	copy(boost::filesystem::directory_iterator(image_directory), boost::filesystem::directory_iterator(), back_inserter(file_in_directory));
+	if (IsRemotePath(directory))
+	{
+		// A remote directory is a prefix of the object keys
+		std::vector<std::string> objects;
+		if (!ListRemoteObjects(directory, objects))
+		{
+			return false;
+		}
+		file_in_directory.assign(objects.begin(), objects.end());
+	}
+	else
+	{
+		copy(boost::filesystem::directory_iterator(image_directory), boost::filesystem::directory_iterator(), back_inserter(file_in_directory));
+	}
 
 	// Sort the images in the directory first
 	sort(file_in_directory.begin(), file_in_directory.end());
@@ -240,8 +319,25 @@ bool ImageCapture::OpenDirectory(std::string directory, std::string bbox_directo
 		{
 			curr_dir_files.push_back(file_iterator->string());
 
+			if (bbox_file)
+			{
+				// The images can be referred to with or without the extension
+				std::map<std::string, std::vector<cv::Rect_<float> > >::const_iterator bboxes = indexed_bboxes.find(file_iterator->filename().string());
+				if (bboxes == indexed_bboxes.end())
+					bboxes = indexed_bboxes.find(file_iterator->stem().string());
+
+				if (bboxes != indexed_bboxes.end())
+				{
+					bounding_boxes.push_back(bboxes->second);
+				}
+				else
+				{
+					ERROR_STREAM("Could not find the corresponding bounding box for file:" + file_iterator->string());
+					exit(1);
+				}
+			}
 			// If bounding box directory is specified, read the bounding boxes from it
-			if (!bbox_directory.empty())
+			else if (!bbox_directory.empty())
 			{
 				boost::filesystem::path current_file = *file_iterator;
 				boost::filesystem::path bbox_file = bbox_directory / current_file.filename().replace_extension("txt");
@@ -290,6 +386,12 @@ bool ImageCapture::OpenDirectory(std::string directory, std::string bbox_directo
 		return false;
 	}
 
+	prefetcher.Stop();
+	if (decode_workers > 0 || IsRemoteImageList(image_files))
+	{
+		prefetcher.Start(image_files, std::max(decode_workers, IsRemoteImageList(image_files) ? REMOTE_READ_AHEAD : 0), true);
+	}
+
 	// Allow for setting the camera intrinsics, but have to be the same ones for every image
 	if (fx != -1 && fy != -1)
 	{
@@ -357,8 +459,15 @@ cv::Mat ImageCapture::GetNextImage()
 		return latest_frame;
 	}
 		
-	// Load the image as an 8 bit RGB
-	latest_frame = cv::imread(image_files[frame_num], cv::IMREAD_COLOR);
+	// Load the image as an 8 bit RGB, the prefetched images come with the grayscale one
+	if (prefetcher.IsRunning())
+	{
+		prefetcher.Next(latest_frame, latest_gray_frame);
+	}
+	else
+	{
+		latest_frame = ReadImage(image_files[frame_num], cv::IMREAD_COLOR);
+	}
 
 	if (latest_frame.empty())
 	{
@@ -391,7 +500,10 @@ cv::Mat ImageCapture::GetNextImage()
 	SetCameraIntrinsics(_fx, _fy, _cx, _cy);
 
 	// Set the grayscale frame
-	ConvertToGrayscale_8bit(latest_frame, latest_gray_frame);
+	if (!prefetcher.IsRunning())
+	{
+		ConvertToGrayscale_8bit(latest_frame, latest_gray_frame);
+	}
 
 	this->name = image_files[frame_num];
 
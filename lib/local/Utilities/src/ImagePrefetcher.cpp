@@ -0,0 +1,158 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ImagePrefetcher.h"
+#include "ImageManipulationHelpers.h"
+#include "RemoteStorage.h"
+#include "Tracing.h"
+
+// OpenCV includes
+#include <opencv2/imgcodecs.hpp>
+
+using namespace Utilities;
+
+ImagePrefetcher::ImagePrefetcher() : convert_to_gray(false), next_to_decode(0), next_to_return(0), stopping(false)
+{
+}
+
+ImagePrefetcher::~ImagePrefetcher()
+{
+	Stop();
+}
+
+void ImagePrefetcher::Start(const std::vector<std::string>& files, int num_workers, bool convert_to_gray)
+{
+	Stop();
+
+	if (num_workers < 1)
+		num_workers = 1;
+
+	this->files = files;
+	this->convert_to_gray = convert_to_gray;
+	next_to_decode = 0;
+	next_to_return = 0;
+	stopping = false;
+
+	slots.clear();
+	slots.resize(2 * num_workers);
+	for (size_t i = 0; i < slots.size(); ++i)
+	{
+		slots[i].index = 0;
+		slots[i].ready = false;
+	}
+
+	for (int i = 0; i < num_workers; ++i)
+	{
+		workers.push_back(std::thread(&ImagePrefetcher::DecodingWorker, this));
+	}
+}
+
+void ImagePrefetcher::DecodingWorker()
+{
+	while (true)
+	{
+		size_t index;
+		{
+			std::unique_lock<std::mutex> lock(prefetch_mutex);
+			if (stopping || next_to_decode >= files.size())
+				return;
+
+			// Claim the next file and wait for its slot in the reorder buffer to be consumed
+			index = next_to_decode++;
+			slot_free.wait(lock, [&] { return stopping || index < next_to_return + slots.size(); });
+			if (stopping)
+				return;
+		}
+
+		// The decoding itself happens outside of the lock
+		cv::Mat image;
+		cv::Mat_<uchar> gray_image;
+		{
+			TRACE_SCOPE("ImagePrefetcher decode");
+			image = ReadImage(files[index], cv::IMREAD_COLOR);
+			if (convert_to_gray && !image.empty())
+			{
+				ConvertToGrayscale_8bit(image, gray_image);
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(prefetch_mutex);
+			Slot& slot = slots[index % slots.size()];
+			slot.index = index;
+			slot.image = image;
+			slot.gray_image = gray_image;
+			slot.ready = true;
+		}
+		slot_ready.notify_all();
+	}
+}
+
+bool ImagePrefetcher::Next(cv::Mat& image, cv::Mat_<uchar>& gray_image)
+{
+	{
+		std::unique_lock<std::mutex> lock(prefetch_mutex);
+		if (workers.empty() || next_to_return >= files.size())
+			return false;
+
+		Slot& slot = slots[next_to_return % slots.size()];
+		slot_ready.wait(lock, [&] { return slot.ready && slot.index == next_to_return; });
+
+		image = slot.image;
+		gray_image = slot.gray_image;
+		slot.image = cv::Mat();
+		slot.gray_image = cv::Mat_<uchar>();
+		slot.ready = false;
+		next_to_return++;
+	}
+	slot_free.notify_all();
+	return true;
+}
+
+void ImagePrefetcher::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(prefetch_mutex);
+		stopping = true;
+	}
+	slot_free.notify_all();
+
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		if (workers[i].joinable())
+			workers[i].join();
+	}
+	workers.clear();
+	slots.clear();
+}
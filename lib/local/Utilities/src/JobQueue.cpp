@@ -0,0 +1,377 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "JobQueue.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+// Boost includes
+#include <filesystem.hpp>
+#include <boost/asio.hpp>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+using namespace Utilities;
+
+#define WARN_STREAM( stream ) \
+std::cout << "Warning: " << stream << std::endl
+
+namespace
+{
+	// The names of the files in a queue subdirectory, in order so that the jobs are taken in the order they were submitted
+	std::vector<std::string> ListFiles(const std::string& directory)
+	{
+		std::vector<std::string> files;
+		boost::system::error_code ec;
+		for (boost::filesystem::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec))
+		{
+			std::string name = it->path().filename().string();
+			// Skipping the files being written
+			if (!name.empty() && name[0] != '.')
+			{
+				files.push_back(name);
+			}
+		}
+		std::sort(files.begin(), files.end());
+		return files;
+	}
+
+	std::string Join(const std::string& directory, const std::string& name)
+	{
+		return (boost::filesystem::path(directory) / name).string();
+	}
+
+	// Writing through a hidden temporary file which is then renamed, so that the readers never see a partially written file
+	bool WriteAtomically(const std::string& filename, const std::string& contents)
+	{
+		boost::filesystem::path target(filename);
+		boost::filesystem::path temporary = target.parent_path() / ("." + target.filename().string() + ".tmp");
+		{
+			std::ofstream out(temporary.string().c_str(), std::ios::binary | std::ios::trunc);
+			if (!out.is_open())
+				return false;
+			out << contents;
+			if (!out)
+				return false;
+		}
+		boost::system::error_code ec;
+		boost::filesystem::rename(temporary, target, ec);
+		return !ec;
+	}
+
+	// Claimed jobs are named <job id>@<worker id>
+	const char CLAIM_SEPARATOR = '@';
+}
+
+bool JobQueue::Open(const std::string& directory)
+{
+	this->directory = directory;
+
+	const char* subdirectories[] = { "pending", "claimed", "done", "failed", "nodes" };
+	for (size_t i = 0; i < sizeof(subdirectories) / sizeof(subdirectories[0]); ++i)
+	{
+		boost::system::error_code ec;
+		boost::filesystem::create_directories(Join(directory, subdirectories[i]), ec);
+		if (!boost::filesystem::is_directory(Join(directory, subdirectories[i])))
+		{
+			WARN_STREAM("Could not create the job queue directory " << Join(directory, subdirectories[i]));
+			return false;
+		}
+	}
+	return true;
+}
+
+std::string JobQueue::DefaultWorkerId()
+{
+	boost::system::error_code ec;
+	std::string host = boost::asio::ip::host_name(ec);
+	if (ec || host.empty())
+		host = "worker";
+
+	// The separators of the claim file names can not be part of the id
+	std::replace(host.begin(), host.end(), CLAIM_SEPARATOR, '_');
+
+	std::stringstream id;
+	id << host << "-" << getpid();
+	return id.str();
+}
+
+bool JobQueue::WriteJobFile(const std::string& filename, const std::vector<std::string>& arguments, int attempts) const
+{
+	std::stringstream contents;
+	contents << "attempts " << attempts << "\n";
+	for (size_t i = 0; i < arguments.size(); ++i)
+	{
+		contents << arguments[i] << "\n";
+	}
+	return WriteAtomically(filename, contents.str());
+}
+
+bool JobQueue::ReadJobFile(const std::string& filename, std::vector<std::string>& arguments, int& attempts) const
+{
+	std::ifstream in(filename.c_str());
+	if (!in.is_open())
+		return false;
+
+	std::string header;
+	if (!std::getline(in, header) || header.compare(0, 9, "attempts ") != 0)
+		return false;
+	attempts = atoi(header.c_str() + 9);
+
+	arguments.clear();
+	std::string line;
+	while (std::getline(in, line))
+	{
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		arguments.push_back(line);
+	}
+	return true;
+}
+
+bool JobQueue::Submit(const std::string& job_id, const std::vector<std::string>& arguments)
+{
+	if (job_id.empty() || job_id[0] == '.' || job_id.find(CLAIM_SEPARATOR) != std::string::npos)
+	{
+		WARN_STREAM("Invalid job id " << job_id);
+		return false;
+	}
+
+	const char* subdirectories[] = { "pending", "done", "failed" };
+	for (size_t i = 0; i < sizeof(subdirectories) / sizeof(subdirectories[0]); ++i)
+	{
+		if (boost::filesystem::exists(Join(Join(directory, subdirectories[i]), job_id)))
+			return false;
+	}
+	std::vector<std::string> claimed = ListFiles(Join(directory, "claimed"));
+	for (size_t i = 0; i < claimed.size(); ++i)
+	{
+		if (claimed[i].substr(0, claimed[i].find(CLAIM_SEPARATOR)) == job_id)
+			return false;
+	}
+
+	return WriteJobFile(Join(Join(directory, "pending"), job_id), arguments, 0);
+}
+
+void JobQueue::Close()
+{
+	if (!WriteAtomically(Join(directory, "closed"), ""))
+	{
+		WARN_STREAM("Could not close the job queue in " << directory);
+	}
+}
+
+bool JobQueue::Claim(const std::string& worker_id, Job& job)
+{
+	std::string pending_dir = Join(directory, "pending");
+	std::vector<std::string> pending = ListFiles(pending_dir);
+
+	for (size_t i = 0; i < pending.size(); ++i)
+	{
+		std::string claim_file = Join(Join(directory, "claimed"), pending[i] + CLAIM_SEPARATOR + worker_id);
+
+		// Only one of the workers racing for the job succeeds in renaming it, the others move on to the next one
+		boost::system::error_code ec;
+		boost::filesystem::rename(Join(pending_dir, pending[i]), claim_file, ec);
+		if (ec)
+			continue;
+
+		// The lease starts from the claim, not from the submission
+		boost::filesystem::last_write_time(claim_file, std::time(0), ec);
+
+		job.id = pending[i];
+		job.claim_file = claim_file;
+		if (!ReadJobFile(claim_file, job.arguments, job.attempts))
+		{
+			WARN_STREAM("Could not read the job " << job.id);
+			Release(claim_file, job.id, 0);
+			continue;
+		}
+		return true;
+	}
+	return false;
+}
+
+bool JobQueue::Heartbeat(const Job& job)
+{
+	boost::system::error_code ec;
+	boost::filesystem::last_write_time(job.claim_file, std::time(0), ec);
+	return !ec;
+}
+
+void JobQueue::Complete(const Job& job)
+{
+	boost::system::error_code ec;
+	boost::filesystem::rename(job.claim_file, Join(Join(directory, "done"), job.id), ec);
+	if (ec)
+	{
+		// The lease expired while processing, the job might be processed again by another worker
+		WARN_STREAM("The claim of the job " << job.id << " was lost before it completed");
+	}
+}
+
+void JobQueue::Fail(const Job& job, int max_attempts)
+{
+	if (!Release(job.claim_file, job.id, max_attempts))
+	{
+		WARN_STREAM("The claim of the job " << job.id << " was lost before it failed");
+	}
+}
+
+bool JobQueue::Release(const std::string& claim_file, const std::string& job_id, int max_attempts)
+{
+	std::vector<std::string> arguments;
+	int attempts = 0;
+	if (!ReadJobFile(claim_file, arguments, attempts))
+	{
+		// An unreadable job can not be retried
+		boost::system::error_code ec;
+		boost::filesystem::rename(claim_file, Join(Join(directory, "failed"), job_id), ec);
+		return !ec;
+	}
+
+	attempts++;
+	if (!WriteJobFile(claim_file, arguments, attempts))
+		return false;
+
+	std::string target = attempts < max_attempts ? "pending" : "failed";
+	boost::system::error_code ec;
+	boost::filesystem::rename(claim_file, Join(Join(directory, target), job_id), ec);
+	return !ec;
+}
+
+int JobQueue::RequeueExpired(double lease_seconds, int max_attempts)
+{
+	std::string claimed_dir = Join(directory, "claimed");
+	std::vector<std::string> claimed = ListFiles(claimed_dir);
+
+	std::time_t now = std::time(0);
+	int requeued = 0;
+	for (size_t i = 0; i < claimed.size(); ++i)
+	{
+		std::string claim_file = Join(claimed_dir, claimed[i]);
+		boost::system::error_code ec;
+		std::time_t touched = boost::filesystem::last_write_time(claim_file, ec);
+		if (ec || std::difftime(now, touched) < lease_seconds)
+			continue;
+
+		// Taking the expired claim over (with a fresh lease) before releasing it, so that another worker requeueing it at the same time does
+		// not count the attempt twice
+		std::string job_id = claimed[i].substr(0, claimed[i].find(CLAIM_SEPARATOR));
+		std::string expired_file = Join(claimed_dir, job_id + CLAIM_SEPARATOR + "expired-" + DefaultWorkerId());
+		boost::filesystem::rename(claim_file, expired_file, ec);
+		if (ec)
+			continue;
+		boost::filesystem::last_write_time(expired_file, now, ec);
+
+		WARN_STREAM("The claim of the job " << claimed[i] << " expired, requeueing it");
+		if (Release(expired_file, job_id, max_attempts))
+			requeued++;
+	}
+	return requeued;
+}
+
+void JobQueue::GetCounts(size_t& pending, size_t& claimed, size_t& done, size_t& failed) const
+{
+	pending = ListFiles(Join(directory, "pending")).size();
+	claimed = ListFiles(Join(directory, "claimed")).size();
+	done = ListFiles(Join(directory, "done")).size();
+	failed = ListFiles(Join(directory, "failed")).size();
+}
+
+bool JobQueue::IsFinished() const
+{
+	if (!boost::filesystem::exists(Join(directory, "closed")))
+		return false;
+
+	return ListFiles(Join(directory, "pending")).empty() && ListFiles(Join(directory, "claimed")).empty();
+}
+
+void JobQueue::WriteNodeStatus(const NodeStatus& status)
+{
+	std::stringstream contents;
+	contents << "worker " << status.worker_id << "\n";
+	contents << "active_jobs " << status.active_jobs << "\n";
+	contents << "jobs_done " << status.jobs_done << "\n";
+	contents << "jobs_failed " << status.jobs_failed << "\n";
+	contents << "frames " << status.frames << "\n";
+	contents << "fps " << status.fps << "\n";
+	contents << "updated " << (int64_t)std::time(0) << "\n";
+
+	if (!WriteAtomically(Join(Join(directory, "nodes"), status.worker_id), contents.str()))
+	{
+		WARN_STREAM("Could not write the status of " << status.worker_id);
+	}
+}
+
+std::vector<NodeStatus> JobQueue::GetNodeStatus() const
+{
+	std::string nodes_dir = Join(directory, "nodes");
+	std::vector<std::string> nodes = ListFiles(nodes_dir);
+
+	std::vector<NodeStatus> statuses;
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		std::ifstream in(Join(nodes_dir, nodes[i]).c_str());
+		if (!in.is_open())
+			continue;
+
+		NodeStatus status;
+		std::string key;
+		while (in >> key)
+		{
+			if (key == "worker") in >> status.worker_id;
+			else if (key == "active_jobs") in >> status.active_jobs;
+			else if (key == "jobs_done") in >> status.jobs_done;
+			else if (key == "jobs_failed") in >> status.jobs_failed;
+			else if (key == "frames") in >> status.frames;
+			else if (key == "fps") in >> status.fps;
+			else if (key == "updated") in >> status.updated;
+			else in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+		}
+		statuses.push_back(status);
+	}
+	return statuses;
+}
@@ -0,0 +1,75 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "MatAllocationCounter.h"
+
+using namespace Utilities;
+
+MatAllocationCounter& MatAllocationCounter::Instance()
+{
+	static MatAllocationCounter counter;
+	return counter;
+}
+
+MatAllocationCounter::MatAllocationCounter() : std_allocator(cv::Mat::getStdAllocator()), count(0)
+{
+}
+
+void MatAllocationCounter::Install()
+{
+	count = 0;
+	cv::Mat::setDefaultAllocator(this);
+}
+
+cv::UMatData* MatAllocationCounter::allocate(int dims, const int* sizes, int type, void* data, size_t* step, int flags, cv::UMatUsageFlags usageFlags) const
+{
+	// Wrapping user provided memory does not allocate
+	if (data == 0)
+	{
+		++count;
+	}
+
+	// The memory is owned by the standard allocator, so it will also be the one releasing it
+	return std_allocator->allocate(dims, sizes, type, data, step, flags, usageFlags);
+}
+
+bool MatAllocationCounter::allocate(cv::UMatData* data, int accessflags, cv::UMatUsageFlags usageFlags) const
+{
+	return std_allocator->allocate(data, accessflags, usageFlags);
+}
+
+void MatAllocationCounter::deallocate(cv::UMatData* data) const
+{
+	std_allocator->deallocate(data);
+}
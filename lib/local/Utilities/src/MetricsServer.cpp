@@ -0,0 +1,165 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "MetricsServer.h"
+#include "Metrics.h"
+
+#include <iostream>
+#include <sstream>
+
+// Boost includes
+#include <boost/asio.hpp>
+
+using namespace Utilities;
+
+struct MetricsServer::Impl
+{
+	Impl() : acceptor(io_service) {}
+
+	void AcceptNext()
+	{
+		std::shared_ptr<boost::asio::ip::tcp::socket> socket = std::make_shared<boost::asio::ip::tcp::socket>(io_service);
+		acceptor.async_accept(*socket, [this, socket](const boost::system::error_code& error)
+		{
+			if (error)
+				return;
+
+			HandleRequest(*socket);
+			AcceptNext();
+		});
+	}
+
+	// Scrapes are small and infrequent, so a request is fully handled on the serving thread before accepting the next one
+	static void HandleRequest(boost::asio::ip::tcp::socket& socket)
+	{
+		boost::system::error_code error;
+		boost::asio::streambuf request;
+		boost::asio::read_until(socket, request, "\r\n", error);
+		if (error)
+			return;
+
+		std::istream request_stream(&request);
+		std::string method, path;
+		request_stream >> method >> path;
+
+		std::string status, content_type, body;
+		if (method == "GET" && (path == "/metrics" || path.compare(0, 9, "/metrics?") == 0))
+		{
+			status = "200 OK";
+			content_type = "text/plain; version=0.0.4; charset=utf-8";
+			body = Metrics::GetRegistry().ExportPrometheus();
+		}
+		else
+		{
+			status = "404 Not Found";
+			content_type = "text/plain; charset=utf-8";
+			body = "Not found, the metrics are served at /metrics\n";
+		}
+
+		std::ostringstream response;
+		response << "HTTP/1.0 " << status << "\r\n";
+		response << "Content-Type: " << content_type << "\r\n";
+		response << "Content-Length: " << body.size() << "\r\n";
+		response << "Connection: close\r\n\r\n";
+		response << body;
+
+		boost::asio::write(socket, boost::asio::buffer(response.str()), error);
+		socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, error);
+		socket.close(error);
+	}
+
+	boost::asio::io_service io_service;
+	boost::asio::ip::tcp::acceptor acceptor;
+};
+
+MetricsServer::MetricsServer() : running(false)
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+	Stop();
+}
+
+bool MetricsServer::Start(int port)
+{
+	if (running)
+	{
+		Stop();
+	}
+
+	impl.reset(new Impl());
+
+	boost::system::error_code error;
+	boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), (unsigned short)port);
+	impl->acceptor.open(endpoint.protocol(), error);
+	if (!error)
+		impl->acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true), error);
+	if (!error)
+		impl->acceptor.bind(endpoint, error);
+	if (!error)
+		impl->acceptor.listen(boost::asio::socket_base::max_connections, error);
+
+	if (error)
+	{
+		std::cout << "Could not start the metrics server on port " << port << ": " << error.message() << std::endl;
+		impl.reset();
+		return false;
+	}
+
+	impl->AcceptNext();
+
+	running = true;
+	Impl* server = impl.get();
+	serving_thread = std::thread([server]() { server->io_service.run(); });
+
+	return true;
+}
+
+void MetricsServer::Stop()
+{
+	if (!running)
+		return;
+
+	impl->io_service.stop();
+	if (serving_thread.joinable())
+	{
+		serving_thread.join();
+	}
+
+	boost::system::error_code error;
+	impl->acceptor.close(error);
+	impl.reset();
+	running = false;
+}
@@ -0,0 +1,220 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "MultiSequenceCapture.h"
+
+// TBB includes
+#include <tbb/tbb.h>
+
+#include <cmath>
+#include <iostream>
+
+#define INFO_STREAM( stream ) \
+std::cout << stream << std::endl
+
+#define ERROR_STREAM( stream ) \
+std::cout << "Error: " << stream << std::endl
+
+using namespace Utilities;
+
+MultiSequenceCapture::~MultiSequenceCapture()
+{
+	Close();
+}
+
+std::vector<std::vector<std::string> > MultiSequenceCapture::GetSourceArguments(const std::vector<std::string>& arguments)
+{
+	std::vector<std::string> common_arguments;
+	std::vector<std::vector<std::string> > source_arguments;
+
+	for (size_t i = 0; i < arguments.size(); ++i)
+	{
+		if (i + 1 < arguments.size() && (arguments[i].compare("-sync_f") == 0 || arguments[i].compare("-sync_fdir") == 0 || arguments[i].compare("-sync_device") == 0))
+		{
+			// -sync_f becomes -f and so on for the source's own capture
+			source_arguments.push_back(std::vector<std::string>());
+			source_arguments.back().push_back("-" + arguments[i].substr(6));
+			source_arguments.back().push_back(arguments[i + 1]);
+			i++;
+		}
+		else if (i + 4 < arguments.size() && arguments[i].compare("-sync_intrinsics") == 0)
+		{
+			// The intrinsics come after the shared ones, so that they take precedence
+			if (!source_arguments.empty())
+			{
+				const char* names[4] = { "-fx", "-fy", "-cx", "-cy" };
+				for (int k = 0; k < 4; ++k)
+				{
+					source_arguments.back().push_back(names[k]);
+					source_arguments.back().push_back(arguments[i + 1 + k]);
+				}
+			}
+			i += 4;
+		}
+		else if (i + 1 < arguments.size() && (arguments[i].compare("-f") == 0 || arguments[i].compare("-fdir") == 0 || arguments[i].compare("-device") == 0))
+		{
+			// The single sources are replaced by the synchronised ones
+			i++;
+		}
+		else
+		{
+			common_arguments.push_back(arguments[i]);
+		}
+	}
+
+	for (size_t s = 0; s < source_arguments.size(); ++s)
+	{
+		source_arguments[s].insert(source_arguments[s].begin(), common_arguments.begin(), common_arguments.end());
+	}
+	return source_arguments;
+}
+
+bool MultiSequenceCapture::Open(std::vector<std::vector<std::string> >& source_arguments)
+{
+	Close();
+
+	for (size_t s = 0; s < source_arguments.size(); ++s)
+	{
+		sources.push_back(std::unique_ptr<Source>(new Source()));
+		if (!sources.back()->capture.Open(source_arguments[s]))
+		{
+			ERROR_STREAM("Could not open the synchronised source " << s);
+			Close();
+			return false;
+		}
+	}
+
+	// The webcams are opened one after another, so their clocks are started together once all of them are open
+	int64 start_time = cv::getTickCount();
+	for (size_t s = 0; s < sources.size(); ++s)
+	{
+		sources[s]->capture.SetClockStart(start_time);
+	}
+
+	INFO_STREAM("Opened " << sources.size() << " synchronised sources");
+	return !sources.empty();
+}
+
+void MultiSequenceCapture::ReadAhead(Source& source)
+{
+	if (source.has_next || source.ended)
+	{
+		return;
+	}
+
+	source.next_frame = source.capture.GetNextFrame();
+	if (source.next_frame.empty())
+	{
+		source.ended = true;
+		return;
+	}
+	source.next_gray_frame = source.capture.GetGrayFrame();
+
+	// Webcams read into the same buffers every frame, so the frame is copied to stay valid while the next one is read
+	if (source.capture.IsWebcam())
+	{
+		source.next_frame = source.next_frame.clone();
+		source.next_gray_frame = source.next_gray_frame.clone();
+	}
+	source.next_time_stamp = source.capture.time_stamp;
+	source.has_next = true;
+}
+
+bool MultiSequenceCapture::GetNextFrames(std::vector<cv::Mat>& frames, std::vector<cv::Mat_<uchar> >& gray_frames, double& time_stamp)
+{
+	if (sources.empty())
+	{
+		return false;
+	}
+
+	Source& reference = *sources[0];
+	ReadAhead(reference);
+	if (!reference.has_next)
+	{
+		return false;
+	}
+	time_stamp = reference.next_time_stamp;
+
+	frames.assign(sources.size(), cv::Mat());
+	gray_frames.assign(sources.size(), cv::Mat_<uchar>());
+	frames[0] = reference.next_frame;
+	gray_frames[0] = reference.next_gray_frame;
+	reference.has_next = false;
+
+	double offset = max_offset;
+	if (offset < 0)
+	{
+		offset = reference.capture.fps > 0 ? 0.5 / reference.capture.fps : 0.02;
+	}
+
+	// Every other source skips to its latest frame that is not ahead of the reference by more than the offset, the sources are read in
+	// parallel as reading a webcam blocks until its next frame arrives
+	tbb::parallel_for((size_t)1, sources.size(), [&](size_t s)
+	{
+		Source& source = *sources[s];
+		cv::Mat frame;
+		cv::Mat_<uchar> gray_frame;
+		double frame_time_stamp = 0;
+		while (true)
+		{
+			ReadAhead(source);
+			if (!source.has_next || source.next_time_stamp > time_stamp + offset)
+			{
+				break;
+			}
+			frame = source.next_frame;
+			gray_frame = source.next_gray_frame;
+			frame_time_stamp = source.next_time_stamp;
+			source.has_next = false;
+		}
+
+		if (!frame.empty() && std::abs(frame_time_stamp - time_stamp) <= offset)
+		{
+			frames[s] = frame;
+			gray_frames[s] = gray_frame;
+		}
+	});
+
+	return true;
+}
+
+void MultiSequenceCapture::Close()
+{
+	for (size_t s = 0; s < sources.size(); ++s)
+	{
+		sources[s]->capture.Close();
+	}
+	sources.clear();
+}
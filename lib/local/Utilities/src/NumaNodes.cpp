@@ -0,0 +1,174 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "NumaNodes.h"
+
+// System includes
+#include <fstream>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace Utilities;
+
+#ifndef _WIN32
+// Parsing the Linux list format used in sysfs (e.g. "0-3,8-11")
+static std::vector<int> ParseList(const std::string& list)
+{
+	std::vector<int> values;
+	std::stringstream list_stream(list);
+	std::string range;
+	while (std::getline(list_stream, range, ','))
+	{
+		int first = -1, last = -1;
+		char dash;
+		std::stringstream range_stream(range);
+		if (!(range_stream >> first))
+			continue;
+		if (!(range_stream >> dash >> last))
+			last = first;
+		for (int value = first; value <= last; ++value)
+		{
+			values.push_back(value);
+		}
+	}
+	return values;
+}
+
+static std::string ReadLine(const std::string& location)
+{
+	std::ifstream file(location.c_str());
+	std::string line;
+	std::getline(file, line);
+	return line;
+}
+#endif
+
+std::vector<NumaNode> Utilities::GetNumaNodes()
+{
+	std::vector<NumaNode> nodes;
+
+#ifdef _WIN32
+	ULONG highest_node = 0;
+	if (GetNumaHighestNodeNumber(&highest_node))
+	{
+		for (ULONG node_id = 0; node_id <= highest_node; ++node_id)
+		{
+			ULONGLONG mask = 0;
+			if (!GetNumaNodeProcessorMask((UCHAR)node_id, &mask) || mask == 0)
+				continue;
+
+			NumaNode node;
+			node.id = (int)node_id;
+			for (int cpu = 0; cpu < 64; ++cpu)
+			{
+				if (mask & (1ULL << cpu))
+					node.cpus.push_back(cpu);
+			}
+			nodes.push_back(node);
+		}
+	}
+#else
+	std::vector<int> node_ids = ParseList(ReadLine("/sys/devices/system/node/online"));
+	for (size_t i = 0; i < node_ids.size(); ++i)
+	{
+		NumaNode node;
+		node.id = node_ids[i];
+		node.cpus = ParseList(ReadLine("/sys/devices/system/node/node" + std::to_string(node.id) + "/cpulist"));
+
+		// Memory only nodes can not run the work
+		if (!node.cpus.empty())
+			nodes.push_back(node);
+	}
+#endif
+
+	if (nodes.empty())
+	{
+		NumaNode node;
+		node.id = 0;
+		int num_cpus = (int)std::thread::hardware_concurrency();
+		for (int cpu = 0; cpu < num_cpus; ++cpu)
+		{
+			node.cpus.push_back(cpu);
+		}
+		nodes.push_back(node);
+	}
+	return nodes;
+}
+
+bool Utilities::PinThreadToNode(const NumaNode& node)
+{
+	if (node.cpus.empty())
+		return false;
+
+#ifdef _WIN32
+	DWORD_PTR mask = 0;
+	for (size_t i = 0; i < node.cpus.size(); ++i)
+	{
+		if (node.cpus[i] < (int)(8 * sizeof(DWORD_PTR)))
+			mask |= (DWORD_PTR)1 << node.cpus[i];
+	}
+	return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+	cpu_set_t cpu_set;
+	CPU_ZERO(&cpu_set);
+	for (size_t i = 0; i < node.cpus.size(); ++i)
+	{
+		if (node.cpus[i] < CPU_SETSIZE)
+			CPU_SET(node.cpus[i], &cpu_set);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set) == 0;
+#endif
+}
+
+NumaArena::NumaArena(const NumaNode& node) : node(node), arena((int)std::max<size_t>(node.cpus.size(), 1))
+{
+	observer.reset(new PinningObserver(arena, this->node));
+	observer->observe(true);
+}
+
+NumaArena::~NumaArena()
+{
+	observer->observe(false);
+}
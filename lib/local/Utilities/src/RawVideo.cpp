@@ -0,0 +1,245 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "RawVideo.h"
+
+// Boost includes
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include <cstring>
+#include <iostream>
+
+#define WARN_STREAM( stream ) \
+std::cout << "Warning: " << stream << std::endl
+
+using namespace Utilities;
+
+namespace
+{
+	const char RAW_VIDEO_MAGIC[8] = { 'O', 'F', 'R', 'A', 'W', '0', '0', '1' };
+	const size_t RAW_VIDEO_HEADER_SIZE = 64;
+
+	struct RawVideoHeader
+	{
+		char magic[8];
+		int32_t width;
+		int32_t height;
+		double fps;
+		int64_t num_frames;
+		int64_t index_offset;
+	};
+
+	size_t FrameBytes(int width, int height)
+	{
+		// The BGR image followed by the grayscale one
+		return (size_t)width * (size_t)height * 4;
+	}
+}
+
+RawVideoWriter::~RawVideoWriter()
+{
+	Close();
+}
+
+bool RawVideoWriter::Open(const std::string& filename, int width, int height, double fps)
+{
+	Close();
+
+	output.open(filename.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+	if (!output.is_open())
+	{
+		return false;
+	}
+	this->width = width;
+	this->height = height;
+	this->fps = fps;
+	time_stamps.clear();
+
+	// The header is written again with the number of frames once closing
+	RawVideoHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, RAW_VIDEO_MAGIC, sizeof(RAW_VIDEO_MAGIC));
+	header.width = width;
+	header.height = height;
+	header.fps = fps;
+
+	char header_bytes[RAW_VIDEO_HEADER_SIZE] = { 0 };
+	std::memcpy(header_bytes, &header, sizeof(header));
+	output.write(header_bytes, RAW_VIDEO_HEADER_SIZE);
+	return (bool)output;
+}
+
+bool RawVideoWriter::WriteFrame(const cv::Mat& frame, const cv::Mat_<uchar>& gray_frame, double time_stamp)
+{
+	if (!output.is_open() || frame.type() != CV_8UC3 || frame.cols != width || frame.rows != height || gray_frame.cols != width || gray_frame.rows != height)
+	{
+		return false;
+	}
+
+	for (int y = 0; y < height; ++y)
+	{
+		output.write((const char*)frame.ptr(y), (std::streamsize)width * 3);
+	}
+	for (int y = 0; y < height; ++y)
+	{
+		output.write((const char*)gray_frame.ptr(y), (std::streamsize)width);
+	}
+	time_stamps.push_back(time_stamp);
+	return (bool)output;
+}
+
+bool RawVideoWriter::Close()
+{
+	if (!output.is_open())
+	{
+		return false;
+	}
+
+	RawVideoHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, RAW_VIDEO_MAGIC, sizeof(RAW_VIDEO_MAGIC));
+	header.width = width;
+	header.height = height;
+	header.fps = fps;
+	header.num_frames = (int64_t)time_stamps.size();
+	header.index_offset = (int64_t)(RAW_VIDEO_HEADER_SIZE + FrameBytes(width, height) * time_stamps.size());
+
+	if (!time_stamps.empty())
+	{
+		output.write((const char*)time_stamps.data(), (std::streamsize)(time_stamps.size() * sizeof(double)));
+	}
+	output.seekp(0);
+	output.write((const char*)&header, sizeof(header));
+
+	bool success = (bool)output;
+	output.close();
+	time_stamps.clear();
+	return success;
+}
+
+RawVideoReader::RawVideoReader() : width(0), height(0), fps(0)
+{
+}
+
+RawVideoReader::~RawVideoReader()
+{
+	Close();
+}
+
+bool RawVideoReader::IsRawVideo(const std::string& filename)
+{
+	return boost::algorithm::iends_with(filename, ".ofraw");
+}
+
+bool RawVideoReader::Open(const std::string& filename)
+{
+	Close();
+
+	try
+	{
+		mapping.reset(new boost::interprocess::file_mapping(filename.c_str(), boost::interprocess::read_only));
+		region.reset(new boost::interprocess::mapped_region(*mapping, boost::interprocess::read_only));
+	}
+	catch (const boost::interprocess::interprocess_exception&)
+	{
+		Close();
+		return false;
+	}
+
+	const char* data = (const char*)region->get_address();
+	size_t size = region->get_size();
+
+	RawVideoHeader header;
+	if (size < RAW_VIDEO_HEADER_SIZE)
+	{
+		Close();
+		return false;
+	}
+	std::memcpy(&header, data, sizeof(header));
+	if (std::memcmp(header.magic, RAW_VIDEO_MAGIC, sizeof(RAW_VIDEO_MAGIC)) != 0 || header.width <= 0 || header.height <= 0)
+	{
+		Close();
+		return false;
+	}
+	width = header.width;
+	height = header.height;
+	fps = header.fps;
+
+	size_t frame_bytes = FrameBytes(width, height);
+	size_t num_frames = (size - RAW_VIDEO_HEADER_SIZE) / frame_bytes;
+	size_t index_offset = (size_t)header.index_offset;
+
+	if (header.num_frames > 0 && index_offset == RAW_VIDEO_HEADER_SIZE + frame_bytes * (size_t)header.num_frames &&
+		index_offset + (size_t)header.num_frames * sizeof(double) <= size)
+	{
+		num_frames = (size_t)header.num_frames;
+		time_stamps.resize(num_frames);
+		std::memcpy(time_stamps.data(), data + index_offset, num_frames * sizeof(double));
+	}
+	else
+	{
+		// Not closed properly, so only the complete frames are used
+		WARN_STREAM("The raw video " << filename << " has no index, using its " << num_frames << " complete frames");
+		time_stamps.resize(num_frames);
+		for (size_t i = 0; i < num_frames; ++i)
+		{
+			time_stamps[i] = fps > 0 ? i / fps : 0;
+		}
+	}
+
+	return true;
+}
+
+bool RawVideoReader::ReadFrame(size_t frame, cv::Mat& image, cv::Mat_<uchar>& gray_image) const
+{
+	if (!region || frame >= time_stamps.size())
+	{
+		return false;
+	}
+
+	const uchar* frame_data = (const uchar*)region->get_address() + RAW_VIDEO_HEADER_SIZE + FrameBytes(width, height) * frame;
+	cv::Mat(height, width, CV_8UC3, (void*)frame_data).copyTo(image);
+	cv::Mat_<uchar>(height, width, (uchar*)frame_data + (size_t)width * height * 3).copyTo(gray_image);
+	return true;
+}
+
+void RawVideoReader::Close()
+{
+	region.reset();
+	mapping.reset();
+	time_stamps.clear();
+}
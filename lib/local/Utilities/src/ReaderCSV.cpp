@@ -0,0 +1,347 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "ReaderCSV.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+using namespace Utilities;
+
+namespace
+{
+	// Counting the columns named prefix0, prefix1, ... and checking that they are consecutive, returns the index of the first one or -1
+	int CountColumns(const std::map<std::string, int>& columns, const std::string& prefix, int& count)
+	{
+		count = 0;
+		auto first = columns.find(prefix + "0");
+		if (first == columns.end())
+		{
+			return -1;
+		}
+		while (true)
+		{
+			auto next = columns.find(prefix + std::to_string(count));
+			if (next == columns.end() || next->second != first->second + count)
+			{
+				break;
+			}
+			count++;
+		}
+		return first->second;
+	}
+
+	// Checking that a group of columns directly follows another one of the same length
+	bool Follows(const std::map<std::string, int>& columns, const std::string& prefix, int start, int count)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			auto col = columns.find(prefix + std::to_string(i));
+			if (col == columns.end() || col->second != start + i)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+ReaderCSV::ReaderCSV() : csv_file(), num_landmarks(0), num_eye_landmarks(0), num_model_modes(0), col_frame(-1), col_face_id(-1), col_timestamp(-1),
+	col_confidence(-1), col_success(-1), col_gaze(-1), col_eye_landmarks(-1), col_pose(-1), col_landmarks_2D(-1), col_landmarks_3D(-1),
+	col_params_global(-1), col_params_local(-1), row_valid(false) {};
+
+int ReaderCSV::Column(const std::map<std::string, int>& columns, const std::string& name) const
+{
+	auto col = columns.find(name);
+	return col == columns.end() ? -1 : col->second;
+}
+
+bool ReaderCSV::Open(const std::string& filename)
+{
+	Close();
+
+	csv_file.open(filename, std::ios_base::in);
+	if (!csv_file.is_open())
+	{
+		std::cout << "Could not open the CSV file " << filename << std::endl;
+		return false;
+	}
+
+	std::string header;
+	if (!std::getline(csv_file, header))
+	{
+		std::cout << "Could not read the header of the CSV file " << filename << std::endl;
+		Close();
+		return false;
+	}
+
+	// The column names are separated by commas and possibly spaces
+	std::map<std::string, int> columns;
+	std::stringstream header_stream(header);
+	std::string name;
+	int num_columns = 0;
+	while (std::getline(header_stream, name, ','))
+	{
+		size_t start = name.find_first_not_of(" \t\r");
+		size_t end = name.find_last_not_of(" \t\r");
+		columns[start == std::string::npos ? std::string() : name.substr(start, end - start + 1)] = num_columns++;
+	}
+
+	col_frame = Column(columns, "frame");
+	col_face_id = Column(columns, "face_id");
+	col_timestamp = Column(columns, "timestamp");
+	col_confidence = Column(columns, "confidence");
+	col_success = Column(columns, "success");
+
+	col_landmarks_2D = CountColumns(columns, "x_", num_landmarks);
+	if (col_frame < 0 || col_success < 0 || col_landmarks_2D < 0 || !Follows(columns, "y_", col_landmarks_2D + num_landmarks, num_landmarks))
+	{
+		std::cout << "The CSV file " << filename << " was not recorded from a sequence with the 2D landmarks" << std::endl;
+		Close();
+		return false;
+	}
+
+	int num_3D = 0;
+	col_landmarks_3D = CountColumns(columns, "X_", num_3D);
+	if (num_3D != num_landmarks || !Follows(columns, "Y_", col_landmarks_3D + num_3D, num_3D) || !Follows(columns, "Z_", col_landmarks_3D + 2 * num_3D, num_3D))
+	{
+		col_landmarks_3D = -1;
+	}
+
+	col_params_global = Column(columns, "p_scale");
+	if (col_params_global >= 0 && Column(columns, "p_ty") == col_params_global + 5)
+	{
+		col_params_local = CountColumns(columns, "p_", num_model_modes);
+		if (col_params_local != col_params_global + 6)
+		{
+			col_params_local = -1;
+			num_model_modes = 0;
+		}
+	}
+	else
+	{
+		col_params_global = -1;
+	}
+
+	col_pose = Column(columns, "pose_Tx");
+	if (col_pose >= 0 && Column(columns, "pose_Rz") != col_pose + 5)
+	{
+		col_pose = -1;
+	}
+
+	col_gaze = Column(columns, "gaze_0_x");
+	if (col_gaze >= 0 && Column(columns, "gaze_angle_y") == col_gaze + 7)
+	{
+		col_eye_landmarks = CountColumns(columns, "eye_lmk_x_", num_eye_landmarks);
+		if (col_eye_landmarks != col_gaze + 8 || !Follows(columns, "eye_lmk_Z_", col_eye_landmarks + 4 * num_eye_landmarks, num_eye_landmarks))
+		{
+			col_eye_landmarks = -1;
+			num_eye_landmarks = 0;
+		}
+	}
+	else
+	{
+		col_gaze = -1;
+	}
+
+	row.resize(num_columns);
+	return true;
+}
+
+void ReaderCSV::Close()
+{
+	csv_file.close();
+	csv_file.clear();
+	num_landmarks = num_eye_landmarks = num_model_modes = 0;
+	col_frame = col_face_id = col_timestamp = col_confidence = col_success = -1;
+	col_gaze = col_eye_landmarks = col_pose = col_landmarks_2D = col_landmarks_3D = col_params_global = col_params_local = -1;
+	row.clear();
+	row_valid = false;
+}
+
+bool ReaderCSV::ReadRow()
+{
+	row_valid = false;
+	while (std::getline(csv_file, line))
+	{
+		// Skipping empty lines (e.g. at the end of the file)
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+		{
+			continue;
+		}
+
+		const char* pos = line.c_str();
+		size_t col = 0;
+		for (; col < row.size(); ++col)
+		{
+			char* end;
+			row[col] = std::strtod(pos, &end);
+			if (end == pos)
+			{
+				break;
+			}
+			pos = end;
+			while (*pos == ',' || *pos == ' ')
+			{
+				pos++;
+			}
+		}
+
+		if (col != row.size())
+		{
+			std::cout << "Skipping an incomplete line of the CSV file" << std::endl;
+			continue;
+		}
+		row_valid = true;
+		return true;
+	}
+	return false;
+}
+
+bool ReaderCSV::ReadFrame(int frame_number, RecordedObservation& observation, int face_id)
+{
+	if (!csv_file.is_open())
+	{
+		return false;
+	}
+
+	// The rows are in the order of the frames, so skip until the frame is reached
+	while (true)
+	{
+		if (!row_valid && !ReadRow())
+		{
+			return false;
+		}
+
+		int row_frame = (int)row[col_frame];
+		int row_face = col_face_id >= 0 ? (int)row[col_face_id] : 0;
+		if (row_frame > frame_number)
+		{
+			return false;
+		}
+		row_valid = false;
+		if (row_frame == frame_number && row_face == face_id)
+		{
+			break;
+		}
+	}
+
+	GetObservation(observation);
+	return true;
+}
+
+bool ReaderCSV::ReadNextFrame(RecordedObservation& observation)
+{
+	if (!csv_file.is_open() || (!row_valid && !ReadRow()))
+	{
+		return false;
+	}
+	row_valid = false;
+
+	GetObservation(observation);
+	return true;
+}
+
+void ReaderCSV::GetObservation(RecordedObservation& observation) const
+{
+	observation.frame_number = (int)row[col_frame];
+	observation.face_id = col_face_id >= 0 ? (int)row[col_face_id] : 0;
+	observation.time_stamp = col_timestamp >= 0 ? row[col_timestamp] : 0.0;
+	observation.confidence = col_confidence >= 0 ? (float)row[col_confidence] : 0.0f;
+	observation.success = row[col_success] != 0;
+
+	observation.landmarks_2D.create(2 * num_landmarks, 1);
+	for (int i = 0; i < 2 * num_landmarks; ++i)
+	{
+		observation.landmarks_2D(i) = (float)row[col_landmarks_2D + i];
+	}
+
+	if (col_landmarks_3D >= 0)
+	{
+		observation.landmarks_3D.create(3, num_landmarks);
+		for (int i = 0; i < 3 * num_landmarks; ++i)
+		{
+			observation.landmarks_3D(i) = (float)row[col_landmarks_3D + i];
+		}
+	}
+	else
+	{
+		observation.landmarks_3D = cv::Mat_<float>();
+	}
+
+	observation.params_global = cv::Vec6f();
+	observation.params_local.create(num_model_modes, 1);
+	if (col_params_global >= 0)
+	{
+		for (int i = 0; i < 6; ++i)
+		{
+			observation.params_global[i] = (float)row[col_params_global + i];
+		}
+		for (int i = 0; i < num_model_modes; ++i)
+		{
+			observation.params_local(i) = (float)row[col_params_local + i];
+		}
+	}
+
+	observation.pose_estimate = cv::Vec6d();
+	if (col_pose >= 0)
+	{
+		for (int i = 0; i < 6; ++i)
+		{
+			observation.pose_estimate[i] = row[col_pose + i];
+		}
+	}
+
+	observation.gaze_direction0 = cv::Point3f();
+	observation.gaze_direction1 = cv::Point3f();
+	observation.gaze_angle = cv::Vec2d();
+	observation.eye_landmarks_2D.clear();
+	observation.eye_landmarks_3D.clear();
+	if (col_gaze >= 0)
+	{
+		observation.gaze_direction0 = cv::Point3f((float)row[col_gaze], (float)row[col_gaze + 1], (float)row[col_gaze + 2]);
+		observation.gaze_direction1 = cv::Point3f((float)row[col_gaze + 3], (float)row[col_gaze + 4], (float)row[col_gaze + 5]);
+		observation.gaze_angle = cv::Vec2d(row[col_gaze + 6], row[col_gaze + 7]);
+
+		int n = num_eye_landmarks;
+		for (int i = 0; col_eye_landmarks >= 0 && i < n; ++i)
+		{
+			observation.eye_landmarks_2D.push_back(cv::Point2f((float)row[col_eye_landmarks + i], (float)row[col_eye_landmarks + n + i]));
+			observation.eye_landmarks_3D.push_back(cv::Point3f((float)row[col_eye_landmarks + 2 * n + i], (float)row[col_eye_landmarks + 3 * n + i],
+				(float)row[col_eye_landmarks + 4 * n + i]));
+		}
+	}
+}
@@ -0,0 +1,270 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "ReaderHOG.h"
+
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+
+using namespace Utilities;
+
+namespace
+{
+	template<typename T>
+	bool ReadValue(std::ifstream& in, T& value)
+	{
+		return (bool)in.read((char*)&value, sizeof(T));
+	}
+
+	// Undoing the element by element delta coding of RecorderHOG (rows are frames)
+	template<typename T>
+	bool DecodeFrames(const std::vector<unsigned char>& in, cv::Mat& frames)
+	{
+		size_t pos = 0;
+		for (int i = 0; i < frames.cols; ++i)
+		{
+			int64_t prev = 0;
+			for (int f = 0; f < frames.rows; ++f)
+			{
+				uint64_t zigzag = 0;
+				int shift = 0;
+				while (true)
+				{
+					if (pos >= in.size() || shift > 63)
+					{
+						return false;
+					}
+					unsigned char byte = in[pos++];
+					zigzag |= (uint64_t)(byte & 0x7f) << shift;
+					shift += 7;
+					if (byte < 0x80)
+					{
+						break;
+					}
+				}
+				prev += (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+				frames.ptr<T>(f)[i] = (T)prev;
+			}
+		}
+		return true;
+	}
+}
+
+ReaderHOG::ReaderHOG() :hog_file(), num_frames(0), num_cols(0), num_rows(0), num_channels(0), compressed(false), half_precision(false),
+	frames_per_chunk(0), cached_chunk(-1) {};
+
+bool ReaderHOG::Open(const std::string& filename)
+{
+	Close();
+
+	hog_file.open(filename, std::ios_base::in | std::ios_base::binary);
+	if (!hog_file.is_open())
+	{
+		std::cout << "Could not open the HOG file " << filename << std::endl;
+		return false;
+	}
+
+	char magic[8];
+	if (hog_file.read(magic, 8) && std::memcmp(magic, "OFHOG002", 8) == 0)
+	{
+		compressed = true;
+		int32_t half;
+		if (!ReadValue(hog_file, num_cols) || !ReadValue(hog_file, num_rows) || !ReadValue(hog_file, num_channels) || !ReadValue(hog_file, half) ||
+			!ReadValue(hog_file, frames_per_chunk) || frames_per_chunk <= 0)
+		{
+			std::cout << "Could not read the header of the HOG file " << filename << std::endl;
+			Close();
+			return false;
+		}
+		half_precision = half != 0;
+
+		// The index is located through the footer at the end of the file
+		int64_t frames_total = 0, index_offset;
+		int32_t num_chunks;
+		hog_file.seekg(-16, std::ios_base::end);
+		if (!ReadValue(hog_file, index_offset) || !hog_file.read(magic, 8) || std::memcmp(magic, "OFHOGIDX", 8) != 0)
+		{
+			std::cout << "The HOG file " << filename << " has no index, it was not closed properly" << std::endl;
+			Close();
+			return false;
+		}
+
+		hog_file.seekg(index_offset);
+		if (!ReadValue(hog_file, num_chunks) || num_chunks < 0)
+		{
+			Close();
+			return false;
+		}
+		for (int c = 0; c < num_chunks; ++c)
+		{
+			int64_t offset;
+			if (!ReadValue(hog_file, offset))
+			{
+				Close();
+				return false;
+			}
+			chunk_offsets.push_back(offset);
+		}
+		ReadValue(hog_file, frames_total);
+		num_frames = (int)frames_total;
+	}
+	else
+	{
+		// The original format has a fixed size for every frame, so the dimensions of the first one give the location of all of them
+		hog_file.clear();
+		hog_file.seekg(0, std::ios_base::beg);
+		compressed = false;
+		if (ReadValue(hog_file, num_cols) && ReadValue(hog_file, num_rows) && ReadValue(hog_file, num_channels))
+		{
+			hog_file.seekg(0, std::ios_base::end);
+			long long file_size = (long long)hog_file.tellg();
+			long long frame_size = 16 + 4 * (long long)num_cols * num_rows * num_channels;
+			num_frames = (int)(file_size / frame_size);
+		}
+	}
+
+	hog_file.clear();
+	return true;
+}
+
+void ReaderHOG::Close()
+{
+	hog_file.close();
+	hog_file.clear();
+	num_frames = num_cols = num_rows = num_channels = 0;
+	chunk_offsets.clear();
+	cached_chunk = -1;
+	cached_frames = cv::Mat_<float>();
+	cached_good_frames.clear();
+}
+
+bool ReaderHOG::ReadChunk(int chunk)
+{
+	hog_file.clear();
+	hog_file.seekg(chunk_offsets[chunk]);
+
+	int32_t frames_in_chunk, num_bytes;
+	if (!ReadValue(hog_file, frames_in_chunk) || frames_in_chunk <= 0 || frames_in_chunk > frames_per_chunk)
+	{
+		return false;
+	}
+
+	cached_good_frames.resize(frames_in_chunk);
+	hog_file.read(cached_good_frames.data(), frames_in_chunk);
+
+	std::vector<unsigned char> encoded;
+	if (!ReadValue(hog_file, num_bytes) || num_bytes < 0)
+	{
+		return false;
+	}
+	encoded.resize(num_bytes);
+	if (!hog_file.read((char*)encoded.data(), num_bytes))
+	{
+		return false;
+	}
+
+	int num_values = num_cols * num_rows * num_channels;
+	if (half_precision)
+	{
+		cv::Mat frames_half(frames_in_chunk, num_values, CV_16S);
+		if (!DecodeFrames<uint16_t>(encoded, frames_half))
+		{
+			return false;
+		}
+		cv::Mat frames_float;
+		cv::convertFp16(frames_half, frames_float);
+		cached_frames = frames_float;
+	}
+	else
+	{
+		cached_frames = cv::Mat_<float>(frames_in_chunk, num_values);
+		if (!DecodeFrames<uint32_t>(encoded, cached_frames))
+		{
+			return false;
+		}
+	}
+
+	cached_chunk = chunk;
+	return true;
+}
+
+bool ReaderHOG::ReadFrame(int frame, cv::Mat_<float>& hog_descriptor, bool& good_frame)
+{
+	if (!hog_file.is_open() || frame < 0 || frame >= num_frames)
+	{
+		return false;
+	}
+
+	int num_values = num_cols * num_rows * num_channels;
+
+	if (compressed)
+	{
+		int chunk = frame / frames_per_chunk;
+		if (chunk >= (int)chunk_offsets.size())
+		{
+			return false;
+		}
+		if (chunk != cached_chunk && !ReadChunk(chunk))
+		{
+			cached_chunk = -1;
+			std::cout << "Could not read chunk " << chunk << " of the HOG file" << std::endl;
+			return false;
+		}
+
+		int frame_in_chunk = frame - chunk * frames_per_chunk;
+		if (frame_in_chunk >= cached_frames.rows)
+		{
+			return false;
+		}
+		hog_descriptor = cached_frames.row(frame_in_chunk).clone();
+		good_frame = cached_good_frames[frame_in_chunk] != 0;
+	}
+	else
+	{
+		long long frame_size = 16 + 4 * (long long)num_values;
+		hog_file.clear();
+		hog_file.seekg(frame * frame_size + 12);
+
+		float good_frame_float;
+		hog_descriptor.create(1, num_values);
+		if (!ReadValue(hog_file, good_frame_float) || !hog_file.read((char*)hog_descriptor.data, 4 * (long long)num_values))
+		{
+			return false;
+		}
+		good_frame = good_frame_float > 0;
+	}
+	return true;
+}
@@ -0,0 +1,229 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ReaderSharedMemory.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Boost includes
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+using namespace Utilities;
+
+struct ReaderSharedMemory::Impl
+{
+	boost::interprocess::shared_memory_object memory;
+	boost::interprocess::mapped_region region;
+
+	const SharedRingHeader& Header() const { return *(const SharedRingHeader*)region.get_address(); }
+
+	const char* Slot(uint64_t record) const
+	{
+		const SharedRingHeader& header = Header();
+		return (const char*)region.get_address() + header.slots_offset + (size_t)(record % header.slot_count) * header.slot_size;
+	}
+};
+
+ReaderSharedMemory::ReaderSharedMemory() : next_record(0), dropped(0) {}
+
+ReaderSharedMemory::~ReaderSharedMemory()
+{
+	this->Close();
+}
+
+bool ReaderSharedMemory::Open(const std::string& name)
+{
+	Close();
+
+	std::unique_ptr<Impl> shared(new Impl());
+	try
+	{
+		boost::interprocess::shared_memory_object memory(boost::interprocess::open_only, name.c_str(), boost::interprocess::read_only);
+		boost::interprocess::mapped_region region(memory, boost::interprocess::read_only);
+		shared->memory.swap(memory);
+		shared->region.swap(region);
+	}
+	catch (const boost::interprocess::interprocess_exception&)
+	{
+		return false;
+	}
+
+	// The ring has to be complete and of the same layout
+	if (shared->region.get_size() < sizeof(SharedRingHeader))
+	{
+		return false;
+	}
+	const SharedRingHeader& header = shared->Header();
+	if (std::memcmp(header.magic, SHARED_RING_MAGIC, sizeof(SHARED_RING_MAGIC)) != 0 || header.version != SHARED_RING_VERSION ||
+		shared->region.get_size() < (size_t)header.slots_offset + (size_t)header.slot_size * header.slot_count)
+	{
+		return false;
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	au_intensity_names.clear();
+	au_occurence_names.clear();
+	const char* names = (const char*)shared->region.get_address() + sizeof(SharedRingHeader);
+	for (uint32_t i = 0; i < header.num_au_intensities + header.num_au_occurences; ++i)
+	{
+		const char* au_name = names + i * SHARED_RING_AU_NAME_LENGTH;
+		std::string name_str(au_name, std::find(au_name, au_name + SHARED_RING_AU_NAME_LENGTH, '\0'));
+		if (i < header.num_au_intensities)
+			au_intensity_names.push_back(name_str);
+		else
+			au_occurence_names.push_back(name_str);
+	}
+
+	// Starting with the oldest record still in the ring
+	uint64_t published = header.published.load(std::memory_order_acquire);
+	next_record = published > header.slot_count ? published - header.slot_count : 0;
+	dropped = 0;
+
+	impl = std::move(shared);
+	return true;
+}
+
+void ReaderSharedMemory::Close()
+{
+	impl.reset();
+}
+
+bool ReaderSharedMemory::WriterClosed() const
+{
+	return !impl || impl->Header().closed.load(std::memory_order_acquire) != 0;
+}
+
+bool ReaderSharedMemory::ReadRecord(uint64_t record, SharedFrame& frame)
+{
+	const SharedRingHeader& header = impl->Header();
+	const char* slot = impl->Slot(record);
+	const SharedRingRecord& shared = *(const SharedRingRecord*)slot;
+
+	uint64_t complete = 2 * record + 2;
+	if (shared.sequence.load(std::memory_order_acquire) != complete)
+	{
+		return false;
+	}
+
+	frame.record = record;
+	frame.frame_number = (int)shared.frame_number;
+	frame.face_id = shared.face_id;
+	frame.success = shared.success != 0;
+	frame.reused = shared.reused != 0;
+	frame.confidence = shared.confidence;
+	frame.timestamp = shared.timestamp;
+	frame.pose = cv::Vec6f(shared.pose);
+	frame.gaze_direction0 = cv::Point3f(shared.gaze_direction0[0], shared.gaze_direction0[1], shared.gaze_direction0[2]);
+	frame.gaze_direction1 = cv::Point3f(shared.gaze_direction1[0], shared.gaze_direction1[1], shared.gaze_direction1[2]);
+	frame.gaze_angle = cv::Vec2f(shared.gaze_angle[0], shared.gaze_angle[1]);
+
+	const float* landmarks = (const float*)(slot + SharedRingLandmarksOffset(header));
+	frame.landmarks_2D.assign(landmarks, landmarks + 2 * header.num_landmarks);
+	const float* landmarks_3D = (const float*)(slot + SharedRingLandmarks3DOffset(header));
+	frame.landmarks_3D.assign(landmarks_3D, landmarks_3D + 3 * header.num_landmarks);
+	const float* eye_landmarks = (const float*)(slot + SharedRingEyeLandmarksOffset(header));
+	frame.eye_landmarks_2D.assign(eye_landmarks, eye_landmarks + 2 * header.num_eye_landmarks);
+	const float* eye_landmarks_3D = (const float*)(slot + SharedRingEyeLandmarks3DOffset(header));
+	frame.eye_landmarks_3D.assign(eye_landmarks_3D, eye_landmarks_3D + 3 * header.num_eye_landmarks);
+	const float* intensities = (const float*)(slot + SharedRingAUIntensitiesOffset(header));
+	frame.au_intensities.assign(intensities, intensities + header.num_au_intensities);
+	const float* occurences = (const float*)(slot + SharedRingAUOccurencesOffset(header));
+	frame.au_occurences.assign(occurences, occurences + header.num_au_occurences);
+
+	int width = shared.aligned_width, height = shared.aligned_height, channels = shared.aligned_channels;
+	if (width > 0 && height > 0 && channels > 0 && channels <= 4 && (size_t)width * height * channels <= header.aligned_face_capacity)
+	{
+		frame.aligned_face.create(height, width, CV_8UC(channels));
+		std::memcpy(frame.aligned_face.data, slot + SharedRingAlignedFaceOffset(header), (size_t)width * height * channels);
+	}
+	else
+	{
+		frame.aligned_face.release();
+	}
+
+	// If the writer started on the slot while copying, the copy is not consistent
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return shared.sequence.load(std::memory_order_relaxed) == complete;
+}
+
+bool ReaderSharedMemory::ReadNext(SharedFrame& frame)
+{
+	if (!impl)
+	{
+		return false;
+	}
+
+	const SharedRingHeader& header = impl->Header();
+	uint64_t published = header.published.load(std::memory_order_acquire);
+
+	// Falling behind by more than the ring, the oldest records are gone
+	if (published > next_record + header.slot_count)
+	{
+		dropped += published - header.slot_count - next_record;
+		next_record = published - header.slot_count;
+	}
+
+	while (next_record < published)
+	{
+		uint64_t record = next_record++;
+		if (ReadRecord(record, frame))
+		{
+			return true;
+		}
+
+		// Overwritten while reading it
+		dropped++;
+	}
+	return false;
+}
+
+bool ReaderSharedMemory::ReadLatest(SharedFrame& frame)
+{
+	if (!impl)
+	{
+		return false;
+	}
+
+	uint64_t published = impl->Header().published.load(std::memory_order_acquire);
+	if (published == 0 || published <= next_record)
+	{
+		return false;
+	}
+
+	dropped += published - 1 - next_record;
+	next_record = published;
+	return ReadRecord(published - 1, frame);
+}
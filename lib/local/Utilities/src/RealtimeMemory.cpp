@@ -0,0 +1,133 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "RealtimeMemory.h"
+#include "MatAllocationCounter.h"
+#include "Metrics.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+using namespace Utilities;
+
+void Utilities::RetainFreedHeap()
+{
+#ifdef __GLIBC__
+	// Large blocks would otherwise be mapped on allocation and unmapped when freed, and the top of the heap trimmed
+	mallopt(M_MMAP_MAX, 0);
+	mallopt(M_TRIM_THRESHOLD, -1);
+#endif
+}
+
+bool Utilities::LockProcessMemory()
+{
+#ifdef _WIN32
+	// Only ranges can be locked on Windows (ModelBundle::Lock does that for the models)
+	return false;
+#else
+	struct rlimit limit;
+	int flags = MCL_CURRENT;
+	if (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur == RLIM_INFINITY)
+	{
+		flags |= MCL_FUTURE;
+	}
+	return mlockall(flags) == 0;
+#endif
+}
+
+size_t Utilities::GetHeapBytes()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+#elif defined(__GLIBC__)
+	struct mallinfo info = mallinfo();
+	return (size_t)(unsigned int)info.uordblks + (size_t)(unsigned int)info.hblkhd;
+#elif defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS_EX counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&counters, sizeof(counters)))
+	{
+		return counters.PrivateUsage;
+	}
+	return 0;
+#else
+	return 0;
+#endif
+}
+
+HeapGrowthMonitor::HeapGrowthMonitor() : started(false), baseline_heap_bytes(0), peak_heap_bytes(0), baseline_mat_allocations(0), last_mat_allocations(0)
+{
+}
+
+void HeapGrowthMonitor::Start()
+{
+	baseline_heap_bytes = GetHeapBytes();
+	peak_heap_bytes = baseline_heap_bytes;
+	baseline_mat_allocations = MatAllocationCounter::Instance().GetCount();
+	last_mat_allocations = baseline_mat_allocations;
+	started = true;
+}
+
+bool HeapGrowthMonitor::Check(size_t& heap_growth, size_t& mat_allocations)
+{
+	if (!started)
+	{
+		return false;
+	}
+
+	size_t heap_bytes = GetHeapBytes();
+	size_t allocations = MatAllocationCounter::Instance().GetCount();
+
+	bool grew = heap_bytes > peak_heap_bytes || allocations > last_mat_allocations;
+	peak_heap_bytes = heap_bytes > peak_heap_bytes ? heap_bytes : peak_heap_bytes;
+	last_mat_allocations = allocations;
+
+	heap_growth = heap_bytes > baseline_heap_bytes ? heap_bytes - baseline_heap_bytes : 0;
+	mat_allocations = allocations - baseline_mat_allocations;
+
+	METRICS_GAUGE_SET("openface_heap_growth_bytes", "Growth of the heap in use since the end of the warm up", (int64_t)heap_growth);
+	METRICS_GAUGE_SET("openface_mat_allocations_after_warm_up", "The cv::Mat allocations since the end of the warm up", (int64_t)mat_allocations);
+
+	return grew;
+}
@@ -0,0 +1,170 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "RecorderAlignedTensor.h"
+
+// OpenCV includes
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+
+using namespace Utilities;
+
+namespace
+{
+	// The magic string, the version and the header length take 10 bytes, the whole header is padded to a multiple of 64 bytes
+	const int NPY_HEADER_SIZE = 128;
+}
+
+// Default constructor initializes the variables
+RecorderAlignedTensor::RecorderAlignedTensor() :tensor_file(), index_file(), rows(0), cols(0), channels(0), num_faces(0) {};
+
+RecorderAlignedTensor::~RecorderAlignedTensor()
+{
+	Close();
+}
+
+bool RecorderAlignedTensor::Open(const std::string& tensor_filename, const std::string& index_filename)
+{
+	tensor_file.open(tensor_filename, std::ios_base::out | std::ios_base::binary);
+	index_file.open(index_filename, std::ios_base::out);
+
+	rows = 0;
+	cols = 0;
+	channels = 0;
+	num_faces = 0;
+
+	if (!tensor_file.is_open() || !index_file.is_open())
+	{
+		tensor_file.close();
+		index_file.close();
+		return false;
+	}
+
+	index_file << "row,frame,face_id,timestamp,success" << std::endl;
+	index_file << std::fixed << std::setprecision(3);
+
+	// Reserving the room for the header, it is only known once the first face arrives
+	WriteHeader();
+
+	return true;
+}
+
+void RecorderAlignedTensor::WriteHeader()
+{
+	char header[NPY_HEADER_SIZE];
+	std::memset(header, ' ', sizeof(header));
+
+	std::memcpy(header, "\x93NUMPY\x01\x00", 8);
+	header[8] = (char)((NPY_HEADER_SIZE - 10) & 0xFF);
+	header[9] = (char)((NPY_HEADER_SIZE - 10) >> 8);
+
+	int length = std::snprintf(header + 10, NPY_HEADER_SIZE - 10, "{'descr': '|u1', 'fortran_order': False, 'shape': (%lld, %d, %d, %d), }",
+		num_faces, rows, cols, channels);
+
+	// The spaces after the dictionary are part of the padding, the header ends with a new line
+	header[10 + length] = ' ';
+	header[NPY_HEADER_SIZE - 1] = '\n';
+
+	tensor_file.write(header, sizeof(header));
+}
+
+bool RecorderAlignedTensor::Write(const cv::Mat& aligned_face, int frame_number, int face_id, double timestamp, bool success)
+{
+	if (!tensor_file.is_open() || aligned_face.empty())
+	{
+		return false;
+	}
+
+	if (num_faces == 0)
+	{
+		rows = aligned_face.rows;
+		cols = aligned_face.cols;
+		channels = aligned_face.channels();
+	}
+
+	// Bringing the face to the shape of the tensor, the aligned faces are normally all of the same size so this is rarely needed
+	cv::Mat face = aligned_face;
+	if (face.depth() != CV_8U)
+	{
+		cv::Mat converted;
+		face.convertTo(converted, CV_8U);
+		face = converted;
+	}
+	if (face.channels() != channels)
+	{
+		cv::Mat converted;
+		if (channels == 1)
+			cv::cvtColor(face, converted, face.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+		else
+			cv::cvtColor(face, converted, face.channels() == 1 ? cv::COLOR_GRAY2BGR : cv::COLOR_BGRA2BGR);
+		face = converted;
+	}
+	if (face.rows != rows || face.cols != cols)
+	{
+		cv::Mat resized;
+		cv::resize(face, resized, cv::Size(cols, rows), 0, 0, cv::INTER_LINEAR);
+		face = resized;
+	}
+
+	// The rows of a face are appended as they are, without the padding of non-continuous matrices
+	size_t row_bytes = (size_t)cols * channels;
+	for (int r = 0; r < rows; ++r)
+	{
+		tensor_file.write((const char*)face.ptr(r), row_bytes);
+	}
+
+	if (!tensor_file)
+	{
+		return false;
+	}
+
+	index_file << num_faces << "," << frame_number << "," << face_id << "," << timestamp << "," << (success ? 1 : 0) << "\n";
+	num_faces++;
+
+	return true;
+}
+
+void RecorderAlignedTensor::Close()
+{
+	if (tensor_file.is_open())
+	{
+		tensor_file.seekp(0);
+		WriteHeader();
+		tensor_file.close();
+	}
+	index_file.close();
+}
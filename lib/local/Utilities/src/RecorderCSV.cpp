@@ -32,6 +32,7 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "RecorderCSV.h"
+#include "Tracing.h"
 
 // For sorting
 #include <algorithm>
@@ -40,27 +41,179 @@
 #include <iostream>
 #include <iomanip>
 #include <locale>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <chrono>
+
+// Boost includes
+#include <filesystem.hpp>
 
 using namespace Utilities;
 
+namespace
+{
+	// Writing a value in fixed notation with the given number of decimals (the same as std::fixed with std::setprecision), independent of the locale.
+	// Returns the end of the written characters, out should have room for at least 32 characters
+	char* FormatFixed(char* out, double value, int decimals)
+	{
+		static const double scales[] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6 };
+		static const uint64_t int_scales[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+		double scaled = decimals <= 6 ? std::fabs(value) * scales[decimals] : HUGE_VAL;
+
+		// Fall back to printf for very large and non finite values, and for values close to a rounding tie where the scaling might have
+		// moved them to the other side
+		if (!(scaled < 1e18) || std::fabs(scaled - std::floor(scaled) - 0.5) < 1e-6)
+		{
+			char long_value[512];
+			int length = std::snprintf(long_value, sizeof(long_value), "%.*f", decimals, value);
+			length = std::min(length, 31);
+			std::copy(long_value, long_value + length, out);
+			return out + length;
+		}
+
+		uint64_t rounded = (uint64_t)std::nearbyint(scaled);
+		uint64_t int_part = rounded / int_scales[decimals];
+		uint64_t frac_part = rounded % int_scales[decimals];
+
+		if (std::signbit(value))
+		{
+			*out++ = '-';
+		}
+
+		char digits[20];
+		int num_digits = 0;
+		do
+		{
+			digits[num_digits++] = (char)('0' + int_part % 10);
+			int_part /= 10;
+		} while (int_part > 0);
+
+		while (num_digits > 0)
+		{
+			*out++ = digits[--num_digits];
+		}
+
+		if (decimals > 0)
+		{
+			*out++ = '.';
+			for (int i = decimals - 1; i >= 0; --i)
+			{
+				out[i] = (char)('0' + frac_part % 10);
+				frac_part /= 10;
+			}
+			out += decimals;
+		}
+		return out;
+	}
+
+	// Copying up to num_columns values to a line, the columns without a value are set to NaN
+	void CopyValues(const float* values, int num_values, double* out, int num_columns)
+	{
+		int num_copied = std::min(num_values, num_columns);
+		std::copy(values, values + num_copied, out);
+		std::fill(out + num_copied, out + num_columns, std::numeric_limits<double>::quiet_NaN());
+	}
+
+	void CopyValues(const cv::Mat_<float>& values, double* out, int num_columns)
+	{
+		if (values.isContinuous())
+		{
+			CopyValues(values.empty() ? NULL : values.ptr<float>(0), (int)values.total(), out, num_columns);
+		}
+		else
+		{
+			cv::Mat_<float> continuous = values.clone();
+			CopyValues(continuous.ptr<float>(0), (int)continuous.total(), out, num_columns);
+		}
+	}
+
+	// The points are written as all of the x coordinates followed by all of the y (and z) coordinates
+	template<typename Point>
+	void CopyPoints(const std::vector<Point>& points, double* out, int num_columns)
+	{
+		const int dims = sizeof(Point) / sizeof(float);
+		int num_points = std::min((int)points.size(), num_columns / dims);
+		for (int d = 0; d < dims; ++d)
+		{
+			double* coordinates = out + d * (num_columns / dims);
+			for (int i = 0; i < num_points; ++i)
+			{
+				coordinates[i] = (&points[i].x)[d];
+			}
+			std::fill(coordinates + num_points, coordinates + num_columns / dims, std::numeric_limits<double>::quiet_NaN());
+		}
+	}
+
+	void CopyIndexedValues(const std::vector<float>& values, const std::vector<int>& indices, double* out)
+	{
+		for (size_t i = 0; i < indices.size(); ++i)
+		{
+			out[i] = indices[i] < (int)values.size() ? values[indices[i]] : std::numeric_limits<double>::quiet_NaN();
+		}
+	}
+}
+
 // Default constructor initializes the variables
-RecorderCSV::RecorderCSV():output_file(){};
+RecorderCSV::RecorderCSV():output_file(), compression(COMPRESSION_NONE), compression_level(0), rows_in_batch(0), resume_rows(-1), rows_queued(0), rows_written(0) {};
+
+RecorderCSV::~RecorderCSV()
+{
+	this->Close();
+}
 
 // Making sure full stop is used for decimal point separation
 struct fullstop : std::numpunct<char> {
 	char do_decimal_point() const { return '.'; }
 };
 
+void RecorderCSV::AddColumns(ColumnSource source, const std::vector<int>& decimals)
+{
+	ColumnGroup group = { source, (int)column_decimals.size(), (int)decimals.size() };
+	column_groups.push_back(group);
+	column_decimals.insert(column_decimals.end(), decimals.begin(), decimals.end());
+}
+
 // Opening the file and preparing the header for it
 bool RecorderCSV::Open(std::string output_file_name, bool is_sequence, bool output_2D_landmarks, bool output_3D_landmarks, bool output_model_params, bool output_pose, bool output_AUs, bool output_gaze,
-	int num_face_landmarks, int num_model_modes, int num_eye_landmarks, const std::vector<std::string>& au_names_class, const std::vector<std::string>& au_names_reg)
+	int num_face_landmarks, int num_model_modes, int num_eye_landmarks, const std::vector<std::string>& au_names_class, const std::vector<std::string>& au_names_reg,
+	bool output_reused)
 {
 
-	output_file.open(output_file_name, std::ios_base::out);
-	output_file.imbue(std::locale(output_file.getloc(), new fullstop));
+	if (compression != COMPRESSION_NONE)
+	{
+		// The compressed blocks can not be truncated to the rows to keep
+		if (resume_rows >= 0)
+		{
+			std::cout << "Could not resume the compressed CSV file " << output_file_name << ", resuming needs an uncompressed output" << std::endl;
+			return false;
+		}
+		if (!compressed_file.Open(output_file_name, compression, compression_level))
+			return false;
+	}
+	else
+	{
+		// When resuming the existing lines are kept and the new ones appended to them
+		if (resume_rows >= 0 && !TruncateFile(output_file_name, resume_rows))
+		{
+			std::cout << "Could not resume the CSV file " << output_file_name << ", it has less than " << resume_rows << " lines" << std::endl;
+			return false;
+		}
+		output_file.open(output_file_name, resume_rows >= 0 ? std::ios_base::app : std::ios_base::out);
+		output_file.imbue(std::locale(output_file.getloc(), new fullstop));
 
-	if (!output_file.is_open())
-		return false;
+		if (!output_file.is_open())
+			return false;
+	}
+
+	rows_queued = resume_rows >= 0 ? resume_rows : 0;
+	rows_written = rows_queued;
+
+	// The header is only written for a new file
+	std::ostringstream header;
 
 	this->is_sequence = is_sequence;
 
@@ -71,278 +224,363 @@ bool RecorderCSV::Open(std::string output_file_name, bool is_sequence, bool outp
 	this->output_gaze = output_gaze;
 	this->output_model_params = output_model_params;
 	this->output_pose = output_pose;
+	this->output_reused = output_reused;
 
 	this->au_names_class = au_names_class;
 	this->au_names_reg = au_names_reg;
 
+	// Keep track of the precision every column is written with, and of where its values come from
+	column_decimals.clear();
+	column_groups.clear();
+
 	// Different headers if we are writing out the results on a sequence or an individual image
 	if(this->is_sequence)
 	{
-		output_file << "frame, face_id, timestamp, confidence, success";
+		header << "frame, face_id, timestamp, confidence, success";
+		AddColumns(COLUMN_FRAME, 1, 0);
+		AddColumns(COLUMN_FACE_ID, 1, 0);
+		AddColumns(COLUMN_TIMESTAMP, 1, 3);
+		AddColumns(COLUMN_CONFIDENCE, 1, 2);
+		AddColumns(COLUMN_SUCCESS, 1, 0);
+		if (output_reused)
+		{
+			header << ", reused";
+			AddColumns(COLUMN_REUSED, 1, 0);
+		}
 	}
 	else
 	{
-		output_file << "face, confidence";
+		header << "face, confidence";
+		AddColumns(COLUMN_FACE_ID, 1, 0);
+		AddColumns(COLUMN_CONFIDENCE, 1, 3);
 	}
 
 	if (output_gaze)
 	{
-		output_file << ", gaze_0_x, gaze_0_y, gaze_0_z, gaze_1_x, gaze_1_y, gaze_1_z, gaze_angle_x, gaze_angle_y";
+		header << ", gaze_0_x, gaze_0_y, gaze_0_z, gaze_1_x, gaze_1_y, gaze_1_z, gaze_angle_x, gaze_angle_y";
+		AddColumns(COLUMN_GAZE, { 6, 6, 6, 6, 6, 6, 3, 3 });
+		AddColumns(COLUMN_EYE_LANDMARKS_2D, 2 * num_eye_landmarks, 1);
+		AddColumns(COLUMN_EYE_LANDMARKS_3D, 3 * num_eye_landmarks, 1);
 
 		for (int i = 0; i < num_eye_landmarks; ++i)
 		{
-			output_file << ", eye_lmk_x_" << i;
+			header << ", eye_lmk_x_" << i;
 		}
 		for (int i = 0; i < num_eye_landmarks; ++i)
 		{
-			output_file << ", eye_lmk_y_" << i;
+			header << ", eye_lmk_y_" << i;
 		}
 
 		for (int i = 0; i < num_eye_landmarks; ++i)
 		{
-			output_file << ", eye_lmk_X_" << i;
+			header << ", eye_lmk_X_" << i;
 		}
 		for (int i = 0; i < num_eye_landmarks; ++i)
 		{
-			output_file << ", eye_lmk_Y_" << i;
+			header << ", eye_lmk_Y_" << i;
 		}
 		for (int i = 0; i < num_eye_landmarks; ++i)
 		{
-			output_file << ", eye_lmk_Z_" << i;
+			header << ", eye_lmk_Z_" << i;
 		}
 	}
 
 	if (output_pose)
 	{
-		output_file << ", pose_Tx, pose_Ty, pose_Tz, pose_Rx, pose_Ry, pose_Rz";
+		header << ", pose_Tx, pose_Ty, pose_Tz, pose_Rx, pose_Ry, pose_Rz";
+		AddColumns(COLUMN_POSE, { 1, 1, 1, 3, 3, 3 });
 	}
 
 	if (output_2D_landmarks)
 	{
+		AddColumns(COLUMN_LANDMARKS_2D, 2 * num_face_landmarks, 1);
 		for (int i = 0; i < num_face_landmarks; ++i)
 		{
-			output_file << ", x_" << i;
+			header << ", x_" << i;
 		}
 		for (int i = 0; i < num_face_landmarks; ++i)
 		{
-			output_file << ", y_" << i;
+			header << ", y_" << i;
 		}
 	}
 
 	if (output_3D_landmarks)
 	{
+		AddColumns(COLUMN_LANDMARKS_3D, 3 * num_face_landmarks, 1);
 		for (int i = 0; i < num_face_landmarks; ++i)
 		{
-			output_file << ", X_" << i;
+			header << ", X_" << i;
 		}
 		for (int i = 0; i < num_face_landmarks; ++i)
 		{
-			output_file << ", Y_" << i;
+			header << ", Y_" << i;
 		}
 		for (int i = 0; i < num_face_landmarks; ++i)
 		{
-			output_file << ", Z_" << i;
+			header << ", Z_" << i;
 		}
 	}
 
 	// Outputting model parameters (rigid and non-rigid), the first parameters are the 6 rigid shape parameters, they are followed by the non rigid shape parameters
 	if (output_model_params)
 	{
-		output_file << ", p_scale, p_rx, p_ry, p_rz, p_tx, p_ty";
+		header << ", p_scale, p_rx, p_ry, p_rz, p_tx, p_ty";
+		AddColumns(COLUMN_RIGID_PARAMS, 6, 3);
+		AddColumns(COLUMN_LOCAL_PARAMS, num_model_modes, 3);
 		for (int i = 0; i < num_model_modes; ++i)
 		{
-			output_file << ", p_" << i;
+			header << ", p_" << i;
 		}
 	}
 
 	if (output_AUs)
 	{
 		std::sort(this->au_names_reg.begin(), this->au_names_reg.end());
+		au_value_indices_reg.clear();
 		for (std::string reg_name : this->au_names_reg)
 		{
-			output_file << ", " << reg_name << "_r";
+			header << ", " << reg_name << "_r";
+			au_value_indices_reg.push_back((int)(std::find(au_names_reg.begin(), au_names_reg.end(), reg_name) - au_names_reg.begin()));
 		}
+		AddColumns(COLUMN_AU_INTENSITIES, (int)this->au_names_reg.size(), 2);
 
 		std::sort(this->au_names_class.begin(), this->au_names_class.end());
+		au_value_indices_class.clear();
 		for (std::string class_name : this->au_names_class)
 		{
-			output_file << ", " << class_name << "_c";
+			header << ", " << class_name << "_c";
+			au_value_indices_class.push_back((int)(std::find(au_names_class.begin(), au_names_class.end(), class_name) - au_names_class.begin()));
 		}
+		AddColumns(COLUMN_AU_OCCURENCES, (int)this->au_names_class.size(), 1);
 	}
 
-	output_file << std::endl;
+	column_widths.assign(column_decimals.size(), 0);
+	if (output_AUs)
+	{
+		std::vector<int>::iterator first_class = column_widths.end() - this->au_names_class.size();
+		std::fill(first_class - this->au_names_reg.size(), first_class, AU_INTENSITY_WIDTH);
+		std::fill(first_class, column_widths.end(), AU_OCCURENCE_WIDTH);
+	}
+
+	header << std::endl;
+	if (compressed_file.IsOpen())
+	{
+		std::string header_line = header.str();
+		compressed_file.WriteBlock(header_line.data(), header_line.size(), -1);
+	}
+	else if (resume_rows < 0)
+	{
+		output_file << header.str();
+	}
+
+	batch = cv::Mat_<double>(LINES_PER_BATCH, (int)column_decimals.size(), 0.0);
+	rows_in_batch = 0;
+
+	// Start the writing thread
+	batch_queue.set_capacity(BATCH_QUEUE_CAPACITY);
+	writing_thread = std::thread(&RecorderCSV::BatchWritingTask, &batch_queue, &output_file, &compressed_file, &column_decimals, &column_widths, &rows_written);
 
 	return true;
 
 }
 
-void RecorderCSV::WriteLine(int face_id, int frame_num, double time_stamp, bool landmark_detection_success, double landmark_confidence,
-	const cv::Mat_<float>& landmarks_2D, const cv::Mat_<float>& landmarks_3D, const cv::Mat_<float>& pdm_model_params, const cv::Vec6f& rigid_shape_params, cv::Vec6f& pose_estimate,
-	const cv::Point3f& gazeDirection0, const cv::Point3f& gazeDirection1, const cv::Vec2f& gaze_angle, const std::vector<cv::Point2f>& eye_landmarks2d, const std::vector<cv::Point3f>& eye_landmarks3d,
-	const std::vector<std::pair<std::string, double> >& au_intensities, const std::vector<std::pair<std::string, double> >& au_occurences)
+void RecorderCSV::BatchWritingTask(tbb::concurrent_bounded_queue<cv::Mat_<double> > *writing_queue, std::ofstream *output_file, CompressedOutputFile *compressed_file, const std::vector<int> *decimals,
+	const std::vector<int> *widths, std::atomic<long long> *rows_written)
 {
+	cv::Mat_<double> batch;
 
-	if (!output_file.is_open())
-	{
-		std::cout << "The output CSV file is not open, exiting" << std::endl;
-		exit(1);
-	}
+	// Every value takes at most 32 characters together with the separator
+	std::vector<char> buffer;
 
-	// Making sure fixed and not scientific notation is used
-	output_file << std::fixed;
-	output_file << std::noshowpoint;
-	if(is_sequence)
-	{
-		
-		output_file << std::setprecision(3);
-		output_file << frame_num << ", " << face_id << ", " << time_stamp;
-		output_file << std::setprecision(2);
-		output_file << ", " << landmark_confidence;
-		output_file << std::setprecision(0);
-		output_file << ", " << landmark_detection_success;
-	}
-	else
-	{
-		output_file << std::setprecision(3);
-		output_file << face_id << ", " << landmark_confidence;
-	}
-	// Output the estimated gaze
-	if (output_gaze)
+	while (true)
 	{
-		output_file << std::setprecision(6);
-		output_file << ", " << gazeDirection0.x << ", " << gazeDirection0.y << ", " << gazeDirection0.z
-			<< ", " << gazeDirection1.x << ", " << gazeDirection1.y << ", " << gazeDirection1.z;
+		writing_queue->pop(batch);
 
-		// Output gaze angle (same format as head pose angle)
-		output_file << std::setprecision(3);
-		output_file << ", " << gaze_angle[0] << ", " << gaze_angle[1];
+		// Empty batch indicates termination
+		if (batch.empty())
+			break;
 
-		// Output the 2D eye landmarks
-		output_file << std::setprecision(1);
-		for (auto eye_lmk : eye_landmarks2d)
-		{
-			output_file << ", " << eye_lmk.x;
-		}
+		buffer.resize(batch.rows * (batch.cols * 34 + 1));
+		char* out = buffer.data();
 
-		for (auto eye_lmk : eye_landmarks2d)
+		for (int r = 0; r < batch.rows; ++r)
 		{
-			output_file << ", " << eye_lmk.y;
-		}
+			const double* row = batch.ptr<double>(r);
+			for (int c = 0; c < batch.cols; ++c)
+			{
+				if (c > 0)
+				{
+					*out++ = ',';
+					*out++ = ' ';
+				}
 
-		// Output the 3D eye landmarks
-		for (auto eye_lmk : eye_landmarks3d)
-		{
-			output_file << ", " << eye_lmk.x;
-		}
+				// Values that were not available are written out as 0
+				char* value_start = out;
+				if (std::isnan(row[c]))
+				{
+					*out++ = '0';
+				}
+				else
+				{
+					out = FormatFixed(out, row[c], (*decimals)[c]);
+				}
 
-		for (auto eye_lmk : eye_landmarks3d)
+				// Right aligning the values of the fixed width columns
+				int padding = (*widths)[c] - (int)(out - value_start);
+				if (padding > 0)
+				{
+					std::memmove(value_start + padding, value_start, out - value_start);
+					std::fill(value_start, value_start + padding, ' ');
+					out += padding;
+				}
+			}
+			*out++ = '\n';
+		}
+		// A compressed batch is a block of its own, so that the file can be read from any batch
+		if (compressed_file->IsOpen())
 		{
-			output_file << ", " << eye_lmk.y;
+			compressed_file->WriteBlock(buffer.data(), out - buffer.data(), *rows_written);
 		}
-
-		for (auto eye_lmk : eye_landmarks3d)
+		else
 		{
-			output_file << ", " << eye_lmk.z;
+			output_file->write(buffer.data(), out - buffer.data());
+			output_file->flush();
 		}
+		*rows_written += batch.rows;
 	}
+}
 
-	// Output the estimated head pose
-	if (output_pose)
+void RecorderCSV::FlushBatch()
+{
+	if (rows_in_batch == 0)
 	{
-		output_file << std::setprecision(1);
-		output_file << ", " << pose_estimate[0] << ", " << pose_estimate[1] << ", " << pose_estimate[2];
-		output_file << std::setprecision(3);
-		output_file << ", " << pose_estimate[3] << ", " << pose_estimate[4] << ", " << pose_estimate[5];
+		return;
 	}
 
-	// Output the detected 2D facial landmarks
-	if (output_2D_landmarks)
+	// The writing thread owns the pushed lines, so keep filling a fresh batch
+	if (rows_in_batch == batch.rows)
 	{
-		output_file.precision(1);
-		// Output the 2D eye landmarks
-		for (auto lmk : landmarks_2D)
-		{
-			output_file << ", " << lmk;
-		}
+		batch_queue.push(batch);
+		batch = cv::Mat_<double>(LINES_PER_BATCH, (int)column_decimals.size(), 0.0);
 	}
+	else
+	{
+		batch_queue.push(batch.rowRange(0, rows_in_batch).clone());
+	}
+	rows_queued += rows_in_batch;
+	rows_in_batch = 0;
+	TRACE_COUNTER("RecorderCSV batch_queue", batch_queue.size());
+}
 
-	// Output the detected 3D facial landmarks
-	if (output_3D_landmarks)
+long long RecorderCSV::Sync()
+{
+	if (!isOpen())
 	{
-		output_file.precision(1);
-		// Output the 2D eye landmarks
-		for (auto lmk : landmarks_3D)
-		{
-			output_file << ", " << lmk;
-		}
+		return 0;
 	}
 
-	if (output_model_params)
+	FlushBatch();
+	while (rows_written < rows_queued)
 	{
-		output_file.precision(3);
-		for (int i = 0; i < 6; ++i)
-		{
-			output_file << ", " << rigid_shape_params[i];
-		}
-		// Output the non_rigid shape parameters
-		for (auto lmk : pdm_model_params)
-		{
-			output_file << ", " << lmk;
-		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
 	}
+	return rows_queued;
+}
 
-	if (output_AUs)
+bool RecorderCSV::TruncateFile(const std::string& filename, long long rows)
+{
+	std::ifstream existing(filename, std::ios_base::in | std::ios_base::binary);
+	if (!existing.is_open())
 	{
+		return false;
+	}
 
-		// write out ar the correct index
-		output_file.precision(2);
-		for (std::string au_name : au_names_reg)
+	// Finding the end of the header and the rows to keep
+	std::string line;
+	for (long long i = 0; i <= rows; ++i)
+	{
+		if (!std::getline(existing, line) || existing.eof())
 		{
-			for (auto au_reg : au_intensities)
-			{
-				if (au_name.compare(au_reg.first) == 0)
-				{
-					output_file << ", " << au_reg.second;
-					break;
-				}
-			}
+			return false;
 		}
+	}
+	long long length = (long long)existing.tellg();
+	existing.close();
 
-		if (au_intensities.size() == 0)
-		{
-			for (size_t p = 0; p < au_names_reg.size(); ++p)
-			{
-				output_file << ", 0";
-			}
-		}
+	boost::system::error_code error;
+	boost::filesystem::resize_file(filename, length, error);
+	return !error;
+}
 
-		output_file.precision(1);
-		// write out ar the correct index
-		for (std::string au_name : au_names_class)
-		{
-			for (auto au_class : au_occurences)
-			{
-				if (au_name.compare(au_class.first) == 0)
-				{
-					output_file << ", " << au_class.second;
-					break;
-				}
-			}
-		}
+void RecorderCSV::WriteLine(int face_id, int frame_num, double time_stamp, bool landmark_detection_success, double landmark_confidence,
+	const cv::Mat_<float>& landmarks_2D, const cv::Mat_<float>& landmarks_3D, const cv::Mat_<float>& pdm_model_params, const cv::Vec6f& rigid_shape_params, cv::Vec6f& pose_estimate,
+	const cv::Point3f& gazeDirection0, const cv::Point3f& gazeDirection1, const cv::Vec2f& gaze_angle, const std::vector<cv::Point2f>& eye_landmarks2d, const std::vector<cv::Point3f>& eye_landmarks3d,
+	const std::vector<float>& au_intensities, const std::vector<float>& au_occurences, bool reused)
+{
 
-		if (au_occurences.size() == 0)
+	if (!isOpen())
+	{
+		std::cout << "The output CSV file is not open, exiting" << std::endl;
+		exit(1);
+	}
+
+	// Only the values are collected here, the formatting (with the precision set up in Open) happens on the writing thread
+	double* row = batch.ptr<double>(rows_in_batch);
+	for (const ColumnGroup& group : column_groups)
+	{
+		double* out = row + group.first_column;
+		int n = group.num_columns;
+		switch (group.source)
 		{
-			for (size_t p = 0; p < au_names_class.size(); ++p)
-			{
-				output_file << ", 0";
-			}
+		case COLUMN_FRAME: out[0] = frame_num; break;
+		case COLUMN_FACE_ID: out[0] = face_id; break;
+		case COLUMN_TIMESTAMP: out[0] = time_stamp; break;
+		case COLUMN_CONFIDENCE: out[0] = landmark_confidence; break;
+		case COLUMN_SUCCESS: out[0] = landmark_detection_success; break;
+		case COLUMN_REUSED: out[0] = reused; break;
+		case COLUMN_GAZE:
+		{
+			// The gaze angle has the same format as the head pose angle
+			const double gaze[] = { gazeDirection0.x, gazeDirection0.y, gazeDirection0.z, gazeDirection1.x, gazeDirection1.y, gazeDirection1.z, gaze_angle[0], gaze_angle[1] };
+			std::copy(gaze, gaze + 8, out);
+			break;
+		}
+		case COLUMN_EYE_LANDMARKS_2D: CopyPoints(eye_landmarks2d, out, n); break;
+		case COLUMN_EYE_LANDMARKS_3D: CopyPoints(eye_landmarks3d, out, n); break;
+		case COLUMN_POSE: CopyValues(pose_estimate.val, 6, out, n); break;
+		case COLUMN_LANDMARKS_2D: CopyValues(landmarks_2D, out, n); break;
+		case COLUMN_LANDMARKS_3D: CopyValues(landmarks_3D, out, n); break;
+		case COLUMN_RIGID_PARAMS: CopyValues(rigid_shape_params.val, 6, out, n); break;
+		case COLUMN_LOCAL_PARAMS: CopyValues(pdm_model_params, out, n); break;
+		// AUs that are not available are written as NaN
+		case COLUMN_AU_INTENSITIES: CopyIndexedValues(au_intensities, au_value_indices_reg, out); break;
+		case COLUMN_AU_OCCURENCES: CopyIndexedValues(au_occurences, au_value_indices_class, out); break;
 		}
 	}
-	output_file << std::endl;
+
+	rows_in_batch++;
+	if (rows_in_batch == batch.rows)
+	{
+		FlushBatch();
+	}
 }
 
 // Closing the file and cleaning up
 void RecorderCSV::Close()
 {
+	if (!isOpen())
+	{
+		return;
+	}
+
+	FlushBatch();
+
+	// Insert the terminating batch and wait for the writing to complete
+	batch_queue.push(cv::Mat_<double>());
+	if (writing_thread.joinable())
+		writing_thread.join();
+
 	output_file.close();
+	compressed_file.Close();
+	resume_rows = -1;
 }
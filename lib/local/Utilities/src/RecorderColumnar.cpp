@@ -0,0 +1,538 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include "RecorderColumnar.h"
+
+// For sorting
+#include <algorithm>
+
+// For standard out
+#include <iostream>
+#include <cmath>
+#include <cstdint>
+
+using namespace Utilities;
+
+namespace
+{
+	// Zig-zag varint coding of the deltas between the quantised values of a column
+	void EncodeColumn(const cv::Mat_<double>& chunk, int col, double scale, std::vector<unsigned char>& out)
+	{
+		out.clear();
+		int64_t prev = 0;
+		for (int r = 0; r < chunk.rows; ++r)
+		{
+			double value = chunk(r, col) * scale;
+			int64_t quantised = std::isfinite(value) ? (int64_t)std::llround(value) : 0;
+			int64_t delta = quantised - prev;
+			prev = quantised;
+
+			uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+			while (zigzag >= 0x80)
+			{
+				out.push_back((unsigned char)(zigzag | 0x80));
+				zigzag >>= 7;
+			}
+			out.push_back((unsigned char)zigzag);
+		}
+	}
+
+	bool DecodeColumn(const std::vector<unsigned char>& in, double scale, cv::Mat_<double>& data, int col)
+	{
+		size_t pos = 0;
+		int64_t prev = 0;
+		for (int r = 0; r < data.rows; ++r)
+		{
+			uint64_t zigzag = 0;
+			int shift = 0;
+			while (true)
+			{
+				if (pos >= in.size() || shift > 63)
+				{
+					return false;
+				}
+				unsigned char byte = in[pos++];
+				zigzag |= (uint64_t)(byte & 0x7f) << shift;
+				shift += 7;
+				if (byte < 0x80)
+				{
+					break;
+				}
+			}
+			int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+			prev += delta;
+			data(r, col) = (double)prev / scale;
+		}
+		return true;
+	}
+
+	void WriteInt(std::ofstream& out, int value)
+	{
+		int32_t v = value;
+		out.write((char*)&v, 4);
+	}
+
+	bool ReadInt(std::ifstream& in, int& value)
+	{
+		int32_t v;
+		if (!in.read((char*)&v, 4))
+		{
+			return false;
+		}
+		value = v;
+		return true;
+	}
+
+	const char COLUMNAR_MAGIC[] = "OFCOL001";
+}
+
+// Default constructor initializes the variables
+RecorderColumnar::RecorderColumnar() :output_file(), rows_in_chunk(0), current_col(0) {};
+
+RecorderColumnar::~RecorderColumnar()
+{
+	this->Close();
+}
+
+void RecorderColumnar::AddColumn(const std::string& name, int decimals)
+{
+	column_names.push_back(name);
+	column_scales.push_back(std::pow(10.0, decimals));
+}
+
+// Opening the file and preparing the header for it
+bool RecorderColumnar::Open(std::string output_file_name, bool is_sequence, bool output_2D_landmarks, bool output_3D_landmarks, bool output_model_params, bool output_pose, bool output_AUs, bool output_gaze,
+	int num_face_landmarks, int num_model_modes, int num_eye_landmarks, const std::vector<std::string>& au_names_class, const std::vector<std::string>& au_names_reg,
+	bool output_reused)
+{
+
+	output_file.open(output_file_name, std::ios_base::out | std::ios_base::binary);
+
+	if (!output_file.is_open())
+		return false;
+
+	this->is_sequence = is_sequence;
+
+	// Set up what we are recording
+	this->output_2D_landmarks = output_2D_landmarks;
+	this->output_3D_landmarks = output_3D_landmarks;
+	this->output_AUs = output_AUs;
+	this->output_gaze = output_gaze;
+	this->output_model_params = output_model_params;
+	this->output_pose = output_pose;
+	this->output_reused = output_reused;
+
+	this->au_names_class = au_names_class;
+	this->au_names_reg = au_names_reg;
+
+	// The same columns and precisions as in the CSV output
+	column_names.clear();
+	column_scales.clear();
+
+	if (this->is_sequence)
+	{
+		AddColumn("frame", 0);
+		AddColumn("face_id", 0);
+		AddColumn("timestamp", 3);
+		AddColumn("confidence", 2);
+		AddColumn("success", 0);
+		if (output_reused)
+		{
+			AddColumn("reused", 0);
+		}
+	}
+	else
+	{
+		AddColumn("face", 0);
+		AddColumn("confidence", 3);
+	}
+
+	if (output_gaze)
+	{
+		const char* gaze_names[] = { "gaze_0_x", "gaze_0_y", "gaze_0_z", "gaze_1_x", "gaze_1_y", "gaze_1_z" };
+		for (const char* name : gaze_names)
+		{
+			AddColumn(name, 6);
+		}
+		AddColumn("gaze_angle_x", 3);
+		AddColumn("gaze_angle_y", 3);
+
+		const char* eye_names[] = { "eye_lmk_x_", "eye_lmk_y_", "eye_lmk_X_", "eye_lmk_Y_", "eye_lmk_Z_" };
+		for (const char* name : eye_names)
+		{
+			for (int i = 0; i < num_eye_landmarks; ++i)
+			{
+				AddColumn(name + std::to_string(i), 1);
+			}
+		}
+	}
+
+	if (output_pose)
+	{
+		AddColumn("pose_Tx", 1);
+		AddColumn("pose_Ty", 1);
+		AddColumn("pose_Tz", 1);
+		AddColumn("pose_Rx", 3);
+		AddColumn("pose_Ry", 3);
+		AddColumn("pose_Rz", 3);
+	}
+
+	if (output_2D_landmarks)
+	{
+		const char* names[] = { "x_", "y_" };
+		for (const char* name : names)
+		{
+			for (int i = 0; i < num_face_landmarks; ++i)
+			{
+				AddColumn(name + std::to_string(i), 1);
+			}
+		}
+	}
+
+	if (output_3D_landmarks)
+	{
+		const char* names[] = { "X_", "Y_", "Z_" };
+		for (const char* name : names)
+		{
+			for (int i = 0; i < num_face_landmarks; ++i)
+			{
+				AddColumn(name + std::to_string(i), 1);
+			}
+		}
+	}
+
+	// Outputting model parameters (rigid and non-rigid), the first parameters are the 6 rigid shape parameters, they are followed by the non rigid shape parameters
+	if (output_model_params)
+	{
+		const char* rigid_names[] = { "p_scale", "p_rx", "p_ry", "p_rz", "p_tx", "p_ty" };
+		for (const char* name : rigid_names)
+		{
+			AddColumn(name, 3);
+		}
+		for (int i = 0; i < num_model_modes; ++i)
+		{
+			AddColumn("p_" + std::to_string(i), 3);
+		}
+	}
+
+	if (output_AUs)
+	{
+		std::sort(this->au_names_reg.begin(), this->au_names_reg.end());
+		au_value_indices_reg.clear();
+		for (std::string reg_name : this->au_names_reg)
+		{
+			AddColumn(reg_name + "_r", 2);
+			au_value_indices_reg.push_back((int)(std::find(au_names_reg.begin(), au_names_reg.end(), reg_name) - au_names_reg.begin()));
+		}
+
+		std::sort(this->au_names_class.begin(), this->au_names_class.end());
+		au_value_indices_class.clear();
+		for (std::string class_name : this->au_names_class)
+		{
+			AddColumn(class_name + "_c", 1);
+			au_value_indices_class.push_back((int)(std::find(au_names_class.begin(), au_names_class.end(), class_name) - au_names_class.begin()));
+		}
+	}
+
+	// Write out the header
+	output_file.write(COLUMNAR_MAGIC, 8);
+	WriteInt(output_file, (int)column_names.size());
+	for (size_t i = 0; i < column_names.size(); ++i)
+	{
+		WriteInt(output_file, (int)column_names[i].size());
+		output_file.write(column_names[i].c_str(), column_names[i].size());
+		WriteInt(output_file, (int)std::lround(std::log10(column_scales[i])));
+	}
+
+	chunk = cv::Mat_<double>(ROWS_PER_CHUNK, (int)column_names.size(), 0.0);
+	rows_in_chunk = 0;
+
+	// Start the writing thread
+	chunk_queue.set_capacity(CHUNK_QUEUE_CAPACITY);
+	writing_thread = std::thread(&RecorderColumnar::ChunkWritingTask, &chunk_queue, &output_file, &column_scales);
+
+	return true;
+
+}
+
+void RecorderColumnar::ChunkWritingTask(tbb::concurrent_bounded_queue<cv::Mat_<double> > *writing_queue, std::ofstream *output_file, const std::vector<double> *scales)
+{
+	cv::Mat_<double> chunk;
+	std::vector<unsigned char> encoded;
+
+	while (true)
+	{
+		writing_queue->pop(chunk);
+
+		// Empty chunk indicates termination
+		if (chunk.empty())
+			break;
+
+		WriteInt(*output_file, chunk.rows);
+		for (int c = 0; c < chunk.cols; ++c)
+		{
+			EncodeColumn(chunk, c, (*scales)[c], encoded);
+			WriteInt(*output_file, (int)encoded.size());
+			output_file->write((char*)encoded.data(), encoded.size());
+		}
+	}
+}
+
+void RecorderColumnar::FlushChunk()
+{
+	if (rows_in_chunk == 0)
+	{
+		return;
+	}
+
+	// The writing thread owns the pushed rows, so keep filling a fresh chunk
+	if (rows_in_chunk == chunk.rows)
+	{
+		chunk_queue.push(chunk);
+		chunk = cv::Mat_<double>(ROWS_PER_CHUNK, (int)column_names.size(), 0.0);
+	}
+	else
+	{
+		chunk_queue.push(chunk.rowRange(0, rows_in_chunk).clone());
+	}
+	rows_in_chunk = 0;
+}
+
+void RecorderColumnar::WriteLine(int face_id, int frame_num, double time_stamp, bool landmark_detection_success, double landmark_confidence,
+	const cv::Mat_<float>& landmarks_2D, const cv::Mat_<float>& landmarks_3D, const cv::Mat_<float>& pdm_model_params, const cv::Vec6f& rigid_shape_params, cv::Vec6f& pose_estimate,
+	const cv::Point3f& gazeDirection0, const cv::Point3f& gazeDirection1, const cv::Vec2f& gaze_angle, const std::vector<cv::Point2f>& eye_landmarks2d, const std::vector<cv::Point3f>& eye_landmarks3d,
+	const std::vector<float>& au_intensities, const std::vector<float>& au_occurences, bool reused)
+{
+
+	if (!output_file.is_open())
+	{
+		std::cout << "The output columnar file is not open, exiting" << std::endl;
+		exit(1);
+	}
+
+	current_col = 0;
+
+	if (is_sequence)
+	{
+		Push(frame_num);
+		Push(face_id);
+		Push(time_stamp);
+		Push(landmark_confidence);
+		Push(landmark_detection_success);
+		if (output_reused)
+		{
+			Push(reused);
+		}
+	}
+	else
+	{
+		Push(face_id);
+		Push(landmark_confidence);
+	}
+
+	// Output the estimated gaze
+	if (output_gaze)
+	{
+		Push(gazeDirection0.x);
+		Push(gazeDirection0.y);
+		Push(gazeDirection0.z);
+		Push(gazeDirection1.x);
+		Push(gazeDirection1.y);
+		Push(gazeDirection1.z);
+		Push(gaze_angle[0]);
+		Push(gaze_angle[1]);
+
+		for (auto eye_lmk : eye_landmarks2d)
+			Push(eye_lmk.x);
+		for (auto eye_lmk : eye_landmarks2d)
+			Push(eye_lmk.y);
+		for (auto eye_lmk : eye_landmarks3d)
+			Push(eye_lmk.x);
+		for (auto eye_lmk : eye_landmarks3d)
+			Push(eye_lmk.y);
+		for (auto eye_lmk : eye_landmarks3d)
+			Push(eye_lmk.z);
+	}
+
+	// Output the estimated head pose
+	if (output_pose)
+	{
+		for (int i = 0; i < 6; ++i)
+		{
+			Push(pose_estimate[i]);
+		}
+	}
+
+	if (output_2D_landmarks)
+	{
+		for (auto lmk : landmarks_2D)
+			Push(lmk);
+	}
+
+	if (output_3D_landmarks)
+	{
+		for (auto lmk : landmarks_3D)
+			Push(lmk);
+	}
+
+	if (output_model_params)
+	{
+		for (int i = 0; i < 6; ++i)
+		{
+			Push(rigid_shape_params[i]);
+		}
+		for (auto lmk : pdm_model_params)
+			Push(lmk);
+	}
+
+	if (output_AUs)
+	{
+		// Missing AUs are recorded as 0
+		for (int index : au_value_indices_reg)
+		{
+			double value = index < (int)au_intensities.size() ? au_intensities[index] : 0;
+			Push(std::isnan(value) ? 0 : value);
+		}
+
+		for (int index : au_value_indices_class)
+		{
+			double value = index < (int)au_occurences.size() ? au_occurences[index] : 0;
+			Push(std::isnan(value) ? 0 : value);
+		}
+	}
+
+	if (current_col != chunk.cols)
+	{
+		std::cout << "The number of recorded values does not match the columnar header, exiting" << std::endl;
+		exit(1);
+	}
+
+	rows_in_chunk++;
+	if (rows_in_chunk == chunk.rows)
+	{
+		FlushChunk();
+	}
+}
+
+// Closing the file and cleaning up
+void RecorderColumnar::Close()
+{
+	if (!output_file.is_open())
+	{
+		return;
+	}
+
+	FlushChunk();
+
+	// Insert the terminating chunk and wait for the writing to complete
+	chunk_queue.push(cv::Mat_<double>());
+	if (writing_thread.joinable())
+		writing_thread.join();
+
+	output_file.close();
+}
+
+bool RecorderColumnar::Read(const std::string& input_file_name, std::vector<std::string>& column_names, cv::Mat_<double>& data)
+{
+	std::ifstream input_file(input_file_name, std::ios_base::in | std::ios_base::binary);
+
+	if (!input_file.is_open())
+	{
+		std::cout << "Could not open the columnar file " << input_file_name << std::endl;
+		return false;
+	}
+
+	char magic[8];
+	int num_cols;
+	if (!input_file.read(magic, 8) || std::string(magic, 8).compare(COLUMNAR_MAGIC) != 0 || !ReadInt(input_file, num_cols) || num_cols < 0)
+	{
+		std::cout << "The file " << input_file_name << " is not an OpenFace columnar file" << std::endl;
+		return false;
+	}
+
+	column_names.clear();
+	std::vector<double> scales;
+	for (int c = 0; c < num_cols; ++c)
+	{
+		int name_length, decimals;
+		if (!ReadInt(input_file, name_length) || name_length < 0)
+		{
+			return false;
+		}
+		std::string name(name_length, ' ');
+		input_file.read(&name[0], name_length);
+		if (!ReadInt(input_file, decimals))
+		{
+			return false;
+		}
+		column_names.push_back(name);
+		scales.push_back(std::pow(10.0, decimals));
+	}
+
+	// Read the chunks, growing the data matrix as needed
+	cv::Mat_<double> all_data(0, num_cols);
+	std::vector<unsigned char> encoded;
+	int rows;
+	while (ReadInt(input_file, rows))
+	{
+		if (rows <= 0)
+		{
+			return false;
+		}
+
+		cv::Mat_<double> chunk_data(rows, num_cols);
+		for (int c = 0; c < num_cols; ++c)
+		{
+			int num_bytes;
+			if (!ReadInt(input_file, num_bytes) || num_bytes < 0)
+			{
+				return false;
+			}
+			encoded.resize(num_bytes);
+			if (!input_file.read((char*)encoded.data(), num_bytes) || !DecodeColumn(encoded, scales[c], chunk_data, c))
+			{
+				std::cout << "The columnar file " << input_file_name << " is truncated" << std::endl;
+				return false;
+			}
+		}
+		if (num_cols > 0)
+		{
+			all_data.push_back(chunk_data);
+		}
+	}
+
+	data = all_data;
+	return true;
+}
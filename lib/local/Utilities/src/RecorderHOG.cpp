@@ -34,30 +34,219 @@
 #include "RecorderHOG.h"
 
 #include <fstream>
+#include <cstdint>
+#include <utility>
 
 using namespace Utilities;
 
+namespace
+{
+	void WriteVarint(std::vector<unsigned char>& out, int64_t delta)
+	{
+		uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+		while (zigzag >= 0x80)
+		{
+			out.push_back((unsigned char)(zigzag | 0x80));
+			zigzag >>= 7;
+		}
+		out.push_back((unsigned char)zigzag);
+	}
+
+	// Delta coding every element against the same element in the previous frame (rows are frames)
+	template<typename T>
+	void EncodeFrames(const cv::Mat& frames, std::vector<unsigned char>& out)
+	{
+		for (int i = 0; i < frames.cols; ++i)
+		{
+			int64_t prev = 0;
+			for (int f = 0; f < frames.rows; ++f)
+			{
+				int64_t value = frames.ptr<T>(f)[i];
+				WriteVarint(out, value - prev);
+				prev = value;
+			}
+		}
+	}
+
+	template<typename T>
+	void WriteValue(std::ostream& out, T value)
+	{
+		out.write((char*)&value, sizeof(T));
+	}
+}
+
 // Default constructor initializes the variables
-RecorderHOG::RecorderHOG() :hog_file() {};
+RecorderHOG::RecorderHOG() :hog_file(), hog_out(&hog_file), compression(COMPRESSION_NONE), compression_level(0), block_offset(0), block_first_frame(0), frames_recorded(0),
+	compressed(false), half_precision(false), header_written(false), header_num_values(0), num_frames_written(0) {};
 
 // Opening the file and preparing the header for it
-bool RecorderHOG::Open(std::string output_file_name)
+bool RecorderHOG::Open(std::string output_file_name, bool compressed, bool half_precision)
 {
-	hog_file.open(output_file_name, std::ios_base::out | std::ios_base::binary);
+	bool opened;
+	if (compression != COMPRESSION_NONE)
+	{
+		// Everything is written to the block in memory, which is handed over to the writing thread of the file once it holds whole frames
+		opened = compressed_file.Open(output_file_name, compression, compression_level);
+		block.str("");
+		block.clear();
+		hog_out = &block;
+	}
+	else
+	{
+		hog_file.open(output_file_name, std::ios_base::out | std::ios_base::binary);
+		opened = hog_file.is_open();
+		hog_out = &hog_file;
+	}
+	block_offset = 0;
+	block_first_frame = 0;
+	frames_recorded = 0;
+
+	this->compressed = compressed;
+	this->half_precision = half_precision;
+	this->header_written = false;
+	this->num_frames_written = 0;
+	chunk_frames = cv::Mat_<float>();
+	chunk_good_frames.clear();
+	chunk_offsets.clear();
+
+	return opened;
+}
+
+bool RecorderHOG::IsOpen() const
+{
+	return hog_file.is_open() || compressed_file.IsOpen();
+}
+
+long long RecorderHOG::Position()
+{
+	return hog_out == &block ? block_offset + (long long)block.tellp() : (long long)hog_file.tellp();
+}
+
+void RecorderHOG::EndBlock()
+{
+	if (!compressed_file.IsOpen())
+	{
+		return;
+	}
+
+	std::string data = block.str();
+	if (data.empty())
+	{
+		return;
+	}
+
+	// The blocks without frames (the index of the v2 format) are not indexed
+	long long first_frame = frames_recorded > block_first_frame ? block_first_frame : -1;
+	block_offset += (long long)data.size();
+	compressed_file.PushBlock(std::move(data), first_frame);
 
-	return hog_file.is_open();
+	block.str("");
+	block.clear();
+	block_first_frame = frames_recorded;
 }
 
 void RecorderHOG::Close()
 {
+	if (compressed && IsOpen() && header_written)
+	{
+		WriteChunk();
+
+		// Write the index of the chunks, followed by its location so that it can be found from the end of the file
+		long long index_offset = Position();
+		WriteValue<int32_t>(*hog_out, (int32_t)chunk_offsets.size());
+		for (long long offset : chunk_offsets)
+		{
+			WriteValue<int64_t>(*hog_out, offset);
+		}
+		WriteValue<int64_t>(*hog_out, num_frames_written);
+		WriteValue<int64_t>(*hog_out, index_offset);
+		hog_out->write("OFHOGIDX", 8);
+	}
+	EndBlock();
+	header_written = false;
 	hog_file.close();
+	compressed_file.Close();
+}
+
+void RecorderHOG::WriteChunk()
+{
+	if (chunk_frames.rows == 0)
+	{
+		return;
+	}
+
+	chunk_offsets.push_back(Position());
+
+	WriteValue<int32_t>(*hog_out, chunk_frames.rows);
+	hog_out->write(chunk_good_frames.data(), chunk_good_frames.size());
+
+	std::vector<unsigned char> encoded;
+	if (half_precision)
+	{
+		cv::Mat frames_half;
+		cv::convertFp16(chunk_frames, frames_half);
+		EncodeFrames<uint16_t>(frames_half, encoded);
+	}
+	else
+	{
+		EncodeFrames<uint32_t>(chunk_frames, encoded);
+	}
+
+	WriteValue<int32_t>(*hog_out, (int32_t)encoded.size());
+	hog_out->write((char*)encoded.data(), encoded.size());
+
+	num_frames_written += chunk_frames.rows;
+	chunk_frames = cv::Mat_<float>();
+	chunk_good_frames.clear();
+
+	// Every chunk is a block of its own
+	EndBlock();
 }
 
 void RecorderHOG::Write()
 {
-	hog_file.write((char*)(&num_cols), 4);
-	hog_file.write((char*)(&num_rows), 4);
-	hog_file.write((char*)(&num_channels), 4);
+	if (compressed)
+	{
+		int num_values = num_cols * num_rows * num_channels;
+
+		// The dimensions are fixed by the first frame
+		if (!header_written)
+		{
+			hog_out->write("OFHOG002", 8);
+			WriteValue<int32_t>(*hog_out, num_cols);
+			WriteValue<int32_t>(*hog_out, num_rows);
+			WriteValue<int32_t>(*hog_out, num_channels);
+			WriteValue<int32_t>(*hog_out, half_precision ? 1 : 0);
+			WriteValue<int32_t>(*hog_out, FRAMES_PER_CHUNK);
+			header_written = true;
+			header_num_values = num_values;
+		}
+		else if (num_values != header_num_values)
+		{
+			std::cout << "The HOG descriptor size changed during recording, frame not recorded" << std::endl;
+			return;
+		}
+
+		if ((int)hog_descriptor.total() != num_values)
+		{
+			std::cout << "The HOG descriptor does not match its dimensions, frame not recorded" << std::endl;
+			return;
+		}
+
+		chunk_frames.push_back(cv::Mat_<float>(hog_descriptor.clone()).reshape(1, 1));
+		chunk_good_frames.push_back(good_frame ? 1 : 0);
+		frames_recorded++;
+
+		if (chunk_frames.rows == FRAMES_PER_CHUNK)
+		{
+			WriteChunk();
+		}
+		return;
+	}
+
+	hog_out->write((char*)(&num_cols), 4);
+	hog_out->write((char*)(&num_rows), 4);
+	hog_out->write((char*)(&num_channels), 4);
 
 	// Not the best way to store a bool, but will be much easier to read it
 	float good_frame_float;
@@ -66,16 +255,14 @@ void RecorderHOG::Write()
 	else
 		good_frame_float = -1;
 
-	hog_file.write((char*)(&good_frame_float), 4);
+	hog_out->write((char*)(&good_frame_float), 4);
 	if(hog_descriptor.isContinuous())
 	{
-		cv::Mat_<float> desc;
-		hog_descriptor.convertTo(desc, CV_32F);
-		hog_file.write((char*)desc.data, 4 * num_cols * num_rows * 31);
+		hog_out->write((char*)hog_descriptor.data, 4 * num_cols * num_rows * 31);
 	}
 	else
 	{
-		cv::MatConstIterator_<double> descriptor_it = hog_descriptor.begin();
+		cv::MatConstIterator_<float> descriptor_it = hog_descriptor.begin();
 
 		for (int y = 0; y < num_cols; ++y)
 		{
@@ -84,16 +271,23 @@ void RecorderHOG::Write()
 				for (unsigned int o = 0; o < 31; ++o)
 				{
 
-					float hog_data = (float)(*descriptor_it++);
-					hog_file.write((char*)&hog_data, 4);
+					float hog_data = *descriptor_it++;
+					hog_out->write((char*)&hog_data, 4);
 				}
 			}
 		}
 	}
+
+	// The uncompressed format is split into blocks of the same number of frames as the chunks of the v2 format
+	frames_recorded++;
+	if (frames_recorded - block_first_frame >= FRAMES_PER_CHUNK)
+	{
+		EndBlock();
+	}
 }
 
 // Writing to a HOG file
-void RecorderHOG::SetObservationHOG(bool good_frame, const cv::Mat_<double>& hog_descriptor, int num_cols, int num_rows, int num_channels)
+void RecorderHOG::SetObservationHOG(bool good_frame, const cv::Mat_<float>& hog_descriptor, int num_cols, int num_rows, int num_channels)
 {
 	this->num_cols = num_cols;
 	this->num_rows = num_rows;
@@ -32,9 +32,13 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "RecorderOpenFace.h"
+#include "Concurrency.h"
+#include "Tracing.h"
+#include "Metrics.h"
 
 // For sorting
 #include <algorithm>
+#include <limits>
 
 // File manipulation
 #include <fstream>
@@ -49,6 +53,9 @@
 // For threading
 #include <chrono>
 
+#include <cstring>
+#include <ctime>
+
 using namespace boost::filesystem;
 
 using namespace Utilities;
@@ -79,14 +86,14 @@ void CreateDirectory(std::string output_path)
 	}
 }
 
-void VideoWritingTask(tbb::concurrent_bounded_queue<std::pair<std::string, cv::Mat> > *writing_queue, bool is_sequence, cv::VideoWriter *video_writer)
+void VideoWritingTask(SpscRing<std::pair<std::string, cv::Mat> > *writing_queue, bool is_sequence, cv::VideoWriter *video_writer)
 {
 
 	std::pair<std::string, cv::Mat> tracked_data;
 
 	while (true)
 	{
-		writing_queue->pop(tracked_data);
+		writing_queue->Pop(tracked_data);
 
 		// Indicate that the thread should complete
 		if (tracked_data.second.empty())
@@ -98,6 +105,7 @@ void VideoWritingTask(tbb::concurrent_bounded_queue<std::pair<std::string, cv::M
 		{
 			if (video_writer->isOpened())
 			{
+				METRICS_LATENCY("openface_stage_latency_seconds{stage=\"video_encoding\"}", "Latency of the processing stages in seconds");
 				video_writer->write(tracked_data.second);
 			}
 		}
@@ -112,20 +120,119 @@ void VideoWritingTask(tbb::concurrent_bounded_queue<std::pair<std::string, cv::M
 	}
 }
 
-void AlignedImageWritingTask(tbb::concurrent_bounded_queue<std::pair<std::string, cv::Mat> > *writing_queue)
+// Appending a single file to a (ustar) tar archive, the header is followed by the data padded to 512 byte blocks
+void WriteTarEntry(std::ofstream& archive, const std::string& name, const std::vector<uchar>& data)
+{
+	char header[512];
+	memset(header, 0, sizeof(header));
+
+	strncpy(header, name.c_str(), 99);
+	std::sprintf(header + 100, "%07o", 0644);
+	std::sprintf(header + 108, "%07o", 0);
+	std::sprintf(header + 116, "%07o", 0);
+	std::sprintf(header + 124, "%011o", (unsigned int) data.size());
+	std::sprintf(header + 136, "%011o", (unsigned int) std::time(0));
+	header[156] = '0';
+	memcpy(header + 257, "ustar", 6);
+	memcpy(header + 263, "00", 2);
+
+	// The checksum is computed with the checksum field itself set to spaces
+	memset(header + 148, ' ', 8);
+	unsigned int checksum = 0;
+	for (size_t i = 0; i < sizeof(header); ++i)
+	{
+		checksum += (unsigned char)header[i];
+	}
+	std::sprintf(header + 148, "%06o", checksum);
+	header[155] = ' ';
+
+	archive.write(header, sizeof(header));
+	archive.write((const char*)data.data(), data.size());
+
+	size_t padding = (512 - data.size() % 512) % 512;
+	if (padding > 0)
+	{
+		char zeros[512] = { 0 };
+		archive.write(zeros, padding);
+	}
+}
+
+// A number of these can run at the same time, if an archive is provided the faces are appended to it instead of written as files
+// Opening the tracked video with the requested backend, falling back to the default one if it is not available
+bool OpenVideoWriter(cv::VideoWriter& video_writer, const std::string& filename, int fourcc, double fps, cv::Size size, const std::string& backend, bool hw_acceleration)
+{
+	int api = cv::CAP_ANY;
+	if (backend.compare("ffmpeg") == 0)
+		api = cv::CAP_FFMPEG;
+	else if (backend.compare("gstreamer") == 0)
+		api = cv::CAP_GSTREAMER;
+#ifdef _WIN32
+	else if (backend.compare("msmf") == 0)
+		api = cv::CAP_MSMF;
+#endif
+	else if (backend.compare("any") != 0)
+		WARN_STREAM("Unknown video backend " << backend << ", using the default one");
+
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && (CV_VERSION_MINOR > 5 || (CV_VERSION_MINOR == 5 && CV_VERSION_REVISION >= 2)))
+	if (hw_acceleration)
+	{
+		std::vector<int> writer_params;
+		writer_params.push_back(cv::VIDEOWRITER_PROP_HW_ACCELERATION);
+		writer_params.push_back(cv::VIDEO_ACCELERATION_ANY);
+		if (video_writer.open(filename, api, fourcc, fps, size, writer_params))
+			return true;
+		WARN_STREAM("Could not open a hardware accelerated VideoWriter, using software encoding");
+	}
+#else
+	if (hw_acceleration)
+		WARN_STREAM("Hardware accelerated video encoding requires OpenCV 4.5.2 or newer, using software encoding");
+#endif
+
+#if CV_VERSION_MAJOR > 3 || (CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR >= 4)
+	if (api != cv::CAP_ANY)
+	{
+		if (video_writer.open(filename, api, fourcc, fps, size, true))
+			return true;
+		WARN_STREAM("Could not open VideoWriter with the " << backend << " backend, using the default one");
+	}
+#else
+	if (api != cv::CAP_ANY)
+		WARN_STREAM("Selecting a video backend requires OpenCV 3.4 or newer, using the default one");
+#endif
+
+	return video_writer.open(filename, fourcc, fps, size, true);
+}
+
+void AlignedImageWritingTask(FrameQueue<std::pair<std::string, cv::Mat> > *writing_queue, std::ofstream *archive, std::mutex *archive_mutex)
 {
 
 	std::pair<std::string, cv::Mat> tracked_data;
+	std::vector<uchar> encoded;
 
 	while (true)
 	{
-		writing_queue->pop(tracked_data);
+		writing_queue->Pop(tracked_data);
 
 		// Empty frame indicates termination
 		if (tracked_data.second.empty())
 			break;
 
-		bool write_success = cv::imwrite(tracked_data.first, tracked_data.second);
+		bool write_success;
+		if (archive)
+		{
+			// Only the appending is serialised, the encoding happens in parallel
+			write_success = cv::imencode(path(tracked_data.first).extension().string(), tracked_data.second, encoded);
+			if (write_success)
+			{
+				std::lock_guard<std::mutex> lock(*archive_mutex);
+				WriteTarEntry(*archive, tracked_data.first, encoded);
+				write_success = (bool)*archive;
+			}
+		}
+		else
+		{
+			write_success = cv::imwrite(tracked_data.first, tracked_data.second);
+		}
 
 		if (!write_success)
 		{
@@ -172,17 +279,28 @@ void RecorderOpenFace::PrepareRecording(const std::string& in_filename)
 
 	metadata_file << "Camera parameters:" << params.getFx() << "," << params.getFy() << "," << params.getCx() << "," << params.getCy() << endl;
 
+	// The CSV and HOG outputs can be compressed as they are written
+	OutputCompression compression = ParseOutputCompression(params.outputCompression());
+	if (!params.outputCompression().empty() && (compression == COMPRESSION_NONE || !IsCompressionAvailable(compression)))
+	{
+		WARN_STREAM("The compression " << params.outputCompression() << " is not supported or not compiled in, writing uncompressed outputs");
+		compression = COMPRESSION_NONE;
+	}
+	csv_recorder.SetCompression(compression);
+	hog_recorder.SetCompression(compression);
+
 	// Create the required individual recorders, CSV, HOG, aligned, video
-	csv_filename = out_name + ".csv";
+	csv_filename = out_name + ".csv" + CompressionExtension(compression);
+	columnar_filename = out_name + ".ofcol";
 
 	// Consruct HOG recorder here
 	if (params.outputHOG())
 	{
 		// Output the data based on record_root, but do not include record_root in the meta file, as it is also in that directory
-		std::string hog_filename = out_name + ".hog";
+		std::string hog_filename = out_name + ".hog" + CompressionExtension(compression);
 		metadata_file << "Output HOG:" << hog_filename << endl;
 		hog_filename = (path(record_root) / hog_filename).string();
-		hog_recorder.Open(hog_filename);
+		hog_recorder.Open(hog_filename, params.outputHOGCompressed(), params.outputHOGHalfPrecision());
 	}
 		
 	// saving the videos	
@@ -204,7 +322,31 @@ void RecorderOpenFace::PrepareRecording(const std::string& in_filename)
 	}
 
 	// Prepare image recording
-	if (params.outputAlignedFaces())
+	if (params.outputAlignedFaces() && params.outputAlignedTensor())
+	{
+		std::string tensor_filename = out_name + "_aligned.npy";
+		std::string index_filename = out_name + "_aligned_index.csv";
+		metadata_file << "Output aligned tensor:" << tensor_filename << endl;
+		metadata_file << "Output aligned tensor index:" << index_filename << endl;
+		if (!aligned_tensor_recorder.Open((path(record_root) / tensor_filename).string(), (path(record_root) / index_filename).string()))
+		{
+			std::cout << "ERROR: could not open the aligned face tensor " << tensor_filename << " for writing" << std::endl;
+			exit(1);
+		}
+	}
+	else if (params.outputAlignedFaces() && params.outputAlignedArchive())
+	{
+		std::string archive_filename = out_name + "_aligned.tar";
+		metadata_file << "Output aligned archive:" << archive_filename << endl;
+		archive_filename = (path(record_root) / archive_filename).string();
+		aligned_archive.open(archive_filename, std::ios_base::out | std::ios_base::binary);
+		if (!aligned_archive.is_open())
+		{
+			std::cout << "ERROR: could not open the aligned face archive " << archive_filename << " for writing" << std::endl;
+			exit(1);
+		}
+	}
+	else if (params.outputAlignedFaces())
 	{
 		aligned_output_directory = out_name + "_aligned";
 		metadata_file << "Output aligned directory:" << this->aligned_output_directory << endl;
@@ -213,8 +355,10 @@ void RecorderOpenFace::PrepareRecording(const std::string& in_filename)
 	}
 
 	this->frame_number = 0;
+	this->reused = false;
 	this->tracked_writing_thread_started = false;
 	this->aligned_writing_thread_started = false;
+	this->num_aligned_writers = 0;
 }
 
 RecorderOpenFace::RecorderOpenFace(const std::string in_filename, const RecorderOpenFaceParameters& parameters, std::vector<std::string>& arguments):video_writer(), params(parameters)
@@ -316,31 +460,26 @@ void RecorderOpenFace::SetObservationVisualization(const cv::Mat &vis_track)
 void RecorderOpenFace::WriteObservation()
 {
 
-	// Write out the CSV file (it will always be there, even if not outputting anything more but frame/face numbers)	
-	if(!csv_recorder.isOpen())
+	// Write out the CSV (or columnar) file (it will always be there, even if not outputting anything more but frame/face numbers)	
+	if(!csv_recorder.isOpen() && !columnar_recorder.isOpen())
 	{
 		// As we are writing out the header, work out some things like number of landmarks, names of AUs etc.
 		int num_face_landmarks = landmarks_2D.rows / 2;
 		int num_eye_landmarks = (int)eye_landmarks2D.size();
 		int num_model_modes = pdm_params_local.rows;
 
-		std::vector<std::string> au_names_class;
-		for (auto au : au_occurences)
+		// The recorders sort the AU columns by name, the values stay in the order of the names
+		const std::vector<std::string>& au_names_class = au_occurence_names;
+		const std::vector<std::string>& au_names_reg = au_intensity_names;
+
+		if (params.outputColumnar())
 		{
-			au_names_class.push_back(au.first);
+			metadata_file << "Output columnar:" << columnar_filename << endl;
 		}
-
-		std::sort(au_names_class.begin(), au_names_class.end());
-
-		std::vector<std::string> au_names_reg;
-		for (auto au : au_intensities)
+		else
 		{
-			au_names_reg.push_back(au.first);
+			metadata_file << "Output csv:" << csv_filename << endl;
 		}
-
-		std::sort(au_names_reg.begin(), au_names_reg.end());
-
-		metadata_file << "Output csv:" << csv_filename << endl;
 		metadata_file << "Gaze: " << params.outputGaze() << endl;
 		metadata_file << "AUs: " << params.outputAUs() << endl;
 		metadata_file << "Landmarks 2D: " << params.output2DLandmarks() << endl;
@@ -348,14 +487,77 @@ void RecorderOpenFace::WriteObservation()
 		metadata_file << "Pose: " << params.outputPose() << endl;
 		metadata_file << "Shape parameters: " << params.outputPDMParams() << endl;
 
-		csv_filename = (path(record_root) / csv_filename).string();
-		csv_recorder.Open(csv_filename, params.isSequence(), params.output2DLandmarks(), params.output3DLandmarks(), params.outputPDMParams(), params.outputPose(),
-			params.outputAUs(), params.outputGaze(), num_face_landmarks, num_model_modes, num_eye_landmarks, au_names_class, au_names_reg);
+		if (params.outputColumnar())
+		{
+			columnar_filename = (path(record_root) / columnar_filename).string();
+			columnar_recorder.Open(columnar_filename, params.isSequence(), params.output2DLandmarks(), params.output3DLandmarks(), params.outputPDMParams(), params.outputPose(),
+				params.outputAUs(), params.outputGaze(), num_face_landmarks, num_model_modes, num_eye_landmarks, au_names_class, au_names_reg, params.outputReused());
+		}
+		else
+		{
+			csv_filename = (path(record_root) / csv_filename).string();
+			csv_recorder.Open(csv_filename, params.isSequence(), params.output2DLandmarks(), params.output3DLandmarks(), params.outputPDMParams(), params.outputPose(),
+				params.outputAUs(), params.outputGaze(), num_face_landmarks, num_model_modes, num_eye_landmarks, au_names_class, au_names_reg, params.outputReused());
+		}
 	}
 
-	this->csv_recorder.WriteLine(face_id, frame_number, timestamp, landmark_detection_success, 
-		landmark_detection_confidence, landmarks_2D, landmarks_3D, pdm_params_local, pdm_params_global, head_pose,
-		gaze_direction0, gaze_direction1, gaze_angle, eye_landmarks2D, eye_landmarks3D, au_intensities, au_occurences);
+	if (!stream_connect_attempted && !params.outputStream().empty())
+	{
+		stream_connect_attempted = true;
+
+		RecorderStream::StreamFormat stream_format;
+		if (!RecorderStream::ParseFormat(params.outputStreamFormat(), stream_format))
+		{
+			std::cout << "Unknown stream format " << params.outputStreamFormat() << ", expecting ndjson or binary, not streaming" << std::endl;
+		}
+		else
+		{
+			stream_recorder.Open(params.outputStream(), stream_format, params.outputStreamLinesPerFlush(), params.isSequence(), params.output2DLandmarks(),
+				params.output3DLandmarks(), params.outputPDMParams(), params.outputPose(), params.outputAUs(), params.outputGaze(), landmarks_2D.rows / 2,
+				pdm_params_local.rows, (int)eye_landmarks2D.size(), au_occurence_names, au_intensity_names, params.outputReused());
+		}
+	}
+
+	if (stream_recorder.isOpen())
+	{
+		this->stream_recorder.WriteLine(face_id, frame_number, timestamp, landmark_detection_success,
+			landmark_detection_confidence, landmarks_2D, landmarks_3D, pdm_params_local, pdm_params_global, head_pose,
+			gaze_direction0, gaze_direction1, gaze_angle, eye_landmarks2D, eye_landmarks3D, au_intensities, au_occurences, reused);
+	}
+
+	if (!shared_memory_attempted && !params.outputSharedMemory().empty())
+	{
+		shared_memory_attempted = true;
+
+		// Room for the aligned faces of the first observation, and at least for the default 112x112 colour ones
+		int aligned_capacity = 0;
+		if (params.outputSharedMemoryAligned())
+		{
+			aligned_capacity = std::max(112 * 112 * 3, (int)(aligned_face.total() * aligned_face.elemSize()));
+		}
+		shared_memory_recorder.Open(params.outputSharedMemory(), params.outputSharedMemorySlots(), landmarks_2D.rows / 2, (int)eye_landmarks2D.size(),
+			au_intensity_names, au_occurence_names, aligned_capacity);
+	}
+
+	if (shared_memory_recorder.isOpen())
+	{
+		this->shared_memory_recorder.WriteRecord(face_id, frame_number, timestamp, landmark_detection_success, landmark_detection_confidence, reused,
+			landmarks_2D, landmarks_3D, head_pose, gaze_direction0, gaze_direction1, gaze_angle, eye_landmarks2D, eye_landmarks3D, au_intensities, au_occurences,
+			params.outputSharedMemoryAligned() ? aligned_face : cv::Mat());
+	}
+
+	if (params.outputColumnar())
+	{
+		this->columnar_recorder.WriteLine(face_id, frame_number, timestamp, landmark_detection_success,
+			landmark_detection_confidence, landmarks_2D, landmarks_3D, pdm_params_local, pdm_params_global, head_pose,
+			gaze_direction0, gaze_direction1, gaze_angle, eye_landmarks2D, eye_landmarks3D, au_intensities, au_occurences, reused);
+	}
+	else
+	{
+		this->csv_recorder.WriteLine(face_id, frame_number, timestamp, landmark_detection_success,
+			landmark_detection_confidence, landmarks_2D, landmarks_3D, pdm_params_local, pdm_params_global, head_pose,
+			gaze_direction0, gaze_direction1, gaze_angle, eye_landmarks2D, eye_landmarks3D, au_intensities, au_occurences, reused);
+	}
 
 	if(params.outputHOG())
 	{
@@ -363,23 +565,32 @@ void RecorderOpenFace::WriteObservation()
 	}
 
 	// Write aligned faces
-	if (params.outputAlignedFaces())
+	if (aligned_tensor_recorder.isOpen())
+	{
+		if ((params.outputBadAligned() || landmark_detection_success) && !aligned_tensor_recorder.Write(aligned_face, frame_number, face_id, timestamp, landmark_detection_success))
+		{
+			WARN_STREAM("Could not append the similarity aligned image to the tensor");
+		}
+
+		// Clear the image
+		aligned_face = cv::Mat();
+	}
+	else if (params.outputAlignedFaces())
 	{
 
 		if (!aligned_writing_thread_started)
 		{
 			aligned_writing_thread_started = true;
-			int capacity = (1024 * 1024 * ALIGNED_QUEUE_CAPACITY) / (aligned_face.size().width *aligned_face.size().height * aligned_face.channels()) + 1;
-			aligned_face_queue.set_capacity(capacity);
+			aligned_face_queue.SetCapacity(Concurrency::LimitQueueBytes((size_t)1024 * 1024 * ALIGNED_QUEUE_CAPACITY));
 
-			// Start the alignment output thread			
-#ifdef _WIN32 
-			// For keeping track of tasks
-			writing_threads.run([&] {AlignedImageWritingTask(&aligned_face_queue); });
-#else
-			// Start the alignment output thread
-			aligned_writing_thread = std::thread(&AlignedImageWritingTask, &aligned_face_queue);
-#endif
+			std::ofstream* archive = aligned_archive.is_open() ? &aligned_archive : 0;
+
+			// Start the alignment output threads
+			num_aligned_writers = params.alignedWriters();
+			for (int i = 0; i < num_aligned_writers; ++i)
+			{
+				aligned_writing_threads.push_back(std::thread(&AlignedImageWritingTask, &aligned_face_queue, archive, &aligned_archive_mutex));
+			}
 		}
 
 		char name[100];
@@ -395,11 +606,14 @@ void RecorderOpenFace::WriteObservation()
 
 		std::string preferredSlash = slash.make_preferred().string();
 
-		string out_file = aligned_output_directory + preferredSlash + string(name);
+		// Within the archive the faces are stored by name only
+		string out_file = aligned_archive.is_open() ? string(name) : aligned_output_directory + preferredSlash + string(name);
 
 		if(params.outputBadAligned() || landmark_detection_success)
 		{
-			aligned_face_queue.push(std::pair<std::string, cv::Mat>(out_file, aligned_face));
+			aligned_face_queue.Push(std::pair<std::string, cv::Mat>(out_file, aligned_face), MatBytes(aligned_face));
+			TRACE_COUNTER("RecorderOpenFace aligned_face_queue", aligned_face_queue.Size());
+			METRICS_GAUGE_SET("openface_writing_queue_depth{queue=\"aligned_face\"}", "Frames waiting in the RecorderOpenFace writing queues", aligned_face_queue.Size());
 		}
 
 		// Clear the image
@@ -418,9 +632,8 @@ void RecorderOpenFace::WriteObservationTracked()
 		if (!tracked_writing_thread_started)
 		{
 			tracked_writing_thread_started = true;
-			// Set up the queue for video writing based on output size
-			int capacity = (1024 * 1024 * TRACKED_QUEUE_CAPACITY) / (vis_to_out.size().width * vis_to_out.size().height * vis_to_out.channels()) + 1;
-			vis_to_out_queue.set_capacity(capacity);
+			// Set up the queue for video writing, with as many slots as fit in the memory bound (the frames keep their size throughout)
+			vis_to_out_queue.Reset(std::max<size_t>(2, Concurrency::LimitQueueBytes((size_t)1024 * 1024 * TRACKED_QUEUE_CAPACITY) / std::max<size_t>(1, MatBytes(vis_to_out))));
 
 			// Initialize the video writer if it has not been opened yet
 			if (params.isSequence())
@@ -428,9 +641,10 @@ void RecorderOpenFace::WriteObservationTracked()
 				std::string output_codec = params.outputCodec();
 				try
 				{
-					video_writer.open(media_filename, cv::VideoWriter::fourcc(output_codec[0], output_codec[1], output_codec[2], output_codec[3]), params.outputFps(), vis_to_out.size(), true);
+					bool opened = OpenVideoWriter(video_writer, media_filename, cv::VideoWriter::fourcc(output_codec[0], output_codec[1], output_codec[2], output_codec[3]),
+						params.outputFps(), vis_to_out.size(), params.outputVideoBackend(), params.outputVideoHardwareAcceleration());
 
-					if (!video_writer.isOpened())
+					if (!opened || !video_writer.isOpened())
 					{
 						WARN_STREAM("Could not open VideoWriter, OUTPUT FILE WILL NOT BE WRITTEN.");
 					}
@@ -442,12 +656,7 @@ void RecorderOpenFace::WriteObservationTracked()
 			}
 
 			// Start the video and tracked image writing thread
-#ifdef _WIN32 
-			// For keeping track of tasks
-			writing_threads.run([&] {VideoWritingTask(&vis_to_out_queue, params.isSequence(), &video_writer); });
-#else
 			video_writing_thread = std::thread(&VideoWritingTask, &vis_to_out_queue, params.isSequence(), &video_writer);
-#endif
 
 
 		}
@@ -457,21 +666,31 @@ void RecorderOpenFace::WriteObservationTracked()
 			WARN_STREAM("Output tracked video frame is not set");
 		}
 
-		if (params.isSequence())
+		// Keep track of how often and for how long the encoder holds up the processing
+		if (vis_to_out_queue.Full())
 		{
-			vis_to_out_queue.push(std::pair<std::string, cv::Mat>("", vis_to_out));
+			METRICS_INCREMENT("openface_writing_blocked_frames_total{queue=\"tracked_video\"}", "Frames that had to wait for space in the RecorderOpenFace writing queues");
 		}
-		else
 		{
-			vis_to_out_queue.push(std::pair<std::string, cv::Mat>(media_filename, vis_to_out));
+			METRICS_LATENCY("openface_writing_blocked_seconds{queue=\"tracked_video\"}", "Time spent waiting for space in the RecorderOpenFace writing queues");
+			if (params.isSequence())
+			{
+				vis_to_out_queue.Push(std::pair<std::string, cv::Mat>("", std::move(vis_to_out)));
+			}
+			else
+			{
+				vis_to_out_queue.Push(std::pair<std::string, cv::Mat>(media_filename, std::move(vis_to_out)));
+			}
 		}
+		TRACE_COUNTER("RecorderOpenFace vis_to_out_queue", vis_to_out_queue.Size());
+		METRICS_GAUGE_SET("openface_writing_queue_depth{queue=\"tracked_video\"}", "Frames waiting in the RecorderOpenFace writing queues", vis_to_out_queue.Size());
 
 		// Clear the output
 		vis_to_out = cv::Mat();
 	}
 }
 
-void RecorderOpenFace::SetObservationHOG(bool good_frame, const cv::Mat_<double>& hog_descriptor, int num_cols, int num_rows, int num_channels)
+void RecorderOpenFace::SetObservationHOG(bool good_frame, const cv::Mat_<float>& hog_descriptor, int num_cols, int num_rows, int num_channels)
 {
 	this->hog_recorder.SetObservationHOG(good_frame, hog_descriptor, num_cols, num_rows, num_channels);
 }
@@ -493,6 +712,11 @@ void RecorderOpenFace::SetObservationFaceID(int face_id)
 	this->face_id = face_id;
 }
 
+void RecorderOpenFace::SetObservationReused(bool reused)
+{
+	this->reused = reused;
+}
+
 
 void RecorderOpenFace::SetObservationLandmarks(const cv::Mat_<float>& landmarks_2D, const cv::Mat_<float>& landmarks_3D,
 	const cv::Vec6f& pdm_params_global, const cv::Mat_<float>& pdm_params_local, double confidence, bool success)
@@ -511,9 +735,48 @@ void RecorderOpenFace::SetObservationPose(const cv::Vec6f& pose)
 	this->head_pose = pose;
 }
 
+// Taking the values of named AUs in the order of the recorded names, or taking the names as well while the output file is not open yet
+static void SetNamedAUs(const std::vector<std::pair<std::string, double> >& named_aus, bool names_fixed, std::vector<std::string>& names, std::vector<float>& values)
+{
+	if (!names_fixed)
+	{
+		names.clear();
+		values.clear();
+		for (size_t i = 0; i < named_aus.size(); ++i)
+		{
+			names.push_back(named_aus[i].first);
+			values.push_back((float)named_aus[i].second);
+		}
+		return;
+	}
+
+	values.assign(names.size(), std::numeric_limits<float>::quiet_NaN());
+	for (size_t i = 0; i < named_aus.size(); ++i)
+	{
+		size_t index = std::find(names.begin(), names.end(), named_aus[i].first) - names.begin();
+		if (index < names.size())
+		{
+			values[index] = (float)named_aus[i].second;
+		}
+	}
+}
+
 void RecorderOpenFace::SetObservationActionUnits(const std::vector<std::pair<std::string, double> >& au_intensities,
 	const std::vector<std::pair<std::string, double> >& au_occurences)
 {
+	bool names_fixed = csv_recorder.isOpen() || columnar_recorder.isOpen();
+	SetNamedAUs(au_intensities, names_fixed, this->au_intensity_names, this->au_intensities);
+	SetNamedAUs(au_occurences, names_fixed, this->au_occurence_names, this->au_occurences);
+}
+
+void RecorderOpenFace::SetObservationActionUnits(const std::vector<std::string>& au_intensity_names, const std::vector<float>& au_intensities,
+	const std::vector<std::string>& au_occurence_names, const std::vector<float>& au_occurences)
+{
+	if (!csv_recorder.isOpen() && !columnar_recorder.isOpen())
+	{
+		this->au_intensity_names = au_intensity_names;
+		this->au_occurence_names = au_occurence_names;
+	}
 	this->au_intensities = au_intensities;
 	this->au_occurences = au_occurences;
 }
@@ -534,30 +797,68 @@ RecorderOpenFace::~RecorderOpenFace()
 }
 
 
+void RecorderOpenFace::ReportMemory(MemoryReport& report, const std::string& component)
+{
+	report.AddBytes(component + "/aligned_queue", aligned_face_queue.Bytes());
+
+	// The tracked frames in the queue are the size of the last one
+	report.AddBytes(component + "/tracked_queue", vis_to_out_queue.Size() * MatBytes(vis_to_out));
+}
+
 void RecorderOpenFace::Close()
 {
-	// Insert terminating frames to the queues
-	vis_to_out_queue.push(std::pair<string, cv::Mat>("", cv::Mat()));
-	aligned_face_queue.push(std::pair<string, cv::Mat>("", cv::Mat()));
+	// Insert terminating frames to the queues, the tracked one only has a consumer once its thread started
+	if (tracked_writing_thread_started)
+	{
+		vis_to_out_queue.Push(std::pair<string, cv::Mat>("", cv::Mat()));
+	}
+	for (int i = 0; i < num_aligned_writers; ++i)
+	{
+		aligned_face_queue.Push(std::pair<string, cv::Mat>("", cv::Mat()), 0);
+	}
 
 	// Make sure the recording threads complete
-#ifdef _WIN32 
-	writing_threads.wait();
-#else
 	if (video_writing_thread.joinable())
 		video_writing_thread.join();
-	if (aligned_writing_thread.joinable())
-		aligned_writing_thread.join();
-#endif
+	for (size_t i = 0; i < aligned_writing_threads.size(); ++i)
+	{
+		if (aligned_writing_threads[i].joinable())
+			aligned_writing_threads[i].join();
+	}
+	aligned_writing_threads.clear();
 
 	tracked_writing_thread_started = false;
 	aligned_writing_thread_started = false;
+	num_aligned_writers = 0;
+
+	// The end of a tar archive is marked by two empty blocks
+	if (aligned_archive.is_open())
+	{
+		char zeros[1024] = { 0 };
+		aligned_archive.write(zeros, sizeof(zeros));
+		aligned_archive.close();
+	}
 
+	aligned_tensor_recorder.Close();
 	hog_recorder.Close();
 	csv_recorder.Close();
+	columnar_recorder.Close();
+	stream_recorder.Close();
+	stream_connect_attempted = false;
+	shared_memory_recorder.Close();
+	shared_memory_attempted = false;
 	video_writer.release();
 	metadata_file.close();
 }
 
 
 
+
+bool RecorderOpenFace::WritesTo(const std::string& filename) const
+{
+	// The CSV output is only created with the first observation, so it is enough to compare with the files already there
+	boost::system::error_code error;
+	path csv_path = path(record_root) / path(csv_filename).filename();
+	path columnar_path = path(record_root) / path(columnar_filename).filename();
+	return boost::filesystem::equivalent(csv_path, filename, error) || boost::filesystem::equivalent(columnar_path, filename, error);
+}
@@ -33,6 +33,9 @@
 
 #include "RecorderOpenFaceParameters.h"
 
+#include <algorithm>
+#include <cstdlib>
+
 using namespace std;
 
 using namespace Utilities;
@@ -57,6 +60,8 @@ RecorderOpenFaceParameters::RecorderOpenFaceParameters(std::vector<std::string>
 	}
 	// Default output code
 	this->output_codec = "DIVX";
+	this->output_video_backend = "any";
+	this->output_video_hw_acceleration = false;
 
 	bool output_set = false;
 
@@ -71,6 +76,22 @@ RecorderOpenFaceParameters::RecorderOpenFaceParameters(std::vector<std::string>
 	this->output_aligned_faces = false;
 
 	this->record_aligned_bad = true;
+	this->output_columnar = false;
+	this->output_hog_compressed = false;
+	this->output_hog_half_precision = false;
+	this->output_compression = "";
+	this->aligned_writers = 1;
+	this->output_aligned_archive = false;
+	this->output_aligned_tensor = false;
+	this->output_reused = false;
+	this->au_rate = 0;
+	this->gaze_rate = 0;
+	this->output_stream = "";
+	this->output_stream_format = "ndjson";
+	this->output_stream_flush = 1;
+	this->output_shared_memory = "";
+	this->output_shared_memory_slots = 64;
+	this->output_shared_memory_aligned = false;
 
 	for (size_t i = 0; i < arguments.size(); ++i)
 	{
@@ -78,6 +99,79 @@ RecorderOpenFaceParameters::RecorderOpenFaceParameters(std::vector<std::string>
 		{
 			this->record_aligned_bad = false;
 		}
+		if (arguments[i].compare("-out_format") == 0 && i + 1 < arguments.size())
+		{
+			this->output_columnar = arguments[i + 1].compare("columnar") == 0;
+		}
+		if (arguments[i].compare("-hogv2") == 0)
+		{
+			this->output_hog_compressed = true;
+		}
+		if (arguments[i].compare("-hogfp16") == 0)
+		{
+			this->output_hog_compressed = true;
+			this->output_hog_half_precision = true;
+		}
+		if (arguments[i].compare("-compress_outputs") == 0 && i + 1 < arguments.size())
+		{
+			this->output_compression = arguments[i + 1];
+		}
+		if (arguments[i].compare("-aligned_writers") == 0 && i + 1 < arguments.size())
+		{
+			this->aligned_writers = std::max(1, atoi(arguments[i + 1].c_str()));
+		}
+		if (arguments[i].compare("-oc") == 0 && i + 1 < arguments.size() && arguments[i + 1].size() == 4)
+		{
+			this->output_codec = arguments[i + 1];
+		}
+		if (arguments[i].compare("-video_backend") == 0 && i + 1 < arguments.size())
+		{
+			this->output_video_backend = arguments[i + 1];
+		}
+		if (arguments[i].compare("-video_hw") == 0)
+		{
+			this->output_video_hw_acceleration = true;
+		}
+		if (arguments[i].compare("-aligned_archive") == 0)
+		{
+			this->output_aligned_archive = true;
+		}
+		if (arguments[i].compare("-aligned_tensor") == 0)
+		{
+			this->output_aligned_tensor = true;
+		}
+		if (arguments[i].compare("-au_rate") == 0 && i + 1 < arguments.size())
+		{
+			this->au_rate = std::max(0.0, atof(arguments[i + 1].c_str()));
+		}
+		if (arguments[i].compare("-gaze_rate") == 0 && i + 1 < arguments.size())
+		{
+			this->gaze_rate = std::max(0.0, atof(arguments[i + 1].c_str()));
+		}
+		if (arguments[i].compare("-stream") == 0 && i + 1 < arguments.size())
+		{
+			this->output_stream = arguments[i + 1];
+		}
+		if (arguments[i].compare("-stream_format") == 0 && i + 1 < arguments.size())
+		{
+			this->output_stream_format = arguments[i + 1];
+		}
+		if (arguments[i].compare("-stream_flush") == 0 && i + 1 < arguments.size())
+		{
+			this->output_stream_flush = std::max(1, atoi(arguments[i + 1].c_str()));
+		}
+		if (arguments[i].compare("-shm") == 0 && i + 1 < arguments.size())
+		{
+			this->output_shared_memory = arguments[i + 1];
+		}
+		if (arguments[i].compare("-shm_slots") == 0 && i + 1 < arguments.size())
+		{
+			this->output_shared_memory_slots = std::max(2, atoi(arguments[i + 1].c_str()));
+		}
+		if (arguments[i].compare("-shm_aligned") == 0)
+		{
+			this->output_shared_memory_aligned = true;
+		}
 		if (arguments[i].compare("-simalign") == 0)
 		{
 			this->output_aligned_faces = true;
@@ -163,6 +257,8 @@ RecorderOpenFaceParameters::RecorderOpenFaceParameters(bool sequence, bool is_fr
 	}
 	// Default output code
 	this->output_codec = "DIVX";
+	this->output_video_backend = "any";
+	this->output_video_hw_acceleration = false;
 
 	this->output_2D_landmarks = output_2D_landmarks;
 	this->output_3D_landmarks = output_3D_landmarks;
@@ -173,4 +269,20 @@ RecorderOpenFaceParameters::RecorderOpenFaceParameters(bool sequence, bool is_fr
 	this->output_hog = output_hog;
 	this->output_tracked = output_tracked;
 	this->output_aligned_faces = output_aligned_faces;
+	this->output_columnar = false;
+	this->output_hog_compressed = false;
+	this->output_hog_half_precision = false;
+	this->output_compression = "";
+	this->aligned_writers = 1;
+	this->output_aligned_archive = false;
+	this->output_aligned_tensor = false;
+	this->output_reused = false;
+	this->au_rate = 0;
+	this->gaze_rate = 0;
+	this->output_stream = "";
+	this->output_stream_format = "ndjson";
+	this->output_stream_flush = 1;
+	this->output_shared_memory = "";
+	this->output_shared_memory_slots = 64;
+	this->output_shared_memory_aligned = false;
 }
\ No newline at end of file
@@ -0,0 +1,243 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "RecorderSharedMemory.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+// Boost includes
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+using namespace Utilities;
+
+namespace
+{
+	// Keeping every slot on its own cache lines
+	size_t RoundUp(size_t size)
+	{
+		return (size + 63) / 64 * 64;
+	}
+
+	// Copying up to num_floats values, the ones without a value are set to NaN
+	void CopyFloats(float* out, const float* values, size_t num_values, size_t num_floats)
+	{
+		size_t num_copied = std::min(num_values, num_floats);
+		std::copy(values, values + num_copied, out);
+		std::fill(out + num_copied, out + num_floats, std::numeric_limits<float>::quiet_NaN());
+	}
+
+	void CopyMat(float* out, const cv::Mat_<float>& values, size_t num_floats)
+	{
+		if (values.isContinuous())
+		{
+			CopyFloats(out, values.empty() ? NULL : values.ptr<float>(0), values.total(), num_floats);
+		}
+		else
+		{
+			cv::Mat_<float> continuous = values.clone();
+			CopyFloats(out, continuous.ptr<float>(0), continuous.total(), num_floats);
+		}
+	}
+}
+
+struct RecorderSharedMemory::Impl
+{
+	boost::interprocess::shared_memory_object memory;
+	boost::interprocess::mapped_region region;
+};
+
+RecorderSharedMemory::RecorderSharedMemory() : next_record(0) {}
+
+RecorderSharedMemory::~RecorderSharedMemory()
+{
+	this->Close();
+}
+
+bool RecorderSharedMemory::Open(const std::string& name, int slot_count, int num_landmarks, int num_eye_landmarks, const std::vector<std::string>& au_names_reg,
+	const std::vector<std::string>& au_names_class, int aligned_face_capacity)
+{
+	Close();
+
+	static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "The shared memory ring needs lock free 64 bit atomics");
+
+	SharedRingHeader layout;
+	layout.num_landmarks = (uint32_t)std::max(0, num_landmarks);
+	layout.num_eye_landmarks = (uint32_t)std::max(0, num_eye_landmarks);
+	layout.num_au_intensities = (uint32_t)au_names_reg.size();
+	layout.num_au_occurences = (uint32_t)au_names_class.size();
+	layout.aligned_face_capacity = (uint32_t)std::max(0, aligned_face_capacity);
+	layout.slot_count = (uint32_t)std::max(2, slot_count);
+	layout.slots_offset = (uint32_t)RoundUp(sizeof(SharedRingHeader) + (au_names_reg.size() + au_names_class.size()) * SHARED_RING_AU_NAME_LENGTH);
+	layout.slot_size = (uint32_t)RoundUp(SharedRingAlignedFaceOffset(layout) + layout.aligned_face_capacity);
+
+	size_t total_size = (size_t)layout.slots_offset + (size_t)layout.slot_size * layout.slot_count;
+
+	std::unique_ptr<Impl> shared(new Impl());
+	try
+	{
+		boost::interprocess::shared_memory_object::remove(name.c_str());
+		boost::interprocess::shared_memory_object memory(boost::interprocess::create_only, name.c_str(), boost::interprocess::read_write);
+		memory.truncate((boost::interprocess::offset_t)total_size);
+		boost::interprocess::mapped_region region(memory, boost::interprocess::read_write);
+		shared->memory.swap(memory);
+		shared->region.swap(region);
+	}
+	catch (const boost::interprocess::interprocess_exception& e)
+	{
+		std::cout << "Could not create the shared memory " << name << ": " << e.what() << std::endl;
+		return false;
+	}
+
+	// The memory starts zeroed, so every slot starts out as not written
+	char* base = (char*)shared->region.get_address();
+	SharedRingHeader* header = new (base) SharedRingHeader();
+	header->version = SHARED_RING_VERSION;
+	header->slots_offset = layout.slots_offset;
+	header->slot_size = layout.slot_size;
+	header->slot_count = layout.slot_count;
+	header->num_landmarks = layout.num_landmarks;
+	header->num_eye_landmarks = layout.num_eye_landmarks;
+	header->num_au_intensities = layout.num_au_intensities;
+	header->num_au_occurences = layout.num_au_occurences;
+	header->aligned_face_capacity = layout.aligned_face_capacity;
+	header->published.store(0);
+	header->closed.store(0);
+
+	char* names = base + sizeof(SharedRingHeader);
+	for (size_t i = 0; i < au_names_reg.size() + au_names_class.size(); ++i)
+	{
+		const std::string& au_name = i < au_names_reg.size() ? au_names_reg[i] : au_names_class[i - au_names_reg.size()];
+		std::strncpy(names + i * SHARED_RING_AU_NAME_LENGTH, au_name.c_str(), SHARED_RING_AU_NAME_LENGTH - 1);
+	}
+
+	for (uint32_t s = 0; s < layout.slot_count; ++s)
+	{
+		new (base + layout.slots_offset + (size_t)s * layout.slot_size) SharedRingRecord();
+	}
+
+	// The magic is written last, so that a reader opening the memory early does not take it for a complete ring
+	std::atomic_thread_fence(std::memory_order_release);
+	std::memcpy(header->magic, SHARED_RING_MAGIC, sizeof(SHARED_RING_MAGIC));
+
+	this->name = name;
+	this->next_record = 0;
+	impl = std::move(shared);
+	return true;
+}
+
+void RecorderSharedMemory::WriteRecord(int face_id, int frame_num, double time_stamp, bool landmark_detection_success, double landmark_confidence, bool reused,
+	const cv::Mat_<float>& landmarks_2D, const cv::Mat_<float>& landmarks_3D, const cv::Vec6f& pose_estimate, const cv::Point3f& gazeDirection0,
+	const cv::Point3f& gazeDirection1, const cv::Vec2f& gaze_angle, const std::vector<cv::Point2f>& eye_landmarks2d, const std::vector<cv::Point3f>& eye_landmarks3d,
+	const std::vector<float>& au_intensities, const std::vector<float>& au_occurences, const cv::Mat& aligned_face)
+{
+	if (!impl)
+	{
+		return;
+	}
+
+	char* base = (char*)impl->region.get_address();
+	SharedRingHeader& header = *(SharedRingHeader*)base;
+	char* slot = base + header.slots_offset + (size_t)(next_record % header.slot_count) * header.slot_size;
+	SharedRingRecord& record = *(SharedRingRecord*)slot;
+
+	// Marking the slot as being written, the fence keeps the following writes after it
+	record.sequence.store(2 * next_record + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	record.frame_number = frame_num;
+	record.face_id = face_id;
+	record.success = landmark_detection_success ? 1 : 0;
+	record.reused = reused ? 1 : 0;
+	record.confidence = (float)landmark_confidence;
+	record.timestamp = time_stamp;
+	std::copy(pose_estimate.val, pose_estimate.val + 6, record.pose);
+	record.gaze_direction0[0] = gazeDirection0.x;
+	record.gaze_direction0[1] = gazeDirection0.y;
+	record.gaze_direction0[2] = gazeDirection0.z;
+	record.gaze_direction1[0] = gazeDirection1.x;
+	record.gaze_direction1[1] = gazeDirection1.y;
+	record.gaze_direction1[2] = gazeDirection1.z;
+	record.gaze_angle[0] = gaze_angle[0];
+	record.gaze_angle[1] = gaze_angle[1];
+
+	CopyMat((float*)(slot + SharedRingLandmarksOffset(header)), landmarks_2D, 2 * header.num_landmarks);
+	CopyMat((float*)(slot + SharedRingLandmarks3DOffset(header)), landmarks_3D, 3 * header.num_landmarks);
+	CopyFloats((float*)(slot + SharedRingEyeLandmarksOffset(header)), eye_landmarks2d.empty() ? NULL : &eye_landmarks2d[0].x, 2 * eye_landmarks2d.size(), 2 * header.num_eye_landmarks);
+	CopyFloats((float*)(slot + SharedRingEyeLandmarks3DOffset(header)), eye_landmarks3d.empty() ? NULL : &eye_landmarks3d[0].x, 3 * eye_landmarks3d.size(), 3 * header.num_eye_landmarks);
+	CopyFloats((float*)(slot + SharedRingAUIntensitiesOffset(header)), au_intensities.data(), au_intensities.size(), header.num_au_intensities);
+	CopyFloats((float*)(slot + SharedRingAUOccurencesOffset(header)), au_occurences.data(), au_occurences.size(), header.num_au_occurences);
+
+	size_t aligned_bytes = aligned_face.total() * aligned_face.elemSize();
+	if (!aligned_face.empty() && aligned_face.depth() == CV_8U && aligned_bytes <= header.aligned_face_capacity)
+	{
+		unsigned char* pixels = (unsigned char*)(slot + SharedRingAlignedFaceOffset(header));
+		size_t row_bytes = aligned_face.cols * aligned_face.elemSize();
+		for (int r = 0; r < aligned_face.rows; ++r)
+		{
+			std::memcpy(pixels + r * row_bytes, aligned_face.ptr(r), row_bytes);
+		}
+		record.aligned_width = aligned_face.cols;
+		record.aligned_height = aligned_face.rows;
+		record.aligned_channels = aligned_face.channels();
+	}
+	else
+	{
+		record.aligned_width = 0;
+		record.aligned_height = 0;
+		record.aligned_channels = 0;
+	}
+
+	// Publishing the complete record
+	record.sequence.store(2 * next_record + 2, std::memory_order_release);
+	next_record++;
+	header.published.store(next_record, std::memory_order_release);
+}
+
+void RecorderSharedMemory::Close()
+{
+	if (!impl)
+	{
+		return;
+	}
+
+	SharedRingHeader& header = *(SharedRingHeader*)impl->region.get_address();
+	header.closed.store(1, std::memory_order_release);
+
+	impl.reset();
+	boost::interprocess::shared_memory_object::remove(name.c_str());
+}
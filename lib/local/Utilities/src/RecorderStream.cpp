@@ -0,0 +1,546 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "RecorderStream.h"
+
+// For sorting
+#include <algorithm>
+
+// For standard out
+#include <iostream>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <mutex>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <csignal>
+#endif
+
+// Boost includes
+#include <boost/asio.hpp>
+
+using namespace Utilities;
+
+namespace
+{
+	void AppendUInt32(std::string& out, uint32_t value)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			out.push_back((char)((value >> (8 * i)) & 0xff));
+		}
+	}
+
+	// Starting a binary record, its length is filled in by EndRecord
+	size_t BeginRecord(std::string& out, char type)
+	{
+		size_t start = out.size();
+		AppendUInt32(out, 0);
+		out.push_back(type);
+		return start;
+	}
+
+	void EndRecord(std::string& out, size_t start)
+	{
+		uint32_t length = (uint32_t)(out.size() - start - 4);
+		for (int i = 0; i < 4; ++i)
+		{
+			out[start + i] = (char)((length >> (8 * i)) & 0xff);
+		}
+	}
+
+	// All of the recorders streaming to stdout share it
+	std::mutex stdout_mutex;
+}
+
+struct RecorderStream::Impl
+{
+	Impl() : to_stdout(false) {}
+
+	bool Write(const std::string& data)
+	{
+		boost::system::error_code error;
+		if (to_stdout)
+		{
+			std::lock_guard<std::mutex> lock(stdout_mutex);
+			return std::fwrite(data.data(), 1, data.size(), stdout) == data.size() && std::fflush(stdout) == 0;
+		}
+		else if (tcp_socket)
+		{
+			boost::asio::write(*tcp_socket, boost::asio::buffer(data), error);
+		}
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+		else if (unix_socket)
+		{
+			boost::asio::write(*unix_socket, boost::asio::buffer(data), error);
+		}
+#endif
+		return !error;
+	}
+
+	bool Connect(const std::string& target)
+	{
+		boost::system::error_code error;
+		if (target == "stdout" || target == "-")
+		{
+			to_stdout = true;
+#ifdef _WIN32
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			return true;
+		}
+		else if (target.compare(0, 5, "unix:") == 0)
+		{
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+			unix_socket.reset(new boost::asio::local::stream_protocol::socket(io_service));
+			unix_socket->connect(boost::asio::local::stream_protocol::endpoint(target.substr(5)), error);
+#else
+			std::cout << "UNIX domain sockets are not available on this platform" << std::endl;
+			return false;
+#endif
+		}
+		else if (target.compare(0, 4, "tcp:") == 0 && target.rfind(':') > 3)
+		{
+			size_t port_start = target.rfind(':');
+			boost::asio::ip::tcp::resolver resolver(io_service);
+			boost::asio::ip::tcp::resolver::query query(target.substr(4, port_start - 4), target.substr(port_start + 1));
+			tcp_socket.reset(new boost::asio::ip::tcp::socket(io_service));
+			boost::asio::connect(*tcp_socket, resolver.resolve(query, error), error);
+
+			// Lines are small and should not wait for more data to fill a packet
+			if (!error)
+				tcp_socket->set_option(boost::asio::ip::tcp::no_delay(true), error);
+		}
+		else
+		{
+			std::cout << "Unknown stream target " << target << ", expecting stdout, unix:<path> or tcp:<host>:<port>" << std::endl;
+			return false;
+		}
+
+		if (error)
+		{
+			std::cout << "Could not connect the stream to " << target << ": " << error.message() << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	boost::asio::io_service io_service;
+	std::unique_ptr<boost::asio::ip::tcp::socket> tcp_socket;
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+	std::unique_ptr<boost::asio::local::stream_protocol::socket> unix_socket;
+#endif
+	bool to_stdout;
+};
+
+RecorderStream::RecorderStream() : format(FORMAT_NDJSON), lines_per_flush(1), pending_lines(0), current_col(0) {}
+
+RecorderStream::~RecorderStream()
+{
+	this->Close();
+}
+
+bool RecorderStream::ParseFormat(const std::string& name, StreamFormat& format)
+{
+	if (name == "ndjson" || name == "json")
+	{
+		format = FORMAT_NDJSON;
+		return true;
+	}
+	if (name == "binary")
+	{
+		format = FORMAT_BINARY;
+		return true;
+	}
+	return false;
+}
+
+void RecorderStream::ReserveStdout(const std::vector<std::string>& arguments)
+{
+	for (size_t i = 0; i + 1 < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-stream") == 0 && (arguments[i + 1] == "stdout" || arguments[i + 1] == "-"))
+		{
+			std::cout.rdbuf(std::cerr.rdbuf());
+#ifndef _WIN32
+			// A consumer closing the pipe shows up as a failed write instead of terminating the process
+			std::signal(SIGPIPE, SIG_IGN);
+#endif
+			return;
+		}
+	}
+}
+
+void RecorderStream::AddColumn(const std::string& name, int decimals)
+{
+	column_keys.push_back((column_names.empty() ? "{\"" : ",\"") + name + "\":");
+	column_names.push_back(name);
+	column_decimals.push_back(decimals);
+}
+
+bool RecorderStream::Open(const std::string& target, StreamFormat format, int lines_per_flush, bool is_sequence, bool output_2D_landmarks, bool output_3D_landmarks,
+	bool output_model_params, bool output_pose, bool output_AUs, bool output_gaze, int num_face_landmarks, int num_model_modes, int num_eye_landmarks,
+	const std::vector<std::string>& au_names_class, const std::vector<std::string>& au_names_reg, bool output_reused)
+{
+	Close();
+
+	std::unique_ptr<Impl> connection(new Impl());
+	if (!connection->Connect(target))
+	{
+		return false;
+	}
+
+	this->format = format;
+	this->lines_per_flush = std::max(1, lines_per_flush);
+	this->pending_lines = 0;
+	this->is_sequence = is_sequence;
+
+	// Set up what we are recording
+	this->output_2D_landmarks = output_2D_landmarks;
+	this->output_3D_landmarks = output_3D_landmarks;
+	this->output_AUs = output_AUs;
+	this->output_gaze = output_gaze;
+	this->output_model_params = output_model_params;
+	this->output_pose = output_pose;
+	this->output_reused = output_reused;
+
+	// The same columns and precisions as in the CSV output
+	column_names.clear();
+	column_keys.clear();
+	column_decimals.clear();
+
+	if (this->is_sequence)
+	{
+		AddColumn("frame", 0);
+		AddColumn("face_id", 0);
+		AddColumn("timestamp", 3);
+		AddColumn("confidence", 2);
+		AddColumn("success", 0);
+		if (output_reused)
+		{
+			AddColumn("reused", 0);
+		}
+	}
+	else
+	{
+		AddColumn("face", 0);
+		AddColumn("confidence", 3);
+	}
+
+	if (output_gaze)
+	{
+		const char* gaze_names[] = { "gaze_0_x", "gaze_0_y", "gaze_0_z", "gaze_1_x", "gaze_1_y", "gaze_1_z" };
+		for (const char* name : gaze_names)
+		{
+			AddColumn(name, 6);
+		}
+		AddColumn("gaze_angle_x", 3);
+		AddColumn("gaze_angle_y", 3);
+
+		const char* eye_names[] = { "eye_lmk_x_", "eye_lmk_y_", "eye_lmk_X_", "eye_lmk_Y_", "eye_lmk_Z_" };
+		for (const char* name : eye_names)
+		{
+			for (int i = 0; i < num_eye_landmarks; ++i)
+			{
+				AddColumn(name + std::to_string(i), 1);
+			}
+		}
+	}
+
+	if (output_pose)
+	{
+		AddColumn("pose_Tx", 1);
+		AddColumn("pose_Ty", 1);
+		AddColumn("pose_Tz", 1);
+		AddColumn("pose_Rx", 3);
+		AddColumn("pose_Ry", 3);
+		AddColumn("pose_Rz", 3);
+	}
+
+	if (output_2D_landmarks)
+	{
+		const char* names[] = { "x_", "y_" };
+		for (const char* name : names)
+		{
+			for (int i = 0; i < num_face_landmarks; ++i)
+			{
+				AddColumn(name + std::to_string(i), 1);
+			}
+		}
+	}
+
+	if (output_3D_landmarks)
+	{
+		const char* names[] = { "X_", "Y_", "Z_" };
+		for (const char* name : names)
+		{
+			for (int i = 0; i < num_face_landmarks; ++i)
+			{
+				AddColumn(name + std::to_string(i), 1);
+			}
+		}
+	}
+
+	if (output_model_params)
+	{
+		const char* rigid_names[] = { "p_scale", "p_rx", "p_ry", "p_rz", "p_tx", "p_ty" };
+		for (const char* name : rigid_names)
+		{
+			AddColumn(name, 3);
+		}
+		for (int i = 0; i < num_model_modes; ++i)
+		{
+			AddColumn("p_" + std::to_string(i), 3);
+		}
+	}
+
+	if (output_AUs)
+	{
+		std::vector<std::string> sorted_reg(au_names_reg), sorted_class(au_names_class);
+		std::sort(sorted_reg.begin(), sorted_reg.end());
+		std::sort(sorted_class.begin(), sorted_class.end());
+
+		au_value_indices_reg.clear();
+		for (const std::string& reg_name : sorted_reg)
+		{
+			AddColumn(reg_name + "_r", 2);
+			au_value_indices_reg.push_back((int)(std::find(au_names_reg.begin(), au_names_reg.end(), reg_name) - au_names_reg.begin()));
+		}
+
+		au_value_indices_class.clear();
+		for (const std::string& class_name : sorted_class)
+		{
+			AddColumn(class_name + "_c", 1);
+			au_value_indices_class.push_back((int)(std::find(au_names_class.begin(), au_names_class.end(), class_name) - au_names_class.begin()));
+		}
+	}
+
+	line.assign(column_names.size(), 0.0);
+	pending.clear();
+
+	// The binary stream starts with the names of the columns, the JSON lines carry them
+	if (format == FORMAT_BINARY)
+	{
+		size_t start = BeginRecord(pending, 'H');
+		AppendUInt32(pending, (uint32_t)column_names.size());
+		for (const std::string& name : column_names)
+		{
+			pending.push_back((char)(name.size() & 0xff));
+			pending.push_back((char)((name.size() >> 8) & 0xff));
+			pending.append(name);
+		}
+		EndRecord(pending, start);
+	}
+
+	impl = std::move(connection);
+	if (format == FORMAT_BINARY && !Flush())
+	{
+		return false;
+	}
+	return true;
+}
+
+void RecorderStream::EncodeLine()
+{
+	if (format == FORMAT_BINARY)
+	{
+		size_t start = BeginRecord(pending, 'L');
+		for (size_t c = 0; c < line.size(); ++c)
+		{
+			float value = (float)line[c];
+			char bytes[4];
+			std::memcpy(bytes, &value, 4);
+			pending.append(bytes, 4);
+		}
+		EndRecord(pending, start);
+		return;
+	}
+
+	char value[512];
+	for (size_t c = 0; c < line.size(); ++c)
+	{
+		pending.append(column_keys[c]);
+		if (std::isfinite(line[c]))
+		{
+			int length = std::snprintf(value, sizeof(value), "%.*f", column_decimals[c], line[c]);
+			pending.append(value, std::min(length, (int)sizeof(value) - 1));
+		}
+		else
+		{
+			pending.append("null");
+		}
+	}
+	pending.append(line.empty() ? "{}\n" : "}\n");
+}
+
+bool RecorderStream::Flush()
+{
+	if (!impl || pending.empty())
+	{
+		return impl.get() != NULL;
+	}
+
+	bool written = impl->Write(pending);
+	pending.clear();
+	pending_lines = 0;
+
+	if (!written)
+	{
+		std::cout << "The stream consumer went away, no longer streaming the results" << std::endl;
+		impl.reset();
+	}
+	return written;
+}
+
+void RecorderStream::WriteLine(int face_id, int frame_num, double time_stamp, bool landmark_detection_success, double landmark_confidence,
+	const cv::Mat_<float>& landmarks_2D, const cv::Mat_<float>& landmarks_3D, const cv::Mat_<float>& pdm_model_params, const cv::Vec6f& rigid_shape_params, cv::Vec6f& pose_estimate,
+	const cv::Point3f& gazeDirection0, const cv::Point3f& gazeDirection1, const cv::Vec2f& gaze_angle, const std::vector<cv::Point2f>& eye_landmarks2d, const std::vector<cv::Point3f>& eye_landmarks3d,
+	const std::vector<float>& au_intensities, const std::vector<float>& au_occurences, bool reused)
+{
+	// The stream might have been closed by the consumer
+	if (!impl)
+	{
+		return;
+	}
+
+	current_col = 0;
+	std::fill(line.begin(), line.end(), std::numeric_limits<double>::quiet_NaN());
+
+	if (is_sequence)
+	{
+		Push(frame_num);
+		Push(face_id);
+		Push(time_stamp);
+		Push(landmark_confidence);
+		Push(landmark_detection_success);
+		if (output_reused)
+		{
+			Push(reused);
+		}
+	}
+	else
+	{
+		Push(face_id);
+		Push(landmark_confidence);
+	}
+
+	if (output_gaze)
+	{
+		Push(gazeDirection0.x);
+		Push(gazeDirection0.y);
+		Push(gazeDirection0.z);
+		Push(gazeDirection1.x);
+		Push(gazeDirection1.y);
+		Push(gazeDirection1.z);
+		Push(gaze_angle[0]);
+		Push(gaze_angle[1]);
+
+		for (auto eye_lmk : eye_landmarks2d)
+			Push(eye_lmk.x);
+		for (auto eye_lmk : eye_landmarks2d)
+			Push(eye_lmk.y);
+		for (auto eye_lmk : eye_landmarks3d)
+			Push(eye_lmk.x);
+		for (auto eye_lmk : eye_landmarks3d)
+			Push(eye_lmk.y);
+		for (auto eye_lmk : eye_landmarks3d)
+			Push(eye_lmk.z);
+	}
+
+	if (output_pose)
+	{
+		for (int i = 0; i < 6; ++i)
+		{
+			Push(pose_estimate[i]);
+		}
+	}
+
+	if (output_2D_landmarks)
+	{
+		for (auto lmk : landmarks_2D)
+			Push(lmk);
+	}
+
+	if (output_3D_landmarks)
+	{
+		for (auto lmk : landmarks_3D)
+			Push(lmk);
+	}
+
+	if (output_model_params)
+	{
+		for (int i = 0; i < 6; ++i)
+		{
+			Push(rigid_shape_params[i]);
+		}
+		for (auto lmk : pdm_model_params)
+			Push(lmk);
+	}
+
+	if (output_AUs)
+	{
+		for (int index : au_value_indices_reg)
+		{
+			Push(index < (int)au_intensities.size() ? au_intensities[index] : std::numeric_limits<double>::quiet_NaN());
+		}
+		for (int index : au_value_indices_class)
+		{
+			Push(index < (int)au_occurences.size() ? au_occurences[index] : std::numeric_limits<double>::quiet_NaN());
+		}
+	}
+
+	EncodeLine();
+	pending_lines++;
+	if (pending_lines >= lines_per_flush)
+	{
+		Flush();
+	}
+}
+
+void RecorderStream::Close()
+{
+	if (!impl)
+	{
+		return;
+	}
+
+	Flush();
+	impl.reset();
+}
@@ -0,0 +1,383 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace 2.0: Facial Behavior Analysis Toolkit
+//       Tadas Baltrušaitis, Amir Zadeh, Yao Chong Lim, and Louis-Philippe Morency
+//       in IEEE International Conference on Automatic Face and Gesture Recognition, 2018  
+//
+//       Convolutional experts constrained local model for facial landmark detection.
+//       A. Zadeh, T. Baltrušaitis, and Louis-Philippe Morency,
+//       in Computer Vision and Pattern Recognition Workshops, 2017.    
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltrušaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-specific normalisation for automatic Action Unit detection
+//       Tadas Baltrušaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "RemoteStorage.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <thread>
+
+// Boost includes
+#include <boost/algorithm/string.hpp>
+#include <boost/asio.hpp>
+
+using namespace Utilities;
+
+#define WARN_STREAM( stream ) \
+std::cout << "Warning: " << stream << std::endl
+
+namespace
+{
+	struct HttpUrl
+	{
+		std::string host;
+		std::string port;
+		std::string target;
+	};
+
+	bool ParseHttpUrl(const std::string& url, HttpUrl& parsed)
+	{
+		if (!boost::algorithm::istarts_with(url, "http://"))
+			return false;
+
+		std::string rest = url.substr(7);
+		size_t slash = rest.find('/');
+		std::string authority = rest.substr(0, slash);
+		parsed.target = slash == std::string::npos ? "/" : rest.substr(slash);
+
+		size_t colon = authority.rfind(':');
+		if (colon != std::string::npos)
+		{
+			parsed.host = authority.substr(0, colon);
+			parsed.port = authority.substr(colon + 1);
+		}
+		else
+		{
+			parsed.host = authority;
+			parsed.port = "80";
+		}
+		return !parsed.host.empty();
+	}
+
+	// Percent encoding a key or a query value, the slashes are kept in the keys
+	std::string UrlEncode(const std::string& value, bool keep_slashes)
+	{
+		std::ostringstream encoded;
+		const char* hex = "0123456789ABCDEF";
+		for (size_t i = 0; i < value.size(); ++i)
+		{
+			unsigned char c = (unsigned char)value[i];
+			if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~' || (keep_slashes && c == '/'))
+				encoded << c;
+			else
+				encoded << '%' << hex[c >> 4] << hex[c & 15];
+		}
+		return encoded.str();
+	}
+
+	std::string XmlUnescape(std::string value)
+	{
+		boost::replace_all(value, "&lt;", "<");
+		boost::replace_all(value, "&gt;", ">");
+		boost::replace_all(value, "&quot;", "\"");
+		boost::replace_all(value, "&apos;", "'");
+		boost::replace_all(value, "&amp;", "&");
+		return value;
+	}
+
+	// All of the values of an element in a (flat) XML document
+	std::vector<std::string> XmlValues(const std::string& xml, const std::string& element)
+	{
+		std::vector<std::string> values;
+		std::string open = "<" + element + ">";
+		std::string close = "</" + element + ">";
+		size_t start = xml.find(open);
+		while (start != std::string::npos)
+		{
+			start += open.size();
+			size_t end = xml.find(close, start);
+			if (end == std::string::npos)
+				break;
+			values.push_back(XmlUnescape(xml.substr(start, end - start)));
+			start = xml.find(open, end);
+		}
+		return values;
+	}
+
+	// A single request on its own connection. HTTP/1.0 is used so that the body is never chunked and simply ends with the connection
+	bool HttpRequest(const std::string& method, const std::string& url, const std::string& range, int& status, std::map<std::string, std::string>& headers,
+		std::vector<uchar>& body)
+	{
+		HttpUrl parsed;
+		if (!ParseHttpUrl(url, parsed))
+			return false;
+
+		try
+		{
+			boost::asio::io_service io_service;
+			boost::asio::ip::tcp::resolver resolver(io_service);
+			boost::asio::ip::tcp::socket socket(io_service);
+			boost::asio::connect(socket, resolver.resolve(boost::asio::ip::tcp::resolver::query(parsed.host, parsed.port)));
+
+			std::ostringstream request;
+			request << method << " " << parsed.target << " HTTP/1.0\r\n";
+			request << "Host: " << parsed.host << "\r\n";
+			if (!range.empty())
+				request << "Range: bytes=" << range << "\r\n";
+			request << "Connection: close\r\n\r\n";
+			boost::asio::write(socket, boost::asio::buffer(request.str()));
+
+			boost::asio::streambuf response;
+			boost::asio::read_until(socket, response, "\r\n\r\n");
+
+			std::istream response_stream(&response);
+			std::string version, line;
+			response_stream >> version >> status;
+			std::getline(response_stream, line);
+
+			headers.clear();
+			while (std::getline(response_stream, line) && line != "\r")
+			{
+				size_t colon = line.find(':');
+				if (colon == std::string::npos)
+					continue;
+				std::string name = boost::algorithm::to_lower_copy(line.substr(0, colon));
+				headers[name] = boost::algorithm::trim_copy(line.substr(colon + 1));
+			}
+
+			// The part of the body that came with the headers, followed by the rest of it
+			body.clear();
+			if (headers.count("content-length"))
+				body.reserve(std::strtoull(headers["content-length"].c_str(), 0, 10));
+			body.insert(body.end(), std::istreambuf_iterator<char>(response_stream), std::istreambuf_iterator<char>());
+
+			if (method != "HEAD")
+			{
+				boost::system::error_code error;
+				char buffer[64 * 1024];
+				while (true)
+				{
+					size_t read = socket.read_some(boost::asio::buffer(buffer), error);
+					body.insert(body.end(), buffer, buffer + read);
+					if (error == boost::asio::error::eof)
+						break;
+					if (error)
+						return false;
+				}
+			}
+		}
+		catch (const boost::system::system_error& error)
+		{
+			WARN_STREAM("Could not reach " << url << ": " << error.what());
+			return false;
+		}
+		return true;
+	}
+}
+
+bool Utilities::IsRemotePath(const std::string& path)
+{
+	return boost::algorithm::istarts_with(path, "s3://") || boost::algorithm::istarts_with(path, "http://");
+}
+
+std::string Utilities::RemoteHttpUrl(const std::string& path)
+{
+	if (boost::algorithm::istarts_with(path, "http://"))
+		return path;
+
+	if (!boost::algorithm::istarts_with(path, "s3://"))
+		return "";
+
+	const char* endpoint = std::getenv("OPENFACE_S3_ENDPOINT");
+	std::string url = endpoint && *endpoint ? endpoint : "http://s3.amazonaws.com";
+	if (url.back() == '/')
+		url.pop_back();
+
+	if (!boost::algorithm::istarts_with(url, "http://"))
+	{
+		WARN_STREAM("Only http endpoints are supported for the remote inputs, not " << url);
+		return "";
+	}
+
+	return url + "/" + UrlEncode(path.substr(5), true);
+}
+
+bool Utilities::ReadRemoteObject(const std::string& path, std::vector<uchar>& data, int parallel_ranges, size_t range_size)
+{
+	std::string url = RemoteHttpUrl(path);
+	int status = 0;
+	std::map<std::string, std::string> headers;
+
+	// Small objects (or all of them without parallel reads) are fetched in one go, which saves the request for their size
+	data.clear();
+	size_t size = 0;
+	if (parallel_ranges > 1 && range_size > 0)
+	{
+		std::vector<uchar> unused;
+		if (!HttpRequest("HEAD", url, "", status, headers, unused) || status != 200)
+		{
+			WARN_STREAM("Could not read " << path << " (HTTP status " << status << ")");
+			return false;
+		}
+		size = headers.count("content-length") ? (size_t)std::strtoull(headers["content-length"].c_str(), 0, 10) : 0;
+	}
+
+	if (size <= range_size)
+	{
+		if (!HttpRequest("GET", url, "", status, headers, data) || status != 200)
+		{
+			WARN_STREAM("Could not read " << path << " (HTTP status " << status << ")");
+			data.clear();
+			return false;
+		}
+		return true;
+	}
+
+	// Every worker fetches every parallel_ranges-th range straight into its place in the object
+	data.resize(size);
+	size_t num_ranges = (size + range_size - 1) / range_size;
+	int num_workers = (int)std::min(num_ranges, (size_t)parallel_ranges);
+	std::vector<char> worker_success(num_workers, 1);
+	std::vector<std::thread> workers;
+	for (int w = 0; w < num_workers; ++w)
+	{
+		workers.push_back(std::thread([&, w]()
+		{
+			int range_status = 0;
+			std::map<std::string, std::string> range_headers;
+			std::vector<uchar> range_data;
+			for (size_t r = w; r < num_ranges && worker_success[w]; r += num_workers)
+			{
+				size_t first = r * range_size;
+				size_t last = std::min(size, first + range_size) - 1;
+				std::ostringstream range;
+				range << first << "-" << last;
+				if (!HttpRequest("GET", url, range.str(), range_status, range_headers, range_data) || range_status != 206 || range_data.size() != last - first + 1)
+				{
+					worker_success[w] = 0;
+					break;
+				}
+				std::memcpy(&data[first], range_data.data(), range_data.size());
+			}
+		}));
+	}
+	for (size_t w = 0; w < workers.size(); ++w)
+	{
+		workers[w].join();
+	}
+
+	if (std::find(worker_success.begin(), worker_success.end(), 0) != worker_success.end())
+	{
+		WARN_STREAM("Could not read all of the ranges of " << path);
+		data.clear();
+		return false;
+	}
+	return true;
+}
+
+bool Utilities::ListRemoteObjects(const std::string& prefix, std::vector<std::string>& objects)
+{
+	objects.clear();
+
+	HttpUrl parsed;
+	if (!ParseHttpUrl(RemoteHttpUrl(prefix), parsed))
+	{
+		WARN_STREAM("Could not map " << prefix << " to an http URL");
+		return false;
+	}
+
+	// The first segment of the target is the bucket (path style addressing), the rest is the prefix of the keys
+	std::string target = parsed.target.substr(1);
+	size_t slash = target.find('/');
+	std::string bucket = target.substr(0, slash);
+	std::string key_prefix = slash == std::string::npos ? "" : target.substr(slash + 1);
+	if (!key_prefix.empty() && key_prefix.back() != '/')
+		key_prefix += "/";
+
+	// The keys in the URL are percent encoded, the prefix in the query is encoded again from the decoded one
+	std::string decoded_prefix;
+	for (size_t i = 0; i < key_prefix.size(); ++i)
+	{
+		if (key_prefix[i] == '%' && i + 2 < key_prefix.size())
+		{
+			decoded_prefix += (char)std::strtol(key_prefix.substr(i + 1, 2).c_str(), 0, 16);
+			i += 2;
+		}
+		else
+		{
+			decoded_prefix += key_prefix[i];
+		}
+	}
+
+	std::string bucket_url = "http://" + parsed.host + ":" + parsed.port + "/" + bucket;
+	std::string continuation_token;
+	while (true)
+	{
+		// Only the objects directly under the prefix are listed, the deeper ones are left out with the delimiter
+		std::string url = bucket_url + "?list-type=2&delimiter=%2F&prefix=" + UrlEncode(decoded_prefix, false);
+		if (!continuation_token.empty())
+			url += "&continuation-token=" + UrlEncode(continuation_token, false);
+
+		int status = 0;
+		std::map<std::string, std::string> headers;
+		std::vector<uchar> body;
+		if (!HttpRequest("GET", url, "", status, headers, body) || status != 200)
+		{
+			WARN_STREAM("Could not list the objects under " << prefix << " (HTTP status " << status << ")");
+			return false;
+		}
+
+		std::string xml(body.begin(), body.end());
+		std::vector<std::string> keys = XmlValues(xml, "Key");
+		for (size_t i = 0; i < keys.size(); ++i)
+		{
+			objects.push_back(bucket_url + "/" + UrlEncode(keys[i], true));
+		}
+
+		std::vector<std::string> truncated = XmlValues(xml, "IsTruncated");
+		std::vector<std::string> tokens = XmlValues(xml, "NextContinuationToken");
+		if (truncated.empty() || truncated[0] != "true" || tokens.empty())
+			break;
+		continuation_token = tokens[0];
+	}
+
+	return true;
+}
+
+cv::Mat Utilities::ReadImage(const std::string& path, int flags)
+{
+	if (!IsRemotePath(path))
+		return cv::imread(path, flags);
+
+	std::vector<uchar> data;
+	if (!ReadRemoteObject(path, data) || data.empty())
+		return cv::Mat();
+
+	return cv::imdecode(data, flags);
+}
@@ -32,8 +32,15 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "SequenceCapture.h"
+#include "Concurrency.h"
 #include "ImageManipulationHelpers.h"
+#include "RemoteStorage.h"
+#include "Tracing.h"
+#include "Metrics.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
 
 // Boost includes
@@ -59,6 +66,117 @@ std::cout << "Warning: " << stream << std::endl
 #define ERROR_STREAM( stream ) \
 std::cout << "Error: " << stream << std::endl
 
+namespace
+{
+	// Allows cv::Mat headers to reference externally owned buffers and to call the release callback once the last header is gone (the same approach as
+	// the numpy allocator of the OpenCV python bindings). Anything newly allocated through it is handled by the default allocator
+	class ExternalBufferAllocator : public cv::MatAllocator
+	{
+	public:
+
+		cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, int flags, cv::UMatUsageFlags usageFlags) const
+		{
+			return cv::Mat::getDefaultAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+		}
+
+		bool allocate(cv::UMatData* data, int accessflags, cv::UMatUsageFlags usageFlags) const
+		{
+			return cv::Mat::getDefaultAllocator()->allocate(data, accessflags, usageFlags);
+		}
+
+		void deallocate(cv::UMatData* u) const
+		{
+			if (!u)
+				return;
+
+			std::function<void()>* release = (std::function<void()>*)u->userdata;
+			if (release && *release)
+			{
+				(*release)();
+			}
+			delete release;
+			delete u;
+		}
+	};
+
+	// Opening the video with the requested backend and decoding settings, falling back to the default ones if they are not available
+	bool OpenVideoCapture(cv::VideoCapture& capture, const std::string& filename, const std::string& backend, bool hw_acceleration, int threads)
+	{
+		int api = cv::CAP_ANY;
+		if (backend.compare("ffmpeg") == 0)
+			api = cv::CAP_FFMPEG;
+		else if (backend.compare("gstreamer") == 0)
+			api = cv::CAP_GSTREAMER;
+#ifdef _WIN32
+		else if (backend.compare("msmf") == 0)
+			api = cv::CAP_MSMF;
+#endif
+		else if (backend.compare("any") != 0)
+			WARN_STREAM("Unknown video backend " << backend << ", using the default one");
+
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && (CV_VERSION_MINOR > 5 || (CV_VERSION_MINOR == 5 && CV_VERSION_REVISION >= 2)))
+		std::vector<int> capture_params;
+		if (hw_acceleration)
+		{
+			capture_params.push_back(cv::CAP_PROP_HW_ACCELERATION);
+			capture_params.push_back(cv::VIDEO_ACCELERATION_ANY);
+		}
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 6)
+		if (threads > 0)
+		{
+			capture_params.push_back(cv::CAP_PROP_N_THREADS);
+			capture_params.push_back(threads);
+		}
+#else
+		if (threads > 0)
+			WARN_STREAM("Setting the number of decoding threads requires OpenCV 4.6 or newer, using the default");
+#endif
+		if (!capture_params.empty())
+		{
+			if (capture.open(filename, api, capture_params))
+				return true;
+			WARN_STREAM("Could not open the video with the requested decoding settings, using the default ones");
+		}
+#else
+		if (hw_acceleration || threads > 0)
+			WARN_STREAM("Hardware decoding and decoding threads require OpenCV 4.5.2 or newer, using the default decoding");
+#endif
+
+#if CV_VERSION_MAJOR > 3 || (CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR >= 4)
+		if (api != cv::CAP_ANY)
+		{
+			if (capture.open(filename, api))
+				return true;
+			WARN_STREAM("Could not open the video with the " << backend << " backend, using the default one");
+		}
+#else
+		if (api != cv::CAP_ANY)
+			WARN_STREAM("Selecting a video backend requires OpenCV 3.4 or newer, using the default one");
+#endif
+
+		return capture.open(filename);
+	}
+
+	cv::Mat_<uchar> WrapExternalPlane(const uchar* data, int rows, int cols, size_t step, const std::function<void()>& release)
+	{
+		static ExternalBufferAllocator allocator;
+
+		cv::Mat plane(rows, cols, CV_8U, (void*)data, step);
+
+		cv::UMatData* u = new cv::UMatData(&allocator);
+		u->data = u->origdata = (uchar*)data;
+		u->size = step * rows;
+		u->flags |= cv::UMatData::USER_ALLOCATED;
+		u->userdata = new std::function<void()>(release);
+		u->refcount = 1;
+
+		plane.u = u;
+		plane.allocator = &allocator;
+
+		return plane;
+	}
+}
+
 bool SequenceCapture::Open(std::vector<std::string>& arguments)
 {
 
@@ -93,9 +211,13 @@ bool SequenceCapture::Open(std::vector<std::string>& arguments)
 
 	std::string input_video_file;
 	std::string input_sequence_directory;
+	std::string replay_directory;
 	int device = -1;
 	int cam_width = 640;
 	int cam_height = 480;
+	std::string capture_backend = "any";
+	bool capture_hw = false;
+	int capture_threads = 0;
 
 	bool file_found = false;
 
@@ -117,6 +239,25 @@ bool SequenceCapture::Open(std::vector<std::string>& arguments)
 			i++;
 			file_found = true;
 		}
+		else if (!file_found && arguments[i].compare("-replay") == 0)
+		{
+			replay_directory = arguments[i + 1];
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+			file_found = true;
+		}
+		else if (arguments[i].compare("-record_session") == 0)
+		{
+			session_directory = arguments[i + 1];
+			i++;
+		}
+		else if (arguments[i].compare("-record_session_scale") == 0)
+		{
+			std::stringstream data(arguments[i + 1]);
+			data >> session_scale;
+			i++;
+		}
 		else if (arguments[i].compare("-fx") == 0)
 		{
 			std::stringstream data(arguments[i + 1]);
@@ -157,6 +298,30 @@ bool SequenceCapture::Open(std::vector<std::string>& arguments)
 			valid[i + 1] = false;
 			i++;
 		}
+		else if (arguments[i].compare("-capture_backend") == 0)
+		{
+			capture_backend = arguments[i + 1];
+			i++;
+		}
+		else if (arguments[i].compare("-capture_hw") == 0)
+		{
+			capture_hw = true;
+		}
+		else if (arguments[i].compare("-latest_frame") == 0)
+		{
+			SetLatestFrameOnly(true);
+		}
+		else if (arguments[i].compare("-write_raw") == 0)
+		{
+			SetRawOutput(arguments[i + 1]);
+			i++;
+		}
+		else if (arguments[i].compare("-capture_threads") == 0)
+		{
+			std::stringstream data(arguments[i + 1]);
+			data >> capture_threads;
+			i++;
+		}
 		else if (arguments[i].compare("-cam_height") == 0)
 		{
 			std::stringstream data(arguments[i + 1]);
@@ -177,13 +342,23 @@ bool SequenceCapture::Open(std::vector<std::string>& arguments)
 	
 	no_input_specified = !file_found;
 
+	if (!session_directory.empty())
+	{
+		SetSessionOutput(session_directory, session_scale, arguments);
+	}
+
 	// Based on what was read in open the sequence
+	if (!replay_directory.empty())
+	{
+		return OpenReplay(replay_directory, fx, fy, cx, cy);
+	}
 	if (device != -1)
 	{
 		return OpenWebcam(device, cam_width, cam_height, fx, fy, cx, cy);
 	}
 	if (!input_video_file.empty())
 	{
+		SetVideoDecoding(capture_backend, capture_hw, capture_threads);
 		return OpenVideoFile(input_video_file, fx, fy, cx, cy);
 	}
 	if (!input_sequence_directory.empty())
@@ -219,6 +394,7 @@ bool SequenceCapture::OpenWebcam(int device, int image_width, int image_height,
 	INFO_STREAM("Attempting to read from webcam: " << device);
 
 	no_input_specified = false;
+	is_external = false;
 	frame_num = 0;
 	time_stamp = 0;
 
@@ -268,30 +444,106 @@ bool SequenceCapture::OpenWebcam(int device, int image_width, int image_height,
 	this->name = "webcam_" + time;
 
 	start_time = cv::getTickCount();
+	has_camera_time = false;
+	last_camera_time = 0;
 	capturing = true;
+	StartRawOutput();
+
+	if (latest_frame_only)
+	{
+		has_webcam_frame = false;
+		webcam_ended = false;
+		webcam_dropped = 0;
+		capture_thread = std::thread(&SequenceCapture::WebcamThread, this);
+	}
 
 	return true;
 
 }
 
+double SequenceCapture::WebcamTimestamp()
+{
+	double read_time = (cv::getTickCount() - start_time) / cv::getTickFrequency();
+
+	// The camera's clock is anchored to the read time of the first frame, so that the timestamps are on the same clock as other sources
+	double camera_time = capture.get(cv::CAP_PROP_POS_MSEC) / 1000.0;
+	if (camera_time > 0 && (!has_camera_time || camera_time > last_camera_time))
+	{
+		if (!has_camera_time)
+		{
+			camera_time_offset = read_time - camera_time;
+			has_camera_time = true;
+		}
+		last_camera_time = camera_time;
+		return camera_time + camera_time_offset;
+	}
+	return read_time;
+}
+
+void SequenceCapture::WebcamThread()
+{
+	frame_pool.SetCapacity(Concurrency::LimitQueueBytes(CAPTURE_CAPACITY * 1024 * 1024));
+
+	while (capturing)
+	{
+		cv::Mat frame = frame_pool.Acquire(frame_height, frame_width, CV_8UC3);
+		bool success = capture.grab();
+		double frame_time = WebcamTimestamp();
+		success = success && capture.retrieve(frame) && !frame.empty();
+
+		std::lock_guard<std::mutex> lock(webcam_mutex);
+		if (!success)
+		{
+			break;
+		}
+		if (has_webcam_frame)
+		{
+			webcam_dropped++;
+			METRICS_INCREMENT("openface_dropped_frames_total", "Frames that were lost before processing");
+		}
+		webcam_frame = frame;
+		webcam_time_stamp = frame_time;
+		has_webcam_frame = true;
+		webcam_frame_ready.notify_one();
+	}
+
+	std::lock_guard<std::mutex> lock(webcam_mutex);
+	webcam_ended = true;
+	webcam_frame_ready.notify_one();
+}
+
 void SequenceCapture::Close()
 {
 	// Close the capturing threads
 	capturing = false;
 
-	// In case the queue is full and the thread is blocking, free one element so it can finish
-	std::tuple<double, cv::Mat, cv::Mat_<uchar> > data;
-	capture_queue.try_pop(data);
+	// In case the queues are full and the threads are blocking, let them drop frames instead so they can finish
+	capture_queue.SetPolicy(FrameQueue<std::tuple<double, cv::Mat, cv::Mat_<uchar> > >::DROP_OLDEST);
+	decoded_queue.Close();
 
-	capture_threads.wait();
+	if (capture_thread.joinable())
+		capture_thread.join();
+	if (conversion_thread.joinable())
+		conversion_thread.join();
+	image_prefetcher.Stop();
 	
-	// Empty the capture queue (in case a capture was cancelled and we still have frames in the queue)
-	capture_queue.clear();
+	// Empty the capture queues (in case a capture was cancelled and we still have frames in the queue)
+	capture_queue.Clear();
+	decoded_queue.Reset();
+	SetDropFramesWhenFull(drop_frames_when_full);
+	frame_pool.Clear();
+	gray_frame_pool.Clear();
 
 	// Release the capture objects
 	if (capture.isOpened())
 		capture.release();
+	raw_video.Close();
+	raw_output.Close();
+	CloseSessionOutput();
 
+	paced_replay = false;
+	replay_width = 0;
+	replay_height = 0;
 }
 
 // Destructor that releases the capture
@@ -302,16 +554,30 @@ SequenceCapture::~SequenceCapture()
 
 bool SequenceCapture::OpenVideoFile(std::string video_file, float fx, float fy, float cx, float cy)
 {
+	if (RawVideoReader::IsRawVideo(video_file))
+	{
+		if (IsRemotePath(video_file))
+		{
+			std::cout << "The raw videos are memory mapped, so they have to be local: " << video_file << std::endl;
+			return false;
+		}
+		return OpenRawVideo(video_file, fx, fy, cx, cy);
+	}
+
 	INFO_STREAM("Attempting to read from file: " << video_file);
 
+	// The remote videos are streamed by the decoder itself, which reads them with range requests as it goes
+	std::string video_location = IsRemotePath(video_file) ? RemoteHttpUrl(video_file) : video_file;
+
 	no_input_specified = false;
+	is_external = false;
 	frame_num = 0;
 	time_stamp = 0;
 
 	latest_frame = cv::Mat();
 	latest_gray_frame = cv::Mat();
 
-	capture.open(video_file);
+	OpenVideoCapture(capture, video_location, decode_backend, decode_hw_acceleration, decode_threads);
 
 	if (!capture.isOpened())
 	{
@@ -336,14 +602,371 @@ bool SequenceCapture::OpenVideoFile(std::string video_file, float fx, float fy,
 
 	vid_length = (int)capture.get(cv::CAP_PROP_FRAME_COUNT);
 
+	// Seeking is only approximate for some codecs and backends, in which case the frames before the start are decoded and skipped
+	size_t first_frame = start_frame;
+	size_t last_frame = end_frame;
+	start_frame = 0;
+	end_frame = 0;
+	if (first_frame > 0)
+	{
+		if (!capture.set(cv::CAP_PROP_POS_FRAMES, (double)first_frame) || (size_t)capture.get(cv::CAP_PROP_POS_FRAMES) != first_frame)
+		{
+			capture.release();
+			OpenVideoCapture(capture, video_location, decode_backend, decode_hw_acceleration, decode_threads);
+			for (size_t i = 0; i < first_frame && capture.grab(); ++i) {}
+		}
+		frame_num = first_frame;
+	}
+
+	SetCameraIntrinsics(fx, fy, cx, cy);
+
+	this->name = video_file;
+	StartRawOutput();
+	capturing = true;
+	capture_thread = std::thread(&SequenceCapture::CaptureThread, this, first_frame, last_frame);
+	conversion_thread = std::thread(&SequenceCapture::ConversionThread, this);
+
+	return true;
+
+}
+
+bool SequenceCapture::OpenRawVideo(const std::string& video_file, float fx, float fy, float cx, float cy)
+{
+	INFO_STREAM("Attempting to read from raw video: " << video_file);
+
+	no_input_specified = false;
+	is_external = false;
+	frame_num = 0;
+	time_stamp = 0;
+
+	latest_frame = cv::Mat();
+	latest_gray_frame = cv::Mat();
+
+	if (!raw_video.Open(video_file))
+	{
+		std::cout << "Failed to open the raw video at location: " << video_file << std::endl;
+		return false;
+	}
+
+	this->fps = raw_video.fps;
+	if (fps != fps || fps <= 0)
+	{
+		WARN_STREAM("FPS of the raw video is not known, assuming 30");
+		fps = 30;
+	}
+
+	is_webcam = false;
+	is_image_seq = false;
+
+	// A replayed session is scaled back to the size it was recorded at
+	this->frame_width = replay_width > 0 ? replay_width : raw_video.width;
+	this->frame_height = replay_height > 0 ? replay_height : raw_video.height;
+	vid_length = raw_video.GetNumFrames();
+
+	// The frames are indexed, so seeking is exact
+	frame_num = std::min(start_frame, vid_length);
+	size_t last_frame = end_frame > 0 ? std::max(frame_num, std::min(end_frame, vid_length)) : vid_length;
+	start_frame = 0;
+	end_frame = 0;
+
 	SetCameraIntrinsics(fx, fy, cx, cy);
 
+	// The frames are already raw
+	if (!raw_output_file.empty())
+	{
+		WARN_STREAM("Not writing " << video_file << " to a raw video again");
+		raw_output_file = "";
+	}
+
 	this->name = video_file;
+	StartSessionOutput();
 	capturing = true;
-	capture_threads.run([&] {CaptureThread(); });
+	capture_thread = std::thread(&SequenceCapture::CaptureThread, this, frame_num, last_frame);
+	conversion_thread = std::thread(&SequenceCapture::ConversionThread, this);
+
+	return true;
+}
+
+void SequenceCapture::StartRawOutput()
+{
+	StartSessionOutput();
+
+	if (raw_output_file.empty())
+	{
+		return;
+	}
+
+	if (raw_output.Open(raw_output_file, frame_width, frame_height, fps))
+	{
+		INFO_STREAM("Writing the frames to the raw video " << raw_output_file);
+	}
+	else
+	{
+		WARN_STREAM("Could not open the raw video " << raw_output_file << " for writing");
+	}
+	raw_output_file = "";
+}
+
+void SequenceCapture::WriteRawFrame(double timestamp, const cv::Mat& frame, const cv::Mat_<uchar>& gray_frame)
+{
+	if (raw_output.IsOpen() && !frame.empty() && !raw_output.WriteFrame(frame, gray_frame, timestamp))
+	{
+		WARN_STREAM("Could not write the frame to the raw video (the frames have to be colour and of the same size), not writing any more frames");
+		raw_output.Close();
+	}
+}
+
+namespace
+{
+	// The arguments that select the input or the outputs are not part of a recorded session, with the number of values they take
+	int SessionExcludedArgument(const std::string& argument)
+	{
+		const char* with_value[] = { "-f", "-fdir", "-device", "-cam_width", "-cam_height", "-root", "-inroot", "-outroot", "-out_dir", "-of",
+			"-write_raw", "-record_session", "-record_session_scale", "-replay", "-trace", "-metrics_port" };
+		for (size_t i = 0; i < sizeof(with_value) / sizeof(with_value[0]); ++i)
+		{
+			if (argument.compare(with_value[i]) == 0)
+				return 1;
+		}
+		return -1;
+	}
+
+	// FNV-1a over the pixels, for checking that a replayed frame is the one that was recorded without storing it in full
+	uint64_t HashFrame(const cv::Mat& frame)
+	{
+		uint64_t hash = 14695981039346656037ULL;
+		size_t row_bytes = frame.cols * frame.elemSize();
+		for (int y = 0; y < frame.rows; ++y)
+		{
+			const uchar* row = frame.ptr<uchar>(y);
+			for (size_t x = 0; x < row_bytes; ++x)
+			{
+				hash = (hash ^ row[x]) * 1099511628211ULL;
+			}
+		}
+		return hash;
+	}
+}
+
+void SequenceCapture::SetSessionOutput(const std::string& directory, double scale, const std::vector<std::string>& arguments)
+{
+	session_directory = directory;
+	session_scale = std::min(1.0, std::max(0.05, scale));
+
+	session_arguments.clear();
+	for (size_t i = 1; i < arguments.size(); ++i)
+	{
+		int excluded = SessionExcludedArgument(arguments[i]);
+		if (excluded >= 0)
+		{
+			i += excluded;
+			continue;
+		}
+		session_arguments.push_back(arguments[i]);
+	}
+}
+
+void SequenceCapture::StartSessionOutput()
+{
+	if (session_directory.empty())
+	{
+		return;
+	}
+
+	std::string directory = session_directory;
+	session_directory = "";
+
+	boost::system::error_code ec;
+	boost::filesystem::create_directories(directory, ec);
+
+	int session_width = std::max(1, (int)std::round(frame_width * session_scale));
+	int session_height = std::max(1, (int)std::round(frame_height * session_scale));
+	std::string video_file = (boost::filesystem::path(directory) / "frames.ofraw").string();
+	if (!session_video.Open(video_file, session_width, session_height, fps))
+	{
+		WARN_STREAM("Could not record the session to " << directory);
+		return;
+	}
+
+	session_frames.open((boost::filesystem::path(directory) / "frames.csv").string().c_str(), std::ios::out | std::ios::trunc);
+	session_frames << "frame, timestamp, hash" << std::endl;
+	session_frames_written = 0;
+
+	std::ofstream session_file((boost::filesystem::path(directory) / "session.txt").string().c_str(), std::ios::out | std::ios::trunc);
+	session_file << "name " << name << "\n";
+	session_file << "source " << (is_webcam ? "webcam" : (is_external ? "external" : (is_image_seq ? "images" : "video"))) << "\n";
+	session_file << "width " << frame_width << "\n";
+	session_file << "height " << frame_height << "\n";
+	session_file << "fps " << fps << "\n";
+	session_file << "scale " << session_scale << "\n";
+	for (size_t i = 0; i < session_arguments.size(); ++i)
+	{
+		session_file << "argument " << session_arguments[i] << "\n";
+	}
+
+	session_output_directory = directory;
+	INFO_STREAM("Recording the session to " << directory);
+}
+
+void SequenceCapture::WriteSessionFrame(double timestamp, const cv::Mat& frame, const cv::Mat_<uchar>& gray_frame)
+{
+	if (!session_video.IsOpen() || frame.empty())
+	{
+		return;
+	}
+
+	// The frames of external sources can be grayscale only
+	const cv::Mat* colour = &frame;
+	cv::Mat bgr_frame;
+	if (frame.channels() == 1)
+	{
+		cv::cvtColor(frame, bgr_frame, cv::COLOR_GRAY2BGR);
+		colour = &bgr_frame;
+	}
+
+	session_frames << session_frames_written << ", " << timestamp << ", " << std::hex << HashFrame(frame) << std::dec << "\n";
+	session_frames_written++;
+
+	bool written;
+	if (session_scale < 1.0)
+	{
+		session_frame.create(std::max(1, (int)std::round(frame.rows * session_scale)), std::max(1, (int)std::round(frame.cols * session_scale)), CV_8UC3);
+		cv::resize(*colour, session_frame, session_frame.size(), 0, 0, cv::INTER_AREA);
+		cv::resize(gray_frame, session_gray_frame, session_frame.size(), 0, 0, cv::INTER_AREA);
+		written = session_video.WriteFrame(session_frame, session_gray_frame, timestamp);
+	}
+	else
+	{
+		written = session_video.WriteFrame(*colour, gray_frame, timestamp);
+	}
+
+	if (!written)
+	{
+		WARN_STREAM("Could not write the frame to the session (the frames have to be of the same size), not recording any more frames");
+		session_video.Close();
+	}
+}
+
+void SequenceCapture::CloseSessionOutput()
+{
+	if (session_output_directory.empty())
+	{
+		return;
+	}
 
+	session_video.Close();
+	session_frames.close();
+
+	// The stage latencies of the session, to compare with those of the replay
+	boost::filesystem::path directory(session_output_directory);
+	std::ofstream metrics_file((directory / "metrics.txt").string().c_str(), std::ios::out | std::ios::trunc);
+	metrics_file << Metrics::GetRegistry().ExportPrometheus();
+
+	if (Tracing::IsEnabled() && !Tracing::WriteChromeTrace((directory / "trace.json").string()))
+	{
+		WARN_STREAM("Could not write the trace of the session");
+	}
+
+	INFO_STREAM("Recorded " << session_frames_written << " frames of the session to " << session_output_directory);
+	session_output_directory = "";
+}
+
+bool SequenceCapture::OpenReplay(const std::string& directory, float fx, float fy, float cx, float cy)
+{
+	boost::filesystem::path session_path(directory);
+	std::ifstream session_file((session_path / "session.txt").string().c_str());
+	if (!session_file.is_open())
+	{
+		std::cout << "Failed to open the recorded session at location: " << directory << std::endl;
+		return false;
+	}
+
+	std::string session_name;
+	std::string source;
+	int width = 0;
+	int height = 0;
+	std::string line;
+	while (std::getline(session_file, line))
+	{
+		size_t space = line.find(' ');
+		std::string key = line.substr(0, space);
+		std::string value = space == std::string::npos ? "" : line.substr(space + 1);
+		if (key == "name")
+			session_name = value;
+		else if (key == "source")
+			source = value;
+		else if (key == "width")
+			width = atoi(value.c_str());
+		else if (key == "height")
+			height = atoi(value.c_str());
+	}
+
+	replay_width = width;
+	replay_height = height;
+	paced_replay = true;
+	replay_started = false;
+
+	// A live camera does not wait for the processing
+	if (source == "webcam" || source == "external")
+	{
+		capture_queue.SetPolicy(FrameQueue<std::tuple<double, cv::Mat, cv::Mat_<uchar> > >::DROP_OLDEST);
+	}
+
+	if (!OpenRawVideo((session_path / "frames.ofraw").string(), fx, fy, cx, cy))
+	{
+		paced_replay = false;
+		replay_width = 0;
+		replay_height = 0;
+		return false;
+	}
+
+	// The outputs are named after the recorded sequence
+	if (!session_name.empty())
+	{
+		this->name = session_name;
+	}
 	return true;
+}
+
+void SequenceCapture::WaitForReplayFrame(double timestamp)
+{
+	if (!replay_started)
+	{
+		replay_started = true;
+		replay_start = std::chrono::steady_clock::now();
+		replay_first_timestamp = timestamp;
+		return;
+	}
 
+	std::chrono::steady_clock::time_point due = replay_start + std::chrono::microseconds((int64_t)((timestamp - replay_first_timestamp) * 1e6));
+	std::this_thread::sleep_until(due);
+}
+
+void SequenceCapture::AddReplayArguments(std::vector<std::string>& arguments)
+{
+	std::string directory;
+	for (size_t i = 0; i + 1 < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-replay") == 0)
+		{
+			directory = arguments[i + 1];
+			break;
+		}
+	}
+	if (directory.empty())
+	{
+		return;
+	}
+
+	std::ifstream session_file((boost::filesystem::path(directory) / "session.txt").string().c_str());
+	std::string line;
+	while (std::getline(session_file, line))
+	{
+		if (line.compare(0, 9, "argument ") == 0)
+		{
+			arguments.push_back(line.substr(9));
+		}
+	}
 }
 
 bool SequenceCapture::OpenImageSequence(std::string directory, float fx, float fy, float cx, float cy)
@@ -351,21 +974,36 @@ bool SequenceCapture::OpenImageSequence(std::string directory, float fx, float f
 	INFO_STREAM("Attempting to read from directory: " << directory);
 
 	no_input_specified = false;
+	is_external = false;
 	frame_num = 0;
 	time_stamp = 0;
 
 	image_files.clear();
 
 	boost::filesystem::path image_directory(directory);
+	bool remote = IsRemotePath(directory);
 
-	if (!boost::filesystem::exists(image_directory))
+	std::vector<boost::filesystem::path> file_in_directory;
+	if (remote)
 	{
-		std::cout << "Provided directory does not exist: " << directory << std::endl;
-		return false;
+		// A remote directory is a prefix of the object keys
+		std::vector<std::string> objects;
+		if (!ListRemoteObjects(directory, objects))
+		{
+			std::cout << "Could not list the provided remote directory: " << directory << std::endl;
+			return false;
+		}
+		file_in_directory.assign(objects.begin(), objects.end());
+	}
+	else
+	{
+		if (!boost::filesystem::exists(image_directory))
+		{
+			std::cout << "Provided directory does not exist: " << directory << std::endl;
+			return false;
+		}
+		copy(boost::filesystem::directory_iterator(image_directory), boost::filesystem::directory_iterator(), back_inserter(file_in_directory));
 	}
-
-	std::vector<boost::filesystem::path> file_in_directory;
-	copy(boost::filesystem::directory_iterator(image_directory), boost::filesystem::directory_iterator(), back_inserter(file_in_directory));
 
 	// Sort the images in the directory first
 	sort(file_in_directory.begin(), file_in_directory.end());
@@ -389,26 +1027,255 @@ bool SequenceCapture::OpenImageSequence(std::string directory, float fx, float f
 		return false;
 	}
 
+	// The recorded sequences have an index with the capture time of every image (frame, timestamp), it is only used if it covers all images
+	image_timestamps.clear();
+	std::stringstream index_file;
+	bool has_index = false;
+	if (remote)
+	{
+		// Only fetched if it was listed, saving a failing request for the sequences without one
+		for (size_t i = 0; i < file_in_directory.size() && !has_index; ++i)
+		{
+			std::vector<uchar> index_data;
+			if (file_in_directory[i].filename().string() == "timestamps.csv" && ReadRemoteObject(file_in_directory[i].string(), index_data))
+			{
+				index_file.str(std::string(index_data.begin(), index_data.end()));
+				has_index = true;
+			}
+		}
+	}
+	else
+	{
+		boost::filesystem::ifstream local_index_file(image_directory / "timestamps.csv");
+		if (local_index_file.is_open())
+		{
+			index_file << local_index_file.rdbuf();
+			has_index = true;
+		}
+	}
+	if (has_index)
+	{
+		std::string line;
+		std::getline(index_file, line);
+		while (std::getline(index_file, line))
+		{
+			std::vector<std::string> values;
+			boost::split(values, line, boost::is_any_of(","));
+			if (values.size() < 2)
+			{
+				break;
+			}
+			image_timestamps.push_back(atof(values[1].c_str()));
+		}
+		if (image_timestamps.size() != image_files.size())
+		{
+			WARN_STREAM("The index of " << directory << " has " << image_timestamps.size() << " timestamps for " << image_files.size() << " images, not using it");
+			image_timestamps.clear();
+		}
+	}
+
 	// Assume all images are same size in an image sequence
-	cv::Mat tmp = cv::imread(image_files[0], cv::IMREAD_COLOR);
+	cv::Mat tmp = ReadImage(image_files[0], cv::IMREAD_COLOR);
 	this->frame_height = tmp.size().height;
 	this->frame_width = tmp.size().width;
 
 	SetCameraIntrinsics(fx, fy, cx, cy);
 
-	// No fps as we have a sequence
+	// No fps as we have a sequence, unless the index has the capture times
 	this->fps = 0;
+	if (image_timestamps.size() > 1 && image_timestamps.back() > image_timestamps.front())
+	{
+		this->fps = (image_timestamps.size() - 1) / (image_timestamps.back() - image_timestamps.front());
+	}
 
 	this->name = directory;
 
 	is_webcam = false;
 	is_image_seq = true;	
 	vid_length = image_files.size();
+
+	frame_num = std::min(start_frame, image_files.size());
+	size_t last_frame = end_frame > 0 ? std::max(frame_num, std::min(end_frame, image_files.size())) : image_files.size();
+	start_frame = 0;
+	end_frame = 0;
+	if (decode_threads > 1 || remote)
+	{
+		image_prefetcher.Start(std::vector<std::string>(image_files.begin() + frame_num, image_files.begin() + last_frame), std::max(decode_threads, remote ? REMOTE_READ_AHEAD : 0), false);
+	}
+	StartRawOutput();
+	capturing = true;
+	capture_thread = std::thread(&SequenceCapture::CaptureThread, this, frame_num, last_frame);
+	conversion_thread = std::thread(&SequenceCapture::ConversionThread, this);
+
+	return true;
+
+}
+
+bool SequenceCapture::Reopen(size_t frame)
+{
+	if (is_webcam || is_external)
+	{
+		return false;
+	}
+
+	Close();
+	SetStartFrame(frame);
+
+	// The camera parameters were already worked out when opening, so they are kept as they are
+	std::string sequence_name = name;
+	if (is_image_seq)
+	{
+		return OpenImageSequence(sequence_name, fx, fy, cx, cy);
+	}
+	return OpenVideoFile(sequence_name, fx, fy, cx, cy);
+}
+
+bool SequenceCapture::OpenExternal(int width, int height, double fps, bool convert_to_bgr, std::string name, float fx, float fy, float cx, float cy)
+{
+	INFO_STREAM("Reading external frames: " << name);
+
+	no_input_specified = false;
+	frame_num = 0;
+	time_stamp = 0;
+
+	if (width <= 0 || height <= 0)
+	{
+		std::cout << "Specify a valid external frame size" << std::endl;
+		return false;
+	}
+
+	latest_frame = cv::Mat();
+	latest_gray_frame = cv::Mat();
+
+	this->frame_width = width;
+	this->frame_height = height;
+
+	// Check if fps is nan or less than 0
+	this->fps = fps;
+	if (fps != fps || fps <= 0)
+	{
+		WARN_STREAM("FPS of the external frames not provided, assuming 30");
+		this->fps = 30;
+	}
+
+	SetCameraIntrinsics(fx, fy, cx, cy);
+
+	this->name = name;
+
+	is_webcam = false;
+	is_image_seq = false;
+	is_external = true;
+	external_to_bgr = convert_to_bgr;
+	vid_length = 0;
+
+	// There is no capture thread, the frames are pushed to the queue directly
+	capture_queue.SetCapacity(Concurrency::LimitQueueBytes(CAPTURE_CAPACITY * 1024 * 1024));
+	frame_pool.SetCapacity(Concurrency::LimitQueueBytes(CAPTURE_CAPACITY * 1024 * 1024));
+	gray_frame_pool.SetCapacity(Concurrency::LimitQueueBytes(CAPTURE_CAPACITY * 1024 * 1024));
+	StartSessionOutput();
 	capturing = true;
-	capture_threads.run([&] {CaptureThread(); });
 
 	return true;
+}
+
+bool SequenceCapture::PushExternalFrame(const ExternalFrame& frame)
+{
+	if (!is_external || !capturing)
+	{
+		METRICS_INCREMENT("openface_dropped_frames_total", "Frames that were lost before processing");
+		if (frame.release)
+			frame.release();
+		return false;
+	}
+
+	// The grayscale frame references the Y plane directly, it will release the buffer once all references to it are gone
+	cv::Mat_<uchar> gray_frame = WrapExternalPlane(frame.planes[0], frame_height, frame_width, frame.steps[0], frame.release);
+
+	cv::Mat bgr_frame;
+	if (external_to_bgr && frame.format != ExternalFrame::GRAY)
+	{
+		bgr_frame = frame_pool.Acquire(frame_height, frame_width, CV_8UC3);
+	}
+
+	if (!external_to_bgr || frame.format == ExternalFrame::GRAY)
+	{
+		bgr_frame = gray_frame;
+	}
+	else
+	{
+		// OpenCV converts from a single buffer with the planes after each other, so decoders that lay out the frame that way are converted in place
+		// and otherwise the planes are gathered first
+		int chroma_rows = frame_height / 2;
+		bool nv12 = frame.format == ExternalFrame::NV12;
+		cv::Mat yuv;
+		if (nv12 && frame.steps[1] == frame.steps[0] && frame.planes[1] == frame.planes[0] + frame.steps[0] * frame_height)
+		{
+			yuv = cv::Mat(frame_height + chroma_rows, frame_width, CV_8U, (void*)frame.planes[0], frame.steps[0]);
+		}
+		else if (!nv12 && frame.steps[0] == (size_t)frame_width && frame.steps[1] == (size_t)frame_width / 2 && frame.steps[2] == (size_t)frame_width / 2 &&
+			frame.planes[1] == frame.planes[0] + frame_width * frame_height && frame.planes[2] == frame.planes[1] + (frame_width / 2) * chroma_rows)
+		{
+			yuv = cv::Mat(frame_height + chroma_rows, frame_width, CV_8U, (void*)frame.planes[0]);
+		}
+		else
+		{
+			yuv.create(frame_height + chroma_rows, frame_width, CV_8U);
+			gray_frame.copyTo(yuv.rowRange(0, frame_height));
+			if (nv12)
+			{
+				cv::Mat(chroma_rows, frame_width, CV_8U, (void*)frame.planes[1], frame.steps[1]).copyTo(yuv.rowRange(frame_height, frame_height + chroma_rows));
+			}
+			else
+			{
+				uchar* dst = yuv.ptr(frame_height);
+				for (int p = 1; p < 3; ++p)
+				{
+					cv::Mat chroma(chroma_rows, frame_width / 2, CV_8U, (void*)frame.planes[p], frame.steps[p]);
+					chroma.copyTo(cv::Mat(chroma_rows, frame_width / 2, CV_8U, dst));
+					dst += (frame_width / 2) * chroma_rows;
+				}
+			}
+		}
+		cv::cvtColor(yuv, bgr_frame, nv12 ? cv::COLOR_YUV2BGR_NV12 : cv::COLOR_YUV2BGR_I420);
+	}
+
+	PushCaptured(frame.timestamp, bgr_frame, gray_frame);
+
+	return true;
+}
+
+void SequenceCapture::PushCaptured(double timestamp, const cv::Mat& frame, const cv::Mat_<uchar>& gray_frame)
+{
+	WriteSessionFrame(timestamp, frame, gray_frame);
+
+	// The grayscale frame can share the buffer of the colour one
+	size_t bytes = MatBytes(gray_frame);
+	if (frame.data != gray_frame.data)
+		bytes += MatBytes(frame);
+
+	size_t dropped = capture_queue.Push(std::make_tuple(timestamp, frame, gray_frame), bytes);
+	for (size_t i = 0; i < dropped; ++i)
+	{
+		METRICS_INCREMENT("openface_dropped_frames_total", "Frames that were lost before processing");
+	}
+	TRACE_COUNTER("SequenceCapture capture_queue", capture_queue.Size());
+	METRICS_GAUGE_SET("openface_capture_queue_depth", "Frames waiting in the SequenceCapture capture queue", capture_queue.Size());
+}
+
+void SequenceCapture::SetDropFramesWhenFull(bool drop_frames)
+{
+	drop_frames_when_full = drop_frames;
+	capture_queue.SetPolicy(drop_frames ? FrameQueue<std::tuple<double, cv::Mat, cv::Mat_<uchar> > >::DROP_OLDEST :
+		FrameQueue<std::tuple<double, cv::Mat, cv::Mat_<uchar> > >::BLOCK);
+}
 
+void SequenceCapture::EndExternalFrames()
+{
+	if (is_external && capturing)
+	{
+		capturing = false;
+		capture_queue.Push(std::make_tuple(0.0, cv::Mat(), cv::Mat_<uchar>()), 0);
+	}
 }
 
 void SequenceCapture::SetCameraIntrinsics(float fx, float fy, float cx, float cy)
@@ -440,20 +1307,53 @@ void SequenceCapture::SetCameraIntrinsics(float fx, float fy, float cx, float cy
 	}
 }
 
-void SequenceCapture::CaptureThread()
+void SequenceCapture::CaptureThread(size_t first_frame, size_t last_frame)
 {
-	int capacity = (CAPTURE_CAPACITY * 1024 * 1024) / (4 * frame_width * frame_height);
-	capture_queue.set_capacity(capacity);
-	int frame_num_int = 0;
+	capture_queue.SetCapacity(Concurrency::LimitQueueBytes(CAPTURE_CAPACITY * 1024 * 1024));
+	frame_pool.SetCapacity(Concurrency::LimitQueueBytes(CAPTURE_CAPACITY * 1024 * 1024) + DECODE_SLOTS * (size_t)frame_width * frame_height * 3);
+	gray_frame_pool.SetCapacity(Concurrency::LimitQueueBytes(CAPTURE_CAPACITY * 1024 * 1024));
+	int frame_num_int = (int)first_frame;
+	bool end_pushed = false;
 
 	while(capturing)
 	{
 		double timestamp_curr = 0;
 		cv::Mat tmp_frame;
-		cv::Mat_<uchar> tmp_gray_frame;
 
-		if (!is_image_seq)
+		if (last_frame > 0 && frame_num_int >= (int)last_frame)
+		{
+			// The end of the requested frames, indicated by an empty image
+			capturing = false;
+		}
+		else if (raw_video.IsOpen())
+		{
+			// Copied straight out of the mapped file, the grayscale image is stored as well so the conversion is skipped
+			tmp_frame = frame_pool.Acquire(frame_height, frame_width, CV_8UC3);
+			cv::Mat_<uchar> gray_frame = gray_frame_pool.Acquire(frame_height, frame_width, CV_8U);
+			bool scaled = raw_video.width != frame_width || raw_video.height != frame_height;
+			if (scaled ? raw_video.ReadFrame(frame_num_int, replay_frame, replay_gray_frame) : raw_video.ReadFrame(frame_num_int, tmp_frame, gray_frame))
+			{
+				if (scaled)
+				{
+					cv::resize(replay_frame, tmp_frame, tmp_frame.size(), 0, 0, cv::INTER_LINEAR);
+					cv::resize(replay_gray_frame, gray_frame, gray_frame.size(), 0, 0, cv::INTER_LINEAR);
+				}
+				if (paced_replay)
+				{
+					WaitForReplayFrame(raw_video.GetTimestamp(frame_num_int));
+				}
+				PushCaptured(raw_video.GetTimestamp(frame_num_int), tmp_frame, gray_frame);
+				frame_num_int++;
+				continue;
+			}
+
+			tmp_frame = cv::Mat();
+			capturing = false;
+		}
+		else if (!is_image_seq)
 		{
+			// Decoding into a recycled buffer, the capture only reallocates it if the frame does not match
+			tmp_frame = frame_pool.Acquire(frame_height, frame_width, CV_8UC3);
 			bool success = capture.read(tmp_frame);
 
 			if (!success)
@@ -474,46 +1374,121 @@ void SequenceCapture::CaptureThread()
 				tmp_frame = cv::Mat();
 				capturing = false;
 			}
+			else if (image_prefetcher.IsRunning())
+			{
+				cv::Mat_<uchar> unused_gray;
+				image_prefetcher.Next(tmp_frame, unused_gray);
+			}
 			else
 			{
-				tmp_frame = cv::imread(image_files[frame_num_int], cv::IMREAD_COLOR);
+				tmp_frame = ReadImage(image_files[frame_num_int], cv::IMREAD_COLOR);
 			}
-			timestamp_curr = 0;
+			timestamp_curr = image_timestamps.empty() || tmp_frame.empty() ? 0 : image_timestamps[frame_num_int];
 		}
 
 		frame_num_int++;
-		// Set the grayscale frame
-		ConvertToGrayscale_8bit(tmp_frame, tmp_gray_frame);
 
-		capture_queue.push(std::make_tuple(timestamp_curr, tmp_frame, tmp_gray_frame));
+		end_pushed = tmp_frame.empty();
+		decoded_queue.Push(std::make_pair(timestamp_curr, std::move(tmp_frame)));
+		TRACE_COUNTER("SequenceCapture decoded_queue", decoded_queue.Size());
+	}
+
+	// Make sure the conversion finishes even if the capture was stopped
+	if (!end_pushed)
+	{
+		decoded_queue.Push(std::make_pair(0.0, cv::Mat()));
+	}
+}
+
+void SequenceCapture::ConversionThread()
+{
+	std::pair<double, cv::Mat> decoded;
+
+	while (true)
+	{
+		// Only fails once closing, in which case the capture queue is not read any more either
+		if (!decoded_queue.Pop(decoded))
+		{
+			break;
+		}
+
+		cv::Mat_<uchar> gray_frame;
+		if (!decoded.second.empty())
+		{
+			gray_frame = gray_frame_pool.Acquire(decoded.second.rows, decoded.second.cols, CV_8U);
+			ConvertToGrayscale_8bit(decoded.second, gray_frame);
+		}
+
+		WriteRawFrame(decoded.first, decoded.second, gray_frame);
+
+		// The empty frame indicating the end is passed on as well, once closing the capture queue drops instead of blocking so this always gets there
+		PushCaptured(decoded.first, decoded.second, gray_frame);
+
+		if (decoded.second.empty())
+		{
+			break;
+		}
 	}
 }
 
+void SequenceCapture::SetVideoDecoding(const std::string& backend, bool hw_acceleration, int threads)
+{
+	decode_backend = backend;
+	decode_hw_acceleration = hw_acceleration;
+	decode_threads = threads;
+}
+
 cv::Mat SequenceCapture::GetNextFrame()
 {
 	if(!is_webcam)
 	{
 		std::tuple<double, cv::Mat, cv::Mat_<uchar> > data;
 
-		capture_queue.pop(data);
+		capture_queue.Pop(data);
+		METRICS_GAUGE_SET("openface_capture_queue_depth", "Frames waiting in the SequenceCapture capture queue", capture_queue.Size());
 		time_stamp = std::get<0>(data);
 		latest_frame = std::get<1>(data);
 		latest_gray_frame = std::get<2>(data);
 	}
+	else if (latest_frame_only)
+	{
+		// Waiting for the next frame if the latest one was already returned
+		std::unique_lock<std::mutex> lock(webcam_mutex);
+		webcam_frame_ready.wait(lock, [this] { return has_webcam_frame || webcam_ended; });
+		if (has_webcam_frame)
+		{
+			latest_frame = webcam_frame;
+			time_stamp = webcam_time_stamp;
+			webcam_frame = cv::Mat();
+			has_webcam_frame = false;
+		}
+		else
+		{
+			latest_frame = cv::Mat();
+		}
+		lock.unlock();
+
+		ConvertToGrayscale_8bit(latest_frame, latest_gray_frame);
+		WriteRawFrame(time_stamp, latest_frame, latest_gray_frame);
+		WriteSessionFrame(time_stamp, latest_frame, latest_gray_frame);
+	}
 	else
 	{
 		// Webcam does not use the threaded interface
 		bool success = capture.read(latest_frame);
 
-		time_stamp = (cv::getTickCount() - start_time) / cv::getTickFrequency();
+		time_stamp = WebcamTimestamp();
 
 		if (!success)
 		{
 			// Indicate lack of success by returning an empty image
 			latest_frame = cv::Mat();
+			METRICS_INCREMENT("openface_dropped_frames_total", "Frames that were lost before processing");
 		}
 		
 		ConvertToGrayscale_8bit(latest_frame, latest_gray_frame);
+		WriteRawFrame(time_stamp, latest_frame, latest_gray_frame);
+		WriteSessionFrame(time_stamp, latest_frame, latest_gray_frame);
 
 	}
 	frame_num++;
@@ -523,7 +1498,7 @@ cv::Mat SequenceCapture::GetNextFrame()
 
 double SequenceCapture::GetProgress()
 {
-	if (is_webcam)
+	if (is_webcam || is_external)
 	{
 		return -1.0;
 	}
@@ -533,9 +1508,33 @@ double SequenceCapture::GetProgress()
 	}
 }
 
+void SequenceCapture::ReportMemory(MemoryReport& report, const std::string& component)
+{
+	report.AddBytes(component + "/queue", capture_queue.Bytes());
+	report.AddBytes(component + "/frame_pool", frame_pool.FreeBytes() + gray_frame_pool.FreeBytes());
+	report.Add(component + "/latest", latest_frame);
+	report.Add(component + "/latest", latest_gray_frame);
+}
+
+size_t SequenceCapture::PrefaultBuffers(size_t num_frames)
+{
+	if (frame_width <= 0 || frame_height <= 0)
+	{
+		return 0;
+	}
+
+	size_t colour_frames = frame_pool.Prefault(frame_height, frame_width, CV_8UC3, num_frames);
+	size_t gray_frames = gray_frame_pool.Prefault(frame_height, frame_width, CV_8U, num_frames);
+	return std::min(colour_frames, gray_frames);
+}
+
 bool SequenceCapture::IsOpened()
 {
-	if (is_webcam || !is_image_seq)
+	if (is_external)
+		return capturing || !capture_queue.Empty();
+	else if (raw_video.IsOpen())
+		return frame_num < vid_length;
+	else if (is_webcam || !is_image_seq)
 		return capture.isOpened();
 	else
 		return (image_files.size() > 0 && frame_num < image_files.size());
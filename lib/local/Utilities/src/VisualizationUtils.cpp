@@ -41,6 +41,8 @@
 // For drawing on images
 #include <opencv2/imgproc.hpp>
 
+#include <cmath>
+
 namespace Utilities
 {
 
@@ -77,10 +79,10 @@ namespace Utilities
 			frame_times.pop();
 	}
 
-	void DrawBox(cv::Mat image, cv::Vec6f pose, cv::Scalar color, int thickness, float fx, float fy, float cx, float cy)
+	void DrawBox(cv::Mat image, cv::Vec6f pose, cv::Scalar color, int thickness, float fx, float fy, float cx, float cy, int line_type)
 	{
 		auto edge_lines = CalculateBox(pose, fx, fy, cx, cy);
-		DrawBox(edge_lines, image, color, thickness);
+		DrawBox(edge_lines, image, color, thickness, line_type);
 	}
 
 	std::vector<std::pair<cv::Point2f, cv::Point2f>> CalculateBox(cv::Vec6f pose, float fx, float fy, float cx, float cy)
@@ -147,7 +149,7 @@ namespace Utilities
 		return lines;
 	}
 
-	void DrawBox(const std::vector<std::pair<cv::Point2f, cv::Point2f>>& lines, cv::Mat image, cv::Scalar color, int thickness)
+	void DrawBox(const std::vector<std::pair<cv::Point2f, cv::Point2f>>& lines, cv::Mat image, cv::Scalar color, int thickness, int line_type)
 	{
 		cv::Rect image_rect(0, 0, image.cols, image.rows);
 
@@ -158,34 +160,82 @@ namespace Utilities
 			// Only draw the line if one of the points is inside the image
 			if (p1.inside(image_rect) || p2.inside(image_rect))
 			{
-				cv::line(image, p1, p2, color, thickness, cv::LINE_AA);
+				cv::line(image, p1, p2, color, thickness, line_type);
 			}
 
 		}
 
 	}
 
-	void Visualise_FHOG(const cv::Mat_<double>& descriptor, int num_rows, int num_cols, cv::Mat& visualisation)
+	// The oriented bars drawn for every HOG cell are the same for every frame, so they are made once (using the same bars as dlib::draw_fhog)
+	static const int FHOG_CELL_DRAW_SIZE = 15;
+
+	static const std::vector<cv::Mat_<float> >& FHOGBars()
 	{
+		static const std::vector<cv::Mat_<float> > bars = []()
+		{
+			dlib::array<dlib::matrix<float> > dlib_bars;
+			dlib::impl_fhog::create_fhog_bar_images(dlib_bars, FHOG_CELL_DRAW_SIZE);
 
-		// First convert to dlib format
-		dlib::array2d<dlib::matrix<float, 31, 1> > hog(num_rows, num_cols);
+			std::vector<cv::Mat_<float> > cv_bars(dlib_bars.size());
+			for (size_t i = 0; i < dlib_bars.size(); ++i)
+			{
+				cv_bars[i] = cv::Mat_<float>((int)dlib_bars[i].nr(), (int)dlib_bars[i].nc());
+				for (int r = 0; r < cv_bars[i].rows; ++r)
+				{
+					for (int c = 0; c < cv_bars[i].cols; ++c)
+					{
+						cv_bars[i](r, c) = dlib_bars[i](r, c);
+					}
+				}
+			}
+			return cv_bars;
+		}();
+		return bars;
+	}
 
-		cv::MatConstIterator_<double> descriptor_it = descriptor.begin();
+	// The same visualisation as dlib::draw_fhog, without converting the descriptor to dlib and recreating the bars for every frame
+	void Visualise_FHOG(const cv::Mat_<float>& descriptor, int num_rows, int num_cols, cv::Mat& visualisation)
+	{
+		const int cell_draw_size = FHOG_CELL_DRAW_SIZE;
+		const std::vector<cv::Mat_<float> >& bars = FHOGBars();
+		const int num_orientations = (int)bars.size();
+
+		cv::Mat_<float> himg = cv::Mat_<float>::zeros(num_cols * cell_draw_size, num_rows * cell_draw_size);
+
+		// The descriptor has the 31 channels of a cell after each other
+		const float* cell = descriptor.ptr<float>();
 		for (int y = 0; y < num_cols; ++y)
 		{
 			for (int x = 0; x < num_rows; ++x)
 			{
-				for (unsigned int o = 0; o < 31; ++o)
+				cv::Mat_<float> cell_image = himg(cv::Rect(x * cell_draw_size, y * cell_draw_size, cell_draw_size, cell_draw_size));
+				for (int d = 0; d < num_orientations; ++d)
 				{
-					hog[y][x](o) = *descriptor_it++;
+					// The contrast sensitive and insensitive responses of an orientation are drawn together
+					const float val = cell[d] + cell[d + num_orientations] + cell[d + num_orientations * 2];
+					if (val > 0)
+					{
+						cv::scaleAdd(bars[d], val, cell_image, cell_image);
+					}
 				}
+				cell += 31;
 			}
 		}
 
-		// Draw the FHOG to OpenCV format
-		auto fhog_vis = dlib::draw_fhog(hog);
-		visualisation = dlib::toMat(fhog_vis).clone();
+		// Scaling by the mean plus four (sample) standard deviations as dlib does
+		cv::Scalar mean, stddev;
+		cv::meanStdDev(himg, mean, stddev);
+		double num_pixels = (double)himg.total();
+		double thresh = mean[0] + 4 * stddev[0] * (num_pixels > 1 ? std::sqrt(num_pixels / (num_pixels - 1)) : 0);
+		if (thresh != 0)
+		{
+			himg.convertTo(visualisation, CV_8U, 255.0 / thresh);
+		}
+		else
+		{
+			himg.convertTo(visualisation, CV_8U);
+		}
 	}
 
 }
\ No newline at end of file
@@ -40,6 +40,7 @@
 #include <iomanip>
 #include <map>
 #include <set>
+#include <cmath>
 
 // For drawing on images
 #include <opencv2/imgproc.hpp>
@@ -105,6 +106,10 @@ Visualizer::Visualizer(std::vector<std::string> arguments)
 		{
 			this->vis_aus = true;
 		}
+		else if (arguments[i].compare("-vis-fast") == 0)
+		{
+			this->line_type = cv::LINE_8;
+		}
 	}
 
 }
@@ -120,8 +125,15 @@ Visualizer::Visualizer(bool vis_track, bool vis_hog, bool vis_align, bool vis_au
 // Setting the image on which to draw
 void Visualizer::SetImage(const cv::Mat& canvas, float fx, float fy, float cx, float cy)
 {
-	// Convert the image to 8 bit RGB
-	captured_image = canvas.clone();
+	// Convert the image to 8 bit RGB, only copied if it is drawn on
+	if (DrawsTrack())
+	{
+		captured_image = canvas.clone();
+	}
+	else
+	{
+		captured_image = cv::Mat();
+	}
 
 	this->fx = fx;
 	this->fy = fy;
@@ -138,6 +150,11 @@ void Visualizer::SetImage(const cv::Mat& canvas, float fx, float fy, float cx, f
 
 void Visualizer::SetObservationFaceAlign(const cv::Mat& aligned_face)
 {
+	if (!vis_align)
+	{
+		return;
+	}
+
 	if(this->aligned_face_image.empty())
 	{
 		this->aligned_face_image = aligned_face;
@@ -148,7 +165,7 @@ void Visualizer::SetObservationFaceAlign(const cv::Mat& aligned_face)
 	}
 }
 
-void Visualizer::SetObservationHOG(const cv::Mat_<double>& hog_descriptor, int num_cols, int num_rows)
+void Visualizer::SetObservationHOG(const cv::Mat_<float>& hog_descriptor, int num_cols, int num_rows)
 {
 	if(vis_hog)
 	{
@@ -170,7 +187,7 @@ void Visualizer::SetObservationHOG(const cv::Mat_<double>& hog_descriptor, int n
 void Visualizer::SetObservationLandmarks(const cv::Mat_<float>& landmarks_2D, double confidence, const cv::Mat_<int>& visibilities)
 {
 
-	if(confidence > visualisation_boundary)
+	if(DrawsTrack() && confidence > visualisation_boundary)
 	{
 		// Draw 2D landmarks on the image
 		int n = landmarks_2D.rows / 2;
@@ -186,8 +203,8 @@ void Visualizer::SetObservationLandmarks(const cv::Mat_<float>& landmarks_2D, do
 				int thickness = (int)std::ceil(3.0* ((double)captured_image.cols) / 640.0);
 				int thickness_2 = (int)std::ceil(1.0* ((double)captured_image.cols) / 640.0);
 
-				cv::circle(captured_image, featurePoint, 1 * draw_multiplier, cv::Scalar(0, 0, 255), thickness, cv::LINE_AA, draw_shiftbits);
-				cv::circle(captured_image, featurePoint, 1 * draw_multiplier, cv::Scalar(255, 0, 0), thickness_2, cv::LINE_AA, draw_shiftbits);
+				cv::circle(captured_image, featurePoint, 1 * draw_multiplier, cv::Scalar(0, 0, 255), thickness, line_type, draw_shiftbits);
+				cv::circle(captured_image, featurePoint, 1 * draw_multiplier, cv::Scalar(255, 0, 0), thickness_2, line_type, draw_shiftbits);
 
 			}
 			else
@@ -199,8 +216,8 @@ void Visualizer::SetObservationLandmarks(const cv::Mat_<float>& landmarks_2D, do
 				int thickness = (int)std::ceil(2.5* ((double)captured_image.cols) / 640.0);
 				int thickness_2 = (int)std::ceil(1.0* ((double)captured_image.cols) / 640.0);
 
-				cv::circle(captured_image, featurePoint, 1 * draw_multiplier, cv::Scalar(0, 0, 155), thickness, cv::LINE_AA, draw_shiftbits);
-				cv::circle(captured_image, featurePoint, 1 * draw_multiplier, cv::Scalar(155, 0, 0), thickness_2, cv::LINE_AA, draw_shiftbits);
+				cv::circle(captured_image, featurePoint, 1 * draw_multiplier, cv::Scalar(0, 0, 155), thickness, line_type, draw_shiftbits);
+				cv::circle(captured_image, featurePoint, 1 * draw_multiplier, cv::Scalar(155, 0, 0), thickness_2, line_type, draw_shiftbits);
 
 			}
 		}
@@ -211,7 +228,7 @@ void Visualizer::SetObservationPose(const cv::Vec6f& pose, double confidence)
 {
 
 	// Only draw if the reliability is reasonable, the value is slightly ad-hoc
-	if (confidence > visualisation_boundary)
+	if (DrawsTrack() && confidence > visualisation_boundary)
 	{
 		double vis_certainty = confidence;
 		if (vis_certainty > 1)
@@ -224,14 +241,36 @@ void Visualizer::SetObservationPose(const cv::Vec6f& pose, double confidence)
 		int thickness = (int)std::ceil(2.0* ((double)captured_image.cols) / 640.0);
 
 		// Draw it in reddish if uncertain, blueish if certain
-		DrawBox(captured_image, pose, cv::Scalar(vis_certainty*255.0, 0, (1 - vis_certainty) * 255), thickness, fx, fy, cx, cy);
+		DrawBox(captured_image, pose, cv::Scalar(vis_certainty*255.0, 0, (1 - vis_certainty) * 255), thickness, fx, fy, cx, cy, line_type);
+	}
+}
+
+std::vector<std::pair<std::string, double> > Visualizer::NamedAUs(const std::vector<std::string>& names, const std::vector<float>& values)
+{
+	std::vector<std::pair<std::string, double> > named_aus;
+	for (size_t i = 0; i < names.size() && i < values.size(); ++i)
+	{
+		if (!std::isnan(values[i]))
+		{
+			named_aus.push_back(std::pair<std::string, double>(names[i], values[i]));
+		}
+	}
+	return named_aus;
+}
+
+void Visualizer::SetObservationActionUnits(const std::vector<std::string>& au_intensity_names, const std::vector<float>& au_intensities,
+	const std::vector<std::string>& au_occurence_names, const std::vector<float>& au_occurences)
+{
+	if (vis_aus)
+	{
+		SetObservationActionUnits(NamedAUs(au_intensity_names, au_intensities), NamedAUs(au_occurence_names, au_occurences));
 	}
 }
 
 void Visualizer::SetObservationActionUnits(const std::vector<std::pair<std::string, double> >& au_intensities,
 	const std::vector<std::pair<std::string, double> >& au_occurences)
 {
-	if (au_intensities.size() > 0 || au_occurences.size() > 0)
+	if (vis_aus && (au_intensities.size() > 0 || au_occurences.size() > 0))
 	{
 
 		std::set<std::string> au_names;
@@ -309,12 +348,12 @@ void Visualizer::SetObservationActionUnits(const std::vector<std::pair<std::stri
 			int offset = MARGIN_Y + idx * (AU_TRACKBAR_HEIGHT + 10);
 			std::ostringstream au_i;
 			au_i << std::setprecision(2) << std::setw(4) << std::fixed << intensity;
-			cv::putText(action_units_image, name, cv::Point(10, offset + 10), cv::FONT_HERSHEY_SIMPLEX, 0.5, CV_RGB(present ? 0 : 200, 0, 0), 1, cv::LINE_AA);
-			cv::putText(action_units_image, AUS_DESCRIPTION.at(name), cv::Point(55, offset + 10), cv::FONT_HERSHEY_SIMPLEX, 0.3, CV_RGB(0, 0, 0), 1, cv::LINE_AA);
+			cv::putText(action_units_image, name, cv::Point(10, offset + 10), cv::FONT_HERSHEY_SIMPLEX, 0.5, CV_RGB(present ? 0 : 200, 0, 0), 1, line_type);
+			cv::putText(action_units_image, AUS_DESCRIPTION.at(name), cv::Point(55, offset + 10), cv::FONT_HERSHEY_SIMPLEX, 0.3, CV_RGB(0, 0, 0), 1, line_type);
 
 			if (present)
 			{
-				cv::putText(action_units_image, au_i.str(), cv::Point(160, offset + 10), cv::FONT_HERSHEY_SIMPLEX, 0.3, CV_RGB(0, 100, 0), 1, cv::LINE_AA);
+				cv::putText(action_units_image, au_i.str(), cv::Point(160, offset + 10), cv::FONT_HERSHEY_SIMPLEX, 0.3, CV_RGB(0, 100, 0), 1, line_type);
 				cv::rectangle(action_units_image, cv::Point(MARGIN_X, offset),
 					cv::Point((int)(MARGIN_X + AU_TRACKBAR_LENGTH * intensity / 5.0), offset + AU_TRACKBAR_HEIGHT),
 					cv::Scalar(128, 128, 128),
@@ -322,7 +361,7 @@ void Visualizer::SetObservationActionUnits(const std::vector<std::pair<std::stri
 			}
 			else
 			{
-				cv::putText(action_units_image, "0.00", cv::Point(160, offset + 10), cv::FONT_HERSHEY_SIMPLEX, 0.3, CV_RGB(0, 0, 0), 1, cv::LINE_AA);
+				cv::putText(action_units_image, "0.00", cv::Point(160, offset + 10), cv::FONT_HERSHEY_SIMPLEX, 0.3, CV_RGB(0, 0, 0), 1, line_type);
 			}
 			idx++;
 		}
@@ -333,7 +372,7 @@ void Visualizer::SetObservationActionUnits(const std::vector<std::pair<std::stri
 // Eye gaze infomration drawing, first of eye landmarks then of gaze
 void Visualizer::SetObservationGaze(const cv::Point3f& gaze_direction0, const cv::Point3f& gaze_direction1, const std::vector<cv::Point2f>& eye_landmarks2d, const std::vector<cv::Point3f>& eye_landmarks3d, double confidence)
 {
-	if(confidence > visualisation_boundary)
+	if(DrawsTrack() && confidence > visualisation_boundary)
 	{
 		if (eye_landmarks2d.size() > 0)
 		{
@@ -363,9 +402,9 @@ void Visualizer::SetObservationGaze(const cv::Point3f& gaze_direction0, const cv
 
 				cv::Point nextFeaturePoint(cvRound(eye_landmarks2d[next_point].x * (double)draw_multiplier), cvRound(eye_landmarks2d[next_point].y * (double)draw_multiplier));
 				if ((i < 28 && (i < 8 || i > 19)) || (i >= 28 && (i < 8 + 28 || i > 19 + 28)))
-					cv::line(captured_image, featurePoint, nextFeaturePoint, cv::Scalar(255, 0, 0), thickness_2, cv::LINE_AA, draw_shiftbits);
+					cv::line(captured_image, featurePoint, nextFeaturePoint, cv::Scalar(255, 0, 0), thickness_2, line_type, draw_shiftbits);
 				else
-					cv::line(captured_image, featurePoint, nextFeaturePoint, cv::Scalar(0, 0, 255), thickness_2, cv::LINE_AA, draw_shiftbits);
+					cv::line(captured_image, featurePoint, nextFeaturePoint, cv::Scalar(0, 0, 255), thickness_2, line_type, draw_shiftbits);
 
 			}
 
@@ -395,12 +434,12 @@ void Visualizer::SetObservationGaze(const cv::Point3f& gaze_direction0, const cv
 			cv::Mat_<float> mesh_0 = (cv::Mat_<float>(2, 3) << points_left[0].x, points_left[0].y, points_left[0].z, points_left[1].x, points_left[1].y, points_left[1].z);
 			Project(proj_points, mesh_0, fx, fy, cx, cy);
 			cv::line(captured_image, cv::Point(cvRound(proj_points.at<float>(0, 0) * (float)draw_multiplier), cvRound(proj_points.at<float>(0, 1) * (float)draw_multiplier)),
-				cv::Point(cvRound(proj_points.at<float>(1, 0) * (float)draw_multiplier), cvRound(proj_points.at<float>(1, 1) * (float)draw_multiplier)), cv::Scalar(110, 220, 0), 2, cv::LINE_AA, draw_shiftbits);
+				cv::Point(cvRound(proj_points.at<float>(1, 0) * (float)draw_multiplier), cvRound(proj_points.at<float>(1, 1) * (float)draw_multiplier)), cv::Scalar(110, 220, 0), 2, line_type, draw_shiftbits);
 
 			cv::Mat_<float> mesh_1 = (cv::Mat_<float>(2, 3) << points_right[0].x, points_right[0].y, points_right[0].z, points_right[1].x, points_right[1].y, points_right[1].z);
 			Project(proj_points, mesh_1, fx, fy, cx, cy);
 			cv::line(captured_image, cv::Point(cvRound(proj_points.at<float>(0, 0) * (float)draw_multiplier), cvRound(proj_points.at<float>(0, 1) * (float)draw_multiplier)),
-				cv::Point(cvRound(proj_points.at<float>(1, 0) * (float)draw_multiplier), cvRound(proj_points.at<float>(1, 1) * (float)draw_multiplier)), cv::Scalar(110, 220, 0), 2, cv::LINE_AA, draw_shiftbits);
+				cv::Point(cvRound(proj_points.at<float>(1, 0) * (float)draw_multiplier), cvRound(proj_points.at<float>(1, 1) * (float)draw_multiplier)), cv::Scalar(110, 220, 0), 2, line_type, draw_shiftbits);
 
 		}
 	}
@@ -408,12 +447,17 @@ void Visualizer::SetObservationGaze(const cv::Point3f& gaze_direction0, const cv
 
 void Visualizer::SetFps(double fps)
 {
+	if (!DrawsTrack())
+	{
+		return;
+	}
+
 	// Write out the framerate on the image before displaying it
 	char fpsC[255];
 	std::sprintf(fpsC, "%d", (int)fps);
 	std::string fpsSt("FPS:");
 	fpsSt += fpsC;
-	cv::putText(captured_image, fpsSt, cv::Point(10, 20), cv::FONT_HERSHEY_SIMPLEX, 0.5, CV_RGB(255, 0, 0), 1, cv::LINE_AA);
+	cv::putText(captured_image, fpsSt, cv::Point(10, 20), cv::FONT_HERSHEY_SIMPLEX, 0.5, CV_RGB(255, 0, 0), 1, line_type);
 }
 
 char Visualizer::ShowObservation()